@@ -0,0 +1,91 @@
+/* KallistiOS ##version##
+
+   kos/xxhash.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+#ifndef __KOS_XXHASH_H
+#define __KOS_XXHASH_H
+
+/** \file   kos/xxhash.h
+    \brief  xxHash32 hashing support.
+
+    This file provides the 32-bit variant of xxHash, a non-cryptographic hash
+    that is a lot faster than MD5 or even a CRC-32 on the SH-4: it works on 16
+    bytes at a time with four independent multiply-rotate chains, so the
+    multiplier is kept busy. It is a good fit for things like the indexes of
+    asset packs or checking data for accidental damage, but not against
+    tampering.
+
+    The results are the same as those of the reference implementation.
+*/
+
+#include <sys/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdint.h>
+
+/** \brief  xxHash32 context.
+
+    This structure contains the variables needed to maintain the internal state
+    of the xxHash32 code. You should not manipulate these variables manually,
+    but rather use the kos_xxh32_* functions to do everything you need.
+
+    \headerfile kos/xxhash.h
+*/
+typedef struct kos_xxh32_cxt {
+    uint64_t size;        /**< \brief Number of bytes hashed so far. */
+    uint32_t acc[4];      /**< \brief Accumulators of the 16 byte stripes. */
+    uint32_t seed;        /**< \brief Seed of the hash. */
+    uint8_t  buf[16];     /**< \brief Temporary storage of values to be hashed. */
+} kos_xxh32_cxt_t;
+
+/** \brief  Initialize a xxHash32 context.
+
+    This function initializes the context passed in to the initial state needed
+    for computing a hash. You must call this function to initialize the state
+    variables before attempting to hash any blocks of data.
+
+    \param  cxt         The context to initialize.
+    \param  seed        The seed of the hash, typically 0.
+*/
+void kos_xxh32_start(kos_xxh32_cxt_t *cxt, uint32_t seed);
+
+/** \brief  Hash a block of data with xxHash32.
+
+    This function is used to hash the block of data input into the function,
+    updating the state context as appropriate. Any data that doesn't fill a
+    16-byte stripe is kept in the context for hashing with a future block.
+
+    \param  cxt         The context to use.
+    \param  input       The block of data to hash.
+    \param  size        The number of bytes of input data passed in.
+*/
+void kos_xxh32_hash_block(kos_xxh32_cxt_t *cxt, const uint8_t *input,
+                          uint32_t size);
+
+/** \brief  Complete a xxHash32 hash.
+
+    This function computes the final hash of the context passed in. The
+    context is left as it was, so more data can still be hashed into it.
+
+    \param  cxt         The context to finalize.
+    \return             The hash.
+*/
+uint32_t kos_xxh32_finish(const kos_xxh32_cxt_t *cxt);
+
+/** \brief  Compute the hash of a block of data with xxHash32.
+
+    This function is used to hash a full block of data without messing around
+    with any contexts or anything else of the sort.
+
+    \param  input       The data to hash.
+    \param  size        The number of bytes of input data passed in.
+    \param  seed        The seed of the hash, typically 0.
+    \return             The hash.
+*/
+uint32_t kos_xxh32(const uint8_t *input, uint32_t size, uint32_t seed);
+
+__END_DECLS
+
+#endif /* !__KOS_XXHASH_H */
@@ -331,6 +331,7 @@ int ppp_lcp_send_proto_reject(uint16_t proto, const uint8_t *pkt, size_t len);
 #define PPP_FLAG_MAGIC_NUMBER   0x00000010  /**< \brief Use magic numbers */
 #define PPP_FLAG_WANT_MRU       0x00000020  /**< \brief Specify MRU */
 #define PPP_FLAG_NO_ACCM        0x00000040  /**< \brief No ctl character map */
+#define PPP_FLAG_VJ_COMP        0x00000080  /**< \brief VJ TCP/IP header comp. */
 /** @} */
 
 /** \brief   Get the flags set for our side of the link.
@@ -64,6 +64,12 @@ ext2_dirent_t *ext2_dir_entry(ext2_fs_t *fs, const struct ext2_inode *dir,
     size_t len = strlen(fn);
     int err;
 
+    /* Use the directory's index, if it has one. */
+    if((err = ext2_dir_htree_lookup(fs, dir, fn, &dent)) == 1)
+        return dent;
+    else if(!err)
+        return NULL;
+
     blocks = dir->i_blocks / (2 << fs->sb.s_log_block_size);
 
     for(i = 0; i < blocks; ++i) {
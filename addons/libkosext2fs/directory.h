@@ -40,6 +40,13 @@ int ext2_dir_is_empty(ext2_fs_t *fs, const struct ext2_inode *dir);
 ext2_dirent_t *ext2_dir_entry(ext2_fs_t *fs, const struct ext2_inode *dir,
                               const char *fn);
 
+/* Find an entry in a directory through its hashed index (in htree.c). Returns
+   1 with *rv set if it's found, 0 if the index says it isn't there, or -1 if
+   the directory isn't indexed (or the index can't be used), and it has to be
+   searched through instead. */
+int ext2_dir_htree_lookup(ext2_fs_t *fs, const struct ext2_inode *dir,
+                          const char *fn, ext2_dirent_t **rv);
+
 /* Delete an entry from a directory. Note that this does nothing about cleaning
    up the inode, but it does tell you which inode you're going to need to clean
    up (or lower the reference count on). */
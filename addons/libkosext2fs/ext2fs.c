@@ -21,6 +21,93 @@
 
 static int initted = 0;
 
+#ifndef EXT2_NOT_IN_KOS
+static int block_read_cb(void *ctx, uint32_t bl, void *buf) {
+    return ext2_block_read_nc((ext2_fs_t *)ctx, bl, (uint8_t *)buf);
+}
+
+static int block_write_cb(void *ctx, uint32_t bl, void *buf) {
+    return ext2_block_write_nc((ext2_fs_t *)ctx, bl, (const uint8_t *)buf);
+}
+
+uint8_t *ext2_block_read(ext2_fs_t *fs, uint32_t bl, int *err) {
+    uint8_t *rv;
+
+    if(!(rv = bcache_read(fs->bcache, bl)))
+        *err = EIO;
+
+    return rv;
+}
+
+uint8_t *ext2_bitmap_read(ext2_fs_t *fs, uint32_t bl, int *err) {
+    uint8_t *rv;
+
+    if(!(rv = bcache_read(fs->bmcache, bl)))
+        *err = EIO;
+
+    return rv;
+}
+
+uint8_t *ext2_block_clear(ext2_fs_t *fs, uint32_t bl, int *err) {
+    uint8_t *rv;
+
+    /* It's all about to be overwritten, so there's no need to read it. */
+    if(bl >= fs->sb.s_blocks_count || !(rv = bcache_get(fs->bcache, bl))) {
+        *err = EIO;
+        return NULL;
+    }
+
+    memset(rv, 0, fs->block_size);
+    bcache_mark_dirty(fs->bcache, bl);
+    return rv;
+}
+
+int ext2_block_read_run(ext2_fs_t *fs, uint32_t bl, uint32_t count,
+                        uint8_t *buf, int *err) {
+    int fs_per_block = fs->sb.s_log_block_size - fs->dev->l_block_size + 10;
+    uint32_t i, start;
+    uint8_t *blk;
+
+    if(fs_per_block < 0 || bl + count > fs->sb.s_blocks_count) {
+        *err = EINVAL;
+        return -1;
+    }
+
+    /* Blocks in the cache may be newer than what's on the disk, so copy those
+       out of it, and read each stretch of the rest with one request. */
+    for(i = start = 0; i <= count; ++i) {
+        blk = i < count ? bcache_lookup(fs->bcache, bl + i) : NULL;
+
+        if(i < count && !blk)
+            continue;
+
+        if(i > start &&
+           fs->dev->read_blocks(fs->dev, (uint64_t)(bl + start) << fs_per_block,
+                                (size_t)(i - start) << fs_per_block,
+                                buf + start * fs->block_size)) {
+            *err = EIO;
+            return -1;
+        }
+
+        if(blk)
+            memcpy(buf + i * fs->block_size, blk, fs->block_size);
+
+        start = i + 1;
+    }
+
+    return 0;
+}
+
+void ext2_block_readahead(ext2_fs_t *fs, uint32_t bl) {
+    if(bl && bl < fs->sb.s_blocks_count)
+        bcache_readahead(fs->bcache, bl);
+}
+
+void ext2_fs_set_lock(ext2_fs_t *fs, mutex_t *lock) {
+    bcache_set_lock(fs->bcache, lock);
+    bcache_set_lock(fs->bmcache, lock);
+}
+#else
 /* This is basically the same as bgrad_cache from fs_iso9660 */
 static void make_mru(ext2_fs_t *fs, ext2_cache_t **cache, int block) {
     int i;
@@ -87,6 +174,36 @@ out:
     return rv;
 }
 
+uint8_t *ext2_bitmap_read(ext2_fs_t *fs, uint32_t bl, int *err) {
+    return ext2_block_read(fs, bl, err);
+}
+
+uint8_t *ext2_block_clear(ext2_fs_t *fs, uint32_t bl, int *err) {
+    uint8_t *rv;
+
+    if(!(rv = ext2_block_read(fs, bl, err)))
+        return NULL;
+
+    memset(rv, 0, fs->block_size);
+    ext2_block_mark_dirty(fs, bl);
+    return rv;
+}
+
+int ext2_block_read_run(ext2_fs_t *fs, uint32_t bl, uint32_t count,
+                        uint8_t *buf, int *err) {
+    uint8_t *blk;
+
+    for(; count; --count, ++bl, buf += fs->block_size) {
+        if(!(blk = ext2_block_read(fs, bl, err)))
+            return -1;
+
+        memcpy(buf, blk, fs->block_size);
+    }
+
+    return 0;
+}
+#endif /* !EXT2_NOT_IN_KOS */
+
 int ext2_block_read_nc(ext2_fs_t *fs, uint32_t block_num, uint8_t *rv) {
     int fs_per_block = fs->sb.s_log_block_size - fs->dev->l_block_size + 10;
 
@@ -123,6 +240,37 @@ int ext2_block_write_nc(ext2_fs_t *fs, uint32_t block_num, const uint8_t *blk) {
     return 0;
 }
 
+#ifndef EXT2_NOT_IN_KOS
+int ext2_block_mark_dirty(ext2_fs_t *fs, uint32_t block_num) {
+    if(bcache_mark_dirty(fs->bcache, block_num))
+        return -EINVAL;
+
+    return 0;
+}
+
+int ext2_bitmap_mark_dirty(ext2_fs_t *fs, uint32_t block_num) {
+    if(bcache_mark_dirty(fs->bmcache, block_num))
+        return -EINVAL;
+
+    return 0;
+}
+
+int ext2_block_cache_wb(ext2_fs_t *fs) {
+    int rv = 0;
+
+    /* Don't even bother if we're mounted read-only. */
+    if(!(fs->mnt_flags & EXT2FS_MNT_FLAG_RW))
+        return 0;
+
+    if(bcache_sync(fs->bcache))
+        rv = -EIO;
+
+    if(bcache_sync(fs->bmcache))
+        rv = -EIO;
+
+    return rv;
+}
+#else
 int ext2_block_mark_dirty(ext2_fs_t *fs, uint32_t block_num) {
     int i;
     ext2_cache_t **cache = fs->bcache;
@@ -140,6 +288,10 @@ int ext2_block_mark_dirty(ext2_fs_t *fs, uint32_t block_num) {
     return -EINVAL;
 }
 
+int ext2_bitmap_mark_dirty(ext2_fs_t *fs, uint32_t block_num) {
+    return ext2_block_mark_dirty(fs, block_num);
+}
+
 int ext2_block_cache_wb(ext2_fs_t *fs) {
     int i, err;
     ext2_cache_t **cache = fs->bcache;
@@ -159,10 +311,59 @@ int ext2_block_cache_wb(ext2_fs_t *fs) {
     
     return 0;
 }
-
-uint8_t *ext2_block_alloc(ext2_fs_t *fs, uint32_t bg, uint32_t *bn, int *err) {
+#endif /* !EXT2_NOT_IN_KOS */
+
+/* Allocate the first free block from the index start on in a block group, and
+   as many of up to want - 1 free blocks straight after it as there are. Returns
+   NULL with *err set to 0 if there aren't any free from there on. */
+static uint8_t *alloc_in_group(ext2_fs_t *fs, uint32_t bg, uint32_t start,
+                               uint32_t want, uint32_t *bn, uint32_t *count,
+                               int *err) {
     uint8_t *buf, *blk;
-    uint32_t index;
+    uint32_t index, base, n;
+    uint32_t bpg = fs->sb.s_blocks_per_group;
+
+    if(!(buf = ext2_bitmap_read(fs, fs->bg[bg].bg_block_bitmap, err)))
+        return NULL;
+
+    index = ext2_bit_find_zero((uint32_t *)buf, start, bpg - 1);
+
+    if(index >= bpg) {
+        *err = 0;
+        return NULL;
+    }
+
+    base = bg * bpg + fs->sb.s_first_data_block;
+
+    if(!(blk = ext2_block_clear(fs, base + index, err)))
+        return NULL;
+
+    ext2_bit_set((uint32_t *)buf, index);
+
+    /* Take as many of the blocks after it as we can, up to what was asked. */
+    for(n = 1; n < want && n < fs->bg[bg].bg_free_blocks_count; ++n) {
+        if(index + n >= bpg - 1 || base + index + n >= fs->sb.s_blocks_count ||
+           ext2_bit_is_set((uint32_t *)buf, index + n))
+            break;
+
+        ext2_bit_set((uint32_t *)buf, index + n);
+    }
+
+    ext2_bitmap_mark_dirty(fs, fs->bg[bg].bg_block_bitmap);
+    fs->bg[bg].bg_free_blocks_count -= n;
+    fs->sb.s_free_blocks_count -= n;
+    fs->flags |= EXT2_FS_FLAG_SB_DIRTY;
+
+    *bn = base + index;
+    *count = n;
+    return blk;
+}
+
+uint8_t *ext2_block_alloc_run(ext2_fs_t *fs, uint32_t bg, uint32_t goal,
+                              uint32_t want, uint32_t *bn, uint32_t *count,
+                              int *err) {
+    uint8_t *blk;
+    uint32_t start = 0;
 
     /* Don't even bother if we're mounted read-only. */
     if(!(fs->mnt_flags & EXT2FS_MNT_FLAG_RW)) {
@@ -176,30 +377,27 @@ uint8_t *ext2_block_alloc(ext2_fs_t *fs, uint32_t bg, uint32_t *bn, int *err) {
         return NULL;
     }
 
-    /* See if we have any free blocks in the block group requested. */
-    if(fs->bg[bg].bg_free_blocks_count) {
-        if(!(buf = ext2_block_read(fs, fs->bg[bg].bg_block_bitmap, err)))
-            return NULL;
-
-        index = ext2_bit_find_zero((uint32_t *)buf, 0,
-                                   fs->sb.s_blocks_per_group - 1);
-        if(index < fs->sb.s_blocks_per_group) {
-            *bn = index + bg * fs->sb.s_blocks_per_group +
-                fs->sb.s_first_data_block;
+    if(!want)
+        want = 1;
 
-            if(!(blk = ext2_block_read(fs, *bn, err)))
-                return NULL;
+    /* Start from the goal block, if there is one. */
+    if(goal >= fs->sb.s_first_data_block && goal < fs->sb.s_blocks_count) {
+        bg = (goal - fs->sb.s_first_data_block) / fs->sb.s_blocks_per_group;
+        start = (goal - fs->sb.s_first_data_block) % fs->sb.s_blocks_per_group;
+    }
 
-            ext2_bit_set((uint32_t *)buf, index);
-            ext2_block_mark_dirty(fs, fs->bg[bg].bg_block_bitmap);
-            --fs->bg[bg].bg_free_blocks_count;
-            --fs->sb.s_free_blocks_count;
-            fs->flags |= EXT2_FS_FLAG_SB_DIRTY;
+    /* See if we have any free blocks in the block group requested, looking
+       after the goal first. */
+    if(fs->bg[bg].bg_free_blocks_count) {
+        if((blk = alloc_in_group(fs, bg, start, want, bn, count, err)))
+            return blk;
+        else if(*err)
+            return NULL;
 
-            memset(blk, 0, fs->block_size);
-            ext2_block_mark_dirty(fs, *bn);
+        if(start && (blk = alloc_in_group(fs, bg, 0, want, bn, count, err)))
             return blk;
-        }
+        else if(*err)
+            return NULL;
 
         /* We shouldn't get here... But, just in case, fall through. We should
            probably log an error and tell the user to fsck though. */
@@ -212,28 +410,10 @@ uint8_t *ext2_block_alloc(ext2_fs_t *fs, uint32_t bg, uint32_t *bn, int *err) {
        all the block groups looking for a free block. */
     for(bg = 0; bg < fs->bg_count; ++bg) {
         if(fs->bg[bg].bg_free_blocks_count) {
-            if(!(buf = ext2_block_read(fs, fs->bg[bg].bg_block_bitmap, err)))
-                return NULL;
-
-            index = ext2_bit_find_zero((uint32_t *)buf, 0,
-                                       fs->sb.s_blocks_per_group - 1);
-            if(index < fs->sb.s_blocks_per_group) {
-                *bn = index + bg * fs->sb.s_blocks_per_group +
-                    fs->sb.s_first_data_block;
-
-                if(!(blk = ext2_block_read(fs, *bn, err)))
-                    return NULL;
-
-                ext2_bit_set((uint32_t *)buf, index);
-                ext2_block_mark_dirty(fs, fs->bg[bg].bg_block_bitmap);
-                --fs->bg[bg].bg_free_blocks_count;
-                --fs->sb.s_free_blocks_count;
-                fs->flags |= EXT2_FS_FLAG_SB_DIRTY;
-
-                memset(blk, 0, fs->block_size);
-                ext2_block_mark_dirty(fs, *bn);
+            if((blk = alloc_in_group(fs, bg, 0, want, bn, count, err)))
                 return blk;
-            }
+            else if(*err)
+                return NULL;
 
             /* We shouldn't get here... But, just in case, fall through. We
                should probably log an error and tell the user to fsck though. */
@@ -252,6 +432,12 @@ uint8_t *ext2_block_alloc(ext2_fs_t *fs, uint32_t bg, uint32_t *bn, int *err) {
     return NULL;
 }
 
+uint8_t *ext2_block_alloc(ext2_fs_t *fs, uint32_t bg, uint32_t *bn, int *err) {
+    uint32_t count;
+
+    return ext2_block_alloc_run(fs, bg, 0, 1, bn, &count, err);
+}
+
 uint32_t ext2_block_size(const ext2_fs_t *fs) {
     return fs->block_size;
 }
@@ -274,7 +460,9 @@ ext2_fs_t *ext2_fs_init(kos_blockdev_t *bd, uint32_t flags) {
 ext2_fs_t *ext2_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz) {
     ext2_fs_t *rv;
     uint32_t bc;
+#ifdef EXT2_NOT_IN_KOS
     int j;
+#endif
     int block_size;
 
 #ifdef EXT2FS_DEBUG
@@ -409,6 +597,41 @@ ext2_fs_t *ext2_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz) {
 #endif /* EXT2FS_DEBUG */
 
     /* Make space for the block cache. */
+#ifndef EXT2_NOT_IN_KOS
+    if(cache_sz < 2)
+        cache_sz = 2;
+
+    if(!(rv->bcache = bcache_create(block_size, cache_sz, block_read_cb,
+                                    (rv->mnt_flags & EXT2FS_MNT_FLAG_RW) ?
+                                    block_write_cb : NULL, rv))) {
+        free(rv->bg);
+        free(rv);
+        bd->shutdown(bd);
+        return NULL;
+    }
+
+    /* The bitmaps get a cache of their own, so that file data doesn't push
+       them out of it. */
+    cache_sz = EXT2_BITMAP_CACHE_BLOCKS;
+
+    if(rv->bg_count * 2 < (uint32_t)cache_sz)
+        cache_sz = rv->bg_count * 2;
+
+    if(cache_sz < 2)
+        cache_sz = 2;
+
+    if(!(rv->bmcache = bcache_create(block_size, cache_sz, block_read_cb,
+                                     (rv->mnt_flags & EXT2FS_MNT_FLAG_RW) ?
+                                     block_write_cb : NULL, rv))) {
+        bcache_destroy(rv->bcache);
+        free(rv->bg);
+        free(rv);
+        bd->shutdown(bd);
+        return NULL;
+    }
+
+    return rv;
+#else
     if(!(rv->bcache = (ext2_cache_t **)malloc(sizeof(ext2_cache_t *) *
                                               cache_sz))) {
         free(rv->bg);
@@ -449,6 +672,7 @@ out_cache:
     free(rv);
     bd->shutdown(bd);
     return NULL;
+#endif /* !EXT2_NOT_IN_KOS */
 }
 
 int ext2_fs_sync(ext2_fs_t *fs) {
@@ -499,17 +723,24 @@ int ext2_fs_sync(ext2_fs_t *fs) {
 }
 
 void ext2_fs_shutdown(ext2_fs_t *fs) {
+#ifdef EXT2_NOT_IN_KOS
     int i;
+#endif
 
     /* Sync the filesystem back to the block device, if needed. */
     ext2_fs_sync(fs);
 
+#ifndef EXT2_NOT_IN_KOS
+    bcache_destroy(fs->bcache);
+    bcache_destroy(fs->bmcache);
+#else
     for(i = 0; i < fs->cache_size; ++i) {
         free(fs->bcache[i]->data);
         free(fs->bcache[i]);
     }
 
     free(fs->bcache);
+#endif
     fs->dev->shutdown(fs->dev);
     free(fs->bg);
     free(fs);
@@ -14,6 +14,7 @@ __BEGIN_DECLS
 
 #ifndef EXT2_NOT_IN_KOS
 #include <kos/blockdev.h>
+#include <kos/mutex.h>
 #endif
 
 /* Tunable filesystem parameters. These must be set at compile time. */
@@ -47,9 +48,32 @@ __BEGIN_DECLS
    Note that this is a default value for filesystems initialized/mounted with
    ext2_fs_init(). If you wish to specify your own value that differs from this
    one, you can do so with the ext2_fs_init_ex() function.
+
+   In KOS, the blocks live in the shared block cache (see <kos/bcache.h>), and
+   this is the number reserved for each filesystem. Past that, filesystems use
+   as many more as the cache's memory budget lets them.
 */
 #define EXT2_CACHE_BLOCKS       32
 
+/* Number of block and inode bitmap blocks to keep cached apart from the rest.
+
+   The bitmaps are kept in a cache of their own, so that streaming file data
+   through the block cache doesn't push them out and make each allocation read
+   them back in again. This is the number of blocks reserved for them, and is
+   lowered to fit filesystems with fewer block groups.
+*/
+#define EXT2_BITMAP_CACHE_BLOCKS    8
+
+/* Number of blocks to preallocate when a regular file needs a new one.
+
+   The extra blocks are allocated along with the one needed, right after it on
+   the disk, and held for the file to grow into. This keeps files that are
+   written a bit at a time (such as logs) contiguous, even with other files
+   being written at the same time. Any that are left over are freed again when
+   the file is closed. Setting this to 0 turns it off.
+*/
+#define EXT2_PREALLOC_BLOCKS    8
+
 /* End tunable filesystem parameters. */
 
 /* Convenience stuff, for in case you want to use this outside of KOS. */
@@ -100,6 +124,12 @@ void ext2_fs_shutdown(ext2_fs_t *fs);
 int ext2_block_read_nc(ext2_fs_t *fs, uint32_t block_num, uint8_t *rv);
 uint8_t *ext2_block_read(ext2_fs_t *fs, uint32_t block_num, int *err);
 
+/* Read a run of consecutive blocks into buf, taking any that are cached from
+   the cache and reading the rest from the device in as few requests as they
+   allow. Returns 0 on success, or -1 with *err set. */
+int ext2_block_read_run(ext2_fs_t *fs, uint32_t block_num, uint32_t count,
+                        uint8_t *buf, int *err);
+
 int ext2_block_write_nc(ext2_fs_t *fs, uint32_t block_num, const uint8_t *blk);
 
 int ext2_block_mark_dirty(ext2_fs_t *fs, uint32_t block_num);
@@ -108,8 +138,35 @@ int ext2_block_mark_dirty(ext2_fs_t *fs, uint32_t block_num);
    call the corresponding inode function before this one. */
 int ext2_block_cache_wb(ext2_fs_t *fs);
 
+#ifndef EXT2_NOT_IN_KOS
+/* Ask for a block to be read into the cache in the background, ahead of it
+   being needed. This only does anything once a lock has been set. */
+void ext2_block_readahead(ext2_fs_t *fs, uint32_t block_num);
+
+/* Set the lock held around all calls on the filesystem, so that the block
+   cache can write back and read ahead its blocks in the background. */
+void ext2_fs_set_lock(ext2_fs_t *fs, mutex_t *lock);
+#endif
+
+/* Get a block or inode bitmap block, or mark it dirty. These go through the
+   cache the bitmaps are kept in, so all accesses to them must use these. */
+uint8_t *ext2_bitmap_read(ext2_fs_t *fs, uint32_t block_num, int *err);
+int ext2_bitmap_mark_dirty(ext2_fs_t *fs, uint32_t block_num);
+
+/* Get a block filled with zeroes and marked dirty, without reading it in. */
+uint8_t *ext2_block_clear(ext2_fs_t *fs, uint32_t block_num, int *err);
+
 uint8_t *ext2_block_alloc(ext2_fs_t *fs, uint32_t bg, uint32_t *bn, int *err);
 
+/* Allocate a block, preferably the goal block (or if that's 0 or taken, the
+   next free one after it in its block group, or failing that, one in the group
+   bg), along with up to want - 1 more free blocks directly following it. The
+   first block is returned cleared, and the number allocated in all is put in
+   *count. The rest are only marked as in use. */
+uint8_t *ext2_block_alloc_run(ext2_fs_t *fs, uint32_t bg, uint32_t goal,
+                              uint32_t want, uint32_t *bn, uint32_t *count,
+                              int *err);
+
 __END_DECLS
 
 #endif /* !__EXT2_EXT2FS_H */
@@ -16,6 +16,8 @@
 #include <kos/fs.h>
 #include <kos/mutex.h>
 #include <kos/dbglog.h>
+#include <kos/genwait.h>
+#include <kos/worker_thread.h>
 
 #include <ext2/fs_ext2.h>
 
@@ -33,12 +35,21 @@ char *strdup(const char *);
 
 #define MAX_EXT2_FILES 16
 
+/* How long after a write the filesystem is synced, in milliseconds. Writes
+   made in the meantime all go out together. */
+#define FLUSH_DELAY_MS 1000
+
 typedef struct fs_ext2_fs {
     LIST_ENTRY(fs_ext2_fs) entry;
 
     vfs_handler_t *vfsh;
     ext2_fs_t *fs;
     uint32_t mount_flags;
+
+    /* Worker syncing the filesystem a while after it's written to. */
+    kthread_worker_t *flusher;
+    int flush_pending;
+    int flush_quit;
 } fs_ext2_fs_t;
 
 LIST_HEAD(ext2_list, fs_ext2_fs);
@@ -54,6 +65,45 @@ static struct {
     fs_ext2_fs_t *fs;
 } fh[MAX_EXT2_FILES];
 
+/* Have the filesystem synced a little while from now, if it isn't already
+   going to be. Called with ext2_mutex held. */
+static void flush_later(fs_ext2_fs_t *mnt) {
+    if(mnt->flusher && !mnt->flush_pending) {
+        mnt->flush_pending = 1;
+        thd_worker_wakeup(mnt->flusher);
+    }
+}
+
+static void flush_thread(void *data) {
+    fs_ext2_fs_t *mnt = (fs_ext2_fs_t *)data;
+
+    /* Let writes pile up for a while, unless we're told to stop. */
+    if(!mnt->flush_quit)
+        genwait_wait(mnt, "fs_ext2 flush", FLUSH_DELAY_MS, NULL);
+
+    mutex_lock(&ext2_mutex);
+
+    if(!mnt->flush_quit) {
+        mnt->flush_pending = 0;
+        ext2_fs_sync(mnt->fs);
+    }
+
+    mutex_unlock(&ext2_mutex);
+}
+
+/* Stop the flush worker of a mount. Called with ext2_mutex held. */
+static void flush_stop(fs_ext2_fs_t *mnt) {
+    if(!mnt->flusher)
+        return;
+
+    mnt->flush_quit = 1;
+    genwait_wake_all(mnt);
+    mutex_unlock(&ext2_mutex);
+    thd_worker_destroy(mnt->flusher);
+    mutex_lock(&ext2_mutex);
+    mnt->flusher = NULL;
+}
+
 static int create_empty_file(fs_ext2_fs_t *fs, const char *fn,
                              ext2_inode_t **rinode, uint32_t *rinode_num) {
     int irv;
@@ -244,7 +294,7 @@ static int fs_ext2_close(void *h) {
 static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
     file_t fd = ((file_t)h) - 1;
     ext2_fs_t *fs;
-    uint32_t bs, lbs, bo;
+    uint32_t bs, lbs, bo, bn, n;
     uint8_t *block;
     uint8_t *bbuf = (uint8_t *)buf;
     ssize_t rv;
@@ -309,6 +359,29 @@ static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
 
     /* While we still have more to read, do it. */
     while(cnt) {
+        /* Whole blocks that follow on from each other on the disk are read in
+           one go, straight into the caller's buffer. That has to be 32-byte
+           aligned for block devices that DMA into it. */
+        if(cnt >= bs && !((uintptr_t)bbuf & 0x1F)) {
+            if(ext2_inode_map_run(fs, fh[fd].inode, fh[fd].ptr >> lbs,
+                                  cnt >> lbs, &bn, &n, &errno)) {
+                mutex_unlock(&ext2_mutex);
+                return -1;
+            }
+
+            if(bn && n > 1) {
+                if(ext2_block_read_run(fs, bn, n, bbuf, &errno)) {
+                    mutex_unlock(&ext2_mutex);
+                    return -1;
+                }
+
+                fh[fd].ptr += n << lbs;
+                cnt -= n << lbs;
+                bbuf += n << lbs;
+                continue;
+            }
+        }
+
         if(!(block = ext2_inode_read_block(fs, fh[fd].inode, fh[fd].ptr >> lbs,
                                            NULL, &errno))) {
             mutex_unlock(&ext2_mutex);
@@ -328,6 +401,10 @@ static ssize_t fs_ext2_read(void *h, void *buf, size_t cnt) {
         }
     }
 
+    /* Get the next block on its way while the caller deals with this one. */
+    if(fh[fd].ptr < sz)
+        ext2_inode_readahead(fs, fh[fd].inode, (fh[fd].ptr + bs - 1) >> lbs);
+
     /* We're done, clean up and return. */
     mutex_unlock(&ext2_mutex);
     return rv;
@@ -481,6 +558,7 @@ static ssize_t fs_ext2_write(void *h, const void *buf, size_t cnt) {
 
     fh[fd].inode->i_mtime = time(NULL);
     ext2_inode_mark_dirty(fh[fd].inode);
+    flush_later(fh[fd].fs);
 
     mutex_unlock(&ext2_mutex);
     return rv;
@@ -557,7 +635,72 @@ static uint64_t fs_ext2_total64(void *h) {
     return rv;
 }
 
-static dirent_t *fs_ext2_readdir(void *h) {
+/* Fill in the status of an inode. */
+static int fill_stat(vfs_handler_t *vfs, const ext2_inode_t *inode,
+                     uint32_t inode_num, struct stat *st) {
+    uint64_t sz;
+    int irv = 0;
+
+    /* Fill in the structure */
+    memset(st, 0, sizeof(struct stat));
+    st->st_dev = (dev_t)((uintptr_t)vfs);
+    st->st_ino = inode_num;
+    st->st_mode = inode->i_mode & 0x0FFF;
+    st->st_nlink = inode->i_links_count;
+    st->st_uid = inode->i_uid;
+    st->st_gid = inode->i_gid;
+
+    st->st_atime = inode->i_atime;
+    st->st_mtime = inode->i_mtime;
+    st->st_ctime = inode->i_ctime;
+    st->st_blksize = 512;
+    st->st_blocks = inode->i_blocks;
+
+    /* The rest depends on what type of inode this is... */
+    switch(inode->i_mode & 0xF000) {
+        case EXT2_S_IFLNK:
+            st->st_mode |= S_IFLNK;
+            st->st_size = inode->i_size;
+            break;
+
+        case EXT2_S_IFREG:
+            st->st_mode |= S_IFREG;
+            sz = ext2_inode_size(inode);
+
+            if(sz > LONG_MAX) {
+                errno = EOVERFLOW;
+                irv = -1;
+            }
+
+            st->st_size = sz;
+            break;
+
+        case EXT2_S_IFDIR:
+            st->st_mode |= S_IFDIR;
+            st->st_size = inode->i_size;
+            break;
+
+        case EXT2_S_IFSOCK:
+            st->st_mode |= S_IFSOCK;
+            break;
+
+        case EXT2_S_IFIFO:
+            st->st_mode |= S_IFIFO;
+            break;
+
+        case EXT2_S_IFBLK:
+            st->st_mode |= S_IFBLK;
+            break;
+
+        case EXT2_S_IFCHR:
+            st->st_mode |= S_IFCHR;
+            break;
+    }
+
+    return irv;
+}
+
+static dirent_t *fs_ext2_readdir_plus(void *h, struct stat *st) {
     file_t fd = ((file_t)h) - 1;
     ext2_fs_t *fs;
     uint32_t bs, lbs;
@@ -628,11 +771,19 @@ retry:
     else
         fh[fd].dent.attr = 0;
 
+    /* The inode's already been read in for the above, so this is free. */
+    if(st)
+        fill_stat(fh[fd].fs->vfsh, inode, dent->inode, st);
+
     ext2_inode_put(inode);
     mutex_unlock(&ext2_mutex);
     return &fh[fd].dent;
 }
 
+static dirent_t *fs_ext2_readdir(void *h) {
+    return fs_ext2_readdir_plus(h, NULL);
+}
+
 static int int_rename(fs_ext2_fs_t *fs, const char *fn1, const char *fn2,
                       ext2_inode_t *pinode, ext2_inode_t *finode,
                       uint32_t finode_num, int isfile) {
@@ -1692,7 +1843,6 @@ int fs_ext2_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
     ext2_inode_t *inode;
     uint32_t inode_num;
     int rl = 1;
-    uint64_t sz;
     size_t len = strlen(path);
 
     /* Do we want the status of a symlink or of the thing it points at if we end
@@ -1721,62 +1871,7 @@ int fs_ext2_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
         return -1;
     }
 
-    /* Fill in the structure */
-    memset(st, 0, sizeof(struct stat));
-    st->st_dev = (dev_t)((uintptr_t)vfs);
-    st->st_ino = inode_num;
-    st->st_mode = inode->i_mode & 0x0FFF;
-    st->st_nlink = inode->i_links_count;
-    st->st_uid = inode->i_uid;
-    st->st_gid = inode->i_gid;
-
-    st->st_atime = inode->i_atime;
-    st->st_mtime = inode->i_mtime;
-    st->st_ctime = inode->i_ctime;
-    st->st_blksize = 512;
-    st->st_blocks = inode->i_blocks;
-
-    /* The rest depends on what type of inode this is... */
-    switch(inode->i_mode & 0xF000) {
-        case EXT2_S_IFLNK:
-            st->st_mode |= S_IFLNK;
-            st->st_size = inode->i_size;
-            break;
-
-        case EXT2_S_IFREG:
-            st->st_mode |= S_IFREG;
-            sz = ext2_inode_size(inode);
-
-            if(sz > LONG_MAX) {
-                errno = EOVERFLOW;
-                irv = -1;
-            }
-
-            st->st_size = sz;
-            break;
-
-        case EXT2_S_IFDIR:
-            st->st_mode |= S_IFDIR;
-            st->st_size = inode->i_size;
-            break;
-
-        case EXT2_S_IFSOCK:
-            st->st_mode |= S_IFSOCK;
-            break;
-
-        case EXT2_S_IFIFO:
-            st->st_mode |= S_IFIFO;
-            break;
-
-        case EXT2_S_IFBLK:
-            st->st_mode |= S_IFBLK;
-            break;
-
-        case EXT2_S_IFCHR:
-            st->st_mode |= S_IFCHR;
-            break;
-    }
-
+    irv = fill_stat(vfs, inode, inode_num, st);
     ext2_inode_put(inode);
     mutex_unlock(&ext2_mutex);
 
@@ -1803,11 +1898,8 @@ static int fs_ext2_rewinddir(void *h) {
 }
 
 static int fs_ext2_fstat(void *h, struct stat *st) {
-    fs_ext2_fs_t *fs;
-    ext2_inode_t *inode;
-    uint64_t sz;
     file_t fd = ((file_t)h) - 1;
-    int irv = 0;
+    int irv;
 
     mutex_lock(&ext2_mutex);
 
@@ -1817,66 +1909,7 @@ static int fs_ext2_fstat(void *h, struct stat *st) {
         return -1;
     }
 
-    /* Find the object in question */
-    inode = fh[fd].inode;
-    fs = fh[fd].fs;
-
-    /* Fill in the structure */
-    memset(st, 0, sizeof(struct stat));
-    st->st_dev = (dev_t)((uintptr_t)fs->vfsh);
-    st->st_ino = fh[fd].inode_num;
-    st->st_mode = inode->i_mode & 0x0FFF;
-    st->st_nlink = inode->i_links_count;
-    st->st_uid = inode->i_uid;
-    st->st_gid = inode->i_gid;
-
-    st->st_atime = inode->i_atime;
-    st->st_mtime = inode->i_mtime;
-    st->st_ctime = inode->i_ctime;
-    st->st_blksize = 512;
-    st->st_blocks = inode->i_blocks;
-
-    /* The rest depends on what type of inode this is... */
-    switch(inode->i_mode & 0xF000) {
-        case EXT2_S_IFLNK:
-            st->st_mode |= S_IFLNK;
-            st->st_size = inode->i_size;
-            break;
-
-        case EXT2_S_IFREG:
-            st->st_mode |= S_IFREG;
-            sz = ext2_inode_size(inode);
-
-            if(sz > LONG_MAX) {
-                errno = EOVERFLOW;
-                irv = -1;
-            }
-
-            st->st_size = sz;
-            break;
-
-        case EXT2_S_IFDIR:
-            st->st_mode |= S_IFDIR;
-            st->st_size = inode->i_size;
-            break;
-
-        case EXT2_S_IFSOCK:
-            st->st_mode |= S_IFSOCK;
-            break;
-
-        case EXT2_S_IFIFO:
-            st->st_mode |= S_IFIFO;
-            break;
-
-        case EXT2_S_IFBLK:
-            st->st_mode |= S_IFBLK;
-            break;
-
-        case EXT2_S_IFCHR:
-            st->st_mode |= S_IFCHR;
-            break;
-    }
-
+    irv = fill_stat(fh[fd].fs->vfsh, fh[fd].inode, fh[fd].inode_num, st);
     mutex_unlock(&ext2_mutex);
 
     return irv;
@@ -1921,7 +1954,12 @@ static vfs_handler_t vh = {
     fs_ext2_total64,            /* total64 */
     fs_ext2_readlink,           /* readlink */
     fs_ext2_rewinddir,          /* rewinddir */
-    fs_ext2_fstat               /* fstat */
+    fs_ext2_fstat,              /* fstat */
+    NULL,                       /* read_async */
+    NULL,                       /* write_async */
+    NULL,                       /* splice_out */
+    NULL,                       /* splice_in */
+    fs_ext2_readdir_plus        /* readdir_plus */
 };
 
 static int initted = 0;
@@ -1960,6 +1998,13 @@ int fs_ext2_mount(const char *mp, kos_blockdev_t *dev, uint32_t flags) {
 
     mnt->fs = fs;
     mnt->mount_flags = flags;
+    mnt->flusher = NULL;
+    mnt->flush_pending = 0;
+    mnt->flush_quit = 0;
+
+    /* The block cache can write back and read ahead in the background while
+       holding our lock. */
+    ext2_fs_set_lock(fs, &ext2_mutex);
 
     /* Create a VFS structure */
     if(!(vfsh = (vfs_handler_t *)malloc(sizeof(vfs_handler_t)))) {
@@ -1988,6 +2033,14 @@ int fs_ext2_mount(const char *mp, kos_blockdev_t *dev, uint32_t flags) {
         return -1;
     }
 
+    /* Without the worker, changes only go out on sync and unmount, and as the
+       block cache writes them back. */
+    if(flags & FS_EXT2_MOUNT_READWRITE) {
+        if((mnt->flusher = thd_worker_create(flush_thread, mnt)))
+            thd_set_label(thd_worker_get_thread(mnt->flusher),
+                          "fs_ext2 flush");
+    }
+
     mutex_unlock(&ext2_mutex);
     return 0;
 }
@@ -2009,6 +2062,7 @@ int fs_ext2_unmount(const char *mp) {
         LIST_REMOVE(i, entry);
 
         /* XXXX: We should probably do something with open files... */
+        flush_stop(i);
         nmmgr_handler_remove(&i->vfsh->nmmgr);
         ext2_fs_shutdown(i->fs);
         free(i->vfsh);
@@ -2069,11 +2123,13 @@ int fs_ext2_shutdown(void) {
         return 0;
 
     /* Clean up the mounted filesystems */
+    mutex_lock(&ext2_mutex);
     i = LIST_FIRST(&ext2_fses);
     while(i) {
         next = LIST_NEXT(i, entry);
 
         /* XXXX: We should probably do something with open files... */
+        flush_stop(i);
         nmmgr_handler_remove(&i->vfsh->nmmgr);
         ext2_fs_shutdown(i->fs);
         free(i->vfsh);
@@ -2082,6 +2138,7 @@ int fs_ext2_shutdown(void) {
         i = next;
     }
 
+    mutex_unlock(&ext2_mutex);
     mutex_destroy(&ext2_mutex);
     initted = 0;
 
@@ -0,0 +1,361 @@
+/* KallistiOS ##version##
+
+   htree.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* This file implements looking up entries through the hashed index (htree)
+   that Linux adds to large directories when the dir_index feature is on. The
+   index is kept in blocks that look like empty directory blocks to anything
+   that doesn't know about it, so only lookups use it. Anything that changes a
+   directory clears the directory's index flag instead of updating the index,
+   and e2fsck will rebuild it. */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "ext2fs.h"
+#include "ext2internal.h"
+#include "directory.h"
+#include "inode.h"
+
+/* Hash versions, as kept in the root of the tree. The unsigned versions are
+   never stored there, but are used instead of the others when the superblock
+   says to. */
+#define DX_HASH_LEGACY              0
+#define DX_HASH_HALF_MD4            1
+#define DX_HASH_TEA                 2
+#define DX_HASH_LEGACY_UNSIGNED     3
+#define DX_HASH_HALF_MD4_UNSIGNED   4
+#define DX_HASH_TEA_UNSIGNED        5
+
+/* s_flags in the superblock (after s_first_meta_bg, in the unused space in
+   our copy of it), and its flag to say hashes treat names as unsigned. */
+#define EXT2_SB_FLAGS_OFFSET        0x58
+#define EXT2_FLAGS_UNSIGNED_HASH    0x0002
+
+/* The deepest tree ext2/ext3 makes has an index node between the root and the
+   leaves. */
+#define DX_MAX_LEVELS               2
+
+/* The root of the tree, after the "." and ".." entries in the first block. */
+typedef struct dx_root_info {
+    uint32_t reserved_zero;
+    uint8_t hash_version;
+    uint8_t info_length;
+    uint8_t indirect_levels;
+    uint8_t unused_flags;
+} dx_root_info_t;
+
+/* An index entry. The first in each node holds the limit and count of entries
+   in place of a hash, as the first covers all hashes below the second. */
+typedef struct dx_entry {
+    uint32_t hash;
+    uint32_t block;
+} dx_entry_t;
+
+static uint32_t dx_hack_hash(const char *name, int len, int unsigned_char) {
+    uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    int c;
+
+    while(len--) {
+        c = unsigned_char ? (int)(unsigned char)*name++ :
+            (int)(signed char)*name++;
+        hash = hash1 + (hash0 ^ (uint32_t)(c * 7152373));
+
+        if(hash & 0x80000000)
+            hash -= 0x7fffffff;
+
+        hash1 = hash0;
+        hash0 = hash;
+    }
+
+    return hash0 << 1;
+}
+
+/* Pack (up to) num words of the name into buf, padded with its length. */
+static void str2hashbuf(const char *msg, int len, uint32_t *buf, int num,
+                        int unsigned_char) {
+    uint32_t pad, val;
+    int i, c;
+
+    pad = (uint32_t)len | ((uint32_t)len << 8);
+    pad |= pad << 16;
+    val = pad;
+
+    if(len > num * 4)
+        len = num * 4;
+
+    for(i = 0; i < len; ++i) {
+        c = unsigned_char ? (int)(unsigned char)msg[i] :
+            (int)(signed char)msg[i];
+        val = (uint32_t)c + (val << 8);
+
+        if((i % 4) == 3) {
+            *buf++ = val;
+            val = pad;
+            --num;
+        }
+    }
+
+    if(--num >= 0)
+        *buf++ = val;
+
+    while(--num >= 0)
+        *buf++ = pad;
+}
+
+static void tea_transform(uint32_t buf[4], const uint32_t in[4]) {
+    uint32_t sum = 0, b0 = buf[0], b1 = buf[1];
+    int n = 16;
+
+    do {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+        b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    } while(--n);
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+#define ROL32(x, s)     (((x) << (s)) | ((x) >> (32 - (s))))
+#define MD4_F(x, y, z)  ((z) ^ ((x) & ((y) ^ (z))))
+#define MD4_G(x, y, z)  (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define MD4_H(x, y, z)  ((x) ^ (y) ^ (z))
+#define MD4_ROUND(f, a, b, c, d, x, s) \
+    do { (a) += f((b), (c), (d)) + (x); (a) = ROL32((a), (s)); } while(0)
+#define MD4_K2          013240474631U
+#define MD4_K3          015666365641U
+
+/* The cut down MD4 transform Linux uses for directory hashes. */
+static void half_md4_transform(uint32_t buf[4], const uint32_t in[8]) {
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    MD4_ROUND(MD4_F, a, b, c, d, in[0], 3);
+    MD4_ROUND(MD4_F, d, a, b, c, in[1], 7);
+    MD4_ROUND(MD4_F, c, d, a, b, in[2], 11);
+    MD4_ROUND(MD4_F, b, c, d, a, in[3], 19);
+    MD4_ROUND(MD4_F, a, b, c, d, in[4], 3);
+    MD4_ROUND(MD4_F, d, a, b, c, in[5], 7);
+    MD4_ROUND(MD4_F, c, d, a, b, in[6], 11);
+    MD4_ROUND(MD4_F, b, c, d, a, in[7], 19);
+
+    MD4_ROUND(MD4_G, a, b, c, d, in[1] + MD4_K2, 3);
+    MD4_ROUND(MD4_G, d, a, b, c, in[3] + MD4_K2, 5);
+    MD4_ROUND(MD4_G, c, d, a, b, in[5] + MD4_K2, 9);
+    MD4_ROUND(MD4_G, b, c, d, a, in[7] + MD4_K2, 13);
+    MD4_ROUND(MD4_G, a, b, c, d, in[0] + MD4_K2, 3);
+    MD4_ROUND(MD4_G, d, a, b, c, in[2] + MD4_K2, 5);
+    MD4_ROUND(MD4_G, c, d, a, b, in[4] + MD4_K2, 9);
+    MD4_ROUND(MD4_G, b, c, d, a, in[6] + MD4_K2, 13);
+
+    MD4_ROUND(MD4_H, a, b, c, d, in[3] + MD4_K3, 3);
+    MD4_ROUND(MD4_H, d, a, b, c, in[7] + MD4_K3, 9);
+    MD4_ROUND(MD4_H, c, d, a, b, in[2] + MD4_K3, 11);
+    MD4_ROUND(MD4_H, b, c, d, a, in[6] + MD4_K3, 15);
+    MD4_ROUND(MD4_H, a, b, c, d, in[1] + MD4_K3, 3);
+    MD4_ROUND(MD4_H, d, a, b, c, in[5] + MD4_K3, 9);
+    MD4_ROUND(MD4_H, c, d, a, b, in[0] + MD4_K3, 11);
+    MD4_ROUND(MD4_H, b, c, d, a, in[4] + MD4_K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+/* Work out the hash of a name, the same way Linux does. */
+static uint32_t dx_hash(const ext2_fs_t *fs, int version, const char *name,
+                        int len) {
+    uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    uint32_t in[8], hash;
+    int i, uc = 0;
+
+    /* Use the filesystem's seed, if it has one. */
+    for(i = 0; i < 4; ++i) {
+        if(fs->sb.s_hash_seed[i])
+            break;
+    }
+
+    if(i < 4)
+        memcpy(buf, fs->sb.s_hash_seed, sizeof(buf));
+
+    switch(version) {
+        case DX_HASH_LEGACY_UNSIGNED:
+            uc = 1;
+            /* Fall through... */
+        case DX_HASH_LEGACY:
+            hash = dx_hack_hash(name, len, uc);
+            break;
+
+        case DX_HASH_HALF_MD4_UNSIGNED:
+            uc = 1;
+            /* Fall through... */
+        case DX_HASH_HALF_MD4:
+            for(; len > 0; len -= 32, name += 32) {
+                str2hashbuf(name, len, in, 8, uc);
+                half_md4_transform(buf, in);
+            }
+
+            hash = buf[1];
+            break;
+
+        case DX_HASH_TEA_UNSIGNED:
+            uc = 1;
+            /* Fall through... */
+        default:
+            for(; len > 0; len -= 16, name += 16) {
+                str2hashbuf(name, len, in, 4, uc);
+                tea_transform(buf, in);
+            }
+
+            hash = buf[0];
+            break;
+    }
+
+    /* The bottom bit marks hash collisions in the index, and the top value is
+       kept for the end of the directory. */
+    hash &= ~1U;
+
+    if(hash == (0x7fffffffU << 1))
+        hash = (0x7fffffffU - 1) << 1;
+
+    return hash;
+}
+
+/* Get the entries of a node of the tree (block 0 being the root), or NULL if
+   it can't be read or doesn't look right. */
+static const dx_entry_t *dx_node(ext2_fs_t *fs, const struct ext2_inode *dir,
+                                 uint32_t block, uint32_t *count) {
+    const uint8_t *buf;
+    const uint16_t *cl;
+    uint32_t off = 8;
+    int err;
+
+    if(!(buf = ext2_inode_read_block(fs, dir, block, NULL, &err)))
+        return NULL;
+
+    /* The root's entries come after the "." and ".." entries and its info. */
+    if(!block)
+        off = 24 + ((const dx_root_info_t *)(buf + 24))->info_length;
+
+    cl = (const uint16_t *)(buf + off);
+
+    if(!cl[1] || cl[1] > cl[0] || cl[0] != (fs->block_size - off) / 8)
+        return NULL;
+
+    *count = cl[1];
+    return (const dx_entry_t *)(buf + off);
+}
+
+int ext2_dir_htree_lookup(ext2_fs_t *fs, const struct ext2_inode *dir,
+                          const char *fn, ext2_dirent_t **rv) {
+    const dx_root_info_t *info;
+    const dx_entry_t *ent;
+    const uint8_t *buf;
+    ext2_dirent_t *dent;
+    uint32_t node[DX_MAX_LEVELS], pos[DX_MAX_LEVELS];
+    uint32_t hash, count, lo, hi, mid, off, leaf, flags;
+    int levels, l, version, err;
+    size_t len = strlen(fn);
+
+    if(!(fs->sb.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX) ||
+       !(dir->i_flags & EXT2_INDEX_FL))
+        return -1;
+
+    /* "." and ".." are only in the root block, which isn't a leaf. */
+    if(!len || len > 255 || !strcmp(fn, ".") || !strcmp(fn, ".."))
+        return -1;
+
+    if(!(buf = ext2_inode_read_block(fs, dir, 0, NULL, &err)))
+        return -1;
+
+    info = (const dx_root_info_t *)(buf + 24);
+
+    if(info->reserved_zero || info->info_length != 8 ||
+       info->indirect_levels >= DX_MAX_LEVELS ||
+       info->hash_version > DX_HASH_TEA)
+        return -1;
+
+    levels = info->indirect_levels;
+    version = info->hash_version;
+    memcpy(&flags, fs->sb.unused + EXT2_SB_FLAGS_OFFSET, sizeof(flags));
+
+    if(flags & EXT2_FLAGS_UNSIGNED_HASH)
+        version += DX_HASH_LEGACY_UNSIGNED;
+
+    hash = dx_hash(fs, version, fn, (int)len);
+
+    /* Walk down the tree to the leaf that would hold the name, finding the
+       last entry at each level starting at or below its hash. */
+    node[0] = 0;
+
+    for(l = 0; ; ++l) {
+        if(!(ent = dx_node(fs, dir, node[l], &count)))
+            return -1;
+
+        for(lo = 1, hi = count; lo < hi;) {
+            mid = (lo + hi) / 2;
+
+            if(ent[mid].hash > hash)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+
+        pos[l] = lo - 1;
+
+        if(l == levels)
+            break;
+
+        node[l + 1] = ent[pos[l]].block & 0x0FFFFFFF;
+    }
+
+    leaf = ent[pos[levels]].block & 0x0FFFFFFF;
+
+    for(;;) {
+        if(!(buf = ext2_inode_read_block(fs, dir, leaf, NULL, &err)))
+            return -1;
+
+        for(off = 0; off < fs->block_size; off += dent->rec_len) {
+            dent = (ext2_dirent_t *)(buf + off);
+
+            if(dent->rec_len < 8 || off + dent->rec_len > fs->block_size)
+                return -1;
+
+            if(dent->inode && dent->name_len == len &&
+               !memcmp(dent->name, fn, len)) {
+                *rv = dent;
+                return 1;
+            }
+        }
+
+        /* Names with the same hash can go on into the next leaf, which then
+           starts with that hash (with the collision bit set). Find the next
+           leaf, going back up the tree as far as needed. */
+        for(l = levels; ; --l) {
+            if(!(ent = dx_node(fs, dir, node[l], &count)))
+                return -1;
+
+            if(++pos[l] < count)
+                break;
+
+            if(!l)
+                return 0;
+        }
+
+        if((ent[pos[l]].hash & ~1U) != hash)
+            return 0;
+
+        for(; l < levels; ++l) {
+            node[l + 1] = ent[pos[l]].block & 0x0FFFFFFF;
+            pos[l + 1] = 0;
+
+            if(!(ent = dx_node(fs, dir, node[l + 1], &count)))
+                return -1;
+        }
+
+        leaf = ent[pos[levels]].block & 0x0FFFFFFF;
+    }
+}
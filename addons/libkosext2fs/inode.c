@@ -65,6 +65,11 @@ static struct int_inode {
 
     /* What inode number is this? */
     uint32_t inode_num;
+
+    /* Blocks allocated ahead of need, directly after the last one the inode
+       was given, for it to be extended into. */
+    uint32_t pa_block;
+    uint32_t pa_count;
 } inodes[MAX_INODES];
 
 /* Head types */
@@ -79,7 +84,10 @@ static struct inode_list inode_hash[INODE_HASH_SZ];
 
 /* Forward declaration... */
 static ext2_inode_t *ext2_inode_read(ext2_fs_t *fs, uint32_t inode_num);
+static int inode_block_num(ext2_fs_t *fs, const ext2_inode_t *inode,
+                           uint32_t block_num, uint32_t *rv, int *err);
 static int ext2_inode_wb(struct int_inode *inode);
+static void prealloc_release(struct int_inode *inode);
 
 void ext2_inode_init(void) {
     int i;
@@ -96,6 +104,7 @@ void ext2_inode_init(void) {
         inodes[i].flags = 0;
         inodes[i].inode_num = 0;
         inodes[i].refcnt = 0;
+        inodes[i].pa_count = 0;
         TAILQ_INSERT_TAIL(&free_inodes, inodes + i, qentry);
     }
 }
@@ -139,6 +148,7 @@ ext2_inode_t *ext2_inode_get(ext2_fs_t *fs, uint32_t inode_num, int *err) {
     i->refcnt = 1;
     i->inode_num = inode_num;
     i->fs = fs;
+    i->pa_count = 0;
 
     /* Read the inode in from the block device. */
     if(!(rinode = ext2_inode_read(fs, inode_num))) {
@@ -172,6 +182,9 @@ void ext2_inode_put(ext2_inode_t *inode) {
 
     /* Decrement the reference counter, and see if we've got the last one. */
     if(!--iinode->refcnt) {
+        /* Give back any blocks it didn't get to use. */
+        prealloc_release(iinode);
+
         /* Write it back out to the block cache if it was dirty. */
         if(iinode->flags & INODE_FLAG_DIRTY)
             /* XXXX: Should probably make sure this succeeds... */
@@ -234,7 +247,7 @@ static ext2_inode_t *ext2_inode_read(ext2_fs_t *fs, uint32_t inode_num) {
     if(inode_num > fs->sb.s_inodes_count)
         return NULL;
 
-    if(!(buf = ext2_block_read(fs, fs->bg[bg].bg_inode_bitmap, &err)))
+    if(!(buf = ext2_bitmap_read(fs, fs->bg[bg].bg_inode_bitmap, &err)))
         return NULL;
 
     if(!ext2_bit_is_set((uint32_t *)buf, index))
@@ -332,14 +345,14 @@ ext2_inode_t *ext2_inode_alloc(ext2_fs_t *fs, uint32_t parent, int *err,
 
     /* See if we have any free inodes in the block group requested. */
     if(fs->bg[bg].bg_free_inodes_count) {
-        if(!(buf = ext2_block_read(fs, fs->bg[bg].bg_inode_bitmap, err)))
+        if(!(buf = ext2_bitmap_read(fs, fs->bg[bg].bg_inode_bitmap, err)))
             return NULL;
 
         index = ext2_bit_find_zero((uint32_t *)buf, 0,
                                    fs->sb.s_inodes_per_group - 1);
         if(index < fs->sb.s_inodes_per_group) {
             ext2_bit_set((uint32_t *)buf, index);
-            ext2_block_mark_dirty(fs, fs->bg[bg].bg_inode_bitmap);
+            ext2_bitmap_mark_dirty(fs, fs->bg[bg].bg_inode_bitmap);
             --fs->bg[bg].bg_free_inodes_count;
             --fs->sb.s_free_inodes_count;
             fs->flags |= EXT2_FS_FLAG_SB_DIRTY;
@@ -363,14 +376,14 @@ ext2_inode_t *ext2_inode_alloc(ext2_fs_t *fs, uint32_t parent, int *err,
        all the block groups looking for a free inode. */
     for(bg = 0; bg < fs->bg_count; ++bg) {
         if(fs->bg[bg].bg_free_inodes_count) {
-            if(!(buf = ext2_block_read(fs, fs->bg[bg].bg_inode_bitmap, err)))
+            if(!(buf = ext2_bitmap_read(fs, fs->bg[bg].bg_inode_bitmap, err)))
                 return NULL;
 
             index = ext2_bit_find_zero((uint32_t *)buf, 0,
                                        fs->sb.s_inodes_per_group - 1);
             if(index < fs->sb.s_inodes_per_group) {
                 ext2_bit_set((uint32_t *)buf, index);
-                ext2_block_mark_dirty(fs, fs->bg[bg].bg_inode_bitmap);
+                ext2_bitmap_mark_dirty(fs, fs->bg[bg].bg_inode_bitmap);
                 --fs->bg[bg].bg_free_inodes_count;
                 --fs->sb.s_free_inodes_count;
                 fs->flags |= EXT2_FS_FLAG_SB_DIRTY;
@@ -408,18 +421,28 @@ static inline int mark_block_free(ext2_fs_t *fs, uint32_t blk) {
     bg = (blk - fs->sb.s_first_data_block) / fs->sb.s_blocks_per_group;
     index = (blk - fs->sb.s_first_data_block) % fs->sb.s_blocks_per_group;
 
-    if(!(buf = ext2_block_read(fs, fs->bg[bg].bg_block_bitmap, &err)))
+    if(!(buf = ext2_bitmap_read(fs, fs->bg[bg].bg_block_bitmap, &err)))
         return -EIO;
 
     /* Mark the block as free in the bitmap and increase the counters. */
     ext2_bit_clear((uint32_t *)buf, index);
-    ext2_block_mark_dirty(fs, fs->bg[bg].bg_block_bitmap);
+    ext2_bitmap_mark_dirty(fs, fs->bg[bg].bg_block_bitmap);
     ++fs->bg[bg].bg_free_blocks_count;
     ++fs->sb.s_free_blocks_count;
 
     return 0;
 }
 
+static void prealloc_release(struct int_inode *inode) {
+    if(!inode->pa_count)
+        return;
+
+    for(; inode->pa_count; --inode->pa_count, ++inode->pa_block)
+        mark_block_free(inode->fs, inode->pa_block);
+
+    inode->fs->flags |= EXT2_FS_FLAG_SB_DIRTY;
+}
+
 static int free_ind_block(ext2_fs_t *fs, ext2_inode_t *inode, uint32_t iblk) {
     uint32_t blks_per_ind = fs->block_size >> 2;
     uint32_t i, blk;
@@ -554,18 +577,20 @@ int ext2_inode_free_all(ext2_fs_t *fs, ext2_inode_t *inode,
     if((rv = ext2_block_cache_wb(fs)))
         return rv;
 
+    prealloc_release(iinode);
+
     if(for_del) {
         /* Figure out what block group and index within that group the inode in
            question is. */
         bg = (inode_num - 1) / fs->sb.s_inodes_per_group;
         index = (inode_num - 1) % fs->sb.s_inodes_per_group;
 
-        if(!(buf = ext2_block_read(fs, fs->bg[bg].bg_inode_bitmap, &rv)))
+        if(!(buf = ext2_bitmap_read(fs, fs->bg[bg].bg_inode_bitmap, &rv)))
             return -EIO;
 
         /* Mark the inode as free in the bitmap and increase the counters. */
         ext2_bit_clear((uint32_t *)buf, index);
-        ext2_block_mark_dirty(fs, fs->bg[bg].bg_inode_bitmap);
+        ext2_bitmap_mark_dirty(fs, fs->bg[bg].bg_inode_bitmap);
 
         ++fs->bg[bg].bg_free_inodes_count;
         ++fs->sb.s_free_inodes_count;
@@ -687,12 +712,46 @@ int ext2_inode_deref(ext2_fs_t *fs, uint32_t inode_num, int isdir) {
     return rv;
 }
 
+/* Allocate a block for an inode, preferably the goal block. Regular files get
+   blocks preallocated after it, to take the following ones from. */
+static uint8_t *alloc_blk(ext2_fs_t *fs, struct int_inode *inode, uint32_t bg,
+                          uint32_t goal, uint32_t *rbn, int *err) {
+    uint8_t *buf;
+    uint32_t count, want = 1;
+
+    if(inode->pa_count) {
+        /* Carry on into the preallocated blocks if we're allocating the next
+           one of them. If not, the file isn't growing into them anymore. */
+        if(inode->pa_block == goal) {
+            if(!(buf = ext2_block_clear(fs, goal, err)))
+                return NULL;
+
+            *rbn = inode->pa_block++;
+            --inode->pa_count;
+            return buf;
+        }
+
+        prealloc_release(inode);
+    }
+
+    if((inode->inode.i_mode & 0xF000) == EXT2_S_IFREG)
+        want += EXT2_PREALLOC_BLOCKS;
+
+    if(!(buf = ext2_block_alloc_run(fs, bg, goal, want, rbn, &count, err)))
+        return NULL;
+
+    inode->pa_block = *rbn + 1;
+    inode->pa_count = count - 1;
+    return buf;
+}
+
 static uint8_t *alloc_direct_blk(ext2_fs_t *fs, struct int_inode *inode,
-                                 uint32_t bg, uint32_t *rbn, int *err) {
+                                 uint32_t bg, uint32_t goal, uint32_t *rbn,
+                                 int *err) {
     uint8_t *buf;
     uint32_t bn;
 
-    if(!(buf = ext2_block_alloc(fs, bg, &bn, err)))
+    if(!(buf = alloc_blk(fs, inode, bg, goal, &bn, err)))
         return NULL;
 
     *rbn = bn;
@@ -703,19 +762,20 @@ static uint8_t *alloc_direct_blk(ext2_fs_t *fs, struct int_inode *inode,
 }
 
 static uint8_t *alloc_ind_blk(ext2_fs_t *fs, struct int_inode *inode,
-                              uint32_t bg, uint32_t *rbn, int *err) {
+                              uint32_t bg, uint32_t goal, uint32_t *rbn,
+                              int *err) {
     uint8_t *buf;
     uint32_t *buf32;
     uint32_t bn, bn2;
 
     /* Allocate the indirect block */
-    if(!(buf = ext2_block_alloc(fs, bg, &bn, err)))
+    if(!(buf = alloc_blk(fs, inode, bg, goal, &bn, err)))
         return NULL;
 
     buf32 = (uint32_t *)buf;
 
     /* Allocate the direct block and update the inode */
-    if(!(buf = alloc_direct_blk(fs, inode, bg, &bn2, err))) {
+    if(!(buf = alloc_direct_blk(fs, inode, bg, bn + 1, &bn2, err))) {
         mark_block_free(fs, bn);
         return NULL;
     }
@@ -729,19 +789,20 @@ static uint8_t *alloc_ind_blk(ext2_fs_t *fs, struct int_inode *inode,
 }
 
 static uint8_t *alloc_dind_blk(ext2_fs_t *fs, struct int_inode *inode,
-                               uint32_t bg, uint32_t *rbn, int *err) {
+                               uint32_t bg, uint32_t goal, uint32_t *rbn,
+                               int *err) {
     uint8_t *buf;
     uint32_t *buf32;
     uint32_t bn, bn2;
 
     /* Allocate the double indirect block */
-    if(!(buf = ext2_block_alloc(fs, bg, &bn, err)))
+    if(!(buf = alloc_blk(fs, inode, bg, goal, &bn, err)))
         return NULL;
 
     buf32 = (uint32_t *)buf;
 
     /* Allocate the indirect and direct blocks and update the inode */
-    if(!(buf = alloc_ind_blk(fs, inode, bg, &bn2, err))) {
+    if(!(buf = alloc_ind_blk(fs, inode, bg, bn + 1, &bn2, err))) {
         mark_block_free(fs, bn);
         return NULL;
     }
@@ -755,20 +816,21 @@ static uint8_t *alloc_dind_blk(ext2_fs_t *fs, struct int_inode *inode,
 }
 
 static uint8_t *alloc_tind_blk(ext2_fs_t *fs, struct int_inode *inode,
-                               uint32_t bg, uint32_t *rbn, int *err) {
+                               uint32_t bg, uint32_t goal, uint32_t *rbn,
+                               int *err) {
     uint8_t *buf;
     uint32_t *buf32;
     uint32_t bn, bn2;
 
     /* Allocate the double indirect block */
-    if(!(buf = ext2_block_alloc(fs, bg, &bn, err)))
+    if(!(buf = alloc_blk(fs, inode, bg, goal, &bn, err)))
         return NULL;
 
     buf32 = (uint32_t *)buf;
 
     /* Allocate the double indirect, indirect, and direct blocks and update the
        inode */
-    if(!(buf = alloc_dind_blk(fs, inode, bg, &bn2, err))) {
+    if(!(buf = alloc_dind_blk(fs, inode, bg, bn + 1, &bn2, err))) {
         mark_block_free(fs, bn);
         return NULL;
     }
@@ -786,8 +848,9 @@ uint8_t *ext2_inode_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode,
     struct int_inode *iinode = (struct int_inode *)inode;
     uint8_t *buf;
     uint32_t *ind, *ind2, *ind3;
-    uint32_t bg, ibn, ibn2, ibn3;
+    uint32_t bg, ibn, ibn2, ibn3, goal = 0;
     uint32_t blocks_per_ind = fs->block_size >> 2;
+    int err2;
 
     /* Don't even bother if we're mounted read-only. */
     if(!(fs->mnt_flags & EXT2FS_MNT_FLAG_RW)) {
@@ -801,12 +864,17 @@ uint8_t *ext2_inode_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode,
 
     bg = (iinode->inode_num - 1) / fs->sb.s_inodes_per_group;
 
+    /* Try to put the block right after the one before it. */
+    if(blocks && !inode_block_num(fs, inode, blocks - 1, &goal, &err2) && goal)
+        ++goal;
+
     /* First, see if we have a slot in the direct blocks open still. */
     if(blocks < 12) {
-        return alloc_direct_blk(fs, iinode, bg, &inode->i_block[blocks], err);
+        return alloc_direct_blk(fs, iinode, bg, goal, &inode->i_block[blocks],
+                                err);
     }
     else if(blocks == 12) {
-        return alloc_ind_blk(fs, iinode, bg, &inode->i_block[12], err);
+        return alloc_ind_blk(fs, iinode, bg, goal, &inode->i_block[12], err);
     }
 
     blocks -= 12;
@@ -819,13 +887,13 @@ uint8_t *ext2_inode_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode,
         }
 
         /* Allocate the data block. */
-        if((buf = alloc_direct_blk(fs, iinode, bg, &ind[blocks], err)))
+        if((buf = alloc_direct_blk(fs, iinode, bg, goal, &ind[blocks], err)))
             ext2_block_mark_dirty(fs, inode->i_block[12]);
 
         return buf;
     }
     else if(blocks == blocks_per_ind) {
-        return alloc_dind_blk(fs, iinode, bg, &inode->i_block[13], err);
+        return alloc_dind_blk(fs, iinode, bg, goal, &inode->i_block[13], err);
     }
 
     blocks -= blocks_per_ind;
@@ -845,20 +913,21 @@ uint8_t *ext2_inode_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode,
                 return NULL;
 
             /* Allocate the data block. */
-            if((buf = alloc_direct_blk(fs, iinode, bg, &ind[blocks], err)))
+            if((buf = alloc_direct_blk(fs, iinode, bg, goal, &ind[blocks],
+                                       err)))
                 ext2_block_mark_dirty(fs, ind2[ibn]);
 
             return buf;
         }
         else {
-            if((buf = alloc_ind_blk(fs, iinode, bg, &ind2[ibn], err)))
+            if((buf = alloc_ind_blk(fs, iinode, bg, goal, &ind2[ibn], err)))
                 ext2_block_mark_dirty(fs, inode->i_block[13]);
 
             return buf;
         }
     }
     else if(blocks == (blocks_per_ind * blocks_per_ind)) {
-        return alloc_tind_blk(fs, iinode, bg, &inode->i_block[14], err);
+        return alloc_tind_blk(fs, iinode, bg, goal, &inode->i_block[14], err);
     }
 
     /* So, it comes to this... */
@@ -878,7 +947,7 @@ uint8_t *ext2_inode_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode,
         if(!(ind3 = (uint32_t *)ext2_block_read(fs, inode->i_block[14], err)))
             return NULL;
 
-        if((buf = alloc_dind_blk(fs, iinode, bg, &ind3[ibn3], err)))
+        if((buf = alloc_dind_blk(fs, iinode, bg, goal, &ind3[ibn3], err)))
             ext2_block_mark_dirty(fs, inode->i_block[14]);
 
         return buf;
@@ -891,7 +960,7 @@ uint8_t *ext2_inode_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode,
         if(!(ind2 = (uint32_t *)ext2_block_read(fs, ind3[ibn3], err)))
             return NULL;
 
-        if((buf = alloc_ind_blk(fs, iinode, bg, &ind2[ibn2], err)))
+        if((buf = alloc_ind_blk(fs, iinode, bg, goal, &ind2[ibn2], err)))
             ext2_block_mark_dirty(fs, ind3[ibn3]);
 
         return buf;
@@ -907,7 +976,7 @@ uint8_t *ext2_inode_alloc_block(ext2_fs_t *fs, ext2_inode_t *inode,
         if(!(ind = (uint32_t *)ext2_block_read(fs, ind2[ibn2], err)))
             return NULL;
 
-        if((buf = alloc_direct_blk(fs, iinode, bg, &ind[ibn], err)))
+        if((buf = alloc_direct_blk(fs, iinode, bg, goal, &ind[ibn], err)))
             ext2_block_mark_dirty(fs, ind2[ibn2]);
 
         return buf;
@@ -1091,6 +1160,13 @@ int ext2_inode_by_path(ext2_fs_t *fs, const char *path, ext2_inode_t **rv,
             return -ENOTDIR;
         }
 
+        /* Use the directory's index, if it has one, to go straight to the
+           block the entry would be in. */
+        if((i = ext2_dir_htree_lookup(fs, inode, token, &dent)) == 1)
+            goto next_token;
+        else if(!i)
+            goto out;
+
         blocks = inode->i_blocks / (2 << fs->sb.s_log_block_size);
 
         /* Run through any direct blocks in the inode. */
@@ -1278,9 +1354,12 @@ next_token:
     return 0;
 }
 
-uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
-                               uint32_t block_num, uint32_t *r_block,
-                               int *err) {
+/* Find the entry mapping a block of an inode's data, in the inode itself or
+   in an indirect block, along with how many entries there are from it to the
+   end of that table. */
+static int inode_block_ptr(ext2_fs_t *fs, const ext2_inode_t *inode,
+                           uint32_t block_num, const uint32_t **rv,
+                           uint32_t *left, int *err) {
     uint32_t blks_per_ind, ibn;
     uint32_t *iblock;
     int shift = 1 + fs->sb.s_log_block_size;
@@ -1295,15 +1374,14 @@ uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
     /* Check to be sure we're not being asked to do something stupid... */
     if((block_num << (shift + 9)) >= sz) {
         *err = EINVAL;
-        return NULL;
+        return -1;
     }
 
     /* If we're reading a direct block, this is easy. */
     if(block_num < 12) {
-        if(r_block)
-            *r_block = inode->i_block[block_num];
-
-        return ext2_block_read(fs, inode->i_block[block_num], err);
+        *rv = &inode->i_block[block_num];
+        *left = 12 - block_num;
+        return 0;
     }
 
     blks_per_ind = fs->block_size >> 2;
@@ -1312,63 +1390,134 @@ uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
     /* Are we looking at the singly-indirect block? */
     if(block_num < blks_per_ind) {
         if(!(iblock = (uint32_t *)ext2_block_read(fs, inode->i_block[12], err)))
-            return NULL;
-
-        if(r_block)
-            *r_block = iblock[block_num];
+            return -1;
 
-        return ext2_block_read(fs, iblock[block_num], err);
+        *rv = &iblock[block_num];
+        *left = blks_per_ind - block_num;
+        return 0;
     }
 
     /* Ok, we're looking at at least a doubly-indirect block... */
     block_num -= blks_per_ind;
     if(block_num < (blks_per_ind * blks_per_ind)) {
         if(!(iblock = (uint32_t *)ext2_block_read(fs, inode->i_block[13], err)))
-            return NULL;
+            return -1;
 
         /* Figure out what entry we want in here... */
         ibn = block_num / blks_per_ind;
         block_num %= blks_per_ind;
 
         if(!(iblock = (uint32_t *)ext2_block_read(fs, iblock[ibn], err)))
-            return NULL;
+            return -1;
 
         /* Ok... Now we should be good to go. */
-        if(r_block)
-            *r_block = iblock[block_num];
-
-        return ext2_block_read(fs, iblock[block_num], err);
+        *rv = &iblock[block_num];
+        *left = blks_per_ind - block_num;
+        return 0;
     }
 
     /* Ugh... You're going to make me look at a triply-indirect block now? */
     block_num -= blks_per_ind * blks_per_ind;
     if(!(iblock = (uint32_t *)ext2_block_read(fs, inode->i_block[14], err)))
-        return NULL;
+        return -1;
 
     /* Figure out what entry we want in here... */
     ibn = block_num / blks_per_ind;
     block_num %= blks_per_ind;
 
     if(!(iblock = (uint32_t *)ext2_block_read(fs, iblock[ibn], err)))
-        return NULL;
+        return -1;
 
     /* And in this one too... */
     ibn = block_num / blks_per_ind;
     block_num %= blks_per_ind;
 
     if(!(iblock = (uint32_t *)ext2_block_read(fs, iblock[ibn], err)))
-        return NULL;
+        return -1;
 
     /* Ok... Now we should be good to go. Finally. */
     if(block_num < blks_per_ind) {
-        if(r_block)
-            *r_block = iblock[block_num];
-
-        return ext2_block_read(fs, iblock[block_num], err);
+        *rv = &iblock[block_num];
+        *left = blks_per_ind - block_num;
+        return 0;
     }
     else {
         /* This really shouldn't happen... */
         *err = EIO;
-        return NULL;
+        return -1;
+    }
+}
+
+/* Find the filesystem block holding a block of an inode's data. */
+static int inode_block_num(ext2_fs_t *fs, const ext2_inode_t *inode,
+                           uint32_t block_num, uint32_t *rv, int *err) {
+    const uint32_t *ptr;
+    uint32_t left;
+
+    if(inode_block_ptr(fs, inode, block_num, &ptr, &left, err))
+        return -1;
+
+    *rv = *ptr;
+    return 0;
+}
+
+int ext2_inode_map_run(ext2_fs_t *fs, const ext2_inode_t *inode,
+                       uint32_t block_num, uint32_t max, uint32_t *r_block,
+                       uint32_t *r_count, int *err) {
+    const uint32_t *ptr;
+    uint32_t left, bn, n = 0;
+    int err2;
+
+    if(inode_block_ptr(fs, inode, block_num, &ptr, &left, err))
+        return -1;
+
+    *r_block = bn = *ptr;
+
+    /* A hole is a run of one, with nothing on the disk to read together. */
+    if(!bn) {
+        *r_count = 1;
+        return 0;
+    }
+
+    /* Walk along the table for as long as each block follows on from the one
+       before, moving on to the next table if this one runs out first. */
+    for(;;) {
+        while(n < max && left && *ptr == bn + n) {
+            ++n;
+            ++ptr;
+            --left;
+        }
+
+        if(n == max || left ||
+           inode_block_ptr(fs, inode, block_num + n, &ptr, &left, &err2))
+            break;
     }
+
+    *r_count = n;
+    return 0;
+}
+
+uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
+                               uint32_t block_num, uint32_t *r_block,
+                               int *err) {
+    uint32_t bn;
+
+    if(inode_block_num(fs, inode, block_num, &bn, err))
+        return NULL;
+
+    if(r_block)
+        *r_block = bn;
+
+    return ext2_block_read(fs, bn, err);
+}
+
+#ifndef EXT2_NOT_IN_KOS
+void ext2_inode_readahead(ext2_fs_t *fs, const ext2_inode_t *inode,
+                          uint32_t block_num) {
+    uint32_t bn;
+    int err;
+
+    if(!inode_block_num(fs, inode, block_num, &bn, &err))
+        ext2_block_readahead(fs, bn);
 }
+#endif
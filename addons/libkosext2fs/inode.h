@@ -158,6 +158,22 @@ uint8_t *ext2_inode_read_block(ext2_fs_t *fs, const ext2_inode_t *inode,
                                uint32_t block_num, uint32_t *r_block,
                                int *err);
 
+/* Find the run of an inode's data blocks, starting from block_num and at most
+   max long, that are stored one after another on the disk. The first one's
+   block number goes in *r_block (0 for a hole, which is always a run of one)
+   and the length of the run in *r_count. Returns 0 on success, or -1 with
+   *err set. */
+int ext2_inode_map_run(ext2_fs_t *fs, const ext2_inode_t *inode,
+                       uint32_t block_num, uint32_t max, uint32_t *r_block,
+                       uint32_t *r_count, int *err);
+
+#ifndef EXT2_NOT_IN_KOS
+/* Ask for a block of an inode's data to be read ahead into the block cache.
+   Blocks past the end of the file are ignored. */
+void ext2_inode_readahead(ext2_fs_t *fs, const ext2_inode_t *inode,
+                          uint32_t block_num);
+#endif
+
 /* In symlink.c */
 int ext2_resolve_symlink(ext2_fs_t *fs, ext2_inode_t *inode, char *rv,
                          size_t *rv_len);
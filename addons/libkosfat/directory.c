@@ -31,7 +31,8 @@ char *strtok_r(char *, const char *, char **);
 char *strdup(const char *);
 #endif
 
-static uint16_t longname_buf[256], longname_buf2[256];
+/* Room for the 20 entries of the longest name, each 13 characters. */
+static uint16_t longname_buf[261], longname_buf2[261];
 
 #define DOT_NAME    ".          "
 #define DOTDOT_NAME "..         "
@@ -484,6 +485,379 @@ static int is_component_short(const char *fn) {
     return 1;
 }
 
+/* An index of the names in a directory, so that looking one up is a binary
+   search on a hash of it rather than a walk through the directory converting
+   and comparing every long name on the way. Short names are hashed as they're
+   stored, and long names once converted to lower case, with the bottom bit of
+   the key telling them apart. Matches are checked against the directory
+   itself, so there's no harm in two names hashing the same. */
+typedef struct dir_index_ent {
+    uint32_t key;
+    uint16_t slot;                  /* Entry number of the short name entry */
+    uint16_t nlong;                 /* Long name entries right before it */
+} dir_index_ent_t;
+
+struct fat_dir_index {
+    struct fat_dir_index *next;
+    uint32_t cluster;               /* The directory's first cluster */
+    uint32_t count;                 /* Keys in ents */
+    int usable;                     /* 0 if the directory isn't indexed */
+    fat_chain_t chain;              /* For finding the clusters of entries */
+    dir_index_ent_t *ents;
+};
+
+static uint32_t name_key(const void *name, size_t len, int lng) {
+    const uint8_t *p = (const uint8_t *)name;
+    uint32_t h = 2166136261U;
+
+    while(len--) {
+        h ^= *p++;
+        h *= 16777619U;
+    }
+
+    return (h & ~1U) | (lng ? 1 : 0);
+}
+
+static int index_ent_cmp(const void *a, const void *b) {
+    const dir_index_ent_t *ea = (const dir_index_ent_t *)a;
+    const dir_index_ent_t *eb = (const dir_index_ent_t *)b;
+
+    if(ea->key != eb->key)
+        return ea->key < eb->key ? -1 : 1;
+
+    return (int)ea->slot - (int)eb->slot;
+}
+
+static void index_free(struct fat_dir_index *di) {
+    fat_chain_free(&di->chain);
+    free(di->ents);
+    free(di);
+}
+
+void fat_dir_index_clear(fat_fs_t *fs) {
+    struct fat_dir_index *di;
+
+    while((di = fs->dir_index)) {
+        fs->dir_index = di->next;
+        index_free(di);
+    }
+}
+
+static int index_add(struct fat_dir_index *di, uint32_t *max, uint32_t key,
+                     uint32_t slot, uint32_t nlong) {
+    dir_index_ent_t *tmp;
+
+    if(di->count == *max) {
+        *max = *max ? *max * 2 : 64;
+
+        if(!(tmp = (dir_index_ent_t *)realloc(di->ents, *max *
+                                              sizeof(dir_index_ent_t))))
+            return -ENOMEM;
+
+        di->ents = tmp;
+    }
+
+    di->ents[di->count].key = key;
+    di->ents[di->count].slot = (uint16_t)slot;
+    di->ents[di->count].nlong = (uint16_t)nlong;
+    ++di->count;
+    return 0;
+}
+
+/* Find where an entry of an indexed directory is. */
+static int index_slot(fat_fs_t *fs, struct fat_dir_index *di, uint32_t slot,
+                      uint32_t *cl, uint32_t *off) {
+    uint32_t per, count;
+    int err;
+
+    if(di->cluster & 0x80000000) {
+        per = fs->sb.bytes_per_sector >> 5;
+        *cl = di->cluster + slot / per;
+    }
+    else {
+        per = (fs->sb.bytes_per_sector * fs->sb.sectors_per_cluster) >> 5;
+
+        if((err = fat_chain_map(fs, &di->chain, di->cluster, slot / per, 1, cl,
+                                &count)))
+            return err == -EDOM ? -EIO : err;
+    }
+
+    *off = (slot % per) << 5;
+    return 0;
+}
+
+/* Go through a whole directory, hashing each of its names. */
+static int index_build(fat_fs_t *fs, struct fat_dir_index *di) {
+    uint8_t *cl;
+    uint32_t cluster = di->cluster, i, max, slot = 0, keys = 0, n = 0, want = 0;
+    int32_t max2 = 0x7FFFFFFF;
+    fat_dentry_t *ent;
+    fat_longname_t *lent;
+    size_t len;
+    int err;
+
+    if(fs->sb.fs_type == FAT_FS_FAT32 || !(cluster & 0x80000000)) {
+        max = (fs->sb.bytes_per_sector * fs->sb.sectors_per_cluster) >> 5;
+    }
+    else {
+        max = fs->sb.bytes_per_sector >> 5;
+        max2 = (int32_t)fs->sb.root_dir;
+    }
+
+    for(;;) {
+        if(!(cl = fat_cluster_read(fs, cluster, &err)))
+            return -EIO;
+
+        for(i = 0; i < max; ++i, ++slot) {
+            ent = (fat_dentry_t *)(cl + (i << 5));
+
+            /* Past what the entry numbers can hold, don't bother. */
+            if(slot > 0xFFFF)
+                return -EFBIG;
+
+            if(ent->name[0] == FAT_ENTRY_EOD)
+                return 0;
+
+            if(ent->name[0] == FAT_ENTRY_FREE) {
+                n = want = 0;
+                continue;
+            }
+
+            if(FAT_IS_LONG_NAME(ent)) {
+                lent = (fat_longname_t *)ent;
+
+                /* Long names are stored last part first, counting down. */
+                if(lent->order & FAT_ORDER_LAST) {
+                    n = lent->order & 0x3F;
+                    want = n;
+
+                    if(n > 20)
+                        n = want = 0;
+                    else
+                        longname_buf[n * 13] = 0;
+                }
+
+                if(!want || (lent->order & 0x3F) != want) {
+                    n = want = 0;
+                    continue;
+                }
+
+                --want;
+                memcpy(&longname_buf[want * 13], lent->name1, 10);
+                memcpy(&longname_buf[want * 13 + 5], lent->name2, 12);
+                memcpy(&longname_buf[want * 13 + 11], lent->name3, 4);
+                continue;
+            }
+
+            if((err = index_add(di, &keys, name_key(ent->name, 11, 0), slot,
+                                0)))
+                return err;
+
+            /* If a whole long name came right before this, it's this entry's
+               long name. */
+            if(n && !want) {
+                len = fat_strlen_ucs2(longname_buf);
+                fat_ucs2_tolower(longname_buf, len);
+
+                if((err = index_add(di, &keys, name_key(longname_buf, len *
+                                                        sizeof(uint16_t), 1),
+                                    slot, n)))
+                    return err;
+            }
+
+            n = want = 0;
+        }
+
+        if(!(cluster & 0x80000000)) {
+            cluster = fat_read_fat(fs, cluster, &err);
+
+            if(cluster == 0xFFFFFFFF)
+                return -err;
+
+            if(fat_is_eof(fs, cluster))
+                return 0;
+        }
+        else {
+            ++cluster;
+            max2 -= max;
+
+            if(max2 <= 0)
+                return 0;
+        }
+    }
+}
+
+/* Get the index of a directory, making it if need be. */
+static struct fat_dir_index *index_get(fat_fs_t *fs, uint32_t cluster) {
+    struct fat_dir_index *di, **pp;
+    int n = 0;
+
+    for(pp = &fs->dir_index; (di = *pp); pp = &di->next, ++n) {
+        if(di->cluster == cluster) {
+            /* Move it to the front of the list. */
+            *pp = di->next;
+            di->next = fs->dir_index;
+            fs->dir_index = di;
+            return di;
+        }
+
+        /* Drop the least recently used one to make room. */
+        if(n == FAT_DIR_INDEX_DIRS - 1 && !di->next) {
+            *pp = NULL;
+            index_free(di);
+            break;
+        }
+    }
+
+    if(!(di = (struct fat_dir_index *)calloc(1, sizeof(*di))))
+        return NULL;
+
+    di->cluster = cluster;
+
+    /* Small directories are just searched through, as is any that couldn't
+       be indexed. */
+    if(!index_build(fs, di) && di->count >= FAT_DIR_INDEX_MIN) {
+        di->usable = 1;
+        qsort(di->ents, di->count, sizeof(dir_index_ent_t), index_ent_cmp);
+    }
+    else {
+        free(di->ents);
+        di->ents = NULL;
+        di->count = 0;
+    }
+
+    di->next = fs->dir_index;
+    fs->dir_index = di;
+    return di;
+}
+
+/* Check whether an indexed entry is the one named. */
+static int index_check(fat_fs_t *fs, struct fat_dir_index *di,
+                       const dir_index_ent_t *ie, const char comp[11],
+                       size_t len, fat_dentry_t *rv, uint32_t *rcl,
+                       uint32_t *roff, uint32_t *rlcl, uint32_t *rloff) {
+    fat_longname_t lent;
+    uint32_t cl, off, i, j;
+
+    /* Put the long name back together first, if it's got one. */
+    for(i = 0; i < ie->nlong; ++i) {
+        if(index_slot(fs, di, ie->slot - ie->nlong + i, &cl, &off) ||
+           fat_get_dentry(fs, cl, off, (fat_dentry_t *)&lent))
+            return 0;
+
+        if(!i) {
+            *rlcl = cl;
+            *rloff = off;
+        }
+
+        j = (lent.order & 0x3F) - 1;
+
+        if(!FAT_IS_LONG_NAME(&lent) || j >= ie->nlong)
+            return 0;
+
+        memcpy(&longname_buf[j * 13], lent.name1, 10);
+        memcpy(&longname_buf[j * 13 + 5], lent.name2, 12);
+        memcpy(&longname_buf[j * 13 + 11], lent.name3, 4);
+    }
+
+    if(ie->nlong) {
+        longname_buf[ie->nlong * 13] = 0;
+
+        if(fat_strlen_ucs2(longname_buf) != len)
+            return 0;
+
+        fat_ucs2_tolower(longname_buf, len);
+
+        if(memcmp(longname_buf, longname_buf2, len * sizeof(uint16_t)))
+            return 0;
+    }
+
+    if(index_slot(fs, di, ie->slot, &cl, &off) ||
+       fat_get_dentry(fs, cl, off, rv))
+        return 0;
+
+    if(rv->name[0] == FAT_ENTRY_EOD || rv->name[0] == FAT_ENTRY_FREE ||
+       FAT_IS_LONG_NAME(rv) || (!ie->nlong && memcmp(rv->name, comp, 11)))
+        return 0;
+
+    if(!ie->nlong)
+        *rlcl = *rloff = 0;
+
+    *rcl = cl;
+    *roff = off;
+    return 1;
+}
+
+/* Look a name up in a directory's index. Returns 1 if the directory isn't
+   indexed, so it has to be searched instead. */
+static int index_lookup(fat_fs_t *fs, const char *fn, const char comp[11],
+                        uint32_t cluster, fat_dentry_t *rv, uint32_t *rcl,
+                        uint32_t *roff, uint32_t *rlcl, uint32_t *rloff) {
+    struct fat_dir_index *di;
+    uint32_t key, lo, hi, mid;
+    size_t len = 0;
+
+    if(!(di = index_get(fs, cluster)) || !di->usable)
+        return 1;
+
+    if(comp) {
+        key = name_key(comp, 11, 0);
+    }
+    else {
+        if(fat_utf8_to_ucs2(longname_buf2, (const uint8_t *)fn, 256,
+                            strlen(fn)))
+            return 1;
+
+        len = fat_strlen_ucs2(longname_buf2);
+        fat_ucs2_tolower(longname_buf2, len);
+        key = name_key(longname_buf2, len * sizeof(uint16_t), 1);
+    }
+
+    /* Find the first entry with the key, then check each with it in turn. */
+    for(lo = 0, hi = di->count; lo < hi;) {
+        mid = (lo + hi) / 2;
+
+        if(di->ents[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for(; lo < di->count && di->ents[lo].key == key; ++lo) {
+        if(index_check(fs, di, &di->ents[lo], comp, len, rv, rcl, roff, rlcl,
+                       rloff))
+            return 0;
+    }
+
+    return -ENOENT;
+}
+
+/* Find one component of a path in a directory. */
+static int search_component(fat_fs_t *fs, const char *fn, uint32_t cluster,
+                            fat_dentry_t *rv, uint32_t *rcl, uint32_t *roff,
+                            uint32_t *rlcl, uint32_t *rloff) {
+    char comp[11];
+    int err;
+
+    if(is_component_short(fn)) {
+        normalize_shortname(fn, comp);
+
+        if((err = index_lookup(fs, fn, comp, cluster, rv, rcl, roff, rlcl,
+                               rloff)) <= 0)
+            return err;
+
+        *rlcl = 0;
+        *rloff = 0;
+        return fat_search_dir(fs, comp, cluster, rv, rcl, roff);
+    }
+
+    if((err = index_lookup(fs, fn, NULL, cluster, rv, rcl, roff, rlcl,
+                           rloff)) <= 0)
+        return err;
+
+    return fat_search_long(fs, fn, cluster, rv, rcl, roff, rlcl, rloff);
+}
+
 static int fat_find_child2(fat_fs_t *fs, const char fn[11],
                            fat_dentry_t *parent) {
     uint32_t cl;
@@ -497,31 +871,16 @@ static int fat_find_child2(fat_fs_t *fs, const char fn[11],
 int fat_find_child(fat_fs_t *fs, const char *fn, fat_dentry_t *parent,
                    fat_dentry_t *rv, uint32_t *rcl, uint32_t *roff,
                    uint32_t *rlcl, uint32_t *rloff) {
-    char *fnc = strdup(fn), comp[11];
     uint32_t cl;
-    int err;
 
     cl = parent->cluster_low | (parent->cluster_high << 16);
-
-    if(is_component_short(fnc)) {
-        normalize_shortname(fnc, comp);
-
-        err = fat_search_dir(fs, comp, cl, rv, rcl, roff);
-        *rlcl = 0;
-        *rloff = 0;
-    }
-    else {
-        err = fat_search_long(fs, fnc, cl, rv, rcl, roff, rlcl, rloff);
-    }
-
-    free(fnc);
-    return err;
+    return search_component(fs, fn, cl, rv, rcl, roff, rlcl, rloff);
 }
 
 int fat_find_dentry(fat_fs_t *fs, const char *fn, fat_dentry_t *rv,
                     uint32_t *rcl, uint32_t *roff, uint32_t *rlcl,
                     uint32_t *rloff) {
-    char *fnc = strdup(fn), comp[11], *tmp, *tok;
+    char *fnc = strdup(fn), *tmp, *tok;
     int err = -ENOENT;
     fat_dentry_t cur;
     uint32_t cl, off, lcl = 0, loff = 0;
@@ -561,17 +920,9 @@ int fat_find_dentry(fat_fs_t *fs, const char *fn, fat_dentry_t *rv,
             fs->sb.fat_size));
     }
 
-    if(is_component_short(tok)) {
-        normalize_shortname(tok, comp);
-
-        if((err = fat_search_dir(fs, comp, cl, &cur, &cl, &off)) < 0)
-            goto out;
-    }
-    else {
-        if((err = fat_search_long(fs, tok, cl, &cur, &cl, &off, &lcl,
-                                  &loff)) < 0)
-            goto out;
-    }
+    if((err = search_component(fs, tok, cl, &cur, &cl, &off, &lcl,
+                               &loff)) < 0)
+        goto out;
 
     tok = strtok_r(NULL, "/", &tmp);
 
@@ -584,19 +935,9 @@ int fat_find_dentry(fat_fs_t *fs, const char *fn, fat_dentry_t *rv,
 
         cl = cur.cluster_low | (cur.cluster_high << 16);
 
-        if(is_component_short(tok)) {
-            normalize_shortname(tok, comp);
-            lcl = loff = 0;
-
-            if((err = fat_search_dir(fs, comp, cl, &cur, &cl, &off)) < 0) {
-                goto out;
-            }
-        }
-        else {
-            if((err = fat_search_long(fs, tok, cl, &cur, &cl, &off, &lcl,
-                                      &loff)) < 0)
-                goto out;
-        }
+        if((err = search_component(fs, tok, cl, &cur, &cl, &off, &lcl,
+                                   &loff)) < 0)
+            goto out;
 
         tok = strtok_r(NULL, "/", &tmp);
     }
@@ -626,6 +967,9 @@ int fat_erase_dentry(fat_fs_t *fs, uint32_t cl, uint32_t off, uint32_t lcl,
     uint32_t max, max2, i;
     int done = 0, err;
 
+    /* The directory's changing, so forget what's in it. */
+    fat_dir_index_clear(fs);
+
     /* Read the cluster/block where the short name lives. */
     if(!(buf = fat_cluster_read(fs, cl, &err))) {
         dbglog(DBG_ERROR, "Error reading directory entry at cluster %" PRIu32
@@ -1287,6 +1631,9 @@ int fat_add_dentry(fat_fs_t *fs, const char *fn, fat_dentry_t *parent,
 
     cl = parent->cluster_low | (parent->cluster_high << 16);
 
+    /* The directory's changing, so forget what's in it. */
+    fat_dir_index_clear(fs);
+
     if(is_component_short(fn)) {
         normalize_shortname(fn, comp);
 
@@ -67,6 +67,7 @@ int fat_find_child(fat_fs_t *fs, const char *fn, fat_dentry_t *parent,
 int fat_erase_dentry(fat_fs_t *fs, uint32_t cl, uint32_t off, uint32_t lcl,
                      uint32_t loff);
 int fat_is_dir_empty(fat_fs_t *fs, uint32_t cluster);
+void fat_dir_index_clear(fat_fs_t *fs);
 int fat_add_dentry(fat_fs_t *fs, const char *fn, fat_dentry_t *parent,
                    uint8_t attr, uint32_t cluster, uint32_t *rcl,
                    uint32_t *roff, uint32_t *rlcl, uint32_t *rloff);
@@ -4,6 +4,7 @@
    Copyright (C) 2012, 2013, 2019 Lawrence Sebald
 */
 
+#include <malloc.h>
 #include <stdio.h>
 #include <errno.h>
 #include <stdint.h>
@@ -14,26 +15,6 @@
 #include "fatfs.h"
 #include "fatinternal.h"
 
-/* This is basically the same as bgrad_cache from fs_iso9660 */
-static void make_mru(fat_fs_t *fs, fat_cache_t **cache, int block) {
-    int i;
-    fat_cache_t *tmp;
-
-    /* Don't try it with the end block */
-    if(block < 0 || block >= fs->cache_size - 1)
-        return;
-
-    /* Make a copy and scoot everything down */
-    tmp = cache[block];
-
-    for(i = block; i < fs->cache_size - 1; ++i) {
-        cache[i] = cache[i + 1];
-    }
-
-    cache[fs->cache_size - 1] = tmp;
-}
-
-
 static int fat_fatblock_read_nc(fat_fs_t *fs, uint32_t bn, uint8_t *rv) {
     if(fs->sb.fat_size <= bn)
         return -EINVAL;
@@ -44,6 +25,9 @@ static int fat_fatblock_read_nc(fat_fs_t *fs, uint32_t bn, uint8_t *rv) {
     return 0;
 }
 
+/* Whether a cluster is marked free in the free cluster map. */
+#define MAP_FREE(fs, cl)    ((fs)->free_map[(cl) >> 5] & (1U << ((cl) & 31)))
+
 static int fat_fatblock_write_nc(fat_fs_t *fs, uint32_t bn,
                                  const uint8_t *blk) {
     if(fs->sb.fat_size <= bn)
@@ -55,6 +39,93 @@ static int fat_fatblock_write_nc(fat_fs_t *fs, uint32_t bn,
     return 0;
 }
 
+#ifndef FAT_NOT_IN_KOS
+static int fatblock_read_cb(void *ctx, uint32_t bn, void *buf) {
+    return fat_fatblock_read_nc((fat_fs_t *)ctx, bn, (uint8_t *)buf);
+}
+
+static int fatblock_write_cb(void *ctx, uint32_t bn, void *buf) {
+    return fat_fatblock_write_nc((fat_fs_t *)ctx, bn, (const uint8_t *)buf);
+}
+
+/* Read FAT blocks straight from the device, without filling the cache with
+   them, but taking any that are in the cache from there. */
+static int fat_fatblock_read_run(fat_fs_t *fs, uint32_t bn, uint32_t count,
+                                 uint8_t *buf) {
+    uint32_t i;
+    uint8_t *blk;
+
+    if(fs->sb.fat_size < bn + count)
+        return -EINVAL;
+
+    if(fs->dev->read_blocks(fs->dev, bn, count, buf))
+        return -EIO;
+
+    for(i = 0; i < count; ++i) {
+        if((blk = bcache_lookup(fs->fcache, bn + i)))
+            memcpy(buf + i * fs->sb.bytes_per_sector, blk,
+                   fs->sb.bytes_per_sector);
+    }
+
+    return 0;
+}
+
+bcache_t *fat_fatblock_cache_create(fat_fs_t *fs, int fcache_sz) {
+    /* FAT12 entries can span two blocks, so at least two are needed. */
+    if(fcache_sz < 2)
+        fcache_sz = 2;
+
+    return bcache_create(fs->sb.bytes_per_sector, fcache_sz, fatblock_read_cb,
+                         (fs->mnt_flags & FAT_MNT_FLAG_RW) ?
+                         fatblock_write_cb : NULL, fs);
+}
+
+static uint8_t *fat_read_fatblock(fat_fs_t *fs, uint32_t block, int *err) {
+    uint8_t *rv;
+
+    if(!(rv = bcache_read(fs->fcache, block)))
+        *err = EIO;
+
+    return rv;
+}
+
+static int fat_fatblock_mark_dirty(fat_fs_t *fs, uint32_t bn) {
+    if(bcache_mark_dirty(fs->fcache, bn))
+        return -EINVAL;
+
+    return 0;
+}
+
+int fat_fatblock_cache_wb(fat_fs_t *fs) {
+    /* Don't even bother if we're mounted read-only. */
+    if(!(fs->mnt_flags & FAT_MNT_FLAG_RW))
+        return 0;
+
+    if(bcache_sync(fs->fcache))
+        return -EIO;
+
+    return 0;
+}
+#else
+/* This is basically the same as bgrad_cache from fs_iso9660 */
+static void make_mru(fat_fs_t *fs, fat_cache_t **cache, int block) {
+    int i;
+    fat_cache_t *tmp;
+
+    /* Don't try it with the end block */
+    if(block < 0 || block >= fs->cache_size - 1)
+        return;
+
+    /* Make a copy and scoot everything down */
+    tmp = cache[block];
+
+    for(i = block; i < fs->cache_size - 1; ++i) {
+        cache[i] = cache[i + 1];
+    }
+
+    cache[fs->cache_size - 1] = tmp;
+}
+
 static uint8_t *fat_read_fatblock(fat_fs_t *fs, uint32_t block, int *err) {
     int i;
     uint8_t *rv;
@@ -139,6 +210,22 @@ int fat_fatblock_cache_wb(fat_fs_t *fs) {
     return 0;
 }
 
+static int fat_fatblock_read_run(fat_fs_t *fs, uint32_t bn, uint32_t count,
+                                 uint8_t *buf) {
+    uint8_t *blk;
+    int err;
+
+    for(; count; --count, ++bn, buf += fs->sb.bytes_per_sector) {
+        if(!(blk = fat_read_fatblock(fs, bn, &err)))
+            return -err;
+
+        memcpy(buf, blk, fs->sb.bytes_per_sector);
+    }
+
+    return 0;
+}
+#endif /* !FAT_NOT_IN_KOS */
+
 uint32_t fat_read_fat(fat_fs_t *fs, uint32_t cl, int *err) {
     uint32_t sn, off, val;
     const uint8_t *blk, *blk2;
@@ -214,7 +301,7 @@ uint32_t fat_read_fat(fat_fs_t *fs, uint32_t cl, int *err) {
 }
 
 int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
-    uint32_t sn, off;
+    uint32_t sn, off, ocl = cl;
     uint8_t *blk, *blk2;
     int err;
 
@@ -222,6 +309,15 @@ int fat_write_fat(fat_fs_t *fs, uint32_t cl, uint32_t val) {
     if(!(fs->mnt_flags & FAT_MNT_FLAG_RW))
         return -EROFS;
 
+    /* Keep the free cluster map up to date with the part of the FAT it's been
+       built from. */
+    if(fs->free_map && ocl < fs->free_map_next) {
+        if(val & 0x0FFFFFFF)
+            fs->free_map[ocl >> 5] &= ~(1U << (ocl & 31));
+        else
+            fs->free_map[ocl >> 5] |= 1U << (ocl & 31);
+    }
+
     /* Figure out what sector the value is on... */
     switch(fs->sb.fs_type) {
         case FAT_FS_FAT32:
@@ -338,6 +434,11 @@ uint32_t fat_allocate_cluster(fat_fs_t *fs, int *err) {
         return FAT_INVALID_CLUSTER;
     }
 
+    /* With the free cluster map complete, there's no need to search the FAT
+       for one. */
+    if(fs->free_map && fs->free_map_next >= fs->sb.num_clusters + 2)
+        return fat_allocate_cluster_after(fs, 0, 1, err);
+
     i = fs->sb.last_alloc_cluster + 1;
     last = fs->sb.num_clusters + 2;
 
@@ -522,3 +623,296 @@ int fat_erase_chain(fat_fs_t *fs, uint32_t cluster) {
 
     return 0;
 }
+
+static int chain_append(fat_chain_t *ch, uint32_t cl) {
+    fat_run_t *r;
+    uint32_t n;
+
+    if(ch->nruns) {
+        r = &ch->runs[ch->nruns - 1];
+
+        if(r->cluster + r->count == cl) {
+            ++r->count;
+            ++ch->count;
+            return 0;
+        }
+    }
+
+    if(ch->nruns == ch->maxruns) {
+        n = ch->maxruns ? ch->maxruns * 2 : 8;
+
+        if(!(r = (fat_run_t *)realloc(ch->runs, n * sizeof(fat_run_t))))
+            return -ENOMEM;
+
+        ch->runs = r;
+        ch->maxruns = n;
+    }
+
+    r = &ch->runs[ch->nruns++];
+    r->order = ch->count++;
+    r->cluster = cl;
+    r->count = 1;
+
+    return 0;
+}
+
+int fat_chain_map(fat_fs_t *fs, fat_chain_t *ch, uint32_t first,
+                  uint32_t order, uint32_t max, uint32_t *cl,
+                  uint32_t *count) {
+    const fat_run_t *r;
+    uint32_t lo, hi, mid, last, next;
+    int err;
+
+    /* Start over if the file has been given a new first cluster. */
+    if(ch->first != first || !ch->nruns) {
+        ch->first = first;
+        ch->count = ch->nruns = 0;
+
+        if((err = chain_append(ch, first)) < 0)
+            return err;
+    }
+
+    /* Read in the chain up to the cluster we want, and then on through the run
+       it's in for as far as we've been asked. */
+    while(ch->count <= order ||
+          (ch->runs[ch->nruns - 1].order <= order &&
+           ch->count - order < max)) {
+        r = &ch->runs[ch->nruns - 1];
+        last = r->cluster + r->count - 1;
+        next = fat_read_fat(fs, last, &err);
+
+        if(next == FAT_INVALID_CLUSTER)
+            return -err;
+        else if(fat_is_eof(fs, next) || next < 2)
+            break;
+
+        if((err = chain_append(ch, next)) < 0)
+            return err;
+    }
+
+    if(ch->count <= order) {
+        r = &ch->runs[ch->nruns - 1];
+        *cl = r->cluster + r->count - 1;
+        *count = ch->count;
+        return -EDOM;
+    }
+
+    /* Find the run it's in. */
+    lo = 0;
+    hi = ch->nruns - 1;
+
+    while(lo < hi) {
+        mid = (lo + hi + 1) / 2;
+
+        if(ch->runs[mid].order <= order)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    r = &ch->runs[lo];
+    *cl = r->cluster + (order - r->order);
+    *count = r->count - (order - r->order);
+
+    if(*count > max)
+        *count = max;
+
+    return 0;
+}
+
+void fat_chain_free(fat_chain_t *ch) {
+    free(ch->runs);
+    memset(ch, 0, sizeof(fat_chain_t));
+}
+
+/* Find the first cluster in [from, to) that starts a run of at least want free
+   ones, or return 0 if there isn't one. */
+static uint32_t map_find(const fat_fs_t *fs, uint32_t from, uint32_t to,
+                         uint32_t want) {
+    uint32_t cl = from, start = 0, len = 0;
+
+    while(cl < to) {
+        /* Skip over whole words of clusters in use at once. */
+        if(!(cl & 31) && !fs->free_map[cl >> 5]) {
+            len = 0;
+            cl += 32;
+            continue;
+        }
+
+        if(MAP_FREE(fs, cl)) {
+            if(!len++)
+                start = cl;
+
+            if(len >= want)
+                return start;
+        }
+        else {
+            len = 0;
+        }
+
+        ++cl;
+    }
+
+    return 0;
+}
+
+uint32_t fat_allocate_cluster_after(fat_fs_t *fs, uint32_t prev, uint32_t want,
+                                    int *err) {
+    uint32_t end = fs->sb.num_clusters + 2, hint, cl = 0, eoc;
+    int rv;
+
+    if(!fs->free_map || fs->free_map_next < end)
+        return fat_allocate_cluster(fs, err);
+
+    /* Don't let us write to the FAT if we're on a read-only FS. */
+    if(!(fs->mnt_flags & FAT_MNT_FLAG_RW)) {
+        *err = EROFS;
+        return FAT_INVALID_CLUSTER;
+    }
+
+    /* Carry on from where the last allocation was, as the FSinfo sector's hint
+       says to (where there is one). */
+    hint = fs->sb.last_alloc_cluster + 1;
+
+    if(hint < 2 || hint >= end)
+        hint = 2;
+
+    /* Keep the file contiguous if we can, then look for somewhere it can be
+       for as much as it's going to need, then settle for anywhere at all. */
+    if(prev >= 2 && prev + 1 < end && MAP_FREE(fs, prev + 1))
+        cl = prev + 1;
+
+    if(!cl && want > 1 && !(cl = map_find(fs, hint, end, want)))
+        cl = map_find(fs, 2, hint, want);
+
+    if(!cl && !(cl = map_find(fs, hint, end, 1)))
+        cl = map_find(fs, 2, hint, 1);
+
+    if(!cl) {
+        *err = ENOSPC;
+        return FAT_INVALID_CLUSTER;
+    }
+
+    switch(fs->sb.fs_type) {
+        case FAT_FS_FAT32:
+            eoc = 0x0FFFFFFF;
+            break;
+
+        case FAT_FS_FAT16:
+            eoc = 0xFFFF;
+            break;
+
+        default:
+            eoc = 0x0FFF;
+            break;
+    }
+
+    /* Allocate it by adding in an end of chain marker. */
+    if((rv = fat_write_fat(fs, cl, eoc))) {
+        *err = rv < 0 ? -rv : rv;
+        return FAT_INVALID_CLUSTER;
+    }
+
+    fs->sb.last_alloc_cluster = cl;
+    --fs->sb.free_clusters;
+    return cl;
+}
+
+/* How many FAT blocks to read from the device at once while scanning */
+#define MAP_SCAN_CHUNK      16
+
+int fat_free_map_scan(fat_fs_t *fs, uint32_t count) {
+    uint32_t end = fs->sb.num_clusters + 2, cl, val, sn, per, n, i;
+    uint32_t bps = fs->sb.bytes_per_sector;
+    uint8_t *buf, *ent;
+    int err = 0;
+
+    /* Nothing will be allocated on a read-only filesystem. */
+    if(!(fs->mnt_flags & FAT_MNT_FLAG_RW))
+        return 1;
+
+    if(!fs->free_map) {
+        if(!(fs->free_map = (uint32_t *)calloc((end + 31) >> 5,
+                                               sizeof(uint32_t))))
+            return -ENOMEM;
+
+        /* Clusters 0 and 1 are never free. */
+        fs->free_map_next = 2;
+    }
+
+    if(fs->free_map_next >= end)
+        return 1;
+
+    if(fs->sb.fs_type == FAT_FS_FAT12) {
+        /* FAT12 entries straddle blocks, and there are never very many of
+           them, so just look at each one in turn. */
+        for(n = count * bps * 2 / 3; n && fs->free_map_next < end; --n) {
+            cl = fs->free_map_next;
+            val = fat_read_fat(fs, cl, &err);
+
+            if(val == FAT_INVALID_CLUSTER)
+                return -err;
+            else if(!val)
+                fs->free_map[cl >> 5] |= 1U << (cl & 31);
+
+            ++fs->free_map_next;
+        }
+    }
+    else {
+        per = fs->sb.fs_type == FAT_FS_FAT32 ? 4 : 2;
+
+        if(!(buf = (uint8_t *)memalign(32, MAP_SCAN_CHUNK * bps)))
+            return -ENOMEM;
+
+        while(count && fs->free_map_next < end) {
+            cl = fs->free_map_next;
+            sn = (cl * per) / bps;
+            n = ((end - 1) * per) / bps - sn + 1;
+
+            if(n > count)
+                n = count;
+
+            if(n > MAP_SCAN_CHUNK)
+                n = MAP_SCAN_CHUNK;
+
+            if((err = fat_fatblock_read_run(fs, fs->sb.reserved_sectors + sn,
+                                            n, buf)) < 0) {
+                free(buf);
+                return err;
+            }
+
+            /* Go through the entries from this cluster to the end of what was
+               read (or of the FAT). */
+            i = (cl * per) - sn * bps;
+
+            for(; i < n * bps && cl < end; i += per, ++cl) {
+                ent = buf + i;
+
+                if(per == 4)
+                    val = (ent[0] | (ent[1] << 8) | (ent[2] << 16) |
+                           (ent[3] << 24)) & 0x0FFFFFFF;
+                else
+                    val = ent[0] | (ent[1] << 8);
+
+                if(!val)
+                    fs->free_map[cl >> 5] |= 1U << (cl & 31);
+            }
+
+            fs->free_map_next = cl;
+            count -= n;
+        }
+
+        free(buf);
+    }
+
+    if(fs->free_map_next < end)
+        return 0;
+
+    /* It's complete, so now we know exactly how many clusters are free, even
+       if the FSinfo sector didn't. */
+    for(i = n = 0; i < (end + 31) >> 5; ++i)
+        n += __builtin_popcount(fs->free_map[i]);
+
+    fs->sb.free_clusters = n;
+    return 1;
+}
@@ -15,7 +15,88 @@
 #include "fatfs.h"
 #include "bpb.h"
 #include "fatinternal.h"
+#include "directory.h"
 
+#ifndef FAT_NOT_IN_KOS
+static int cluster_read_cb(void *ctx, uint32_t cl, void *buf) {
+    return fat_cluster_read_nc((fat_fs_t *)ctx, cl, (uint8_t *)buf);
+}
+
+static int cluster_write_cb(void *ctx, uint32_t cl, void *buf) {
+    return fat_cluster_write_nc((fat_fs_t *)ctx, cl, (const uint8_t *)buf);
+}
+
+uint8_t *fat_cluster_read(fat_fs_t *fs, uint32_t cl, int *err) {
+    uint8_t *rv;
+
+    if(!(rv = bcache_read(fs->bcache, cl)))
+        *err = EIO;
+
+    return rv;
+}
+
+uint8_t *fat_cluster_clear(fat_fs_t *fs, uint32_t cl, int *err) {
+    uint8_t *rv;
+
+    /* Don't bother reading the cluster from disk, since we're erasing it
+       anyway... */
+    if(!(rv = bcache_get(fs->bcache, cl))) {
+        *err = EIO;
+        return NULL;
+    }
+
+    memset(rv, 0, fs->sb.bytes_per_sector * fs->sb.sectors_per_cluster);
+    bcache_mark_dirty(fs->bcache, cl);
+    return rv;
+}
+
+int fat_cluster_read_run(fat_fs_t *fs, uint32_t cl, uint32_t count,
+                         uint8_t *buf, int *err) {
+    uint32_t spc = fs->sb.sectors_per_cluster;
+    uint32_t bs = fs->sb.bytes_per_sector * spc;
+    uint32_t i, start;
+    uint8_t *blk;
+
+    if(cl < 2 || cl + count > fs->sb.num_clusters + 2) {
+        *err = EINVAL;
+        return -1;
+    }
+
+    /* Clusters in the cache may be newer than what's on the disk, so copy
+       those out of it, and read each stretch of the rest with one request. */
+    for(i = start = 0; i <= count; ++i) {
+        blk = i < count ? bcache_lookup(fs->bcache, cl + i) : NULL;
+
+        if(i < count && !blk)
+            continue;
+
+        if(i > start &&
+           fs->dev->read_blocks(fs->dev, (uint64_t)(cl + start - 2) * spc +
+                                fs->sb.first_data_block,
+                                (size_t)(i - start) * spc, buf + start * bs)) {
+            *err = EIO;
+            return -1;
+        }
+
+        if(blk)
+            memcpy(buf + i * bs, blk, bs);
+
+        start = i + 1;
+    }
+
+    return 0;
+}
+
+void fat_cluster_readahead(fat_fs_t *fs, uint32_t cl) {
+    if(cl >= 2 && cl < fs->sb.num_clusters + 2)
+        bcache_readahead(fs->bcache, cl);
+}
+
+void fat_fs_set_lock(fat_fs_t *fs, mutex_t *lock) {
+    bcache_set_lock(fs->bcache, lock);
+    bcache_set_lock(fs->fcache, lock);
+}
+#else
 /* This is basically the same as bgrad_cache from fs_iso9660 */
 static void make_mru(fat_fs_t *fs, fat_cache_t **cache, int block) {
     int i;
@@ -124,6 +205,22 @@ out:
     return rv;
 }
 
+int fat_cluster_read_run(fat_fs_t *fs, uint32_t cl, uint32_t count,
+                         uint8_t *buf, int *err) {
+    uint32_t bs = fs->sb.bytes_per_sector * fs->sb.sectors_per_cluster;
+    uint8_t *blk;
+
+    for(; count; --count, ++cl, buf += bs) {
+        if(!(blk = fat_cluster_read(fs, cl, err)))
+            return -1;
+
+        memcpy(buf, blk, bs);
+    }
+
+    return 0;
+}
+#endif /* !FAT_NOT_IN_KOS */
+
 int fat_cluster_read_nc(fat_fs_t *fs, uint32_t cluster, uint8_t *rv) {
     int fs_per_block = (int)fs->sb.sectors_per_cluster;
 
@@ -180,6 +277,25 @@ int fat_cluster_write_nc(fat_fs_t *fs, uint32_t cluster, const uint8_t *blk) {
     return 0;
 }
 
+#ifndef FAT_NOT_IN_KOS
+int fat_cluster_mark_dirty(fat_fs_t *fs, uint32_t cluster) {
+    if(bcache_mark_dirty(fs->bcache, cluster))
+        return -EINVAL;
+
+    return 0;
+}
+
+int fat_cluster_cache_wb(fat_fs_t *fs) {
+    /* Don't even bother if we're mounted read-only. */
+    if(!(fs->mnt_flags & FAT_MNT_FLAG_RW))
+        return 0;
+
+    if(bcache_sync(fs->bcache))
+        return -EIO;
+
+    return 0;
+}
+#else
 int fat_cluster_mark_dirty(fat_fs_t *fs, uint32_t cluster) {
     int i;
     fat_cache_t **cache = fs->bcache;
@@ -217,6 +333,7 @@ int fat_cluster_cache_wb(fat_fs_t *fs) {
 
     return 0;
 }
+#endif /* !FAT_NOT_IN_KOS */
 
 static inline uint32_t ilog2(uint32_t i) {
     i |= (i >> 1);
@@ -265,7 +382,9 @@ fat_fs_t *fat_fs_init(kos_blockdev_t *bd, uint32_t flags) {
 fat_fs_t *fat_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz,
                          int fcache_sz) {
     fat_fs_t *rv;
+#ifdef FAT_NOT_IN_KOS
     int j;
+#endif
     int block_size, cluster_size;
 
     if(bd->init(bd)) {
@@ -279,6 +398,9 @@ fat_fs_t *fat_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz,
 
     rv->dev = bd;
     rv->mnt_flags = flags & FAT_MNT_VALID_FLAGS_MASK;
+    rv->free_map = NULL;
+    rv->free_map_next = 0;
+    rv->dir_index = NULL;
 
     if(rv->mnt_flags != flags) {
         dbglog(DBG_WARNING, "fat_fs_init: unknown mount flags: %08" PRIx32
@@ -302,6 +424,30 @@ fat_fs_t *fat_fs_init_ex(kos_blockdev_t *bd, uint32_t flags, int cache_sz,
     cluster_size = rv->sb.bytes_per_sector * rv->sb.sectors_per_cluster;
 
     /* Make space for the block cache. */
+#ifndef FAT_NOT_IN_KOS
+    (void)block_size;
+
+    if(cache_sz < 2)
+        cache_sz = 2;
+
+    if(!(rv->bcache = bcache_create(cluster_size, cache_sz, cluster_read_cb,
+                                    (rv->mnt_flags & FAT_MNT_FLAG_RW) ?
+                                    cluster_write_cb : NULL, rv))) {
+        free(rv);
+        bd->shutdown(bd);
+        return NULL;
+    }
+
+    /* Make space for the FAT block cache. */
+    if(!(rv->fcache = fat_fatblock_cache_create(rv, fcache_sz))) {
+        bcache_destroy(rv->bcache);
+        free(rv);
+        bd->shutdown(bd);
+        return NULL;
+    }
+
+    return rv;
+#else
     if(!(rv->bcache = (fat_cache_t **)malloc(sizeof(fat_cache_t *) *
                                              cache_sz))) {
         free(rv);
@@ -377,6 +523,7 @@ out_cache:
     free(rv);
     bd->shutdown(bd);
     return NULL;
+#endif /* !FAT_NOT_IN_KOS */
 }
 
 int fat_fs_sync(fat_fs_t *fs) {
@@ -415,11 +562,17 @@ int fat_fs_sync(fat_fs_t *fs) {
 }
 
 void fat_fs_shutdown(fat_fs_t *fs) {
+#ifdef FAT_NOT_IN_KOS
     int i;
+#endif
 
     /* Sync the filesystem back to the block device, if needed. */
     fat_fs_sync(fs);
 
+#ifndef FAT_NOT_IN_KOS
+    bcache_destroy(fs->bcache);
+    bcache_destroy(fs->fcache);
+#else
     for(i = 0; i < fs->cache_size; ++i) {
         free(fs->bcache[i]->data);
         free(fs->bcache[i]);
@@ -431,7 +584,10 @@ void fat_fs_shutdown(fat_fs_t *fs) {
         free(fs->fcache[i]->data);
         free(fs->fcache[i]);
     }
+#endif
 
+    free(fs->free_map);
+    fat_dir_index_clear(fs);
     fs->dev->shutdown(fs->dev);
     free(fs);
 }
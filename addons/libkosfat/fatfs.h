@@ -14,6 +14,7 @@ __BEGIN_DECLS
 
 #ifndef FAT_NOT_IN_KOS
 #include <kos/blockdev.h>
+#include <kos/mutex.h>
 #endif
 
 /* Tunable filesystem parameters. These must be set at compile time. */
@@ -32,6 +33,11 @@ __BEGIN_DECLS
    Note that this is a default value for filesystems initialized/mounted with
    fat_fs_init(). If you wish to specify your own value that differs from this
    one, you can do so with the fat_fs_init_ex() function.
+
+   In KOS, both this and the FAT cache below live in the shared block cache
+   (see <kos/bcache.h>), and these are the numbers reserved for each
+   filesystem. Past that, filesystems use as many more as the cache's memory
+   budget lets them.
 */
 #define FAT_CACHE_BLOCKS        8
 
@@ -48,6 +54,20 @@ __BEGIN_DECLS
 */
 #define FAT_FCACHE_BLOCKS       8
 
+/* Number of directories to keep an index of the names of. The first time a
+   name is looked up in a directory, the whole directory is read through and a
+   sorted list of the hashes of its names made, so that later lookups in it are
+   a binary search rather than a scan of every entry. Each index costs 8 bytes
+   per name, and all of them are thrown away whenever an entry is added to or
+   removed from any directory.
+*/
+#define FAT_DIR_INDEX_DIRS      4
+
+/* Least number of names a directory must have to be indexed. Smaller ones are
+   just searched through each time.
+*/
+#define FAT_DIR_INDEX_MIN       32
+
 /* End tunable filesystem parameters. */
 
 /* Convenience stuff, for in case you want to use this outside of KOS. */
@@ -87,10 +107,26 @@ int fat_cluster_read_nc(fat_fs_t *fs, uint32_t cluster, uint8_t *rv);
 uint8_t *fat_cluster_read(fat_fs_t *fs, uint32_t cluster, int *err);
 uint8_t *fat_cluster_clear(fat_fs_t *fs, uint32_t cl, int *err);
 
+/* Read a run of consecutive clusters into buf, taking any that are cached from
+   the cache and reading the rest from the device in as few requests as they
+   allow. Returns 0 on success, or -1 with *err set. */
+int fat_cluster_read_run(fat_fs_t *fs, uint32_t cluster, uint32_t count,
+                         uint8_t *buf, int *err);
+
 int fat_cluster_write_nc(fat_fs_t *fs, uint32_t cluster, const uint8_t *blk);
 
 int fat_cluster_mark_dirty(fat_fs_t *fs, uint32_t cluster);
 
+#ifndef FAT_NOT_IN_KOS
+/* Ask for a cluster to be read into the cache in the background, ahead of it
+   being needed. This only does anything once a lock has been set. */
+void fat_cluster_readahead(fat_fs_t *fs, uint32_t cluster);
+
+/* Set the lock held around all calls on the filesystem, so that the block
+   cache can write back and read ahead its blocks in the background. */
+void fat_fs_set_lock(fat_fs_t *fs, mutex_t *lock);
+#endif
+
 uint32_t fat_block_size(const fat_fs_t *fs);
 uint32_t fat_log_block_size(const fat_fs_t *fs);
 uint32_t fat_cluster_size(const fat_fs_t *fs);
@@ -123,6 +159,52 @@ int fat_is_eof(fat_fs_t *fs, uint32_t cl);
 uint32_t fat_allocate_cluster(fat_fs_t *fs, int *err);
 int fat_erase_chain(fat_fs_t *fs, uint32_t cluster);
 
+/* Allocate a cluster to follow on from prev in a file that's about to have at
+   least want more written to it. Once the free cluster map is complete, this
+   takes the cluster right after prev if it's free, or else the first run of
+   want free clusters it can find after the last one allocated, so that large
+   files end up contiguous. Until then, it's just fat_allocate_cluster(). */
+uint32_t fat_allocate_cluster_after(fat_fs_t *fs, uint32_t prev, uint32_t want,
+                                    int *err);
+
+/* Read the next count blocks of the FAT into the free cluster map, building it
+   a little at a time so that it can be done in the background while the
+   filesystem is in use. Returns 0 if there's more to do, 1 once the map is
+   complete (or if it isn't needed, on a read-only filesystem), or a negative
+   error code. Allocating clusters only consults the map once it's complete,
+   and the number of free clusters is recounted then. */
+int fat_free_map_scan(fat_fs_t *fs, uint32_t count);
+
+/* A file's cluster chain, as it's been read from the FAT so far, kept as runs
+   of consecutive clusters. Start one off zeroed, and free it with
+   fat_chain_free(). */
+typedef struct fat_run {
+    uint32_t order;                 /* Position in the file of the first one */
+    uint32_t cluster;
+    uint32_t count;
+} fat_run_t;
+
+typedef struct fat_chain {
+    uint32_t first;                 /* The file's first cluster */
+    uint32_t count;                 /* Clusters of the chain read so far */
+    uint32_t nruns;
+    uint32_t maxruns;
+    fat_run_t *runs;
+} fat_chain_t;
+
+/* Find the cluster at a position in a file whose chain starts at first,
+   reading whatever of the chain up to it (and of the run of consecutive
+   clusters it's in, up to max of them) hasn't been read already. Returns 0
+   with the cluster in *cl, and in *count how many consecutive clusters start
+   with it, at most max. If the chain ends before it, returns -EDOM with the
+   last cluster of the chain in *cl and its length in *count. Other errors are
+   returned negated. The chain only ever grows onto its end: forget it with
+   fat_chain_free() if any of it is changed. */
+int fat_chain_map(fat_fs_t *fs, fat_chain_t *ch, uint32_t first,
+                  uint32_t order, uint32_t max, uint32_t *cl,
+                  uint32_t *count);
+void fat_chain_free(fat_chain_t *ch);
+
 __END_DECLS
 
 #endif /* !__FAT_FATFS_H */
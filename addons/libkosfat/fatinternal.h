@@ -12,6 +12,9 @@
 
 #include "bpb.h"
 
+#ifndef FAT_NOT_IN_KOS
+#include <kos/bcache.h>
+#else
 #define FAT_CACHE_FLAG_VALID    1
 #define FAT_CACHE_FLAG_DIRTY    2
 
@@ -20,24 +23,45 @@ typedef struct fat_cache {
     uint32_t block;
     uint8_t *data;
 } fat_cache_t;
+#endif
 
 struct fatfs_struct {
     kos_blockdev_t *dev;
     fat_superblock_t sb;
 
+#ifndef FAT_NOT_IN_KOS
+    bcache_t *bcache;
+    bcache_t *fcache;
+#else
     fat_cache_t **bcache;
     int cache_size;
 
     fat_cache_t **fcache;
     int fcache_size;
+#endif
 
     uint32_t flags;
     uint32_t mnt_flags;
+
+    /* A bit for each cluster, set if it's free, built up by
+       fat_free_map_scan(). Clusters from free_map_next on haven't been looked
+       at yet. */
+    uint32_t *free_map;
+    uint32_t free_map_next;
+
+    /* Indexes of the names in recently searched directories, most recently
+       used first. See directory.c. */
+    struct fat_dir_index *dir_index;
 };
 
 /* The BPB/FSinfo blocks need to be written back to the block device... */
 #define FAT_FS_FLAG_SB_DIRTY   1
 
+#ifndef FAT_NOT_IN_KOS
+/* In fat.c: make the FAT block cache of a filesystem. */
+bcache_t *fat_fatblock_cache_create(fat_fs_t *fs, int fcache_sz);
+#endif
+
 #ifdef FAT_NOT_IN_KOS
     #include <stdio.h>
     #define DBG_DEBUG 0
@@ -16,6 +16,7 @@
 
 #include <kos/fs.h>
 #include <kos/mutex.h>
+#include <kos/thread.h>
 #include <kos/dbglog.h>
 
 #include <fat/fs_fat.h>
@@ -41,6 +42,10 @@ typedef struct fs_fat_fs {
     vfs_handler_t *vfsh;
     fat_fs_t *fs;
     uint32_t mount_flags;
+
+    /* Thread building the free cluster map, and whether it should stop. */
+    kthread_t *map_thd;
+    int map_quit;
 } fs_fat_fs_t;
 
 LIST_HEAD(fat_list, fs_fat_fs);
@@ -56,6 +61,7 @@ static struct {
     uint32_t dentry_loff;
     uint32_t cluster;
     uint32_t cluster_order;
+    fat_chain_t chain;
     int mode;
     uint32_t ptr;
     dirent_t dent;
@@ -137,24 +143,34 @@ static int fat_create_entry(fat_fs_t *fs, const char *fn, uint8_t attr,
     return 0;
 }
 
-static int advance_cluster(fat_fs_t *fs, int fd, uint32_t order, int write) {
+/* want is how many clusters a write still needs, or 0 when reading. */
+static int advance_cluster(fat_fs_t *fs, int fd, uint32_t order,
+                           uint32_t want) {
     uint32_t clo, cl, cl2;
     int err;
 
-    cl = fh[fd].cluster;
-    clo = fh[fd].cluster_order;
+    cl = fh[fd].dentry.cluster_low | (fh[fd].dentry.cluster_high << 16);
+    clo = 0;
 
-    /* Are we moving forward or backward? */
-    if(clo > order) {
-        /* If moving backward, we have to start from the beginning of the file
-           and advance forward. */
-        clo = 0;
-        cl = fh[fd].dentry.cluster_low | (fh[fd].dentry.cluster_high << 16);
-        fh[fd].cluster = cl;
-        fh[fd].cluster_order = clo;
+    /* Look the cluster up in the file's chain, which only has to read the FAT
+       for the part of the chain that hasn't been looked at yet. */
+    if(cl) {
+        err = fat_chain_map(fs, &fh[fd].chain, cl, order, 1, &cl, &clo);
+
+        if(!err) {
+            fh[fd].cluster = cl;
+            fh[fd].cluster_order = order;
+            fh[fd].mode &= ~0x80000000;
+            return 0;
+        }
+        else if(err != -EDOM) {
+            return err;
+        }
+
+        /* The chain ends before it, so carry on from its last cluster. */
+        --clo;
     }
 
-    /* At this point, we're definitely moving forward, if at all... */
     while(clo < order) {
         /* Read the FAT for the current cluster to see where we're going
            next... */
@@ -166,15 +182,15 @@ static int advance_cluster(fat_fs_t *fs, int fd, uint32_t order, int write) {
         else if(fat_is_eof(fs, cl2)) {
             /* If we've hit the EOF and we're writing, we need to allocate a new
                cluster to the file. If we're reading, then return error. */
-            if(!write) {
+            if(!want) {
                 fh[fd].cluster = cl2;
                 fh[fd].cluster_order = clo;
                 fh[fd].mode &= ~0x80000000;
                 return -EDOM;
             }
             else {
-                /* Allocate a new cluster */
-                cl2 = fat_allocate_cluster(fs, &err);
+                /* Allocate a new cluster, preferably right after this one. */
+                cl2 = fat_allocate_cluster_after(fs, cl, want, &err);
 
                 if(cl2 == FAT_INVALID_CLUSTER) {
                     return -err;
@@ -341,6 +357,7 @@ created:
     fh[fd].cluster = fh[fd].dentry.cluster_low |
         (fh[fd].dentry.cluster_high << 16);
     fh[fd].cluster_order = 0;
+    memset(&fh[fd].chain, 0, sizeof(fat_chain_t));
     fh[fd].opened = 1;
 
     mutex_unlock(&fat_mutex);
@@ -355,6 +372,7 @@ static int fs_fat_close(void *h) {
 
     if(fd < MAX_FAT_FILES && fh[fd].opened) {
         fh[fd].opened = 0;
+        fat_chain_free(&fh[fd].chain);
         fh[fd].dentry_offset = fh[fd].dentry_cluster = 0;
         fh[fd].dentry_lcl = fh[fd].dentry_loff = 0;
     }
@@ -375,7 +393,8 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
     uint8_t *bbuf = (uint8_t *)buf;
     ssize_t rv;
     uint64_t sz, cl;
-    int mode;
+    uint32_t rcl, n;
+    int mode, err;
 
     mutex_lock(&fat_mutex);
 
@@ -485,6 +504,49 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
 
     /* While we still have more to read, do it. */
     while(cnt) {
+        /* Whole clusters that follow on from each other on the disk are read
+           in one go, straight into the caller's buffer. That has to be 32-byte
+           aligned for block devices that DMA into it. */
+        if(cnt >= bs && !((uintptr_t)bbuf & 0x1F)) {
+            err = fat_chain_map(fs, &fh[fd].chain, fh[fd].dentry.cluster_low |
+                                (fh[fd].dentry.cluster_high << 16),
+                                fh[fd].cluster_order, cnt / bs, &rcl, &n);
+
+            if(err < 0) {
+                mutex_unlock(&fat_mutex);
+                errno = err == -EDOM ? EIO : -err;
+                return -1;
+            }
+
+            if(n > 1) {
+                if(fat_cluster_read_run(fs, rcl, n, bbuf, &errno)) {
+                    mutex_unlock(&fat_mutex);
+                    return -1;
+                }
+
+                fh[fd].ptr += n * bs;
+                cnt -= n * bs;
+                bbuf += n * bs;
+
+                /* Move on to the cluster after the run. */
+                cl = fat_read_fat(fs, rcl + n - 1, &errno);
+
+                if(cl == FAT_INVALID_CLUSTER) {
+                    mutex_unlock(&fat_mutex);
+                    return -1;
+                }
+                else if(cnt && fat_is_eof(fs, cl)) {
+                    mutex_unlock(&fat_mutex);
+                    errno = EIO;
+                    return -1;
+                }
+
+                fh[fd].cluster = cl;
+                fh[fd].cluster_order += n;
+                continue;
+            }
+        }
+
         if(!(block = fat_cluster_read(fs, fh[fd].cluster, &errno))) {
             mutex_unlock(&fat_mutex);
             return -1;
@@ -532,6 +594,17 @@ static ssize_t fs_fat_read(void *h, void *buf, size_t cnt) {
         }
     }
 
+    /* Get the next cluster on its way while the caller deals with this one. */
+    if(fh[fd].ptr < sz && !fat_is_eof(fs, fh[fd].cluster)) {
+        cl = fh[fd].cluster;
+
+        if(fh[fd].ptr & (bs - 1))
+            cl = fat_read_fat(fs, cl, &err);
+
+        if(cl != FAT_INVALID_CLUSTER && !fat_is_eof(fs, cl))
+            fat_cluster_readahead(fs, cl);
+    }
+
     /* We're done, clean up and return. */
     mutex_unlock(&fat_mutex);
     return rv;
@@ -576,7 +649,8 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
     /* Have we had an intervening seek call (or a write that ended exactly on
        a cluster boundary)? */
     if((fh[fd].mode & 0x80000000)) {
-        if((err = advance_cluster(fs, fd, fh[fd].ptr / bs, 1)) < 0) {
+        if((err = advance_cluster(fs, fd, fh[fd].ptr / bs,
+                                  (cnt + bs - 1) / bs)) < 0) {
             mutex_unlock(&fat_mutex);
             errno = -err;
             return -1;
@@ -601,7 +675,7 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
             cnt -= bs - bo;
 
             if((err = advance_cluster(fs, fd, fh[fd].cluster_order + 1,
-                                      1)) < 0) {
+                                      (cnt + bs - 1) / bs)) < 0) {
                 mutex_unlock(&fat_mutex);
                 errno = -err;
                 return -1;
@@ -638,7 +712,7 @@ static ssize_t fs_fat_write(void *h, const void *buf, size_t cnt) {
             bbuf += bs;
 
             if((err = advance_cluster(fs, fd, fh[fd].cluster_order + 1,
-                                      1)) < 0) {
+                                      (cnt + bs - 1) / bs)) < 0) {
                 mutex_unlock(&fat_mutex);
                 errno = -err;
                 return -1;
@@ -790,6 +864,55 @@ static void fill_stat_timestamps(const fat_dentry_t *ent, struct stat *buf) {
     buf->st_mtime = fat_time_to_stat(ent->mdate, ent->mtime);
 }
 
+/* Fill in the status of an object from its directory entry. */
+static int fill_stat(fs_fat_fs_t *fs, const fat_dentry_t *ent,
+                     struct stat *buf) {
+    uint32_t sz, bs;
+    int irv = 0;
+
+    memset(buf, 0, sizeof(struct stat));
+    buf->st_dev = (dev_t)((uintptr_t)fs->vfsh);
+    buf->st_ino = ent->cluster_low | (ent->cluster_high << 16);
+    buf->st_nlink = 1;
+    buf->st_uid = 0;
+    buf->st_gid = 0;
+    buf->st_blksize = fat_cluster_size(fs->fs);
+
+    /* Read the mode bits... */
+    buf->st_mode = S_IRUSR | S_IRGRP | S_IROTH | S_IXUSR | S_IXGRP | S_IXOTH;
+    if(!(ent->attr & FAT_ATTR_READ_ONLY)) {
+        buf->st_mode |= S_IWUSR | S_IWGRP | S_IWOTH;
+    }
+
+    /* Fill in the timestamps... */
+    fill_stat_timestamps(ent, buf);
+
+    /* The rest depends on what type of object this is... */
+    if(ent->attr & FAT_ATTR_DIRECTORY) {
+        buf->st_mode |= S_IFDIR;
+        buf->st_size = 0;
+        buf->st_blocks = 0;
+    }
+    else {
+        buf->st_mode |= S_IFREG;
+        sz = ent->size;
+
+        if(sz > LONG_MAX) {
+            errno = EOVERFLOW;
+            irv = -1;
+        }
+
+        buf->st_size = sz;
+        bs = fat_cluster_size(fs->fs);
+        buf->st_blocks = sz / bs;
+
+        if(sz & (bs - 1))
+            ++buf->st_blocks;
+    }
+
+    return irv;
+}
+
 static void copy_shortname(fat_dentry_t *dent, char *fn) {
     int i, j = 0;
 
@@ -824,7 +947,7 @@ static void copy_longname(fat_dentry_t *dent) {
     memcpy(&longname_buf[fnlen + 11], lent->name3, 4);
 }
 
-static dirent_t *fs_fat_readdir(void *h) {
+static dirent_t *fs_fat_readdir_plus(void *h, struct stat *st) {
     file_t fd = ((file_t)h) - 1;
     fat_fs_t *fs;
     uint32_t bs, cl;
@@ -941,11 +1064,19 @@ static dirent_t *fs_fat_readdir(void *h) {
         fh[fd].dent.size = -1;
     }
 
+    /* The entry has everything stat would give too. */
+    if(st)
+        fill_stat(fh[fd].fs, dent, st);
+
     /* We're done. Return the static dirent_t. */
     mutex_unlock(&fat_mutex);
     return &fh[fd].dent;
 }
 
+static dirent_t *fs_fat_readdir(void *h) {
+    return fs_fat_readdir_plus(h, NULL);
+}
+
 static int fs_fat_fcntl(void *h, int cmd, va_list ap) {
     file_t fd = ((file_t)h) - 1;
     int rv = -1;
@@ -1041,7 +1172,6 @@ static int fs_fat_unlink(vfs_handler_t *vfs, const char *fn) {
 static int fs_fat_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
                        int flag) {
     fs_fat_fs_t *fs = (fs_fat_fs_t *)vfs->privdata;
-    uint32_t sz, bs;
     int irv = 0;
     fat_dentry_t ent;
     uint32_t cl, off, lcl, loff;
@@ -1071,48 +1201,7 @@ static int fs_fat_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
         return -1;
     }
 
-    /* Fill in the structure */
-    memset(st, 0, sizeof(struct stat));
-    irv = 0;
-    st->st_dev = (dev_t)((uintptr_t)fs->vfsh);
-    st->st_ino = ent.cluster_low | (ent.cluster_high << 16);
-    st->st_nlink = 1;
-    st->st_uid = 0;
-    st->st_gid = 0;
-    st->st_blksize = fat_cluster_size(fs->fs);
-
-    /* Read the mode bits... */
-    st->st_mode = S_IRUSR | S_IRGRP | S_IROTH | S_IXUSR | S_IXGRP | S_IXOTH;
-    if(!(ent.attr & FAT_ATTR_READ_ONLY)) {
-        st->st_mode |= S_IWUSR | S_IWGRP | S_IWOTH;
-    }
-
-    /* Fill in the timestamps... */
-    fill_stat_timestamps(&ent, st);
-
-    /* The rest depends on what type of object this is... */
-    if(ent.attr & FAT_ATTR_DIRECTORY) {
-        st->st_mode |= S_IFDIR;
-        st->st_size = 0;
-        st->st_blocks = 0;
-    }
-    else {
-        st->st_mode |= S_IFREG;
-        sz = ent.size;
-
-        if(sz > LONG_MAX) {
-            errno = EOVERFLOW;
-            irv = -1;
-        }
-
-        st->st_size = sz;
-        bs = fat_cluster_size(fs->fs);
-        st->st_blocks = sz / bs;
-
-        if(sz & (bs - 1))
-            ++st->st_blocks;
-    }
-
+    irv = fill_stat(fs, &ent, st);
     mutex_unlock(&fat_mutex);
 
     return irv;
@@ -1246,11 +1335,8 @@ static int fs_fat_rewinddir(void *h) {
 }
 
 static int fs_fat_fstat(void *h, struct stat *buf) {
-    fs_fat_fs_t *fs;
-    uint32_t sz, bs;
     file_t fd = ((file_t)h) - 1;
-    int irv = 0;
-    fat_dentry_t *ent;
+    int irv;
 
     mutex_lock(&fat_mutex);
 
@@ -1260,51 +1346,7 @@ static int fs_fat_fstat(void *h, struct stat *buf) {
         return -1;
     }
 
-    /* Find the object in question */
-    ent = &fh[fd].dentry;
-    fs = fh[fd].fs;
-
-    /* Fill in the structure */
-    memset(buf, 0, sizeof(struct stat));
-    buf->st_dev = (dev_t)((uintptr_t)fs->vfsh);
-    buf->st_ino = ent->cluster_low | (ent->cluster_high << 16);
-    buf->st_nlink = 1;
-    buf->st_uid = 0;
-    buf->st_gid = 0;
-    buf->st_blksize = fat_cluster_size(fs->fs);
-
-    /* Read the mode bits... */
-    buf->st_mode = S_IRUSR | S_IRGRP | S_IROTH | S_IXUSR | S_IXGRP | S_IXOTH;
-    if(!(ent->attr & FAT_ATTR_READ_ONLY)) {
-        buf->st_mode |= S_IWUSR | S_IWGRP | S_IWOTH;
-    }
-
-    /* Fill in the timestamps... */
-    fill_stat_timestamps(ent, buf);
-
-    /* The rest depends on what type of object this is... */
-    if(ent->attr & FAT_ATTR_DIRECTORY) {
-        buf->st_mode |= S_IFDIR;
-        buf->st_size = 0;
-        buf->st_blocks = 0;
-    }
-    else {
-        buf->st_mode |= S_IFREG;
-        sz = ent->size;
-
-        if(sz > LONG_MAX) {
-            errno = EOVERFLOW;
-            irv = -1;
-        }
-
-        buf->st_size = sz;
-        bs = fat_cluster_size(fs->fs);
-        buf->st_blocks = sz / bs;
-
-        if(sz & (bs - 1))
-            ++buf->st_blocks;
-    }
-
+    irv = fill_stat(fh[fd].fs, &fh[fd].dentry, buf);
     mutex_unlock(&fat_mutex);
 
     return irv;
@@ -1349,12 +1391,45 @@ static vfs_handler_t vh = {
     fs_fat_total64,             /* total64 */
     NULL,                       /* readlink */
     fs_fat_rewinddir,           /* rewinddir */
-    fs_fat_fstat                /* fstat */
+    fs_fat_fstat,               /* fstat */
+    NULL,                       /* read_async */
+    NULL,                       /* write_async */
+    NULL,                       /* splice_out */
+    NULL,                       /* splice_in */
+    fs_fat_readdir_plus         /* readdir_plus */
 };
 
 static int initted = 0;
 
 /* These two functions borrow heavily from the same functions in fs_romdisk */
+/* Build the free cluster map of a read-write mount a little at a time, so
+   the filesystem is never locked for long. */
+static void *map_thread(void *data) {
+    fs_fat_fs_t *mnt = (fs_fat_fs_t *)data;
+    int rv = 0;
+
+    while(!rv) {
+        mutex_lock(&fat_mutex);
+        rv = mnt->map_quit ? 1 : fat_free_map_scan(mnt->fs, 16);
+        mutex_unlock(&fat_mutex);
+        thd_pass();
+    }
+
+    return NULL;
+}
+
+/* Stop the map thread of a mount. Called with fat_mutex held. */
+static void map_thread_stop(fs_fat_fs_t *mnt) {
+    if(!mnt->map_thd)
+        return;
+
+    mnt->map_quit = 1;
+    mutex_unlock(&fat_mutex);
+    thd_join(mnt->map_thd, NULL);
+    mutex_lock(&fat_mutex);
+    mnt->map_thd = NULL;
+}
+
 int fs_fat_mount(const char *mp, kos_blockdev_t *dev, uint32_t flags) {
     fat_fs_t *fs;
     fs_fat_fs_t *mnt;
@@ -1388,6 +1463,12 @@ int fs_fat_mount(const char *mp, kos_blockdev_t *dev, uint32_t flags) {
 
     mnt->fs = fs;
     mnt->mount_flags = flags;
+    mnt->map_thd = NULL;
+    mnt->map_quit = 0;
+
+    /* The block cache can write back and read ahead in the background while
+       holding our lock. */
+    fat_fs_set_lock(fs, &fat_mutex);
 
     /* Create a VFS structure */
     if(!(vfsh = (vfs_handler_t *)malloc(sizeof(vfs_handler_t)))) {
@@ -1416,6 +1497,12 @@ int fs_fat_mount(const char *mp, kos_blockdev_t *dev, uint32_t flags) {
         return -1;
     }
 
+    /* Until the free cluster map is built, allocating searches the FAT. */
+    if(flags & FS_FAT_MOUNT_READWRITE) {
+        if((mnt->map_thd = thd_create(0, map_thread, mnt)))
+            thd_set_label(mnt->map_thd, "fs_fat free map");
+    }
+
     mutex_unlock(&fat_mutex);
     return 0;
 }
@@ -1437,6 +1524,7 @@ int fs_fat_unmount(const char *mp) {
         LIST_REMOVE(i, entry);
 
         /* XXXX: We should probably do something with open files... */
+        map_thread_stop(i);
         nmmgr_handler_remove(&i->vfsh->nmmgr);
         fat_fs_shutdown(i->fs);
         free(i->vfsh);
@@ -1497,11 +1585,13 @@ int fs_fat_shutdown(void) {
         return 0;
 
     /* Clean up the mounted filesystems */
+    mutex_lock(&fat_mutex);
     i = LIST_FIRST(&fat_fses);
     while(i) {
         next = LIST_NEXT(i, entry);
 
         /* XXXX: We should probably do something with open files... */
+        map_thread_stop(i);
         nmmgr_handler_remove(&i->vfsh->nmmgr);
         fat_fs_shutdown(i->fs);
         free(i->vfsh);
@@ -1510,6 +1600,7 @@ int fs_fat_shutdown(void) {
         i = next;
     }
 
+    mutex_unlock(&fat_mutex);
     mutex_destroy(&fat_mutex);
     initted = 0;
 
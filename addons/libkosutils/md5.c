@@ -83,27 +83,36 @@ int main(int argc, char *argv[]) {
 #define MD5_H(x, y, z) (x ^ y ^ z)
 #define MD5_I(x, y, z) (y ^ (x | (~z)))
 
-/* Compound operations, consisting of a F, G, H, or I operation and a rotate */
+/* Compound operations, consisting of a F, G, H, or I operation and a rotate.
+   The message word and constant are added in first, as they don't depend on
+   the previous step; only the basic function and what follows it do. G is
+   done as two ANDs of disjoint bits that can be added in separately, so that
+   b only goes through one operation before being added. */
 #define MD5_FH(a, b, c, d, w, s, t) { \
-        (a) += MD5_F((b), (c), (d)) + (w) + (t); \
+        (a) += (w) + (t); \
+        (a) += MD5_F((b), (c), (d)); \
         (a) = MD5_ROT((a), (s)); \
         (a) += (b); \
     }
 
 #define MD5_GH(a, b, c, d, w, s, t) { \
-        (a) += MD5_G((b), (c), (d)) + (w) + (t); \
+        (a) += (w) + (t); \
+        (a) += (c) & ~(d); \
+        (a) += (b) & (d); \
         (a) = MD5_ROT((a), (s)); \
         (a) += (b); \
     }
 
 #define MD5_HH(a, b, c, d, w, s, t) { \
-        (a) += MD5_H((b), (c), (d)) + (w) + (t); \
+        (a) += (w) + (t); \
+        (a) += MD5_H((b), (c), (d)); \
         (a) = MD5_ROT((a), (s)); \
         (a) += (b); \
     }
 
 #define MD5_IH(a, b, c, d, w, s, t) { \
-        (a) += MD5_I((b), (c), (d)) + (w) + (t); \
+        (a) += (w) + (t); \
+        (a) += MD5_I((b), (c), (d)); \
         (a) = MD5_ROT((a), (s)); \
         (a) += (b); \
     }
@@ -118,7 +127,8 @@ void kos_md5_start(kos_md5_cxt_t *cxt) {
 
 /* input must be at least 64 bytes long */
 static void kos_md5_process(kos_md5_cxt_t *cxt, const uint8_t *input) {
-    uint32_t a, b, c, d, w[16];
+    uint32_t a, b, c, d, buf[16];
+    const uint32_t *w;
     int i;
 
     /* Read in what we're starting with */
@@ -127,10 +137,22 @@ static void kos_md5_process(kos_md5_cxt_t *cxt, const uint8_t *input) {
     c = cxt->hash[2];
     d = cxt->hash[3];
 
-    /* Read the input into our buffer */
-    for(i = 0; i < 16; ++i) {
-        w[i] = input[(i << 2)] | (input[(i << 2) + 1] << 8) |
-               (input[(i << 2) + 2] << 16) | (input[(i << 2) + 3] << 24);
+    /* The input is little-endian words, so on a little-endian CPU an aligned
+       block can be read as is. Otherwise, read it into our buffer. */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(!((uintptr_t)input & 3)) {
+        w = (const uint32_t *)input;
+    }
+    else
+#endif
+    {
+        for(i = 0; i < 16; ++i) {
+            buf[i] = input[(i << 2)] | (input[(i << 2) + 1] << 8) |
+                     (input[(i << 2) + 2] << 16) |
+                     ((uint32_t)input[(i << 2) + 3] << 24);
+        }
+
+        w = buf;
     }
 
     /* First Round */
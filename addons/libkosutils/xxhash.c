@@ -0,0 +1,134 @@
+/* KallistiOS ##version##
+
+   xxhash.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+#include <string.h>
+#include <kos/xxhash.h>
+
+/* The primes of xxHash32 */
+#define XXH_P1  0x9E3779B1U
+#define XXH_P2  0x85EBCA77U
+#define XXH_P3  0xC2B2AE3DU
+#define XXH_P4  0x27D4EB2FU
+#define XXH_P5  0x165667B1U
+
+#define XXH_ROT(x, y)  (((x) << (y)) | ((x) >> (32 - (y))))
+
+static inline uint32_t xxh32_read(const uint8_t *p) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(!((uintptr_t)p & 3))
+        return *(const uint32_t *)p;
+#endif
+
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t xxh32_round(uint32_t acc, uint32_t input) {
+    acc += input * XXH_P2;
+    acc = XXH_ROT(acc, 13);
+    return acc * XXH_P1;
+}
+
+/* Hash as many whole 16-byte stripes as there are, returning how many bytes
+   that was. The four accumulators don't depend on each other, so one's
+   multiplies can go while another's are still in flight. */
+static uint32_t xxh32_stripes(uint32_t acc[4], const uint8_t *input,
+                              uint32_t size) {
+    uint32_t a = acc[0], b = acc[1], c = acc[2], d = acc[3];
+    const uint8_t *p = input;
+
+    for(; size >= 16; size -= 16, p += 16) {
+        a = xxh32_round(a, xxh32_read(p));
+        b = xxh32_round(b, xxh32_read(p + 4));
+        c = xxh32_round(c, xxh32_read(p + 8));
+        d = xxh32_round(d, xxh32_read(p + 12));
+    }
+
+    acc[0] = a;
+    acc[1] = b;
+    acc[2] = c;
+    acc[3] = d;
+
+    return p - input;
+}
+
+void kos_xxh32_start(kos_xxh32_cxt_t *cxt, uint32_t seed) {
+    cxt->size = 0;
+    cxt->seed = seed;
+    cxt->acc[0] = seed + XXH_P1 + XXH_P2;
+    cxt->acc[1] = seed + XXH_P2;
+    cxt->acc[2] = seed;
+    cxt->acc[3] = seed - XXH_P1;
+}
+
+void kos_xxh32_hash_block(kos_xxh32_cxt_t *cxt, const uint8_t *input,
+                          uint32_t size) {
+    uint32_t left, copy, done;
+
+    /* Figure out what we had left over from last time (if anything) */
+    left = (uint32_t)(cxt->size & 15);
+    cxt->size += size;
+
+    if(left) {
+        copy = 16 - left;
+
+        if(size < copy) {
+            memcpy(&cxt->buf[left], input, size);
+            return;
+        }
+
+        memcpy(&cxt->buf[left], input, copy);
+        xxh32_stripes(cxt->acc, cxt->buf, 16);
+        input += copy;
+        size -= copy;
+    }
+
+    done = xxh32_stripes(cxt->acc, input, size);
+
+    /* Buffer anything left over */
+    if(size > done)
+        memcpy(cxt->buf, input + done, size - done);
+}
+
+uint32_t kos_xxh32_finish(const kos_xxh32_cxt_t *cxt) {
+    const uint8_t *p = cxt->buf;
+    uint32_t h, left = (uint32_t)(cxt->size & 15);
+
+    if(cxt->size >= 16)
+        h = XXH_ROT(cxt->acc[0], 1) + XXH_ROT(cxt->acc[1], 7) +
+            XXH_ROT(cxt->acc[2], 12) + XXH_ROT(cxt->acc[3], 18);
+    else
+        h = cxt->seed + XXH_P5;
+
+    h += (uint32_t)cxt->size;
+
+    for(; left >= 4; left -= 4, p += 4) {
+        h += xxh32_read(p) * XXH_P3;
+        h = XXH_ROT(h, 17) * XXH_P4;
+    }
+
+    while(left--) {
+        h += *p++ * XXH_P5;
+        h = XXH_ROT(h, 11) * XXH_P1;
+    }
+
+    /* Final mix */
+    h ^= h >> 15;
+    h *= XXH_P2;
+    h ^= h >> 13;
+    h *= XXH_P3;
+    h ^= h >> 16;
+
+    return h;
+}
+
+/* Convenience function for hashing a complete block. */
+uint32_t kos_xxh32(const uint8_t *input, uint32_t size, uint32_t seed) {
+    kos_xxh32_cxt_t cxt;
+
+    kos_xxh32_start(&cxt, seed);
+    kos_xxh32_hash_block(&cxt, input, size);
+    return kos_xxh32_finish(&cxt);
+}
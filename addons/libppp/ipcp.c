@@ -22,6 +22,7 @@ struct ipcp_state_s {
     uint8_t last_conf;
     uint8_t last_term;
     uint8_t last_coderej;
+    uint8_t vj_slots;
 
     ppp_state_t *ppp_state;
     netif_t *nif;
@@ -41,6 +42,10 @@ struct ipcp_state_s {
 #define IPCP_CONFIGURE_SECONDARY_DNS  131
 #define IPCP_CONFIGURE_SECONDARY_NBNS 132
 
+/* Receive buffer for rebuilding packets with compressed headers. Only touched
+   by the PPP thread. */
+static uint8_t vj_buf[VJ_MAX_HDR + 1500];
+
 static void ipcp_cfg_timeout(ppp_protocol_t *self) {
     (void)self;
 
@@ -94,6 +99,15 @@ static int ipcp_send_client_cfg(ppp_protocol_t *self, int resend) {
     pkt->data[len++] = dns[2];
     pkt->data[len++] = dns[3];
 
+    if(ipcp_state.ppp_state->our_flags & PPP_FLAG_VJ_COMP) {
+        pkt->data[len++] = IPCP_CONFIGURE_IP_COMPRESSION;
+        pkt->data[len++] = 6;
+        pkt->data[len++] = (uint8_t)(PPP_PROTOCOL_VJ_COMP >> 8);
+        pkt->data[len++] = (uint8_t)PPP_PROTOCOL_VJ_COMP;
+        pkt->data[len++] = ipcp_state.vj_slots - 1;  /* Max slot ID */
+        pkt->data[len++] = 1;                        /* Slot ID compression */
+    }
+
     len += 4;
     pkt->len = htons(len);
 
@@ -162,6 +176,7 @@ static int ipcp_handle_configure_req(ppp_protocol_t *self,
 
     /* Parameters and their default values. */
     uint32_t addr = 0;
+    int vj_slots = 0, vj_cid = 0;
 
     (void)pkt;
 
@@ -226,6 +241,22 @@ static int ipcp_handle_configure_req(ppp_protocol_t *self,
                 }
                 break;
 
+            case IPCP_CONFIGURE_IP_COMPRESSION:
+                /* Van Jacobson compression is all we know how to do. */
+                if(opt_len == 6 &&
+                   ((pkt->data[ptr + 2] << 8) | pkt->data[ptr + 3]) ==
+                   PPP_PROTOCOL_VJ_COMP) {
+                    vj_slots = pkt->data[ptr + 4] + 1;
+                    vj_cid = pkt->data[ptr + 5];
+                    DBG("    VJ compression: %d slots%s\n", vj_slots,
+                        vj_cid ? ", slot ID compression" : "");
+                }
+                else {
+                    DBG("    IP compression (unsupported)\n");
+                    goto reject_opt;
+                }
+                break;
+
             case IPCP_CONFIGURE_PRIMARY_DNS:
                 if(opt_len == 6) {
                     DBG("    primary DNS: %d.%d.%d.%d\n",
@@ -308,6 +339,15 @@ reject_opt:
             nif->gateway[3] = (uint8_t)addr;
         }
 
+        /* The peer decompresses what we send, so it picks how many slots we
+           get to use. */
+        _ppp_vj_tx_config(vj_slots, vj_cid);
+
+        if(vj_slots)
+            st->peer_flags |= PPP_FLAG_VJ_COMP;
+        else
+            st->peer_flags &= ~PPP_FLAG_VJ_COMP;
+
         if(ipcp_state.state == PPP_STATE_ACK_RECEIVED) {
             ipcp_state.state = PPP_STATE_OPENED;
 
@@ -353,6 +393,14 @@ reject_opt:
     return 0;
 }
 
+/* Set up to decompress what the peer sends, once it has agreed to how. */
+static void ipcp_config_rx(void) {
+    if(ipcp_state.ppp_state->our_flags & PPP_FLAG_VJ_COMP)
+        _ppp_vj_rx_config(ipcp_state.vj_slots);
+    else
+        _ppp_vj_rx_config(0);
+}
+
 static int ipcp_handle_configure_ack(ppp_protocol_t *self,
                                      const ipcp_pkt_t *pkt, size_t len) {
     (void)self;
@@ -384,6 +432,7 @@ static int ipcp_handle_configure_ack(ppp_protocol_t *self,
                spec is probably right? */
             ipcp_state.resend_cnt = 10;
             ipcp_state.state = PPP_STATE_ACK_RECEIVED;
+            ipcp_config_rx();
             return 0;
 
         case PPP_STATE_OPENED:
@@ -400,6 +449,7 @@ static int ipcp_handle_configure_ack(ppp_protocol_t *self,
             ipcp_state.resend_pkt = NULL;
             ipcp_state.resend_timeout = NULL;
             ipcp_state.state = PPP_STATE_OPENED;
+            ipcp_config_rx();
             /* XXXX: This layer up. */
             _ppp_enter_phase(PPP_PHASE_NETWORK);
 
@@ -501,6 +551,23 @@ static int ipcp_handle_configure_nak(ppp_protocol_t *self,
                 }
                 break;
 
+            case IPCP_CONFIGURE_IP_COMPRESSION:
+                /* Take fewer slots if the peer wants, but VJ or nothing. */
+                if(opt_len == 6 &&
+                   ((pkt->data[ptr + 2] << 8) | pkt->data[ptr + 3]) ==
+                   PPP_PROTOCOL_VJ_COMP) {
+                    if(pkt->data[ptr + 4] < ipcp_state.vj_slots)
+                        ipcp_state.vj_slots = pkt->data[ptr + 4] + 1;
+
+                    DBG("    VJ compression: %d slots\n",
+                        (int)ipcp_state.vj_slots);
+                }
+                else {
+                    DBG("    IP compression (unsupported)\n");
+                    ipcp_state.ppp_state->our_flags &= ~PPP_FLAG_VJ_COMP;
+                }
+                break;
+
             /* If we don't know about the option, ignore it. */
             default:
                 DBG("    unknown option: %d (len %d)\n", pkt->data[ptr],
@@ -529,6 +596,68 @@ static int ipcp_handle_configure_nak(ppp_protocol_t *self,
     return ipcp_send_client_cfg(self, 0);
 }
 
+static int ipcp_handle_configure_rej(ppp_protocol_t *self,
+                                     const ipcp_pkt_t *pkt, size_t len) {
+    size_t ptr = 0;
+    uint8_t opt_len;
+    int resend = 0;
+
+    if(pkt->id != ipcp_state.last_conf) {
+        DBG("ipcp: received configure reject with an invalid identifier\n");
+        return -1;
+    }
+
+    DBG("ipcp: peer sent configure reject with opts:\n");
+
+    len -= 4;
+
+    while(ptr + 2 <= len) {
+        opt_len = pkt->data[ptr + 1];
+
+        if(opt_len < 2 || ptr + opt_len > len) {
+            DBG("ipcp: bad option length, ignoring packet\n");
+            return -1;
+        }
+
+        /* Only compression is optional enough for us to do without. Anything
+           else is still ignored, as it always was. */
+        if(pkt->data[ptr] == IPCP_CONFIGURE_IP_COMPRESSION) {
+            DBG("    IP compression\n");
+            ipcp_state.ppp_state->our_flags &= ~PPP_FLAG_VJ_COMP;
+            resend = 1;
+        }
+        else {
+            DBG("    option: %d (len %d)\n", pkt->data[ptr], opt_len);
+        }
+
+        ptr += opt_len;
+    }
+
+    if(!resend)
+        return 0;
+
+    switch(ipcp_state.state) {
+        case PPP_STATE_CLOSING:
+        case PPP_STATE_STOPPING:
+            /* Silently discard and don't move states. */
+            return 0;
+
+        case PPP_STATE_CLOSED:
+        case PPP_STATE_STOPPED:
+            return ipcp_send_terminate_ack(self, pkt->id, NULL, 0);
+
+        case PPP_STATE_OPENED:
+            /* XXXX: This layer down. */
+
+        case PPP_STATE_REQUEST_SENT:
+        case PPP_STATE_ACK_RECEIVED:
+            ipcp_state.state = PPP_STATE_REQUEST_SENT;
+            break;
+    }
+
+    return ipcp_send_client_cfg(self, 0);
+}
+
 static int ipcp_handle_terminate_req(ppp_protocol_t *self,
                                      const ipcp_pkt_t *pkt, size_t len) {
     (void)len;
@@ -638,8 +767,7 @@ static int ipcp_input(ppp_protocol_t *self, const uint8_t *buf, size_t len) {
             return ipcp_handle_configure_nak(self, pkt, len);
 
         case LCP_CONFIGURE_REJECT:
-            //return ipcp_handle_configure_rej(self, pkt, len);
-            return 0;
+            return ipcp_handle_configure_rej(self, pkt, len);
 
         case LCP_TERMINATE_REQUEST:
             return ipcp_handle_terminate_req(self, pkt, len);
@@ -668,6 +796,11 @@ static void ipcp_enter_phase(ppp_protocol_t *self, int oldp, int newp) {
 
     /* We only care about when we're entering the network phase. */
     if(newp == PPP_PHASE_NETWORK) {
+        /* Nothing is compressed until both sides agree to it again. */
+        ipcp_state.vj_slots = VJ_MAX_SLOTS;
+        _ppp_vj_tx_config(0, 0);
+        _ppp_vj_rx_config(0);
+
         ipcp_send_client_cfg(self, 0);
         ipcp_state.state = PPP_STATE_REQUEST_SENT;
     }
@@ -698,6 +831,22 @@ static int ip_input(ppp_protocol_t *self, const uint8_t *buf, size_t len) {
     return 0;
 }
 
+static int vj_input(ppp_protocol_t *self, const uint8_t *buf, size_t len) {
+    ssize_t pkt_len;
+
+    if(ipcp_state.state != PPP_STATE_OPENED)
+        return 0;
+
+    pkt_len = _ppp_vj_uncompress(self->code, buf, len, vj_buf, sizeof(vj_buf));
+
+    if(pkt_len < 0) {
+        DBG("ipcp: dropping packet with bad compressed header\n");
+        return -1;
+    }
+
+    return net_ipv4_input(ipcp_state.ppp_state->netif, vj_buf, pkt_len, NULL);
+}
+
 static ppp_protocol_t ipcp_proto = {
     PPP_PROTO_ENTRY_INIT,
     "ipcp",
@@ -722,10 +871,36 @@ static ppp_protocol_t ip_proto = {
     NULL                    /* check_timeouts */
 };
 
+static ppp_protocol_t vjc_proto = {
+    PPP_PROTO_ENTRY_INIT,
+    "vjc",
+    PPP_PROTOCOL_VJ_COMP,
+    NULL,                   /* privdata */
+    NULL,                   /* init */
+    &ipcp_shutdown,
+    &vj_input,
+    NULL,                   /* enter_phase */
+    NULL                    /* check_timeouts */
+};
+
+static ppp_protocol_t vju_proto = {
+    PPP_PROTO_ENTRY_INIT,
+    "vju",
+    PPP_PROTOCOL_VJ_UNCOMP,
+    NULL,                   /* privdata */
+    NULL,                   /* init */
+    &ipcp_shutdown,
+    &vj_input,
+    NULL,                   /* enter_phase */
+    NULL                    /* check_timeouts */
+};
+
 int _ppp_ipcp_init(ppp_state_t *st) {
     (void)st;
 
     ipcp_state.ppp_state = st;
+    ipcp_state.vj_slots = VJ_MAX_SLOTS;
 
-    return ppp_add_protocol(&ip_proto) | ppp_add_protocol(&ipcp_proto);
+    return ppp_add_protocol(&ip_proto) | ppp_add_protocol(&vjc_proto) |
+        ppp_add_protocol(&vju_proto) | ppp_add_protocol(&ipcp_proto);
 }
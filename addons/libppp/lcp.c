@@ -396,6 +396,7 @@ reject_opt:
         st->peer_flags = flags;
         st->peer_magic = magic;
         st->out_accm[0] = accm;
+        _ppp_update_accm();
         st->auth_proto = auth_proto;
         st->peer_mru = mru;
 
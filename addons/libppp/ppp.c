@@ -44,6 +44,12 @@ static int conn_rv = 0;
 static uint8_t ppp_recvbuf[PPP_MRU + 4];
 static size_t ppp_recvbuf_len;
 
+/* Transmit buffer, and which bytes need escaping on the way out. These are
+   protected by the mutex. */
+static uint8_t tx_buf[256];
+static size_t tx_len;
+static uint8_t out_esc[256];
+
 TAILQ_HEAD(ppp_proto_list, ppp_proto);
 static struct ppp_proto_list protocols = TAILQ_HEAD_INITIALIZER(protocols);
 
@@ -70,141 +76,110 @@ static inline int check_accm_bit(uint32_t *accm, uint8_t bit) {
     return accm[pos1] & (1 << pos2);
 }
 
-int ppp_send(const uint8_t *data, size_t len, uint16_t proto) {
-    uint8_t tmp[5];
-    uint16_t fcs = INITIAL_FCS;
-    size_t i, j, run_len = 0;
-    const uint8_t *run_start = data;
+/* Build the table of what has to be escaped going out from the ACCM. */
+void _ppp_update_accm(void) {
+    int i;
 
-    /* We can't use mutex_lock() inside an IRQ, so we have this song and dance
-       with mutex_trylock() instead in that case. */
-    if(irq_inside_int()) {
-        if(mutex_trylock(&mutex)) {
-            errno = EAGAIN;
-            return -1;
-        }
-    }
-    else {
-        mutex_lock(&mutex);
-    }
+    for(i = 0; i < 256; ++i)
+        out_esc[i] = check_accm_bit(ppp_state.out_accm, (uint8_t)i) ? 1 : 0;
+}
 
-    if(!ppp_state.device) {
-        mutex_unlock(&mutex);
-        errno = ENETDOWN;
-        return -1;
-    }
+static inline void tx_flush(int flags) {
+    ppp_state.device->tx(ppp_state.device, tx_buf, tx_len, flags);
+    tx_len = 0;
+}
 
-    if(ppp_state.phase == PPP_PHASE_DEAD) {
-        mutex_unlock(&mutex);
-        errno = ENETDOWN;
-        return -1;
-    }
+/* Escape a run of bytes into the transmit buffer, updating the FCS as we go.
+   Handing the device whole buffers rather than the runs between each escaped
+   byte cuts the calls into it down to a few per packet. */
+static uint16_t tx_bytes(const uint8_t *data, size_t len, uint16_t fcs) {
+    uint8_t ch;
 
-    /* Send the start of the framing out first. */
-    i = 0;
-    tmp[i++] = FLAG_SEQUENCE;
+    while(len--) {
+        ch = *data++;
+        fcs = (fcs >> 8) ^ fcstab[(fcs ^ ch) & 0xFF];
 
-    if(check_accm_bit(ppp_state.out_accm, ADDRESS_FIELD)) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = ADDRESS_FIELD ^ 0x20;
-    }
-    else {
-        tmp[i++] = ADDRESS_FIELD;
-    }
+        if(tx_len > sizeof(tx_buf) - 2)
+            tx_flush(0);
 
-    if(check_accm_bit(ppp_state.out_accm, CONTROL_FIELD)) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = CONTROL_FIELD ^ 0x20;
-    }
-    else {
-        tmp[i++] = CONTROL_FIELD;
+        if(out_esc[ch]) {
+            tx_buf[tx_len++] = ESCAPE_CHAR;
+            tx_buf[tx_len++] = ch ^ 0x20;
+        }
+        else {
+            tx_buf[tx_len++] = ch;
+        }
     }
 
-    fcs = (fcs >> 8) ^ fcstab[(fcs ^ ADDRESS_FIELD) & 0xFF];
-    fcs = (fcs >> 8) ^ fcstab[(fcs ^ CONTROL_FIELD) & 0xFF];
-
-    ppp_state.device->tx(ppp_state.device, tmp, i, 0);
-
-    /* Next deal with the PPP protocol field. */
-    i = 0;
-
-    if(check_accm_bit(ppp_state.out_accm, (uint8_t)(proto >> 8))) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = ((uint8_t)(proto >> 8)) ^ 0x20;
-    }
-    else {
-        tmp[i++] = (uint8_t)(proto >> 8);
-    }
+    return fcs;
+}
 
-    if(check_accm_bit(ppp_state.out_accm, (uint8_t)proto)) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = ((uint8_t)proto) ^ 0x20;
+/* We can't use mutex_lock() inside an IRQ, so we have this song and dance
+   with mutex_trylock() instead in that case. */
+static int ppp_lock(void) {
+    if(irq_inside_int()) {
+        if(mutex_trylock(&mutex)) {
+            errno = EAGAIN;
+            return -1;
+        }
     }
     else {
-        tmp[i++] = (uint8_t)proto;
+        mutex_lock(&mutex);
     }
 
-    fcs = (fcs >> 8) ^ fcstab[(fcs ^ ((uint8_t)(proto >> 8))) & 0xFF];
-    fcs = (fcs >> 8) ^ fcstab[(fcs ^ ((uint8_t)proto)) & 0xFF];
+    return 0;
+}
 
-    ppp_state.device->tx(ppp_state.device, tmp, i, 0);
+/* Send one frame made up of hdr followed by data. The lock must be held. */
+static int ppp_tx_frame(const uint8_t *hdr, size_t hdr_len,
+                        const uint8_t *data, size_t len, uint16_t proto) {
+    uint8_t tmp[4];
+    uint16_t fcs = INITIAL_FCS;
 
-    /* Deal with the data now. */
-    for(j = 0; j < len; ++j) {
-        if(check_accm_bit(ppp_state.out_accm, data[j])) {
-            /* Send everything up to this point. */
-            if(run_len)
-                ppp_state.device->tx(ppp_state.device, run_start, run_len, 0);
+    if(!ppp_state.device || ppp_state.phase == PPP_PHASE_DEAD) {
+        errno = ENETDOWN;
+        return -1;
+    }
 
-            /* Escape the current byte and send it. */
-            tmp[0] = ESCAPE_CHAR;
-            tmp[1] = data[j] ^ 0x20;
-            ppp_state.device->tx(ppp_state.device, tmp, 2, 0);
+    /* The flag sequence goes out as is, everything after it is escaped as
+       needed. */
+    tx_len = 0;
+    tx_buf[tx_len++] = FLAG_SEQUENCE;
 
-            /* Restart the run counter. */
-            run_start = data + j + 1;
-            run_len = 0;
-        }
-        else {
-            ++run_len;
-        }
+    tmp[0] = ADDRESS_FIELD;
+    tmp[1] = CONTROL_FIELD;
+    tmp[2] = (uint8_t)(proto >> 8);
+    tmp[3] = (uint8_t)proto;
+    fcs = tx_bytes(tmp, 4, fcs);
 
-        fcs = (fcs >> 8) ^ fcstab[(fcs ^ data[j]) & 0xFF];
-    }
+    if(hdr_len)
+        fcs = tx_bytes(hdr, hdr_len, fcs);
 
-    /* Send anything left over. */
-    if(run_len)
-        ppp_state.device->tx(ppp_state.device, run_start, run_len, 0);
+    fcs = tx_bytes(data, len, fcs);
 
     /* Finish up with the FCS and tack it onto the end along with an extra flag
        sequence to mark the end of the packet. */
     fcs = fcs ^ 0xFFFF;
-    i = 0;
+    tmp[0] = (uint8_t)(fcs & 0xFF);
+    tmp[1] = (uint8_t)(fcs >> 8);
+    tx_bytes(tmp, 2, 0);
 
-    if(check_accm_bit(ppp_state.out_accm, (uint8_t)(fcs & 0xFF))) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = ((uint8_t)(fcs & 0xFF)) ^ 0x20;
-    }
-    else {
-        tmp[i++] = (uint8_t)(fcs & 0xFF);
-    }
+    tx_buf[tx_len++] = FLAG_SEQUENCE;
+    tx_flush(PPP_TX_END_OF_PKT);
 
-    if(check_accm_bit(ppp_state.out_accm, (uint8_t)((fcs >> 8) & 0xFF))) {
-        tmp[i++] = ESCAPE_CHAR;
-        tmp[i++] = ((uint8_t)((fcs >> 8) & 0xFF)) ^ 0x20;
-    }
-    else {
-        tmp[i++] = (uint8_t)((fcs >> 8) & 0xFF);
-    }
+    return 0;
+}
 
-    tmp[i++] = FLAG_SEQUENCE;
+int ppp_send(const uint8_t *data, size_t len, uint16_t proto) {
+    int rv;
 
-    ppp_state.device->tx(ppp_state.device, tmp, i, PPP_TX_END_OF_PKT);
+    if(ppp_lock())
+        return -1;
 
-    /* Clean up, we're done. */
+    rv = ppp_tx_frame(NULL, 0, data, len, proto);
     mutex_unlock(&mutex);
 
-    return 0;
+    return rv;
 }
 
 static int ppp_input(void) {
@@ -300,6 +275,11 @@ void *ppp_main(void *arg) {
                                 ppp_recvbuf[1]);
                             DBG("ppp: was %d bytes long\n",
                                 (int)ppp_recvbuf_len);
+
+                            /* Whatever it was, compressed TCP headers that
+                               follow can't be trusted until the next full
+                               one. */
+                            _ppp_vj_toss();
                         }
 
                         expect = EXPECT_ADDRESS;
@@ -588,11 +568,23 @@ static int ppp_if_shutdown(netif_t *self) {
 }
 
 static int ppp_if_tx(netif_t *self, const uint8_t *data, int len, int blocking) {
+    uint8_t hdr[VJ_MAX_HDR];
+    size_t hdr_len, skip;
+    uint16_t proto;
+    int rv;
+
     (void)self;
     (void)blocking;
 
+    if(ppp_lock())
+        return -1;
+
     /* XXXX: Support protocols other than IPv4 here... */
-    return ppp_send(data, len, PPP_PROTOCOL_IPv4);
+    proto = _ppp_vj_compress(data, len, hdr, &hdr_len, &skip);
+    rv = ppp_tx_frame(hdr, hdr_len, data + skip, len - skip, proto);
+    mutex_unlock(&mutex);
+
+    return rv;
 }
 
 static int ppp_if_set_flags(netif_t *self, uint32_t flags_and, uint32_t flags_or) {
@@ -640,7 +632,9 @@ static netif_t ppp_if = {
     &ppp_if_dummy,              /* tx_commit */
     &ppp_if_dummy,              /* rx_poll */
     &ppp_if_set_flags,          /* set_flags */
-    &ppp_if_set_mc              /* set_mc */
+    &ppp_if_set_mc,             /* set_mc */
+    NULL,                       /* tx_iov */
+    { 0 }                       /* stats */
 };
 
 int ppp_init(void) {
@@ -663,13 +657,14 @@ int ppp_init(void) {
     set_accm_bit(ppp_state.in_accm, ESCAPE_CHAR);
     set_accm_bit(ppp_state.in_accm, FLAG_SEQUENCE);
     ppp_state.out_accm[0] = 0xffffffff;
+    _ppp_update_accm();
     ppp_state.peer_mru = 1500;
     ppp_state.netif = &ppp_if;
 
     /* Initialize a few sane defaults for the LCP configuration. */
     ppp_state.our_magic = time(NULL);
     ppp_state.our_flags = PPP_FLAG_ACCOMP |
-        PPP_FLAG_MAGIC_NUMBER;
+        PPP_FLAG_MAGIC_NUMBER | PPP_FLAG_VJ_COMP;
 
     /* Initialize all the protocols that are included in the library. */
     _ppp_lcp_init(&ppp_state);
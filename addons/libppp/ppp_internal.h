@@ -61,6 +61,8 @@ typedef struct ppp_state {
 /* PPP Protocols we might care about. */
 #define PPP_PROTOCOL_IPv4       0x0021
 #define PPP_PROTOCOL_IPv6       0x0057
+#define PPP_PROTOCOL_VJ_COMP    0x002d    /* RFC 1144 */
+#define PPP_PROTOCOL_VJ_UNCOMP  0x002f
 
 #define PPP_PROTOCOL_IPCP       0x8021    /* RFC 1332 */
 #define PPP_PROTOCOL_IPV6CP     0x8057    /* RFC 2472 */
@@ -95,6 +97,7 @@ typedef struct lcp_packet ipcp_pkt_t;
 
 /* From ppp.c */
 int _ppp_enter_phase(int phase);
+void _ppp_update_accm(void);
 
 /* From lcp.c */
 int _ppp_lcp_init(ppp_state_t *state);
@@ -105,4 +108,29 @@ int _ppp_pap_init(ppp_state_t *state);
 /* From ipcp.c */
 int _ppp_ipcp_init(ppp_state_t *state);
 
+/* From vj.c */
+#define VJ_MAX_SLOTS    16
+#define VJ_MAX_HDR      128     /* Largest IP + TCP header a slot holds */
+
+/* Set up the slots for each direction, to be called when IPCP is done
+   negotiating. Zero slots turns compression off that way. */
+void _ppp_vj_tx_config(int slots, int cid_comp);
+void _ppp_vj_rx_config(int slots);
+int _ppp_vj_tx_enabled(void);
+
+/* Tell the decompressor a frame was lost, so it waits for the next full
+   header rather than applying deltas to the wrong one. */
+void _ppp_vj_toss(void);
+
+/* Compress an outgoing IPv4 packet. This returns the PPP protocol to send it
+   under, and fills in the header to send in place of the first skip bytes of
+   the packet. Must be called with the PPP lock held. */
+uint16_t _ppp_vj_compress(const uint8_t *pkt, size_t len, uint8_t *hdr,
+                          size_t *hdr_len, size_t *skip);
+
+/* Rebuild an IPv4 packet from one received as proto. Returns its length, or
+   -1 if it has to be dropped. */
+ssize_t _ppp_vj_uncompress(uint16_t proto, const uint8_t *in, size_t len,
+                           uint8_t *out, size_t out_len);
+
 #endif /* !__LOCAL_PPP_PPP_INTERNAL_H */
@@ -48,18 +48,26 @@ static int ppp_modem_tx(ppp_device_t *self, const uint8_t *data, size_t len,
 }
 
 static const uint8_t *ppp_modem_rx(ppp_device_t *self, ssize_t *out_len) {
-    static uint8_t rb[1024];
-    int cnt = 0;
+    static int last_cnt = 0;
+    const uint8_t *rv;
+    int cnt;
 
     (void)self;
 
-    /* Read anything that's waiting. */
-    cnt = modem_read_data((unsigned char *)rb, 1024);
+    /* Whatever we handed out last time has been dealt with by now, so let the
+       modem have that space back. */
+    if(last_cnt) {
+        modem_read_consume(last_cnt);
+        last_cnt = 0;
+    }
+
+    /* Hand out anything that's waiting straight from the modem's buffer. */
+    rv = modem_read_peek(&cnt);
 
-    /* If we got anything, return what we got. */
-    if(cnt) {
+    if(rv) {
+        last_cnt = cnt;
         *out_len = (ssize_t)cnt;
-        return rb;
+        return rv;
     }
 
     *out_len = 0;
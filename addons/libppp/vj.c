@@ -0,0 +1,510 @@
+/* KallistiOS ##version##
+
+   libppp/vj.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Van Jacobson TCP/IP header compression, as described in RFC 1144. Each
+   TCP connection gets a slot on both ends of the link holding the last header
+   sent on it, so that only the fields that changed since then have to be sent.
+   Over a modem that takes the usual 40 bytes of headers down to 3 to 5. */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#include "ppp_internal.h"
+#include "net_ipv4.h"
+
+/* Bits in the first byte of a compressed header. */
+#define NEW_C           0x40    /* Connection number follows */
+#define NEW_I           0x20    /* IP ID changed by something other than 1 */
+#define TCP_PUSH_BIT    0x10
+#define NEW_S           0x08
+#define NEW_A           0x04
+#define NEW_W           0x02
+#define NEW_U           0x01
+
+/* Combinations of the above that can't happen otherwise, used for the two
+   most common cases. */
+#define SPECIAL_I       (NEW_S | NEW_W | NEW_U)     /* Echoed interactive */
+#define SPECIAL_D       (NEW_S | NEW_A | NEW_W | NEW_U) /* Unidirectional data */
+#define SPECIALS_MASK   (NEW_S | NEW_A | NEW_W | NEW_U)
+
+/* TCP flags */
+#define TH_FIN          0x01
+#define TH_SYN          0x02
+#define TH_RST          0x04
+#define TH_PUSH         0x08
+#define TH_ACK          0x10
+#define TH_URG          0x20
+
+/* Offsets of the fields we care about in the headers. */
+#define IP_LEN          2
+#define IP_ID           4
+#define IP_FRAG         6
+#define IP_PROTO        9
+#define IP_CSUM         10
+#define IP_SRC          12
+
+#define TCP_SEQ         4
+#define TCP_ACK         8
+#define TCP_OFF         12
+#define TCP_FLAGS       13
+#define TCP_WIN         14
+#define TCP_CSUM        16
+#define TCP_URP         18
+
+typedef struct vj_slot {
+    uint8_t hdr[VJ_MAX_HDR];
+    uint8_t hlen;
+    uint8_t valid;
+    uint32_t used;              /* For picking the least recently used */
+} vj_slot_t;
+
+static struct {
+    vj_slot_t tx[VJ_MAX_SLOTS];
+    vj_slot_t rx[VJ_MAX_SLOTS];
+    int tx_slots;
+    int tx_cid_comp;
+    int rx_slots;
+    int last_tx;
+    int last_rx;
+    int toss;
+    uint32_t clock;
+} vj;
+
+static inline uint16_t get16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)(v >> 8);
+    p[1] = (uint8_t)v;
+}
+
+static inline void put32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24);
+    p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);
+    p[3] = (uint8_t)v;
+}
+
+/* Deltas go out in one byte if they fit, or as a zero and two bytes if not.
+   The Z version is for those that may be zero themselves. */
+static inline uint8_t *encode(uint8_t *cp, uint16_t n) {
+    if(n >= 256) {
+        *cp++ = 0;
+        *cp++ = (uint8_t)(n >> 8);
+    }
+
+    *cp++ = (uint8_t)n;
+    return cp;
+}
+
+static inline uint8_t *encodez(uint8_t *cp, uint16_t n) {
+    if(n >= 256 || n == 0) {
+        *cp++ = 0;
+        *cp++ = (uint8_t)(n >> 8);
+    }
+
+    *cp++ = (uint8_t)n;
+    return cp;
+}
+
+static inline const uint8_t *decode(const uint8_t *cp, const uint8_t *end,
+                                    uint16_t *n) {
+    if(cp >= end)
+        return NULL;
+
+    if(*cp) {
+        *n = *cp;
+        return cp + 1;
+    }
+
+    if(end - cp < 3)
+        return NULL;
+
+    *n = get16(cp + 1);
+    return cp + 3;
+}
+
+void _ppp_vj_tx_config(int slots, int cid_comp) {
+    memset(vj.tx, 0, sizeof(vj.tx));
+    vj.tx_slots = slots > VJ_MAX_SLOTS ? VJ_MAX_SLOTS : slots;
+    vj.tx_cid_comp = cid_comp;
+    vj.last_tx = -1;
+}
+
+void _ppp_vj_rx_config(int slots) {
+    memset(vj.rx, 0, sizeof(vj.rx));
+    vj.rx_slots = slots > VJ_MAX_SLOTS ? VJ_MAX_SLOTS : slots;
+    vj.last_rx = -1;
+    vj.toss = 1;
+}
+
+int _ppp_vj_tx_enabled(void) {
+    return vj.tx_slots != 0;
+}
+
+void _ppp_vj_toss(void) {
+    vj.toss = 1;
+}
+
+uint16_t _ppp_vj_compress(const uint8_t *pkt, size_t len, uint8_t *hdr,
+                          size_t *hdr_len, size_t *skip) {
+    const uint8_t *th, *oip, *oth;
+    vj_slot_t *cs = NULL, *lru = NULL;
+    uint8_t deltas[16], *cp = deltas;
+    size_t ihl, hlen;
+    uint32_t seq, ack, oseq, oack, dseq, dack;
+    uint16_t dw, did;
+    uint8_t changes = 0, flags;
+    int i, id;
+
+    *hdr_len = *skip = 0;
+
+    if(!vj.tx_slots || len < 40 || (pkt[0] & 0xf0) != 0x40 ||
+       pkt[IP_PROTO] != IPPROTO_TCP)
+        return PPP_PROTOCOL_IPv4;
+
+    ihl = (pkt[0] & 0x0f) << 2;
+
+    /* Fragments are left alone, as are packets that are set up or tear down
+       a connection: those need the full header to get through. */
+    if(ihl < 20 || (get16(pkt + IP_FRAG) & 0x3fff) || len < ihl + 20)
+        return PPP_PROTOCOL_IPv4;
+
+    th = pkt + ihl;
+    flags = th[TCP_FLAGS];
+
+    if((flags & (TH_SYN | TH_FIN | TH_RST | TH_ACK)) != TH_ACK)
+        return PPP_PROTOCOL_IPv4;
+
+    hlen = ihl + ((th[TCP_OFF] >> 4) << 2);
+
+    if(hlen < ihl + 20 || hlen > len || hlen > VJ_MAX_HDR)
+        return PPP_PROTOCOL_IPv4;
+
+    /* Find the connection's slot by address and port pair, remembering the
+       least recently used one in case it has none yet. */
+    for(i = 0; i < vj.tx_slots; i++) {
+        vj_slot_t *s = &vj.tx[i];
+
+        if(s->valid && !memcmp(s->hdr + IP_SRC, pkt + IP_SRC, 8) &&
+           !memcmp(s->hdr + (s->hdr[0] & 0x0f) * 4, th, 4)) {
+            cs = s;
+            break;
+        }
+
+        if(!lru || (lru->valid && (!s->valid || s->used < lru->used)))
+            lru = s;
+    }
+
+    if(!cs)
+        cs = lru;
+
+    id = cs - vj.tx;
+    cs->used = ++vj.clock;
+
+    if(i == vj.tx_slots)
+        goto uncompressed;
+
+    oip = cs->hdr;
+    oth = cs->hdr + ihl;
+
+    /* Anything that changed other than the fields we can send deltas of
+       means the other side needs a whole new copy. */
+    if(memcmp(oip, pkt, 2) || memcmp(oip + IP_FRAG, pkt + IP_FRAG, 3) ||
+       cs->hlen != hlen ||
+       memcmp(oip + 20, pkt + 20, ihl - 20) ||
+       memcmp(oth + 20, th + 20, hlen - ihl - 20))
+        goto uncompressed;
+
+    if(flags & TH_URG) {
+        cp = encodez(cp, get16(th + TCP_URP));
+        changes |= NEW_U;
+    }
+    else if(get16(th + TCP_URP) != get16(oth + TCP_URP)) {
+        goto uncompressed;
+    }
+
+    if((dw = (uint16_t)(get16(th + TCP_WIN) - get16(oth + TCP_WIN)))) {
+        cp = encode(cp, dw);
+        changes |= NEW_W;
+    }
+
+    ack = get32(th + TCP_ACK);
+    oack = get32(oth + TCP_ACK);
+
+    if((dack = ack - oack)) {
+        if(dack > 0xffff)
+            goto uncompressed;
+
+        cp = encode(cp, (uint16_t)dack);
+        changes |= NEW_A;
+    }
+
+    seq = get32(th + TCP_SEQ);
+    oseq = get32(oth + TCP_SEQ);
+
+    if((dseq = seq - oseq)) {
+        if(dseq > 0xffff)
+            goto uncompressed;
+
+        cp = encode(cp, (uint16_t)dseq);
+        changes |= NEW_S;
+    }
+
+    switch(changes) {
+        case 0:
+            /* Nothing changed. Data following a bare ACK is normal for an
+               interactive connection, so that goes out compressed. Anything
+               else is likely a retransmit, which goes out whole in case the
+               other side missed the compressed version. */
+            if(get16(pkt + IP_LEN) != get16(oip + IP_LEN) &&
+               get16(oip + IP_LEN) == hlen)
+                break;
+
+            goto uncompressed;
+
+        case SPECIAL_I:
+        case SPECIAL_D:
+            /* These would be read back as the special cases below */
+            goto uncompressed;
+
+        case NEW_S | NEW_A:
+            if(dseq == dack && dseq == get16(oip + IP_LEN) - hlen) {
+                /* Echoed terminal traffic */
+                changes = SPECIAL_I;
+                cp = deltas;
+            }
+            break;
+
+        case NEW_S:
+            if(dseq == get16(oip + IP_LEN) - hlen) {
+                /* Bulk data going one way */
+                changes = SPECIAL_D;
+                cp = deltas;
+            }
+            break;
+    }
+
+    if((did = (uint16_t)(get16(pkt + IP_ID) - get16(oip + IP_ID))) != 1) {
+        cp = encodez(cp, did);
+        changes |= NEW_I;
+    }
+
+    if(flags & TH_PUSH)
+        changes |= TCP_PUSH_BIT;
+
+    memcpy(cs->hdr, pkt, hlen);
+
+    i = 0;
+
+    if(!vj.tx_cid_comp || vj.last_tx != id) {
+        vj.last_tx = id;
+        hdr[i++] = changes | NEW_C;
+        hdr[i++] = (uint8_t)id;
+    }
+    else {
+        hdr[i++] = changes;
+    }
+
+    hdr[i++] = th[TCP_CSUM];
+    hdr[i++] = th[TCP_CSUM + 1];
+    memcpy(hdr + i, deltas, cp - deltas);
+
+    *hdr_len = i + (cp - deltas);
+    *skip = hlen;
+
+    return PPP_PROTOCOL_VJ_COMP;
+
+uncompressed:
+    /* Send the header whole, with the slot in place of the protocol. */
+    memcpy(cs->hdr, pkt, hlen);
+    cs->hlen = hlen;
+    cs->valid = 1;
+    vj.last_tx = id;
+
+    memcpy(hdr, pkt, hlen);
+    hdr[IP_PROTO] = (uint8_t)id;
+
+    *hdr_len = *skip = hlen;
+
+    return PPP_PROTOCOL_VJ_UNCOMP;
+}
+
+static ssize_t vj_uncompressed(const uint8_t *in, size_t len, uint8_t *out,
+                               size_t out_len) {
+    vj_slot_t *cs;
+    size_t ihl, hlen;
+    int id;
+
+    if(len < 40 || len > out_len || (in[0] & 0xf0) != 0x40)
+        goto bad;
+
+    id = in[IP_PROTO];
+    ihl = (in[0] & 0x0f) << 2;
+
+    if(id >= vj.rx_slots || ihl < 20 || len < ihl + 20)
+        goto bad;
+
+    hlen = ihl + ((in[ihl + TCP_OFF] >> 4) << 2);
+
+    if(hlen < ihl + 20 || hlen > len || hlen > VJ_MAX_HDR)
+        goto bad;
+
+    memcpy(out, in, len);
+    out[IP_PROTO] = IPPROTO_TCP;
+
+    cs = &vj.rx[id];
+    memcpy(cs->hdr, out, hlen);
+    cs->hlen = hlen;
+    cs->valid = 1;
+
+    vj.last_rx = id;
+    vj.toss = 0;
+
+    return len;
+
+bad:
+    vj.toss = 1;
+    return -1;
+}
+
+static ssize_t vj_compressed(const uint8_t *in, size_t len, uint8_t *out,
+                             size_t out_len) {
+    const uint8_t *cp = in, *end = in + len;
+    uint8_t *ip, *th;
+    vj_slot_t *cs;
+    uint8_t changes;
+    uint16_t n, olen, csum;
+    size_t ihl, data;
+
+    if(len < 3)
+        goto bad;
+
+    changes = *cp++;
+
+    if(changes & NEW_C) {
+        if(*cp >= vj.rx_slots)
+            goto bad;
+
+        vj.last_rx = *cp++;
+        vj.toss = 0;
+    }
+    else if(vj.toss) {
+        /* Something got lost since the connection was last named, so there
+           is no telling what this is relative to. */
+        return -1;
+    }
+
+    if(vj.last_rx < 0 || !vj.rx[vj.last_rx].valid || end - cp < 2)
+        goto bad;
+
+    cs = &vj.rx[vj.last_rx];
+    ip = cs->hdr;
+    ihl = (ip[0] & 0x0f) << 2;
+    th = ip + ihl;
+    olen = get16(ip + IP_LEN);
+
+    th[TCP_CSUM] = *cp++;
+    th[TCP_CSUM + 1] = *cp++;
+
+    if(changes & TCP_PUSH_BIT)
+        th[TCP_FLAGS] |= TH_PUSH;
+    else
+        th[TCP_FLAGS] &= ~TH_PUSH;
+
+    switch(changes & SPECIALS_MASK) {
+        case SPECIAL_I:
+            put32(th + TCP_SEQ, get32(th + TCP_SEQ) + olen - cs->hlen);
+            put32(th + TCP_ACK, get32(th + TCP_ACK) + olen - cs->hlen);
+            break;
+
+        case SPECIAL_D:
+            put32(th + TCP_SEQ, get32(th + TCP_SEQ) + olen - cs->hlen);
+            break;
+
+        default:
+            if(changes & NEW_U) {
+                if(!(cp = decode(cp, end, &n)))
+                    goto bad;
+
+                th[TCP_FLAGS] |= TH_URG;
+                put16(th + TCP_URP, n);
+            }
+            else {
+                th[TCP_FLAGS] &= ~TH_URG;
+            }
+
+            if(changes & NEW_W) {
+                if(!(cp = decode(cp, end, &n)))
+                    goto bad;
+
+                put16(th + TCP_WIN, get16(th + TCP_WIN) + n);
+            }
+
+            if(changes & NEW_A) {
+                if(!(cp = decode(cp, end, &n)))
+                    goto bad;
+
+                put32(th + TCP_ACK, get32(th + TCP_ACK) + n);
+            }
+
+            if(changes & NEW_S) {
+                if(!(cp = decode(cp, end, &n)))
+                    goto bad;
+
+                put32(th + TCP_SEQ, get32(th + TCP_SEQ) + n);
+            }
+            break;
+    }
+
+    if(changes & NEW_I) {
+        if(!(cp = decode(cp, end, &n)))
+            goto bad;
+    }
+    else {
+        n = 1;
+    }
+
+    put16(ip + IP_ID, get16(ip + IP_ID) + n);
+
+    /* Whatever is left is the data. Put the rebuilt header in front of it. */
+    data = end - cp;
+
+    if(cs->hlen + data > out_len)
+        goto bad;
+
+    put16(ip + IP_LEN, cs->hlen + data);
+    put16(ip + IP_CSUM, 0);
+    csum = net_ipv4_checksum(ip, ihl, 0);
+    memcpy(ip + IP_CSUM, &csum, 2);
+
+    memcpy(out, cs->hdr, cs->hlen);
+    memcpy(out + cs->hlen, cp, data);
+
+    return cs->hlen + data;
+
+bad:
+    vj.toss = 1;
+    return -1;
+}
+
+ssize_t _ppp_vj_uncompress(uint16_t proto, const uint8_t *in, size_t len,
+                           uint8_t *out, size_t out_len) {
+    if(!vj.rx_slots)
+        return -1;
+
+    if(proto == PPP_PROTOCOL_VJ_UNCOMP)
+        return vj_uncompressed(in, len, out, out_len);
+    else
+        return vj_compressed(in, len, out, out_len);
+}
@@ -12,7 +12,8 @@
 
 int pthread_mutex_unlock(pthread_mutex_t *mutex) {
     if(mutex->type == PTHREAD_MUTEX_ERRORCHECK &&
-       (mutex->mutex.count == 0 || mutex->mutex.holder != thd_get_current())) {
+       (mutex->mutex.count == 0 ||
+        __mutex_holder(&mutex->mutex) != thd_get_current())) {
         return EFAULT;
     }
 
@@ -0,0 +1,142 @@
+/* KallistiOS ##version##
+
+   speedtest.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* This measures the checksums and hashes KOS provides over a buffer in main
+   RAM, first checking the CRCs against plain bit at a time versions of them.
+   Each is run over the buffer a few times, from the cache and from RAM. */
+
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <arch/timer.h>
+#include <kos/md5.h>
+#include <kos/net.h>
+#include <kos/xxhash.h>
+
+#define BUF_SIZE    (1024 * 1024)
+#define SMALL_SIZE  (4 * 1024)
+#define RUNS        4
+
+static alignas(32) uint8_t buf[BUF_SIZE];
+
+static volatile uint32_t sink;
+
+static uint32_t ref_crc32le(const uint8_t *data, int size) {
+    uint32_t rv = 0xFFFFFFFF;
+    int i;
+
+    while(size--) {
+        rv ^= *data++;
+
+        for(i = 0; i < 8; i++)
+            rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
+    }
+
+    return ~rv;
+}
+
+static uint16_t ref_crc16ccitt(const uint8_t *data, int size, uint16_t rv) {
+    int i;
+
+    while(size--) {
+        rv ^= *data++ << 8;
+
+        for(i = 0; i < 8; i++)
+            rv = (rv & 0x8000) ? (rv << 1) ^ 0x1021 : rv << 1;
+    }
+
+    return rv;
+}
+
+static void run_crc32(const uint8_t *data, int size) {
+    sink = net_crc32le(data, size);
+}
+
+static void run_crc16(const uint8_t *data, int size) {
+    sink = net_crc16ccitt(data, size, 0);
+}
+
+static void run_xxh32(const uint8_t *data, int size) {
+    sink = kos_xxh32(data, size, 0);
+}
+
+static void run_md5(const uint8_t *data, int size) {
+    uint8_t out[16];
+
+    kos_md5(data, size, out);
+    sink = out[0];
+}
+
+static void run_ref_crc32(const uint8_t *data, int size) {
+    sink = ref_crc32le(data, size);
+}
+
+static const struct {
+    const char *name;
+    void (*run)(const uint8_t *data, int size);
+} tests[] = {
+    { "CRC-32 (bitwise)", run_ref_crc32 },
+    { "CRC-32",           run_crc32 },
+    { "CRC16-CCITT",      run_crc16 },
+    { "xxHash32",         run_xxh32 },
+    { "MD5",              run_md5 },
+};
+
+/* Throughput in KB/s of a test, over size bytes repeated to make 1MB */
+static uint32_t measure(unsigned int test, int size) {
+    uint64_t before, after;
+    int i, j;
+
+    before = timer_us_gettime64();
+
+    for(i = 0; i < RUNS; i++)
+        for(j = 0; j < BUF_SIZE / size; j++)
+            tests[test].run(buf + (size == BUF_SIZE ? 0 : 32), size);
+
+    after = timer_us_gettime64();
+
+    if(after == before)
+        return 0;
+
+    return (uint32_t)((uint64_t)RUNS * BUF_SIZE * 1000000 / 1024 /
+                      (after - before));
+}
+
+int main(int argc, char **argv) {
+    unsigned int i;
+    int size, bad = 0;
+
+    (void)argc;
+    (void)argv;
+
+    srand(1234);
+
+    for(i = 0; i < BUF_SIZE; i++)
+        buf[i] = rand();
+
+    /* Odd sizes and alignments, to go through the edges of each loop */
+    for(size = 0; size < 100; size++) {
+        for(i = 0; i < 4; i++) {
+            if(net_crc32le(buf + i, size) != ref_crc32le(buf + i, size) ||
+               net_crc16ccitt(buf + i, size, 0xFFFF) !=
+               ref_crc16ccitt(buf + i, size, 0xFFFF))
+                bad++;
+        }
+    }
+
+    printf("CRC check: %s\n", bad ? "FAILED" : "ok");
+
+    printf("%-18s %12s %12s\n", "", "4KB (KB/s)", "1MB (KB/s)");
+
+    for(i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+        printf("%-18s %12lu %12lu\n", tests[i].name,
+               (unsigned long)measure(i, SMALL_SIZE),
+               (unsigned long)measure(i, BUF_SIZE));
+
+    return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
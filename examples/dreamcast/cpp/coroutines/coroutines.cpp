@@ -0,0 +1,94 @@
+/* KallistiOS ##version##
+
+   coroutines.cpp
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* This runs two coroutines on one executor thread: one reads from
+   /dev/urandom with asynchronous reads, while the other draws frames and
+   waits for the PVR to be done with each of them. Neither of them blocks the
+   thread, so they take turns as their I/O completes. The main thread waits
+   for both of them to be over. */
+
+#include <kos.h>
+#include <kos/coro.hpp>
+
+#include <stdio.h>
+
+/* Both coroutines run on the executor thread, one at a time, so this needs
+   no lock. */
+static volatile int running = 2;
+
+static void finished() {
+    running = running - 1;
+
+    if(!running)
+        genwait_wake_all((void *)&running);
+}
+
+static kos::task reader() {
+    static uint8_t buf[4096];
+    uint32_t sum = 0;
+    size_t total = 0;
+    file_t fd;
+
+    if((fd = fs_open("/dev/urandom", O_RDONLY)) < 0) {
+        printf("Can't open /dev/urandom\n");
+        finished();
+        co_return;
+    }
+
+    while(total < 256 * 1024) {
+        ssize_t n = co_await kos::async_read(fd, buf, sizeof(buf));
+
+        if(n <= 0)
+            break;
+
+        for(ssize_t i = 0; i < n; i++)
+            sum += buf[i];
+
+        total += n;
+    }
+
+    fs_close(fd);
+    printf("Read %u bytes, average %u\n", (unsigned)total,
+           total ? (unsigned)(sum / total) : 0);
+    finished();
+}
+
+static kos::task frames() {
+    for(int i = 0; i < 180; i++) {
+        pvr_fence_t fence;
+
+        pvr_set_bg_color(0.0f, (i % 60) / 60.0f, 0.25f);
+        pvr_scene_begin();
+        fence = pvr_scene_finish_async();
+        co_await kos::render_done(fence);
+    }
+
+    printf("Drew 180 frames\n");
+    finished();
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    pvr_init_defaults();
+
+    kos::executor exec;
+
+    if(!exec.ok() || exec.spawn(reader()) || exec.spawn(frames())) {
+        printf("Can't start the executor\n");
+        return 1;
+    }
+
+    {
+        irq_disable_scoped();
+
+        while(running)
+            genwait_wait((void *)&running, "coroutines", 0, NULL);
+    }
+
+    return 0;
+}
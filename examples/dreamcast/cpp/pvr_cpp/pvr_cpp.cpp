@@ -0,0 +1,133 @@
+/* KallistiOS ##version##
+
+   pvr_cpp.cpp
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* This draws a spinning fan of Gouraud shaded triangles and a textured quad
+   over it, with the headers for both compiled at build time by dc/pvr.hpp.
+   Press Start to exit. */
+
+#include <kos.h>
+#include <dc/pvr.hpp>
+
+#include <math.h>
+#include <stdint.h>
+
+using col_vtx = pvr::vertex<pvr::Untextured, pvr::Gouraud, pvr::Packed>;
+using txr_vtx = pvr::vertex<pvr::Textured, pvr::Flat, pvr::Packed>;
+
+static constexpr int TXR_SIZE = 64;
+
+/* Neither of these costs anything at runtime: they're just 32 bytes each in
+   the binary. Only the texture's address is added when drawing. */
+static constexpr pvr::header col_hdr =
+    pvr::compile(pvr::with_format<col_vtx>(pvr::cxt_col(PVR_LIST_OP_POLY)));
+
+static constexpr pvr::header txr_hdr =
+    pvr::compile(pvr::with_format<txr_vtx>(
+        pvr::cxt_txr(PVR_LIST_TR_POLY,
+                     PVR_TXRFMT_ARGB4444 | PVR_TXRFMT_NONTWIDDLED,
+                     TXR_SIZE, TXR_SIZE, PVR_FILTER_BILINEAR)));
+
+static pvr_ptr_t make_texture() {
+    static uint16_t pixels[TXR_SIZE * TXR_SIZE];
+    pvr_ptr_t txr = pvr_mem_malloc(sizeof(pixels));
+
+    for(int y = 0; y < TXR_SIZE; y++)
+        for(int x = 0; x < TXR_SIZE; x++)
+            pixels[y * TXR_SIZE + x] = ((x ^ y) & 8) ? 0xffff : 0x80f0;
+
+    pvr_txr_load(pixels, txr, sizeof(pixels));
+    return txr;
+}
+
+static void draw_fan(float angle) {
+    col_vtx v = {};
+    const int count = 12;
+
+    pvr::list_scope list(PVR_LIST_OP_POLY);
+    col_hdr.submit();
+
+    for(int i = 0; i < count; i++) {
+        float a0 = angle + i * 2.0f * F_PI / count;
+        float a1 = a0 + F_PI / count;
+
+        v.end_strip(false);
+        v.x = 320.0f;
+        v.y = 240.0f;
+        v.z = 1.0f;
+        v.argb = 0xffffffff;
+        pvr::submit(v);
+
+        v.x = 320.0f + fcos(a0) * 200.0f;
+        v.y = 240.0f + fsin(a0) * 200.0f;
+        v.argb = 0xff000000 | (i * 0x15) << 16 | 0x40;
+        pvr::submit(v);
+
+        v.end_strip();
+        v.x = 320.0f + fcos(a1) * 200.0f;
+        v.y = 240.0f + fsin(a1) * 200.0f;
+        v.argb = 0xff0000ff;
+        pvr::submit(v);
+    }
+}
+
+static void draw_quad(pvr_ptr_t txr) {
+    static const float pos[4][4] = {
+        { 224.0f, 336.0f, 0.0f, 1.0f },
+        { 224.0f, 144.0f, 0.0f, 0.0f },
+        { 416.0f, 336.0f, 1.0f, 1.0f },
+        { 416.0f, 144.0f, 1.0f, 0.0f },
+    };
+    txr_vtx v = {};
+
+    pvr::list_scope list(PVR_LIST_TR_POLY);
+    txr_hdr.texture(txr).submit();
+
+    for(int i = 0; i < 4; i++) {
+        v.end_strip(i == 3);
+        v.x = pos[i][0];
+        v.y = pos[i][1];
+        v.z = 2.0f;
+        v.u = pos[i][2];
+        v.v = pos[i][3];
+        v.argb = 0xc0ffffff;
+        pvr::submit(v);
+    }
+}
+
+int main(int argc, char **argv) {
+    float angle = 0.0f;
+    pvr_ptr_t txr;
+
+    (void)argc;
+    (void)argv;
+
+    pvr_init_defaults();
+    txr = make_texture();
+
+    for(;;) {
+        maple_device_t *cont = maple_enum_type(0, MAPLE_FUNC_CONTROLLER);
+
+        if(cont) {
+            cont_state_t *state = (cont_state_t *)maple_dev_status(cont);
+
+            if(state && (state->buttons & CONT_START))
+                break;
+        }
+
+        pvr_wait_ready();
+
+        {
+            pvr::scene_scope scene;
+            draw_fan(angle);
+            draw_quad(txr);
+        }
+
+        angle += 0.01f;
+    }
+
+    pvr_mem_free(txr);
+    return 0;
+}
@@ -0,0 +1,625 @@
+/* KallistiOS ##version##
+
+   kosbench.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   This program runs a fixed set of microbenchmarks, so that performance can
+   be compared from one KOS revision to the next: memory copies, store queue
+   copies, PVR polygon submission, sound stream refills, TCP and UDP over the
+   loopback, file reads from /rd, /cd and an SD card, mutex ping-pong and
+   thread switches. Devices that aren't there are skipped.
+
+   The results go out as one line of JSON, starting with "kosbench: ", on the
+   console, and to /pc/kosbench.json if the program was loaded with dcload.
+   The kosbench.py script in utils/kosbench compares them with a baseline.
+
+   Keep the tests and their names the same from one revision to the next, or
+   the results can't be compared.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <malloc.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <kos/init.h>
+#include <kos/thread.h>
+#include <kos/mutex.h>
+#include <kos/cond.h>
+#include <kos/timer.h>
+#include <kos/version.h>
+#include <kos/net.h>
+
+#include <dc/sq.h>
+#include <dc/pvr.h>
+#include <dc/sd.h>
+#include <dc/sound/sound.h>
+#include <dc/sound/stream.h>
+
+#include <fat/fs_fat.h>
+
+KOS_INIT_FLAGS(INIT_DEFAULT | INIT_NET);
+
+#define RESULTS_FILE    "/pc/kosbench.json"
+#define MAX_RESULTS     48
+
+#define COPY_SIZE       (64 * 1024)
+#define COPY_ROUNDS     64
+
+#define PVR_FRAMES      60
+#define PVR_POLYS       8000
+
+#define STREAM_TIME_MS  2000
+#define STREAM_SAMPLES  8192
+
+#define LOOPBACK        0x7f000001
+#define NET_PORT        7421
+#define UDP_ROUNDS      1000
+#define UDP_SIZE        1024
+#define TCP_SIZE        (512 * 1024)
+
+#define FILE_MAX        (1024 * 1024)
+#define FILE_CHUNK      (32 * 1024)
+
+#define SYNC_ROUNDS     10000
+
+typedef struct result {
+    const char *name;
+    const char *unit;
+    double value;
+    int higher_better;
+} result_t;
+
+static result_t results[MAX_RESULTS];
+static int result_cnt;
+
+static void add_result(const char *name, const char *unit, double value,
+                       int higher_better) {
+    if(result_cnt == MAX_RESULTS)
+        return;
+
+    results[result_cnt].name = name;
+    results[result_cnt].unit = unit;
+    results[result_cnt].value = value;
+    results[result_cnt].higher_better = higher_better;
+    result_cnt++;
+
+    printf("  %-24s %12.3f %s\n", name, value, unit);
+}
+
+static double mbps(uint64_t bytes, uint64_t ns) {
+    return ns ? (double)bytes * 1000.0 / (double)ns : 0.0;
+}
+
+/* Memory copies */
+
+typedef void *(*copy_fn_t)(void *dest, const void *src, size_t n);
+
+static void *sq_cpy_fn(void *dest, const void *src, size_t n) {
+    return sq_cpy(dest, src, n);
+}
+
+static void *memset_fn(void *dest, const void *src, size_t n) {
+    (void)src;
+    return memset(dest, 0, n);
+}
+
+static void bench_copy(const char *name, copy_fn_t fn, uint8_t *dst,
+                       const uint8_t *src) {
+    uint64_t start;
+    int i;
+
+    /* Once to warm the cache up, then for real */
+    fn(dst, src, COPY_SIZE);
+    start = timer_ns_gettime64();
+
+    for(i = 0; i < COPY_ROUNDS; i++)
+        fn(dst, src, COPY_SIZE);
+
+    add_result(name, "MB/s",
+               mbps((uint64_t)COPY_SIZE * COPY_ROUNDS,
+                    timer_ns_gettime64() - start), 1);
+}
+
+static void bench_memory(void) {
+    uint8_t *src = memalign(32, COPY_SIZE + 32);
+    uint8_t *dst = memalign(32, COPY_SIZE + 32);
+
+    if(!src || !dst) {
+        printf("memory: out of memory\n");
+        goto out;
+    }
+
+    memset(src, 0x5a, COPY_SIZE + 32);
+
+    bench_copy("memcpy_aligned", memcpy, dst, src);
+    bench_copy("memcpy_unaligned", memcpy, dst + 1, src + 3);
+    bench_copy("memset", memset_fn, dst, src);
+    bench_copy("memmove_overlap", memmove, dst + 8, dst);
+    bench_copy("sq_cpy", sq_cpy_fn, dst, src);
+
+out:
+    free(dst);
+    free(src);
+}
+
+/* PVR submission, pvrmark style: lots of small flat triangles */
+
+static void bench_pvr(void) {
+    pvr_init_params_t params = {
+        { PVR_BINSIZE_16, PVR_BINSIZE_0, PVR_BINSIZE_0, PVR_BINSIZE_0,
+          PVR_BINSIZE_0 },
+        1024 * 1024, 0, 0, 0, 0, 0
+    };
+    pvr_poly_cxt_t cxt;
+    pvr_poly_hdr_t hdr;
+    pvr_vertex_t vert;
+    uint32_t seed = 0xdeadbeef;
+    uint64_t start, submit = 0, t;
+    int frame, i, x, y;
+
+    if(pvr_init(&params)) {
+        printf("pvr: couldn't initialize\n");
+        return;
+    }
+
+    pvr_poly_cxt_col(&cxt, PVR_LIST_OP_POLY);
+    cxt.gen.shading = PVR_SHADE_FLAT;
+    pvr_poly_compile(&hdr, &cxt);
+
+    start = timer_ns_gettime64();
+
+    for(frame = 0; frame < PVR_FRAMES; frame++) {
+        pvr_wait_ready();
+        t = timer_ns_gettime64();
+        pvr_scene_begin();
+        pvr_list_begin(PVR_LIST_OP_POLY);
+        pvr_prim(&hdr, sizeof(hdr));
+
+        for(i = 0; i < PVR_POLYS; i++) {
+            seed = seed * 1164525 + 1013904223;
+            x = (seed >> 8) % 620;
+            y = (seed >> 20) % 460;
+
+            vert.flags = PVR_CMD_VERTEX;
+            vert.x = x;
+            vert.y = y + 20;
+            vert.z = 1.0f + (i & 127);
+            vert.argb = 0xff000000 | seed;
+            vert.oargb = 0;
+            pvr_prim(&vert, sizeof(vert));
+
+            vert.y = y;
+            pvr_prim(&vert, sizeof(vert));
+
+            vert.flags = PVR_CMD_VERTEX_EOL;
+            vert.x = x + 20;
+            vert.y = y + 20;
+            pvr_prim(&vert, sizeof(vert));
+        }
+
+        pvr_list_finish();
+        submit += timer_ns_gettime64() - t;
+        pvr_scene_finish();
+    }
+
+    pvr_wait_ready();
+    t = timer_ns_gettime64() - start;
+
+    add_result("pvr_submit", "Mpolys/s",
+               (double)PVR_POLYS * PVR_FRAMES * 1000.0 / (double)submit, 1);
+    add_result("pvr_frame", "ms",
+               (double)t / PVR_FRAMES / 1000000.0, 0);
+
+    pvr_shutdown();
+}
+
+/* Sound stream refills, with a callback that has its data ready */
+
+static int16_t *stream_buf;
+static uint32_t stream_samples;
+
+static void *stream_cb(snd_stream_hnd_t hnd, int req, int *recv) {
+    (void)hnd;
+
+    if(req > STREAM_SAMPLES)
+        req = STREAM_SAMPLES;
+
+    stream_samples += req;
+    *recv = req;
+    return stream_buf;
+}
+
+static void bench_stream(void) {
+    snd_stream_hnd_t hnd;
+    uint64_t end, in_poll = 0, t;
+
+    if(!(stream_buf = memalign(32, STREAM_SAMPLES * 4))) {
+        printf("snd_stream: out of memory\n");
+        return;
+    }
+
+    memset(stream_buf, 0, STREAM_SAMPLES * 4);
+
+    if(snd_stream_init()) {
+        printf("snd_stream: couldn't initialize\n");
+        free(stream_buf);
+        return;
+    }
+
+    hnd = snd_stream_alloc(stream_cb, SND_STREAM_BUFFER_MAX);
+
+    if(hnd == SND_STREAM_INVALID) {
+        printf("snd_stream: couldn't allocate a stream\n");
+        goto out;
+    }
+
+    snd_stream_volume(hnd, 0);
+    snd_stream_start(hnd, 44100, 1);
+    stream_samples = 0;
+    end = timer_ns_gettime64() + STREAM_TIME_MS * 1000000ULL;
+
+    while(timer_ns_gettime64() < end) {
+        t = timer_ns_gettime64();
+        snd_stream_poll(hnd);
+        in_poll += timer_ns_gettime64() - t;
+        thd_sleep(5);
+    }
+
+    snd_stream_stop(hnd);
+    snd_stream_destroy(hnd);
+
+    /* Stereo samples are 4 bytes */
+    add_result("snd_stream_fill", "MB/s",
+               mbps((uint64_t)stream_samples * 4, in_poll), 1);
+
+out:
+    snd_stream_shutdown();
+    free(stream_buf);
+}
+
+/* TCP and UDP over the loopback */
+
+static void *tcp_server(void *param) {
+    int lfd = (int)(intptr_t)param, fd;
+    char *buf = malloc(FILE_CHUNK);
+    ssize_t n;
+
+    fd = accept(lfd, NULL, NULL);
+
+    if(fd >= 0 && buf) {
+        while((n = recv(fd, buf, FILE_CHUNK, 0)) > 0)
+            ;
+    }
+
+    /* The reply tells the client all of it arrived */
+    if(fd >= 0) {
+        send(fd, "k", 1, 0);
+        close(fd);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static void bench_tcp(void) {
+    struct sockaddr_in addr;
+    int lfd, fd = -1, one = 1;
+    char *buf = NULL, c;
+    size_t sent = 0;
+    uint64_t start;
+    kthread_t *thd = NULL;
+    ssize_t n;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NET_PORT);
+    addr.sin_addr.s_addr = htonl(LOOPBACK);
+
+    if((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return;
+
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if(bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+       listen(lfd, 1)) {
+        printf("tcp: couldn't listen: %s\n", strerror(errno));
+        close(lfd);
+        return;
+    }
+
+    /* The connection waits in the backlog, so the server only starts once
+       there is one for it to accept. */
+    if(!(buf = calloc(1, FILE_CHUNK)) ||
+       (fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+       connect(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+       !(thd = thd_create(false, tcp_server, (void *)(intptr_t)lfd))) {
+        printf("tcp: couldn't connect: %s\n", strerror(errno));
+        goto out;
+    }
+
+    start = timer_ns_gettime64();
+
+    while(sent < TCP_SIZE) {
+        if((n = send(fd, buf, FILE_CHUNK, 0)) <= 0)
+            break;
+
+        sent += n;
+    }
+
+    shutdown(fd, SHUT_WR);
+
+    if(sent == TCP_SIZE && recv(fd, &c, 1, 0) == 1)
+        add_result("tcp_loopback", "MB/s",
+                   mbps(sent, timer_ns_gettime64() - start), 1);
+    else
+        printf("tcp: transfer failed\n");
+
+out:
+    if(fd >= 0)
+        close(fd);
+
+    if(thd)
+        thd_join(thd, NULL);
+
+    close(lfd);
+
+    free(buf);
+}
+
+static void bench_udp(void) {
+    struct sockaddr_in addr;
+    char buf[UDP_SIZE];
+    uint64_t start;
+    int fd, i;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(NET_PORT + 1);
+    addr.sin_addr.s_addr = htonl(LOOPBACK);
+
+    if((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+        return;
+
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        printf("udp: couldn't bind: %s\n", strerror(errno));
+        close(fd);
+        return;
+    }
+
+    memset(buf, 0, sizeof(buf));
+    start = timer_ns_gettime64();
+
+    /* Each datagram goes out to ourselves, and is read back */
+    for(i = 0; i < UDP_ROUNDS; i++) {
+        if(sendto(fd, buf, sizeof(buf), 0, (struct sockaddr *)&addr,
+                  sizeof(addr)) != sizeof(buf) ||
+           recv(fd, buf, sizeof(buf), 0) != sizeof(buf))
+            break;
+    }
+
+    if(i == UDP_ROUNDS)
+        add_result("udp_loopback", "us",
+                   (double)(timer_ns_gettime64() - start) / UDP_ROUNDS /
+                   1000.0, 0);
+    else
+        printf("udp: round trip failed\n");
+
+    close(fd);
+}
+
+static void bench_net(void) {
+    if(!net_default_dev) {
+        printf("No network adapter, skipping the loopback tests\n");
+        return;
+    }
+
+    bench_tcp();
+    bench_udp();
+}
+
+/* File reads */
+
+static void bench_read(const char *name, const char *fn) {
+    uint8_t *buf = memalign(32, FILE_CHUNK);
+    size_t total = 0;
+    uint64_t start;
+    ssize_t n;
+    int fd;
+
+    if(!buf)
+        return;
+
+    if((fd = open(fn, O_RDONLY)) < 0) {
+        free(buf);
+        return;
+    }
+
+    start = timer_ns_gettime64();
+
+    while(total < FILE_MAX && (n = read(fd, buf, FILE_CHUNK)) > 0)
+        total += n;
+
+    if(total)
+        add_result(name, "MB/s", mbps(total, timer_ns_gettime64() - start), 1);
+
+    close(fd);
+    free(buf);
+}
+
+/* Reads the largest file in the root of a filesystem */
+static void bench_read_dir(const char *name, const char *dir) {
+    char fn[NAME_MAX + 16], best[NAME_MAX + 16] = "";
+    struct dirent *ent;
+    struct stat st;
+    off_t best_size = 0;
+    DIR *d;
+
+    if(!(d = opendir(dir))) {
+        printf("%s: not there, skipping\n", dir);
+        return;
+    }
+
+    while((ent = readdir(d))) {
+        snprintf(fn, sizeof(fn), "%s/%s", dir, ent->d_name);
+
+        if(!stat(fn, &st) && S_ISREG(st.st_mode) && st.st_size > best_size) {
+            best_size = st.st_size;
+            strcpy(best, fn);
+        }
+    }
+
+    closedir(d);
+
+    if(best[0])
+        bench_read(name, best);
+    else
+        printf("%s: no files to read\n", dir);
+}
+
+static void bench_sd(void) {
+    kos_blockdev_t d;
+    uint8_t type;
+
+    if(sd_init()) {
+        printf("No SD card, skipping its read test\n");
+        return;
+    }
+
+    if(sd_blockdev_for_partition(0, &d, &type) ||
+       fs_fat_mount("/sd", &d, FS_FAT_MOUNT_READONLY)) {
+        printf("sd: no FAT partition, skipping its read test\n");
+        sd_shutdown();
+        return;
+    }
+
+    bench_read_dir("read_sd", "/sd");
+    fs_fat_unmount("/sd");
+    sd_shutdown();
+}
+
+static void bench_fs(void) {
+    bench_read("read_rd", "/rd/data.bin");
+    bench_read_dir("read_cd", "/cd");
+
+    fs_fat_init();
+    bench_sd();
+    fs_fat_shutdown();
+}
+
+/* Mutex ping-pong and thread switches */
+
+static mutex_t pp_lock = MUTEX_INITIALIZER;
+static condvar_t pp_cond = COND_INITIALIZER;
+static int pp_turn;
+
+static void *pingpong(void *param) {
+    int me = (int)(intptr_t)param, i;
+
+    mutex_lock(&pp_lock);
+
+    for(i = 0; i < SYNC_ROUNDS; i++) {
+        while(pp_turn != me)
+            cond_wait(&pp_cond, &pp_lock);
+
+        pp_turn = !me;
+        cond_signal(&pp_cond);
+    }
+
+    mutex_unlock(&pp_lock);
+    return NULL;
+}
+
+static void *passer(void *param) {
+    int i;
+
+    (void)param;
+
+    for(i = 0; i < SYNC_ROUNDS; i++)
+        thd_pass();
+
+    return NULL;
+}
+
+static void bench_threads(void) {
+    kthread_t *a, *b;
+    uint64_t start;
+
+    pp_turn = 0;
+    start = timer_ns_gettime64();
+    a = thd_create(false, pingpong, (void *)0);
+    b = thd_create(false, pingpong, (void *)1);
+
+    if(a && b) {
+        thd_join(a, NULL);
+        thd_join(b, NULL);
+        add_result("mutex_pingpong", "us",
+                   (double)(timer_ns_gettime64() - start) / SYNC_ROUNDS /
+                   1000.0, 0);
+    }
+
+    /* With the main thread waiting, the two of them switch back and forth */
+    start = timer_ns_gettime64();
+    a = thd_create(false, passer, NULL);
+    b = thd_create(false, passer, NULL);
+
+    if(a && b) {
+        thd_join(a, NULL);
+        thd_join(b, NULL);
+        add_result("thread_switch", "us",
+                   (double)(timer_ns_gettime64() - start) / (2 * SYNC_ROUNDS) /
+                   1000.0, 0);
+    }
+}
+
+static void print_json(FILE *fp, const char *prefix) {
+    int i;
+
+    fprintf(fp, "%s{\"kos\":\"%s\",\"results\":{", prefix, KOS_VERSION_STRING);
+
+    for(i = 0; i < result_cnt; i++) {
+        fprintf(fp, "%s\"%s\":{\"value\":%.4f,\"unit\":\"%s\",\"better\":\"%s\"}",
+                i ? "," : "", results[i].name, results[i].value,
+                results[i].unit, results[i].higher_better ? "higher" : "lower");
+    }
+
+    fprintf(fp, "}}\n");
+}
+
+int main(int argc, char *argv[]) {
+    FILE *fp;
+
+    (void)argc;
+    (void)argv;
+
+    printf("kosbench for KallistiOS %s\n\n", KOS_VERSION_STRING);
+
+    bench_memory();
+    bench_pvr();
+    bench_stream();
+    bench_net();
+    bench_fs();
+    bench_threads();
+
+    printf("\n");
+    print_json(stdout, "kosbench: ");
+
+    if((fp = fopen(RESULTS_FILE, "w"))) {
+        print_json(fp, "");
+        fclose(fp);
+        printf("Results written to %s\n", RESULTS_FILE);
+    }
+
+    return 0;
+}
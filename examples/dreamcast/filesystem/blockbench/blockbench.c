@@ -0,0 +1,445 @@
+/* KallistiOS ##version##
+
+   blockbench.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   This example program measures how fast block devices are, through the
+   kos_blockdev_t interface that filesystems use, and through fs_ext2 and
+   fs_fat mounted on them. It times sequential and random reads and writes on
+   a RAM-backed device, on the first partition of a hard drive on the G1 ATA
+   bus with PIO and DMA, and on the first partition of an SD card with the
+   SCI and SCIF interfaces, whichever of those are present.
+
+   For each test, the throughput is shown along with how long the slowest
+   half, tenth and hundredth of the transfers took, and the slowest of all.
+   The table of results is also written to /pc/blockbench.txt, if the program
+   was loaded with dcload.
+
+   Only the RAM-backed device is written to unless you add -DENABLE_WRITE to
+   the KOS_CFLAGS in the Makefile. With it, each block the raw write tests
+   write is read first and written back unchanged, and the filesystem tests
+   make and then remove a file called blockbench.tmp on the partition. Don't
+   interrupt it while that's going on.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <dc/sd.h>
+#include <dc/g1ata.h>
+
+#include <kos/timer.h>
+#include <kos/blockdev.h>
+
+#include <ext2/fs_ext2.h>
+#include <fat/fs_fat.h>
+
+/* How much of each device the raw tests cover, in bytes, and how much is
+   transferred at a time by the sequential ones. */
+#define TEST_SIZE       (1024 * 1024)
+#define CHUNK_SIZE      (32 * 1024)
+
+/* How many single blocks the random tests transfer. */
+#define RANDOM_OPS      256
+
+/* Size of the file the filesystem tests use, and of each random read of it. */
+#define FILE_SIZE       (1024 * 1024)
+#define FILE_RANDOM     4096
+
+#define RESULTS_FILE    "/pc/blockbench.txt"
+#define MAX_RESULTS     64
+
+typedef struct result {
+    char dev[20];
+    char test[12];
+    double kbps;
+    uint32_t p50, p90, p99, max;
+} result_t;
+
+static result_t results[MAX_RESULTS];
+static int result_count;
+
+static uint8_t buf[CHUNK_SIZE] __attribute__((aligned(32)));
+static uint8_t buf2[CHUNK_SIZE] __attribute__((aligned(32)));
+
+/* How long each transfer of a test took, in microseconds. Sequential tests
+   make TEST_SIZE / CHUNK_SIZE of them, fewer than this. */
+static uint32_t times[RANDOM_OPS];
+
+static int time_cmp(const void *a, const void *b) {
+    uint32_t ta = *(const uint32_t *)a, tb = *(const uint32_t *)b;
+
+    return ta < tb ? -1 : ta > tb;
+}
+
+/* Add a line to the results, from how long each of count transfers took. */
+static void add_result(const char *dev, const char *test, size_t bytes,
+                       uint32_t *t, int count) {
+    result_t *r;
+    uint64_t total = 0;
+    int i;
+
+    if(result_count == MAX_RESULTS || !count)
+        return;
+
+    r = &results[result_count++];
+    strncpy(r->dev, dev, sizeof(r->dev) - 1);
+    strncpy(r->test, test, sizeof(r->test) - 1);
+
+    for(i = 0; i < count; ++i)
+        total += t[i];
+
+    qsort(t, count, sizeof(uint32_t), time_cmp);
+    r->kbps = total ? (bytes / 1024.0) / (total / 1000000.0) : 0.0;
+    r->p50 = t[(count - 1) * 50 / 100];
+    r->p90 = t[(count - 1) * 90 / 100];
+    r->p99 = t[(count - 1) * 99 / 100];
+    r->max = t[count - 1];
+
+    printf("  %-10s %10.1f KB/s\n", test, r->kbps);
+}
+
+static void print_results(FILE *fp) {
+    int i;
+
+    fprintf(fp, "%-20s %-10s %12s %9s %9s %9s %9s\n", "Device", "Test",
+            "KB/s", "p50 us", "p90 us", "p99 us", "max us");
+
+    for(i = 0; i < result_count; ++i) {
+        fprintf(fp, "%-20s %-10s %12.1f %9lu %9lu %9lu %9lu\n",
+                results[i].dev, results[i].test, results[i].kbps,
+                (unsigned long)results[i].p50, (unsigned long)results[i].p90,
+                (unsigned long)results[i].p99, (unsigned long)results[i].max);
+    }
+}
+
+/* A block device kept in memory, to show what the overhead of everything
+   else is. */
+static int ram_init(kos_blockdev_t *d) {
+    (void)d;
+    return 0;
+}
+
+static int ram_shutdown(kos_blockdev_t *d) {
+    free(d->dev_data);
+    d->dev_data = NULL;
+    return 0;
+}
+
+static int ram_read(kos_blockdev_t *d, uint64_t block, size_t count,
+                    void *out) {
+    memcpy(out, (uint8_t *)d->dev_data + (block << d->l_block_size),
+           count << d->l_block_size);
+    return 0;
+}
+
+static int ram_write(kos_blockdev_t *d, uint64_t block, size_t count,
+                     const void *in) {
+    memcpy((uint8_t *)d->dev_data + (block << d->l_block_size), in,
+           count << d->l_block_size);
+    return 0;
+}
+
+static uint64_t ram_count(kos_blockdev_t *d) {
+    (void)d;
+    return TEST_SIZE >> 9;
+}
+
+static int ram_flush(kos_blockdev_t *d) {
+    (void)d;
+    return 0;
+}
+
+static int ram_blockdev(kos_blockdev_t *rv) {
+    memset(rv, 0, sizeof(kos_blockdev_t));
+
+    if(!(rv->dev_data = calloc(1, TEST_SIZE)))
+        return -1;
+
+    rv->l_block_size = 9;
+    rv->init = ram_init;
+    rv->shutdown = ram_shutdown;
+    rv->read_blocks = ram_read;
+    rv->write_blocks = ram_write;
+    rv->count_blocks = ram_count;
+    rv->flush = ram_flush;
+    return 0;
+}
+
+static int timed_io(kos_blockdev_t *d, uint64_t block, size_t count,
+                    int write, uint32_t *t) {
+    uint64_t start;
+    int rv;
+
+    /* Writes put back what's there already, so read it first, untimed. */
+    if(write && d->read_blocks(d, block, count, buf))
+        return -1;
+
+    start = timer_us_gettime64();
+
+    if(write)
+        rv = d->write_blocks(d, block, count, buf);
+    else
+        rv = d->read_blocks(d, block, count, buf);
+
+    *t = (uint32_t)(timer_us_gettime64() - start);
+    return rv;
+}
+
+/* Run the raw tests on a block device. */
+static void bench_blockdev(const char *name, kos_blockdev_t *d, int writes) {
+    uint64_t blocks = d->count_blocks(d), region, b;
+    size_t bs = (size_t)1 << d->l_block_size, chunk = CHUNK_SIZE / bs;
+    int i, n, write;
+
+    if(!chunk) {
+        printf("%s: blocks too large to test\n", name);
+        return;
+    }
+
+    region = TEST_SIZE / bs;
+
+    if(region > blocks)
+        region = blocks;
+
+    printf("%s: %llu blocks of %u bytes\n", name, (unsigned long long)blocks,
+           (unsigned int)bs);
+
+    for(write = 0; write <= writes; ++write) {
+        for(b = 0, n = 0; b + chunk <= region; b += chunk, ++n) {
+            if(timed_io(d, b, chunk, write, &times[n])) {
+                printf("  I/O error at block %llu: %s\n",
+                       (unsigned long long)b, strerror(errno));
+                return;
+            }
+        }
+
+        add_result(name, write ? "seq write" : "seq read", n * chunk * bs,
+                   times, n);
+
+        /* The same blocks each run, so that runs can be compared. */
+        srand(1234);
+
+        for(i = 0; i < RANDOM_OPS; ++i) {
+            b = (uint64_t)rand() % region;
+
+            if(timed_io(d, b, 1, write, &times[i])) {
+                printf("  I/O error at block %llu: %s\n",
+                       (unsigned long long)b, strerror(errno));
+                return;
+            }
+        }
+
+        add_result(name, write ? "rand write" : "rand read", RANDOM_OPS * bs,
+                   times, RANDOM_OPS);
+    }
+}
+
+/* Write, read and then randomly read a file on a mounted filesystem. */
+static void bench_file(const char *name, const char *mp) {
+    char fn[64];
+    uint64_t start;
+    int fd, i, n;
+    off_t off;
+
+    snprintf(fn, sizeof(fn), "%s/blockbench.tmp", mp);
+    printf("%s: %d KB file\n", name, FILE_SIZE / 1024);
+    memset(buf2, 0xA5, sizeof(buf2));
+
+    if((fd = open(fn, O_WRONLY | O_CREAT | O_TRUNC)) < 0) {
+        printf("  Couldn't create %s: %s\n", fn, strerror(errno));
+        return;
+    }
+
+    for(n = 0; n < FILE_SIZE / CHUNK_SIZE; ++n) {
+        start = timer_us_gettime64();
+
+        if(write(fd, buf2, CHUNK_SIZE) != CHUNK_SIZE) {
+            printf("  Couldn't write %s: %s\n", fn, strerror(errno));
+            close(fd);
+            unlink(fn);
+            return;
+        }
+
+        times[n] = (uint32_t)(timer_us_gettime64() - start);
+    }
+
+    /* Count closing it as part of the last write. */
+    start = timer_us_gettime64();
+    close(fd);
+    times[n - 1] += (uint32_t)(timer_us_gettime64() - start);
+    add_result(name, "seq write", FILE_SIZE, times, n);
+
+    if((fd = open(fn, O_RDONLY)) < 0) {
+        printf("  Couldn't open %s: %s\n", fn, strerror(errno));
+        unlink(fn);
+        return;
+    }
+
+    for(n = 0; n < FILE_SIZE / CHUNK_SIZE; ++n) {
+        start = timer_us_gettime64();
+
+        if(read(fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+            break;
+
+        times[n] = (uint32_t)(timer_us_gettime64() - start);
+    }
+
+    add_result(name, "seq read", n * CHUNK_SIZE, times, n);
+    srand(1234);
+
+    for(i = 0; i < RANDOM_OPS; ++i) {
+        off = (off_t)(rand() % (FILE_SIZE / FILE_RANDOM)) * FILE_RANDOM;
+        start = timer_us_gettime64();
+
+        if(lseek(fd, off, SEEK_SET) != off ||
+           read(fd, buf, FILE_RANDOM) != FILE_RANDOM)
+            break;
+
+        times[i] = (uint32_t)(timer_us_gettime64() - start);
+    }
+
+    add_result(name, "rand read", i * FILE_RANDOM, times, i);
+    close(fd);
+    unlink(fn);
+}
+
+/* Mount the filesystem on a partition, if it's one we know, and test it. */
+static void bench_fs(const char *name, kos_blockdev_t *d, uint8_t type) {
+#ifndef ENABLE_WRITE
+    (void)name;
+    (void)type;
+    d->shutdown(d);
+    return;
+#else
+    char label[20];
+
+    if(type == 0x83) {
+        if(fs_ext2_mount("/bench", d, FS_EXT2_MOUNT_READWRITE)) {
+            printf("%s: couldn't mount ext2 partition\n", name);
+            d->shutdown(d);
+            return;
+        }
+
+        snprintf(label, sizeof(label), "%s ext2", name);
+        bench_file(label, "/bench");
+        fs_ext2_unmount("/bench");
+    }
+    else if(type == 0x01 || type == 0x04 || type == 0x06 || type == 0x0B ||
+            type == 0x0C || type == 0x0E) {
+        if(fs_fat_mount("/bench", d, FS_FAT_MOUNT_READWRITE)) {
+            printf("%s: couldn't mount FAT partition\n", name);
+            d->shutdown(d);
+            return;
+        }
+
+        snprintf(label, sizeof(label), "%s fat", name);
+        bench_file(label, "/bench");
+        fs_fat_unmount("/bench");
+    }
+    else {
+        printf("%s: partition type %02x isn't ext2 or FAT\n", name, type);
+        d->shutdown(d);
+    }
+#endif
+}
+
+#ifdef ENABLE_WRITE
+#define DEV_WRITES 1
+#else
+#define DEV_WRITES 0
+#endif
+
+static void bench_g1ata(void) {
+    kos_blockdev_t d;
+    uint8_t type;
+    int dma;
+
+    if(g1_ata_init()) {
+        printf("No hard drive found on the G1 ATA bus\n");
+        return;
+    }
+
+    for(dma = 0; dma <= 1; ++dma) {
+        if(g1_ata_blockdev_for_partition(0, dma, &d, &type)) {
+            printf("Couldn't find the hard drive's first partition: %s\n",
+                   strerror(errno));
+            break;
+        }
+
+        bench_blockdev(dma ? "g1ata dma" : "g1ata pio", &d, DEV_WRITES);
+
+        /* The filesystem shuts the device down when it's unmounted. */
+        if(dma)
+            bench_fs("g1ata dma", &d, type);
+        else
+            d.shutdown(&d);
+    }
+
+    g1_ata_shutdown();
+}
+
+static void bench_sd(void) {
+    sd_init_params_t params = { .check_crc = false };
+    kos_blockdev_t d;
+    uint8_t type;
+    int i;
+
+    for(i = 0; i < 2; ++i) {
+        params.interface = i ? SD_IF_SCIF : SD_IF_SCI;
+
+        if(sd_init_ex(&params)) {
+            printf("No SD card found on the %s interface\n",
+                   i ? "SCIF" : "SCI");
+            continue;
+        }
+
+        if(sd_blockdev_for_partition(0, &d, &type)) {
+            printf("Couldn't find the SD card's first partition: %s\n",
+                   strerror(errno));
+            sd_shutdown();
+            continue;
+        }
+
+        bench_blockdev(i ? "sd scif" : "sd sci", &d, DEV_WRITES);
+        bench_fs(i ? "sd scif" : "sd sci", &d, type);
+        sd_shutdown();
+    }
+}
+
+int main(int argc, char *argv[]) {
+    kos_blockdev_t d;
+    FILE *fp;
+
+    (void)argc;
+    (void)argv;
+
+    fs_ext2_init();
+    fs_fat_init();
+
+    if(!ram_blockdev(&d)) {
+        bench_blockdev("ram", &d, 1);
+        d.shutdown(&d);
+    }
+
+    bench_g1ata();
+    bench_sd();
+
+    printf("\n");
+    print_results(stdout);
+
+    if((fp = fopen(RESULTS_FILE, "w"))) {
+        print_results(fp);
+        fclose(fp);
+        printf("\nResults written to %s\n", RESULTS_FILE);
+    }
+
+    fs_fat_shutdown();
+    fs_ext2_shutdown();
+    return 0;
+}
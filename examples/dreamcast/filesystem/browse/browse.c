@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <sys/stat.h>
 
@@ -166,12 +167,8 @@ int main(int argc, char **argv) {
 
         /* Stat an entry */
         else if(button_pressed(current_buttons, changed_buttons, CONT_Y)) {
-            if(!prompting) {
-                memset(directory_temp, 0, BUFFER_LENGTH);
-                fs_path_append(directory_temp, current_directory, BUFFER_LENGTH);
-                fs_path_append(directory_temp, directory_contents[selector_index].filename, BUFFER_LENGTH);
-                statting = draw_stat(directory_temp);
-            }
+            if(!prompting)
+                statting = draw_stat(&directory_contents[selector_index].st);
         }
         
         /* Navigate the directory */
@@ -280,28 +277,31 @@ static void delete_file(char *filename, bool mounted_sd) {
 
 static int browse_directory(char *directory, directory_file_t *directory_contents) {
     int count = 0;
-    DIR *d;
-    struct dirent *entry;
+    file_t d;
+    dirent_t *entry;
+    struct stat st;
 
     /* Open the directory */
-    if (!(d = opendir(directory))) {
-        fprintf(stderr, "browse_directory: opendir failed for %s\n", directory);
+    if((d = fs_open(directory, O_RDONLY | O_DIR)) == FILEHND_INVALID) {
+        fprintf(stderr, "browse_directory: fs_open failed for %s\n", directory);
         return 0;
     }
 
     /* Clear out all files */
     memset(directory_contents, 0, sizeof(directory_contents[0])*100);
 
-    /* Read all the filenames in the directory */
-    while((entry = readdir(d)) && count < 100) {
-        directory_contents[count].is_dir = (entry->d_type == DT_DIR);
-        strncpy(directory_contents[count].filename, entry->d_name, sizeof(directory_contents[count].filename) - 1);
+    /* Read all the filenames in the directory, and their stats along with
+       them, so looking at one later doesn't have to walk the path again. */
+    while((entry = fs_readdir_plus(d, &st)) && count < 100) {
+        directory_contents[count].is_dir = S_ISDIR(st.st_mode);
+        directory_contents[count].st = st;
+        strncpy(directory_contents[count].filename, entry->name, sizeof(directory_contents[count].filename) - 1);
         directory_contents[count].filename[sizeof(directory_contents[count].filename) - 1] = '\0';  // Ensure null-termination
         count++;
     }
 
     /* Close directory */
-    closedir(d);
+    fs_close(d);
 
     return count;
 }
@@ -370,19 +370,18 @@ static void draw_directory_contents(directory_file_t *directory_contents, int nu
     }
 }
 
-static bool draw_stat(const char *path) {
+static bool draw_stat(const struct stat *path_stat) {
     int x = 20 + BFONT_HEIGHT, y = 350;
-    struct stat path_stat;
 
-    /* If stat fails */
-    if(stat(path, &path_stat) < 0)
+    /* If the entry had no stat to go with it */
+    if(!path_stat->st_mode)
         return false;
 
     /* We got a stat, so lets draw it */
     bfont_draw_str_fmt(vram_s + y*SCREEN_WIDTH+x, SCREEN_WIDTH, true,
     "Stat succeeded:\n\tFile size: %lu\n\tLast Modified: %s\n",
-    S_ISDIR(path_stat.st_mode) ? 0 : path_stat.st_size,
-    asctime(gmtime(&path_stat.st_mtime)));
+    S_ISDIR(path_stat->st_mode) ? 0 : path_stat->st_size,
+    asctime(gmtime(&path_stat->st_mtime)));
 
     return true;
 }
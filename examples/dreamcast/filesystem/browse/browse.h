@@ -7,6 +7,7 @@
 typedef struct directory_file {
     char filename[256];
     bool  is_dir;
+    struct stat st;
 } directory_file_t;
 
 static bool mount_sd_fat();
@@ -17,7 +18,7 @@ static void delete_file(char *filename, bool mounted_sd);
 
 static void prompt_message(char *message, bool highlight_yes);
 
-static bool draw_stat(const char *path);
+static bool draw_stat(const struct stat *path_stat);
 
 static void draw_directory_selector(int index);
 static void draw_directory_contents(directory_file_t *directory_contents, int num);
@@ -24,6 +24,7 @@
 KOS_INIT_FLAGS(INIT_DEFAULT | INIT_EXPORT);
 
 extern export_sym_t libtest_symtab[];
+extern const uint32_t libtest_symtab_hash[];
 static symtab_handler_t st_libtest = {
     {
         "sym/library/test",
@@ -33,7 +34,8 @@ static symtab_handler_t st_libtest = {
         NMMGR_TYPE_SYMTAB,
         NMMGR_LIST_INIT
     },
-    libtest_symtab
+    libtest_symtab,
+    libtest_symtab_hash
 };
 
 static void __attribute__((__noreturn__)) wait_exit(int status) {
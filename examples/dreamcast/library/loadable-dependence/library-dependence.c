@@ -13,6 +13,7 @@
 #include <kos/version.h>
 
 extern export_sym_t library_symtab[];
+extern const uint32_t library_symtab_hash[];
 static symtab_handler_t library_hnd = {
     {
         "sym/library/dependence",
@@ -22,7 +23,8 @@ static symtab_handler_t library_hnd = {
         NMMGR_TYPE_SYMTAB,
         NMMGR_LIST_INIT
     },
-    library_symtab
+    library_symtab,
+    library_symtab_hash
 };
 
 /* Library functions */
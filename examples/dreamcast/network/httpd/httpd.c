@@ -14,6 +14,7 @@
 
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/sendfile.h>
 #include <netinet/in.h>
 
 #include <kos/fs.h>
@@ -245,7 +246,6 @@ void *client_thread(void *p) {
     char * buf, * ext;
     const char * ct;
     file_t f = -1;
-    int r, o, cnt;
 
     printf("httpd: client thread started, sock %d\n", hs->socket);
 
@@ -296,23 +296,11 @@ void *client_thread(void *p) {
 
         send_ok(hs, ct);
 
-        while((cnt = fs_read(f, buf, BUFSIZE)) != 0) {
-            o = 0;
-
-            while(cnt > 0) {
-                r = write(hs->socket, buf + o, cnt);
-
-                if(r <= 0)
-                    goto out;
-
-                cnt -= r;
-                o += r;
-            }
-        }
+        /* The file goes straight from the filesystem to the socket. */
+        if(sendfile(hs->socket, f, NULL, fs_total(f)) < 0)
+            printf("httpd: error sending '%s'\n", buf);
     }
 
-    fs_close(f);
-
 out:
     free(buf);
     printf("httpd: closed client connection %d\n", hs->socket);
@@ -0,0 +1,206 @@
+/* KallistiOS ##version##
+
+   pvrmark_particles.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Like pvrmark, but with particles: every frame moves a set of particles
+   kept as separate arrays, and draws them with pvr_particles_draw(). The
+   number of particles goes up until the frame rate drops below 55 fps.
+   Press A to switch between one color for all of them and a color each, and
+   Start to exit. */
+
+#include <kos.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_PARTICLES   16384
+
+pvr_init_params_t pvr_params = {
+    { PVR_BINSIZE_0, PVR_BINSIZE_0, PVR_BINSIZE_16, PVR_BINSIZE_0, PVR_BINSIZE_0 },
+    2 * 1024 * 1024, 0, 0, 0, 0, 0
+};
+
+enum { PHASE_HALVE, PHASE_INCR, PHASE_DECR, PHASE_FINAL };
+
+static float px[MAX_PARTICLES], py[MAX_PARTICLES];
+static float vx[MAX_PARTICLES], vy[MAX_PARTICLES];
+static float psize[MAX_PARTICLES];
+static uint32_t pcol[MAX_PARTICLES];
+
+static int count;
+static int phase = PHASE_HALVE;
+static int colored;
+static float avgfps = -1;
+static pvr_sprite_hdr_t hdr;
+
+static void running_stats(void) {
+    pvr_stats_t stats;
+    pvr_get_stats(&stats);
+
+    if(avgfps == -1)
+        avgfps = stats.frame_rate;
+    else
+        avgfps = (avgfps + stats.frame_rate) / 2.0f;
+}
+
+static int check_buttons(void) {
+    static uint32_t old;
+    maple_device_t *cont;
+    cont_state_t *state;
+    uint32_t pressed;
+
+    cont = maple_enum_type(0, MAPLE_FUNC_CONTROLLER);
+
+    if(!cont || !(state = (cont_state_t *)maple_dev_status(cont)))
+        return 0;
+
+    pressed = state->buttons & ~old;
+    old = state->buttons;
+
+    if(pressed & CONT_A) {
+        colored = !colored;
+        printf("  Colors: %s\n", colored ? "one per particle" : "shared");
+    }
+
+    return state->buttons & CONT_START;
+}
+
+static void setup(void) {
+    pvr_sprite_cxt_t cxt;
+    int i, c;
+
+    pvr_init(&pvr_params);
+    pvr_set_bg_color(0, 0, 0);
+
+    pvr_sprite_cxt_col(&cxt, PVR_LIST_TR_POLY);
+    cxt.gen.culling = PVR_CULLING_NONE;
+    pvr_sprite_compile(&hdr, &cxt);
+    hdr.argb = 0x80ffc040;
+
+    for(i = 0; i < MAX_PARTICLES; i++) {
+        px[i] = rand() % 640;
+        py[i] = rand() % 480;
+        vx[i] = (rand() % 200 - 100) / 50.0f;
+        vy[i] = (rand() % 200 - 100) / 50.0f;
+        psize[i] = 2 + rand() % 14;
+        c = rand() & 0xff;
+        pcol[i] = 0x80000000 | c << 16 | (255 - c) << 8 | 0x40;
+    }
+}
+
+static void move(void) {
+    int i;
+
+    for(i = 0; i < count; i++) {
+        px[i] += vx[i];
+        py[i] += vy[i];
+
+        if(px[i] < 0.0f || px[i] > 640.0f)
+            vx[i] = -vx[i];
+
+        if(py[i] < 0.0f || py[i] > 480.0f)
+            vy[i] = -vy[i];
+    }
+}
+
+static void do_frame(void) {
+    pvr_particles_t p = {
+        .x = px,
+        .y = py,
+        .size = psize,
+        .argb = colored ? pcol : NULL,
+        .z0 = 1.0f,
+    };
+
+    move();
+
+    vid_border_color(0, 0, 0);
+    pvr_wait_ready();
+    vid_border_color(255, 0, 0);
+    pvr_scene_begin();
+    pvr_list_begin(PVR_LIST_TR_POLY);
+    pvr_particles_draw(&hdr, &p, count);
+    pvr_list_finish();
+    pvr_scene_finish();
+    vid_border_color(0, 255, 0);
+}
+
+static time_t begin;
+
+static void switch_tests(int n) {
+    if(n > MAX_PARTICLES)
+        n = MAX_PARTICLES;
+
+    printf("Beginning new test: %d particles per frame (%d per second at 60fps)\n",
+           n, n * 60);
+    avgfps = -1;
+    count = n;
+}
+
+static void check_switch(void) {
+    time_t now = time(NULL);
+
+    if(now < begin + 5)
+        return;
+
+    printf("  Average Frame Rate: ~%f fps (%d particles per second)\n",
+           (double)avgfps, (int)(count * avgfps));
+    begin = time(NULL);
+
+    switch(phase) {
+        case PHASE_HALVE:
+            if(avgfps < 55) {
+                switch_tests(count / 2);
+            }
+            else {
+                printf("  Entering PHASE_INCR\n");
+                phase = PHASE_INCR;
+            }
+
+            break;
+
+        case PHASE_INCR:
+            if(avgfps >= 55 && count < MAX_PARTICLES) {
+                switch_tests(count + 500);
+            }
+            else {
+                printf("  Entering PHASE_DECR\n");
+                phase = PHASE_DECR;
+            }
+
+            break;
+
+        case PHASE_DECR:
+            if(avgfps < 55) {
+                switch_tests(count - 200);
+            }
+            else {
+                printf("  Entering PHASE_FINAL\n");
+                phase = PHASE_FINAL;
+            }
+
+            break;
+
+        case PHASE_FINAL:
+            break;
+    }
+}
+
+int main(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+
+    setup();
+
+    switch_tests(MAX_PARTICLES);
+    begin = time(NULL);
+
+    while(!check_buttons()) {
+        do_frame();
+        running_stats();
+        check_switch();
+    }
+
+    return 0;
+}
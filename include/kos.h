@@ -36,6 +36,8 @@ __BEGIN_DECLS
 #include <kos/fs.h>
 #include <kos/fs_romdisk.h>
 #include <kos/fs_ramdisk.h>
+#include <kos/fs_pak.h>
+#include <kos/bcache.h>
 #include <kos/fs_dev.h>
 #include <kos/fs_pty.h>
 #include <kos/limits.h>
@@ -61,6 +63,10 @@ __BEGIN_DECLS
 #include <kos/init.h>
 #include <kos/oneshot_timer.h>
 #include <kos/regfield.h>
+#include <kos/ringbuf.h>
+#include <kos/arena.h>
+#include <kos/mem_tags.h>
+#include <kos/fiber.h>
 
 #include <arch/arch.h>
 #include <arch/cache.h>
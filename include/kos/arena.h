@@ -0,0 +1,169 @@
+/* KallistiOS ##version##
+
+   include/kos/arena.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/arena.h
+    \brief   Arena (bump) allocator for transient data.
+    \ingroup system_allocator
+
+    This file contains the arena allocator API. An arena is a single block of
+    memory that allocations are carved off of in order, just by bumping an
+    offset. Nothing is freed on its own: instead, arena_mark() remembers the
+    current offset and arena_release() drops everything allocated since, while
+    arena_reset() drops everything at once. This makes it a good fit for data
+    that only lives for one frame, one request or one function call, which
+    would otherwise churn through malloc() and free().
+
+    All allocations are aligned to 32 bytes, the size of an SH4 cache line
+    and of a store queue burst. Blocks never share a cache line with each
+    other, so they can be flushed or invalidated on their own for DMA, primed
+    with dcache_alloc_block(), or filled through the store queues.
+
+    \see    pvr_set_frame_arena()
+*/
+
+#ifndef __KOS_ARENA_H
+#define __KOS_ARENA_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** \addtogroup system_allocator
+    @{
+*/
+
+/** \brief  Alignment of all arena allocations. */
+#define ARENA_ALIGN         32
+
+/** \brief  Arena allocator state.
+
+    \headerfile kos/arena.h
+*/
+typedef struct arena {
+    uint8_t *base;      /**< \brief Start of the memory block */
+    size_t size;        /**< \brief Size of the memory block */
+    size_t used;        /**< \brief Current allocation offset */
+    size_t peak;        /**< \brief Highest value used has ever reached */
+    int owned;          /**< \brief Whether the block was allocated by us */
+} arena_t;
+
+/** \brief  A saved arena position, see arena_mark(). */
+typedef size_t arena_mark_t;
+
+/** \brief  Initialize an arena.
+
+    \param  arena           The arena to initialize.
+    \param  buf             The memory to use, or NULL to allocate size bytes
+                            with memalign(). A buffer passed in is aligned up
+                            to \ref ARENA_ALIGN, and stays owned by the
+                            caller.
+    \param  size            The size of the memory to use, in bytes.
+
+    \retval 0               On success.
+    \retval -1              On failure (errno set to ENOMEM).
+*/
+int arena_init(arena_t *arena, void *buf, size_t size) __nonnull((1));
+
+/** \brief  Destroy an arena.
+
+    This frees the memory of the arena if arena_init() allocated it.
+
+    \param  arena           The arena to destroy.
+*/
+void arena_destroy(arena_t *arena) __nonnull_all;
+
+/** \brief  Allocate from an arena.
+
+    \param  arena           The arena to allocate from.
+    \param  size            The number of bytes to allocate.
+
+    \return                 The block (aligned to \ref ARENA_ALIGN), or NULL
+                            if the arena is full (errno set to ENOMEM).
+*/
+static inline void *arena_alloc(arena_t *arena, size_t size) {
+    size_t used = arena->used;
+    void *ptr;
+
+    if(size > arena->size - used) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ptr = arena->base + used;
+    used += (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    /* The rounding can run past the end when the last block is filled. */
+    arena->used = used < arena->size ? used : arena->size;
+
+    if(arena->used > arena->peak)
+        arena->peak = arena->used;
+
+    return ptr;
+}
+
+/** \brief  Allocate zeroed memory from an arena.
+
+    \param  arena           The arena to allocate from.
+    \param  nmemb           The number of elements.
+    \param  size            The size of each element.
+
+    \return                 The zeroed block, or NULL on failure.
+*/
+void *arena_calloc(arena_t *arena, size_t nmemb, size_t size) __nonnull((1));
+
+/** \brief  Copy a string into an arena.
+
+    \param  arena           The arena to allocate from.
+    \param  str             The string to copy.
+
+    \return                 The copy, or NULL if the arena is full.
+*/
+char *arena_strdup(arena_t *arena, const char *str) __nonnull_all;
+
+/** \brief  Get the current position of an arena.
+
+    \param  arena           The arena to look at.
+    \return                 A mark to pass to arena_release().
+*/
+static inline arena_mark_t arena_mark(const arena_t *arena) {
+    return arena->used;
+}
+
+/** \brief  Free everything allocated since a mark.
+
+    \param  arena           The arena to release memory of.
+    \param  mark            A mark returned by arena_mark() on this arena
+                            since it was last reset.
+*/
+static inline void arena_release(arena_t *arena, arena_mark_t mark) {
+    arena->used = mark;
+}
+
+/** \brief  Free everything allocated from an arena.
+
+    \param  arena           The arena to reset.
+*/
+static inline void arena_reset(arena_t *arena) {
+    arena->used = 0;
+}
+
+/** \brief  Get the amount of free memory left in an arena.
+
+    \param  arena           The arena to look at.
+    \return                 The number of bytes left.
+*/
+static inline size_t arena_avail(const arena_t *arena) {
+    return arena->size - arena->used;
+}
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __KOS_ARENA_H */
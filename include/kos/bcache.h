@@ -0,0 +1,192 @@
+/* KallistiOS ##version##
+
+   kos/bcache.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/bcache.h
+    \brief   Shared block cache for filesystems.
+    \ingroup vfs_bcache
+
+    This file contains a buffer cache that filesystems on block devices keep
+    their blocks in, sharing one memory budget between all of them.
+*/
+
+#ifndef __KOS_BCACHE_H
+#define __KOS_BCACHE_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <kos/mutex.h>
+
+/** \defgroup vfs_bcache    Block cache
+    \brief                  Buffer cache shared by block-based filesystems
+    \ingroup                vfs
+
+    Each mounted filesystem makes a cache with bcache_create(), giving the
+    size of its blocks and functions to read and write one of them, and then
+    gets at its blocks with bcache_read(). The blocks of every cache live in
+    one pool, found by a hash on the cache and block number, and evicted in
+    least recently used order across all of them.
+
+    Each cache also has a reserve of blocks of its own, allocated up front,
+    which the other caches never take from it. Blocks beyond the reserve come
+    out of a budget shared between the caches (see bcache_set_budget()), so
+    that a busy mount can use the memory an idle one isn't. A block returned
+    by bcache_read() stays where it is until that cache has read as many
+    other blocks as its reserve, as with a cache of that many blocks of its
+    own.
+
+    Changed blocks are marked with bcache_mark_dirty(), and written back when
+    they're evicted or bcache_sync() is called. If the cache has been given
+    the lock its filesystem holds while using it (see bcache_set_lock()), a
+    thread also writes back blocks that have been dirty for a while, and
+    reads blocks asked for with bcache_readahead() in the background. That
+    thread only ever tries the lock, so it never waits on a filesystem.
+
+    None of these calls should be made on a cache from more than one thread
+    at once. With a lock given, they should be made while holding it.
+
+    @{
+*/
+
+/** \brief   Opaque type for a filesystem's cache. */
+typedef struct bcache bcache_t;
+
+/** \brief   Function to read or write one block.
+
+    \param  ctx             The pointer given to bcache_create().
+    \param  block           The block number.
+    \param  buf             The block's data, of the cache's block size.
+    \return                 0 on success, anything else on failure.
+*/
+typedef int (*bcache_io_t)(void *ctx, uint32_t block, void *buf);
+
+/** \cond */
+void bcache_shutdown(void);
+/** \endcond */
+
+/** \brief   Create a cache.
+
+    \param  block_size      The size of each block, in bytes.
+    \param  reserve         Blocks allocated for this cache alone. At least 2.
+    \param  read            Function to read a block.
+    \param  write           Function to write a block, or NULL if the cache
+                            is never written to.
+    \param  ctx             Pointer passed to read and write.
+    \return                 The new cache, or NULL on failure, with errno set
+                            to EINVAL for bad arguments or ENOMEM.
+*/
+bcache_t *bcache_create(size_t block_size, size_t reserve, bcache_io_t read,
+                        bcache_io_t write, void *ctx);
+
+/** \brief   Destroy a cache.
+
+    Dirty blocks are thrown away: call bcache_sync() first to keep them.
+
+    \param  c               The cache.
+*/
+void bcache_destroy(bcache_t *c);
+
+/** \brief   Set the lock guarding a cache.
+
+    This lets the cache's blocks be written back and read ahead in the
+    background, while the flush thread holds the lock.
+
+    \param  c               The cache.
+    \param  lock            The lock the filesystem holds while calling into
+                            the cache, or NULL to stop background work on it.
+*/
+void bcache_set_lock(bcache_t *c, mutex_t *lock);
+
+/** \brief   Get a block, reading it in if it isn't cached.
+
+    \param  c               The cache.
+    \param  block           The block number.
+    \return                 The block's data, 32-byte aligned, or NULL with
+                            errno set to EIO if it couldn't be read (or a
+                            dirty block couldn't be written back to make
+                            room for it).
+*/
+uint8_t *bcache_read(bcache_t *c, uint32_t block);
+
+/** \brief   Get a block without reading it in.
+
+    This is for blocks about to be overwritten whole. If the block isn't
+    cached, what's in the buffer returned is undefined.
+
+    \param  c               The cache.
+    \param  block           The block number.
+    \return                 The block's buffer, or NULL with errno set to EIO.
+*/
+uint8_t *bcache_get(bcache_t *c, uint32_t block);
+
+/** \brief   Get a block only if it's cached.
+
+    This is for reading around the cache: a caller transferring blocks to or
+    from the device itself uses it to find the ones it has to take from (or
+    keep in step with) the cache instead.
+
+    \param  c               The cache.
+    \param  block           The block number.
+    \return                 The block's data, or NULL if it isn't cached.
+*/
+uint8_t *bcache_lookup(bcache_t *c, uint32_t block);
+
+/** \brief   Mark a cached block as changed.
+
+    \param  c               The cache.
+    \param  block           The block number.
+    \retval 0               On success.
+    \retval -1              If the block isn't cached, with errno set to
+                            EINVAL.
+*/
+int bcache_mark_dirty(bcache_t *c, uint32_t block);
+
+/** \brief   Write back all of a cache's dirty blocks.
+
+    \param  c               The cache.
+    \retval 0               On success.
+    \retval -1              If a block couldn't be written, with errno set to
+                            EIO. The blocks that couldn't be are left dirty.
+*/
+int bcache_sync(bcache_t *c);
+
+/** \brief   Ask for a block to be read ahead of its use.
+
+    This does nothing if the block is already cached, the cache has no lock
+    set, or too many blocks have been asked for already.
+
+    \param  c               The cache.
+    \param  block           The block number.
+*/
+void bcache_readahead(bcache_t *c, uint32_t block);
+
+/** \brief   Set the memory budget shared by all caches.
+
+    This doesn't count the reserves of each cache. Lowering it frees clean
+    blocks beyond the reserves straight away, and dirty ones as their caches
+    evict them.
+
+    \param  bytes           The budget, in bytes. The default is
+                            \ref BCACHE_BUDGET.
+*/
+void bcache_set_budget(size_t bytes);
+
+/** \brief   Set how long blocks stay dirty before the flush thread writes
+             them back.
+
+    \param  ms              The time in milliseconds, or 0 to only write
+                            them back on eviction and sync. The default is
+                            \ref BCACHE_WRITEBACK_MS.
+*/
+void bcache_set_writeback(unsigned int ms);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __KOS_BCACHE_H */
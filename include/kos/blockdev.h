@@ -38,6 +38,46 @@ __BEGIN_DECLS
     @{
 */
 
+struct kos_blockdev;
+
+/** \brief  An asynchronous block device request.
+
+    This structure describes one transfer handed to a block device's submit
+    function. The caller owns it and must keep it (and the buffer) around
+    until the request has completed, which is when the callback is called or
+    poll says so.
+
+    \headerfile kos/blockdev.h
+*/
+typedef struct kos_blockdev_req {
+    uint64_t block;         /**< \brief The first block to transfer. */
+    size_t count;           /**< \brief The number of blocks to transfer. */
+    void *buf;              /**< \brief The buffer to read into or write from.
+                                        Should be 32-byte aligned. */
+    int write;              /**< \brief Nonzero to write, zero to read. */
+
+    /** \brief  Completion callback, or NULL.
+
+        This is called once the transfer is done, with the request's status
+        already set. It may be called from an interrupt handler, so it should
+        do no more than hand the request on to a thread.
+
+        \param  req         The request that completed.
+    */
+    void (*callback)(struct kos_blockdev_req *req);
+    void *data;             /**< \brief Free for the caller's use. */
+
+    /** \brief  The request's status: EINPROGRESS until it completes, then 0
+                on success or an errno value. Set by the device. */
+    volatile int status;
+
+    /** \cond */
+    /* For the device's use while it has the request queued. */
+    struct kos_blockdev_req *next;
+    uint64_t dev_block;
+    /** \endcond */
+} kos_blockdev_req_t;
+
 /** \brief  A simple block device.
 
     This structure represents a single block device. Each block device should be
@@ -129,6 +169,40 @@ typedef struct kos_blockdev {
         \retval -1          On failure. Set errno as appropriate.
     */
     int (*flush)(struct kos_blockdev *d);
+
+    /** \brief  Start a transfer without waiting for it (optional).
+
+        This function should start the transfer the request describes and
+        return, leaving it to finish in the background. Devices that support
+        only one transfer at a time may wait for the one before it to finish
+        first. A device that can't do a transfer in the background may do it
+        before returning, so long as it still completes the request. Requests
+        in flight at once may be done in any order, so they shouldn't overlap
+        when one of them is a write. Devices
+        without this leave it NULL, and should be used with read_blocks and
+        write_blocks.
+
+        \param  d           The device to transfer with.
+        \param  req         The request. Its status is set to EINPROGRESS.
+        \retval 0           If the request was started. It will complete.
+        \retval -1          If it could not be started, with errno set as
+                            appropriate. It will not complete.
+    */
+    int (*submit)(struct kos_blockdev *d, kos_blockdev_req_t *req);
+
+    /** \brief  Check on or wait for a submitted request (optional).
+
+        This must be given if submit is.
+
+        \param  d           The device the request was submitted to.
+        \param  req         The request.
+        \param  wait        Nonzero to wait for the request to complete.
+        \retval 0           If the request completed successfully.
+        \retval -1          If it failed, with errno set to its status, or if
+                            it has not completed yet and wait is zero, with
+                            errno set to EAGAIN.
+    */
+    int (*poll)(struct kos_blockdev *d, kos_blockdev_req_t *req, int wait);
 } kos_blockdev_t;
 
 /** @} */
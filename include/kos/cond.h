@@ -60,10 +60,11 @@ __BEGIN_DECLS
 */
 typedef struct condvar {
     int dummy;
+    mutex_t *mutex;     /* Mutex of the last waiter, for wait morphing */
 } condvar_t;
 
 /** \brief  Initializer for a transient condvar. */
-#define COND_INITIALIZER    { 0 }
+#define COND_INITIALIZER    { 0, NULL }
 
 /** \brief  Initialize a condition variable.
 
@@ -0,0 +1,706 @@
+/* KallistiOS ##version##
+
+   include/kos/coro.hpp
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/coro.hpp
+    \brief   C++20 coroutines over asynchronous I/O and genwait.
+    \ingroup kthreads
+
+    This file contains a header-only layer that lets C++20 coroutines await
+    what KOS can signal without blocking a thread: asynchronous file reads and
+    writes (kos/fs_aio.h), socket and pty readiness (kos/epoll.h), the end of
+    rendering of a PVR scene, and any object woken with genwait_wake_*().
+
+    Coroutines are kos::task functions, started with executor::spawn(). Each
+    executor is a worker thread (kos/worker_thread.h) that runs its coroutines
+    one at a time, until they finish or await something. The completion of
+    what they were awaiting, be it from another thread or from an interrupt,
+    just puts them back on the executor's queue and wakes it up, so an
+    executor with nothing to do sleeps like any other thread.
+
+    \code
+    kos::task copy(int in, int out) {
+        char buf[2048];
+        ssize_t n;
+
+        while((n = co_await kos::async_read(in, buf, sizeof(buf))) > 0)
+            co_await kos::async_write(out, buf, n);
+    }
+
+    kos::executor exec;
+    exec.spawn(copy(in, out));
+    \endcode
+
+    Frames of coroutines are allocated with kos_coro_frame_alloc(), which keeps
+    them in slab caches rather than going through the heap for each call.
+
+    As with fibers (kos/fiber.h), a coroutine calling something that blocks the
+    thread stalls all the other coroutines of its executor. A coroutine must
+    not be destroyed while it is awaiting something.
+
+    \see    kos/fiber.h
+*/
+
+#ifndef __KOS_CORO_HPP
+#define __KOS_CORO_HPP
+
+#ifndef __cplusplus
+#error "kos/coro.hpp is only for C++"
+#endif
+
+#ifndef __cpp_impl_coroutine
+#error "kos/coro.hpp needs C++20 coroutines (-std=c++20)"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <arch/irq.h>
+#include <kos/epoll.h>
+#include <kos/fs.h>
+#include <kos/fs_aio.h>
+#include <kos/genwait.h>
+#include <kos/worker_thread.h>
+
+#ifdef _arch_dreamcast
+#include <dc/pvr.h>
+#endif
+
+/** \addtogroup kthreads
+    @{
+*/
+
+extern "C" {
+
+/** \brief  Allocate a coroutine frame.
+
+    Frames too big for the slab caches of malloc() but of up to a kilobyte
+    come from caches of their own, anything else from malloc().
+
+    \param  size            The size of the frame.
+    \return                 The frame, or NULL if out of memory.
+*/
+void *kos_coro_frame_alloc(size_t size);
+
+/** \brief  Free a coroutine frame.
+
+    \param  ptr             The frame, may be NULL.
+    \param  size            The size it was allocated with.
+*/
+void kos_coro_frame_free(void *ptr, size_t size);
+
+}
+
+namespace kos {
+
+class executor;
+
+/** \cond */
+namespace detail {
+
+/* Something for an executor to run, by default resuming a coroutine. These
+   are linked in the executor's queue, so they must stay put until run. */
+struct work {
+    work *next = nullptr;
+    void (*run)(work *) = &work::resume;
+    std::coroutine_handle<> handle;
+
+    static void resume(work *w) { w->handle.resume(); }
+};
+
+/* A coroutine waiting for a file descriptor to be ready. */
+struct fd_work : work {
+    int revents = 0;
+};
+
+}  // namespace detail
+/** \endcond */
+
+/** \brief  A coroutine run by an executor.
+
+    A task doesn't start running until it is either given to
+    executor::spawn(), after which it runs on its own and frees itself once
+    over, or awaited by another task, in which case it runs on the same
+    executor, and the awaiting one carries on when it is over.
+
+    If its frame can't be allocated, calling a task function gives an empty
+    task: spawning it fails with ENOMEM, and awaiting it does nothing.
+
+    \headerfile kos/coro.hpp
+*/
+class task {
+public:
+    /** \cond */
+    struct promise_type {
+        executor *exec = nullptr;
+        std::coroutine_handle<> parent;
+        detail::work start;
+
+        static void *operator new(size_t size) noexcept {
+            return kos_coro_frame_alloc(size);
+        }
+
+        static void operator delete(void *ptr, size_t size) noexcept {
+            kos_coro_frame_free(ptr, size);
+        }
+
+        static task get_return_object_on_allocation_failure() noexcept {
+            return task();
+        }
+
+        task get_return_object() noexcept {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        struct final_awaiter {
+            bool await_ready() const noexcept { return false; }
+
+            std::coroutine_handle<>
+            await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                std::coroutine_handle<> parent = h.promise().parent;
+
+                /* An awaited task is destroyed by its owner, once the
+                   awaiting one is done with it. */
+                if(parent)
+                    return parent;
+
+                h.destroy();
+                return std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        final_awaiter final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    using handle_type = std::coroutine_handle<promise_type>;
+    /** \endcond */
+
+    /** \brief  Make an empty task. */
+    task() noexcept = default;
+
+    /** \brief  Take over another task. */
+    task(task &&other) noexcept : h_(other.h_) { other.h_ = nullptr; }
+
+    task &operator=(task &&other) noexcept {
+        if(this != &other) {
+            if(h_)
+                h_.destroy();
+
+            h_ = other.h_;
+            other.h_ = nullptr;
+        }
+
+        return *this;
+    }
+
+    /** \brief  Destroy a task that wasn't spawned. */
+    ~task() {
+        if(h_)
+            h_.destroy();
+    }
+
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    /** \brief  Whether the task has a coroutine. */
+    explicit operator bool() const noexcept { return static_cast<bool>(h_); }
+
+    /** \cond */
+    bool await_ready() const noexcept { return !h_; }
+
+    std::coroutine_handle<> await_suspend(handle_type parent) noexcept {
+        h_.promise().exec = parent.promise().exec;
+        h_.promise().parent = parent;
+        return h_;
+    }
+
+    void await_resume() const noexcept {}
+    /** \endcond */
+
+private:
+    friend class executor;
+
+    explicit task(handle_type h) noexcept : h_(h) {}
+
+    handle_type h_;
+};
+
+/** \brief  A worker thread running coroutines.
+
+    The executor must not be destroyed while some of its tasks are still
+    running, nor by one of them.
+
+    \headerfile kos/coro.hpp
+*/
+class executor {
+public:
+    /** \brief  Start the worker thread; check ok() to see if it was. */
+    executor() noexcept : worker_(thd_worker_create(&executor::routine, this)) {
+        io_wake_.exec = this;
+        io_wake_.wake = &executor::io_woken;
+    }
+
+    /** \brief  Stop the worker thread. */
+    ~executor() {
+        if(worker_)
+            thd_worker_destroy(worker_);
+
+        if(ep_) {
+            genwait_waiter_remove(&io_wake_);
+            kos_epoll_destroy(ep_);
+        }
+    }
+
+    executor(const executor &) = delete;
+    executor &operator=(const executor &) = delete;
+
+    /** \brief  Whether the worker thread could be created. */
+    bool ok() const noexcept { return worker_ != nullptr; }
+
+    /** \brief  The worker thread, to set its priority for instance. */
+    kthread_t *thread() const noexcept {
+        return worker_ ? thd_worker_get_thread(worker_) : nullptr;
+    }
+
+    /** \brief  Start running a task on the executor.
+
+        \param  t           The task, which is left empty.
+        \retval 0           On success.
+        \retval -1          If the task is empty (errno set to ENOMEM).
+    */
+    int spawn(task &&t) noexcept {
+        task::handle_type h = t.h_;
+
+        if(!h) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        t.h_ = nullptr;
+        h.promise().exec = this;
+        h.promise().start.handle = h;
+        post(&h.promise().start);
+        return 0;
+    }
+
+    /** \cond */
+    /* Queue something to run. Safe from interrupts. */
+    void post(detail::work *w) noexcept {
+        irq_mask_t flags = irq_disable();
+
+        w->next = nullptr;
+
+        if(tail_)
+            tail_->next = w;
+        else
+            head_ = w;
+
+        tail_ = w;
+        irq_restore(flags);
+
+        thd_worker_wakeup(worker_);
+    }
+
+    /* Watch a file descriptor for the next time it is ready. */
+    int watch(int fd, short events, detail::fd_work *w) noexcept {
+        kos_epoll_event_t ev;
+
+        if(!ep_ && !(ep_ = kos_epoll_create()))
+            return -1;
+
+        ev.events = (uint16_t)events | KOS_EPOLLONESHOT;
+        ev.data.ptr = w;
+
+        /* File descriptors stay in the set, only disarmed once reported. */
+        if(kos_epoll_ctl(ep_, KOS_EPOLL_CTL_MOD, fd, &ev) &&
+           (errno != ENOENT ||
+            kos_epoll_ctl(ep_, KOS_EPOLL_CTL_ADD, fd, &ev)))
+            return -1;
+
+        ++io_waits_;
+        return 0;
+    }
+    /** \endcond */
+
+    /** \brief  Stop watching a file descriptor.
+
+        File descriptors that have been awaited on with kos::ready() stay
+        watched by the executor. This must be called from one of its tasks
+        before closing one.
+
+        \param  fd          The file descriptor.
+    */
+    void forget(int fd) noexcept {
+        if(ep_)
+            kos_epoll_ctl(ep_, KOS_EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+private:
+    /* Woken when a watched file descriptor gets ready. */
+    struct io_waiter : genwait_waiter_t {
+        executor *exec;
+    };
+
+    static void routine(void *data) {
+        static_cast<executor *>(data)->drain();
+    }
+
+    static void io_woken(genwait_waiter_t *w, int) {
+        executor *exec = static_cast<io_waiter *>(w)->exec;
+
+        exec->io_armed_ = false;
+        thd_worker_wakeup(exec->worker_);
+    }
+
+    /* Run all that is queued, then whatever that queued in turn, until
+       there's nothing left. */
+    void drain() {
+        detail::work *w, *next;
+        irq_mask_t flags;
+
+        for(;;) {
+            flags = irq_disable();
+            w = head_;
+            head_ = tail_ = nullptr;
+            irq_restore(flags);
+
+            if(!w && !poll_io())
+                break;
+
+            /* Whatever is run may free itself, so move on first. */
+            for(; w; w = next) {
+                next = w->next;
+                w->run(w);
+            }
+        }
+    }
+
+    /* Resume the coroutines whose file descriptors are ready. */
+    bool poll_io() {
+        kos_epoll_event_t evs[8];
+        detail::fd_work *fw;
+        irq_mask_t flags;
+        bool any = false;
+        int i, n;
+
+        if(!io_waits_)
+            return false;
+
+        /* Be woken by the next readiness change before looking, so that none
+           is missed in between. A spurious wakeup costs just a look. */
+        flags = irq_disable();
+
+        if(!io_armed_) {
+            io_armed_ = true;
+            genwait_waiter_add(&io_wake_, ep_);
+        }
+
+        irq_restore(flags);
+
+        while((n = kos_epoll_wait(ep_, evs, 8, 0)) > 0) {
+            for(i = 0; i < n; i++) {
+                fw = static_cast<detail::fd_work *>(evs[i].data.ptr);
+                fw->revents = evs[i].events & 0xffff;
+                --io_waits_;
+                fw->run(fw);
+            }
+
+            any = true;
+        }
+
+        return any;
+    }
+
+    kthread_worker_t *worker_;
+    detail::work *head_ = nullptr;
+    detail::work *tail_ = nullptr;
+    kos_epoll_t *ep_ = nullptr;
+    io_waiter io_wake_ = {};
+    volatile bool io_armed_ = false;
+    unsigned int io_waits_ = 0;
+};
+
+/** \brief  Await an object being woken by genwait_wake_*().
+
+    \code
+    int err = co_await kos::wait_on(&obj);
+    \endcode
+
+    The result is the error code given to the genwait_wake_*() function, 0 for
+    a normal wakeup. There is no timeout.
+
+    \headerfile kos/coro.hpp
+*/
+class wait_on : genwait_waiter_t, detail::work {
+public:
+    /** \brief  Get ready to wait on an object. */
+    explicit wait_on(const void *obj) noexcept
+        : genwait_waiter_t(), obj_(obj) {
+        wake = &wait_on::woken;
+    }
+
+    /** \cond */
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(task::handle_type h) noexcept {
+        exec_ = h.promise().exec;
+        handle = h;
+        genwait_waiter_add(this, obj_);
+    }
+
+    int await_resume() const noexcept { return err_; }
+    /** \endcond */
+
+private:
+    static void woken(genwait_waiter_t *w, int err) {
+        wait_on *self = static_cast<wait_on *>(w);
+
+        self->err_ = err;
+        self->exec_->post(self);
+    }
+
+    const void *obj_;
+    executor *exec_ = nullptr;
+    int err_ = 0;
+};
+
+/** \cond */
+namespace detail {
+
+/* A read or write done by the asynchronous I/O thread. */
+class aio_op : work {
+protected:
+    aio_op(file_t fd, void *buf, size_t cnt, bool write) noexcept
+        : fd_(fd), buf_(buf), cnt_(cnt), write_(write) {}
+
+public:
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(task::handle_type h) noexcept {
+        fs_aio_t *req;
+
+        exec_ = h.promise().exec;
+        handle = h;
+
+        if(write_)
+            req = fs_write_async(fd_, buf_, cnt_, &aio_op::done, this);
+        else
+            req = fs_read_async(fd_, buf_, cnt_, &aio_op::done, this);
+
+        if(!req) {
+            rv_ = -1;
+            err_ = errno;
+            return false;
+        }
+
+        return true;
+    }
+
+    ssize_t await_resume() const noexcept {
+        if(rv_ < 0)
+            errno = err_;
+
+        return rv_;
+    }
+
+private:
+    static void done(void *data, ssize_t rv, int err) {
+        aio_op *self = static_cast<aio_op *>(data);
+
+        self->rv_ = rv;
+        self->err_ = err;
+        self->exec_->post(self);
+    }
+
+    file_t fd_;
+    void *buf_;
+    size_t cnt_;
+    bool write_;
+    executor *exec_ = nullptr;
+    ssize_t rv_ = 0;
+    int err_ = 0;
+};
+
+}  // namespace detail
+/** \endcond */
+
+/** \brief  Await a read with fs_read_async().
+
+    \code
+    ssize_t n = co_await kos::async_read(fd, buf, sizeof(buf));
+    \endcode
+
+    The result is that of fs_read(), with errno set on failure.
+
+    \headerfile kos/coro.hpp
+*/
+class async_read : public detail::aio_op {
+public:
+    /** \brief  Get ready to read from a file. */
+    async_read(file_t fd, void *buf, size_t cnt) noexcept
+        : aio_op(fd, buf, cnt, false) {}
+};
+
+/** \brief  Await a write with fs_write_async().
+
+    The result is that of fs_write(), with errno set on failure.
+
+    \headerfile kos/coro.hpp
+*/
+class async_write : public detail::aio_op {
+public:
+    /** \brief  Get ready to write to a file. */
+    async_write(file_t fd, const void *buf, size_t cnt) noexcept
+        : aio_op(fd, const_cast<void *>(buf), cnt, true) {}
+};
+
+/** \brief  Await a file descriptor being ready, like poll() would.
+
+    \code
+    if(co_await kos::ready(sock, POLLIN) & POLLIN)
+        n = recv(sock, buf, sizeof(buf), 0);
+    \endcode
+
+    The result is the events the file descriptor is ready for (POLLERR and
+    POLLHUP are always reported), or -1 with errno set if it can't be watched.
+    Only one coroutine may await each file descriptor at a time. See
+    executor::forget() before closing it.
+
+    \headerfile kos/coro.hpp
+*/
+class ready : detail::fd_work {
+public:
+    /** \brief  Get ready to wait for events on a file descriptor. */
+    ready(int fd, short events) noexcept : fd_(fd), events_(events) {}
+
+    /** \cond */
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(task::handle_type h) noexcept {
+        handle = h;
+
+        if(h.promise().exec->watch(fd_, events_, this)) {
+            revents = -1;
+            err_ = errno;
+            return false;
+        }
+
+        return true;
+    }
+
+    int await_resume() const noexcept {
+        if(revents < 0)
+            errno = err_;
+
+        return revents;
+    }
+    /** \endcond */
+
+private:
+    int fd_;
+    short events_;
+    int err_ = 0;
+};
+
+/** \brief  Await a file descriptor having data to read. */
+inline ready readable(int fd) noexcept {
+    return ready(fd, POLLIN);
+}
+
+/** \brief  Await a file descriptor having room to write. */
+inline ready writable(int fd) noexcept {
+    return ready(fd, POLLOUT);
+}
+
+#ifdef _arch_dreamcast
+/** \brief  Await the PVR being done rendering a scene.
+
+    \code
+    pvr_fence_t fence = pvr_scene_finish_async();
+    co_await kos::render_done(fence);
+    \endcode
+
+    \headerfile kos/coro.hpp
+*/
+class render_done : genwait_waiter_t, detail::work {
+public:
+    /** \brief  Get ready to wait on the fence of a scene. */
+    explicit render_done(pvr_fence_t fence) noexcept
+        : genwait_waiter_t(), fence_(fence) {
+        wake = &render_done::woken;
+        run = &render_done::recheck;
+    }
+
+    /** \cond */
+    bool await_ready() const noexcept { return !pvr_fence_check(fence_); }
+
+    bool await_suspend(task::handle_type h) noexcept {
+        exec_ = h.promise().exec;
+        handle = h;
+        return !pvr_fence_add_waiter(fence_, this);
+    }
+
+    void await_resume() const noexcept {}
+    /** \endcond */
+
+private:
+    static void woken(genwait_waiter_t *w, int) {
+        render_done *self = static_cast<render_done *>(w);
+
+        self->exec_->post(self);
+    }
+
+    /* The waiter is woken at the end of every render, which may not be the
+       one of this scene yet. */
+    static void recheck(detail::work *w) {
+        render_done *self = static_cast<render_done *>(w);
+
+        if(pvr_fence_add_waiter(self->fence_, self))
+            self->handle.resume();
+    }
+
+    pvr_fence_t fence_;
+    executor *exec_ = nullptr;
+};
+#endif
+
+/** \brief  Let the other coroutines of the executor run.
+
+    \code
+    co_await kos::yield();
+    \endcode
+
+    \headerfile kos/coro.hpp
+*/
+class yield : detail::work {
+public:
+    /** \cond */
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(task::handle_type h) noexcept {
+        handle = h;
+        h.promise().exec->post(this);
+    }
+
+    void await_resume() const noexcept {}
+    /** \endcond */
+};
+
+}  // namespace kos
+
+/** @} */
+
+#endif /* __KOS_CORO_HPP */
@@ -23,6 +23,7 @@
 #include <kos/cdefs.h>
 __BEGIN_DECLS
 
+#include <stddef.h>
 #include <stdint.h>
 
 /** \brief   Debug I/O Interface.
@@ -262,6 +263,46 @@ void dbgio_disable(void);
 */
 void dbgio_enable(void);
 
+/** \brief   Default size of the ring of asynchronous debug output.
+    \ingroup logging
+*/
+#define DBGIO_ASYNC_SIZE    16384
+
+/** \brief   Priority of the thread writing out asynchronous debug output.
+    \ingroup logging
+*/
+#define DBGIO_ASYNC_PRIO    (PRIO_DEFAULT + 10)
+
+/** \brief   Write debug output asynchronously.
+    \ingroup logging
+
+    From then on, output written with newline translation (which is what
+    printf(), dbglog() and dbgio_printf() use) is queued in a ring instead of
+    going to the debug I/O device right away. A low priority thread gives it
+    to the device, in pieces as large as it has, which for dcload means far
+    fewer syscalls. Writers only wait when the ring is full; in interrupts,
+    what doesn't fit is dropped, and the number of bytes is reported.
+
+    Untranslated writes, and dbgio_flush(), write out what's queued first.
+    The ring is flushed when the kernel shuts down and on panics.
+
+    \param  size            The size of the ring, or 0 for
+                            \ref DBGIO_ASYNC_SIZE.
+    \retval 0               On success.
+    \retval -1              On error, with errno set to EBUSY if it's already
+                            running, or ENOMEM.
+*/
+int dbgio_async_start(size_t size);
+
+/** \brief   Go back to writing debug output synchronously.
+    \ingroup logging
+
+    What's queued is written out first.
+
+    \retval 0               On success.
+*/
+int dbgio_async_stop(void);
+
 /** \brief   Built-in debug I/O printf function.
     \ingroup logging
     
@@ -22,6 +22,10 @@
 #include <kos/cdefs.h>
 __BEGIN_DECLS
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include <kos/opts.h>
 
 /** \defgroup logging   Logging
@@ -89,6 +93,106 @@ do { \
 */
 void dbglog_set_level(int level);
 
+/** \defgroup dbglog_trace   Trace Ring
+    \brief                  Deferred, binary debug logging
+    \ingroup                logging
+
+    dbgtrace() is a cheap version of dbglog() for hot paths and interrupt
+    handlers. Once dbgtrace_init() has been called, it doesn't format
+    anything: the format string, the arguments and a timestamp go into a
+    lock-free ring, and are only formatted and written out later, by a low
+    priority thread or when dbgtrace_dump() is called. Before that, and after
+    dbgtrace_shutdown(), messages are passed on to dbglog().
+
+    As the arguments are only looked at later, there's a limit to what they
+    can be. Each must be an integer or a pointer no bigger than a pointer
+    (so no doubles or long longs), there can be at most
+    \ref DBGTRACE_MAX_ARGS of them, and anything pointed to (like the string
+    for a %s) must still be around when the message is written out. String
+    literals are fine. If the ring is full, messages are dropped and counted,
+    and the count is written out along with the next message that makes it.
+
+    @{
+*/
+
+/** \brief  The most arguments a dbgtrace() message can have. */
+#define DBGTRACE_MAX_ARGS   6
+
+/** \cond */
+void __real_dbgtrace(int level, const char *fmt, unsigned int nargs, ...);
+
+static inline void __printflike(1, 2) __dbgtrace_check(const char *fmt, ...) {
+    (void)fmt;
+}
+
+#define __DBGTRACE_N(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+#define __DBGTRACE_COUNT(...) \
+    __DBGTRACE_N(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+
+#define __DBGTRACE_ARG(x)       , (uintptr_t)(x)
+#define __DBGTRACE_0()
+#define __DBGTRACE_1(a)         __DBGTRACE_ARG(a)
+#define __DBGTRACE_2(a, ...)    __DBGTRACE_ARG(a) __DBGTRACE_1(__VA_ARGS__)
+#define __DBGTRACE_3(a, ...)    __DBGTRACE_ARG(a) __DBGTRACE_2(__VA_ARGS__)
+#define __DBGTRACE_4(a, ...)    __DBGTRACE_ARG(a) __DBGTRACE_3(__VA_ARGS__)
+#define __DBGTRACE_5(a, ...)    __DBGTRACE_ARG(a) __DBGTRACE_4(__VA_ARGS__)
+#define __DBGTRACE_6(a, ...)    __DBGTRACE_ARG(a) __DBGTRACE_5(__VA_ARGS__)
+#define __DBGTRACE_CAT(a, b)    a ## b
+#define __DBGTRACE_ARGS(n, ...) __DBGTRACE_CAT(__DBGTRACE_, n)(__VA_ARGS__)
+/** \endcond */
+
+/** \brief   Log a message into the trace ring.
+
+    This takes the same arguments as dbglog(), with the limits given above,
+    and is safe to use from inside an interrupt.
+
+    \param  lvl             The level of importance of this message.
+    \param  fmt             Message format string.
+    \param  ...             Format arguments
+*/
+#define dbgtrace(lvl, fmt, ...) \
+do { \
+    if((lvl) <= DBGLOG_LEVEL_SUPPORT) { \
+        if(0) \
+            __dbgtrace_check(fmt, ##__VA_ARGS__); \
+        __real_dbgtrace(lvl, fmt, __DBGTRACE_COUNT(__VA_ARGS__) \
+            __DBGTRACE_ARGS(__DBGTRACE_COUNT(__VA_ARGS__), ##__VA_ARGS__)); \
+    } \
+} while(0)
+
+/** \brief   Start keeping dbgtrace() messages in a ring.
+
+    This must not be called from inside an interrupt.
+
+    \param  count           The number of messages the ring can hold. Must be
+                            a power of two.
+    \param  thread          If true, start a thread to write messages out as
+                            they come in, whenever nothing else wants to run.
+                            Otherwise, they're only written out by
+                            dbgtrace_dump().
+    \retval 0               On success.
+    \retval -1              On error, with errno set to EINVAL if count
+                            isn't a power of two, EBUSY if the ring has
+                            already been started, or ENOMEM.
+*/
+int dbgtrace_init(size_t count, bool thread);
+
+/** \brief   Write out the messages in the trace ring now.
+
+    This must not be called from inside an interrupt.
+*/
+void dbgtrace_dump(void);
+
+/** \brief   Write out the messages in the trace ring and stop using it.
+
+    Later dbgtrace() messages are passed straight on to dbglog(). The ring
+    itself is kept, to be used again by the next dbgtrace_init() with the same
+    count, as a message may still be on its way into it.
+*/
+void dbgtrace_shutdown(void);
+
+/** @} */
+
 __END_DECLS
 
 #endif  /* __KOS_DBGLOG_H */
@@ -0,0 +1,134 @@
+/* KallistiOS ##version##
+
+   include/kos/epoll.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/epoll.h
+    \brief   Event-driven readiness notification for file descriptors.
+    \ingroup threading_polling
+
+    This file contains an interface along the lines of Linux's epoll, for
+    programs that watch many file descriptors at once. Unlike poll() and
+    select(), which ask every file descriptor for its state on each call, a
+    set of watched file descriptors is registered once with kos_epoll_ctl(),
+    and the VFS handlers push readiness changes to it as they happen.
+    kos_epoll_wait() then only looks at the file descriptors that have become
+    ready, so its cost depends on how many are ready, not on how many are
+    watched.
+
+    Events are the ones of poll() (POLLIN, POLLOUT, and so on). POLLERR and
+    POLLHUP are always reported, whether asked for or not. A file descriptor is
+    level-triggered by default: it keeps being reported by kos_epoll_wait() as
+    long as it stays ready. With \ref KOS_EPOLLET, it is only reported again
+    once it has become ready anew.
+
+    Sockets and ptys report their readiness changes. File descriptors of
+    handlers that don't are always considered ready, as with poll().
+*/
+
+#ifndef __KOS_EPOLL_H
+#define __KOS_EPOLL_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdint.h>
+#include <poll.h>
+
+/** \addtogroup threading_polling
+    @{
+*/
+
+/** \brief  Add a file descriptor to the set. */
+#define KOS_EPOLL_CTL_ADD   1
+
+/** \brief  Remove a file descriptor from the set. */
+#define KOS_EPOLL_CTL_DEL   2
+
+/** \brief  Change the events watched for on a file descriptor of the set. */
+#define KOS_EPOLL_CTL_MOD   3
+
+/** \brief  Event flag: edge-triggered, only report new readiness. */
+#define KOS_EPOLLET         (1 << 30)
+
+/** \brief  Event flag: stop watching the descriptor once it was reported,
+            until it is rearmed with \ref KOS_EPOLL_CTL_MOD. */
+#define KOS_EPOLLONESHOT    (1 << 29)
+
+/** \brief  User data attached to a watched file descriptor. */
+typedef union kos_epoll_data {
+    void *ptr;
+    int fd;
+    uint32_t u32;
+    uint64_t u64;
+} kos_epoll_data_t;
+
+/** \brief  Watched events, or events reported by kos_epoll_wait().
+
+    \headerfile kos/epoll.h
+*/
+typedef struct kos_epoll_event {
+    uint32_t events;            /**< \brief Poll events and flags */
+    kos_epoll_data_t data;      /**< \brief User data, returned as is */
+} kos_epoll_event_t;
+
+/** \brief  Opaque set of watched file descriptors. */
+typedef struct kos_epoll kos_epoll_t;
+
+/** \brief  Create an empty set of watched file descriptors.
+
+    \return                 The new set, or NULL on failure (errno set to
+                            ENOMEM).
+*/
+kos_epoll_t *kos_epoll_create(void);
+
+/** \brief  Destroy a set of watched file descriptors.
+
+    No thread may be waiting on the set.
+
+    \param  ep              The set to destroy.
+*/
+void kos_epoll_destroy(kos_epoll_t *ep);
+
+/** \brief  Add, change or remove a watched file descriptor.
+
+    \param  ep              The set.
+    \param  op              \ref KOS_EPOLL_CTL_ADD, \ref KOS_EPOLL_CTL_MOD or
+                            \ref KOS_EPOLL_CTL_DEL.
+    \param  fd              The file descriptor.
+    \param  ev              The events to watch for and the user data to
+                            report them with (ignored by
+                            \ref KOS_EPOLL_CTL_DEL).
+
+    \retval 0               On success.
+    \retval -1              On failure, with errno set: EBADF if fd isn't
+                            open, EEXIST if adding a file descriptor already
+                            in the set, ENOENT if changing or removing one
+                            that isn't, EINVAL for a bad op, ENOMEM if out of
+                            memory.
+*/
+int kos_epoll_ctl(kos_epoll_t *ep, int op, int fd, kos_epoll_event_t *ev);
+
+/** \brief  Wait for watched file descriptors to become ready.
+
+    \param  ep              The set.
+    \param  events          Where to store the ready file descriptors' events
+                            and user data.
+    \param  maxevents       The number of entries of events, at least 1.
+    \param  timeout         The maximum time to wait, in milliseconds, 0 not to
+                            wait at all or -1 to wait forever.
+
+    \return                 The number of entries of events filled in (0 on
+                            timeout), or -1 on failure (errno set to EINVAL
+                            for bad arguments, or EPERM when called in an
+                            interrupt with a non-zero timeout).
+*/
+int kos_epoll_wait(kos_epoll_t *ep, kos_epoll_event_t *events, int maxevents,
+                   int timeout);
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __KOS_EPOLL_H */
@@ -45,23 +45,38 @@ typedef struct export_sym {
 /** \cond */
 /* These are the platform-independent exports */
 extern export_sym_t kernel_symtab[];
+extern const uint32_t kernel_symtab_hash[];
 
 /* And these are the arch-specific exports */
 extern export_sym_t arch_symtab[];
+extern const uint32_t arch_symtab_hash[];
 
 /* And these are the subarch-specific exports */
 extern export_sym_t subarch_symtab[];
+extern const uint32_t subarch_symtab_hash[];
 /** \endcond */
 
 #ifndef __EXPORTS_FILE
 #include <kos/nmmgr.h>
 
 /** \brief  A symbol table "handler" for nmmgr.
+
+    Tables made by genexports.sh come with a hash index, named after the
+    table with _hash on the end, which makes looking a name up cost a few
+    string compares instead of one per export. Its first word is the number
+    of buckets, a power of two. Then comes the index of the first entry of
+    each bucket, or 0xffffffff if it has none, and then one word for each
+    entry of the table: the djb2 hash of its name, with the lowest bit set if
+    it is the last entry of its bucket. The entries of a bucket are next to
+    each other in the table.
+
     \headerfile kos/exports.h
 */
 typedef struct symtab_handler {
     struct nmmgr_handler nmmgr;   /**< \brief Name manager handler header */
     export_sym_t *table;          /**< \brief Location of the first entry */
+    const uint32_t *hash;         /**< \brief Hash index, or NULL to search
+                                               the table linearly */
 } symtab_handler_t;
 #endif
 
@@ -0,0 +1,127 @@
+/* KallistiOS ##version##
+
+   include/kos/fiber.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/fiber.h
+    \brief   Lightweight cooperative fibers.
+    \ingroup kthreads
+
+    This file contains the fiber API. A fiber is a cooperatively scheduled task
+    with its own (small) stack, which runs inside of a regular thread, called
+    its host. Switching between fibers is just a function call that saves the
+    callee-saved registers, and a fiber costs little more than its stack, so a
+    single thread can easily drive thousands of them: one per network session,
+    script instance, and so on.
+
+    All of the fibers of a host run one at a time, until they yield or block.
+    A fiber that blocks with fiber_wait() sleeps on an object exactly like
+    genwait_wait() does, so anything that is signalled with genwait_wake_*()
+    (socket readiness, DMA completion, semaphores being signalled, etc) can wake
+    up fibers too. When every fiber is blocked, the host thread itself sleeps
+    until one of them is woken, so idle fibers cost no CPU time.
+
+    Fibers should not call functions that block the whole thread (like
+    mutex_lock() on a contended mutex or thd_sleep()) for long, as that also
+    stalls all the other fibers of the host. Fibers share the thread-local
+    storage and errno of their host.
+
+    \see    kos/genwait.h
+*/
+
+#ifndef __KOS_FIBER_H
+#define __KOS_FIBER_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+
+/** \brief  Default fiber stack size, in bytes. */
+#define FIBER_STACK_SIZE    4096
+
+struct kfiber;
+
+/** \struct  kfiber_t
+    \brief   Opaque structure describing a fiber.
+*/
+typedef struct kfiber kfiber_t;
+
+/** \brief       Create a new fiber.
+    \relatesalso kfiber_t
+
+    This function creates a fiber on the calling thread (or on the host of the
+    calling fiber). It will start running the next time the host runs its
+    fibers, see fiber_run(). The fiber is freed once the routine returns.
+
+    \param  routine         The function to run in the fiber.
+    \param  data            A parameter to pass to the function called.
+    \param  stack_size      The size of the stack to give the fiber, or 0 for
+                            \ref FIBER_STACK_SIZE.
+
+    \return                 The new fiber on success, NULL on failure (errno
+                            will be set to ENOMEM).
+*/
+kfiber_t *fiber_create(void (*routine)(void *data), void *data,
+                       size_t stack_size);
+
+/** \brief   Run the fibers of the calling thread.
+
+    This function turns the calling thread into the host of the fibers created
+    on it, and runs them until all of them have returned. Fibers may create more
+    fibers while this runs. This must not be called from a fiber.
+
+    \retval 0               On success.
+    \retval -1              If called from a fiber (errno set to EDEADLK).
+*/
+int fiber_run(void);
+
+/** \brief   Let other fibers run.
+
+    This function puts the calling fiber at the back of its host's run queue.
+    Called from outside of a fiber, this is the same as thd_pass().
+*/
+void fiber_yield(void);
+
+/** \brief   Sleep on an object.
+
+    This function works exactly like genwait_wait(), except that only the
+    calling fiber blocks, while the other fibers of its host keep running. It
+    is woken up by the usual genwait_wake_*() functions. Called from outside of
+    a fiber, this just calls genwait_wait(), so code using it works from both.
+
+    \param  obj             The object to sleep on.
+    \param  mesg            A message to show in the status.
+    \param  timeout         If not woken before this many milliseconds have
+                            passed, wake up anyway (0 to wait forever).
+
+    \retval 0               On successfully being woken up (not by timeout).
+    \retval -1              On error or being woken by timeout.
+
+    \par    Error Conditions:
+    \em     EAGAIN - on timeout \n
+    Any error passed to genwait_wake_*_err().
+*/
+int fiber_wait(void *obj, const char *mesg, unsigned int timeout);
+
+/** \brief   Sleep for a while.
+
+    This function blocks the calling fiber for the given time, letting the
+    other fibers of its host run. Called from outside of a fiber, this is the
+    same as thd_sleep().
+
+    \param  ms              The number of milliseconds to sleep.
+*/
+void fiber_sleep(unsigned int ms);
+
+/** \brief   Retrieve the calling fiber.
+
+    \return                 The fiber currently running, or NULL if not called
+                            from a fiber.
+*/
+kfiber_t *fiber_self(void);
+
+__END_DECLS
+
+#endif /* __KOS_FIBER_H */
@@ -58,6 +58,7 @@ typedef struct kos_dirent {
 
 /* Forward declaration */
 struct vfs_handler;
+struct fs_aio;
 
 /* stat_t.unique */
 /** \brief stat_t.unique: Constant to use denoting file has no unique ID */
@@ -204,6 +205,28 @@ typedef struct vfs_handler {
 
     /** \brief Get status information on an already opened file. */
     int (*fstat)(void *hnd, struct stat *st);
+
+    /** \brief Start reading in the background (see \ref vfs_aio).
+        \note  Returns 0 once the request is taken, or -1 to leave it to the
+               aio worker thread. A request taken is completed later with
+               fs_aio_complete(), even on error. */
+    int (*read_async)(void *hnd, struct fs_aio *req);
+
+    /** \brief Start writing in the background, as read_async */
+    int (*write_async)(void *hnd, struct fs_aio *req);
+
+    /** \brief Move data from this file to fd_out without copying it through
+               another buffer first (see fs_splice()).
+        \note  Returns -1 with errno set to ENOSYS to have fs_splice() do
+               it with a read and a write instead. */
+    ssize_t (*splice_out)(void *hnd, file_t fd_out, size_t len);
+
+    /** \brief Move data from fd_in to this file, as splice_out */
+    ssize_t (*splice_in)(void *hnd, file_t fd_in, size_t len);
+
+    /** \brief Read a directory entry along with its status information, as
+               stat would fill it in (see fs_readdir_plus()). */
+    dirent_t *(*readdir_plus)(void *hnd, struct stat *st);
 } vfs_handler_t;
 
 /** \cond */
@@ -300,6 +323,30 @@ ssize_t fs_read(file_t hnd, void *buffer, size_t cnt);
 */
 ssize_t fs_write(file_t hnd, const void *buffer, size_t cnt);
 
+/** \brief   Move data from one opened file to another.
+
+    This reads from one file and writes what it read to another, like a read
+    followed by a write, but without the caller needing a buffer for it. When
+    either end is a pty (or pipe), the data goes straight between its buffer
+    and the other file. Otherwise, it goes through a buffer of
+    \ref FS_SPLICE_BUF_SIZE bytes here, so it works between any two files,
+    sockets or consoles that can be read and written.
+
+    Like fs_read(), this may move less than was asked, and only waits for
+    data to read if there is none at all. Data that was read but then couldn't
+    be written is lost.
+
+    \param  fd_in           The file descriptor to read from.
+    \param  fd_out          The file descriptor to write to.
+    \param  len             The most bytes to move.
+
+    \return                 The number of bytes moved, 0 at the end of fd_in,
+                            or -1 on error, with errno set as the read or write
+                            set it, or to EINVAL if one end can't be read or
+                            written, or both are the same pipe.
+*/
+ssize_t fs_splice(file_t fd_in, file_t fd_out, size_t len);
+
 /** \brief   Seek to a new position within a file.
 
     This function moves the file pointer to the specified position within the
@@ -390,6 +437,21 @@ uint64_t fs_total64(file_t hnd);
 */
 dirent_t *fs_readdir(file_t hnd);
 
+/** \brief   Read an entry from an opened directory, along with its status.
+
+    This works like fs_readdir(), but also fills in st as fs_stat() would for
+    the entry, which saves looking up each entry again by its path. Most
+    filesystems have everything needed in the directory itself. For those
+    that don't, st is made up from what the entry has: its type, size and
+    time.
+
+    \param  hnd             The opened directory's file descriptor.
+    \param  st              Where to put the entry's status information.
+
+    \return                 The next entry, or NULL on failure.
+*/
+dirent_t *fs_readdir_plus(file_t hnd, struct stat *st);
+
 /** \brief   Execute a device-specific command on a file descriptor.
 
     The types and formats of the commands are device/filesystem specific, and
@@ -448,10 +510,14 @@ int fs_chdir(const char *fn);
     up to the original length of the file, will be written back to the file when
     it is closed, assuming that the file is opened for writing.
 
-    \note                   Some of the filesystems in KallistiOS do not support
-                            this operation. If you attempt to use this function
-                            on a filesystem that does not support it, the
-                            function will return NULL and set errno to EINVAL.
+    Filesystems that can't do this themselves, like iso9660 and FAT, have the
+    file mapped read-only instead, with its pages read in as they're touched,
+    once mmu_mmap_init() has been called (see \ref mmu_mmap for what can be
+    done with such a mapping). Otherwise, this fails with errno set to ENXIO.
+
+    \note                   Some handles, like those of directories, can't be
+                            mapped at all. For those, the function will return
+                            NULL and set errno to EINVAL.
 
     \param  hnd             The descriptor to memory map.
     
@@ -496,9 +562,27 @@ int fs_mkdir(const char *fn);
 */
 int fs_rmdir(const char *fn);
 
+/** \brief   fs_fcntl() command to set the size of a file's buffer.
+
+    With a buffer, small reads of the file are served from data read ahead of
+    them, and small writes are gathered up until the buffer is full, instead
+    of each going to the filesystem. The argument is the size in bytes, as an
+    int, or 0 to drop the buffer. Whatever was in the old one is written out
+    or given back first. This works for any file whose filesystem can seek
+    and tell, and is set on the file, so it's shared with any duplicates of
+    its descriptor. Don't use a buffered file from more than one thread at a
+    time. Writes waiting in the buffer go out when it fills, or the file is
+    seeked, closed or asked for its size.
+*/
+#define F_SETBUFSIZE    0x4B01
+
+/** \brief   fs_fcntl() command to get the size of a file's buffer, or 0. */
+#define F_GETBUFSIZE    0x4B02
+
 /** \brief   Manipulate file control flags.
 
-    This function implements the standard C fcntl function.
+    This function implements the standard C fcntl function, along with
+    \ref F_SETBUFSIZE and \ref F_GETBUFSIZE.
 
     \param  fd              The file descriptor to use.
     \param  cmd             The command to run.
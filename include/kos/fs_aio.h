@@ -0,0 +1,143 @@
+/* KallistiOS ##version##
+
+   kos/fs_aio.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/fs_aio.h
+    \brief   Asynchronous file I/O.
+    \ingroup vfs_aio
+
+    This file contains an interface for reading and writing files without
+    waiting for the transfer, on any filesystem.
+*/
+
+#ifndef __KOS_FS_AIO_H
+#define __KOS_FS_AIO_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <sys/types.h>
+#include <kos/fs.h>
+#include <kos/worker_thread.h>
+
+/** \defgroup vfs_aio   Asynchronous I/O
+    \brief              Reading and writing files in the background
+    \ingroup            vfs
+
+    An asynchronous read or write is started with fs_read_async() or
+    fs_write_async(), which return straight away with a request. The request
+    is either waited on with fs_aio_wait(), which can be polled first with
+    fs_aio_done(), or given a callback to be called once it's over.
+
+    Filesystems that can do the transfer themselves in the background do so,
+    such as /cd, which reads by DMA and completes requests from the G1 DMA
+    interrupt. Transfers on any other filesystem are done by a single worker
+    thread shared by all requests, so no thread needs to be dedicated to
+    each stream being read.
+
+    Requests on a file are done in the order they were made, each at the
+    position the previous one left the file at, so a stream can be read by
+    queueing reads one after the other. Like read(), a request may read less
+    than it was asked to. A file shouldn't be read, written or seeked in any
+    other way while requests on it are pending.
+
+    @{
+*/
+
+/** \brief   Asynchronous I/O completion callback.
+
+    Called once a request is over, from the aio worker thread. The request
+    is freed after this returns.
+
+    \param  data            The data passed in with the request.
+    \param  rv              The number of bytes transferred, or -1 on error.
+    \param  err             The errno value of the error, if there was one.
+*/
+typedef void (*fs_aio_cb_t)(void *data, ssize_t rv, int err);
+
+/** \brief   Asynchronous I/O request.
+
+    The fields are for the filesystems to read. Requests are only ever made
+    with fs_read_async() or fs_write_async().
+*/
+typedef struct fs_aio {
+    kthread_job_t job;          /**< \brief Worker thread queue entry */
+    file_t fd;                  /**< \brief File to transfer on */
+    void *buf;                  /**< \brief Buffer to transfer to or from */
+    size_t cnt;                 /**< \brief Number of bytes asked for */
+    int write;                  /**< \brief Non-zero for a write */
+    fs_aio_cb_t cb;             /**< \brief Completion callback, or NULL */
+    void *data;                 /**< \brief Data for the callback */
+    volatile int state;         /**< \brief Where the request is at */
+    ssize_t rv;                 /**< \brief Result, once over */
+    int err;                    /**< \brief errno value, on error */
+} fs_aio_t;
+
+/** \brief   Start reading from a file in the background.
+
+    \param  fd              The file to read from.
+    \param  buf             The buffer to read into. Reads from /cd are done
+                            by DMA when this is 32-byte aligned.
+    \param  cnt             The number of bytes to read.
+    \param  cb              The function to call when the read is over, or
+                            NULL to wait for it with fs_aio_wait().
+    \param  data            Data to pass to the callback.
+    \return                 The request, or NULL on failure, with errno set
+                            to EBADF for a bad file, or ENOMEM.
+*/
+fs_aio_t *fs_read_async(file_t fd, void *buf, size_t cnt, fs_aio_cb_t cb,
+                        void *data);
+
+/** \brief   Start writing to a file in the background.
+
+    \param  fd              The file to write to.
+    \param  buf             The data to write, which must stay as it is
+                            until the write is over.
+    \param  cnt             The number of bytes to write.
+    \param  cb              The function to call when the write is over, or
+                            NULL to wait for it with fs_aio_wait().
+    \param  data            Data to pass to the callback.
+    \return                 The request, or NULL on failure, with errno set
+                            to EBADF for a bad file, or ENOMEM.
+*/
+fs_aio_t *fs_write_async(file_t fd, const void *buf, size_t cnt,
+                         fs_aio_cb_t cb, void *data);
+
+/** \brief   Check if a request is over.
+
+    \param  req             A request made without a callback.
+    \return                 Non-zero once fs_aio_wait() won't wait.
+*/
+int fs_aio_done(const fs_aio_t *req);
+
+/** \brief   Wait for a request to be over, and free it.
+
+    \param  req             A request made without a callback.
+    \return                 The number of bytes transferred, or -1 with errno
+                            set as the read or write set it, or to EINVAL if
+                            the request has a callback.
+*/
+ssize_t fs_aio_wait(fs_aio_t *req);
+
+/** \brief   Complete a request.
+
+    This is for filesystems doing a transfer in the background, once it is
+    over. It may be called from an interrupt.
+
+    \param  req             The request given to the filesystem.
+    \param  rv              The number of bytes transferred, or -1.
+    \param  err             The errno value to report, if rv is -1.
+*/
+void fs_aio_complete(fs_aio_t *req, ssize_t rv, int err);
+
+/** \cond */
+void fs_aio_shutdown(void);
+/** \endcond */
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __KOS_FS_AIO_H */
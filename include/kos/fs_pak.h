@@ -0,0 +1,132 @@
+/* KallistiOS ##version##
+
+   kos/fs_pak.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/fs_pak.h
+    \brief   Packed archive virtual file system.
+    \ingroup vfs_pak
+
+    This file contains support for mounting packed archives: single files
+    that hold a whole tree of files, with an index that is read into RAM when
+    the archive is mounted. The archive itself can be on any other file
+    system, such as /cd.
+*/
+
+#ifndef __KOS_FS_PAK_H
+#define __KOS_FS_PAK_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdint.h>
+#include <kos/fs.h>
+
+/** \defgroup vfs_pak       Packed archives
+    \brief                  VFS driver for indexed asset archives
+    \ingroup                vfs
+
+    A packed archive is made from a directory on the host with the mkpak
+    utility, and mounted read-only with fs_pak_mount(). Opening a file looks
+    it up in the index in RAM, by a binary search on the hash of its path,
+    so opening and checking files never touches the disc, however many there
+    are. Each file starts on a 2048-byte boundary in the archive, so reads of
+    its data start on a sector, and can be stored LZ4-compressed.
+
+    Small reads from a file are served from a per-file buffer, filled with one
+    read from the archive, and large ones go straight from the archive into
+    the caller's buffer. Reads carrying on from each other don't seek the
+    archive. Compressed files are read and decompressed whole the first time
+    they're read from.
+
+    If the archive file itself can be memory mapped (for instance if it is on
+    /rd or /ram), files in it are read from there, and fs_mmap() on a stored
+    file maps it in place. fs_mmap() on any other file returns it loaded whole
+    into RAM, for as long as the file is open.
+
+    Paths are matched without regard to case, as on /cd and /rd.
+
+    All integers in an archive are little endian. An archive is laid out as:
+
+    - A \ref pak_hdr_t.
+    - The entries, sorted by hash, then by path.
+    - The paths, each terminated with a NUL, relative to the top of the
+      archive and separated with '/'.
+    - The data of each file, starting on a 2048-byte boundary, after padding
+      the above to one.
+
+    @{
+*/
+
+/** \brief   Magic value at the start of an archive ("KPAK") */
+#define PAK_MAGIC           0x4b41504b
+
+/** \brief   Archive format version */
+#define PAK_VERSION         1
+
+/** \brief   Alignment of file data in an archive */
+#define PAK_ALIGN           2048
+
+/** \brief   Entry flag: the entry is a directory */
+#define PAK_FLAG_DIR        0x00000001
+
+/** \brief   Entry flag: the data is LZ4 compressed (see \ref pak_entry_t) */
+#define PAK_FLAG_LZ4        0x00000002
+
+/** \brief   Archive header. */
+typedef struct pak_hdr {
+    uint32_t magic;             /**< \brief \ref PAK_MAGIC */
+    uint32_t version;           /**< \brief \ref PAK_VERSION */
+    uint32_t count;             /**< \brief Number of entries */
+    uint32_t names_size;        /**< \brief Bytes of paths after the entries */
+} pak_hdr_t;
+
+/** \brief   Archive entry.
+
+    The hash is the 32-bit FNV-1a hash of the path, in lower case. A
+    compressed file holds one LZ4 block (not frame), that decompresses to the
+    size of the file.
+*/
+typedef struct pak_entry {
+    uint32_t hash;              /**< \brief Hash of the path */
+    uint32_t name;              /**< \brief Offset of the path in the paths */
+    uint32_t offset;            /**< \brief Offset of the data in the archive */
+    uint32_t size;              /**< \brief Size of the file */
+    uint32_t stored;            /**< \brief Size of the data in the archive */
+    uint32_t flags;             /**< \brief PAK_FLAG_* values */
+} pak_entry_t;
+
+/** \cond */
+void fs_pak_shutdown(void);
+/** \endcond */
+
+/** \brief   Mount a packed archive.
+
+    The archive is kept open for as long as it is mounted.
+
+    \param  mountpoint      Where to mount it, such as "/pak".
+    \param  fn              The archive, on any file system.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if the file
+                            isn't an archive, ENOMEM if there isn't the memory
+                            for its index, EIO if it can't be read, or as set
+                            by fs_open() or the name manager.
+*/
+int fs_pak_mount(const char *mountpoint, const char *fn);
+
+/** \brief   Unmount a packed archive.
+
+    \param  mountpoint      Where it was mounted.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to ENOENT if nothing
+                            is mounted there, or EBUSY if files in it are
+                            still open.
+*/
+int fs_pak_unmount(const char *mountpoint);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __KOS_FS_PAK_H */
@@ -40,6 +40,15 @@
     the created object file must be linked with your binary file by adding romdisk.o to your 
     list of objects.
     
+    \par   Compressed images
+    The genromfs in utils/ can compress the files in an image with LZ4 when
+    given -z (set "KOS_ROMDISK_FLAGS=-z" in your Makefile for the embedded
+    romdisk), which usually makes it half the size or less. Only files that
+    come out smaller are compressed, in 8KB blocks. Reads decompress the blocks
+    they need into a cache of the last 4 blocks read, and fs_mmap() on a
+    compressed file decompresses it whole into a heap buffer, which is freed
+    when the file is closed. Such images can't be mounted outside of KOS.
+
     \see INIT_FS_ROMDISK
     \see KOS_INIT_FLAGS()
 
@@ -377,6 +377,39 @@ typedef struct fs_socket_proto {
                             currently true in the socket. 0 if none are true.
     */
     short (*poll)(net_socket_t *s, short events);
+
+    /** \brief  Receive several messages on a socket created with the protocol.
+
+        This function should implement the ::recvmmsg() function for the
+        protocol. It may be NULL, in which case fs_socket falls back to calling
+        recvfrom() for each message.
+
+        \param  s           The socket to receive on.
+        \param  msgvec      The messages to receive into.
+        \param  vlen        The number of entries of msgvec.
+        \param  flags       Flags to the function.
+        \param  timeout     The longest time to wait, or NULL for no limit.
+        \retval -1          On error (set errno appropriately)
+        \retval n           The number of messages received
+    */
+    int (*recvmmsg)(net_socket_t *s, struct mmsghdr *msgvec, unsigned int vlen,
+                    int flags, const struct timespec *timeout);
+
+    /** \brief  Send several messages on a socket created with the protocol.
+
+        This function should implement the ::sendmmsg() function for the
+        protocol. It may be NULL, in which case fs_socket falls back to calling
+        sendto() for each message.
+
+        \param  s           The socket to send on.
+        \param  msgvec      The messages to send.
+        \param  vlen        The number of entries of msgvec.
+        \param  flags       Flags to the function.
+        \retval -1          On error (set errno appropriately)
+        \retval n           The number of messages sent
+    */
+    int (*sendmmsg)(net_socket_t *s, struct mmsghdr *msgvec, unsigned int vlen,
+                    int flags);
 } fs_socket_proto_t;
 
 /** \brief   Initializer for the entry field in the fs_socket_proto_t struct. 
@@ -27,6 +27,7 @@
 __BEGIN_DECLS
 
 #include <kos/thread.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /** \brief  Sleep on an object.
@@ -50,6 +51,47 @@ __BEGIN_DECLS
 int genwait_wait(void *obj, const char *mesg, unsigned int timeout,
                  void (*callback)(void *));
 
+/** \brief  Sleep on an object, with a timeout in nanoseconds.
+
+    This works like genwait_wait(), but takes a finer timeout. Timeouts shorter
+    than a scheduler tick are timed with a high-resolution timer (see
+    kos/hrtimer.h) instead of the tick, which would round them up to the next
+    tick. Longer ones, or all of them if the high-resolution timer is busy,
+    are rounded up to a whole millisecond and handled as with genwait_wait().
+
+    \param  obj             The object to sleep on
+    \param  mesg            A message to show in the status
+    \param  timeout         If not woken before this many nanoseconds have
+                            passed, wake up anyway (0 for no timeout)
+    \param  callback        If non-NULL, call this function with obj as its
+                            argument if the wait times out (but before the
+                            calling thread has been woken back up)
+    \retval 0               On successfully being woken up (not by timeout)
+    \retval -1              On error or being woken by timeout
+
+    \par    Error Conditions:
+    \em     EAGAIN - on timeout
+*/
+int genwait_wait_ns(void *obj, const char *mesg, uint64_t timeout,
+                    void (*callback)(void *));
+
+/** \brief  Sleep on an object from an exception handler.
+
+    This puts the thread that took the exception to sleep on the specified
+    object, and switches to another thread on the way out of the exception.
+    Once woken up, the thread picks up again from where the exception left it,
+    as with any other thread switch, with none of its registers changed. This
+    is for handlers of faults the thread can simply retry once something
+    else has fixed them up, like a page that isn't loaded yet.
+
+    This may only be called from an exception taken by a thread, not from an
+    interrupt handler.
+
+    \param  obj             The object to sleep on
+    \param  mesg            A message to show in the status
+*/
+void genwait_wait_fault(void *obj, const char *mesg);
+
 /* Wake up N threads waiting on the given object. If cnt is <=0, then we
    wake all threads. Returns the number of threads actually woken. */
 /** \brief  Wake up a number of threads sleeping on an object.
@@ -127,6 +169,81 @@ void genwait_wake_one_err(const void *obj, int err);
 */
 int genwait_wake_thd(const void *obj, kthread_t *thd, int err) __nonnull((2));
 
+/** \brief  Move threads sleeping on one object to another.
+
+    This function takes threads sleeping on obj and puts them to sleep on
+    newobj instead, without waking them up. They are moved in the order they
+    would have been woken, and keep their priority order on newobj. Any timeout
+    they had is cancelled. A later wakeup on newobj will return 0 from their
+    genwait_wait() call.
+
+    This lets a primitive that would wake up a crowd of threads, only for them
+    to block on something else straight away, skip the intermediate step.
+    Non-thread waiters are not moved.
+
+    \param  obj             The object the threads are sleeping on
+    \param  newobj          The object to move them to
+    \param  cntmax          The maximum number of threads to move, or <= 0 to
+                            move all of them
+    \param  mesg            The new wait message, or NULL to keep the old one
+    \return                 The number of threads moved
+*/
+int genwait_requeue(const void *obj, void *newobj, int cntmax,
+                    const char *mesg) __nonnull((1, 2));
+
+/** \brief  Find the highest priority thread sleeping on an object.
+
+    This function looks up the thread that would be woken first by
+    genwait_wake_one() on the specified object, without waking it.
+
+    \param  obj             The object to look up sleepers on
+    \return                 The first thread sleeping on obj, or NULL if there
+                            are none.
+*/
+kthread_t *genwait_first(const void *obj);
+
+struct genwait_waiter;
+
+/** \brief  A sleeper on an object that isn't a thread.
+
+    This allows things other than threads (like fibers, see kos/fiber.h) to be
+    woken by the genwait_wake_*() functions. Instead of being made runnable,
+    the waiter's callback is called when it is woken.
+
+    Waiters are woken after any threads sleeping on the same object, and do not
+    support timeouts of their own. The callback is called with interrupts
+    disabled, and possibly from inside an interrupt handler. It may wake up
+    threads, but must not add or remove other waiters.
+
+    \headerfile kos/genwait.h
+*/
+typedef struct genwait_waiter {
+    /** \cond */
+    TAILQ_ENTRY(genwait_waiter) q;
+    const void *obj;
+    /** \endcond */
+
+    /** \brief  Function to call when woken, with the error code passed to the
+                genwait_wake_*() function (0 for a normal wakeup). The waiter
+                has already been removed when this is called. */
+    void (*wake)(struct genwait_waiter *w, int err);
+} genwait_waiter_t;
+
+/** \brief  Add a waiter on an object.
+
+    \param  w               The waiter to add; its wake member must be set.
+    \param  obj             The object to sleep on.
+*/
+void genwait_waiter_add(genwait_waiter_t *w, const void *obj) __nonnull_all;
+
+/** \brief  Remove a waiter before it was woken.
+
+    It is safe to call this on a waiter that has already been woken.
+
+    \param  w               The waiter to remove.
+*/
+void genwait_waiter_remove(genwait_waiter_t *w) __nonnull_all;
+
 /** \brief  Look for timed out genwait_wait() calls.
 
     There should be no reason you need to call this function, it is called
@@ -147,6 +264,38 @@ void genwait_check_timeouts(uint64_t now);
 */
 uint64_t genwait_next_timeout(void);
 
+/** \brief  Genwait sleep queue statistics.
+
+    The sleep queues are a hash table of objects being slept on (see
+    GENWAIT_TABLE_SIZE in kos/opts.h). These statistics are meant for checking
+    that waiters are spread evenly over the queues.
+
+    \headerfile kos/genwait.h
+*/
+typedef struct genwait_stats {
+    size_t queues;      /**< \brief Number of sleep queues */
+    size_t waiting;     /**< \brief Number of threads currently sleeping */
+    size_t used;        /**< \brief Number of non-empty sleep queues */
+    size_t longest;     /**< \brief Length of the longest sleep queue */
+    size_t peak;        /**< \brief Longest any sleep queue has ever been */
+} genwait_stats_t;
+
+/** \brief  Retrieve genwait sleep queue statistics.
+
+    \param  stats           Where to store the statistics.
+*/
+void genwait_get_stats(genwait_stats_t *stats) __nonnull_all;
+
+/** \brief  Print the occupancy of each genwait sleep queue.
+
+    This function prints a summary of the sleep queues, followed by the current
+    and peak number of sleeping threads of every queue that has ever been used.
+
+    \param  pf              The printf-like function to print with.
+    \retval 0               On success.
+*/
+int genwait_pslist(int (*pf)(const char *fmt, ...));
+
 /** \cond */
 /* Initialize the genwait system */
 int genwait_init(void);
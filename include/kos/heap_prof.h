@@ -0,0 +1,88 @@
+/* KallistiOS ##version##
+
+   include/kos/heap_prof.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/heap_prof.h
+    \brief   Sampling heap profiler.
+    \ingroup system_allocator
+
+    This file contains the heap profiler API. While the profiler runs, one in
+    every N allocations made through malloc(), calloc(), realloc() and
+    memalign() is sampled: the call chain that made it is recorded, and the
+    block is tracked until it is freed. The live blocks are aggregated per
+    call chain, so that heap_prof_dump() can tell which code currently holds
+    how much of the heap.
+
+    The dump is in the text format of the gperftools heap profiler, with the
+    counts scaled up by the sampling period, so that it can be read with
+    something like `pprof --text program.elf heap.prof`.
+
+    Only the immediate caller of the allocator is recorded unless KOS and the
+    program are built with frame pointers (see arch/stack.h), in which case
+    up to \ref HEAP_PROF_DEPTH frames are.
+*/
+
+#ifndef __KOS_HEAP_PROF_H
+#define __KOS_HEAP_PROF_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \addtogroup system_allocator
+    @{
+*/
+
+/** \brief  Maximum number of frames recorded per call chain. */
+#define HEAP_PROF_DEPTH     8
+
+/** \brief  Maximum number of distinct call chains tracked. */
+#define HEAP_PROF_SITES     1024
+
+/** \brief  Maximum number of sampled blocks tracked at once. */
+#define HEAP_PROF_BLOCKS    4096
+
+/** \brief  Start the heap profiler.
+
+    Only allocations made after this call are sampled.
+
+    \param  period          Sample one in every period allocations (1 to
+                            sample all of them).
+
+    \retval 0               On success.
+    \retval -1              On failure, with errno set: EINVAL if period is 0,
+                            EBUSY if the profiler is already running or ENOMEM
+                            if the tables could not be allocated.
+*/
+int heap_prof_start(unsigned int period);
+
+/** \brief  Stop the heap profiler and drop everything it collected. */
+void heap_prof_stop(void);
+
+/** \brief  Dump the live sampled memory of the heap profiler.
+
+    \param  pf              The printf-like function to print with, for
+                            instance dbgio_printf() to send the profile over
+                            dcload or the serial port.
+
+    \retval 0               On success.
+    \retval -1              If the profiler isn't running.
+*/
+int heap_prof_dump(int (*pf)(const char *fmt, ...));
+
+/** \cond */
+/* Hooks for malloc(), called whenever __heap_prof_period is not zero. */
+extern unsigned int __heap_prof_period;
+void __heap_prof_alloc(void *ptr, size_t size, uintptr_t ret, uintptr_t fp);
+void __heap_prof_free(void *ptr);
+/** \endcond */
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __KOS_HEAP_PROF_H */
@@ -0,0 +1,110 @@
+/* KallistiOS ##version##
+
+   include/kos/hrtimer.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/hrtimer.h
+    \brief   High-resolution timers.
+    \ingroup kthreads
+
+    This file contains the high-resolution timer API. A high-resolution timer
+    calls a function at a given time, with much better than the millisecond
+    resolution of the scheduler tick: it is good for as fine as a few
+    microseconds. Any number of timers can be pending at once. They are kept
+    in order of expiry, with the hardware timer programmed for the first one.
+
+    The callbacks are called from an interrupt, so they have to be short and
+    can't block. Once they have run, the scheduler is given a chance to switch
+    to any thread they woke up, right away instead of at the next tick.
+
+    The hardware timer is shared with other users of \ref TMU1 (such as the
+    profiler), and only claimed while timers are pending. If it is busy,
+    hrtimer_start() fails, and the caller will have to make do with a coarser
+    timeout.
+
+    \see    kos/genwait.h
+    \see    arch/timer.h
+*/
+
+#ifndef __KOS_HRTIMER_H
+#define __KOS_HRTIMER_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+/** \brief   High-resolution timer.
+
+    Set this up with hrtimer_setup() before use. The fields are only to be
+    touched by the hrtimer functions.
+
+    \headerfile kos/hrtimer.h
+*/
+typedef struct hrtimer {
+    /** \cond */
+    TAILQ_ENTRY(hrtimer) q;
+    uint64_t expires;
+    void (*callback)(struct hrtimer *timer, void *data);
+    void *data;
+    bool armed;
+    /** \endcond */
+} hrtimer_t;
+
+/** \brief       Set up a high-resolution timer.
+    \relatesalso hrtimer_t
+
+    \param  timer           The timer to set up. It must not be pending.
+    \param  callback        The function to call when the timer expires. It is
+                            called from an interrupt.
+    \param  data            A parameter to pass to the callback.
+*/
+void hrtimer_setup(hrtimer_t *timer,
+                   void (*callback)(hrtimer_t *timer, void *data),
+                   void *data) __nonnull((1, 2));
+
+/** \brief       Start a high-resolution timer.
+    \relatesalso hrtimer_t
+
+    Queues the timer to expire at the given time. If it was pending already,
+    it is moved to the new time. A time in the past expires right away.
+
+    \param  timer           The timer to start.
+    \param  expires         When to expire, in nanoseconds of uptime (as
+                            returned by timer_ns_gettime64()).
+
+    \retval 0               On success.
+    \retval -1              If the hardware timer is in use by something else
+                            (errno is set to EBUSY).
+
+    \sa hrtimer_cancel()
+*/
+int hrtimer_start(hrtimer_t *timer, uint64_t expires) __nonnull_all;
+
+/** \brief       Cancel a high-resolution timer.
+    \relatesalso hrtimer_t
+
+    \param  timer           The timer to cancel.
+
+    \return                 True if the timer was pending, false if it had
+                            expired already or wasn't started.
+*/
+bool hrtimer_cancel(hrtimer_t *timer) __nonnull_all;
+
+/** \brief       Check whether a high-resolution timer is pending.
+    \relatesalso hrtimer_t
+
+    \param  timer           The timer to check.
+
+    \return                 True if the timer is started and hasn't expired.
+*/
+static inline bool hrtimer_pending(const hrtimer_t *timer) {
+    return timer->armed;
+}
+
+__END_DECLS
+
+#endif  /* __KOS_HRTIMER_H */
@@ -162,6 +162,7 @@ extern const void * __kos_romdisk;
 #define INIT_FS_RND      0x00000200  /**< Enable support for /dev/urandom VFS */
 
 #define INIT_NO_SHUTDOWN 0x00000400  /**< Disable hardware shutdown */
+#define INIT_MALLOCTAGS  0x00000800  /**< Enable per-subsystem memory tags */
 /** @} */
 
 __END_DECLS
@@ -0,0 +1,151 @@
+/* KallistiOS ##version##
+
+   include/kos/mem_tags.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/mem_tags.h
+    \brief   Per-subsystem memory accounting.
+    \ingroup system_allocator
+
+    This file contains the memory tag API. When a program is built with
+    \ref INIT_MALLOCTAGS in its KOS_INIT_FLAGS(), every block returned by
+    malloc() and friends is tagged with the subsystem that allocated it, and
+    the current and peak usage of each subsystem is tracked.
+
+    The tag of an allocation is the current tag of the calling thread, which
+    the kernel sets around the parts of the network stack, filesystems, PVR,
+    sound and maple drivers that allocate memory, and which new threads
+    inherit from their creator. Anything else is accounted to
+    \ref MEM_TAG_USER, unless the program sets tags of its own.
+
+    Tagging stores the tag in one extra byte at the end of each block, so it
+    costs a little memory and is disabled by default.
+
+    \see    kos_mem_stats(), /dev/meminfo
+*/
+
+#ifndef __KOS_MEM_TAGS_H
+#define __KOS_MEM_TAGS_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+
+/** \addtogroup system_allocator
+    @{
+*/
+
+/** \brief  Memory accounting tags. */
+typedef enum mem_tag {
+    MEM_TAG_USER,       /**< \brief The program itself (default) */
+    MEM_TAG_NET,        /**< \brief Network stack and drivers */
+    MEM_TAG_FS,         /**< \brief Filesystems */
+    MEM_TAG_PVR,        /**< \brief PowerVR driver */
+    MEM_TAG_SOUND,      /**< \brief Sound drivers */
+    MEM_TAG_MAPLE,      /**< \brief Maple bus and drivers */
+    MEM_TAG_COUNT       /**< \brief Number of tags */
+} mem_tag_t;
+
+/** \brief  Memory usage of a tag.
+
+    \headerfile kos/mem_tags.h
+*/
+typedef struct mem_tag_stats {
+    size_t current;     /**< \brief Bytes currently allocated */
+    size_t peak;        /**< \brief Highest value current has reached */
+    size_t blocks;      /**< \brief Number of blocks currently allocated */
+} mem_tag_stats_t;
+
+/** \brief  Consolidated memory usage overview.
+
+    \headerfile kos/mem_tags.h
+*/
+typedef struct kos_mem_stats {
+    size_t heap_size;       /**< \brief Size of the malloc() heap */
+    size_t heap_used;       /**< \brief Bytes allocated from the heap */
+    size_t heap_free;       /**< \brief Bytes free in the heap */
+
+    /** \brief  Per-tag usage, all zero without \ref INIT_MALLOCTAGS. */
+    mem_tag_stats_t tags[MEM_TAG_COUNT];
+
+    size_t vram_size;       /**< \brief Size of video RAM */
+    size_t vram_free;       /**< \brief Video RAM free for textures */
+    size_t aram_size;       /**< \brief Size of sound RAM */
+    size_t aram_free;       /**< \brief Largest free block of sound RAM */
+} kos_mem_stats_t;
+
+/** \brief  Set the memory tag of the calling thread.
+
+    \param  tag             The tag to account the thread's allocations to.
+    \return                 The previous tag of the thread.
+*/
+mem_tag_t mem_tag_set(mem_tag_t tag);
+
+/** \brief  Get the memory tag of the calling thread.
+
+    \return                 The tag allocations are currently accounted to.
+*/
+mem_tag_t mem_tag_get(void);
+
+/** \cond */
+static inline void __mem_tag_scoped_cleanup(mem_tag_t *tag) {
+    mem_tag_set(*tag);
+}
+
+#define ___mem_tag_scoped(t, l) \
+    mem_tag_t __scoped_mem_tag_##l __attribute__((cleanup(__mem_tag_scoped_cleanup))) = mem_tag_set(t)
+
+#define __mem_tag_scoped(t, l) ___mem_tag_scoped(t, l)
+/** \endcond */
+
+/** \brief  Set the memory tag of the calling thread for the current scope.
+
+    The previous tag is restored once the scope is left.
+
+    \param  tag             The tag to account the thread's allocations to.
+*/
+#define mem_tag_scoped(tag) __mem_tag_scoped(tag, __LINE__)
+
+/** \brief  Get the name of a memory tag.
+
+    \param  tag             The tag to look at.
+    \return                 Its name, or NULL if the tag isn't valid.
+*/
+const char *mem_tag_name(mem_tag_t tag);
+
+/** \brief  Retrieve the memory usage of a tag.
+
+    \param  tag             The tag to look at.
+    \param  stats           Where to store its usage.
+
+    \retval 0               On success.
+    \retval -1              On failure (errno set to EINVAL if the tag isn't
+                            valid, or ENOTSUP if tagging isn't enabled).
+*/
+int mem_tag_stats(mem_tag_t tag, mem_tag_stats_t *stats);
+
+/** \brief  Retrieve an overview of all memory usage.
+
+    This combines the heap usage, the per-tag usage if tagging is enabled,
+    and what is left of video and sound RAM (as pvr_mem_available() and
+    snd_mem_available() tell, so zero when those aren't initialized). The
+    same information can be read as text from /dev/meminfo.
+
+    \param  stats           Where to store the overview.
+*/
+void kos_mem_stats(kos_mem_stats_t *stats);
+
+/** \cond */
+/* Hooks for malloc(), only called with INIT_MALLOCTAGS. The tag lives in the
+   last byte of the usable size of the block. */
+void __mem_tag_alloc(void *ptr, size_t usable, mem_tag_t tag);
+mem_tag_t __mem_tag_free(void *ptr, size_t usable);
+/** \endcond */
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __KOS_MEM_TAGS_H */
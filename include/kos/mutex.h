@@ -71,6 +71,20 @@ typedef struct kos_mutex {
 #define MUTEX_TYPE_RECURSIVE    3   /**< \brief Recursive mutex type */
 #define MUTEX_TYPE_DESTROYED    4   /**< \brief Mutex that has been destroyed */
 
+/** \brief  Priority inheritance flag
+
+    OR this with \ref MUTEX_TYPE_NORMAL or \ref MUTEX_TYPE_RECURSIVE to get a
+    priority inheritance mutex. While a higher priority thread is blocked on
+    such a mutex, the owner runs at (at least) the waiter's priority. If the
+    owner is itself blocked on another priority inheritance mutex, the boost is
+    passed down the chain. The owner keeps its boosted priority until it has
+    released every priority inheritance mutex it holds.
+
+    This bounds priority inversion, at the cost of some extra bookkeeping when
+    the mutex is contended.
+*/
+#define MUTEX_TYPE_PI           0x10
+
  __depr("Error-checking mutexes are deprecated")
 static const unsigned int MUTEX_TYPE_ERRORCHECK = 2;
 
@@ -87,6 +101,12 @@ static const unsigned int MUTEX_TYPE_ERRORCHECK = 2;
 /** \brief  Initializer for a transient recursive mutex. */
 #define RECURSIVE_MUTEX_INITIALIZER     { MUTEX_TYPE_RECURSIVE, NULL, 0 }
 
+/** \brief  Initializer for a transient priority inheritance mutex. */
+#define PI_MUTEX_INITIALIZER            { MUTEX_TYPE_NORMAL | MUTEX_TYPE_PI, NULL, 0 }
+
+/** \brief  Initializer for a transient recursive priority inheritance mutex. */
+#define PI_RECURSIVE_MUTEX_INITIALIZER  { MUTEX_TYPE_RECURSIVE | MUTEX_TYPE_PI, NULL, 0 }
+
 /** \brief  Initialize a new mutex.
 
     This function initializes a new mutex for use.
@@ -160,6 +180,7 @@ int mutex_lock_irqsafe(mutex_t *m) __nonnull_all;
     \retval -1              On error, errno will be set as appropriate
 
     \par    Error Conditions:
+    \em     EPERM - called inside an interrupt \n
     \em     ETIMEDOUT - the timeout expired \n
     \em     EAGAIN - lock has been acquired too many times (recursive) \n
 */
@@ -185,6 +206,27 @@ int mutex_lock_timed(mutex_t *m, unsigned int timeout) __nonnull_all;
 */
 __nonnull_all
 static inline int mutex_lock(mutex_t *m) {
+    kthread_t *owner = NULL;
+
+    /* Interrupts can't hold a mutex as thd_current; the slow path turns them
+       away. */
+    if(__predict_false(irq_inside_int()))
+        return mutex_lock_timed(m, 0);
+
+    /* Uncontended fast path: grab the mutex with a single compare-and-swap,
+       and only go through the scheduler if someone already holds it. */
+    if(__predict_true(__atomic_compare_exchange_n(&m->holder, &owner,
+                                                  thd_current, false,
+                                                  __ATOMIC_ACQUIRE,
+                                                  __ATOMIC_RELAXED))) {
+        m->count = 1;
+
+        if(m->type & MUTEX_TYPE_PI)
+            ++thd_current->pi_count;
+
+        return 0;
+    }
+
     return mutex_lock_timed(m, 0);
 }
 
@@ -234,6 +276,20 @@ int mutex_trylock(mutex_t *m) __nonnull_all;
 int mutex_unlock(mutex_t *m) __nonnull_all;
 
 /** \cond */
+/* Set in the holder pointer while threads are blocked on the mutex, so that
+   mutex_unlock() only has to go through genwait when there is someone to wake
+   up. Thread structures are 32-byte aligned, so the bit is otherwise unused. */
+#define __MUTEX_WAITERS         ((uintptr_t)0x1)
+
+static inline kthread_t *__mutex_holder(const mutex_t *m) {
+    return (kthread_t *)((uintptr_t)m->holder & ~__MUTEX_WAITERS);
+}
+
+/* Set __MUTEX_WAITERS on a held mutex, for code that moves threads onto its
+   wait queue behind its back (condition variables). Assumes interrupts are
+   disabled. */
+void __mutex_set_waiters(mutex_t *m);
+
 static inline void __mutex_scoped_cleanup(mutex_t **m) {
     if(*m)
         mutex_unlock(*m);
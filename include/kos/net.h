@@ -25,6 +25,7 @@
 __BEGIN_DECLS
 
 #include <sys/queue.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 
 /* All functions in this header return < 0 on failure, and 0 on success. */
@@ -42,6 +43,29 @@ __BEGIN_DECLS
     \ingroup                        networking
 */
 
+/** \brief   Structure describing one usable network device.
+    \ingroup networking_drivers
+
+    Each usable network device should have one of these describing it. These
+    must be registered to the network layer before the device is usable.
+
+/** \brief   Traffic counters of a network device.
+    \ingroup networking_drivers
+
+    The stack keeps these up to date for every device, in the stats member of
+    its netif_t, as packets go between it and the driver.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_if_stats {
+    uint32_t  pkt_sent;               /**< \brief Packets handed to the driver */
+    uint32_t  pkt_send_failed;        /**< \brief Packets the driver refused */
+    uint64_t  bytes_sent;             /**< \brief Bytes of the packets sent */
+    uint32_t  pkt_recv;               /**< \brief Packets from the driver */
+    uint32_t  pkt_recv_dropped;       /**< \brief Packets the stack dropped */
+    uint64_t  bytes_recv;             /**< \brief Bytes of the packets received */
+} net_if_stats_t;
+
 /** \brief   Structure describing one usable network device.
     \ingroup networking_drivers
 
@@ -181,6 +205,28 @@ typedef struct knetif {
         \param  count       The number of addresses in list.
     */
     int (*if_set_mc)(struct knetif *self, const uint8_t *list, int count);
+
+    /** \brief  Queue a packet made of several pieces for transmission.
+
+        This is optional: if it is NULL, the stack assembles the packet into
+        one buffer and calls if_tx instead. Drivers that copy packets into
+        their own memory anyway should implement it, so that headers and
+        payload get copied straight from where they are.
+
+        \param  self        The network device in question.
+        \param  iov         The pieces of the packet, in order.
+        \param  iovcnt      The number of pieces.
+        \param  blocking    1 if we should block if needed, 0 otherwise.
+        \retval NETIF_TX_OK     On success.
+        \retval NETIF_TX_ERROR  On general failure.
+        \retval NETIF_TX_AGAIN  If non-blocking and we must block to send.
+    */
+    int (*if_tx_iov)(struct knetif *self, const struct iovec *iov, int iovcnt,
+                     int blocking);
+
+    /** \brief  Traffic counters, kept by the stack (drivers leave these
+                alone). */
+    net_if_stats_t      stats;
 } netif_t;
 
 /** \defgroup net_drivers_flags netif_t Flags
@@ -281,7 +327,11 @@ typedef struct ipv6_hdr_s {
 /** \brief   Init ARP.
     \ingroup networking_arp
 
-    \retval  0               On success (no error conditions defined).
+    This also starts the cache timer, which retries and refreshes entries on
+    the network thread, so it must be called after net_thd_init().
+
+    \retval  0               On success.
+    \retval  -1              If the cache timer could not be started.
 */
 int net_arp_init(void);
 
@@ -311,7 +361,9 @@ int net_arp_insert(netif_t *nif, const uint8_t mac[6], const uint8_t ip[4],
 
     If no entry is found, then an ARP query will be sent and an error will be
     returned. If you specify a packet with the call, it will be sent when the
-    reply comes in.
+    reply comes in. A few packets are kept for each address being resolved,
+    and the query is repeated by the cache timer until a reply comes in or it
+    gives up on the address.
 
     \param  nif             The network device in use.
     \param  ip_in           The IP address to lookup.
@@ -322,8 +374,10 @@ int net_arp_insert(netif_t *nif, const uint8_t mac[6], const uint8_t ip[4],
     \param  data_size       The size of data.
 
     \retval 0               On success.
-    \retval -1              A query is outstanding for that address.
-    \retval -2              Address not found, query generated.
+    \retval -1              A query is outstanding for that address, and the
+                            packet could not be queued.
+    \retval -2              Address not found yet, the packet (if any) was
+                            queued or a query was generated.
     \retval -3              Error allocating memory.
 */
 int net_arp_lookup(netif_t *nif, const uint8_t ip_in[4], uint8_t mac_out[6],
@@ -365,6 +419,31 @@ int net_arp_input(netif_t *nif, const uint8_t *pkt, int len);
 */
 int net_arp_query(netif_t *nif, const uint8_t ip[4]);
 
+/** \brief   ARP statistics structure.
+    \ingroup networking_arp
+
+    This structure holds some basic statistics about the ARP cache, and can be
+    retrieved with the appropriate function.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_arp_stats {
+    uint32_t  lookup_miss;            /**< \brief Lookups of unresolved addresses */
+    uint32_t  query_sent;             /**< \brief Who-has queries sent */
+    uint32_t  pkt_queued;             /**< \brief Packets held for resolution */
+    uint32_t  pkt_queue_full;         /**< \brief Packets that couldn't be held */
+    uint32_t  pkt_timed_out;          /**< \brief Held packets of addresses
+                                                 that never resolved */
+    uint32_t  pending;                /**< \brief Packets held right now */
+} net_arp_stats_t;
+
+/** \brief   Retrieve statistics from the ARP cache.
+    \ingroup networking_arp
+
+    \return                 The global ARP stats structure.
+*/
+net_arp_stats_t net_arp_get_stats(void);
+
 
 /***** net_input.c *********************************************************/
 
@@ -728,7 +807,12 @@ net_ipv6_stats_t net_ipv6_get_stats(void);
 */
 
 /** \brief  Init NDP.
-    \retval 0               On success (no error conditions defined).
+
+    This also starts the cache timer, which calls net_ndp_gc() on the network
+    thread, so it must be called after net_thd_init().
+
+    \retval 0               On success.
+    \retval -1              If the cache timer could not be started.
 */
 int net_ndp_init(void);
 
@@ -736,7 +820,10 @@ int net_ndp_init(void);
 void net_ndp_shutdown(void);
 
 /** \brief  Garbage collect timed out NDP entries.
-    This will be called periodically as NDP queries come in.
+
+    This also repeats the solicitations of addresses being resolved, and
+    checks on the entries in use that are stale or about to be. It is called
+    periodically by the cache timer.
 */
 void net_ndp_gc(void);
 
@@ -754,7 +841,7 @@ int net_ndp_insert(netif_t *nif, const uint8_t mac[6], const struct in6_addr *ip
 
     If no entry is found, then an NDP query will be sent and an error will be
     returned. If you specify a packet with the call, it will be sent when the
-    reply comes in.
+    reply comes in. A few packets are kept for each address being resolved.
 
     \param  net             The network device to use.
     \param  ip              The IPv6 address to query.
@@ -763,7 +850,12 @@ int net_ndp_insert(netif_t *nif, const uint8_t mac[6], const struct in6_addr *ip
                             when a reply comes in.
     \param  data            Anything that comes after the header.
     \param  data_size       The size of data.
-    \return                 0 on success, <0 on failure.
+
+    \retval 0               On success.
+    \retval -1              A query is outstanding for that address, and the
+                            packet could not be queued (or out of memory).
+    \retval -2              Address not found yet, the packet (if any) was
+                            queued or a query was generated.
 */
 int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8_t mac_out[6],
                    const ipv6_hdr_t *pkt, const uint8_t *data, int data_size);
@@ -792,6 +884,10 @@ typedef struct net_udp_stats {
     uint32_t  pkt_recv_bad_size;      /**< \brief Packets of a bad size */
     uint32_t  pkt_recv_bad_chksum;    /**< \brief Packets with a bad checksum */
     uint32_t  pkt_recv_no_sock;       /**< \brief Packets with to a closed port */
+    uint32_t  pkt_recv_no_space;      /**< \brief Packets dropped because the
+                                                 receive queue was full */
+    uint32_t  pkt_queued;             /**< \brief Packets waiting to be read
+                                                 right now */
 } net_udp_stats_t;
 
 /** \brief  Retrieve statistics from the UDP layer.
@@ -819,6 +915,32 @@ void net_udp_shutdown(void);
     @{
 */
 
+/** \brief  TCP statistics structure.
+
+    This structure holds some basic statistics about the TCP layer of the stack,
+    and can be retrieved with the appropriate function.
+
+    \headerfile kos/net.h
+*/
+typedef struct net_tcp_stats {
+    uint32_t  pkt_sent;               /**< \brief Segments sent out successfully */
+    uint32_t  pkt_send_failed;        /**< \brief Segments that failed to send */
+    uint32_t  pkt_resent;             /**< \brief Segments retransmitted */
+    uint32_t  pkt_recv;               /**< \brief Segments received */
+    uint32_t  pkt_recv_bad_chksum;    /**< \brief Segments with a bad checksum */
+    uint32_t  pkt_recv_no_sock;       /**< \brief Segments to a closed port */
+    uint32_t  pkt_recv_out_of_order;  /**< \brief Segments received out of
+                                                 order */
+    uint32_t  pkt_recv_outside_wnd;   /**< \brief Segments (partly) outside of
+                                                 the receive window */
+} net_tcp_stats_t;
+
+/** \brief  Retrieve statistics from the TCP layer.
+
+    \return                 The global TCP stats struct.
+*/
+net_tcp_stats_t net_tcp_get_stats(void);
+
 /** \brief  Init TCP.
     \retval 0               On success (no error conditions defined).
 */
@@ -844,7 +966,7 @@ void net_tcp_shutdown(void);
 
     \return                 The calculated CRC-32.
 */
-uint32_t __pure net_crc32le(const uint8_t *data, int size);
+uint32_t net_crc32le(const uint8_t *data, int size);
 
 /** \brief  Calculate a "big-endian" CRC-32 over a block of data.
 
@@ -853,7 +975,7 @@ uint32_t __pure net_crc32le(const uint8_t *data, int size);
 
     \return                 The calculated CRC-32.
 */
-uint32_t __pure net_crc32be(const uint8_t *data, int size);
+uint32_t net_crc32be(const uint8_t *data, int size);
 
 /** \brief  Calculate a CRC16-CCITT over a block of data.
 
@@ -869,7 +991,7 @@ uint32_t __pure net_crc32be(const uint8_t *data, int size);
 
     \return                 The calculated CRC16-CCITT.
 */
-uint16_t __pure net_crc16ccitt(const uint8_t *data, int size, uint16_t start);
+uint16_t net_crc16ccitt(const uint8_t *data, int size, uint16_t start);
 
 /** @} */
 
@@ -968,6 +1090,23 @@ int net_reg_device(netif_t *device);
 */
 int net_unreg_device(netif_t *device);
 
+/** \brief   Transmit a packet made of several pieces on a device.
+    \ingroup networking_drivers
+
+    This uses the device's if_tx_iov, if it has one. Otherwise the pieces are
+    assembled into a temporary buffer that is passed to if_tx.
+
+    \param  device          The device to transmit on.
+    \param  iov             The pieces of the packet, in order.
+    \param  iovcnt          The number of pieces.
+    \param  blocking        1 if we should block if needed, 0 otherwise.
+
+    \return                 The return value of the driver (NETIF_TX_OK on
+                            success).
+*/
+int net_tx_iov(netif_t *device, const struct iovec *iov, int iovcnt,
+               int blocking);
+
 /** \brief   Init network support.
     \ingroup networking_drivers
 
@@ -975,6 +1114,10 @@ int net_unreg_device(netif_t *device);
                             default device (i.e, over DHCP or from the flashrom
                             on the Dreamcast), pass 0 as the IP parameter.
 
+    \note                   With a lease saved in \ref net_dhcp_lease_file,
+                            this returns as soon as the device is set up with
+                            it, and DHCP confirms it in the background.
+
     \param  ip              The IPv4 address to set on the default device, in
                             host byte order.
 
@@ -982,6 +1125,24 @@ int net_unreg_device(netif_t *device);
 */
 int net_init(uint32_t ip);
 
+/** \brief   File to keep the DHCP lease in between boots.
+    \ingroup networking_drivers
+
+    When this is set, each lease DHCP binds to is written to this file, and
+    the next net_init() asking for an address reuses it instead of going
+    through the whole discovery: the default device is set up with it at once,
+    and a DHCPREQUEST asks the server to confirm it in the background. If the
+    server says no, the address is dropped and discovery starts normally.
+
+    A lease that ran out, or was saved for another adapter, is ignored. Telling
+    if it ran out relies on the clock keeping time across reboots.
+
+    This is NULL by default. To have it set before KOS initializes networking
+    itself, define it in the program, like
+    <tt>const char *net_dhcp_lease_file = "/vmu/a1/DHCPLEAS";</tt>
+*/
+extern const char *net_dhcp_lease_file;
+
 /** \brief   Shutdown network support.
     \ingroup networking_drivers
 */
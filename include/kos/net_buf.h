@@ -0,0 +1,175 @@
+/* KallistiOS ##version##
+
+   include/kos/net_buf.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/net_buf.h
+    \brief   Reference-counted network packet buffers.
+    \ingroup networking_drivers
+
+    This file contains the packet buffer pool that network drivers receive
+    into. A buffer is a fixed size slot of a pool allocated once, with some
+    headroom in front of the packet and tailroom after it. Whoever holds a
+    reference to a buffer can keep pointers into it, so the upper layers of
+    the stack can queue received data where the driver put it, instead of
+    copying it out before the driver reuses its memory.
+
+    Drivers keep handing packets to net_input() as plain pointers. Protocols
+    then call net_buf_hold() on the data they want to keep, which only takes a
+    reference when that data lives in a pool buffer, and otherwise tells them
+    to copy it like before.
+*/
+
+#ifndef __KOS_NET_BUF_H
+#define __KOS_NET_BUF_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \addtogroup networking_drivers
+    @{
+*/
+
+/** \brief  Size of each buffer of the pool, in bytes. */
+#define NET_BUF_SIZE        2048
+
+/** \brief  Space reserved in front of the packet by net_buf_alloc(). */
+#define NET_BUF_HEADROOM    64
+
+/** \brief  Number of buffers in the pool. */
+#define NET_BUF_COUNT       48
+
+/** \brief  Network packet buffer.
+
+    \headerfile kos/net_buf.h
+*/
+typedef struct net_buf {
+    uint8_t *head;              /**< \brief Start of the buffer's storage */
+    uint8_t *data;              /**< \brief Start of the packet */
+    size_t len;                 /**< \brief Length of the packet */
+    unsigned int refcnt;        /**< \brief Number of references held */
+    struct net_buf *next;       /**< \brief Free list link (internal) */
+} net_buf_t;
+
+/** \brief  Set up the buffer pool.
+
+    This may be called several times (every driver using the pool does so),
+    the pool is only allocated the first time.
+
+    \retval 0               On success.
+    \retval -1              On failure (errno set to ENOMEM).
+*/
+int net_buf_init(void);
+
+/** \brief  Release the buffer pool.
+
+    This must be called once for every successful net_buf_init(). The pool
+    is freed by the last call, unless buffers are still held somewhere.
+*/
+void net_buf_shutdown(void);
+
+/** \brief  Allocate a buffer from the pool.
+
+    This may be called from an interrupt handler. The buffer is returned with
+    one reference, an empty packet and \ref NET_BUF_HEADROOM bytes of
+    headroom.
+
+    \return                 The buffer, or NULL if the pool is empty (errno
+                            set to ENOBUFS) or not set up (errno set to
+                            ENXIO).
+*/
+net_buf_t *net_buf_alloc(void);
+
+/** \brief  Take an extra reference to a buffer.
+
+    \param  nb              The buffer.
+    \return                 nb.
+*/
+net_buf_t *net_buf_ref(net_buf_t *nb);
+
+/** \brief  Drop a reference to a buffer.
+
+    The buffer goes back to the pool once its last reference is dropped. This
+    may be called from an interrupt handler.
+
+    \param  nb              The buffer, or NULL to do nothing.
+*/
+void net_buf_unref(net_buf_t *nb);
+
+/** \brief  Take a reference to whatever buffer holds some received data.
+
+    Protocols call this on data they would otherwise copy into a queue.
+
+    \param  ptr             A pointer to the data.
+    \return                 The buffer holding ptr with an extra reference,
+                            or NULL if ptr isn't in a live pool buffer or if
+                            the pool is running low, in which case the data
+                            should be copied.
+*/
+net_buf_t *net_buf_hold(const void *ptr);
+
+/** \brief  Get the free space in front of the packet of a buffer.
+
+    \param  nb              The buffer.
+    \return                 The headroom, in bytes.
+*/
+static inline size_t net_buf_headroom(const net_buf_t *nb) {
+    return (size_t)(nb->data - nb->head);
+}
+
+/** \brief  Get the free space after the packet of a buffer.
+
+    \param  nb              The buffer.
+    \return                 The tailroom, in bytes.
+*/
+static inline size_t net_buf_tailroom(const net_buf_t *nb) {
+    return NET_BUF_SIZE - net_buf_headroom(nb) - nb->len;
+}
+
+/** \brief  Grow the packet of a buffer at the front, into the headroom.
+
+    \param  nb              The buffer.
+    \param  len             The number of bytes to add, at most the headroom.
+    \return                 The new start of the packet.
+*/
+static inline uint8_t *net_buf_push(net_buf_t *nb, size_t len) {
+    nb->data -= len;
+    nb->len += len;
+    return nb->data;
+}
+
+/** \brief  Strip bytes off the front of the packet of a buffer.
+
+    \param  nb              The buffer.
+    \param  len             The number of bytes to strip, at most the length
+                            of the packet.
+    \return                 The new start of the packet.
+*/
+static inline uint8_t *net_buf_pull(net_buf_t *nb, size_t len) {
+    nb->data += len;
+    nb->len -= len;
+    return nb->data;
+}
+
+/** \brief  Grow the packet of a buffer at the end, into the tailroom.
+
+    \param  nb              The buffer.
+    \param  len             The number of bytes to add, at most the tailroom.
+    \return                 Where the added bytes start.
+*/
+static inline uint8_t *net_buf_append(net_buf_t *nb, size_t len) {
+    uint8_t *tail = nb->data + nb->len;
+
+    nb->len += len;
+    return tail;
+}
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __KOS_NET_BUF_H */
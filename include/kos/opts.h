@@ -84,14 +84,30 @@ __BEGIN_DECLS
    handler print them when they occur.  */
 /* #define PVR_RENDER_DBG */
 
+/* Enable this define to build the hooks of the kernel event tracer in, so that
+   trace_start() can record a timeline. See kos/trace.h. */
+/* #define KOS_TRACE 1 */
+
+/* Enable this define to have irq_disable() and irq_restore() time how long
+   interrupts stay masked. See irq_get_mask_stats(). */
+/* #define IRQ_MASK_DEBUG 1 */
+
+/* Enable this define to paint every thread stack when the thread is created,
+   instead of only those created with the paint_stack attribute, so that
+   thd_get_stack_usage() and thd_pslist() can show how much of each stack is
+   really used. Each painted thread also logs its usage and a suggested stack
+   size when it is destroyed. See kos/thread.h. */
+/* #define THD_STACK_PAINT_ALL 1 */
+
 /* Aggregate debugging levels. It's probably best to enable these with your
    KOS_CFLAGS when compiling KOS itself, but they're all documented here and
    can be enabled here, if you really want to. */
 
 /* Enable all recommended options for normal debugging use. This enables the
    first level of malloc debugging for the main pool, as well as the internal
-   dlmalloc debugging code for the main pool. This is essentially the set that
-   was normally enabled in the repository tree. */
+   dlmalloc debugging code for the main pool, and paints every thread stack.
+   This is essentially the set that was normally enabled in the repository
+   tree. */
 /* #define KOS_DEBUG 1 */
 
 /* Enable verbose debugging support. Basically, if your code is crashing and the
@@ -114,6 +130,7 @@ __BEGIN_DECLS
 #if KOS_DEBUG >= 1
 #define MALLOC_DEBUG 1
 #define KM_DBG 1
+#define THD_STACK_PAINT_ALL 1
 #endif
 
 #if KOS_DEBUG >= 2
@@ -132,6 +149,49 @@ __BEGIN_DECLS
 #define FS_RAMDISK_MAX_FILES 8
 #endif
 
+/** \brief  The size of the buffer of each end of a pty or pipe, in bytes.
+            This must be a power of two. Each pty takes twice this. */
+#ifndef FS_PTY_BUFFER_SIZE
+#define FS_PTY_BUFFER_SIZE 4096
+#endif
+
+/** \brief  The size of the buffer fs_splice() copies through when neither
+            end can move the data itself, in bytes. */
+#ifndef FS_SPLICE_BUF_SIZE
+#define FS_SPLICE_BUF_SIZE 4096
+#endif
+
+/** \brief  The size of the pieces fs_ramdisk keeps file data in, in bytes.
+            This must be a power of two. Growing a file only ever copies the
+            last piece, so appending to a big file stays quick. Files smaller
+            than this take only as much as they need, in powers of two. */
+#ifndef FS_RAMDISK_CHUNK_SIZE
+#define FS_RAMDISK_CHUNK_SIZE (16 * 1024)
+#endif
+
+/** \brief  The least number of files and directories a romdisk image must
+            have for an index of its paths to be built when it is mounted.
+            With the index, opening a file is a hash lookup rather than a walk
+            through each directory on its path, at the cost of about 12 bytes
+            and the length of the path for each. 0 never builds one. */
+#ifndef FS_ROMDISK_INDEX_MIN
+#define FS_ROMDISK_INDEX_MIN 64
+#endif
+
+/** \brief  The memory the shared block cache of ext2, FAT and other
+            block-based filesystems can use beyond the blocks each mount
+            reserves for itself, in bytes. */
+#ifndef BCACHE_BUDGET
+#define BCACHE_BUDGET (256 * 1024)
+#endif
+
+/** \brief  How long a block stays dirty in the shared block cache before
+            the flush thread writes it back, in milliseconds. 0 leaves them
+            until they're evicted or synced. */
+#ifndef BCACHE_WRITEBACK_MS
+#define BCACHE_WRITEBACK_MS 1000
+#endif
+
 /** \brief  The number of distinct file descriptors, including files and
             network sockets, that can be in use at a time. Decreasing this
             value can reduce memory usage.  */
@@ -139,6 +199,14 @@ __BEGIN_DECLS
 #define FD_SETSIZE 1024
 #endif
 
+/** \brief  The number of sleep queues that genwait hashes objects onto. This
+            must be a power of two. Increasing this value shortens the queues
+            that have to be searched to wake up a thread, at the cost of 8
+            bytes of memory per queue. */
+#ifndef GENWAIT_TABLE_SIZE
+#define GENWAIT_TABLE_SIZE 128
+#endif
+
 /** @} */
 
 __END_DECLS
@@ -0,0 +1,244 @@
+/* KallistiOS ##version##
+
+   include/kos/ringbuf.h
+   Copyright (C) 2026 KallistiOS Contributors
+
+*/
+
+/** \file    kos/ringbuf.h
+    \brief   Lock-free ring buffers.
+    \ingroup ringbuf
+
+    This file defines a fixed-size, lock-free ring buffer meant for handing
+    data from interrupt handlers (or other threads) to a consumer thread
+    without having to disable interrupts around every access.
+
+    \see    kos/genwait.h
+*/
+
+#ifndef __KOS_RINGBUF_H
+#define __KOS_RINGBUF_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** \defgroup ringbuf Ring Buffers
+    \brief    Lock-free SPSC/MPSC queues
+    \ingroup  kthreads
+
+    A ring buffer holds a power-of-two number of fixed-size elements. It comes
+    in two flavors, selected at initialization time:
+
+    - Single producer, single consumer (the default): one context pushes and
+      one context pops. This is the cheapest mode, as no read-modify-write
+      operations are needed at all.
+    - Multiple producer, single consumer (\ref RINGBUF_MPSC): any number of
+      contexts may push concurrently (including nested interrupt handlers), and
+      one context pops. Each slot carries a sequence number so that a
+      producer that gets interrupted halfway through a push never stalls the
+      others.
+
+    Pushing never blocks and is safe to do from inside an interrupt handler.
+    Popping can either be done without blocking, or by waiting for data with
+    ringbuf_wait() / ringbuf_pop_wait(), which sleep on the ring buffer through
+    genwait.
+
+    The producer and consumer indices live on separate cache lines so that the
+    two sides don't keep writing back each other's lines.
+
+    @{
+*/
+
+/** \brief  Ring buffer flag: allow multiple concurrent producers. */
+#define RINGBUF_MPSC    0x00000001
+
+/** \brief  Ring buffer type.
+
+    There are no public members of this structure for you to actually do
+    anything with in your code, so don't try.
+
+    \headerfile kos/ringbuf.h
+*/
+typedef struct ringbuf {
+    /** \cond */
+    /* Producer index. Only ever written by producers. */
+    volatile size_t head __attribute__((aligned(32)));
+
+    /* Consumer index. Only ever written by the consumer. */
+    volatile size_t tail __attribute__((aligned(32)));
+
+    /* Everything below is read-only after ringbuf_init(). */
+    uint8_t *data __attribute__((aligned(32)));
+    volatile size_t *seq;
+    size_t elem_size;
+    size_t stride;
+    size_t mask;
+    uint32_t flags;
+
+    /* Number of threads blocked in ringbuf_wait(). */
+    volatile int waiters;
+    /** \endcond */
+} ringbuf_t;
+
+/** \brief  Initialize a ring buffer.
+
+    This function allocates storage for the ring buffer and sets it up for use.
+    This must not be called from inside an interrupt.
+
+    \param  rb              The ring buffer to initialize.
+    \param  elem_size       The size of each element, in bytes.
+    \param  count           The number of elements the ring buffer can hold.
+                            Must be a power of two.
+    \param  flags           Zero for a single producer ring buffer, or
+                            \ref RINGBUF_MPSC.
+    \retval 0               On success
+    \retval -1              On error, errno will be set as appropriate
+
+    \par    Error Conditions:
+    \em     EINVAL - elem_size is 0 or count is not a power of two \n
+    \em     ENOMEM - out of memory
+*/
+int ringbuf_init(ringbuf_t *rb, size_t elem_size, size_t count,
+                 uint32_t flags) __nonnull_all;
+
+/** \brief  Destroy a ring buffer.
+
+    This function frees the storage associated with a ring buffer. Any pending
+    elements are discarded and any threads waiting on the ring buffer will be
+    woken with an ENOTRECOVERABLE error.
+
+    \param  rb              The ring buffer to destroy.
+*/
+void ringbuf_destroy(ringbuf_t *rb) __nonnull_all;
+
+/** \brief  Push an element onto a ring buffer.
+
+    This function copies an element into the ring buffer and wakes up a waiting
+    consumer, if there is one. It never blocks and is safe to call inside an
+    interrupt. Only one context may push at a time unless the ring buffer was
+    created with \ref RINGBUF_MPSC.
+
+    \param  rb              The ring buffer to push onto.
+    \param  elem            The element to copy in (elem_size bytes).
+    \retval true            On success.
+    \retval false           If the ring buffer is full.
+*/
+bool ringbuf_push(ringbuf_t *rb, const void *elem) __nonnull_all;
+
+/** \brief  Pop an element off of a ring buffer.
+
+    This function removes the oldest element from the ring buffer without
+    blocking. It must only be called by the consumer.
+
+    \param  rb              The ring buffer to pop from.
+    \param  elem            Where to copy the element to, or NULL to just drop
+                            it.
+    \retval true            On success.
+    \retval false           If the ring buffer is empty.
+*/
+bool ringbuf_pop(ringbuf_t *rb, void *elem);
+
+/** \brief  Look at the oldest element of a ring buffer.
+
+    This function returns a pointer to the oldest element of the ring buffer,
+    leaving it in place. The pointer stays valid until the element is popped.
+    This allows the consumer to process elements in place and only release
+    them once it is done with them.
+
+    In single producer mode, the producer may also call this function to get a
+    (possibly stale, but never too new) look at the oldest pending element.
+
+    \param  rb              The ring buffer to look at.
+    \return                 The oldest element, or NULL if empty.
+*/
+void *ringbuf_peek(ringbuf_t *rb) __nonnull_all;
+
+/** \brief  Wait for a ring buffer to have data.
+
+    This function blocks until the ring buffer is not empty, the timeout
+    expires, or ringbuf_wake() is called. It must only be called by the
+    consumer, and not from inside an interrupt. Note that this function may
+    return 0 while the ring buffer is still empty if it was woken up with
+    ringbuf_wake(), so check the result of ringbuf_pop() afterwards.
+
+    \param  rb              The ring buffer to wait on.
+    \param  timeout         The maximum number of milliseconds to block (a value
+                            of 0 here will block indefinitely).
+    \retval 0               On success.
+    \retval -1              On error, sets errno as appropriate.
+
+    \par    Error Conditions:
+    \em     ETIMEDOUT - timed out while blocking \n
+    \em     ENOTRECOVERABLE - the ring buffer was destroyed
+*/
+int ringbuf_wait(ringbuf_t *rb, unsigned int timeout) __nonnull_all;
+
+/** \brief  Pop an element off of a ring buffer, blocking if necessary.
+
+    This function works like ringbuf_pop(), but will wait for an element to be
+    pushed if the ring buffer is empty. It must only be called by the consumer,
+    and not from inside an interrupt.
+
+    \param  rb              The ring buffer to pop from.
+    \param  elem            Where to copy the element to, or NULL to just drop
+                            it.
+    \param  timeout         The maximum number of milliseconds to block (a value
+                            of 0 here will block indefinitely).
+    \retval 0               On success.
+    \retval -1              On error, sets errno as appropriate.
+
+    \par    Error Conditions:
+    \em     ETIMEDOUT - timed out while blocking \n
+    \em     EINTR - woken up by ringbuf_wake() with nothing to pop \n
+    \em     ENOTRECOVERABLE - the ring buffer was destroyed
+*/
+int ringbuf_pop_wait(ringbuf_t *rb, void *elem, unsigned int timeout);
+
+/** \brief  Wake up any threads waiting on a ring buffer.
+
+    This is mainly useful for shutting down a consumer thread that is blocked
+    in ringbuf_wait(). It is safe to call inside an interrupt.
+
+    \param  rb              The ring buffer to wake waiters on.
+*/
+void ringbuf_wake(ringbuf_t *rb) __nonnull_all;
+
+/** \brief  Retrieve the number of elements in a ring buffer.
+
+    This is only a snapshot, as producers and consumers may be working on the
+    ring buffer concurrently.
+
+    \param  rb              The ring buffer to check.
+    \return                 The number of elements currently pushed.
+*/
+static inline size_t ringbuf_count(const ringbuf_t *rb) {
+    return rb->head - rb->tail;
+}
+
+/** \brief  Retrieve the capacity of a ring buffer.
+
+    \param  rb              The ring buffer to check.
+    \return                 The maximum number of elements it can hold.
+*/
+static inline size_t ringbuf_capacity(const ringbuf_t *rb) {
+    return rb->mask + 1;
+}
+
+/** \brief  Check whether a ring buffer is empty.
+
+    \param  rb              The ring buffer to check.
+    \return                 True if no elements are pushed.
+*/
+static inline bool ringbuf_empty(const ringbuf_t *rb) {
+    return rb->head == rb->tail;
+}
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __KOS_RINGBUF_H */
@@ -21,16 +21,11 @@
     a reader either (since the reader might attempt to read while the writer is
     changing data).
 
-    This is implemented using two mutexes and an atomic read counter.
-    - The readers will lock the write mutex, then optionally the read mutex
-      (if they are the first reader), then unlock the write mutex. The writers
-      will lock the write mutex, then the read mutex.
-    - The write mutex is used to allow a pending writer to prevent new readers
-      from getting the semaphore.
-    - The read mutex is reserved when the first reader gets the semaphore, and
-      released after the last reader releases the lock. It is used to make the
-      writer wait until all readers are done.
-    - The atomic counter keeps count of the number of readers.
+    Threads that have to wait are put to sleep with genwait, readers and
+    writers on two different queues. When the semaphore is released, it is
+    handed over directly to whoever is next: either one writer, or all of the
+    waiting readers at once. Which of the two goes first when both are
+    waiting is decided by the semaphore's policy (see \ref rwsem_policy_t).
 
     \author Lawrence Sebald
     \author Paul Cercueil
@@ -47,6 +42,36 @@ __BEGIN_DECLS
 #include <kos/thread.h>
 #include <kos/mutex.h>
 
+/** \brief  Who goes first on a reader/writer semaphore.
+
+    These decide who gets the semaphore when both readers and writers are
+    waiting for it. A reader that wants to upgrade its lock always goes
+    before anyone else.
+*/
+typedef enum rwsem_policy {
+    /** \brief  Readers and writers take turns.
+
+        Readers that arrive while a writer is waiting queue up behind it, and
+        when a writer is done, all of the readers waiting are let in before
+        the next writer. Neither side can starve the other. This is the
+        default.
+    */
+    RWSEM_PHASE_FAIR,
+
+    /** \brief  Writers go first.
+
+        No new reader gets in while a writer is waiting. Readers can starve.
+    */
+    RWSEM_PREFER_WRITERS,
+
+    /** \brief  Readers go first.
+
+        Readers get in whenever no writer holds the semaphore. Writers can
+        starve.
+    */
+    RWSEM_PREFER_READERS
+} rwsem_policy_t;
+
 /** \brief  Reader/writer semaphore structure.
 
     All members of this structure should be considered to be private, it is not
@@ -58,12 +83,24 @@ typedef struct rw_semaphore {
     /** \brief  The number of readers that are currently holding the lock. */
     int read_count;
 
-    mutex_t write_lock;
-    mutex_t read_lock;
+    /** \brief  The thread holding the write lock, or NULL. */
+    kthread_t *writer;
+
+    /** \brief  The reader waiting to upgrade its lock, or NULL. */
+    kthread_t *upgrader;
+
+    /** \brief  Who goes first, a \ref rwsem_policy_t. */
+    int policy;
 } rw_semaphore_t;
 
 /** \brief  Initializer for a transient reader/writer semaphore */
-#define RWSEM_INITIALIZER   { 0, MUTEX_INITIALIZER, MUTEX_INITIALIZER }
+#define RWSEM_INITIALIZER   { 0, NULL, NULL, RWSEM_PHASE_FAIR }
+
+/** \brief  Initializer for a transient reader/writer semaphore with a policy
+
+    \param  p       The \ref rwsem_policy_t to use.
+*/
+#define RWSEM_INITIALIZER_POLICY(p) { 0, NULL, NULL, (p) }
 
 /** \brief  Initialize a reader/writer semaphore.
 
@@ -73,6 +110,22 @@ typedef struct rw_semaphore {
 */
 int rwsem_init(rw_semaphore_t *s) __nonnull_all;
 
+/** \brief  Change who goes first on a reader/writer semaphore.
+
+    This should be done before the semaphore is used, but it is safe to do
+    at any time; the new policy applies from the next time the semaphore
+    changes hands.
+
+    \param  s       The r/w semaphore to change.
+    \param  policy  Who goes first.
+    \retval 0       On success.
+    \retval -1      On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     EINVAL - the policy is not valid
+*/
+int rwsem_set_policy(rw_semaphore_t *s, rwsem_policy_t policy) __nonnull_all;
+
 /** \brief  Destroy a reader/writer semaphore.
 
     This function cleans up a reader/writer semaphore. It is an error to attempt
@@ -330,6 +383,26 @@ static inline int rwsem_read_upgrade(rw_semaphore_t *s) {
 */
 int rwsem_read_tryupgrade(rw_semaphore_t *s) __nonnull_all;
 
+/** \brief  Upgrade a thread from reader status to writer status, in an
+            IRQ-safe manner.
+
+    This function will upgrade the lock on the calling thread from a reader
+    state to a writer state. If it cannot do this at the moment, it will block
+    until it is possible, unless called inside an interrupt, in which case it
+    fails right away. On error, the calling thread will still hold a read
+    lock.
+
+    \param  s       The r/w semaphore to upgrade.
+    \retval 0       On success.
+    \retval -1      On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     EWOULDBLOCK - called inside an interrupt and the upgrade would
+                          block \n
+    \em     EBUSY - another reader has already requested an upgrade
+*/
+int rwsem_read_upgrade_irqsafe(rw_semaphore_t *s) __nonnull_all;
+
 /** \brief  Read the reader count on the reader/writer semaphore.
 
     This function is not a safe way to see if the lock will be locked by any
@@ -109,6 +109,17 @@ int sem_wait_timed(semaphore_t *sm, unsigned int timeout) __nonnull_all;
 */
 __nonnull_all
 static inline int sem_wait(semaphore_t *sm) {
+    int count = __atomic_load_n(&sm->count, __ATOMIC_RELAXED);
+
+    /* Uncontended fast path: take a resource with a compare-and-swap, and
+       only go through the scheduler if none are left. */
+    if(__predict_true(count > 0 &&
+                      __atomic_compare_exchange_n(&sm->count, &count,
+                                                  count - 1, false,
+                                                  __ATOMIC_ACQUIRE,
+                                                  __ATOMIC_RELAXED)))
+        return 0;
+
     return sem_wait_timed(sm, 0);
 }
 
@@ -0,0 +1,135 @@
+/* KallistiOS ##version##
+
+   include/kos/slab.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/slab.h
+    \brief   Slab allocator for fixed-size objects.
+    \ingroup system_allocator
+
+    This file contains the slab allocator API. A slab cache hands out objects
+    of one fixed size, carved out of page-sized slabs that it gets from the
+    main heap. Allocating and freeing an object is just popping or pushing a
+    free list, the objects of one type are packed together instead of being
+    spread all over the heap, and each cache has its own lock, so small
+    allocations neither fragment the heap nor contend on the malloc() lock.
+
+    malloc() itself uses a set of general purpose caches for all requests of
+    up to \ref SLAB_MALLOC_MAX bytes, so most code gets this for free. Kernel
+    subsystems that allocate lots of objects of the same type can also create
+    their own cache with slab_cache_create(), which gives them separate
+    statistics and keeps their objects clear of everyone else's.
+*/
+
+#ifndef __KOS_SLAB_H
+#define __KOS_SLAB_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** \addtogroup system_allocator
+    @{
+*/
+
+/** \brief  Largest request that malloc() serves from its slab caches. */
+#define SLAB_MALLOC_MAX     256
+
+struct slab_cache;
+
+/** \brief  Opaque slab cache type. */
+typedef struct slab_cache slab_cache_t;
+
+/** \brief  Slab cache statistics.
+
+    \headerfile kos/slab.h
+*/
+typedef struct slab_cache_stats {
+    const char *name;       /**< \brief Name of the cache */
+    size_t obj_size;        /**< \brief Size of each object, in bytes */
+    size_t objs_per_slab;   /**< \brief Number of objects per slab */
+    size_t slabs;           /**< \brief Number of slabs currently allocated */
+    size_t inuse;           /**< \brief Number of objects currently allocated */
+    size_t peak;            /**< \brief Highest value inuse has ever reached */
+    size_t allocs;          /**< \brief Total number of allocations */
+    size_t frees;           /**< \brief Total number of frees */
+} slab_cache_stats_t;
+
+/** \brief  Create a slab cache.
+
+    \param  name            A name for the cache, shown in the statistics. The
+                            string is not copied.
+    \param  size            The size of each object, in bytes.
+    \param  align           The required alignment of each object (a power of
+                            two up to 32), or 0 for the default of 8 bytes.
+
+    \return                 The new cache, or NULL on failure.
+
+    \par    Error Conditions:
+    \em     EINVAL - size or align are out of range \n
+    \em     ENOMEM - out of memory
+*/
+slab_cache_t *slab_cache_create(const char *name, size_t size, size_t align);
+
+/** \brief  Destroy a slab cache.
+
+    All of the objects of the cache must have been freed.
+
+    \param  cache           The cache to destroy.
+
+    \retval 0               On success.
+    \retval -1              If objects are still allocated (errno set to
+                            EBUSY); the cache is left alone.
+*/
+int slab_cache_destroy(slab_cache_t *cache) __nonnull_all;
+
+/** \brief  Allocate an object from a slab cache.
+
+    This is not safe to call from an interrupt unless malloc_irq_safe() says
+    so.
+
+    \param  cache           The cache to allocate from.
+    \return                 The object, or NULL if out of memory.
+*/
+void *slab_cache_alloc(slab_cache_t *cache) __nonnull_all;
+
+/** \brief  Free an object back to its slab cache.
+
+    \param  cache           The cache the object was allocated from.
+    \param  obj             The object to free, may be NULL.
+*/
+void slab_cache_free(slab_cache_t *cache, void *obj) __nonnull((1));
+
+/** \brief  Retrieve the statistics of a slab cache.
+
+    \param  cache           The cache to look at.
+    \param  stats           Where to store the statistics.
+*/
+void slab_cache_stats(slab_cache_t *cache, slab_cache_stats_t *stats)
+    __nonnull_all;
+
+/** \brief  Print the statistics of all slab caches.
+
+    \param  pf              The printf-like function to print with.
+    \retval 0               On success.
+*/
+int slab_print_stats(int (*pf)(const char *fmt, ...));
+
+/** \cond */
+/* Hooks for malloc(). __slab_malloc() returns NULL if the request should go
+   to the main heap instead, __slab_free() and __slab_usable_size() do nothing
+   (and return false / 0) if the block isn't a slab object. */
+void *__slab_malloc(size_t size);
+bool __slab_free(void *ptr);
+size_t __slab_usable_size(const void *ptr);
+int __slab_irq_safe(void);
+/** \endcond */
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __KOS_SLAB_H */
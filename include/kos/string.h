@@ -39,13 +39,13 @@ __BEGIN_DECLS
 */
 
 /** \brief  Copy a block of memory, 4 bytes at a time.
-    \deprecated Invokes undefined behavior. Use memcpy().
+    \deprecated Use memcpy().
 
     This function is identical to memcpy(), except it copies 4 bytes at a time.
 
-    \warning
-    This function breaks C/C++ strict aliasing rules and is no longer
-    considered safe to use. It's also slow.
+    \note
+    This now just calls memcpy() with count rounded down, which on the
+    Dreamcast copies aligned words and halfwords with accesses of that size.
 
     \param  dest            The destination of the copy.
     \param  src             The source to copy.
@@ -54,7 +54,7 @@ __BEGIN_DECLS
     \return                 The original value of dest.
 */
 void *memcpy4(void *dest, const void *src, size_t count)
-    __depr("Unsafe. Use memcpy().");
+    __depr("Use memcpy().");
 
 /** \brief  Set a block of memory, 4 bytes at a time.
     \deprecated Invokes undefined behavior. Use memset().
@@ -77,13 +77,13 @@ void *memset4(void *s, unsigned long c, size_t count)
     __depr("Unsafe. Use memset().");
 
 /** \brief  Copy a block of memory, 2 bytes at a time.
-    \deprecated Invokes undefined behavior. Use memcpy().
+    \deprecated Use memcpy().
 
     This function is identical to memcpy(), except it copies 2 bytes at a time.
 
-    \warning
-    This function breaks C/C++ strict aliasing rules and is no longer
-    considered safe to use. It's also slow.
+    \note
+    This now just calls memcpy() with count rounded down, which on the
+    Dreamcast copies aligned words and halfwords with accesses of that size.
 
     \param  dest            The destination of the copy.
     \param  src             The source to copy.
@@ -92,7 +92,7 @@ void *memset4(void *s, unsigned long c, size_t count)
     \return                 The original value of dest.
 */
 void *memcpy2(void * dest, const void *src, size_t count)
-    __depr("Unsafe. Use memcpy().");
+    __depr("Use memcpy().");
 
 /** \brief Set a block of memory, 2 bytes at a time.
     \deprecated Invokes undefined behavior.
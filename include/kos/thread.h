@@ -40,11 +40,13 @@ __BEGIN_DECLS
 
 #include <kos/cdefs.h>
 #include <kos/tls.h>
+#include <kos/hrtimer.h>
 #include <arch/irq.h>
 #include <arch/types.h>
 
 #include <sys/queue.h>
 #include <sys/reent.h>
+#include <sys/types.h>
 
 #include <stdint.h>
 #include <stdbool.h>
@@ -98,6 +100,16 @@ __BEGIN_DECLS
 */
 #define PRIO_DEFAULT 10
 
+/** \brief   Number of scheduler run queues
+
+    Every priority lower than this value minus one gets its own run queue,
+    tracked by a bitmap so the scheduler can pick the next thread in constant
+    time. All lower priorities (including \ref PRIO_MAX, used by the idle
+    thread) share the last queue, which is kept sorted. Must be a multiple of
+    32, and no larger than 1024.
+*/
+#define THD_RUNQ_COUNT  256
+
 /** \brief   Size of a kthread's label
 
     Maximum number of characters in a thread's label or name
@@ -134,10 +146,79 @@ LIST_HEAD(ktlist, kthread);
 #define THD_DETACHED    0x4  /**< \brief Thread is detached */
 #define THD_OWNS_STACK  0x8  /**< \brief Thread manages stack lifetime */
 #define THD_DISABLE_TLS 0x10 /**< \brief Thread does not use TLS variables */
+#define THD_LAZY_STACK  0x20 /**< \brief Stack is committed on demand */
+#define THD_WAIT_RETRY  0x40 /**< \brief Waits to retry a faulting access */
+#define THD_FPU         0x80 /**< \brief Thread uses the FPU (set on first use) */
+#define THD_STACK_PAINT 0x100 /**< \brief Stack was painted when created */
 /** @} */
 
 /** \brief Kernel thread flags type */
-typedef uint8_t kthread_flags_t;
+typedef uint16_t kthread_flags_t;
+
+/** \brief   Number of buckets in the scheduling histograms
+
+    Bucket 0 counts events shorter than 2 time units, and each bucket n after
+    that counts events lasting [2^n, 2^(n + 1)) units, where a unit is 1024ns
+    (roughly a microsecond). The last bucket also counts anything longer.
+*/
+#define THD_SCHED_HIST_BUCKETS  16
+
+/** \brief   Per-thread scheduling statistics
+
+    These are gathered by the scheduler for every thread, and can be fetched
+    with thd_get_sched_stats().
+
+    \headerfile kos/thread.h
+*/
+typedef struct kthread_sched_stats {
+    /** \brief  Histogram of wakeup to run latencies.
+
+        Counts how long the thread sat in the run queue after being made
+        runnable (by a genwait wakeup, a sync primitive, or being created)
+        until it actually got the CPU. Time spent in the run queue after being
+        preempted isn't counted.
+    */
+    uint32_t latency[THD_SCHED_HIST_BUCKETS];
+
+    /** \brief  Histogram of run slice lengths.
+
+        Counts how long the thread ran each time it was scheduled, until it
+        blocked, yielded or got preempted by another thread.
+    */
+    uint32_t runtime[THD_SCHED_HIST_BUCKETS];
+
+    /** \brief  Worst wakeup to run latency seen, in nanoseconds. */
+    uint64_t latency_max;
+
+    /** \brief  Longest run slice seen, in nanoseconds. */
+    uint64_t runtime_max;
+
+    /** \cond */
+    /* When the thread was last made runnable (0 if not waiting to run). */
+    uint64_t ready_time;
+
+    /* When the current run slice started. */
+    uint64_t slice_start;
+    /** \endcond */
+} kthread_sched_stats_t;
+
+/** \brief   Real-time scheduling parameters
+
+    A thread with these set (see thd_set_rt()) is in the real-time class:
+    every \p period milliseconds it is given \p budget milliseconds of CPU
+    time, which should be used up within \p deadline milliseconds of the start
+    of the period. As an example, an audio mixer that has to produce a buffer
+    every 10ms and needs about 2ms to do so would ask for a period of 10 and a
+    budget of 2.
+
+    \headerfile kos/thread.h
+*/
+typedef struct kthread_rt_params {
+    uint32_t period;    /**< \brief Length of a period, in milliseconds */
+    uint32_t budget;    /**< \brief CPU time per period, in milliseconds */
+    uint32_t deadline;  /**< \brief Deadline within the period, in
+                                    milliseconds (0 for the whole period) */
+} kthread_rt_params_t;
 
 /** \brief Kernel thread state
 
@@ -171,8 +252,8 @@ typedef __attribute__((aligned(32))) struct kthread {
     /** \brief  Run/Wait queue handle. Once again, not a function. */
     TAILQ_ENTRY(kthread) thdq;
 
-    /** \brief  Timer queue handle (if applicable). Also not a function. */
-    TAILQ_ENTRY(kthread) timerq;
+    /** \brief  Timer wheel handle (if applicable). Also not a function. */
+    LIST_ENTRY(kthread) timerq;
 
     /** \brief  Kernel thread id. */
     tid_t tid;
@@ -183,9 +264,24 @@ typedef __attribute__((aligned(32))) struct kthread {
     /** \brief  Static priority: 0..PRIO_MAX (higher means lower priority). */
     prio_t real_prio;
 
+    /** \brief  Priority inheritance mutex this thread is blocked on, if any. */
+    struct kos_mutex *pi_wait;
+
+    /** \brief  Number of priority inheritance mutexes held. */
+    unsigned int pi_count;
+
     /** \brief  Thread flags. */
     kthread_flags_t flags;
 
+    /** \brief  Index of the run queue this thread is on (if THD_QUEUED). */
+    uint16_t runq;
+
+    /** \brief  Memory tag of the thread's allocations.
+
+        \see    kos/mem_tags.h
+    */
+    uint8_t mem_tag;
+
     /** \brief  Process state */
     kthread_state_t state;
 
@@ -218,12 +314,38 @@ typedef __attribute__((aligned(32))) struct kthread {
     */
     uint64_t wait_timeout;
 
+    /** \brief  High-resolution wait timeout.
+
+        Used instead of wait_timeout for timeouts shorter than a scheduler
+        tick. \see genwait_wait_ns()
+    */
+    hrtimer_t wait_hrtimer;
+
     /** \brief Per-Thread CPU Time. */
     struct {
         uint64_t scheduled; /**< \brief time when the thread became active */
         uint64_t total;     /**< \brief total running CPU time for thread */
     } cpu_time;
 
+    /** \brief Per-Thread scheduling statistics. */
+    kthread_sched_stats_t sched_stats;
+
+    /** \brief Real-time scheduling class state.
+
+        Only used if rt.params.period is non-zero. \see thd_set_rt()
+    */
+    struct {
+        kthread_rt_params_t params; /**< \brief As given to thd_set_rt() */
+        uint32_t overruns;  /**< \brief Periods the budget ran out in */
+
+        /** \cond */
+        uint64_t release;   /* Start of the current period (ns) */
+        uint64_t deadline;  /* Deadline of the current period (ns) */
+        uint64_t left;      /* Budget left in the current period (ns) */
+        uint64_t charged;   /* Run time charged to the budget up to (ns) */
+        /** \endcond */
+    } rt;
+
     /** \brief  Thread label.
 
         This value is used when printing out a user-readable process listing.
@@ -254,9 +376,21 @@ typedef __attribute__((aligned(32))) struct kthread {
     */
     struct kthread_tls_kv_list tls_list;
 
+    /** \brief  Values of the first TLS keys, indexed by key - 1.
+
+        \see    KTHREAD_TLS_FAST_KEYS
+    */
+    void *tls_fast[KTHREAD_TLS_FAST_KEYS];
+
     /** \brief Compiler-level thread-local storage. */
     void *tls_hnd;
 
+    /** \brief  Fibers hosted by this thread, if any.
+
+        \see    kos/fiber.h
+    */
+    struct fiber_host *fibers;
+
     /** \brief  Return value of the thread function.
 
         This is only used in joinable threads.
@@ -295,6 +429,20 @@ typedef struct kthread_attr {
 
     /** \brief 1 if the thread doesn't use thread_local variables. */
     bool disable_tls;
+
+    /** \brief  1 to only back the stack with RAM as it grows.
+        \note   On Dreamcast, this needs mmu_stack_init(), and a normal stack
+                is allocated when it wasn't called. The stack lives at a
+                virtual address, so it must not be used for DMA buffers. */
+    bool lazy_stack;
+
+    /** \brief  1 to fill the stack with a known pattern when creating the
+                thread, so that thd_get_stack_usage() can tell how much of it
+                was used. This is always done if THD_STACK_PAINT_ALL is
+                defined (see kos/opts.h).
+        \note   Lazy stacks are never painted, as that would commit all of
+                them. Their usage is what has been committed. */
+    bool paint_stack;
 } kthread_attr_t;
 
 /** \brief  kthread mode values
@@ -361,6 +509,10 @@ kthread_t *thd_by_tid(tid_t tid);
     the same priority if front_of_line is zero, otherwise queues it at the front
     of its priority group. Generally, you will not have to do this manually.
 
+    Each priority below \ref THD_RUNQ_COUNT - 1 has its own queue, so this is a
+    constant time operation for all of those. Threads with a priority at or
+    above that value share a single sorted overflow queue.
+
     \param  t               The thread to queue.
     \param  front_of_line   Set to true to put this thread in front of other
                             threads of the same priority, false to put it
@@ -503,6 +655,21 @@ void thd_pass(void);
 */
 void thd_sleep(unsigned ms);
 
+/** \brief   Sleep for a given number of nanoseconds.
+
+    This function puts the current thread to sleep for the specified amount of
+    time. Sleeps shorter than a scheduler tick are timed with a
+    high-resolution timer, so they aren't rounded up to the next tick (see
+    genwait_wait_ns()).
+
+    When \p ns is given a value of `0`, this is equivalent to thd_pass().
+
+    \param  ns              The number of nanoseconds to sleep.
+
+    \sa thd_sleep()
+*/
+void thd_sleep_ns(uint64_t ns);
+
 /** \brief       Set a thread's priority value.
     \relatesalso kthread_t
 
@@ -653,6 +820,124 @@ uint64_t thd_get_cpu_time(kthread_t *thd);
 */
 uint64_t thd_get_total_cpu_time(void);
 
+/** \brief       Retrieves the thread's stack high-water mark
+    \relatesalso kthread_t
+
+    Returns how much of its stack the thread has used at most so far. This
+    works by finding how much of the pattern stack painting left at the bottom
+    of the stack is still intact, so it needs the thread to have been created
+    with the \p paint_stack attribute (or THD_STACK_PAINT_ALL). For a lazy
+    stack, it is how much of the stack has been committed instead.
+
+    This scans the stack, so it takes a little while on a big one.
+
+    \param  thd             The thread to look at, or NULL for the current
+                            thread.
+
+    \return                 The most the stack has been used, in bytes, or -1
+                            (setting errno to EINVAL) if the stack wasn't
+                            painted.
+
+    \sa thd_pslist
+*/
+ssize_t thd_get_stack_usage(const kthread_t *thd);
+
+/** \brief       Retrieves the thread's scheduling statistics
+    \relatesalso kthread_t
+
+    Copies out the wakeup latency and run slice histograms gathered by the
+    scheduler for the given thread.
+
+    \param  thd             The thread to retrieve from, or NULL for the
+                            current thread.
+    \param  stats           Where to store the statistics.
+
+    \retval 0               On success.
+    \retval -1              If stats is NULL.
+
+    \sa thd_reset_sched_stats, thd_pslist_sched
+*/
+int thd_get_sched_stats(const kthread_t *thd, kthread_sched_stats_t *stats);
+
+/** \brief       Resets the thread's scheduling statistics
+    \relatesalso kthread_t
+
+    \param  thd             The thread to reset, or NULL for all threads.
+
+    \sa thd_get_sched_stats
+*/
+void thd_reset_sched_stats(kthread_t *thd);
+
+/** \brief   Most CPU time that real-time threads can reserve
+
+    thd_set_rt() turns away a thread whose budget would take the total share
+    of CPU time reserved by real-time threads over this percentage, so that
+    normal threads (and the rest of the system) can't be starved completely.
+*/
+#define THD_RT_MAX_UTIL 90
+
+/** \brief       Put a thread in the real-time scheduling class.
+    \relatesalso kthread_t
+
+    Real-time threads are scheduled earliest deadline first, ahead of every
+    normal thread regardless of priority. A real-time thread that uses up its
+    budget for the current period is throttled until its next period starts,
+    at which point its budget is refilled. The thread's priority still applies
+    to priority inheritance, but not to picking which thread runs next.
+
+    Since each thread is limited to its budget, they can't get in each other's
+    way: as long as the total share of CPU time reserved stays under 100%,
+    every real-time thread gets all of its budget before its deadline. That
+    total is kept under \ref THD_RT_MAX_UTIL.
+
+    Budgets are enforced with the primary timer, so at millisecond resolution;
+    a thread can overrun its budget by up to a millisecond (or longer if it
+    disables interrupts).
+
+    \param  thd             The thread to change, or NULL for the current
+                            thread.
+    \param  params          The real-time parameters, or NULL to put the
+                            thread back in the normal class.
+
+    \retval 0               On success.
+    \retval -1              On error, errno will be set as appropriate.
+
+    \par    Error Conditions:
+    \em     EINVAL - the period or budget is zero, or the budget is larger
+                     than the deadline or the deadline than the period \n
+    \em     EBUSY - the reservation would go over \ref THD_RT_MAX_UTIL
+
+    \sa thd_get_rt(), thd_rt_wait_period()
+*/
+int thd_set_rt(kthread_t *thd, const kthread_rt_params_t *params);
+
+/** \brief       Retrieve a thread's real-time parameters.
+    \relatesalso kthread_t
+
+    \param  thd             The thread to retrieve from, or NULL for the
+                            current thread.
+    \param  params          Where to store the parameters. These are all zero
+                            for a thread in the normal class.
+
+    \retval 1               If the thread is in the real-time class.
+    \retval 0               If the thread is in the normal class.
+    \retval -1              If params is NULL.
+
+    \sa thd_set_rt()
+*/
+int thd_get_rt(const kthread_t *thd, kthread_rt_params_t *params);
+
+/** \brief   Wait for the next period of a real-time thread.
+
+    A real-time thread calls this when it is done with its work for the
+    current period, giving up the rest of its budget. It then sleeps until its
+    next period starts, or returns right away if that has already happened.
+    For a normal thread, this is the same as thd_pass().
+
+    \sa thd_set_rt()
+*/
+void thd_rt_wait_period(void);
+
 /** \brief   Change threading modes.
 
     This function changes the current threading mode of the system.
@@ -705,6 +990,40 @@ int thd_set_hz(unsigned int hertz);
 */
 unsigned thd_get_hz(void);
 
+/** \brief   Longest tickless idle period
+
+    When tickless idle is enabled and nothing has a pending timeout, the
+    scheduler will still wake up at least this often (in milliseconds).
+*/
+#define THD_TICKLESS_MAX_MS 1000
+
+/** \brief   Enable or disable tickless idle.
+
+    When tickless idle is enabled, the scheduler stops ticking at its regular
+    frequency whenever every thread is blocked. Instead, the primary timer is
+    programmed to fire at the next genwait timeout (which covers thd_sleep(),
+    timed waits on sync primitives and one-shot timers), or after
+    \ref THD_TICKLESS_MAX_MS if nothing is pending. As soon as a thread is
+    made runnable again (typically from an interrupt handler), a scheduler tick
+    is requested and the regular frequency resumes.
+
+    This cuts timer interrupt overhead during mostly-idle phases, and makes a
+    high value for thd_set_hz() much cheaper. It is disabled by default.
+
+    \param  enable          True to enable tickless idle, false to disable.
+
+    \sa thd_get_tickless(), thd_set_hz()
+*/
+void thd_set_tickless(bool enable);
+
+/** \brief   Query whether tickless idle is enabled.
+
+    \return                 True if tickless idle is enabled.
+
+    \sa thd_set_tickless()
+*/
+bool thd_get_tickless(void);
+
 /** \brief       Wait for a thread to exit.
     \relatesalso kthread_t
 
@@ -756,7 +1075,8 @@ int thd_each(int (*cb)(kthread_t *thd, void *user_data), void *data);
 
     Each thread is printed with its address, tid, priority level, flags,
     it's wait timeout (if sleeping) the amount of cpu time usage in ns
-    (this includes time in IRQs), state, and name.
+    (this includes time in IRQs), state, stack usage (see
+    thd_get_stack_usage()) and size, and name.
 
     In addition a '[system]' item is provided that represents time since
     initialization not spent in a thread (context switching, updating
@@ -780,6 +1100,19 @@ int thd_pslist(int (*pf)(const char *fmt, ...));
 */
 int thd_pslist_queue(int (*pf)(const char *fmt, ...));
 
+/** \brief   Print the scheduling statistics of all threads.
+
+    For each thread, this prints its wakeup latency and run slice histograms
+    (see \ref kthread_sched_stats_t) along with the worst cases seen.
+
+    \param  pf              The printf-like function to print with.
+
+    \retval 0               On success.
+
+    \sa thd_pslist, thd_get_sched_stats
+*/
+int thd_pslist_sched(int (*pf)(const char *fmt, ...));
+
 /** \cond INTERNAL */
 
 /** \brief  Initialize the threading system.
@@ -0,0 +1,189 @@
+/* KallistiOS ##version##
+
+   include/kos/thread_pool.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/thread_pool.h
+    \brief   Thread pools.
+    \ingroup kthreads
+
+    This file contains the thread pool API. A thread pool is a fixed set of
+    worker threads (see kos/worker_thread.h) that cooperatively process
+    submitted tasks.
+
+    Each worker has its own queue of tasks, sorted by task priority. A worker
+    always picks the most urgent task from its own queue first; if that queue
+    is empty, it steals the least urgent task from another worker's queue
+    before going to sleep. Tasks submitted from within a pool worker go to
+    that worker's own queue, while tasks submitted from elsewhere are spread
+    across the workers.
+
+    The Dreamcast only has one CPU core of course, so this won't make compute
+    bound code any faster. It is however useful for overlapping work that
+    spends most of its time blocked on I/O (CD reads, G1 ATA DMA, SD card
+    transfers, etc) with computation, without every subsystem having to spawn
+    its own threads.
+
+    \see    kos/worker_thread.h
+*/
+
+#ifndef __KOS_THREAD_POOL_H
+#define __KOS_THREAD_POOL_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <kos/thread.h>
+#include <sys/queue.h>
+#include <stddef.h>
+
+struct kthread_pool;
+
+/** \struct  kthread_pool_t
+    \brief   Opaque structure describing a thread pool.
+*/
+typedef struct kthread_pool kthread_pool_t;
+
+/** \brief   Group of tasks that can be waited on together.
+
+    Every task submitted with a group increments its pending count, which gets
+    decremented when the task completes. This is what's used to implement
+    fork/join: submit a batch of tasks with the same group, then wait for the
+    group with thd_pool_group_wait().
+
+    Initialize with \ref KTHREAD_POOL_GROUP_INITIALIZER, or zero it out.
+
+    \headerfile kos/thread_pool.h
+*/
+typedef struct kthread_pool_group {
+    /** \brief  Number of submitted tasks not yet completed. */
+    volatile unsigned int pending;
+} kthread_pool_group_t;
+
+/** \brief  Initializer for a task group. */
+#define KTHREAD_POOL_GROUP_INITIALIZER  { 0 }
+
+/** \brief   Structure describing one task for a thread pool.
+
+    The task must stay valid until it has completed.
+
+    \headerfile kos/thread_pool.h
+*/
+typedef struct kthread_task {
+    /** \brief  Queue handle. */
+    TAILQ_ENTRY(kthread_task) entry;
+
+    /** \brief  Function to call to run the task. */
+    void (*routine)(void *data);
+
+    /** \brief  User pointer passed to the routine. */
+    void *data;
+
+    /** \brief  Priority of the task (lower values are more urgent). */
+    prio_t prio;
+
+    /** \brief  Group the task belongs to (may be NULL). */
+    kthread_pool_group_t *group;
+} kthread_task_t;
+
+/** \brief       Create a new thread pool.
+    \relatesalso kthread_pool_t
+
+    This function creates a thread pool with the given number of workers.
+
+    \param  nworkers        The number of worker threads (at least 1).
+    \param  attr            A set of thread attributes for the worker threads.
+                            Passing NULL will initialize all attributes to their
+                            default values. The stack_ptr attribute must not be
+                            set.
+
+    \return                 The new thread pool on success, NULL on failure.
+
+    \sa thd_pool_destroy
+*/
+kthread_pool_t *thd_pool_create(unsigned int nworkers,
+                                const kthread_attr_t *attr);
+
+/** \brief       Stop and destroy a thread pool.
+    \relatesalso kthread_pool_t
+
+    This function stops all of the worker threads, letting them finish their
+    current task, and frees the pool. Tasks that are still queued are not run,
+    so wait on the relevant groups first if that matters.
+
+    \param  pool            The thread pool to destroy.
+*/
+void thd_pool_destroy(kthread_pool_t *pool);
+
+/** \brief       Initialize a task.
+    \relatesalso kthread_task_t
+
+    \param  task            The task to initialize.
+    \param  routine         The function to call to run the task.
+    \param  data            A parameter to pass to the function called.
+    \param  prio            The priority of the task, where lower values are
+                            more urgent (same as thread priorities).
+*/
+static inline void thd_pool_task_init(kthread_task_t *task,
+                                      void (*routine)(void *), void *data,
+                                      prio_t prio) {
+    task->routine = routine;
+    task->data = data;
+    task->prio = prio;
+    task->group = NULL;
+}
+
+/** \brief       Submit a task to a thread pool.
+    \relatesalso kthread_pool_t
+
+    This function queues a task in the pool and wakes up a worker to run it.
+    This function is safe to call from an interrupt handler.
+
+    \param  pool            The thread pool to submit to.
+    \param  task            The task to run.
+    \param  group           The group to add the task to, or NULL.
+*/
+void thd_pool_submit(kthread_pool_t *pool, kthread_task_t *task,
+                     kthread_pool_group_t *group);
+
+/** \brief       Wait for all the tasks in a group to complete.
+    \relatesalso kthread_pool_t
+
+    This function blocks until the pending count of the group drops to zero.
+    While waiting, the calling thread runs queued tasks of the pool itself, so
+    it is safe (and efficient) to call this from within a task to join on
+    tasks that it forked.
+
+    \param  pool            The thread pool the tasks were submitted to.
+    \param  group           The group to wait on.
+*/
+void thd_pool_group_wait(kthread_pool_t *pool, kthread_pool_group_t *group);
+
+/** \brief       Run a loop in parallel on a thread pool.
+    \relatesalso kthread_pool_t
+
+    This function splits the range [begin, end) into chunks of at most grain
+    iterations, runs routine on each chunk from the pool, and waits for all of
+    them to complete (helping out in the meantime).
+
+    \param  pool            The thread pool to run the chunks on.
+    \param  begin           The first index of the range.
+    \param  end             One past the last index of the range.
+    \param  grain           The maximum number of indices per chunk. Passing 0
+                            will split the range evenly over the workers.
+    \param  routine         The function to call for each chunk, with the
+                            chunk's first and one-past-last indices.
+    \param  data            A parameter to pass to the function called.
+
+    \retval 0               On success.
+    \retval -1              If out of memory (nothing was run).
+*/
+int thd_pool_parallel_for(kthread_pool_t *pool, size_t begin, size_t end,
+                          size_t grain,
+                          void (*routine)(size_t begin, size_t end, void *data),
+                          void *data);
+
+__END_DECLS
+
+#endif /* __KOS_THREAD_POOL_H */
@@ -27,6 +27,14 @@ __BEGIN_DECLS
 /** \brief  Thread-local storage key type. */
 typedef int kthread_key_t;
 
+/** \brief  Number of keys stored directly in each thread.
+
+    The values of the first keys handed out by kthread_key_create() are kept
+    in an array in the thread, so that getting and setting them costs no more
+    than an index. Any keys beyond that go in a list that has to be searched.
+*/
+#define KTHREAD_TLS_FAST_KEYS   8
+
 /** \brief  Thread-local storage key-value pair.
 
     This is the structure that is actually used to store the specific value for
@@ -122,6 +130,14 @@ int kthread_key_delete(kthread_key_t key);
    only! */
 void kthread_key_delete_destructor(kthread_key_t key);
 
+/* Get the destructor for a given key, or NULL if it has none. Internal use
+   only, too. */
+void (*kthread_key_get_destructor(kthread_key_t key))(void *);
+
+/* Is the key one of those stored in the thread's array? */
+#define __KTHREAD_TLS_FAST(key) \
+    ((unsigned int)(key) - 1 < KTHREAD_TLS_FAST_KEYS)
+
 /* Initialization and shutdown. Once again, internal use only. */
 int kthread_tls_init(void);
 void kthread_tls_shutdown(void);
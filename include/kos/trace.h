@@ -0,0 +1,174 @@
+/* KallistiOS ##version##
+
+   kos/trace.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    kos/trace.h
+    \brief   Kernel event tracer.
+    \ingroup trace
+
+    This file contains a tracer that records what the kernel was doing, and
+    when, for viewing as a timeline.
+*/
+
+#ifndef __KOS_TRACE_H
+#define __KOS_TRACE_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <kos/opts.h>
+
+/** \defgroup trace Event tracer
+    \brief          Timeline of context switches, interrupts and hardware work
+    \ingroup        debugging
+
+    Counters tell how much time went where; they don't tell in which order,
+    which is what working out why a frame took 20 ms needs. When KOS is built
+    with KOS_TRACE defined (see kos/opts.h), the kernel marks context
+    switches, interrupts, genwait sleeps and wake-ups, PVR list and render
+    boundaries, DMA transfers and Maple and GD-ROM commands. Once
+    trace_start() has been called, each of those is written to a ring buffer
+    along with the time, from perf_cntr_timer_ns(), and the thread it
+    happened in. When the buffer fills up, the oldest events are overwritten.
+
+    trace_write() turns the buffer into Chrome's trace event JSON, which
+    chrome://tracing and ui.perfetto.dev both open. Write it to a file under
+    /pc to get it back through dcload, or to a socket with fdopen() to send it
+    over the network.
+
+    Without KOS_TRACE, the hooks compile to nothing and trace_start() fails.
+
+    @{
+*/
+
+/** \brief   Kinds of trace events. */
+typedef enum trace_type {
+    TRACE_THD_SWITCH,       /**< \brief Switch threads, arg is the new tid */
+    TRACE_IRQ_ENTER,        /**< \brief Enter an interrupt, arg is the event */
+    TRACE_IRQ_EXIT,         /**< \brief Leave an interrupt, arg is the event */
+    TRACE_GENWAIT_SLEEP,    /**< \brief Go to sleep, arg is the object */
+    TRACE_GENWAIT_WAKE,     /**< \brief Wake a thread, arg is the object */
+    TRACE_PVR_LIST_BEGIN,   /**< \brief Open a list, arg is the list */
+    TRACE_PVR_LIST_FINISH,  /**< \brief Close a list, arg is the list */
+    TRACE_PVR_RENDER_START, /**< \brief Start a render */
+    TRACE_PVR_RENDER_DONE,  /**< \brief Render is done */
+    TRACE_DMA_START,        /**< \brief Start a DMA, arg is the channel */
+    TRACE_DMA_DONE,         /**< \brief DMA is done, arg is the channel */
+    TRACE_MAPLE_START,      /**< \brief Send a batch of Maple frames */
+    TRACE_MAPLE_DONE,       /**< \brief The replies are in */
+    TRACE_CDROM_BEGIN,      /**< \brief Start a command, arg is the command */
+    TRACE_CDROM_END,        /**< \brief Command is done, arg is the command */
+    TRACE_MARK_BEGIN,       /**< \brief trace_mark_begin(), arg is the name */
+    TRACE_MARK_END,         /**< \brief trace_mark_end() */
+    TRACE_TYPE_COUNT        /**< \brief Number of kinds of events */
+} trace_type_t;
+
+/** \cond */
+#define __TRACE_TID_CURRENT     0xffff
+
+extern volatile int __trace_on;
+
+void __trace_record(trace_type_t type, unsigned int tid, uint32_t arg);
+
+#ifdef KOS_TRACE
+static inline void __trace_event(trace_type_t type, unsigned int tid,
+                                 uint32_t arg) {
+    if(__predict_false(__trace_on))
+        __trace_record(type, tid, arg);
+}
+#else
+static inline void __trace_event(trace_type_t type, unsigned int tid,
+                                 uint32_t arg) {
+    (void)type;
+    (void)tid;
+    (void)arg;
+}
+#endif
+/** \endcond */
+
+/** \brief   Record an event in the current thread.
+
+    \param  type            The kind of event.
+    \param  arg             What it is about, as documented for type.
+*/
+#define trace_event(type, arg) \
+    __trace_event((type), __TRACE_TID_CURRENT, (uint32_t)(arg))
+
+/** \brief   Record an event in another thread.
+
+    \param  type            The kind of event.
+    \param  tid             The thread it belongs to.
+    \param  arg             What it is about, as documented for type.
+*/
+#define trace_event_thd(type, tid, arg) \
+    __trace_event((type), (unsigned int)(tid), (uint32_t)(arg))
+
+/** \brief   Mark the start of a span of the current thread's work.
+
+    \param  name            What to call it. Only the pointer is kept, so it
+                            must be a string literal or otherwise live for as
+                            long as the trace does.
+*/
+#define trace_mark_begin(name) trace_event(TRACE_MARK_BEGIN, (uintptr_t)(name))
+
+/** \brief   Mark the end of the span opened last by trace_mark_begin(). */
+#define trace_mark_end() trace_event(TRACE_MARK_END, 0)
+
+/** \brief   Start recording.
+
+    Any earlier trace is thrown away.
+
+    \param  entries         How many events the buffer holds, or 0 for 16384.
+                            Each takes 16 bytes.
+    \retval 0               On success.
+    \retval -1              On error, setting errno as appropriate.
+
+    \par    Error Conditions:
+    \em     ENOSYS - KOS was built without KOS_TRACE \n
+    \em     EALREADY - the tracer is running already \n
+    \em     ENOMEM - the buffer could not be allocated
+*/
+int trace_start(size_t entries);
+
+/** \brief   Stop recording.
+
+    The trace is kept for trace_write().
+*/
+void trace_stop(void);
+
+/** \brief   Get the number of events in the buffer.
+
+    \param  lost            If not NULL, set to the number of older events
+                            that were overwritten.
+    \return                 The number of events that will be written out.
+*/
+size_t trace_count(size_t *lost);
+
+/** \brief   Write the trace out as Chrome trace event JSON.
+
+    Recording is paused while this runs.
+
+    \param  f               Where to write it.
+    \retval 0               On success.
+    \retval -1              If there is no trace, with errno set to ENOENT.
+*/
+int trace_write(FILE *f);
+
+/** \brief   Write the trace out to a file as Chrome trace event JSON.
+
+    \param  path            The file to write, for instance "/pc/trace.json".
+    \retval 0               On success.
+    \retval -1              On error, setting errno as appropriate.
+*/
+int trace_dump(const char *path);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __KOS_TRACE_H */
@@ -160,6 +160,47 @@ void freeaddrinfo(struct addrinfo *ai);
 int getaddrinfo(const char *nodename, const char *servname,
                 const struct addrinfo *hints, struct addrinfo **res);
 
+/** \brief   Callback of getaddrinfo_async().
+    \ingroup network_db
+
+    \param  rv              What getaddrinfo() returned.
+    \param  res             The resulting address information, which the
+                            callback must free with freeaddrinfo().
+    \param  data            The data passed to getaddrinfo_async().
+*/
+typedef void (*getaddrinfo_cb_t)(int rv, struct addrinfo *res, void *data);
+
+/** \brief   Get information about a specified address, in the background.
+    \ingroup network_db
+
+    This function does the same as getaddrinfo(), but in a thread of its own,
+    and returns right away. The callback is called from that thread once the
+    lookup is done. Many lookups can be in progress at once. This is a KOS
+    extension.
+
+    \param  nodename        The host to look up.
+    \param  servname        The service to look up.
+    \param  hints           Hints used in aiding lookup.
+    \param  cb              The function to call with the result.
+    \param  data            Data to pass to the callback.
+    \retval 0               If the lookup was started.
+    \retval -1              On failure, with errno set to EINVAL if there is
+                            no callback, or ENOMEM.
+*/
+int getaddrinfo_async(const char *nodename, const char *servname,
+                      const struct addrinfo *hints, getaddrinfo_cb_t cb,
+                      void *data);
+
+/** \brief   Forget the DNS answers getaddrinfo() has cached.
+    \ingroup network_db
+
+    Answers are cached for as long as their TTL allows, up to a day, and names
+    that don't exist for 30 seconds. Answers from another DNS server than the
+    current one are never used, but use this if the addresses of a name are
+    known to have changed. This is a KOS extension.
+*/
+void getaddrinfo_flush(void);
+
 /** \brief   Look up a host by its name.
     \ingroup network_db
 
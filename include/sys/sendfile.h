@@ -0,0 +1,52 @@
+/* KallistiOS ##version##
+
+   sys/sendfile.h
+   Copyright (C) 2026 KallistiOS Contributors
+
+*/
+
+/** \file    sys/sendfile.h
+    \brief   Sending files over sockets.
+    \ingroup networking_sockets
+
+    This file contains the sendfile() function, which is not in any standard,
+    but which works like the one in Linux does.
+*/
+
+#ifndef __SYS_SENDFILE_H
+#define __SYS_SENDFILE_H
+
+#include <sys/cdefs.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+/** \brief   Send data from a file on a socket.
+    \ingroup networking_sockets
+
+    This function sends data from a file on a socket, without it having to go
+    through a buffer of the caller. Files that can be memory mapped with
+    fs_mmap() (like those of the romdisk and ramdisk) are given to the socket
+    straight from memory, which for TCP means that the only copy made is into
+    its send buffer. Other files are read into a buffer of 16KB at a time.
+
+    On a blocking socket, this only returns once everything has been sent (or
+    on error). On a non-blocking one, as much as can be sent right away is.
+
+    \param  out_fd          The socket to send the data on.
+    \param  in_fd           The file to send data from.
+    \param  offset          Where to start in the file, updated to just past
+                            what was sent, in which case the position of the
+                            file isn't changed. If NULL, the data is taken from
+                            the position of the file, which is moved along.
+    \param  count           The number of bytes to send.
+    \return                 The number of bytes sent, or -1 on failure (with
+                            errno set to EBADF for a bad descriptor, ENOTSOCK
+                            if out_fd isn't a socket, ENOMEM, or as the socket
+                            or the file set it).
+*/
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+
+__END_DECLS
+
+#endif /* !__SYS_SENDFILE_H */
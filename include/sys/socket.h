@@ -27,6 +27,8 @@
 
 __BEGIN_DECLS
 
+struct timespec;
+
 /** \defgroup networking_sockets    Sockets
     \brief                          POSIX Sockets Interface for IPv4 and IPv6
                                     Address Families
@@ -87,6 +89,27 @@ struct sockaddr_storage {
     char _ss_pad2[_SS_PAD2SIZE];
 };
 
+/** \brief  Message header structure, for scatter/gather socket I/O.
+    \headerfile sys/socket.h
+*/
+struct msghdr {
+    void *msg_name;             /**< \brief Optional address */
+    socklen_t msg_namelen;      /**< \brief Size of address */
+    struct iovec *msg_iov;      /**< \brief Scatter/gather array */
+    int msg_iovlen;             /**< \brief Members in msg_iov */
+    void *msg_control;          /**< \brief Ancillary data (unsupported) */
+    socklen_t msg_controllen;   /**< \brief Ancillary data length */
+    int msg_flags;              /**< \brief Flags on received message */
+};
+
+/** \brief  Message header of recvmmsg() and sendmmsg() (non-standard).
+    \headerfile sys/socket.h
+*/
+struct mmsghdr {
+    struct msghdr msg_hdr;      /**< \brief The message */
+    unsigned int msg_len;       /**< \brief Bytes received or sent */
+};
+
 /** \brief  Datagram socket type.
 
     This socket type specifies that the socket in question transmits datagrams
@@ -171,6 +194,7 @@ struct sockaddr_storage {
 #define MSG_TRUNC       0x20    /**< \brief Normal data truncated (U) */
 #define MSG_WAITALL     0x40    /**< \brief Attempt to fill read buffer */
 #define MSG_DONTWAIT    0x80    /**< \brief Make this call non-blocking (non-standard) */
+#define MSG_WAITFORONE  0x100   /**< \brief Only block for the first message of recvmmsg() (non-standard) */
 /** @} */
 
 /** \addtogroup networking_sockets
@@ -339,6 +363,56 @@ ssize_t send(int socket, const void *message, size_t length, int flags);
 ssize_t sendto(int socket, const void *message, size_t length, int flags,
                const struct sockaddr *dest_addr, socklen_t dest_len);
 
+/** \brief  Receive several messages on a socket.
+
+    This function receives up to vlen messages on a socket at once, which saves
+    the per-call overhead of recvfrom() when many small datagrams are waiting.
+    Each message is scattered into the buffers of its msg_iov, its length is
+    stored in msg_len, and MSG_TRUNC is set in its msg_flags if it didn't fit.
+    msg_name, if not NULL, receives the address the message came from.
+
+    Unless the socket is non-blocking or MSG_DONTWAIT is given, this blocks
+    until vlen messages have been received or the timeout expires. With
+    MSG_WAITFORONE, it only blocks for the first message and then returns
+    whatever else is already waiting. This is a non-standard function (though
+    Linux and the BSDs have it).
+
+    \param  socket      The socket to receive on.
+    \param  msgvec      The messages to receive into.
+    \param  vlen        The number of entries of msgvec.
+    \param  flags       MSG_DONTWAIT, MSG_PEEK or MSG_WAITFORONE.
+    \param  timeout     The longest time to wait overall, or NULL to wait for
+                        as long as it takes.
+
+    \return             On success, the number of messages received. If the
+                        socket has been shut down, 0. On error (including no
+                        message arriving at all before timing out), -1, and
+                        sets errno as appropriate.
+*/
+int recvmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+             struct timespec *timeout);
+
+/** \brief  Send several messages on a socket.
+
+    This function sends up to vlen messages on a socket at once, which saves
+    the per-call overhead of sendto() when sending many small datagrams. Each
+    message is gathered from the buffers of its msg_iov and sent to msg_name,
+    or to the peer of a connected socket when msg_name is NULL. The number of
+    bytes sent is stored in msg_len. This is a non-standard function (though
+    Linux and the BSDs have it).
+
+    \param  socket      The socket to send on.
+    \param  msgvec      The messages to send.
+    \param  vlen        The number of entries of msgvec.
+    \param  flags       The type of message transmission. Set to 0 for now.
+
+    \return             On success, the number of messages sent, which may be
+                        less than vlen if an error occurred part way through.
+                        If the first message couldn't be sent, -1, and sets
+                        errno as appropriate.
+*/
+int sendmmsg(int socket, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+
 /** \brief  Shutdown socket send and receive operations.
 
     This function closes a specific socket for the set of specified operations.
@@ -26,6 +26,7 @@ printf goes to the dc-tool console
 #include <kos/init.h>
 #include <kos/mutex.h>
 #include <kos/rwsem.h>
+#include <kos/timer.h>
 
 #include <errno.h>
 #include <stdint.h>
@@ -35,14 +36,127 @@ printf goes to the dc-tool console
 #include <sys/dirent.h>
 #include <sys/queue.h>
 
+/* Every call to dcload is a round trip to the host, so files have a buffer
+   of this many bytes, made on first use. Reads smaller than it are served
+   from data read ahead, and writes smaller than it are gathered up until it
+   fills, the file is seeked or closed. */
+#define DCL_BUF_SIZE        (32 * 1024)
+
+/* Readdir stats each entry it returns, and the caller quite often stats each
+   one again straight after. The last few are kept for this long, or until
+   anything is changed through /pc. */
+#define DCL_STAT_CACHE      64
+#define DCL_STAT_CACHE_MS   2000
+
 typedef struct dcl_obj {
     int hnd;
     char *path;
     dirent_t dirent;
+
+    /* Data read ahead, from bpos up to blen, or if dirty, blen bytes
+       written that dcload hasn't been sent yet. */
+    uint8_t *buf;
+    size_t bpos;
+    size_t blen;
+    int dirty;
 } dcl_obj_t;
 
 static mutex_t mutex = MUTEX_INITIALIZER;
 
+static struct {
+    char *path;
+    dcload_stat_t st;
+} stat_cache[DCL_STAT_CACHE];
+static int stat_next;
+static uint64_t stat_time;
+
+/* These assume the mutex is held. */
+static void stat_cache_clear(void) {
+    int i;
+
+    for(i = 0; i < DCL_STAT_CACHE; ++i) {
+        free(stat_cache[i].path);
+        stat_cache[i].path = NULL;
+    }
+
+    stat_next = 0;
+}
+
+/* Takes over path, which was malloc'd. */
+static void stat_cache_add(char *path, const dcload_stat_t *st) {
+    free(stat_cache[stat_next].path);
+    stat_cache[stat_next].path = path;
+    stat_cache[stat_next].st = *st;
+    stat_next = (stat_next + 1) % DCL_STAT_CACHE;
+    stat_time = timer_ms_gettime64();
+}
+
+static int stat_cache_find(const char *path, dcload_stat_t *st) {
+    int i;
+
+    if(timer_ms_gettime64() - stat_time > DCL_STAT_CACHE_MS) {
+        stat_cache_clear();
+        return 0;
+    }
+
+    for(i = 0; i < DCL_STAT_CACHE; ++i) {
+        if(stat_cache[i].path && !strcmp(stat_cache[i].path, path)) {
+            *st = stat_cache[i].st;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Send what's in a file's buffer on to dcload: write out what's waiting to
+   be written or, with discard set, move dcload's position back over what was
+   read ahead and forget it. Either way, dcload's position is then the
+   file's. Assumes the mutex is held. */
+static int dcl_sync(dcl_obj_t *obj, int discard) {
+    size_t done = 0;
+    ssize_t rv;
+    int err = 0;
+
+    if(!obj->blen)
+        return 0;
+
+    if(obj->dirty) {
+        while(done < obj->blen) {
+            if((rv = dcload_write(obj->hnd, obj->buf + done,
+                                  obj->blen - done)) <= 0) {
+                err = -1;
+                break;
+            }
+
+            done += rv;
+        }
+
+        obj->blen = obj->bpos = 0;
+        obj->dirty = 0;
+        stat_cache_clear();
+        return err;
+    }
+
+    if(!discard)
+        return 0;
+
+    if(obj->blen != obj->bpos &&
+       dcload_lseek(obj->hnd, -(off_t)(obj->blen - obj->bpos), SEEK_CUR) < 0)
+        err = -1;
+
+    obj->blen = obj->bpos = 0;
+    return err;
+}
+
+/* Make a file's buffer, if it doesn't have one. */
+static int dcl_buf(dcl_obj_t *obj) {
+    if(!obj->buf)
+        obj->buf = malloc(DCL_BUF_SIZE);
+
+    return obj->buf ? 0 : -1;
+}
+
 int dcload_write_buffer(const uint8_t *data, int len, int xlat) {
     (void)xlat;
 
@@ -122,6 +236,12 @@ static void *fs_dcload_open(vfs_handler_t *vfs, const char *fn, int mode) {
             free(entry);
             return (void *)NULL;
         }
+
+        /* Opening it for writing could have made or truncated it. */
+        if(mm != O_RDONLY) {
+            mutex_lock_scoped(&mutex);
+            stat_cache_clear();
+        }
     }
 
     entry->hnd = hnd;
@@ -139,50 +259,124 @@ static int fs_dcload_close(void *h) {
 
         free(obj->path);
     }
-    else
+    else {
+        mutex_lock(&mutex);
+        dcl_sync(obj, 0);
+        mutex_unlock(&mutex);
         dcload_close(obj->hnd);
+        free(obj->buf);
+    }
 
     free(obj);
     return 0;
 }
 
 static ssize_t fs_dcload_read(void *h, void *buf, size_t cnt) {
-    ssize_t ret = -1;
+    uint8_t *out = buf;
+    ssize_t ret;
+    size_t done, n;
     dcl_obj_t *obj = h;
 
-    if(obj)
-        ret = dcload_read(obj->hnd, buf, cnt);
+    if(!obj)
+        return -1;
 
-    return ret;
+    mutex_lock_scoped(&mutex);
+
+    if(obj->dirty && dcl_sync(obj, 1))
+        return -1;
+
+    /* Take what we can from what's already been read. */
+    done = obj->blen - obj->bpos;
+
+    if(done > cnt)
+        done = cnt;
+
+    if(done) {
+        memcpy(out, obj->buf + obj->bpos, done);
+        obj->bpos += done;
+    }
+
+    if(done == cnt)
+        return done;
+
+    /* Big reads, or any if there's no buffer, go straight to dcload. */
+    if(cnt - done >= DCL_BUF_SIZE || dcl_buf(obj)) {
+        ret = dcload_read(obj->hnd, out + done, cnt - done);
+        return ret < 0 ? (done ? (ssize_t)done : -1) : (ssize_t)done + ret;
+    }
+
+    if((ret = dcload_read(obj->hnd, obj->buf, DCL_BUF_SIZE)) <= 0) {
+        obj->blen = obj->bpos = 0;
+        return done ? (ssize_t)done : ret;
+    }
+
+    obj->blen = ret;
+    n = cnt - done < (size_t)ret ? cnt - done : (size_t)ret;
+    memcpy(out + done, obj->buf, n);
+    obj->bpos = n;
+
+    return done + n;
 }
 
 static ssize_t fs_dcload_write(void *h, const void *buf, size_t cnt) {
-    ssize_t ret = -1;
     dcl_obj_t *obj = h;
 
-    if(obj)
-        ret = dcload_write(obj->hnd, buf, cnt);
+    if(!obj)
+        return -1;
 
-    return ret;
+    mutex_lock_scoped(&mutex);
+
+    if(!obj->dirty && dcl_sync(obj, 1))
+        return -1;
+
+    if(obj->blen + cnt > DCL_BUF_SIZE && dcl_sync(obj, 0))
+        return -1;
+
+    /* Big writes, or any if there's no buffer, go straight to dcload. */
+    if(cnt >= DCL_BUF_SIZE || dcl_buf(obj)) {
+        stat_cache_clear();
+        return dcload_write(obj->hnd, buf, cnt);
+    }
+
+    memcpy(obj->buf + obj->blen, buf, cnt);
+    obj->blen += cnt;
+    obj->dirty = 1;
+
+    return cnt;
 }
 
 static off_t fs_dcload_seek(void *h, off_t offset, int whence) {
-    off_t ret = -1;
     dcl_obj_t *obj = h;
 
-    if(obj)
-        ret = dcload_lseek(obj->hnd, offset, whence);
+    if(!obj)
+        return -1;
 
-    return ret;
+    mutex_lock_scoped(&mutex);
+
+    if(dcl_sync(obj, 1))
+        return -1;
+
+    return dcload_lseek(obj->hnd, offset, whence);
 }
 
 static off_t fs_dcload_tell(void *h) {
     off_t ret = -1;
     dcl_obj_t *obj = h;
 
-    if(obj)
+    if(obj) {
+        mutex_lock_scoped(&mutex);
+
         ret = dcload_lseek(obj->hnd, 0, SEEK_CUR);
 
+        /* Account for what's in the buffer. */
+        if(ret >= 0) {
+            if(obj->dirty)
+                ret += obj->blen;
+            else
+                ret -= obj->blen - obj->bpos;
+        }
+    }
+
     return ret;
 }
 
@@ -195,6 +389,10 @@ static size_t fs_dcload_total(void *h) {
         /* Lock to ensure commands are sent sequentially. */
         mutex_lock_scoped(&mutex);
 
+        /* Writes that are waiting could make the file bigger. */
+        if(dcl_sync(obj, 0))
+            return -1;
+
         cur = dcload_lseek(obj->hnd, 0, SEEK_CUR);
         ret = dcload_lseek(obj->hnd, 0, SEEK_END);
         dcload_lseek(obj->hnd, cur, SEEK_SET);
@@ -203,7 +401,27 @@ static size_t fs_dcload_total(void *h) {
     return ret;
 }
 
-static dirent_t *fs_dcload_readdir(void *h) {
+static vfs_handler_t vh;
+
+static void dcl_fill_stat(vfs_handler_t *vfs, const dcload_stat_t *filestat,
+                          struct stat *st) {
+    memset(st, 0, sizeof(struct stat));
+    st->st_dev = (dev_t)((uintptr_t)vfs);
+    st->st_ino = filestat->st_ino;
+    st->st_mode = filestat->st_mode;
+    st->st_nlink = filestat->st_nlink;
+    st->st_uid = filestat->st_uid;
+    st->st_gid = filestat->st_gid;
+    st->st_rdev = filestat->st_rdev;
+    st->st_size = filestat->st_size;
+    st->st_atime = filestat->atime;
+    st->st_mtime = filestat->mtime;
+    st->st_ctime = filestat->ctime;
+    st->st_blksize = filestat->st_blksize;
+    st->st_blocks = filestat->st_blocks;
+}
+
+static dirent_t *fs_dcload_readdir_plus(void *h, struct stat *st) {
     dirent_t *rv = NULL;
     struct dirent *dcld;
     dcload_stat_t filestat;
@@ -255,14 +473,28 @@ static dirent_t *fs_dcload_readdir(void *h) {
 
             rv->time = filestat.mtime;
 
+            if(st)
+                dcl_fill_stat(&vh, &filestat, st);
+
+            /* Keep it for if it's asked for again. */
+            stat_cache_add(fn, &filestat);
         }
+        else {
+            free(fn);
 
-        free(fn);
+            /* All that's known is the name. */
+            if(st)
+                memset(st, 0, sizeof(struct stat));
+        }
     }
 
     return rv;
 }
 
+static dirent_t *fs_dcload_readdir(void *h) {
+    return fs_dcload_readdir_plus(h, NULL);
+}
+
 static int fs_dcload_rename(vfs_handler_t *vfs, const char *fn1, const char *fn2) {
     int ret;
 
@@ -273,6 +505,7 @@ static int fs_dcload_rename(vfs_handler_t *vfs, const char *fn1, const char *fn2
 
     /* really stupid hack, since I didn't put rename() in dcload */
 
+    stat_cache_clear();
     ret = dcload_link(fn1, fn2);
 
     if(!ret)
@@ -284,6 +517,9 @@ static int fs_dcload_rename(vfs_handler_t *vfs, const char *fn1, const char *fn2
 static int fs_dcload_unlink(vfs_handler_t *vfs, const char *fn) {
     (void)vfs;
 
+    mutex_lock_scoped(&mutex);
+    stat_cache_clear();
+
     return dcload_unlink(fn);
 }
 
@@ -306,24 +542,12 @@ static int fs_dcload_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
         return 0;
     }
 
-    retval = dcload_stat(path, &filestat);
+    mutex_lock_scoped(&mutex);
 
-    if(!retval) {
-        memset(st, 0, sizeof(struct stat));
-        st->st_dev = (dev_t)((uintptr_t)vfs);
-        st->st_ino = filestat.st_ino;
-        st->st_mode = filestat.st_mode;
-        st->st_nlink = filestat.st_nlink;
-        st->st_uid = filestat.st_uid;
-        st->st_gid = filestat.st_gid;
-        st->st_rdev = filestat.st_rdev;
-        st->st_size = filestat.st_size;
-        st->st_atime = filestat.atime;
-        st->st_mtime = filestat.mtime;
-        st->st_ctime = filestat.ctime;
-        st->st_blksize = filestat.st_blksize;
-        st->st_blocks = filestat.st_blocks;
+    retval = stat_cache_find(path, &filestat) ? 0 : dcload_stat(path, &filestat);
 
+    if(!retval) {
+        dcl_fill_stat(vfs, &filestat, st);
         return 0;
     }
 
@@ -405,7 +629,12 @@ static vfs_handler_t vh = {
     NULL,               /* total64 */
     NULL,               /* readlink */
     fs_dcload_rewinddir,
-    NULL                /* fstat */
+    NULL,               /* fstat */
+    NULL,               /* read_async */
+    NULL,               /* write_async */
+    NULL,               /* splice_out */
+    NULL,               /* splice_in */
+    fs_dcload_readdir_plus
 };
 
 /* We have to provide a minimal interface in case dcload usage is
@@ -500,4 +729,8 @@ void fs_dcload_shutdown(void) {
     }
 
     nmmgr_handler_remove(&vh.nmmgr);
+
+    mutex_lock(&mutex);
+    stat_cache_clear();
+    mutex_unlock(&mutex);
 }
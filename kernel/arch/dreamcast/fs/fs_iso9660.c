@@ -33,11 +33,16 @@ ISO9660 systems, as these were used as references as well.
 #include <dc/cdrom.h>
 #include <dc/vblank.h>
 
+#include <arch/irq.h>
+
 #include <kos/thread.h>
 #include <kos/mutex.h>
 #include <kos/fs.h>
+#include <kos/fs_aio.h>
+#include <kos/genwait.h>
 #include <kos/opts.h>
 #include <kos/dbglog.h>
+#include <kos/timer.h>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -191,133 +196,297 @@ static uint32 iso_733(const uint8 *from) {
 
 
 /********************************************************************************/
-/* Low-level block caching routines. This implements a simple queue-based
-   LRU/MRU caching system. Whenever a block is requested, it will be placed
-   on the MRU end of the queue. As more blocks are loaded than can fit in
-   the cache, blocks are deleted from the LRU end. */
-
-/* Holds the data for one cache block, and a pointer to the next one.
-   As sectors are read from the disc, they are added to the front of
-   this cache. As the cache fills up, sectors are removed from the end
-   of it. */
-typedef struct {
+/* Low-level block caching routines. This implements a simple LRU caching
+   system, with each cache's blocks on a list from least to most recently
+   used, and hashed by sector so that finding one doesn't mean going through
+   the whole list. Whenever a block is requested, it will be placed on the
+   MRU end of the list. As more blocks are loaded than can fit in the cache,
+   blocks are reused from the LRU end.
+
+   A miss on the sector just after the last one read into a cache looks like
+   a file or directory being read through, and reads ahead of it with one
+   multi-sector read, rather than seeking back for each sector. */
+
+/* Holds the data for one cache block */
+typedef struct cache_block {
     uint8   *data;          /* Sector data */
-    uint32  sector;         /* CD sector */
+    uint32  sector;         /* CD sector, or -1 if unused */
+    TAILQ_ENTRY(cache_block) lru;
+    LIST_ENTRY(cache_block) hash;
 } cache_block_t;
 
-/* List of cache blocks (ordered least recently used to most recently) */
-#define NUM_CACHE_BLOCKS 16
-static cache_block_t *icache[NUM_CACHE_BLOCKS];     /* inode cache */
-static cache_block_t *dcache[NUM_CACHE_BLOCKS];     /* data cache */
-
-static unsigned char *cache_data;
-static cache_block_t *caches;
+typedef struct {
+    cache_block_t *blocks;
+    uint8 *data;
+    size_t count;
+    LIST_HEAD(cache_hash, cache_block) *hash;
+    uint32 hash_mask;
+    TAILQ_HEAD(cache_lru, cache_block) lru;     /* LRU first */
+    uint32 next;            /* Sector after the last one read in */
+} cache_t;
+
+static cache_t icache;      /* inode cache */
+static cache_t dcache;      /* data cache */
+
+/* Read-ahead is read into here and copied out into cache blocks */
+static uint8 *ra_buf;
+static size_t ra_max;
 
 /* Cache modification mutex */
 static mutex_t cache_mutex;
 
+static int cache_alloc(cache_t *cache, size_t count) {
+    size_t i, buckets = 1;
+
+    while(buckets < count)
+        buckets <<= 1;
+
+    cache->data = aligned_alloc(32, count * 2048);
+    cache->blocks = malloc(count * sizeof(cache_block_t));
+    cache->hash = malloc(buckets * sizeof(*cache->hash));
+
+    if(!cache->data || !cache->blocks || !cache->hash) {
+        free(cache->data);
+        free(cache->blocks);
+        free(cache->hash);
+        return -1;
+    }
+
+    cache->count = count;
+    cache->hash_mask = buckets - 1;
+    cache->next = (uint32)-1;
+    TAILQ_INIT(&cache->lru);
+
+    for(i = 0; i < buckets; i++)
+        LIST_INIT(&cache->hash[i]);
+
+    for(i = 0; i < count; i++) {
+        cache->blocks[i].data = &cache->data[i * 2048];
+        cache->blocks[i].sector = (uint32)-1;
+        TAILQ_INSERT_TAIL(&cache->lru, &cache->blocks[i], lru);
+    }
+
+    return 0;
+}
+
+static void cache_free(cache_t *cache) {
+    free(cache->data);
+    free(cache->blocks);
+    free(cache->hash);
+}
+
 /* Clears all cache blocks */
-static void bclear_cache(cache_block_t **cache) {
-    int i;
+static void bclear_cache(cache_t *cache) {
+    size_t i;
 
     mutex_lock(&cache_mutex);
 
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++)
-        cache[i]->sector = (uint32)-1;
+    for(i = 0; i < cache->count; i++) {
+        if(cache->blocks[i].sector != (uint32)-1) {
+            LIST_REMOVE(&cache->blocks[i], hash);
+            cache->blocks[i].sector = (uint32)-1;
+        }
+    }
 
+    cache->next = (uint32)-1;
     mutex_unlock(&cache_mutex);
 }
 
-/* Graduate a block from its current position to the MRU end of the cache */
-static void bgrad_cache(cache_block_t **cache, int block) {
-    int     i;
-    cache_block_t   *tmp;
+static cache_block_t *cache_find(cache_t *cache, uint32 sector) {
+    cache_block_t *b;
 
-    /* Don't try it with the end block */
-    if(block < 0 || block >= (NUM_CACHE_BLOCKS - 1)) return;
+    LIST_FOREACH(b, &cache->hash[sector & cache->hash_mask], hash) {
+        if(b->sector == sector)
+            return b;
+    }
 
-    /* Make a copy and scoot everything down */
-    tmp = cache[block];
+    return NULL;
+}
+
+/* Take the least recently used block out of the cache */
+static cache_block_t *cache_take(cache_t *cache) {
+    cache_block_t *b = TAILQ_FIRST(&cache->lru);
+
+    TAILQ_REMOVE(&cache->lru, b, lru);
 
-    for(i = block; i < (NUM_CACHE_BLOCKS - 1); i++)
-        cache[i] = cache[i + 1];
+    if(b->sector != (uint32)-1) {
+        LIST_REMOVE(b, hash);
+        b->sector = (uint32)-1;
+    }
+
+    return b;
+}
 
-    cache[NUM_CACHE_BLOCKS - 1] = tmp;
+/* Put a block back in as the most recently used, holding a sector */
+static void cache_put(cache_t *cache, cache_block_t *b, uint32 sector) {
+    b->sector = sector;
+    LIST_INSERT_HEAD(&cache->hash[sector & cache->hash_mask], b, hash);
+    TAILQ_INSERT_TAIL(&cache->lru, b, lru);
 }
 
-/* Pulls the requested sector into a cache block and returns the cache
-   block index. Note that the sector in question may already be in the
-   cache, in which case it just returns the containing block. */
+/* Pulls the requested sector into a cache block and returns its data. Note
+   that the sector in question may already be in the cache, in which case it
+   just returns the containing block. The caller wants this many sectors
+   from there on, at most, which is how far it may read ahead. */
 static void iso_break_all(void);
 static void iso_abort_stream(bool lock);
-static int bread_cache(cache_block_t **cache, uint32 sector) {
-    int i, j, rv;
+static uint8 *bread_cache(cache_t *cache, uint32 sector, size_t want) {
+    cache_block_t *b;
+    uint8 *rv = NULL;
+    size_t i, n = 1;
+    int j;
 
-    rv = -1;
     mutex_lock(&cache_mutex);
 
+    /* Out of memory at init */
+    if(!cache->count)
+        goto bread_exit;
+
     /* Look for a pre-existing cache block */
-    for(i = NUM_CACHE_BLOCKS - 1; i >= 0; i--) {
-        if(cache[i]->sector == sector) {
-            bgrad_cache(cache, i);
-            rv = NUM_CACHE_BLOCKS - 1;
-            goto bread_exit;
-        }
+    if((b = cache_find(cache, sector))) {
+        TAILQ_REMOVE(&cache->lru, b, lru);
+        TAILQ_INSERT_TAIL(&cache->lru, b, lru);
+        rv = b->data;
+        goto bread_exit;
     }
 
-    /* If not, look for an open cache slot; if we find one, use it */
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++) {
-        if(cache[i]->sector == (uint32)-1) break;
-    }
+    /* Read ahead when reading through, up to whatever is already cached */
+    if(sector == cache->next && want > 1) {
+        n = want < ra_max ? want : ra_max;
 
-    /* If we didn't find one, kick an LRU block out of cache */
-    if(i >= NUM_CACHE_BLOCKS) {
-        i = 0;
+        for(i = 1; i < n; i++) {
+            if(cache_find(cache, sector + i)) {
+                n = i;
+                break;
+            }
+        }
     }
 
-    iso_abort_stream(cache == icache);
-    // dbglog(DBG_DEBUG, "Stream stop for %s read\n", cache == icache ? "cached" : "inode");
+    iso_abort_stream(cache == &icache);
+    // dbglog(DBG_DEBUG, "Stream stop for %s read\n", cache == &icache ? "cached" : "inode");
 
-    /* Load the requested block */
-    j = cdrom_read_sectors_ex(cache[i]->data, sector + 150, 1, CDROM_READ_DMA);
+    /* Load the requested block, kicking the LRU block out of cache */
+    b = cache_take(cache);
+    j = cdrom_read_sectors_ex(n > 1 ? ra_buf : b->data, sector + 150, n,
+                              CDROM_READ_DMA);
 
     if(j != ERR_OK) {
         //dbglog(DBG_ERROR, "fs_iso9660: can't read_sectors for %d: %d\n",
         //  sector+150, j);
+        TAILQ_INSERT_HEAD(&cache->lru, b, lru);
+        cache->next = (uint32)-1;
+
         if(j == ERR_DISC_CHG || j == ERR_NO_DISC) {
             init_percd();
         }
 
-        rv = -1;
         goto bread_exit;
     }
 
-    cache[i]->sector = sector;
+    /* Move it to the most-recently-used position, with whatever was read
+       ahead after it. */
+    for(i = 0; i < n; i++) {
+        if(i)
+            b = cache_take(cache);
+
+        if(n > 1)
+            memcpy(b->data, ra_buf + i * 2048, 2048);
+
+        cache_put(cache, b, sector + i);
+
+        if(!i)
+            rv = b->data;
+    }
 
-    /* Move it to the most-recently-used position */
-    bgrad_cache(cache, i);
-    rv = NUM_CACHE_BLOCKS - 1;
+    cache->next = sector + n;
 
-    /* Return the new cache block index */
+    /* Return the new cache block's data */
 bread_exit:
     mutex_unlock(&cache_mutex);
     return rv;
 }
 
 /* read data block */
-static inline int bdread(uint32_t sector) {
-    return bread_cache(dcache, sector);
+static inline uint8 *bdread(uint32_t sector, size_t want) {
+    return bread_cache(&dcache, sector, want);
 }
 
 /* read inode block */
-static inline int biread(uint32_t sector) {
-    return bread_cache(icache, sector);
+static inline uint8 *biread(uint32_t sector, size_t want) {
+    return bread_cache(&icache, sector, want);
 }
 
 /* Clear both caches */
 static inline void bclear(void) {
-    bclear_cache(dcache);
-    bclear_cache(icache);
+    bclear_cache(&dcache);
+    bclear_cache(&icache);
+}
+
+/* Set up the caches, replacing the ones there are if any */
+static int cache_init(size_t inode_blocks, size_t data_blocks,
+                      size_t readahead) {
+    cache_t ic, dc;
+    uint8 *buf = NULL;
+
+    /* More read-ahead than half a cache would push out what it's read
+       before anyone got to it. */
+    if(readahead > inode_blocks / 2)
+        readahead = inode_blocks / 2;
+
+    if(readahead > data_blocks / 2)
+        readahead = data_blocks / 2;
+
+    if(readahead < 1)
+        readahead = 1;
+
+    if(cache_alloc(&ic, inode_blocks) < 0)
+        goto nomem;
+
+    if(cache_alloc(&dc, data_blocks) < 0) {
+        cache_free(&ic);
+        goto nomem;
+    }
+
+    if(readahead > 1 && !(buf = aligned_alloc(32, readahead * 2048))) {
+        cache_free(&dc);
+        cache_free(&ic);
+        goto nomem;
+    }
+
+    mutex_lock(&cache_mutex);
+
+    if(icache.count) {
+        cache_free(&icache);
+        cache_free(&dcache);
+        free(ra_buf);
+    }
+
+    /* The lists point back at their heads, which are moving. */
+    icache = ic;
+    dcache = dc;
+    TAILQ_INIT(&icache.lru);
+    TAILQ_INIT(&dcache.lru);
+    TAILQ_CONCAT(&icache.lru, &ic.lru, lru);
+    TAILQ_CONCAT(&dcache.lru, &dc.lru, lru);
+    ra_buf = buf;
+    ra_max = readahead;
+
+    mutex_unlock(&cache_mutex);
+    return 0;
+
+nomem:
+    errno = ENOMEM;
+    return -1;
+}
+
+int fs_iso9660_set_cache(size_t inode_blocks, size_t data_blocks,
+                         size_t readahead) {
+    if(!inode_blocks || !data_blocks) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return cache_init(inode_blocks, data_blocks, readahead);
 }
 
 /********************************************************************************/
@@ -333,10 +502,14 @@ static uint32 root_extent = 0, root_size = 0;
 static iso_dirent_t root_dirent;
 
 
+static void dentry_clear(void);
+static void dentry_prewarm(void);
+
 /* Per-disc initialization; this is done every time it's discovered that
    a new CD has been inserted. */
 static int init_percd(void) {
-    int     i, blk;
+    int     i;
+    uint8   *data;
     CDROM_TOC   toc;
 
     dbglog(DBG_NOTICE, "fs_iso9660: disc change detected\n");
@@ -360,12 +533,12 @@ static int init_percd(void) {
     joliet = 0;
 
     for(i = 1; i <= 3; i++) {
-        blk = biread(session_base + i + 16 - 150);
+        data = biread(session_base + i + 16 - 150, 1);
 
-        if(blk < 0) return blk;
+        if(!data) return -1;
 
-        if(memcmp((char *)icache[blk]->data, "\02CD001", 6) == 0) {
-            joliet = isjoliet((char *)icache[blk]->data + 88);
+        if(memcmp((char *)data, "\02CD001", 6) == 0) {
+            joliet = isjoliet((char *)data + 88);
             dbglog(DBG_NOTICE, "  (joliet level %d extensions detected)\n", joliet);
 
             if(joliet) break;
@@ -375,21 +548,23 @@ static int init_percd(void) {
     /* If that failed, go after standard/RockRidge ISO */
     if(!joliet) {
         /* Grab and check the volume descriptor */
-        blk = biread(session_base + 16 - 150);
+        data = biread(session_base + 16 - 150, 1);
 
-        if(blk < 0) return i;
+        if(!data) return -1;
 
-        if(memcmp((char*)icache[blk]->data, "\01CD001", 6)) {
+        if(memcmp((char*)data, "\01CD001", 6)) {
             dbglog(DBG_ERROR, "fs_iso9660: disc is not iso9660\r\n");
             return -1;
         }
     }
 
     /* Locate the root directory */
-    memcpy(&root_dirent, icache[blk]->data + 156, sizeof(iso_dirent_t));
+    memcpy(&root_dirent, data + 156, sizeof(iso_dirent_t));
     root_extent = iso_733(root_dirent.extent);
     root_size = iso_733(root_dirent.size);
 
+    dentry_prewarm();
+
     return 0;
 }
 
@@ -435,7 +610,8 @@ static int fncompare(const char *isofn, int isosize, const char *normalfn) {
  */
 static iso_dirent_t *find_object(const char *fn, int dir,
                                  uint32 dir_extent, uint32 dir_size) {
-    int     i, c;
+    int     i;
+    uint8   *data;
     iso_dirent_t    *de;
 
     /* RockRidge */
@@ -456,13 +632,13 @@ static iso_dirent_t *find_object(const char *fn, int dir,
         utf2ucs(ucsname, (uint8 *)fn);
 
     while(size_left > 0) {
-        c = biread(dir_extent);
+        data = biread(dir_extent, (size_left + 2047) / 2048);
 
-        if(c < 0) return NULL;
+        if(!data) return NULL;
 
         for(i = 0; i < 2048 && i < size_left;) {
             /* Locate the current dirent */
-            de = (iso_dirent_t *)(icache[c]->data + i);
+            de = (iso_dirent_t *)(data + i);
 
             if(!de->length) break;
 
@@ -574,6 +750,383 @@ static iso_dirent_t *find_object_path(const char *fn, int dir, iso_dirent_t *sta
     }
 }
 
+/* Helper function for readdir: post-processes an ISO filename to make
+   it a bit prettier. */
+static void fn_postprocess(char *fnin) {
+    char    * fn = fnin;
+
+    while(*fn && *fn != ';') {
+        *fn = tolower((int) * fn);
+        fn++;
+    }
+
+    *fn = 0;
+
+    /* Strip trailing dots */
+    if(fn > fnin && fn[-1] == '.') {
+        fn[-1] = 0;
+    }
+}
+
+/* The name of a directory entry, as readdir gives it */
+static void dirent_name(const iso_dirent_t *de, char *name) {
+    /* RockRidge */
+    int     len;
+    const uint8 *pnt;
+
+    if(joliet) {
+        ucs2utfn((uint8 *)name, (const uint8 *)de->name, de->name_len);
+        return;
+    }
+
+    strncpy(name, de->name, de->name_len);
+    name[de->name_len] = 0;
+    fn_postprocess(name);
+
+    /* Check for Rock Ridge NM extension */
+    len = de->length - sizeof(iso_dirent_t) + sizeof(de->name) - de->name_len;
+    pnt = (const uint8 *)de + sizeof(iso_dirent_t) - sizeof(de->name) + de->name_len;
+
+    if((de->name_len & 1) == 0) {
+        pnt++;
+        len--;
+    }
+
+    while((len >= 4) && ((pnt[3] == 1) || (pnt[3] == 2))) {
+        if(strncmp((const char *)pnt, "NM", 2) == 0) {
+            strncpy(name, (const char *)(pnt + 5), pnt[2] - 5);
+            name[pnt[2] - 5] = 0;
+        }
+
+        len -= pnt[2];
+        pnt += pnt[2];
+    }
+}
+
+/********************************************************************************/
+/* Path lookup cache. Paths that have been looked up are kept in a hash,
+   normalized to lower case without any leading, trailing or doubled
+   slashes, so that opening a file only goes to the disc for the parts of
+   its path that haven't been seen before. Names are matched without regard
+   to case on the disc, so lower-casing them doesn't merge anything that
+   wasn't already the same. When asked to, the whole tree is read into the
+   cache as soon as a disc is found.
+
+   Lookups don't hold the lock while reading the disc; the generation is
+   bumped on each clear so that what a lookup found on a disc that has since
+   gone never makes it into the cache. */
+
+/* Longest path kept; anything longer is looked up on the disc each time */
+#define DENTRY_PATH_MAX 256
+
+typedef struct dentry {
+    LIST_ENTRY(dentry) hash;
+    uint32 key_hash;
+    uint32 extent, size;
+    bool dir;
+    char path[];
+} dentry_t;
+
+static struct {
+    LIST_HEAD(dentry_hash, dentry) *hash;
+    uint32 hash_mask;
+    size_t count, max;
+    uint32 gen;
+    bool prewarm;
+} dentries;
+
+static mutex_t dentry_mutex;
+
+static uint32 dentry_hash(const char *key, size_t len) {
+    uint32 h = 2166136261u;
+
+    while(len--)
+        h = (h ^ (uint8)*key++) * 16777619u;
+
+    return h;
+}
+
+/* Normalize a path into a lookup key, returning its length or -1 if it's
+   too long to keep */
+static int dentry_key(const char *fn, char *key) {
+    int len = 0;
+
+    while(*fn) {
+        if(*fn == '/') {
+            fn++;
+            continue;
+        }
+
+        if(len)
+            key[len++] = '/';
+
+        while(*fn && *fn != '/') {
+            if(len >= DENTRY_PATH_MAX - 1)
+                return -1;
+
+            key[len++] = tolower((int)*fn++);
+        }
+    }
+
+    key[len] = 0;
+    return len;
+}
+
+static bool dentry_find(const char *key, size_t len, bool dir,
+                        uint32 *extent, uint32 *size) {
+    uint32 h = dentry_hash(key, len);
+    dentry_t *d;
+    bool rv = false;
+
+    mutex_lock(&dentry_mutex);
+
+    if(dentries.hash) {
+        LIST_FOREACH(d, &dentries.hash[h & dentries.hash_mask], hash) {
+            if(d->key_hash == h && d->dir == dir && !strcmp(d->path, key)) {
+                *extent = d->extent;
+                *size = d->size;
+                rv = true;
+                break;
+            }
+        }
+    }
+
+    mutex_unlock(&dentry_mutex);
+    return rv;
+}
+
+/* Add a path, unless the cache is full or has been cleared since the path
+   was looked up. The first of any entries that are the same but for case
+   is the one kept, as that's the one the disc lookup finds. */
+static void dentry_add(const char *key, size_t len, bool dir, uint32 extent,
+                       uint32 size, uint32 gen) {
+    uint32 h = dentry_hash(key, len);
+    dentry_t *d;
+
+    mutex_lock(&dentry_mutex);
+
+    if(!dentries.hash || gen != dentries.gen ||
+       dentries.count >= dentries.max)
+        goto out;
+
+    LIST_FOREACH(d, &dentries.hash[h & dentries.hash_mask], hash) {
+        if(d->key_hash == h && d->dir == dir && !strcmp(d->path, key))
+            goto out;
+    }
+
+    if(!(d = malloc(sizeof(dentry_t) + len + 1)))
+        goto out;
+
+    d->key_hash = h;
+    d->extent = extent;
+    d->size = size;
+    d->dir = dir;
+    memcpy(d->path, key, len + 1);
+    LIST_INSERT_HEAD(&dentries.hash[h & dentries.hash_mask], d, hash);
+    dentries.count++;
+
+out:
+    mutex_unlock(&dentry_mutex);
+}
+
+static void dentry_clear(void) {
+    dentry_t *d;
+    uint32 i;
+
+    mutex_lock(&dentry_mutex);
+    dentries.gen++;
+
+    if(dentries.hash) {
+        for(i = 0; i <= dentries.hash_mask; i++) {
+            while((d = LIST_FIRST(&dentries.hash[i]))) {
+                LIST_REMOVE(d, hash);
+                free(d);
+            }
+        }
+    }
+
+    dentries.count = 0;
+    mutex_unlock(&dentry_mutex);
+}
+
+/* Look up a normalized path, going to the disc for whatever of it isn't
+   cached yet. The key is borrowed for looking up its parent along the way,
+   but given back as it was. */
+static int dentry_lookup(char *key, size_t len, bool dir, uint32 *extent,
+                         uint32 *size) {
+    uint32 gen = dentries.gen, dext, dsize;
+    iso_dirent_t *de;
+    char *name;
+
+    if(!len) {
+        if(!dir)
+            return -1;
+
+        *extent = root_extent;
+        *size = root_size;
+        return 0;
+    }
+
+    if(dentry_find(key, len, dir, extent, size))
+        return 0;
+
+    if((name = strrchr(key, '/'))) {
+        *name = 0;
+
+        if(dentry_lookup(key, name - key, true, &dext, &dsize) < 0) {
+            *name = '/';
+            return -1;
+        }
+
+        *name++ = '/';
+    }
+    else {
+        name = key;
+        dext = root_extent;
+        dsize = root_size;
+    }
+
+    if(!(de = find_object(name, dir, dext, dsize)))
+        return -1;
+
+    *extent = iso_733(de->extent);
+    *size = iso_733(de->size);
+    dentry_add(key, len, dir, *extent, *size, gen);
+
+    return 0;
+}
+
+/* Look up an object by its path on the disc */
+static int lookup_object(const char *fn, bool dir, uint32 *extent,
+                         uint32 *size) {
+    char key[DENTRY_PATH_MAX];
+    iso_dirent_t *de;
+    int len;
+
+    if((len = dentry_key(fn, key)) >= 0)
+        return dentry_lookup(key, len, dir, extent, size);
+
+    if(!(de = find_object_path(fn, dir, &root_dirent)))
+        return -1;
+
+    *extent = iso_733(de->extent);
+    *size = iso_733(de->size);
+    return 0;
+}
+
+/* Add everything in a directory and under it to the cache. Each sector is
+   copied out, as the directories under it are read into the same cache. */
+static void dentry_scan(char *key, size_t len, uint32 extent, uint32 size,
+                        uint32 gen) {
+    char name[NAME_MAX], *n;
+    uint8 *data, *sect;
+    iso_dirent_t *de;
+    size_t nlen, i;
+    uint32 s, left;
+
+    if(!(sect = malloc(2048)))
+        return;
+
+    for(s = 0; s * 2048 < size; s++) {
+        left = (size + 2047) / 2048 - s;
+
+        if(!(data = biread(extent + s, left)))
+            break;
+
+        memcpy(sect, data, 2048);
+
+        for(i = 0; i < 2048 && s * 2048 + i < size; i += de->length) {
+            de = (iso_dirent_t *)(sect + i);
+
+            if(!de->length)
+                break;
+
+            /* The disc lookup only finds plain files and directories, and
+               the first two entries are the directory and its parent. */
+            if((de->flags != 0 && de->flags != 2) ||
+               (de->name_len == 1 && (uint8)de->name[0] <= 1))
+                continue;
+
+            dirent_name(de, name);
+            nlen = strlen(name);
+
+            if(!nlen || len + nlen + 2 > DENTRY_PATH_MAX)
+                continue;
+
+            if(len)
+                key[len] = '/';
+
+            for(n = name; *n; n++)
+                *n = tolower((int)*n);
+
+            memcpy(key + len + !!len, name, nlen + 1);
+            nlen += len + !!len;
+            dentry_add(key, nlen, de->flags == 2, iso_733(de->extent),
+                       iso_733(de->size), gen);
+
+            if(de->flags == 2)
+                dentry_scan(key, nlen, iso_733(de->extent),
+                            iso_733(de->size), gen);
+
+            key[len] = 0;
+        }
+    }
+
+    free(sect);
+}
+
+/* Read the whole tree into the cache, if asked to */
+static void dentry_prewarm(void) {
+    char key[DENTRY_PATH_MAX] = "";
+
+    if(!dentries.prewarm || !dentries.max)
+        return;
+
+    dentry_scan(key, 0, root_extent, root_size, dentries.gen);
+}
+
+static int dentry_init(size_t max, bool prewarm) {
+    uint32 buckets = 1;
+    void *hash = NULL;
+
+    if(max) {
+        while(buckets < max / 2)
+            buckets <<= 1;
+
+        if(!(hash = malloc(buckets * sizeof(*dentries.hash)))) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    dentry_clear();
+
+    mutex_lock(&dentry_mutex);
+    free(dentries.hash);
+    dentries.hash = hash;
+    dentries.hash_mask = buckets - 1;
+    dentries.max = max;
+    dentries.prewarm = prewarm;
+
+    if(hash) {
+        for(buckets = 0; buckets <= dentries.hash_mask; buckets++)
+            LIST_INIT(&dentries.hash[buckets]);
+    }
+
+    mutex_unlock(&dentry_mutex);
+    return 0;
+}
+
+int fs_iso9660_set_dentry_cache(size_t max, bool prewarm) {
+    if(dentry_init(max, prewarm) < 0)
+        return -1;
+
+    if(percd_done)
+        dentry_prewarm();
+
+    return 0;
+}
+
 /********************************************************************************/
 /* File primitives */
 
@@ -585,6 +1138,8 @@ typedef struct iso_fd {
     uint32_t size;              /* Length of file in bytes */
     dirent_t dirent;            /* A static dirent to pass back to clients */
     bool broken;                /* True if the CD has been swapped out since open */
+    uint32_t trace_gen;         /* Trace the handle was opened in, if any */
+    uint32_t trace_name;        /* Its name in that trace */
     size_t stream_part;         /* Stream DMA part of 32 bytes */
     uint8_t alignas(32) stream_data[32];
 } iso_fd_t;
@@ -594,6 +1149,7 @@ static TAILQ_HEAD(iso_fd_queue, iso_fd) iso_fd_queue;
 /* Mutex for protecting access to the iso_fd_queue */
 static mutex_t fh_mutex;
 static iso_fd_t *stream_fd = NULL;
+static uint32_t stream_seq = 0;
 
 /* Break all of our open file descriptor. This is necessary when the disc
    is changed so that we don't accidentally try to keep on doing stuff
@@ -609,13 +1165,206 @@ static inline void iso_break_all(void) {
     }
 }
 
+/* The asynchronous read in flight, which is always on the stream. Anything
+   about to use the drive waits for it, as stream requests can't be made
+   while it's in flight and stopping the stream would lose it. */
+static fs_aio_t *iso_aio = NULL;
+static size_t iso_aio_len;
+
+static void iso_aio_wait(void) {
+    irq_disable_scoped();
+
+    while(iso_aio)
+        genwait_wait(&iso_aio, "iso_aio_wait", 0, NULL);
+}
+
+/* Called from the G1 DMA interrupt */
+static void iso_aio_done(void *data) {
+    iso_aio = NULL;
+    genwait_wake_all(&iso_aio);
+    fs_aio_complete((fs_aio_t *)data, iso_aio_len, 0);
+}
+
+/* Access trace, for laying a disc out in the order it's read. Each name is
+   kept once, and reads refer to it by its offset among the names. Only
+   files opened while a trace is running are traced, so that a handle can't
+   refer to the names of an earlier trace. Protected by fh_mutex. */
+typedef struct {
+    uint64_t time;              /* Microseconds since boot */
+    uint32_t sector;            /* First sector read */
+    uint32_t len;               /* Bytes read */
+    uint32_t name;
+} trace_ent_t;
+
+static struct {
+    trace_ent_t *ents;
+    size_t count, max;
+    char *names;
+    size_t names_len, names_size;
+    uint32_t gen;
+    bool full;
+} trace;
+
+static uint32_t trace_name(const char *fn) {
+    size_t len = strlen(fn) + 1, i;
+    char *names;
+
+    for(i = 0; i < trace.names_len; i += strlen(trace.names + i) + 1) {
+        if(!strcmp(trace.names + i, fn))
+            return i;
+    }
+
+    if(trace.names_len + len > trace.names_size) {
+        if(!(names = realloc(trace.names, (trace.names_size + len) * 2)))
+            return UINT32_MAX;
+
+        trace.names = names;
+        trace.names_size = (trace.names_size + len) * 2;
+    }
+
+    memcpy(trace.names + trace.names_len, fn, len);
+    trace.names_len += len;
+
+    return i;
+}
+
+static void trace_read(const iso_fd_t *fd, uint32_t ptr, size_t len) {
+    trace_ent_t *ent;
+
+    if(!trace.ents || fd->trace_gen != trace.gen || !len)
+        return;
+
+    if(trace.count == trace.max) {
+        trace.full = true;
+        return;
+    }
+
+    ent = &trace.ents[trace.count++];
+    ent->time = timer_us_gettime64();
+    ent->sector = fd->first_extent + ptr / 2048;
+    ent->len = len;
+    ent->name = fd->trace_name;
+}
+
+int fs_iso9660_trace_start(size_t max) {
+    trace_ent_t *ents;
+
+    if(!max) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!(ents = malloc(max * sizeof(trace_ent_t)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mutex_lock_scoped(&fh_mutex);
+
+    if(trace.ents) {
+        free(ents);
+        errno = EBUSY;
+        return -1;
+    }
+
+    trace.ents = ents;
+    trace.max = max;
+    trace.count = 0;
+    trace.full = false;
+
+    /* Never 0, which is what handles opened outside of a trace have */
+    if(!++trace.gen)
+        trace.gen = 1;
+
+    return 0;
+}
+
+ssize_t fs_iso9660_trace_stop(const char *fn) {
+    trace_ent_t *ents;
+    char *names, line[64 + NAME_MAX];
+    size_t count, i;
+    bool full;
+    file_t f = -1;
+    int len;
+
+    mutex_lock(&fh_mutex);
+    ents = trace.ents;
+    names = trace.names;
+    count = trace.count;
+    full = trace.full;
+
+    trace.ents = NULL;
+    trace.names = NULL;
+    trace.names_len = trace.names_size = 0;
+    mutex_unlock(&fh_mutex);
+
+    if(!ents) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(full)
+        dbglog(DBG_WARNING, "fs_iso9660: trace ran out of room after %u "
+               "reads\n", (unsigned int)count);
+
+    if(fn && (f = fs_open(fn, O_WRONLY | O_CREAT | O_TRUNC)) < 0) {
+        free(ents);
+        free(names);
+        return -1;
+    }
+
+    for(i = 0; i < count; i++) {
+        len = snprintf(line, sizeof(line), "%llu %lu %lu %s\n",
+                       (unsigned long long)ents[i].time,
+                       (unsigned long)ents[i].sector,
+                       (unsigned long)ents[i].len,
+                       names + ents[i].name);
+
+        /* Keep the line whole, even if the name is cut short */
+        if(len >= (int)sizeof(line)) {
+            len = sizeof(line) - 1;
+            line[len - 1] = '\n';
+        }
+
+        if(f < 0)
+            dbglog(DBG_INFO, "iso_trace: %s", line);
+        else if(fs_write(f, line, len) != len)
+            break;
+    }
+
+    if(f >= 0)
+        fs_close(f);
+
+    free(ents);
+    free(names);
+
+    if(i < count) {
+        errno = EIO;
+        return -1;
+    }
+
+    return count;
+}
+
+/* Forget the current stream if someone else has started one since, such as
+   a sound stream reading ahead from the disc. What has already been read
+   into the handle stays there. */
+static inline void iso_check_stream(void) {
+    if(stream_fd && stream_seq != cdrom_stream_seq())
+        stream_fd = NULL;
+}
+
 /* Abort the current stream. */
 static inline void iso_abort_stream(bool lock) {
+    iso_aio_wait();
+
     if(stream_fd) {
         if(lock)
             mutex_lock(&fh_mutex);
 
-        cdrom_stream_stop(false);
+        if(stream_seq == cdrom_stream_seq())
+            cdrom_stream_stop(false);
+
         stream_fd->stream_part = 0;
         stream_fd = NULL;
 
@@ -626,7 +1375,7 @@ static inline void iso_abort_stream(bool lock) {
 
 /* Open a file or directory */
 static void * iso_open(vfs_handler_t * vfs, const char *fn, int mode) {
-    iso_dirent_t    *de;
+    uint32 extent, size;
     iso_fd_t *fd;
 
     (void)vfs;
@@ -646,9 +1395,7 @@ static void * iso_open(vfs_handler_t * vfs, const char *fn, int mode) {
     percd_done = 1;
 
     /* Find the file we want */
-    de = find_object_path(fn, (mode & O_DIR) ? 1 : 0, &root_dirent);
-
-    if(!de) {
+    if(lookup_object(fn, (mode & O_DIR) != 0, &extent, &size) < 0) {
         errno = ENOENT;
         return 0;
     }
@@ -661,9 +1408,9 @@ static void * iso_open(vfs_handler_t * vfs, const char *fn, int mode) {
 
     /* Fill in the file handle and return the fd */
     *fd = (iso_fd_t){
-        .first_extent = iso_733(de->extent),
+        .first_extent = extent,
         .dir = (mode & O_DIR) != 0,
-        .size = iso_733(de->size),
+        .size = size,
         .broken = false,
         .stream_part = 0,
         .stream_data = {0},
@@ -671,6 +1418,9 @@ static void * iso_open(vfs_handler_t * vfs, const char *fn, int mode) {
 
     mutex_lock_scoped(&fh_mutex);
 
+    if(trace.ents && (fd->trace_name = trace_name(fn)) != UINT32_MAX)
+        fd->trace_gen = trace.gen;
+
     TAILQ_INSERT_TAIL(&iso_fd_queue, fd, next);
 
     return fd;
@@ -697,9 +1447,9 @@ static int iso_close(void * h) {
 static ssize_t iso_read(void * h, void *buf, size_t bytes) {
     int rv, c;
     size_t toread, thissect;
-    uint8 * outbuf;
+    uint8 * outbuf, *data;
     size_t remain_size = 0, req_size;
-    uint32_t sector;
+    uint32_t sector, start;
     iso_fd_t *fd = (iso_fd_t *)h;
 
     /* Check that the fd is valid */
@@ -711,6 +1461,9 @@ static ssize_t iso_read(void * h, void *buf, size_t bytes) {
     rv = 0;
     outbuf = (uint8 *)buf;
     mutex_lock(&fh_mutex);
+    iso_aio_wait();
+    iso_check_stream();
+    start = fd->ptr;
 
     /* Read zero or more sectors into the buffer from the current pos */
     while(bytes > 0) {
@@ -742,6 +1495,14 @@ static ssize_t iso_read(void * h, void *buf, size_t bytes) {
 
         if((thissect & 31) == 0 && toread >= 32 && (((uintptr_t)outbuf) & 31) == 0) {
 
+            /* Whole sectors, or everything up to the end of the file, go
+               straight into the buffer with one read, rather than through
+               a stream over the rest of the file. */
+            if(stream_fd != fd && thissect == 2048 && toread >= 2048 &&
+               ((toread & 2047) == 0 || fd->ptr + toread == fd->size)) {
+                goto read_loop;
+            }
+
             if(stream_fd == fd) {
                 toread &= ~31;
                 c = cdrom_stream_request(outbuf, toread, 1);
@@ -770,6 +1531,7 @@ static ssize_t iso_read(void * h, void *buf, size_t bytes) {
                 }
                 fd->stream_part = 0;
                 stream_fd = fd;
+                stream_seq = cdrom_stream_seq();
                 // dbglog(DBG_DEBUG, "Stream start: lba=%ld cnt=%d fd=%p\n",
                 //     sector + 150, req_size / 2048, fd);
 
@@ -827,6 +1589,10 @@ read_loop:
             /* Round it off to an even sector count. */
             thissect = toread / 2048;
             toread = thissect * 2048;
+
+            if(stream_fd) {
+                iso_abort_stream(false);
+            }
             c = cdrom_read_sectors_ex(outbuf, sector + 150, thissect, CDROM_READ_DMA);
 
             if(c) {
@@ -835,12 +1601,12 @@ read_loop:
         }
         else {
             toread = (toread > thissect) ? thissect : toread;
-            c = bdread(sector);
+            data = bdread(sector, (fd->size + 2047) / 2048 - fd->ptr / 2048);
 
-            if(c < 0) {
+            if(!data) {
                 goto read_error;
             }
-            memcpy(outbuf, dcache[c]->data + (fd->ptr % 2048), toread);
+            memcpy(outbuf, data + (fd->ptr % 2048), toread);
         }
 
 end_loop:
@@ -851,6 +1617,7 @@ end_loop:
         rv += toread;
     }
 
+    trace_read(fd, start, rv);
     mutex_unlock(&fh_mutex);
     return rv;
 
@@ -860,6 +1627,71 @@ read_error:
     return -1;
 }
 
+/* Read in the background. This goes by the same stream as big reads do,
+   continuing it if it's already on this file, and leaves anything that
+   can't be DMAed straight into the buffer to the aio worker, which comes
+   back through iso_read(). */
+static int iso_read_async(void *h, fs_aio_t *req) {
+    iso_fd_t *fd = (iso_fd_t *)h;
+    size_t n;
+    uint32_t sector;
+    int rv = -1;
+
+    if(fd->first_extent == 0 || fd->dir || fd->broken ||
+       !__is_aligned(req->buf, 32)) {
+        return -1;
+    }
+
+    mutex_lock(&fh_mutex);
+    iso_check_stream();
+
+    n = fd->size - fd->ptr;
+
+    if(n > req->cnt)
+        n = req->cnt;
+
+    n &= ~31;
+
+    if(iso_aio || !n || fd->stream_part)
+        goto out;
+
+    if(stream_fd != fd) {
+        if(fd->ptr & 2047)
+            goto out;
+
+        if(stream_fd)
+            iso_abort_stream(false);
+
+        sector = fd->first_extent + fd->ptr / 2048;
+
+        if(cdrom_stream_start(sector + 150, (fd->size - fd->ptr + 2047) / 2048,
+                              CDROM_READ_DMA) != ERR_OK) {
+            goto out;
+        }
+
+        fd->stream_part = 0;
+        stream_fd = fd;
+        stream_seq = cdrom_stream_seq();
+    }
+
+    iso_aio = req;
+    iso_aio_len = n;
+
+    if(cdrom_stream_request_async(req->buf, n, iso_aio_done, req) != ERR_OK) {
+        iso_aio = NULL;
+        iso_abort_stream(false);
+        goto out;
+    }
+
+    trace_read(fd, fd->ptr, n);
+    fd->ptr += n;
+    rv = 0;
+
+out:
+    mutex_unlock(&fh_mutex);
+    return rv;
+}
+
 /* Seek elsewhere in a file */
 static off_t iso_seek(void * h, off_t offset, int whence) {
     uint32_t old_ptr;
@@ -941,33 +1773,10 @@ static size_t iso_total(void * h) {
     return fd->size;
 }
 
-/* Helper function for readdir: post-processes an ISO filename to make
-   it a bit prettier. */
-static void fn_postprocess(char *fnin) {
-    char    * fn = fnin;
-
-    while(*fn && *fn != ';') {
-        *fn = tolower((int) * fn);
-        fn++;
-    }
-
-    *fn = 0;
-
-    /* Strip trailing dots */
-    if(fn > fnin && fn[-1] == '.') {
-        fn[-1] = 0;
-    }
-}
-
 /* Read a directory entry */
-static dirent_t *iso_readdir(void * h) {
-    int     c;
+static dirent_t *iso_readdir_plus(void *h, struct stat *st) {
+    uint8   *data = NULL;
     iso_dirent_t    *de;
-
-    /* RockRidge */
-    int     len;
-    uint8       *pnt;
-
     iso_fd_t *fd = (iso_fd_t *)h;
 
     if(fd->first_extent == 0 || !fd->dir || fd->broken) {
@@ -977,16 +1786,16 @@ static dirent_t *iso_readdir(void * h) {
 
     /* Scan forwards until we find the next valid entry, an
        end-of-entry mark, or run out of dir size. */
-    c = -1;
     de = NULL;
 
     while(fd->ptr < fd->size) {
         /* Get the current dirent block */
-        c = biread(fd->first_extent + fd->ptr / 2048);
+        data = biread(fd->first_extent + fd->ptr / 2048,
+                      (fd->size + 2047) / 2048 - fd->ptr / 2048);
 
-        if(c < 0) return NULL;
+        if(!data) return NULL;
 
-        de = (iso_dirent_t *)(icache[c]->data + (fd->ptr % 2048));
+        de = (iso_dirent_t *)(data + (fd->ptr % 2048));
 
         if(de->length) break;
 
@@ -999,41 +1808,15 @@ static dirent_t *iso_readdir(void * h) {
     /* If we're at the first, skip the two blank entries */
     if(!de->name[0] && de->name_len == 1) {
         fd->ptr += de->length;
-        de = (iso_dirent_t *)(icache[c]->data + (fd->ptr % 2048));
+        de = (iso_dirent_t *)(data + (fd->ptr % 2048));
         fd->ptr += de->length;
-        de = (iso_dirent_t *)(icache[c]->data + (fd->ptr % 2048));
+        de = (iso_dirent_t *)(data + (fd->ptr % 2048));
 
         if(!de->length) return NULL;
     }
 
-    if(joliet) {
-        ucs2utfn((uint8 *)fd->dirent.name, (uint8 *)de->name, de->name_len);
-    }
-    else {
-        /* Fill out the VFS dirent */
-        strncpy(fd->dirent.name, de->name, de->name_len);
-        fd->dirent.name[de->name_len] = 0;
-        fn_postprocess(fd->dirent.name);
-
-        /* Check for Rock Ridge NM extension */
-        len = de->length - sizeof(iso_dirent_t) + sizeof(de->name) - de->name_len;
-        pnt = (uint8*)de + sizeof(iso_dirent_t) - sizeof(de->name) + de->name_len;
-
-        if((de->name_len & 1) == 0) {
-            pnt++;
-            len--;
-        }
-
-        while((len >= 4) && ((pnt[3] == 1) || (pnt[3] == 2))) {
-            if(strncmp((char *)pnt, "NM", 2) == 0) {
-                strncpy(fd->dirent.name, (char *)(pnt + 5), pnt[2] - 5);
-                fd->dirent.name[pnt[2] - 5] = 0;
-            }
-
-            len -= pnt[2];
-            pnt += pnt[2];
-        }
-    }
+    /* Fill out the VFS dirent */
+    dirent_name(de, fd->dirent.name);
 
     if(de->flags & 2) {
         fd->dirent.size = -1;
@@ -1046,9 +1829,24 @@ static dirent_t *iso_readdir(void * h) {
 
     fd->ptr += de->length;
 
+    /* The same as iso_stat() would give for it */
+    if(st) {
+        memset(st, 0, sizeof(struct stat));
+        st->st_dev = (dev_t)('c' | ('d' << 8));
+        st->st_mode = S_IRUSR | S_IRGRP | S_IROTH | S_IXUSR | S_IXGRP | S_IXOTH;
+        st->st_mode |= (de->flags & 2) ? S_IFDIR : S_IFREG;
+        st->st_size = fd->dirent.size;
+        st->st_nlink = (de->flags & 2) ? 2 : 1;
+        st->st_blksize = 512;
+    }
+
     return &fd->dirent;
 }
 
+static dirent_t *iso_readdir(void *h) {
+    return iso_readdir_plus(h, NULL);
+}
+
 static int iso_ioctl(void *h, int cmd, va_list ap) {
     iso_fd_t *fd = (iso_fd_t *)h;
     void *arg = va_arg(ap, void*);
@@ -1062,6 +1860,13 @@ static int iso_ioctl(void *h, int cmd, va_list ap) {
                 return (fd->ptr & 31) ? -1 : 0;
             }
             return (fd->ptr & 2047) ? -1 : 0;
+        case IOCTL_ISO9660_GET_LBA:
+            if(fd->dir || arg == NULL) {
+                errno = EINVAL;
+                return -1;
+            }
+            *(uint32_t *)arg = fd->first_extent + 150;
+            return 0;
         default:
             errno = EINVAL;
             return -1;
@@ -1084,6 +1889,7 @@ static int iso_rewinddir(void * h) {
 int iso_reset(void) {
     iso_break_all();
     bclear();
+    dentry_clear();
     iso_abort_stream(false);
     percd_done = 0;
     return 0;
@@ -1117,7 +1923,7 @@ static void iso_vblank(uint32 evt, void *data) {
 static int iso_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
                     int flag) {
     mode_t md;
-    iso_dirent_t *de;
+    uint32 extent, size;
     size_t len = strlen(path);
 
     (void)vfs;
@@ -1136,25 +1942,23 @@ static int iso_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
     }
 
     /* First try opening as a file */
-    de = find_object_path(path, 0, &root_dirent);
     md = S_IFREG;
 
     /* If we couldn't get it as a file, try as a directory */
-    if(!de) {
-        de = find_object_path(path, 1, &root_dirent);
+    if(lookup_object(path, false, &extent, &size) < 0) {
         md = S_IFDIR;
-    }
 
-    /* If we still don't have it, then we're not going to get it. */
-    if(!de) {
-        errno = ENOENT;
-        return -1;
+        /* If we still don't have it, then we're not going to get it. */
+        if(lookup_object(path, true, &extent, &size) < 0) {
+            errno = ENOENT;
+            return -1;
+        }
     }
 
     memset(st, 0, sizeof(struct stat));
     st->st_dev = (dev_t)('c' | ('d' << 8));
     st->st_mode = md | S_IRUSR | S_IRGRP | S_IROTH | S_IXUSR | S_IXGRP | S_IXOTH;
-    st->st_size = (md == S_IFDIR) ? -1 : (int)iso_733(de->size);
+    st->st_size = (md == S_IFDIR) ? -1 : (int)size;
     st->st_nlink = (md == S_IFDIR) ? 2 : 1;
     st->st_blksize = 512;
 
@@ -1252,38 +2056,37 @@ static vfs_handler_t vh = {
     NULL,               /* total64 */
     NULL,               /* readlink */
     iso_rewinddir,
-    iso_fstat
+    iso_fstat,
+    iso_read_async,
+    NULL,               /* write_async */
+    NULL,               /* splice_out */
+    NULL,               /* splice_in */
+    iso_readdir_plus
 };
 
 /* Initialize the file system */
 void fs_iso9660_init(void) {
-    int i;
-
     /* Init the linked list */
     TAILQ_INIT(&iso_fd_queue);
 
     /* Init thread mutexes */
-    mutex_init(&cache_mutex, MUTEX_TYPE_NORMAL);
+    mutex_init(&cache_mutex, MUTEX_TYPE_NORMAL | MUTEX_TYPE_PI);
     mutex_init(&fh_mutex, MUTEX_TYPE_NORMAL);
+    mutex_init(&dentry_mutex, MUTEX_TYPE_NORMAL);
 
     /* Allocate cache block space, properly aligned for DMA access */
-    cache_data = aligned_alloc(32, 2 * NUM_CACHE_BLOCKS * 2048);
-    caches = malloc(2 * NUM_CACHE_BLOCKS * sizeof(cache_block_t));
+    cache_init(FS_ISO9660_CACHE_BLOCKS, FS_ISO9660_CACHE_BLOCKS,
+               FS_ISO9660_READAHEAD);
 
-    for(i = 0; i < NUM_CACHE_BLOCKS; i++) {
-        icache[i] = &caches[i * 2];
-        icache[i]->data = &cache_data[i * 2 * 2048];
-        icache[i]->sector = -1;
-        dcache[i] = &caches[i * 2 + 1];
-        dcache[i]->data = &cache_data[i * 2 * 2048 + 2048];
-        dcache[i]->sector = -1;
-    }
+    dentry_init(FS_ISO9660_DENTRIES, false);
 
     percd_done = 0;
     iso_last_status = -1;
 
-    /* Register with the vblank */
-    iso_vblank_hnd = vblank_handler_add(iso_vblank, NULL);
+    /* Register with the vblank. Checking for a disc change takes a syscall,
+       so keep it out of the interrupt. */
+    iso_vblank_hnd = vblank_handler_add_ex(iso_vblank, NULL, VBLANK_PRIO_LOW,
+                                           VBLANK_HND_DEFERRED);
 
     /* Register with VFS */
     nmmgr_handler_add(&vh.nmmgr);
@@ -1295,10 +2098,23 @@ void fs_iso9660_shutdown(void) {
     vblank_handler_remove(iso_vblank_hnd);
 
     /* Dealloc cache block space */
-    free(cache_data);
-    free(caches);
+    if(icache.count) {
+        cache_free(&icache);
+        cache_free(&dcache);
+        free(ra_buf);
+        icache.count = dcache.count = 0;
+        ra_buf = NULL;
+    }
+
+    dentry_init(0, false);
+
+    free(trace.ents);
+    free(trace.names);
+    trace.ents = NULL;
+    trace.names = NULL;
 
     /* Free muteces */
+    mutex_destroy(&dentry_mutex);
     mutex_destroy(&cache_mutex);
     mutex_destroy(&fh_mutex);
 
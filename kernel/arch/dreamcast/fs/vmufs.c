@@ -10,8 +10,13 @@
 #include <string.h>
 #include <time.h>
 
+#include <errno.h>
+#include <arch/irq.h>
+
 #include <kos/dbglog.h>
 #include <kos/mutex.h>
+#include <kos/thread.h>
+#include <kos/worker_thread.h>
 #include <dc/vmufs.h>
 #include <dc/maple.h>
 #include <dc/maple/vmu.h>
@@ -22,9 +27,10 @@ This is a whole new module that sits between the fs_vmu module and the maple
 VMU driver. It's based loosely on the stuff in the old fs_vmu, but it's been
 rewritten and reworked to be clearer, more clean, use threads better, etc.
 
-Unlike the fs_vmu module, this code is stateless. You make a call and you get
-back data (or have written it). There are no handles involved or anything
-else like that. The new fs_vmu sits on top of this and provides a (mostly)
+Unlike the fs_vmu module, this code is (nearly) stateless. You make a call and
+you get back data (or have written it). There are no handles involved or
+anything else like that. The only thing kept between calls is a copy of each
+card's root block, directory and FAT, dropped when the card is unplugged. The new fs_vmu sits on top of this and provides a (mostly)
 nice VFS interface similar to the old fs_vmu.
 
 This module tends to do more work than it really needs to for some
@@ -48,6 +54,73 @@ Function comments located in vmufs.h.
    be much of an issue :) */
 static mutex_t mutex;
 
+/* How many blocks of a file are written between calls to the progress
+   callback of an asynchronous write */
+#define VMUFS_PROGRESS_BLOCKS   4
+
+/* The root block, directory and FAT of each card, as last read or written,
+   so that the higher level functions don't have to read them over maple
+   on every call. The driver bumps gen when a card comes or goes (from an
+   interrupt, so that's all it does), and the copies are thrown out the next
+   time they're looked at. Everything else in here is under the mutex. */
+typedef struct {
+    volatile unsigned int gen;
+    unsigned int    seen;
+    int             root_ok, dir_ok, fat_ok;
+    vmu_root_t      root;
+    vmu_dir_t       *dir;
+    int             dirsize;
+    uint16          *fat;
+    int             fatsize;
+} vmufs_cache_t;
+
+static vmufs_cache_t cache[MAPLE_PORT_COUNT][MAPLE_UNIT_COUNT];
+
+void vmufs_invalidate(maple_device_t * dev) {
+    cache[dev->port][dev->unit].gen++;
+}
+
+static vmufs_cache_t *vmufs_cache_get(maple_device_t * dev) {
+    vmufs_cache_t *c = &cache[dev->port][dev->unit];
+    unsigned int gen = c->gen;
+
+    if(c->seen != gen) {
+        c->root_ok = c->dir_ok = c->fat_ok = 0;
+        c->seen = gen;
+    }
+
+    return c;
+}
+
+/* Copy something just read from or written to the card into the cache, if
+   the root block it was found with is the one cached. */
+static void vmufs_cache_put(maple_device_t * dev, vmu_root_t * root,
+                            const void * buf, int fat) {
+    vmufs_cache_t *c = vmufs_cache_get(dev);
+    int size = fat ? vmufs_fat_blocks(root) : vmufs_dir_blocks(root);
+    void **data = fat ? (void **)&c->fat : (void **)&c->dir;
+    int *datasize = fat ? &c->fatsize : &c->dirsize;
+    int *ok = fat ? &c->fat_ok : &c->dir_ok;
+
+    *ok = 0;
+
+    if(!c->root_ok || memcmp(root, &c->root, sizeof(vmu_root_t)))
+        return;
+
+    if(*datasize != size) {
+        free(*data);
+        *datasize = 0;
+
+        if(!(*data = malloc(size)))
+            return;
+
+        *datasize = size;
+    }
+
+    memcpy(*data, buf, size);
+    *ok = 1;
+}
+
 /* Convert a decimal number to BCD; max of two digits */
 static uint8 __pure dec_to_bcd(int dec) {
     uint8 rv = 0;
@@ -89,14 +162,27 @@ int vmufs_root_read(maple_device_t * dev, vmu_root_t * root_buf) {
 }
 
 int vmufs_root_write(maple_device_t * dev, vmu_root_t * root_buf) {
+    vmufs_cache_t *c = vmufs_cache_get(dev);
+
     /* XXX: Assume root is at 255.. is there some way to figure this out dynamically? */
     if(vmu_block_write(dev, 255, (uint8 *)root_buf) != 0) {
         dbglog(DBG_ERROR, "vmufs_root_write: can't write block %d on device %c%c\n",
                255, dev->port + 'A', dev->unit + '0');
+        c->root_ok = c->dir_ok = c->fat_ok = 0;
         return -1;
     }
-    else
-        return 0;
+
+    /* If the dir or FAT moved, the cached ones are no use any more */
+    if(!c->root_ok || root_buf->dir_loc != c->root.dir_loc ||
+       root_buf->dir_size != c->root.dir_size ||
+       root_buf->fat_loc != c->root.fat_loc ||
+       root_buf->fat_size != c->root.fat_size)
+        c->dir_ok = c->fat_ok = 0;
+
+    memcpy(&c->root, root_buf, sizeof(vmu_root_t));
+    c->root_ok = 1;
+
+    return 0;
 }
 
 int vmufs_dir_blocks(vmu_root_t * root_buf) {
@@ -109,6 +195,7 @@ int vmufs_fat_blocks(vmu_root_t * root_buf) {
 
 /* Common code for both dir_read and dir_write */
 static int vmufs_dir_ops(maple_device_t * dev, vmu_root_t * root, vmu_dir_t * dir_buf, int write) {
+    vmu_dir_t *start = dir_buf;
     uint16  dir_block, dir_size;
     unsigned int i;
     int needsop, rv;
@@ -143,6 +230,10 @@ static int vmufs_dir_ops(maple_device_t * dev, vmu_root_t * root, vmu_dir_t * di
                        write ? "write" : "read",
                        write ? "write" : "read",
                        (int)dir_block, dev->port + 'A', dev->unit + '0');
+
+                if(write)
+                    vmufs_cache_get(dev)->dir_ok = 0;
+
                 return -1;
             }
         }
@@ -152,6 +243,9 @@ static int vmufs_dir_ops(maple_device_t * dev, vmu_root_t * root, vmu_dir_t * di
         dir_buf += 512 / sizeof(vmu_dir_t); /* == 16 */
     }
 
+    if(write)
+        vmufs_cache_put(dev, root, start, 0);
+
     return 0;
 }
 
@@ -190,9 +284,16 @@ static int vmufs_fat_ops(maple_device_t * dev, vmu_root_t * root, uint16 * fat_b
                write ? "write" : "read",
                write ? "write" : "read",
                (int)fat_block, dev->port + 'A', dev->unit + '0', rv);
+
+        if(write)
+            vmufs_cache_get(dev)->fat_ok = 0;
+
         return -2;
     }
 
+    if(write)
+        vmufs_cache_put(dev, root, fat_buf, 1);
+
     return 0;
 }
 
@@ -333,10 +434,36 @@ static int vmufs_find_block(vmu_root_t * root, uint16 * fat, vmu_dir_t * dirent)
     return -2;
 }
 
-int vmufs_file_write(maple_device_t * dev, vmu_root_t * root, uint16 * fat,
-                     vmu_dir_t * dir, vmu_dir_t * newdirent, void * filebuf, int size) {
-    int curblk, blkleft, rv;
+/* Write out a file's blocks, telling progress about it every few blocks if
+   there's a progress callback */
+static int vmufs_blocks_write(maple_device_t * dev, uint16 * blocks, int size, uint8 * out,
+                              vmufs_progress_t progress, void * data, int total) {
+    int i, n, rv;
+
+    if(!progress)
+        return vmu_block_write_multi(dev, blocks, size, out);
+
+    for(i = 0; i < size; i += n) {
+        n = size - i;
+
+        if(n > VMUFS_PROGRESS_BLOCKS)
+            n = VMUFS_PROGRESS_BLOCKS;
+
+        if((rv = vmu_block_write_multi(dev, blocks + i, n, out + i * 512)) != 0)
+            return rv;
+
+        progress(data, i + n, total);
+    }
+
+    return 0;
+}
+
+static int vmufs_file_write_progress(maple_device_t * dev, vmu_root_t * root, uint16 * fat,
+                                     vmu_dir_t * dir, vmu_dir_t * newdirent, void * filebuf, int size,
+                                     vmufs_progress_t progress, void * data, int total) {
+    int curblk, i, rv;
     int vmuspaceleft;
+    uint16  * blocks;
     uint8   * out;
 
     /* Files must be at least one block long */
@@ -373,43 +500,53 @@ int vmufs_file_write(maple_device_t * dev, vmu_root_t * root, uint16 * fat,
         return curblk;
 
     /* And the blocks remaining */
-    blkleft = newdirent->filesize = size;
+    newdirent->filesize = size;
 
-    /* While we've got stuff remaining... */
-    while(blkleft > 0) {
-        /* Write the block */
-        rv = vmu_block_write(dev, curblk, (uint8 *)out);
+    blocks = (uint16 *)malloc(size * sizeof(uint16));
 
-        if(rv != 0) {
-            dbglog(DBG_ERROR, "vmufs_file_write: can't write block %d on device %c%c (error %d)\n",
-                   curblk, dev->port + 'A', dev->unit + '0', rv);
-            return -5;
-        }
+    if(!blocks) {
+        dbglog(DBG_ERROR, "vmufs_file_write: can't alloc %d bytes for block list\n",
+               size * (int)sizeof(uint16));
+        return -5;
+    }
 
-        /* Scoot our counters */
-        blkleft--;
-        out += 512;
+    /* Chain all of the blocks together first, so they can be written out in
+       one batch rather than one at a time */
+    for(i = 0; i < size; i++) {
+        blocks[i] = curblk;
+
+        // Set the pointer to the terminator just in case:
+        // a) vmufs_find_block() fails to find a block, AND
+        // b) the calling code for some reason writes the FAT back out anyway.
+        // This may render the save game unusable but at least we won't link
+        // into some other file (or worse, a game!)
+        fat[curblk] = 0xfffa;
 
         /* If we have blocks left, find another free block. Otherwise,
-           write out a terminator. */
-        if(blkleft) {
-            // Set the pointer to the terminator just in case:
-            // a) vmufs_find_block() fails to find a block, AND
-            // b) the calling code for some reason writes the FAT back out anyway.
-            // This may render the save game unusable but at least we won't link
-            // into some other file (or worse, a game!)
-            fat[curblk] = 0xfffa;
+           leave the terminator. */
+        if(i + 1 < size) {
             rv = vmufs_find_block(root, fat, newdirent);
 
-            if(rv < 0)
+            if(rv < 0) {
+                free(blocks);
                 return rv;
+            }
 
             fat[curblk] = rv;
             curblk = rv;
         }
-        else {
-            fat[curblk] = 0xfffa;
-        }
+    }
+
+    /* Write the blocks */
+    rv = vmufs_blocks_write(dev, blocks, size, out, progress, data, total);
+    free(blocks);
+
+    if(rv != 0) {
+        char fn[13] = {0};
+        memcpy(fn, newdirent->filename, 12);
+        dbglog(DBG_ERROR, "vmufs_file_write: can't write file '%s' on device %c%c (error %d)\n",
+               fn, dev->port + 'A', dev->unit + '0', rv);
+        return -5;
     }
 
     /* Add the entry to the directory */
@@ -422,6 +559,12 @@ int vmufs_file_write(maple_device_t * dev, vmu_root_t * root, uint16 * fat,
     return 0;
 }
 
+int vmufs_file_write(maple_device_t * dev, vmu_root_t * root, uint16 * fat,
+                     vmu_dir_t * dir, vmu_dir_t * newdirent, void * filebuf, int size) {
+    return vmufs_file_write_progress(dev, root, fat, dir, newdirent, filebuf, size,
+                                     NULL, NULL, 0);
+}
+
 int vmufs_file_delete(vmu_root_t * root, uint16 * fat, vmu_dir_t * dir, const char * fn) {
     int idx;
     int blk, nextblk;
@@ -498,9 +641,66 @@ int vmufs_mutex_unlock(void) {
 
 /* ****************** Higher level functions ******************** */
 
-/* Internal function gets everything setup for you */
+/* Make sure the cache holds the root block, and the dir and FAT if asked */
+static int vmufs_cache_fill(maple_device_t * dev, vmufs_cache_t * c, int dir, int fat) {
+    vmu_root_t root;
+    void *buf;
+
+    if(!c->root_ok) {
+        if(vmufs_root_read(dev, &root) < 0)
+            return -1;
+
+        memcpy(&c->root, &root, sizeof(vmu_root_t));
+        c->dir_ok = c->fat_ok = 0;
+        c->root_ok = 1;
+    }
+
+    if(dir && !c->dir_ok) {
+        if(!(buf = malloc(vmufs_dir_blocks(&c->root)))) {
+            dbglog(DBG_ERROR, "vmufs_setup: can't alloc %d bytes for dir on device %c%c\n",
+                   vmufs_dir_blocks(&c->root), dev->port + 'A', dev->unit + '0');
+            return -1;
+        }
+
+        if(vmufs_dir_read(dev, &c->root, buf) < 0) {
+            free(buf);
+            return -1;
+        }
+
+        free(c->dir);
+        c->dir = buf;
+        c->dirsize = vmufs_dir_blocks(&c->root);
+        c->dir_ok = 1;
+    }
+
+    if(fat && !c->fat_ok) {
+        if(!(buf = malloc(vmufs_fat_blocks(&c->root)))) {
+            dbglog(DBG_ERROR, "vmufs_setup: can't alloc %d bytes for FAT on device %c%c\n",
+                   vmufs_fat_blocks(&c->root), dev->port + 'A', dev->unit + '0');
+            return -1;
+        }
+
+        if(vmufs_fat_read(dev, &c->root, buf) < 0) {
+            free(buf);
+            return -1;
+        }
+
+        free(c->fat);
+        c->fat = buf;
+        c->fatsize = vmufs_fat_blocks(&c->root);
+        c->fat_ok = 1;
+    }
+
+    return 0;
+}
+
+/* Internal function gets everything setup for you. The root, dir and FAT
+   come from the cache where it has them; the dir and FAT handed back are
+   copies, free for the caller to change (and write back) as it likes. */
 static int vmufs_setup(maple_device_t * dev, vmu_root_t * root, vmu_dir_t ** dir, int * dirsize,
                        uint16 ** fat, int * fatsize) {
+    vmufs_cache_t *c;
+
     /* Check to make sure this is a valid device right now */
     if(!dev || !(dev->info.functions & MAPLE_FUNC_MEMCARD)) {
         if(!dev)
@@ -514,13 +714,17 @@ static int vmufs_setup(maple_device_t * dev, vmu_root_t * root, vmu_dir_t ** dir
 
     vmufs_mutex_lock();
 
-    /* Read its root block */
-    if(!root || vmufs_root_read(dev, root) < 0)
+    c = vmufs_cache_get(dev);
+
+    /* Read in whatever isn't cached */
+    if(!root || vmufs_cache_fill(dev, c, !!dir, !!fat) < 0)
         goto dead;
 
+    memcpy(root, &c->root, sizeof(vmu_root_t));
+
     if(dir) {
         /* Alloc enough space for the whole dir */
-        *dirsize = vmufs_dir_blocks(root);
+        *dirsize = c->dirsize;
         *dir = (vmu_dir_t *)malloc(*dirsize);
 
         if(!*dir) {
@@ -529,20 +733,12 @@ static int vmufs_setup(maple_device_t * dev, vmu_root_t * root, vmu_dir_t ** dir
             goto dead;
         }
 
-        /* Ensure that the dir is 0'd to avoid possible uninitialized reads */
-        memset(*dir, 0, sizeof(*dirsize));
-
-        /* Read it */
-        if(vmufs_dir_read(dev, root, *dir) < 0) {
-            free(*dir);
-            *dir = NULL;
-            goto dead;
-        }
+        memcpy(*dir, c->dir, *dirsize);
     }
 
     if(fat) {
         /* Alloc enough space for the fat */
-        *fatsize = vmufs_fat_blocks(root);
+        *fatsize = c->fatsize;
         *fat = (uint16 *)malloc(*fatsize);
 
         if(!*fat) {
@@ -553,13 +749,7 @@ static int vmufs_setup(maple_device_t * dev, vmu_root_t * root, vmu_dir_t ** dir
             goto dead;
         }
 
-        /* Read it */
-        if(vmufs_fat_read(dev, root, *fat) < 0) {
-            free(*fat);
-            if(dir)
-                free(*dir);
-            goto dead;
-        }
+        memcpy(*fat, c->fat, *fatsize);
     }
 
     /* Ok, everything's cool */
@@ -709,7 +899,8 @@ int vmufs_read_dirent(maple_device_t * dev, vmu_dir_t * dirent, void ** outbuf,
 }
 
 /* Returns 0 for success, -7 for 'not enough space', and other values for other errors. :-)  */
-int vmufs_write(maple_device_t * dev, const char * fn, void * inbuf, int insize, int flags) {
+static int vmufs_write_progress(maple_device_t * dev, const char * fn, void * inbuf, int insize,
+                                int flags, vmufs_progress_t progress, void * data) {
     vmu_root_t  root;
     vmu_dir_t   * dir = NULL, nd;
     uint16      * fat = NULL;
@@ -771,7 +962,8 @@ int vmufs_write(maple_device_t * dev, const char * fn, void * inbuf, int insize,
     // If any of these fail, the action to take can be decided by the caller.
 
     /* Write out the data and update our structs */
-    if((st = vmufs_file_write(dev, &root, fat, dir, &nd, inbuf, insize / 512)) < 0) {
+    if((st = vmufs_file_write_progress(dev, &root, fat, dir, &nd, inbuf, insize / 512,
+                                       progress, data, insize / 512 + 2)) < 0) {
         if(st == -2)
             rv = -7;
         else
@@ -785,6 +977,9 @@ int vmufs_write(maple_device_t * dev, const char * fn, void * inbuf, int insize,
         goto ex;
     }
 
+    if(progress)
+        progress(data, insize / 512 + 1, insize / 512 + 2);
+
     /* This is the critical point. If the dir doesn't save correctly, then
        we may have an unusable card (until it's reformatted) or leaked
        blocks not attached to a file. Cross your fingers! */
@@ -795,12 +990,119 @@ int vmufs_write(maple_device_t * dev, const char * fn, void * inbuf, int insize,
         goto ex;
     }
 
+    if(progress)
+        progress(data, insize / 512 + 2, insize / 512 + 2);
+
     /* Looks like everything was good */
 ex:
     vmufs_teardown(dir, fat);
     return rv;
 }
 
+int vmufs_write(maple_device_t * dev, const char * fn, void * inbuf, int insize, int flags) {
+    return vmufs_write_progress(dev, fn, inbuf, insize, flags, NULL, NULL);
+}
+
+/* Asynchronous writes. These are done one after the other, in the order
+   they were asked for, by a worker thread started on the first of them. */
+typedef struct {
+    kthread_job_t   job;
+    maple_device_t  *dev;
+    char            fn[13];
+    void            *buf;
+    int             size;
+    int             flags;
+    vmufs_progress_t progress;
+    vmufs_done_t    done;
+    void            *data;
+} vmufs_async_t;
+
+static kthread_worker_t *worker;
+static mutex_t worker_mutex = MUTEX_INITIALIZER;
+
+/* Jobs on the worker */
+static size_t jobs;
+
+static void vmufs_worker(void *d) {
+    kthread_job_t *job;
+    vmufs_async_t *req;
+    uint32 flags;
+    int rv;
+
+    (void)d;
+
+    for(;;) {
+        flags = irq_disable();
+
+        if(!jobs) {
+            irq_restore(flags);
+            break;
+        }
+
+        jobs--;
+        job = thd_worker_dequeue_job(worker);
+        irq_restore(flags);
+
+        req = (vmufs_async_t *)job->data;
+        rv = vmufs_write_progress(req->dev, req->fn, req->buf, req->size,
+                                  req->flags, req->progress, req->data);
+
+        if(req->done)
+            req->done(req->data, rv);
+
+        free(req);
+    }
+}
+
+int vmufs_write_async(maple_device_t * dev, const char * fn, void * inbuf, int insize,
+                      int flags, vmufs_progress_t progress, vmufs_done_t done,
+                      void * data) {
+    const kthread_attr_t attr = {
+        .label = "vmufs"
+    };
+    vmufs_async_t *req;
+
+    if(!dev || !fn || !inbuf) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    {
+        mutex_lock_scoped(&worker_mutex);
+
+        if(!worker && !(worker = thd_worker_create_ex(&attr, vmufs_worker, NULL))) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    if(!(req = (vmufs_async_t *)malloc(sizeof(vmufs_async_t)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memset(req, 0, sizeof(vmufs_async_t));
+    req->job.data = req;
+    req->dev = dev;
+    strncpy(req->fn, fn, 12);
+    req->buf = inbuf;
+    req->size = insize;
+    req->flags = flags;
+    req->progress = progress;
+    req->done = done;
+    req->data = data;
+
+    {
+        irq_disable_scoped();
+
+        jobs++;
+        thd_worker_add_job(worker, &req->job);
+        thd_worker_wakeup(worker);
+    }
+
+    return 0;
+}
+
 int vmufs_delete(maple_device_t * dev, const char * fn) {
     vmu_root_t  root;
     vmu_dir_t   * dir = NULL;
@@ -857,11 +1159,34 @@ int vmufs_free_blocks(maple_device_t * dev) {
 
 
 int vmufs_init(void) {
-    mutex_init(&mutex, MUTEX_TYPE_NORMAL);
+    mutex_init(&mutex, MUTEX_TYPE_NORMAL | MUTEX_TYPE_PI);
     return 0;
 }
 
 int vmufs_shutdown(void) {
+    int p, u;
+
+    mutex_lock(&worker_mutex);
+
+    if(worker) {
+        /* Let any writes still queued finish, so no save is cut short */
+        while(jobs)
+            thd_sleep(10);
+
+        thd_worker_destroy(worker);
+        worker = NULL;
+    }
+
+    mutex_unlock(&worker_mutex);
+
+    for(p = 0; p < MAPLE_PORT_COUNT; p++) {
+        for(u = 0; u < MAPLE_UNIT_COUNT; u++) {
+            free(cache[p][u].dir);
+            free(cache[p][u].fat);
+            memset(&cache[p][u], 0, sizeof(vmufs_cache_t));
+        }
+    }
+
     mutex_destroy(&mutex);
     return 0;
 }
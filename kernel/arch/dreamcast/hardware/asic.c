@@ -163,11 +163,13 @@ static void handler_irq9(irq_t source, irq_context_t *context, void *data) {
         /* Short circuit going through the table if none on this reg */
         if(mask == 0) continue;
 
-        /* Search for relevant handlers */
-        for(i = 0; i < ASIC_EVT_REG_HNDS; i++) {
+        /* Go straight to the handlers of the pending events */
+        while(mask) {
+            i = __builtin_ctz(mask);
+            mask &= mask - 1;
             entry = &handlers[reg][i];
 
-            if((mask & BIT(i)) && entry->hdl != NULL)
+            if(entry->hdl != NULL)
                 entry->hdl((reg << 8) | i, entry->data);
         }
     }
@@ -0,0 +1,400 @@
+/* KallistiOS ##version##
+
+   blit.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Fills and blits. VRAM is uncached and takes 16 and 32-bit stores, so runs
+   of pixels go through the store queues where they're 32-byte aligned, and
+   pixel by pixel at either end. Copies large enough to be worth it and laid
+   out as a single block go through channel 3 of the DMA controller, which is
+   kept for memory to memory transfers. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <arch/cache.h>
+#include <arch/dmac.h>
+#include <dc/blit.h>
+#include <dc/sq.h>
+#include <dc/video.h>
+#include <kos/mutex.h>
+
+/* Smallest copy worth doing with DMA */
+#define BLIT_DMA_MIN    2048
+
+/* 16-bit pixels with their fields spread apart, so that all three can be
+   scaled at once in 32 bits */
+#define SPREAD_565      0x07e0f81f
+#define SPREAD_555      0x03e07c1f
+
+static mutex_t dma_mutex = MUTEX_INITIALIZER;
+
+static const dma_config_t blit_dma_cfg = {
+    .channel = DMA_CHANNEL_3,
+    .request = DMA_REQUEST_AUTO_MEM_TO_MEM,
+    .unit_size = DMA_UNITSIZE_32BYTE,
+    .src_mode = DMA_ADDRMODE_INCREMENT,
+    .dst_mode = DMA_ADDRMODE_INCREMENT,
+    .transmit_mode = DMA_TRANSMITMODE_CYCLE_STEAL,
+    .callback = NULL
+};
+
+static inline size_t fmt_bpp(blit_fmt_t fmt) {
+    return fmt == BLIT_FMT_RGB0888 ? 4 : 2;
+}
+
+static inline uint8_t *blit_px(const blit_surface_t *s, int x, int y) {
+    return (uint8_t *)s->pixels + (size_t)y * s->stride +
+           (size_t)x * fmt_bpp(s->fmt);
+}
+
+static inline bool in_vram(const void *p) {
+    return ((uintptr_t)p & 0x1f000000) == 0x05000000;
+}
+
+/* Clip one axis of a rectangle going from s to d */
+static bool clip_axis(int *d, int *s, long *len, size_t dlim, size_t slim) {
+    if(*d < 0) {
+        *len += *d;
+        *s -= *d;
+        *d = 0;
+    }
+
+    if(*s < 0) {
+        *len += *s;
+        *d -= *s;
+        *s = 0;
+    }
+
+    if(*d + *len > (long)dlim)
+        *len = (long)dlim - *d;
+
+    if(*s + *len > (long)slim)
+        *len = (long)slim - *s;
+
+    return *len > 0;
+}
+
+static bool blit_clip(const blit_surface_t *dst, int *dx, int *dy,
+                      const blit_surface_t *src, int *sx, int *sy,
+                      size_t *w, size_t *h) {
+    long lw = (long)*w, lh = (long)*h;
+
+    if(!clip_axis(dx, sx, &lw, dst->width, src->width) ||
+       !clip_axis(dy, sy, &lh, dst->height, src->height))
+        return false;
+
+    *w = lw;
+    *h = lh;
+    return true;
+}
+
+int blit_screen(blit_surface_t *s) {
+    switch(vid_mode->pm) {
+        case PM_RGB555:
+            s->fmt = BLIT_FMT_RGB555;
+            break;
+        case PM_RGB565:
+            s->fmt = BLIT_FMT_RGB565;
+            break;
+        case PM_RGB0888:
+            s->fmt = BLIT_FMT_RGB0888;
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    s->pixels = vram_s;
+    s->width = vid_mode->width;
+    s->height = vid_mode->height;
+    s->stride = s->width * fmt_bpp(s->fmt);
+
+    return 0;
+}
+
+static void fill_px(uint8_t *p, size_t n, uint32_t pat, size_t bpp) {
+    if(bpp == 2) {
+        for(; n; n -= 2, p += 2)
+            *(uint16_t *)p = pat;
+    }
+    else {
+        for(; n; n -= 4, p += 4)
+            *(uint32_t *)p = pat;
+    }
+}
+
+static void fill_span(uint8_t *p, size_t n, uint32_t pat, size_t bpp) {
+    size_t head = (-(uintptr_t)p) & 31, mid;
+
+    /* Store queue writes go around the cache. */
+    if(!in_vram(p)) {
+        fill_px(p, n, pat, bpp);
+        return;
+    }
+
+    if(head > n)
+        head = n;
+
+    fill_px(p, head, pat, bpp);
+    p += head;
+    n -= head;
+
+    if((mid = n & ~31)) {
+        sq_set32(p, pat, mid);
+        p += mid;
+        n -= mid;
+    }
+
+    fill_px(p, n, pat, bpp);
+}
+
+void blit_fill(const blit_surface_t *dst, int x, int y, size_t w, size_t h,
+               uint32_t color) {
+    blit_surface_t all = { NULL, (size_t)-1 / 4, (size_t)-1 / 4, 0, dst->fmt };
+    size_t bpp = fmt_bpp(dst->fmt), row;
+    int sx = 0, sy = 0;
+    uint8_t *p;
+
+    if(!blit_clip(dst, &x, &y, &all, &sx, &sy, &w, &h))
+        return;
+
+    if(bpp == 2)
+        color = (color & 0xffff) | (color << 16);
+
+    p = blit_px(dst, x, y);
+    row = w * bpp;
+
+    /* Full rows are one span. */
+    if(dst->stride == row) {
+        fill_span(p, row * h, color, bpp);
+        return;
+    }
+
+    for(; h; h--, p += dst->stride)
+        fill_span(p, row, color, bpp);
+}
+
+static int copy_dma(void *d, const void *s, size_t n) {
+    mutex_lock_scoped(&dma_mutex);
+
+    if(dma_transfer(&blit_dma_cfg, dma_map_dst(d, n), dma_map_src(s, n), n,
+                    NULL) < 0)
+        return -1;
+
+    dma_wait_complete(DMA_CHANNEL_3);
+
+    return 0;
+}
+
+static void copy_px(uint8_t *d, const uint8_t *s, size_t n, bool backwards) {
+    uint16_t *d16 = (uint16_t *)d;
+    const uint16_t *s16 = (const uint16_t *)s;
+    size_t i;
+
+    n /= 2;
+
+    if(backwards) {
+        for(i = n; i; i--)
+            d16[i - 1] = s16[i - 1];
+    }
+    else {
+        for(i = 0; i < n; i++)
+            d16[i] = s16[i];
+    }
+}
+
+static void copy_row(uint8_t *d, const uint8_t *s, size_t n, bool overlap) {
+    size_t head = (-(uintptr_t)d) & 31, mid;
+
+    if(head > n)
+        head = n;
+
+    if(!in_vram(d)) {
+        memmove(d, s, n);
+        return;
+    }
+
+    /* The store queues read the source 4 bytes at a time. */
+    if(overlap || (((uintptr_t)s + head) & 3)) {
+        copy_px(d, s, n, overlap && d > s);
+        return;
+    }
+
+    copy_px(d, s, head, false);
+    d += head;
+    s += head;
+    n -= head;
+
+    if((mid = n & ~31)) {
+        sq_cpy(d, s, mid);
+        d += mid;
+        s += mid;
+        n -= mid;
+    }
+
+    copy_px(d, s, n, false);
+}
+
+int blit_copy(const blit_surface_t *dst, int dx, int dy,
+              const blit_surface_t *src, int sx, int sy, size_t w, size_t h) {
+    size_t row, n;
+    uint8_t *d;
+    const uint8_t *s;
+    ptrdiff_t dstep, sstep;
+    bool same = dst->pixels == src->pixels;
+
+    if(dst->fmt != src->fmt) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!blit_clip(dst, &dx, &dy, src, &sx, &sy, &w, &h))
+        return 0;
+
+    d = blit_px(dst, dx, dy);
+    s = blit_px(src, sx, sy);
+    row = w * fmt_bpp(dst->fmt);
+    n = row * h;
+
+    if(dst->stride == row && src->stride == row && n >= BLIT_DMA_MIN &&
+       !(((uintptr_t)d | (uintptr_t)s | n) & 31) &&
+       (d + n <= s || s + n <= d) && !copy_dma(d, s, n))
+        return 0;
+
+    dstep = dst->stride;
+    sstep = src->stride;
+
+    /* Scrolling down, start from the bottom. */
+    if(same && d > s) {
+        d += (h - 1) * dstep;
+        s += (h - 1) * sstep;
+        dstep = -dstep;
+        sstep = -sstep;
+    }
+
+    for(; h; h--, d += dstep, s += sstep)
+        copy_row(d, s, row, same && dy == sy);
+
+    return 0;
+}
+
+int blit_colorkey(const blit_surface_t *dst, int dx, int dy,
+                  const blit_surface_t *src, int sx, int sy, size_t w, size_t h,
+                  uint16_t key) {
+    uint16_t *d, p;
+    const uint16_t *s;
+    size_t i;
+
+    if(dst->fmt != src->fmt || fmt_bpp(dst->fmt) != 2) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!blit_clip(dst, &dx, &dy, src, &sx, &sy, &w, &h))
+        return 0;
+
+    for(; h; h--, dy++, sy++) {
+        d = (uint16_t *)blit_px(dst, dx, dy);
+        s = (const uint16_t *)blit_px(src, sx, sy);
+
+        for(i = 0; i < w; i++) {
+            /* Fetch the next cache line while going through this one. */
+            if(!(i & 15))
+                dcache_pref_block(s + i + 16);
+
+            if((p = s[i]) != key)
+                d[i] = p;
+        }
+    }
+
+    return 0;
+}
+
+/* Blend s over d, with a from 0 to 32 */
+static inline uint16_t blend16(uint32_t s, uint32_t d, uint32_t a,
+                               uint32_t spread) {
+    uint32_t fs = (s | (s << 16)) & spread;
+    uint32_t fd = (d | (d << 16)) & spread;
+    uint32_t r = ((((fs - fd) * a) >> 5) + fd) & spread;
+
+    return r | (r >> 16);
+}
+
+/* ARGB4444 to RGB565 or RGB555, without the alpha */
+static inline uint16_t from_4444(uint32_t p, bool is565) {
+    uint32_t r = (p >> 8) & 15, g = (p >> 4) & 15, b = p & 15;
+
+    r = (r << 1) | (r >> 3);
+    b = (b << 1) | (b >> 3);
+
+    if(is565)
+        return (r << 11) | (((g << 2) | (g >> 2)) << 5) | b;
+
+    return (r << 10) | (((g << 1) | (g >> 3)) << 5) | b;
+}
+
+int blit_alpha(const blit_surface_t *dst, int dx, int dy,
+               const blit_surface_t *src, int sx, int sy, size_t w, size_t h,
+               uint8_t alpha) {
+    uint8_t lut[16];
+    uint16_t *d;
+    const uint16_t *s;
+    uint32_t spread, a = 0, p;
+    bool is565 = dst->fmt == BLIT_FMT_RGB565, per_px;
+    size_t i;
+
+    if(dst->fmt != BLIT_FMT_RGB565 && dst->fmt != BLIT_FMT_RGB555) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    per_px = src->fmt == BLIT_FMT_ARGB4444;
+
+    if(!per_px && src->fmt != dst->fmt) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!alpha || !blit_clip(dst, &dx, &dy, src, &sx, &sy, &w, &h))
+        return 0;
+
+    spread = is565 ? SPREAD_565 : SPREAD_555;
+
+    /* Alpha from 0 to 32, for each 4-bit alpha scaled by the constant one
+       (8773 / 2^20 is just over 32 / (15 * 255)). */
+    if(per_px) {
+        for(i = 0; i < 16; i++)
+            lut[i] = (i * alpha * 8773) >> 20;
+    }
+    else {
+        a = (alpha * 32 + 127) / 255;
+    }
+
+    for(; h; h--, dy++, sy++) {
+        d = (uint16_t *)blit_px(dst, dx, dy);
+        s = (const uint16_t *)blit_px(src, sx, sy);
+
+        for(i = 0; i < w; i++) {
+            if(!(i & 15))
+                dcache_pref_block(s + i + 16);
+
+            p = s[i];
+
+            if(per_px) {
+                a = lut[p >> 12];
+                p = from_4444(p, is565);
+            }
+
+            if(a == 32)
+                d[i] = p;
+            else if(a)
+                d[i] = blend16(p, d[i], a, spread);
+        }
+    }
+
+    return 0;
+}
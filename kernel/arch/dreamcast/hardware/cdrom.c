@@ -10,8 +10,10 @@
 
  */
 #include <assert.h>
+#include <stdint.h>
 
 #include <arch/cache.h>
+#include <arch/dmac.h>
 #include <kos/timer.h>
 #include <arch/memory.h>
 #include <arch/irq.h>
@@ -22,10 +24,16 @@
 #include <dc/syscalls.h>
 #include <dc/vblank.h>
 
+#include <kos/genwait.h>
 #include <kos/thread.h>
 #include <kos/mutex.h>
+#include <kos/cond.h>
 #include <kos/sem.h>
 #include <kos/dbglog.h>
+#include <kos/init.h>
+#include <kos/trace.h>
+
+#include <sys/queue.h>
 
 /*
 
@@ -72,17 +80,71 @@ static int32_t cmd_status[4] = {
 static bool dma_in_progress = false;
 static bool dma_blocking = false;
 static bool dma_auto_unlock = false;
+static cdrom_stream_callback_t dma_done_cb = NULL;
+static void *dma_done_param = NULL;
 static semaphore_t dma_done = SEM_INITIALIZER(0);
 static asic_evt_handler_entry_t old_dma_irq = {NULL, NULL};
 static int vblank_hnd = -1;
 
 /* Streaming */
 static int stream_mode = -1;
+static uint32_t stream_seq = 0;
 static cdrom_stream_callback_t stream_cb = NULL;
 static void *stream_cb_param = NULL;
+static size_t stream_bytes = 0;
+
+/* Ring mode: the G1 DMA goes from one buffer to the next by itself, from the
+   DMA interrupt. Buffers go around in order: the ones handed out to the
+   reader, then the full ones waiting for it, then the one being filled, if
+   any, then the free ones. */
+static struct {
+    void *bufs[CDROM_STREAM_RING_MAX];
+    size_t lens[CDROM_STREAM_RING_MAX];
+    size_t count, size;
+    size_t tail;            /* Oldest buffer handed out */
+    size_t held, full;
+    size_t left;            /* Bytes of the stream still to be read */
+    bool active, filling;
+    int err;
+} ring;
+
+static void cdrom_ring_reset(void);
+
+/* Request scheduling. Sector reads queue up here, and whichever caller
+   finds the drive free serves the queue, in order of LBA going up from
+   where the drive last read (C-SCAN), until its own read is done. Reads
+   that carry on from each other are merged into one stream. Any read that
+   has waited past its deadline goes first, earliest deadline first. */
+typedef struct cd_req {
+    TAILQ_ENTRY(cd_req) q;
+    void *buffer;
+    int sector, cnt, mode;
+    uint64_t deadline;
+    int rv;
+    bool done;
+} cd_req_t;
+
+/* Most reads merged into one stream */
+#define SCHED_MERGE     8
+
+static TAILQ_HEAD(cd_req_queue, cd_req) sched_queue =
+    TAILQ_HEAD_INITIALIZER(sched_queue);
+static mutex_t sched_mutex = MUTEX_INITIALIZER;
+static condvar_t sched_cond = COND_INITIALIZER;
+static bool sched_busy = false;
+static int sched_head = 0;
+static unsigned int sched_deadline = CDROM_SCHED_DEADLINE;
 
 /* Initialization */
 static bool inited = false;
+
+/* With INIT_LAZY, the drive is only set up when it is first used */
+static bool reinit_pending = false;
+
+static inline void cdrom_lazy_init(void) {
+    if(__predict_false(reinit_pending))
+        cdrom_reinit();
+}
 static int cur_sector_size = 2048;
 
 /* Shortcut to cdrom_reinit_ex. Typically this is the only thing changed. */
@@ -198,6 +260,9 @@ int cdrom_exec_cmd(int cmd, void *param) {
 
 int cdrom_exec_cmd_timed(int cmd, void *param, uint32_t timeout) {
     int rv = ERR_OK;
+    bool timed_out;
+
+    cdrom_lazy_init();
 
     sem_wait_scoped(&_g1_ata_sem);
     cmd_hnd = cdrom_req_cmd(cmd, param);
@@ -206,8 +271,14 @@ int cdrom_exec_cmd_timed(int cmd, void *param, uint32_t timeout) {
         return ERR_SYS;
     }
 
+    trace_event(TRACE_CDROM_BEGIN, cmd);
+
     /* Start the process of executing the command. */
-    if(cdrom_poll(&cmd_hnd, timeout, cdrom_check_cmd_done) == ERR_TIMEOUT) {
+    timed_out = cdrom_poll(&cmd_hnd, timeout, cdrom_check_cmd_done) == ERR_TIMEOUT;
+
+    trace_event(TRACE_CDROM_END, cmd);
+
+    if(timed_out) {
         cdrom_abort_cmd(1000, true);
         return ERR_TIMEOUT;
     }
@@ -248,7 +319,16 @@ int cdrom_abort_cmd(uint32_t timeout, bool abort_dma) {
         dma_in_progress = false;
         dma_blocking = false;
         dma_auto_unlock = false;
+        ring.filling = false;
         /* G1 ATA mutex already locked */
+
+        /* Whoever is waiting on the transfer still has to hear of it. */
+        if(dma_done_cb) {
+            cdrom_stream_callback_t cb = dma_done_cb;
+
+            dma_done_cb = NULL;
+            cb(dma_done_param);
+        }
     }
     else {
         sem_wait(&_g1_ata_sem);
@@ -266,6 +346,7 @@ int cdrom_abort_cmd(uint32_t timeout, bool abort_dma) {
 
     cmd_hnd = 0;
     stream_mode = -1;
+    cdrom_ring_reset();
 
     if(stream_cb) {
         cdrom_stream_set_callback(0, NULL);
@@ -359,6 +440,8 @@ int cdrom_reinit(void) {
 int cdrom_reinit_ex(int sector_part, int cdxa, int sector_size) {
     int r;
 
+    reinit_pending = false;
+
     do {
         r = cdrom_exec_cmd_timed(CMD_INIT, NULL, 10000);
     } while(r == ERR_DISC_CHG);
@@ -435,7 +518,7 @@ static int cdrom_read_sectors_dma_irq(void *params) {
 }
 
 /* Enhanced Sector reading: Choose mode to read in. */
-int cdrom_read_sectors_ex(void *buffer, int sector, int cnt, int mode) {
+static int read_sectors(void *buffer, int sector, int cnt, int mode) {
     struct {
         int sec, num;
         void *buffer;
@@ -456,15 +539,11 @@ int cdrom_read_sectors_ex(void *buffer, int sector, int cnt, int mode) {
         /* Use the physical memory address. */
         params.buffer = (void *)(buf_addr & MEM_AREA_CACHE_MASK);
 
-        /* Invalidate the CPU cache only for cacheable memory areas.
-           Otherwise, it is assumed that either this operation is unnecessary
-           (another DMA is being used) or that the caller is responsible
-           for managing the CPU data cache.
-        */
-        if((buf_addr & MEM_AREA_P2_BASE) != MEM_AREA_P2_BASE) {
-            /* Invalidate the dcache over the range of the data. */
-            dcache_inval_range(buf_addr, cnt * cur_sector_size);
-        }
+        /* Get the data cache out of the way. Uncached areas are left alone,
+           as it is assumed that either this is unnecessary (another DMA is
+           being used) or that the caller is managing the data cache. */
+        dma_sync_for_device((void *)buf_addr, cnt * cur_sector_size,
+                            DMA_FROM_DEVICE);
         rv = cdrom_read_sectors_dma_irq(&params);
     }
     else if(mode == CDROM_READ_PIO) {
@@ -480,6 +559,146 @@ int cdrom_read_sectors_ex(void *buffer, int sector, int cnt, int mode) {
     return rv;
 }
 
+/* Pick the next reads to do and take them off the queue */
+static int sched_pick(cd_req_t **batch) {
+    uint64_t now = timer_ms_gettime64();
+    cd_req_t *r, *first = NULL, *wrap = NULL;
+    int n = 1, end;
+
+    TAILQ_FOREACH(r, &sched_queue, q) {
+        if(r->deadline <= now) {
+            if(!first || first->deadline > now || r->deadline < first->deadline)
+                first = r;
+        }
+        else if(first && first->deadline <= now) {
+            continue;
+        }
+        else if(r->sector >= sched_head) {
+            if(!first || r->sector < first->sector)
+                first = r;
+        }
+        else if(!wrap || r->sector < wrap->sector) {
+            wrap = r;
+        }
+    }
+
+    if(!first)
+        first = wrap;
+
+    TAILQ_REMOVE(&sched_queue, first, q);
+    batch[0] = first;
+    end = first->sector + first->cnt;
+
+    /* Take whatever carries straight on from there */
+    while(n < SCHED_MERGE) {
+        TAILQ_FOREACH(r, &sched_queue, q) {
+            if(r->sector == end && r->mode == first->mode)
+                break;
+        }
+
+        if(!r)
+            break;
+
+        TAILQ_REMOVE(&sched_queue, r, q);
+        batch[n++] = r;
+        end += r->cnt;
+    }
+
+    return n;
+}
+
+/* Do a batch of reads, as a stream if there's more than one */
+static void sched_read(cd_req_t **batch, int n) {
+    int i, total = 0, rv = ERR_SYS;
+
+    if(n > 1) {
+        for(i = 0; i < n; i++)
+            total += batch[i]->cnt;
+
+        rv = cdrom_stream_start(batch[0]->sector, total, batch[0]->mode);
+
+        if(rv == ERR_OK) {
+            for(i = 0; i < n; i++) {
+                batch[i]->rv = rv;
+
+                if(rv == ERR_OK)
+                    rv = batch[i]->rv = cdrom_stream_request(batch[i]->buffer,
+                        batch[i]->cnt * cur_sector_size, true);
+            }
+
+            cdrom_stream_stop(false);
+        }
+    }
+
+    /* One read, or a stream that couldn't be started */
+    if(rv != ERR_OK) {
+        for(i = 0; i < n; i++)
+            batch[i]->rv = read_sectors(batch[i]->buffer, batch[i]->sector,
+                                        batch[i]->cnt, batch[i]->mode);
+    }
+
+    sched_head = batch[n - 1]->sector + batch[n - 1]->cnt;
+}
+
+int cdrom_read_sectors_deadline(void *buffer, int sector, int cnt, int mode,
+                                unsigned int deadline) {
+    cd_req_t req = {
+        .buffer = buffer,
+        .sector = sector,
+        .cnt = cnt,
+        .mode = mode,
+        .deadline = timer_ms_gettime64() + deadline
+    };
+    cd_req_t *batch[SCHED_MERGE];
+    int i, n;
+
+    cdrom_lazy_init();
+
+    mutex_lock(&sched_mutex);
+    TAILQ_INSERT_TAIL(&sched_queue, &req, q);
+
+    while(!req.done) {
+        if(sched_busy) {
+            cond_wait(&sched_cond, &sched_mutex);
+            continue;
+        }
+
+        /* Serve the queue until our own read is done, then leave it for
+           someone else who's waiting. */
+        sched_busy = true;
+
+        while(!req.done) {
+            n = sched_pick(batch);
+            mutex_unlock(&sched_mutex);
+
+            sched_read(batch, n);
+
+            mutex_lock(&sched_mutex);
+
+            for(i = 0; i < n; i++)
+                batch[i]->done = true;
+
+            cond_broadcast(&sched_cond);
+        }
+
+        sched_busy = false;
+        cond_broadcast(&sched_cond);
+    }
+
+    mutex_unlock(&sched_mutex);
+
+    return req.rv;
+}
+
+int cdrom_read_sectors_ex(void *buffer, int sector, int cnt, int mode) {
+    return cdrom_read_sectors_deadline(buffer, sector, cnt, mode,
+                                       sched_deadline);
+}
+
+void cdrom_set_sched_deadline(unsigned int deadline) {
+    sched_deadline = deadline;
+}
+
 /* Basic old sector read */
 int cdrom_read_sectors(void *buffer, int sector, int cnt) {
     return cdrom_read_sectors_ex(buffer, sector, cnt, CDROM_READ_PIO);
@@ -510,12 +729,236 @@ int cdrom_stream_start(int sector, int cnt, int mode) {
     if(rv != ERR_OK) {
         stream_mode = -1;
     }
+    else {
+        stream_seq++;
+        stream_bytes = cnt == 0x1ff ? SIZE_MAX : (size_t)cnt * cur_sector_size;
+    }
+    return rv;
+}
+
+/* Whether the ring has a free buffer to fill, and data to fill it with. */
+static inline bool cdrom_ring_can_fill(void) {
+    return ring.active && !ring.filling && !dma_in_progress && ring.left &&
+           ring.held + ring.full < ring.count && cmd_hnd > 0;
+}
+
+/* Start filling the next free buffer. Called with interrupts disabled and
+   the G1 bus held, which the DMA interrupt gives back. */
+static void cdrom_ring_fill(void) {
+    size_t slot = (ring.tail + ring.held + ring.full) % ring.count;
+    size_t n = ring.left < ring.size ? ring.left : ring.size;
+    int32_t params[2];
+
+    params[0] = ((uintptr_t)ring.bufs[slot]) & MEM_AREA_CACHE_MASK;
+    params[1] = n;
+    ring.lens[slot] = n;
+
+    dma_in_progress = true;
+    dma_blocking = false;
+    dma_auto_unlock = true;
+    ring.filling = true;
+
+    if(syscall_gdrom_dma_transfer(cmd_hnd, params) < 0) {
+        dma_in_progress = false;
+        dma_auto_unlock = false;
+        ring.filling = false;
+        ring.err = ERR_SYS;
+        sem_signal(&_g1_ata_sem);
+        genwait_wake_all(&ring);
+        return;
+    }
+
+    if(ring.left != SIZE_MAX)
+        ring.left -= n;
+}
+
+/* Fill the next free buffer if the G1 bus is free. Called with interrupts
+   disabled; returns false if the bus is busy. */
+static bool cdrom_ring_kick_locked(void) {
+    if(!cdrom_ring_can_fill())
+        return true;
+
+    if(sem_trywait(&_g1_ata_sem) < 0)
+        return false;
+
+    cdrom_ring_fill();
+    return true;
+}
+
+/* The same, from a thread, waiting for the bus if someone else has it. */
+static void cdrom_ring_kick(void) {
+    int old = irq_disable();
+
+    if(!cdrom_ring_kick_locked()) {
+        irq_restore(old);
+        sem_wait(&_g1_ata_sem);
+        old = irq_disable();
+
+        if(cdrom_ring_can_fill())
+            cdrom_ring_fill();
+        else
+            sem_signal(&_g1_ata_sem);
+    }
+
+    irq_restore(old);
+}
+
+/* The buffer being filled is done with. Called from interrupts, after
+   the G1 bus has been given back. */
+static void cdrom_ring_filled(bool ok) {
+    ring.filling = false;
+
+    if(ok)
+        ring.full++;
+    else
+        ring.err = ERR_SYS;
+
+    /* The drive is done with the stream, whatever was asked for. */
+    if(cmd_response != STREAMING && cmd_response != PROCESSING &&
+       cmd_response != BUSY)
+        ring.left = 0;
+
+    genwait_wake_all(&ring);
+
+    if(ok)
+        cdrom_ring_kick_locked();
+}
+
+static void cdrom_ring_reset(void) {
+    int old = irq_disable();
+
+    if(ring.active) {
+        ring.active = false;
+        genwait_wake_all(&ring);
+    }
+
+    irq_restore(old);
+}
+
+int cdrom_stream_ring_start(void *const *bufs, size_t count, size_t size) {
+    size_t i;
+    int old;
+
+    if(stream_mode != CDROM_READ_DMA || cmd_hnd <= 0 || ring.active ||
+       !count || count > CDROM_STREAM_RING_MAX || !size || (size & 0x1f))
+        return ERR_SYS;
+
+    for(i = 0; i < count; i++) {
+        if(((uintptr_t)bufs[i]) & 0x1f) {
+            dbglog(DBG_ERROR, "cdrom_stream_ring_start: Unaligned memory for DMA (32-byte).\n");
+            return ERR_SYS;
+        }
+
+        dma_sync_for_device(bufs[i], size, DMA_FROM_DEVICE);
+    }
+
+    old = irq_disable();
+
+    for(i = 0; i < count; i++)
+        ring.bufs[i] = bufs[i];
+
+    ring.count = count;
+    ring.size = size;
+    ring.tail = ring.held = ring.full = 0;
+    ring.left = stream_bytes;
+    ring.filling = false;
+    ring.err = ERR_OK;
+    ring.active = true;
+
+    irq_restore(old);
+
+    cdrom_ring_kick();
+    return ERR_OK;
+}
+
+int cdrom_stream_ring_get(void **buf, size_t *size, int timeout) {
+    size_t slot;
+    int old, rv = ERR_OK;
+
+    /* The bus may have been busy when the last transfer ended. */
+    cdrom_ring_kick();
+
+    old = irq_disable();
+
+    while(!ring.full) {
+        if(!ring.active || ring.err != ERR_OK ||
+           (!ring.filling && !ring.left)) {
+            rv = ring.err != ERR_OK ? ring.err : ERR_NO_ACTIVE;
+            break;
+        }
+
+        /* Every buffer is with the reader, nothing can come in. */
+        if(ring.held == ring.count) {
+            rv = ERR_SYS;
+            break;
+        }
+
+        if(genwait_wait(&ring, "cdrom_stream_ring_get", timeout, NULL) < 0) {
+            rv = ERR_TIMEOUT;
+            break;
+        }
+    }
+
+    if(rv == ERR_OK) {
+        slot = (ring.tail + ring.held) % ring.count;
+        ring.full--;
+        ring.held++;
+        *buf = ring.bufs[slot];
+
+        if(size)
+            *size = ring.lens[slot];
+    }
+
+    irq_restore(old);
     return rv;
 }
 
+int cdrom_stream_ring_put(void) {
+    void *buf;
+    int old = irq_disable();
+
+    if(!ring.active || !ring.held) {
+        irq_restore(old);
+        return ERR_SYS;
+    }
+
+    buf = ring.bufs[ring.tail];
+    irq_restore(old);
+
+    /* Nothing can fill it before it's handed back, so the cache can be
+       dealt with first. */
+    dma_sync_for_device(buf, ring.size, DMA_FROM_DEVICE);
+
+    old = irq_disable();
+    ring.tail = (ring.tail + 1) % ring.count;
+    ring.held--;
+    irq_restore(old);
+
+    cdrom_ring_kick();
+    return ERR_OK;
+}
+
+int cdrom_stream_ring_stop(void) {
+    int old = irq_disable();
+    bool filling = ring.filling;
+
+    ring.active = false;
+    genwait_wake_all(&ring);
+    irq_restore(old);
+
+    return cdrom_stream_stop(filling);
+}
+
+uint32_t cdrom_stream_seq(void) {
+    return stream_seq;
+}
+
 int cdrom_stream_stop(bool abort_dma) {
     int rv = ERR_OK;
 
+    /* Don't let the ring start another transfer in the meantime. */
+    cdrom_ring_reset();
+
     if(cmd_hnd <= 0) {
         return rv;
     }
@@ -560,9 +1003,7 @@ int cdrom_stream_request(void *buffer, size_t size, bool block) {
             dbglog(DBG_ERROR, "cdrom_stream_request: Unaligned memory for DMA (32-byte).\n");
             return ERR_SYS;
         }
-        if((params[0] >> 24) == 0x0c) {
-            dcache_inval_range((uintptr_t)buffer, size);
-        }
+        dma_sync_for_device(buffer, size, DMA_FROM_DEVICE);
     }
     else {
         params[0] = (uintptr_t)buffer;
@@ -614,6 +1055,25 @@ int cdrom_stream_request(void *buffer, size_t size, bool block) {
     return rv;
 }
 
+int cdrom_stream_request_async(void *buffer, size_t size,
+                               cdrom_stream_callback_t done, void *data) {
+    int rv;
+
+    if(stream_mode != CDROM_READ_DMA) {
+        return ERR_SYS;
+    }
+
+    dma_done_cb = done;
+    dma_done_param = data;
+    rv = cdrom_stream_request(buffer, size, false);
+
+    if(rv != ERR_OK) {
+        dma_done_cb = NULL;
+    }
+
+    return rv;
+}
+
 int cdrom_stream_progress(size_t *size) {
     int rv = 0;
     size_t check_size = 0;
@@ -753,6 +1213,11 @@ static void cdrom_vblank(uint32 evt, void *data) {
                 sem_signal(&dma_done);
                 thd_schedule(true);
             }
+            else if(ring.filling) {
+                dma_auto_unlock = false;
+                sem_signal(&_g1_ata_sem);
+                cdrom_ring_filled(cmd_response == COMPLETED);
+            }
         }
     }
 }
@@ -774,6 +1239,16 @@ static void g1_dma_irq_hnd(uint32_t code, void *data) {
         else if(dma_auto_unlock) {
             sem_signal(&_g1_ata_sem);
             dma_auto_unlock = false;
+
+            if(dma_done_cb) {
+                cdrom_stream_callback_t cb = dma_done_cb;
+
+                dma_done_cb = NULL;
+                cb(dma_done_param);
+            }
+
+            if(ring.filling)
+                cdrom_ring_filled(code == ASIC_EVT_GD_DMA);
         }
         if(stream_mode != -1) {
             syscall_gdrom_dma_callback((uintptr_t)stream_cb, stream_cb_param);
@@ -862,10 +1337,13 @@ void cdrom_init(void) {
         asic_evt_enable(ASIC_EVT_GD_DMA_ILLADDR, ASIC_IRQB);
     }
 
-    vblank_hnd = vblank_handler_add(cdrom_vblank, NULL);
+    vblank_hnd = vblank_handler_add_ex(cdrom_vblank, NULL, VBLANK_PRIO_LOW, 0);
     inited = true;
 
-    cdrom_reinit();
+    if(__kos_init_flags & INIT_LAZY)
+        reinit_pending = true;
+    else
+        cdrom_reinit();
 }
 
 void cdrom_shutdown(void) {
@@ -8,12 +8,17 @@
 #include <arch/dmac.h>
 #include <arch/irq.h>
 #include <arch/memory.h>
+#include <arch/ocram.h>
 #include <kos/dbglog.h>
 #include <kos/genwait.h>
 #include <kos/platform.h>
 #include <kos/regfield.h>
+#include <kos/timer.h>
+#include <kos/trace.h>
 
 #include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
 
 #define DMAC_BASE       0xffa00000
 
@@ -48,7 +53,23 @@ enum dmaor_pr_mode {
     DMAOR_PR_ROUND_ROBIN,
 };
 
-static const dma_config_t *channels_cfg[4];
+TAILQ_HEAD(dma_req_queue, dma_req);
+
+typedef struct dma_chan {
+    dma_config_t cfg;           /* Configuration of a dma_transfer() */
+    void *cb_data;              /* And the argument to its callback */
+    bool direct;                /* A dma_transfer() is in flight */
+    dma_unitsize_t unit_size;   /* Unit of whatever was programmed last */
+
+    dma_req_t *cur;             /* The queued request being transferred */
+    struct dma_req_queue queue; /* The ones waiting, by priority */
+    uint32_t queued;
+    uint64_t start_ns;
+
+    dma_stats_t stats;
+} dma_chan_t;
+
+static dma_chan_t chans[4];
 
 static const irq_t channel_to_irq[] = {
     [0] = EXC_DMAC_DMTE0,
@@ -73,21 +94,135 @@ dma_addr_t hw_to_dma_addr(uintptr_t hw_addr) {
     return (dma_addr_t)(hw_addr & MEM_AREA_CACHE_MASK);
 }
 
-static dma_addr_t dma_map_src_dst(uintptr_t addr, size_t len, bool is_dst) {
+/* Scratch space for dcache_purge_all_with_buffer(), allocated the first time
+   a sync is big enough to want it. Its contents never matter. */
+static void *purge_buf;
+
+static size_t purge_buf_size(void) {
+    return ocram_enabled() ? CACHE_L1_DCACHE_SIZE / 2 : CACHE_L1_DCACHE_SIZE;
+}
+
+/* Purge the whole data cache, if there is a buffer to do it with. */
+static bool dma_purge_all(void) {
+    void *buf;
+
+    if(!purge_buf) {
+        if(irq_inside_int())
+            return false;
+
+        buf = memalign(32, purge_buf_size());
+        if(!buf)
+            return false;
+
+        irq_disable_scoped();
+
+        if(purge_buf)
+            free(buf);
+        else
+            purge_buf = buf;
+    }
+
+    dcache_purge_all_with_buffer((uintptr_t)purge_buf, purge_buf_size());
+    return true;
+}
+
+static bool dma_is_cached(uintptr_t addr) {
     switch(addr & ~MEM_AREA_CACHE_MASK) {
     case MEM_AREA_P0_BASE:
     case MEM_AREA_P1_BASE:
     case MEM_AREA_P3_BASE:
-        if(is_dst)
-            dcache_inval_range(addr, len);
-        else
-            dcache_flush_range(addr, len);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+void dma_sync_for_device(const void *ptr, size_t len, dma_dir_t dir) {
+    uintptr_t addr = (uintptr_t)ptr;
+
+    if(!len || !dma_is_cached(addr))
+        return;
+
+    if(len > DMA_SYNC_ALL_THRESHOLD && dma_purge_all())
+        return;
+
+    switch(dir) {
+    case DMA_TO_DEVICE:
+        dcache_flush_range(addr, len);
+        break;
+
+    case DMA_FROM_DEVICE:
+        /* Only whole lines can be thrown away. Ones that are shared with
+           something else get written back first. */
+        if(addr & (CACHE_L1_DCACHE_LINESIZE - 1))
+            dcache_purge_range(addr, 1);
+        if((addr + len) & (CACHE_L1_DCACHE_LINESIZE - 1))
+            dcache_purge_range(addr + len - 1, 1);
+
+        dcache_inval_range(addr, len);
         break;
 
     default:
-        /* Nothing to do */
+        dcache_purge_range(addr, len);
         break;
     }
+}
+
+void dma_sync_for_cpu(const void *ptr, size_t len, dma_dir_t dir) {
+    uintptr_t addr = (uintptr_t)ptr;
+
+    if(dir == DMA_TO_DEVICE || !len || !dma_is_cached(addr))
+        return;
+
+    /* Anything cached now was pulled in while the device was at work, and
+       is clean, so dropping it all is as good as dropping the range. */
+    if(len > DMA_SYNC_ALL_THRESHOLD && dma_purge_all())
+        return;
+
+    dcache_inval_range(addr, len);
+}
+
+void *dma_alloc_coherent(size_t size, dma_addr_t *handle, unsigned int flags) {
+    uintptr_t addr;
+    void *ptr;
+
+    size = (size + CACHE_L1_DCACHE_LINESIZE - 1) &
+           ~(CACHE_L1_DCACHE_LINESIZE - 1);
+
+    ptr = memalign(CACHE_L1_DCACHE_LINESIZE, size ?: CACHE_L1_DCACHE_LINESIZE);
+    if(!ptr) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    addr = (uintptr_t)ptr;
+
+    if(handle)
+        *handle = hw_to_dma_addr(addr);
+
+    if(flags & DMA_ALLOC_CACHED)
+        return ptr;
+
+    /* Nothing written through the cached alias may be left dirty, or it
+       would land on top of the device's data some time later. */
+    dcache_purge_range(addr, size);
+
+    return (void *)((addr & MEM_AREA_CACHE_MASK) | MEM_AREA_P2_BASE);
+}
+
+void dma_free_coherent(void *ptr) {
+    uintptr_t addr = (uintptr_t)ptr;
+
+    if((addr & ~MEM_AREA_CACHE_MASK) == MEM_AREA_P2_BASE)
+        addr = (addr & MEM_AREA_CACHE_MASK) | MEM_AREA_P1_BASE;
+
+    free((void *)addr);
+}
+
+static dma_addr_t dma_map_src_dst(uintptr_t addr, size_t len, bool is_dst) {
+    dma_sync_for_device((const void *)addr, len,
+                        is_dst ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
 
     return hw_to_dma_addr(addr);
 }
@@ -108,19 +243,120 @@ static const unsigned char dma_unit_size[] = {
     [DMA_UNITSIZE_32BYTE] = 32,
 };
 
+static void dma_irq_handler(irq_t code, irq_context_t *context, void *d);
+
+/* Program the channel. The IRQ is always taken, as that is how the queue
+   moves on. Called with IRQs disabled. */
+static void dma_program(dma_channel_t channel, const dma_config_t *cfg,
+                        dma_addr_t dst, dma_addr_t src, size_t len) {
+    unsigned int transfer_size = dma_unit_size[cfg->unit_size];
+    dma_chan_t *ch = &chans[channel];
+    uint32_t chcr;
+
+    ch->unit_size = cfg->unit_size;
+
+    dmac_write(channel, DMA_REG_CHCR, 0);
+    dmac_write(channel, DMA_REG_SAR, src);
+    dmac_write(channel, DMA_REG_DAR, dst);
+    dmac_write(channel, DMA_REG_TCR, len >> __builtin_ctz(transfer_size));
+
+    irq_set_handler(channel_to_irq[channel], dma_irq_handler, ch);
+
+    chcr = FIELD_PREP(REG_CHCR_DST_ADDRMODE, cfg->dst_mode)
+        | FIELD_PREP(REG_CHCR_SRC_ADDRMODE, cfg->src_mode)
+        | FIELD_PREP(REG_CHCR_REQUEST, cfg->request)
+        | FIELD_PREP(REG_CHCR_TRANSMIT_MODE, cfg->transmit_mode)
+        | FIELD_PREP(REG_CHCR_BUSWIDTH, cfg->unit_size)
+        | FIELD_PREP(REG_CHCR_INTERRUPT_EN, 1)
+        | FIELD_PREP(REG_CHCR_DMAC_EN, 1);
+
+    trace_event(TRACE_DMA_START, channel);
+    dmac_write(channel, DMA_REG_CHCR, chcr);
+
+    ch->stats.bytes += len;
+}
+
+/* Start the next segment of the current request */
+static void dma_req_program(dma_channel_t channel, dma_req_t *req) {
+    const dma_sg_t *sg = &req->sg[req->sg_next++];
+
+    dma_program(channel, &req->cfg, sg->dst, sg->src, sg->len);
+    chans[channel].stats.segments++;
+}
+
+/* Start the request at the head of the queue, if the channel is free.
+   Called with IRQs disabled. */
+static void dma_queue_run(dma_channel_t channel) {
+    dma_chan_t *ch = &chans[channel];
+    dma_req_t *req;
+
+    if(ch->cur || ch->direct || dma_is_running(channel))
+        return;
+
+    req = TAILQ_FIRST(&ch->queue);
+
+    if(!req)
+        return;
+
+    TAILQ_REMOVE(&ch->queue, req, entry);
+    ch->queued--;
+
+    ch->cur = req;
+    ch->start_ns = timer_ns_gettime64();
+    req->state = DMA_REQ_RUNNING;
+
+    dma_req_program(channel, req);
+}
+
+/* Take the current request off the channel */
+static void dma_req_finish(dma_chan_t *ch, dma_req_t *req,
+                           dma_req_state_t state) {
+    ch->cur = NULL;
+    ch->stats.busy_ns += timer_ns_gettime64() - ch->start_ns;
+
+    if(state == DMA_REQ_DONE)
+        ch->stats.requests++;
+    else
+        ch->stats.cancelled++;
+
+    req->state = state;
+    genwait_wake_all(req);
+}
+
 static void dma_irq_handler(irq_t code, irq_context_t *context, void *d) {
-    unsigned char channel = irq_to_channel(code);
+    dma_channel_t channel = irq_to_channel(code);
+    dma_chan_t *ch = d;
+    dma_req_t *req = ch->cur;
 
     (void)context;
 
     /* ACK the IRQ by clearing CHCR */
     dmac_write(channel, DMA_REG_CHCR, 0);
+    trace_event(TRACE_DMA_DONE, channel);
+
+    if(req) {
+        /* Straight on to the next segment, if there is one */
+        if(req->sg_next < req->sg_count) {
+            dma_req_program(channel, req);
+            return;
+        }
+
+        dma_req_finish(ch, req, DMA_REQ_DONE);
 
-    genwait_wake_all((void *)&channels_cfg[channel]);
+        if(req->cfg.callback)
+            req->cfg.callback(req->data);
+    }
+    else if(ch->direct) {
+        ch->direct = false;
 
-    if(channels_cfg[channel]->callback) {
-        channels_cfg[channel]->callback(d);
+        if(ch->cfg.callback)
+            ch->cfg.callback(ch->cb_data);
     }
+
+    /* Unless a callback chained another transfer itself */
+    dma_queue_run(channel);
+
+    genwait_wake_all(ch);
 }
 
 bool dma_is_running(dma_channel_t channel) {
@@ -129,20 +365,29 @@ bool dma_is_running(dma_channel_t channel) {
     return (chcr & (REG_CHCR_TRANSFER_END | REG_CHCR_DMAC_EN)) == REG_CHCR_DMAC_EN;
 }
 
+/* Is anything programmed or waiting on the channel? */
+static bool dma_chan_busy(dma_channel_t channel) {
+    const dma_chan_t *ch = &chans[channel];
+
+    return ch->cur || !TAILQ_EMPTY(&ch->queue) || dma_is_running(channel);
+}
+
 void dma_wait_complete(dma_channel_t channel) {
     irq_disable_scoped();
 
-    while(dma_is_running(channel)) {
-        if(!irq_inside_int()) {
-            genwait_wait(&channels_cfg[channel], "DMA complete wait", 0, NULL);
-        }
+    if(irq_inside_int()) {
+        while(dma_is_running(channel));
+        return;
     }
+
+    while(dma_chan_busy(channel))
+        genwait_wait(&chans[channel], "DMA complete wait", 0, NULL);
 }
 
 int dma_transfer(const dma_config_t *cfg, dma_addr_t dst, dma_addr_t src,
                  size_t len, void *cb_data) {
     unsigned int transfer_size = dma_unit_size[cfg->unit_size];
-    uint32_t chcr;
+    dma_chan_t *ch = &chans[cfg->channel];
 
     if(!__is_aligned((src|dst|len), transfer_size)) {
         dbglog(DBG_ERROR, "dmac: src=0x%08x dst=0x%08x len=%u not aligned to %u bytes\n",
@@ -153,44 +398,170 @@ int dma_transfer(const dma_config_t *cfg, dma_addr_t dst, dma_addr_t src,
 
     irq_disable_scoped();
 
+    if(irq_inside_int() && (ch->cur || !TAILQ_EMPTY(&ch->queue))) {
+        errno = EBUSY;
+        return -1;
+    }
+
     dma_wait_complete(cfg->channel);
-    channels_cfg[cfg->channel] = cfg;
 
-    dmac_write(cfg->channel, DMA_REG_CHCR, 0);
-    dmac_write(cfg->channel, DMA_REG_SAR, src);
-    dmac_write(cfg->channel, DMA_REG_DAR, dst);
-    dmac_write(cfg->channel, DMA_REG_TCR, len >> __builtin_ctz(transfer_size));
+    /* Keep a copy, the caller's might be on its stack */
+    ch->cfg = *cfg;
+    ch->cb_data = cb_data;
+    ch->direct = true;
+    ch->stats.transfers++;
 
-    irq_set_handler(channel_to_irq[cfg->channel], dma_irq_handler, cb_data);
+    dma_program(cfg->channel, cfg, dst, src, len);
 
-    chcr = FIELD_PREP(REG_CHCR_DST_ADDRMODE, cfg->dst_mode)
-        | FIELD_PREP(REG_CHCR_SRC_ADDRMODE, cfg->src_mode)
-        | FIELD_PREP(REG_CHCR_REQUEST, cfg->request)
-        | FIELD_PREP(REG_CHCR_TRANSMIT_MODE, cfg->transmit_mode)
-        | FIELD_PREP(REG_CHCR_BUSWIDTH, cfg->unit_size)
-        | FIELD_PREP(REG_CHCR_INTERRUPT_EN, !!cfg->callback)
-        | FIELD_PREP(REG_CHCR_DMAC_EN, 1);
+    return 0;
+}
+
+int dma_req_submit(dma_req_t *req) {
+    unsigned int transfer_size;
+    dma_channel_t channel = req->cfg.channel;
+    dma_chan_t *ch;
+    dma_req_t *it;
+    size_t i;
+
+    if((channel != DMA_CHANNEL_1 && channel != DMA_CHANNEL_3) ||
+       !req->sg || !req->sg_count) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    transfer_size = dma_unit_size[req->cfg.unit_size];
+
+    for(i = 0; i < req->sg_count; i++) {
+        if(!__is_aligned((req->sg[i].src | req->sg[i].dst | req->sg[i].len),
+                         transfer_size)) {
+            dbglog(DBG_ERROR, "dmac: segment %u of request not aligned to %u bytes\n",
+                   (unsigned int)i, transfer_size);
+            errno = EFAULT;
+            return -1;
+        }
+    }
+
+    ch = &chans[channel];
+
+    irq_disable_scoped();
+
+    if(req->state == DMA_REQ_QUEUED || req->state == DMA_REQ_RUNNING) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    req->sg_next = 0;
+    req->state = DMA_REQ_QUEUED;
+
+    /* After everything of the same priority */
+    TAILQ_FOREACH(it, &ch->queue, entry) {
+        if(it->prio > req->prio)
+            break;
+    }
+
+    if(it)
+        TAILQ_INSERT_BEFORE(it, req, entry);
+    else
+        TAILQ_INSERT_TAIL(&ch->queue, req, entry);
+
+    if(++ch->queued > ch->stats.max_queued)
+        ch->stats.max_queued = ch->queued;
 
-    dmac_write(cfg->channel, DMA_REG_CHCR, chcr);
+    dma_queue_run(channel);
 
     return 0;
 }
 
+int dma_req_wait(dma_req_t *req, unsigned int timeout) {
+    if(irq_inside_int()) {
+        errno = EPERM;
+        return -1;
+    }
+
+    irq_disable_scoped();
+
+    if(req->state == DMA_REQ_IDLE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while(req->state == DMA_REQ_QUEUED || req->state == DMA_REQ_RUNNING) {
+        if(genwait_wait(req, "DMA request wait", timeout, NULL) < 0)
+            return -1;
+    }
+
+    if(req->state == DMA_REQ_CANCELLED) {
+        errno = ECANCELED;
+        return -1;
+    }
+
+    return 0;
+}
+
+int dma_req_cancel(dma_req_t *req) {
+    dma_channel_t channel = req->cfg.channel;
+    dma_chan_t *ch = &chans[channel];
+
+    irq_disable_scoped();
+
+    if(req->state == DMA_REQ_QUEUED) {
+        TAILQ_REMOVE(&ch->queue, req, entry);
+        ch->queued--;
+        ch->stats.cancelled++;
+        req->state = DMA_REQ_CANCELLED;
+        genwait_wake_all(req);
+    }
+    else if(req->state == DMA_REQ_RUNNING && ch->cur == req) {
+        dmac_write(channel, DMA_REG_CHCR, 0);
+        dma_req_finish(ch, req, DMA_REQ_CANCELLED);
+        dma_queue_run(channel);
+    }
+    else {
+        errno = EINVAL;
+        return -1;
+    }
+
+    genwait_wake_all(ch);
+
+    return 0;
+}
+
+void dma_get_stats(dma_channel_t channel, dma_stats_t *stats) {
+    irq_disable_scoped();
+
+    *stats = chans[channel].stats;
+}
+
 size_t dma_transfer_get_remaining(dma_channel_t channel) {
-    unsigned char unit_size = channels_cfg[channel]->unit_size;
+    unsigned char unit_size = chans[channel].unit_size;
     uint32_t tcr = dmac_read(channel, DMA_REG_TCR);
 
     return tcr * dma_unit_size[unit_size];
 }
 
 void dma_transfer_abort(dma_channel_t channel) {
+    dma_chan_t *ch = &chans[channel];
+
     irq_disable_scoped();
 
     dmac_write(channel, DMA_REG_CHCR, 0);
-    genwait_wake_all((void *)&channels_cfg[channel]);
+    ch->direct = false;
+
+    /* A queued request goes, but the rest of the queue carries on */
+    if(ch->cur) {
+        dma_req_finish(ch, ch->cur, DMA_REQ_CANCELLED);
+        dma_queue_run(channel);
+    }
+
+    genwait_wake_all(ch);
 }
 
 void dma_init(void) {
+    int i;
+
+    for(i = 0; i < 4; i++)
+        TAILQ_INIT(&chans[i].queue);
+
     /* Set default settings for DMA #2.
      * These are set by the bios on Dreamcast, but should be set by the OS
      * on Naomi. */
@@ -0,0 +1,224 @@
+/* KallistiOS ##version##
+
+   kernel/arch/dreamcast/hardware/fast_memcpy.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* memcpy(), with the copy done whichever way suits the destination best.
+   This replaces Newlib's memcpy(), which knows nothing of the store queues or
+   movca.l, so it must not itself call memcpy(), nor have GCC turn any of its
+   loops into calls to it. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <arch/cache.h>
+#include <arch/irq.h>
+#include <arch/memory.h>
+#include <arch/mmu.h>
+#include <dc/memcpy.h>
+#include <dc/sq.h>
+
+#define NO_LIBCALLS __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+/* Cache control register */
+#define CCR         (*(volatile uint32_t *)(void *)0xff00001c)
+#define CCR_OCE     (1 << 0)    /* Operand cache enabled */
+#define CCR_WT      (1 << 1)    /* P0/U0/P3 write-through */
+#define CCR_CB      (1 << 2)    /* P1 copy-back */
+
+/* The external memory areas that matter here */
+#define AREA_MASK   0x1c000000
+#define AREA_VRAM   0x04000000
+#define AREA_RAM    0x0c000000
+
+typedef uint32_t __attribute__((__may_alias__)) word_t;
+typedef uint16_t __attribute__((__may_alias__)) half_t;
+
+void __fast_memcpy_lines(void *dest, const void *src, size_t n);
+
+typedef enum {
+    DEST_PLAIN,     /* Word or byte at a time */
+    DEST_CACHED,    /* movca.l and fmov.d */
+    DEST_SQ         /* Store queues */
+} dest_kind_t;
+
+static dest_kind_t dest_kind(const void *dest) {
+    const uintptr_t addr = (uintptr_t)dest;
+    const uintptr_t phys = addr & MEM_AREA_CACHE_MASK;
+    uint32_t ccr;
+    bool cached;
+
+    if(addr >= MEM_AREA_P4_BASE)
+        return DEST_PLAIN;
+
+    /* Only P1 and P2 are sure to be what they look like with the MMU on */
+    if((addr < MEM_AREA_P1_BASE || addr >= MEM_AREA_P3_BASE) && mmu_enabled())
+        return DEST_PLAIN;
+
+    /* Sound RAM is left alone: store queue bursts onto G2 have to hold the
+       bus against DMA and PIO, which is spu_memload_sq()'s business. */
+    if((phys & AREA_MASK) == AREA_VRAM)
+        return irq_inside_int() ? DEST_PLAIN : DEST_SQ;
+
+    if((phys & AREA_MASK) != AREA_RAM)
+        return DEST_PLAIN;
+
+    ccr = CCR;
+
+    if(addr >= MEM_AREA_P2_BASE && addr < MEM_AREA_P3_BASE)
+        cached = false;
+    else if(addr >= MEM_AREA_P1_BASE && addr < MEM_AREA_P2_BASE)
+        cached = (ccr & (CCR_OCE | CCR_CB)) == (CCR_OCE | CCR_CB);
+    else
+        cached = (ccr & (CCR_OCE | CCR_WT)) == CCR_OCE;
+
+    if(cached)
+        return DEST_CACHED;
+
+    /* Write-through is left alone, as movca.l won't allocate there */
+    if(!(ccr & CCR_OCE) || (addr >= MEM_AREA_P2_BASE && addr < MEM_AREA_P3_BASE))
+        return irq_inside_int() ? DEST_PLAIN : DEST_SQ;
+
+    return DEST_PLAIN;
+}
+
+/* Copy with the widest accesses the relative alignment of dest and src
+   allows. Aligned halfwords and words are always copied as such. */
+static NO_LIBCALLS void copy_plain(uint8_t *d, const uint8_t *s, size_t n) {
+    const uintptr_t diff = (uintptr_t)d ^ (uintptr_t)s;
+    const word_t *ws;
+    uint32_t w0, w1;
+    unsigned int sh;
+
+    if(!(diff & 3)) {
+        if(n && ((uintptr_t)d & 1)) {
+            *d++ = *s++;
+            n--;
+        }
+
+        if(n >= 2 && ((uintptr_t)d & 2)) {
+            *(half_t *)d = *(const half_t *)s;
+            d += 2;
+            s += 2;
+            n -= 2;
+        }
+
+        for(; n >= 4; n -= 4, d += 4, s += 4)
+            *(word_t *)d = *(const word_t *)s;
+
+        if(n >= 2) {
+            *(half_t *)d = *(const half_t *)s;
+            d += 2;
+            s += 2;
+            n -= 2;
+        }
+    }
+    else if(!(diff & 1)) {
+        if(n && ((uintptr_t)d & 1)) {
+            *d++ = *s++;
+            n--;
+        }
+
+        for(; n >= 2; n -= 2, d += 2, s += 2)
+            *(half_t *)d = *(const half_t *)s;
+    }
+    else if(n >= 16) {
+        /* Odd offset: align dest, then build each word of it out of two
+           aligned words of src. The reads never leave the aligned word
+           holding the last byte, so they can't run off the end of a page. */
+        while((uintptr_t)d & 3) {
+            *d++ = *s++;
+            n--;
+        }
+
+        sh = ((uintptr_t)s & 3) * 8;
+        ws = (const word_t *)((uintptr_t)s & ~3);
+        w0 = *ws++;
+
+        for(; n >= 4; n -= 4, d += 4, s += 4) {
+            w1 = *ws++;
+            *(word_t *)d = (w0 >> sh) | (w1 << (32 - sh));
+            w0 = w1;
+        }
+    }
+
+    while(n--)
+        *d++ = *s++;
+}
+
+/* Copy whole lines through the cache, allocating each rather than reading
+   it in. dest is 32-byte aligned and src 4-byte aligned. */
+static void copy_lines32(word_t *d, const word_t *s, size_t lines) {
+    while(lines--) {
+        dcache_pref_block(s + 8);
+        dcache_alloc_block(d, s[0]);
+        d[1] = s[1];
+        d[2] = s[2];
+        d[3] = s[3];
+        d[4] = s[4];
+        d[5] = s[5];
+        d[6] = s[6];
+        d[7] = s[7];
+        d += 8;
+        s += 8;
+    }
+}
+
+/* Split off the head that brings dest to a 32-byte boundary. Returns the
+   number of bytes of whole lines that follow, or 0 if the rest has to be
+   copied the plain way since src can't be word aligned along with dest. */
+static size_t copy_head(uint8_t **d, const uint8_t **s, size_t *n) {
+    size_t head = (-(uintptr_t)*d) & 31;
+
+    if(head) {
+        copy_plain(*d, *s, head);
+        *d += head;
+        *s += head;
+        *n -= head;
+    }
+
+    if(((uintptr_t)*d ^ (uintptr_t)*s) & 3)
+        return 0;
+
+    return *n & ~31;
+}
+
+void *fast_memcpy(void *__RESTRICT dest, const void *__RESTRICT src, size_t n) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+    dest_kind_t kind;
+    size_t bytes;
+
+    kind = n < FAST_MEMCPY_THRESHOLD ? DEST_PLAIN : dest_kind(dest);
+
+    if(kind != DEST_PLAIN && (bytes = copy_head(&d, &s, &n))) {
+        if(kind == DEST_CACHED) {
+            if(!((uintptr_t)s & 7))
+                __fast_memcpy_lines(d, s, bytes >> 5);
+            else
+                copy_lines32((word_t *)d, (const word_t *)s, bytes >> 5);
+        }
+        else {
+            /* Hold the lock across the wait, so nobody else's data is
+               sitting in the queues when it happens */
+            sq_lock(d);
+            sq_cpy(d, s, bytes);
+            sq_wait();
+            sq_unlock();
+        }
+
+        d += bytes;
+        s += bytes;
+        n -= bytes;
+    }
+
+    copy_plain(d, s, n);
+
+    return dest;
+}
+
+void *memcpy(void *__RESTRICT dest, const void *__RESTRICT src, size_t n) {
+    return fast_memcpy(dest, src, n);
+}
@@ -0,0 +1,46 @@
+! KallistiOS ##version##
+!
+! arch/dreamcast/hardware/fast_memcpy_lines.s
+! Copyright (C) 2026 KallistiOS Contributors
+!
+! Copies whole 32-byte lines into cacheable RAM. Each destination line is
+! allocated in the operand cache with movca.l, so that it isn't read in from
+! RAM just to be overwritten, then filled with pair single-precision moves.
+!
+
+.globl ___fast_memcpy_lines
+
+!
+! void __fast_memcpy_lines(void *dest, const void *src, size_t n);
+!
+! r4: dest (32-byte aligned, cacheable, copy-back address)
+! r5: src (8-byte aligned address)
+! r6: n (how many 32-byte lines to copy)
+!
+    .align 2
+___fast_memcpy_lines:
+    tst    r6, r6
+    bt     .exit       ! Exit if size is 0
+    pref   @r5         ! Prefetch the first line
+    fschg              ! Change to pair single-precision data
+1:
+    movca.l r0, @r4    ! Allocate the line without fetching it
+    fmov.d @r5+, dr0
+    mov    r4, r1
+    fmov.d @r5+, dr2
+    add    #32, r1
+    fmov.d @r5+, dr4
+    add    #32, r4
+    fmov.d @r5+, dr6
+    pref   @r5         ! Prefetch 32 bytes for next loop
+    dt     r6          ! while(n--)
+    fmov.d dr6, @-r1
+    fmov.d dr4, @-r1
+    fmov.d dr2, @-r1
+    bf.s   1b
+    fmov.d dr0, @-r1   ! Overwrites what movca.l stored
+
+    fschg
+.exit:
+    rts
+    nop
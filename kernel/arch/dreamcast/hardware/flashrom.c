@@ -20,8 +20,38 @@
 #include <dc/flashrom.h>
 #include <dc/syscalls.h>
 #include <kos/dbglog.h>
+#include <kos/mutex.h>
 #include <arch/irq.h>
 
+/* An index of each block allocated partition, built the first time a block
+   is looked up in it: the latest physical block with a good checksum for
+   each logical block ID. Writes and deletes bump the generation, which
+   throws away every index and the cached ISP settings. */
+typedef struct {
+    uint16  id;             /* Logical block ID */
+    uint16  phys;           /* Physical block holding its latest version */
+} block_ent_t;
+
+typedef struct {
+    uint32      gen;        /* Generation this was built at, 0 if never */
+    int         rv;         /* Result of the scan */
+    int         start;      /* Offset of the partition */
+    int         count;      /* Number of logical blocks found */
+    block_ent_t *ents;
+} block_index_t;
+
+#define FLASHROM_PARTS  (FLASHROM_PT_BLOCK_2 + 1)
+
+/* Number of blocks read at once while building an index */
+#define SCAN_BLOCKS     16
+
+static block_index_t block_index[FLASHROM_PARTS];
+static flashrom_ispcfg_t isp_cache;
+static int isp_cache_rv;
+static uint32 isp_cache_gen;
+static volatile uint32 flash_gen = 1;
+static mutex_t cache_mutex = RECURSIVE_MUTEX_INITIALIZER;
+
 static void strcpy_no_term(char *dest, const char *src, size_t destsize) {
     size_t srclength;
 
@@ -72,6 +102,7 @@ int flashrom_write(int offset, void * buffer, int bytes) {
 
     old = irq_disable();
     rv = syscall_flashrom_write(offset, buffer, bytes);
+    flash_gen++;
     irq_restore(old);
     return rv;
 }
@@ -81,6 +112,7 @@ int flashrom_delete(int offset) {
 
     old = irq_disable();
     rv = syscall_flashrom_delete(offset);
+    flash_gen++;
     irq_restore(old);
     return rv;
 }
@@ -106,12 +138,21 @@ static int flashrom_calc_crc(uint8 * buffer) {
     return (~n) & 0xffff;
 }
 
-int flashrom_get_block(int partid, int blockid, uint8 * buffer_out) {
+/* Scan a partition and (re)build its index. */
+static int flashrom_index_part(int partid, block_index_t *idx) {
     int start, size;
     int bmcnt;
     char magic[18];
-    uint8 * bitmap;
-    int i;
+    uint8 * bitmap, * blocks;
+    block_ent_t * ents;
+    uint32 gen = flash_gen;
+    int i, j, k, n, e, count;
+    uint16 crc;
+
+    free(idx->ents);
+    idx->ents = NULL;
+    idx->count = 0;
+    idx->gen = 0;
 
     /* First, figure out where the partition is located. */
     if(flashrom_info(partid, &start, &size))
@@ -156,14 +197,14 @@ int flashrom_get_block(int partid, int blockid, uint8 * buffer_out) {
         return FLASHROM_ERR_READ_BITMAP;
     }
 
-    /* Go through all the allocated blocks, and look for the latest one
-       that has a matching logical block ID. We'll start at the end since
-       that's easiest to deal with. Block 0 is the magic block, so we
-       won't check that. */
+    /* Go through all the allocated blocks to find the first unused one.
+       Block 0 is the magic block, so we won't check that. */
     for(i = 0; i < bmcnt * 8; i++) {
-        /* Little shortcut */
-        if(bitmap[i / 8] == 0)
-            i += 8;
+        /* Little shortcut: skip over fully used bytes */
+        if(!(i % 8) && bitmap[i / 8] == 0) {
+            i += 7;
+            continue;
+        }
 
         if(bitmap[i / 8] & (0x80 >> (i % 8)))
             break;
@@ -172,40 +213,111 @@ int flashrom_get_block(int partid, int blockid, uint8 * buffer_out) {
     /* Done with the bitmap, free it. */
     free(bitmap);
 
+    idx->start = start;
+
     /* All blocks unused -> file not found. Note that this is probably
        a very unusual condition. */
-    if(i == 0)
-        return FLASHROM_ERR_EMPTY_PART;
+    if(i == 0) {
+        idx->rv = FLASHROM_ERR_EMPTY_PART;
+        idx->gen = gen;
+        return idx->rv;
+    }
 
     i--;    /* 'i' was the first unused block, so back up one */
 
-    for(; i > 0; i--) {
-        /* Read the block; +1 because bitmap block zero is actually
-           _user_ block zero, which is physical block 1. */
-        if(flashrom_read(start + (i + 1) * 64, buffer_out, 64) < 0) {
-            dbglog(DBG_ERROR, "flashrom_get_block: can't read part %d phys block %d\n", partid, i + 1);
+    ents = (block_ent_t *)malloc((i ? i : 1) * sizeof(block_ent_t));
+    blocks = (uint8 *)malloc(SCAN_BLOCKS * 64);
+
+    if(!ents || !blocks) {
+        free(ents);
+        free(blocks);
+        return FLASHROM_ERR_NOMEM;
+    }
+
+    /* Read the used blocks in order, so that later versions of a logical
+       block replace the earlier ones. +1 because bitmap block zero is
+       actually _user_ block zero, which is physical block 1. */
+    for(j = 1, count = 0; j <= i; j += n) {
+        n = i - j + 1 > SCAN_BLOCKS ? SCAN_BLOCKS : i - j + 1;
+
+        if(flashrom_read(start + (j + 1) * 64, blocks, n * 64) < 0) {
+            dbglog(DBG_ERROR, "flashrom_get_block: can't read part %d phys block %d\n", partid, j + 1);
+            free(ents);
+            free(blocks);
             return FLASHROM_ERR_READ_BLOCK;
         }
 
-        /* Does the block ID match? */
-        if(*((uint16*)buffer_out) != blockid)
-            continue;
+        for(k = 0; k < n; k++) {
+            uint8 * block = blocks + k * 64;
 
-        /* Check the checksum to make sure it's valid */
-        bmcnt = flashrom_calc_crc(buffer_out);
+            /* Check the checksum to make sure it's valid */
+            crc = flashrom_calc_crc(block);
 
-        if(bmcnt != *((uint16*)(buffer_out + FLASHROM_OFFSET_CRC))) {
-            dbglog(DBG_WARNING, "flashrom_get_block: part %d phys block %d has invalid checksum %04x (should be %04x)\n",
-                   partid, i + 1, *((uint16*)(buffer_out + FLASHROM_OFFSET_CRC)), bmcnt);
-            continue;
+            if(crc != *((uint16*)(block + FLASHROM_OFFSET_CRC))) {
+                dbglog(DBG_WARNING, "flashrom_get_block: part %d phys block %d has invalid checksum %04x (should be %04x)\n",
+                       partid, j + k + 1, *((uint16*)(block + FLASHROM_OFFSET_CRC)), crc);
+                continue;
+            }
+
+            for(e = 0; e < count && ents[e].id != *((uint16*)block); e++)
+                ;
+
+            if(e == count)
+                ents[count++].id = *((uint16*)block);
+
+            ents[e].phys = j + k + 1;
         }
+    }
+
+    free(blocks);
 
-        /* Ok, looks like we got it! */
-        return FLASHROM_ERR_NONE;
+    /* Give back what we didn't use. */
+    if(count) {
+        block_ent_t * shrunk = (block_ent_t *)realloc(ents, count * sizeof(block_ent_t));
+
+        idx->ents = shrunk ? shrunk : ents;
+    }
+    else {
+        free(ents);
+    }
+
+    idx->count = count;
+    idx->rv = FLASHROM_ERR_NONE;
+    idx->gen = gen;
+
+    return FLASHROM_ERR_NONE;
+}
+
+int flashrom_get_block(int partid, int blockid, uint8 * buffer_out) {
+    block_index_t * idx;
+    int i, rv;
+
+    if(partid < 0 || partid >= FLASHROM_PARTS)
+        return FLASHROM_ERR_NO_PARTITION;
+
+    mutex_lock_scoped(&cache_mutex);
+
+    idx = &block_index[partid];
+    rv = idx->gen == flash_gen ? idx->rv : flashrom_index_part(partid, idx);
+
+    if(rv < 0)
+        return rv;
+
+    for(i = 0; i < idx->count; i++) {
+        if(idx->ents[i].id == blockid)
+            break;
     }
 
     /* Didn't find anything */
-    return FLASHROM_ERR_NOT_FOUND;
+    if(i == idx->count)
+        return FLASHROM_ERR_NOT_FOUND;
+
+    if(flashrom_read(idx->start + idx->ents[i].phys * 64, buffer_out, 64) < 0) {
+        dbglog(DBG_ERROR, "flashrom_get_block: can't read part %d phys block %d\n", partid, idx->ents[i].phys);
+        return FLASHROM_ERR_READ_BLOCK;
+    }
+
+    return FLASHROM_ERR_NONE;
 }
 
 /* This internal function returns the system config block. As far as I
@@ -395,7 +507,7 @@ typedef struct {
     };
 } isp_settings_t;
 
-int flashrom_get_ispcfg(flashrom_ispcfg_t * out) {
+static int flashrom_load_ispcfg(flashrom_ispcfg_t * out) {
     uint8 buffer[sizeof(isp_settings_t)];
     isp_settings_t * isp = (isp_settings_t *)buffer;
     int found = 0;
@@ -533,6 +645,23 @@ int flashrom_get_ispcfg(flashrom_ispcfg_t * out) {
     return found > 0 ? 0 : -1;
 }
 
+int flashrom_get_ispcfg(flashrom_ispcfg_t * out) {
+    uint32 gen;
+
+    mutex_lock_scoped(&cache_mutex);
+
+    /* Only parse the settings again if the flashrom was written since. */
+    if(isp_cache_gen != flash_gen) {
+        gen = flash_gen;
+        isp_cache_rv = flashrom_load_ispcfg(&isp_cache);
+        isp_cache_gen = gen;
+    }
+
+    memcpy(out, &isp_cache, sizeof(flashrom_ispcfg_t));
+
+    return isp_cache_rv;
+}
+
 /* Structure of the ISP configuration blocks created by PlanetWeb (confirmed on
    version 1.0 and 2.1; some fields are longer on 2.1, but they always extend
    into what would be padding in 1.0). */
@@ -14,12 +14,13 @@
 
 #include <kos/dbglog.h>
 #include <kos/sem.h>
+#include <kos/genwait.h>
 #include <kos/mutex.h>
 #include <kos/thread.h>
 
 #include <kos/timer.h>
 #include <arch/arch.h>
-#include <arch/cache.h>
+#include <arch/dmac.h>
 #include <arch/irq.h>
 #include <arch/memory.h>
 
@@ -69,6 +70,7 @@ static struct {
     uint16_t heads;
     uint16_t sectors;
     uint16_t wdma_modes;
+    uint16_t multiple;
 } device;
 
 /* The type of the dev_data in the block device structure */
@@ -131,9 +133,14 @@ typedef struct ata_devdata {
 #define ATA_CMD_READ_SECTORS        0x20
 #define ATA_CMD_READ_SECTORS_EXT    0x24
 #define ATA_CMD_READ_DMA_EXT        0x25
+#define ATA_CMD_READ_MULTIPLE_EXT   0x29
 #define ATA_CMD_WRITE_SECTORS       0x30
 #define ATA_CMD_WRITE_SECTORS_EXT   0x34
 #define ATA_CMD_WRITE_DMA_EXT       0x35
+#define ATA_CMD_WRITE_MULTIPLE_EXT  0x39
+#define ATA_CMD_READ_MULTIPLE       0xC4
+#define ATA_CMD_WRITE_MULTIPLE      0xC5
+#define ATA_CMD_SET_MULTIPLE        0xC6
 #define ATA_CMD_READ_DMA            0xC8
 #define ATA_CMD_WRITE_DMA           0xCA
 #define ATA_CMD_FLUSH_CACHE         0xE7
@@ -182,6 +189,14 @@ static uint8_t dma_cmd = 0;
 static size_t dma_nb_sectors = 0;
 static uint64_t dma_sector = 0;
 static semaphore_t dma_done = SEM_INITIALIZER(0);
+static kos_blockdev_req_t *dma_req = NULL;
+
+/* Block device requests waiting for the DMA engine, in order of sector. While
+   dma_queue_active is set, the G1 mutex is held on the queue's behalf, and
+   each request's completion starts the next. */
+static kos_blockdev_req_t *dma_queue = NULL;
+static uint64_t dma_queue_pos = 0;
+static int dma_queue_active = 0;
 static asic_evt_handler_entry_t old_dma_irq;
 
 /* From cdrom.c */
@@ -238,7 +253,13 @@ static void g1_ata_set_sector_and_count(uint64_t sector, size_t count, int lba28
     OUT8(G1_ATA_LBA_HIGH, (uint8_t)((sector >> 16) & 0xFF));
 }
 
-static void g1_dma_done(void) {
+static int dma_start(uint64_t sector, size_t count, uint32_t addr, int write,
+                      int block);
+static void dma_queue_next(void);
+
+static void g1_dma_done(int err) {
+    kos_blockdev_req_t *req = dma_req, *next;
+
     /* Signal the calling thread to continue, if it is blocking. */
     if(dma_blocking) {
         sem_signal(&dma_done);
@@ -247,9 +268,35 @@ static void g1_dma_done(void) {
     }
 
     dma_in_progress = 0;
+    dma_req = NULL;
 
-    /* Make sure to select the GD-ROM drive back. */
-    g1_ata_mutex_unlock();
+    if(!req) {
+        /* Make sure to select the GD-ROM drive back. */
+        g1_ata_mutex_unlock();
+        return;
+    }
+
+    /* Complete the block device requests this transfer was for. This is done
+       before looking at the queue, so anything their callbacks submit goes
+       straight onto it. */
+    for(; req; req = next) {
+        next = req->next;
+        req->status = err ? EIO : 0;
+        genwait_wake_all(req);
+
+        if(req->callback)
+            req->callback(req);
+    }
+
+    /* Keep the DMA engine busy if there's more queued, without letting go of
+       the bus in between. */
+    if(dma_queue) {
+        dma_queue_next();
+    }
+    else {
+        dma_queue_active = 0;
+        g1_ata_mutex_unlock();
+    }
 }
 
 static void g1_dma_irq_hnd(uint32 code, void *data) {
@@ -271,7 +318,7 @@ static void g1_dma_irq_hnd(uint32 code, void *data) {
         /* If there is an error, stop the DMA chain. */
         if(status & (G1_ATA_SR_ERR | G1_ATA_SR_DF)) {
             dbglog(DBG_ERROR, "g1_dma_irq_hnd: Error detected in DMA chain, aborting\n");
-            g1_dma_done();
+            g1_dma_done(1);
             return;
         }
 
@@ -294,7 +341,9 @@ static void g1_dma_irq_hnd(uint32 code, void *data) {
         OUT32(G1_ATA_DMA_STATUS, 1);
     }
     else if(dma_in_progress) {
-        g1_dma_done();
+        /* Nobody is waiting to ack the IRQ for a request, so do it here. */
+        status = dma_req ? IN8(G1_ATA_STATUS_REG) : 0;
+        g1_dma_done(status & (G1_ATA_SR_ERR | G1_ATA_SR_DF));
     }
     else {
         if(old_dma_irq.hdl) {
@@ -558,6 +607,8 @@ int g1_ata_read_lba(uint64_t sector, size_t count, void *buf) {
     uint8_t *ptr = (uint8_t *)buf;
     int lba28, cmd;
     const size_t max_sectors = CAN_USE_LBA48() ? ATA_MAX_SECTORS_LBA48 : ATA_MAX_SECTORS_LBA28;
+    const size_t multiple = device.multiple > 1 ? device.multiple : 1;
+    size_t per;
 
     /* Make sure that we've been initialized and there's a disk attached. */
     if(!devices) {
@@ -593,11 +644,12 @@ int g1_ata_read_lba(uint64_t sector, size_t count, void *buf) {
         if(lba28) {
             g1_ata_select_device(G1_ATA_SLAVE | G1_ATA_LBA_MODE |
                                  ((sector >> 24) & 0x0F));
-            cmd = ATA_CMD_READ_SECTORS;
+            cmd = multiple > 1 ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ_SECTORS;
         }
         else {
             g1_ata_select_device(G1_ATA_SLAVE | G1_ATA_LBA_MODE);
-            cmd = ATA_CMD_READ_SECTORS_EXT;
+            cmd = multiple > 1 ? ATA_CMD_READ_MULTIPLE_EXT :
+                                 ATA_CMD_READ_SECTORS_EXT;
         }
 
         /* Write out the number of sectors we want and the LBA. */
@@ -610,8 +662,11 @@ int g1_ata_read_lba(uint64_t sector, size_t count, void *buf) {
         /* Write out the command to the device. */
         OUT8(G1_ATA_COMMAND_REG, cmd);
 
-        /* Now, wait for the drive to give us back each sector. */
-        for(i = 0; i < nsects; ++i, ++sector) {
+        /* Now, wait for the drive to give us back each sector, or each block
+           of sectors with READ MULTIPLE. */
+        for(i = 0; i < nsects; i += per, sector += per) {
+            per = nsects - i < multiple ? nsects - i : multiple;
+
             /* Wait for data */
             if(g1_ata_wait_drq()) {
                 dbglog(DBG_KDEBUG, "g1_ata_read_lba: error reading sector %d "
@@ -621,7 +676,7 @@ int g1_ata_read_lba(uint64_t sector, size_t count, void *buf) {
                 goto out;
             }
 
-            for(j = 0; j < 256; ++j) {
+            for(j = 0; j < 256 * per; ++j) {
                 word = IN16(G1_ATA_DATA);
                 ptr[0] = word;
                 ptr[1] = word >> 8;
@@ -638,11 +693,93 @@ out:
     return rv;
 }
 
+/* Program and start a DMA transfer. The G1 mutex must be held, and the DMA
+   state variables set up for it. */
+static int dma_start(uint64_t sector, size_t count, uint32_t addr, int write,
+                     int block) {
+    int lba28, can_lba48 = CAN_USE_LBA48();
+    uint8_t cmd;
+
+    if(!can_lba48 && count > ATA_MAX_SECTORS_LBA28)
+        count = ATA_MAX_SECTORS_LBA28;
+
+    /* Wait for the device to signal it is ready. */
+    g1_ata_wait_bsydrq();
+
+    /* Which mode are we using: LBA28 or LBA48? */
+    lba28 = !can_lba48 || use_lba28(sector, count);
+    if(lba28) {
+        g1_ata_select_device(G1_ATA_SLAVE | G1_ATA_LBA_MODE |
+                             ((sector >> 24) & 0x0F));
+        cmd = write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+    }
+    else {
+        g1_ata_select_device(G1_ATA_SLAVE | G1_ATA_LBA_MODE);
+        cmd = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    }
+
+    /* Write out the number of sectors we want and the LBA. */
+    g1_ata_set_sector_and_count(sector, count, lba28);
+
+    /* Do the rest of the work... */
+    return dma_common(cmd, count, addr,
+                      write ? G1_DMA_TO_DEVICE : G1_DMA_TO_MEMORY, block);
+}
+
+/* Start the next transfer from the queue. Carrying on up the disk from where
+   the last one ended (going back to the lowest sector queued once there's
+   nothing past it), it takes the first request along with every one after it
+   that carries on from it both on the disk and in memory, up to the most one
+   command can transfer. The G1 mutex must be held on the queue's behalf. */
+static void dma_queue_next(void) {
+    kos_blockdev_req_t **first = &dma_queue, **pp, *req, *last;
+    const size_t max = CAN_USE_LBA48() ? ATA_MAX_SECTORS_LBA48 :
+                                         ATA_MAX_SECTORS_LBA28;
+    size_t count;
+    int old;
+
+    old = irq_disable();
+
+    for(pp = &dma_queue; *pp; pp = &(*pp)->next) {
+        if((*pp)->dev_block >= dma_queue_pos) {
+            first = pp;
+            break;
+        }
+    }
+
+    req = last = *first;
+    count = req->count;
+
+    while(last->next && last->next->write == req->write &&
+          last->next->dev_block == last->dev_block + last->count &&
+          (uint8_t *)last->next->buf == (uint8_t *)last->buf +
+                                        last->count * 512 &&
+          count + last->next->count <= max) {
+        last = last->next;
+        count += last->count;
+    }
+
+    /* Take them off the queue, leaving them linked together for the IRQ
+       handler to complete. */
+    *first = last->next;
+    last->next = NULL;
+    dma_queue_pos = req->dev_block + count;
+
+    dma_blocking = 0;
+    dma_req = req;
+    dma_in_progress = 1;
+    dma_nb_sectors = count;
+    dma_sector = req->dev_block;
+    irq_restore(old);
+
+    dma_start(req->dev_block, count,
+              ((uintptr_t)req->buf) & MEM_AREA_CACHE_MASK, req->write, 0);
+}
+
 int g1_ata_read_lba_dma(uint64_t sector, size_t count, void *buf,
                         int block) {
-    int lba28, old, can_lba48 = CAN_USE_LBA48();
+    int old;
     uintptr_t addr;
-    uint8_t cmd;
 
     /* Make sure we're actually being asked to do work... */
     if(!count)
@@ -692,15 +829,10 @@ int g1_ata_read_lba_dma(uint64_t sector, size_t count, void *buf,
         return -1;
     }
 
-    /* Invalidate the CPU cache only for cacheable memory areas.
-       Otherwise, it is assumed that either this operation is unnecessary
-       (another DMA is being used) or that the caller is responsible
-       for managing the CPU data cache.
-    */
-    if((addr & MEM_AREA_P2_BASE) != MEM_AREA_P2_BASE) {
-        /* Invalidate the dcache over the range of the data. */
-        dcache_inval_range(addr, count * 512);
-    }
+    /* Get the data cache out of the way. Uncached areas are left alone, as
+       it is assumed that either this is unnecessary (another DMA is being
+       used) or that the caller is managing the data cache. */
+    dma_sync_for_device(buf, count * 512, DMA_FROM_DEVICE);
 
     /* Use the physical memory address. */
     addr &= MEM_AREA_CACHE_MASK;
@@ -728,29 +860,7 @@ int g1_ata_read_lba_dma(uint64_t sector, size_t count, void *buf,
     dma_sector = sector;
     irq_restore(old);
 
-    if(!can_lba48 && count > ATA_MAX_SECTORS_LBA28)
-        count = ATA_MAX_SECTORS_LBA28;
-
-    /* Wait for the device to signal it is ready. */
-    g1_ata_wait_bsydrq();
-
-    /* Which mode are we using: LBA28 or LBA48? */
-    lba28 = !can_lba48 || use_lba28(sector, count);
-    if(lba28) {
-        g1_ata_select_device(G1_ATA_SLAVE | G1_ATA_LBA_MODE |
-                             ((sector >> 24) & 0x0F));
-        cmd = ATA_CMD_READ_DMA;
-    }
-    else {
-        g1_ata_select_device(G1_ATA_SLAVE | G1_ATA_LBA_MODE);
-        cmd = ATA_CMD_READ_DMA_EXT;
-    }
-
-    /* Write out the number of sectors we want and the LBA. */
-    g1_ata_set_sector_and_count(sector, count, lba28);
-
-    /* Do the rest of the work... */
-    return dma_common(cmd, count, addr, G1_DMA_TO_MEMORY, block);
+    return dma_start(sector, count, addr, 0, block);
 }
 
 int g1_ata_write_lba(uint64_t sector, size_t count, const void *buf) {
@@ -760,6 +870,8 @@ int g1_ata_write_lba(uint64_t sector, size_t count, const void *buf) {
     uint8_t *ptr = (uint8_t *)buf;
     int cmd, lba28;
     const size_t max_sectors = CAN_USE_LBA48() ? ATA_MAX_SECTORS_LBA48 : ATA_MAX_SECTORS_LBA28;
+    const size_t multiple = device.multiple > 1 ? device.multiple : 1;
+    size_t per;
 
     /* Make sure that we've been initialized and there's a disk attached. */
     if(!devices) {
@@ -795,11 +907,13 @@ int g1_ata_write_lba(uint64_t sector, size_t count, const void *buf) {
         if(lba28) {
             g1_ata_select_device(G1_ATA_SLAVE | G1_ATA_LBA_MODE |
                                  ((sector >> 24) & 0x0F));
-            cmd = ATA_CMD_WRITE_SECTORS;
+            cmd = multiple > 1 ? ATA_CMD_WRITE_MULTIPLE :
+                                 ATA_CMD_WRITE_SECTORS;
         }
         else {
             g1_ata_select_device(G1_ATA_SLAVE | G1_ATA_LBA_MODE);
-            cmd = ATA_CMD_WRITE_SECTORS_EXT;
+            cmd = multiple > 1 ? ATA_CMD_WRITE_MULTIPLE_EXT :
+                                 ATA_CMD_WRITE_SECTORS_EXT;
         }
 
         /* Write out the number of sectors we want and the LBA. */
@@ -808,13 +922,16 @@ int g1_ata_write_lba(uint64_t sector, size_t count, const void *buf) {
         /* Write out the command to the device. */
         OUT8(G1_ATA_COMMAND_REG, cmd);
 
-        /* Now, send the drive each sector. */
-        for(i = 0; i < nsects; ++i, ++sector) {
+        /* Now, send the drive each sector, or each block of sectors with
+           WRITE MULTIPLE. */
+        for(i = 0; i < nsects; i += per, sector += per) {
+            per = nsects - i < multiple ? nsects - i : multiple;
+
             /* Wait for the device to signal it is ready. */
             g1_ata_wait_nbsy();
 
             /* Send the data! */
-            for(j = 0; j < 256; ++j) {
+            for(j = 0; j < 256 * per; ++j) {
                 word = ptr[0] | (ptr[1] << 8);
                 OUT16(G1_ATA_DATA, word);
                 ptr += 2;
@@ -832,7 +949,7 @@ int g1_ata_write_lba(uint64_t sector, size_t count, const void *buf) {
 
 int g1_ata_write_lba_dma(uint64_t sector, size_t count, const void *buf,
                          int block) {
-    int cmd, lba28, old, can_lba48 = CAN_USE_LBA48();
+    int old;
     uintptr_t addr;
 
     /* Make sure we're actually being asked to do work... */
@@ -883,15 +1000,10 @@ int g1_ata_write_lba_dma(uint64_t sector, size_t count, const void *buf,
         return -1;
     }
 
-    /* Flush the CPU cache only for cacheable memory areas.
-       Otherwise, it is assumed that either this operation is unnecessary
-       (another DMA is being used) or that the caller is responsible
-       for managing the CPU data cache.
-    */
-    if((addr & MEM_AREA_P2_BASE) != MEM_AREA_P2_BASE) {
-        /* Flush the dcache over the range of the data. */
-        dcache_flush_range(addr, count * 512);
-    }
+    /* Write back the data cache. Uncached areas are left alone, as it is
+       assumed that either this is unnecessary (another DMA is being used) or
+       that the caller is managing the data cache. */
+    dma_sync_for_device(buf, count * 512, DMA_TO_DEVICE);
 
     /* Use the physical memory address. */
     addr &= MEM_AREA_CACHE_MASK;
@@ -919,29 +1031,7 @@ int g1_ata_write_lba_dma(uint64_t sector, size_t count, const void *buf,
     dma_sector = sector;
     irq_restore(old);
 
-    /* Wait for the device to signal it is ready. */
-    g1_ata_wait_bsydrq();
-
-    /* Which mode are we using: LBA28 or LBA48? */
-    lba28 = !can_lba48 || use_lba28(sector, count);
-    if(lba28) {
-        g1_ata_select_device(G1_ATA_SLAVE | G1_ATA_LBA_MODE |
-                             ((sector >> 24) & 0x0F));
-        cmd = ATA_CMD_WRITE_DMA;
-        if(count > ATA_MAX_SECTORS_LBA28) {
-            count = ATA_MAX_SECTORS_LBA28;
-        }
-    }
-    else {
-        g1_ata_select_device(G1_ATA_SLAVE | G1_ATA_LBA_MODE);
-        cmd = ATA_CMD_WRITE_DMA_EXT;
-    }
-
-    /* Write out the number of sectors we want and the LBA. */
-    g1_ata_set_sector_and_count(sector, count, lba28);
-
-    /* Do the rest of the work... */
-    return dma_common(cmd, count, addr, G1_DMA_TO_DEVICE, block);
+    return dma_start(sector, count, addr, 1, block);
 }
 
 int g1_ata_flush(void) {
@@ -1014,6 +1104,29 @@ static int g1_ata_set_transfer_mode(uint8_t mode) {
     return 0;
 }
 
+static int g1_ata_set_multiple(uint8_t count) {
+    uint8_t status;
+
+    OUT8(G1_ATA_SECTOR_COUNT, count);
+
+    /* Send the SET MULTIPLE MODE command. */
+    OUT8(G1_ATA_COMMAND_REG, ATA_CMD_SET_MULTIPLE);
+    thd_sleep(1);
+
+    /* Wait for command completion. */
+    g1_ata_wait_nbsy();
+
+    /* See if the command completed. */
+    status = IN8(G1_ATA_STATUS_REG);
+
+    if((status & G1_ATA_SR_ERR) || (status & G1_ATA_SR_DF)) {
+        dbglog(DBG_KDEBUG, "Error setting multiple count %d\n", count);
+        return -1;
+    }
+
+    return 0;
+}
+
 static int g1_ata_scan(void) {
     uint8_t dsel = IN8(G1_ATA_DEVICE_SELECT), st;
     int rv, i;
@@ -1065,6 +1178,7 @@ static int g1_ata_scan(void) {
     device.command_sets = (uint32_t)(data[82]) | ((uint32_t)(data[83]) << 16);
     device.capabilities = (uint32_t)(data[49]) | ((uint32_t)(data[50]) << 16);
     device.wdma_modes = data[63];
+    device.multiple = data[47] & 0xFF;
 
     /* See if we support LBA mode or not... */
     if(!(device.capabilities & (1 << 9))) {
@@ -1118,6 +1232,15 @@ static int g1_ata_scan(void) {
         device.wdma_modes = 0;
     }
 
+    /* If the drive can move more than one sector per DRQ, have PIO transfers
+       use READ/WRITE MULTIPLE with as many as it allows (which should be a
+       power of two). */
+    while(device.multiple & (device.multiple - 1))
+        device.multiple &= device.multiple - 1;
+
+    if(device.multiple > 1 && g1_ata_set_multiple(device.multiple))
+        device.multiple = 0;
+
 out:
     OUT8(G1_ATA_DEVICE_SELECT, dsel);
     g1_ata_mutex_unlock();
@@ -1190,6 +1313,119 @@ static int atab_write_blocks_dma(kos_blockdev_t *d, uint64_t block,
     return g1_ata_write_lba_dma(block + data->start_block, count, buf, 1);
 }
 
+static int atab_submit_dma(kos_blockdev_t *d, kos_blockdev_req_t *req) {
+    ata_devdata_t *data = (ata_devdata_t *)d->dev_data;
+    kos_blockdev_req_t **pp, *r, *next;
+    uintptr_t addr = (uintptr_t)req->buf;
+    int old, start, err;
+
+    if(req->block + req->count > data->end_block ||
+       req->count > ATA_MAX_SECTORS_LBA48) {
+        errno = EOVERFLOW;
+        return -1;
+    }
+
+    if(addr & 0x1F) {
+        dbglog(DBG_ERROR, "atab_submit_dma: Unaligned buffer address\n");
+        errno = EFAULT;
+        return -1;
+    }
+
+    req->status = EINPROGRESS;
+
+    /* With nothing to transfer, there won't be an IRQ to complete it. */
+    if(!req->count) {
+        req->status = 0;
+
+        if(req->callback)
+            req->callback(req);
+
+        return 0;
+    }
+
+    /* Get the cache out of the way now, as the transfer may well be started
+       from the IRQ handler. */
+    dma_sync_for_device((void *)addr, req->count * 512,
+                        req->write ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+
+    req->dev_block = req->block + data->start_block;
+
+    /* Queue it up in order of sector, after any for the same sector. If the
+       queue is already running, the IRQ handler will get to it. */
+    old = irq_disable();
+
+    for(pp = &dma_queue; *pp && (*pp)->dev_block <= req->dev_block;
+        pp = &(*pp)->next) {
+    }
+
+    req->next = *pp;
+    *pp = req;
+    start = !dma_queue_active;
+    dma_queue_active = 1;
+    irq_restore(old);
+
+    if(!start)
+        return 0;
+
+    /* Otherwise, get the bus for the queue. This waits for anything else using
+       it, such as the CD drive, to finish. */
+    if(g1_ata_mutex_lock()) {
+        /* Fail everything that was queued up in the meantime. */
+        err = errno;
+        old = irq_disable();
+        r = dma_queue;
+        dma_queue = NULL;
+        dma_queue_active = 0;
+        irq_restore(old);
+
+        for(; r; r = next) {
+            next = r->next;
+            r->status = err;
+
+            if(r == req)
+                continue;
+
+            genwait_wake_all(r);
+
+            if(r->callback)
+                r->callback(r);
+        }
+
+        errno = err;
+        return -1;
+    }
+
+    dma_queue_next();
+    return 0;
+}
+
+static int atab_poll(kos_blockdev_t *d, kos_blockdev_req_t *req, int wait) {
+    int old;
+
+    (void)d;
+
+    old = irq_disable();
+
+    while(req->status == EINPROGRESS) {
+        if(!wait) {
+            irq_restore(old);
+            errno = EAGAIN;
+            return -1;
+        }
+
+        genwait_wait(req, "atab_poll", 0, NULL);
+    }
+
+    irq_restore(old);
+
+    if(req->status) {
+        errno = req->status;
+        return -1;
+    }
+
+    return 0;
+}
+
 static int atab_read_blocks_chs(kos_blockdev_t *d, uint64_t block, size_t count,
                                 void *buf) {
     ata_devdata_t *data = (ata_devdata_t *)d->dev_data;
@@ -1249,7 +1485,9 @@ static kos_blockdev_t ata_blockdev = {
     &atab_read_blocks,      /* read_blocks */
     &atab_write_blocks,     /* write_blocks */
     &atab_count_blocks,     /* count_blocks */
-    &atab_flush             /* flush */
+    &atab_flush,            /* flush */
+    NULL,                   /* submit */
+    NULL                    /* poll */
 };
 
 static kos_blockdev_t ata_blockdev_dma = {
@@ -1260,7 +1498,9 @@ static kos_blockdev_t ata_blockdev_dma = {
     &atab_read_blocks_dma,  /* read_blocks */
     &atab_write_blocks_dma, /* write_blocks */
     &atab_count_blocks,     /* count_blocks */
-    &atab_flush             /* flush */
+    &atab_flush,            /* flush */
+    &atab_submit_dma,       /* submit */
+    &atab_poll              /* poll */
 };
 
 static kos_blockdev_t ata_blockdev_chs = {
@@ -1271,7 +1511,9 @@ static kos_blockdev_t ata_blockdev_chs = {
     &atab_read_blocks_chs,  /* read_blocks */
     &atab_write_blocks_chs, /* write_blocks */
     &atab_count_blocks,     /* count_blocks */
-    &atab_flush             /* flush */
+    &atab_flush,            /* flush */
+    NULL,                   /* submit */
+    NULL                    /* poll */
 };
 
 int g1_ata_blockdev_for_partition(int partition, int dma, kos_blockdev_t *rv,
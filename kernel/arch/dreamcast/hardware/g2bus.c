@@ -19,6 +19,9 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <arch/cache.h>
+#include <arch/irq.h>
 #include <dc/g2bus.h>
 
 /* Always use these functions to access G2 bus memory (includes the SPU
@@ -87,102 +90,194 @@ void g2_write_32(uintptr_t address, uint32_t value) {
     g2_unlock(ctx);
 }
 
+/* Most bytes the block functions move with interrupts disabled at a time,
+   or 0 for no bound */
+static size_t irq_window = G2_IRQ_WINDOW_DEFAULT;
+
+void g2_set_irq_window(size_t bytes) {
+    irq_window = bytes;
+}
+
+/* How many values of the given size fit in one stretch with IRQs off */
+static inline size_t g2_window(size_t unit) {
+    if(!irq_window)
+        return SIZE_MAX;
+
+    return irq_window >= unit ? irq_window / unit : 1;
+}
+
+/* Copy amt values of a type between two pointers, letting interrupts in
+   every window's worth of them. */
+#define G2_BLOCK_COPY(type, dst, src, amt) do { \
+        const size_t max = g2_window(sizeof(type)); \
+        g2_ctx_t ctx; \
+        size_t n; \
+        while(amt) { \
+            n = amt < max ? amt : max; \
+            amt -= n; \
+            ctx = g2_lock(); \
+            while(n--) \
+                *dst++ = *src++; \
+            g2_unlock(ctx); \
+        } \
+    } while(0)
+
 /* Read a block of 8-bit values from G2 */
 void g2_read_block_8(uint8_t * output, uintptr_t address, size_t amt) {
     const volatile uint8_t * input = (const volatile uint8_t *)address;
-    g2_ctx_t ctx;
-
-    ctx = g2_lock();
-
-    while(amt--) {
-        *output++ = *input++;
-    }
 
-    g2_unlock(ctx);
+    G2_BLOCK_COPY(uint8_t, output, input, amt);
 }
 
 /* Write a block 8-bit values to G2 */
 void g2_write_block_8(const uint8_t * input, uintptr_t address, size_t amt) {
     volatile uint8_t * output = (volatile uint8_t *)address;
-    g2_ctx_t ctx;
-
-    ctx = g2_lock();
-
-    while(amt--) {
-        *output++ = *input++;
-    }
 
-    g2_unlock(ctx);
+    G2_BLOCK_COPY(uint8_t, output, input, amt);
 }
 
 /* Read a block of 16-bit values from G2 */
 void g2_read_block_16(uint16_t * output, uintptr_t address, size_t amt) {
     const volatile uint16_t * input = (const volatile uint16_t *)address;
-    g2_ctx_t ctx;
 
-    ctx = g2_lock();
-
-    while(amt--) {
-        *output++ = *input++;
-    }
-
-    g2_unlock(ctx);
+    G2_BLOCK_COPY(uint16_t, output, input, amt);
 }
 
 /* Write a block of 16-bit values to G2 */
 void g2_write_block_16(const uint16_t * input, uintptr_t address, size_t amt) {
     volatile uint16_t * output = (volatile uint16_t *)address;
-    g2_ctx_t ctx;
-
-    ctx = g2_lock();
-
-    while(amt--) {
-        *output++ = *input++;
-    }
 
-    g2_unlock(ctx);
+    G2_BLOCK_COPY(uint16_t, output, input, amt);
 }
 
 /* Read a block of 32-bit values from G2 */
 void g2_read_block_32(uint32_t * output, uintptr_t address, size_t amt) {
     const volatile uint32_t * input = (const volatile uint32_t *)address;
-    g2_ctx_t ctx;
-
-    ctx = g2_lock();
-
-    while(amt--) {
-        *output++ = *input++;
-    }
 
-    g2_unlock(ctx);
+    G2_BLOCK_COPY(uint32_t, output, input, amt);
 }
 
 /* Write a block of 32-bit values to G2 */
 void g2_write_block_32(const uint32_t * input, uintptr_t address, size_t amt) {
     volatile uint32_t * output = (volatile uint32_t *)address;
-    g2_ctx_t ctx;
 
-    ctx = g2_lock();
-
-    while(amt--) {
-        *output++ = *input++;
-    }
-
-    g2_unlock(ctx);
+    G2_BLOCK_COPY(uint32_t, output, input, amt);
 }
 
 /* A memset-like function for G2 */
 void g2_memset_8(uintptr_t address, uint8_t c, size_t amt) {
     volatile uint8_t * output = (volatile uint8_t *)address;
+    const size_t max = g2_window(1);
     g2_ctx_t ctx;
+    size_t n;
 
-    ctx = g2_lock();
+    while(amt) {
+        n = amt < max ? amt : max;
+        amt -= n;
+        ctx = g2_lock();
+
+        while(n--) {
+            *output++ = c;
+        }
 
-    while(amt--) {
-        *output++ = c;
+        g2_unlock(ctx);
     }
+}
 
-    g2_unlock(ctx);
+/* Move the 32-byte aligned bulk of a block by DMA, if it's worth it and can
+   be done from here. Returns the number of bytes moved. */
+static size_t g2_block_dma(void *sh4, uintptr_t address, size_t bytes,
+                           uint32_t dir, uint32_t g2chn) {
+    size_t len = bytes & ~31;
+
+    if(len < G2_DMA_THRESHOLD || irq_inside_int() ||
+       (((uintptr_t)sh4 | address) & 31))
+        return 0;
+
+    if(dir == G2_DMA_TO_G2)
+        dcache_flush_range((uintptr_t)sh4, len);
+    else
+        dcache_inval_range((uintptr_t)sh4, len);
+
+    /* Someone else has the channel: just do it by PIO instead. */
+    if(g2_dma_transfer(sh4, (void *)address, len, 1, NULL, NULL, dir, 0,
+                       g2chn, 0) < 0)
+        return 0;
+
+    return len;
+}
+
+void g2_read_block_32_dma(uint32_t * output, uintptr_t address, size_t amt,
+                          uint32_t g2chn) {
+    size_t done = g2_block_dma(output, address, amt * 4, G2_DMA_TO_SH4, g2chn);
+
+    g2_read_block_32(output + done / 4, address + done, amt - done / 4);
+}
+
+void g2_write_block_32_dma(const uint32_t * input, uintptr_t address,
+                           size_t amt, uint32_t g2chn) {
+    size_t done = g2_block_dma((void *)input, address, amt * 4, G2_DMA_TO_G2,
+                               g2chn);
+
+    g2_write_block_32(input + done / 4, address + done, amt - done / 4);
+}
+
+/* Queue up a write, flushing the batch first if it's full */
+static void g2_batch_add(g2_batch_t *batch, uintptr_t address, uint32_t value,
+                         uint8_t size) {
+    if(batch->count == G2_BATCH_MAX)
+        g2_batch_flush(batch);
+
+    batch->addr[batch->count] = address;
+    batch->value[batch->count] = value;
+    batch->size[batch->count] = size;
+    batch->count++;
+}
+
+void g2_batch_write_8(g2_batch_t *batch, uintptr_t address, uint8_t value) {
+    g2_batch_add(batch, address, value, 1);
+}
+
+void g2_batch_write_16(g2_batch_t *batch, uintptr_t address, uint16_t value) {
+    g2_batch_add(batch, address, value, 2);
+}
+
+void g2_batch_write_32(g2_batch_t *batch, uintptr_t address, uint32_t value) {
+    g2_batch_add(batch, address, value, 4);
+}
+
+/* The whole batch goes under as few locks as the IRQ window allows, with
+   the FIFO waited on once for each 8 writes, which is what it can hold. */
+void g2_batch_flush(g2_batch_t *batch) {
+    const size_t max = g2_window(4);
+    size_t i = 0, n;
+    g2_ctx_t ctx;
+
+    while(i < batch->count) {
+        n = batch->count - i < max ? batch->count - i : max;
+        ctx = g2_lock();
+
+        for(; n--; i++) {
+            if(i && !(i & 7))
+                g2_fifo_wait();
+
+            switch(batch->size[i]) {
+                case 1:
+                    *((volatile uint8_t *)batch->addr[i]) = batch->value[i];
+                    break;
+                case 2:
+                    *((volatile uint16_t *)batch->addr[i]) = batch->value[i];
+                    break;
+                default:
+                    *((volatile uint32_t *)batch->addr[i]) = batch->value[i];
+                    break;
+            }
+        }
+
+        g2_unlock(ctx);
+    }
+
+    batch->count = 0;
 }
 
 /* When writing to the SPU RAM, this is required at least every 8 32-bit
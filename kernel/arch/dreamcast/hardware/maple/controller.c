@@ -7,11 +7,14 @@
  */
 
 #include <arch/arch.h>
+#include <arch/irq.h>
 #include <dc/maple.h>
 #include <dc/maple/controller.h>
 #include <kos/mutex.h>
 #include <kos/worker_thread.h>
+#include <kos/timer.h>
 #include <assert.h>
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/queue.h>
@@ -34,6 +37,27 @@ typedef struct cont_cond {
     uint8_t joy2y;     /* second joystick Y */
 } cont_cond_t;
 
+/* A queue of events. Only the DMA IRQ moves head and only the reader moves
+   tail, so neither side has to lock the other out. */
+typedef struct cont_event_queue {
+    cont_event_t events[CONT_EVENT_QUEUE_SIZE];
+    size_t head;
+    size_t tail;
+} cont_event_queue_t;
+
+/* What we keep in each controller's status buffer */
+typedef struct cont_state_private {
+    cont_state_t base;
+    cont_event_queue_t queue;
+
+    /* The last state seen, to find the changes in */
+    uint32_t last_buttons;
+    int8_t zones[CONT_AXIS_COUNT];
+} cont_state_private_t;
+
+/* Events from every controller */
+static cont_event_queue_t cont_events;
+
 typedef struct cont_callback_params {
     cont_btn_callback_t cb;
     uint8_t addr;
@@ -141,6 +165,80 @@ int cont_btn_callback(uint8_t addr, uint32_t btns, cont_btn_callback_t cb) {
     return 0;
 }
 
+static void cont_event_push(cont_event_queue_t *q, const cont_event_t *ev) {
+    size_t head = q->head;
+
+    /* Drop it if the reader has fallen behind */
+    if(head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= CONT_EVENT_QUEUE_SIZE)
+        return;
+
+    q->events[head & (CONT_EVENT_QUEUE_SIZE - 1)] = *ev;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static int cont_event_take(cont_event_queue_t *q, cont_event_t *ev) {
+    size_t tail = q->tail;
+
+    if(tail == __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+        return 0;
+
+    *ev = q->events[tail & (CONT_EVENT_QUEUE_SIZE - 1)];
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+static void cont_event_queue(cont_state_private_t *state, cont_event_t *ev) {
+    cont_event_push(&state->queue, ev);
+    cont_event_push(&cont_events, ev);
+}
+
+static int cont_axis_zone(cont_axis_t axis, int value) {
+    if(value >= CONT_EVENT_THRESHOLD)
+        return 1;
+    else if(axis >= CONT_AXIS_JOYX && value <= -CONT_EVENT_THRESHOLD)
+        return -1;
+
+    return 0;
+}
+
+/* Queue up everything that changed since the last state */
+static void cont_find_events(cont_state_private_t *state, uint8_t addr) {
+    const cont_state_t *cur = &state->base;
+    const int values[CONT_AXIS_COUNT] = {
+        cur->ltrig, cur->rtrig, cur->joyx, cur->joyy, cur->joy2x, cur->joy2y
+    };
+    uint32_t changed = cur->buttons ^ state->last_buttons;
+    cont_event_t ev = {
+        .timestamp = cur->timestamp,
+        .addr = addr
+    };
+    int i, zone;
+
+    while(changed) {
+        ev.input = changed & -changed;
+        ev.type = (cur->buttons & ev.input) ? CONT_EVENT_PRESS : CONT_EVENT_RELEASE;
+        cont_event_queue(state, &ev);
+        changed &= changed - 1;
+    }
+
+    state->last_buttons = cur->buttons;
+
+    ev.type = CONT_EVENT_AXIS;
+
+    for(i = 0; i < CONT_AXIS_COUNT; i++) {
+        zone = cont_axis_zone(i, values[i]);
+
+        if(zone != state->zones[i]) {
+            ev.input = i;
+            ev.zone = zone;
+            ev.value = values[i];
+            cont_event_queue(state, &ev);
+            state->zones[i] = zone;
+        }
+    }
+}
+
 /* Response callback for the GETCOND Maple command. */
 static void cont_reply(maple_state_t *st, maple_frame_t *frm) {
     (void)st;
@@ -181,8 +279,12 @@ static void cont_reply(maple_state_t *st, maple_frame_t *frm) {
     cooked->joyy = ((int)raw->joyy) - 128;
     cooked->joy2x = ((int)raw->joy2x) - 128;
     cooked->joy2y = ((int)raw->joy2y) - 128;
+    cooked->timestamp = timer_ns_gettime64();
     frm->dev->status_valid = 1;
 
+    cont_find_events((cont_state_private_t *)cooked,
+                     maple_addr(frm->dev->port, frm->dev->unit));
+
     /* If someone is in the middle of modifying the list, don't process callbacks */
     if(mutex_trylock(&btn_cbs_mtx))
         return;
@@ -223,14 +325,51 @@ static void cont_periodic(maple_driver_t *drv) {
     maple_driver_foreach(drv, cont_poll);
 }
 
+int cont_get_state_since(maple_device_t *cont, uint64_t since,
+                         cont_state_t *state) {
+    irq_mask_t old;
+
+    if(!cont || !cont->valid || !(cont->info.functions & MAPLE_FUNC_CONTROLLER)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!cont->status_valid) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    /* Updates come in from the maple DMA IRQ */
+    old = irq_disable();
+    *state = *(cont_state_t *)cont->status;
+    irq_restore(old);
+
+    return state->timestamp > since;
+}
+
+int cont_event_pop(maple_device_t *cont, cont_event_t *event) {
+    if(!cont || !cont->valid || !(cont->info.functions & MAPLE_FUNC_CONTROLLER)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return cont_event_take(&((cont_state_private_t *)cont->status)->queue,
+                           event);
+}
+
+int cont_event_get(cont_event_t *event) {
+    return cont_event_take(&cont_events, event);
+}
+
 /* Device Driver Struct */
 static maple_driver_t controller_drv = {
     .functions = MAPLE_FUNC_CONTROLLER,
     .name = "Controller Driver",
     .periodic = cont_periodic,
-    .status_size = sizeof(cont_state_t),
+    .status_size = sizeof(cont_state_private_t),
     .attach = NULL,
-    .detach = NULL
+    .detach = NULL,
+    .poll_midframe = true
 };
 
 /* Add the controller to the driver chain */
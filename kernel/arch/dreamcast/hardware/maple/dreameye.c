@@ -8,8 +8,12 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include <kos/cond.h>
 #include <kos/dbglog.h>
 #include <kos/genwait.h>
+#include <kos/mutex.h>
+#include <kos/thread.h>
+#include <kos/worker_thread.h>
 #include <dc/maple.h>
 #include <dc/maple/dreameye.h>
 
@@ -19,6 +23,33 @@ static int dreameye_send_get_image(maple_device_t *dev,
 
 static dreameye_state_t *first_state = NULL;
 
+/* The streaming capture, if one is running. Frames are fetched into one
+   buffer while the callback is handed the other. */
+static struct {
+    maple_device_t *dev;
+    uint8 image;
+    dreameye_frame_callback_t cb;
+    void *data;
+
+    uint8 *buf[2];
+    int buf_size[2];
+    int size[2];
+
+    int ready;      /* Buffer waiting for the callback, or -1 */
+    int busy;       /* Buffer the callback has, or -1 */
+    volatile bool running;
+
+    kthread_t *thd;
+    kthread_worker_t *worker;
+    mutex_t mutex;
+    condvar_t cv;
+} stream = {
+    .ready = -1,
+    .busy = -1,
+    .mutex = MUTEX_INITIALIZER,
+    .cv = COND_INITIALIZER
+};
+
 static void dreameye_get_image_count_cb(maple_state_t *st, maple_frame_t *frame) {
     (void)st;
 
@@ -151,7 +182,8 @@ static void dreameye_get_image_cb(maple_state_t *st, maple_frame_t *frame) {
     /* Unlock the frame */
     maple_frame_unlock(frame);
 
-    if(frame->dev == NULL)
+    /* Late answer to a transfer that already timed out */
+    if(frame->dev == NULL || first_state == NULL)
         return;
 
     dev = frame->dev;
@@ -161,6 +193,7 @@ static void dreameye_get_image_cb(maple_state_t *st, maple_frame_t *frame) {
 
     if(resp->response != MAPLE_RESPONSE_DATATRF) {
         first_state->img_transferring = -1;
+        genwait_wake_all(first_state);
         return;
     }
 
@@ -169,6 +202,7 @@ static void dreameye_get_image_cb(maple_state_t *st, maple_frame_t *frame) {
 
     if(respbuf32[0] != MAPLE_FUNC_CAMERA) {
         first_state->img_transferring = -1;
+        genwait_wake_all(first_state);
         return;
     }
 
@@ -182,17 +216,25 @@ static void dreameye_get_image_cb(maple_state_t *st, maple_frame_t *frame) {
     /* Check if we're done. */
     if(respbuf8[4] & 0x40) {
         first_state->img_transferring = 0;
+        genwait_wake_all(first_state);
         return;
     }
 
-    if(respbuf8[5] + 5 < first_state->transfer_count)
+    /* Ask for this unit's next piece in the very next maple round, rather
+       than at the next vblank. */
+    if(respbuf8[5] + 5 < first_state->transfer_count) {
         dreameye_send_get_image(dev, first_state, DREAMEYE_IMAGEREQ_CONTINUE,
                                 respbuf8[5] + 5);
+        maple_queue_kick();
+    }
 }
 
 static int dreameye_send_get_image(maple_device_t *dev,
                                    dreameye_state_t *state, uint8 req,
                                    uint8 cnt) {
+    if(!dev)
+        return MAPLE_EINVALID;
+
     /* Lock the frame */
     if(maple_frame_lock(&dev->frame) < 0)
         return MAPLE_EAGAIN;
@@ -245,20 +287,19 @@ static int dreameye_get_transfer_count(maple_device_t *dev, uint8 img) {
     return MAPLE_EOK;
 }
 
-int dreameye_get_image(maple_device_t *dev, uint8 image, uint8 **data,
-                       int *img_sz) {
+/* Fetch an image into *buf, growing it if it's smaller than *buf_size. The
+   Dreameye's five sub-units each answer for every fifth 512 byte piece, so
+   all five are kept busy at once. */
+static int dreameye_fetch(maple_device_t *dev, uint8 image, uint8 **buf,
+                          int *buf_size, int *img_sz) {
     dreameye_state_t *de;
-    maple_device_t *dev2, *dev3, *dev4, *dev5;
-    int err;
+    maple_device_t *sub;
+    uint8 *nbuf;
+    int err, u;
 
     assert(dev != NULL);
     assert(dev->unit == 1);
 
-    dev2 = maple_enum_dev(dev->port, 2);
-    dev3 = maple_enum_dev(dev->port, 3);
-    dev4 = maple_enum_dev(dev->port, 4);
-    dev5 = maple_enum_dev(dev->port, 5);
-
     de = (dreameye_state_t *)dev->status;
 
     first_state = de;
@@ -274,29 +315,41 @@ int dreameye_get_image(maple_device_t *dev, uint8 image, uint8 **data,
     if(err)
         goto fail;
 
-    /* Allocate space for the largest possible image that could fit in that
+    /* Make room for the largest possible image that could fit in that
        number of transfers. */
-    de->img_buf = (uint8 *)malloc(512 * de->transfer_count);
+    if(*buf_size < 512 * de->transfer_count) {
+        if(!(nbuf = (uint8 *)realloc(*buf, 512 * de->transfer_count)))
+            goto fail;
 
-    if(!de->img_buf)
-        goto fail;
+        *buf = nbuf;
+        *buf_size = 512 * de->transfer_count;
+    }
+
+    de->img_buf = *buf;
 
     /* Send out the image requests to all sub devices. */
     dreameye_send_get_image(dev, de, DREAMEYE_IMAGEREQ_START, 0);
-    dreameye_send_get_image(dev2, de, DREAMEYE_IMAGEREQ_CONTINUE, 1);
-    dreameye_send_get_image(dev3, de, DREAMEYE_IMAGEREQ_CONTINUE, 2);
-    dreameye_send_get_image(dev4, de, DREAMEYE_IMAGEREQ_CONTINUE, 3);
-    dreameye_send_get_image(dev5, de, DREAMEYE_IMAGEREQ_CONTINUE, 4);
+
+    for(u = 2; u <= 5; u++) {
+        sub = maple_enum_dev(dev->port, u);
+        dreameye_send_get_image(sub, de, DREAMEYE_IMAGEREQ_CONTINUE, u - 1);
+    }
+
+    maple_queue_kick();
 
     while(de->img_transferring == 1) {
-        thd_pass();
+        if(genwait_wait(de, "dreameye_fetch", 1000, NULL) < 0 &&
+           de->img_transferring == 1) {
+            dbglog(DBG_ERROR, "dreameye_fetch: timeout to unit %c%c\n",
+                   dev->port + 'A', dev->unit + '0');
+            break;
+        }
     }
 
     if(de->img_transferring == 0) {
-        *data = de->img_buf;
         *img_sz = de->img_size;
 
-        dbglog(DBG_DEBUG, "dreameye_get_image: Image of size %d received in "
+        dbglog(DBG_DEBUG, "dreameye_fetch: Image of size %d received in "
                "%d transfers\n", de->img_size, de->transfer_count);
 
         first_state = NULL;
@@ -306,11 +359,6 @@ int dreameye_get_image(maple_device_t *dev, uint8 image, uint8 **data,
         return MAPLE_EOK;
     }
 
-    /* If we get here, something went wrong. */
-    if(de->img_buf != NULL) {
-        free(de->img_buf);
-    }
-
 fail:
     first_state = NULL;
     de->img_transferring = 0;
@@ -321,6 +369,140 @@ fail:
     return MAPLE_EFAIL;
 }
 
+int dreameye_get_image(maple_device_t *dev, uint8 image, uint8 **data,
+                       int *img_sz) {
+    uint8 *buf = NULL;
+    int size = 0;
+
+    if(stream.running)
+        return MAPLE_EAGAIN;
+
+    if(dreameye_fetch(dev, image, &buf, &size, img_sz) != MAPLE_EOK) {
+        free(buf);
+        return MAPLE_EFAIL;
+    }
+
+    *data = buf;
+    return MAPLE_EOK;
+}
+
+/* Hands the newest frame to the callback, in the worker thread */
+static void dreameye_stream_deliver(void *d) {
+    int i;
+
+    (void)d;
+
+    mutex_lock(&stream.mutex);
+
+    if((i = stream.ready) < 0) {
+        mutex_unlock(&stream.mutex);
+        return;
+    }
+
+    stream.ready = -1;
+    stream.busy = i;
+    mutex_unlock(&stream.mutex);
+
+    stream.cb(stream.dev, stream.buf[i], stream.size[i], stream.data);
+
+    mutex_lock(&stream.mutex);
+    stream.busy = -1;
+    cond_signal(&stream.cv);
+    mutex_unlock(&stream.mutex);
+}
+
+static void *dreameye_stream_thd(void *d) {
+    int back = 0;
+
+    (void)d;
+
+    while(stream.running) {
+        /* Wait for the callback to be done with the buffer we'd fill */
+        mutex_lock(&stream.mutex);
+
+        while(stream.running && (stream.ready == back || stream.busy == back))
+            cond_wait(&stream.cv, &stream.mutex);
+
+        mutex_unlock(&stream.mutex);
+
+        if(!stream.running)
+            break;
+
+        if(dreameye_fetch(stream.dev, stream.image, &stream.buf[back],
+                          &stream.buf_size[back], &stream.size[back])) {
+            thd_sleep(10);
+            continue;
+        }
+
+        mutex_lock(&stream.mutex);
+        stream.ready = back;
+        mutex_unlock(&stream.mutex);
+
+        thd_worker_wakeup(stream.worker);
+        back ^= 1;
+    }
+
+    return NULL;
+}
+
+int dreameye_stream_start(maple_device_t *dev, uint8 image,
+                          dreameye_frame_callback_t cb, void *data) {
+    const kthread_attr_t attr = {
+        .prio = PRIO_DEFAULT,
+        .label = "dreameye_stream"
+    };
+
+    if(!dev || dev->unit != 1 || !cb)
+        return MAPLE_EINVALID;
+
+    if(stream.running || first_state)
+        return MAPLE_EAGAIN;
+
+    stream.dev = dev;
+    stream.image = image;
+    stream.cb = cb;
+    stream.data = data;
+    stream.ready = stream.busy = -1;
+    stream.running = true;
+
+    if(!(stream.worker = thd_worker_create(dreameye_stream_deliver, NULL)))
+        goto fail;
+
+    if(!(stream.thd = thd_create_ex(&attr, dreameye_stream_thd, NULL))) {
+        thd_worker_destroy(stream.worker);
+        goto fail;
+    }
+
+    return MAPLE_EOK;
+
+fail:
+    stream.running = false;
+    return MAPLE_EFAIL;
+}
+
+void dreameye_stream_stop(void) {
+    int i;
+
+    if(!stream.running)
+        return;
+
+    mutex_lock(&stream.mutex);
+    stream.running = false;
+    cond_broadcast(&stream.cv);
+    mutex_unlock(&stream.mutex);
+
+    thd_join(stream.thd, NULL);
+    thd_worker_destroy(stream.worker);
+
+    for(i = 0; i < 2; i++) {
+        free(stream.buf[i]);
+        stream.buf[i] = NULL;
+        stream.buf_size[i] = 0;
+    }
+
+    stream.ready = stream.busy = -1;
+}
+
 static void dreameye_erase_cb(maple_state_t *st, maple_frame_t *frame) {
     (void)st;
 
@@ -428,5 +610,6 @@ void dreameye_init(void) {
 }
 
 void dreameye_shutdown(void) {
+    dreameye_stream_stop();
     maple_driver_unreg(&dreameye_drv);
 }
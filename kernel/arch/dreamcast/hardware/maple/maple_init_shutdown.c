@@ -12,9 +12,11 @@
 #include <dc/maple.h>
 #include <dc/asic.h>
 #include <dc/vblank.h>
+#include <arch/cache.h>
 #include <kos/thread.h>
 #include <kos/init.h>
 #include <kos/dbglog.h>
+#include <kos/mem_tags.h>
 
 #include <dc/maple/controller.h>
 #include <dc/maple/keyboard.h>
@@ -66,6 +68,13 @@ static void maple_hw_init(void) {
     assert_msg(maple_state.dma_buffer != NULL, "Couldn't allocate maple DMA buffer");
     assert_msg((((uint32)maple_state.dma_buffer) & 0x1f) == 0, "DMA buffer was unaligned; bug in dlmalloc; please report!");
 
+    /* Nothing may be left in the cache for it; maple_queue_flush() builds
+       each list through the cache and writes it back itself. */
+    if(__is_defined(MAPLE_DMA_DEBUG))
+        dcache_purge_range((uintptr_t)maple_state.dma_buffer, MAPLE_DMA_SIZE + 1024);
+    else
+        dcache_purge_range((uintptr_t)maple_state.dma_buffer, MAPLE_DMA_SIZE);
+
     /* Force it into the P2 area */
     maple_state.dma_buffer = (uint8*)((((uint32)maple_state.dma_buffer) & MEM_AREA_CACHE_MASK) | MEM_AREA_P2_BASE);
 
@@ -83,6 +92,9 @@ static void maple_hw_init(void) {
     maple_state.scan_ready_mask = 0;
     maple_state.gun_port = -1;
     maple_state.gun_x = maple_state.gun_y = -1;
+    maple_state.poll_rounds = maple_state.poll_left = 0;
+    maple_state.vbl_ns = maple_state.frame_ns = 0;
+    maple_state.dma_kick = 0;
 
     /* Reset hardware */
     maple_write(MAPLE_RESET1, MAPLE_RESET1_MAGIC);
@@ -91,7 +103,9 @@ static void maple_hw_init(void) {
     maple_bus_enable();
 
     /* Hook the necessary interrupts */
-    maple_state.vbl_handle = vblank_handler_add(maple_vbl_irq_hnd, &maple_state);
+    maple_state.vbl_handle = vblank_handler_add_ex(maple_vbl_irq_hnd,
+                                                   &maple_state,
+                                                   VBLANK_PRIO_HIGH, 0);
     asic_evt_set_handler(ASIC_EVT_MAPLE_DMA, maple_dma_irq_hnd, &maple_state);
     asic_evt_enable(ASIC_EVT_MAPLE_DMA, ASIC_IRQ_DEFAULT);
 }
@@ -104,6 +118,7 @@ void maple_hw_shutdown(void) {
     maple_device_t *dev;
 
     /* Unhook interrupts */
+    maple_poll_rounds(0);
     vblank_handler_remove(maple_state.vbl_handle);
     asic_evt_remove_handler(ASIC_EVT_MAPLE_DMA);
     asic_evt_disable(ASIC_EVT_MAPLE_DMA, ASIC_IRQ_DEFAULT);
@@ -181,6 +196,8 @@ KOS_INIT_FLAG_WEAK(dreameye_init, true);
 
 /* Full init: initialize known drivers and start maple operations */
 void maple_init(void) {
+    mem_tag_scoped(MEM_TAG_MAPLE);
+
     KOS_INIT_FLAG_CALL(lightgun_init);
     KOS_INIT_FLAG_CALL(cont_init);
     KOS_INIT_FLAG_CALL(kbd_init);
@@ -7,6 +7,7 @@
  */
 
 #include <malloc.h>
+#include <errno.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -14,8 +15,12 @@
 #include <dc/maple.h>
 #include <dc/asic.h>
 #include <dc/pvr.h>
+#include <arch/irq.h>
+#include <arch/timer.h>
 #include <kos/dbglog.h>
 #include <kos/thread.h>
+#include <kos/timer.h>
+#include <kos/trace.h>
 
 /*********************************************************************/
 /* VBlank IRQ handler */
@@ -202,10 +207,91 @@ static void vbl_autodetect(maple_state_t *state) {
     }
 }
 
+/* A frame is taken to be this long until we've timed one, in ns */
+#define FRAME_NS_DEFAULT    16683350
+#define FRAME_NS_MAX        40000000
+
+/* Start TMU1 for this frame's extra polling rounds, spread evenly over the
+   time until the next vblank. */
+static void poll_start(maple_state_t *state) {
+    uint64_t frame = state->frame_ns;
+
+    if(!frame || frame > FRAME_NS_MAX)
+        frame = FRAME_NS_DEFAULT;
+
+    timer_stop(TMU1);
+    timer_clear(TMU1);
+    state->poll_left = state->poll_rounds;
+    timer_prime(TMU1, (uint32)((state->poll_rounds + 1) * 1000000000ULL / frame), 1);
+    timer_start(TMU1);
+}
+
+/* Called on TMU1 underflow, for each extra polling round */
+static void maple_poll_irq_hnd(irq_t code, irq_context_t *context, void *data) {
+    maple_state_t *state = data;
+    maple_driver_t *drv;
+
+    (void)code;
+    (void)context;
+
+    timer_clear(TMU1);
+
+    if(state->poll_left <= 0) {
+        timer_stop(TMU1);
+        return;
+    }
+
+    /* Don't let the timer fire again on top of the next vblank */
+    if(--state->poll_left == 0)
+        timer_stop(TMU1);
+
+    LIST_FOREACH(drv, &state->driver_list, drv_list) {
+        if(drv->poll_midframe && drv->periodic != NULL)
+            drv->periodic(drv);
+    }
+
+    if(!state->dma_in_progress)
+        maple_queue_flush();
+}
+
+int maple_poll_rounds(unsigned int rounds) {
+    irq_mask_t old;
+
+    if(rounds > MAPLE_POLL_ROUNDS_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    old = irq_disable();
+
+    if(rounds && !maple_state.poll_rounds) {
+        if(timer_claim(TMU1) < 0) {
+            irq_restore(old);
+            return -1;
+        }
+
+        irq_set_handler(EXC_TMU1_TUNI1, maple_poll_irq_hnd, &maple_state);
+    }
+    else if(!rounds && maple_state.poll_rounds) {
+        timer_stop(TMU1);
+        timer_clear(TMU1);
+        maple_state.poll_left = 0;
+        irq_set_handler(EXC_TMU1_TUNI1, NULL, NULL);
+        timer_release(TMU1);
+    }
+
+    maple_state.poll_rounds = rounds;
+
+    irq_restore(old);
+
+    return 0;
+}
+
 /* Called on every VBL (~60fps) */
 void maple_vbl_irq_hnd(uint32 code, void *data) {
     maple_state_t *state = data;
     maple_driver_t *drv;
+    uint64_t now = timer_ns_gettime64();
 
     (void)code;
 
@@ -214,6 +300,12 @@ void maple_vbl_irq_hnd(uint32 code, void *data) {
     /* Count, for fun and profit */
     state->vbl_cntr++;
 
+    /* Time the frame, so the extra rounds can be spaced out over it */
+    if(state->vbl_ns)
+        state->frame_ns = now - state->vbl_ns;
+
+    state->vbl_ns = now;
+
     /* Autodetect changed devices */
     vbl_autodetect(state);
 
@@ -227,6 +319,9 @@ void maple_vbl_irq_hnd(uint32 code, void *data) {
     if(!state->dma_in_progress)
         maple_queue_flush();
 
+    if(state->poll_rounds)
+        poll_start(state);
+
     /* dbgio_write_str("finish vbl_irq_hnd\n"); */
 }
 
@@ -242,6 +337,8 @@ void maple_dma_irq_hnd(uint32 code, void *data) {
 
     (void)code;
 
+    trace_event(TRACE_MAPLE_DONE, 0);
+
     /* dbgio_write_str("start dma_irq_hnd\n"); */
 
     /* Count, for fun and profit */
@@ -300,5 +397,11 @@ void maple_dma_irq_hnd(uint32 code, void *data) {
         state->gun_port = -1;
     }
 
+    /* Someone wants the next round sent now, rather than on vblank */
+    if(state->dma_kick && !state->dma_in_progress) {
+        state->dma_kick = 0;
+        maple_queue_flush();
+    }
+
     /* dbgio_write_str("finish dma_irq_hnd\n"); */
 }
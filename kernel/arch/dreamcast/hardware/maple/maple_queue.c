@@ -8,18 +8,28 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
 #include <dc/maple.h>
+#include <arch/cache.h>
 #include <arch/irq.h>
 #include <arch/memory.h>
 
+/* Frames for drivers that need more than their device's own one */
+static maple_frame_t frame_pool[MAPLE_FRAME_POOL_SIZE];
+
 /* Send all queued frames */
 void maple_queue_flush(void) {
     int     cnt, amt;
-    uint32      *out, *last;
+    uint32      *out, *last, *start;
     maple_frame_t   *i;
 
     cnt = amt = 0;
-    out = (uint32 *)maple_state.dma_buffer;
+
+    /* Build the command list through the cache and write it out in whole
+       lines at the end, rather than one uncached store per word. */
+    start = (uint32 *)((((uint32)maple_state.dma_buffer) & MEM_AREA_CACHE_MASK) |
+                       MEM_AREA_P1_BASE);
+    out = start;
     last = NULL;
 
     /* Make sure we end up with space for the gun enable command... */
@@ -77,6 +87,8 @@ void maple_queue_flush(void) {
         assert(last != NULL);
         *last |= 0x80000000;
 
+        dcache_flush_range((uintptr_t)start, (uintptr_t)out - (uintptr_t)start);
+
         /* Start a DMA transfer */
         maple_dma_addr(maple_state.dma_buffer);
         maple_dma_start();
@@ -84,6 +96,20 @@ void maple_queue_flush(void) {
     }
 }
 
+/* Send what's queued as soon as the bus is free */
+void maple_queue_kick(void) {
+    irq_mask_t save = irq_disable();
+
+    /* Frame callbacks run from the DMA IRQ, which flushes again itself once
+       they're all done. */
+    if(!maple_state.dma_in_progress && !irq_inside_int())
+        maple_queue_flush();
+    else
+        maple_state.dma_kick = 1;
+
+    irq_restore(save);
+}
+
 /* Submit a frame for queueing; see header for notes */
 int maple_queue_frame(maple_frame_t *frame) {
     uint32 save = 0;
@@ -203,3 +229,26 @@ void maple_frame_unlock(maple_frame_t *frame) {
     assert(frame->state == MAPLE_FRAME_RESPONDED);
     frame->state = MAPLE_FRAME_VACANT;
 }
+
+/* Take a locked, initialized frame from the pool. Unlocking it once its
+   response has come in puts it back. */
+maple_frame_t *maple_frame_alloc(void) {
+    int i;
+
+    for(i = 0; i < MAPLE_FRAME_POOL_SIZE; i++) {
+        if(!maple_frame_lock(&frame_pool[i])) {
+            maple_frame_init(&frame_pool[i]);
+            return &frame_pool[i];
+        }
+    }
+
+    errno = EAGAIN;
+    return NULL;
+}
+
+/* Hand back a frame that was locked but never queued */
+void maple_frame_release(maple_frame_t *frame) {
+    assert(!frame->queued);
+    assert(frame->state == MAPLE_FRAME_UNSENT);
+    frame->state = MAPLE_FRAME_VACANT;
+}
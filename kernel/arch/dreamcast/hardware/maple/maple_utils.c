@@ -11,6 +11,7 @@
 #include <arch/memory.h>
 #include <dc/maple.h>
 #include <kos/dbglog.h>
+#include <kos/trace.h>
 
 /* Enable / Disable the bus */
 void maple_bus_enable(void) {
@@ -22,6 +23,7 @@ void maple_bus_disable(void) {
 
 /* Start / Stop DMA */
 void maple_dma_start(void) {
+    trace_event(TRACE_MAPLE_START, 0);
     maple_write(MAPLE_STATE, MAPLE_STATE_DMA);
 }
 void maple_dma_stop(void) {
@@ -14,10 +14,12 @@
  */
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <kos/thread.h>
 #include <kos/genwait.h>
+#include <kos/mutex.h>
 #include <kos/platform.h>
 #include <kos/dbglog.h>
 #include <dc/maple.h>
@@ -26,8 +28,11 @@
 #include <dc/biosfont.h>
 #include <dc/vmufs.h>
 #include <kos/timer.h>
+#include <arch/irq.h>
 
 #define VMU_BLOCK_WRITE_RETRY_TIME  100     /* time to sleep until retrying a failed write */
+#define VMU_WRITE_BATCH             4       /* blocks queued at once by vmu_block_write_multi() */
+#define VMU_WRITE_FRAMES            5       /* frames per block: four phases and a sync */
 
 /* This is the value that official VMUs report for function_data[0]. Have not 
    found any official ones that report a different value nor any third party
@@ -35,6 +40,35 @@
 */
 static const uint32_t vmu_official_function_data0 = 0x403f7e7e;
 
+/* A frame of a batched write, and where it came in the order the answers
+   to the batch arrived. */
+typedef struct vmu_wframe {
+    maple_frame_t   frame;      /* Must be first */
+    int             order;
+} vmu_wframe_t;
+
+/* The frames vmu_block_write_multi() queues, allocated the first time it's
+   called and kept, since a frame that timed out may still be answered. */
+static vmu_wframe_t *write_frames;
+static mutex_t write_mutex = MUTEX_INITIALIZER;
+
+/* How many frames of the batch in flight have been answered, of how many. */
+static volatile int write_done;
+static int write_count;
+
+/* What we keep in each VMU's status buffer */
+typedef struct vmu_state_private {
+    vmu_state_t base;
+
+    /* The LCD image last sent, and the one to send once it's done */
+    uint32_t lcd_sent[VMU_SCREEN_WIDTH];
+    uint32_t lcd_next[VMU_SCREEN_WIDTH];
+
+    maple_frame_t *lcd_frame;   /* The LCD write in flight, if any */
+    bool lcd_valid;             /* lcd_sent is what's on the screen */
+    bool lcd_pending;           /* lcd_next is waiting to be sent */
+} vmu_state_private_t;
+
 /* Distinguish between VMU (only official, with screen/clock/buttons)
    and VMS (memcard only). */
 static bool vmu_is_vmu(const maple_device_t *dev) {
@@ -92,9 +126,17 @@ static void vmu_datetime_from_tm(vmu_datetime_t *dt, const struct tm *bt) {
 static int vmu_attach(maple_driver_t *drv, maple_device_t *dev) {
     (void)drv;
     dev->status_valid = 1;
+    vmufs_invalidate(dev);
     return 0;
 }
 
+static void vmu_detach(maple_driver_t *drv, maple_device_t *dev) {
+    (void)drv;
+
+    /* Whatever's plugged in here next may well be a different card */
+    vmufs_invalidate(dev);
+}
+
 static void vmu_poll_reply(maple_state_t *st, maple_frame_t *frm) {
     (void)st;
 
@@ -178,9 +220,9 @@ static maple_driver_t vmu_drv = {
     .functions = MAPLE_FUNC_MEMCARD | MAPLE_FUNC_LCD | MAPLE_FUNC_CLOCK,
     .name = "VMU Driver",
     .periodic = NULL,
-    .status_size = sizeof(vmu_state_t),
+    .status_size = sizeof(vmu_state_private_t),
     .attach = vmu_attach,
-    .detach = NULL
+    .detach = vmu_detach
 };
 
 /* Add the VMU to the driver chain */
@@ -190,6 +232,9 @@ void vmu_init(void) {
 
 void vmu_shutdown(void) {
     maple_driver_unreg(&vmu_drv);
+
+    free(write_frames);
+    write_frames = NULL;
 }
 
 /* Dynamically add the periodic polling callback to the driver when button input is enabled. */
@@ -342,30 +387,95 @@ int vmu_beep_waveform(maple_device_t *dev, uint8_t period1, uint8_t duty_cycle1,
 
 /* Draw a 1-bit bitmap on the LCD screen (48x32). return a -1 if
    an error occurs */
+static int vmu_lcd_send(maple_device_t *dev, vmu_state_private_t *st,
+                        const uint32_t *bitmap);
+
+static void vmu_lcd_reply(maple_state_t *state, maple_frame_t *frm) {
+    maple_device_t *dev = frm->dev;
+    maple_response_t *resp = (maple_response_t *)frm->recv_buf;
+    vmu_state_private_t *st;
+
+    (void)state;
+
+    maple_frame_unlock(frm);
+
+    /* The VMU may have been pulled out while this was on its way */
+    if(!dev || !dev->status)
+        return;
+
+    st = (vmu_state_private_t *)dev->status;
+    st->lcd_frame = NULL;
+
+    /* If it didn't take, don't skip sending the same image again */
+    if(resp->response != MAPLE_RESPONSE_OK)
+        st->lcd_valid = false;
+
+    if(st->lcd_pending) {
+        st->lcd_pending = false;
+
+        if(!st->lcd_valid || memcmp(st->lcd_sent, st->lcd_next, sizeof(st->lcd_next)))
+            vmu_lcd_send(dev, st, st->lcd_next);
+    }
+}
+
+/* Must be called with interrupts disabled, or from inside one */
+static int vmu_lcd_send(maple_device_t *dev, vmu_state_private_t *st,
+                        const uint32_t *bitmap) {
+    maple_frame_t *frm;
+
+    /* Use a frame from the pool, so this doesn't have to wait for (or hold
+       up) whatever else the VMU is doing on its own frame. */
+    if(!(frm = maple_frame_alloc()))
+        return MAPLE_EAGAIN;
+
+    frm->send_buf[0] = MAPLE_FUNC_LCD;
+    frm->send_buf[1] = 0;    /* Block / phase / partition */
+    memcpy(frm->send_buf + 2, bitmap, VMU_SCREEN_WIDTH * 4);
+    frm->cmd = MAPLE_COMMAND_BWRITE;
+    frm->dst_port = dev->port;
+    frm->dst_unit = dev->unit;
+    frm->length = 2 + VMU_SCREEN_WIDTH;
+    frm->callback = vmu_lcd_reply;
+
+    if(bitmap != st->lcd_sent)
+        memcpy(st->lcd_sent, bitmap, sizeof(st->lcd_sent));
+
+    st->lcd_valid = true;
+    st->lcd_frame = frm;
+    maple_queue_frame(frm);
+
+    return MAPLE_EOK;
+}
+
 int vmu_draw_lcd(maple_device_t *dev, const void *bitmap) {
+    vmu_state_private_t *st;
+    irq_mask_t old;
+    int rv = MAPLE_EOK;
+
     assert(dev != NULL);
 
     /* Only try to draw to screen if this is a real VMU */
     if(!vmu_is_vmu(dev))
         return MAPLE_EINVALID;
 
-    /* Lock the frame */
-    if(maple_frame_lock(&dev->frame) < 0)
-        return MAPLE_EAGAIN;
+    st = (vmu_state_private_t *)dev->status;
+    old = irq_disable();
 
-    /* Reset the frame */
-    maple_frame_init(&dev->frame);
-    dev->frame.send_buf[0] = MAPLE_FUNC_LCD;
-    dev->frame.send_buf[1] = 0;    /* Block / phase / partition */
-    memcpy(dev->frame.send_buf + 2, bitmap, VMU_SCREEN_WIDTH * 4);
-    dev->frame.cmd = MAPLE_COMMAND_BWRITE;
-    dev->frame.dst_port = dev->port;
-    dev->frame.dst_unit = dev->unit;
-    dev->frame.length = 2 + VMU_SCREEN_WIDTH;
-    dev->frame.callback = NULL;
-    maple_queue_frame(&dev->frame);
+    if(st->lcd_frame) {
+        /* Only one write goes out to each VMU at a time; keep the newest
+           image to send when the one in flight is done. */
+        if(st->lcd_pending || memcmp(st->lcd_sent, bitmap, sizeof(st->lcd_sent))) {
+            memcpy(st->lcd_next, bitmap, sizeof(st->lcd_next));
+            st->lcd_pending = true;
+        }
+    }
+    else if(!st->lcd_valid || memcmp(st->lcd_sent, bitmap, sizeof(st->lcd_sent))) {
+        rv = vmu_lcd_send(dev, st, bitmap);
+    }
 
-    return MAPLE_EOK;
+    irq_restore(old);
+
+    return rv;
 }
 
 int vmu_draw_lcd_rotated(maple_device_t *dev, const void *bitmap) {
@@ -624,6 +734,146 @@ int vmu_block_write(maple_device_t *dev, uint16_t blocknum, const uint8_t *buffe
     return rv;
 }
 
+static void vmu_block_write_multi_callback(maple_state_t *st, maple_frame_t *frm) {
+    vmu_wframe_t *wf = (vmu_wframe_t *)frm;
+
+    (void)st;
+
+    wf->order = write_done++;
+
+    if(write_done == write_count)
+        genwait_wake_all((void *)&write_done);
+}
+
+static void vmu_block_write_frame(maple_device_t *dev, vmu_wframe_t *wf,
+                                  uint16_t blocknum, int phase,
+                                  const uint8_t *buffer) {
+    wf->frame.state = MAPLE_FRAME_UNSENT;
+    wf->order = -1;
+
+    maple_frame_init(&wf->frame);
+    wf->frame.send_buf[0] = MAPLE_FUNC_MEMCARD;
+    wf->frame.send_buf[1] = ((blocknum & 0xff) << 24)
+                          | (((blocknum >> 8) & 0xff) << 16)
+                          | (phase << 8);
+    wf->frame.dst_port = dev->port;
+    wf->frame.dst_unit = dev->unit;
+    wf->frame.callback = vmu_block_write_multi_callback;
+
+    if(buffer) {
+        memcpy(wf->frame.send_buf + 2, buffer + 128 * phase, 128);
+        wf->frame.cmd = MAPLE_COMMAND_BWRITE;
+        wf->frame.length = 2 + (128 / 4);
+    }
+    else {
+        wf->frame.cmd = MAPLE_COMMAND_BSYNC;
+        wf->frame.length = 2;
+    }
+}
+
+/* Did every phase of this block get written, and in order? */
+static bool vmu_block_write_ok(const vmu_wframe_t *wf) {
+    const maple_response_t *resp;
+    int phase;
+
+    for(phase = 0; phase < VMU_WRITE_FRAMES; phase++) {
+        if(wf[phase].frame.state != MAPLE_FRAME_RESPONDED)
+            return false;
+
+        if(phase && wf[phase].order < wf[phase - 1].order)
+            return false;
+
+        resp = (const maple_response_t *)wf[phase].frame.recv_buf;
+
+        if(phase < 4 && resp->response != MAPLE_RESPONSE_OK)
+            return false;
+    }
+
+    return true;
+}
+
+/* Rather than waiting for the card to answer each of the five frames a block
+   takes before sending the next, as vmu_block_write() does, queue the frames
+   for a few blocks together so they all go out in the same DMA. Should some
+   phase of a block not come back, or the card ask for one again so that it
+   arrives out of turn, that block is simply written over again the slow way. */
+int vmu_block_write_multi(maple_device_t *dev, const uint16_t *blocks,
+                          size_t count, const uint8_t *buffer) {
+    vmu_wframe_t *wf;
+    size_t i, j, n;
+    int f, phase, rv = MAPLE_EOK, r;
+
+    assert(dev != NULL);
+
+    mutex_lock_scoped(&write_mutex);
+
+    if(!write_frames)
+        write_frames = calloc(VMU_WRITE_BATCH * VMU_WRITE_FRAMES,
+                              sizeof(vmu_wframe_t));
+
+    for(i = 0; i < count; i += n) {
+        n = count - i;
+
+        if(n > VMU_WRITE_BATCH)
+            n = VMU_WRITE_BATCH;
+
+        if(!write_frames)
+            goto slow;
+
+        for(j = 0; j < n; j++) {
+            wf = write_frames + j * VMU_WRITE_FRAMES;
+
+            for(phase = 0; phase < 4; phase++)
+                vmu_block_write_frame(dev, wf + phase, blocks[i + j], phase,
+                                      buffer + (i + j) * 512);
+
+            vmu_block_write_frame(dev, wf + 4, blocks[i + j], 4, NULL);
+        }
+
+        {
+            irq_disable_scoped();
+
+            write_done = 0;
+            write_count = n * VMU_WRITE_FRAMES;
+
+            for(f = 0; f < write_count; f++)
+                maple_queue_frame(&write_frames[f].frame);
+
+            while(write_done < write_count) {
+                if(genwait_wait((void *)&write_done, "vmu_block_write_multi",
+                                100 * write_count, NULL) < 0)
+                    break;
+            }
+
+            /* Take back anything still waiting for an answer */
+            for(f = 0; f < write_count; f++) {
+                if(write_frames[f].frame.queued)
+                    maple_queue_remove(&write_frames[f].frame);
+            }
+        }
+
+    slow:
+        for(j = 0; j < n; j++) {
+            wf = write_frames ? write_frames + j * VMU_WRITE_FRAMES : NULL;
+
+            if(wf && vmu_block_write_ok(wf))
+                continue;
+
+            r = vmu_block_write(dev, blocks[i + j], buffer + (i + j) * 512);
+
+            if(r != MAPLE_EOK)
+                rv = r;
+        }
+
+        if(write_frames) {
+            for(f = 0; f < (int)n * VMU_WRITE_FRAMES; f++)
+                write_frames[f].frame.state = MAPLE_FRAME_VACANT;
+        }
+    }
+
+    return rv;
+}
+
 int vmu_set_datetime(maple_device_t *dev, time_t unix) {
     struct tm *btime;
 
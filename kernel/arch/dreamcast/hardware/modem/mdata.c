@@ -27,15 +27,12 @@
 #include <dc/modem/modem.h>
 #include "mintern.h"
 
-/* The maximum size of the MDP's TX and RX FIFO buffers are 128 bytes */
-#define MODEM_DATA_LIMIT 128
-
 /* Default buffer sizes. This should be sufficient for most things */
 #define MODEM_TX_BUFFER_SIZE 1024
 #define MODEM_RX_BUFFER_SIZE 1024
 
-CHAIN_BUFFER *rxBuffer = NULL;
-CHAIN_BUFFER *txBuffer = NULL;
+RING_BUFFER *rxBuffer = NULL;
+RING_BUFFER *txBuffer = NULL;
 
 unsigned char rxBufferLockFlag = 0;
 unsigned char txBufferLockFlag = 0;
@@ -82,12 +79,12 @@ void modemDataUnlockFlag(unsigned char *flag) {
 /* Create the RX and TX buffers with the defined sizes. */
 void modemDataSetupBuffers(void) {
     if(!rxBuffer) {
-        rxBuffer         = createChainBuffer(MODEM_RX_BUFFER_SIZE);
+        rxBuffer         = createRingBuffer(MODEM_RX_BUFFER_SIZE);
         rxBufferLockFlag = 0;
     }
 
     if(!txBuffer) {
-        txBuffer         = createChainBuffer(MODEM_TX_BUFFER_SIZE);
+        txBuffer         = createRingBuffer(MODEM_TX_BUFFER_SIZE);
         txBufferLockFlag = 0;
     }
 }
@@ -95,11 +92,8 @@ void modemDataSetupBuffers(void) {
 /* Clears all data from the RX and TX buffers and makes sure they're ready for
    use */
 void modemDataClearBuffers(void) {
-    if(rxBuffer)
-        clearChainBuffer(rxBuffer);
-
-    if(txBuffer)
-        clearChainBuffer(txBuffer);
+    clearRingBuffer(rxBuffer);
+    clearRingBuffer(txBuffer);
 
     rxBufferLockFlag = 0;
     txBufferLockFlag = 0;
@@ -107,31 +101,34 @@ void modemDataClearBuffers(void) {
 
 void modemDataDestroyBuffers(void) {
     if(rxBuffer) {
-        destroyChainBuffer(rxBuffer);
+        destroyRingBuffer(rxBuffer);
         rxBuffer = NULL;
     }
 
     if(txBuffer) {
-        destroyChainBuffer(txBuffer);
+        destroyRingBuffer(txBuffer);
         txBuffer = NULL;
     }
 }
 
 /* Internal function. It's assumed that this is being called from a function
-   that already has a valid lock on the receive buffer. Returns the number of
-   bytes that were written to the local RX FIFO buffer. */
+   that already has a valid lock on the receive buffer. The MDP's RX FIFO is
+   drained straight into the receive buffer for as long as it has data and
+   there's room, so one interrupt takes care of everything that has arrived.
+   Returns the number of bytes that were written to the receive buffer. */
 int modemDataInternalHandleReceivedData(void) {
-    int           freeSpace;
+    int           space;
     int           offset;
-    unsigned char data[MODEM_DATA_LIMIT];
+    int           total = 0;
+    unsigned char *dst;
     unsigned char wasEmpty;
 
-    wasEmpty = chainBufferContainsData(rxBuffer) ? 0 : 1;
+    wasEmpty = getRingBufferLength(rxBuffer) ? 0 : 1;
 
     /* Check for an overflow */
     if(modemRead(REGLOC(0xA)) & 0x8) { /* Check OE */
         /* Critical: Clear the receive buffer that's in system RAM */
-        clearChainBuffer(rxBuffer);
+        clearRingBuffer(rxBuffer);
 
         if(modemCfg.eventHandler)
             modemCfg.eventHandler(MODEM_EVENT_OVERFLOW);
@@ -140,28 +137,25 @@ int modemDataInternalHandleReceivedData(void) {
         modemClearBits(REGLOC(0xA), 0x8);
     }
 
-    /* Copy data from the MDP's RX FIFO buffer to the local RX FIFO buffer if
-       any data exists */
-    freeSpace = getChainBufferFreeSpace(rxBuffer);
-    offset    = 0;
-
-    if(freeSpace > MODEM_DATA_LIMIT)
-        freeSpace = MODEM_DATA_LIMIT;
+    /* Copy data from the MDP's RX FIFO buffer to the receive buffer. This
+       takes at most two runs, either side of the point where it wraps. */
+    do {
+        dst    = getRingBufferSpace(rxBuffer, &space);
+        offset = 0;
 
-    while((modemRead(REGLOC(0xC)) & 0x2) && offset < freeSpace) { /* Checks RXFNE */
-        data[offset] = modemRead(REGLOC(0x0)); /* Read a byte */
-        offset++;
-    }
+        while(offset < space && (modemRead(REGLOC(0xC)) & 0x2)) { /* Checks RXFNE */
+            dst[offset] = modemRead(REGLOC(0x0)); /* Read a byte */
+            offset++;
+        }
 
-    /* If anything was read, then store it in the chain buffer */
-    if(offset > 0) {
-        writeToChainBuffer(rxBuffer, data, offset);
+        commitRingBuffer(rxBuffer, offset);
+        total += offset;
+    } while(offset && offset == space);
 
-        if(wasEmpty && modemCfg.eventHandler)
-            modemCfg.eventHandler(MODEM_EVENT_RX_NOT_EMPTY);
-    }
+    if(total > 0 && wasEmpty && modemCfg.eventHandler)
+        modemCfg.eventHandler(MODEM_EVENT_RX_NOT_EMPTY);
 
-    return offset;
+    return total;
 }
 
 /* Internal function. It's assumed that this is being called from a function
@@ -169,12 +163,10 @@ int modemDataInternalHandleReceivedData(void) {
 void modemDataInternalHandleOutgoingData(void) {
     int           bufferLength;
     int           counter;
-    unsigned char data;
+    unsigned char *src;
 
     /* Don't need to do anything if the local TX FIFO buffer is empty */
-    bufferLength = getChainBufferLength(txBuffer);
-
-    if(bufferLength <= 0)
+    if(getRingBufferLength(txBuffer) <= 0)
         return;
 
     /* CTS needs to be set before any data can be copied into TBUFFER */
@@ -185,24 +177,21 @@ void modemDataInternalHandleOutgoingData(void) {
     /* Copy data from the local TX FIFO buffer into the MDP's TX FIFO buffer
         while there's data in the local buffer and there's space in the MDP's
         buffer */
-    counter = 0;
-
-    while((modemRead(REGLOC(0x0D)) & 0x2) && bufferLength > 0 &&
-            counter < MODEM_DATA_LIMIT) { /* Checks TXFNF */
-        /* Read a byte from the chain buffer */
-        if(readFromChainBuffer(txBuffer, &data, 1) != 1)
-            assert(0); /* This should never happen */
+    do {
+        src = peekRingBuffer(txBuffer, &bufferLength);
 
-        /* Write the byte to TBUFFER */
-        modemWrite(REGLOC(0x10), data);
+        for(counter = 0; counter < bufferLength &&
+            (modemRead(REGLOC(0x0D)) & 0x2); counter++) { /* Checks TXFNF */
+            /* Write the byte to TBUFFER */
+            modemWrite(REGLOC(0x10), src[counter]);
+        }
 
-        bufferLength--;
-        counter++;
-    }
+        consumeRingBuffer(txBuffer, counter);
+    } while(counter && counter == bufferLength);
 
     /* If the buffer was emptied then generate the corresponding event
         if the event handler is set */
-    if(bufferLength <= 0 && modemCfg.eventHandler)
+    if(getRingBufferLength(txBuffer) <= 0 && modemCfg.eventHandler)
         modemCfg.eventHandler(MODEM_EVENT_TX_EMPTY);
 
 }
@@ -233,43 +222,59 @@ void modemDataUpdateTXBuffer(void) {
 
 int modem_read_data(unsigned char *data, int size) {
     int bytesRead = 0;
-    int bufferLength;
 
     if(!rxBuffer || !(modemCfg.flags & MODEM_CFG_FLAG_CONNECTED))
         return 0;
 
     if(modemDataLockFlag(&rxBufferLockFlag)) {
-        /* Make sure OE isn't set before reading. Don't read from the local
-           buffer if OE is set, since the buffer will be cleared soon after. */
-        if(!(modemRead(REGLOC(0xA)) & 0x8)) {
-            bufferLength = getChainBufferLength(rxBuffer);
-
-            if(bufferLength > 0)
-                bytesRead = readFromChainBuffer(rxBuffer, data,
-                                                (size < bufferLength) ? size :
-                                                bufferLength);
-        }
+        /* Update the receive buffer if there's data waiting on the MDP, then
+           read as much as possible into the destination. Don't read if OE is
+           set, since the buffer will be cleared soon after. */
+        modemDataInternalHandleReceivedData();
+
+        if(!(modemRead(REGLOC(0xA)) & 0x8))
+            bytesRead = readFromRingBuffer(rxBuffer, data, size);
+
+        modemDataUnlockFlag(&rxBufferLockFlag);
+    }
 
-        /* Update the local RX FIFO buffer if there's data waiting on the MDP */
-        bufferLength = modemDataInternalHandleReceivedData();
+    return bytesRead;
+}
 
-        /* If there's still room left in the destination and there's data in the
-           buffer then read as much as possible into the destination */
-        size -= bytesRead;
+const unsigned char *modem_read_peek(int *size) {
+    const unsigned char *rv = NULL;
 
-        if(size > 0 && bufferLength > 0)
-            bytesRead += readFromChainBuffer(rxBuffer, &data[bytesRead],
-                                             (size < bufferLength) ? size :
-                                             bufferLength);
+    *size = 0;
+
+    if(!rxBuffer || !(modemCfg.flags & MODEM_CFG_FLAG_CONNECTED))
+        return NULL;
+
+    if(modemDataLockFlag(&rxBufferLockFlag)) {
+        modemDataInternalHandleReceivedData();
+
+        if(!(modemRead(REGLOC(0xA)) & 0x8))
+            rv = peekRingBuffer(rxBuffer, size);
 
         modemDataUnlockFlag(&rxBufferLockFlag);
     }
 
-    return bytesRead;
+    return *size ? rv : NULL;
+}
+
+void modem_read_consume(int size) {
+    int irqState;
+
+    if(!rxBuffer)
+        return;
+
+    /* The interrupt handler only ever adds to the end, but it might clear the
+       buffer on an overflow, so this has to happen with it kept out. */
+    irqState = irq_disable();
+    consumeRingBuffer(rxBuffer, size);
+    irq_restore(irqState);
 }
 
 int modem_write_data(unsigned char *data, int size) {
-    int freeSpace;
     int bytesWritten = 0;
 
     if(!txBuffer || !(modemCfg.flags & MODEM_CFG_FLAG_CONNECTED))
@@ -278,17 +283,7 @@ int modem_write_data(unsigned char *data, int size) {
     if(modemDataLockFlag(&txBufferLockFlag)) {
         /* Write data from the source to the local buffer if there's any free
            space */
-        freeSpace = getChainBufferFreeSpace(txBuffer);
-
-        if(freeSpace > 0) {
-            if(size > freeSpace)
-                size = freeSpace;
-
-            if(writeToChainBuffer(txBuffer, data, size))
-                assert(0); /* This should never happen */
-
-            bytesWritten = size;
-        }
+        bytesWritten = writeToRingBuffer(txBuffer, data, size);
 
         /* Send data to the MDP if there's any waiting in the local buffer */
         modemDataInternalHandleOutgoingData();
@@ -302,7 +297,7 @@ int modem_write_data(unsigned char *data, int size) {
 /* If the modem has data waiting to be read a non zero value is returned,
    otherwise zero is returned. */
 int modem_has_data(void) {
-    return chainBufferContainsData(rxBuffer);
+    return getRingBufferLength(rxBuffer) > 0;
 }
 
 /********************************************************************/
@@ -349,7 +344,7 @@ int modem_dial(const char *digits) {
         if(length > 0) {
             /* Debug: The length of free space in the transmit buffer should be
                       greater than or equal to the length of the input digits */
-            assert(getChainBufferFreeSpace(txBuffer) >= length);
+            assert(getRingBufferFreeSpace(txBuffer) >= length);
 
             for(i = 0; i < length; i++) {
                 w = dtmf_trans(digits[i]);
@@ -357,17 +352,17 @@ int modem_dial(const char *digits) {
                 if(w < 0)
                     dbglog(DBG_ERROR, "modem_dial: unknown DTMF symbol '%c'\n", digits[i]);
                 else
-                    writeToChainBuffer(txBuffer, (unsigned char *)&w, 1);
+                    writeToRingBuffer(txBuffer, &w, 1);
             }
 
             primeBuffer = 1;
 
             /* Get the byte to prime the MDP's transmission buffer with */
-            length = readFromChainBuffer(txBuffer, &w, 1);
+            length = readFromRingBuffer(txBuffer, &w, 1);
             assert(length == 1); /* Should have read one byte */
 
             /* Get the number of bytes still in the transmission buffer */
-            length = getChainBufferLength(txBuffer);
+            length = getRingBufferLength(txBuffer);
         }
 
         modemDataUnlockFlag(&txBufferLockFlag);
@@ -398,13 +393,13 @@ void modemDataHandleDialingData(void) {
     /* Get a lock on the transmission buffer */
     if(modemDataLockFlag(&txBufferLockFlag)) {
         /* Get the byte to send to the MDP */
-        length = readFromChainBuffer(txBuffer, &data, 1);
+        length = readFromRingBuffer(txBuffer, &data, 1);
         (void)length;
         assert(length == 1); /* Should have read one byte */
 
         /* If this is going to be the last byte of data sent to the MDP then
            the dialing interrupts need to be cleared before that happens */
-        if(getChainBufferLength(txBuffer) <= 0) {
+        if(getRingBufferLength(txBuffer) <= 0) {
             /* Clear the dialing flag and interrupts */
             modemCfg.flags &= ~MODEM_CFG_FLAG_DIALING;
             modemInternalSetupDialingInts(1);
@@ -13,7 +13,7 @@
 #include <time.h>
 #include <arch/irq.h>
 #include <dc/g2bus.h>
-#include "chainbuf.h"
+#include "ringbuf.h"
 
 #ifndef REGLOC
 #define REGLOC(x) (0xA0600400 + (x) * 4)
@@ -0,0 +1,152 @@
+/* KallistiOS ##version##
+
+   ringbuf.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   Distributed under the terms of the KOS license.
+*/
+
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "ringbuf.h"
+
+/* Allocates a new ring buffer of at least length bytes. Length must be
+   greater than or equal to 1 */
+RING_BUFFER *createRingBuffer(int length) {
+    RING_BUFFER *buffer;
+    unsigned int size = 1;
+
+    assert(length >= 1);
+
+    while(size < (unsigned int)length)
+        size <<= 1;
+
+    buffer = (RING_BUFFER *)malloc(sizeof(RING_BUFFER));
+    assert(buffer);
+
+    memset(buffer, 0, sizeof(RING_BUFFER));
+
+    buffer->size = size;
+    buffer->data = (unsigned char *)malloc(size);
+
+    assert(buffer->data);
+
+    return buffer;
+}
+
+void destroyRingBuffer(RING_BUFFER *buffer) {
+    if(buffer) {
+        free(buffer->data);
+        free(buffer);
+    }
+}
+
+void clearRingBuffer(RING_BUFFER *buffer) {
+    if(buffer)
+        buffer->start = buffer->end;
+}
+
+/* Gets the number of bytes stored */
+int getRingBufferLength(RING_BUFFER *buffer) {
+    if(!buffer)
+        return 0;
+
+    return buffer->end - buffer->start;
+}
+
+/* Gets the number of bytes that are unused */
+int getRingBufferFreeSpace(RING_BUFFER *buffer) {
+    if(!buffer)
+        return 0;
+
+    return buffer->size - (buffer->end - buffer->start);
+}
+
+unsigned char *peekRingBuffer(RING_BUFFER *buffer, int *length) {
+    unsigned int offset = buffer->start & (buffer->size - 1);
+    unsigned int used = buffer->end - buffer->start;
+
+    *length = (used < buffer->size - offset) ? used : buffer->size - offset;
+
+    return buffer->data + offset;
+}
+
+/* Drops up to length bytes from the front. Asking for more than is there is
+   fine, in case the buffer was cleared since it was peeked at. */
+void consumeRingBuffer(RING_BUFFER *buffer, int length) {
+    int used = getRingBufferLength(buffer);
+
+    buffer->start += (length < used) ? length : used;
+}
+
+unsigned char *getRingBufferSpace(RING_BUFFER *buffer, int *length) {
+    unsigned int offset = buffer->end & (buffer->size - 1);
+    unsigned int space = buffer->size - (buffer->end - buffer->start);
+
+    *length = (space < buffer->size - offset) ? space : buffer->size - offset;
+
+    return buffer->data + offset;
+}
+
+void commitRingBuffer(RING_BUFFER *buffer, int length) {
+    buffer->end += length;
+}
+
+/* Stores as much of the data as fits, and returns how much that was. The
+   copy is done in at most two pieces, either side of the wrap. */
+int writeToRingBuffer(RING_BUFFER *buffer, const void *data, int length) {
+    const unsigned char *src = (const unsigned char *)data;
+    unsigned char *dst;
+    int written = 0, n;
+
+    assert(length >= 0);
+
+    if(!buffer)
+        return 0;
+
+    while(written < length) {
+        dst = getRingBufferSpace(buffer, &n);
+
+        if(!n)
+            break;
+
+        if(n > length - written)
+            n = length - written;
+
+        memcpy(dst, src + written, n);
+        commitRingBuffer(buffer, n);
+        written += n;
+    }
+
+    return written;
+}
+
+/* Reads up to length bytes into the destination. The actual number of bytes
+   read is returned. */
+int readFromRingBuffer(RING_BUFFER *buffer, void *data, int length) {
+    unsigned char *dst = (unsigned char *)data;
+    const unsigned char *src;
+    int bytesRead = 0, n;
+
+    assert(length >= 0);
+
+    if(!buffer)
+        return 0;
+
+    while(bytesRead < length) {
+        src = peekRingBuffer(buffer, &n);
+
+        if(!n)
+            break;
+
+        if(n > length - bytesRead)
+            n = length - bytesRead;
+
+        memcpy(dst + bytesRead, src, n);
+        consumeRingBuffer(buffer, n);
+        bytesRead += n;
+    }
+
+    return bytesRead;
+}
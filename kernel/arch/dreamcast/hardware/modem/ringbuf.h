@@ -0,0 +1,38 @@
+/* KallistiOS ##version##
+
+   ringbuf.h
+   Copyright (C) 2026 KallistiOS Contributors
+
+   Distributed under the terms of the KOS license.
+*/
+
+#ifndef __RINGBUF_H
+#define __RINGBUF_H
+
+/* A ring buffer whose size is a power of two. The start and end counters run
+   freely and are only masked to index the data, so the buffer can be filled
+   completely and the length is always end - start. */
+typedef struct {
+    unsigned int           size;       /* Number of bytes allocated to data */
+    volatile unsigned int  start, end; /* Read and write counters */
+    unsigned char          *data;
+} RING_BUFFER;
+
+/* From ringbuf.c */
+RING_BUFFER   *createRingBuffer(int length);
+void          destroyRingBuffer(RING_BUFFER *buffer);
+void          clearRingBuffer(RING_BUFFER *buffer);
+int           getRingBufferLength(RING_BUFFER *buffer);
+int           getRingBufferFreeSpace(RING_BUFFER *buffer);
+int           writeToRingBuffer(RING_BUFFER *buffer, const void *data,
+                                int length);
+int           readFromRingBuffer(RING_BUFFER *buffer, void *data, int length);
+
+/* Direct access: get the longest contiguous run of data that can be read (or
+   space that can be written) in place, then say how much of it was used. */
+unsigned char *peekRingBuffer(RING_BUFFER *buffer, int *length);
+void          consumeRingBuffer(RING_BUFFER *buffer, int length);
+unsigned char *getRingBufferSpace(RING_BUFFER *buffer, int *length);
+void          commitRingBuffer(RING_BUFFER *buffer, int length);
+
+#endif
@@ -16,14 +16,18 @@
 #include <dc/asic.h>
 #include <dc/g2bus.h>
 #include <dc/sq.h>
+#include <dc/perfctr.h>
 #include <dc/flashrom.h>
 #include <arch/irq.h>
 #include <arch/cache.h>
 #include <arch/memory.h>
 #include <kos/dbglog.h>
 #include <kos/net.h>
+#include <kos/net_buf.h>
 #include <kos/thread.h>
 #include <kos/sem.h>
+#include <kos/ringbuf.h>
+#include <kos/timer.h>
 
 /* Configuration definitions */
 
@@ -47,9 +51,31 @@
 /* This was originally set as ASIC_IRQB */
 #define BBA_ASIC_IRQ ASIC_IRQ_DEFAULT
 
-/* DMA transfer will be used only if the amount of bytes exceeds that threshold */
+/* DMA transfer will be used only if the amount of bytes exceeds that threshold,
+   by default. See bba_set_dma_threshold(). */
 #define DMA_THRESHOLD 128 // looks like a good value
 
+/* Once this many receive interrupts come within POLL_WINDOW milliseconds, the
+   receive interrupts are masked and the rx thread polls the chip instead,
+   until it finds nothing more to receive. See bba_set_poll_threshold(). */
+#define POLL_THRESHOLD  16
+#define POLL_WINDOW     10
+
+/* Most packets the rx thread handles in polling mode before letting the rest
+   of the system run for a millisecond. The chip's ring holds about that much
+   traffic at full speed, so under a flood the excess is dropped by the chip
+   instead of eating all of the CPU. */
+#define POLL_BUDGET     32
+
+/* Interrupts we want from the chip, and those of them that are masked while
+   polling */
+#define INTR_MASK       (RT_INT_PCIERR | RT_INT_TIMEOUT | \
+                         RT_INT_RXFIFO_OVERFLOW | \
+                         RT_INT_RXFIFO_UNDERRUN | /* +link change */ \
+                         RT_INT_RXBUF_OVERFLOW | RT_INT_TX_ERR | \
+                         RT_INT_TX_OK | RT_INT_RX_ERR | RT_INT_RX_OK)
+#define INTR_RX_MASK    (RT_INT_RX_ERR | RT_INT_RX_OK)
+
 /* Since callbacks will be running with interrupts enabled,
    it might be a good idea to protect bba_tx with a semaphore from inside.
    I'm not sure lwip needs that, but dcplaya does when using both lwip and its
@@ -243,6 +269,28 @@ void bba_set_rx_callback(eth_rx_callback_t cb) {
     eth_rx_callback = cb;
 }
 
+/* Packets larger than this are received by DMA, -1 to never use it */
+static int dma_threshold = DMA_THRESHOLD;
+
+/* Receive interrupts that switch to polling, -1 to never poll */
+static int poll_threshold = POLL_THRESHOLD;
+
+/* Receive statistics */
+static bba_rx_stats_t rx_stats;
+
+void bba_set_dma_threshold(int bytes) {
+    dma_threshold = bytes;
+}
+
+void bba_set_poll_threshold(int irqs) {
+    poll_threshold = irqs;
+}
+
+void bba_get_rx_stats(bba_rx_stats_t *stats) {
+    irq_disable_scoped();
+    *stats = rx_stats;
+}
+
 static int rtl_reset(void) {
     int i = 100;
 
@@ -371,15 +419,7 @@ static int bba_hw_init(void) {
     /* Enable receive interrupts */
     /* XXX need to handle more! */
     g2_write_16(NIC(RT_INTRSTATUS), 0xffff);
-    g2_write_16(NIC(RT_INTRMASK), RT_INT_PCIERR |
-                RT_INT_TIMEOUT |
-                RT_INT_RXFIFO_OVERFLOW |
-                RT_INT_RXFIFO_UNDERRUN |    // +link change
-                RT_INT_RXBUF_OVERFLOW |
-                RT_INT_TX_ERR |
-                RT_INT_TX_OK |
-                RT_INT_RX_ERR |
-                RT_INT_RX_OK);
+    g2_write_16(NIC(RT_INTRMASK), INTR_MASK);
 
     /* Reset RXMISSED counter */
     g2_write_32(NIC(RT_RXMISSED), 0);
@@ -464,25 +504,37 @@ static void g2_read_block_8_fast(uint8 *dst, uint8 *src, int len) {
 }
 
 
-#define RXBSZ    (64*1024) /* must be a power of two */
-#define MAX_PKTS (RXBSZ / 32)
-static struct pkt {
+/* Every packet waiting in the ring holds a pool buffer, so the ring never
+   needs more room than the pool has buffers. */
+#define MAX_PKTS 64
+struct pkt {
     int pkt_size;
     uint8 * rxbuff;
-} rx_pkt[MAX_PKTS];
+    net_buf_t * nb;
+};
+
+_Static_assert(MAX_PKTS >= NET_BUF_COUNT, "rx ring smaller than the pool");
+
+/* Received packets waiting for the rx thread. These are pushed from the IRQ
+   handler (or the DMA callback) and popped by the rx thread, so this needs no
+   locking. The packet being copied out of the chip lives in rx_cur until the
+   copy is done. */
+static ringbuf_t rx_ring;
+static struct pkt rx_cur;
 
-static alignas(32) uint8 rxbuff[RXBSZ + 2 * 1600];
-static uint32 rxbuff_pos;
-static int rxin;
-static int rxout;
 static int dma_used;
 
 static uint32 rx_size;
 
 static kthread_t * bba_rx_thread;
-static semaphore_t bba_rx_sema;
-static int bba_rx_exit_thread;
-static semaphore_t bba_rx_sema2;
+static volatile int bba_rx_exit_thread;
+
+/* Set while the receive interrupts are masked and the rx thread polls the
+   chip. The interrupts of the current window are counted to decide when to
+   switch to polling. */
+static volatile int rx_polling;
+static uint64 rx_window_start;
+static int rx_window_irqs;
 
 static void bba_rx(void);
 
@@ -497,10 +549,11 @@ static void rx_finish_enq(int room) {
     rtl.cur_rx = (rtl.cur_rx + rx_size + 4 + 3) & ~3;
     g2_write_16(NIC(RT_RXBUFTAIL), (rtl.cur_rx - 16) & (RX_BUFFER_LEN - 1));
 
-    if(room > 0 && (((rxin + 1) % MAX_PKTS) != rxout)) {
-        rxin = (rxin + 1) % MAX_PKTS;
-        sem_signal(&bba_rx_sema);
-        thd_schedule(true);
+    if(room > 0) {
+        if(!ringbuf_push(&rx_ring, &rx_cur))
+            net_buf_unref(rx_cur.nb);
+        else if(!rx_polling)
+            thd_schedule(true);
     }
 }
 
@@ -529,7 +582,7 @@ static int bba_copy_dma(uint8 * dst, uint32 s, int len) {
     if(len <= 0)
         return 1;
 
-    if(len > DMA_THRESHOLD && !irq_inside_int()) {
+    if(dma_threshold >= 0 && len > dma_threshold) {
         uint32 add;
 
         /*
@@ -586,32 +639,71 @@ static int  bba_copy_packet(uint8 * dst, uint32 src, int len) {
 }
 
 static int rx_enq(int ring_offset, size_t pkt_size) {
+    net_buf_t *nb;
+    uint64 start;
+    int rv;
+
     /* If there's no one to receive it, don't bother. */
     if(eth_rx_callback) {
-        if(rxin != rxout &&
-                (((rx_pkt[rxout].rxbuff - (rxbuff + 32)) - rxbuff_pos) & (RXBSZ - 1)) < pkt_size + 2048) {
+        /* Receive the packet into a buffer of the pool, that the stack can
+           keep instead of copying it again. If they're all in use, drop it. */
+        if(!(nb = net_buf_alloc())) {
+            ++rx_stats.dropped;
             return -1;
         }
 
-        /* Receive buffer: temporary space to copy out received data */
+        start = perf_cntr_count(PRFC0);
+
+        /* Keep the same alignment as in the chip's ring for the DMA. */
+        nb->data += ring_offset & 31;
+        nb->len = pkt_size;
 
         if(__is_defined(USE_P2_AREA))
-            rx_pkt[rxin].rxbuff = rxbuff + 32 + (rxbuff_pos | MEM_AREA_P2_BASE) + (ring_offset & 31);
+            rx_cur.rxbuff = (uint8 *)((uint32)nb->data | MEM_AREA_P2_BASE);
         else
-            rx_pkt[rxin].rxbuff = rxbuff + 32 + rxbuff_pos + (ring_offset & 31);
+            rx_cur.rxbuff = nb->data;
 
-        rxbuff_pos = (rxbuff_pos + pkt_size + 63) & (RXBSZ - 32);
+        rx_cur.nb = nb;
+        rx_cur.pkt_size = pkt_size;
+        rv = bba_copy_packet(rx_cur.rxbuff, ring_offset, pkt_size);
 
-        rx_pkt[rxin].pkt_size = pkt_size;
-        return bba_copy_packet(rx_pkt[rxin].rxbuff, ring_offset, pkt_size);
+        /* Only count what the CPU spent, not the time the DMA takes. */
+        ++rx_stats.pkts;
+        rx_stats.bytes += pkt_size;
+        rx_stats.cycles += perf_cntr_count(PRFC0) - start;
+
+        if(dma_used)
+            ++rx_stats.dma_pkts;
+
+        return rv;
     }
     else
-        return 1;
+        return -1;
 }
 
-/* Transmit a single packet */
-static int bba_rtx(const uint8 * pkt, int len, int wait)
+/* Copy one piece of a packet out to RTL memory */
+static void bba_tx_copy(const uint8 * pkt, uint32 dst, int len) {
+    /* XXX could use store queues or memcpy8 here */
+
+    /* Check alignment of the piece and of where it goes: if they're both
+       32-bit aligned, use g2_write_block_32, if they're 16-bit aligned, use
+       g2_write_block_16, otherwise, use g2_write_block_8. */
+    if(!(((uint32)pkt | dst) & 0x03)) {
+        g2_write_block_32((uint32 *) pkt, dst, (len + 3) >> 2);
+    }
+    else if(!(((uint32)pkt | dst) & 0x01)) {
+        g2_write_block_16((uint16 *) pkt, dst, (len + 1) >> 1);
+    }
+    else {
+        g2_write_block_8(pkt, dst, len);
+    }
+}
+
+/* Transmit a single packet, gathered from several pieces */
+static int bba_rtx(const struct iovec * iov, int iovcnt, int wait)
 {
+    int i, len = 0;
+
     if(!link_stable) {
         if(wait == BBA_TX_WAIT) {
             while(!link_stable)
@@ -635,22 +727,15 @@ static int bba_rtx(const uint8 * pkt, int len, int wait)
         }
     }
 
-    /* Copy the packet out to RTL memory */
-    /* XXX could use store queues or memcpy8 here */
-
-    //g2_write_block_8(pkt, txdesc[rtl.cur_tx], len);
+    /* Copy the pieces out to RTL memory one after the other. The block writes
+       can run a byte or so past the end of a piece, but the next piece
+       overwrites that. */
+    for(i = 0; i < iovcnt; i++) {
+        if(len + iov[i].iov_len > TX_BUFFER_LEN)
+            return BBA_TX_ERROR;
 
-    /* Check alignment of the packet, if its 32-bit aligned, use
-       g2_write_block_32, if its 16-bit aligned, use g2_write_block_16,
-       otherwise, use g2_write_block_8. */
-    if(!((uint32)pkt & 0x03)) {
-        g2_write_block_32((uint32 *) pkt, txdesc[rtl.cur_tx], (len + 3) >> 2);
-    }
-    else if(!((uint32)pkt & 0x01)) {
-        g2_write_block_16((uint16 *) pkt, txdesc[rtl.cur_tx], (len + 1) >> 1);
-    }
-    else {
-        g2_write_block_8(pkt, txdesc[rtl.cur_tx], len);
+        bba_tx_copy(iov[i].iov_base, txdesc[rtl.cur_tx] + len, iov[i].iov_len);
+        len += iov[i].iov_len;
     }
 
     /* All packets must be at least 60 bytes, pad them with null bytes if
@@ -669,11 +754,11 @@ static int bba_rtx(const uint8 * pkt, int len, int wait)
     return BBA_TX_OK;
 }
 
-int bba_tx(const uint8 * pkt, int len, int wait) {
+static int bba_tx_iov(const struct iovec * iov, int iovcnt, int wait) {
     int res;
 
     if(!__is_defined(TX_SEMA))
-        return bba_rtx(pkt, len, wait);
+        return bba_rtx(iov, iovcnt, wait);
 
     if(irq_inside_int()) {
         if(sem_trywait(&tx_sema)) {
@@ -684,12 +769,18 @@ int bba_tx(const uint8 * pkt, int len, int wait) {
     else
         sem_wait(&tx_sema);
 
-    res = bba_rtx(pkt, len, wait);
+    res = bba_rtx(iov, iovcnt, wait);
     sem_signal(&tx_sema);
 
     return res;
 }
 
+int bba_tx(const uint8 * pkt, int len, int wait) {
+    struct iovec iov = { (void *)pkt, len };
+
+    return bba_tx_iov(&iov, 1, wait);
+}
+
 void bba_lock(void) {
     //sem_wait(&bba_rx_sema2);
     //asic_evt_disable(ASIC_EVT_EXP_PCI, BBA_ASIC_IRQ);
@@ -700,27 +791,107 @@ void bba_unlock(void) {
     //sem_signal(&bba_rx_sema2);
 }
 
+/* Hand up to budget received packets to the callback, and drop our reference
+   to each buffer once the callback is done with it. Anything the stack queued
+   keeps its own reference. Returns the number of packets handled. */
+static int bba_rx_deliver(int budget) {
+    struct pkt *p;
+    int n = 0;
+
+    /* Process packets in place */
+    while(n < budget && (p = ringbuf_peek(&rx_ring))) {
+        /* Call the callback to process it */
+        eth_rx_callback(p->rxbuff, p->pkt_size);
+
+        net_buf_unref(p->nb);
+        ringbuf_pop(&rx_ring, NULL);
+        ++n;
+    }
+
+    return n;
+}
+
+/* Copy whatever the chip has received into the ring, unless a copy is already
+   in flight, in which case its DMA callback carries on from there. */
+static void bba_rx_kick(void) {
+    irq_disable_scoped();
+
+    if(!dma_used)
+        bba_rx();
+}
+
+/* Mask the receive interrupts and let the rx thread poll. Called from the IRQ
+   handler. */
+static void bba_poll_enter(void) {
+    g2_write_16(NIC(RT_INTRMASK), INTR_MASK & ~INTR_RX_MASK);
+    rx_polling = 1;
+    ++rx_stats.polls;
+    ringbuf_wake(&rx_ring);
+}
+
+/* Go back to receive interrupts, unless something came in since the rx thread
+   last looked. Once the status is cleared, anything new raises an interrupt as
+   soon as they're unmasked. */
+static void bba_poll_leave(void) {
+    irq_disable_scoped();
+
+    g2_write_16(NIC(RT_INTRSTATUS), RT_INT_RX_ACK);
+
+    if(dma_used || !ringbuf_empty(&rx_ring) ||
+       !(g2_read_8(NIC(RT_CHIPCMD)) & RT_CMD_RX_BUF_EMPTY))
+        return;
+
+    rx_polling = 0;
+    rx_window_irqs = 0;
+    g2_write_16(NIC(RT_INTRMASK), INTR_MASK);
+}
+
 static void *bba_rx_threadfunc(void *dummy) {
+    int n;
+
     (void)dummy;
 
     while(!bba_rx_exit_thread) {
-        //sem_wait_timed(&bba_rx_sema, 500);
-        sem_wait(&bba_rx_sema);
+        if(!rx_polling) {
+            ringbuf_wait(&rx_ring, 0);
 
-        if(bba_rx_exit_thread)
-            break;
+            if(bba_rx_exit_thread)
+                break;
+        }
 
         bba_lock();
 
-        if(rxout != rxin) {
+        if(!rx_polling) {
+            bba_rx_deliver(MAX_PKTS);
+            bba_unlock();
+            continue;
+        }
 
-            /* Call the callback to process it */
-            eth_rx_callback(rx_pkt[rxout].rxbuff, rx_pkt[rxout].pkt_size);
+        /* Polling: pull packets out of the chip ourselves, a batch at a
+           time. */
+        bba_rx_kick();
+        n = bba_rx_deliver(POLL_BUDGET);
+        bba_unlock();
 
-            rxout = (rxout + 1) % MAX_PKTS;
+        if(n == POLL_BUDGET) {
+            thd_sleep(1);
+        }
+        else if(n) {
+            thd_pass();
         }
+        else {
+            bba_poll_leave();
 
-        bba_unlock();
+            /* Still polling if a copy was in flight. */
+            if(rx_polling)
+                thd_pass();
+        }
+    }
+
+    /* Leave the receive interrupts the way they were set up. */
+    if(rx_polling) {
+        rx_polling = 0;
+        g2_write_16(NIC(RT_INTRMASK), INTR_MASK);
     }
 
     bba_rx_exit_thread = 0;
@@ -807,7 +978,12 @@ static void bba_irq_hnd(uint32 code, void *data) {
     /* Do processing */
     hnd = 0;
 
-    if(intr & RT_INT_RX_ACK) {
+    /* While polling, the receive status bits still get set, but the rx thread
+       takes care of them. */
+    if(rx_polling && (intr & RT_INT_RX_ACK)) {
+        hnd = 1;
+    }
+    else if(intr & RT_INT_RX_ACK) {
 
         if(!dma_used) {
             bba_rx();
@@ -816,6 +992,19 @@ static void bba_irq_hnd(uint32 code, void *data) {
         /* so that the irq is not called again and again */
         g2_write_16(NIC(RT_INTRSTATUS), RT_INT_RX_ACK);
 
+        /* If they keep coming, switch to polling. */
+        if(poll_threshold > 0) {
+            uint64 now = timer_ms_gettime64();
+
+            if(now - rx_window_start >= POLL_WINDOW) {
+                rx_window_start = now;
+                rx_window_irqs = 0;
+            }
+
+            if(++rx_window_irqs >= poll_threshold)
+                bba_poll_enter();
+        }
+
         hnd = 1;
     }
 
@@ -918,10 +1107,8 @@ static int bba_if_start(netif_t *self) {
 
     // Start the BBA RX thread.
     assert(bba_rx_thread == NULL);
-    sem_init(&bba_rx_sema, 0);
-    sem_init(&bba_rx_sema2, 1);
     bba_rx_thread = thd_create(0, bba_rx_threadfunc, 0);
-    bba_rx_thread->prio = 1;
+    thd_set_prio(bba_rx_thread, 1);
     thd_set_label(bba_rx_thread, "BBA-rx-thd");
 
     /* We need something like this to get DHCP to work (since it doesn't
@@ -953,11 +1140,8 @@ static int bba_if_stop(netif_t *self) {
     /* VP : Shutdown rx thread */
     assert(bba_rx_thread != NULL);
     bba_rx_exit_thread = 1;
-    sem_signal(&bba_rx_sema);
-    sem_signal(&bba_rx_sema2);
+    ringbuf_wake(&rx_ring);
     thd_join(bba_rx_thread, NULL);
-    sem_destroy(&bba_rx_sema);
-    sem_destroy(&bba_rx_sema2);
 
     bba_rx_thread = NULL;
 
@@ -977,6 +1161,19 @@ static int bba_if_tx(netif_t *self, const uint8 *data, int len, int blocking) {
     return 0;
 }
 
+static int bba_if_tx_iov(netif_t *self, const struct iovec *iov, int iovcnt,
+                         int blocking) {
+    (void)self;
+
+    if(!(bba_if.flags & NETIF_RUNNING))
+        return -1;
+
+    if(bba_tx_iov(iov, iovcnt, blocking) != BBA_TX_OK)
+        return -1;
+
+    return 0;
+}
+
 /* We'll auto-commit for now */
 static int bba_if_tx_commit(netif_t *self) {
     (void)self;
@@ -991,18 +1188,13 @@ static int bba_if_rx_poll(netif_t *self) {
     intr = g2_read_16(NIC(RT_INTRSTATUS));
 
     if(intr & RT_INT_RX_ACK) {
-        bba_rx();
+        bba_rx_kick();
 
         /* so that the irq is not called */
         g2_write_16(NIC(RT_INTRSTATUS), RT_INT_RX_ACK);
     }
 
-    if(rxout != rxin) {
-        /* Call the callback to process it */
-        eth_rx_callback(rx_pkt[rxout].rxbuff, rx_pkt[rxout].pkt_size);
-
-        rxout = (rxout + 1) % MAX_PKTS;
-    }
+    bba_rx_deliver(POLL_BUDGET);
 
     return 0;
 }
@@ -1119,6 +1311,17 @@ int bba_init(void) {
         return -1;
     }
 
+    if(ringbuf_init(&rx_ring, sizeof(struct pkt), MAX_PKTS, 0) < 0) {
+        dbglog(DBG_ERROR, "bba: can't allocate rx queue\n");
+        return -1;
+    }
+
+    if(net_buf_init() < 0) {
+        dbglog(DBG_ERROR, "bba: can't allocate rx buffers\n");
+        ringbuf_destroy(&rx_ring);
+        return -1;
+    }
+
     bba_get_mac(bba_if.mac_addr);
     memset(bba_if.ip_addr, 0, sizeof(bba_if.ip_addr));
     memset(bba_if.netmask, 0, sizeof(bba_if.netmask));
@@ -1138,6 +1341,7 @@ int bba_init(void) {
     bba_if.if_start = bba_if_start;
     bba_if.if_stop = bba_if_stop;
     bba_if.if_tx = bba_if_tx;
+    bba_if.if_tx_iov = bba_if_tx_iov;
     bba_if.if_tx_commit = bba_if_tx_commit;
     bba_if.if_rx_poll = bba_if_rx_poll;
     bba_if.if_set_flags = bba_if_set_flags;
@@ -1175,6 +1379,9 @@ int bba_shutdown(void) {
     if(__is_defined(TX_SEMA))
         sem_destroy(&tx_sema);
 
+    ringbuf_destroy(&rx_ring);
+    net_buf_shutdown();
+
     return 0;
 }
 
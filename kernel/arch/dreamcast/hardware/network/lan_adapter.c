@@ -251,6 +251,84 @@ static void la_write(int reg, int bank, int value) {
     g2_write_8(REGLOC(reg), value);
 }
 
+/* Bytes moved through the buffer memory port per G2 lock. This bounds how
+   long interrupts are kept off. */
+#define LA_BURST    128
+
+/* Read a block from the buffer memory port. The port is only 8 bits wide, so
+   this still takes a G2 access per byte, but the bank is selected once and
+   the G2 lock is only taken once per burst rather than for every byte. When
+   the destination is aligned, the bytes are gathered up and stored four at a
+   time. */
+static void la_read_block(uint8 *dst, int len) {
+    volatile uint32 *port = (volatile uint32 *)REGLOC(8);
+    uint32 *dst32;
+    g2_ctx_t ctx;
+    int n;
+
+    la_set_bank(DLCR7_RBS_B8);
+
+    while(len > 0) {
+        n = len < LA_BURST ? len : LA_BURST;
+        len -= n;
+
+        ctx = g2_lock();
+
+        if(!((uintptr_t)dst & 3)) {
+            for(dst32 = (uint32 *)dst; n >= 4; n -= 4) {
+                uint32 w = *port & 0xff;
+                w |= (*port & 0xff) << 8;
+                w |= (*port & 0xff) << 16;
+                w |= (*port & 0xff) << 24;
+                *dst32++ = w;
+            }
+
+            dst = (uint8 *)dst32;
+        }
+
+        while(n--)
+            *dst++ = *port & 0xff;
+
+        g2_unlock(ctx);
+    }
+}
+
+/* Write a block to the buffer memory port, the same way as above. */
+static void la_write_block(const uint8 *src, int len) {
+    volatile uint8 *port = (volatile uint8 *)REGLOC(8);
+    g2_ctx_t ctx;
+    int n;
+
+    la_set_bank(DLCR7_RBS_B8);
+
+    while(len > 0) {
+        n = len < LA_BURST ? len : LA_BURST;
+        len -= n;
+
+        ctx = g2_lock();
+
+        while(n--)
+            *port = *src++;
+
+        g2_unlock(ctx);
+    }
+}
+
+/* Throw away the packet at the head of the receive buffer, after its 4 byte
+   header has been read. The chip wants at least the first 16 bytes read out
+   before the rest can be skipped. */
+static void la_drop_rx(int len) {
+    uint8 junk[12];
+
+    if(len > 12) {
+        la_read_block(junk, 12);
+        la_write(BMPR14, la_read(BMPR14) | BMPR14_SKIPRX);
+    }
+    else if(len > 0) {
+        la_read_block(junk, len);
+    }
+}
+
 /* This is based on the JLI EEPROM reader from FreeBSD. EEPROM in the
    Sega adapter is a bit simpler than what is described in the Fujitsu
    manual -- it appears to contain only the MAC address and not a base
@@ -446,8 +524,8 @@ static int total_pkts_rx = 0, total_pkts_tx = 0;
 /* Transmit a packet */
 /* Note that it's technically possible to queue up more than one packet
    at a time for transmission, but this is the simple way. */
-static int la_tx(const uint8 * pkt, int len, int blocking) {
-    int i, timeout;
+static int la_tx_iov(const struct iovec * iov, int iovcnt, int blocking) {
+    int i, j, len = 0, timeout;
 
     (void)blocking;
 
@@ -464,17 +542,23 @@ static int la_tx(const uint8 * pkt, int len, int blocking) {
         return 0;
     }
 
-    /* Is the length less than the minimum? */
-    if(len < 0x60)
-        len = 0x60;
+    for(i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
 
-    /* Poke the length */
-    la_write(BMPR8, (len & 0x00ff));
-    la_write(BMPR8, (len & 0xff00) >> 8);
+    /* Poke the length, padding it up to the minimum if needed */
+    j = len < 0x60 ? 0x60 : len;
+    la_write(BMPR8, (j & 0x00ff));
+    la_write(BMPR8, (j & 0xff00) >> 8);
 
-    /* Write the packet */
-    for(i = 0; i < len; i++)
-        la_write(BMPR8, pkt[i]);
+    /* Write the packet, one piece after the other */
+    for(i = 0; i < iovcnt; i++)
+        la_write_block(iov[i].iov_base, iov[i].iov_len);
+
+    if(len < 0x60) {
+        static const uint8 pad[0x60];
+
+        la_write_block(pad, 0x60 - len);
+    }
 
     /* Start the transmitter */
     thd_sleep(2);
@@ -485,11 +569,18 @@ static int la_tx(const uint8 * pkt, int len, int blocking) {
     return 1;
 }
 
-static unsigned char current_pkt[1514];
+static int la_tx(const uint8 * pkt, int len, int blocking) {
+    struct iovec iov = { (void *)pkt, len };
+
+    return la_tx_iov(&iov, 1, blocking);
+}
+
+static unsigned char current_pkt[1514] __attribute__((aligned(4)));
 
 /* Check for received packets */
 static int la_rx(void) {
-    int i, status, len, count;
+    uint8 hdr[4];
+    int status, len, count;
 
     assert_msg(la_started == LA_RUNNING, "la_rx called out of sequence");
 
@@ -498,29 +589,28 @@ static int la_rx(void) {
         if(la_read(DLCR5) & DLCR5_BUFEMP)
             return count;
 
-        /* Get the receive status byte */
-        status = la_read(BMPR8);
-        (void)la_read(BMPR8);
-
-        /* Get the packet length */
-        len = la_read(BMPR8);
-        len |= la_read(BMPR8) << 8;
+        /* Get the receive status byte and the packet length */
+        la_read_block(hdr, 4);
+        status = hdr[0];
+        len = hdr[2] | (hdr[3] << 8);
 
-        /* Check for errors */
+        /* Check for errors. Skip over bad packets rather than leaving them
+           stuck at the head of the buffer, so anything behind them still
+           gets through. */
         if((status & 0xF0) != 0x20) {
             dbglog(DBG_ERROR, "la_rx: receive error occurred (status %02x)\n", status);
-            return -1;
+            la_drop_rx(len);
+            continue;
         }
 
-        /* Read the packet */
         if(len > 1514) {
             dbglog(DBG_ERROR, "la_rx: big packet received (size %d)\n", len);
-            return -2;
+            la_drop_rx(len);
+            continue;
         }
 
-        for(i = 0; i < len; i++) {
-            current_pkt[i] = la_read(BMPR8);
-        }
+        /* Read the packet */
+        la_read_block(current_pkt, len);
 
         /* Submit it for processing */
         net_input(&la_if, current_pkt, len);
@@ -646,6 +736,17 @@ static int la_if_tx(netif_t * self, const uint8 * data, int len, int blocking) {
     return NETIF_TX_OK;
 }
 
+static int la_if_tx_iov(netif_t * self, const struct iovec * iov, int iovcnt,
+                        int blocking) {
+    if(!(self->flags & NETIF_RUNNING))
+        return NETIF_TX_ERROR;
+
+    if(la_tx_iov(iov, iovcnt, blocking) != 1)
+        return NETIF_TX_ERROR;
+
+    return NETIF_TX_OK;
+}
+
 /* We'll auto-commit for now */
 static int la_if_tx_commit(netif_t * self) {
     (void)self;
@@ -773,6 +874,7 @@ int la_init(void) {
     la_if.if_start = la_if_start;
     la_if.if_stop = la_if_stop;
     la_if.if_tx = la_if_tx;
+    la_if.if_tx_iov = la_if_tx_iov;
     la_if.if_tx_commit = la_if_tx_commit;
     la_if.if_rx_poll = la_if_rx_poll;
     la_if.if_set_flags = la_if_set_flags;
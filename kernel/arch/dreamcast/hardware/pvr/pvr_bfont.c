@@ -0,0 +1,385 @@
+/* KallistiOS ##version##
+
+   pvr_bfont.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* BIOS font glyph atlas. Glyphs are drawn with bfont_draw_ex() at 4bpp into
+   a small buffer in RAM, and written from there into their spot of a
+   twiddled 4bpp texture, a 2x2 group of pixels (16 bits) at a time. The top
+   of the texture has a fixed spot for each thin glyph; the rest is a cache of
+   wide glyphs, looked up by a hash of their code. Each wide glyph remembers
+   the last scene that drew it, so that it's only replaced once the PVR is
+   done with it. */
+
+#include <errno.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <dc/biosfont.h>
+#include <dc/pvr.h>
+
+#include "pvr_internal.h"
+
+#define ATLAS_SIZE      512
+
+/* Thin glyphs: 256 character codes, then the 64 half-width kana */
+#define THIN_COLS       (ATLAS_SIZE / BFONT_THIN_WIDTH)
+#define THIN_ROWS       8
+#define THIN_KANA       256
+#define THIN_SLOTS      (THIN_KANA + 64)
+
+/* Wide glyphs, under the thin ones */
+#define WIDE_TOP        (THIN_ROWS * BFONT_HEIGHT)
+#define WIDE_COLS       (ATLAS_SIZE / BFONT_WIDE_WIDTH)
+#define WIDE_ROWS       ((ATLAS_SIZE - WIDE_TOP) / BFONT_HEIGHT)
+#define WIDE_SLOTS      (WIDE_COLS * WIDE_ROWS)
+#define WIDE_HASH       64
+
+typedef enum {
+    GLYPH_THIN,
+    GLYPH_KANA,
+    GLYPH_WIDE
+} glyph_kind_t;
+
+typedef struct {
+    uint32_t code;                  /* Character and encoding, 0 if free */
+    int16_t next;                   /* Next in the hash chain, or -1 */
+    pvr_fence_t used;               /* Last scene drawing it */
+} wide_slot_t;
+
+static struct {
+    pvr_ptr_t txr;
+    int bank;
+
+    uint32_t thin[(THIN_SLOTS + 31) / 32];  /* Thin glyphs drawn already */
+
+    wide_slot_t wide[WIDE_SLOTS];
+    int16_t hash[WIDE_HASH];
+    int wide_used;                  /* Slots handed out so far */
+} bfa;
+
+/* Spread the bits of v out to the even bits */
+static inline uint32_t bfa_spread(uint32_t v) {
+    v = (v | (v << 8)) & 0x00ff00ff;
+    v = (v | (v << 4)) & 0x0f0f0f0f;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+/* Draw a glyph into the texture, with its top left at (sx, sy). */
+static void bfa_raster(uint32_t ch, glyph_kind_t kind, uint32_t sx,
+                       uint32_t sy) {
+    alignas(4) uint8_t buf[BFONT_WIDE_WIDTH * BFONT_HEIGHT / 2];
+    volatile uint16_t *txr = (volatile uint16_t *)bfa.txr;
+    bool wide = kind == GLYPH_WIDE;
+    uint32_t w = wide ? BFONT_WIDE_WIDTH : BFONT_THIN_WIDTH;
+    uint32_t x, y, a, b, t;
+    const uint8_t *row;
+
+    memset(buf, 0, sizeof(buf));
+    bfont_draw_ex(buf, w, 1, 0, 4, true, ch, wide, kind == GLYPH_KANA);
+
+    for(y = 0; y < BFONT_HEIGHT; y += 2) {
+        row = buf + y * w / 2;
+
+        for(x = 0; x < w; x += 2) {
+            a = row[x / 2];
+            b = row[(x + w) / 2];
+            t = bfa_spread(sy + y) | (bfa_spread(sx + x) << 1);
+
+            txr[t / 4] = (a & 15) | ((b & 15) << 4) | ((a >> 4) << 8) |
+                         ((b >> 4) << 12);
+        }
+    }
+}
+
+static inline uint32_t bfa_hash(uint32_t code) {
+    return (code ^ (code >> 6) ^ (code >> 16)) % WIDE_HASH;
+}
+
+/* Find a slot for a new wide glyph: a fresh one, or failing that the one
+   least recently drawn by a scene that has been rendered. */
+static int bfa_wide_evict(void) {
+    wide_slot_t *ws;
+    int i, best = -1;
+    int16_t *p;
+
+    if(bfa.wide_used < WIDE_SLOTS)
+        return bfa.wide_used++;
+
+    for(i = 0; i < WIDE_SLOTS; i++) {
+        if(pvr_fence_check(bfa.wide[i].used) < 0)
+            continue;
+
+        if(best < 0 || (int32_t)(bfa.wide[i].used - bfa.wide[best].used) < 0)
+            best = i;
+    }
+
+    if(best < 0)
+        return -1;
+
+    ws = &bfa.wide[best];
+
+    for(p = &bfa.hash[bfa_hash(ws->code)]; *p != best; p = &bfa.wide[*p].next)
+        ;
+
+    *p = ws->next;
+    ws->code = 0;
+
+    return best;
+}
+
+/* Get the spot of a glyph in the texture, drawing it there if needed. */
+static int bfa_glyph(uint32_t ch, glyph_kind_t kind, uint32_t *sx,
+                     uint32_t *sy) {
+    uint32_t code, h, idx;
+    int i;
+
+    if(kind != GLYPH_WIDE) {
+        idx = kind == GLYPH_KANA ? THIN_KANA + (ch - 0xa0) : ch;
+        *sx = (idx % THIN_COLS) * BFONT_THIN_WIDTH;
+        *sy = (idx / THIN_COLS) * BFONT_HEIGHT;
+
+        if(!(bfa.thin[idx / 32] & (1u << (idx % 32)))) {
+            bfa_raster(ch, kind, *sx, *sy);
+            bfa.thin[idx / 32] |= 1u << (idx % 32);
+        }
+
+        return 0;
+    }
+
+    /* The same code is a different glyph in EUC and Shift-JIS. */
+    code = ch | ((uint32_t)bfont_get_encoding() << 16);
+    h = bfa_hash(code);
+
+    for(i = bfa.hash[h]; i >= 0; i = bfa.wide[i].next)
+        if(bfa.wide[i].code == code)
+            break;
+
+    if(i < 0) {
+        if((i = bfa_wide_evict()) < 0)
+            return -1;
+
+        bfa.wide[i].code = code;
+        bfa.wide[i].next = bfa.hash[h];
+        bfa.hash[h] = i;
+
+        bfa_raster(ch, kind, (i % WIDE_COLS) * BFONT_WIDE_WIDTH,
+                   WIDE_TOP + (i / WIDE_COLS) * BFONT_HEIGHT);
+    }
+
+    bfa.wide[i].used = pvr_state.scene_seq;
+    *sx = (i % WIDE_COLS) * BFONT_WIDE_WIDTH;
+    *sy = WIDE_TOP + (i / WIDE_COLS) * BFONT_HEIGHT;
+
+    return 0;
+}
+
+/* Decode the next character the same way bfont_draw_str_ex() does. Returns
+   where the one after it starts. */
+static const char *bfa_next(const char *str, uint32_t *ch,
+                            glyph_kind_t *kind) {
+    uint32_t c = *str++ & 0xff;
+
+    *kind = GLYPH_THIN;
+
+    if(bfont_get_encoding() == BFONT_CODE_ISO8859_1 || !(c & 0x80)) {
+        *ch = c;
+        return str;
+    }
+
+    if(bfont_get_encoding() == BFONT_CODE_EUC) {
+        if(c == 0x8e) {
+            /* 'SS2': a half-width katakana follows */
+            c = *str & 0xff;
+
+            if(c)
+                str++;
+
+            *kind = GLYPH_KANA;
+        }
+        else
+            *kind = GLYPH_WIDE;
+    }
+    else {
+        switch(c & 0xf0) {
+            case 0x80:
+            case 0x90:
+            case 0xe0:
+                *kind = GLYPH_WIDE;
+                break;
+
+            default:
+                *kind = GLYPH_KANA;
+                break;
+        }
+    }
+
+    if(*kind == GLYPH_WIDE) {
+        if(!*str) {
+            /* Cut off halfway through */
+            *ch = ' ';
+            *kind = GLYPH_THIN;
+            return str;
+        }
+
+        c = (c << 8) | (*str++ & 0xff);
+    }
+    else if(c < 0xa1 || c > 0xdf) {
+        /* Not a valid half-width katakana character: blank space */
+        c = 0xa0;
+    }
+
+    *ch = c;
+    return str;
+}
+
+int pvr_bfont_init(int pal_bank) {
+    uint32_t *pal, white;
+    uint32_t ch, sx, sy;
+    int i;
+
+    if(pal_bank < 0 || pal_bank >= PVR_PAL_ENTRIES / 16) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!bfa.txr) {
+        bfa.txr = pvr_mem_malloc(ATLAS_SIZE * ATLAS_SIZE / 2);
+
+        if(!bfa.txr) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        memset(bfa.thin, 0, sizeof(bfa.thin));
+        memset(bfa.hash, 0xff, sizeof(bfa.hash));
+        bfa.wide_used = 0;
+
+        /* Have the printable ASCII ones ready from the start. */
+        for(ch = 33; ch < 127; ch++)
+            bfa_glyph(ch, GLYPH_THIN, &sx, &sy);
+    }
+
+    /* Entry 1 is opaque white, whatever the format; the rest transparent. */
+    white = (PVR_GET(PVR_PALETTE_CFG) & 3) == PVR_PAL_ARGB8888 ?
+            0xffffffff : 0xffff;
+
+    pal = pvr_pal_shadow();
+
+    for(i = 0; i < 16; i++)
+        pal[pal_bank * 16 + i] = i == 1 ? white : 0;
+
+    bfa.bank = pal_bank;
+
+    return pvr_pal_commit(pal_bank * 16, 16);
+}
+
+void pvr_bfont_shutdown(void) {
+    if(!bfa.txr)
+        return;
+
+    pvr_mem_free(bfa.txr);
+    bfa.txr = NULL;
+}
+
+int pvr_bfont_draw_str_ex(pvr_list_t list, float x, float y, float z,
+                          uint32_t argb, float scale, const char *str) {
+    pvr_sprite_cxt_t cxt;
+    pvr_sprite_hdr_t hdr;
+    alignas(32) pvr_sprite_txr_t spr;
+    glyph_kind_t kind;
+    uint32_t ch, sx, sy, w;
+    float cx = x, h = BFONT_HEIGHT * scale, u0, v0, u1, v1;
+
+    if(!bfa.txr || bfont_get_encoding() == BFONT_CODE_RAW) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pvr_sprite_cxt_txr(&cxt, list,
+                       PVR_TXRFMT_PAL4BPP | PVR_TXRFMT_4BPP_PAL(bfa.bank) |
+                       PVR_TXRFMT_TWIDDLED, ATLAS_SIZE, ATLAS_SIZE, bfa.txr,
+                       PVR_FILTER_NONE);
+    cxt.gen.culling = PVR_CULLING_NONE;
+    pvr_sprite_compile(&hdr, &cxt);
+    hdr.argb = argb;
+    pvr_prim(&hdr, sizeof(hdr));
+
+    spr.flags = PVR_CMD_VERTEX_EOL;
+    spr.az = spr.bz = spr.cz = z;
+    spr.dummy = 0;
+
+    while(*str) {
+        str = bfa_next(str, &ch, &kind);
+
+        if(kind == GLYPH_THIN && ch == '\n') {
+            cx = x;
+            y += h;
+            continue;
+        }
+        else if(kind == GLYPH_THIN && ch == '\t') {
+            cx += 4 * BFONT_THIN_WIDTH * scale;
+            continue;
+        }
+
+        w = kind == GLYPH_WIDE ? BFONT_WIDE_WIDTH : BFONT_THIN_WIDTH;
+
+        /* Spaces need no sprite, and a glyph without room stays blank. */
+        if(!(kind == GLYPH_THIN && ch == ' ') &&
+           !bfa_glyph(ch, kind, &sx, &sy)) {
+            u0 = (float)sx / ATLAS_SIZE;
+            v0 = (float)sy / ATLAS_SIZE;
+            u1 = (float)(sx + w) / ATLAS_SIZE;
+            v1 = (float)(sy + BFONT_HEIGHT) / ATLAS_SIZE;
+
+            spr.ax = cx;
+            spr.ay = y + h;
+            spr.bx = cx;
+            spr.by = y;
+            spr.cx = cx + w * scale;
+            spr.cy = y;
+            spr.dx = cx + w * scale;
+            spr.dy = y + h;
+            spr.auv = PVR_PACK_16BIT_UV(u0, v1);
+            spr.buv = PVR_PACK_16BIT_UV(u0, v0);
+            spr.cuv = PVR_PACK_16BIT_UV(u1, v0);
+
+            pvr_prim(&spr, sizeof(spr));
+        }
+
+        cx += w * scale;
+    }
+
+    return 0;
+}
+
+int pvr_bfont_draw_str(float x, float y, float z, uint32_t argb,
+                       const char *str) {
+    return pvr_bfont_draw_str_ex(PVR_LIST_TR_POLY, x, y, z, argb, 1.0f, str);
+}
+
+uint32_t pvr_bfont_str_width(const char *str) {
+    uint32_t ch, w = 0, max = 0;
+    glyph_kind_t kind;
+
+    while(*str) {
+        str = bfa_next(str, &ch, &kind);
+
+        if(kind == GLYPH_THIN && ch == '\n')
+            w = 0;
+        else if(kind == GLYPH_THIN && ch == '\t')
+            w += 4 * BFONT_THIN_WIDTH;
+        else
+            w += kind == GLYPH_WIDE ? BFONT_WIDE_WIDTH : BFONT_THIN_WIDTH;
+
+        if(w > max)
+            max = w;
+    }
+
+    return max;
+}
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <dc/pvr.h>
 #include <dc/video.h>
+#include <kos/dbglog.h>
 #include <kos/regfield.h>
 
 #include "pvr_internal.h"
@@ -30,36 +31,31 @@
 
 #define LIST_ENABLED(i) (pvr_state.lists_enabled & BIT(i))
 
+/* Limits of automatic buffer resizing */
+#define AUTOSIZE_VERTEX_MAX     (2 * 1024 * 1024)
+#define AUTOSIZE_OPB_MAX        16
 
-/* Fill Tile Matrix buffers. This function takes a base address and sets up
-   the rendering structures there. Each tile of the screen (32x32) receives
-   a small buffer space. */
-static void pvr_init_tile_matrix(int which, bool presort) {
+/* Parameters the buffers were last allocated with */
+static pvr_init_params_t buf_params;
+
+
+/* Fill the tiles of a Tile Matrix, for the tiles its clip rectangle covers
+   (all of them, unless rendering to a part of a texture). The tiles left
+   out are simply never rendered. */
+static void pvr_fill_tile_matrix(int which) {
     volatile pvr_ta_buffers_t   *buf;
-    int     x, y, tn;
+    int     x, y, tn, x0, y0, x1, y1;
     uint32      *vr;  /* Note: We're working in 4-byte pointer maths in this function */
     volatile int    *opb_sizes;
-    //uint32      matbase, opbbase;
 
-    vr = (uint32*)PVR_RAM_BASE;
     buf = pvr_state.ta_buffers + which;
     opb_sizes = pvr_state.opb_size;
+    vr = (uint32*)PVR_RAM_BASE + BYTES_TO_WORDS(buf->tile_matrix);
 
-#if 0
-    matbase = buf->tile_matrix;
-    opbbase = buf->opb;
-#endif
-
-    /*
-        FIXME? Is this header necessary? If we're moving the tilematrix
-        register to after it, how does the Dreamcast know this is here?
-    */
-
-    /* Header of zeros */
-    vr += BYTES_TO_WORDS(buf->tile_matrix);
-
-    for(x = 0; x < 0x48; x += 4)
-        * vr++ = 0;
+    x0 = PVR_TILE_CLIP_X0(buf->tile_clip);
+    y0 = PVR_TILE_CLIP_Y0(buf->tile_clip);
+    x1 = PVR_TILE_CLIP_X1(buf->tile_clip);
+    y1 = PVR_TILE_CLIP_Y1(buf->tile_clip);
 
     /* Initial init tile */
     vr[0] = 0x10000000;
@@ -70,19 +66,6 @@ static void pvr_init_tile_matrix(int which, bool presort) {
     vr[5] = 0x80000000;
     vr += 6;
 
-    /* Must skip over zeroed header for actual usage */
-    buf->tile_matrix += 0x48;
-
-    /* Now the main tile matrix */
-#if 0
-    dbglog(DBG_KDEBUG, "  Using poly buffers %08lx/%08lx/%08lx/%08lx/%08lx\r\n",
-           buf->opb_type[0],
-           buf->opb_type[1],
-           buf->opb_type[2],
-           buf->opb_type[3],
-           buf->opb_type[4]);
-#endif  /* !NDEBUG */
-
     /*
         This sets up the addresses for each list, for each tile in the
         memory we allocate in pvr_allocate_buffers. If a list isn't enabled
@@ -96,12 +79,12 @@ static void pvr_init_tile_matrix(int which, bool presort) {
         This is the tile matrix setup.
     */
 
-    for(x = 0; x < pvr_state.tw; x++) {
-        for(y = 0; y < pvr_state.th; y++) {
+    for(x = x0; x <= x1; x++) {
+        for(y = y0; y <= y1; y++) {
             tn = (pvr_state.tw * y) + x;
 
             /* Control word */
-            vr[0] = (y << 8) | (x << 2) | (presort << 29);
+            vr[0] = (y << 8) | (x << 2) | (buf->presort << 29);
 
             /* Opaque poly buffer */
             vr[1] = LIST_ENABLED(0) ? buf->opb_addresses[0] + (opb_sizes[0] * tn) : 0x80000000;
@@ -124,16 +107,67 @@ static void pvr_init_tile_matrix(int which, bool presort) {
     vr[-6] |= BIT(31);
 }
 
+/* Set up Tile Matrix buffers. This function takes a base address and sets up
+   the rendering structures there. Each tile of the screen (32x32) receives
+   a small buffer space. */
+static void pvr_init_tile_matrix(int which, bool presort) {
+    volatile pvr_ta_buffers_t   *buf;
+    int     x;
+    uint32      *vr;  /* Note: We're working in 4-byte pointer maths in this function */
+
+    vr = (uint32*)PVR_RAM_BASE;
+    buf = pvr_state.ta_buffers + which;
+
+    /*
+        FIXME? Is this header necessary? If we're moving the tilematrix
+        register to after it, how does the Dreamcast know this is here?
+    */
+
+    /* Header of zeros */
+    vr += BYTES_TO_WORDS(buf->tile_matrix_base);
+
+    for(x = 0; x < 0x48; x += 4)
+        * vr++ = 0;
+
+    /* Must skip over zeroed header for actual usage */
+    buf->tile_matrix = buf->tile_matrix_base + 0x48;
+
+    /* Now the main tile matrix */
+    buf->presort = presort;
+    buf->tile_clip = PVR_TILE_CLIP(0, 0, pvr_state.tw - 1, pvr_state.th - 1);
+    pvr_fill_tile_matrix(which);
+}
+
 /* Fill all tile matrices */
 void pvr_init_tile_matrices(bool presort) {
     int i;
 
-    for(i = 0; i < 2; i++)
-        pvr_init_tile_matrix(i, presort);
+    for(i = 0; i < PVR_TA_BUFFERS; i++) {
+        /* Skip the third set if we're not triple-buffering */
+        if(pvr_state.ta_buffers[i].tile_matrix_size)
+            pvr_init_tile_matrix(i, presort);
+    }
+}
+
+void pvr_clip_tile_matrix(int which, uint32 clip) {
+    volatile pvr_ta_buffers_t *buf = pvr_state.ta_buffers + which;
+
+    /* Consecutive passes over the same tiles keep what's there. */
+    if(buf->tile_clip == clip)
+        return;
+
+    buf->tile_clip = clip;
+    pvr_fill_tile_matrix(which);
 }
 
 void pvr_set_presort_mode(bool presort) {
-    pvr_init_tile_matrix(pvr_state.ta_target, presort);
+    volatile pvr_ta_buffers_t *buf = pvr_state.ta_buffers + pvr_state.ta_target;
+
+    if(buf->presort == presort)
+        return;
+
+    buf->presort = presort;
+    pvr_fill_tile_matrix(pvr_state.ta_target);
 }
 
 
@@ -144,14 +178,19 @@ There's some confusion in here that is explained more fully in pvr_internal.h.
 The other confusing thing is that texture ram is a 64-bit multiplexed space
 rather than a copy of the flat 32-bit VRAM. So in order to maximize the
 available texture RAM, the PVR structures for the two frames are broken
-up and placed at 0x000000 and 0x400000.
+up and placed at 0x000000 and 0x400000. When triple-buffering, the third
+set of TA buffers goes after the first frame's structures, and texture RAM
+starts after whichever half ends up bigger.
 
 */
 void pvr_allocate_buffers(const pvr_init_params_t *params) {
     volatile pvr_ta_buffers_t   *buf;
     volatile pvr_frame_buffers_t    *fbuf;
-    int i, j;
+    int i, j, nbufs;
     uint32  outaddr, sconst, opb_size_accum, opb_total_size;
+    uint32  bank_end[2];
+
+    buf_params = *params;
 
     /* Set screen sizes; pvr_init has ensured that we have a valid mode
        and all that by now, so we can freely dig into the vid_mode
@@ -230,12 +269,14 @@ void pvr_allocate_buffers(const pvr_init_params_t *params) {
     }
 
     /* Initialize each buffer set */
-    for(i = 0; i < 2; i++) {
-        /* Frame 0 goes at 0, Frame 1 goes at 0x400000 (half way) */
-        if(i == 0)
-            outaddr = 0;
-        else
-            outaddr = 0x400000;
+    nbufs = pvr_state.ta_count > 2 ? pvr_state.ta_count : 2;
+    bank_end[0] = 0;
+    bank_end[1] = 0x400000;
+
+    for(i = 0; i < nbufs; i++) {
+        /* Frame 0 goes at 0, Frame 1 goes at 0x400000 (half way), and the
+           third set (if any) after frame 0 */
+        outaddr = bank_end[i & 1];
 
         /* Select a pvr_buffers_t. Note that there's no good reason
            to allocate the frame buffers at the same time as the TA
@@ -270,25 +311,32 @@ void pvr_allocate_buffers(const pvr_init_params_t *params) {
         /* N-byte align */
         outaddr = __align_up(outaddr, 128);
 
-        /* Tile Matrix */
-        buf->tile_matrix = outaddr;
-        buf->tile_matrix_size = WORDS_TO_BYTES(18 + 6 * pvr_state.tw * pvr_state.th);
+        /* Tile Matrix: header, init tile and tiles */
+        buf->tile_matrix_base = buf->tile_matrix = outaddr;
+        buf->tile_matrix_size = WORDS_TO_BYTES(18 + 6 + 6 * pvr_state.tw * pvr_state.th);
         outaddr += buf->tile_matrix_size;
 
         /* N-byte align */
         outaddr = __align_up(outaddr, 128);
 
-        /* Output buffer */
-        fbuf->frame = outaddr;
-        fbuf->frame_size = pvr_state.w * pvr_state.h * vid_pmode_bpp[vid_mode->pm];
-        outaddr += fbuf->frame_size;
+        /* Output buffer; there are only two of them */
+        if(i < 2) {
+            fbuf->frame = outaddr;
+            fbuf->frame_size = pvr_state.w * pvr_state.h * vid_pmode_bpp[vid_mode->pm];
+            outaddr += fbuf->frame_size;
 
-        /* N-byte align */
-        outaddr = __align_up(outaddr, 128);
+            /* N-byte align */
+            outaddr = __align_up(outaddr, 128);
+        }
+
+        bank_end[i & 1] = outaddr;
     }
 
     /* Texture ram is whatever is left */
-    pvr_state.texture_base = (outaddr - 0x400000) * 2;
+    if(bank_end[0] > bank_end[1] - 0x400000)
+        pvr_state.texture_base = bank_end[0] * 2;
+    else
+        pvr_state.texture_base = (bank_end[1] - 0x400000) * 2;
 
 #if 0
     dbglog(DBG_KDEBUG, "pvr: initialized PVR buffers:\n");
@@ -320,3 +368,70 @@ void pvr_allocate_buffers(const pvr_init_params_t *params) {
            0x800000 - pvr_state.texture_base);
 #endif  /* !NDEBUG */
 }
+
+/* Grow the buffers that overflowed since the last time. Buffers are below
+   texture memory, so this can only be done while no textures are allocated;
+   otherwise, try again at the next scene. */
+void pvr_autosize_buffers(void) {
+    pvr_init_params_t params = buf_params;
+    int vertex_max = AUTOSIZE_VERTEX_MAX;
+    bool presort;
+
+    if(pvr_mem_used_blocks())
+        return;
+
+    /* The third set of buffers shares the first half of VRAM with the first
+       one and its frame buffer. */
+    if(pvr_state.ta_count > 2)
+        vertex_max /= 2;
+
+    if(pvr_state.buf_overflowed & PVR_OVF_VERTEX) {
+        params.vertex_buf_size = __align_up(params.vertex_buf_size +
+                                            params.vertex_buf_size / 2,
+                                            64 * 1024);
+
+        if(params.vertex_buf_size > vertex_max)
+            params.vertex_buf_size = vertex_max;
+    }
+
+    if(pvr_state.buf_overflowed & PVR_OVF_OPB) {
+        params.opb_overflow_count = params.opb_overflow_count ?
+                                    params.opb_overflow_count * 2 : 1;
+
+        if(params.opb_overflow_count > AUTOSIZE_OPB_MAX)
+            params.opb_overflow_count = AUTOSIZE_OPB_MAX;
+    }
+
+    pvr_state.buf_overflowed = 0;
+
+    if(params.vertex_buf_size == buf_params.vertex_buf_size &&
+       params.opb_overflow_count == buf_params.opb_overflow_count) {
+        dbglog(DBG_WARNING, "pvr: buffers overflowed, but can't grow them "
+               "any more\n");
+        return;
+    }
+
+    /* Nothing may be using the buffers while they move around. */
+    pvr_wait_ready();
+    pvr_wait_render_done();
+    sem_wait((semaphore_t *)&pvr_state.dma_lock);
+
+    presort = pvr_state.ta_buffers[pvr_state.ta_target].presort;
+
+    pvr_allocate_buffers(&params);
+    pvr_init_tile_matrices(presort);
+
+    pvr_state.ta_target = 0;
+    pvr_state.ta_render = 0;
+    pvr_sync_view();
+    pvr_sync_reg_buffer();
+    pvr_mem_reset();
+
+    sem_signal((semaphore_t *)&pvr_state.dma_lock);
+
+    pvr_state.buf_resizes++;
+
+    dbglog(DBG_INFO, "pvr: resized buffers: %d bytes of vertex buffer, "
+           "%d extra OPBs\n", params.vertex_buf_size,
+           params.opb_overflow_count);
+}
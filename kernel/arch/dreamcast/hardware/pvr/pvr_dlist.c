@@ -0,0 +1,100 @@
+/* KallistiOS ##version##
+
+   pvr_dlist.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Display lists: TA data recorded in main RAM, and sent to the TA with DMA
+   each time they are replayed. */
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dc/pvr.h>
+#include <kos/sem.h>
+
+#include "pvr_internal.h"
+
+int pvr_dlist_init(pvr_dlist_t *dl, pvr_list_t list, void *buf, size_t size) {
+    if(!size || (size & 31) || ((uintptr_t)buf & 31)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    dl->owned = !buf;
+
+    if(!buf && !(buf = memalign(32, size))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    dl->buf = (uint8_t *)buf;
+    dl->size = size;
+    dl->used = 0;
+    dl->list = list;
+
+    return 0;
+}
+
+void pvr_dlist_destroy(pvr_dlist_t *dl) {
+    if(dl->owned)
+        free(dl->buf);
+
+    dl->buf = NULL;
+    dl->size = dl->used = 0;
+}
+
+ptrdiff_t pvr_dlist_add(pvr_dlist_t *dl, const void *data, size_t size) {
+    ptrdiff_t offset = dl->used;
+
+    if(size & 31) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(size > dl->size - dl->used) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    memcpy(dl->buf + dl->used, data, size);
+    dl->used += size;
+
+    return offset;
+}
+
+int pvr_dlist_patch(pvr_dlist_t *dl, size_t offset, const void *data,
+                    size_t size) {
+    if(offset > dl->used || size > dl->used - offset) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memcpy(dl->buf + offset, data, size);
+
+    return 0;
+}
+
+int pvr_dlist_replay(const pvr_dlist_t *dl) {
+    int rv;
+
+    if(!dl->used)
+        return 0;
+
+    if(pvr_state.list_reg_open != (int)dl->list && pvr_list_begin(dl->list) < 0)
+        return -1;
+
+    /* Lists going through vertex DMA are built in RAM anyway. */
+    if(pvr_state.dma_mode && pvr_state.dma_buffers[pvr_state.ram_target].base[dl->list])
+        return pvr_list_prim(dl->list, dl->buf, dl->used);
+
+    /* The list may change headers without the cache knowing. */
+    pvr_state.hdr_valid &= ~BIT(dl->list);
+
+    sem_wait((semaphore_t *)&pvr_state.dma_lock);
+    rv = pvr_dma_load_ta(dl->buf, dl->used, true, NULL, NULL);
+    sem_signal((semaphore_t *)&pvr_state.dma_lock);
+
+    return rv;
+}
@@ -18,6 +18,7 @@
 #include <kos/thread.h>
 #include <kos/sem.h>
 #include <kos/dbglog.h>
+#include <kos/timer.h>
 
 #include "pvr_internal.h"
 
@@ -46,6 +47,8 @@ static void pvr_dma_irq_hnd(uint32_t code, void *data) {
     if(dma_transfer_get_remaining(DMA_CHANNEL_2) != 0)
         dbglog(DBG_INFO, "pvr_dma: The dma did not complete successfully\n");
 
+    pvr_state.dma_busy_len += timer_ns_gettime64() - pvr_state.dma_start_time;
+
     /* Call the callback, if any. */
     if(dma_callback) {
         /* This song and dance is necessary because the handler
@@ -134,6 +137,7 @@ int pvr_dma_transfer(const void *src, uintptr_t dest, size_t count,
 
     pvr_dma[PVR_STATE] = pvr_dest_addr(dest, type);
     pvr_dma[PVR_LEN] = count;
+    pvr_state.dma_start_time = timer_ns_gettime64();
     pvr_dma[PVR_DST] = 0x1;
 
     /* Wait for us to be signaled */
@@ -0,0 +1,363 @@
+/* KallistiOS ##version##
+
+   pvr_hud.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Performance overlay. The text is drawn with minifont into an ARGB4444
+   buffer in RAM (minifont's white is opaque white there, and what it doesn't
+   touch stays transparent), then loaded into whichever of two textures the
+   PVR is done with, so that a scene still to be rendered never sees it
+   change. The graph is made of plain colored quads. */
+
+#include <errno.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dc/maple/controller.h>
+#include <dc/minifont.h>
+#include <dc/pvr.h>
+#include <kos/mem_tags.h>
+#include <kos/thread.h>
+#include <kos/timer.h>
+
+#include "pvr_internal.h"
+
+#define HUD_TXR_W       PVR_HUD_WIDTH
+#define HUD_TXR_H       128
+#define HUD_LINE_H      16
+#define HUD_GRAPH_H     64
+#define HUD_SAMPLES     64
+#define HUD_Z           1000.0f
+
+/* Milliseconds at the top of the graph */
+#define HUD_GRAPH_MS    50.0f
+
+/* Time between text refreshes, in milliseconds */
+#define HUD_REFRESH_MS  250
+
+/* Threads tracked, and shown */
+#define HUD_THREADS     16
+#define HUD_THREADS_SHOWN 4
+
+/* Polls of the toggle combo closer together than this are the same press */
+#define HUD_BTN_GAP_MS  100
+
+typedef struct {
+    tid_t tid;
+    uint64_t last;                  /* CPU time at the last refresh */
+    unsigned int load;              /* Percent of the last refresh period */
+    bool seen;
+    char label[20];
+} hud_thd_t;
+
+static struct {
+    bool enabled;
+    uint32_t btns;
+    uint64_t btn_last;
+
+    uint16_t *text;                 /* RAM copy of the text texture */
+    pvr_ptr_t txr[2];
+    pvr_fence_t fence[2];           /* Last scene drawing each texture */
+    int cur;                        /* Texture to draw */
+    bool valid;                     /* The current texture has text in it */
+    uint64_t refresh_time;
+
+    float frame_ms[HUD_SAMPLES];
+    float rnd_ms[HUD_SAMPLES];
+    size_t sample;
+    size_t last_frame;
+
+    hud_thd_t thds[HUD_THREADS];
+    uint64_t thd_time;
+} hud;
+
+void pvr_hud_enable(bool enable) {
+    hud.enabled = enable;
+}
+
+bool pvr_hud_enabled(void) {
+    return hud.enabled;
+}
+
+static void hud_btn(uint8_t addr, uint32_t btns) {
+    uint64_t now = timer_ms_gettime64();
+
+    (void)addr;
+    (void)btns;
+
+    /* This is called on each poll while the buttons are held. */
+    if(now - hud.btn_last > HUD_BTN_GAP_MS)
+        hud.enabled = !hud.enabled;
+
+    hud.btn_last = now;
+}
+
+int pvr_hud_set_toggle(uint32_t btns) {
+    if(hud.btns)
+        cont_btn_callback(0, hud.btns, NULL);
+
+    hud.btns = btns;
+
+    if(btns)
+        return cont_btn_callback(0, btns, hud_btn);
+
+    return 0;
+}
+
+void pvr_hud_shutdown(void) {
+    /* PVR RAM is about to be reset. */
+    free(hud.text);
+    hud.text = NULL;
+    hud.txr[0] = hud.txr[1] = NULL;
+    hud.valid = false;
+}
+
+static int hud_alloc(void) {
+    hud.text = aligned_alloc(32, HUD_TXR_W * HUD_TXR_H * 2);
+    hud.txr[0] = pvr_mem_malloc(HUD_TXR_W * HUD_TXR_H * 2);
+    hud.txr[1] = pvr_mem_malloc(HUD_TXR_W * HUD_TXR_H * 2);
+
+    if(!hud.text || !hud.txr[0] || !hud.txr[1]) {
+        if(hud.txr[1])
+            pvr_mem_free(hud.txr[1]);
+
+        if(hud.txr[0])
+            pvr_mem_free(hud.txr[0]);
+
+        pvr_hud_shutdown();
+        errno = ENOMEM;
+        return -1;
+    }
+
+    hud.fence[0] = hud.fence[1] = 0;
+    return 0;
+}
+
+static int hud_thd_cb(kthread_t *thd, void *data) {
+    uint64_t period = *(uint64_t *)data, t = thd_get_cpu_time(thd);
+    hud_thd_t *h, *free_slot = NULL;
+    int i;
+
+    for(i = 0; i < HUD_THREADS; i++) {
+        h = &hud.thds[i];
+
+        if(h->tid == thd->tid && h->tid)
+            break;
+
+        if(!h->tid && !free_slot)
+            free_slot = h;
+    }
+
+    if(i == HUD_THREADS) {
+        if(!(h = free_slot))
+            return 0;
+
+        h->tid = thd->tid;
+        h->last = t;
+    }
+
+    h->load = period ? (unsigned int)((t - h->last) * 100 / period) : 0;
+    h->last = t;
+    h->seen = true;
+    strncpy(h->label, thd->label, sizeof(h->label) - 1);
+    h->label[sizeof(h->label) - 1] = '\0';
+
+    return 0;
+}
+
+static void hud_threads(void) {
+    uint64_t now = timer_ns_gettime64(), period = 0;
+    int i;
+
+    if(hud.thd_time)
+        period = now - hud.thd_time;
+
+    hud.thd_time = now;
+
+    for(i = 0; i < HUD_THREADS; i++)
+        hud.thds[i].seen = false;
+
+    thd_each(hud_thd_cb, &period);
+
+    for(i = 0; i < HUD_THREADS; i++) {
+        if(!hud.thds[i].seen)
+            hud.thds[i].tid = 0;
+    }
+}
+
+static void hud_line(int line, const char *str) {
+    minifont_draw_str(hud.text + line * HUD_LINE_H * HUD_TXR_W, HUD_TXR_W, str);
+}
+
+static void hud_text(const pvr_stats_t *st) {
+    kos_mem_stats_t mem;
+    char buf[40];
+    hud_thd_t *top[HUD_THREADS_SHOWN] = { NULL };
+    int i, j, k, line = 4;
+
+    memset(hud.text, 0, HUD_TXR_W * HUD_TXR_H * 2);
+    minifont_set_color(255, 255, 255);
+
+    snprintf(buf, sizeof(buf), "frame %5.1fms %5.1ffps",
+             st->frame_last_time / 1e6f, st->frame_rate);
+    hud_line(0, buf);
+    snprintf(buf, sizeof(buf), "ta %4.1f rnd %4.1f dma %4.1f",
+             st->reg_last_time / 1e6f, st->rnd_last_time / 1e6f,
+             st->dma_last_time / 1e6f);
+    hud_line(1, buf);
+
+    kos_mem_stats(&mem);
+    snprintf(buf, sizeof(buf), "ram  %5uK / %5uK",
+             (unsigned int)(mem.heap_used >> 10),
+             (unsigned int)(mem.heap_size >> 10));
+    hud_line(2, buf);
+    snprintf(buf, sizeof(buf), "vram %5uK free", (unsigned int)(mem.vram_free >> 10));
+    hud_line(3, buf);
+
+    hud_threads();
+
+    /* The busiest few threads */
+    for(i = 0; i < HUD_THREADS; i++) {
+        if(!hud.thds[i].tid)
+            continue;
+
+        for(j = 0; j < HUD_THREADS_SHOWN; j++) {
+            if(!top[j] || hud.thds[i].load > top[j]->load) {
+                for(k = HUD_THREADS_SHOWN - 1; k > j; k--)
+                    top[k] = top[k - 1];
+
+                top[j] = &hud.thds[i];
+                break;
+            }
+        }
+    }
+
+    for(j = 0; j < HUD_THREADS_SHOWN && top[j]; j++) {
+        snprintf(buf, sizeof(buf), "%-20.20s %3u%%", top[j]->label,
+                 top[j]->load);
+        hud_line(line++, buf);
+    }
+}
+
+/* Send a quad, with texture coordinates going across the whole texture */
+static void hud_quad(float x0, float y0, float x1, float y1, uint32_t argb,
+                     float v1) {
+    alignas(32) pvr_vertex_t v[4];
+    int i;
+
+    for(i = 0; i < 4; i++) {
+        v[i].flags = i == 3 ? PVR_CMD_VERTEX_EOL : PVR_CMD_VERTEX;
+        v[i].x = (i & 2) ? x1 : x0;
+        v[i].y = (i & 1) ? y0 : y1;
+        v[i].z = HUD_Z;
+        v[i].u = (i & 2) ? 1.0f : 0.0f;
+        v[i].v = (i & 1) ? 0.0f : v1;
+        v[i].argb = argb;
+        v[i].oargb = 0;
+    }
+
+    pvr_prim(v, sizeof(v));
+}
+
+static inline uint32_t hud_bar_color(float ms) {
+    if(ms <= 17.0f)
+        return 0xc000ff00;
+    else if(ms <= 34.0f)
+        return 0xc0ffff00;
+
+    return 0xc0ff0000;
+}
+
+static inline float hud_graph_y(float ms) {
+    if(ms > HUD_GRAPH_MS)
+        ms = HUD_GRAPH_MS;
+
+    return ms * HUD_GRAPH_H / HUD_GRAPH_MS;
+}
+
+int pvr_hud_draw(float x, float y) {
+    pvr_stats_t st;
+    pvr_poly_cxt_t cxt;
+    pvr_poly_hdr_t hdr;
+    uint64_t now;
+    float gy = y + HUD_TXR_H + 4.0f, base = gy + HUD_GRAPH_H, bx, bw;
+    size_t i, s;
+    int back;
+
+    if(!hud.enabled)
+        return 0;
+
+    if(!hud.text && hud_alloc() < 0)
+        return -1;
+
+    if(pvr_get_stats(&st) < 0)
+        return -1;
+
+    if(st.frame_count != hud.last_frame) {
+        hud.last_frame = st.frame_count;
+        hud.frame_ms[hud.sample] = st.frame_last_time / 1e6f;
+        hud.rnd_ms[hud.sample] = st.rnd_last_time / 1e6f;
+        hud.sample = (hud.sample + 1) % HUD_SAMPLES;
+    }
+
+    /* New figures go into the texture that isn't shown, once the PVR is done
+       with it. */
+    now = timer_ms_gettime64();
+    back = hud.cur ^ 1;
+
+    if((!hud.valid || now - hud.refresh_time >= HUD_REFRESH_MS) &&
+       !pvr_fence_check(hud.fence[back])) {
+        hud_text(&st);
+        pvr_txr_load(hud.text, hud.txr[back], HUD_TXR_W * HUD_TXR_H * 2);
+        hud.cur = back;
+        hud.valid = true;
+        hud.refresh_time = now;
+    }
+
+    /* Background and graph */
+    pvr_poly_cxt_col(&cxt, PVR_LIST_TR_POLY);
+    pvr_poly_compile(&hdr, &cxt);
+    pvr_prim(&hdr, sizeof(hdr));
+
+    hud_quad(x, y, x + PVR_HUD_WIDTH, y + PVR_HUD_HEIGHT, 0x80000000, 0.0f);
+
+    bw = (float)PVR_HUD_WIDTH / HUD_SAMPLES;
+
+    for(i = 0; i < HUD_SAMPLES; i++) {
+        s = (hud.sample + i) % HUD_SAMPLES;
+        bx = x + i * bw;
+
+        if(hud.frame_ms[s] > 0.0f)
+            hud_quad(bx, base - hud_graph_y(hud.frame_ms[s]), bx + bw - 1.0f,
+                     base, hud_bar_color(hud.frame_ms[s]), 0.0f);
+
+        if(hud.rnd_ms[s] > 0.0f)
+            hud_quad(bx, base - hud_graph_y(hud.rnd_ms[s]), bx + bw / 2.0f,
+                     base, 0xc00080ff, 0.0f);
+    }
+
+    /* 60 and 30 fps lines */
+    hud_quad(x, base - hud_graph_y(16.7f), x + PVR_HUD_WIDTH,
+             base - hud_graph_y(16.7f) + 1.0f, 0xffffffff, 0.0f);
+    hud_quad(x, base - hud_graph_y(33.3f), x + PVR_HUD_WIDTH,
+             base - hud_graph_y(33.3f) + 1.0f, 0x80ffffff, 0.0f);
+
+    /* Text */
+    pvr_poly_cxt_txr(&cxt, PVR_LIST_TR_POLY,
+                     PVR_TXRFMT_ARGB4444 | PVR_TXRFMT_NONTWIDDLED,
+                     HUD_TXR_W, HUD_TXR_H, hud.txr[hud.cur], PVR_FILTER_NONE);
+    pvr_poly_compile(&hdr, &cxt);
+    pvr_prim(&hdr, sizeof(hdr));
+
+    hud_quad(x, y, x + HUD_TXR_W, y + HUD_TXR_H, 0xffffffff, 1.0f);
+
+    /* The scene being submitted has started by now. */
+    hud.fence[hud.cur] = pvr_state.scene_seq;
+
+    return 0;
+}
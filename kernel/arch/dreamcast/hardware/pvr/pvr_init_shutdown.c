@@ -13,6 +13,7 @@
 #include <dc/asic.h>
 #include <dc/vblank.h>
 #include <kos/dbglog.h>
+#include <kos/mem_tags.h>
 #include "pvr_internal.h"
 
 /*
@@ -46,6 +47,12 @@ int pvr_init_defaults(void) {
         3,
 
         /* Vertex buffer double-buffering enabled */
+        0,
+
+        /* No vertex buffer triple-buffering */
+        0,
+
+        /* No automatic buffer resizing */
         0
     };
 
@@ -59,6 +66,8 @@ int pvr_init_defaults(void) {
 int pvr_init(const pvr_init_params_t *params) {
     uint16_t vscale = 1024;
 
+    mem_tag_scoped(MEM_TAG_PVR);
+
     /* If we're already initialized, fail */
     if(pvr_state.valid == 1) {
         dbglog(DBG_WARNING, "pvr: pvr_init called twice!\n");
@@ -95,7 +104,16 @@ int pvr_init(const pvr_init_params_t *params) {
     // Copy over FSAA setting.
     pvr_state.fsaa = params->fsaa_enabled;
 
-    pvr_state.vbuf_doublebuf = !params->vbuf_doublebuf_disabled;
+    pvr_state.buf_autosize = params->buf_autosize_enabled;
+    pvr_state.buf_overflowed = 0;
+
+    // Pick the number of vertex buffers to rotate through.
+    if(params->vbuf_doublebuf_disabled)
+        pvr_state.ta_count = 1;
+    else if(params->vbuf_triplebuf_enabled)
+        pvr_state.ta_count = 3;
+    else
+        pvr_state.ta_count = 2;
 
     /* Everything's clear, do the initial buffer pointer setup */
     pvr_allocate_buffers(params);
@@ -107,6 +125,8 @@ int pvr_init(const pvr_init_params_t *params) {
     // like to have it explicit.
     pvr_state.ram_target = 0;
     pvr_state.ta_target = 0;
+    pvr_state.ta_render = 0;
+    pvr_state.ta_queued = 0;
     pvr_state.view_target = 0;
 
     pvr_state.list_reg_open = -1;
@@ -127,6 +147,14 @@ int pvr_init(const pvr_init_params_t *params) {
     pvr_state.rnd_last_len = -1;
     pvr_state.vtx_buf_used = 0;
     pvr_state.vtx_buf_used_max = 0;
+    memset((void *)pvr_state.list_buf_used_max, 0,
+           sizeof(pvr_state.list_buf_used_max));
+    pvr_state.opb_ovf_used_max = 0;
+    pvr_state.vtx_buf_overflows = 0;
+    pvr_state.opb_overflows = 0;
+    pvr_state.buf_resizes = 0;
+    pvr_state.hdr_skipped = 0;
+    pvr_state.swap_cur = 1;
     pvr_state.dr_used = 0;
 
     /* If we're on a VGA box, disable vertical smoothing */
@@ -143,7 +171,8 @@ int pvr_init(const pvr_init_params_t *params) {
             FIELD_PREP(PVR_SCALER_CFG_VSCALE_FACTOR, vscale));
 
     /* Hook the PVR interrupt events on G2 */
-    pvr_state.vbl_handle = vblank_handler_add(pvr_vblank_handler, NULL);
+    pvr_state.vbl_handle = vblank_handler_add_ex(pvr_vblank_handler, NULL,
+                                                 VBLANK_PRIO_HIGH, 0);
     
     asic_evt_set_handler(ASIC_EVT_PVR_OPAQUEDONE, pvr_int_handler, NULL);
     asic_evt_enable(ASIC_EVT_PVR_OPAQUEDONE, ASIC_IRQ_DEFAULT);
@@ -158,14 +187,18 @@ int pvr_init(const pvr_init_params_t *params) {
     asic_evt_set_handler(ASIC_EVT_PVR_RENDERDONE_TSP, pvr_int_handler, NULL);
     asic_evt_enable(ASIC_EVT_PVR_RENDERDONE_TSP, ASIC_IRQ_DEFAULT);
 
+    /* Buffer overflows are counted, and may get the buffers resized */
+    asic_evt_set_handler(ASIC_EVT_PVR_PARAM_OUTOFMEM, pvr_int_handler, NULL);
+    asic_evt_enable(ASIC_EVT_PVR_PARAM_OUTOFMEM, ASIC_IRQ_DEFAULT);
+    asic_evt_set_handler(ASIC_EVT_PVR_OPB_OUTOFMEM, pvr_int_handler, NULL);
+    asic_evt_enable(ASIC_EVT_PVR_OPB_OUTOFMEM, ASIC_IRQ_DEFAULT);
+
     if(__is_defined(PVR_RENDER_DBG)) {
         /* Hook up interrupt handlers for error events */
         asic_evt_set_handler(ASIC_EVT_PVR_ISP_OUTOFMEM, pvr_int_handler, NULL);
         asic_evt_enable(ASIC_EVT_PVR_ISP_OUTOFMEM, ASIC_IRQ_DEFAULT);
         asic_evt_set_handler(ASIC_EVT_PVR_STRIP_HALT, pvr_int_handler, NULL);
         asic_evt_enable(ASIC_EVT_PVR_STRIP_HALT, ASIC_IRQ_DEFAULT);
-        asic_evt_set_handler(ASIC_EVT_PVR_OPB_OUTOFMEM, pvr_int_handler, NULL);
-        asic_evt_enable(ASIC_EVT_PVR_OPB_OUTOFMEM, ASIC_IRQ_DEFAULT);
         asic_evt_set_handler(ASIC_EVT_PVR_TA_INPUT_ERR, pvr_int_handler, NULL);
         asic_evt_enable(ASIC_EVT_PVR_TA_INPUT_ERR, ASIC_IRQ_DEFAULT);
         asic_evt_set_handler(ASIC_EVT_PVR_TA_INPUT_OVERFLOW, pvr_int_handler, NULL);
@@ -196,6 +229,7 @@ int pvr_init(const pvr_init_params_t *params) {
     /* Initialize PVR DMA */
     sem_init((semaphore_t *)&pvr_state.dma_lock, 1);
     pvr_dma_init();
+    pvr_upload_init();
 
     /* Set us as valid and return success */
     pvr_state.valid = 1;
@@ -238,11 +272,18 @@ int pvr_shutdown(void) {
     asic_evt_disable(ASIC_EVT_PVR_PTDONE, ASIC_IRQ_DEFAULT);
     asic_evt_remove_handler(ASIC_EVT_PVR_RENDERDONE_TSP);
     asic_evt_disable(ASIC_EVT_PVR_RENDERDONE_TSP, ASIC_IRQ_DEFAULT);
+    asic_evt_remove_handler(ASIC_EVT_PVR_PARAM_OUTOFMEM);
+    asic_evt_disable(ASIC_EVT_PVR_PARAM_OUTOFMEM, ASIC_IRQ_DEFAULT);
+    asic_evt_remove_handler(ASIC_EVT_PVR_OPB_OUTOFMEM);
+    asic_evt_disable(ASIC_EVT_PVR_OPB_OUTOFMEM, ASIC_IRQ_DEFAULT);
 
     /* Shut down PVR DMA */
+    pvr_upload_shutdown();
     pvr_dma_shutdown();
 
     /* Invalidate our memory pool */
+    pvr_hud_shutdown();
+    pvr_bfont_shutdown();
     pvr_mem_reset();
 
     /* Destroy the mutex */
@@ -17,6 +17,7 @@
    be added to dc/pvr.h. */
 
 #include <stdbool.h>
+#include <kos/arena.h>
 #include <kos/sem.h>
 
 /**** State stuff ***************************************************/
@@ -109,6 +110,23 @@
    or ISP/TSP phases to take longer than one frame, they are allowed to expand
    into the next slot gracefully.
 
+   Once the TA is done with a frame, its buffers are handed to the renderer
+   and the TA moves on to the next set, if that one isn't still owned by the
+   renderer. With two sets, that means waiting for the previous render to be
+   over. With three sets (triple-buffering), one set can be rendering while
+   a finished frame waits in another for its turn, and the TA accepts the
+   next frame in the third:
+
+   VBlanks  SH4-to-TA   ISP/TSP         View
+   0        ->T0        -           -
+   1        ->T1        T0->F0          -
+   2        ->T2        T1->F1          F0
+   3        ->T0        T2->F0          F1
+   ...
+
+   A frame may then be submitted as soon as the CPU is done with the previous
+   one, instead of waiting for the render of the one before that to end.
+
  */
 
 /* Note that these must match the list types in pvr.h; these are here
@@ -120,15 +138,37 @@
 #define PVR_OPB_PT      4
 #define PVR_OPB_COUNT   5
 
-// TA buffers structure: we have two sets of these
+// Maximum number of TA buffer sets (with triple-buffering)
+#define PVR_TA_BUFFERS  3
+
+// TA buffers structure: we have two or three sets of these
 typedef struct {
     uint32  vertex, vertex_size;            /* Vertex buffer */
     uint32  opb, opb_size;                  /* Object pointer buffers, size */
     uint32  opb_addresses[PVR_OPB_COUNT];        /* Object pointer buffers (of each type) */
     uint32  tile_matrix, tile_matrix_size;  /* Tile matrix, size */
+    uint32  tile_matrix_base;               /* Tile matrix header */
+    uint32  tile_clip;                      /* Tiles in the tile matrix */
+    bool    presort;                        /* Presort mode of the tile matrix */
     uint32  opb_overflow_count;             /* Extra OPB space after opb_size for TA overflow */
+
+    /* The scene the TA left in these buffers, waiting to be rendered */
+    uint32  vertex_end;                     /* TA vertex position at the end of the scene */
+    uint32  seq;                            /* Fence of the scene */
+    bool    to_texture;                     /* True if rendered to a texture */
+    int     to_txr_rp;                      /* Render pitch for to-texture mode */
+    uint32  to_txr_addr;                    /* Output address for to-texture mode */
+    uint32  pclip_x, pclip_y;               /* Pixel clip of the scene */
 } pvr_ta_buffers_t;
 
+/* Tile clip rectangles: first and last tiles (inclusive) in each direction */
+#define PVR_TILE_CLIP(x0, y0, x1, y1) \
+    ((x0) | ((y0) << 8) | ((x1) << 16) | ((uint32)(y1) << 24))
+#define PVR_TILE_CLIP_X0(c) ((c) & 0xff)
+#define PVR_TILE_CLIP_Y0(c) (((c) >> 8) & 0xff)
+#define PVR_TILE_CLIP_X1(c) (((c) >> 16) & 0xff)
+#define PVR_TILE_CLIP_Y1(c) ((c) >> 24)
+
 // DMA buffers structure: we have two sets of these
 typedef struct {
     uint8   * base[PVR_OPB_COUNT];  // DMA buffers, if assigned
@@ -159,7 +199,10 @@ typedef struct {
     int     ram_target;                 // RAM buffer we're writing into
                                         // (^1 == RAM buffer we're DMAing from)
     int     ta_target;                  // TA buffer we're writing (or DMAing) into
-                                        // (^1 == TA buffer we're rendering from)
+    int     ta_render;                  // Oldest TA buffer handed to the renderer
+    int     ta_queued;                  // Number of TA buffers handed to the renderer,
+                                        // including the one being rendered
+    int     ta_count;                   // Number of TA buffers in the rotation
     int     view_target;                // Frame buffer we're viewing
                                         // (^1 == frame buffer we're rendering to)
 
@@ -176,7 +219,7 @@ typedef struct {
 
     // Memory pointers / buffers
     pvr_dma_buffers_t   dma_buffers[2];     // DMA buffers (if any)
-    pvr_ta_buffers_t    ta_buffers[2];      // TA buffers
+    pvr_ta_buffers_t    ta_buffers[PVR_TA_BUFFERS]; // TA buffers
     pvr_frame_buffers_t frame_buffers[2];   // Frame buffers
     uint32              texture_base;       // Start of texture RAM
 
@@ -202,8 +245,28 @@ typedef struct {
     uint64_t rnd_last_len;               // Render time for the last frame
     size_t   vbl_count;                  // VBlank counter for animations and such
     size_t   frame_count;                // Total number of viewed frames
+    uint64_t list_last_len[PVR_OPB_COUNT]; // Registration start to the TA finishing each list
+    uint64_t dma_start_time;             // When did the current PVR DMA begin?
+    uint64_t dma_busy_len;               // Cumulative PVR DMA busy time
+    uint64_t dma_busy_mark;              // dma_busy_len at the last page flip
+    uint64_t dma_last_len;               // PVR DMA busy time for the last frame
+    uint64_t wait_len;                   // Cumulative time blocked in pvr_wait_ready()
+    uint64_t wait_mark;                  // wait_len at the last page flip
+    uint64_t wait_last_len;              // Time blocked in pvr_wait_ready() for the last frame
+    uint32_t frame_hist[PVR_STATS_HIST_FRAMES]; // Lengths of the last frames, in microseconds
+    size_t   frame_hist_count;           // Number of frame lengths recorded
     size_t   vtx_buf_used;               // Vertex buffer used size for the last frame
     size_t   vtx_buf_used_max;           // Maximum used vertex buffer size
+    size_t   list_buf_used_max[PVR_OPB_COUNT]; // Maximum used DMA buffer size of each list
+    size_t   opb_ovf_used_max;           // Maximum used extra OPB space
+    size_t   vtx_buf_overflows;          // Vertex buffer overflows
+    size_t   opb_overflows;              // OPB overflows
+    size_t   buf_resizes;                // Automatic buffer resizes
+    size_t   hdr_skipped;                // Headers dropped by the header cache
+
+    // Automatic buffer resizing
+    int     buf_autosize;               // Non-zero if enabled at init time
+    uint32  buf_overflowed;             // PVR_OVF_* for each overflow since the last resize
 
     // Handle for the vblank interrupt
     int     vbl_handle;
@@ -211,8 +274,9 @@ typedef struct {
     // Non-zero if FSAA was enabled at init time.
     int     fsaa;
 
-    // Non-zero if using double-buffering for the vertex buffer.
-    int     vbuf_doublebuf;
+    // Scene fences: last one given out, and last one rendered
+    uint32  scene_seq;
+    uint32  rendered_seq;
 
     // True if the next frame is rendered to a texture
     bool    next_to_texture;
@@ -235,8 +299,30 @@ typedef struct {
     // Output address for to-texture mode for the next frame
     uint32  next_to_txr_addr;
 
+    // Tiles and pixel clip for the next frame
+    uint32  next_tile_clip;
+    uint32  next_pclip_x, next_pclip_y;
+
     // Whether direct rendering is active or not
     uint32  dr_used;
+
+    // Frame pacing
+    int     swap_interval;              // Vblanks per frame asked for, 0 for automatic
+    int     swap_cur;                   // Vblanks per frame in use
+    int     pace_calm;                  // Frames in a row that fit a shorter interval
+    bool    adaptive_vsync;             // Flip late frames right away
+    size_t  flip_vbl;                   // vbl_count at the last flip
+    uint64_t flip_time;                 // When did the last flip occur?
+    uint64_t vbl_time;                  // When did the last vblank occur?
+    uint64_t vbl_period;                // Time between vblanks
+
+    // Arena to reset at the start of each frame, if any
+    arena_t *frame_arena;
+
+    // Header cache: last header sent to each list, when hdr_valid has its bit
+    bool    hdr_cache;
+    uint32  hdr_valid;
+    uint32  hdr_last[PVR_OPB_COUNT][8];
 } pvr_state_t;
 
 /* There will be exactly one of these in KOS (in pvr_globals.c) */
@@ -266,9 +352,25 @@ typedef struct pvr_bkg_poly {
 /* Initialize buffers for TA/ISP/TSP usage */
 void pvr_allocate_buffers(const pvr_init_params_t *params);
 
+/* Overflows to grow buffers for */
+#define PVR_OVF_VERTEX  BIT(0)
+#define PVR_OVF_OPB     BIT(1)
+
+/* Grow the buffers that overflowed, if texture memory is unused */
+void pvr_autosize_buffers(void);
+
 /* Fill the tile matrices (after it's initialized) */
 void pvr_init_tile_matrices(bool presort);
 
+/* Restrict a tile matrix to the given tile clip rectangle */
+void pvr_clip_tile_matrix(int which, uint32 clip);
+
+
+/**** pvr_mem.c *******************************************************/
+
+/* Number of blocks of texture memory allocated */
+size_t pvr_mem_used_blocks(void);
+
 
 /**** pvr_misc.c ******************************************************/
 
@@ -292,7 +394,7 @@ void pvr_sync_view(void);
 void pvr_sync_reg_buffer(void);
 
 /* Begin a render operation that has been queued completely */
-void pvr_begin_queued_render(void);
+void pvr_begin_queued_render(int which);
 
 /* Generate synthetic polygon headers for the given list type (to submit
    blank lists that the user forgot) */
@@ -310,4 +412,50 @@ void pvr_vblank_handler(uint32 code, void *data);
 
 void pvr_start_dma(void);
 
+/* Start rendering the oldest scene handed to the renderer, if possible */
+void pvr_render_lists(void);
+
+
+/**** pvr_pace.c ******************************************************/
+
+/* Measure the vblank period; called on each vblank */
+void pvr_pace_vblank(void);
+
+/* True if the frame shown has been up for as many vblanks as it should */
+bool pvr_pace_flip_due(void);
+
+/* Record a flip, and pick the swap interval for the next frames */
+void pvr_pace_flipped(void);
+
+
+/**** pvr_hud.c *******************************************************/
+
+/* Drop the overlay's textures, before PVR RAM is reset */
+void pvr_hud_shutdown(void);
+
+
+/**** pvr_palette.c ***************************************************/
+
+/* Write committed shadow palette entries to the hardware, unless a render is
+   in progress. Assumes interrupts are disabled. */
+void pvr_pal_sync(void);
+
+
+/**** pvr_upload.c ****************************************************/
+
+/* Reset / drop the texture upload queue */
+void pvr_upload_init(void);
+void pvr_upload_shutdown(void);
+
+/* Start sending queued uploads if the DMA lock is free */
+void pvr_upload_kick(void);
+
+/* Send a piece of an upload due for the current scene, while the caller holds
+   the DMA lock, and call next once it's done. Returns false if there is none
+   to send. */
+bool pvr_upload_interleave(pvr_dma_callback_t next, void *data);
+
+/* True if uploads needed by the given scene are still queued */
+bool pvr_upload_blocks(pvr_fence_t seq);
+
 #endif
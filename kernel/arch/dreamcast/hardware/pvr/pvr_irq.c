@@ -13,6 +13,8 @@
 
 #include <kos/genwait.h>
 #include <kos/regfield.h>
+#include <kos/timer.h>
+#include <kos/trace.h>
 
 #include <stdio.h>
 
@@ -31,6 +33,10 @@ static void dma_next_list(void *thread) {
     volatile pvr_dma_buffers_t * b;
     unsigned int i;
 
+    // Textures the scene needs go first, in between lists.
+    if(pvr_upload_interleave(dma_next_list, thread))
+        return;
+
     // Get the buffers for this frame.
     b = pvr_state.dma_buffers + (pvr_state.ram_target ^ 1);
 
@@ -64,6 +70,9 @@ static void dma_next_list(void *thread) {
 
     // Buffers are now empty again
     pvr_state.dma_buffers[pvr_state.ram_target ^ 1].ready = 0;
+
+    // Let queued texture uploads have the DMA channel.
+    pvr_upload_kick();
 }
 
 void pvr_start_dma(void) {
@@ -75,11 +84,46 @@ void pvr_start_dma(void) {
     dma_next_list(thd_get_current());
 }
 
-static void pvr_render_lists(void) {
-    if(pvr_state.ta_busy
+/* Hand the scene the TA just finished over to the renderer, if the renderer
+   doesn't still own the next set of TA buffers. */
+static bool pvr_queue_lists(void) {
+    volatile pvr_ta_buffers_t *buf;
+    uint32_t used;
+    int limit = pvr_state.ta_count > 1 ? pvr_state.ta_count - 1 : 1;
+
+    if(!pvr_state.ta_busy
+       || pvr_state.lists_transferred != pvr_state.lists_enabled
+       || pvr_state.ta_queued >= limit)
+        return false;
+
+    // Remember what the scene needs to be rendered later on.
+    buf = pvr_state.ta_buffers + pvr_state.ta_target;
+    buf->vertex_end = PVR_GET(PVR_TA_VERTBUF_POS);
+    buf->seq = pvr_state.scene_seq;
+    buf->to_texture = pvr_state.curr_to_texture;
+    buf->to_txr_rp = pvr_state.to_txr_rp;
+    buf->to_txr_addr = pvr_state.to_txr_addr;
+    pvr_state.ta_queued++;
+
+    // See how much of the extra OPB space the scene needed.
+    used = (PVR_GET(PVR_TA_OPB_POS) << 2) - (buf->opb + buf->opb_size);
+
+    if((int32_t)used > 0 && used > pvr_state.opb_ovf_used_max)
+        pvr_state.opb_ovf_used_max = used;
+
+    return true;
+}
+
+void pvr_render_lists(void) {
+    volatile pvr_ta_buffers_t *buf;
+    bool queued = pvr_queue_lists();
+
+    buf = pvr_state.ta_buffers + pvr_state.ta_render;
+
+    if(pvr_state.ta_queued
        && !pvr_state.render_busy
-       && (!pvr_state.render_completed || pvr_state.curr_to_texture)
-       && pvr_state.lists_transferred == pvr_state.lists_enabled) {
+       && (!pvr_state.render_completed || buf->to_texture)
+       && !pvr_upload_blocks(buf->seq)) {
 
         /* XXX Note:
            For some reason, the render must be started _before_ we sync
@@ -87,55 +131,76 @@ static void pvr_render_lists(void) {
            are that there may be something in the reg sync that messes up
            the render in progress, or we are misusing some bits somewhere. */
 
-        // Begin rendering from the dirty TA buffer into the clean
+        // Begin rendering from the oldest queued TA buffer into the clean
         // frame buffer.
-        //DBG(("start_render(%d -> %d)\n", pvr_state.ta_target, pvr_state.view_target ^ 1));
-        pvr_state.ta_target ^= pvr_state.vbuf_doublebuf;
-        pvr_begin_queued_render();
+        //DBG(("start_render(%d -> %d)\n", pvr_state.ta_render, pvr_state.view_target ^ 1));
+        pvr_pal_sync();
+        pvr_begin_queued_render(pvr_state.ta_render);
         pvr_state.render_busy = 1;
+        pvr_state.was_to_texture = buf->to_texture;
         pvr_sync_stats(PVR_SYNC_RNDSTART);
+    }
 
+    if(queued) {
         // Switch to the clean TA buffer.
+        pvr_state.ta_target = (pvr_state.ta_target + 1) % pvr_state.ta_count;
         pvr_state.lists_transferred = 0;
         pvr_sync_reg_buffer();
 
         // The TA is no longer busy.
         pvr_state.ta_busy = 0;
 
-        pvr_state.was_to_texture = pvr_state.curr_to_texture;
-
         // Signal the client code to continue onwards.
         genwait_wake_all((void *)&pvr_state.ta_busy);
         thd_schedule(true);
     }
 }
 
+/* The TA is done with a list of the scene. */
+static void pvr_list_done(int list) {
+    pvr_state.lists_transferred |= BIT(list);
+    pvr_state.list_last_len[list] = timer_ns_gettime64() - pvr_state.reg_start_time;
+}
+
+/* Show the frame buffer that was just rendered. */
+static void pvr_flip(void) {
+    //DBG(("view(%d)\n", pvr_state.view_target ^ 1));
+
+    // Handle PVR stats
+    pvr_sync_stats(PVR_SYNC_PAGEFLIP);
+
+    // Switch view address to the "good" buffer
+    pvr_state.view_target ^= 1;
+
+    pvr_sync_view();
+
+    // Clear the render completed flag.
+    pvr_state.render_completed = 0;
+
+    pvr_pace_flipped();
+}
+
 void pvr_vblank_handler(uint32 code, void *data) {
     (void)code;
     (void)data;
 
     pvr_sync_stats(PVR_SYNC_VBLANK);
+    pvr_pace_vblank();
 
     // If the render-done interrupt has fired then we are ready to flip to the
-    // new frame buffer.
-    if(pvr_state.render_completed) {
-        //DBG(("view(%d)\n", pvr_state.view_target ^ 1));
-
-        // Handle PVR stats
-        pvr_sync_stats(PVR_SYNC_PAGEFLIP);
-
-        // Switch view address to the "good" buffer
-        pvr_state.view_target ^= 1;
-
-        pvr_sync_view();
-
-        // Clear the render completed flag.
-        pvr_state.render_completed = 0;
-    }
+    // new frame buffer, once the frame before has been up for long enough.
+    if(pvr_state.render_completed && pvr_pace_flip_due())
+        pvr_flip();
 
     // We may have a pending render, that couldn't be done as the previous
     // render wasn't flipped yet; do it now.
     pvr_render_lists();
+
+    // Palette changes go out now if no render picked them up.
+    pvr_pal_sync();
+
+    // Pick up uploads left behind by users of the DMA lock outside of here.
+    pvr_upload_kick();
 }
 
 void pvr_int_handler(uint32 code, void *data) {
@@ -145,30 +210,55 @@ void pvr_int_handler(uint32 code, void *data) {
     switch(code) {
         case ASIC_EVT_PVR_OPAQUEDONE:
             //DBG(("irq_opaquedone\n"));
-            pvr_state.lists_transferred |= BIT(PVR_OPB_OP);
+            pvr_list_done(PVR_OPB_OP);
             break;
         case ASIC_EVT_PVR_TRANSDONE:
             //DBG(("irq_transdone\n"));
-            pvr_state.lists_transferred |= BIT(PVR_OPB_TP);
+            pvr_list_done(PVR_OPB_TP);
             break;
         case ASIC_EVT_PVR_OPAQUEMODDONE:
-            pvr_state.lists_transferred |= BIT(PVR_OPB_OM);
+            pvr_list_done(PVR_OPB_OM);
             break;
         case ASIC_EVT_PVR_TRANSMODDONE:
-            pvr_state.lists_transferred |= BIT(PVR_OPB_TM);
+            pvr_list_done(PVR_OPB_TM);
             break;
         case ASIC_EVT_PVR_PTDONE:
-            pvr_state.lists_transferred |= BIT(PVR_OPB_PT);
+            pvr_list_done(PVR_OPB_PT);
             break;
         case ASIC_EVT_PVR_RENDERDONE_TSP:
             //DBG(("irq_renderdone\n"));
+            if(!pvr_state.render_busy)
+                break;
+
             pvr_state.render_busy = 0;
+            trace_event(TRACE_PVR_RENDER_DONE, 0);
+
             if(!pvr_state.was_to_texture)
                 pvr_state.render_completed = 1;
             pvr_sync_stats(PVR_SYNC_RNDDONE);
 
+            // Too late for the vblank it was meant for: rather than waiting
+            // for the next one, show it now, tearing.
+            if(pvr_state.render_completed && pvr_state.adaptive_vsync &&
+               pvr_pace_flip_due())
+                pvr_flip();
+
+            // The renderer is done with these TA buffers.
+            pvr_state.rendered_seq = pvr_state.ta_buffers[pvr_state.ta_render].seq;
+            pvr_state.ta_render = (pvr_state.ta_render + 1) % pvr_state.ta_count;
+            pvr_state.ta_queued--;
+
             genwait_wake_all((void *)&pvr_state.render_busy);
             break;
+        case ASIC_EVT_PVR_PARAM_OUTOFMEM:
+            // Whatever didn't fit in the vertex buffer is lost.
+            pvr_state.vtx_buf_overflows++;
+            pvr_state.buf_overflowed |= PVR_OVF_VERTEX;
+            break;
+        case ASIC_EVT_PVR_OPB_OUTOFMEM:
+            pvr_state.opb_overflows++;
+            pvr_state.buf_overflowed |= PVR_OVF_OPB;
+            break;
     }
 
     if(__is_defined(PVR_RENDER_DBG)) {
@@ -57,6 +57,9 @@ static LIST_HEAD(memctl_list, memctl) block_list;
 
 /* PVR RAM base; NULL is considered invalid */
 static pvr_ptr_t pvr_mem_base = NULL;
+
+/* Number of blocks allocated */
+static size_t pvr_mem_blocks;
 #define CHECK_MEM_BASE \
     assert_msg(pvr_mem_base != NULL, \
                "pvr_mem_* used, but PVR hasn't been initialized yet")
@@ -90,6 +93,10 @@ pvr_ptr_t pvr_mem_malloc(size_t size) {
     CHECK_MEM_BASE;
 
     rv32 = (uint32)pvr_int_malloc(size);
+
+    if(rv32)
+        pvr_mem_blocks++;
+
     assert_msg((rv32 & 0x1f) == 0,
                "dlmalloc's alignment is broken; "
                "please make a bug report");
@@ -147,6 +154,9 @@ void pvr_mem_free(pvr_ptr_t chunk) {
         }
     }
 
+    if(chunk)
+        pvr_mem_blocks--;
+
     pvr_int_free((void *)chunk);
 }
 
@@ -193,6 +203,12 @@ void pvr_mem_reset(void) {
         pvr_mem_base = (pvr_ptr_t)(PVR_RAM_INT_BASE + pvr_state.texture_base);
         pvr_int_mem_reset();
     }
+
+    pvr_mem_blocks = 0;
+}
+
+size_t pvr_mem_used_blocks(void) {
+    return pvr_mem_blocks;
 }
 
 /* Print some statistics (like mallocstats) */
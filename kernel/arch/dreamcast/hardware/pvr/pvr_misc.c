@@ -14,6 +14,7 @@
 #include <dc/pvr.h>
 #include <dc/video.h>
 #include <kos/regfield.h>
+#include <kos/trace.h>
 
 #include "pvr_internal.h"
 
@@ -54,6 +55,9 @@ int pvr_get_vbl_count(void) {
 /* Fill in a statistics structure (above) from current data. This
    is a super-set of frame count. */
 int pvr_get_stats(pvr_stats_t *stat) {
+    size_t i, n;
+    uint32_t ms;
+
     if(!pvr_state.valid)
         return -1;
 
@@ -75,6 +79,32 @@ int pvr_get_stats(pvr_stats_t *stat) {
     stat->buf_last_time = pvr_state.buf_last_len;
     stat->frame_count = pvr_state.frame_count;
 
+    for(i = 0; i < PVR_OPB_COUNT; i++)
+        stat->list_buffer_used_max[i] = pvr_state.list_buf_used_max[i];
+
+    for(i = 0; i < PVR_OPB_COUNT; i++)
+        stat->list_last_time[i] = pvr_state.list_last_len[i];
+
+    stat->dma_last_time = pvr_state.dma_last_len;
+    stat->wait_last_time = pvr_state.wait_last_len;
+    stat->wait_total_time = pvr_state.wait_len;
+
+    /* Sort the last frames into 1ms buckets */
+    memset(stat->frame_time_hist, 0, sizeof(stat->frame_time_hist));
+    n = pvr_state.frame_hist_count < PVR_STATS_HIST_FRAMES ?
+        pvr_state.frame_hist_count : PVR_STATS_HIST_FRAMES;
+
+    for(i = 0; i < n; i++) {
+        ms = pvr_state.frame_hist[i] / 1000;
+        stat->frame_time_hist[ms < PVR_STATS_HIST_BUCKETS ? ms : PVR_STATS_HIST_BUCKETS - 1]++;
+    }
+
+    stat->opb_overflow_used_max = pvr_state.opb_ovf_used_max;
+    stat->vtx_buffer_overflows = pvr_state.vtx_buf_overflows;
+    stat->opb_overflows = pvr_state.opb_overflows;
+    stat->buf_resizes = pvr_state.buf_resizes;
+    stat->hdr_skipped = pvr_state.hdr_skipped;
+
     return 0;
 }
 
@@ -130,8 +160,18 @@ void pvr_sync_stats(int event) {
 
             case PVR_SYNC_PAGEFLIP:
                 pvr_state.frame_last_len = t - pvr_state.frame_last_time;
+
+                if(pvr_state.frame_last_time)
+                    pvr_state.frame_hist[pvr_state.frame_hist_count++ % PVR_STATS_HIST_FRAMES] =
+                        pvr_state.frame_last_len / 1000;
+
                 pvr_state.frame_last_time = t;
                 pvr_state.frame_count++;
+
+                pvr_state.dma_last_len = pvr_state.dma_busy_len - pvr_state.dma_busy_mark;
+                pvr_state.dma_busy_mark = pvr_state.dma_busy_len;
+                pvr_state.wait_last_len = pvr_state.wait_len - pvr_state.wait_mark;
+                pvr_state.wait_mark = pvr_state.wait_len;
                 break;
         }
     }
@@ -172,9 +212,9 @@ void pvr_sync_reg_buffer(void) {
 #endif
 }
 
-/* Begin a render operation that has been queued completely (i.e., the
-   opposite of ta_target) */
-void pvr_begin_queued_render(void) {
+/* Begin a render operation that has been queued completely in the given
+   TA buffers */
+void pvr_begin_queued_render(int which) {
     volatile pvr_ta_buffers_t   * tbuf;
     volatile pvr_frame_buffers_t    * rbuf;
     pvr_bkg_poly_t  bkg;
@@ -187,7 +227,7 @@ void pvr_begin_queued_render(void) {
     } zclip;
 
     /* Get the appropriate buffer */
-    tbuf = pvr_state.ta_buffers + (pvr_state.ta_target ^ pvr_state.vbuf_doublebuf);
+    tbuf = pvr_state.ta_buffers + which;
     rbuf = pvr_state.frame_buffers + (bufn ^ 1);
 
     /* Calculate background value for below */
@@ -195,7 +235,7 @@ void pvr_begin_queued_render(void) {
        0x01203000... I'm thinking that the upper word signifies
        the length of the background plane list in dwords
        shifted up by 4. */
-    vert_end = 0x01000000 | ((PVR_GET(PVR_TA_VERTBUF_POS) - tbuf->vertex) << 1);
+    vert_end = 0x01000000 | ((tbuf->vertex_end - tbuf->vertex) << 1);
 
     /* Throw the background data on the end of the TA's list */
     bkg.flags1 = 0x90800000;    /* These are from libdream.. ought to figure out */
@@ -213,7 +253,7 @@ void pvr_begin_queued_render(void) {
     bkg.y3     = pvr_state.h;
     bkg.z3     = FLT_EPSILON;
     bkg.argb3  = pvr_state.bg_color;
-    vrl = (uint32_t *)(PVR_RAM_BASE | PVR_GET(PVR_TA_VERTBUF_POS));
+    vrl = (uint32_t *)(PVR_RAM_BASE | tbuf->vertex_end);
 
     memcpy(vrl, &bkg, sizeof(bkg));
 
@@ -225,26 +265,27 @@ void pvr_begin_queued_render(void) {
     PVR_SET(PVR_ISP_TILEMAT_ADDR, tbuf->tile_matrix);
     PVR_SET(PVR_ISP_VERTBUF_ADDR, tbuf->vertex);
 
-    if(!pvr_state.curr_to_texture)
+    if(!tbuf->to_texture)
         PVR_SET(PVR_RENDER_ADDR, rbuf->frame);
     else {
-        PVR_SET(PVR_RENDER_ADDR, pvr_state.to_txr_addr | BIT(24));
-        PVR_SET(PVR_RENDER_ADDR_2, pvr_state.to_txr_addr | BIT(24));
+        PVR_SET(PVR_RENDER_ADDR, tbuf->to_txr_addr | BIT(24));
+        PVR_SET(PVR_RENDER_ADDR_2, tbuf->to_txr_addr | BIT(24));
     }
 
     PVR_SET(PVR_BGPLANE_CFG, vert_end); /* Bkg plane location */
     zclip.f = pvr_state.zclip;
     PVR_SET(PVR_BGPLANE_Z, zclip.i);
-    PVR_SET(PVR_PCLIP_X, pvr_state.pclip_x);
-    PVR_SET(PVR_PCLIP_Y, pvr_state.pclip_y);
+    PVR_SET(PVR_PCLIP_X, tbuf->pclip_x);
+    PVR_SET(PVR_PCLIP_Y, tbuf->pclip_y);
 
-    if(!pvr_state.curr_to_texture)
+    if(!tbuf->to_texture)
         PVR_SET(PVR_RENDER_MODULO, (pvr_state.w * vid_pmode_bpp[vid_mode->pm]) / 8);
     else
-        PVR_SET(PVR_RENDER_MODULO, pvr_state.to_txr_rp);
+        PVR_SET(PVR_RENDER_MODULO, tbuf->to_txr_rp);
 
     // XXX Do we _really_ need this every time?
     // SETREG(PVR_FB_CFG_2, 0x00000009);        /* Alpha mode */
+    trace_event(TRACE_PVR_RENDER_START, which);
     PVR_SET(PVR_ISP_START, PVR_ISP_START_GO);   /* Start render */
 }
 
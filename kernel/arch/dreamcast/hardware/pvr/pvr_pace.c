@@ -0,0 +1,126 @@
+/* KallistiOS ##version##
+
+   pvr_pace.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Frame pacing. Flips wait for the frame shown to have been up for the swap
+   interval, so that frames come out every 1, 2 or 3 vblanks (60, 30 or 20 Hz
+   at 60 Hz). The automatic interval is picked from what the last frame cost:
+   the longest of its render time and of the CPU time spent on it, which is
+   the time between flips not spent in pvr_wait_ready(). It goes up as soon as
+   a frame doesn't fit, and only goes down once frames fit a shorter interval
+   with room to spare for a while, so that it doesn't flicker between two. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <arch/irq.h>
+#include <kos/timer.h>
+#include <dc/pvr.h>
+#include "pvr_internal.h"
+
+#define PACE_MAX_INTERVAL   3
+
+/* Frames in a row that have to fit a shorter interval before using it */
+#define PACE_CALM_FRAMES    30
+
+/* Shortest interval fitting the cost when using pct percent of it */
+static int pace_fit(uint64_t cost, int pct) {
+    int n = 1;
+
+    while(n < PACE_MAX_INTERVAL && cost * 100 > n * pvr_state.vbl_period * pct)
+        n++;
+
+    return n;
+}
+
+void pvr_pace_vblank(void) {
+    uint64_t t = timer_ns_gettime64();
+
+    if(pvr_state.vbl_time)
+        pvr_state.vbl_period = t - pvr_state.vbl_time;
+
+    pvr_state.vbl_time = t;
+}
+
+bool pvr_pace_flip_due(void) {
+    return pvr_state.vbl_count - pvr_state.flip_vbl >= (size_t)pvr_state.swap_cur;
+}
+
+void pvr_pace_flipped(void) {
+    uint64_t cost, cpu = 0;
+    int up, down;
+
+    pvr_state.flip_vbl = pvr_state.vbl_count;
+    pvr_state.flip_time = timer_ns_gettime64();
+
+    if(pvr_state.swap_interval) {
+        pvr_state.swap_cur = pvr_state.swap_interval;
+        return;
+    }
+
+    if(!pvr_state.vbl_period)
+        return;
+
+    if(pvr_state.frame_last_len > pvr_state.wait_last_len)
+        cpu = pvr_state.frame_last_len - pvr_state.wait_last_len;
+
+    cost = pvr_state.rnd_last_len > cpu ? pvr_state.rnd_last_len : cpu;
+    up = pace_fit(cost, 95);
+    down = pace_fit(cost, 80);
+
+    if(up > pvr_state.swap_cur) {
+        pvr_state.swap_cur = up;
+        pvr_state.pace_calm = 0;
+    }
+    else if(down < pvr_state.swap_cur) {
+        if(++pvr_state.pace_calm >= PACE_CALM_FRAMES) {
+            pvr_state.swap_cur = down;
+            pvr_state.pace_calm = 0;
+        }
+    }
+    else {
+        pvr_state.pace_calm = 0;
+    }
+}
+
+int pvr_set_swap_interval(int interval) {
+    if(interval < 0 || interval > PACE_MAX_INTERVAL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    irq_disable_scoped();
+
+    pvr_state.swap_interval = interval;
+    pvr_state.pace_calm = 0;
+
+    if(interval)
+        pvr_state.swap_cur = interval;
+
+    return 0;
+}
+
+int pvr_get_swap_interval(void) {
+    return pvr_state.swap_cur;
+}
+
+void pvr_set_adaptive_vsync(bool enable) {
+    pvr_state.adaptive_vsync = enable;
+}
+
+uint64_t pvr_get_present_time(void) {
+    uint64_t period, base;
+    int pending;
+
+    irq_disable_scoped();
+
+    period = pvr_state.vbl_period ? pvr_state.vbl_period : 16683333;
+    base = pvr_state.flip_time ? pvr_state.flip_time : pvr_state.vbl_time;
+
+    /* Frames handed to the renderer and not shown yet come first. */
+    pending = pvr_state.ta_queued + (pvr_state.render_completed ? 1 : 0);
+
+    return base + period * pvr_state.swap_cur * (pending + 1);
+}
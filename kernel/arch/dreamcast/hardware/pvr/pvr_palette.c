@@ -6,7 +6,11 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <arch/irq.h>
 #include <dc/pvr.h>
+#include <kos/genwait.h>
 #include "pvr_internal.h"
 
 /*
@@ -21,3 +25,116 @@ void pvr_set_pal_format(pvr_palfmt_t fmt) {
     PVR_SET(PVR_PALETTE_CFG, fmt);
 }
 
+
+/* Shadow palettes. Entries are edited in one of them, and committing swaps
+   them, so that the committed entries stay put until they are written to the
+   hardware. Committed entries are copied to the other one first, and the
+   range waiting to be written only ever grows, so the palette waiting to be
+   written always holds all committed entries. They are written in between
+   renders, so that a scene is never drawn with half a palette. */
+static uint32_t shadow[2][PVR_PAL_ENTRIES] __attribute__((aligned(32)));
+static int shadow_edit;
+static size_t pending_lo, pending_hi;
+
+void pvr_pal_sync(void) {
+    const uint32_t *src = shadow[shadow_edit ^ 1];
+    vuint32 *dst = &PVR_GET(PVR_PALETTE_TABLE_BASE);
+    size_t i;
+
+    if(pending_lo >= pending_hi || pvr_state.render_busy)
+        return;
+
+    for(i = pending_lo; i < pending_hi; i++)
+        dst[i] = src[i];
+
+    pending_lo = pending_hi = 0;
+    genwait_wake_all(shadow);
+}
+
+uint32_t *pvr_pal_shadow(void) {
+    return shadow[shadow_edit];
+}
+
+int pvr_pal_commit(size_t first, size_t count) {
+    uint32_t *src, *dst;
+
+    if(first > PVR_PAL_ENTRIES || count > PVR_PAL_ENTRIES - first) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!count)
+        return 0;
+
+    irq_disable_scoped();
+
+    src = shadow[shadow_edit];
+    dst = shadow[shadow_edit ^ 1];
+    memcpy(dst + first, src + first, count * sizeof(uint32_t));
+    shadow_edit ^= 1;
+
+    if(pending_lo >= pending_hi) {
+        pending_lo = first;
+        pending_hi = first + count;
+    }
+    else {
+        if(first < pending_lo)
+            pending_lo = first;
+
+        if(first + count > pending_hi)
+            pending_hi = first + count;
+    }
+
+    pvr_pal_sync();
+
+    return 0;
+}
+
+int pvr_pal_commit_wait(int timeout) {
+    irq_disable_scoped();
+
+    while(pending_lo < pending_hi) {
+        if(genwait_wait(shadow, "pvr_pal_commit_wait", timeout, NULL) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void pal_reverse(uint32_t *pal, size_t lo, size_t hi) {
+    uint32_t tmp;
+
+    while(lo + 1 < hi) {
+        tmp = pal[lo];
+        pal[lo++] = pal[--hi];
+        pal[hi] = tmp;
+    }
+}
+
+int pvr_pal_rotate(size_t first, size_t count, int shift) {
+    uint32_t *pal = shadow[shadow_edit];
+    int n;
+
+    if(first > PVR_PAL_ENTRIES || count > PVR_PAL_ENTRIES - first) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(count < 2)
+        return 0;
+
+    /* Rotating right by n is reversing both parts, then the whole. */
+    n = shift % (int)count;
+
+    if(n < 0)
+        n += count;
+
+    if(!n)
+        return 0;
+
+    pal_reverse(pal, first, first + count - n);
+    pal_reverse(pal, first + count - n, first + count);
+    pal_reverse(pal, first, first + count);
+
+    return 0;
+}
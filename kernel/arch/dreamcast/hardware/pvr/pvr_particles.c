@@ -0,0 +1,230 @@
+/* KallistiOS ##version##
+
+   pvr_particles.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Particle batches. Each particle becomes a square sprite, written as the two
+   32-byte halves the TA takes it in, either straight into the Store Queues
+   or, for lists that go through vertex DMA, a chunk at a time into their
+   vertex buffer. */
+
+#include <errno.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <arch/cache.h>
+#include <dc/pvr.h>
+#include <dc/sq.h>
+
+#include "pvr_internal.h"
+
+/* Sprites built at a time for lists that go through vertex DMA. */
+#define PARTICLE_CHUNK  32
+
+/* The corners of a particle's sprite, and its texture coordinates. */
+typedef struct particle_quad {
+    float x0, y0, x1, y1, z;
+    uint32_t auv, buv, cuv;
+} particle_quad_t;
+
+typedef union {
+    float f;
+    uint32_t i;
+} particle_word_t;
+
+static inline uint32_t fword(float f) {
+    particle_word_t w = { .f = f };
+    return w.i;
+}
+
+static inline void particle_quad(const pvr_particles_t *p, size_t i,
+                                 particle_quad_t *q) {
+    float h = (p->size ? p->size[i] : p->size0) * 0.5f;
+    const float *r;
+
+    q->x0 = p->x[i] - h;
+    q->x1 = p->x[i] + h;
+    q->y0 = p->y[i] - h;
+    q->y1 = p->y[i] + h;
+    q->z = p->z ? p->z[i] : p->z0;
+
+    if(p->uv) {
+        r = p->uv + i * 4;
+        q->auv = PVR_PACK_16BIT_UV(r[0], r[3]);
+        q->buv = PVR_PACK_16BIT_UV(r[0], r[1]);
+        q->cuv = PVR_PACK_16BIT_UV(r[2], r[1]);
+    }
+}
+
+/* The same corner order as pvr_sprite_txr_t: bottom left, top left, top
+   right and bottom right. */
+static inline void particle_put_a(uint32_t *d, const particle_quad_t *q) {
+    d[0] = PVR_CMD_VERTEX_EOL;
+    d[1] = fword(q->x0);
+    d[2] = fword(q->y1);
+    d[3] = fword(q->z);
+    d[4] = fword(q->x0);
+    d[5] = fword(q->y0);
+    d[6] = fword(q->z);
+    d[7] = fword(q->x1);
+}
+
+static inline void particle_put_b(uint32_t *d, const particle_quad_t *q) {
+    d[0] = fword(q->y0);
+    d[1] = fword(q->z);
+    d[2] = fword(q->x1);
+    d[3] = fword(q->y1);
+    d[4] = 0;
+    d[5] = q->auv;
+    d[6] = q->buv;
+    d[7] = q->cuv;
+}
+
+/* Pull in the attributes of the particles coming up, a cache line of each
+   array at a time. */
+static inline void particle_prefetch(const pvr_particles_t *p, size_t i) {
+    if(i & 7)
+        return;
+
+    dcache_pref_block(p->x + i + 8);
+    dcache_pref_block(p->y + i + 8);
+
+    if(p->z)
+        dcache_pref_block(p->z + i + 8);
+
+    if(p->size)
+        dcache_pref_block(p->size + i + 8);
+
+    if(p->uv) {
+        dcache_pref_block(p->uv + (i + 8) * 4);
+        dcache_pref_block(p->uv + (i + 10) * 4);
+        dcache_pref_block(p->uv + (i + 12) * 4);
+        dcache_pref_block(p->uv + (i + 14) * 4);
+    }
+}
+
+/* The Store Queues only take whole words, which memcpy() doesn't promise. */
+static inline void particle_sq_put(pvr_dr_state_t *dr, const void *data) {
+    uint32_t *d = (uint32_t *)pvr_dr_target(*dr);
+    const uint32_t *s = (const uint32_t *)data;
+    int i;
+
+    for(i = 0; i < 8; i++)
+        d[i] = s[i];
+
+    pvr_dr_commit(d);
+}
+
+/* Particles first to last, all of the same color, through the Store
+   Queues. Two particles are worked out before either is written, which
+   gives the FPU something to do while the Store Queues are being flushed. */
+static void particles_sq(pvr_dr_state_t *dr, const pvr_particles_t *p,
+                         size_t first, size_t last, particle_quad_t *q) {
+    uint32_t *d;
+    size_t i;
+
+    for(i = first; i + 1 < last; i += 2) {
+        particle_prefetch(p, i);
+        particle_quad(p, i, &q[0]);
+        particle_quad(p, i + 1, &q[1]);
+
+        d = (uint32_t *)pvr_dr_target(*dr);
+        particle_put_a(d, &q[0]);
+        pvr_dr_commit(d);
+        d = (uint32_t *)pvr_dr_target(*dr);
+        particle_put_b(d, &q[0]);
+        pvr_dr_commit(d);
+
+        d = (uint32_t *)pvr_dr_target(*dr);
+        particle_put_a(d, &q[1]);
+        pvr_dr_commit(d);
+        d = (uint32_t *)pvr_dr_target(*dr);
+        particle_put_b(d, &q[1]);
+        pvr_dr_commit(d);
+    }
+
+    if(i < last) {
+        particle_quad(p, i, &q[0]);
+
+        d = (uint32_t *)pvr_dr_target(*dr);
+        particle_put_a(d, &q[0]);
+        pvr_dr_commit(d);
+        d = (uint32_t *)pvr_dr_target(*dr);
+        particle_put_b(d, &q[0]);
+        pvr_dr_commit(d);
+    }
+}
+
+/* The same, into the vertex buffer of a list. */
+static void particles_dma(pvr_list_t list, const pvr_particles_t *p,
+                          size_t first, size_t last, particle_quad_t *q) {
+    alignas(32) uint32_t buf[PARTICLE_CHUNK * 16];
+    size_t i, n;
+
+    while(first < last) {
+        n = last - first < PARTICLE_CHUNK ? last - first : PARTICLE_CHUNK;
+
+        for(i = 0; i < n; i++) {
+            particle_prefetch(p, first + i);
+            particle_quad(p, first + i, q);
+            particle_put_a(buf + i * 16, q);
+            particle_put_b(buf + i * 16 + 8, q);
+        }
+
+        pvr_list_prim(list, buf, n * 64);
+        first += n;
+    }
+}
+
+int pvr_particles_draw(const pvr_sprite_hdr_t *hdr, const pvr_particles_t *p,
+                       size_t count) {
+    alignas(32) pvr_sprite_hdr_t h = *hdr;
+    particle_quad_t q[2];
+    pvr_dr_state_t dr;
+    int list = pvr_state.list_reg_open;
+    size_t i, j;
+    bool dma;
+
+    if(list < 0 || !p->x || !p->y) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!count)
+        return 0;
+
+    dma = pvr_state.dma_mode &&
+          pvr_state.dma_buffers[pvr_state.ram_target].base[list];
+
+    if(!dma)
+        pvr_dr_init(&dr);
+
+    /* Without texture rectangles, every sprite shows the whole texture. */
+    q[0].auv = q[1].auv = PVR_PACK_16BIT_UV(0.0f, 1.0f);
+    q[0].buv = q[1].buv = PVR_PACK_16BIT_UV(0.0f, 0.0f);
+    q[0].cuv = q[1].cuv = PVR_PACK_16BIT_UV(1.0f, 0.0f);
+
+    /* One header per run of particles of the same color. */
+    for(i = 0; i < count; i = j) {
+        j = count;
+
+        if(p->argb) {
+            h.argb = p->argb[i];
+
+            for(j = i + 1; j < count && p->argb[j] == h.argb; j++)
+                ;
+        }
+
+        if(dma) {
+            pvr_list_prim(list, &h, sizeof(h));
+            particles_dma(list, p, i, j, q);
+        }
+        else {
+            particle_sq_put(&dr, &h);
+            particles_sq(&dr, p, i, j, q);
+        }
+    }
+
+    return 0;
+}
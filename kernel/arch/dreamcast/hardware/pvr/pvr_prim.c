@@ -6,9 +6,11 @@
  */
 
 #include <assert.h>
+#include <stdbool.h>
 #include <string.h>
 #include <arch/cache.h>
 #include <dc/pvr.h>
+#include <kos/mutex.h>
 #include "pvr_internal.h"
 
 /*
@@ -101,6 +103,50 @@ void pvr_poly_compile(pvr_poly_hdr_t *dst, const pvr_poly_cxt_t *src) {
     }
 }
 
+/* Memoized pvr_poly_compile(): a small direct-mapped cache of contexts and
+   their headers, indexed by an FNV-1a hash of the context. */
+#define COMPILE_CACHE_SIZE  32
+
+static struct {
+    pvr_poly_cxt_t cxt;
+    pvr_poly_hdr_t hdr;
+    bool valid;
+} compile_cache[COMPILE_CACHE_SIZE];
+
+static mutex_t compile_lock = MUTEX_INITIALIZER;
+
+static uint32_t pvr_cxt_hash(const pvr_poly_cxt_t *cxt) {
+    const uint32_t *p = (const uint32_t *)cxt;
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    for(i = 0; i < sizeof(*cxt) / 4; i++)
+        h = (h ^ p[i]) * 16777619u;
+
+    return h ^ (h >> 16);
+}
+
+void pvr_poly_compile_cached(pvr_poly_hdr_t *dst, const pvr_poly_cxt_t *src) {
+    uint32_t *d = (uint32_t *)dst;
+    const uint32_t *s;
+    int i, idx = pvr_cxt_hash(src) & (COMPILE_CACHE_SIZE - 1);
+
+    mutex_lock_scoped(&compile_lock);
+
+    if(!compile_cache[idx].valid ||
+       memcmp(&compile_cache[idx].cxt, src, sizeof(*src))) {
+        compile_cache[idx].cxt = *src;
+        pvr_poly_compile(&compile_cache[idx].hdr, src);
+        compile_cache[idx].valid = true;
+    }
+
+    /* Word by word, as dst may be a Store Queue. */
+    s = (const uint32_t *)&compile_cache[idx].hdr;
+
+    for(i = 0; i < 8; i++)
+        d[i] = s[i];
+}
+
 /* Create a colored polygon context with parameters similar to
    the old "ta" function `ta_poly_hdr_col' */
 void pvr_poly_cxt_col(pvr_poly_cxt_t *dst, pvr_list_t list) {
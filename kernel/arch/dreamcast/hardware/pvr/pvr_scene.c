@@ -7,6 +7,7 @@
  */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -14,6 +15,8 @@
 #include <kos/genwait.h>
 #include <kos/regfield.h>
 #include <kos/thread.h>
+#include <kos/timer.h>
+#include <kos/trace.h>
 #include <dc/pvr.h>
 #include <dc/sq.h>
 #include "pvr_internal.h"
@@ -103,14 +106,26 @@ static void pvr_start_ta_rendering(void) {
 
         // If using a single vertex buffer, we have to wait until the PVR is
         // done rendering to use the TA again.
-        if(!pvr_state.vbuf_doublebuf)
+        if(pvr_state.ta_count == 1)
             pvr_wait_render_done();
 
         pvr_state.ta_checked_ready = 1;
+        pvr_state.scene_seq++;
+
+        // Zero is the fence that's always signaled.
+        if(!pvr_state.scene_seq)
+            pvr_state.scene_seq++;
+
         pvr_state.curr_to_texture = pvr_state.next_to_texture;
         pvr_state.to_txr_rp = pvr_state.next_to_txr_rp;
         pvr_state.to_txr_addr = pvr_state.next_to_txr_addr;
 
+        // The TA buffers aren't the renderer's anymore, set up the tiles to
+        // render out of them.
+        pvr_clip_tile_matrix(pvr_state.ta_target, pvr_state.next_tile_clip);
+        pvr_state.ta_buffers[pvr_state.ta_target].pclip_x = pvr_state.next_pclip_x;
+        pvr_state.ta_buffers[pvr_state.ta_target].pclip_y = pvr_state.next_pclip_y;
+
         // Starting from that point, we consider that the Tile Accelerator
         // might be busy.
         pvr_state.ta_busy = 1;
@@ -126,8 +141,22 @@ void pvr_scene_begin(void) {
     pvr_state.ta_checked_ready = 0;
     pvr_state.lists_closed = 0;
 
+    // Render the whole screen, unless told otherwise.
+    pvr_state.next_tile_clip = PVR_TILE_CLIP(0, 0, pvr_state.tw - 1,
+                                             pvr_state.th - 1);
+    pvr_state.next_pclip_x = pvr_state.pclip_x;
+    pvr_state.next_pclip_y = pvr_state.pclip_y;
+
     // Get general stuff ready.
     pvr_state.list_reg_open = -1;
+    pvr_state.hdr_valid = 0;
+
+    if(pvr_state.frame_arena)
+        arena_reset(pvr_state.frame_arena);
+
+    // Grow the buffers if the previous scenes didn't fit.
+    if(pvr_state.buf_autosize && pvr_state.buf_overflowed)
+        pvr_autosize_buffers();
 
     // Clear these out in case we're using DMA.
     if(pvr_state.dma_mode) {
@@ -144,6 +173,10 @@ void pvr_scene_begin(void) {
     }
 }
 
+void pvr_set_frame_arena(arena_t *arena) {
+    pvr_state.frame_arena = arena;
+}
+
 /* Begin collecting data for a frame of 3D output to the specified texture;
    pass in the size of the buffer in rx and ry, and the return values in
    rx and ry will be the size actually used (if changed). Note that
@@ -170,6 +203,31 @@ void pvr_scene_begin_txr(pvr_ptr_t txr, uint32 *rx, uint32 *ry) {
     pvr_state.next_to_texture = 1;
 }
 
+/* Same as above, but only rendering the tiles a rectangle of the texture
+   covers, and clipping the output to it. */
+int pvr_scene_begin_txr_rect(pvr_ptr_t txr, uint32_t width, uint32_t x,
+                             uint32_t y, uint32_t w, uint32_t h) {
+    if(!w || !h || x + w > width ||
+       x + w > (uint32_t)pvr_state.tw * 32 ||
+       y + h > (uint32_t)pvr_state.th * 32) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pvr_state.next_to_txr_rp = width * 2 / 8;
+    pvr_state.next_to_txr_addr = (uint32)(txr) - PVR_RAM_INT_BASE;
+
+    pvr_scene_begin();
+
+    pvr_state.next_to_texture = 1;
+    pvr_state.next_tile_clip = PVR_TILE_CLIP(x / 32, y / 32, (x + w - 1) / 32,
+                                             (y + h - 1) / 32);
+    pvr_state.next_pclip_x = ((x + w - 1) << 16) | x;
+    pvr_state.next_pclip_y = ((y + h - 1) << 16) | y;
+
+    return 0;
+}
+
 static bool pvr_list_dma;
 
 inline static bool pvr_list_uses_dma(pvr_list_t list) {
@@ -197,11 +255,14 @@ int pvr_list_begin(pvr_list_t list) {
     if(!pvr_list_dma) {
         pvr_start_ta_rendering();
         sq_lock((void *)PVR_TA_INPUT);
+        pvr_state.hdr_valid &= ~BIT(list);
     }
 
     /* Ok, set the flag */
     pvr_state.list_reg_open = list;
 
+    trace_event(TRACE_PVR_LIST_BEGIN, list);
+
     return 0;
 }
 
@@ -218,6 +279,8 @@ int pvr_list_finish(void) {
         return -1;
     }
 
+    trace_event(TRACE_PVR_LIST_FINISH, pvr_state.list_reg_open);
+
     /* Check for immediate submission:
        A. If we are not in DMA mode, we must be submitting polygons
           immediately.
@@ -247,6 +310,52 @@ int pvr_list_finish(void) {
     return 0;
 }
 
+void pvr_set_hdr_cache(bool enable) {
+    pvr_state.hdr_cache = enable;
+    pvr_state.hdr_valid = 0;
+}
+
+/* Check data about to be sent to a list against the header cache. Returns the
+   number of bytes at the start of data that the TA already has, which is 32 if
+   data is just the header last sent to the list, and 0 otherwise. Anything
+   bigger than a single header that starts with one may be a 64-byte header, or
+   have more headers in it, so the list's cached header is dropped then. */
+static inline size_t pvr_hdr_skip(pvr_list_t list, const void *data,
+                                  size_t size) {
+    const uint32_t *hdr = (const uint32_t *)data;
+    volatile uint32_t *last = pvr_state.hdr_last[list];
+    uint32_t type = hdr[0] >> 29;
+    int i;
+
+    if(!pvr_state.hdr_cache || type < 4 || type > 5)
+        return 0;
+
+    /* Headers sent with Direct Rendering can't be seen here. */
+    if(size != 32 || pvr_state.dr_used) {
+        pvr_state.hdr_valid &= ~BIT(list);
+        return 0;
+    }
+
+    if(pvr_state.hdr_valid & BIT(list)) {
+        for(i = 0; i < 8; i++) {
+            if(hdr[i] != last[i])
+                break;
+        }
+
+        if(i == 8) {
+            pvr_state.hdr_skipped++;
+            return 32;
+        }
+    }
+
+    for(i = 0; i < 8; i++)
+        last[i] = hdr[i];
+
+    pvr_state.hdr_valid |= BIT(list);
+
+    return 0;
+}
+
 int pvr_prim(const void *data, size_t size) {
     /* Check to make sure we can do this */
     if(PVR_DEBUG && pvr_state.list_reg_open == -1) {
@@ -261,6 +370,9 @@ int pvr_prim(const void *data, size_t size) {
             return -1;
         }
 
+        if(pvr_hdr_skip(pvr_state.list_reg_open, data, size))
+            return 0;
+
         /* Immediately send data via SQs. */
         sq_fast_cpy(SQ_MASK_DEST(PVR_TA_INPUT), data, size >> 5);
     }
@@ -283,6 +395,9 @@ int pvr_list_prim(pvr_list_t list, const void *data, size_t size) {
     /* Ensure at least 4-byte alignment. */
     assert(!((uintptr_t)data & 0x3));
 
+    if(pvr_hdr_skip(list, data, size))
+        return 0;
+
     /* Ensure we won't overflow the vertex buffer. */
     assert(b->ptr[list] + size <= b->size[list]);
 
@@ -295,12 +410,68 @@ int pvr_list_prim(pvr_list_t list, const void *data, size_t size) {
 void pvr_dr_init(pvr_dr_state_t *vtx_buf_ptr) {
     *vtx_buf_ptr = 0;
     pvr_state.dr_used = 1;
+
+    /* Whatever goes through the Store Queues now isn't seen by the cache. */
+    if(pvr_state.list_reg_open != -1)
+        pvr_state.hdr_valid &= ~BIT(pvr_state.list_reg_open);
 }
 
 void pvr_dr_finish(void) {
     pvr_state.dr_used = 0;
 }
 
+/* Write one vertex into the next Store Queue and flush it. The flush of one
+   queue goes on while the other one is being filled. */
+static inline void pvr_dr_put(pvr_dr_state_t *vtx_buf_ptr,
+                              const pvr_vertex_t *src, uint32_t flags) {
+    uint32_t *d = (uint32_t *)pvr_dr_target(*vtx_buf_ptr);
+    const uint32_t *s = (const uint32_t *)src;
+
+    d[0] = flags;
+    d[1] = s[1];
+    d[2] = s[2];
+    d[3] = s[3];
+    d[4] = s[4];
+    d[5] = s[5];
+    d[6] = s[6];
+    d[7] = s[7];
+    pvr_dr_commit(d);
+}
+
+void pvr_dr_strip(pvr_dr_state_t *vtx_buf_ptr, const pvr_vertex_t *vtx,
+                  size_t count) {
+    if(!count)
+        return;
+
+    while(--count) {
+        dcache_pref_block(vtx + 1);
+        pvr_dr_put(vtx_buf_ptr, vtx++, PVR_CMD_VERTEX);
+    }
+
+    pvr_dr_put(vtx_buf_ptr, vtx, PVR_CMD_VERTEX_EOL);
+}
+
+void pvr_dr_strip_indexed(pvr_dr_state_t *vtx_buf_ptr, const pvr_vertex_t *vtx,
+                          const uint16_t *idx, size_t count) {
+    size_t i;
+    uint16_t next;
+
+    for(i = 0; i < count; i++) {
+        if(idx[i] == PVR_DR_RESTART)
+            continue;
+
+        next = i + 1 < count ? idx[i + 1] : PVR_DR_RESTART;
+
+        if(next != PVR_DR_RESTART) {
+            dcache_pref_block(vtx + next);
+            pvr_dr_put(vtx_buf_ptr, vtx + idx[i], PVR_CMD_VERTEX);
+        }
+        else {
+            pvr_dr_put(vtx_buf_ptr, vtx + idx[i], PVR_CMD_VERTEX_EOL);
+        }
+    }
+}
+
 int pvr_list_flush(pvr_list_t list) {
     (void)list;
 
@@ -310,9 +481,9 @@ int pvr_list_flush(pvr_list_t list) {
 
 /* Call this after you have finished submitting all data for a frame; once
    this has been called, you can not submit any more data until one of the
-   pvr_scene_begin() functions is called again. An error (-1) is returned if
-   you have not started a scene already. */
-int pvr_scene_finish(void) {
+   pvr_scene_begin() functions is called again. The returned fence is signaled
+   once the scene has been rendered. */
+pvr_fence_t pvr_scene_finish_async(void) {
     int i, o;
     volatile pvr_dma_buffers_t * b;
 
@@ -358,6 +529,9 @@ int pvr_scene_finish(void) {
 
             // Verify that there is no overrun.
             assert(b->ptr[i] <= b->size[i]);
+
+            if(b->ptr[i] > pvr_state.list_buf_used_max[i])
+                pvr_state.list_buf_used_max[i] = b->ptr[i];
         }
 
         pvr_start_ta_rendering();
@@ -389,18 +563,73 @@ int pvr_scene_finish(void) {
     }
 
     /* Ok, now it's just a matter of waiting for the interrupt... */
+    return pvr_state.scene_seq;
+}
+
+int pvr_scene_finish(void) {
+    pvr_scene_finish_async();
+    return 0;
+}
+
+int pvr_fence_check(pvr_fence_t fence) {
+    if((int32_t)(pvr_state.rendered_seq - fence) >= 0)
+        return 0;
+    else
+        return -1;
+}
+
+int pvr_fence_wait(pvr_fence_t fence, int timeout) {
+    uint64_t end = 0, now;
+
+    assert(pvr_state.valid);
+
+    if(timeout)
+        end = timer_ms_gettime64() + timeout;
+
+    irq_disable_scoped();
+
+    while(pvr_fence_check(fence)) {
+        if(timeout) {
+            now = timer_ms_gettime64();
+
+            if(now >= end)
+                return -1;
+
+            timeout = (int)(end - now);
+        }
+
+        genwait_wait((void *)&pvr_state.render_busy, "PVR wait fence",
+                     timeout, NULL);
+    }
+
+    return 0;
+}
+
+int pvr_fence_add_waiter(pvr_fence_t fence, genwait_waiter_t *w) {
+    irq_disable_scoped();
+
+    /* Checking with interrupts disabled means the end of render can't slip
+       in between the check and adding the waiter. */
+    if(!pvr_fence_check(fence))
+        return 1;
+
+    genwait_waiter_add(w, (void *)&pvr_state.render_busy);
     return 0;
 }
 
 int pvr_wait_ready(void) {
     int flags, t = 0;
+    uint64_t start;
 
     assert(pvr_state.valid);
 
     flags = irq_disable();
 
-    if(pvr_state.ta_busy)
+    if(pvr_state.ta_busy) {
+        start = timer_ns_gettime64();
         t = genwait_wait((void *)&pvr_state.ta_busy, "PVR wait ready", 100, NULL);
+        pvr_state.wait_len += timer_ns_gettime64() - start;
+    }
 
     irq_restore(flags);
 
@@ -437,7 +666,8 @@ int pvr_wait_render_done(void) {
 
     irq_disable_scoped();
 
-    if(pvr_state.render_busy)
+    // Wait for the scenes queued behind the one being rendered as well.
+    while(pvr_state.ta_queued && t >= 0)
         t = genwait_wait((void *)&pvr_state.render_busy, "PVR wait render done", 100, NULL);
 
     return t;
@@ -0,0 +1,277 @@
+/* KallistiOS ##version##
+
+   pvr_shadow.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Shadow volumes. The edge table is built once per mesh, by sorting the
+   edges of all triangles so that both sides of each edge end up next to each
+   other. Each frame, triangles are sorted out by whether they face the light,
+   the vertices are transformed once where they are and once pushed along the
+   light, and the volume goes out in batches of modifier triangles. */
+
+#include <errno.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dc/matrix.h>
+#include <dc/pvr.h>
+#include "pvr_internal.h"
+
+/* Triangles sent to the TA at a time */
+#define SHADOW_BATCH    16
+
+/* Vertices behind the camera are moved to this W */
+#define SHADOW_MIN_W    0.0001f
+
+typedef struct pvr_shadow_edge {
+    uint16_t v[2];
+    uint16_t t[2];
+} shadow_edge_t;
+
+/* One side of an edge, while building the table */
+typedef struct {
+    uint16_t lo, hi;
+    uint16_t tri;
+} half_edge_t;
+
+static int half_edge_cmp(const void *a, const void *b) {
+    const half_edge_t *ea = (const half_edge_t *)a;
+    const half_edge_t *eb = (const half_edge_t *)b;
+
+    if(ea->lo != eb->lo)
+        return (int)ea->lo - (int)eb->lo;
+
+    return (int)ea->hi - (int)eb->hi;
+}
+
+void pvr_shadow_mesh_update(pvr_shadow_mesh_t *m) {
+    const vec3f_t *a, *b, *c;
+    float ux, uy, uz, vx, vy, vz;
+    size_t i;
+
+    for(i = 0; i < m->tri_count; i++) {
+        a = &m->verts[m->tris[i * 3]];
+        b = &m->verts[m->tris[i * 3 + 1]];
+        c = &m->verts[m->tris[i * 3 + 2]];
+
+        ux = b->x - a->x;
+        uy = b->y - a->y;
+        uz = b->z - a->z;
+        vx = c->x - a->x;
+        vy = c->y - a->y;
+        vz = c->z - a->z;
+
+        /* Only the sign of its dot product with the light matters. */
+        m->normals[i].x = uy * vz - uz * vy;
+        m->normals[i].y = uz * vx - ux * vz;
+        m->normals[i].z = ux * vy - uy * vx;
+    }
+}
+
+int pvr_shadow_mesh_init(pvr_shadow_mesh_t *m, const vec3f_t *verts,
+                         size_t vert_count, const uint16_t *tris,
+                         size_t tri_count) {
+    half_edge_t *he;
+    size_t i, j, n = tri_count * 3;
+    uint16_t a, b;
+
+    memset(m, 0, sizeof(*m));
+
+    if(!tri_count || vert_count > UINT16_MAX + 1 || tri_count > UINT16_MAX + 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    m->verts = verts;
+    m->vert_count = vert_count;
+    m->tris = tris;
+    m->tri_count = tri_count;
+
+    he = malloc(n * sizeof(*he));
+    m->normals = malloc(tri_count * sizeof(*m->normals));
+    m->edges = malloc(n / 2 * sizeof(*m->edges));
+    m->facing = malloc(tri_count);
+    m->xf = malloc(vert_count * 2 * sizeof(*m->xf));
+
+    if(!he || !m->normals || !m->edges || !m->facing || !m->xf) {
+        free(he);
+        pvr_shadow_mesh_destroy(m);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for(i = 0; i < tri_count; i++) {
+        for(j = 0; j < 3; j++) {
+            a = tris[i * 3 + j];
+            b = tris[i * 3 + (j + 1) % 3];
+
+            he[i * 3 + j].lo = a < b ? a : b;
+            he[i * 3 + j].hi = a < b ? b : a;
+            he[i * 3 + j].tri = i;
+        }
+    }
+
+    qsort(he, n, sizeof(*he), half_edge_cmp);
+
+    /* In a closed mesh, every edge comes up exactly twice. */
+    for(i = 0; i < n; i += 2) {
+        if(i + 1 == n || half_edge_cmp(&he[i], &he[i + 1]) ||
+           (i + 2 < n && !half_edge_cmp(&he[i], &he[i + 2]))) {
+            free(he);
+            pvr_shadow_mesh_destroy(m);
+            errno = EINVAL;
+            return -1;
+        }
+
+        m->edges[i / 2].v[0] = he[i].lo;
+        m->edges[i / 2].v[1] = he[i].hi;
+        m->edges[i / 2].t[0] = he[i].tri;
+        m->edges[i / 2].t[1] = he[i + 1].tri;
+    }
+
+    m->edge_count = n / 2;
+    free(he);
+
+    pvr_shadow_mesh_update(m);
+
+    return 0;
+}
+
+void pvr_shadow_mesh_destroy(pvr_shadow_mesh_t *m) {
+    free(m->normals);
+    free(m->edges);
+    free(m->facing);
+    free(m->xf);
+    m->normals = NULL;
+    m->edges = NULL;
+    m->facing = NULL;
+    m->xf = NULL;
+}
+
+static inline void shadow_xf(vec3f_t *d, float x, float y, float z) {
+    float w = 1.0f;
+
+    mat_trans_nodiv(x, y, z, w);
+
+    if(w < SHADOW_MIN_W)
+        w = SHADOW_MIN_W;
+
+    w = 1.0f / w;
+    d->x = x * w;
+    d->y = y * w;
+    d->z = w;
+}
+
+/* Batch of triangles on its way out */
+typedef struct {
+    alignas(32) pvr_modifier_vol_t tri[SHADOW_BATCH];
+    size_t count;           /* In the batch */
+    size_t left;            /* Still to be added */
+    pvr_mod_hdr_t last_hdr;
+} shadow_out_t;
+
+static void shadow_flush(shadow_out_t *o) {
+    if(o->count)
+        pvr_prim(o->tri, o->count * sizeof(pvr_modifier_vol_t));
+
+    o->count = 0;
+}
+
+static void shadow_tri(shadow_out_t *o, const vec3f_t *a, const vec3f_t *b,
+                       const vec3f_t *c) {
+    pvr_modifier_vol_t *t;
+
+    /* The last triangle of the volume goes after a header of its own, that
+       closes the volume. */
+    if(--o->left == 0) {
+        shadow_flush(o);
+        pvr_prim(&o->last_hdr, sizeof(o->last_hdr));
+    }
+
+    t = &o->tri[o->count++];
+    t->flags = PVR_CMD_VERTEX_EOL;
+    t->ax = a->x;
+    t->ay = a->y;
+    t->az = a->z;
+    t->bx = b->x;
+    t->by = b->y;
+    t->bz = b->z;
+    t->cx = c->x;
+    t->cy = c->y;
+    t->cz = c->z;
+
+    if(o->count == SHADOW_BATCH || !o->left)
+        shadow_flush(o);
+}
+
+int pvr_shadow_submit(pvr_shadow_mesh_t *m, const vec3f_t *light, float dist,
+                      pvr_list_t list, uint32_t mode) {
+    shadow_out_t out;
+    pvr_mod_hdr_t hdr;
+    const vec3f_t *v, *n = m->normals;
+    const vec3f_t *xf0 = m->xf, *xf1 = m->xf + m->vert_count;
+    const shadow_edge_t *e;
+    const uint16_t *t;
+    size_t i, lit = 0, sides = 0;
+    float dx = light->x * dist, dy = light->y * dist, dz = light->z * dist;
+
+    if(list != PVR_LIST_OP_MOD && list != PVR_LIST_TR_MOD) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for(i = 0; i < m->tri_count; i++) {
+        m->facing[i] = n[i].x * light->x + n[i].y * light->y +
+                       n[i].z * light->z < 0.0f;
+        lit += m->facing[i];
+    }
+
+    if(!lit)
+        return 0;
+
+    for(i = 0; i < m->edge_count; i++) {
+        e = &m->edges[i];
+        sides += m->facing[e->t[0]] != m->facing[e->t[1]];
+    }
+
+    for(i = 0; i < m->vert_count; i++) {
+        v = &m->verts[i];
+        shadow_xf(&m->xf[i], v->x, v->y, v->z);
+        shadow_xf(&m->xf[m->vert_count + i], v->x + dx, v->y + dy, v->z + dz);
+    }
+
+    if(pvr_state.list_reg_open != (int)list && pvr_list_begin(list) < 0)
+        return -1;
+
+    pvr_mod_compile(&hdr, list, PVR_MODIFIER_OTHER_POLY, PVR_CULLING_NONE);
+    pvr_mod_compile(&out.last_hdr, list, mode, PVR_CULLING_NONE);
+    out.count = 0;
+    out.left = lit * 2 + sides * 2;
+
+    pvr_prim(&hdr, sizeof(hdr));
+
+    /* Caps: the lit side of the mesh, and its copy pushed away. */
+    for(i = 0; i < m->tri_count; i++) {
+        if(!m->facing[i])
+            continue;
+
+        t = &m->tris[i * 3];
+        shadow_tri(&out, &xf0[t[0]], &xf0[t[1]], &xf0[t[2]]);
+        shadow_tri(&out, &xf1[t[0]], &xf1[t[2]], &xf1[t[1]]);
+    }
+
+    /* Sides: a quad down from each edge of the silhouette. */
+    for(i = 0; i < m->edge_count; i++) {
+        e = &m->edges[i];
+
+        if(m->facing[e->t[0]] == m->facing[e->t[1]])
+            continue;
+
+        shadow_tri(&out, &xf0[e->v[0]], &xf0[e->v[1]], &xf1[e->v[1]]);
+        shadow_tri(&out, &xf0[e->v[0]], &xf1[e->v[1]], &xf1[e->v[0]]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,232 @@
+/* KallistiOS ##version##
+
+   pvr_sort.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Sorted translucent lists, and opaque lists batched by header. Polygons are
+   kept in an arena, sorted with a two pass LSD radix sort on their 16-bit
+   key, and written out in order into one buffer that goes to the TA like a
+   display list. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <dc/pvr.h>
+#include <kos/arena.h>
+#include <kos/regfield.h>
+
+#include "pvr_internal.h"
+
+typedef struct pvr_sort_item {
+    const pvr_poly_hdr_t *hdr;
+    const void *verts;
+    uint32_t size;
+    uint16_t key;
+} pvr_sort_item_t;
+
+static inline uint16_t pvr_sort_key(float z) {
+    union {
+        float f;
+        uint32_t i;
+    } v = { .f = z };
+
+    /* Negative depths are behind the camera anyway. */
+    return (v.i & 0x80000000) ? 0 : v.i >> 16;
+}
+
+/* Polygons of the opaque and punch-through lists can be drawn in any order,
+   so they are grouped by header instead: the key is a hash of the header, and
+   the sort being stable, the polygons of each header stay in the order they
+   were added. Two headers with the same hash may still end up interleaved,
+   which only costs the headers it takes to switch between them. */
+static uint16_t pvr_sort_hdr_key(const pvr_poly_hdr_t *hdr) {
+    const uint32_t *w = (const uint32_t *)hdr;
+    uint32_t h = 0x811c9dc5;
+    size_t i;
+
+    for(i = 0; i < sizeof(pvr_poly_hdr_t) / 4; i++)
+        h = (h ^ w[i]) * 0x01000193;
+
+    return (uint16_t)(h ^ (h >> 16));
+}
+
+static int pvr_sort_init(pvr_sort_t *q, pvr_list_t list, arena_t *arena,
+                         size_t max) {
+    if(!arena)
+        arena = pvr_state.frame_arena;
+
+    if(!arena || !max) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!(q->items = arena_alloc(arena, max * sizeof(pvr_sort_item_t))))
+        return -1;
+
+    q->arena = arena;
+    q->list = list;
+    q->count = 0;
+    q->max = max;
+    q->size = 0;
+
+    return 0;
+}
+
+int pvr_sort_begin(pvr_sort_t *q, arena_t *arena, size_t max) {
+    return pvr_sort_init(q, PVR_LIST_TR_POLY, arena, max);
+}
+
+int pvr_sort_begin_batched(pvr_sort_t *q, pvr_list_t list, arena_t *arena,
+                           size_t max) {
+    if(list != PVR_LIST_OP_POLY && list != PVR_LIST_PT_POLY) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return pvr_sort_init(q, list, arena, max);
+}
+
+int pvr_sort_add(pvr_sort_t *q, const pvr_poly_hdr_t *hdr, const void *verts,
+                 size_t size, float z) {
+    pvr_sort_item_t *it;
+    void *p;
+
+    if(!size || (size & 31)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(q->count == q->max) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    it = q->items + q->count;
+
+    /* Polygons of the same material usually come in together, so only keep
+       one copy of their header. */
+    if(q->count && !memcmp(it[-1].hdr, hdr, sizeof(pvr_poly_hdr_t))) {
+        it->hdr = it[-1].hdr;
+        it->key = it[-1].key;
+    }
+    else {
+        if(!(p = arena_alloc(q->arena, sizeof(pvr_poly_hdr_t))))
+            return -1;
+
+        memcpy(p, hdr, sizeof(pvr_poly_hdr_t));
+        it->hdr = p;
+
+        if(q->list != PVR_LIST_TR_POLY)
+            it->key = pvr_sort_hdr_key(hdr);
+    }
+
+    if(!(p = arena_alloc(q->arena, size)))
+        return -1;
+
+    memcpy(p, verts, size);
+    it->verts = p;
+    it->size = size;
+
+    if(q->list == PVR_LIST_TR_POLY)
+        it->key = pvr_sort_key(z);
+
+    q->count++;
+    q->size += size;
+
+    return 0;
+}
+
+/* Whether the TA has the header cached for a list, as it's open. */
+static bool pvr_sort_hdr_cached(pvr_list_t list) {
+    return pvr_state.hdr_cache && !pvr_state.dr_used &&
+           pvr_state.list_reg_open == (int)list &&
+           (pvr_state.hdr_valid & BIT(list));
+}
+
+/* One counting pass of the radix sort, on the byte at shift. */
+static void pvr_sort_pass(const pvr_sort_item_t *src, pvr_sort_item_t *dst,
+                          size_t count, int shift) {
+    size_t hist[256] = { 0 };
+    size_t i, sum = 0, n;
+
+    for(i = 0; i < count; i++)
+        hist[(src[i].key >> shift) & 0xff]++;
+
+    for(i = 0; i < 256; i++) {
+        n = hist[i];
+        hist[i] = sum;
+        sum += n;
+    }
+
+    for(i = 0; i < count; i++)
+        dst[hist[(src[i].key >> shift) & 0xff]++] = src[i];
+}
+
+int pvr_sort_finish(pvr_sort_t *q) {
+    pvr_sort_item_t *tmp;
+    const pvr_poly_hdr_t *last = NULL;
+    pvr_dlist_t dl;
+    uint8_t *out, *p;
+    size_t i, size;
+    uint32_t type;
+    int rv;
+
+    if(!q->count)
+        return 0;
+
+    /* Worst case, every polygon needs its header. */
+    size = q->size + q->count * sizeof(pvr_poly_hdr_t);
+
+    if(!(tmp = arena_alloc(q->arena, q->count * sizeof(pvr_sort_item_t))) ||
+       !(out = arena_alloc(q->arena, size)))
+        return -1;
+
+    /* Stable, so polygons at the same depth stay in submission order. */
+    pvr_sort_pass(q->items, tmp, q->count, 0);
+    pvr_sort_pass(tmp, q->items, q->count, 8);
+
+    /* Polygons already sent to the open list leave their header with the TA,
+       so the header cache may spare the first one of the queue. */
+    if(pvr_sort_hdr_cached(q->list))
+        last = (const pvr_poly_hdr_t *)pvr_state.hdr_last[q->list];
+
+    /* Smallest 1/w first: that's back to front. Batched lists come out
+       grouped by header. */
+    for(i = 0, p = out; i < q->count; i++) {
+        if(q->items[i].hdr != last &&
+           (!last || memcmp(q->items[i].hdr, last, sizeof(pvr_poly_hdr_t)))) {
+            memcpy(p, q->items[i].hdr, sizeof(pvr_poly_hdr_t));
+            p += sizeof(pvr_poly_hdr_t);
+        }
+        else if(!i) {
+            pvr_state.hdr_skipped++;
+        }
+
+        last = q->items[i].hdr;
+        memcpy(p, q->items[i].verts, q->items[i].size);
+        p += q->items[i].size;
+    }
+
+    q->count = 0;
+    q->size = 0;
+
+    if(pvr_dlist_init(&dl, q->list, out, p - out) < 0)
+        return -1;
+
+    dl.used = p - out;
+    rv = pvr_dlist_replay(&dl);
+
+    /* And whatever polygons come next can be spared the last one. */
+    type = *(const uint32_t *)last >> 29;
+
+    if(!rv && pvr_state.hdr_cache && !pvr_state.dr_used &&
+       type >= 4 && type <= 5) {
+        memcpy((void *)pvr_state.hdr_last[q->list], last,
+               sizeof(pvr_poly_hdr_t));
+        pvr_state.hdr_valid |= BIT(q->list);
+    }
+
+    return rv;
+}
@@ -7,6 +7,10 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <malloc.h>
+#include <stdlib.h>
 #include <dc/pvr.h>
 #include <dc/sq.h>
 #include <kos/dbglog.h>
@@ -51,20 +55,128 @@ void pvr_txr_load(const void *src, pvr_ptr_t dst, size_t count) {
 /* Linear/iterative twiddling algorithm from Marcus' tatest */
 #define TWIDTAB(x) ( (x&1)|((x&2)<<1)|((x&4)<<2)|((x&8)<<3)|((x&16)<<4)| \
                      ((x&32)<<5)|((x&64)<<6)|((x&128)<<7)|((x&256)<<8)|((x&512)<<9) )
-#define TWIDOUT(x, y) ( TWIDTAB((y)) | (TWIDTAB((x)) << 1) )
 
 #define MIN(a, b) ( (a)<(b)? (a):(b) )
 
+/* The same thing as a lookup table, for the coordinates of 32-byte blocks
+   (which are at least 4 pixels wide, so there are at most 256 of them in
+   each direction). */
+#define TWID1(n)    TWIDTAB((n))
+#define TWID4(n)    TWID1(n), TWID1(n + 1), TWID1(n + 2), TWID1(n + 3)
+#define TWID16(n)   TWID4(n), TWID4(n + 4), TWID4(n + 8), TWID4(n + 12)
+#define TWID64(n)   TWID16(n), TWID16(n + 16), TWID16(n + 32), TWID16(n + 48)
+
+static const uint16_t twid_tab[256] = {
+    TWID64(0), TWID64(64), TWID64(128), TWID64(192)
+};
+
+/* Order of the 2x2 pixel groups of a 4x4 square in twiddled order, as
+   (x | y << 2). */
+static const uint8_t twid_quads[16] = {
+    0x0, 0x4, 0x1, 0x5, 0x8, 0xc, 0x9, 0xd,
+    0x2, 0x6, 0x3, 0x7, 0xa, 0xe, 0xb, 0xf
+};
+
+/* Which 32-byte block the block of pixels at (x, y) goes to. Twiddled
+   textures that aren't square are made of squares of min x min pixels, one
+   after the other; within those, blocks are bw x bh pixels. */
+static inline uint32_t twid_block(uint32_t x, uint32_t y, uint32_t min,
+                                  uint32_t bw, uint32_t bh, uint32_t sqblocks) {
+    uint32_t mask = min - 1;
+    uint32_t bx = twid_tab[(x & mask) / bw], by = twid_tab[(y & mask) / bh];
+
+    /* 4x8 blocks (8bpp) start with an X bit, the square ones with a Y bit. */
+    if(bw != bh)
+        return (x / min + y / min) * sqblocks + (bx | (by << 1));
+    else
+        return (x / min + y / min) * sqblocks + (by | (bx << 1));
+}
+
+/* 16bpp: 4x4 pixel blocks */
+static void twid_16bpp(const uint16_t *src, uint32_t *out, uint32_t w,
+                       uint32_t h, uint32_t min, bool invert) {
+    const uint16_t *r[4];
+    uint32_t x, y, i, *d, sqblocks = min * min / 16;
+
+    for(y = 0; y < h; y += 4) {
+        for(i = 0; i < 4; i++)
+            r[i] = src + (invert ? h - 1 - (y + i) : y + i) * w;
+
+        for(x = 0; x < w; x += 4, r[0] += 4, r[1] += 4, r[2] += 4, r[3] += 4) {
+            d = out + twid_block(x, y, min, 4, 4, sqblocks) * 8;
+            d[0] = r[0][0] | ((uint32_t)r[1][0] << 16);
+            d[1] = r[0][1] | ((uint32_t)r[1][1] << 16);
+            d[2] = r[2][0] | ((uint32_t)r[3][0] << 16);
+            d[3] = r[2][1] | ((uint32_t)r[3][1] << 16);
+            d[4] = r[0][2] | ((uint32_t)r[1][2] << 16);
+            d[5] = r[0][3] | ((uint32_t)r[1][3] << 16);
+            d[6] = r[2][2] | ((uint32_t)r[3][2] << 16);
+            d[7] = r[2][3] | ((uint32_t)r[3][3] << 16);
+        }
+    }
+}
+
+/* Two columns of a pair of 8bpp rows, in twiddled order */
+#define TWID_PAIR8(a, b, x) \
+    ((a)[x] | ((b)[x] << 8) | ((a)[(x) + 1] << 16) | ((uint32_t)(b)[(x) + 1] << 24))
+
+/* 8bpp: 4x8 pixel blocks */
+static void twid_8bpp(const uint8_t *src, uint32_t *out, uint32_t w,
+                      uint32_t h, uint32_t min, bool invert) {
+    const uint8_t *r[8];
+    uint32_t x, y, i, *d, sqblocks = min * min / 32;
+
+    for(y = 0; y < h; y += 8) {
+        for(i = 0; i < 8; i++)
+            r[i] = src + (invert ? h - 1 - (y + i) : y + i) * w;
+
+        for(x = 0; x < w; x += 4) {
+            d = out + twid_block(x, y, min, 4, 8, sqblocks) * 8;
+            d[0] = TWID_PAIR8(r[0], r[1], x);
+            d[1] = TWID_PAIR8(r[2], r[3], x);
+            d[2] = TWID_PAIR8(r[0], r[1], x + 2);
+            d[3] = TWID_PAIR8(r[2], r[3], x + 2);
+            d[4] = TWID_PAIR8(r[4], r[5], x);
+            d[5] = TWID_PAIR8(r[6], r[7], x);
+            d[6] = TWID_PAIR8(r[4], r[5], x + 2);
+            d[7] = TWID_PAIR8(r[6], r[7], x + 2);
+        }
+    }
+}
+
+/* 4bpp: 8x8 pixel blocks, made of 16 groups of 2x2 pixels */
+static void twid_4bpp(const uint8_t *src, uint32_t *out, uint32_t w,
+                      uint32_t h, uint32_t min, bool invert) {
+    const uint8_t *r[8];
+    uint16_t *d;
+    uint32_t x, y, i, q, a, b, sqblocks = min * min / 64;
+
+    for(y = 0; y < h; y += 8) {
+        for(i = 0; i < 8; i++)
+            r[i] = src + (invert ? h - 1 - (y + i) : y + i) * w / 2;
+
+        for(x = 0; x < w; x += 8) {
+            d = (uint16_t *)(out + twid_block(x, y, min, 8, 8, sqblocks) * 8);
+
+            for(i = 0; i < 16; i++) {
+                q = twid_quads[i];
+                a = r[(q >> 2) * 2][x / 2 + (q & 3)];
+                b = r[(q >> 2) * 2 + 1][x / 2 + (q & 3)];
+                d[i] = (a & 15) | ((b & 15) << 4) | ((a >> 4) << 8) |
+                       ((b >> 4) << 12);
+            }
+        }
+    }
+}
+
 /*
-   Load texture data from an SH-4 buffer into PVR RAM, twiddling it
-   in the process.
+   Twiddle texture data from an SH-4 buffer, the output being written 32
+   bytes at a time.
 
-   This is a modified version of Vincent Penne's general twiddling
-   function. The texture can be 16bpp, 8bpp, or 4bpp (i.e., paletted).
-   The rectangle does not need to be a square (not tested with h>w, but
-   this is just a matter of a rotation by PI/2 and UV swapping).
+   The texture can be 16bpp, 8bpp, or 4bpp (i.e., paletted). The rectangle
+   does not need to be a square.
 
-   - w and h must be a power of 2
+   - w and h must be a power of 2, 8 or more
    - flags must be a logical OR of the various texture loading
      flags available:
        PVR_TXRLOAD_4BPP, _8BPP, _16BPP, _32BPP (not supported yet)
@@ -72,94 +184,61 @@ void pvr_txr_load(const void *src, pvr_ptr_t dst, size_t count) {
        PVR_TXRLOAD_INVERT
 
 */
-void pvr_txr_load_ex(const void *src, pvr_ptr_t dst, uint32_t w, uint32_t h,
-                     uint32_t flags) {
-    uint32_t x, y, yout, min, mask, bpp, invert;
+size_t pvr_txr_twiddle(const void *src, void *dst, uint32_t w, uint32_t h,
+                       uint32_t flags) {
+    uint32_t min;
+    bool invert;
+
+    assert_msg(!(flags & PVR_TXRLOAD_VQ_LOAD), "VQ compression on the fly not supported yet");
+    invert = !!(flags & PVR_TXRLOAD_INVERT_Y);
+
+    min = MIN(w, h);
 
     /* Make sure we're attempting something we can do */
     switch(flags & PVR_TXRLOAD_FMT_MASK) {
         case PVR_TXRLOAD_4BPP:
-            bpp = 4;
-            break;
+            twid_4bpp((const uint8_t *)src, (uint32_t *)dst, w, h, min, invert);
+            return w * h / 2;
         case PVR_TXRLOAD_8BPP:
-            bpp = 8;
-            break;
+            twid_8bpp((const uint8_t *)src, (uint32_t *)dst, w, h, min, invert);
+            return w * h;
         case PVR_TXRLOAD_16BPP:
-            bpp = 16;
-            break;
+            twid_16bpp((const uint16_t *)src, (uint32_t *)dst, w, h, min, invert);
+            return w * h * 2;
         default:
             assert_msg(0, "Invalid format specifier in `flags'");
-            bpp = 8;
+            return 0;
     }
+}
 
-    assert_msg(!(flags & PVR_TXRLOAD_VQ_LOAD), "VQ compression on the fly not supported yet");
-    invert = (flags & PVR_TXRLOAD_INVERT_Y) ? 1 : 0;
+/*
+   Load texture data from an SH-4 buffer into PVR RAM, twiddling it
+   in the process.
+*/
+void pvr_txr_load_ex(const void *src, pvr_ptr_t dst, uint32_t w, uint32_t h,
+                     uint32_t flags) {
+    pvr_txr_twiddle(src, dst, w, h, flags);
+}
 
-    min = MIN(w, h);
-    mask = min - 1;
-
-    switch(bpp) {
-        case 4: {
-            uint8_t * pixels;
-            uint16_t * vtex;
-            pixels = (uint8_t *) src;
-            vtex = (uint16_t *)dst;
-
-            for(y = 0; y < h; y += 2) {
-                if(!invert)
-                    yout = y;
-                else
-                    yout = ((h - 1) - y);
-
-                for(x = 0; x < w; x += 2) {
-                    vtex[TWIDOUT((x & mask) / 2, (yout & mask) / 2) +
-                         (x / min + yout / min)*min * min / 4] =
-                             (pixels[(x + y * w) >> 1] & 15) | ((pixels[(x + (y + 1) * w) >> 1] & 15) << 4) |
-                             ((pixels[(x + y * w) >> 1] >> 4) << 8) | ((pixels[(x + (y + 1) * w) >> 1] >> 4) << 12);
-                }
-            }
-        }
-        break;
-        case 8: {
-            uint8_t * pixels;
-            uint16_t * vtex;
-            pixels = (uint8_t *) src;
-            vtex = (uint16_t *)dst;
-
-            for(y = 0; y < h; y += 2) {
-                if(!invert)
-                    yout = y;
-                else
-                    yout = ((h - 1) - y);
-
-                for(x = 0; x < w; x++) {
-                    vtex[TWIDOUT((yout & mask) / 2, x & mask) +
-                         (x / min + yout / min)*min * min / 2] =
-                             pixels[y * w + x] | (pixels[(y + 1) * w + x] << 8);
-                }
-            }
-        }
-        break;
-        case 16: {
-            uint16_t * pixels;
-            uint16_t * vtex;
-            pixels = (uint16_t *) src;
-            vtex = (uint16_t *)dst;
-
-            for(y = 0; y < h; y++) {
-                if(!invert)
-                    yout = y;
-                else
-                    yout = ((h - 1) - y);
-
-                for(x = 0; x < w; x++) {
-                    vtex[TWIDOUT(x & mask, yout & mask) +
-                         (x / min + yout / min)*min * min] = pixels[y * w + x];
-                }
-            }
-        }
-        break;
+/* Twiddle into a staging buffer, and DMA that to PVR RAM */
+int pvr_txr_load_ex_dma(const void *src, pvr_ptr_t dst, uint32_t w,
+                        uint32_t h, uint32_t flags, void *staging,
+                        pvr_dma_callback_t callback, void *cbdata) {
+    size_t count;
+    int rv;
+
+    if(!__is_aligned(staging, 32)) {
+        errno = EFAULT;
+        return -1;
     }
+
+    count = pvr_txr_twiddle(src, staging, w, h, flags);
+
+    sem_wait((semaphore_t *)&pvr_state.dma_lock);
+    rv = pvr_txr_load_dma(staging, dst, count, false, callback, cbdata);
+    sem_signal((semaphore_t *)&pvr_state.dma_lock);
+
+    return rv;
 }
 
 /* Load a KOS Platform Independent Image (subject to restraint checking) */
@@ -226,3 +305,157 @@ void pvr_txr_load_kimg(const kos_img_t *img, pvr_ptr_t dst, uint32_t flags) {
         pvr_txr_load_ex(img->data, dst, w, h, flags);
     }
 }
+
+/* Rows decoded before they're twiddled, that being the height of the
+   smallest square that is contiguous in PVR RAM for every format. */
+#define STREAM_ROWS 8
+
+static inline bool txr_size_ok(uint32_t n) {
+    return n >= 8 && n <= 1024 && !(n & (n - 1));
+}
+
+/* Where pixel (x, y) of a twiddled texture is, in pixels from its start */
+static inline uint32_t twid_pixel(uint32_t x, uint32_t y, uint32_t min) {
+    uint32_t mx = x & (min - 1), my = y & (min - 1);
+
+    return (x / min + y / min) * min * min + (TWIDTAB(my) | (TWIDTAB(mx) << 1));
+}
+
+/* Convert a row of 24 or 32-bit pixels to a 16-bit texture format */
+static void stream_conv_row(const uint8_t *src, uint16_t *dst, uint32_t w,
+                            uint32_t src_fmt, uint32_t txr_fmt) {
+    uint32_t x, a, r, g, b, px;
+
+    for(x = 0; x < w; x++) {
+        if(src_fmt == KOS_IMG_FMT_ARGB8888) {
+            px = ((const uint32_t *)src)[x];
+            a = px >> 24;
+            r = (px >> 16) & 0xff;
+            g = (px >> 8) & 0xff;
+            b = px & 0xff;
+        }
+        else if(src_fmt == KOS_IMG_FMT_RGBA8888) {
+            r = src[x * 4];
+            g = src[x * 4 + 1];
+            b = src[x * 4 + 2];
+            a = src[x * 4 + 3];
+        }
+        else {
+            r = src[x * 3];
+            g = src[x * 3 + 1];
+            b = src[x * 3 + 2];
+            a = 0xff;
+        }
+
+        if(txr_fmt == PVR_TXRFMT_RGB565)
+            dst[x] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+        else if(txr_fmt == PVR_TXRFMT_ARGB4444)
+            dst[x] = ((a >> 4) << 12) | ((r >> 4) << 8) | ((g >> 4) << 4) |
+                     (b >> 4);
+        else
+            dst[x] = ((a >> 7) << 15) | ((r >> 3) << 10) | ((g >> 3) << 5) |
+                     (b >> 3);
+    }
+}
+
+/* Load a texture a few rows at a time, as they come out of a decoder */
+int pvr_txr_load_stream(pvr_ptr_t dst, uint32_t w, uint32_t h,
+                        uint32_t src_fmt, uint32_t txr_fmt, uint32_t flags,
+                        pvr_txr_row_t read_row, void *data) {
+    uint32_t bits, pitch, tile, min, raw = 0, x, y, yd, i;
+    uint8_t *buf, *strip, *twid, *row;
+    bool invert;
+    int rv = 0;
+
+    if(!read_row || !__is_aligned(dst, 32) || !txr_size_ok(w) ||
+       !txr_size_ok(h)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    src_fmt = KOS_IMG_FMT_I(src_fmt) & KOS_IMG_FMT_MASK;
+    txr_fmt &= PVR_TXRFMT_PAL8BPP | PVR_TXRFMT_ARGB4444 | PVR_TXRFMT_RGB565;
+
+    switch(src_fmt) {
+        case KOS_IMG_FMT_RGB565:
+        case KOS_IMG_FMT_ARGB4444:
+        case KOS_IMG_FMT_ARGB1555:
+            bits = 16;
+            break;
+        case KOS_IMG_FMT_PAL8BPP:
+            bits = 8;
+            break;
+        case KOS_IMG_FMT_PAL4BPP:
+            bits = 4;
+            break;
+        case KOS_IMG_FMT_RGB888:
+        case KOS_IMG_FMT_ARGB8888:
+        case KOS_IMG_FMT_RGBA8888:
+            if(txr_fmt != PVR_TXRFMT_RGB565 && txr_fmt != PVR_TXRFMT_ARGB1555 &&
+               txr_fmt != PVR_TXRFMT_ARGB4444) {
+                errno = EINVAL;
+                return -1;
+            }
+
+            raw = src_fmt == KOS_IMG_FMT_RGB888 ? 3 : 4;
+            bits = 16;
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    /* The decoded rows, the same rows twiddled, and one row before
+       conversion if there's any to do. */
+    pitch = w * bits / 8;
+    buf = memalign(32, pitch * STREAM_ROWS * 2 + w * raw);
+
+    if(!buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    strip = buf;
+    twid = buf + pitch * STREAM_ROWS;
+    row = twid + pitch * STREAM_ROWS;
+
+    invert = !!(flags & PVR_TXRLOAD_INVERT_Y);
+    tile = STREAM_ROWS * STREAM_ROWS * bits / 8;
+    min = MIN(w, h);
+
+    for(y = 0; y < h; y += STREAM_ROWS) {
+        for(i = 0; i < STREAM_ROWS; i++) {
+            if(read_row(raw ? row : strip + i * pitch, y + i, data) < 0) {
+                rv = -1;
+                goto out;
+            }
+
+            if(raw)
+                stream_conv_row(row, (uint16_t *)(strip + i * pitch), w,
+                                src_fmt, txr_fmt);
+        }
+
+        /* Twiddled as a row of 8x8 textures, each of those is a square of
+           the real one, which is contiguous in PVR RAM. */
+        if(bits == 16)
+            twid_16bpp((const uint16_t *)strip, (uint32_t *)twid, w,
+                       STREAM_ROWS, STREAM_ROWS, invert);
+        else if(bits == 8)
+            twid_8bpp(strip, (uint32_t *)twid, w, STREAM_ROWS, STREAM_ROWS,
+                      invert);
+        else
+            twid_4bpp(strip, (uint32_t *)twid, w, STREAM_ROWS, STREAM_ROWS,
+                      invert);
+
+        yd = invert ? h - y - STREAM_ROWS : y;
+
+        for(x = 0; x < w; x += STREAM_ROWS)
+            pvr_txr_load(twid + x / STREAM_ROWS * tile,
+                         (uint8_t *)dst + twid_pixel(x, yd, min) * bits / 8,
+                         tile);
+    }
+
+out:
+    free(buf);
+    return rv;
+}
@@ -0,0 +1,291 @@
+/* KallistiOS ##version##
+
+   pvr_transform.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Near plane clipper and transform + submit pipeline for Direct Rendering.
+   Each triangle of a strip is checked against the near plane, and as long as
+   triangles are entirely in front of it, vertices go straight out to the
+   Store Queues. The last vertex sent is always held back by one, so that it
+   can still be flagged as the end of a strip when a triangle has to be
+   clipped. The transform pipeline runs vertices through XMTRX one at a time,
+   keeping a window of the last three for the clipper. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <dc/fmath.h>
+#include <dc/matrix.h>
+#include <dc/pvr.h>
+
+typedef pvr_clip_vertex_t xf_vtx_t;
+
+/* Source vertex layout, with -1 for missing attributes */
+typedef struct {
+    size_t stride;
+    int pos, uv, argb, oargb;
+    uint32_t argb_def, oargb_def;
+} xf_fmt_t;
+
+/* Output strip, with the vertex held back */
+typedef struct {
+    pvr_dr_state_t *dr;
+    xf_vtx_t held;
+    bool have_held;
+    bool in_strip;
+    bool textured;
+    float near_w;
+} xf_out_t;
+
+static int xf_compile(xf_fmt_t *f, const pvr_vtx_fmt_t *fmt) {
+    size_t i;
+
+    f->stride = fmt->stride;
+    f->pos = f->uv = f->argb = f->oargb = -1;
+    f->argb_def = fmt->argb;
+    f->oargb_def = fmt->oargb;
+
+    for(i = 0; i < fmt->attr_count; i++) {
+        switch(fmt->attrs[i].type) {
+            case PVR_VTX_ATTR_POS:
+                f->pos = fmt->attrs[i].offset;
+                break;
+            case PVR_VTX_ATTR_UV:
+                f->uv = fmt->attrs[i].offset;
+                break;
+            case PVR_VTX_ATTR_ARGB:
+                f->argb = fmt->attrs[i].offset;
+                break;
+            case PVR_VTX_ATTR_OARGB:
+                f->oargb = fmt->attrs[i].offset;
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    return f->pos < 0 ? -1 : 0;
+}
+
+static inline void xf_load(const xf_fmt_t *f, const uint8_t *p, xf_vtx_t *v) {
+    const float *pos = (const float *)(p + f->pos);
+    const float *uv;
+    float x = pos[0], y = pos[1], z = pos[2], w = 1.0f;
+
+    mat_trans_nodiv(x, y, z, w);
+    v->x = x;
+    v->y = y;
+    v->z = z;
+    v->w = w;
+
+    if(f->uv >= 0) {
+        uv = (const float *)(p + f->uv);
+        v->u = uv[0];
+        v->v = uv[1];
+    }
+    else {
+        v->u = v->v = 0.0f;
+    }
+
+    v->argb = f->argb >= 0 ? *(const uint32_t *)(p + f->argb) : f->argb_def;
+    v->oargb = f->oargb >= 0 ? *(const uint32_t *)(p + f->oargb) : f->oargb_def;
+}
+
+/* Divide by W and write one vertex to the next Store Queue. */
+static inline void xf_send(pvr_dr_state_t *dr, const xf_vtx_t *v,
+                           uint32_t flags) {
+    pvr_vertex_t *d = pvr_dr_target(*dr);
+    float inv = __frsqrt(v->w * v->w);
+
+    d->flags = flags;
+    d->x = v->x * inv;
+    d->y = v->y * inv;
+    d->z = inv;
+    d->u = v->u;
+    d->v = v->v;
+    d->argb = v->argb;
+    d->oargb = v->oargb;
+    pvr_dr_commit(d);
+}
+
+static inline void xf_emit(xf_out_t *o, const xf_vtx_t *v) {
+    if(o->have_held)
+        xf_send(o->dr, &o->held, PVR_CMD_VERTEX);
+
+    o->held = *v;
+    o->have_held = true;
+}
+
+static inline void xf_end(xf_out_t *o) {
+    if(o->have_held) {
+        xf_send(o->dr, &o->held, PVR_CMD_VERTEX_EOL);
+        o->have_held = false;
+    }
+}
+
+static uint32_t xf_lerp_argb(uint32_t a, uint32_t b, float t) {
+    uint32_t rv = 0;
+    int i, ca, cb;
+
+    for(i = 0; i < 32; i += 8) {
+        ca = (a >> i) & 0xff;
+        cb = (b >> i) & 0xff;
+        rv |= ((uint32_t)(ca + (cb - ca) * t) & 0xff) << i;
+    }
+
+    return rv;
+}
+
+/* Find where the edge from a to b crosses the near plane. */
+static void xf_lerp(xf_vtx_t *d, const xf_vtx_t *a, const xf_vtx_t *b,
+                    float near_w, bool textured) {
+    float t = (near_w - a->w) / (b->w - a->w);
+
+    d->x = a->x + (b->x - a->x) * t;
+    d->y = a->y + (b->y - a->y) * t;
+    d->z = a->z + (b->z - a->z) * t;
+    d->w = near_w;
+
+    if(textured) {
+        d->u = a->u + (b->u - a->u) * t;
+        d->v = a->v + (b->v - a->v) * t;
+    }
+    else {
+        d->u = d->v = 0.0f;
+    }
+
+    d->argb = xf_lerp_argb(a->argb, b->argb, t);
+    d->oargb = xf_lerp_argb(a->oargb, b->oargb, t);
+}
+
+/* Clip a triangle against the near plane, and send what's left of it (a
+   triangle or a quad) as a strip of its own. */
+static void xf_clip(xf_out_t *o, const xf_vtx_t *tri[3]) {
+    xf_vtx_t poly[4];
+    const xf_vtx_t *a, *b;
+    int i, n = 0;
+
+    for(i = 0; i < 3; i++) {
+        a = tri[i];
+        b = tri[i == 2 ? 0 : i + 1];
+
+        if(a->w >= o->near_w)
+            poly[n++] = *a;
+
+        if((a->w >= o->near_w) != (b->w >= o->near_w))
+            xf_lerp(&poly[n++], a, b, o->near_w, o->textured);
+    }
+
+    if(n < 3)
+        return;
+
+    xf_emit(o, &poly[0]);
+    xf_emit(o, &poly[1]);
+
+    if(n == 4)
+        xf_emit(o, &poly[3]);
+
+    xf_emit(o, &poly[2]);
+    xf_end(o);
+}
+
+/* Send triangle k of a strip, made of a, b and c. */
+static inline void xf_tri(xf_out_t *o, const xf_vtx_t *a, const xf_vtx_t *b,
+                          const xf_vtx_t *c, size_t k) {
+    const xf_vtx_t *tri[3];
+
+    if(a->w >= o->near_w && b->w >= o->near_w && c->w >= o->near_w) {
+        if(!o->in_strip) {
+            /* Odd triangles of a strip are wound the other way; start with a
+               degenerate triangle to keep them that way. */
+            if(k & 1)
+                xf_emit(o, a);
+
+            xf_emit(o, a);
+            xf_emit(o, b);
+            o->in_strip = true;
+        }
+
+        xf_emit(o, c);
+    }
+    else {
+        xf_end(o);
+        o->in_strip = false;
+
+        /* Put odd triangles back in the winding of even ones, since they go
+           out as strips of their own. */
+        tri[0] = (k & 1) ? b : a;
+        tri[1] = (k & 1) ? a : b;
+        tri[2] = c;
+        xf_clip(o, tri);
+    }
+}
+
+void pvr_dr_clip_strip(pvr_dr_state_t *vtx_buf_ptr,
+                       const pvr_clip_vertex_t *vtx, size_t count,
+                       float near_w, bool textured) {
+    xf_out_t out = {
+        .dr = vtx_buf_ptr,
+        .textured = textured,
+        .near_w = near_w
+    };
+    size_t k;
+
+    for(k = 0; k + 2 < count; k++) {
+        if(k + 3 < count)
+            dcache_pref_block(vtx + k + 3);
+
+        xf_tri(&out, vtx + k, vtx + k + 1, vtx + k + 2, k);
+    }
+
+    xf_end(&out);
+}
+
+int pvr_dr_transform_strip(pvr_dr_state_t *vtx_buf_ptr,
+                           const pvr_vtx_fmt_t *fmt, const void *src,
+                           size_t count) {
+    xf_fmt_t f;
+    xf_vtx_t win[3];
+    xf_out_t out = {
+        .dr = vtx_buf_ptr,
+        .near_w = fmt->near_w
+    };
+    const uint8_t *p = (const uint8_t *)src;
+    int i0 = 0, i1 = 1, i2 = 2, t;
+    size_t k;
+
+    if(xf_compile(&f, fmt) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(count < 3)
+        return 0;
+
+    out.textured = f.uv >= 0;
+
+    xf_load(&f, p, &win[0]);
+    p += f.stride;
+    xf_load(&f, p, &win[1]);
+    p += f.stride;
+
+    for(k = 0; k + 2 < count; k++) {
+        if(k + 3 < count)
+            dcache_pref_block(p + f.stride);
+
+        xf_load(&f, p, &win[i2]);
+        p += f.stride;
+
+        xf_tri(&out, &win[i0], &win[i1], &win[i2], k);
+
+        t = i0;
+        i0 = i1;
+        i1 = i2;
+        i2 = t;
+    }
+
+    xf_end(&out);
+
+    return 0;
+}
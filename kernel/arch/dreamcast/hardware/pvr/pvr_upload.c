@@ -0,0 +1,299 @@
+/* KallistiOS ##version##
+
+   pvr_upload.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Texture upload queue. Uploads are sent to PVR RAM with DMA, one piece at a
+   time, so that the vertex DMA of a scene never has to wait long for the DMA
+   channel. The queue grabs the channel (the DMA lock) whenever nobody else
+   holds it, and lets it go after each piece, which is enough for a thread
+   waiting on the lock to get it next. Uploads due for the scene being
+   submitted also get sent in between the lists of its vertex DMA, and the
+   renderer is held back until they are done.
+
+   Most of this runs in interrupts, so the queue is protected by disabling
+   interrupts. */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/queue.h>
+
+#include <arch/irq.h>
+#include <dc/pvr.h>
+#include <kos/genwait.h>
+#include <kos/sem.h>
+#include <kos/timer.h>
+
+#include "pvr_internal.h"
+
+/* Size of the pieces uploads are sent in */
+#define UPLOAD_CHUNK    16384
+
+typedef struct upload {
+    TAILQ_ENTRY(upload) queue;
+    const uint8_t *src;
+    uintptr_t dst;
+    size_t left;
+    pvr_upload_t id;                    /* Zero when not queued */
+    pvr_fence_t deadline;
+    int prio;
+} upload_t;
+
+static upload_t jobs[PVR_UPLOAD_MAX];
+static TAILQ_HEAD(upload_queue, upload) queue, free_jobs;
+static uint32_t upload_gen;
+
+/* The upload a piece is in flight for, and what to do once it's done */
+static upload_t *running;
+static size_t running_len;
+static pvr_dma_callback_t running_next;
+static void *running_data;
+
+/* True if the queue holds the DMA lock */
+static bool lock_owned;
+
+/* An upload is due if the scene being submitted, or the one after it, needs
+   it. */
+static inline bool upload_due(const upload_t *u) {
+    return u->deadline && (int32_t)(u->deadline - pvr_state.scene_seq) <= 1;
+}
+
+static bool upload_before(const upload_t *a, const upload_t *b) {
+    bool da = upload_due(a), db = upload_due(b);
+
+    if(da != db)
+        return da;
+
+    if(da && a->deadline != b->deadline)
+        return (int32_t)(a->deadline - b->deadline) < 0;
+
+    return a->prio > b->prio;
+}
+
+/* Pick the next upload to send, oldest first among equals. */
+static upload_t *upload_pick(bool due_only) {
+    upload_t *u, *best = NULL;
+
+    TAILQ_FOREACH(u, &queue, queue) {
+        if((!due_only || upload_due(u)) && (!best || upload_before(u, best)))
+            best = u;
+    }
+
+    return best;
+}
+
+static void upload_done(void *data) {
+    upload_t *u = running;
+    pvr_dma_callback_t next = running_next;
+    bool kick = false;
+
+    (void)data;
+
+    /* Shut down while the piece was in flight. */
+    if(!u)
+        return;
+
+    running = NULL;
+    u->src += running_len;
+    u->dst += running_len;
+    u->left -= running_len;
+
+    if(!u->left) {
+        TAILQ_REMOVE(&queue, u, queue);
+        TAILQ_INSERT_TAIL(&free_jobs, u, queue);
+        u->id = 0;
+        kick = u->deadline != 0;
+        genwait_wake_all(jobs);
+    }
+
+    next(running_data);
+
+    /* A scene may have been waiting for this one. */
+    if(kick)
+        pvr_render_lists();
+}
+
+/* Send the next piece of the most urgent upload, and call next once it's
+   done. Assumes interrupts are disabled, and the DMA channel is the caller's
+   to use. */
+static bool upload_start(bool due_only, pvr_dma_callback_t next, void *data) {
+    upload_t *u;
+    size_t len;
+
+    if(running || !pvr_dma_ready() || !(u = upload_pick(due_only)))
+        return false;
+
+    len = u->left < UPLOAD_CHUNK ? u->left : UPLOAD_CHUNK;
+
+    running = u;
+    running_len = len;
+    running_next = next;
+    running_data = data;
+
+    if(pvr_dma_transfer(u->src, u->dst, len, PVR_DMA_VRAM64, false,
+                        upload_done, NULL) < 0) {
+        running = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static void upload_chain(void *data) {
+    (void)data;
+
+    lock_owned = false;
+    sem_signal((semaphore_t *)&pvr_state.dma_lock);
+
+    /* If a thread was waiting for the lock, it got it and this won't. */
+    pvr_upload_kick();
+}
+
+void pvr_upload_kick(void) {
+    irq_disable_scoped();
+
+    if(lock_owned || TAILQ_EMPTY(&queue))
+        return;
+
+    if(sem_trywait((semaphore_t *)&pvr_state.dma_lock) < 0)
+        return;
+
+    lock_owned = true;
+
+    if(!upload_start(false, upload_chain, NULL)) {
+        lock_owned = false;
+        sem_signal((semaphore_t *)&pvr_state.dma_lock);
+    }
+}
+
+bool pvr_upload_interleave(pvr_dma_callback_t next, void *data) {
+    irq_disable_scoped();
+
+    return upload_start(true, next, data);
+}
+
+bool pvr_upload_blocks(pvr_fence_t seq) {
+    upload_t *u;
+
+    irq_disable_scoped();
+
+    TAILQ_FOREACH(u, &queue, queue) {
+        if(u->deadline && (int32_t)(u->deadline - seq) <= 0)
+            return true;
+    }
+
+    return false;
+}
+
+void pvr_upload_init(void) {
+    int i;
+
+    irq_disable_scoped();
+
+    TAILQ_INIT(&queue);
+    TAILQ_INIT(&free_jobs);
+
+    for(i = 0; i < PVR_UPLOAD_MAX; i++) {
+        jobs[i].id = 0;
+        TAILQ_INSERT_TAIL(&free_jobs, &jobs[i], queue);
+    }
+
+    running = NULL;
+    lock_owned = false;
+}
+
+void pvr_upload_shutdown(void) {
+    int i;
+
+    irq_disable_scoped();
+
+    /* Whatever didn't make it to PVR RAM is dropped. */
+    for(i = 0; i < PVR_UPLOAD_MAX; i++)
+        jobs[i].id = 0;
+
+    TAILQ_INIT(&queue);
+    TAILQ_INIT(&free_jobs);
+    running = NULL;
+    lock_owned = false;
+
+    genwait_wake_all(jobs);
+}
+
+pvr_upload_t pvr_txr_upload(const void *src, pvr_ptr_t dst, size_t count,
+                            int prio, pvr_fence_t deadline) {
+    upload_t *u;
+    pvr_upload_t id;
+
+    assert(pvr_state.valid);
+
+    if(((uintptr_t)src | (uintptr_t)dst) & 31) {
+        errno = EFAULT;
+        return 0;
+    }
+
+    if(!count || (count & 31)) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    irq_disable_scoped();
+
+    if(!(u = TAILQ_FIRST(&free_jobs))) {
+        errno = EAGAIN;
+        return 0;
+    }
+
+    TAILQ_REMOVE(&free_jobs, u, queue);
+
+    /* The slot is in the low bits of the handle, so that completion can be
+       checked without looking anything up. */
+    do {
+        id = ++upload_gen * PVR_UPLOAD_MAX + (pvr_upload_t)(u - jobs);
+    } while(!id);
+
+    u->src = (const uint8_t *)src;
+    u->dst = (uintptr_t)dst;
+    u->left = count;
+    u->id = id;
+    u->deadline = deadline;
+    u->prio = prio;
+    TAILQ_INSERT_TAIL(&queue, u, queue);
+
+    pvr_upload_kick();
+
+    return id;
+}
+
+int pvr_txr_upload_check(pvr_upload_t upload) {
+    if(upload && jobs[upload % PVR_UPLOAD_MAX].id == upload)
+        return -1;
+    else
+        return 0;
+}
+
+int pvr_txr_upload_wait(pvr_upload_t upload, int timeout) {
+    uint64_t end = 0, now;
+
+    if(timeout)
+        end = timer_ms_gettime64() + timeout;
+
+    irq_disable_scoped();
+
+    while(pvr_txr_upload_check(upload)) {
+        if(timeout) {
+            now = timer_ms_gettime64();
+
+            if(now >= end)
+                return -1;
+
+            timeout = (int)(end - now);
+        }
+
+        genwait_wait(jobs, "pvr_txr_upload_wait", timeout, NULL);
+    }
+
+    return 0;
+}
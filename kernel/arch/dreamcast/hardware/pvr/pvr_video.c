@@ -0,0 +1,296 @@
+/* KallistiOS ##version##
+
+   pvr_video.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* YUV420 video playback. Decoded frames go into a ring of frame buffers,
+   which are sent in order to the YUV converter with DMA, into whichever of
+   two textures isn't shown. A converted frame waits there for the vblank
+   where the one shown has been up for long enough, and the textures are
+   swapped. A texture is only converted into once the scenes that drew it
+   have been rendered.
+
+   The DMA completion is taken as the end of a conversion: the converter is
+   only a FIFO behind, and the texture isn't shown before the next vblank.
+
+   Most of this runs in interrupts, so players are protected by disabling
+   interrupts. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arch/irq.h>
+#include <dc/pvr.h>
+#include <dc/vblank.h>
+#include <kos/genwait.h>
+#include <kos/sem.h>
+#include <kos/timer.h>
+
+#include "pvr_internal.h"
+
+/* What the texture that isn't shown holds */
+#define BACK_EMPTY      0
+#define BACK_BUSY       1
+#define BACK_READY      2
+
+struct pvr_video {
+    size_t tw, th;                  /* Texture size */
+    size_t mb_cols, mb_rows;        /* Size in macroblocks */
+    size_t frame_size;
+
+    uint8_t *frames;                /* The ring of frame buffers */
+    unsigned int *holds;            /* Vblanks to show each frame for */
+    size_t count;
+    size_t get_idx;                 /* Next one for the decoder */
+    size_t conv_idx;                /* Next one to convert */
+    size_t queued;                  /* Pushed, and not converted yet */
+
+    pvr_ptr_t txr[2];
+    pvr_fence_t fence[2];           /* Last scene drawing each texture */
+    int front;                      /* Texture shown */
+    int back;                       /* BACK_* for the other one */
+    unsigned int back_hold;
+    unsigned int front_left;        /* Vblanks left to show the front one */
+    size_t shown;
+
+    int vbl_handle;
+};
+
+static inline uint8_t *vid_frame(const pvr_video_t *vid, size_t idx) {
+    return vid->frames + idx * vid->frame_size;
+}
+
+/* The fence the scene being submitted will get */
+static pvr_fence_t vid_scene_fence(void) {
+    pvr_fence_t seq = pvr_state.scene_seq;
+
+    if(!pvr_state.ta_checked_ready && !++seq)
+        seq++;
+
+    return seq;
+}
+
+static void vid_done(void *data) {
+    pvr_video_t *vid = (pvr_video_t *)data;
+
+    vid->back = BACK_READY;
+    vid->back_hold = vid->holds[vid->conv_idx];
+    vid->conv_idx = (vid->conv_idx + 1) % vid->count;
+    vid->queued--;
+
+    sem_signal((semaphore_t *)&pvr_state.dma_lock);
+    genwait_wake_all(vid);
+
+    /* If a thread was waiting for the lock, it got it and this won't. */
+    pvr_upload_kick();
+}
+
+/* Start converting the next frame, if it can be. Assumes interrupts are
+   disabled. */
+static void vid_kick(pvr_video_t *vid) {
+    int back = vid->front ^ 1;
+
+    if(vid->back != BACK_EMPTY || !vid->queued)
+        return;
+
+    if(pvr_fence_check(vid->fence[back]) < 0)
+        return;
+
+    if(sem_trywait((semaphore_t *)&pvr_state.dma_lock) < 0)
+        return;
+
+    if(!pvr_dma_ready())
+        goto out;
+
+    PVR_SET(PVR_YUV_ADDR, (uintptr_t)vid->txr[back] & 0xffffff);
+    PVR_SET(PVR_YUV_CFG, ((vid->mb_rows - 1) << 8) | (vid->mb_cols - 1));
+    PVR_GET(PVR_YUV_CFG);
+
+    vid->back = BACK_BUSY;
+
+    if(pvr_dma_yuv_conv(vid_frame(vid, vid->conv_idx), vid->frame_size, false,
+                        vid_done, vid) < 0) {
+        vid->back = BACK_EMPTY;
+        goto out;
+    }
+
+    return;
+
+out:
+    sem_signal((semaphore_t *)&pvr_state.dma_lock);
+}
+
+static void vid_vblank(uint32_t code, void *data) {
+    pvr_video_t *vid = (pvr_video_t *)data;
+
+    (void)code;
+
+    if(vid->front_left)
+        vid->front_left--;
+
+    if(!vid->front_left && vid->back == BACK_READY) {
+        vid->front ^= 1;
+        vid->front_left = vid->back_hold;
+        vid->back = BACK_EMPTY;
+        vid->shown++;
+    }
+
+    vid_kick(vid);
+}
+
+static size_t next_pow2(size_t n) {
+    size_t rv = 8;
+
+    while(rv < n)
+        rv <<= 1;
+
+    return rv;
+}
+
+pvr_video_t *pvr_video_create(size_t width, size_t height, size_t frames) {
+    pvr_video_t *vid;
+
+    if(!width || !height || (width & 15) || (height & 15) ||
+       width > 1024 || height > 1024 || !frames) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(!(vid = calloc(1, sizeof(*vid)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    vid->tw = next_pow2(width);
+    vid->th = next_pow2(height);
+    vid->mb_cols = vid->tw / 16;
+    vid->mb_rows = height / 16;
+    vid->frame_size = vid->mb_cols * vid->mb_rows * PVR_VIDEO_MB_SIZE;
+    vid->count = frames;
+
+    vid->frames = aligned_alloc(32, vid->frame_size * frames);
+    vid->holds = calloc(frames, sizeof(*vid->holds));
+    vid->txr[0] = pvr_mem_malloc(vid->tw * vid->th * 2);
+    vid->txr[1] = pvr_mem_malloc(vid->tw * vid->th * 2);
+
+    if(!vid->frames || !vid->holds || !vid->txr[0] || !vid->txr[1])
+        goto fail;
+
+    /* The decoder leaves the padding macroblocks alone. */
+    memset(vid->frames, 0, vid->frame_size * frames);
+
+    if((vid->vbl_handle = vblank_handler_add(vid_vblank, vid)) < 0)
+        goto fail;
+
+    return vid;
+
+fail:
+    if(vid->txr[1])
+        pvr_mem_free(vid->txr[1]);
+
+    if(vid->txr[0])
+        pvr_mem_free(vid->txr[0]);
+
+    free(vid->holds);
+    free(vid->frames);
+    free(vid);
+    errno = ENOMEM;
+    return NULL;
+}
+
+void pvr_video_destroy(pvr_video_t *vid) {
+    if(!vid)
+        return;
+
+    vblank_handler_remove(vid->vbl_handle);
+
+    {
+        irq_disable_scoped();
+
+        while(vid->back == BACK_BUSY)
+            genwait_wait(vid, "pvr_video_destroy", 0, NULL);
+    }
+
+    pvr_mem_free(vid->txr[1]);
+    pvr_mem_free(vid->txr[0]);
+    free(vid->holds);
+    free(vid->frames);
+    free(vid);
+}
+
+void *pvr_video_frame_get(pvr_video_t *vid, int timeout) {
+    uint64_t end = 0, now;
+
+    if(timeout)
+        end = timer_ms_gettime64() + timeout;
+
+    irq_disable_scoped();
+
+    while(vid->queued == vid->count) {
+        if(timeout) {
+            now = timer_ms_gettime64();
+
+            if(now >= end)
+                return NULL;
+
+            timeout = (int)(end - now);
+        }
+
+        genwait_wait(vid, "pvr_video_frame_get", timeout, NULL);
+    }
+
+    return vid_frame(vid, vid->get_idx);
+}
+
+uint8_t *pvr_video_macroblock(const pvr_video_t *vid, void *frame, size_t x,
+                              size_t y) {
+    return (uint8_t *)frame + (y * vid->mb_cols + x) * PVR_VIDEO_MB_SIZE;
+}
+
+int pvr_video_frame_push(pvr_video_t *vid, void *frame, unsigned int vblanks) {
+    irq_disable_scoped();
+
+    if(!vblanks || vid->queued == vid->count ||
+       frame != vid_frame(vid, vid->get_idx)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    vid->holds[vid->get_idx] = vblanks;
+    vid->get_idx = (vid->get_idx + 1) % vid->count;
+    vid->queued++;
+
+    vid_kick(vid);
+
+    return 0;
+}
+
+pvr_ptr_t pvr_video_texture(pvr_video_t *vid) {
+    irq_disable_scoped();
+
+    /* The other texture may be free by now. */
+    vid_kick(vid);
+
+    if(!vid->shown)
+        return NULL;
+
+    vid->fence[vid->front] = vid_scene_fence();
+
+    return vid->txr[vid->front];
+}
+
+void pvr_video_texture_size(const pvr_video_t *vid, size_t *w, size_t *h) {
+    if(w)
+        *w = vid->tw;
+
+    if(h)
+        *h = vid->th;
+}
+
+size_t pvr_video_frames_shown(const pvr_video_t *vid) {
+    return vid->shown;
+}
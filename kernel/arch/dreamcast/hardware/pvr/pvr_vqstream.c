@@ -0,0 +1,481 @@
+/* KallistiOS ##version##
+
+   pvr_vqstream.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* VQ texture streaming. The data of .pvr, .dt and .kmg files is already laid
+   out as in PVR RAM: the codebook, then the indices, with mipmap levels from
+   the smallest up. It goes up a chunk at a time, through two bounce buffers
+   so that a chunk can be read while the previous one uploads. Uploads of the
+   same priority are done in order, so everything before the end of the last
+   finished one is in PVR RAM.
+
+   The indices of the mipmap levels of a texture start where they would in a
+   smaller texture of the same format, so a texture with some of its levels in
+   is drawn as a smaller mipmapped texture, at the same address. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kos/fs.h>
+#include <dc/pvr.h>
+
+#define VQ_CODEBOOK_SIZE    2048
+
+/* Smallest mipmapped size drawn while loading */
+#define VQ_MIN_SIZE         8
+
+/* .pvr texture types, in the second byte of the format word; the first is
+   the pixel format, as the PVR numbers them */
+#define PVRT_VQ             3
+#define PVRT_VQ_MIP         4
+#define PVRT_SMALL_VQ       16
+#define PVRT_SMALL_VQ_MIP   17
+
+/* .dt texture type word, mipmap flag and format bits */
+#define DT_MIPMAP           (1u << 31)
+#define DT_FMT_MASK         0x7e000000
+
+/* KMG header fields, as written by vqenc and kmgenc */
+#define KMG_HDR_SIZE        64
+#define KMG_VERSION         1
+#define KMG_PLAT_DC         1
+#define KMG_DCFMT_RGB565    0x03
+#define KMG_DCFMT_ARGB4444  0x04
+#define KMG_DCFMT_ARGB1555  0x05
+#define KMG_DCFMT_MASK      0xff
+#define KMG_DCFMT_VQ        0x0100
+#define KMG_DCFMT_TWIDDLED  0x0200
+#define KMG_DCFMT_MIPMAP    0x0400
+
+/* KMG packs: a 32-byte header, then a table of 128-byte entries, each with a
+   56-byte name, the data offset, and the texture's KMG header at 64. */
+#define KMG_PACK_HDR_SIZE   32
+#define KMG_PACK_ENT_SIZE   128
+#define KMG_PACK_VERSION    1
+#define KMG_PACK_MAX        4096
+
+struct pvr_vq_stream {
+    file_t fd;
+    pvr_ptr_t base;                 /* The allocation in PVR RAM */
+    pvr_ptr_t txr;                  /* The texture, for small codebooks */
+    int fmt;                        /* PVR_TXRFMT_* */
+    size_t w, h;
+    bool mipmap;
+    size_t cb_size;                 /* Bytes of codebook */
+    size_t size;                    /* Bytes of data */
+    size_t read;                    /* Bytes read so far */
+    size_t done;                    /* Bytes in PVR RAM */
+
+    uint8_t *bounce[2];
+    pvr_upload_t upload[2];         /* Upload from each bounce buffer */
+    size_t upload_end[2];           /* Where each upload ends */
+    int next;                       /* Bounce buffer to read into next */
+};
+
+static inline uint32_t rd32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint16_t rd16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+/* Codebook entries pvrtex keeps for small codebook textures */
+static size_t small_cb_entries(size_t w, bool mipmap) {
+    if(w <= 16)
+        return 16;
+    else if(w <= 32)
+        return mipmap ? 64 : 32;
+    else if(w <= 64)
+        return mipmap ? 256 : 128;
+
+    return 256;
+}
+
+static bool valid_size(size_t n) {
+    return n >= 8 && n <= 1024 && !(n & (n - 1));
+}
+
+/* Reads the .pvr header following the PVRT fourcc */
+static int parse_pvr(pvr_vq_stream_t *s, const uint8_t *hdr) {
+    uint32_t fmt = rd32(hdr + 8);
+    unsigned int type = (fmt >> 8) & 0xff;
+
+    s->w = rd16(hdr + 12);
+    s->h = rd16(hdr + 14);
+    s->size = rd32(hdr + 4) - 8;
+    s->fmt = PVR_TXRFMT_VQ_ENABLE | PVR_TXRFMT_TWIDDLED |
+             ((fmt & 7) << 27);
+
+    switch(type) {
+        case PVRT_VQ_MIP:
+            s->mipmap = true;
+            __fallthrough;
+        case PVRT_VQ:
+            s->cb_size = VQ_CODEBOOK_SIZE;
+            break;
+
+        case PVRT_SMALL_VQ_MIP:
+            s->mipmap = true;
+            __fallthrough;
+        case PVRT_SMALL_VQ:
+            s->cb_size = small_cb_entries(s->w, s->mipmap) * 8;
+            break;
+
+        default:
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Reads the .dt header, and skips to its data */
+static int parse_dt(pvr_vq_stream_t *s, const uint8_t *hdr) {
+    uint32_t type = rd32(hdr + 28);
+    size_t hdr_size = ((size_t)hdr[12] + 1) * 32;
+
+    if(!(type & PVR_TXRFMT_VQ_ENABLE) || rd32(hdr + 4) < hdr_size)
+        return -1;
+
+    s->w = 8 << ((type >> 3) & 7);
+    s->h = 8 << (type & 7);
+    s->mipmap = !!(type & DT_MIPMAP);
+    s->fmt = type & DT_FMT_MASK;
+    s->cb_size = ((size_t)rd16(hdr + 16) + 1) * 8;
+    s->size = rd32(hdr + 4) - hdr_size;
+
+    if(hdr_size > 32 && fs_seek(s->fd, hdr_size, SEEK_SET) < 0)
+        return -1;
+
+    return 0;
+}
+
+/* Reads a KMG header, from a .kmg file or a pack's table of contents */
+static int parse_kmg(pvr_vq_stream_t *s, const uint8_t *hdr) {
+    uint32_t fmt = rd32(hdr + 12);
+
+    if(rd32(hdr + 4) != KMG_VERSION || rd32(hdr + 8) != KMG_PLAT_DC)
+        return -1;
+
+    /* The PVR can't draw VQ textures that aren't twiddled. */
+    if(!(fmt & KMG_DCFMT_VQ) || !(fmt & KMG_DCFMT_TWIDDLED))
+        return -1;
+
+    switch(fmt & KMG_DCFMT_MASK) {
+        case KMG_DCFMT_RGB565:
+            s->fmt = PVR_TXRFMT_RGB565;
+            break;
+        case KMG_DCFMT_ARGB4444:
+            s->fmt = PVR_TXRFMT_ARGB4444;
+            break;
+        case KMG_DCFMT_ARGB1555:
+            s->fmt = PVR_TXRFMT_ARGB1555;
+            break;
+        default:
+            return -1;
+    }
+
+    s->fmt |= PVR_TXRFMT_VQ_ENABLE | PVR_TXRFMT_TWIDDLED;
+    s->w = rd32(hdr + 16);
+    s->h = rd32(hdr + 20);
+    s->size = rd32(hdr + 24);
+    s->mipmap = !!(fmt & KMG_DCFMT_MIPMAP);
+    s->cb_size = VQ_CODEBOOK_SIZE;
+
+    return 0;
+}
+
+/* Looks up a texture in a pack's table of contents, and skips to its data */
+static int find_in_pack(pvr_vq_stream_t *s, const char *name) {
+    uint8_t hdr[KMG_PACK_HDR_SIZE], *toc, *ent;
+    size_t count, i;
+    int rv = -1;
+
+    if(fs_read(s->fd, hdr, sizeof(hdr)) != sizeof(hdr) ||
+       memcmp(hdr, "KMPK", 4) || rd32(hdr + 4) != KMG_PACK_VERSION)
+        return -1;
+
+    count = rd32(hdr + 8);
+
+    if(!count || count > KMG_PACK_MAX)
+        return -1;
+
+    /* The whole table comes in with one read. */
+    if(!(toc = malloc(count * KMG_PACK_ENT_SIZE))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if(fs_read(s->fd, toc, count * KMG_PACK_ENT_SIZE) !=
+       (ssize_t)(count * KMG_PACK_ENT_SIZE))
+        goto out;
+
+    errno = ENOENT;
+
+    for(i = 0; i < count; i++) {
+        ent = toc + i * KMG_PACK_ENT_SIZE;
+
+        if(!strncmp((const char *)ent, name, 56) && strlen(name) < 56)
+            break;
+    }
+
+    if(i == count)
+        goto out;
+
+    errno = EINVAL;
+
+    if(memcmp(ent + 64, "KMG", 4) || parse_kmg(s, ent + 64) < 0 ||
+       fs_seek(s->fd, rd32(ent + 56), SEEK_SET) < 0)
+        goto out;
+
+    rv = 0;
+
+out:
+    free(toc);
+    return rv;
+}
+
+static int read_header(pvr_vq_stream_t *s) {
+    uint8_t hdr[KMG_HDR_SIZE];
+
+    if(fs_read(s->fd, hdr, 16) != 16)
+        return -1;
+
+    /* .pvr files may start with a global index. */
+    if(!memcmp(hdr, "GBIX", 4)) {
+        if(fs_seek(s->fd, 8 + rd32(hdr + 4), SEEK_SET) < 0 ||
+           fs_read(s->fd, hdr, 16) != 16)
+            return -1;
+    }
+
+    if(!memcmp(hdr, "PVRT", 4))
+        return parse_pvr(s, hdr);
+
+    if(!memcmp(hdr, "DcTx", 4)) {
+        if(fs_read(s->fd, hdr + 16, 16) != 16)
+            return -1;
+
+        return parse_dt(s, hdr);
+    }
+
+    if(!memcmp(hdr, "KMG", 4)) {
+        if(fs_read(s->fd, hdr + 16, KMG_HDR_SIZE - 16) != KMG_HDR_SIZE - 16)
+            return -1;
+
+        return parse_kmg(s, hdr);
+    }
+
+    return -1;
+}
+
+/* Opens the file and reads the texture's header, either from the file or
+   from the named entry of a pack. */
+static pvr_vq_stream_t *vq_stream_open(const char *fn, const char *name) {
+    pvr_vq_stream_t *s;
+    int err = EINVAL;
+
+    if(!(s = calloc(1, sizeof(*s)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if((s->fd = fs_open(fn, O_RDONLY)) == FILEHND_INVALID) {
+        free(s);
+        errno = ENOENT;
+        return NULL;
+    }
+
+    if(name) {
+        errno = EINVAL;
+
+        if(find_in_pack(s, name) < 0) {
+            err = errno;
+            goto fail;
+        }
+    }
+    else if(read_header(s) < 0) {
+        goto fail;
+    }
+
+    if(!valid_size(s->w) || !valid_size(s->h) || s->cb_size > VQ_CODEBOOK_SIZE ||
+       s->size <= s->cb_size || s->size > 2 * 1024 * 1024)
+        goto fail;
+
+    err = ENOMEM;
+    s->base = pvr_mem_malloc((s->size + 31) & ~31);
+    s->bounce[0] = aligned_alloc(32, PVR_VQ_STREAM_CHUNK);
+    s->bounce[1] = aligned_alloc(32, PVR_VQ_STREAM_CHUNK);
+
+    if(!s->base || !s->bounce[0] || !s->bounce[1])
+        goto fail;
+
+    /* The PVR expects a full codebook in front of the indices. */
+    s->txr = (pvr_ptr_t)((uintptr_t)s->base - VQ_CODEBOOK_SIZE + s->cb_size);
+
+    return s;
+
+fail:
+    if(s->base)
+        pvr_mem_free(s->base);
+
+    free(s->bounce[1]);
+    free(s->bounce[0]);
+    fs_close(s->fd);
+    free(s);
+    errno = err;
+    return NULL;
+}
+
+pvr_vq_stream_t *pvr_txr_load_vq_stream(const char *fn) {
+    return vq_stream_open(fn, NULL);
+}
+
+pvr_vq_stream_t *pvr_txr_load_vq_stream_pack(const char *fn, const char *name) {
+    if(!name) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    return vq_stream_open(fn, name);
+}
+
+/* Catch up with the uploads that are done */
+static void vq_update(pvr_vq_stream_t *s) {
+    int i;
+
+    for(i = 0; i < 2; i++) {
+        if(s->upload[i] && !pvr_txr_upload_check(s->upload[i])) {
+            if(s->upload_end[i] > s->done)
+                s->done = s->upload_end[i];
+
+            s->upload[i] = 0;
+        }
+    }
+}
+
+void pvr_vq_stream_destroy(pvr_vq_stream_t *s) {
+    int i;
+
+    if(!s)
+        return;
+
+    for(i = 0; i < 2; i++) {
+        if(s->upload[i])
+            pvr_txr_upload_wait(s->upload[i], 0);
+    }
+
+    if(s->fd != FILEHND_INVALID)
+        fs_close(s->fd);
+
+    pvr_mem_free(s->base);
+    free(s->bounce[1]);
+    free(s->bounce[0]);
+    free(s);
+}
+
+int pvr_vq_stream_poll(pvr_vq_stream_t *s) {
+    int b = s->next;
+    size_t len;
+    pvr_upload_t up;
+
+    vq_update(s);
+
+    if(s->read == s->size) {
+        if(s->fd != FILEHND_INVALID) {
+            fs_close(s->fd);
+            s->fd = FILEHND_INVALID;
+        }
+
+        return s->done == s->size ? 0 : 1;
+    }
+
+    if(s->upload[b]) {
+        pvr_txr_upload_wait(s->upload[b], 0);
+        vq_update(s);
+    }
+
+    len = s->size - s->read;
+
+    if(len > PVR_VQ_STREAM_CHUNK)
+        len = PVR_VQ_STREAM_CHUNK;
+
+    if(fs_read(s->fd, s->bounce[b], len) != (ssize_t)len) {
+        errno = EIO;
+        return -1;
+    }
+
+    /* Only the last chunk is short; round its upload up. */
+    memset(s->bounce[b] + len, 0, ((len + 31) & ~31) - len);
+
+    up = pvr_txr_upload(s->bounce[b], (uint8_t *)s->base + s->read,
+                        (len + 31) & ~31, PVR_UPLOAD_PRIO_LOW, 0);
+
+    if(!up) {
+        /* Read the chunk again next time. */
+        fs_seek(s->fd, -(off_t)len, SEEK_CUR);
+        return -1;
+    }
+
+    s->upload[b] = up;
+    s->upload_end[b] = s->read + len;
+    s->read += len;
+    s->next = b ^ 1;
+
+    return 1;
+}
+
+int pvr_vq_stream_size(const pvr_vq_stream_t *s, size_t *w, size_t *h) {
+    size_t n, end, idx;
+
+    if(s->done == s->size) {
+        n = s->w;
+        goto out;
+    }
+
+    if(!s->mipmap || s->w != s->h || s->done < s->cb_size)
+        return -1;
+
+    /* Levels end 1, 2, 6, 22... bytes into the indices; an n by n level takes
+       n * n / 4 of them. */
+    idx = s->done - s->cb_size;
+    end = 22;
+
+    if(idx < end)
+        return -1;
+
+    for(n = VQ_MIN_SIZE; n < s->w && end + n * n <= idx; n <<= 1)
+        end += n * n;
+
+out:
+    if(w)
+        *w = n;
+
+    if(h)
+        *h = s->done == s->size ? s->h : n;
+
+    return 0;
+}
+
+int pvr_vq_stream_cxt(const pvr_vq_stream_t *s, pvr_poly_cxt_t *dst,
+                      pvr_list_t list, int filtering) {
+    size_t w, h;
+
+    if(pvr_vq_stream_size(s, &w, &h) < 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    pvr_poly_cxt_txr(dst, list, s->fmt, w, h, s->txr, filtering);
+    dst->txr.mipmap = s->mipmap ? PVR_MIPMAP_ENABLE : PVR_MIPMAP_DISABLE;
+
+    return 0;
+}
+
+pvr_ptr_t pvr_vq_stream_texture(const pvr_vq_stream_t *s) {
+    return s->txr;
+}
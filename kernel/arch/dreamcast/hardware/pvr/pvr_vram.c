@@ -0,0 +1,388 @@
+/* KallistiOS ##version##
+
+   pvr_vram.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Handle-based VRAM allocator. The pool is described by an array of block
+   nodes, each either free or allocated, chained together in address order.
+   A handle is simply the index of an allocated node, so moving a block only
+   means updating its offset. Free nodes are also kept in buckets by power of
+   two for allocation, and merged with their free neighbours whenever
+   possible. Nodes that are not describing any block at all are kept on a
+   list of their own for reuse. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <dc/pvr.h>
+#include <kos/mutex.h>
+
+#define VRAM_ALIGN      32
+#define VRAM_MIN_SHIFT  5
+#define VRAM_BUCKETS    19      /* 32 bytes to 8MB */
+
+#define NIL             -1
+
+typedef enum vram_state {
+    VRAM_UNUSED,
+    VRAM_FREE,
+    VRAM_USED
+} vram_state_t;
+
+typedef struct vram_block {
+    uint32_t offset;
+    uint32_t size;
+    int prev, next;             /* Neighbours in address order */
+    int fprev, fnext;           /* Bucket (or unused list) links */
+    uint8_t state;
+    uint8_t flags;
+} vram_block_t;
+
+static mutex_t vram_mutex = MUTEX_INITIALIZER;
+
+static uint8_t *vram_base;
+static size_t vram_size;
+static vram_block_t *blocks;
+static int nblocks;
+static int unused;
+static int buckets[VRAM_BUCKETS];
+
+static inline int vram_bucket(uint32_t size) {
+    int b = 31 - __builtin_clz(size) - VRAM_MIN_SHIFT;
+
+    return b < VRAM_BUCKETS ? b : VRAM_BUCKETS - 1;
+}
+
+static void bucket_insert(int i) {
+    int b = vram_bucket(blocks[i].size);
+
+    blocks[i].state = VRAM_FREE;
+    blocks[i].fprev = NIL;
+    blocks[i].fnext = buckets[b];
+
+    if(buckets[b] != NIL)
+        blocks[buckets[b]].fprev = i;
+
+    buckets[b] = i;
+}
+
+static void bucket_remove(int i) {
+    if(blocks[i].fprev != NIL)
+        blocks[blocks[i].fprev].fnext = blocks[i].fnext;
+    else
+        buckets[vram_bucket(blocks[i].size)] = blocks[i].fnext;
+
+    if(blocks[i].fnext != NIL)
+        blocks[blocks[i].fnext].fprev = blocks[i].fprev;
+}
+
+/* Get an unused node, growing the array if needed. */
+static int node_get(void) {
+    vram_block_t *nb;
+    int i, n;
+
+    if(unused == NIL) {
+        n = nblocks * 2;
+        nb = realloc(blocks, n * sizeof(*nb));
+        if(!nb)
+            return NIL;
+
+        blocks = nb;
+
+        for(i = n - 1; i >= nblocks; i--) {
+            blocks[i].state = VRAM_UNUSED;
+            blocks[i].fnext = unused;
+            unused = i;
+        }
+
+        nblocks = n;
+    }
+
+    i = unused;
+    unused = blocks[i].fnext;
+
+    return i;
+}
+
+static void node_put(int i) {
+    blocks[i].state = VRAM_UNUSED;
+    blocks[i].fnext = unused;
+    unused = i;
+}
+
+/* Unlink node j from the address chain. */
+static void chain_remove(int j) {
+    if(blocks[j].prev != NIL)
+        blocks[blocks[j].prev].next = blocks[j].next;
+
+    if(blocks[j].next != NIL)
+        blocks[blocks[j].next].prev = blocks[j].prev;
+}
+
+/* Merge the free node i with its free successor, if any. Neither is on a
+   bucket at this point. */
+static void merge_next(int i) {
+    int j = blocks[i].next;
+
+    if(j == NIL || blocks[j].state != VRAM_FREE)
+        return;
+
+    bucket_remove(j);
+    blocks[i].size += blocks[j].size;
+    chain_remove(j);
+    node_put(j);
+}
+
+int pvr_vram_init(size_t size) {
+    int i;
+
+    mutex_lock_scoped(&vram_mutex);
+
+    if(vram_base) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    size = (size + VRAM_ALIGN - 1) & ~(VRAM_ALIGN - 1);
+    nblocks = 64;
+
+    if(!size || !(blocks = malloc(nblocks * sizeof(*blocks)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if(!(vram_base = pvr_mem_malloc(size))) {
+        free(blocks);
+        blocks = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    vram_size = size;
+
+    for(i = 0; i < VRAM_BUCKETS; i++)
+        buckets[i] = NIL;
+
+    unused = NIL;
+
+    for(i = nblocks - 1; i > 0; i--)
+        node_put(i);
+
+    blocks[0].offset = 0;
+    blocks[0].size = size;
+    blocks[0].prev = NIL;
+    blocks[0].next = NIL;
+    blocks[0].flags = 0;
+    bucket_insert(0);
+
+    return 0;
+}
+
+void pvr_vram_shutdown(void) {
+    mutex_lock_scoped(&vram_mutex);
+
+    if(!vram_base)
+        return;
+
+    pvr_mem_free(vram_base);
+    free(blocks);
+
+    vram_base = NULL;
+    blocks = NULL;
+    nblocks = 0;
+}
+
+pvr_vram_t pvr_vram_alloc(size_t size, unsigned int flags) {
+    int b, i, best = NIL, rest;
+
+    mutex_lock_scoped(&vram_mutex);
+
+    if(!vram_base || !size || size > vram_size) {
+        errno = ENOMEM;
+        return PVR_VRAM_INVALID;
+    }
+
+    size = (size + VRAM_ALIGN - 1) & ~(VRAM_ALIGN - 1);
+
+    /* Best fit within the first bucket that has a large enough block. Every
+       block of the buckets above the request's own is large enough. */
+    for(b = vram_bucket(size); b < VRAM_BUCKETS && best == NIL; b++) {
+        for(i = buckets[b]; i != NIL; i = blocks[i].fnext) {
+            if(blocks[i].size >= size &&
+               (best == NIL || blocks[i].size < blocks[best].size)) {
+                best = i;
+
+                if(blocks[i].size == size)
+                    break;
+            }
+        }
+    }
+
+    if(best == NIL) {
+        errno = ENOMEM;
+        return PVR_VRAM_INVALID;
+    }
+
+    /* Get the node for the remainder before touching anything, as that may
+       move the array around. */
+    rest = NIL;
+
+    if(blocks[best].size > size && (rest = node_get()) == NIL) {
+        errno = ENOMEM;
+        return PVR_VRAM_INVALID;
+    }
+
+    bucket_remove(best);
+
+    if(rest != NIL) {
+        blocks[rest].offset = blocks[best].offset + size;
+        blocks[rest].size = blocks[best].size - size;
+        blocks[rest].flags = 0;
+        blocks[rest].prev = best;
+        blocks[rest].next = blocks[best].next;
+
+        if(blocks[best].next != NIL)
+            blocks[blocks[best].next].prev = rest;
+
+        blocks[best].next = rest;
+        blocks[best].size = size;
+        bucket_insert(rest);
+    }
+
+    blocks[best].state = VRAM_USED;
+    blocks[best].flags = flags;
+
+    return best;
+}
+
+static inline bool vram_valid(pvr_vram_t hnd) {
+    return vram_base && hnd >= 0 && hnd < nblocks &&
+           blocks[hnd].state == VRAM_USED;
+}
+
+void pvr_vram_free(pvr_vram_t hnd) {
+    int p;
+
+    mutex_lock_scoped(&vram_mutex);
+
+    if(!vram_valid(hnd))
+        return;
+
+    blocks[hnd].state = VRAM_FREE;
+    merge_next(hnd);
+
+    p = blocks[hnd].prev;
+
+    if(p != NIL && blocks[p].state == VRAM_FREE) {
+        bucket_remove(p);
+        blocks[p].size += blocks[hnd].size;
+        chain_remove(hnd);
+        node_put(hnd);
+        hnd = p;
+    }
+
+    bucket_insert(hnd);
+}
+
+pvr_ptr_t pvr_vram_ptr(pvr_vram_t hnd) {
+    mutex_lock_scoped(&vram_mutex);
+
+    if(!vram_valid(hnd))
+        return NULL;
+
+    return vram_base + blocks[hnd].offset;
+}
+
+/* Copy a block down to a lower address. Texture RAM is accessed a word at a
+   time, as byte accesses aren't reliable on it. */
+static void vram_move(uint32_t dst, uint32_t src, size_t size) {
+    volatile uint32_t *d = (volatile uint32_t *)(vram_base + dst);
+    volatile uint32_t *s = (volatile uint32_t *)(vram_base + src);
+
+    for(size /= 4; size; size--)
+        *d++ = *s++;
+}
+
+size_t pvr_vram_compact(size_t max_bytes) {
+    size_t moved = 0, count = 0;
+    int h, a, n;
+
+    mutex_lock_scoped(&vram_mutex);
+
+    if(!vram_base)
+        return 0;
+
+    /* Start with the lowest hole. */
+    for(h = 0; blocks[h].prev != NIL || blocks[h].state == VRAM_UNUSED; h++)
+        ;
+
+    for(; h != NIL; h = blocks[h].next) {
+        if(blocks[h].state != VRAM_FREE)
+            continue;
+
+        /* Bubble the hole up past every movable block that follows it. */
+        while((a = blocks[h].next) != NIL && blocks[a].state == VRAM_USED &&
+              !(blocks[a].flags & PVR_VRAM_PINNED)) {
+            if(max_bytes && moved && moved + blocks[a].size > max_bytes)
+                return count;
+
+            vram_move(blocks[h].offset, blocks[a].offset, blocks[a].size);
+            moved += blocks[a].size;
+            ++count;
+
+            /* Swap the two in the address chain. */
+            n = blocks[a].next;
+            blocks[a].offset = blocks[h].offset;
+            blocks[h].offset = blocks[a].offset + blocks[a].size;
+
+            blocks[a].prev = blocks[h].prev;
+            if(blocks[h].prev != NIL)
+                blocks[blocks[h].prev].next = a;
+
+            blocks[a].next = h;
+            blocks[h].prev = a;
+            blocks[h].next = n;
+            if(n != NIL)
+                blocks[n].prev = h;
+
+            /* The hole may now touch the next one. */
+            if(n != NIL && blocks[n].state == VRAM_FREE) {
+                bucket_remove(h);
+                merge_next(h);
+                bucket_insert(h);
+            }
+        }
+    }
+
+    return count;
+}
+
+void pvr_vram_get_stats(pvr_vram_stats_t *stats) {
+    int i;
+
+    mutex_lock_scoped(&vram_mutex);
+
+    stats->size = vram_size;
+    stats->used = 0;
+    stats->largest_free = 0;
+    stats->blocks = 0;
+    stats->holes = 0;
+
+    if(!vram_base)
+        return;
+
+    for(i = 0; i < nblocks; i++) {
+        if(blocks[i].state == VRAM_USED) {
+            stats->used += blocks[i].size;
+            ++stats->blocks;
+        }
+        else if(blocks[i].state == VRAM_FREE) {
+            if(blocks[i].size > stats->largest_free)
+                stats->largest_free = blocks[i].size;
+
+            ++stats->holes;
+        }
+    }
+}
@@ -12,6 +12,7 @@
 #include <kos/timer.h>
 
 #include <kos/dbglog.h>
+#include <kos/net.h>
 #include <kos/regfield.h>
 #include <kos/thread.h>
 #include <stdint.h>
@@ -1038,7 +1039,18 @@ sci_result_t sci_spi_read_data(uint8_t *rx_data, size_t len) {
     return SCI_OK;
 }
 
-sci_result_t sci_spi_dma_write_data(const uint8_t *data, size_t len, dma_callback_t callback, void *cb_data) {
+/* One more byte of a CRC16-CCITT, as net_crc16ccitt() */
+static inline uint16_t crc16_byte(uint16_t crc, uint8_t byte) {
+    uint16_t tmp = (crc >> 8) ^ byte;
+
+    tmp ^= tmp >> 4;
+
+    return (crc << 8) ^ (tmp << 12) ^ (tmp << 5) ^ tmp;
+}
+
+static sci_result_t spi_dma_write(const uint8_t *data, size_t len,
+                                  dma_callback_t callback, void *cb_data,
+                                  uint16_t *crc) {
     size_t i;
     sci_result_t result;
     uint32_t timeout_cnt = 0;
@@ -1073,6 +1085,10 @@ sci_result_t sci_spi_dma_write_data(const uint8_t *data, size_t len, dma_callbac
         return SCI_ERR_DMA;
     }
 
+    /* The CRC is worked out while the data goes out. */
+    if(crc)
+        *crc = net_crc16ccitt(data, len, *crc);
+
     /* If no callback was provided, wait for completion */
     if(callback == NULL) {
 
@@ -1095,11 +1111,23 @@ sci_result_t sci_spi_dma_write_data(const uint8_t *data, size_t len, dma_callbac
     return check_sci_errors();
 }
 
-sci_result_t sci_spi_dma_read_data(uint8_t *data, size_t len, dma_callback_t callback, void *cb_data) {
+sci_result_t sci_spi_dma_write_data(const uint8_t *data, size_t len, dma_callback_t callback, void *cb_data) {
+    return spi_dma_write(data, len, callback, cb_data, NULL);
+}
+
+sci_result_t sci_spi_dma_write_data_crc(const uint8_t *data, size_t len, uint16_t *crc) {
+    return spi_dma_write(data, len, NULL, NULL, crc);
+}
+
+static sci_result_t spi_dma_read(uint8_t *data, size_t len,
+                                 dma_callback_t callback, void *cb_data,
+                                 uint16_t *crc) {
     size_t i;
     sci_result_t result;
     uint32_t timeout_cnt;
     uint8_t *buffer = spi_dma_buffer;
+    uint16_t c = crc ? *crc : 0;
+    uint8_t byte;
 
     if(!initialized || sci_mode != SCI_MODE_SPI) {
         return SCI_ERR_NOT_INITIALIZED;
@@ -1141,9 +1169,13 @@ sci_result_t sci_spi_dma_read_data(uint8_t *data, size_t len, dma_callback_t cal
         SCTDR1 = 0xff;
         SCSSR1 &= ~TDRE;
 
-        /* Perform bit reversal while waiting for TDRE flag */
+        /* Perform bit reversal (and the CRC) while waiting for TDRE flag */
         if(i > 32) {
-            *data++ = bit_reverse8(*buffer++);
+            byte = bit_reverse8(*buffer++);
+            *data++ = byte;
+
+            if(crc)
+                c = crc16_byte(c, byte);
         }
     }
 
@@ -1164,10 +1196,17 @@ sci_result_t sci_spi_dma_read_data(uint8_t *data, size_t len, dma_callback_t cal
     }
 
     /* Perform bit reversal after DMA completes for the last 33 bytes */
-    for(i = 0; i < 33; i++) {
-        *data++ = bit_reverse8(*buffer++);
+    for(i = 0; i < 33 && i < len; i++) {
+        byte = bit_reverse8(*buffer++);
+        *data++ = byte;
+
+        if(crc)
+            c = crc16_byte(c, byte);
     }
 
+    if(crc)
+        *crc = c;
+
     if(callback) {
         callback(cb_data);
     }
@@ -1175,6 +1214,14 @@ sci_result_t sci_spi_dma_read_data(uint8_t *data, size_t len, dma_callback_t cal
     return result;
 }
 
+sci_result_t sci_spi_dma_read_data(uint8_t *data, size_t len, dma_callback_t callback, void *cb_data) {
+    return spi_dma_read(data, len, callback, cb_data, NULL);
+}
+
+sci_result_t sci_spi_dma_read_data_crc(uint8_t *data, size_t len, uint16_t *crc) {
+    return spi_dma_read(data, len, NULL, NULL, crc);
+}
+
 sci_result_t sci_dma_wait_complete(void) {
     dma_wait_complete(sci_dma_rx_config.channel);
     return check_sci_errors();
@@ -40,8 +40,10 @@ static uint8_t (*spi_rw_byte)(uint8_t data) = NULL;
 static void (*spi_set_cs)(bool enabled) = NULL;
 static int (*spi_init)(bool fast) = NULL;
 static void (*spi_shutdown)(void) = NULL;
-static int (*spi_read_data)(uint8_t *data, size_t len) = NULL;
-static int (*spi_write_data)(const uint8_t *data, size_t len) = NULL;
+/* These also update *crc with the data, unless crc is NULL. */
+static int (*spi_read_data)(uint8_t *data, size_t len, uint16_t *crc) = NULL;
+static int (*spi_write_data)(const uint8_t *data, size_t len,
+                             uint16_t *crc) = NULL;
 static uint8_t (*spi_read_byte)(void) = NULL;
 static void (*spi_write_byte)(uint8_t data) = NULL;
 
@@ -117,12 +119,20 @@ static uint8_t scif_rw_byte_wrapper(uint8_t data) {
         return scif_spi_slow_rw_byte(data);
 }
 
-static int scif_read_data_wrapper(uint8_t *data, size_t len) {
+static int scif_read_data_wrapper(uint8_t *data, size_t len, uint16_t *crc) {
     scif_spi_read_data(data, len);
+
+    if(crc)
+        *crc = net_crc16ccitt(data, len, *crc);
+
     return 0;
 }
 
-static int scif_write_data_wrapper(const uint8_t *data, size_t len) {
+static int scif_write_data_wrapper(const uint8_t *data, size_t len,
+                                   uint16_t *crc) {
+    if(crc)
+        *crc = net_crc16ccitt(data, len, *crc);
+
     while(len--) {
         scif_spi_write_byte(*data++);
     }
@@ -139,18 +149,38 @@ static void sci_write_byte_wrapper(uint8_t data) {
     sci_spi_write_byte(data);
 }
 
-static int sci_read_data_wrapper(uint8_t *data, size_t len) {
-    if(len & 31)
-        return sci_spi_read_data(data, len);
-    else
-        return sci_spi_dma_read_data(data, len, NULL, NULL);
+/* With DMA, the CRC is worked out during the transfer rather than after. */
+static int sci_read_data_wrapper(uint8_t *data, size_t len, uint16_t *crc) {
+    int rv;
+
+    if(!(len & 31)) {
+        if(crc)
+            return sci_spi_dma_read_data_crc(data, len, crc);
+        else
+            return sci_spi_dma_read_data(data, len, NULL, NULL);
+    }
+
+    rv = sci_spi_read_data(data, len);
+
+    if(!rv && crc)
+        *crc = net_crc16ccitt(data, len, *crc);
+
+    return rv;
 }
 
-static int sci_write_data_wrapper(const uint8_t *data, size_t len) {
-    if(len & 31)
-        return sci_spi_write_data(data, len);
-    else
-        return sci_spi_dma_write_data(data, len, NULL, NULL);
+static int sci_write_data_wrapper(const uint8_t *data, size_t len,
+                                  uint16_t *crc) {
+    if(!(len & 31)) {
+        if(crc)
+            return sci_spi_dma_write_data_crc(data, len, crc);
+        else
+            return sci_spi_dma_write_data(data, len, NULL, NULL);
+    }
+
+    if(crc)
+        *crc = net_crc16ccitt(data, len, *crc);
+
+    return sci_spi_write_data(data, len);
 }
 
 static void scif_shutdown_wrapper(void) {
@@ -448,7 +478,7 @@ int sd_shutdown(void) {
 
 static int read_data(size_t bytes, uint8 *buf) {
     uint8 byte;
-    uint16 crc;
+    uint16 crc = 0, rcrc;
     int i = 0;
 
     /* This should come back in 100ms at worst... */
@@ -460,15 +490,16 @@ static int read_data(size_t bytes, uint8 *buf) {
     if(byte != 0xFE)
         return -1;
 
-    /* Read in the data */
-    if(spi_read_data(buf, bytes)) {
+    /* Read in the data, and work out its CRC as it comes in */
+    if(spi_read_data(buf, bytes, check_crc ? &crc : NULL)) {
         return -1;
     }
 
     /* Read in the trailing CRC */
     if(check_crc) {
-        crc = (spi_read_byte() << 8) | spi_read_byte();
-        return crc != net_crc16ccitt(buf, bytes, 0);
+        rcrc = spi_read_byte() << 8;
+        rcrc |= spi_read_byte();
+        return rcrc != crc;
     }
     else {
         (void)spi_read_byte();
@@ -551,7 +582,7 @@ out:
 static int write_data(uint8 tag, size_t bytes, const uint8 *buf) {
     uint8 rv;
     int i = 0;
-    uint16 crc;
+    uint16 crc = 0;
 
     /* Wait for the card to be ready for our data */
     spi_rw_byte(0xFF);
@@ -565,9 +596,8 @@ static int write_data(uint8 tag, size_t bytes, const uint8 *buf) {
 
     spi_write_byte(tag);
 
-    /* Send the data. */
-    crc = net_crc16ccitt(buf, bytes, 0);
-    if(spi_write_data(buf, bytes)) {
+    /* Send the data, working out its CRC as it goes. */
+    if(spi_write_data(buf, bytes, &crc)) {
         return -1;
     }
 
@@ -786,6 +816,39 @@ static int sdb_flush(kos_blockdev_t *d) {
     return 0;
 }
 
+/* The card is driven a byte at a time (or with a DMA the CPU spins on) with
+   commands in between, so there's nothing to hand a transfer off to: do it
+   now and complete the request before returning. */
+static int sdb_submit(kos_blockdev_t *d, kos_blockdev_req_t *req) {
+    int rv;
+
+    req->status = EINPROGRESS;
+
+    if(req->write)
+        rv = sdb_write_blocks(d, req->block, req->count, req->buf);
+    else
+        rv = sdb_read_blocks(d, req->block, req->count, req->buf);
+
+    req->status = rv ? errno : 0;
+
+    if(req->callback)
+        req->callback(req);
+
+    return 0;
+}
+
+static int sdb_poll(kos_blockdev_t *d, kos_blockdev_req_t *req, int wait) {
+    (void)d;
+    (void)wait;
+
+    if(req->status) {
+        errno = req->status;
+        return -1;
+    }
+
+    return 0;
+}
+
 static kos_blockdev_t sd_blockdev = {
     NULL,                   /* dev_data */
     9,                      /* l_block_size (block size of 512 bytes) */
@@ -794,7 +857,9 @@ static kos_blockdev_t sd_blockdev = {
     &sdb_read_blocks,       /* read_blocks */
     &sdb_write_blocks,      /* write_blocks */
     &sdb_count_blocks,      /* count_blocks */
-    &sdb_flush              /* flush */
+    &sdb_flush,             /* flush */
+    &sdb_submit,            /* submit */
+    &sdb_poll               /* poll */
 };
 
 int sd_blockdev_for_partition(int partition, kos_blockdev_t *rv,
@@ -6,6 +6,10 @@
  */
 
 #include <kos/thread.h>
+#include <kos/genwait.h>
+#include <kos/sem.h>
+#include <arch/cache.h>
+#include <arch/irq.h>
 #include <dc/spu.h>
 #include <dc/g2bus.h>
 #include <dc/sq.h>
@@ -302,16 +306,17 @@ void spu_cdda_volume(int left_volume, int right_volume) {
                 (g2_read_32(SNDREGADDR(0x2044)) & ~0xff00) | (right_volume << 8));
 }
 
-void spu_cdda_pan(int left_pan, int right_pan) {
-    if(left_pan < 16)
-        left_pan = ~(left_pan - 16);
-
-    left_pan &= 0x1f;
+/* Pan from 0-31 to the sign and magnitude of the mixer registers */
+static inline int mixer_pan(int pan) {
+    if(pan < 16)
+        pan = ~(pan - 16);
 
-    if(right_pan < 16)
-        right_pan = ~(right_pan - 16);
+    return pan & 0x1f;
+}
 
-    right_pan &= 0x1f;
+void spu_cdda_pan(int left_pan, int right_pan) {
+    left_pan = mixer_pan(left_pan);
+    right_pan = mixer_pan(right_pan);
 
     g2_fifo_wait();
     g2_write_32(SNDREGADDR(0x2040),
@@ -355,6 +360,9 @@ int spu_init(void) {
     /* Initialize CDDA channels */
     spu_cdda_init();
 
+    /* Nothing to run on the DSP yet */
+    spu_dsp_clear();
+
     return 0;
 }
 
@@ -365,11 +373,406 @@ int spu_shutdown(void) {
     return 0;
 }
 
+/* Every transfer on the SPU channel ends in spu_dma_done(), which calls the
+   transfer's own callback, and then starts the next queued asynchronous
+   upload if that left the channel free. */
+static g2_dma_callback_t dma_cb;
+static void *dma_cbdata;
+static int dma_block;
+static semaphore_t dma_sem = SEM_INITIALIZER(0);
+
+/* Asynchronous uploads, in order. The first one is in flight if
+   async_busy is set. */
+typedef struct {
+    void *from;
+    uintptr_t dest;
+    size_t length;
+    spu_fence_t fence;
+} spu_upload_t;
+
+static spu_upload_t async_q[SPU_ASYNC_MAX];
+static size_t async_head, async_count;
+static int async_busy;
+static spu_fence_t async_last;
+static volatile spu_fence_t async_done;
+
+static void spu_async_kick(void);
+
+static void spu_dma_done(void *data) {
+    g2_dma_callback_t cb = dma_cb;
+
+    (void)data;
+    dma_cb = NULL;
+
+    if(dma_block) {
+        dma_block = 0;
+        sem_signal(&dma_sem);
+        thd_schedule(true);
+    }
+
+    if(cb)
+        cb(dma_cbdata);
+
+    spu_async_kick();
+}
+
+/* Start a transfer with IRQs disabled, so that it can't end before it has
+   been recorded. */
+static int spu_dma_start(void *from, uintptr_t dest, size_t length, int block,
+                         g2_dma_callback_t callback, void *cbdata) {
+    if(g2_dma_transfer(from, (void *)(dest | SPU_RAM_BASE), length, 0,
+                       spu_dma_done, NULL, 0, 0, G2_DMA_CHAN_SPU, 0) < 0)
+        return -1;
+
+    dma_cb = callback;
+    dma_cbdata = cbdata;
+    dma_block = block;
+    return 0;
+}
+
 int spu_dma_transfer(void *from, uintptr_t dest, size_t length, int block,
                      g2_dma_callback_t callback, void *cbdata) {
-    /* Adjust destination to SPU RAM */
-    dest |= SPU_RAM_BASE;
+    int old = irq_disable();
+    int rv = spu_dma_start(from, dest, length, block, callback, cbdata);
+
+    irq_restore(old);
+
+    if(!rv && block)
+        sem_wait(&dma_sem);
+
+    return rv;
+}
+
+static void spu_async_finished(void *data) {
+    (void)data;
+
+    async_busy = 0;
+    async_done = async_q[async_head].fence;
+    async_head = (async_head + 1) % SPU_ASYNC_MAX;
+    async_count--;
+    genwait_wake_all((void *)&async_done);
+}
+
+/* Start the next upload if the channel is free. Called with IRQs disabled. */
+static void spu_async_kick(void) {
+    spu_upload_t *u;
+
+    if(async_busy || !async_count)
+        return;
+
+    u = &async_q[async_head];
+
+    if(!spu_dma_start(u->from, u->dest, u->length, 0, spu_async_finished,
+                      NULL))
+        async_busy = 1;
+}
+
+static inline int fence_passed(spu_fence_t fence) {
+    return !fence || (int32_t)(async_done - fence) >= 0;
+}
+
+spu_fence_t spu_memload_async(uintptr_t to, void *from, size_t length) {
+    spu_upload_t *u;
+    int old;
 
-    return g2_dma_transfer(from, (void *) dest, length, block, callback, cbdata, 0,
-                           0, G2_DMA_CHAN_SPU, 0);
+    if(!length || (((uintptr_t)from | to) & 31)) {
+        errno = EFAULT;
+        return 0;
+    }
+
+    length = (length + 31) & ~31;
+    dcache_flush_range((uintptr_t)from, length);
+
+    old = irq_disable();
+
+    while(async_count == SPU_ASYNC_MAX) {
+        if(irq_inside_int()) {
+            irq_restore(old);
+            errno = EAGAIN;
+            return 0;
+        }
+
+        spu_async_kick();
+        genwait_wait((void *)&async_done, "spu_memload_async", 0, NULL);
+    }
+
+    u = &async_q[(async_head + async_count) % SPU_ASYNC_MAX];
+    u->from = from;
+    u->dest = to;
+    u->length = length;
+
+    if(!++async_last)
+        ++async_last;
+
+    u->fence = async_last;
+    async_count++;
+    spu_async_kick();
+
+    irq_restore(old);
+    return u->fence;
+}
+
+int spu_fence_check(spu_fence_t fence) {
+    int old = irq_disable();
+    int rv;
+
+    /* The channel may have been busy when it was the upload's turn. */
+    spu_async_kick();
+    rv = fence_passed(fence) ? 0 : -1;
+
+    irq_restore(old);
+    return rv;
+}
+
+int spu_fence_wait(spu_fence_t fence, int timeout) {
+    uint64_t deadline = timer_ms_gettime64() + timeout;
+    int old = irq_disable();
+    int rv = 0, left = timeout;
+
+    while(!fence_passed(fence)) {
+        if(timeout) {
+            left = (int)(deadline - timer_ms_gettime64());
+
+            if(left <= 0) {
+                rv = -1;
+                break;
+            }
+        }
+
+        spu_async_kick();
+
+        /* The channel was taken straight through g2_dma_transfer(), which
+           won't start the queue again: check back on it shortly. */
+        if(!async_busy) {
+            irq_restore(old);
+            thd_pass();
+            old = irq_disable();
+            continue;
+        }
+
+        if(genwait_wait((void *)&async_done, "spu_fence_wait", left,
+                        NULL) < 0) {
+            rv = -1;
+            break;
+        }
+    }
+
+    irq_restore(old);
+    return rv;
+}
+
+spu_fence_t spu_memload_pending(uintptr_t to, size_t length) {
+    spu_fence_t fence = 0;
+    spu_upload_t *u;
+    size_t i;
+    int old = irq_disable();
+
+    for(i = 0; i < async_count; i++) {
+        u = &async_q[(async_head + i) % SPU_ASYNC_MAX];
+
+        if(u->dest < to + length && to < u->dest + u->length)
+            fence = u->fence;
+    }
+
+    irq_restore(old);
+    return fence;
+}
+
+/* DSP registers */
+#define DSP_RBP         0x2804
+#define DSP_EFSDL(n)    (0x2000 + (n) * 4)
+#define DSP_COEF(n)     (0x3000 + (n) * 4)
+#define DSP_MADRS(n)    (0x3200 + (n) * 4)
+#define DSP_MPRO(n)     (0x3400 + (n) * 16)
+#define DSP_TEMP        0x4000
+#define DSP_STATE_SIZE  0x500   /* TEMP and MEMS */
+
+#define DSP_STEPS       128
+#define DSP_COEFS       64
+#define DSP_ADDRS       32
+
+/* Reverb: the left comb is at 0, read 1491 samples on at 1, the right
+   comb follows it at 2 and is read 1979 samples on at 3. Each comb's output
+   is damped into a temporary, and fed back with the input. */
+static const uint64_t reverb_mpro[] = {
+    0,
+    /* Read the left comb */
+    SPU_DSP_MRD | SPU_DSP_MASA(1),
+    0,
+    /* Read the right comb, the left one's arrives */
+    SPU_DSP_MRD | SPU_DSP_MASA(3) | SPU_DSP_IWT | SPU_DSP_IWA(0),
+    0,
+    SPU_DSP_IWT | SPU_DSP_IWA(1),
+    0,
+    /* Output the combs */
+    SPU_DSP_XSEL | SPU_DSP_IRA(0) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(0) |
+        SPU_DSP_ZERO,
+    SPU_DSP_EWT | SPU_DSP_EWA(0) |
+        SPU_DSP_XSEL | SPU_DSP_IRA(1) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(0) |
+        SPU_DSP_ZERO,
+    /* Damp them */
+    SPU_DSP_EWT | SPU_DSP_EWA(1) |
+        SPU_DSP_XSEL | SPU_DSP_IRA(0) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(1) |
+        SPU_DSP_ZERO,
+    SPU_DSP_TRA(1) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(2) | SPU_DSP_BSEL,
+    SPU_DSP_TWT | SPU_DSP_TWA(0) |
+        SPU_DSP_XSEL | SPU_DSP_IRA(1) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(1) |
+        SPU_DSP_ZERO,
+    SPU_DSP_TRA(3) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(2) | SPU_DSP_BSEL,
+    /* Feed them back with the input */
+    SPU_DSP_TWT | SPU_DSP_TWA(2) |
+        SPU_DSP_TRA(0) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(3) | SPU_DSP_ZERO,
+    SPU_DSP_XSEL | SPU_DSP_IRA(0x20) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(4) |
+        SPU_DSP_BSEL,
+    SPU_DSP_MWT | SPU_DSP_MASA(0) |
+        SPU_DSP_TRA(2) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(3) | SPU_DSP_ZERO,
+    SPU_DSP_XSEL | SPU_DSP_IRA(0x21) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(4) |
+        SPU_DSP_BSEL,
+    SPU_DSP_MWT | SPU_DSP_MASA(2)
+};
+
+static const int16_t reverb_coef[] = {
+    SPU_DSP_COEF_VAL(1.0f),
+    SPU_DSP_COEF_VAL(0.5f),
+    SPU_DSP_COEF_VAL(0.5f),
+    SPU_DSP_COEF_VAL(0.7f),
+    SPU_DSP_COEF_VAL(0.5f)
+};
+
+static const uint16_t reverb_madrs[] = { 0, 1491, 1492, 1492 + 1979 };
+
+const spu_dsp_prog_t spu_dsp_reverb = {
+    reverb_mpro, sizeof(reverb_mpro) / sizeof(reverb_mpro[0]),
+    reverb_coef, sizeof(reverb_coef) / sizeof(reverb_coef[0]),
+    reverb_madrs, sizeof(reverb_madrs) / sizeof(reverb_madrs[0]),
+    SPU_DSP_RING_8K
+};
+
+/* Low-pass: each side's last output is kept in a temporary */
+static const uint64_t lowpass_mpro[] = {
+    SPU_DSP_XSEL | SPU_DSP_IRA(0x20) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(0) |
+        SPU_DSP_ZERO,
+    SPU_DSP_TRA(1) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(1) | SPU_DSP_BSEL,
+    SPU_DSP_TWT | SPU_DSP_TWA(0) | SPU_DSP_EWT | SPU_DSP_EWA(0) |
+        SPU_DSP_XSEL | SPU_DSP_IRA(0x21) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(0) |
+        SPU_DSP_ZERO,
+    SPU_DSP_TRA(3) | SPU_DSP_YSEL(1) | SPU_DSP_COEF(1) | SPU_DSP_BSEL,
+    SPU_DSP_TWT | SPU_DSP_TWA(2) | SPU_DSP_EWT | SPU_DSP_EWA(1)
+};
+
+static const int16_t lowpass_coef[] = {
+    SPU_DSP_COEF_VAL(0.248f),
+    SPU_DSP_COEF_VAL(0.752f)
+};
+
+const spu_dsp_prog_t spu_dsp_lowpass = {
+    lowpass_mpro, sizeof(lowpass_mpro) / sizeof(lowpass_mpro[0]),
+    lowpass_coef, sizeof(lowpass_coef) / sizeof(lowpass_coef[0]),
+    NULL, 0, SPU_DSP_RING_8K
+};
+
+/* Write 16-bit values to consecutive DSP registers */
+static void dsp_write(uintptr_t reg, const uint16_t *vals, size_t count,
+                      int shift) {
+    g2_ctx_t ctx;
+    size_t i;
+
+    ctx = g2_lock();
+
+    for(i = 0; i < count; i++) {
+        if((i & 7) == 0) g2_fifo_wait();
+
+        g2_write_32_raw(SNDREGADDR(reg + i * 4),
+                        vals ? (uint16_t)(vals[i] << shift) : 0);
+    }
+
+    g2_unlock(ctx);
+}
+
+static void dsp_mute(void) {
+    int i;
+
+    for(i = 0; i < 16; i++) {
+        g2_fifo_wait();
+        g2_write_32(SNDREGADDR(DSP_EFSDL(i)), 0);
+    }
+}
+
+void spu_dsp_clear(void) {
+    dsp_mute();
+    dsp_write(DSP_MPRO(0), NULL, DSP_STEPS * 4, 0);
+    dsp_write(DSP_TEMP, NULL, DSP_STATE_SIZE / 4, 0);
+}
+
+int spu_dsp_load(const spu_dsp_prog_t *prog, uintptr_t ring) {
+    uint16_t words[4];
+    size_t i;
+
+    if(prog->steps > DSP_STEPS || prog->coefs > DSP_COEFS ||
+       prog->addrs > DSP_ADDRS || prog->rbl < 0 || prog->rbl > 3 ||
+       (prog->addrs && ((ring & 2047) ||
+        ring + SPU_DSP_RING_SIZE(prog->rbl) > 0x200000))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    spu_dsp_clear();
+
+    if(prog->addrs) {
+        spu_memset_sq(ring, 0, SPU_DSP_RING_SIZE(prog->rbl));
+        g2_fifo_wait();
+        g2_write_32(SNDREGADDR(DSP_RBP), (prog->rbl << 13) | (ring >> 11));
+        dsp_write(DSP_MADRS(0), prog->madrs, prog->addrs, 0);
+    }
+
+    /* Coefficients are 13 bits, at the top of the register */
+    dsp_write(DSP_COEF(0), (const uint16_t *)prog->coef, prog->coefs, 3);
+
+    for(i = 0; i < prog->steps; i++) {
+        words[0] = prog->mpro[i] >> 48;
+        words[1] = prog->mpro[i] >> 32;
+        words[2] = prog->mpro[i] >> 16;
+        words[3] = prog->mpro[i];
+        dsp_write(DSP_MPRO(i), words, 4, 0);
+    }
+
+    return 0;
+}
+
+int spu_dsp_set_coef(int idx, int16_t val) {
+    if(idx < 0 || idx >= DSP_COEFS) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    g2_fifo_wait();
+    g2_write_32(SNDREGADDR(DSP_COEF(idx)), (uint16_t)((uint16_t)val << 3));
+
+    return 0;
+}
+
+int spu_dsp_send(int ch, int input, int level) {
+    if(ch < 0 || ch > 63 || input < 0 || input > 15 || level < 0 ||
+       level > 15) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    g2_fifo_wait();
+    g2_write_32(CHNREGADDR(ch, 0x20), (level << 4) | input);
+
+    return 0;
+}
+
+int spu_dsp_output(int efreg, int level, int pan) {
+    if(efreg < 0 || efreg > 15 || level < 0 || level > 15 || pan < 0 ||
+       pan > 31) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    g2_fifo_wait();
+    g2_write_32(SNDREGADDR(DSP_EFSDL(efreg)), (level << 8) | mixer_pan(pan));
+
+    return 0;
 }
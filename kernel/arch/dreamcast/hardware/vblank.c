@@ -11,23 +11,59 @@
 
 #include <arch/irq.h>
 #include <dc/vblank.h>
+#include <kos/mutex.h>
+#include <kos/thread.h>
+#include <kos/timer.h>
+#include <kos/worker_thread.h>
 
 /*
    Functions to multiplex the vblank IRQ out to N client routines.
    This module is necessary because a number of things need to hang
    off the vblank IRQ, and chaining is unreliable.
+
+   Handlers are kept sorted by priority, so that dispatching is just a walk
+   down the list. Deferred handlers are on a list of their own, walked by a
+   worker thread that the interrupt wakes up. That list is protected by a
+   mutex rather than by disabling interrupts, as the handlers on it may take
+   their time.
 */
 
 /* Our list of handlers */
 struct vblhnd {
     TAILQ_ENTRY(vblhnd) listent;
     int         id;
+    int         prio;
+    unsigned int flags;
     asic_evt_handler    handler;
     void *data;
+    vblank_stats_t stats;
 };
-static TAILQ_HEAD(vhlist, vblhnd) vblhnds;
+TAILQ_HEAD(vhlist, vblhnd);
+static struct vhlist vblhnds;
+static struct vhlist vbldeferred;
 static int vblid_high;
 
+/* Deferred handler thread, created along with the first deferred handler. */
+static kthread_worker_t *vbl_worker;
+static mutex_t vbl_deferred_lock = RECURSIVE_MUTEX_INITIALIZER;
+
+/* Call a handler, keeping track of how long it takes. */
+static void vblank_call(struct vblhnd *t, uint32_t src) {
+    uint64_t start, ns;
+
+    start = timer_ns_gettime64();
+    t->handler(src, t->data);
+    ns = timer_ns_gettime64() - start;
+
+    irq_disable_scoped();
+
+    t->stats.calls++;
+    t->stats.total_ns += ns;
+
+    if(ns > t->stats.max_ns)
+        t->stats.max_ns = ns;
+}
+
 /* Our internal IRQ handler */
 static void vblank_handler(uint32_t src, void *data) {
     struct vblhnd * t;
@@ -35,21 +71,84 @@ static void vblank_handler(uint32_t src, void *data) {
     (void)data;
 
     TAILQ_FOREACH(t, &vblhnds, listent) {
-        t->handler(src, t->data);
+        vblank_call(t, src);
     }
+
+    if(vbl_worker && !TAILQ_EMPTY(&vbldeferred))
+        thd_worker_wakeup(vbl_worker);
 }
 
-int vblank_handler_add(asic_evt_handler hnd, void *data) {
+/* Deferred handler thread */
+static void vblank_deferred(void *data) {
+    struct vblhnd * t, * n;
+
+    (void)data;
+
+    mutex_lock(&vbl_deferred_lock);
+
+    TAILQ_FOREACH_SAFE(t, &vbldeferred, listent, n) {
+        vblank_call(t, ASIC_EVT_PVR_VBLANK_BEGIN);
+    }
+
+    mutex_unlock(&vbl_deferred_lock);
+}
+
+/* Insert a handler after any others of the same or higher priority. */
+static void vblank_insert(struct vhlist *list, struct vblhnd *vh) {
+    struct vblhnd * t;
+
+    TAILQ_FOREACH(t, list, listent) {
+        if(t->prio > vh->prio) {
+            TAILQ_INSERT_BEFORE(t, vh, listent);
+            return;
+        }
+    }
+
+    TAILQ_INSERT_TAIL(list, vh, listent);
+}
+
+int vblank_handler_add_ex(asic_evt_handler hnd, void *data, int prio,
+                          unsigned int flags) {
     struct vblhnd * vh;
+    kthread_worker_t *worker;
     int old;
 
-    vh = malloc(sizeof(struct vblhnd));
+    if((flags & VBLANK_HND_DEFERRED) && irq_inside_int()) {
+        errno = EPERM;
+        return -1;
+    }
+
+    vh = calloc(1, sizeof(struct vblhnd));
 
     if(!vh) {
         errno = ENOMEM;
         return -1;
     }
 
+    /* Finish filling the struct */
+    vh->handler = hnd;
+    vh->data = data;
+    vh->prio = prio;
+    vh->flags = flags;
+
+    if(flags & VBLANK_HND_DEFERRED) {
+        mutex_lock(&vbl_deferred_lock);
+
+        if(!vbl_worker) {
+            worker = thd_worker_create(vblank_deferred, NULL);
+
+            if(!worker) {
+                mutex_unlock(&vbl_deferred_lock);
+                free(vh);
+                errno = ENOMEM;
+                return -1;
+            }
+
+            thd_set_label(thd_worker_get_thread(worker), "[vblank]");
+            vbl_worker = worker;
+        }
+    }
+
     /* Disable ints just in case */
     old = irq_disable();
 
@@ -57,46 +156,122 @@ int vblank_handler_add(asic_evt_handler hnd, void *data) {
     vh->id = vblid_high;
     vblid_high++;
 
-    /* Finish filling the struct */
-    vh->handler = hnd;
-    vh->data = data;
-
     /* Add it to the list */
-    TAILQ_INSERT_TAIL(&vblhnds, vh, listent);
+    vblank_insert((flags & VBLANK_HND_DEFERRED) ? &vbldeferred : &vblhnds, vh);
 
     /* Restore ints */
     irq_restore(old);
 
+    if(flags & VBLANK_HND_DEFERRED)
+        mutex_unlock(&vbl_deferred_lock);
+
     return vh->id;
 }
 
+int vblank_handler_add(asic_evt_handler hnd, void *data) {
+    return vblank_handler_add_ex(hnd, data, VBLANK_PRIO_DEFAULT, 0);
+}
+
+/* Look for a handler on one of the lists; assumes ints are disabled. */
+static struct vblhnd *vblank_find(struct vhlist *list, int handle) {
+    struct vblhnd * t;
+
+    TAILQ_FOREACH(t, list, listent) {
+        if(t->id == handle)
+            return t;
+    }
+
+    return NULL;
+}
+
 int vblank_handler_remove(int handle) {
     struct vblhnd * t;
-    int old, rv;
+    int old;
 
     /* Disable ints just in case */
     old = irq_disable();
 
     /* Look for it */
-    rv = -1;
-    TAILQ_FOREACH(t, &vblhnds, listent) {
-        if(t->id == handle) {
-            TAILQ_REMOVE(&vblhnds, t, listent);
-            free(t);
-            rv = 0;
-            break;
-        }
+    if((t = vblank_find(&vblhnds, handle))) {
+        TAILQ_REMOVE(&vblhnds, t, listent);
+        irq_restore(old);
+        free(t);
+        return 0;
     }
 
-    /* Restore ints */
     irq_restore(old);
 
-    return rv;
+    /* It may be a deferred one, which can't go while it's running. */
+    if(irq_inside_int())
+        return -1;
+
+    mutex_lock(&vbl_deferred_lock);
+    old = irq_disable();
+
+    if((t = vblank_find(&vbldeferred, handle)))
+        TAILQ_REMOVE(&vbldeferred, t, listent);
+
+    irq_restore(old);
+    mutex_unlock(&vbl_deferred_lock);
+
+    if(!t)
+        return -1;
+
+    free(t);
+    return 0;
+}
+
+int vblank_handler_get_stats(int handle, vblank_stats_t *stats) {
+    struct vblhnd * t;
+
+    irq_disable_scoped();
+
+    if(!(t = vblank_find(&vblhnds, handle)) &&
+       !(t = vblank_find(&vbldeferred, handle)))
+        return -1;
+
+    *stats = t->stats;
+    return 0;
+}
+
+static void vblank_pslist_one(int (*pf)(const char *fmt, ...),
+                              const struct vblhnd *t) {
+    pf("%3d  %4d  %s  %8lu  %10llu  %8llu  %p\n", t->id, t->prio,
+       (t->flags & VBLANK_HND_DEFERRED) ? "thd" : "irq",
+       (unsigned long)t->stats.calls,
+       (unsigned long long)(t->stats.calls ?
+                            t->stats.total_ns / t->stats.calls : 0),
+       (unsigned long long)t->stats.max_ns, (void *)t->handler);
+}
+
+int vblank_pslist(int (*pf)(const char *fmt, ...)) {
+    struct vblhnd * t;
+
+    pf("Vblank handlers:\n");
+    pf(" id  prio  ctx  calls     avg_ns      max_ns    handler\n");
+
+    mutex_lock(&vbl_deferred_lock);
+    irq_disable_scoped();
+
+    TAILQ_FOREACH(t, &vblhnds, listent) {
+        vblank_pslist_one(pf, t);
+    }
+
+    TAILQ_FOREACH(t, &vbldeferred, listent) {
+        vblank_pslist_one(pf, t);
+    }
+
+    mutex_unlock(&vbl_deferred_lock);
+
+    pf("--end of list--\n");
+
+    return 0;
 }
 
 int vblank_init(void) {
     /* Setup our data structures */
     TAILQ_INIT(&vblhnds);
+    TAILQ_INIT(&vbldeferred);
     vblid_high = 1;
 
     /* Hook and enable the interrupt */
@@ -113,18 +288,23 @@ int vblank_shutdown(void) {
     asic_evt_disable(ASIC_EVT_PVR_VBLANK_BEGIN, ASIC_IRQ_DEFAULT);
     asic_evt_remove_handler(ASIC_EVT_PVR_VBLANK_BEGIN);
 
+    /* Stop running the deferred handlers */
+    if(vbl_worker) {
+        thd_worker_destroy(vbl_worker);
+        vbl_worker = NULL;
+    }
+
     /* Free any allocated handlers */
-    c = TAILQ_FIRST(&vblhnds);
+    TAILQ_FOREACH_SAFE(c, &vblhnds, listent, n) {
+        free(c);
+    }
 
-    while(c != NULL) {
-        n = TAILQ_NEXT(c, listent);
+    TAILQ_FOREACH_SAFE(c, &vbldeferred, listent, n) {
         free(c);
-        c = n;
     }
 
     TAILQ_INIT(&vblhnds);
+    TAILQ_INIT(&vbldeferred);
 
     return 0;
 }
-
-
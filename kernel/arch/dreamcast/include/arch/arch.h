@@ -111,6 +111,14 @@ void arch_panic(const char *str) __noreturn;
 */
 void arch_main(void) __noreturn;
 
+/** \brief  Wait for initialization to finish.
+
+    With \ref INIT_LAZY, this waits for the network to be brought up and for
+    the first scan of the Maple bus. Does nothing otherwise, or when called
+    again.
+*/
+void arch_init_wait(void);
+
 /** @} */
 
 /** \defgroup arch_retpaths Exit Paths
@@ -22,6 +22,8 @@ __BEGIN_DECLS
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/queue.h>
 
 /** \defgroup dmac  DMA Controller API
     \brief          API to use the SH4's DMA Controller
@@ -30,6 +32,13 @@ __BEGIN_DECLS
     This API can be used to program DMA transfers from memory to memory,
     from hardware to memory or from memory to hardware.
 
+    Transfers can either be programmed straight away with dma_transfer(), or
+    handed to the request queue of their channel with dma_req_submit(). The
+    queue runs requests by priority, and moves from one segment or request to
+    the next from the completion interrupt, so the channel never sits idle
+    waiting for a thread to notice the last transfer ended. dma_transfer()
+    waits for the queue of its channel to drain first.
+
     @{
 */
 
@@ -192,6 +201,93 @@ dma_addr_t dma_map_src(const void *ptr, size_t len);
 */
 dma_addr_t dma_map_dst(void *ptr, size_t len);
 
+/** \brief   Direction of a DMA transfer, for cache maintenance.
+    \ingroup dmac
+
+    Tells dma_sync_for_device() and dma_sync_for_cpu() which way the data goes
+    through a buffer, and so what the data cache needs done to it.
+*/
+typedef enum dma_dir {
+    DMA_TO_DEVICE,      /**< The device reads the buffer. */
+    DMA_FROM_DEVICE,    /**< The device writes the buffer. */
+    DMA_BIDIRECTIONAL   /**< Both, or not known. */
+} dma_dir_t;
+
+/** \brief   Size above which the sync helpers purge the whole data cache.
+    \ingroup dmac
+
+    Past this many bytes, walking the buffer a cache line at a time costs more
+    than purging all of the data cache with dcache_purge_all_with_buffer().
+*/
+#define DMA_SYNC_ALL_THRESHOLD  (16 * 1024)
+
+/** \brief   Hand a buffer over to a device.
+    \ingroup dmac
+
+    Does whatever the data cache needs before a device reads or writes the
+    buffer: a write-back for DMA_TO_DEVICE, an invalidate for DMA_FROM_DEVICE
+    (with the partial cache lines at either end of an unaligned buffer
+    written back first, so that neighbouring data is not lost), and both for
+    DMA_BIDIRECTIONAL. Buffers larger than \ref DMA_SYNC_ALL_THRESHOLD purge
+    the whole cache instead. Uncached (P2) and non-RAM addresses need
+    nothing and are left alone.
+
+    \param  ptr             The buffer.
+    \param  len             Its size in bytes.
+    \param  dir             Which way the data goes.
+
+    \sa dma_sync_for_cpu()
+*/
+void dma_sync_for_device(const void *ptr, size_t len, dma_dir_t dir);
+
+/** \brief   Take a buffer back from a device.
+    \ingroup dmac
+
+    Drops anything the CPU may have speculatively or accidentally cached of
+    the buffer while the device was writing to it, so that it reads what the
+    device wrote. Nothing is needed for DMA_TO_DEVICE.
+
+    \param  ptr             The buffer.
+    \param  len             Its size in bytes.
+    \param  dir             Which way the data went.
+
+    \sa dma_sync_for_device()
+*/
+void dma_sync_for_cpu(const void *ptr, size_t len, dma_dir_t dir);
+
+/** \brief   Flag for dma_alloc_coherent(): return a cached buffer.
+    \ingroup dmac
+
+    The buffer is returned through the cached P1 area, and it is up to the
+    caller to use dma_sync_for_device() and dma_sync_for_cpu() around each
+    transfer. Without it, the buffer is returned through the uncached P2 area
+    and needs no cache maintenance at all.
+*/
+#define DMA_ALLOC_CACHED    0x1
+
+/** \brief   Allocate a buffer for DMA.
+    \ingroup dmac
+
+    The buffer is 32-byte aligned and padded out to a whole number of cache
+    lines, so that it never shares a cache line with anything else. By default
+    it is returned uncached, after the cache has been purged over it.
+
+    \param  size            The size of the buffer in bytes.
+    \param  handle          Where to store its DMA address, or NULL.
+    \param  flags           0 or \ref DMA_ALLOC_CACHED.
+    \return                 The buffer, or NULL with errno set to ENOMEM.
+
+    \sa dma_free_coherent()
+*/
+void *dma_alloc_coherent(size_t size, dma_addr_t *handle, unsigned int flags);
+
+/** \brief   Free a buffer from dma_alloc_coherent().
+    \ingroup dmac
+
+    \param  ptr             The buffer, cached or not, or NULL.
+*/
+void dma_free_coherent(void *ptr);
+
 /** \brief   Program a DMA transfer.
     \ingroup dmac
 
@@ -199,7 +295,9 @@ dma_addr_t dma_map_dst(void *ptr, size_t len);
     source/destination addresses and transfer length.
 
     It will return as soon as the DMA transfer is programmed, which means that
-    it will not work for the DMA transfer to complete before returning.
+    it will not work for the DMA transfer to complete before returning. If
+    requests are queued on the channel, it first waits for them, or fails
+    with EBUSY when called from an interrupt.
 
     \param  cfg             A pointer to the configuration structure.
     \param  dst             The destination address, if targetting memory;
@@ -222,7 +320,8 @@ int dma_transfer(const dma_config_t *cfg, dma_addr_t dst, dma_addr_t src,
     \ingroup dmac
 
     This function will block until any previously programmed DMA transfer for
-    the given DMA channel has completed.
+    the given DMA channel has completed, along with all the requests queued
+    on it. From an interrupt, it only waits for the transfer in progress.
 
     \param  channel         The DMA channel to wait for.
 */
@@ -254,12 +353,143 @@ size_t dma_transfer_get_remaining(dma_channel_t channel);
 /** \brief   Abort a DMA transfer
     \ingroup dmac
 
-    This function will abort a DMA transfer for the given DMA channel.
+    This function will abort a DMA transfer for the given DMA channel. If that
+    was a queued request, it is cancelled and the next one in the queue
+    started.
 
     \param  channel         The DMA channel to abort.
 */
 void dma_transfer_abort(dma_channel_t channel);
 
+/** \brief   One segment of a scatter list.
+    \ingroup dmac
+
+    The addresses are as from dma_map_src(), dma_map_dst() or
+    hw_to_dma_addr(), which is also where any cache maintenance happens.
+*/
+typedef struct dma_sg {
+    dma_addr_t dst;                     /**< Destination address. */
+    dma_addr_t src;                     /**< Source address. */
+    size_t len;                         /**< Length in bytes. */
+} dma_sg_t;
+
+/** \brief   State of a queued DMA request.
+    \ingroup dmac
+*/
+typedef enum dma_req_state {
+    DMA_REQ_IDLE,                       /**< Never submitted. */
+    DMA_REQ_QUEUED,                     /**< Waiting for the channel. */
+    DMA_REQ_RUNNING,                    /**< Being transferred. */
+    DMA_REQ_DONE,                       /**< All segments transferred. */
+    DMA_REQ_CANCELLED,                  /**< Cancelled before it finished. */
+} dma_req_state_t;
+
+/** \brief   Queued DMA request.
+    \ingroup dmac
+
+    A list of segments to transfer one after another with the same
+    configuration. The caller owns the structure, which has to stay around
+    until the request is done or cancelled, and fills in the fields up to
+    data; the rest belong to the queue.
+
+    The callback in the configuration is called once the last segment is
+    done, in an interrupt context, with data as its argument.
+*/
+typedef struct dma_req {
+    dma_config_t cfg;                   /**< Configuration for all segments. */
+    const dma_sg_t *sg;                 /**< The segments to transfer. */
+    size_t sg_count;                    /**< The number of segments. */
+    int prio;                           /**< Priority; lower goes first, as
+                                             with threads. */
+    void *data;                         /**< Passed to the callback. */
+
+    volatile dma_req_state_t state;     /**< Where the request is at. */
+
+    /** \cond */
+    size_t sg_next;
+    TAILQ_ENTRY(dma_req) entry;
+    /** \endcond */
+} dma_req_t;
+
+/** \brief   DMA channel statistics.
+    \ingroup dmac
+
+    \sa dma_get_stats()
+*/
+typedef struct dma_stats {
+    uint32_t requests;                  /**< Queued requests completed. */
+    uint32_t cancelled;                 /**< Queued requests cancelled. */
+    uint32_t segments;                  /**< Segments transferred. */
+    uint32_t transfers;                 /**< Transfers from dma_transfer(). */
+    uint64_t bytes;                     /**< Bytes transferred, all told. */
+    uint32_t max_queued;                /**< Most requests ever waiting. */
+    uint64_t busy_ns;                   /**< Time spent on queued requests. */
+} dma_stats_t;
+
+/** \brief   Queue a DMA request.
+    \ingroup dmac
+
+    The request goes after any others waiting on its channel with the same or
+    a lower prio value, and starts at once if the channel is free. This can be
+    called from an interrupt, including from the callback of another request.
+
+    Channels 0 and 2 are tied to the hardware on the Dreamcast, so only
+    channels 1 and 3 have a queue.
+
+    \param  req             The request to queue.
+    \retval 0               On success.
+    \retval -1              On error, setting errno as appropriate.
+
+    \par    Error Conditions:
+    \em     EINVAL - the channel has no queue, or there are no segments \n
+    \em     EFAULT - a segment is not aligned to the unit size \n
+    \em     EBUSY - the request is already queued or running
+
+    \sa dma_req_wait(), dma_req_cancel()
+*/
+int dma_req_submit(dma_req_t *req);
+
+/** \brief   Wait for a queued DMA request.
+    \ingroup dmac
+
+    This may not be called from an interrupt.
+
+    \param  req             The request to wait for.
+    \param  timeout         How long to wait, in milliseconds, or 0 for as
+                            long as it takes.
+    \retval 0               Once the request is done.
+    \retval -1              On error, setting errno as appropriate.
+
+    \par    Error Conditions:
+    \em     ECANCELED - the request was cancelled \n
+    \em     EAGAIN - the timeout ran out \n
+    \em     EINVAL - the request was never submitted \n
+    \em     EPERM - called from an interrupt
+*/
+int dma_req_wait(dma_req_t *req, unsigned int timeout);
+
+/** \brief   Cancel a queued DMA request.
+    \ingroup dmac
+
+    A request still waiting is taken off the queue; one that is running is
+    aborted part way through, and the next in the queue started. The
+    callback is not called.
+
+    \param  req             The request to cancel.
+    \retval 0               On success.
+    \retval -1              If the request was not queued or running, with
+                            errno set to EINVAL.
+*/
+int dma_req_cancel(dma_req_t *req);
+
+/** \brief   Get the statistics of a DMA channel.
+    \ingroup dmac
+
+    \param  channel         The DMA channel.
+    \param  stats           Where to store its statistics.
+*/
+void dma_get_stats(dma_channel_t channel, dma_stats_t *stats);
+
 /** @} */
 
 __END_DECLS
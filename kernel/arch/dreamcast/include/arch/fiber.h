@@ -0,0 +1,78 @@
+/* KallistiOS ##version##
+
+   arch/dreamcast/include/arch/fiber.h
+   Copyright (C) 2026 KallistiOS Contributors
+
+*/
+
+/** \file    arch/fiber.h
+    \brief   Fiber context switching.
+    \ingroup kthreads
+
+    This file contains the architecture specific part of the fiber
+    implementation: the saved register state of a fiber, and the routine that
+    swaps between two of them. You should not need to use anything in here
+    directly, see kos/fiber.h instead.
+
+    \see    kos/fiber.h
+*/
+
+#ifndef __ARCH_FIBER_H
+#define __ARCH_FIBER_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdint.h>
+#include <string.h>
+
+/** \brief   Saved fiber state.
+
+    This only holds the registers that are preserved across function calls by
+    the SH4 ABI, as fibers are only switched through a function call.
+
+    \headerfile arch/fiber.h
+*/
+typedef struct arch_fiber_ctx {
+    uint32_t r[8];      /**< \brief R8 through R15 */
+    uint32_t pr;        /**< \brief Procedure register (return address) */
+    uint32_t mach;      /**< \brief Multiply-accumulate high */
+    uint32_t macl;      /**< \brief Multiply-accumulate low */
+    uint32_t fpscr;     /**< \brief Floating-point status/control register */
+    uint32_t fr[4];     /**< \brief FR12 through FR15 */
+} arch_fiber_ctx_t;
+
+/** \brief   Swap fiber contexts.
+
+    This function saves the calling context into save, and resumes the context
+    in load. It returns once something switches back to save.
+
+    \param  save            Where to save the current context.
+    \param  load            The context to switch to.
+*/
+void arch_fiber_switch(arch_fiber_ctx_t *save, const arch_fiber_ctx_t *load);
+
+/** \brief   Set up a fresh fiber context.
+
+    The first switch to the context will call entry on the given stack. The
+    entry function must never return.
+
+    \param  ctx             The context to set up.
+    \param  stack_top       The (8-byte aligned) top of the fiber's stack.
+    \param  entry           The function to start executing.
+*/
+static inline void arch_fiber_init(arch_fiber_ctx_t *ctx, void *stack_top,
+                                   void (*entry)(void)) {
+    uint32_t fpscr;
+
+    __asm__ __volatile__("sts fpscr, %0" : "=r"(fpscr));
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->r[7] = (uint32_t)stack_top;
+    ctx->pr = (uint32_t)entry;
+    ctx->fpscr = fpscr;
+}
+
+__END_DECLS
+
+#endif  /* __ARCH_FIBER_H */
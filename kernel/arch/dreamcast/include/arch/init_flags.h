@@ -109,6 +109,16 @@ __BEGIN_DECLS
 #define INIT_OCRAM          0x10000000  /**< \brief Use half of the dcache as RAM */
 #define INIT_NO_DCLOAD      0x20000000  /**< \brief Disable dcload */
 
+/** \brief Don't wait for slow hardware before main()
+
+    With this flag, the GD-ROM drive is only set up when it is first used (for
+    instance by the first open under /cd), the network is brought up in a
+    thread of its own, and the first Maple bus scan isn't waited for, so that
+    main() gets to run sooner. Call arch_init_wait() before relying on the
+    network or on the Maple devices being known. Needs INIT_IRQ.
+*/
+#define INIT_LAZY           0x40000000
+
 /** @} */
 
 __END_DECLS
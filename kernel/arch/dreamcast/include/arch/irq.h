@@ -30,6 +30,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <kos/cdefs.h>
+#include <kos/opts.h>
 __BEGIN_DECLS
 
 /** \defgroup irqs  Interrupts
@@ -74,7 +75,7 @@ __BEGIN_DECLS
     (even if not all of these are actually used).
 
     \note
-    On the Dreamcast, we need `228` bytes for all of that, but we round it up to a
+    On the Dreamcast, we need `232` bytes for all of that, but we round it up to a
     nicer number for sanity.
 */
 #define REG_BYTE_CNT 256
@@ -87,6 +88,13 @@ __BEGIN_DECLS
     \note
     The size of this structure should be less than or equal to the
     \ref REG_BYTE_CNT value.
+
+    \note
+    The FPU registers are only saved and restored for contexts that have
+    `fpu` set. A new context starts out with it clear and runs with SR.FD set,
+    so the first FPU instruction it executes raises an FPU disable exception,
+    which sets `fpu` and lets the instruction run again with the FPU enabled.
+    Until then, `fr`, `frbank` and `fpscr` keep their initial values.
 */
 typedef __attribute__((aligned(32))) struct irq_context {
     uint32_t  pc;         /**< Program counter */
@@ -101,6 +109,7 @@ typedef __attribute__((aligned(32))) struct irq_context {
     uint32_t  frbank[16]; /**< Secondary floating point registers */
     uint32_t  r[16];      /**< 16 general purpose (integer) registers */
     uint32_t  fpscr;      /**< Floating-point status/control register */
+    uint32_t  fpu;        /**< Nonzero once the context uses the FPU */
 } irq_context_t;
 
 /* Included for legacy compatibility with these two APIs being one. */
@@ -206,8 +215,8 @@ typedef enum irq_exception {
     EXC_ITLB_PV            = 0x00a0, /**< `[REEXEC]` Instruction TLB protection violation */
     EXC_ILLEGAL_INSTR      = 0x0180, /**< `[REEXEC]` Illegal instruction */
     EXC_SLOT_ILLEGAL_INSTR = 0x01a0, /**< `[REEXEC]` Slot illegal instruction */
-    EXC_GENERAL_FPU        = 0x0800, /**< `[REEXEC]` General FPU exception */
-    EXC_SLOT_FPU           = 0x0820, /**< `[REEXEC]` Slot FPU exception */
+    EXC_GENERAL_FPU        = 0x0800, /**< `[REEXEC]` General FPU disable exception */
+    EXC_SLOT_FPU           = 0x0820, /**< `[REEXEC]` Slot FPU disable exception */
     EXC_DATA_ADDRESS_READ  = 0x00e0, /**< `[REEXEC]` Data address (read) */
     EXC_DATA_ADDRESS_WRITE = 0x0100, /**< `[REEXEC]` Data address (write) */
     EXC_DTLB_MISS_READ     = 0x0040, /**< `[REEXEC]` Data TLB miss (read) */
@@ -297,6 +306,13 @@ int irq_inside_int(void);
 /** Type representing an interrupt mask state. */
 typedef uint32_t irq_mask_t;
 
+/** \cond INTERNAL */
+void __irq_mask_begin(void);
+void __irq_mask_end(void);
+
+#define __IRQ_SR_MASKED(sr) (((sr) & 0xf0) == 0xf0)
+/** \endcond */
+
 /** Get status register contents.
 
     Returns the current value of the status register, as irq_disable() does.
@@ -325,6 +341,11 @@ static inline irq_mask_t irq_get_sr(void) {
     \sa irq_disable()
 */
 static inline void irq_restore(irq_mask_t old) {
+#ifdef IRQ_MASK_DEBUG
+    if(!__IRQ_SR_MASKED(old) && __IRQ_SR_MASKED(irq_get_sr()))
+        __irq_mask_end();
+#endif
+
     __asm__ volatile("ldc %0, sr" : : "r" (old));
 }
 
@@ -342,6 +363,12 @@ static inline void irq_restore(irq_mask_t old) {
 static inline irq_mask_t irq_disable(void) {
     uint32_t mask = (uint32_t)irq_get_sr();
     irq_restore((mask & 0xefffff0f) | 0x000000f0);
+
+#ifdef IRQ_MASK_DEBUG
+    if(!__IRQ_SR_MASKED(mask))
+        __irq_mask_begin();
+#endif
+
     return mask;
 }
 
@@ -484,6 +511,70 @@ irq_cb_t irq_get_global_handler(void);
 
 /** @} */
 
+/** \defgroup irq_stats     Statistics
+    \brief                  How often interrupts come and how long they take
+
+    Each interrupt and exception gets counted, along with the time spent in
+    its handlers, which is the time everything else had to wait.
+
+    With IRQ_MASK_DEBUG defined in kos/opts.h, irq_disable() and irq_restore()
+    also time every stretch of time outside of interrupts with interrupts
+    masked, and keep the longest together with where it began and ended. Those
+    stretches are what delay audio and network interrupts. A stretch that
+    ends with the thread blocking is cut off at the switch.
+
+    @{
+*/
+
+/** \brief  Statistics about an interrupt or exception code. */
+typedef struct irq_stats {
+    uint32_t count;         /**< \brief Number of times it was taken */
+    uint64_t total_ns;      /**< \brief Total time spent in handlers */
+    uint32_t max_ns;        /**< \brief Longest time spent in handlers */
+} irq_stats_t;
+
+/** \brief  Statistics about the time spent with interrupts masked. */
+typedef struct irq_mask_stats {
+    uint32_t count;         /**< \brief Number of times they were masked */
+    uint64_t total_ns;      /**< \brief Total time they were masked */
+    uint32_t max_ns;        /**< \brief Longest time they were masked */
+    uintptr_t max_begin;    /**< \brief Where the longest one began */
+    uintptr_t max_end;      /**< \brief Where the longest one ended */
+} irq_mask_stats_t;
+
+/** \brief  Get the statistics of an interrupt or exception code.
+
+    \param  code            The code, as for irq_set_handler().
+    \param  stats           Where to put them.
+    \retval 0               On success.
+    \retval -1              If the code is invalid, with errno set to EINVAL.
+*/
+int irq_get_stats(irq_t code, irq_stats_t *stats);
+
+/** \brief  Get the statistics of the time spent with interrupts masked.
+
+    \param  stats           Where to put them.
+    \retval 0               On success.
+    \retval -1              If KOS was built without IRQ_MASK_DEBUG, with
+                            errno set to ENOSYS.
+*/
+int irq_get_mask_stats(irq_mask_stats_t *stats);
+
+/** \brief  Clear all interrupt statistics. */
+void irq_reset_stats(void);
+
+/** \brief  Print out the interrupt statistics.
+
+    One line is printed per code that was taken, then the masked time if it
+    is being measured.
+
+    \param  pf              The printf-like function to print with.
+    \retval 0               On success.
+*/
+int irq_print_stats(int (*pf)(const char *fmt, ...));
+
+/** @} */
+
 /** \cond INTERNAL */
 
 /** Initialize interrupts.
@@ -52,6 +52,8 @@ __BEGIN_DECLS
 
 #include <sys/uio.h>
 
+#include <kos/fs.h>
+
 /** \defgroup mmu   MMU
     \brief          Driver for the SH4's MMU (disabled by default).
     \ingroup        system
@@ -149,7 +151,9 @@ typedef struct mmupage {
     uint32_t cache: 1;       /**< \brief Cacheable -- 1 bit */
     uint32_t dirty: 1;       /**< \brief Dirty -- 1 bit */
     uint32_t wthru: 1;       /**< \brief Write-thru enable -- 1 bit */
-    uint32_t blank: 7;       /**< \brief Reserved -- 7 bits */
+    uint32_t size: 2;        /**< \brief Size of the page this is part of
+                                         (see \ref page_size_t) -- 2 bits */
+    uint32_t blank: 5;       /**< \brief Reserved -- 5 bits */
 
     /* Pre-compiled pieces. These waste a bit of ram, but they also
        speed loading immensely at runtime. */
@@ -271,6 +275,11 @@ void mmu_switch_context(mmucontext_t *context);
     This implies turning on the "valid" bit. Also sets the other named
     attributes as specified.
 
+    Once mapped, any naturally aligned 64KB or 1MB block that is entirely
+    mapped with the same attributes onto contiguous, equally aligned physical
+    pages is folded into one large page, so that it only takes one TLB entry.
+    Remapping or unmapping part of it splits it back into 4KB pages.
+
     \param  context         The context to modify.
     \param  virtpage        The first virtual page to map.
     \param  physpage        The first physical page to map.
@@ -285,6 +294,46 @@ void mmu_page_map(mmucontext_t *context, int virtpage, int physpage,
                   int count, page_prot_t prot, page_cache_t cache,
                   bool share, bool dirty);
 
+/** \brief   Unmap a range of virtual pages.
+    \ingroup mmu
+
+    This turns off the "valid" bit of the pages, and drops them from the TLB.
+    Pages that weren't mapped are skipped.
+
+    \param  context         The context to modify.
+    \param  virtpage        The first virtual page to unmap.
+    \param  count           The number of sequential pages to unmap.
+*/
+void mmu_page_unmap(mmucontext_t *context, int virtpage, int count);
+
+/** \brief   TLB miss counts.
+    \ingroup mmu
+
+    \see    mmu_get_tlb_stats()
+*/
+typedef struct mmu_tlb_stats {
+    uint32_t itlb_misses;       /**< \brief Instruction TLB misses */
+    uint32_t dtlb_read_misses;  /**< \brief Data TLB misses on reads */
+    uint32_t dtlb_write_misses; /**< \brief Data TLB misses on writes */
+} mmu_tlb_stats_t;
+
+/** \brief   Get the TLB miss counts.
+    \ingroup mmu
+
+    These count the misses taken since mmu_init() or the last call to
+    mmu_reset_tlb_stats().
+
+    \param  stats           Where to store the counts.
+    \retval 0               On success.
+    \retval -1              If stats is NULL (errno set to EFAULT).
+*/
+int mmu_get_tlb_stats(mmu_tlb_stats_t *stats);
+
+/** \brief   Reset the TLB miss counts.
+    \ingroup mmu
+*/
+void mmu_reset_tlb_stats(void);
+
 /** \brief   Copy a chunk of data from a process' address space into a kernel
              buffer, taking into account page mappings.
     \ingroup mmu
@@ -429,6 +478,126 @@ bool mmu_enabled(void);
  *  \param  addr            The base address to reset to */
 void mmu_set_sq_addr(void *addr);
 
+/** \defgroup mmu_stack     Lazy Thread Stacks
+    \brief                  Thread stacks committed on demand by the MMU
+    \ingroup                mmu
+
+    Threads created with the \c lazy_stack attribute set get a stack in a
+    virtual address range instead of from malloc(). Pages of it are only
+    backed by RAM once they are touched, so a thread only uses as much memory
+    as its stack actually grew to, and the page below the stack is never
+    mapped, so that overflowing it faults right away instead of corrupting
+    whatever lies below.
+
+    The pages are handed out by the TLB miss handler from a small reserve,
+    which is refilled from malloc() whenever a lazy stack is created. A thread
+    growing its stack by more than \ref MMU_STACK_RESERVE pages in one go,
+    with no thread being created in between, exhausts the reserve.
+
+    Stacks are limited to just under 2MB, and \ref MMU_STACK_SLOTS slots of
+    64KB are available in total.
+
+    @{
+*/
+
+/** \brief  Number of 64KB slots of virtual address space for stacks. */
+#define MMU_STACK_SLOTS     256
+
+/** \brief  Number of pages kept ready for stacks to grow into. */
+#define MMU_STACK_RESERVE   16
+
+/** \brief  Set up lazily committed thread stacks.
+
+    This requires mmu_init() to have been called first. If no page table is
+    in use yet, an empty one is created and made current.
+
+    \retval 0               On success.
+    \retval -1              On failure (errno set to ENXIO if MMU support
+                            isn't initialized, or ENOMEM).
+*/
+int mmu_stack_init(void);
+
+/** \brief  Shut down lazily committed thread stacks.
+
+    \retval 0               On success.
+    \retval -1              If lazy stacks are still in use (errno set to
+                            EBUSY).
+*/
+int mmu_stack_shutdown(void);
+
+/** @} */
+
+/** \defgroup mmu_mmap      Paged File Mappings
+    \brief                  Files mapped into memory a page at a time
+    \ingroup                mmu
+
+    This lets fs_mmap() map files of filesystems that can't do it themselves,
+    like iso9660 and FAT, into a range of virtual address space. Nothing is
+    read up front: touching a page that isn't loaded puts the thread to sleep
+    while a pager thread reads it in from the file, and at most
+    \ref MMU_MMAP_RESIDENT pages are kept in RAM at once, pages that haven't
+    been touched lately being dropped to make room for others.
+
+    The mappings are read-only, and are read through the file's own handle,
+    whose position is put back afterwards. A mapping should only be touched
+    by threads, with interrupts enabled, and not while holding locks the
+    filesystem needs to read the file (such as by passing it as the buffer of
+    a write to the same filesystem). It also can't be handed to anything that
+    does DMA. \ref MMU_MMAP_PAGES pages of address space are available for
+    mappings in total.
+
+    @{
+*/
+
+/** \brief  Number of pages of virtual address space for file mappings. */
+#define MMU_MMAP_PAGES      16384
+
+/** \brief  Number of pages of mapped files kept in RAM at once. */
+#define MMU_MMAP_RESIDENT   64
+
+/** \brief  Number of files that can be mapped at once. */
+#define MMU_MMAP_MAX        16
+
+/** \brief  Set up paged file mappings.
+
+    This requires mmu_init() to have been called first. If no page table is
+    in use yet, an empty one is created and made current.
+
+    \retval 0               On success.
+    \retval -1              On failure (errno set to ENXIO if MMU support
+                            isn't initialized, or ENOMEM).
+*/
+int mmu_mmap_init(void);
+
+/** \brief  Shut down paged file mappings.
+
+    \retval 0               On success.
+    \retval -1              If files are still mapped (errno set to EBUSY).
+*/
+int mmu_mmap_shutdown(void);
+
+/** \brief  Map a file.
+
+    This is called by fs_mmap() for files whose filesystem has no mmap
+    function of its own. The mapping lasts until mmu_mmap_release() is
+    called, which fs_close() does on the last close of the file.
+
+    \param  fd              The file to map.
+    \return                 The start of the mapping, or NULL on failure
+                            (errno set to ENXIO if paged mappings aren't set
+                            up, EINVAL if the file is empty or can't be read,
+                            or ENOMEM).
+*/
+void *mmu_mmap_file(file_t fd);
+
+/** \brief  Unmap a file mapped with mmu_mmap_file().
+
+    \param  addr            The start of the mapping.
+*/
+void mmu_mmap_release(void *addr);
+
+/** @} */
+
 __END_DECLS
 
 #endif  /* __ARCH_MMU_H */
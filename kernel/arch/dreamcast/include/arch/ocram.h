@@ -0,0 +1,94 @@
+/* KallistiOS ##version##
+
+   arch/ocram.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    arch/ocram.h
+    \brief   Operand cache RAM.
+    \ingroup ocram
+
+    This file contains an allocator for the half of the operand cache that
+    INIT_OCRAM turns into RAM, and a way to put static data there.
+*/
+
+#ifndef __ARCH_OCRAM_H
+#define __ARCH_OCRAM_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** \defgroup ocram Operand cache RAM
+    \brief          8 KB of on-chip RAM carved out of the operand cache
+    \ingroup        memory
+
+    With INIT_OCRAM in the init flags, the SH4 uses 8 KB of its 16 KB operand
+    cache as RAM instead. Accesses to it take a single cycle, never miss, and
+    can't be evicted by whatever else is going through the cache, which is
+    what a matrix stack, vertex staging buffer or mixing scratch area wants.
+    The price is that everything else gets half the cache.
+
+    Data can be put there statically, with the \ref __ocram attribute, or
+    carved out at runtime with ocram_alloc(). Static data is zeroed during
+    startup, like the BSS. Neither works without INIT_OCRAM.
+
+    The RAM is not seen by DMA, nor the store queues, and doesn't survive
+    the cache being reconfigured.
+
+    @{
+*/
+
+/** \brief   The address the RAM starts at. */
+#define OCRAM_BASE  0x7c001000
+
+/** \brief   The size of the RAM, in bytes. */
+#define OCRAM_SIZE  0x2000
+
+/** \brief   Put a variable in operand cache RAM.
+
+    For instance: `static matrix_t stack[16] __ocram;`
+*/
+#define __ocram     __attribute__((__section__(".ocram")))
+
+/** \brief   Is operand cache RAM enabled?
+
+    \return                 True if INIT_OCRAM was given.
+*/
+bool ocram_enabled(void);
+
+/** \brief   Allocate operand cache RAM.
+
+    This can be called from an interrupt.
+
+    \param  size            The number of bytes wanted.
+    \return                 A 32-byte aligned block of at least size bytes,
+                            or NULL on error, setting errno as appropriate.
+
+    \par    Error Conditions:
+    \em     ENODEV - operand cache RAM is not enabled \n
+    \em     EINVAL - size is 0 \n
+    \em     ENOMEM - there is no free block big enough
+*/
+void *ocram_alloc(size_t size);
+
+/** \brief   Free operand cache RAM.
+
+    \param  ptr             A block from ocram_alloc(), or NULL.
+*/
+void ocram_free(void *ptr);
+
+/** \brief   How much operand cache RAM is free?
+
+    \return                 The number of free bytes, all told. They need not
+                            be in one block.
+*/
+size_t ocram_available(void);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __ARCH_OCRAM_H */
@@ -109,6 +109,33 @@ static inline uintptr_t arch_fptr_next(uintptr_t fptr) {
 */
 void arch_stk_setup(kthread_t *nt);
 
+/** \brief  Allocate a lazily committed stack.
+
+    This is used for threads created with the \c lazy_stack attribute. On
+    Dreamcast, it needs mmu_stack_init() to have been called.
+
+    \param  size            The size of the stack.
+    \return                 The bottom of the stack, or NULL if lazy stacks
+                            aren't available, in which case a normal stack is
+                            allocated instead.
+*/
+void *arch_stk_alloc_lazy(size_t size);
+
+/** \brief  Free a stack allocated with arch_stk_alloc_lazy().
+
+    \param  stack           The bottom of the stack.
+*/
+void arch_stk_free_lazy(void *stack);
+
+/** \brief  Find how much of a lazily committed stack is committed.
+
+    \param  stack           The bottom of the stack, as returned by
+                            arch_stk_alloc_lazy().
+    \return                 The number of bytes committed, from the top of the
+                            stack down.
+*/
+size_t arch_stk_lazy_committed(const void *stack);
+
 /** \brief  Do a stack trace from the current function.
 
     This function does a stack trace from the current function, printing the
@@ -84,7 +84,9 @@ __BEGIN_DECLS
 /** \brief  SH4 Timer Channel 1.
 
     \warning
-    This timer channel is free to use.
+    This timer channel is free to use, but is shared between the maple
+    driver's extra polling rounds, the sampling profiler and any user code,
+    so take it with timer_claim() first.
 */
 #define TMU1    1
 
@@ -211,6 +213,32 @@ void timer_disable_ints(int channel);
 */
 int timer_ints_enabled(int channel);
 
+/** \brief   Claim a timer channel.
+    \ingroup tmu_direct
+
+    This function marks a free timer channel as in use, so that the things
+    that share it don't trample on each other. It doesn't touch the timer
+    itself.
+
+    \param  channel         The timer channel to claim. Only \ref TMU1 can be
+                            claimed, the others belonging to the kernel.
+    \retval 0               On success.
+    \retval -1              On error, setting errno to EINVAL for another
+                            channel or EBUSY if it is claimed already.
+
+    \sa timer_release()
+*/
+int timer_claim(int channel);
+
+/** \brief   Release a timer channel.
+    \ingroup tmu_direct
+
+    This function undoes timer_claim(), once the timer is stopped.
+
+    \param  channel         The timer channel to release.
+*/
+void timer_release(int channel);
+
 /** \defgroup tmu_uptime    Uptime
     \brief                  Maintaining time since system boot.
     \ingroup                timers
@@ -315,6 +343,57 @@ timer_primary_callback_t timer_primary_set_callback(timer_primary_callback_t cal
 */
 void timer_primary_wakeup(uint32_t millis);
 
+/** \defgroup tmu_hr      High-Resolution Timer
+    \brief                  One-shot wakeups at full timer resolution.
+    \ingroup                timers
+
+    This API provides a one-shot timer with a resolution of 80ns, for wakeups
+    that the millisecond primary timer is too coarse for. It is backed by
+    \ref TMU1 and claims it with timer_claim() while in use, so it can't be
+    used at the same time as the other things that share that channel.
+
+    \note
+    Generally, you want the hrtimer API in kos/hrtimer.h instead, which keeps
+    any number of timers on top of this one.
+*/
+
+/** \brief   High-resolution timer callback type.
+    \ingroup tmu_hr
+
+    This is the type of function which may be passed to timer_hr_claim(). It
+    is called from the timer interrupt.
+*/
+typedef void (*timer_hr_callback_t)(irq_context_t *);
+
+/** \brief   Claim the high-resolution timer.
+    \ingroup tmu_hr
+
+    \param  callback        The function to call when a wakeup comes due.
+    \retval 0               On success.
+    \retval -1              If \ref TMU1 is in use (errno is set to EBUSY).
+
+    \sa timer_hr_release()
+*/
+int timer_hr_claim(timer_hr_callback_t callback);
+
+/** \brief   Release the high-resolution timer.
+    \ingroup tmu_hr
+
+    Cancels any pending wakeup and gives \ref TMU1 back.
+*/
+void timer_hr_release(void);
+
+/** \brief   Request a high-resolution timer wakeup.
+    \ingroup tmu_hr
+
+    Calls the callback given to timer_hr_claim() once, after about \p ns
+    nanoseconds, replacing any wakeup scheduled already. Waits of more than
+    five minutes are cut short to that.
+
+    \param  ns              The number of nanoseconds to wait.
+*/
+void timer_hr_wakeup(uint64_t ns);
+
 /** \cond */
 /* Init function */
 int timer_init(void);
@@ -306,6 +306,12 @@ typedef enum bfont_code {
 */
 void bfont_set_encoding(bfont_code_t enc);
 
+/** \brief   Get the font encoding.
+
+    \return                 The character encoding in use.
+*/
+bfont_code_t bfont_get_encoding(void);
+
 /** \name Character Lookups
     \brief Methods for finding various font characters and icons.
     @{
@@ -0,0 +1,155 @@
+/* KallistiOS ##version##
+
+   dc/blit.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    dc/blit.h
+    \brief   Rectangle fills and blits on the framebuffer.
+    \ingroup blit
+
+    This file provides 2D drawing helpers for the framebuffer, and for images
+    in RAM laid out the same way.
+*/
+
+#ifndef __DC_BLIT_H
+#define __DC_BLIT_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \defgroup blit  Blitter
+    \brief          Fast fills and copies of rectangles of pixels
+    \ingroup        video
+
+    Drawing to the framebuffer with plain stores is slow, as it is uncached.
+    The blitter fills rectangles with the store queues, copies them with the
+    store queues or the SH4's DMA controller (channel 3) when the rows line up,
+    and draws 16-bit images with a color key or alpha blending, prefetching
+    the source as it goes.
+
+    Rectangles are clipped to both surfaces. Coordinates are in pixels, and
+    may be negative.
+
+    @{
+*/
+
+/** \brief   Pixel formats of blitter surfaces */
+typedef enum blit_fmt {
+    BLIT_FMT_RGB555,                /**< \brief 16-bit RGB555 */
+    BLIT_FMT_RGB565,                /**< \brief 16-bit RGB565 */
+    BLIT_FMT_ARGB4444,              /**< \brief 16-bit ARGB4444 */
+    BLIT_FMT_RGB0888                /**< \brief 32-bit RGB0888 */
+} blit_fmt_t;
+
+/** \brief   A surface to blit to or from.
+
+    \headerfile dc/blit.h
+*/
+typedef struct blit_surface {
+    void *pixels;                   /**< \brief The top left pixel */
+    size_t width;                   /**< \brief Width, in pixels */
+    size_t height;                  /**< \brief Height, in pixels */
+    size_t stride;                  /**< \brief Bytes from a row to the next */
+    blit_fmt_t fmt;                 /**< \brief Pixel format */
+} blit_surface_t;
+
+/** \brief   Get a surface for the current framebuffer.
+
+    The surface points at the current drawing area (see \ref vram_s), so get
+    it again after flipping.
+
+    \param  s               The surface to fill in.
+    \retval 0               On success.
+    \retval -1              If the framebuffer is in a format the blitter
+                            doesn't support (\ref PM_RGB888P), with errno set
+                            to EINVAL.
+*/
+int blit_screen(blit_surface_t *s);
+
+/** \brief   Fill a rectangle with a color.
+
+    \param  dst             The surface to draw to.
+    \param  x               The left of the rectangle.
+    \param  y               The top of the rectangle.
+    \param  w               The width of the rectangle.
+    \param  h               The height of the rectangle.
+    \param  color           The pixel value to fill with, in the format of
+                            the surface.
+*/
+void blit_fill(const blit_surface_t *dst, int x, int y, size_t w, size_t h,
+               uint32_t color);
+
+/** \brief   Copy a rectangle.
+
+    Both surfaces must be in the same format. They may be the same surface, in
+    which case the rectangles may overlap, to scroll.
+
+    \param  dst             The surface to draw to.
+    \param  dx              The left of the rectangle on dst.
+    \param  dy              The top of the rectangle on dst.
+    \param  src             The surface to copy from.
+    \param  sx              The left of the rectangle on src.
+    \param  sy              The top of the rectangle on src.
+    \param  w               The width of the rectangle.
+    \param  h               The height of the rectangle.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if the
+                            formats differ.
+*/
+int blit_copy(const blit_surface_t *dst, int dx, int dy,
+              const blit_surface_t *src, int sx, int sy, size_t w, size_t h);
+
+/** \brief   Copy a rectangle, leaving out pixels of a color.
+
+    Both surfaces must be in the same 16-bit format.
+
+    \param  dst             The surface to draw to.
+    \param  dx              The left of the rectangle on dst.
+    \param  dy              The top of the rectangle on dst.
+    \param  src             The surface to copy from.
+    \param  sx              The left of the rectangle on src.
+    \param  sy              The top of the rectangle on src.
+    \param  w               The width of the rectangle.
+    \param  h               The height of the rectangle.
+    \param  key             The pixel value to leave out.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if the
+                            formats differ or aren't 16-bit.
+*/
+int blit_colorkey(const blit_surface_t *dst, int dx, int dy,
+                  const blit_surface_t *src, int sx, int sy, size_t w, size_t h,
+                  uint16_t key);
+
+/** \brief   Blend a rectangle onto another.
+
+    The source is either in the format of the destination, blended with a
+    constant alpha, or in \ref BLIT_FMT_ARGB4444, blended with the alpha of
+    each pixel scaled by the constant alpha. The destination must be
+    \ref BLIT_FMT_RGB555 or \ref BLIT_FMT_RGB565.
+
+    \param  dst             The surface to draw to.
+    \param  dx              The left of the rectangle on dst.
+    \param  dy              The top of the rectangle on dst.
+    \param  src             The surface to blend in.
+    \param  sx              The left of the rectangle on src.
+    \param  sy              The top of the rectangle on src.
+    \param  w               The width of the rectangle.
+    \param  h               The height of the rectangle.
+    \param  alpha           The opacity of the source, from 0 to 255.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if the
+                            formats can't be blended.
+*/
+int blit_alpha(const blit_surface_t *dst, int dx, int dy,
+               const blit_surface_t *src, int sx, int sy, size_t w, size_t h,
+               uint8_t alpha);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_BLIT_H */
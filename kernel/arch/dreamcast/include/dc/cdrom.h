@@ -422,10 +422,51 @@ int cdrom_read_toc(CDROM_TOC *toc_buffer, bool high_density);
                             the caller function will be responsible for ensuring
                             memory coherency.
 
+    \note                   Reads from several threads are queued and served
+                            in order of sector going up from the last one
+                            read, merging reads that carry on from each other,
+                            rather than in the order they were made. One that
+                            has waited longer than the default deadline goes
+                            first, see cdrom_set_sched_deadline().
+
     \see    cd_read_sector_mode
 */
 int cdrom_read_sectors_ex(void *buffer, int sector, int cnt, int mode);
 
+/** \brief    Default deadline for queued sector reads, in milliseconds.
+    \ingroup  gdrom
+*/
+#define CDROM_SCHED_DEADLINE    100
+
+/** \brief    Read one or more sectors, with a deadline.
+    \ingroup  gdrom
+
+    This works as cdrom_read_sectors_ex(), but the read is served ahead of
+    the order it would have in the queue once it has waited for the given
+    time. Reads past their deadlines are served earliest deadline first.
+
+    \param  buffer          Space to store the read sectors.
+    \param  sector          The sector to start reading from.
+    \param  cnt             The number of sectors to read.
+    \param  mode            \ref cd_read_sector_mode
+    \param  deadline        How long the read may wait in the queue, in
+                            milliseconds. 0 serves it as soon as the reads
+                            past their deadlines before it are done.
+    \return                 \ref cd_cmd_response
+*/
+int cdrom_read_sectors_deadline(void *buffer, int sector, int cnt, int mode,
+                                unsigned int deadline);
+
+/** \brief    Set the deadline of reads made with cdrom_read_sectors_ex().
+    \ingroup  gdrom
+
+    A deadline of 0 serves reads in the order they're made.
+
+    \param  deadline        The deadline, in milliseconds. Defaults to
+                            \ref CDROM_SCHED_DEADLINE.
+*/
+void cdrom_set_sched_deadline(unsigned int deadline);
+
 /** \brief    Read one or more sector from a CD-ROM in PIO mode.
     \ingroup  gdrom
 
@@ -477,6 +518,25 @@ int cdrom_stream_stop(bool abort_dma);
 */
 int cdrom_stream_request(void *buffer, size_t size, bool block);
 
+/** \brief    Request stream transfer, without waiting for it.
+    \ingroup  gdrom
+
+    This function requests data from a DMA stream, and calls back when the
+    DMA has completed, from the G1 DMA interrupt. The G1 bus is held until
+    then, so other drive and G1 ATA calls wait for the transfer to finish.
+    The callback is also called if the transfer is aborted.
+
+    \param  buffer          Space to store the read sectors (aligned to 32).
+    \param  size            The size in bytes to read (min 32).
+    \param  done            The function to call when the transfer is over.
+    \param  data            The parameter to pass to the callback.
+    \return                 \ref cd_cmd_response, ERR_SYS if the stream isn't
+                            a DMA stream.
+    \see    cdrom_stream_start
+*/
+int cdrom_stream_request_async(void *buffer, size_t size,
+                               cdrom_stream_callback_t done, void *data);
+
 /** \brief    Check requested stream transfer.
     \ingroup  gdrom
 
@@ -499,6 +559,86 @@ int cdrom_stream_progress(size_t *size);
 */
 void cdrom_stream_set_callback(cdrom_stream_callback_t callback, void *param);
 
+/** \brief    Most buffers of a stream ring.
+    \ingroup  gdrom
+*/
+#define CDROM_STREAM_RING_MAX   16
+
+/** \brief    Read a DMA stream into a ring of buffers.
+    \ingroup  gdrom
+
+    Instead of asking for each transfer with cdrom_stream_request(), the
+    stream is read into the given buffers in turn, the G1 DMA interrupt
+    starting the transfer into the next free buffer as soon as the one before
+    it is done. The drive then keeps reading while the buffers filled so far
+    are being used. Full buffers are taken with cdrom_stream_ring_get(), in
+    order, and handed back to be filled again with cdrom_stream_ring_put().
+
+    This is to be called right after cdrom_stream_start() with
+    \ref CDROM_READ_DMA, before any cdrom_stream_request(). The G1 bus is
+    only held while a transfer is going on. The ring is over once the stream
+    is stopped.
+
+    \param  bufs            The buffers, aligned to 32 bytes.
+    \param  count           The number of buffers, up to
+                            \ref CDROM_STREAM_RING_MAX.
+    \param  size            The size of each buffer, a multiple of 32 bytes
+                            (usually of the sector size).
+    \return                 \ref cd_cmd_response, ERR_SYS if the stream isn't
+                            a DMA stream, a ring is already running, or for
+                            bad buffers.
+    \see    cdrom_stream_start
+*/
+int cdrom_stream_ring_start(void *const *bufs, size_t count, size_t size);
+
+/** \brief    Take the next full buffer of a stream ring.
+    \ingroup  gdrom
+
+    Buffers come in the order they were filled, which is that of the stream.
+    Only the last one of the stream may be partly filled.
+
+    \param  buf             Where to store the buffer.
+    \param  size            Where to store the number of bytes read into it,
+                            or NULL.
+    \param  timeout         The most time to wait for the buffer, in
+                            milliseconds, or 0 to wait forever.
+    \return                 ERR_OK with the buffer, ERR_NO_ACTIVE once the
+                            whole stream has been taken or the ring was
+                            stopped, ERR_TIMEOUT, or ERR_SYS if a transfer
+                            failed (or every buffer is already taken).
+*/
+int cdrom_stream_ring_get(void **buf, size_t *size, int timeout);
+
+/** \brief    Hand back the oldest buffer taken from a stream ring.
+    \ingroup  gdrom
+
+    The buffer is filled again with the next data of the stream.
+
+    \return                 ERR_OK, or ERR_SYS if no buffer was taken.
+*/
+int cdrom_stream_ring_put(void);
+
+/** \brief    Stop a stream ring, and the stream.
+    \ingroup  gdrom
+
+    A transfer in progress is aborted.
+
+    \return                 \ref cd_cmd_response
+*/
+int cdrom_stream_ring_stop(void);
+
+/** \brief    Get the number of the current stream.
+    \ingroup  gdrom
+
+    Every stream started with cdrom_stream_start() gets a new number. As
+    starting a stream stops the one before it, a reader keeping its own
+    stream open can compare this with the number it got just after starting
+    it, to find out whether someone else has started one since.
+
+    \return                 The number of the last stream started.
+*/
+uint32_t cdrom_stream_seq(void);
+
 /** \brief    Read subcode data from the most recently read sectors.
     \ingroup  gdrom
 
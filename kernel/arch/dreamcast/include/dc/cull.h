@@ -0,0 +1,125 @@
+/* KallistiOS ##version##
+
+   dc/cull.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    dc/cull.h
+    \brief   Frustum culling of bounding volumes.
+    \ingroup math_cull
+
+    This file contains batched visibility tests of bounding spheres and boxes
+    against the view frustum, done with the SH4's matrix unit.
+*/
+
+#ifndef __DC_CULL_H
+#define __DC_CULL_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <dc/matrix.h>
+#include <dc/vec3f.h>
+
+/** \defgroup math_cull Frustum culling
+    \brief              Test bounding volumes against the view frustum
+    \ingroup            math
+
+    A frustum is made from the current matrix (XMTRX), which must take the
+    space the bounding volumes are in to screen space, as set up by
+    mat_perspective() and the like: visible points have a W of at least the
+    near W, and land in the given rectangle of the screen once divided by W.
+    The frustum's planes are kept in that space, so culling costs nothing per
+    volume beyond the tests themselves.
+
+    Volumes are tested in batches. Four of the planes are loaded into XMTRX,
+    so that a single ftrv gives the distance from a volume's center to all of
+    them; the near plane and the extents of boxes are done with fipr. The
+    current matrix is saved and put back around each batch.
+
+    There is no far plane, as the PVR doesn't clip on depth.
+
+    @{
+*/
+
+/** \brief   Result of culling a volume */
+typedef enum cull_result {
+    CULL_OUTSIDE = 0,               /**< \brief Not visible */
+    CULL_INTERSECT = 1,             /**< \brief Partly visible, may need
+                                                clipping */
+    CULL_INSIDE = 2                 /**< \brief Entirely visible */
+} cull_result_t;
+
+/** \brief   A view frustum.
+
+    \headerfile dc/cull.h
+*/
+typedef struct cull_frustum {
+    /** \brief Left, right, top and bottom planes, as the rows of a matrix */
+    matrix_t sides __attribute__((aligned(32)));
+    float near[4];                  /**< \brief Near plane */
+    float abs_sides[4][4];          /**< \brief The sides, with |a|, |b|, |c| */
+    float abs_near[4];              /**< \brief The near plane, likewise */
+} cull_frustum_t;
+
+/** \brief   A bounding sphere.
+
+    \headerfile dc/cull.h
+*/
+typedef struct cull_sphere {
+    float x, y, z;                  /**< \brief Center */
+    float r;                        /**< \brief Radius */
+} cull_sphere_t;
+
+/** \brief   An axis-aligned bounding box.
+
+    \headerfile dc/cull.h
+*/
+typedef struct cull_aabb {
+    vec3f_t min;                    /**< \brief Lowest corner */
+    vec3f_t max;                    /**< \brief Highest corner */
+} cull_aabb_t;
+
+/** \brief   Set up a frustum from the current matrix.
+
+    \param  f               The frustum to set up.
+    \param  x0              The left of the visible area of the screen.
+    \param  y0              The top of the visible area of the screen.
+    \param  x1              The right of the visible area of the screen.
+    \param  y1              The bottom of the visible area of the screen.
+    \param  near_w          The smallest visible W, as given to
+                            pvr_dr_clip_strip().
+*/
+void cull_frustum_init(cull_frustum_t *f, float x0, float y0, float x1,
+                       float y1, float near_w);
+
+/** \brief   Cull bounding spheres.
+
+    \param  f               The frustum.
+    \param  s               The spheres.
+    \param  count           The number of spheres.
+    \param  out             Where to store a \ref cull_result_t for each
+                            sphere.
+    \return                 The number of spheres at least partly visible.
+*/
+size_t cull_spheres(const cull_frustum_t *f, const cull_sphere_t *s,
+                    size_t count, uint8_t *out);
+
+/** \brief   Cull axis-aligned bounding boxes.
+
+    \param  f               The frustum.
+    \param  b               The boxes.
+    \param  count           The number of boxes.
+    \param  out             Where to store a \ref cull_result_t for each box.
+    \return                 The number of boxes at least partly visible.
+*/
+size_t cull_aabbs(const cull_frustum_t *f, const cull_aabb_t *b, size_t count,
+                  uint8_t *out);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_CULL_H */
@@ -0,0 +1,313 @@
+/* KallistiOS ##version##
+
+   dc/fastmath.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    dc/fastmath.h
+    \brief   Fast approximations of transcendental functions.
+    \ingroup math_fastmath
+
+    This file contains quick approximations of exp, log, pow and atan2, a
+    table-driven fixed-point sine and cosine, and versions of them that work
+    over whole arrays.
+*/
+
+#ifndef __DC_FASTMATH_H
+#define __DC_FASTMATH_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <dc/fmath.h>
+
+/** \defgroup math_fastmath Fast approximations
+    \brief                  Quick and close enough exp, log, pow and atan2
+    \ingroup                math
+
+    Newlib's libm computes these to full single precision in software, which
+    is far too slow for audio or physics inner loops. These get within a
+    chosen accuracy in a few multiplies: exp and log split their argument into
+    its exponent and mantissa and fit a polynomial to the mantissa, atan2
+    fits one to atan over [0, 1] after a division done with fsrra, and the
+    sines and cosines come from fsca.
+
+    How accurate (and how slow) they are is picked at compile time, for each
+    file that includes this header, by defining \ref FASTMATH_ACCURACY before
+    including it. The figures given are the largest errors of each tier.
+
+    The functions take no care over infinities, NaNs or denormals, and the
+    arguments of log and pow must be positive.
+
+    @{
+*/
+
+/** \brief   Tier with the fewest terms.
+    exp2: 2e-3 relative; log2: 8e-4; atan2: 5e-3 radians. */
+#define FASTMATH_LOW        0
+
+/** \brief   The default tier.
+    exp2: 8e-5 relative; log2: 1e-4; atan2: 6e-4 radians. */
+#define FASTMATH_MEDIUM     1
+
+/** \brief   Tier with the most terms.
+    exp2: 2e-7 relative; log2: 6e-6; atan2: 2e-5 radians. */
+#define FASTMATH_HIGH       2
+
+#ifndef FASTMATH_ACCURACY
+/** \brief   The accuracy tier to use; one of the FASTMATH_* tiers. */
+#define FASTMATH_ACCURACY   FASTMATH_MEDIUM
+#endif
+
+/** \cond */
+typedef union {
+    float f;
+    int32_t i;
+} __fastmath_bits_t;
+
+extern const int16_t __fast_sin_table[257];
+/** \endcond */
+
+/** \brief   Approximate 2 to the power of x.
+
+    \param  x               The power, between -126 and 128. Anything beyond
+                            that is clamped.
+    \return                 2^x
+*/
+static inline float __pure fast_exp2(float x) {
+    __fastmath_bits_t b;
+    float f, p;
+    int n;
+
+    if(x < -126.0f)
+        x = -126.0f;
+    else if(x > 127.999f)
+        x = 127.999f;
+
+    n = (int)x;
+
+    if(x < (float)n)
+        n--;
+
+    f = x - (float)n;
+
+    /* 2^f, for f in [0, 1) */
+#if FASTMATH_ACCURACY == FASTMATH_LOW
+    p = 1.00172472f + f * (0.657636703f + f * 0.337188972f);
+#elif FASTMATH_ACCURACY == FASTMATH_MEDIUM
+    p = 0.99992522f + f * (0.695833509f + f * (0.226067247f +
+        f * 0.0780244585f));
+#else
+    p = 0.999999925f + f * (0.693153073f + f * (0.240153618f +
+        f * (0.0558263154f + f * (0.00898934327f + f * 0.00187757537f))));
+#endif
+
+    /* Then times 2^n, straight into the exponent */
+    b.f = p;
+    b.i += n << 23;
+
+    return b.f;
+}
+
+/** \brief   Approximate e to the power of x.
+
+    \param  x               The power, between about -87 and 88.
+    \return                 e^x
+*/
+static inline float __pure fast_exp(float x) {
+    return fast_exp2(x * 1.44269504f);
+}
+
+/** \brief   Approximate the base 2 logarithm of x.
+
+    \param  x               A positive number.
+    \return                 log2(x)
+*/
+static inline float __pure fast_log2(float x) {
+    __fastmath_bits_t b = { .f = x };
+    float e, t, p;
+
+    /* x = 2^e * (1 + t), with t in [0, 1) */
+    e = (float)(((b.i >> 23) & 0xff) - 127);
+    b.i = (b.i & 0x007fffff) | 0x3f800000;
+    t = b.f - 1.0f;
+
+#if FASTMATH_ACCURACY == FASTMATH_LOW
+    p = 1.424593f + t * (-0.58920389f + t * 0.165381756f);
+#elif FASTMATH_ACCURACY == FASTMATH_MEDIUM
+    p = 1.43901449f + t * (-0.679942867f + t * (0.325593636f +
+        t * -0.0847675803f));
+#else
+    p = 1.44255313f + t * (-0.718281779f + t * (0.458270164f +
+        t * (-0.279536852f + t * (0.123450314f + t * -0.026457051f))));
+#endif
+
+    return e + t * p;
+}
+
+/** \brief   Approximate the natural logarithm of x.
+
+    \param  x               A positive number.
+    \return                 ln(x)
+*/
+static inline float __pure fast_log(float x) {
+    return fast_log2(x) * 0.693147181f;
+}
+
+/** \brief   Approximate x to the power of y.
+
+    The error of the result grows with the size of y * log2(x).
+
+    \param  x               A positive number.
+    \param  y               The power.
+    \return                 x^y
+*/
+static inline float __pure fast_pow(float x, float y) {
+    return fast_exp2(y * fast_log2(x));
+}
+
+/** \brief   Approximate the angle of the point (x, y).
+
+    \param  y               The y coordinate.
+    \param  x               The x coordinate.
+    \return                 The angle from the x axis to the point, in
+                            radians, between -pi and pi. 0 for (0, 0).
+*/
+static inline float __pure fast_atan2(float y, float x) {
+    const float ax = x < 0.0f ? -x : x, ay = y < 0.0f ? -y : y;
+    float mn, mx, r, r2, a;
+
+    mn = ax < ay ? ax : ay;
+    mx = ax < ay ? ay : ax;
+
+    if(mx == 0.0f)
+        return 0.0f;
+
+    /* mn / mx, with fsrra rather than fdiv */
+    r = mn * frsqrt(mx * mx);
+    r2 = r * r;
+
+#if FASTMATH_ACCURACY == FASTMATH_LOW
+    a = r * (0.972393958f + r2 * -0.191947669f);
+#elif FASTMATH_ACCURACY == FASTMATH_MEDIUM
+    a = r * (0.995357961f + r2 * (-0.288690157f + r2 * 0.0793389391f));
+#else
+    a = r * (0.999866332f + r2 * (-0.330304798f + r2 * (0.180159302f +
+        r2 * (-0.0851563302f + r2 * 0.0208450959f))));
+#endif
+
+    if(ay > ax)
+        a = 1.57079633f - a;
+
+    if(x < 0.0f)
+        a = 3.14159265f - a;
+
+    return y < 0.0f ? -a : a;
+}
+
+/** \brief   Fixed-point sine from a table.
+
+    This is good to about 1 part in 30000, and needs no FPU at all.
+
+    \param  angle           The angle, in 65536ths of a turn (so 16384 is a
+                            right angle), the same units fsca uses.
+    \return                 The sine of the angle, times 32767.
+*/
+static inline int16_t __pure fast_isin(uint16_t angle) {
+    unsigned int p = angle & 0x3fff, i, frac;
+    int s;
+
+    /* Second and fourth quarters run the table backwards */
+    if(angle & 0x4000)
+        p = 0x4000 - p;
+
+    i = p >> 6;
+    frac = p & 63;
+
+    s = __fast_sin_table[i];
+
+    if(frac)
+        s += ((__fast_sin_table[i + 1] - s) * (int)frac) >> 6;
+
+    return (angle & 0x8000) ? -s : s;
+}
+
+/** \brief   Fixed-point cosine from a table.
+
+    \param  angle           The angle, in 65536ths of a turn.
+    \return                 The cosine of the angle, times 32767.
+    \see    fast_isin()
+*/
+static inline int16_t __pure fast_icos(uint16_t angle) {
+    return fast_isin(angle + 0x4000);
+}
+
+/** \brief   Approximate e^x of each of an array of numbers.
+
+    \param  in              The powers.
+    \param  out             Where to store the results. This may be in.
+    \param  count           The number of them.
+*/
+static inline void fast_exp_batch(const float *in, float *out, size_t count) {
+    size_t i;
+
+    for(i = 0; i < count; i++)
+        out[i] = fast_exp(in[i]);
+}
+
+/** \brief   Approximate the natural logarithm of each of an array of numbers.
+
+    \param  in              The numbers, which must be positive.
+    \param  out             Where to store the results. This may be in.
+    \param  count           The number of them.
+*/
+static inline void fast_log_batch(const float *in, float *out, size_t count) {
+    size_t i;
+
+    for(i = 0; i < count; i++)
+        out[i] = fast_log(in[i]);
+}
+
+/** \brief   Approximate atan2 of each of an array of points.
+
+    \param  y               The y coordinates.
+    \param  x               The x coordinates.
+    \param  out             Where to store the angles. This may be x or y.
+    \param  count           The number of points.
+*/
+static inline void fast_atan2_batch(const float *y, const float *x, float *out,
+                                    size_t count) {
+    size_t i;
+
+    for(i = 0; i < count; i++)
+        out[i] = fast_atan2(y[i], x[i]);
+}
+
+/** \brief   Sines and cosines of an array of angles, with fsca.
+
+    fsca is good to about 1 part in 2^21 whatever the accuracy tier.
+
+    \param  angles          The angles, in radians.
+    \param  s               Where to store the sines. This may be angles.
+    \param  c               Where to store the cosines.
+    \param  count           The number of angles.
+*/
+static inline void fast_sincos_batch(const float *angles, float *s, float *c,
+                                     size_t count) {
+    float sv, cv;
+    size_t i;
+
+    for(i = 0; i < count; i++) {
+        fsincosr(angles[i], &sv, &cv);
+        s[i] = sv;
+        c[i] = cv;
+    }
+}
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_FASTMATH_H */
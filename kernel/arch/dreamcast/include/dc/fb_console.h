@@ -45,6 +45,12 @@ extern dbgio_handler_t dbgio_fb;
     change this, you can restore the original functionality by passing NULL for
     t, 640 for w, 480 for h, and 32 for borderx and bordery.
 
+    When drawing to the whole screen of a single-buffered video mode (NULL
+    for t), the console also uses as much VRAM again right after the
+    framebuffer, and scrolls by moving the start of the display rather than
+    by copying the framebuffer. It goes back to copying as soon as something
+    else moves the display.
+
     \param  t               The target in memory to render to.
     \param  w               The width of the target.
     \param  h               The height of the target.
@@ -168,6 +168,11 @@ int flashrom_delete(int offset);
     This function retrieves the specified block ID from the given partition. The
     newest version of the data is returned.
 
+    The first lookup in a partition scans all of it and keeps an index of where
+    the newest valid version of each block is, so that later lookups only take
+    a single read. Writing to or deleting from the flashrom through
+    flashrom_write() or flashrom_delete() throws the index away.
+
     \param  partid          The partition ID to look in.
     \param  blockid         The logical block ID to look for.
     \param  buffer_out      Space to store the data. Must be at least 60 bytes.
@@ -363,6 +368,9 @@ typedef struct flashrom_ispcfg {
     if they exist. You should check the valid_fields bitfield for the part of
     the struct you want before relying on the data.
 
+    The settings are only parsed on the first call, and again after the
+    flashrom has been written to with flashrom_write() or flashrom_delete().
+
     \param  out             Storage for the structure.
     \retval 0               On success.
     \retval -1              On error (no settings found, or other errors).
@@ -31,6 +31,8 @@ __BEGIN_DECLS
 
 #include <kos/limits.h>
 #include <kos/fs.h>
+#include <stdbool.h>
+#include <stdint.h>
 
 /** \addtogroup gdrom
     @{
@@ -46,6 +48,133 @@ __BEGIN_DECLS
 */
 int iso_reset(void);
 
+/** \brief  Default number of sectors in each of the block caches */
+#define FS_ISO9660_CACHE_BLOCKS 16
+
+/** \brief  Default number of sectors read ahead */
+#define FS_ISO9660_READAHEAD    8
+
+/** \brief  Resize the ISO9660 block caches.
+
+    The driver keeps two caches of recently read sectors, one for directories
+    and one for file data that isn't read in whole sectors straight into the
+    caller's buffer. Both are looked up by sector, so they can be made a lot
+    larger than the default without slowing lookups down, which pays off when
+    loading many small files: the directories to find them in and the
+    sectors they share stay in the cache rather than being read again.
+
+    When a cache misses on the sector right after the last one it read in,
+    it reads ahead of it, up to the end of the file or directory, in one
+    multi-sector read. This is capped to half the smaller cache.
+
+    Resizing empties the caches. It shouldn't be done while another thread
+    is using files on /cd.
+
+    \param  inode_blocks    Number of sectors in the directory cache.
+    \param  data_blocks     Number of sectors in the data cache.
+    \param  readahead       Most sectors to read at once when reading a file
+                            or directory through, or 1 not to read ahead.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if a cache
+                            size is 0, or ENOMEM if out of memory, in which
+                            case the caches are left as they were.
+*/
+int fs_iso9660_set_cache(size_t inode_blocks, size_t data_blocks,
+                         size_t readahead);
+
+/** \brief  Default number of paths kept in the path lookup cache */
+#define FS_ISO9660_DENTRIES     1024
+
+/** \brief  Set up the ISO9660 path lookup cache.
+
+    Paths that have been looked up are kept, along with where they are on the
+    disc, so that opening a file in a directory that has been seen before
+    doesn't go through the directories above it on the disc again, and opening
+    or checking the same file again doesn't read the disc at all. The cache is
+    emptied on a disc change, and stops taking new paths once full.
+
+    Optionally, the whole directory tree of the disc can be read into the
+    cache when it is first found, so that looking files up never waits on
+    the drive from then on. Opening many files at load time is then one pass
+    over the directories rather than a seek for each.
+
+    Each path takes about 32 bytes and the length of the path.
+
+    \param  max             The most paths to keep, or 0 to turn the cache
+                            off.
+    \param  prewarm         True to read the whole directory tree into the
+                            cache, now if a disc has already been found, and
+                            each time a new one is.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to ENOMEM, in which
+                            case the cache is left as it was.
+*/
+int fs_iso9660_set_dentry_cache(size_t max, bool prewarm);
+
+/** \brief  Start tracing reads from the disc.
+
+    Every read from a file opened while the trace is running is recorded, with
+    when it was made, where on the disc it was from, how much was read and the
+    path of the file. Files that are already open when the trace starts are
+    left out, so the trace is best started before anything is loaded.
+
+    The trace is meant for working out the order a program loads its files
+    in, so that they can be laid out on the disc in that order, see
+    fs_iso9660_trace_stop().
+
+    \param  max             The most reads to record. Each takes 24 bytes,
+                            and each file traced takes the length of its path.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if max is 0,
+                            EBUSY if a trace is already running, or ENOMEM if
+                            out of memory.
+*/
+int fs_iso9660_trace_start(size_t max);
+
+/** \brief  Stop tracing reads and write the trace out.
+
+    The trace is written as text, one read a line:
+
+        <microseconds since boot> <sector> <bytes> <path>
+
+    where the sector is the ISO9660 one the read started in, and the path is
+    the one the file was opened with, under /cd. With no file given, each line
+    is printed to the debug log with an "iso_trace: " prefix, so that it ends
+    up in the dcload console. The isosort utility turns either into a sort
+    file for mkisofs or genisoimage.
+
+    \param  fn              The file to write the trace to, such as one on
+                            /pc, or NULL to print it.
+    \return                 The number of reads in the trace, or -1 on failure
+                            with errno set to EINVAL if no trace is running,
+                            or as set by the file system for the trace file.
+                            The trace is dropped either way.
+*/
+ssize_t fs_iso9660_trace_stop(const char *fn);
+
+/* \cond */
+#define IOCTL_ISO9660_GET_LBA 0x49534f30 /* "ISO0" */
+/* \endcond */
+
+/** \brief  Get the first sector of an opened file.
+
+    Files are laid out on the disc in consecutive sectors, so this is all
+    that's needed to read one with the \ref gdrom functions directly, such as
+    to stream from it with cdrom_stream_start().
+
+    \param  fd              A file descriptor for a file (not a directory)
+                            on /cd.
+    \param  lba             Where to store the sector, as given to the
+                            \ref gdrom functions (so 150 past the ISO9660
+                            sector number).
+    \retval 0               On success.
+    \retval -1              On error, with errno set to EINVAL if the file
+                            descriptor isn't that of a file on /cd.
+*/
+static inline int fs_iso9660_get_lba(file_t fd, uint32_t *lba) {
+    return fs_ioctl(fd, IOCTL_ISO9660_GET_LBA, lba);
+}
+
 /* \cond */
 void fs_iso9660_init(void);
 void fs_iso9660_shutdown(void);
@@ -35,6 +35,7 @@
 #include <kos/cdefs.h>
 __BEGIN_DECLS
 
+#include <stddef.h>
 #include <stdint.h>
 #include <arch/irq.h>
 
@@ -360,6 +361,113 @@ void g2_write_block_32(const uint32_t * input, uintptr_t address, size_t amt);
 */
 void g2_memset_8(uintptr_t address, uint8_t c, size_t amt);
 
+/** \brief  Default bound of IRQ-off stretches of the block functions.
+
+    \see    g2_set_irq_window()
+*/
+#define G2_IRQ_WINDOW_DEFAULT   256
+
+/** \brief  Bound how long the block functions keep IRQs disabled.
+
+    The block functions above keep IRQs and G2 DMA off while they access G2,
+    but only for up to this many bytes at a time, letting interrupts in between
+    stretches. This bounds the IRQ latency they add for long transfers.
+
+    \param  bytes           The most bytes moved at a time, or 0 to do each
+                            block in one go.
+*/
+void g2_set_irq_window(size_t bytes);
+
+/** \brief  Smallest transfer g2_*_block_32_dma() use DMA for. */
+#define G2_DMA_THRESHOLD        256
+
+/** \brief  Read a block of dwords from G2, by DMA if worth it.
+
+    This works like g2_read_block_32(), but the bulk of the block is moved by
+    G2 DMA on the given channel when it has at least \ref G2_DMA_THRESHOLD
+    bytes, both addresses are 32-byte aligned, and it's not called from an
+    interrupt. Otherwise, or if the channel is busy, it falls back to PIO.
+    The function blocks until the block has been read.
+
+    \param  output          Pointer in system memory to write to.
+    \param  address         The address in G2-space to read from.
+    \param  amt             The number of dwords to read.
+    \param  g2chn           The G2 DMA channel to use.
+*/
+void g2_read_block_32_dma(uint32_t * output, uintptr_t address, size_t amt,
+                          uint32_t g2chn);
+
+/** \brief  Write a block of dwords to G2, by DMA if worth it.
+
+    This works like g2_write_block_32(), but the bulk of the block is moved
+    by G2 DMA on the given channel under the same conditions as
+    g2_read_block_32_dma().
+
+    \param  input           The pointer in system memory to read from.
+    \param  address         The address in G2-space to write to.
+    \param  amt             The number of dwords to write.
+    \param  g2chn           The G2 DMA channel to use.
+*/
+void g2_write_block_32_dma(const uint32_t * input, uintptr_t address,
+                           size_t amt, uint32_t g2chn);
+
+/** \brief  Most writes a G2 batch holds before it's flushed by itself. */
+#define G2_BATCH_MAX            32
+
+/** \brief  A batch of G2 register writes.
+
+    Writes queued up in a batch are done together by g2_batch_flush(), under
+    one lock (or as few as the IRQ window allows) instead of one each, and
+    with the FIFO only waited on once for each 8 of them. Initialize it with
+    \ref G2_BATCH_INITIALIZER or by zeroing it.
+*/
+typedef struct g2_batch {
+    size_t      count;                  /**< \brief Writes queued */
+    uintptr_t   addr[G2_BATCH_MAX];     /**< \brief Where to write */
+    uint32_t    value[G2_BATCH_MAX];    /**< \brief What to write */
+    uint8_t     size[G2_BATCH_MAX];     /**< \brief Size of each write */
+} g2_batch_t;
+
+/** \brief  Initializer for an empty G2 batch. */
+#define G2_BATCH_INITIALIZER    { 0 }
+
+/** \brief  Queue a byte write to G2 in a batch.
+
+    If the batch is full, it is flushed first.
+
+    \param  batch           The batch to queue it in.
+    \param  address         The address in memory to write.
+    \param  value           The value to write to that address.
+*/
+void g2_batch_write_8(g2_batch_t *batch, uintptr_t address, uint8_t value);
+
+/** \brief  Queue a word write to G2 in a batch.
+
+    \param  batch           The batch to queue it in.
+    \param  address         The address in memory to write.
+    \param  value           The value to write to that address.
+    \see    g2_batch_write_8()
+*/
+void g2_batch_write_16(g2_batch_t *batch, uintptr_t address, uint16_t value);
+
+/** \brief  Queue a dword write to G2 in a batch.
+
+    \param  batch           The batch to queue it in.
+    \param  address         The address in memory to write.
+    \param  value           The value to write to that address.
+    \see    g2_batch_write_8()
+*/
+void g2_batch_write_32(g2_batch_t *batch, uintptr_t address, uint32_t value);
+
+/** \brief  Do the writes queued in a batch.
+
+    The writes are done in the order they were queued, and the batch is left
+    empty.
+
+    \param  batch           The batch to flush.
+*/
+void g2_batch_flush(g2_batch_t *batch);
+
 /** \brief  Wait for the G2 write FIFO to empty.
 
     This function will spinwait until the G2 FIFO indicates that it has been
@@ -377,6 +377,13 @@ typedef struct maple_driver {
         \return             0 on success, <0 on error.
     */
     void (*user_detach)(maple_device_t *dev);
+
+    /** \brief  Also call periodic in the extra rounds of maple_poll_rounds().
+
+        Drivers that count time in frames, like the keyboard's key repeat,
+        leave this false so they're still polled once per frame.
+    */
+    bool        poll_midframe;
 } maple_driver_t;
 
 /** \brief   Maple state structure.
@@ -426,6 +433,21 @@ typedef struct maple_state_str {
 
     /** \brief  The vertical position of the lightgun signal. */
     int                         gun_y;
+
+    /** \brief  Extra polling rounds to run each frame, see maple_poll_rounds() */
+    int                         poll_rounds;
+
+    /** \brief  Extra polling rounds still to run this frame */
+    volatile int                poll_left;
+
+    /** \brief  When the last vblank came, in nanoseconds */
+    uint64_t                    vbl_ns;
+
+    /** \brief  How long the last frame was, in nanoseconds */
+    uint64_t                    frame_ns;
+
+    /** \brief  Start another DMA when this one is done, see maple_queue_kick() */
+    volatile int                dma_kick;
 } maple_state_t;
 
 /** \brief   Maple DMA buffer size.
@@ -637,6 +659,18 @@ void maple_sentinel_verify(const char * bufname, void * buffer, int bufsize);
  */
 void maple_queue_flush(void);
 
+/** \brief   Send queued frames without waiting for the next vblank.
+    \ingroup maple
+
+    Frames are normally sent once per frame, from the vblank interrupt. This
+    asks for whatever is queued to go out as soon as the bus is free: right
+    away if no DMA is running, or else as soon as the one running finishes.
+    It is meant for drivers moving a lot of data in many small frames, like
+    the Dreameye's image transfers, and is safe to call inside an interrupt
+    (including a frame callback).
+*/
+void maple_queue_kick(void);
+
 /** \brief   Submit a frame for queueing.
     \ingroup maple
 
@@ -685,6 +719,39 @@ int maple_frame_lock(maple_frame_t *frame);
  */
 void maple_frame_unlock(maple_frame_t *frame);
 
+/** \brief   Number of frames in the shared frame pool.
+    \ingroup maple
+*/
+#define MAPLE_FRAME_POOL_SIZE   8
+
+/** \brief   Get a frame from the shared frame pool.
+    \ingroup maple
+
+    Each device has a frame of its own, but only one command can be in flight
+    on it at a time. This hands out one of a few spare frames, already locked
+    and initialized, so a driver can queue a second command (a rumble, say)
+    without waiting for the first. It is safe to call inside an interrupt.
+
+    Fill it in and queue it as usual. Unlocking it with maple_frame_unlock()
+    once its response has come in returns it to the pool.
+
+    \return                 The frame, or NULL with errno set to EAGAIN if
+                            all of them are in use.
+
+    \sa maple_frame_release
+*/
+maple_frame_t *maple_frame_alloc(void);
+
+/** \brief   Return a frame that was never queued.
+    \ingroup maple
+
+    This gives back a frame from maple_frame_alloc() (or one locked with
+    maple_frame_lock()) that ends up not being sent after all.
+
+    \param  frame           The frame to release.
+*/
+void maple_frame_release(maple_frame_t *frame);
+
 /**************************************************************************/
 /* maple_driver.c */
 
@@ -797,6 +864,33 @@ void maple_vbl_irq_hnd(uint32 code, void *data);
 */
 void maple_dma_irq_hnd(uint32 code, void *data);
 
+/** \brief   Poll devices more than once a frame.
+    \ingroup maple
+
+    Normally devices are polled once per frame, in the vblank interrupt, so
+    the state read from a controller can be up to a frame old before the
+    game even starts drawing. This uses TMU1 to run further polling rounds,
+    spread evenly through each frame, for the drivers that set
+    maple_driver_t::poll_midframe (the controller does). Each round is one
+    more maple DMA, so this costs a little bus time.
+
+    \param  rounds          How many extra rounds to run each frame, 0 to go
+                            back to polling only on vblank.
+
+    \retval 0               On success.
+    \retval -1              On error, errno will be set as appropriate.
+
+    \par   Error Conditions:
+    \em    EINVAL - rounds was more than \ref MAPLE_POLL_ROUNDS_MAX \n
+    \em    EBUSY - something else has claimed TMU1
+*/
+int maple_poll_rounds(unsigned int rounds);
+
+/** \brief   Most extra polling rounds maple_poll_rounds() will run a frame.
+    \ingroup maple
+*/
+#define MAPLE_POLL_ROUNDS_MAX   7
+
 /**************************************************************************/
 /* maple_enum.c */
 
@@ -175,6 +175,9 @@ typedef struct cont_state {
     int joyy;     /**< \brief Main joystick y-axis value. */
     int joy2x;    /**< \brief Secondary joystick x-axis value. */
     int joy2y;    /**< \brief Secondary joystick y-axis value. */
+
+    /** \brief  When this state came in, on the timer_ns_gettime64() clock. */
+    uint64_t timestamp;
 } cont_state_t;
 
 /** \brief   Controller automatic callback type.
@@ -218,6 +221,125 @@ typedef void (*cont_btn_callback_t)(uint8_t addr, uint32_t btns);
 */
 int cont_btn_callback(uint8_t addr, uint32_t btns, cont_btn_callback_t cb);
 
+/** \brief   Get a controller's latest state, if it's newer than a given time.
+    \ingroup controller_inputs
+
+    This copies out the whole state at once, so it can't be torn by an update
+    coming in halfway through. Along with maple_poll_rounds(), it lets a game
+    read input as late as it can before using it, and tell whether anything
+    has arrived since it last looked.
+
+    \param  cont            The controller to read.
+    \param  since           A time on the timer_ns_gettime64() clock, such
+                            as the timestamp of the last state read.
+    \param  state           Where to copy the state.
+
+    \retval 1               The state is newer than since.
+    \retval 0               No state has come in since then. state is still
+                            filled in with the latest one.
+    \retval -1              On error, errno will be set as appropriate.
+
+    \par   Error Conditions:
+    \em    EINVAL - cont is not a valid controller \n
+    \em    EAGAIN - no state has come in from the controller yet
+*/
+int cont_get_state_since(maple_device_t *cont, uint64_t since,
+                         cont_state_t *state);
+
+/** \defgroup controller_events Input Events
+    \brief    Queued button and analog changes
+    \ingroup  controller_inputs
+
+    Polling a controller's state only tells you how it looks at the time you
+    poll it, so a press that starts and ends between two polls is never seen.
+    Every time a new state comes in, the controller driver compares it with
+    the last one and queues an event for each button that was pressed or
+    released and for each trigger or stick axis that crossed
+    \ref CONT_EVENT_THRESHOLD, stamped with when the state came in.
+
+    Each controller has its own queue, read with cont_event_pop(), and all of
+    them feed one shared queue as well, read with cont_event_get(), much like
+    the keyboard's kbd_queue_pop() and kbd_get_key(). Each queue must only be
+    read from one thread at a time. If a queue fills up, new events are
+    dropped until it is read.
+
+    @{
+*/
+
+/** \brief   Size of each controller event queue.
+
+    \note   This <strong>MUST</strong> be a power of two.
+*/
+#define CONT_EVENT_QUEUE_SIZE   32
+
+/** \brief   How far from rest an axis must go to count as pushed.
+
+    Triggers count from 0 and sticks from the center either way.
+*/
+#define CONT_EVENT_THRESHOLD    64
+
+/** \brief   Types of controller events. */
+typedef enum cont_event_type {
+    CONT_EVENT_PRESS,       /**< \brief A button was pressed */
+    CONT_EVENT_RELEASE,     /**< \brief A button was released */
+    CONT_EVENT_AXIS         /**< \brief An axis crossed the threshold */
+} cont_event_type_t;
+
+/** \brief   Analog axes, as found in cont_event_t::input. */
+typedef enum cont_axis {
+    CONT_AXIS_LTRIG,        /**< \brief Left trigger */
+    CONT_AXIS_RTRIG,        /**< \brief Right trigger */
+    CONT_AXIS_JOYX,         /**< \brief Main joystick x-axis */
+    CONT_AXIS_JOYY,         /**< \brief Main joystick y-axis */
+    CONT_AXIS_JOY2X,        /**< \brief Secondary joystick x-axis */
+    CONT_AXIS_JOY2Y,        /**< \brief Secondary joystick y-axis */
+    CONT_AXIS_COUNT         /**< \brief Number of axes */
+} cont_axis_t;
+
+/** \brief   A queued controller event. */
+typedef struct cont_event {
+    /** \brief  When the state with this change came in, on the
+                timer_ns_gettime64() clock. */
+    uint64_t timestamp;
+
+    cont_event_type_t type; /**< \brief What happened */
+
+    /** \brief  The button (one of the \ref controller_input_masks) for a
+                press or release, or the \ref cont_axis_t for an axis. */
+    uint32_t input;
+
+    /** \brief  For an axis, the side of the threshold it's now on: -1, 0
+                or 1. Triggers are only ever 0 or 1. */
+    int zone;
+
+    int value;              /**< \brief For an axis, its new value */
+
+    uint8_t addr;           /**< \brief The controller's maple_addr() */
+} cont_event_t;
+
+/** \brief   Take the oldest event off one controller's queue.
+
+    \param  cont            The controller to read.
+    \param  event           Where to copy the event.
+
+    \retval 1               An event was popped.
+    \retval 0               The queue is empty.
+    \retval -1              If cont isn't a valid controller, errno will be
+                            set to EINVAL.
+*/
+int cont_event_pop(maple_device_t *cont, cont_event_t *event);
+
+/** \brief   Take the oldest event off the queue shared by all controllers.
+
+    \param  event           Where to copy the event.
+
+    \retval 1               An event was popped.
+    \retval 0               The queue is empty.
+*/
+int cont_event_get(cont_event_t *event);
+
+/** @} */
+
 /** \defgroup controller_query_caps Querying Capabilities
     \brief    API used to query for a controller's capabilities
     \ingroup  controller
@@ -162,6 +162,52 @@ int dreameye_erase_image(maple_device_t *dev, uint8 image, int block);
 
 /* \cond */
 /* Init / Shutdown */
+/** \brief  Streaming capture frame callback type.
+
+    Functions of this type are handed each image a streaming capture
+    fetches. They run in a worker thread of their own, so this is the place
+    to decode the image. The next image is fetched into another buffer in
+    the meantime.
+
+    \param  dev             The Dreameye the image came from.
+    \param  data            The image data. It is only valid until the
+                            callback returns.
+    \param  size            The size of the image, in bytes.
+    \param  user            The pointer passed to dreameye_stream_start().
+*/
+typedef void (*dreameye_frame_callback_t)(maple_device_t *dev, uint8 *data,
+                                          int size, void *user);
+
+/** \brief  Start fetching an image from the Dreameye over and over.
+
+    This starts a thread that fetches the given image from the Dreameye again
+    and again, into two buffers in turn, and hands each one to the callback
+    as it arrives. The callback gets one buffer while the next image comes
+    into the other; if it's still busy when that's done, fetching waits.
+
+    Image pieces are asked for in every maple DMA round rather than once a
+    frame, as they also are for dreameye_get_image(). Only one capture can
+    run at a time, and dreameye_get_image() can't be used while it is.
+
+    \param  dev             The device to fetch from (unit 1 of the Dreameye).
+    \param  image           The image number to fetch.
+    \param  cb              The function to hand each image to.
+    \param  user            A pointer to pass to the callback.
+    \retval MAPLE_EOK       On success.
+    \retval MAPLE_EINVALID  If dev isn't unit 1 of a Dreameye, or cb is NULL.
+    \retval MAPLE_EAGAIN    If an image is already being fetched.
+    \retval MAPLE_EFAIL     If the threads couldn't be created.
+*/
+int dreameye_stream_start(maple_device_t *dev, uint8 image,
+                          dreameye_frame_callback_t cb, void *user);
+
+/** \brief  Stop a streaming capture.
+
+    This waits for the image being fetched, and for the callback, to finish.
+    It does nothing if no capture is running.
+*/
+void dreameye_stream_stop(void);
+
 void dreameye_init(void);
 void dreameye_shutdown(void);
 /* \endcond */
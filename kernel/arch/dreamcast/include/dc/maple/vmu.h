@@ -33,6 +33,7 @@ __BEGIN_DECLS
 #include <dc/maple.h>
 #include <kos/regfield.h>
 
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
@@ -248,6 +249,11 @@ int vmu_get_icon_shape(maple_device_t *dev, uint8_t *icon_shape);
     This function sends a raw bitmap to a VMU to display on its screen. This
     bitmap is 1bpp, and is 48x32 in size.
 
+    The bitmap is queued and this returns right away. If it's the same as the
+    image last sent, nothing is sent at all. Only one image is in flight to
+    each VMU at a time; one drawn while another is on its way is kept, and
+    sent when that one is done, replacing any other that was waiting.
+
     \param  dev             The device to draw to.
     \param  bitmap          The bitmap to show.
 
@@ -372,6 +378,28 @@ int vmu_block_read(maple_device_t *dev, uint16_t blocknum, uint8_t *buffer);
 */
 int vmu_block_write(maple_device_t *dev, uint16_t blocknum, const uint8_t *buffer);
 
+/** \brief   Write several blocks to a memory card.
+    \ingroup maple_memcard
+
+    This function writes a number of blocks as vmu_block_write() would, but
+    sends the frames for a few blocks at a time together, instead of waiting
+    for each one to be answered before sending the next. That makes it several
+    times quicker than writing the blocks one by one.
+
+    \param  dev             The device to write to.
+    \param  blocks          The block numbers to write, in order.
+    \param  count           The number of blocks to write.
+    \param  buffer          The buffer to write from (512 bytes per block).
+
+    \retval MAPLE_EOK       On success.
+    \retval MAPLE_ETIMEOUT  If the command timed out while blocking.
+    \retval MAPLE_EFAIL     On errors other than timeout.
+
+    \sa vmu_block_write
+*/
+int vmu_block_write_multi(maple_device_t *dev, const uint16_t *blocks,
+                          size_t count, const uint8_t *buffer);
+
 /** \defgroup maple_clock Clock Function
     \brief    API for features of the Clock Maple Function
     \ingroup  vmu
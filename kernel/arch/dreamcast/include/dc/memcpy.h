@@ -0,0 +1,71 @@
+/* KallistiOS ##version##
+
+   dc/memcpy.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    dc/memcpy.h
+    \brief   A memcpy() that picks its method by where it is copying to.
+    \ingroup fast_memcpy
+
+    This file contains fast_memcpy(), which is what memcpy(), memcpy2() and
+    memcpy4() use on the Dreamcast.
+*/
+
+#ifndef __DC_MEMCPY_H
+#define __DC_MEMCPY_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+
+/** \defgroup fast_memcpy Fast memcpy
+    \brief                Block copies tuned to the destination
+    \ingroup              store_queues
+
+    How best to copy a block depends on where it is going:
+
+    - Into cacheable main RAM, each 32-byte line of the destination is
+      allocated in the cache with movca.l, so it is never read from RAM only
+      to be overwritten, and then filled with pairs of fmov.d from the
+      source, which is prefetched a line ahead.
+    - Into VRAM, or main RAM through the uncached P2 area, the store queues
+      write whole 32-byte bursts.
+    - Anything else, including sound RAM (use spu_memload_sq() there, which
+      holds the G2 bus for the bursts), and anything shorter than \ref FAST_MEMCPY_THRESHOLD
+      bytes, is copied a word at a time where the source and destination
+      allow it and a byte at a time where they don't.
+
+    Either way, misaligned heads and tails are handled, and aligned words
+    and halfwords are copied with accesses of that size, so fast_memcpy() is
+    still safe for registers that want 16- or 32-bit accesses, as memcpy2()
+    and memcpy4() used to be.
+
+    The store queues are not used from inside an interrupt, as they have to
+    be locked, nor is main RAM given the cache treatment with the MMU on or
+    with the cache in write-through mode.
+
+    @{
+*/
+
+/** \brief   Copies shorter than this always take the plain path. */
+#define FAST_MEMCPY_THRESHOLD   64
+
+/** \brief   Copy a block of memory.
+
+    The same as memcpy(), which calls it.
+
+    \param  dest            The address to copy to.
+    \param  src             The address to copy from. This must not overlap
+                            dest.
+    \param  n               The number of bytes to copy.
+    \return                 dest
+*/
+void *fast_memcpy(void *__RESTRICT dest, const void *__RESTRICT src, size_t n);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_MEMCPY_H */
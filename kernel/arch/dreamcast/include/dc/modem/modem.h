@@ -283,6 +283,27 @@ unsigned long modem_get_connection_rate(void);
 */
 int modem_read_data(unsigned char *data, int size);
 
+/** \brief   Look at the data in the modem's receive buffer without copying it.
+    \ingroup modem
+
+    This returns a pointer into the receive buffer itself. The data stays put
+    until it is released with modem_read_consume(), so the pointer is good
+    until then. Data that wraps around the end of the buffer is returned by
+    the next call, once this part has been consumed.
+
+    \param  size            Set to the number of bytes at the pointer.
+    \return                 A pointer to the data, or NULL if there is none.
+*/
+const unsigned char *modem_read_peek(int *size);
+
+/** \brief   Release data looked at with modem_read_peek().
+    \ingroup modem
+
+    \param  size            The number of bytes that were used. This may be
+                            less than modem_read_peek() returned.
+*/
+void modem_read_consume(int size);
+
 /** \brief   Write data to the modem buffers.
     \ingroup modem
 
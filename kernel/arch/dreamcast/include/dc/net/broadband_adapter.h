@@ -307,6 +307,54 @@ typedef void (*eth_rx_callback_t)(uint8 *pkt, int len);
 */
 void bba_set_rx_callback(eth_rx_callback_t cb);
 
+/** \brief   Set the size above which packets are received by DMA.
+
+    Received packets are copied out of the BBA's memory with G2 DMA when they
+    are larger than this, which leaves the CPU free while the copy happens.
+    Smaller ones are read directly by the CPU, since setting up the DMA would
+    take about as long. The default is 128 bytes.
+
+    \param  bytes           The threshold, in bytes, or -1 to always read
+                            packets with the CPU.
+*/
+void bba_set_dma_threshold(int bytes);
+
+/** \brief   Set how busy reception gets before switching to polling.
+
+    Each received packet normally raises an interrupt and wakes up the receive
+    thread. Once this many receive interrupts come within 10 milliseconds, the
+    receive interrupts are masked and the receive thread polls the BBA instead,
+    handling packets in batches and leaving room for the rest of the system to
+    run in between, until it finds nothing more to receive. The default is 16.
+
+    \param  irqs            The threshold, or -1 to never poll.
+*/
+void bba_set_poll_threshold(int irqs);
+
+/** \brief   BBA receive statistics.
+
+    \headerfile dc/net/broadband_adapter.h
+*/
+typedef struct bba_rx_stats {
+    uint32 pkts;        /**< \brief Packets received */
+    uint32 dma_pkts;    /**< \brief Packets received by DMA */
+    uint32 dropped;     /**< \brief Packets dropped for lack of buffers */
+    uint64 bytes;       /**< \brief Bytes received */
+    uint64 cycles;      /**< \brief CPU cycles spent copying packets out */
+    uint32 polls;       /**< \brief Times reception switched to polling */
+} bba_rx_stats_t;
+
+/** \brief   Retrieve the BBA receive statistics.
+
+    The cycles are counted with the performance counter used by
+    perf_cntr_timer_ns(), so they only mean something while that timer is
+    enabled (which it is by default). Dividing them by the number of packets
+    gives the receive cost per packet.
+
+    \param  stats           Where to store the statistics.
+*/
+void bba_get_rx_stats(bba_rx_stats_t *stats);
+
 /** @} */
 
 /** \defgroup bba_tx TX
@@ -22,6 +22,7 @@
 __BEGIN_DECLS
 
 #include <dc/perfctr.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -34,29 +35,63 @@ __BEGIN_DECLS
     With this API, programs can set probe points in different functional blocks
     and later obtain statistics about the execution of said functional blocks.
 
+    Probe points may nest. Each one gets both its inclusive figures (the whole
+    block, probes inside it included) and its exclusive ones (minus the time
+    and events of the probes that ran inside it), and its calls and time are
+    also broken down by the thread that ran it. Probes nest per thread, but
+    time is wall-clock time, so a block that gets preempted is also charged
+    for whatever ran meanwhile.
+
+    The SH4 has only two counters. To get more than two events out of a
+    single run, start the monitor with perf_monitor_init_mux() and call
+    perf_monitor_frame() once per frame: each frame, the next two events of
+    the list are counted, and the figures for each are averaged over the
+    calls made while it was being counted.
+
     @{
 */
 
 /** /cond */
+#define PERF_MONITOR_MUX_MAX    8
+
+struct perf_monitor_thread;
+
+struct perf_monitor_event {
+    uint64_t total, self;
+    uint64_t calls;
+};
+
 struct perf_monitor {
     const char *fn;
     unsigned int line;
     uint64_t calls;
-    uint64_t time_ns, time_start;
-    uint64_t event0, event0_start;
-    uint64_t event1, event1_start;
+    uint64_t time_ns, self_ns;
+    uint64_t event0, self_event0;
+    uint64_t event1, self_event1;
+    struct perf_monitor_event mux[PERF_MONITOR_MUX_MAX];
+    struct perf_monitor_thread *threads;
+};
+
+struct perf_monitor_scope {
+    struct perf_monitor *monitor;
+    struct perf_monitor_scope *parent;
+    unsigned int gen;
+    uint64_t time_start, event0_start, event1_start;
+    uint64_t child_ns, child_event0, child_event1;
 };
 
-void __stop_perf_monitor(struct perf_monitor **monitor);
+void __stop_perf_monitor(struct perf_monitor_scope **scope);
 
-struct perf_monitor *__start_perf_monitor(struct perf_monitor *monitor);
+struct perf_monitor_scope *__start_perf_monitor(struct perf_monitor_scope *scope,
+                                                struct perf_monitor *monitor);
 
 #define __perf_monitor(f, l) \
     static struct perf_monitor __perf_monitor_##l \
         __attribute__((section(".monitors"))) = { f, l, }; \
-    struct perf_monitor *___perf_monitor_##l \
+    struct perf_monitor_scope ___perf_monitor_scope_##l; \
+    struct perf_monitor_scope *___perf_monitor_##l \
         __attribute__((cleanup(__stop_perf_monitor))) = \
-        __start_perf_monitor(&__perf_monitor_##l)
+        __start_perf_monitor(&___perf_monitor_scope_##l, &__perf_monitor_##l)
 
 #define _perf_monitor(f, l) __perf_monitor(f, l)
 
@@ -102,6 +137,40 @@ struct perf_monitor *__start_perf_monitor(struct perf_monitor *monitor);
 */
 void perf_monitor_init(perf_cntr_event_t event1, perf_cntr_event_t event2);
 
+/** \brief  Initialize the performance monitor system, multiplexing events
+
+    Like perf_monitor_init(), but with a list of events that are counted two
+    at a time, moving on to the next two each time perf_monitor_frame() is
+    called. For instance:
+
+    \code
+    static const perf_cntr_event_t events[] = {
+        PMCR_OPERAND_CACHE_MISS_MODE,
+        PMCR_INSTRUCTION_CACHE_MISS_MODE,
+        PMCR_UTLB_MISS_MODE,
+        PMCR_PIPELINE_FREEZE_BY_DCACHE_MISS_MODE,
+    };
+
+    perf_monitor_init_mux(events, 4);
+    \endcode
+
+    \param  events          The events to count.
+    \param  count           How many there are, at most 8.
+    \retval 0               On success.
+    \retval -1              If count is 0 or more than 8, with errno set to
+                            EINVAL.
+*/
+int perf_monitor_init_mux(const perf_cntr_event_t *events, size_t count);
+
+/** \brief  Move on to the next events
+
+    With perf_monitor_init_mux(), this switches the counters over to the next
+    two events of the list. Call it once per frame, outside of any probe
+    point: probe points that are running while it is called don't count the
+    events for that call. Does nothing with perf_monitor_init().
+*/
+void perf_monitor_frame(void);
+
 /** \brief  De-initialize the performance monitor system
 
     After this function is called, the performance counter API can be
@@ -0,0 +1,125 @@
+/* KallistiOS ##version##
+
+   dc/profiler.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    dc/profiler.h
+    \brief   Statistical sampling profiler.
+    \ingroup profiler
+
+    This file contains a profiler that samples where the CPU is from a timer
+    interrupt, so that code can be profiled without being changed.
+*/
+
+#ifndef __DC_PROFILER_H
+#define __DC_PROFILER_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** \defgroup profiler Sampling profiler
+    \brief             Find out where the time goes without probe points
+    \ingroup           debugging
+
+    Once started, TMU1 interrupts the CPU at a fixed rate, and each time the
+    program counter and return address (PR) of whatever was running, and the
+    thread it was running in, are counted in a hash table. Time spent in
+    other interrupt handlers is not seen, as they run with interrupts off.
+
+    The results can be written out as a flat profile, with the addresses
+    that took the most samples first, or as collapsed stacks of the form
+    "thread;caller;callee count", which is what flamegraph.pl reads. The
+    stacks are only two deep, since that is all the interrupted context
+    tells. Addresses are written out raw, with the nearest exported kernel
+    symbol as a hint in the flat profile. To name them properly, run the
+    output through utils/profsym with the ELF file.
+
+    Writing to a path under /pc sends the results back through dcload.
+
+    The profiler shares TMU1 with maple_poll_rounds(), so only one of the two
+    can be used at a time.
+
+    @{
+*/
+
+/** \brief   Default sampling rate, in Hz. */
+#define PROFILER_DEFAULT_HZ         1000
+
+/** \brief   Default number of distinct samples the table can hold. */
+#define PROFILER_DEFAULT_ENTRIES    4096
+
+/** \brief   Output formats for profiler_print(). */
+typedef enum profiler_format {
+    PROFILER_FLAT,                  /**< \brief Hottest addresses first */
+    PROFILER_COLLAPSED              /**< \brief Collapsed stacks */
+} profiler_format_t;
+
+/** \brief   Start the profiler.
+
+    Any samples from an earlier run are thrown away.
+
+    \param  hz              How many samples to take a second, or 0 for
+                            \ref PROFILER_DEFAULT_HZ.
+    \param  entries         How many distinct (PC, PR, thread) samples to
+                            make room for, or 0 for
+                            \ref PROFILER_DEFAULT_ENTRIES. Rounded up to a
+                            power of two. Samples that don't fit are counted
+                            as dropped.
+    \retval 0               On success.
+    \retval -1              On error, setting errno as appropriate.
+
+    \par    Error Conditions:
+    \em     EALREADY - the profiler is running already \n
+    \em     EBUSY - something else has claimed TMU1 \n
+    \em     ENOMEM - the table could not be allocated
+*/
+int profiler_start(unsigned int hz, size_t entries);
+
+/** \brief   Stop the profiler.
+
+    The samples are kept for profiler_print() and profiler_dump().
+
+    \retval 0               On success.
+    \retval -1              If the profiler was not running, with errno set
+                            to EINVAL.
+*/
+int profiler_stop(void);
+
+/** \brief   Write out the samples.
+
+    This may be called while the profiler is running, though the samples
+    it takes meanwhile will include the time spent printing.
+
+    \param  f               Where to write them.
+    \param  fmt             How to write them.
+*/
+void profiler_print(FILE *f, profiler_format_t fmt);
+
+/** \brief   Write out the samples to a file.
+
+    \param  path            The file to write, for instance "/pc/prof.txt".
+    \param  fmt             How to write them.
+    \retval 0               On success.
+    \retval -1              If the file couldn't be opened, with errno set
+                            by fopen().
+*/
+int profiler_dump(const char *path, profiler_format_t fmt);
+
+/** \brief   Get the number of samples taken.
+
+    \param  dropped         If not NULL, set to the number of samples there
+                            was no room for in the table.
+    \return                 The number of samples in the table.
+*/
+uint32_t profiler_samples(uint32_t *dropped);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_PROFILER_H */
@@ -46,6 +46,7 @@ __BEGIN_DECLS
 #include <arch/types.h>
 #include <arch/cache.h>
 #include <dc/sq.h>
+#include <kos/arena.h>
 #include <kos/img.h>
 #include <kos/regfield.h>
 
@@ -53,6 +54,7 @@ __BEGIN_DECLS
     at the bottom of the file to be able to use types defined throughout. */
 
 #include "pvr/pvr_mem.h"
+#include "pvr/pvr_vram.h"
 #include "pvr/pvr_header.h"
 
 /** \defgroup pvr   PowerVR API
@@ -1042,6 +1044,28 @@ typedef struct {
         but it allows using much smaller vertex buffers. */
     int     vbuf_doublebuf_disabled;
 
+    /** \brief  Enable vertex buffer triple-buffering.
+
+        Use three sets of vertex buffers, object pointer buffers and tile
+        matrices instead of two. Once the Tile Accelerator is done with a
+        frame, that frame can then wait for its turn to be rendered while the
+        next frame is already being submitted, so the CPU doesn't have to wait
+        for the previous render to finish and the view to be flipped before
+        starting a new frame. This costs the video memory of one more set of
+        buffers. Ignored if vbuf_doublebuf_disabled is set. */
+    int     vbuf_triplebuf_enabled;
+
+    /** \brief  Enable automatic buffer resizing.
+
+        When a scene overflows the vertex buffer or the object pointer buffers
+        (which makes geometry disappear), grow them at the next call to
+        pvr_scene_begin(). Buffers live in video memory below textures, so
+        this only happens while no texture memory is allocated (after
+        pvr_mem_reset(), for instance, or before loading the textures of a
+        level); the overflow is only counted in the stats otherwise. See
+        pvr_stats_t for the high-water marks to size buffers with instead. */
+    int     buf_autosize_enabled;
+
 } pvr_init_params_t;
 
 /** \brief   Initialize the PVR chip to ready status.
@@ -1201,6 +1225,18 @@ void pvr_vertbuf_written(pvr_list_t list, size_t amt);
 */
 void pvr_scene_begin(void);
 
+/** \brief   Set an arena to be reset at the start of every frame.
+    \ingroup pvr_scene_mgmt
+
+    Once set, the arena is reset by every call to pvr_scene_begin() (or
+    pvr_scene_begin_txr()), so it can hold whatever per-frame data the program
+    builds up for the scene (vertex lists, sorted display lists, etc) without
+    having to malloc() and free() it every frame.
+
+    \param  arena           The arena to reset, or NULL to stop resetting one.
+*/
+void pvr_set_frame_arena(arena_t *arena);
+
 /** \brief   Begin collecting data for a frame of 3D output to the specified
              texture.
     \ingroup pvr_scene_mgmt
@@ -1217,6 +1253,33 @@ void pvr_scene_begin(void);
 */
 void pvr_scene_begin_txr(pvr_ptr_t txr, uint32_t *rx, uint32_t *ry);
 
+/** \brief   Begin collecting data for a frame of 3D output to a rectangle of
+             the specified texture.
+    \ingroup pvr_scene_mgmt
+
+    This function works like pvr_scene_begin_txr(), but the PVR only renders
+    the tiles covering the given rectangle, and nothing is written outside of
+    it. Small render targets (shadow maps, reflections, impostors...) then
+    only cost as much as the tiles they use. Coordinates are the same in the
+    scene and in the texture, so the scene must be drawn within the rectangle.
+
+    Consecutive passes over the same rectangle reuse the tile setup of the
+    previous one.
+
+    \param  txr             The texture to render to.
+    \param  width           Width of the texture buffer (in pixels).
+    \param  x               Left edge of the rectangle (in pixels).
+    \param  y               Top edge of the rectangle (in pixels).
+    \param  w               Width of the rectangle (in pixels).
+    \param  h               Height of the rectangle (in pixels).
+    \retval 0               On success.
+    \retval -1              If the rectangle is empty, doesn't fit in the
+                            texture width or goes past the screen size (errno
+                            set to EINVAL).
+*/
+int pvr_scene_begin_txr_rect(pvr_ptr_t txr, uint32_t width, uint32_t x,
+                             uint32_t y, uint32_t w, uint32_t h);
+
 
 /** \defgroup pvr_list_mgmt Polygon Lists
     \brief                  PVR API for managing list submission
@@ -1279,6 +1342,30 @@ int pvr_list_finish(void);
 */
 int pvr_prim(const void *data, size_t size);
 
+/** \brief   Enable or disable the polygon header cache.
+    \ingroup pvr_list_mgmt
+
+    With the cache enabled, pvr_prim() and pvr_list_prim() remember the last
+    polygon, sprite or modifier volume header sent to each list, and drop a
+    header that is the same as it instead of sending it again. To be seen by
+    the cache, a header has to be submitted on its own, in a call of exactly
+    32 bytes; anything else that starts with a header (a 64-byte header, or a
+    header followed by vertices) forgets the list's cached header. Data that
+    doesn't start with a header must not have one in it either.
+
+    Headers sent through Direct Rendering aren't seen by the cache, so it is
+    bypassed while Direct Rendering is in use, and forgets the open list's
+    header in pvr_dr_init().
+
+    The cache is disabled by default, and is emptied at the start of each
+    scene.
+
+    \param  enable          True to enable the cache.
+
+    \sa pvr_poly_compile_cached()
+*/
+void pvr_set_hdr_cache(bool enable);
+
 /** \defgroup pvr_direct  Direct Rendering
     \brief                API for using direct rendering with the PVR
     \ingroup              pvr_scene_mgmt
@@ -1327,6 +1414,141 @@ void pvr_dr_init(pvr_dr_state_t *vtx_buf_ptr);
 */
 void pvr_dr_finish(void);
 
+/** \brief  Index that ends a strip in pvr_dr_strip_indexed(). */
+#define PVR_DR_RESTART      0xffff
+
+/** \brief  Submit a whole strip with Direct Rendering.
+
+    Writes the vertices to the Store Queues back-to-back, alternating between
+    the two of them so that one is filled while the other one is flushed, and
+    prefetching the next vertex while doing so. This is quite a bit faster than
+    going through pvr_dr_target() and pvr_dr_commit() for every vertex.
+
+    The flags of the vertices are ignored: every vertex is sent as
+    \ref PVR_CMD_VERTEX, except the last one which ends the strip.
+
+    \param  vtx_buf_ptr     State variable for Direct Rendering, initialized
+                            previously in the scene with pvr_dr_init().
+    \param  vtx             The vertices of the strip, already transformed.
+    \param  count           The number of vertices.
+*/
+void pvr_dr_strip(pvr_dr_state_t *vtx_buf_ptr, const pvr_vertex_t *vtx,
+                  size_t count);
+
+/** \brief  Submit strips of indexed vertices with Direct Rendering.
+
+    Works like pvr_dr_strip(), except that the vertices are taken from vtx in
+    the order given by idx. An index of \ref PVR_DR_RESTART ends the current
+    strip and starts a new one, so that a whole mesh can be submitted at once.
+
+    \param  vtx_buf_ptr     State variable for Direct Rendering, initialized
+                            previously in the scene with pvr_dr_init().
+    \param  vtx             The vertices, already transformed.
+    \param  idx             The indices of the vertices of the strips.
+    \param  count           The number of indices.
+*/
+void pvr_dr_strip_indexed(pvr_dr_state_t *vtx_buf_ptr, const pvr_vertex_t *vtx,
+                          const uint16_t *idx, size_t count);
+
+/** \brief  Vertex in clip space, before the divide by W.
+
+    This is what pvr_dr_clip_strip() takes: the coordinates as they come out of
+    the transform, along with the attributes of \ref pvr_vertex_t.
+
+    \headerfile dc/pvr.h
+*/
+typedef struct pvr_clip_vertex {
+    alignas(32)
+    float x;                    /**< \brief X coordinate */
+    float y;                    /**< \brief Y coordinate */
+    float z;                    /**< \brief Z coordinate */
+    float w;                    /**< \brief W coordinate (depth) */
+    float u;                    /**< \brief Texture U coordinate */
+    float v;                    /**< \brief Texture V coordinate */
+    uint32_t argb;              /**< \brief Vertex color */
+    uint32_t oargb;             /**< \brief Vertex offset color */
+} pvr_clip_vertex_t;
+
+/** \brief  Clip a strip against the near plane and submit it with Direct
+            Rendering.
+
+    Triangles that cross the plane W = near_w are clipped against it, and
+    triangles entirely behind it are dropped, so the strip may go out to the TA
+    as several strips, each properly ended with \ref PVR_CMD_VERTEX_EOL. The
+    winding of every triangle is preserved. The vertices are then divided by W,
+    with 1/W as the Z value sent to the PVR, and written to the Store Queues as
+    \ref pvr_vertex_t.
+
+    \param  vtx_buf_ptr     State variable for Direct Rendering, initialized
+                            previously in the scene with pvr_dr_init().
+    \param  vtx             The vertices of the strip, in clip space.
+    \param  count           The number of vertices.
+    \param  near_w          The near plane, greater than zero.
+    \param  textured        False for Gouraud shaded vertices, whose texture
+                            coordinates are ignored and sent as zero.
+*/
+void pvr_dr_clip_strip(pvr_dr_state_t *vtx_buf_ptr,
+                       const pvr_clip_vertex_t *vtx, size_t count,
+                       float near_w, bool textured);
+
+/** \brief  Vertex attributes known to pvr_dr_transform_strip(). */
+typedef enum pvr_vtx_attr_type {
+    PVR_VTX_ATTR_POS,       /**< \brief Position, 3 floats (required) */
+    PVR_VTX_ATTR_UV,        /**< \brief Texture coordinates, 2 floats */
+    PVR_VTX_ATTR_ARGB,      /**< \brief Vertex color, packed 32-bit ARGB */
+    PVR_VTX_ATTR_OARGB      /**< \brief Offset color, packed 32-bit ARGB */
+} pvr_vtx_attr_type_t;
+
+/** \brief  Where to find one attribute in a source vertex.
+
+    \headerfile dc/pvr.h
+*/
+typedef struct pvr_vtx_attr {
+    pvr_vtx_attr_type_t type;   /**< \brief Which attribute this is */
+    size_t offset;              /**< \brief Offset in the vertex, in bytes */
+} pvr_vtx_attr_t;
+
+/** \brief  Layout of the source vertices of pvr_dr_transform_strip().
+
+    Attributes that are not described are zero (texture coordinates), or take
+    the default colors below.
+
+    \headerfile dc/pvr.h
+*/
+typedef struct pvr_vtx_fmt {
+    size_t stride;                  /**< \brief Bytes from a vertex to the next */
+    const pvr_vtx_attr_t *attrs;    /**< \brief The attributes of a vertex */
+    size_t attr_count;              /**< \brief The number of attributes */
+    uint32_t argb;                  /**< \brief Vertex color, if not given */
+    uint32_t oargb;                 /**< \brief Offset color, if not given */
+    float near_w;                   /**< \brief Near clip plane, as a
+                                         transformed W (greater than zero) */
+} pvr_vtx_fmt_t;
+
+/** \brief  Transform a strip and submit it with Direct Rendering.
+
+    Positions are transformed by the internal matrix (see mat_load()), whose
+    transformed W is expected to be the depth of the vertex, as with the
+    matrices of mat_perspective(). They are then divided by W, with 1/W as the
+    Z value sent to the PVR, and written to the Store Queues along with the
+    other attributes as \ref pvr_vertex_t.
+
+    Triangles that cross the near plane are clipped as with
+    pvr_dr_clip_strip().
+
+    \param  vtx_buf_ptr     State variable for Direct Rendering, initialized
+                            previously in the scene with pvr_dr_init().
+    \param  fmt             The layout of the source vertices.
+    \param  src             The source vertices.
+    \param  count           The number of vertices of the strip.
+
+    \retval 0               On success.
+    \retval -1              If fmt has no position (errno set to EINVAL).
+*/
+int pvr_dr_transform_strip(pvr_dr_state_t *vtx_buf_ptr,
+                           const pvr_vtx_fmt_t *fmt, const void *src,
+                           size_t count);
+
 /** \brief  Upload a 32-byte payload to the Tile Accelerator
 
     Upload the given payload to the Tile Accelerator. The difference with the
@@ -1380,6 +1602,66 @@ int pvr_list_flush(pvr_list_t list);
 */
 int pvr_scene_finish(void);
 
+/** \brief   PVR scene fence.
+    \ingroup pvr_scene_mgmt
+
+    Identifies a submitted scene, to find out when the PVR is done rendering it.
+    Fences of later scenes compare greater (modulo wrap-around), and a fence of
+    zero is always signaled.
+*/
+typedef uint32_t pvr_fence_t;
+
+/** \brief   Finish submitting a frame, and get a fence for it.
+    \ingroup pvr_scene_mgmt
+
+    This does the same as pvr_scene_finish(), but also returns a fence that is
+    signaled once the PVR is done rendering the scene. The caller is free to
+    start the next scene right away, and use the fence to know when the
+    resources used by this one (textures, for instance) can be touched again.
+
+    \return                 The fence of the scene.
+*/
+pvr_fence_t pvr_scene_finish_async(void);
+
+/** \brief   Check if the PVR is done rendering a scene.
+    \ingroup pvr_scene_mgmt
+
+    \param  fence           The fence of the scene.
+    \retval 0               If the scene has been rendered.
+    \retval -1              If it hasn't been rendered yet.
+*/
+int pvr_fence_check(pvr_fence_t fence);
+
+/** \brief   Block the caller until the PVR is done rendering a scene.
+    \ingroup pvr_scene_mgmt
+
+    \param  fence           The fence of the scene.
+    \param  timeout         The maximum time to wait, in milliseconds, or 0 to
+                            wait forever.
+    \retval 0               On success.
+    \retval -1              On timeout.
+*/
+int pvr_fence_wait(pvr_fence_t fence, int timeout);
+
+struct genwait_waiter;
+
+/** \brief   Get woken when the PVR is done rendering a scene, without blocking.
+    \ingroup pvr_scene_mgmt
+
+    Unless the scene has been rendered already, this adds a genwait waiter
+    (see kos/genwait.h) that is woken the next time the PVR is done rendering
+    a scene. That may be an earlier scene than the one of the fence, so the
+    fence must be checked again once the waiter has been woken, and the waiter
+    added again if it still isn't signaled.
+
+    \param  fence           The fence of the scene.
+    \param  w               The waiter, with its wake member set.
+    \retval 0               If the waiter was added.
+    \retval 1               If the scene has been rendered, in which case the
+                            waiter wasn't added.
+*/
+int pvr_fence_add_waiter(pvr_fence_t fence, struct genwait_waiter *w);
+
 /** \brief   Block the caller until the PVR system is ready for another frame to
              be submitted.
     \ingroup pvr_scene_mgmt
@@ -1387,10 +1669,9 @@ int pvr_scene_finish(void);
     The PVR system allocates enough space for two frames: one in data collection
     mode, and another in rendering mode. If a frame is currently rendering, and
     another frame has already been closed, then the caller cannot do anything
-    else until the rendering frame completes. Note also that the new frame
-    cannot be activated except during a vertical blanking period, so this
-    essentially waits until a rendered frame is complete and a vertical blank
-    happens.
+    else until the rendering frame completes. With triple-buffering enabled at
+    init time, a third frame can be collected while a closed frame waits for
+    its turn to be rendered.
 
     \retval 0               On success. A new scene can be started now.
     \retval -1              On error. Something is probably very wrong...
@@ -1407,13 +1688,72 @@ int pvr_wait_ready(void);
 */
 int pvr_check_ready(void);
 
+/** \brief   Set the number of vblanks each frame is shown for.
+    \ingroup pvr_scene_mgmt
+
+    Flips to a newly rendered frame wait until the frame shown has been up
+    for that many vblanks, so that frames come out at a steady 60, 30 or 20 Hz
+    (at a 60 Hz refresh rate) rather than whenever they're ready. Since
+    rendering can't start before the flip, pvr_wait_ready() paces the caller
+    to match.
+
+    With an interval of 0, the interval is picked automatically from the
+    longest of the render time and the CPU time of the last frame (the time
+    between flips not spent in pvr_wait_ready()). It goes up as soon as a
+    frame doesn't fit, and down once frames have fit the shorter interval
+    comfortably for a while.
+
+    The default is 1.
+
+    \param  interval        1 to 3, or 0 for automatic.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL.
+
+    \sa pvr_set_adaptive_vsync(), pvr_get_present_time()
+*/
+int pvr_set_swap_interval(int interval);
+
+/** \brief   Get the number of vblanks each frame is shown for.
+    \ingroup pvr_scene_mgmt
+
+    \return                 The swap interval in use, which is the one picked
+                            in automatic mode.
+*/
+int pvr_get_swap_interval(void);
+
+/** \brief   Flip frames that missed their vblank right away.
+    \ingroup pvr_scene_mgmt
+
+    A frame that isn't rendered in time for the vblank it was meant for
+    normally waits for the next one, which doubles its time on screen at a
+    swap interval of 1. With adaptive vsync, it is shown as soon as it's
+    rendered instead, at the cost of a tear. Disabled by default.
+
+    \param  enable          True to enable adaptive vsync.
+*/
+void pvr_set_adaptive_vsync(bool enable);
+
+/** \brief   Predict when the next scene submitted will be shown.
+    \ingroup pvr_scene_mgmt
+
+    This is the time of the last flip, plus a swap interval for each frame
+    awaiting rendering or display, and one for the next scene. Game logic can
+    use it to simulate up to the time the frame will actually be seen.
+
+    \return                 The predicted time, in nanoseconds on the
+                            timer_ns_gettime64() clock.
+*/
+uint64_t pvr_get_present_time(void);
+
 /** \brief   Block the caller until the PVR has finished rendering the previous
              frame.
     \ingroup pvr_scene_mgmt
 
     This function can be used to wait until the PVR is done rendering a previous
     scene. This can be useful for instance to make sure that the PVR is done
-    using textures that have to be updated, before updating those.
+    using textures that have to be updated, before updating those. Scenes that
+    are queued for rendering are waited for too; use pvr_fence_wait() to wait
+    for one scene only.
 
     \retval 0               On success.
     \retval -1              On error. Something is probably very wrong...
@@ -1440,6 +1780,23 @@ int pvr_wait_render_done(void);
 */
 void pvr_poly_compile(pvr_poly_hdr_t *dst, const pvr_poly_cxt_t *src);
 
+/** \brief   Compile a polygon context into a polygon header, with memoization.
+    \ingroup pvr_primitives_compilation
+
+    This function gives the same result as pvr_poly_compile(), but keeps the
+    last contexts it compiled in a small cache, indexed by a hash of the whole
+    context, and copies the header out of it when the same context comes up
+    again. Contexts are compared byte for byte, so they should be filled in
+    with the pvr_poly_cxt_*() functions, which clear the whole structure
+    first.
+
+    This must not be called from an interrupt.
+
+    \param  dst             Where to store the compiled header.
+    \param  src             The context to compile.
+*/
+void pvr_poly_compile_cached(pvr_poly_hdr_t *dst, const pvr_poly_cxt_t *src);
+
 /** \defgroup pvr_ctx_init     Initialization
     \brief                     Functions for initializing PVR polygon contexts
     \ingroup                   pvr_ctx
@@ -1633,6 +1990,14 @@ pvr_ptr_t pvr_get_back_buffer(void);
 #include "pvr/pvr_fog.h"
 #include "pvr/pvr_pal.h"
 #include "pvr/pvr_txr.h"
+#include "pvr/pvr_dlist.h"
+#include "pvr/pvr_sort.h"
+#include "pvr/pvr_particles.h"
+#include "pvr/pvr_video.h"
+#include "pvr/pvr_vqstream.h"
+#include "pvr/pvr_shadow.h"
+#include "pvr/pvr_hud.h"
+#include "pvr/pvr_bfont.h"
 
 __END_DECLS
 
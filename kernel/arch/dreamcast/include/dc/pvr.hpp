@@ -0,0 +1,503 @@
+/* KallistiOS ##version##
+
+   dc/pvr.hpp
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file       dc/pvr.hpp
+    \brief      Compile-time PVR vertex formats and headers for C++
+    \ingroup    pvr_cpp
+*/
+
+#ifndef __DC_PVR_HPP
+#define __DC_PVR_HPP
+
+#ifndef __cplusplus
+#error "dc/pvr.hpp is only for C++, use dc/pvr.h from C"
+#endif
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <dc/pvr.h>
+
+/** \defgroup pvr_cpp   C++ helpers
+    \brief              Header-only C++ layer over the PVR API
+    \ingroup            pvr
+
+    Vertex formats are types picked at compile time, so the size and layout
+    of the vertices and the bits they need in the polygon header come from
+    the type:
+
+    \code
+    using vtx_t = pvr::vertex<pvr::Textured, pvr::Gouraud, pvr::Packed>;
+    \endcode
+
+    Headers are compiled by a constexpr copy of pvr_poly_compile(), so a
+    header whose state is known when building costs nothing at runtime. Only
+    the address of a texture, which isn't known until it is allocated, is
+    added at runtime:
+
+    \code
+    static constexpr pvr::header op_hdr =
+        pvr::compile(pvr::with_format<vtx_t>(
+            pvr::cxt_txr(PVR_LIST_OP_POLY, PVR_TXRFMT_RGB565, 256, 256,
+                         PVR_FILTER_BILINEAR)));
+
+    {
+        pvr::list_scope list(PVR_LIST_OP_POLY);
+        op_hdr.texture(txr).submit();
+        ...
+    }
+    \endcode
+
+    Everything here is trivially copyable and can be written to Store Queues
+    or Direct Rendering targets like the C types can.
+
+    @{
+*/
+
+namespace pvr {
+
+/** \name   Vertex format tags
+    @{
+*/
+struct Untextured {};   /**< \brief No texture coordinates */
+struct Textured {};     /**< \brief 32-bit floating point U/V */
+struct Textured16 {};   /**< \brief 16-bit floating point U/V, packed */
+struct Flat {};         /**< \brief Flat shading */
+struct Gouraud {};      /**< \brief Gouraud shading */
+struct Packed {};       /**< \brief 32-bit ARGB colors */
+struct Floats {};       /**< \brief Four floating point colors */
+struct Intensity {};    /**< \brief Intensity of the header's color */
+/** @} */
+
+/** \cond */
+namespace detail {
+
+/* The vertex layouts of the TA, by texturing and color format. */
+template<typename Txr, typename Color> struct layout;
+
+template<> struct layout<Untextured, Packed> {
+    uint32_t flags;
+    float x, y, z;
+    uint32_t d1, d2;
+    uint32_t argb;
+    uint32_t d3;
+};
+
+template<> struct layout<Untextured, Floats> {
+    uint32_t flags;
+    float x, y, z;
+    float a, r, g, b;
+};
+
+template<> struct layout<Untextured, Intensity> {
+    uint32_t flags;
+    float x, y, z;
+    uint32_t d1, d2;
+    float intensity;
+    uint32_t d3;
+};
+
+template<> struct layout<Textured, Packed> {
+    uint32_t flags;
+    float x, y, z;
+    float u, v;
+    uint32_t argb;
+    uint32_t oargb;
+};
+
+template<> struct layout<Textured16, Packed> {
+    uint32_t flags;
+    float x, y, z;
+    uint32_t uv;
+    uint32_t d1;
+    uint32_t argb;
+    uint32_t oargb;
+};
+
+template<> struct layout<Textured, Floats> {
+    uint32_t flags;
+    float x, y, z;
+    float u, v;
+    uint32_t d1, d2;
+    float a, r, g, b;
+    float offset_a, offset_r, offset_g, offset_b;
+};
+
+template<> struct layout<Textured16, Floats> {
+    uint32_t flags;
+    float x, y, z;
+    uint32_t uv;
+    uint32_t d1, d2, d3;
+    float a, r, g, b;
+    float offset_a, offset_r, offset_g, offset_b;
+};
+
+template<> struct layout<Textured, Intensity> {
+    uint32_t flags;
+    float x, y, z;
+    float u, v;
+    float intensity;
+    float offset_intensity;
+};
+
+template<> struct layout<Textured16, Intensity> {
+    uint32_t flags;
+    float x, y, z;
+    uint32_t uv;
+    uint32_t d1;
+    float intensity;
+    float offset_intensity;
+};
+
+template<typename T> struct txr_bits;
+template<> struct txr_bits<Untextured> {
+    static constexpr uint32_t value = 0;
+};
+template<> struct txr_bits<Textured> {
+    static constexpr uint32_t value = PVR_TA_CMD_TXRENABLE;
+};
+template<> struct txr_bits<Textured16> {
+    static constexpr uint32_t value = PVR_TA_CMD_TXRENABLE | PVR_TA_CMD_UVFMT;
+};
+
+template<typename T> struct shade_bits;
+template<> struct shade_bits<Flat> {
+    static constexpr uint32_t value = 0;
+};
+template<> struct shade_bits<Gouraud> {
+    static constexpr uint32_t value = PVR_TA_CMD_SHADE;
+};
+
+template<typename T> struct color_bits;
+template<> struct color_bits<Packed> {
+    static constexpr uint32_t value =
+        FIELD_PREP(PVR_TA_CMD_CLRFMT, (uint32_t)PVR_CLRFMT_ARGBPACKED);
+};
+template<> struct color_bits<Floats> {
+    static constexpr uint32_t value =
+        FIELD_PREP(PVR_TA_CMD_CLRFMT, (uint32_t)PVR_CLRFMT_4FLOATS);
+};
+template<> struct color_bits<Intensity> {
+    static constexpr uint32_t value =
+        FIELD_PREP(PVR_TA_CMD_CLRFMT, (uint32_t)PVR_CLRFMT_INTENSITY);
+};
+
+/* Not constexpr: reaching it while compiling a header at build time makes
+   the build fail, just like the assertion does at runtime. */
+inline void bad_uv_size() {
+    assert_msg(0, "Invalid texture U/V size");
+}
+
+constexpr uint32_t uv_size(int size) {
+    if(__builtin_popcount(size) != 1 || size < 8 || size > 1024)
+        bad_uv_size();
+
+    return __builtin_ctz(size) - 3;
+}
+
+constexpr uint32_t prep(uint32_t field, int value) {
+    return FIELD_PREP(field, (uint32_t)value);
+}
+
+} /* namespace detail */
+/** \endcond */
+
+/** \brief   A vertex in a format picked at compile time.
+
+    Txr is one of \ref Untextured, \ref Textured or \ref Textured16, Shade one
+    of \ref Flat or \ref Gouraud, and Color one of \ref Packed, \ref Floats or
+    \ref Intensity. The members are named like those of pvr_vertex_t, with
+    a, r, g, b (and offset_a...) for floating point colors, intensity (and
+    offset_intensity) for intensities, and uv for packed 16-bit U/Vs.
+
+    Untextured vertices have no offset color, so Untextured with Intensity
+    has just the one intensity.
+*/
+template<typename Txr, typename Shade, typename Color>
+struct alignas(32) vertex : detail::layout<Txr, Color> {
+    /** \brief   The bits of the polygon header's command for this format. */
+    static constexpr uint32_t cmd_bits = detail::txr_bits<Txr>::value |
+                                         detail::shade_bits<Shade>::value |
+                                         detail::color_bits<Color>::value;
+
+    /** \brief   Mark the vertex as the last of its strip, or not. */
+    void end_strip(bool eol = true) {
+        this->flags = eol ? PVR_CMD_VERTEX_EOL : PVR_CMD_VERTEX;
+    }
+
+    /** \brief   Set packed 16-bit U/Vs from floats.
+
+        Only for \ref Textured16 vertices. The 16-bit values are the high
+        halves of the floats.
+    */
+    void set_uv(float u, float v) {
+        static_assert(sizeof(detail::layout<Txr, Color>::uv) == 4,
+                      "set_uv() is only for 16-bit U/Vs");
+        uint32_t ub, vb;
+
+        memcpy(&ub, &u, sizeof(ub));
+        memcpy(&vb, &v, sizeof(vb));
+        this->uv = (ub & 0xffff0000) | (vb >> 16);
+    }
+};
+
+static_assert(sizeof(vertex<Textured, Gouraud, Packed>) == 32,
+              "Invalid vertex size");
+static_assert(sizeof(vertex<Textured, Gouraud, Floats>) == 64,
+              "Invalid vertex size");
+
+/** \brief   A compiled polygon header.
+
+    This has the layout of pvr_poly_hdr_t, but as plain words so that it can
+    be built at compile time.
+*/
+struct alignas(32) header {
+    uint32_t cmd;           /**< \brief Command */
+    uint32_t mode1;         /**< \brief Polygon mode 1 */
+    uint32_t mode2;         /**< \brief Polygon mode 2 */
+    uint32_t mode3;         /**< \brief Polygon mode 3 */
+    uint32_t extra[4];      /**< \brief Modes inside a modifier volume, or
+                                        colors, depending on the header */
+
+    /** \brief   Whether the header has the second set of modes, for
+                 polygons affected by a modifier volume. */
+    constexpr bool has_modifier() const {
+        return (cmd & PVR_TA_CMD_MODIFIER) && (cmd & PVR_TA_CMD_MODIFIERMODE);
+    }
+
+    /** \brief   A copy of the header, using the texture at base.
+
+        The texture address is the only part of a header that can't be known
+        at compile time. This sets it over whatever address the header had.
+
+        \param  base        The texture, in PVR RAM.
+        \return             The header, with that texture.
+    */
+    header texture(pvr_ptr_t base) const {
+        header rv = *this;
+        uint32_t ptr = to_pvr_txr_ptr(base);
+
+        rv.mode3 = (rv.mode3 & ~(PVR_RAM_SIZE / 8 - 1)) | ptr;
+
+        if(has_modifier())
+            rv.extra[1] = (rv.extra[1] & ~(PVR_RAM_SIZE / 8 - 1)) | ptr;
+
+        return rv;
+    }
+
+    /** \brief   The header as the C type. */
+    const pvr_poly_hdr_t &hdr() const {
+        return *reinterpret_cast<const pvr_poly_hdr_t *>(this);
+    }
+
+    /** \brief   Submit the header to the open list, with pvr_prim(). */
+    int submit() const {
+        return pvr_prim(this, sizeof(*this));
+    }
+};
+
+static_assert(sizeof(header) == sizeof(pvr_poly_hdr_t), "Invalid header size");
+
+/** \brief   Compile a polygon context into a header.
+
+    This gives the same words as pvr_poly_compile(), and can run at compile
+    time. The texture address of the context is left out, since a pointer
+    can't be used at compile time; add it with header::texture().
+
+    \param  src             The polygon context.
+    \return                 The header.
+*/
+constexpr header compile(const pvr_poly_cxt_t &src) {
+    header dst = {};
+    uint32_t mode2 = 0, mode3 = 0;
+
+    dst.cmd = PVR_CMD_POLYHDR
+        | detail::prep(PVR_TA_CMD_TXRENABLE, src.txr.enable)
+        | detail::prep(PVR_TA_CMD_TYPE, src.list_type)
+        | detail::prep(PVR_TA_CMD_CLRFMT, src.fmt.color)
+        | detail::prep(PVR_TA_CMD_SHADE, src.gen.shading)
+        | detail::prep(PVR_TA_CMD_UVFMT, src.fmt.uv)
+        | detail::prep(PVR_TA_CMD_USERCLIP, src.gen.clip_mode)
+        | detail::prep(PVR_TA_CMD_MODIFIER, src.fmt.modifier)
+        | detail::prep(PVR_TA_CMD_MODIFIERMODE, src.gen.modifier_mode)
+        | detail::prep(PVR_TA_CMD_SPECULAR, src.gen.specular);
+
+    dst.mode1 = detail::prep(PVR_TA_PM1_DEPTHCMP, src.depth.comparison)
+        | detail::prep(PVR_TA_PM1_CULLING, src.gen.culling)
+        | detail::prep(PVR_TA_PM1_DEPTHWRITE, src.depth.write)
+        | detail::prep(PVR_TA_PM1_TXRENABLE, src.txr.enable);
+
+    mode2 = detail::prep(PVR_TA_PM2_SRCBLEND, src.blend.src)
+        | detail::prep(PVR_TA_PM2_DSTBLEND, src.blend.dst)
+        | detail::prep(PVR_TA_PM2_SRCENABLE, src.blend.src_enable)
+        | detail::prep(PVR_TA_PM2_DSTENABLE, src.blend.dst_enable)
+        | detail::prep(PVR_TA_PM2_FOG, src.gen.fog_type)
+        | detail::prep(PVR_TA_PM2_CLAMP, src.gen.color_clamp)
+        | detail::prep(PVR_TA_PM2_ALPHA, src.gen.alpha);
+
+    if(src.txr.enable == PVR_TEXTURE_DISABLE) {
+        mode3 = 0;
+    }
+    else {
+        mode2 |= detail::prep(PVR_TA_PM2_TXRALPHA, src.txr.alpha)
+            | detail::prep(PVR_TA_PM2_UVFLIP, src.txr.uv_flip)
+            | detail::prep(PVR_TA_PM2_UVCLAMP, src.txr.uv_clamp)
+            | detail::prep(PVR_TA_PM2_FILTER, src.txr.filter)
+            | detail::prep(PVR_TA_PM2_MIPBIAS, src.txr.mipmap_bias)
+            | detail::prep(PVR_TA_PM2_TXRENV, src.txr.env)
+            | FIELD_PREP(PVR_TA_PM2_USIZE, detail::uv_size(src.txr.width))
+            | FIELD_PREP(PVR_TA_PM2_VSIZE, detail::uv_size(src.txr.height));
+
+        mode3 = detail::prep(PVR_TA_PM3_MIPMAP, src.txr.mipmap)
+            | (uint32_t)src.txr.format;
+    }
+
+    dst.mode2 = mode2;
+    dst.mode3 = mode3;
+
+    if(src.fmt.modifier && src.gen.modifier_mode) {
+        dst.extra[0] = mode2;
+        dst.extra[1] = mode3;
+    }
+
+    return dst;
+}
+
+/** \brief   Build a colored polygon context.
+
+    This is a constexpr pvr_poly_cxt_col().
+
+    \param  list            The list the polygons go into.
+    \return                 The context.
+*/
+constexpr pvr_poly_cxt_t cxt_col(pvr_list_t list) {
+    pvr_poly_cxt_t dst = {};
+    bool alpha = list > PVR_LIST_OP_MOD;
+
+    dst.list_type = list;
+    dst.fmt.color = PVR_CLRFMT_ARGBPACKED;
+    dst.fmt.uv = PVR_UVFMT_32BIT;
+    dst.gen.shading = PVR_SHADE_GOURAUD;
+    dst.depth.comparison = PVR_DEPTHCMP_GREATER;
+    dst.depth.write = PVR_DEPTHWRITE_ENABLE;
+    dst.gen.culling = PVR_CULLING_CCW;
+    dst.txr.enable = PVR_TEXTURE_DISABLE;
+    dst.gen.alpha = alpha ? PVR_ALPHA_ENABLE : PVR_ALPHA_DISABLE;
+    dst.blend.src = alpha ? PVR_BLEND_SRCALPHA : PVR_BLEND_ONE;
+    dst.blend.dst = alpha ? PVR_BLEND_INVSRCALPHA : PVR_BLEND_ZERO;
+    dst.blend.src_enable = PVR_BLEND_DISABLE;
+    dst.blend.dst_enable = PVR_BLEND_DISABLE;
+    dst.gen.fog_type = PVR_FOG_DISABLE;
+    dst.gen.color_clamp = PVR_CLRCLAMP_DISABLE;
+
+    return dst;
+}
+
+/** \brief   Build a textured polygon context.
+
+    This is a constexpr pvr_poly_cxt_txr(), without the texture address,
+    which header::texture() adds to the compiled header.
+
+    \param  list            The list the polygons go into.
+    \param  format          The texture format (PVR_TXRFMT_*).
+    \param  tw              The texture width, a power of two.
+    \param  th              The texture height, a power of two.
+    \param  filtering       The texture filtering mode.
+    \return                 The context.
+*/
+constexpr pvr_poly_cxt_t cxt_txr(pvr_list_t list, int format, int tw, int th,
+                                 int filtering) {
+    pvr_poly_cxt_t dst = cxt_col(list);
+    bool alpha = list > PVR_LIST_OP_MOD;
+
+    dst.txr.enable = PVR_TEXTURE_ENABLE;
+    dst.txr.alpha = PVR_TXRALPHA_ENABLE;
+    dst.txr.env = alpha ? PVR_TXRENV_MODULATEALPHA : PVR_TXRENV_MODULATE;
+    dst.txr.uv_flip = PVR_UVFLIP_NONE;
+    dst.txr.uv_clamp = PVR_UVCLAMP_NONE;
+    dst.txr.filter = filtering;
+    dst.txr.mipmap_bias = PVR_MIPBIAS_NORMAL;
+    dst.txr.width = tw;
+    dst.txr.height = th;
+    dst.txr.format = format;
+
+    return dst;
+}
+
+/** \brief   Make a polygon context match a vertex format.
+
+    This sets the color and U/V formats, the shading and whether texturing is
+    enabled from the vertex type, so that the header can't disagree with the
+    vertices sent after it.
+
+    \tparam V               The vertex type, a \ref vertex.
+    \param  cxt             The polygon context.
+    \return                 The context, for that vertex format.
+*/
+template<typename V>
+constexpr pvr_poly_cxt_t with_format(pvr_poly_cxt_t cxt) {
+    cxt.txr.enable = (V::cmd_bits & PVR_TA_CMD_TXRENABLE) ?
+                     PVR_TEXTURE_ENABLE : PVR_TEXTURE_DISABLE;
+    cxt.fmt.uv = (V::cmd_bits & PVR_TA_CMD_UVFMT) ?
+                 PVR_UVFMT_16BIT : PVR_UVFMT_32BIT;
+    cxt.gen.shading = (V::cmd_bits & PVR_TA_CMD_SHADE) ?
+                      PVR_SHADE_GOURAUD : PVR_SHADE_FLAT;
+    cxt.fmt.color = FIELD_GET(V::cmd_bits, PVR_TA_CMD_CLRFMT);
+
+    return cxt;
+}
+
+/** \brief   Submit a vertex (or anything else made of 32-byte blocks) to the
+             open list, with pvr_prim(). */
+template<typename T>
+inline int submit(const T &prim) {
+    static_assert(sizeof(T) % 32 == 0, "Primitives are made of 32-byte blocks");
+    return pvr_prim(&prim, sizeof(T));
+}
+
+/** \brief   A scene, from pvr_scene_begin() to pvr_scene_finish(). */
+class scene_scope {
+public:
+    scene_scope() { pvr_scene_begin(); }
+    ~scene_scope() { pvr_scene_finish(); }
+
+    scene_scope(const scene_scope &) = delete;
+    scene_scope &operator=(const scene_scope &) = delete;
+};
+
+/** \brief   An open list, from pvr_list_begin() to pvr_list_finish().
+
+    Lists can't be reopened in a scene, so ok() tells if the list really is
+    open; it isn't finished at the end of the scope if it wasn't.
+*/
+class list_scope {
+public:
+    /** \brief   Open a list. */
+    explicit list_scope(pvr_list_t list) : open_(!pvr_list_begin(list)) {}
+
+    /** \brief   Finish the list, if it was opened. */
+    ~list_scope() {
+        if(open_)
+            pvr_list_finish();
+    }
+
+    /** \brief   Whether the list was opened. */
+    bool ok() const { return open_; }
+
+    list_scope(const list_scope &) = delete;
+    list_scope &operator=(const list_scope &) = delete;
+
+private:
+    bool open_;
+};
+
+} /* namespace pvr */
+
+/** @} */
+
+#endif /* __DC_PVR_HPP */
@@ -0,0 +1,119 @@
+/* KallistiOS ##version##
+
+   dc/pvr/pvr_bfont.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file       dc/pvr/pvr_bfont.h
+    \brief      BIOS font text drawn by the PVR
+    \ingroup    pvr_bfont
+*/
+
+#ifndef __DC_PVR_PVR_BFONT_H
+#define __DC_PVR_PVR_BFONT_H
+
+#include <stdint.h>
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+/** \defgroup pvr_bfont     BIOS font text
+    \brief                  Draw text with the BIOS font through the TA
+    \ingroup                pvr
+
+    Instead of drawing each glyph into a framebuffer pixel by pixel like the
+    bfont_draw functions do, glyphs are drawn once into a 512x512 4bpp
+    paletted texture, and strings are then sent to the TA as one sprite per
+    character, all under a single header. Drawing text then costs about as
+    much as any other sprite.
+
+    The atlas has room for every thin (ISO-8859-1 and half-width kana) glyph,
+    which are drawn the first time they're used, the printable ASCII ones
+    being drawn up front. Wide (Japanese) glyphs are drawn on demand into a
+    cache of 273 of them; once it's full, the glyph that was least recently
+    drawn by a scene the PVR is done with makes room for the new one. A glyph
+    that can't find any room, because all of them are waiting to be rendered,
+    is left blank.
+
+    Strings are decoded the same way as by bfont_draw_str(), following
+    bfont_set_encoding(); only \ref BFONT_CODE_RAW isn't supported. The
+    atlas takes 128KB of PVR RAM, and 16 entries of the palette.
+
+    Glyphs are white and their background is transparent, so the color of
+    the text is that of the sprites, and it should be drawn into the
+    translucent or punch-through lists.
+
+    @{
+*/
+
+/** \brief   Set up the atlas.
+
+    The palette format must have been set with pvr_set_pal_format() already,
+    to one with alpha (anything but PVR_PAL_RGB565). Calling this again after
+    a change of palette format just updates the palette entries.
+
+    \param  pal_bank        The 16-entry palette bank to use, 0 to 63.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if the bank
+                            is out of range, or ENOMEM if there isn't enough
+                            PVR RAM for the atlas.
+*/
+int pvr_bfont_init(int pal_bank);
+
+/** \brief   Free the atlas.
+
+    This is done by pvr_shutdown() too.
+*/
+void pvr_bfont_shutdown(void);
+
+/** \brief   Draw a string, scaled.
+
+    The list must be open, in either normal or direct mode. A newline moves
+    back to x one line down, a tab is as wide as four spaces.
+
+    \param  list            The list open, PVR_LIST_TR_POLY or
+                            PVR_LIST_PT_POLY.
+    \param  x               The left of the text on the screen.
+    \param  y               The top of the text on the screen.
+    \param  z               The depth of the text.
+    \param  argb            The color of the text.
+    \param  scale           The size of the text, 1.0f being the 12x24 (or
+                            24x24) pixels of the font.
+    \param  str             The string to draw.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if the atlas
+                            isn't set up or the encoding is
+                            \ref BFONT_CODE_RAW.
+*/
+int pvr_bfont_draw_str_ex(pvr_list_t list, float x, float y, float z,
+                          uint32_t argb, float scale, const char *str);
+
+/** \brief   Draw a string.
+
+    This is pvr_bfont_draw_str_ex() into the translucent list, at the size of
+    the font.
+
+    \param  x               The left of the text on the screen.
+    \param  y               The top of the text on the screen.
+    \param  z               The depth of the text.
+    \param  argb            The color of the text.
+    \param  str             The string to draw.
+    \retval 0               On success.
+    \retval -1              On failure, see pvr_bfont_draw_str_ex().
+*/
+int pvr_bfont_draw_str(float x, float y, float z, uint32_t argb,
+                       const char *str);
+
+/** \brief   Measure a string.
+
+    \param  str             The string to measure.
+    \return                 The width of its longest line, in pixels at
+                            the size of the font.
+*/
+uint32_t pvr_bfont_str_width(const char *str);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_PVR_PVR_BFONT_H */
@@ -0,0 +1,129 @@
+/* KallistiOS ##version##
+
+   dc/pvr/pvr_dlist.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file       dc/pvr/pvr_dlist.h
+    \brief      Recorded display lists for the PVR
+    \ingroup    pvr_dlist
+*/
+
+#ifndef __DC_PVR_PVR_DLIST_H
+#define __DC_PVR_PVR_DLIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+/** \defgroup pvr_dlist     Display lists
+    \brief                  Record TA data once, replay it every frame
+    \ingroup                pvr_scene_mgmt
+
+    A display list holds polygon headers and vertices, exactly as they would
+    be sent to the Tile Accelerator with pvr_prim(), in a 32-byte aligned
+    buffer. Static geometry (UI, skyboxes, level chunks...) can be recorded
+    into one once, and replayed into a scene each frame with a single DMA to
+    the TA, instead of being built and submitted again by the CPU.
+
+    Since the TA takes vertices in screen space, a display list can't be
+    moved around by a matrix; instead, pvr_dlist_add() returns where each
+    piece of data went, and that piece (a header's colors, or a vertex) can
+    be rewritten with pvr_dlist_patch() in between replays.
+*/
+
+/** \brief   A display list.
+    \ingroup pvr_dlist
+
+    \headerfile dc/pvr/pvr_dlist.h
+*/
+typedef struct pvr_dlist {
+    uint8_t *buf;               /**< \brief The recorded data */
+    size_t size;                /**< \brief Size of the buffer, in bytes */
+    size_t used;                /**< \brief Bytes recorded */
+    pvr_list_t list;            /**< \brief The list to replay into */
+    bool owned;                 /**< \brief True if buf was allocated here */
+} pvr_dlist_t;
+
+/** \brief   Set up an empty display list.
+    \ingroup pvr_dlist
+
+    \param  dl              The display list.
+    \param  list            The list the display list is replayed into.
+    \param  buf             A 32-byte aligned buffer to record into, or NULL
+                            to have one allocated.
+    \param  size            The size of the buffer, in bytes, a multiple of
+                            32.
+    \retval 0               On success.
+    \retval -1              On failure (errno set to EINVAL for a misaligned
+                            buffer or bad size, or ENOMEM).
+*/
+int pvr_dlist_init(pvr_dlist_t *dl, pvr_list_t list, void *buf, size_t size);
+
+/** \brief   Free the buffer of a display list, if it was allocated.
+    \ingroup pvr_dlist
+
+    \param  dl              The display list.
+*/
+void pvr_dlist_destroy(pvr_dlist_t *dl);
+
+/** \brief   Empty a display list, to record it again.
+    \ingroup pvr_dlist
+
+    \param  dl              The display list.
+*/
+static inline void pvr_dlist_reset(pvr_dlist_t *dl) {
+    dl->used = 0;
+}
+
+/** \brief   Record TA data into a display list.
+    \ingroup pvr_dlist
+
+    \param  dl              The display list.
+    \param  data            Polygon headers and/or vertices.
+    \param  size            The size of the data, a multiple of 32 bytes.
+    \return                 The offset of the data in the display list, to
+                            patch it later on, or -1 if it doesn't fit (errno
+                            set to ENOSPC) or size is bad (EINVAL).
+*/
+ptrdiff_t pvr_dlist_add(pvr_dlist_t *dl, const void *data, size_t size);
+
+/** \brief   Rewrite recorded data of a display list.
+    \ingroup pvr_dlist
+
+    This can be done at any time, except while pvr_dlist_replay() is running
+    in another thread.
+
+    \param  dl              The display list.
+    \param  offset          Where to write, as returned by pvr_dlist_add()
+                            (plus an offset within that data, if needed).
+    \param  data            The new data.
+    \param  size            The size of the new data, in bytes.
+    \retval 0               On success.
+    \retval -1              If it would go past the recorded data (errno set
+                            to EINVAL).
+*/
+int pvr_dlist_patch(pvr_dlist_t *dl, size_t offset, const void *data,
+                    size_t size);
+
+/** \brief   Replay a display list into the current scene.
+    \ingroup pvr_dlist
+
+    Opens the display list's list if another one is open, and sends the
+    recorded data to the TA with DMA, sleeping until the DMA is done so that
+    the Store Queues can be used right after. In vertex DMA mode, the data is
+    copied into the list's vertex buffer instead, as with pvr_list_prim().
+
+    \param  dl              The display list.
+    \retval 0               On success.
+    \retval -1              On failure (the list was already closed, or the
+                            DMA couldn't start).
+*/
+int pvr_dlist_replay(const pvr_dlist_t *dl);
+
+__END_DECLS
+
+#endif  /* __DC_PVR_PVR_DLIST_H */
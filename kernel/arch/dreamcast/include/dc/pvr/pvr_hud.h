@@ -0,0 +1,87 @@
+/* KallistiOS ##version##
+
+   dc/pvr/pvr_hud.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file       dc/pvr/pvr_hud.h
+    \brief      On-screen performance overlay
+    \ingroup    pvr_hud
+*/
+
+#ifndef __DC_PVR_PVR_HUD_H
+#define __DC_PVR_PVR_HUD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+/** \defgroup pvr_hud       Performance overlay
+    \brief                  Draw performance figures over the scene
+    \ingroup                pvr_stats
+
+    The overlay shows the frame time, the TA, render and DMA times of the last
+    frame (see \ref pvr_stats_t), the CPU load of the busiest threads and the
+    memory in use, over a graph of the last 64 frame and render times. It's
+    drawn by the PVR into the translucent list, so looking at it doesn't
+    disturb the timings it shows the way pulling them over a serial or
+    network link does.
+
+    Figures are refreshed a few times a second, into a small text texture
+    drawn with the built-in minifont. The overlay takes 128KB of PVR RAM and
+    64KB of RAM once first drawn.
+
+    Call pvr_hud_draw() once per scene, while the translucent list is open.
+    It draws nothing while the overlay is hidden, so it can be left in for
+    release builds. The overlay can be shown and hidden with a button combo on
+    any controller, see pvr_hud_set_toggle().
+
+    @{
+*/
+
+/** \brief   Width of the overlay, in pixels */
+#define PVR_HUD_WIDTH   256
+
+/** \brief   Height of the overlay, in pixels */
+#define PVR_HUD_HEIGHT  196
+
+/** \brief   Show or hide the overlay.
+
+    \param  enable          True to show it.
+*/
+void pvr_hud_enable(bool enable);
+
+/** \brief   Check if the overlay is shown.
+
+    \return                 True if it is.
+*/
+bool pvr_hud_enabled(void);
+
+/** \brief   Set the button combo that shows and hides the overlay.
+
+    \param  btns            The buttons to hold together (CONT_* values ORed
+                            together), or 0 for none.
+    \retval 0               On success.
+    \retval -1              On failure.
+*/
+int pvr_hud_set_toggle(uint32_t btns);
+
+/** \brief   Draw the overlay.
+
+    The translucent list must be open, in either normal or direct mode.
+
+    \param  x               The left of the overlay on the screen.
+    \param  y               The top of the overlay on the screen.
+    \retval 0               On success, or if the overlay is hidden.
+    \retval -1              On failure, with errno set to ENOMEM if there
+                            isn't enough memory for the overlay.
+*/
+int pvr_hud_draw(float x, float y);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_PVR_PVR_HUD_H */
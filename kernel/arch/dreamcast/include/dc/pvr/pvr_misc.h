@@ -161,6 +161,18 @@ int pvr_get_vbl_count(void);
     \ingroup                    pvr
 */
 
+/** \brief   Number of frames in the frame time histogram.
+    \ingroup pvr_stats
+*/
+#define PVR_STATS_HIST_FRAMES   64
+
+/** \brief   Number of 1ms buckets in the frame time histogram.
+    \ingroup pvr_stats
+
+    The last bucket holds every frame that took longer.
+*/
+#define PVR_STATS_HIST_BUCKETS  32
+
 /** \brief   PVR statistics structure.
     \ingroup pvr_stats
 
@@ -178,6 +190,17 @@ typedef struct pvr_stats {
     size_t   vtx_buffer_used_max; /**< \brief Number of bytes used in the vertex buffer for the largest frame */
     float    frame_rate;          /**< \brief Current frame rate (per second) */
     uint32_t enabled_list_mask;   /**< \brief Which lists are enabled? */
+    size_t   list_buffer_used_max[5]; /**< \brief Largest use of each list's vertex DMA buffer, in bytes */
+    size_t   opb_overflow_used_max;   /**< \brief Largest use of the extra OPB space, in bytes */
+    size_t   vtx_buffer_overflows;    /**< \brief Number of vertex buffer overflows */
+    size_t   opb_overflows;           /**< \brief Number of object pointer buffer overflows */
+    size_t   buf_resizes;             /**< \brief Number of automatic buffer resizes */
+    uint64_t list_last_time[5];   /**< \brief Time from the start of registration to the TA finishing each list, for the last frame in nanoseconds */
+    uint64_t dma_last_time;       /**< \brief PVR DMA busy time (vertices and textures) for the last frame in nanoseconds */
+    uint64_t wait_last_time;      /**< \brief Time blocked in pvr_wait_ready() for the last frame in nanoseconds */
+    uint64_t wait_total_time;     /**< \brief Time blocked in pvr_wait_ready() since initialization in nanoseconds */
+    uint16_t frame_time_hist[PVR_STATS_HIST_BUCKETS]; /**< \brief How many of the last \ref PVR_STATS_HIST_FRAMES frames took n to n+1 ms */
+    size_t   hdr_skipped;         /**< \brief Number of headers not sent again thanks to the header cache */
     /* ... more later as it's implemented ... */
 } pvr_stats_t;
 
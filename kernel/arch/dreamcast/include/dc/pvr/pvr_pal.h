@@ -24,6 +24,7 @@
 #ifndef __DC_PVR_PVR_PALETTE_H
 #define __DC_PVR_PVR_PALETTE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include <kos/cdefs.h>
@@ -86,6 +87,78 @@ static inline void pvr_set_pal_entry(uint32_t idx, uint32_t value) {
     PVR_SET(PVR_PALETTE_TABLE_BASE + 4 * idx, value);
 }
 
+/** \brief   Number of entries in the palette table.
+    \ingroup pvr_pal_mgmt
+*/
+#define PVR_PAL_ENTRIES     1024
+
+/** \defgroup pvr_pal_shadow    Shadow palette
+    \brief                      Edit the palette in RAM, and commit it at once
+    \ingroup                    pvr_pal_mgmt
+
+    Writing palette entries while the PVR renders a scene changes colors
+    halfway through it. Instead, entries can be edited in a shadow of the
+    palette table in RAM, and committed, to be written to the hardware in
+    between renders: right away if the PVR isn't rendering, otherwise just
+    before the next render starts, or at the next vblank.
+
+    The shadow is double-buffered: committing hands the edited copy over to be
+    written, and the committed entries are copied into the other copy, which
+    is edited from then on. Entries edited but not committed don't carry over,
+    so the pointer from pvr_pal_shadow() must be fetched again after each
+    commit.
+
+    The shadow starts out zeroed; it isn't read back from the hardware, nor
+    updated by pvr_set_pal_entry().
+*/
+
+/** \brief   Get the shadow palette to edit.
+    \ingroup pvr_pal_shadow
+
+    \return                 The \ref PVR_PAL_ENTRIES entries of the shadow
+                            palette, valid until the next commit.
+*/
+uint32_t *pvr_pal_shadow(void);
+
+/** \brief   Commit entries of the shadow palette.
+    \ingroup pvr_pal_shadow
+
+    Entries committed before and not written yet are written along with these.
+
+    \param  first           The first entry to commit.
+    \param  count           The number of entries to commit.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if the range
+                            is out of the palette.
+*/
+int pvr_pal_commit(size_t first, size_t count);
+
+/** \brief   Wait for committed entries to be written to the hardware.
+    \ingroup pvr_pal_shadow
+
+    \param  timeout         The maximum time to wait, in milliseconds, or 0 to
+                            wait forever.
+    \retval 0               On success.
+    \retval -1              On timeout.
+*/
+int pvr_pal_commit_wait(int timeout);
+
+/** \brief   Rotate entries of the shadow palette, for color cycling.
+    \ingroup pvr_pal_shadow
+
+    Entry first + i moves to first + (i + shift) % count. Commit the range
+    afterwards.
+
+    \param  first           The first entry to rotate.
+    \param  count           The number of entries to rotate.
+    \param  shift           How far to rotate them; negative values rotate
+                            the other way.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if the range
+                            is out of the palette.
+*/
+int pvr_pal_rotate(size_t first, size_t count, int shift);
+
 __END_DECLS 
 
 #endif  /* __DC_PVR_PVR_PALETTE_H */
@@ -0,0 +1,83 @@
+/* KallistiOS ##version##
+
+   dc/pvr/pvr_particles.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file       dc/pvr/pvr_particles.h
+    \brief      Batched submission of particles as sprites
+    \ingroup    pvr_particles
+*/
+
+#ifndef __DC_PVR_PVR_PARTICLES_H
+#define __DC_PVR_PVR_PARTICLES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+/** \defgroup pvr_particles  Particle batches
+    \brief                   Draw thousands of square sprites at once
+    \ingroup                 pvr_scene_mgmt
+
+    A particle batch takes its particles as separate arrays of attributes
+    (centers, depths, sizes, texture rectangles and colors) as particle
+    systems usually keep them, works out the corners of the sprite of each
+    particle, and writes them straight to the TA with the Store Queues, two
+    particles' worth of math at a time. There is no vertex structure to fill
+    in, and no call per sprite. Lists going through vertex DMA get the
+    sprites written into their vertex buffer instead.
+
+    Sprites take their color from their header, so a batch sends a header
+    with the color of each run of particles of the same color. Particles that
+    all have the header's color cost exactly one header, while giving each
+    particle its own color costs one more header per particle.
+*/
+
+/** \brief   The attributes of a batch of particles.
+    \ingroup pvr_particles
+
+    Every array has one entry per particle, except uv. Only x and y are
+    required, the other arrays can be NULL to use the same value for every
+    particle.
+
+    \headerfile dc/pvr/pvr_particles.h
+*/
+typedef struct pvr_particles {
+    const float *x;         /**< \brief X of the centers, on screen */
+    const float *y;         /**< \brief Y of the centers, on screen */
+    const float *z;         /**< \brief Depths (1/w), or NULL for z0 */
+    const float *size;      /**< \brief Widths of the squares, or NULL for
+                                        size0 */
+    const float *uv;        /**< \brief Texture rectangles, four floats per
+                                        particle (left u, top v, right u,
+                                        bottom v), or NULL for the whole
+                                        texture */
+    const uint32_t *argb;   /**< \brief Colors, or NULL for the header's */
+    float z0;               /**< \brief Depth of every particle, if z is NULL */
+    float size0;            /**< \brief Width of every particle, if size is
+                                        NULL */
+} pvr_particles_t;
+
+/** \brief   Draw a batch of particles.
+    \ingroup pvr_particles
+
+    The list the header goes to must be open. The Store Queues are used for
+    Direct Rendering, as with pvr_dr_init().
+
+    \param  hdr             The sprite header, compiled with
+                            pvr_sprite_compile().
+    \param  p               The particles.
+    \param  count           The number of particles.
+    \retval 0               On success.
+    \retval -1              On failure (errno set to EINVAL if no list is
+                            open or x or y is NULL).
+*/
+int pvr_particles_draw(const pvr_sprite_hdr_t *hdr, const pvr_particles_t *p,
+                       size_t count);
+
+__END_DECLS
+
+#endif  /* __DC_PVR_PVR_PARTICLES_H */
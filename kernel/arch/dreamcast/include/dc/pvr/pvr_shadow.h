@@ -0,0 +1,120 @@
+/* KallistiOS ##version##
+
+   dc/pvr/pvr_shadow.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file       dc/pvr/pvr_shadow.h
+    \brief      Shadow volumes made of modifier volumes
+    \ingroup    pvr_shadow
+*/
+
+#ifndef __DC_PVR_PVR_SHADOW_H
+#define __DC_PVR_PVR_SHADOW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <dc/vec3f.h>
+
+/** \defgroup pvr_shadow    Shadow volumes
+    \brief                  Build modifier volumes from the shadow of a mesh
+    \ingroup                pvr_scene_mgmt
+
+    A shadow mesh wraps a closed triangle mesh, along with what's needed to
+    find its silhouette quickly: the normal of each triangle, and a table of
+    its edges with the two triangles on each side of them. Edges are sorted
+    by vertex, so that going through them walks the vertices in order.
+
+    For a directional light, the shadow volume is made of the triangles
+    facing the light, the same triangles pushed away along the light, and a
+    quad joining the two for each edge of the silhouette. It is sent as a
+    single modifier volume, in batches of triangles.
+
+    The mesh is transformed by the current matrix (XMTRX), which must take
+    object space to screen space, as for pvr_dr_transform_strip(). There is no
+    near plane clipping: vertices behind the camera are pushed just in front
+    of it, which distorts the volume, so it should be kept in front of the
+    camera with a suitable extrusion distance.
+*/
+
+/** \brief   A shadow mesh.
+    \ingroup pvr_shadow
+
+    \headerfile dc/pvr/pvr_shadow.h
+*/
+typedef struct pvr_shadow_mesh {
+    const vec3f_t *verts;           /**< \brief Vertex positions */
+    size_t vert_count;              /**< \brief Number of vertices */
+    const uint16_t *tris;           /**< \brief Vertex indices, 3 per triangle */
+    size_t tri_count;               /**< \brief Number of triangles */
+    vec3f_t *normals;               /**< \brief Triangle normals */
+    struct pvr_shadow_edge *edges;  /**< \brief Edges and their triangles */
+    size_t edge_count;              /**< \brief Number of edges */
+    uint8_t *facing;                /**< \brief Triangles facing the light */
+    vec3f_t *xf;                    /**< \brief Transformed vertices */
+} pvr_shadow_mesh_t;
+
+/** \brief   Set up a shadow mesh.
+    \ingroup pvr_shadow
+
+    The vertices and indices aren't copied, and must stay around as long
+    as the shadow mesh does. Vertices may move, as long as
+    pvr_shadow_mesh_update() is called afterwards.
+
+    \param  m               The shadow mesh.
+    \param  verts           The vertex positions.
+    \param  vert_count      The number of vertices.
+    \param  tris            The vertex indices, 3 for each triangle.
+    \param  tri_count       The number of triangles.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set.
+
+    \par    Error Conditions:
+    \em     EINVAL - the mesh isn't closed (each edge must be shared by
+                     exactly two triangles), or is too big \n
+    \em     ENOMEM - out of memory
+*/
+int pvr_shadow_mesh_init(pvr_shadow_mesh_t *m, const vec3f_t *verts,
+                         size_t vert_count, const uint16_t *tris,
+                         size_t tri_count);
+
+/** \brief   Free what a shadow mesh allocated.
+    \ingroup pvr_shadow
+
+    \param  m               The shadow mesh.
+*/
+void pvr_shadow_mesh_destroy(pvr_shadow_mesh_t *m);
+
+/** \brief   Update the normals of a shadow mesh after moving its vertices.
+    \ingroup pvr_shadow
+
+    \param  m               The shadow mesh.
+*/
+void pvr_shadow_mesh_update(pvr_shadow_mesh_t *m);
+
+/** \brief   Send the shadow volume of a mesh.
+    \ingroup pvr_shadow
+
+    The list is opened first if it isn't the one open.
+
+    \param  m               The shadow mesh.
+    \param  light           The direction the light shines in, in object
+                            space. It doesn't need to be normalized.
+    \param  dist            How far to push the volume along the light, in
+                            object space units of the light's length.
+    \param  list            \ref PVR_LIST_OP_MOD or \ref PVR_LIST_TR_MOD.
+    \param  mode            \ref PVR_MODIFIER_INCLUDE_LAST_POLY or
+                            \ref PVR_MODIFIER_EXCLUDE_LAST_POLY.
+    \retval 0               On success (including if nothing faces the light).
+    \retval -1              On failure, with errno set.
+*/
+int pvr_shadow_submit(pvr_shadow_mesh_t *m, const vec3f_t *light, float dist,
+                      pvr_list_t list, uint32_t mode);
+
+__END_DECLS
+
+#endif  /* __DC_PVR_PVR_SHADOW_H */
@@ -0,0 +1,130 @@
+/* KallistiOS ##version##
+
+   dc/pvr/pvr_sort.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file       dc/pvr/pvr_sort.h
+    \brief      Depth-sorted and state-batched polygon submission
+    \ingroup    pvr_sort
+*/
+
+#ifndef __DC_PVR_PVR_SORT_H
+#define __DC_PVR_PVR_SORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <kos/arena.h>
+
+/** \defgroup pvr_sort      Sorted translucent lists
+    \brief                  Submit translucent polygons back to front
+    \ingroup                pvr_scene_mgmt
+
+    With presort mode (see pvr_set_presort_mode()), the PVR draws translucent
+    polygons in the order they were submitted, so they have to be sent back to
+    front. A sort queue collects polygons along with their depth into an
+    arena, sorts them with a radix sort on a 16-bit key taken from the depth,
+    and sends them all to the translucent list at once, leaving out headers
+    that are the same as the one of the previous polygon.
+
+    The key is the top half of the floating point depth (the 1/w value given
+    to the PVR in vertices' z), which orders positive floats the same way they
+    compare, with more precision close to the camera.
+
+    The opaque and punch-through lists don't depend on the order polygons are
+    submitted in, so a sort queue started with pvr_sort_begin_batched() groups
+    their polygons by header instead: all of the polygons with the same header
+    (same texture, blending, and so on) are sent one after the other, under a
+    single copy of it. Scenes made of many small objects that share a few
+    materials, submitted object by object, then change TSP state once per
+    material rather than once per object. Within a group, polygons keep the
+    order they were added in.
+
+    A sort queue only lasts for a frame: begin it after pvr_scene_begin(),
+    which resets the frame arena.
+*/
+
+/** \brief   A sort queue.
+    \ingroup pvr_sort
+
+    \headerfile dc/pvr/pvr_sort.h
+*/
+typedef struct pvr_sort {
+    arena_t *arena;                 /**< \brief Where polygons are kept */
+    struct pvr_sort_item *items;    /**< \brief The queued polygons */
+    size_t count;                   /**< \brief Number of queued polygons */
+    size_t max;                     /**< \brief Maximum number of polygons */
+    size_t size;                    /**< \brief Size of the queued data */
+    pvr_list_t list;                /**< \brief The list it goes to */
+} pvr_sort_t;
+
+/** \brief   Start a sort queue for the translucent list of the frame.
+    \ingroup pvr_sort
+
+    \param  q               The sort queue.
+    \param  arena           The arena to keep polygons in, or NULL for the
+                            frame arena (see pvr_set_frame_arena()).
+    \param  max             The maximum number of polygons.
+    \retval 0               On success.
+    \retval -1              On failure (errno set to EINVAL if there's no
+                            arena, or ENOMEM).
+*/
+int pvr_sort_begin(pvr_sort_t *q, arena_t *arena, size_t max);
+
+/** \brief   Start a queue batching polygons by header for the frame.
+    \ingroup pvr_sort
+
+    \param  q               The sort queue.
+    \param  list            The list the polygons go to, \ref PVR_LIST_OP_POLY
+                            or \ref PVR_LIST_PT_POLY.
+    \param  arena           The arena to keep polygons in, or NULL for the
+                            frame arena (see pvr_set_frame_arena()).
+    \param  max             The maximum number of polygons.
+    \retval 0               On success.
+    \retval -1              On failure (errno set to EINVAL for another list
+                            or if there's no arena, or ENOMEM).
+*/
+int pvr_sort_begin_batched(pvr_sort_t *q, pvr_list_t list, arena_t *arena,
+                           size_t max);
+
+/** \brief   Queue a polygon.
+    \ingroup pvr_sort
+
+    The header and vertices are copied, so they don't need to be kept around.
+
+    \param  q               The sort queue.
+    \param  hdr             The header of the polygon.
+    \param  verts           The vertices of the polygon, the last one marked
+                            as the end of the strip.
+    \param  size            The size of the vertices, a multiple of 32 bytes.
+    \param  z               The depth of the polygon, as 1/w (larger is
+                            nearer). Ignored by batched queues.
+    \retval 0               On success.
+    \retval -1              On failure (errno set to ENOSPC if the queue is
+                            full, EINVAL for a bad size or ENOMEM).
+*/
+int pvr_sort_add(pvr_sort_t *q, const pvr_poly_hdr_t *hdr, const void *verts,
+                 size_t size, float z);
+
+/** \brief   Sort the queued polygons and submit them.
+    \ingroup pvr_sort
+
+    The polygons are sent to their list like pvr_dlist_replay() would, back
+    to front for \ref PVR_LIST_TR_POLY or grouped by header for the others,
+    and the queue is emptied. The list must be open, or not yet opened this
+    frame.
+
+    \param  q               The sort queue.
+    \retval 0               On success.
+    \retval -1              On failure (errno set to ENOMEM, or as
+                            pvr_dlist_replay() does).
+*/
+int pvr_sort_finish(pvr_sort_t *q);
+
+__END_DECLS
+
+#endif  /* __DC_PVR_PVR_SORT_H */
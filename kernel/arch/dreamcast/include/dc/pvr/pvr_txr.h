@@ -127,7 +127,8 @@ void pvr_txr_load(const void *src, pvr_ptr_t dst, size_t count);
     flags. It will currently always twiddle the data, whether you ask it to or
     not, and many of the parameters are just plain not supported at all...
     Pretty much the only supported flag, other than the format ones is the
-    PVR_TXRLOAD_INVERT_Y one.
+    PVR_TXRLOAD_INVERT_Y one. See pvr_txr_twiddle() for the constraints on the
+    texture size.
 
     This will be slower than using pvr_txr_load() in pretty much all cases, so
     unless you need to twiddle your texture, just use that instead.
@@ -143,6 +144,132 @@ void pvr_txr_load(const void *src, pvr_ptr_t dst, size_t count);
 void pvr_txr_load_ex(const void *src, pvr_ptr_t dst,
                      uint32_t w, uint32_t h, uint32_t flags);
 
+/** \brief   Twiddle texture data into a buffer.
+    \ingroup pvr_txr_mgmt
+
+    This function converts a texture to the twiddled layout of the PVR, 32
+    bytes of output at a time. The output can be PVR RAM or a buffer in main
+    RAM. The same flags as pvr_txr_load_ex() are supported.
+
+    \param  src             The texture to twiddle.
+    \param  dst             Where to write the twiddled texture.
+    \param  w               The width of the texture, in pixels. Must be a
+                            power of two, 8 or more.
+    \param  h               The height of the texture, in pixels. Must be a
+                            power of two, 8 or more.
+    \param  flags           Some set of flags, ORed together.
+    \return                 The number of bytes written to dst.
+
+    \see    pvr_txrload_constants
+*/
+size_t pvr_txr_twiddle(const void *src, void *dst,
+                       uint32_t w, uint32_t h, uint32_t flags);
+
+/** \brief   Twiddle a texture and load it into PVR RAM with DMA.
+    \ingroup pvr_txr_mgmt
+
+    This function twiddles the texture like pvr_txr_load_ex() does, but into a
+    staging buffer in main RAM, and then starts a DMA of that buffer to PVR RAM
+    without waiting for it to complete. The staging buffer must stay untouched
+    until the callback has been called.
+
+    \param  src             The texture to load.
+    \param  dst             The location to copy to. Must be 32-byte aligned.
+    \param  w               The width of the texture, in pixels.
+    \param  h               The height of the texture, in pixels.
+    \param  flags           Some set of flags, ORed together.
+    \param  staging         The staging buffer, 32-byte aligned, and big
+                            enough for the whole texture.
+    \param  callback        A function to call upon completion of the DMA, or
+                            NULL.
+    \param  cbdata          Data to pass to the callback function.
+    \retval 0               On success.
+    \retval -1              On failure. Sets errno as pvr_txr_load_dma() does,
+                            or to EFAULT if staging is not 32-byte aligned.
+*/
+int pvr_txr_load_ex_dma(const void *src, pvr_ptr_t dst,
+                        uint32_t w, uint32_t h, uint32_t flags, void *staging,
+                        pvr_dma_callback_t callback, void *cbdata);
+
+/** \brief   Texture upload handle.
+    \ingroup pvr_txr_mgmt
+
+    Identifies an upload queued with pvr_txr_upload(), to find out when it has
+    landed in PVR RAM. A handle of zero is always complete.
+*/
+typedef uint32_t pvr_upload_t;
+
+/** \brief   Maximum number of uploads in the queue at once.
+    \ingroup pvr_txr_mgmt
+*/
+#define PVR_UPLOAD_MAX  64
+
+/** \defgroup pvr_upload_prio   Upload priorities
+    \brief                      Priorities of queued texture uploads
+    \ingroup                    pvr_txr_mgmt
+
+    Uploads of a higher priority go first. Any value in between can be used.
+
+    @{
+*/
+#define PVR_UPLOAD_PRIO_LOW     0   /**< \brief Background streaming */
+#define PVR_UPLOAD_PRIO_NORMAL  8   /**< \brief Default priority */
+#define PVR_UPLOAD_PRIO_HIGH    15  /**< \brief Needed as soon as possible */
+/** @} */
+
+/** \brief   Queue a texture upload to PVR RAM.
+    \ingroup pvr_txr_mgmt
+
+    This function queues a DMA of already formatted texture data to PVR RAM,
+    and returns right away. Queued uploads are sent in pieces, in between the
+    vertex DMAs of the scenes, so that streaming textures in doesn't hold up
+    rendering.
+
+    An upload may be given a deadline: the fence of the scene that needs the
+    texture (the scene after the one pvr_scene_finish_async() last returned
+    the fence of has that fence plus one). Uploads that have to be done for
+    the scene being submitted go before any other, and the PVR won't start
+    rendering a scene before the uploads it needs are done.
+
+    The source data must stay untouched until the upload is complete.
+
+    \param  src             The texture data, 32-byte aligned.
+    \param  dst             The location to copy to, 32-byte aligned.
+    \param  count           The number of bytes to copy, a multiple of 32.
+    \param  prio            The priority of the upload, see
+                            \ref pvr_upload_prio.
+    \param  deadline        The fence of the scene that needs the texture, or 0
+                            for none.
+    \return                 The handle of the upload, or 0 on failure (errno
+                            set to EFAULT for misaligned pointers, EINVAL for a
+                            bad count and EAGAIN if the queue is full).
+*/
+pvr_upload_t pvr_txr_upload(const void *src, pvr_ptr_t dst, size_t count,
+                            int prio, pvr_fence_t deadline);
+
+/** \brief   Check if a queued texture upload is complete.
+    \ingroup pvr_txr_mgmt
+
+    \param  upload          The handle of the upload.
+    \retval 0               If the texture is in PVR RAM.
+    \retval -1              If the upload is still queued or in progress.
+*/
+int pvr_txr_upload_check(pvr_upload_t upload);
+
+/** \brief   Block the caller until a queued texture upload is complete.
+    \ingroup pvr_txr_mgmt
+
+    Use this before pointing a polygon context (see pvr_poly_cxt_txr()) at a
+    texture that may still be in flight, when it wasn't given a deadline.
+
+    \param  upload          The handle of the upload.
+    \param  timeout         The maximum time to wait, in milliseconds, or 0 to
+                            wait forever.
+    \retval 0               On success.
+    \retval -1              On timeout.
+*/
+int pvr_txr_upload_wait(pvr_upload_t upload, int timeout);
+
 /** \brief   Load a KOS Platform Independent Image (subject to constraint
              checking).
     \ingroup pvr_txr_mgmt
@@ -174,5 +301,59 @@ void pvr_txr_load_ex(const void *src, pvr_ptr_t dst,
 */
 void pvr_txr_load_kimg(const kos_img_t *img, pvr_ptr_t dst, uint32_t flags);
 
+/** \brief   Source of the rows of a streamed texture.
+    \ingroup pvr_txr_mgmt
+
+    Called by pvr_txr_load_stream() for each row of the image, in order from
+    the top, to write it into the buffer given.
+
+    \param  row             Where to write the row, in the source format.
+    \param  y               The row wanted.
+    \param  data            The data passed to pvr_txr_load_stream().
+    \retval 0               On success.
+    \retval -1              On failure, with errno set, which stops the load.
+*/
+typedef int (*pvr_txr_row_t)(void *row, uint32_t y, void *data);
+
+/** \brief   Load a texture row by row, from a decoder.
+    \ingroup pvr_txr_mgmt
+
+    This function twiddles a texture into PVR RAM without the whole image
+    ever being in main RAM: rows are asked of the callback eight at a time,
+    converted to the texture format if they need to be, then twiddled and
+    sent to PVR RAM with the store queues one 8x8 square at a time. Only a
+    few rows worth of memory are allocated while loading, which makes it a
+    good fit for image decoders that can hand out scanlines (like libpng or
+    libjpeg can).
+
+    Sources in a 16-bit or paletted format are loaded as they are. 24 and
+    32-bit ones are converted to the 16-bit format given by txr_fmt, where
+    \ref KOS_IMG_FMT_ARGB8888 pixels are read as 32-bit values (with the
+    blue byte first in memory), and \ref KOS_IMG_FMT_RGBA8888 and
+    \ref KOS_IMG_FMT_RGB888 ones as bytes, red first.
+
+    \param  dst             Where to load the texture. Must be 32-byte
+                            aligned.
+    \param  w               The width of the texture, a power of 2 from 8
+                            to 1024.
+    \param  h               The height of the texture, a power of 2 from 8
+                            to 1024.
+    \param  src_fmt         The format of the rows, see \ref kos_img_fmts.
+    \param  txr_fmt         For 24 and 32-bit sources, the texture format to
+                            convert to: \ref PVR_TXRFMT_RGB565,
+                            \ref PVR_TXRFMT_ARGB1555 or
+                            \ref PVR_TXRFMT_ARGB4444. Ignored otherwise.
+    \param  flags           \ref PVR_TXRLOAD_INVERT_Y, or 0.
+    \param  read_row        The source of the rows.
+    \param  data            Data to pass to read_row.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL for a bad
+                            size or format, ENOMEM if the row buffers can't be
+                            allocated, or as read_row set it.
+*/
+int pvr_txr_load_stream(pvr_ptr_t dst, uint32_t w, uint32_t h,
+                        uint32_t src_fmt, uint32_t txr_fmt, uint32_t flags,
+                        pvr_txr_row_t read_row, void *data);
+
 __END_DECLS
 #endif  /* __DC_PVR_PVR_TEXTURE_H */
@@ -0,0 +1,160 @@
+/* KallistiOS ##version##
+
+   dc/pvr/pvr_video.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file       dc/pvr/pvr_video.h
+    \brief      YUV420 video playback through the YUV converter
+    \ingroup    pvr_video
+*/
+
+#ifndef __DC_PVR_PVR_VIDEO_H
+#define __DC_PVR_PVR_VIDEO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+/** \defgroup pvr_video     Video playback
+    \brief                  Play YUV420 video with the YUV converter
+    \ingroup                pvr_txr_mgmt
+
+    A video player takes frames made of YUV420 macroblocks from a decoder
+    (MPEG-1, RoQ, ...), has the PVR's YUV converter turn them into YUV422
+    textures, and switches the texture to draw on vblanks, so that each frame
+    stays on screen for as many vblanks as it was given.
+
+    The decoder gets a frame buffer with pvr_video_frame_get(), writes
+    macroblocks into it (see pvr_video_macroblock()), and hands it back with
+    pvr_video_frame_push(). Frame buffers come from a ring, so the decoder can
+    run a few frames ahead. Frames are sent to the converter with DMA in the
+    background, into whichever of the two textures isn't being shown, once
+    the PVR is done rendering the scenes that used it. Scenes draw the
+    texture given by pvr_video_texture().
+
+    Conversions grab the PVR DMA channel whenever it's free. While a video
+    player is around, don't feed the YUV converter by other means.
+
+    @{
+*/
+
+/** \brief   Size of a macroblock, in bytes */
+#define PVR_VIDEO_MB_SIZE   384
+
+/** \brief   Offset of the 8x8 U block in a macroblock */
+#define PVR_VIDEO_MB_U      0
+
+/** \brief   Offset of the 8x8 V block in a macroblock */
+#define PVR_VIDEO_MB_V      64
+
+/** \brief   Offset of the four 8x8 Y blocks in a macroblock
+
+    The Y blocks are top left, top right, bottom left then bottom right.
+*/
+#define PVR_VIDEO_MB_Y      128
+
+/** \brief   Video player type */
+typedef struct pvr_video pvr_video_t;
+
+/** \brief   Create a video player.
+
+    Allocates the frame buffers in RAM, and two textures in PVR RAM, each as
+    wide and tall as the next power of two of the video's size. The texture
+    format is \ref PVR_TXRFMT_YUV422 | \ref PVR_TXRFMT_NONTWIDDLED.
+
+    \param  width           The width of the video. Must be a multiple of 16,
+                            up to 1024.
+    \param  height          The height of the video. Must be a multiple of 16,
+                            up to 1024.
+    \param  frames          The number of frame buffers in the ring. Must be
+                            at least 1.
+    \return                 The new player, or NULL on failure, with errno
+                            set.
+
+    \par    Error Conditions:
+    \em     EINVAL - invalid size or number of frames \n
+    \em     ENOMEM - out of memory
+*/
+pvr_video_t *pvr_video_create(size_t width, size_t height, size_t frames);
+
+/** \brief   Destroy a video player.
+
+    Waits for the conversion in progress, if any, and frees everything. The
+    textures must not be used by scenes still to be rendered.
+
+    \param  vid             The player.
+*/
+void pvr_video_destroy(pvr_video_t *vid);
+
+/** \brief   Get the next frame buffer to decode into.
+
+    Frame buffers are handed out in order; until it's pushed, the same one is
+    returned again. Macroblocks are laid out left to right, then top to bottom,
+    with rows as many macroblocks wide as the texture. The macroblocks past the
+    video's width are left as they are.
+
+    \param  vid             The player.
+    \param  timeout         The maximum time to wait for a free frame buffer,
+                            in milliseconds, or 0 to wait forever.
+    \return                 The frame buffer, or NULL on timeout.
+*/
+void *pvr_video_frame_get(pvr_video_t *vid, int timeout);
+
+/** \brief   Get a macroblock of a frame buffer.
+
+    \param  vid             The player.
+    \param  frame           The frame buffer.
+    \param  x               The column of the macroblock.
+    \param  y               The row of the macroblock.
+    \return                 Where to write the macroblock.
+*/
+uint8_t *pvr_video_macroblock(const pvr_video_t *vid, void *frame, size_t x,
+                              size_t y);
+
+/** \brief   Queue a decoded frame.
+
+    \param  vid             The player.
+    \param  frame           The frame buffer, from pvr_video_frame_get().
+    \param  vblanks         For how many vblanks the frame is shown, from the
+                            vblank it first is. Must be at least 1.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set.
+
+    \par    Error Conditions:
+    \em     EINVAL - frame isn't the next frame buffer, or vblanks is 0
+*/
+int pvr_video_frame_push(pvr_video_t *vid, void *frame, unsigned int vblanks);
+
+/** \brief   Get the texture to draw the current frame with.
+
+    Call this while submitting a scene, as the texture is kept from being
+    converted into until the PVR is done rendering it.
+
+    \param  vid             The player.
+    \return                 The texture, or NULL if no frame was shown yet.
+*/
+pvr_ptr_t pvr_video_texture(pvr_video_t *vid);
+
+/** \brief   Get the size of a video player's textures.
+
+    \param  vid             The player.
+    \param  w               Where to store the width, or NULL.
+    \param  h               Where to store the height, or NULL.
+*/
+void pvr_video_texture_size(const pvr_video_t *vid, size_t *w, size_t *h);
+
+/** \brief   Get the number of frames shown so far.
+
+    \param  vid             The player.
+    \return                 The number of frames shown.
+*/
+size_t pvr_video_frames_shown(const pvr_video_t *vid);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_PVR_PVR_VIDEO_H */
@@ -0,0 +1,150 @@
+/* KallistiOS ##version##
+
+   dc/pvr/pvr_vqstream.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file       dc/pvr/pvr_vqstream.h
+    \brief      Streaming VQ textures from files into PVR RAM
+    \ingroup    pvr_vqstream
+*/
+
+#ifndef __DC_PVR_PVR_VQSTREAM_H
+#define __DC_PVR_PVR_VQSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+/** \defgroup pvr_vqstream  VQ texture streaming
+    \brief                  Load VQ textures a chunk at a time
+    \ingroup                pvr_txr_mgmt
+
+    A VQ stream loads a VQ compressed texture, as written by pvrtex in its
+    .pvr or .dt formats (small codebooks included) or by vqenc as a .kmg file
+    or in a KMG pack, without holding up the caller or holding the whole file
+    in RAM. Each call to pvr_vq_stream_poll()
+    reads the next chunk of the file into one of two bounce buffers, and
+    queues it for upload to PVR RAM with pvr_txr_upload(), at low priority.
+
+    Mipmap levels are stored smallest first, so a mipmapped texture can be
+    drawn as soon as its codebook and first few levels are in: until the rest
+    arrives, pvr_vq_stream_cxt() sets up polygons with the largest level that's
+    complete, and the texture gets sharper as levels come in. Textures without
+    mipmaps, or that aren't square, can only be drawn once fully loaded.
+
+    @{
+*/
+
+/** \brief   Size of a chunk read by each call to pvr_vq_stream_poll() */
+#define PVR_VQ_STREAM_CHUNK     16384
+
+/** \brief   VQ stream type */
+typedef struct pvr_vq_stream pvr_vq_stream_t;
+
+/** \brief   Start loading a VQ texture.
+
+    Opens the file, reads its header and allocates the texture in PVR RAM. No
+    texture data is read yet.
+
+    \param  fn              The .pvr, .dt or .kmg file to load.
+    \return                 The new stream, or NULL on failure, with errno
+                            set.
+
+    \par    Error Conditions:
+    \em     ENOENT - the file can't be opened \n
+    \em     EINVAL - the file isn't a VQ texture in a known format, or is cut
+                     short \n
+    \em     ENOMEM - out of memory or PVR RAM
+*/
+pvr_vq_stream_t *pvr_txr_load_vq_stream(const char *fn);
+
+/** \brief   Start loading a VQ texture from a KMG pack.
+
+    KMG packs, written by vqenc and kmgenc with -p, hold many textures with a
+    table of contents up front, and each texture's data 2048-byte aligned, so
+    that it can be read from disc in one go. This finds the texture in the
+    table, and otherwise works like pvr_txr_load_vq_stream().
+
+    \param  fn              The pack to load from.
+    \param  name            The texture's name, which is its source image's
+                            file name without the directory or extension.
+    \return                 The new stream, or NULL on failure, with errno
+                            set.
+
+    \par    Error Conditions:
+    \em     ENOENT - the file can't be opened, or has no such texture \n
+    \em     EINVAL - the file isn't a KMG pack, or the texture isn't VQ
+                     compressed and twiddled \n
+    \em     ENOMEM - out of memory or PVR RAM
+*/
+pvr_vq_stream_t *pvr_txr_load_vq_stream_pack(const char *fn, const char *name);
+
+/** \brief   Destroy a VQ stream.
+
+    Waits for uploads in flight, closes the file and frees the texture, which
+    must not be used by scenes still to be rendered.
+
+    \param  s               The stream.
+*/
+void pvr_vq_stream_destroy(pvr_vq_stream_t *s);
+
+/** \brief   Move a VQ stream along.
+
+    Reads the next chunk of the file and queues its upload. If both bounce
+    buffers are in use, this waits for the oldest upload first. Once all of the
+    file is read, the file is closed.
+
+    \param  s               The stream.
+    \retval 1               If there is more to load.
+    \retval 0               If the texture is fully loaded.
+    \retval -1              On failure, with errno set.
+
+    \par    Error Conditions:
+    \em     EIO - the file can't be read \n
+    \em     EAGAIN - the upload queue is full; try again later
+*/
+int pvr_vq_stream_poll(pvr_vq_stream_t *s);
+
+/** \brief   Get the size of the texture that can be drawn so far.
+
+    \param  s               The stream.
+    \param  w               Where to store the width, or NULL.
+    \param  h               Where to store the height, or NULL.
+    \retval 0               If the texture can be drawn at that size.
+    \retval -1              If nothing can be drawn yet.
+*/
+int pvr_vq_stream_size(const pvr_vq_stream_t *s, size_t *w, size_t *h);
+
+/** \brief   Fill a polygon context to draw a VQ stream's texture.
+
+    The context uses the largest size that can be drawn so far (see
+    pvr_vq_stream_size()), so call this again for each scene while the texture
+    loads.
+
+    \param  s               The stream.
+    \param  dst             The context to fill.
+    \param  list            The primitive list to be used.
+    \param  filtering       The type of filtering to use.
+    \retval 0               On success.
+    \retval -1              If nothing can be drawn yet, with errno set to
+                            EAGAIN.
+*/
+int pvr_vq_stream_cxt(const pvr_vq_stream_t *s, pvr_poly_cxt_t *dst,
+                      pvr_list_t list, int filtering);
+
+/** \brief   Get the texture of a VQ stream.
+
+    \param  s               The stream.
+    \return                 The texture address, already adjusted for small
+                            codebooks.
+*/
+pvr_ptr_t pvr_vq_stream_texture(const pvr_vq_stream_t *s);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_PVR_PVR_VQSTREAM_H */
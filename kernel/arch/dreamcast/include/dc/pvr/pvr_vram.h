@@ -0,0 +1,138 @@
+/* KallistiOS ##version##
+
+   dc/pvr/pvr_vram.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file       dc/pvr/pvr_vram.h
+    \brief      Handle-based, compactable VRAM allocator.
+    \ingroup    pvr_vram_pool
+
+    This file contains an alternative to pvr_mem_malloc() for programs that
+    stream textures in and out for a long time. Blocks are referred to by
+    handle instead of by address, which lets pvr_vram_compact() move them
+    around to merge the free space back together, so that fragmentation can't
+    eventually make an allocation fail while plenty of memory is free.
+*/
+
+#ifndef __DC_PVR_PVR_VRAM_H
+#define __DC_PVR_PVR_VRAM_H
+
+#include <stddef.h>
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <dc/pvr/pvr_mem.h>
+
+/** \defgroup pvr_vram_pool   Handle Allocator
+    \brief                    Compactable, handle-based VRAM allocator
+    \ingroup                  pvr_vram
+
+    The pool is a single region of texture RAM taken from pvr_mem_malloc() by
+    pvr_vram_init(). Free space is kept in best-fit buckets by power of two,
+    so that power-of-two sized textures find an exact fit whenever one is
+    available.
+
+    The address of a block is only valid until the next call to
+    pvr_vram_compact(), so pvr_vram_ptr() must be called again (and polygon
+    headers recompiled) after compacting. Blocks allocated with
+    \ref PVR_VRAM_PINNED never move.
+
+    @{
+*/
+
+/** \brief  Handle to a block of the VRAM pool. */
+typedef int pvr_vram_t;
+
+/** \brief  Invalid VRAM handle, returned on errors. */
+#define PVR_VRAM_INVALID    -1
+
+/** \brief  Allocation flag: the block is never moved by compaction. */
+#define PVR_VRAM_PINNED     0x01
+
+/** \brief  VRAM pool statistics.
+
+    \headerfile dc/pvr/pvr_vram.h
+*/
+typedef struct pvr_vram_stats {
+    size_t size;            /**< \brief Total size of the pool */
+    size_t used;            /**< \brief Bytes allocated */
+    size_t largest_free;    /**< \brief Size of the largest free block */
+    size_t blocks;          /**< \brief Number of allocated blocks */
+    size_t holes;           /**< \brief Number of free blocks */
+} pvr_vram_stats_t;
+
+/** \brief  Set up the VRAM pool.
+
+    \param  size            The size of the pool, in bytes.
+
+    \retval 0               On success.
+    \retval -1              On failure (errno set to EBUSY if the pool was
+                            already set up, ENOMEM if the VRAM or the
+                            bookkeeping could not be allocated).
+*/
+int pvr_vram_init(size_t size);
+
+/** \brief  Release the VRAM pool.
+
+    All handles become invalid, and the VRAM goes back to pvr_mem_free().
+    This must be done before pvr_mem_reset() or pvr_shutdown().
+*/
+void pvr_vram_shutdown(void);
+
+/** \brief  Allocate a block from the VRAM pool.
+
+    \param  size            The size of the block. It is rounded up to a
+                            multiple of 32 bytes.
+    \param  flags           \ref PVR_VRAM_PINNED, or 0.
+
+    \return                 A handle to the block, or \ref PVR_VRAM_INVALID if
+                            there is no free block large enough (errno set to
+                            ENOMEM).
+*/
+pvr_vram_t pvr_vram_alloc(size_t size, unsigned int flags);
+
+/** \brief  Free a block of the VRAM pool.
+
+    \param  hnd             The handle of the block to free.
+*/
+void pvr_vram_free(pvr_vram_t hnd);
+
+/** \brief  Get the current address of a block.
+
+    \param  hnd             The handle of the block.
+    \return                 The address of the block in texture RAM (valid
+                            until the next pvr_vram_compact()), or NULL if the
+                            handle isn't valid.
+*/
+pvr_ptr_t pvr_vram_ptr(pvr_vram_t hnd);
+
+/** \brief  Compact the VRAM pool.
+
+    This slides movable blocks down into the free space below them, merging
+    the free space towards the top of the pool. The PVR must not be using any
+    texture of the pool while this runs, so call it once the last frame has
+    been rendered (for instance after pvr_wait_render_done()) and before any
+    polygon referencing pool textures is submitted for the next one.
+
+    \param  max_bytes       The maximum number of bytes to move in this call,
+                            or 0 for no limit. Spreading the work over several
+                            frames keeps each call short.
+
+    \return                 The number of blocks that were moved. Their
+                            addresses must be refetched with pvr_vram_ptr().
+*/
+size_t pvr_vram_compact(size_t max_bytes);
+
+/** \brief  Retrieve the statistics of the VRAM pool.
+
+    \param  stats           Where to store the statistics.
+*/
+void pvr_vram_get_stats(pvr_vram_stats_t *stats);
+
+/** @} */
+
+__END_DECLS
+
+#endif /* __DC_PVR_PVR_VRAM_H */
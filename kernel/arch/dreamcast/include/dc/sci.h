@@ -269,6 +269,32 @@ sci_result_t sci_spi_dma_write_data(const uint8_t *tx_data, size_t len, dma_call
 */
 sci_result_t sci_spi_dma_read_data(uint8_t *rx_data, size_t len, dma_callback_t callback, void *cb_data);
 
+/** \brief  Write multiple bytes to the SPI device using DMA, with their CRC.
+
+    This works out the CRC16-CCITT of the data (as net_crc16ccitt() does)
+    while the DMA sends it, and waits for the transfer to complete.
+
+    \param  tx_data         Buffer containing data to write.
+    \param  len             Number of bytes to transfer.
+    \param  crc             The CRC to carry on from (0 for a new one),
+                            updated with the data.
+    \return                 SCI_OK on success, error code otherwise.
+*/
+sci_result_t sci_spi_dma_write_data_crc(const uint8_t *tx_data, size_t len, uint16_t *crc);
+
+/** \brief  Read multiple bytes from the SPI device using DMA, with their CRC.
+
+    The CRC16-CCITT of the data (as net_crc16ccitt() works out) is updated as
+    each byte comes in, while the next ones are being clocked in.
+
+    \param  rx_data         Buffer to store received data.
+    \param  len             Number of bytes to transfer.
+    \param  crc             The CRC to carry on from (0 for a new one),
+                            updated with the data.
+    \return                 SCI_OK on success, error code otherwise.
+*/
+sci_result_t sci_spi_dma_read_data_crc(uint8_t *rx_data, size_t len, uint16_t *crc);
+
 /** @} */
 
 __END_DECLS
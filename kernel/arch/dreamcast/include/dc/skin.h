@@ -0,0 +1,80 @@
+/* KallistiOS ##version##
+
+   dc/skin.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    dc/skin.h
+    \brief   Matrix palette skinning.
+    \ingroup math_skin
+
+    This file contains linear blend skinning of vertices by up to four bones
+    each, done with the SH4's matrix unit.
+*/
+
+#ifndef __DC_SKIN_H
+#define __DC_SKIN_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <dc/matrix.h>
+#include <dc/vec3f.h>
+
+/** \defgroup math_skin Skinning
+    \brief              Blend vertices between bone matrices
+    \ingroup            math
+
+    Each vertex is transformed by each of its bones' matrices with ftrv, and
+    the results are added up by weight. A bone's matrix is only loaded into
+    XMTRX when it differs from the last one used, so meshes whose vertices are
+    sorted by their first bone, as most exporters write them, load each
+    matrix about once for their rigid parts.
+
+    The current matrix is saved and put back around each call. The results
+    are in the space the bone matrices take the vertices to; project them
+    afterwards with vec_transform_project() or the like.
+
+    @{
+*/
+
+/** \brief   Most bones a vertex can be blended between. */
+#define SKIN_MAX_BONES  4
+
+/** \brief   The bones a vertex follows.
+
+    Bones are used in order until one with a weight of 0, so a vertex with
+    just one bone has weight[0] = 1 and weight[1] = 0. The weights should add
+    up to 1.
+
+    \headerfile dc/skin.h
+*/
+typedef struct skin_influence {
+    uint8_t bone[SKIN_MAX_BONES];   /**< \brief Indexes into the palette */
+    float weight[SKIN_MAX_BONES];   /**< \brief How much each bone counts */
+} skin_influence_t;
+
+/** \brief   Skin vertices.
+
+    \param  bones           The bone matrices, each 8-byte aligned.
+    \param  inf             The bones of each vertex.
+    \param  pos             The positions to skin.
+    \param  nrm             The normals to skin, or NULL. Normals are not
+                            renormalized; see vec_normalize_batch().
+    \param  out_pos         Where to store the skinned positions. This may
+                            be pos.
+    \param  out_nrm         Where to store the skinned normals, if nrm isn't
+                            NULL. This may be nrm.
+    \param  count           The number of vertices.
+*/
+void skin_transform(const matrix_t *bones, const skin_influence_t *inf,
+                    const vec3f_t *pos, const vec3f_t *nrm, vec3f_t *out_pos,
+                    vec3f_t *out_nrm, size_t count);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_SKIN_H */
@@ -0,0 +1,87 @@
+/* KallistiOS ##version##
+
+   dc/sound/adpcm.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    dc/sound/adpcm.h
+    \brief   Encoding of Yamaha ADPCM at runtime.
+    \ingroup audio_adpcm
+
+    This file contains an encoder from 16-bit PCM to the 4-bit Yamaha ADPCM
+    the AICA plays, fast enough to run on audio as it's generated.
+*/
+
+#ifndef __DC_SOUND_ADPCM_H
+#define __DC_SOUND_ADPCM_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** \defgroup audio_adpcm   ADPCM encoding
+    \brief                  Encode PCM to AICA ADPCM at runtime
+    \ingroup                audio
+
+    ADPCM samples take a quarter of the sound RAM and of the G2 bus bandwidth
+    16-bit samples do, which is worth having for audio made as the game runs,
+    such as voice chat or generated music. The encoder can feed a stream
+    started with snd_stream_start_adpcm(), best through
+    snd_stream_set_callback_split(), which takes the channels apart as the
+    stream plays them.
+
+    An encoder's state follows the state the AICA will be in as it decodes,
+    so a stream must be encoded with the same state from its first sample on,
+    and a new state is needed when starting over.
+
+    @{
+*/
+
+/** \brief   ADPCM encoder state, for one channel.
+
+    \headerfile dc/sound/adpcm.h
+*/
+typedef struct snd_adpcm_state {
+    int16_t history;        /**< \brief Last decoded sample */
+    int16_t step;           /**< \brief Current step size */
+} snd_adpcm_state_t;
+
+/** \brief   Set up an encoder state for a new stream.
+
+    \param  st              The state to set up.
+*/
+void snd_adpcm_init(snd_adpcm_state_t *st);
+
+/** \brief   Encode mono PCM.
+
+    \param  st              The channel's encoder state.
+    \param  out             Where to store the ADPCM data, half a byte per
+                            sample.
+    \param  in              16-bit PCM samples.
+    \param  samples         The number of samples, which must be even.
+    \return                 The number of bytes stored.
+*/
+size_t snd_adpcm_encode(snd_adpcm_state_t *st, uint8_t *out,
+                        const int16_t *in, size_t samples);
+
+/** \brief   Encode interleaved stereo PCM into a buffer for each channel.
+
+    \param  st              The encoder states of the left and right
+                            channels.
+    \param  left            Where to store the left channel's ADPCM data.
+    \param  right           Where to store the right channel's ADPCM data.
+    \param  in              Interleaved 16-bit PCM samples.
+    \param  frames          The number of sample pairs, which must be even.
+    \return                 The number of bytes stored for each channel.
+*/
+size_t snd_adpcm_encode_stereo(snd_adpcm_state_t st[2], uint8_t *left,
+                               uint8_t *right, const int16_t *in,
+                               size_t frames);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_SOUND_ADPCM_H */
@@ -77,7 +77,10 @@ typedef struct aica_channel {
     uint32      vol;        /**< \brief Volume 0-255 */
     uint32      pan;        /**< \brief Pan 0-255 */
     uint32      pos;        /**< \brief Sample playback pos */
-    uint32      pad[5];     /**< \brief Padding */
+    uint32      keyon;      /**< \brief Sample clock at key-on, or 0 if not
+                                         keyed on (status); the time to key
+                                         on at for AICA_CH_START_AT */
+    uint32      pad[4];     /**< \brief Padding */
 } aica_channel_t;
 
 /** \brief Macro for declaring an aica channel command
@@ -97,6 +100,54 @@ typedef struct aica_channel {
 /** \brief Size of an AICA channel command in words */
 #define AICA_CMDSTR_CHANNEL_SIZE    ((sizeof(aica_cmd_t) + sizeof(aica_channel_t))/4)
 
+/** \brief Number of sources the mixer can mix */
+#define AICA_MIX_MAX_SOURCES    16
+
+/** \brief AICA command payload data for AICA_CMD_MIX_START
+
+    This is the aica_cmd_t::cmd_data for AICA_CMD_MIX_START. The mixer plays
+    its output through two channels, each looping over a ring of 16-bit
+    samples in sound RAM.
+
+    Sources are started, stopped and updated with AICA_CMD_MIX_SRC, which
+    takes an aica_channel_t just like AICA_CMD_CHAN does, with the source
+    number in aica_cmd_t::cmd_id.
+*/
+typedef struct aica_mixer {
+    uint32      left_chn;   /**< \brief Channel playing the left ring */
+    uint32      right_chn;  /**< \brief Channel playing the right ring */
+    uint32      left;       /**< \brief Left ring in RAM */
+    uint32      right;      /**< \brief Right ring in RAM */
+    uint32      size;       /**< \brief Ring length, in samples */
+    uint32      freq;       /**< \brief Output frequency */
+    uint32      vol;        /**< \brief Output volume 0-255 */
+    uint32      pad[9];     /**< \brief Padding */
+} aica_mixer_t;
+
+/** \brief Macro for declaring an aica mixer command
+
+    \param T        Buffer name
+    \param CMDR     aica_cmd_t pointer name
+    \param MIXR     aica_mixer_t pointer name
+*/
+#define AICA_CMDSTR_MIXER(T, CMDR, MIXR) \
+    uint32   T[(sizeof(aica_cmd_t) + sizeof(aica_mixer_t)) / 4]; \
+    aica_cmd_t  * CMDR = (aica_cmd_t *)T; \
+    aica_mixer_t  * MIXR = (aica_mixer_t *)(CMDR->cmd_data);
+
+/** \brief Size of an AICA mixer command in words */
+#define AICA_CMDSTR_MIXER_SIZE      ((sizeof(aica_cmd_t) + sizeof(aica_mixer_t))/4)
+
+/** \brief Mixer status, kept up to date by the AICA
+
+    This is READ-ONLY from the SH-4 side.
+*/
+typedef struct aica_mix_status {
+    uint32      running;    /**< \brief 1 while the mixer is on */
+    uint32      playing;    /**< \brief Bitmask of the sources playing */
+    uint32      pos[AICA_MIX_MAX_SOURCES]; /**< \brief Source positions */
+} aica_mix_status_t;
+
 /** \defgroup audio_aica_cmd Commands
     \brief                   Values of commands for aica_cmd_t
     @{
@@ -105,6 +156,9 @@ typedef struct aica_channel {
 #define AICA_CMD_PING       0x00000001  /**< \brief Check for signs of life  */
 #define AICA_CMD_CHAN       0x00000002  /**< \brief Perform a wavetable action   */
 #define AICA_CMD_SYNC_CLOCK 0x00000003  /**< \brief Reset the millisecond clock  */
+#define AICA_CMD_MIX_START  0x00000004  /**< \brief Start the mixer   */
+#define AICA_CMD_MIX_STOP   0x00000005  /**< \brief Stop the mixer    */
+#define AICA_CMD_MIX_SRC    0x00000006  /**< \brief Perform a mixer source action */
 /** @} */
 
 /** \defgroup audio_aica_resp Responses
@@ -114,6 +168,21 @@ typedef struct aica_channel {
 #define AICA_RESP_NONE      0x00000000  /**< \brief No response */
 #define AICA_RESP_PONG      0x00000001  /**< \brief Response to CMD_PING */
 #define AICA_RESP_DBGPRINT  0x00000002  /**< \brief Payload is a C string */
+#define AICA_RESP_CHAN_POS  0x00000003  /**< \brief Channel cmd_id passed a
+                                                    quarter of its loop, and
+                                                    is at misc[0] */
+/** @} */
+
+/** \defgroup audio_aica_caps Capabilities
+    \brief                    What the loaded driver supports, as reported by
+                              snd_driver_caps()
+    @{
+*/
+#define AICA_CAP_MIXER      0x00000001  /**< \brief The AICA_CMD_MIX_* commands */
+#define AICA_CAP_CHAN_POS   0x00000002  /**< \brief AICA_CH_START_NOTIFY, and
+                                                    AICA_RESP_CHAN_POS */
+#define AICA_CAP_SAMPLE_CLOCK 0x00000004 /**< \brief AICA_MEM_TICKS, key-on
+                                                    times, AICA_CH_START_AT */
 /** @} */
 
 /** \defgroup audio_aica_ch_cmd Channel Commands
@@ -132,10 +201,16 @@ typedef struct aica_channel {
     \brief                        Start values for AICA channels
     @{
 */
-#define AICA_CH_START_MASK  0x00300000 /**< \brief Mask for start values */
+#define AICA_CH_START_MASK  0x00f00000 /**< \brief Mask for start values */
 
 #define AICA_CH_START_DELAY 0x00100000 /**< \brief Set params, but delay key-on */
 #define AICA_CH_START_SYNC  0x00200000 /**< \brief Set key-on for all selected channels */
+#define AICA_CH_START_NOTIFY 0x00400000 /**< \brief Send AICA_RESP_CHAN_POS and
+                                                    interrupt the SH-4 at each
+                                                    quarter of the loop */
+#define AICA_CH_START_AT    0x00800000 /**< \brief With AICA_CH_START_SYNC, key
+                                                    on when the sample clock
+                                                    reaches keyon */
 /** @} */
 
 /** \defgroup audio_aica_ch_update Channel Update Values 
@@ -0,0 +1,104 @@
+/* KallistiOS ##version##
+
+   dc/sound/cdstream.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    dc/sound/cdstream.h
+    \brief   Streaming audio from the disc.
+    \ingroup audio_cdstream
+
+    This file contains a source for sound streams that reads straight from
+    a file on the GD-ROM, well ahead of playback.
+*/
+
+#ifndef __DC_SOUND_CDSTREAM_H
+#define __DC_SOUND_CDSTREAM_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <dc/sound/stream.h>
+
+/** \defgroup audio_cdstream Disc streams
+    \brief                   Sound streams played from the GD-ROM
+    \ingroup                 audio_streaming
+
+    A disc stream feeds a sound stream from a file on /cd, bypassing the
+    ISO9660 cache. A thread reads the file ahead into a ring of sectors in
+    RAM, DMAed in with cdrom_stream_start() and cdrom_stream_request(), and
+    the stream's callback hands the ring out from there. The ring is refilled
+    in bursts each time a quarter of it has been played, so the drive is left
+    free for loading other files in between. When loading other files takes
+    the drive from it mid-burst, the burst is read again once it's free.
+
+    The file holds the raw data, as the stream's format takes it: 16-bit or
+    8-bit PCM, or Yamaha ADPCM, with the channels interleaved if stereo. How
+    long the ring lasts depends on that format: the default one holds about
+    0.7s of 44.1kHz 16-bit stereo, or 3s of ADPCM.
+
+    A disc stream is opened on a stream that has been allocated, and takes
+    its callback over. The stream is then started and polled as usual (see
+    snd_stream_start() and snd_stream_autofill()).
+
+    @{
+*/
+
+/** \brief   Default ring size, in bytes */
+#define SND_CDSTREAM_RING   (128 * 1024)
+
+/** \brief   Open a disc stream.
+
+    This reads the start of the file into the ring before returning, so that
+    the stream can be started straight away.
+
+    \param  hnd             The stream to feed, as from snd_stream_alloc().
+    \param  fn              The file to play, on /cd.
+    \param  offset          Where the data starts in the file, in bytes. Must
+                            be a multiple of the sector size (2048).
+    \param  ring            The ring size in bytes, or 0 for the default.
+                            Rounded up to a whole number of sectors.
+    \param  loop            Non-zero to start over at the end of the data.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL for a bad
+                            handle or offset, or a file that isn't on /cd,
+                            ENOMEM if out of memory, or EIO if the disc can't
+                            be read.
+*/
+int snd_cdstream_open(snd_stream_hnd_t hnd, const char *fn, uint32_t offset,
+                      size_t ring, int loop);
+
+/** \brief   Close a disc stream.
+
+    The stream should be stopped first. It's left allocated, without a
+    callback.
+
+    \param  hnd             The stream.
+*/
+void snd_cdstream_close(snd_stream_hnd_t hnd);
+
+/** \brief   Check if a disc stream has handed out all of its data.
+
+    A looping stream never does, unless the disc can't be read.
+
+    \param  hnd             The stream.
+    \return                 Non-zero once everything read from the disc has
+                            been given to the stream.
+*/
+int snd_cdstream_done(snd_stream_hnd_t hnd);
+
+/** \brief   Get how far ahead of the stream a disc stream has read.
+
+    \param  hnd             The stream.
+    \return                 The number of bytes in the ring not yet given to
+                            the stream.
+*/
+size_t snd_cdstream_buffered(snd_stream_hnd_t hnd);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_SOUND_CDSTREAM_H */
@@ -0,0 +1,151 @@
+/* KallistiOS ##version##
+
+   dc/sound/mixer.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    dc/sound/mixer.h
+    \brief   Mixing of sound sources on the AICA.
+    \ingroup audio_mixer
+
+    This file contains the interface to the software mixer in the AICA
+    driver, which mixes several sources in sound RAM into one stereo output
+    without any help from the SH4.
+*/
+
+#ifndef __DC_SOUND_MIXER_H
+#define __DC_SOUND_MIXER_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** \defgroup audio_mixer   Mixer
+    \brief                  Mix sound sources on the AICA's ARM
+    \ingroup                audio
+
+    The mixer runs on the AICA's ARM. Each source is a sample in sound RAM
+    (see snd_mem_malloc()) with its own rate, volume and panning, played once
+    or looped. Sources are resampled to the mixer's output rate, mixed, and
+    played through two channels of their own, so a whole soundtrack of music
+    and ambience costs the SH4 nothing beyond a command when something
+    starts, stops or changes.
+
+    The ARM is slow enough that the mixer is best kept to a handful of
+    sources at 44.1kHz; use sound effects (\ref audio_sfx) for anything that
+    doesn't need to be mixed.
+
+    The output is a turn of the mixer's rings behind, around 90ms with the
+    default ring size.
+
+    @{
+*/
+
+/** \brief   Number of mixer sources */
+#define SND_MIXER_SOURCES   16
+
+/** \brief   Default length of the output rings, in samples */
+#define SND_MIXER_RING      4096
+
+/** \defgroup audio_mixer_fmt   Source formats
+    \brief                      Formats of mixer source samples
+    @{
+*/
+#define SND_MIXER_FMT_16BIT 0   /**< \brief Signed 16-bit PCM */
+#define SND_MIXER_FMT_8BIT  1   /**< \brief Signed 8-bit PCM */
+#define SND_MIXER_FMT_ADPCM 2   /**< \brief 4-bit Yamaha ADPCM */
+/** @} */
+
+/** \brief   Data for playing a mixer source.
+
+    \headerfile dc/sound/mixer.h
+*/
+typedef struct snd_mixer_play_data {
+    int src;                /**< \brief The source to play on, or -1 for the
+                                        next one free. */
+    uint32_t base;          /**< \brief The sample, in sound RAM. */
+    int fmt;                /**< \brief The sample's format. */
+    size_t len;             /**< \brief The sample's length, in samples. */
+    int freq;               /**< \brief The sample's rate. */
+    int vol;                /**< \brief Volume, from 0 to 255. */
+    int pan;                /**< \brief Panning. 0 is all the way to the left,
+                                        128 is center, 255 is all the way to
+                                        the right. */
+    int loop;               /**< \brief Whether to loop the sample. */
+    unsigned int loopstart; /**< \brief Loop start, in samples. */
+    unsigned int loopend;   /**< \brief Loop end, in samples, or 0 for the
+                                        end of the sample. */
+} snd_mixer_play_data_t;
+
+/** \brief   Start the mixer.
+
+    Two channels and two rings of sound RAM are taken for the output, until
+    snd_mixer_shutdown() is called.
+
+    \param  freq            The output rate.
+    \param  ring            The length of the output rings in samples, or 0
+                            for \ref SND_MIXER_RING. Longer rings add latency;
+                            short ones may not be kept filled.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if a
+                            parameter is out of range, ENOMEM if no
+                            channels or sound RAM are free, or ENOTSUP if the
+                            loaded driver has no mixer.
+*/
+int snd_mixer_init(uint32_t freq, size_t ring);
+
+/** \brief   Stop the mixer, giving back its channels and sound RAM. */
+void snd_mixer_shutdown(void);
+
+/** \brief   Play a sample on a mixer source.
+
+    Whatever the source was playing is stopped first.
+
+    \param  data            What to play, and how.
+    \return                 The source played on, or -1 on failure, with
+                            errno set to EINVAL if the mixer isn't started or
+                            a parameter is out of range, or EBUSY if no
+                            source is free.
+*/
+int snd_mixer_play(const snd_mixer_play_data_t *data);
+
+/** \brief   Stop a mixer source.
+
+    \param  src             The source.
+*/
+void snd_mixer_stop(int src);
+
+/** \brief   Change a playing source.
+
+    \param  src             The source.
+    \param  freq            The new rate, or -1 to leave it.
+    \param  vol             The new volume, or -1 to leave it.
+    \param  pan             The new panning, or -1 to leave it.
+*/
+void snd_mixer_update(int src, int freq, int vol, int pan);
+
+/** \brief   Check if a mixer source is playing.
+
+    This is as of the AICA's last pass over its sources, so a source just
+    played may not be playing yet.
+
+    \param  src             The source.
+    \return                 True if it's playing.
+*/
+bool snd_mixer_is_playing(int src);
+
+/** \brief   Get the position of a mixer source.
+
+    \param  src             The source.
+    \return                 The sample it's at.
+*/
+uint32_t snd_mixer_get_pos(int src);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_SOUND_MIXER_H */
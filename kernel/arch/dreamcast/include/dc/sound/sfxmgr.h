@@ -36,9 +36,31 @@ __BEGIN_DECLS
     \brief                  Sound Effect Playback and Management
     \ingroup                audio
 
+    Sound effects loaded from files with snd_sfx_load() or snd_sfx_load_ex()
+    are shared and can be evicted: loading the same file again returns the
+    same handle with one more reference, and when sound RAM runs out while
+    loading, the sound RAM of the least recently played of them that isn't
+    playing or pinned (see snd_sfx_pin()) is reused. An evicted sound effect
+    keeps its handle, and is loaded back in from its file the next time it is
+    played. Sound effects loaded from memory or from a file handle are never
+    evicted.
+
+    Channels for sound effects played without one given are picked among the
+    free ones in turn. When none are free, the playing effect with the lowest
+    priority is cut, and of those the quietest, then the oldest; an effect
+    never cuts one with a higher priority than its own. Each effect is also
+    in a category, which can be limited to a number of voices (see
+    snd_sfx_set_voice_limit()), so that, say, a burst of explosions can't
+    take the channels dialogue needs. snd_sfx_batch_begin() and
+    snd_sfx_batch_end() hold the effects started in between back, to be
+    started all at once.
+
     @{
 */
 
+/** \brief  Number of sound effect categories. */
+#define SND_SFX_CATEGORIES  8
+
 /** \brief  Sound effect handle type.
 
     Each loaded sound effect will be assigned one of these, which is to be used
@@ -71,6 +93,10 @@ typedef struct sfx_play_data {
     unsigned int loopstart;  /**< \brief Loop start index (in samples). */
     unsigned int loopend;    /**< \brief Loop end index (in samples). If loopend == 0,
                             the loop end will default to sfx size in samples. */
+    int priority;   /**< \brief Priority, for when channels run out. Higher
+                            priorities are cut last, and 0 is the default. */
+    int category;   /**< \brief Category, from 0 to SND_SFX_CATEGORIES - 1,
+                            for voice limits. */
 } sfx_play_data_t;
 
 /** \brief  Load a sound effect.
@@ -79,6 +105,9 @@ typedef struct sfx_play_data {
     it. The sound effect can be either stereo or mono, and must either be 8-bit
     or 16-bit uncompressed PCM samples, or 4-bit Yamaha ADPCM.
 
+    If the file is already loaded, its handle is returned again and must be
+    unloaded once more.
+
     \warning The sound effect you are loading must be at most 65534 samples
     in length.
 
@@ -94,6 +123,9 @@ sfxhnd_t snd_sfx_load(const char *fn);
     it. The sound effect can be either stereo or mono, and must either be 8-bit
     or 16-bit uncompressed PCM samples, or 4-bit Yamaha ADPCM.
 
+    If the file is already loaded with the same parameters, its handle is
+    returned again and must be unloaded once more.
+
     \warning The sound effect you are loading must be at most 65534 samples
     in length and multiple by 32 bytes for each channel.
 
@@ -164,12 +196,29 @@ sfxhnd_t snd_sfx_load_raw_buf(char *buf, size_t len, uint32_t rate, uint16_t bit
 /** \brief  Unload a sound effect.
 
     This function unloads a previously loaded sound effect, and frees the memory
-    associated with it.
+    associated with it once every reference to it has been unloaded.
 
     \param  idx             A handle to the sound effect to unload.
 */
 void snd_sfx_unload(sfxhnd_t idx);
 
+/** \brief  Get the sample rate of a sound effect.
+
+    \param  idx             A handle to the sound effect.
+    \return                 Its sample rate, in Hz.
+*/
+uint32_t snd_sfx_get_rate(sfxhnd_t idx);
+
+/** \brief  Pin a sound effect in sound RAM.
+
+    A pinned sound effect is never evicted to make room for others, so it can
+    always be played without having to be loaded back in from its file first.
+
+    \param  idx             A handle to the sound effect.
+    \param  pinned          Non-zero to pin the sound effect, 0 to unpin it.
+*/
+void snd_sfx_pin(sfxhnd_t idx, int pinned);
+
 /** \brief  Unload all loaded sound effects.
 
     This function unloads all previously loaded sound effect, and frees the
@@ -224,10 +273,40 @@ int snd_sfx_play_chn(int chn, sfxhnd_t idx, int vol, int pan);
     \param  data            The data structure containing the information needed
                             to play the sound effect.
 
-    \return                 chn
+    \return                 chn, or -1 on failure, with errno set to EBUSY if
+                            there's no channel free and none playing at or
+                            below the priority, or EINVAL if the category is
+                            out of range.
 */
 int snd_sfx_play_ex(sfx_play_data_t *data);
 
+/** \brief  Limit the number of voices of a category.
+
+    When the category has this many effects playing, a new one cuts one of
+    those instead of taking a channel of its own, or isn't played if they all
+    have a higher priority.
+
+    \param  category        The category.
+    \param  count           The most voices it can have playing, or 0 for no
+                            limit.
+    \retval 0               On success.
+    \retval -1              If a parameter is out of range, with errno set to
+                            EINVAL.
+*/
+int snd_sfx_set_voice_limit(int category, int count);
+
+/** \brief  Start holding sound effects back.
+
+    Sound effects started until snd_sfx_batch_end() is called are queued up,
+    and all start at once then. This is best done around all the effects of a
+    frame. Other users of the AICA's command queue (see
+    snd_sh4_to_aica_stop()) wait until the batch is done.
+*/
+void snd_sfx_batch_begin(void);
+
+/** \brief  Start the sound effects held back since snd_sfx_batch_begin(). */
+void snd_sfx_batch_end(void);
+
 /** \brief  Stop a single channel of sound.
 
     This function stops the specified channel of sound from playing. It does no
@@ -107,6 +107,17 @@ int snd_init(void);
 */
 void snd_shutdown(void);
 
+/** \brief  Find out what the loaded AICA driver supports.
+
+    A driver built before a feature was added (such as an out of date
+    prebuilt one) doesn't support it, and the functions that need it fail
+    with ENOTSUP. This says up front which ones those are.
+
+    \return                 The \ref audio_aica_caps "AICA_CAP_*" bits for what
+                            the driver supports, or 0 before snd_init().
+*/
+uint32_t snd_driver_caps(void);
+
 /** \brief  Copy a request packet to the AICA queue.
 
     This function is to put in a low-level request using the built-in streaming
@@ -118,6 +129,62 @@ void snd_shutdown(void);
 */
 int snd_sh4_to_aica(void *packet, uint32 size);
 
+/** \brief  A batch of AICA commands.
+
+    Commands for the AICA can be built up in one of these in main RAM, then
+    sent all at once with snd_cmd_batch_submit(). That writes them to the
+    command queue in bursts through the store queues rather than a dword at a
+    time, and lets the AICA see them with a single update of the queue head,
+    which is much cheaper than a snd_sh4_to_aica() call for each when many
+    channels change every frame.
+
+    \headerfile dc/sound/sound.h
+*/
+typedef struct snd_cmd_batch {
+    uint32_t *buf;          /**< \brief The commands, 32-byte aligned */
+    size_t size;            /**< \brief Room in buf, in uint32's */
+    size_t used;            /**< \brief uint32's of commands in buf */
+} snd_cmd_batch_t;
+
+/** \brief  Set up a batch of AICA commands.
+
+    \param  batch           The batch to set up.
+    \param  size            Room for commands, in uint32's.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to ENOMEM.
+*/
+int snd_cmd_batch_init(snd_cmd_batch_t *batch, size_t size);
+
+/** \brief  Free a batch of AICA commands.
+
+    \param  batch           The batch to free.
+*/
+void snd_cmd_batch_free(snd_cmd_batch_t *batch);
+
+/** \brief  Add a command to a batch.
+
+    \param  batch           The batch.
+    \param  packet          The command, as it would be given to
+                            snd_sh4_to_aica().
+    \param  size            The size of the command, in uint32's.
+    \retval 0               On success.
+    \retval -1              If there's no room left, with errno set to
+                            ENOSPC.
+*/
+int snd_cmd_batch_add(snd_cmd_batch_t *batch, const void *packet, uint32_t size);
+
+/** \brief  Send a batch of commands to the AICA.
+
+    The batch is emptied once sent.
+
+    \param  batch           The batch to send.
+    \retval 0               On success.
+    \retval -1              If the queue doesn't have room for the whole batch
+                            right now, with errno set to EAGAIN. The batch is
+                            kept, to send again once the AICA has caught up.
+*/
+int snd_cmd_batch_submit(snd_cmd_batch_t *batch);
+
 /** \brief  Begin processing AICA queue requests.
 
     This function begins processing of any queued requests in the AICA queue.
@@ -130,6 +197,18 @@ void snd_sh4_to_aica_start(void);
 */
 void snd_sh4_to_aica_stop(void);
 
+/** \brief  Get the AICA's sample clock.
+
+    The sample clock counts output samples at 44.1kHz since the driver was
+    loaded, and is what scheduled stream starts are given in (see
+    snd_stream_set_start_time()). It wraps around after about 27 hours.
+
+    \return                 The number of samples output so far, or 0 if
+                            the loaded driver has no sample clock (see
+                            snd_driver_caps()).
+*/
+uint32_t snd_sample_clock(void);
+
 /** \brief  Transfer a packet of data from the AICA's SH4 queue.
 
     This function is used to retrieve a packet of data from the AICA back to the
@@ -0,0 +1,109 @@
+/* KallistiOS ##version##
+
+   dc/sound/spatial.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    dc/sound/spatial.h
+    \brief   Positional audio.
+    \ingroup audio_spatial
+
+    This file contains a layer over the sound effect system that plays
+    sound effects from points in 3D space.
+*/
+
+#ifndef __DC_SOUND_SPATIAL_H
+#define __DC_SOUND_SPATIAL_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <stdint.h>
+#include <dc/vec3f.h>
+#include <dc/sound/sfxmgr.h>
+
+/** \defgroup audio_spatial Positional audio
+    \brief                  Sound effects played from points in space
+    \ingroup                audio_sfx
+
+    Each emitter plays a mono sound effect, with its volume falling off with
+    its distance to the listener, panned by which side of the listener it's
+    on, and pitched up or down by how fast the two are closing in on each
+    other. snd_spatial_update() works all of that out for a whole array of
+    emitters with the SH4's vector instructions, and sends the changes to the
+    AICA as one batch of commands (see snd_cmd_batch_submit()).
+
+    Volume is full within an emitter's minimum distance, falls off with the
+    inverse of the distance past that, and fades out to nothing at its
+    maximum distance.
+
+    @{
+*/
+
+/** \brief   The listener.
+
+    \headerfile dc/sound/spatial.h
+*/
+typedef struct snd_listener {
+    vec3f_t pos;            /**< \brief Position */
+    vec3f_t vel;            /**< \brief Velocity, in units per second */
+    vec3f_t right;          /**< \brief Unit vector to the listener's right */
+    float speed_of_sound;   /**< \brief In units per second, or 0 for no
+                                        doppler shift */
+} snd_listener_t;
+
+/** \brief   A sound emitter.
+
+    \headerfile dc/sound/spatial.h
+*/
+typedef struct snd_emitter {
+    vec3f_t pos;            /**< \brief Position */
+    vec3f_t vel;            /**< \brief Velocity, in units per second */
+    float min_dist;         /**< \brief Distance up to which it's at full
+                                        volume */
+    float max_dist;         /**< \brief Distance from which it's silent */
+    int vol;                /**< \brief Full volume, from 0 to 255 */
+    sfxhnd_t sfx;           /**< \brief The mono sound effect to play */
+    int loop;               /**< \brief Whether to loop it */
+    int priority;           /**< \brief See sfx_play_data_t::priority */
+    int category;           /**< \brief See sfx_play_data_t::category */
+    int chn;                /**< \brief The channel playing it, or -1 */
+} snd_emitter_t;
+
+/** \brief   Start an emitter playing.
+
+    \param  l               The listener.
+    \param  e               The emitter, which gets the channel it's played
+                            on.
+    \return                 The channel, or -1 on failure (see
+                            snd_sfx_play_ex()).
+*/
+int snd_spatial_play(const snd_listener_t *l, snd_emitter_t *e);
+
+/** \brief   Stop an emitter.
+
+    \param  e               The emitter.
+*/
+void snd_spatial_stop(snd_emitter_t *e);
+
+/** \brief   Update the volume, panning and pitch of emitters.
+
+    Call this once a frame, after moving the listener and emitters. Emitters
+    that aren't playing are skipped. An emitter that played a sound effect
+    once through should be stopped when it's done, or whatever gets its
+    channel next will be updated as well.
+
+    \param  l               The listener.
+    \param  e               The emitters.
+    \param  count           The number of emitters.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to ENOMEM.
+*/
+int snd_spatial_update(const snd_listener_t *l, snd_emitter_t *e, size_t count);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_SOUND_SPATIAL_H */
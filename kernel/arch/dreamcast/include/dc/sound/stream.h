@@ -96,6 +96,24 @@ typedef void *(*snd_stream_callback_t)(snd_stream_hnd_t hnd, int smp_req,
 typedef size_t (*snd_stream_callback_direct_t)(snd_stream_hnd_t hnd,
     uintptr_t left,  uintptr_t right,  size_t size_req);
 
+/** \brief  Split stream data callback type.
+
+    Functions for decoding stream data straight into buffers given by the
+    stream will be of this type, and can be registered with
+    snd_stream_set_callback_split(). The buffers are 32-byte aligned, and
+    are sent to the AICA by DMA as they are, so the data is only written once,
+    and never across the G2 bus by the CPU. Filters are not applied.
+
+    \param  hnd             The stream handle being referred to.
+    \param  left            Buffer for the left (or only) channel.
+    \param  right           Buffer for the right channel, or NULL if mono.
+    \param  size_req        Requested size for each channel, in bytes.
+    \return                 The size written to each channel, in bytes, or
+                            0 if there's no data.
+*/
+typedef int (*snd_stream_callback_split_t)(snd_stream_hnd_t hnd,
+    void *left, void *right, size_t size_req);
+
 /** \brief  Set the callback for a given stream.
 
     This function sets the get data callback function for a given stream,
@@ -116,6 +134,21 @@ void snd_stream_set_callback(snd_stream_hnd_t hnd, snd_stream_callback_t cb);
 */
 void snd_stream_set_callback_direct(snd_stream_hnd_t hnd, snd_stream_callback_direct_t cb);
 
+/** \brief  Set the callback for a given stream with split buffers.
+
+    This function sets the decode callback function for a given stream,
+    overwriting any old callback that may have been in place. It takes
+    precedence over the callback set with snd_stream_set_callback(), which
+    is only called when it returns 0.
+
+    The stream system must have been initialized with a non-zero buffer size
+    for the buffers to exist, see snd_stream_init_ex().
+
+    \param  hnd             The stream handle for the callback.
+    \param  cb              A pointer to the callback function.
+*/
+void snd_stream_set_callback_split(snd_stream_hnd_t hnd, snd_stream_callback_split_t cb);
+
 /** \brief  Set the user data for a given stream.
 
     This function sets the user data pointer for the given stream, overwriting
@@ -189,6 +222,41 @@ void snd_stream_filter_add(snd_stream_hnd_t hnd, snd_stream_filter_t filtfunc,
 void snd_stream_filter_remove(snd_stream_hnd_t hnd,
                               snd_stream_filter_t filtfunc, void *obj);
 
+/** \brief  Fastest resampling, with 4 taps. */
+#define SND_STREAM_RESAMPLE_FAST    0
+/** \brief  Resampling with 8 taps. */
+#define SND_STREAM_RESAMPLE_GOOD    1
+/** \brief  Best resampling, with 16 taps. */
+#define SND_STREAM_RESAMPLE_BEST    2
+
+/** \brief  Resample the data of a stream.
+
+    This function makes the data given by the stream's get data callback be
+    resampled from src_rate to dst_rate before it goes through the filters,
+    with a polyphase FIR filter. The callback is then asked for samples at
+    src_rate, and the stream is to be started at dst_rate. Only 16-bit PCM
+    streams are resampled.
+
+    If nothing else needs the stream to play at a given rate, it's cheaper to
+    just start it at the source rate, and let the AICA do the resampling.
+
+    This is to be called while the stream is stopped.
+
+    \param  hnd             The stream to resample.
+    \param  src_rate        The rate of the data from the callback, or 0 to
+                            stop resampling.
+    \param  dst_rate        The rate the stream is started at.
+    \param  quality         \ref SND_STREAM_RESAMPLE_FAST,
+                            \ref SND_STREAM_RESAMPLE_GOOD or
+                            \ref SND_STREAM_RESAMPLE_BEST.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL for a bad
+                            quality or a ratio that doesn't reduce to 512
+                            phases or less, or ENOMEM.
+*/
+int snd_stream_resample(snd_stream_hnd_t hnd, uint32_t src_rate,
+                        uint32_t dst_rate, int quality);
+
 /** \brief  Prefill the stream buffers.
 
     This function has no effect. The stream is prefilled on start.
@@ -324,6 +392,45 @@ void snd_stream_start_pcm8(snd_stream_hnd_t hnd, uint32_t freq, int st);
 */
 void snd_stream_start_adpcm(snd_stream_hnd_t hnd, uint32_t freq, int st);
 
+/** \brief  Schedule the next start of a stream.
+
+    This sets the next snd_stream_start() (or other start) of the stream to
+    key the stream on when the sample clock reaches the given time, rather
+    than as soon as the driver sees it. Streams scheduled for the same time
+    start on the same sample, so this is a way of starting several streams
+    together without queueing them all with snd_stream_queue_enable().
+
+    The time should be at least a few milliseconds away, for the start to
+    reach the driver in time; a time that has already passed starts the
+    stream straight away. Only one start is scheduled: the next one is
+    immediate again, unless this is called again.
+
+    \param  hnd             The stream to schedule.
+    \param  when            When to start, in samples of the clock returned
+                            by snd_sample_clock().
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to ENOTSUP if the
+                            loaded driver has no sample clock (see
+                            snd_driver_caps()).
+*/
+int snd_stream_set_start_time(snd_stream_hnd_t hnd, uint32_t when);
+
+/** \brief  Get how far a stream has played.
+
+    The stream's clock is worked out from the sample clock, so it's accurate
+    to the sample at any time, unlike the position of the stream in its
+    buffer, which only moves one refill at a time as far as the SH4 is
+    concerned. It counts samples at the stream's own rate, and keeps
+    counting for as long as the stream plays, looping or not.
+
+    \param  hnd             The stream to check.
+    \return                 The number of samples played since the stream
+                            keyed on, negative if its start is scheduled and
+                            hasn't been reached, or 0 if it's stopped or
+                            the loaded driver has no sample clock.
+*/
+int64_t snd_stream_clock(snd_stream_hnd_t hnd);
+
 /** \brief  Stop a stream.
 
     This function stops a stream, stopping any sound playing from it. This will
@@ -333,6 +440,26 @@ void snd_stream_start_adpcm(snd_stream_hnd_t hnd, uint32_t freq, int st);
 */
 void snd_stream_stop(snd_stream_hnd_t hnd);
 
+/** \brief  Have a stream refilled without polling it.
+
+    With this enabled, the AICA interrupts the SH4 each time the stream's play
+    position passes a quarter of its buffer, and the stream is polled from a
+    thread of its own there and then (see asic_evt_request_threaded_handler()),
+    so it doesn't need snd_stream_poll() calls, nor go quiet when they come
+    late. The stream's callbacks are then called from that thread. If the
+    loaded driver can't interrupt the SH4 (see snd_driver_caps()), a thread
+    polls the stream every few milliseconds instead.
+
+    This takes effect when the stream is next started. Don't call
+    snd_stream_poll() on the stream while it's enabled.
+
+    \param  hnd             The stream.
+    \param  enable          Non-zero to refill the stream by itself.
+    \retval 0               On success.
+    \retval -1              If the stream thread can't be started.
+*/
+int snd_stream_autofill(snd_stream_hnd_t hnd, int enable);
+
 /** \brief  Poll a stream.
 
     This function polls the specified stream to load more data if necessary. If
@@ -366,6 +493,21 @@ void snd_stream_volume(snd_stream_hnd_t hnd, int vol);
 */
 void snd_stream_pan(snd_stream_hnd_t hnd, int left_pan, int right_pan);
 
+/** \brief  Send the stream into the DSP.
+
+    This function sends the stream's channels into the AICA's DSP, the left
+    (or only) one into the given input and the right one into the next, see
+    spu_dsp_send().
+
+    \param  hnd             The stream to send.
+    \param  input           The DSP input for the left channel, 0-15 (0-14
+                            if streams are stereo).
+    \param  level           The level to send at, 0 (not sent) to 15.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL.
+*/
+int snd_stream_dsp_send(snd_stream_hnd_t hnd, int input, int level);
+
 /** @} */
 
 __END_DECLS
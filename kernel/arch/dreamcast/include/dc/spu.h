@@ -22,6 +22,8 @@
 #include <kos/cdefs.h>
 __BEGIN_DECLS
 
+#include <stddef.h>
+#include <stdint.h>
 #include <arch/memory.h>
 #include <dc/g2bus.h>
 
@@ -71,6 +73,72 @@ void spu_memload_sq(uintptr_t to, void *from, size_t length);
 */
 void spu_memload_dma(uintptr_t to, void *from, size_t length);
 
+/** \brief  Most asynchronous uploads queued at a time. */
+#define SPU_ASYNC_MAX   32
+
+/** \brief  Sound RAM upload fence.
+
+    Identifies an upload started with spu_memload_async(), to find out when
+    it's done. Fences of later uploads compare greater (modulo wrap-around),
+    and a fence of zero is always signaled.
+*/
+typedef uint32_t spu_fence_t;
+
+/** \brief  Copy a block of data to sound RAM by DMA, without waiting.
+
+    This queues up a DMA transfer to sound RAM and returns right away. Queued
+    uploads are done one after the other, each one being started from the
+    interrupt of the one before. The data must be left alone until the upload
+    is done, which the returned fence tells.
+
+    If the queue is full, this waits for an upload to be done first.
+
+    \param  to              The offset in sound RAM to copy to, 32-byte
+                            aligned. Do not include the 0xA0800000 part, it
+                            is implied.
+    \param  from            A pointer to copy from, 32-byte aligned.
+    \param  length          The number of bytes to copy. Rounded up to be a
+                            multiple of 32.
+    \return                 The fence of the upload, or 0 on failure, with
+                            errno set to EFAULT for unaligned addresses or no
+                            length, or to EAGAIN if the queue is full and this
+                            is called from an interrupt.
+*/
+spu_fence_t spu_memload_async(uintptr_t to, void *from, size_t length);
+
+/** \brief  Check if an upload to sound RAM is done.
+
+    \param  fence           The fence of the upload.
+    \retval 0               If the upload is done.
+    \retval -1              If it isn't done yet.
+*/
+int spu_fence_check(spu_fence_t fence);
+
+/** \brief  Block the caller until an upload to sound RAM is done.
+
+    Since uploads are done in order, this also waits for those queued before
+    it.
+
+    \param  fence           The fence of the upload.
+    \param  timeout         The maximum time to wait, in milliseconds, or 0 to
+                            wait forever.
+    \retval 0               On success.
+    \retval -1              On timeout.
+*/
+int spu_fence_wait(spu_fence_t fence, int timeout);
+
+/** \brief  Find the last upload still to be done into a part of sound RAM.
+
+    snd_mem_free() uses this to wait for uploads into a block before it lets
+    it go.
+
+    \param  to              The offset in sound RAM.
+    \param  length          The size of the part, in bytes.
+    \return                 The fence of the last upload into it, or 0 if
+                            there's none.
+*/
+spu_fence_t spu_memload_pending(uintptr_t to, size_t length);
+
 /** \brief  Copy a block of data from sound RAM.
 
     This function acts much like memcpy() but copies from the sound RAM area.
@@ -207,6 +275,183 @@ int spu_shutdown(void);
 /** \brief  Reset SPU channels. */
 void spu_reset_chans(void);
 
+/** \defgroup audio_dsp  DSP
+    \brief               Effects on the AICA's DSP
+    \ingroup             audio_driver
+
+    The AICA has a DSP that runs a program of up to 128 steps once per
+    sample, at 44.1kHz, alongside the channels. Channels are sent into it
+    through 16 inputs (MIXS), at a level of their own, see spu_dsp_send();
+    the program's 16 outputs (EFREG) are mixed with the channels' direct
+    output, see spu_dsp_output(). Delays are kept in a ring buffer in sound
+    RAM. Effects run there cost the SH4 nothing.
+
+    Two programs come ready to load: \ref spu_dsp_reverb and
+    \ref spu_dsp_lowpass. Both take the left and right inputs on MIXS 0 and 1
+    and give them out on EFREG 0 and 1.
+
+    Steps are made of the SPU_DSP_* fields ORed together. Each step does
+    ACC = X * Y + B, where X is an input (SPU_DSP_XSEL) or a temporary, Y a
+    coefficient (SPU_DSP_YSEL(1)), and B the last ACC (SPU_DSP_BSEL), a
+    temporary, or nothing (SPU_DSP_ZERO). What a step writes out is the ACC
+    of the step before it. Temporaries and ring buffer addresses move down
+    by one each sample, so a temporary written at index n is read back at
+    n + 1 on the next sample, and the ring buffer reads what was written at
+    an address as many samples ago as the two addresses are apart. Reads
+    from the ring buffer take two steps to arrive in the inputs
+    (SPU_DSP_IWT); reads and writes should be done on odd steps.
+
+    @{
+*/
+
+/** \name    DSP step fields
+    @{
+*/
+#define SPU_DSP_TRA(x)      ((uint64_t)(x) << 57)   /**< \brief Temporary read */
+#define SPU_DSP_TWT         (1ULL << 56)            /**< \brief Write temporary */
+#define SPU_DSP_TWA(x)      ((uint64_t)(x) << 49)   /**< \brief Temporary written */
+#define SPU_DSP_XSEL        (1ULL << 47)            /**< \brief X is the input */
+#define SPU_DSP_YSEL(x)     ((uint64_t)(x) << 45)   /**< \brief Y source (1 for
+                                                                a coefficient) */
+#define SPU_DSP_IRA(x)      ((uint64_t)(x) << 39)   /**< \brief Input read: ring
+                                                                data 0x00-0x1f,
+                                                                MIXS 0x20-0x2f,
+                                                                CDDA 0x30-0x31 */
+#define SPU_DSP_IWT         (1ULL << 38)            /**< \brief Store ring data */
+#define SPU_DSP_IWA(x)      ((uint64_t)(x) << 33)   /**< \brief Ring data stored */
+#define SPU_DSP_TABLE       (1ULL << 31)            /**< \brief Absolute address */
+#define SPU_DSP_MWT         (1ULL << 30)            /**< \brief Write ring buffer */
+#define SPU_DSP_MRD         (1ULL << 29)            /**< \brief Read ring buffer */
+#define SPU_DSP_EWT         (1ULL << 28)            /**< \brief Write output */
+#define SPU_DSP_EWA(x)      ((uint64_t)(x) << 24)   /**< \brief Output written */
+#define SPU_DSP_ADRL        (1ULL << 23)            /**< \brief Load address reg */
+#define SPU_DSP_FRCL        (1ULL << 22)            /**< \brief Load fraction reg */
+#define SPU_DSP_SHIFT(x)    ((uint64_t)(x) << 20)   /**< \brief Output shift */
+#define SPU_DSP_YRL         (1ULL << 19)            /**< \brief Latch Y from input */
+#define SPU_DSP_NEGB        (1ULL << 18)            /**< \brief Subtract B */
+#define SPU_DSP_ZERO        (1ULL << 17)            /**< \brief B is zero */
+#define SPU_DSP_BSEL        (1ULL << 16)            /**< \brief B is ACC */
+#define SPU_DSP_NOFL        (1ULL << 15)            /**< \brief Ring data not in
+                                                                float format */
+#define SPU_DSP_COEF(x)     ((uint64_t)(x) << 9)    /**< \brief Coefficient */
+#define SPU_DSP_MASA(x)     ((uint64_t)(x) << 2)    /**< \brief Ring address */
+#define SPU_DSP_ADREB       (1ULL << 1)             /**< \brief Add address reg */
+#define SPU_DSP_NXADR       (1ULL << 0)             /**< \brief Next address */
+/** @} */
+
+/** \brief   Coefficient for a value from -1.0 to just under 1.0 */
+#define SPU_DSP_COEF_VAL(f) \
+    ((int16_t)((f) >= 1.0f ? 4095 : (f) < -1.0f ? -4096 : (f) * 4096.0f))
+
+/** \name    Ring buffer lengths
+    @{
+*/
+#define SPU_DSP_RING_8K     0   /**< \brief 8192 samples */
+#define SPU_DSP_RING_16K    1   /**< \brief 16384 samples */
+#define SPU_DSP_RING_32K    2   /**< \brief 32768 samples */
+#define SPU_DSP_RING_64K    3   /**< \brief 65536 samples */
+/** @} */
+
+/** \brief   Size of a ring buffer in sound RAM, in bytes */
+#define SPU_DSP_RING_SIZE(rbl)  (16384 << (rbl))
+
+/** \brief   A DSP program.
+
+    \headerfile dc/spu.h
+*/
+typedef struct spu_dsp_prog {
+    const uint64_t *mpro;       /**< \brief Steps */
+    size_t steps;               /**< \brief Number of steps, up to 128 */
+    const int16_t *coef;        /**< \brief Coefficients, see
+                                            SPU_DSP_COEF_VAL() */
+    size_t coefs;               /**< \brief Number of coefficients, up to 64 */
+    const uint16_t *madrs;      /**< \brief Ring buffer addresses */
+    size_t addrs;               /**< \brief Number of addresses, up to 32, or 0
+                                            if the program has no ring buffer */
+    int rbl;                    /**< \brief Ring buffer length, see
+                                            SPU_DSP_RING_8K and so on */
+} spu_dsp_prog_t;
+
+/** \brief   Reverb.
+
+    Two damped comb filters, 34ms long on the left and 45ms on the right.
+    Its coefficients are:
+    - 0: output level
+    - 1: brightness (how much of each echo gets through the damping)
+    - 2: 1 - coefficient 1
+    - 3: feedback, which sets how long the reverb lasts
+    - 4: input level
+
+    It needs a ring buffer of SPU_DSP_RING_SIZE(SPU_DSP_RING_8K) bytes.
+*/
+extern const spu_dsp_prog_t spu_dsp_reverb;
+
+/** \brief   Low-pass filter.
+
+    A one-pole filter, out = k * in + (1 - k) * last out, with k in
+    coefficient 0 and 1 - k in coefficient 1. For a cutoff of f Hz,
+    k = 1 - exp(-2 * pi * f / 44100). It starts at 2kHz, and needs no ring
+    buffer.
+*/
+extern const spu_dsp_prog_t spu_dsp_lowpass;
+
+/** \brief   Load a DSP program.
+
+    The outputs are muted while loading; set them up with spu_dsp_output()
+    afterwards. The ring buffer is cleared.
+
+    \param  prog            The program to load.
+    \param  ring            Where its ring buffer goes in sound RAM, 2KB
+                            aligned, such as from snd_mem_malloc(). Unused if
+                            the program has no ring buffer.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL if the
+                            program is too large or the ring buffer isn't
+                            aligned or doesn't fit in sound RAM.
+*/
+int spu_dsp_load(const spu_dsp_prog_t *prog, uintptr_t ring);
+
+/** \brief   Stop the DSP.
+
+    Clears the program and its state, and mutes the outputs. Channels sent
+    to it are left that way.
+*/
+void spu_dsp_clear(void);
+
+/** \brief   Change a coefficient of the loaded program.
+
+    \param  idx             The coefficient, 0 to 63.
+    \param  val             Its value, see SPU_DSP_COEF_VAL().
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL.
+*/
+int spu_dsp_set_coef(int idx, int16_t val);
+
+/** \brief   Send a channel into a DSP input.
+
+    The channel keeps its direct output, and stays sent until this is called
+    again, even when it's used for something else.
+
+    \param  ch              The channel.
+    \param  input           The input (MIXS), 0 to 15.
+    \param  level           The level to send at, 0 (not sent) to 15.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL.
+*/
+int spu_dsp_send(int ch, int input, int level);
+
+/** \brief   Mix a DSP output.
+
+    \param  efreg           The output (EFREG), 0 to 15.
+    \param  level           The level, 0 (muted) to 15.
+    \param  pan             The panning, 0 to 31; 16 is centered.
+    \retval 0               On success.
+    \retval -1              On failure, with errno set to EINVAL.
+*/
+int spu_dsp_output(int efreg, int level, int pan);
+
+/** @} */
+
 /** @} */
 
 __END_DECLS
@@ -13,6 +13,13 @@
     interrupt that occurs. This gives a way to schedule small functions that
     must occur regularly, without using threads.
 
+    Handlers run in order of priority, so that the few that are really tied to
+    the vblank (like kicking off the maple DMA) don't have to wait for the rest.
+    Handlers that take longer and don't need to run in the interrupt can be
+    deferred, in which case they run from a kernel thread right after the
+    interrupt instead. The time spent in each handler is accounted for, see
+    vblank_handler_get_stats().
+
     \author Megan Potter
 */
 
@@ -23,6 +30,7 @@
 __BEGIN_DECLS
 
 #include <dc/asic.h>
+#include <stdint.h>
 
 /** \defgroup system_vblank     VBlank
     \brief                      VBlank interrupt handler management
@@ -31,19 +39,73 @@ __BEGIN_DECLS
     @{
 */
 
+/** \name    Vblank handler priorities
+    \brief   Common priorities for vblank_handler_add_ex()
+
+    Handlers with a lower priority value run first. Any value in between these
+    can be used too.
+
+    @{
+*/
+#define VBLANK_PRIO_HIGH    0   /**< \brief Has to run as early as possible */
+#define VBLANK_PRIO_DEFAULT 64  /**< \brief For vblank_handler_add() */
+#define VBLANK_PRIO_LOW     128 /**< \brief Can wait for the others */
+/** @} */
+
+/** \brief  Vblank handler flag: run from a kernel thread.
+
+    The handler runs in a kernel thread that is woken up by the vblank
+    interrupt, after the interrupt is done with. It can take longer and use
+    blocking calls, but it may be delayed by higher priority threads, and
+    vblanks that come while it is still running are merged into one call.
+    Deferred handlers run in priority order among themselves.
+*/
+#define VBLANK_HND_DEFERRED 0x1
+
+/** \brief  Vblank handler timing statistics.
+
+    \headerfile dc/vblank.h
+*/
+typedef struct vblank_stats {
+    uint32_t calls;         /**< \brief Number of times it was called */
+    uint64_t total_ns;      /**< \brief Total time spent in it */
+    uint64_t max_ns;        /**< \brief Longest single call */
+} vblank_stats_t;
+
 /** \brief  Add a vblank handler.
 
     This function adds a handler to the vblank handler list. The function will
     be called at the start of every vblank period with the same parameters that
-    were passed to the IRQ handler for vblanks.
+    were passed to the IRQ handler for vblanks. It runs in the interrupt, with
+    \ref VBLANK_PRIO_DEFAULT priority.
 
     \param  hnd             The handler to add.
     \param  data            A user pointer that will be passed to the callback.
     
     \return                 The handle id on success, or <0 on failure.
+
+    \sa vblank_handler_add_ex()
 */
 int vblank_handler_add(asic_evt_handler hnd, void *data);
 
+/** \brief  Add a vblank handler with a priority.
+
+    This works like vblank_handler_add(), but lets the handler be given a
+    priority, and be deferred to a kernel thread.
+
+    \param  hnd             The handler to add.
+    \param  data            A user pointer that will be passed to the callback.
+    \param  prio            The priority of the handler (lower runs first).
+    \param  flags           0, or \ref VBLANK_HND_DEFERRED to run the handler
+                            in a kernel thread instead of the interrupt.
+
+    \return                 The handle id on success, or -1 on failure, with
+                            errno set to ENOMEM, or EPERM when adding a deferred
+                            handler from an interrupt.
+*/
+int vblank_handler_add_ex(asic_evt_handler hnd, void *data, int prio,
+                          unsigned int flags);
+
 /** \brief  Remove a vblank handler.
 
     This function removes the specified handler from the vblank handler list.
@@ -56,6 +118,24 @@ int vblank_handler_add(asic_evt_handler hnd, void *data);
 */
 int vblank_handler_remove(int handle);
 
+/** \brief  Get the timing statistics of a vblank handler.
+
+    \param  handle          The handle id of the handler.
+    \param  stats           Where to store its statistics.
+
+    \retval 0               On success.
+    \retval -1              If there's no such handler.
+*/
+int vblank_handler_get_stats(int handle, vblank_stats_t *stats);
+
+/** \brief  Print the vblank handlers, with their timing statistics.
+
+    \param  pf              The printf-like function to print with.
+
+    \retval 0               On success.
+*/
+int vblank_pslist(int (*pf)(const char *fmt, ...));
+
 /* \cond */
 /** Initialize the vblank handler. This must be called after the asic module
     is initialized. */
@@ -0,0 +1,130 @@
+/* KallistiOS ##version##
+
+   dc/vecmath.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/** \file    dc/vecmath.h
+    \brief   Batched vector math.
+    \ingroup math_vecmath
+
+    This file contains functions that run the same vector operation over
+    whole arrays, using the SH4's fipr, ftrv and fsrra instructions.
+*/
+
+#ifndef __DC_VECMATH_H
+#define __DC_VECMATH_H
+
+#include <kos/cdefs.h>
+__BEGIN_DECLS
+
+#include <stddef.h>
+#include <dc/matrix.h>
+#include <dc/vec3f.h>
+
+/** \defgroup math_vecmath Batched vectors
+    \brief                 Vector operations over arrays
+    \ingroup               math
+
+    These save writing the same loops over and over, and do them the quick
+    way: lengths and dot products with fipr, transforms with ftrv, and one
+    fsrra in place of each division. The input is prefetched a cache line
+    ahead.
+
+    The results use the FPU's approximations (fsrra for 1/sqrt(x)), so they
+    are good to about 1 part in 2^20, which is plenty for graphics.
+
+    The inputs and outputs may be the same array, but must not otherwise
+    overlap. The transforms use the current matrix (XMTRX) and leave it as it
+    was.
+
+    @{
+*/
+
+/** \brief   A quaternion.
+
+    \headerfile dc/vecmath.h
+*/
+typedef struct quatf {
+    float x, y, z;                  /**< \brief Vector part */
+    float w;                        /**< \brief Scalar part */
+} quatf_t;
+
+/** \brief   Normalize vectors.
+
+    Vectors of zero length are left as they are.
+
+    \param  v               The vectors to normalize, in place.
+    \param  count           The number of vectors.
+*/
+void vec_normalize_batch(vec3f_t *v, size_t count);
+
+/** \brief   Dot products of pairs of vectors.
+
+    \param  a               The first vector of each pair.
+    \param  b               The second vector of each pair.
+    \param  out             Where to store each a[i] . b[i].
+    \param  count           The number of pairs.
+*/
+void vec_dot_batch(const vec3f_t *a, const vec3f_t *b, float *out,
+                   size_t count);
+
+/** \brief   Cross products of pairs of vectors.
+
+    \param  a               The first vector of each pair.
+    \param  b               The second vector of each pair.
+    \param  out             Where to store each a[i] x b[i]. This may be a
+                            or b.
+    \param  count           The number of pairs.
+*/
+void vec_cross_batch(const vec3f_t *a, const vec3f_t *b, vec3f_t *out,
+                     size_t count);
+
+/** \brief   Transform and project points.
+
+    Each point is transformed by the current matrix, with a W of 1, then
+    divided by the W that comes out. The z of each result holds 1/W rather
+    than z/W, which is what the PVR wants for its depth.
+
+    The division is done with fsrra, so W must be positive: cull or clip
+    points behind the viewer before they get here.
+
+    \param  in              The points to transform.
+    \param  out             Where to store the screen x, y and 1/W. This may
+                            be in.
+    \param  count           The number of points.
+*/
+void vec_transform_project(const vec3f_t *in, vec3f_t *out, size_t count);
+
+/** \brief   Transform and project points stored as separate arrays.
+
+    This works like vec_transform_project(), but with the three coordinates
+    of the points each in an array of its own.
+
+    \param  x               The x of each point to transform.
+    \param  y               The y of each point.
+    \param  z               The z of each point.
+    \param  ox              Where to store each screen x. This may be x.
+    \param  oy              Where to store each screen y. This may be y.
+    \param  oz              Where to store each 1/W. This may be z.
+    \param  count           The number of points.
+*/
+void vec_transform_project_soa(const float *x, const float *y, const float *z,
+                               float *ox, float *oy, float *oz, size_t count);
+
+/** \brief   Make a rotation matrix from a quaternion.
+
+    The quaternion must be of unit length. The matrix is in the same layout
+    as the ones mat_load() and mat_apply() take, so it can be applied to
+    XMTRX directly.
+
+    \param  q               The quaternion.
+    \param  out             Where to store the matrix.
+*/
+void vec_quat_to_matrix(const quatf_t *q, matrix_t *out);
+
+/** @} */
+
+__END_DECLS
+
+#endif  /* __DC_VECMATH_H */
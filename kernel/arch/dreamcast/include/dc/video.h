@@ -439,6 +439,52 @@ int vid_screen_shot(const char *destfn);
 */
 size_t vid_screen_shot_data(uint8_t **buffer);
 
+/** \brief   Image formats for vid_screen_shot_async().
+    \ingroup video_fb
+*/
+typedef enum vid_shot_fmt {
+    VID_SHOT_PPM,       /**< \brief Uncompressed, as vid_screen_shot() */
+    VID_SHOT_QOI        /**< \brief "Quite OK Image" lossless compression */
+} vid_shot_fmt_t;
+
+/** \brief   Most screen shots vid_screen_shot_async() keeps in flight.
+    \ingroup video_fb
+*/
+#define VID_SHOT_ASYNC_MAX  3
+
+/** \brief   Take a screen shot without stopping the program.
+    \ingroup video_fb
+
+    At the next vblank, the displayed framebuffer (which is the one the PVR
+    last finished with, if it's in use) is copied by DMA into RAM. It's then
+    converted, encoded and written to the file by a worker thread running just
+    below the default priority, so that it only takes time the program isn't
+    using. Each screen shot in flight takes a copy of the framebuffer in RAM,
+    up to \ref VID_SHOT_ASYNC_MAX of them.
+
+    Taking one every frame or so captures a sequence, as long as the worker
+    keeps up; the ones that don't fit are refused rather than waited for.
+    Errors past the start are logged.
+
+    \param  destfn          The filename to save to.
+    \param  fmt             The image format.
+    \retval 0               If the screen shot is on its way.
+    \retval -1              On failure, with errno set to EINVAL for a bad
+                            format or video mode, EAGAIN if too many are in
+                            flight, or ENOMEM.
+
+    \sa vid_screen_shot_pending()
+*/
+int vid_screen_shot_async(const char *destfn, vid_shot_fmt_t fmt);
+
+/** \brief   Count the screen shots still in flight.
+    \ingroup video_fb
+
+    \return                 The number of them from vid_screen_shot_async()
+                            not written out yet.
+*/
+int vid_screen_shot_pending(void);
+
 /** \brief   Enable or disable dithering.
     \ingroup video_fb
 
@@ -127,7 +127,9 @@ void vmufb_paint_xbm(vmufb_t *fb,
 /** \brief  Present the VMU framebuffer to a VMU
 
     This function presents the previously rendered VMU framebuffer to the
-    VMU identified by the dev argument.
+    VMU identified by the dev argument. It doesn't wait for the VMU, and a
+    frame that hasn't changed since the last one isn't sent again; see
+    vmu_draw_lcd().
 
     \param  fb              A pointer to the vmufb_t to paint to.
     \param  dev             The maple device of the VMU to present to
@@ -298,6 +298,19 @@ int vmufs_mutex_lock(void);
 */
 int vmufs_mutex_unlock(void);
 
+/** \brief  Forget what's cached of a VMU's root block, directory and FAT.
+
+    The higher level functions below keep a copy of these for each card, so
+    they needn't be read in again on every call. The VMU driver calls this
+    when a card is plugged in or pulled out, and the low-level write functions
+    above keep the copies in step with what they write; anything else writing
+    to a card's blocks directly should call this afterwards. It is safe to
+    call from an interrupt.
+
+    \param  dev             The VMU.
+*/
+void vmufs_invalidate(maple_device_t * dev);
+
 
 /* ****************** Higher level functions ******************** */
 
@@ -365,6 +378,52 @@ int vmufs_read_dirent(maple_device_t * dev, vmu_dir_t * dirent, void ** outbuf,
 */
 int vmufs_write(maple_device_t * dev, const char * fn, void * inbuf, int insize, int flags);
 
+/** \brief  Asynchronous write progress callback.
+
+    \param  data            The data passed to vmufs_write_async().
+    \param  done            The number of blocks written so far.
+    \param  total           The number of blocks the write takes in all,
+                            counting one each for the FAT and directory.
+*/
+typedef void (*vmufs_progress_t)(void *data, int done, int total);
+
+/** \brief  Asynchronous write completion callback.
+
+    \param  data            The data passed to vmufs_write_async().
+    \param  rv              What vmufs_write() would have returned.
+*/
+typedef void (*vmufs_done_t)(void *data, int rv);
+
+/** \brief  Write a file to the VMU in the background.
+
+    This does the same as vmufs_write(), but returns straight away, so the
+    caller can carry on (drawing a frame each vblank, say) while the save goes
+    on. The writes are done in turn, in the order they are asked for, by a
+    worker thread; the callbacks are called from that thread. As with
+    vmufs_write(), the file's data is written first and the FAT and directory
+    last, so a save that fails while writing the data leaves the card's FAT
+    and directory untouched.
+
+    Other vmufs calls wait for a write underway to finish before they go
+    ahead, as they would for a vmufs_write() made from another thread.
+
+    \param  dev             The VMU to write to.
+    \param  fn              The filename to write.
+    \param  inbuf           The data to write to the file, which must stay as
+                            it is until the write is done.
+    \param  insize          The size of the file in bytes.
+    \param  flags           Flags for the write, as for vmufs_write().
+    \param  progress        Called after every few blocks are written, or
+                            NULL.
+    \param  done            Called once the write is over, or NULL.
+    \param  data            Data to pass to the callbacks.
+    \retval 0               If the write was queued.
+    \retval -1              On failure, with errno set to EINVAL or ENOMEM.
+*/
+int vmufs_write_async(maple_device_t * dev, const char * fn, void * inbuf, int insize,
+                      int flags, vmufs_progress_t progress, vmufs_done_t done,
+                      void * data);
+
 /** \brief  Delete a file from the VMU.
 
     \retval 0               On success.
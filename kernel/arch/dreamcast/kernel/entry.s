@@ -38,25 +38,39 @@ krn_stack:
 _irq_save_regs:
 ! On the SH4, an exception triggers a toggle of RB in SR. So all
 ! the R0-R7 registers were convienently saved for us.
+
+! Contexts that don't use the FPU run with SR.FD set, which the exception
+! leaves as it was. Clear it before anything here touches the FPU.
+	stc		sr,r0
+	mov.l		fd_and,r1
+	and		r1,r0
+	ldc		r0,sr
+
 	mov.l		_irq_srt_addr,r0	! Grab the location of the reg store
 	add		#0x72,r0	! Start at the top of the BANK regs
 	add		#0x72,r0
-	sts.l		fpscr,@-r0	! save FPSCR 0xe0
-
-	mov		r0,r1
-	add		#-4,r1
-	mov		#0x7,r2
+	mov.l		@r0,r3		! Get the FPU flag 0xe4
+	tst		r3,r3		! T = 1 if the context doesn't use the FPU
+	bt/s		1f
+	add		#-4,r0
+	sts		fpscr,r2
+	mov.l		r2,@r0		! save FPSCR 0xe0
 
 1:
 	! Write a bogus value (r0) at each (i*0x20) offset of the irq context
-	! structure, using the movca.l opcode. This will pre-allocate cache
-	! blocks that covers the whole memory area, without fetching data
-	! from RAM, which means that the stores will then be as fast as they
-	! can be.
-	movca.l		r0,@r1
-	dt		r2
-	bf/s		1b
+	! structure that we are going to fill, using the movca.l opcode. This
+	! will pre-allocate cache blocks that cover those areas, without
+	! fetching data from RAM, which means that the stores will then be as
+	! fast as they can be. The FPU register blocks are done further down,
+	! only if they get saved.
+	mov		r0,r1
+	add		#-4,r1
+	movca.l		r0,@r1		! R8-R15   0xc0
 	add		#-0x20,r1
+	movca.l		r0,@r1		! R0-R7    0xa0
+	add		#-0x50,r1
+	add		#-0x50,r1
+	movca.l		r0,@r1		! PC-FPUL  0x00
 
 	mov.l		r15,@-r0	! save R15   0xdc
 	mov		#0x30,r2	! Set bits 20/21 to r2
@@ -76,6 +90,23 @@ _irq_save_regs:
 	stc.l		r2_bank,@-r0	! Save R2
 	stc.l		r1_bank,@-r0	! Save R1
 	stc.l		r0_bank,@-r0	! Save R0    0xa0
+
+	bf		2f		! Save the FPU registers if they're used
+	mov		#0,r1
+	lds		r1,fpscr	! If not, just reset FPSCR for the handler
+	bra		3f
+	add		#-0x80,r0	! and skip them
+
+2:
+	mov		r0,r1
+	add		#-4,r1
+	mov		#4,r5
+4:
+	movca.l		r0,@r1		! FR/XF blocks  0x80-0x20
+	dt		r5
+	bf/s		4b
+	add		#-0x20,r1
+
 	lds		r2,fpscr	! Reset FPSCR, switch to bank 2, 64-bit I/O
 
 	fmov		dr14,@-r0	! Save FR15/FR14  0x98
@@ -98,6 +129,7 @@ _irq_save_regs:
 	fmov		dr0,@-r0	! Save FR1/FR0    0x20
 	fschg				! Restore 32-bit I/O
 
+3:
 	! Setup our kernel-mode stack
 	mov.l		stkaddr,r15
 
@@ -131,13 +163,18 @@ irqd_and:
 	.long	0xefffff0f
 irqd_or:
 	.long	0x000000f0
+fd_and:
+	.long	0xffff7fff
 
 ! irq_force_return() jumps here; make sure we're in register
-! bank 1 (as opposed to 0)
+! bank 1 (as opposed to 0), and that the FPU is enabled
 _irq_force_return:
 	mov.l	_irqfr_or,r1
+	mov.l	_irqfr_fd,r2
 	stc	sr,r0
 	or	r1,r0
+	not	r2,r2
+	and	r2,r0
 	ldc	r0,sr
 
 ! Now restore all the registers and jump back to the thread
@@ -151,9 +188,29 @@ _save_regs_finish:
 	add	#4,r1			!
 	lds.l	@r1+,mach		! restore MACH
 	lds.l	@r1+,macl		! restore MACL
-	ldc.l	@r1+,ssr		! restore SSR  0x18
+	mov.l	@r1+,r3			! get SSR  0x18
 	lds.l	@r1+,fpul		! restore FPUL 0x1c
 	shll16	r2
+
+	! Return with the FPU disabled if the context doesn't use it, so
+	! that we hear about it when it starts to.
+	mov	r1,r0
+	add	#0x62,r0
+	add	#0x62,r0
+	mov.l	@r0,r0			! Get the FPU flag 0xe4
+	mov.l	_irqfr_fd,r5
+	tst	r0,r0
+	bt/s	1f
+	or	r5,r3			! Set SR.FD...
+	xor	r5,r3			! ...or not, if the FPU is used
+1:
+	ldc	r3,ssr			! restore SSR
+	bf	2f			! Restore the FPU registers if they're used
+	add	#0x40,r1		! If not, skip them
+	bra	3f
+	add	#0x40,r1
+
+2:
 	lds	r2,fpscr		! Reset FPSCR, 64-bit I/O
 
 	fmov	@r1+,dr0		! restore FR0/FR1    0x20
@@ -175,6 +232,7 @@ _save_regs_finish:
 	fmov	@r1+,dr12		! restore FR12/FR13
 	fmov	@r1+,dr14		! restore FR14/FR15  0x98
 
+3:
 	ldc.l	@r1+,r0_bank		! restore R0    0xa0
 	ldc.l	@r1+,r1_bank		! restore R1
 	ldc.l	@r1+,r2_bank		! restore R2
@@ -202,6 +260,8 @@ _save_regs_finish:
 	.align 2
 _irqfr_or:
 	.long	0x20000000
+_irqfr_fd:
+	.long	0x00008000
 stkaddr:
 	.long	krn_stack
 _irq_srt_addr:
@@ -0,0 +1,62 @@
+! KallistiOS ##version##
+!
+!   arch/dreamcast/kernel/fiberswitch.s
+!   Copyright (C) 2026 KallistiOS Contributors
+!
+! Assembler code for swapping fibers (see kos/fiber.h)
+!
+
+	.text
+	.balign		4
+	.globl		_arch_fiber_switch
+
+! Unlike thd_block_now, this is a plain function call: fibers only ever give
+! up the CPU voluntarily, so only the registers that the SH4 ABI says must
+! survive a call need saving. Interrupt state is left alone, and so is GBR,
+! as fibers share their host thread's TLS.
+!
+! The layout of the save area must be kept in sync with arch_fiber_ctx_t
+! in arch/fiber.h.
+!
+! R4 = address of the save area to save the current state in
+! R5 = address of the save area to restore the new state from
+!
+! Returns (into the new context) by jumping to its saved PR.
+!
+_arch_fiber_switch:
+	add		#0x40,r4
+
+	fmov.s		fr15,@-r4	! save FR15  0x3c
+	fmov.s		fr14,@-r4	! save FR14
+	fmov.s		fr13,@-r4	! save FR13
+	fmov.s		fr12,@-r4	! save FR12  0x30
+	sts.l		fpscr,@-r4	! save FPSCR 0x2c
+	sts.l		macl,@-r4	! save MACL
+	sts.l		mach,@-r4	! save MACH
+	sts.l		pr,@-r4		! save PR    0x20
+	mov.l		r15,@-r4	! save R15   0x1c
+	mov.l		r14,@-r4	! save R14
+	mov.l		r13,@-r4	! save R13
+	mov.l		r12,@-r4	! save R12
+	mov.l		r11,@-r4	! save R11
+	mov.l		r10,@-r4	! save R10
+	mov.l		r9,@-r4		! save R9
+	mov.l		r8,@-r4		! save R8    0x00
+
+	mov.l		@r5+,r8		! restore R8
+	mov.l		@r5+,r9		! restore R9
+	mov.l		@r5+,r10	! restore R10
+	mov.l		@r5+,r11	! restore R11
+	mov.l		@r5+,r12	! restore R12
+	mov.l		@r5+,r13	! restore R13
+	mov.l		@r5+,r14	! restore R14
+	mov.l		@r5+,r15	! restore R15
+	lds.l		@r5+,pr		! restore PR
+	lds.l		@r5+,mach	! restore MACH
+	lds.l		@r5+,macl	! restore MACL
+	lds.l		@r5+,fpscr	! restore FPSCR
+	fmov.s		@r5+,fr12	! restore FR12
+	fmov.s		@r5+,fr13	! restore FR13
+	fmov.s		@r5+,fr14	! restore FR14
+	rts
+	fmov.s		@r5+,fr15	! restore FR15
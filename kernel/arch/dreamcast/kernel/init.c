@@ -16,6 +16,7 @@
 #include <kos/init.h>
 #include <kos/linker.h>
 #include <kos/platform.h>
+#include <kos/thread.h>
 #include <kos/timer.h>
 #include <arch/arch.h>
 #include <arch/irq.h>
@@ -41,6 +42,7 @@ extern void _init(void);
 extern void _fini(void);
 extern void __verify_newlib_patch();
 extern void dma_init(void);
+extern void ocram_init(void);
 
 /* Jump back to the bootloader. From startup.S */
 void arch_real_exit(int ret_code) __noreturn;
@@ -157,6 +159,45 @@ KOS_INIT_FLAG_WEAK(library_shutdown, true);
 /* Auto-init stuff: override with a non-weak symbol if you don't want all of
    this to be linked into your code (and do the same with the
    arch_auto_shutdown function too). */
+/* With INIT_LAZY, the network comes up in here while main() gets going */
+static kthread_t *init_net_thd;
+static bool init_waited;
+
+static void *init_net_thd_fn(void *arg) {
+    (void)arg;
+
+    KOS_INIT_FLAG_CALL(arch_init_net);
+
+    return NULL;
+}
+
+static void init_net_start(void) {
+    const kthread_attr_t attr = {
+        .label = "[init net]"
+    };
+
+    /* dcload-ip's console goes through the adapter while it is being set up,
+       so that has to be done before anything else gets printed. */
+    if(dcload_type == DCLOAD_TYPE_IP || !arch_init_net_weak ||
+       !(init_net_thd = thd_create_ex(&attr, init_net_thd_fn, NULL)))
+        KOS_INIT_FLAG_CALL(arch_init_net);
+}
+
+void arch_init_wait(void) {
+    if(!(__kos_init_flags & INIT_LAZY) || init_waited)
+        return;
+
+    init_waited = true;
+
+    if(init_net_thd)
+        thd_join(init_net_thd, NULL);
+
+    init_net_thd = NULL;
+
+    if(__kos_init_flags & INIT_IRQ)
+        KOS_INIT_FLAG_CALL(maple_wait_scan);
+}
+
 int  __weak_symbol arch_auto_init(void) {
     /* Initialize memory management */
     mm_init();
@@ -228,16 +269,28 @@ int  __weak_symbol arch_auto_init(void) {
     /* Now comes the optional stuff */
     if(__kos_init_flags & INIT_IRQ) {
         irq_enable();       /* Turn on IRQs */
-        KOS_INIT_FLAG_CALL(maple_wait_scan);  /* Wait for the maple scan to complete */
+
+        /* Wait for the maple scan to complete, unless that can wait for
+           arch_init_wait() */
+        if(!(__kos_init_flags & INIT_LAZY))
+            KOS_INIT_FLAG_CALL(maple_wait_scan);
     }
 
-    if (!KOS_PLATFORM_IS_NAOMI)
-        KOS_INIT_FLAG_CALL(arch_init_net);
+    if (!KOS_PLATFORM_IS_NAOMI) {
+        if((__kos_init_flags & (INIT_LAZY | INIT_IRQ)) == (INIT_LAZY | INIT_IRQ))
+            init_net_start();
+        else
+            KOS_INIT_FLAG_CALL(arch_init_net);
+    }
 
     return 0;
 }
 
 void  __weak_symbol arch_auto_shutdown(void) {
+    /* Don't pull anything out from under the threads still starting it */
+    if(init_net_thd)
+        thd_join(init_net_thd, NULL);
+
     KOS_INIT_FLAG_CALL(fs_dclsocket_shutdown);
     if (!KOS_PLATFORM_IS_NAOMI)
         KOS_INIT_FLAG_CALL(net_shutdown);
@@ -297,6 +350,9 @@ void arch_main(void) {
     /* Clear out the BSS area */
     memset(_bss_start, 0, (uintptr_t)end - (uintptr_t)_bss_start);
 
+    /* And the static data in the operand cache RAM, if it's on */
+    ocram_init();
+
     /* Do auto-init stuff */
     arch_auto_init();
 
@@ -328,6 +384,9 @@ void arch_shutdown(void) {
 
     dbglog(DBG_CRITICAL, "arch: shutting down kernel\n");
 
+    /* Write out any debug output still queued up */
+    dbgio_async_stop();
+
     /* Disable the WDT, if active */
     wdt_disable();
 
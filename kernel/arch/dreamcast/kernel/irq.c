@@ -11,6 +11,7 @@
 
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <arch/arch.h>
 #include <arch/types.h>
@@ -19,9 +20,12 @@
 #include <arch/stack.h>
 #include <kos/dbgio.h>
 #include <kos/dbglog.h>
+#include <kos/exports.h>
 #include <kos/thread.h>
 #include <kos/library.h>
 #include <kos/regfield.h>
+#include <kos/trace.h>
+#include <dc/perfctr.h>
 
 /* Macros for accessing related registers. */
 #define TRA    ( *((volatile uint32_t *)(0xff000020)) ) /* TRAPA Exception Register */
@@ -49,12 +53,137 @@ static irq_cb_t        global_irq_handler;
 /* Default IRQ context location */
 static irq_context_t   irq_context_default;
 
+/* Per-code statistics, indexed like irq_handlers */
+static irq_stats_t     irq_stats[0x40];
+
 /* Are we inside an interrupt? */
 static int inside_int;
 int irq_inside_int(void) {
     return inside_int;
 }
 
+#ifdef IRQ_MASK_DEBUG
+static irq_mask_stats_t mask_stats;
+static uint64_t mask_start;
+static uintptr_t mask_pc;
+static bool mask_open;
+#endif
+
+/* Called as interrupts get masked, from outside of an interrupt. These are
+   always built, for modules built with IRQ_MASK_DEBUG. */
+void __irq_mask_begin(void) {
+#ifdef IRQ_MASK_DEBUG
+    if(inside_int)
+        return;
+
+    mask_pc = (uintptr_t)__builtin_return_address(0);
+    mask_start = perf_cntr_timer_ns();
+    mask_open = true;
+#endif
+}
+
+/* Called just before they get unmasked again, still masked */
+void __irq_mask_end(void) {
+#ifdef IRQ_MASK_DEBUG
+    uint64_t ns;
+
+    if(!mask_open)
+        return;
+
+    mask_open = false;
+    ns = perf_cntr_timer_ns() - mask_start;
+
+    mask_stats.count++;
+    mask_stats.total_ns += ns;
+
+    if(ns > mask_stats.max_ns) {
+        mask_stats.max_ns = ns;
+        mask_stats.max_begin = mask_pc;
+        mask_stats.max_end = (uintptr_t)__builtin_return_address(0);
+    }
+#endif
+}
+
+int irq_get_stats(irq_t code, irq_stats_t *stats) {
+    if(code >= 0x800 || (code & 0x000f)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    irq_disable_scoped();
+    *stats = irq_stats[code >> 5];
+
+    return 0;
+}
+
+int irq_get_mask_stats(irq_mask_stats_t *stats) {
+#ifdef IRQ_MASK_DEBUG
+    irq_disable_scoped();
+    *stats = mask_stats;
+
+    return 0;
+#else
+    (void)stats;
+
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+void irq_reset_stats(void) {
+    irq_disable_scoped();
+
+    memset(irq_stats, 0, sizeof(irq_stats));
+
+#ifdef IRQ_MASK_DEBUG
+    memset(&mask_stats, 0, sizeof(mask_stats));
+#endif
+}
+
+static void print_addr(int (*pf)(const char *fmt, ...), uintptr_t addr) {
+    export_sym_t *sym = export_lookup_addr(addr);
+
+    if(sym)
+        pf(" 0x%08lx (%s+0x%lx)", (unsigned long)addr, sym->name,
+           (unsigned long)(addr - sym->ptr));
+    else
+        pf(" 0x%08lx", (unsigned long)addr);
+}
+
+int irq_print_stats(int (*pf)(const char *fmt, ...)) {
+    irq_stats_t stats[0x40];
+    irq_mask_stats_t ms;
+    unsigned int i;
+
+    {
+        irq_disable_scoped();
+        memcpy(stats, irq_stats, sizeof(stats));
+    }
+
+    pf("code       count       total ns     avg ns     max ns\n");
+
+    for(i = 0; i < 0x40; i++) {
+        if(!stats[i].count)
+            continue;
+
+        pf("0x%03x %10lu %14llu %10lu %10lu\n", i << 5,
+           (unsigned long)stats[i].count, stats[i].total_ns,
+           (unsigned long)(stats[i].total_ns / stats[i].count),
+           (unsigned long)stats[i].max_ns);
+    }
+
+    if(!irq_get_mask_stats(&ms) && ms.count) {
+        pf("masked: %lu times, %llu ns total, %lu ns longest, from",
+           (unsigned long)ms.count, ms.total_ns, (unsigned long)ms.max_ns);
+        print_addr(pf, ms.max_begin);
+        pf(" to");
+        print_addr(pf, ms.max_end);
+        pf("\n");
+    }
+
+    return 0;
+}
+
 /* Set a handler, or remove a handler */
 int irq_set_handler(irq_t code, irq_handler hnd, void *data) {
     /* Make sure they don't do something crackheaded */
@@ -213,7 +342,9 @@ void irq_dump_regs(int code, irq_t evt) {
 volatile uint32_t jiffies = 0;
 void irq_handle_exception(int code) {
     const struct irq_cb *hnd;
-    uint32_t evt = 0;
+    irq_stats_t *stats;
+    uint64_t start;
+    uint32_t evt = 0, ns;
     int handled = 0;
 
     if(__is_defined(__SH_ATOMIC_MODEL_SOFT_GUSA__)
@@ -261,6 +392,15 @@ void irq_handle_exception(int code) {
        diagnostics returns if we try to do something in the int. */
     inside_int = ((code&0xf)<<16) | (evt&0xffff);
 
+#ifdef IRQ_MASK_DEBUG
+    /* Interrupts can't come in with them masked, so this is a trapa or an
+       exception, and whoever had them masked is being switched away from. */
+    __irq_mask_end();
+#endif
+
+    trace_event(TRACE_IRQ_ENTER, evt);
+    start = perf_cntr_timer_ns();
+
     /* If there's a global handler, call it */
     if(global_irq_handler.hdl) {
         global_irq_handler.hdl(evt, irq_srt_addr, global_irq_handler.data);
@@ -286,6 +426,16 @@ void irq_handle_exception(int code) {
         arch_panic("unhandled IRQ/Exception");
     }
 
+    ns = perf_cntr_timer_ns() - start;
+    stats = &irq_stats[evt >> 5];
+    stats->count++;
+    stats->total_ns += ns;
+
+    if(ns > stats->max_ns)
+        stats->max_ns = ns;
+
+    trace_event(TRACE_IRQ_EXIT, evt);
+
     irq_disable();
     inside_int = 0;
 }
@@ -364,6 +514,21 @@ static void irq_def_fpu(irq_t src, irq_context_t *context, void *data) {
     context->pc += 2;
 }
 
+/* FPU disable exception handler. Contexts start out with the FPU disabled
+   (see entry.s), and get it here the first time they use it; the faulting
+   instruction is then run again. */
+static void irq_fpu_disabled(irq_t src, irq_context_t *context, void *data) {
+    kthread_t *thd = thd_get_current();
+
+    (void)src;
+    (void)data;
+
+    context->fpu = 1;
+
+    if(thd && context == &thd->context)
+        thd->flags |= THD_FPU;
+}
+
 /* Pre-init SR and VBR */
 static uint32_t pre_sr, pre_vbr;
 
@@ -402,11 +567,16 @@ int irq_init(void) {
     /* Set a default FPU exception handler */
     irq_set_handler(EXC_FPU, irq_def_fpu, NULL);
 
+    /* Enable the FPU for contexts on their first use of it */
+    irq_set_handler(EXC_GENERAL_FPU, irq_fpu_disabled, NULL);
+    irq_set_handler(EXC_SLOT_FPU, irq_fpu_disabled, NULL);
+
     /* Unmask DMA IRQs, set priority of 3 */
     irq_set_priority(IRQ_SRC_DMAC, 3);
 
     /* Set a default context (will be superseded if threads are
-       enabled later) */
+       enabled later). It's the code running now, which has the FPU. */
+    irq_context_default.fpu = 1;
     irq_set_context(&irq_context_default);
 
     /* Set VBR to our exception table above, but don't enable
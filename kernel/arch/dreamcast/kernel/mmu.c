@@ -6,6 +6,7 @@
 
 /* SH-4 MMU related functions, ported up from KOS-MMU */
 
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -86,6 +87,14 @@ static mmu_mapfunc_t map_func;
 /* Number of static allocations */
 static unsigned int tlb_nb_static;
 
+/* TLB miss counts */
+static mmu_tlb_stats_t tlb_stats;
+
+static const unsigned int page_mask[] = { 0x3ff, 0xfff, 0xffff, 0xfffff };
+
+/* Number of 4 KB page entries making up a page of the given size */
+#define LARGE_PAGES(SZ) ((int)(page_mask[SZ] >> PAGESIZE_BITS) + 1)
+
 /********************************************************************************/
 /* Physical hardware management */
 
@@ -114,6 +123,18 @@ static inline void mmu_ldtlb_wait(void) {
 /* Defined in mmuitlb.s */
 void mmu_reset_itlb(void);
 
+/* Drop whatever the UTLB holds for a range of virtual pages. An associative
+   write with V cleared invalidates any entry covering the address, whatever
+   its size. The ITLB can't be done that way. */
+static void mmu_utlb_drop(int asid, int virtpage, int count) {
+    while(count > 0) {
+        *(volatile uint32_t *)(MEM_AREA_UTLB_ADDRESS_ARRAY_BASE | 0x80) =
+            BUILD_PTEH(virtpage << PAGESIZE_BITS, asid);
+        virtpage++;
+        count--;
+    }
+}
+
 /* Defined below */
 static mmupage_t *map_virt(mmucontext_t *context, int virtpage);
 
@@ -161,6 +182,20 @@ void mmu_context_destroy(mmucontext_t *context) {
     free(context);
 }
 
+/* Return the page entry for the given virtual page ID, valid or not, or
+   NULL if its sub-context was never allocated. */
+static mmupage_t *mmu_page_entry(mmucontext_t *context, int virtpage) {
+    mmusubcontext_t *sub;
+    int     top, bot;
+
+    virtpage = virtpage << MMU_IND_BITS;
+    top = FIELD_GET(virtpage, MMU_TOP_MASK);
+    bot = FIELD_GET(virtpage, MMU_BOT_MASK);
+    sub = context->sub[top];
+
+    return sub ? sub->page + bot : NULL;
+}
+
 /* Using the given page tables, return a pointer to the page entry
    matching the given virtual page ID, or return NULL if there
    isn't one. */
@@ -210,6 +245,80 @@ void mmu_switch_context(mmucontext_t *context) {
     SET_PTEH(0, context->asid);
 }
 
+/* Pre-build the TLB values of a page entry. Every 4 KB entry of a large page
+   carries the TLB values of the whole large page, so a miss anywhere in it
+   loads a single entry covering all of it. */
+static void mmu_page_build(mmupage_t *page, int virtpage) {
+    int mask = LARGE_PAGES(page->size) - 1;
+
+    page->pteh = BUILD_PTEH((virtpage & ~mask) << PAGESIZE_BITS, 0);
+    page->ptel = BUILD_PTEL((page->physical & ~mask) << PAGESIZE_BITS, 1,
+                            page->size, page->prkey, page->cache,
+                            page->dirty, page->shared, page->wthru);
+}
+
+/* Split the large page holding the given virtual page back into 4 KB pages,
+   and drop it from the UTLB. The caller resets the ITLB. */
+static void mmu_page_split(mmucontext_t *context, int virtpage) {
+    mmupage_t *page = mmu_page_entry(context, virtpage);
+    int i, count;
+
+    if(!page || !page->valid || page->size == PAGE_SIZE_4K)
+        return;
+
+    count = LARGE_PAGES(page->size);
+    page -= virtpage & (count - 1);
+    virtpage &= ~(count - 1);
+
+    irq_disable_scoped();
+
+    for(i = 0; i < count; i++) {
+        page[i].size = PAGE_SIZE_4K;
+        mmu_page_build(page + i, virtpage + i);
+    }
+
+    mmu_utlb_drop(context->asid, virtpage, 1);
+}
+
+/* Fold the naturally aligned block of the given size holding the given
+   virtual page into one large page. This only happens if all of the block is
+   mapped with the same attributes onto contiguous physical pages, aligned the
+   same way. */
+static void mmu_page_coalesce(mmucontext_t *context, int virtpage,
+                              page_size_t size) {
+    mmupage_t *page, *p;
+    int i, count = LARGE_PAGES(size);
+
+    virtpage &= ~(count - 1);
+    page = mmu_page_entry(context, virtpage);
+
+    if(!page || !page->valid || page->size >= size ||
+       (page->physical & (count - 1)))
+        return;
+
+    for(i = 1; i < count; i++) {
+        p = page + i;
+
+        if(!p->valid || p->physical != page->physical + i ||
+           p->prkey != page->prkey || p->cache != page->cache ||
+           p->dirty != page->dirty || p->shared != page->shared ||
+           p->wthru != page->wthru)
+            return;
+    }
+
+    irq_disable_scoped();
+
+    for(i = 0; i < count; i++) {
+        page[i].size = size;
+        mmu_page_build(page + i, virtpage + i);
+    }
+
+    /* The smaller pages may still be in the TLB, and overlapping entries
+       there would be a multiple hit. */
+    mmu_utlb_drop(context->asid, virtpage, count);
+    mmu_reset_itlb();
+}
+
 /* Set the given virtual page to map to the given physical page; implies
    turning on the "valid" bit. */
 static void mmu_page_map_single(mmucontext_t *context,
@@ -218,10 +327,18 @@ static void mmu_page_map_single(mmucontext_t *context,
                                 bool share, bool dirty) {
     mmusubcontext_t *sub;
     mmupage_t   *page;
-    int     top, bot, i;
+    int     top, bot, i, vpage = virtpage;
 
     (void)dirty;
 
+    /* Remapping part of a large page breaks it up first */
+    page = mmu_page_entry(context, virtpage);
+
+    if(page && page->valid && page->size != PAGE_SIZE_4K) {
+        mmu_page_split(context, virtpage);
+        mmu_reset_itlb();
+    }
+
     /* Get back the virtual address */
     virtpage = virtpage << MMU_IND_BITS;
 
@@ -267,28 +384,57 @@ static void mmu_page_map_single(mmucontext_t *context,
     }
 
     page->dirty = 1;    /* XXX Initial-write exception not called */
+    page->size = PAGE_SIZE_4K;
     page->blank = 0;
     page->shared = share;
     page->valid = 1;
 
-    page->pteh = BUILD_PTEH(virtpage, 0);
-    page->ptel = BUILD_PTEL(page->physical << PAGESIZE_BITS, 1, 1, page->prkey,
-                            page->cache, page->dirty, page->shared, page->wthru);
+    mmu_page_build(page, vpage);
 }
 
-/* Map N pages sequentially */
+/* Map N pages sequentially, then fold whatever they complete into large
+   pages: the UTLB only has 64 entries, and one 1 MB page saves 255 misses. */
 void mmu_page_map(mmucontext_t *context,
                   int virtpage, int physpage, int count,
                   page_prot_t prot, page_cache_t cache,
                   bool share, bool dirty) {
+    int i, end = virtpage + count;
+
+    for(i = virtpage; i < end; i++, physpage++)
+        mmu_page_map_single(context, i, physpage, prot, cache, share, dirty);
+
+    for(i = virtpage & ~(LARGE_PAGES(PAGE_SIZE_1M) - 1); i < end;
+        i += LARGE_PAGES(PAGE_SIZE_1M))
+        mmu_page_coalesce(context, i, PAGE_SIZE_1M);
+
+    for(i = virtpage & ~(LARGE_PAGES(PAGE_SIZE_64K) - 1); i < end;
+        i += LARGE_PAGES(PAGE_SIZE_64K))
+        mmu_page_coalesce(context, i, PAGE_SIZE_64K);
+}
+
+/* Unmap N pages sequentially, dropping them from the UTLB too */
+void mmu_page_unmap(mmucontext_t *context, int virtpage, int count) {
+    mmupage_t *page;
+    bool itlb = false;
+
+    irq_disable_scoped();
+
     while(count > 0) {
-        mmu_page_map_single(context,
-                            virtpage, physpage,
-                            prot, cache, share, dirty);
+        page = map_virt(context, virtpage);
+
+        if(page) {
+            mmu_page_split(context, virtpage);
+            page->valid = 0;
+            mmu_utlb_drop(context->asid, virtpage, 1);
+            itlb = true;
+        }
+
         virtpage++;
-        physpage++;
         count--;
     }
+
+    if(itlb)
+        mmu_reset_itlb();
 }
 
 #if 0   /* Only applies to KOS-MMU */
@@ -665,9 +811,27 @@ void mmu_gen_tlb_miss(const char *what, irq_t source, irq_context_t *context) {
     mmu_ldtlb_wait(); */
 }
 
+int mmu_get_tlb_stats(mmu_tlb_stats_t *stats) {
+    if(!stats) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    irq_disable_scoped();
+    *stats = tlb_stats;
+
+    return 0;
+}
+
+void mmu_reset_tlb_stats(void) {
+    irq_disable_scoped();
+    memset(&tlb_stats, 0, sizeof(tlb_stats));
+}
+
 /* Instruction TLB miss exception */
 static void itlb_miss(irq_t source, irq_context_t *context, void *data) {
     (void)data;
+    tlb_stats.itlb_misses++;
     mmu_gen_tlb_miss("itlb_miss", source, context);
 }
 
@@ -683,12 +847,14 @@ static void itlb_pv(irq_t source, irq_context_t *context, void *data) {
 /* Data TLB miss (read) */
 static void dtlb_miss_read(irq_t source, irq_context_t *context, void *data) {
     (void)data;
+    tlb_stats.dtlb_read_misses++;
     mmu_gen_tlb_miss("dtlb_miss_read", source, context);
 }
 
 /* Data TLB miss (write) */
 static void dtlb_miss_write(irq_t source, irq_context_t *context, void *data) {
     (void)data;
+    tlb_stats.dtlb_write_misses++;
     mmu_gen_tlb_miss("dtlb_miss_write", source, context);
 }
 
@@ -713,8 +879,6 @@ static void initial_page_write(irq_t source, irq_context_t *context, void *data)
     unhandled_mmu(source, context);
 }
 
-static const unsigned int page_mask[] = { 0x3ff, 0xfff, 0xffff, 0xfffff };
-
 int mmu_page_map_static(uintptr_t virt, uintptr_t phys,
                         page_size_t page_size,
                         page_prot_t page_prot,
@@ -769,6 +933,8 @@ void mmu_init(void) {
     /* No context -- shortcuts not OK yet */
     mmu_shortcut_ok = 0;
 
+    memset(&tlb_stats, 0, sizeof(tlb_stats));
+
     /* Set up interrupt handlers */
     irq_set_handler(EXC_ITLB_MISS, itlb_miss, NULL);
     irq_set_handler(EXC_ITLB_PV, itlb_pv, NULL);
@@ -0,0 +1,524 @@
+/* KallistiOS ##version##
+
+   arch/dreamcast/kernel/mmu_mmap.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Files mapped into virtual address space and paged in on demand. A thread
+   touching a page that isn't loaded yet takes a TLB miss, which queues the
+   page for the pager thread and puts the thread to sleep on it, so that it
+   retries the access once woken. The pager reads the page in from the file
+   and maps it. Only so many pages are kept around: once they're all used,
+   the pager drops one that hasn't been touched since the last time it went
+   around them, clearing them out of the TLB as it goes so that touching them
+   again is noticed. */
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arch/arch.h>
+#include <arch/cache.h>
+#include <arch/irq.h>
+#include <arch/mmu.h>
+#include <kos/dbgio.h>
+#include <kos/dbglog.h>
+#include <kos/fs.h>
+#include <kos/genwait.h>
+#include <kos/mutex.h>
+#include <kos/thread.h>
+#include <kos/worker_thread.h>
+
+#define MMAP_BASE       0x50000000
+#define MMAP_QUEUE      32
+
+/* What a page of a mapping has in place of a resident page number. */
+#define PAGE_ABSENT     -1
+#define PAGE_WANTED     -2
+
+typedef struct mmap_region {
+    vfs_handler_t *vfs;
+    void *hnd;
+    size_t size;
+    int first;          /* First page, 0 if the region is free */
+    int npages;
+    int16_t *slot;      /* For each page: its resident page, or PAGE_* */
+} mmap_region_t;
+
+/* A page of RAM holding a page of a mapping. */
+typedef struct mmap_resident {
+    uintptr_t mem;
+    int16_t region;     /* -1 if the page is free */
+    bool ref;
+    int page;
+} mmap_resident_t;
+
+static mmap_region_t regions[MMU_MMAP_MAX];
+static mmap_resident_t resident[MMU_MMAP_RESIDENT];
+static int nresident, hand;
+
+/* Pages waiting on the pager. If the queue fills up, the pager looks through
+   every mapping for them instead. */
+static struct {
+    int16_t region;
+    int page;
+} queue[MMAP_QUEUE];
+static unsigned int qhead, qlen;
+static bool qlost;
+
+static mmucontext_t *mmap_cxt;
+static mmu_mapfunc_t prev_map;
+static kthread_worker_t *pager;
+
+/* Held while reading pages in and tearing down mappings. */
+static mutex_t pager_mutex = MUTEX_INITIALIZER;
+
+/* Loaded in place of a page that isn't resident yet. It isn't valid, so the
+   access faults again when retried, by which time the page is there. */
+static mmupage_t not_yet;
+
+static inline int page_of(uintptr_t addr) {
+    return addr >> PAGESIZE_BITS;
+}
+
+static inline int vpage(int r, int page) {
+    return regions[r].first + page;
+}
+
+static int region_of(int virtpage) {
+    int r;
+
+    for(r = 0; r < MMU_MMAP_MAX; r++) {
+        if(regions[r].first && virtpage >= regions[r].first &&
+           virtpage < regions[r].first + regions[r].npages)
+            return r;
+    }
+
+    return -1;
+}
+
+/* Called from the TLB miss handler. */
+static mmupage_t *mmap_map(mmucontext_t *context, int virtpage) {
+    mmupage_t *page = prev_map(context, virtpage);
+    uintptr_t addr = (uintptr_t)virtpage << PAGESIZE_BITS;
+    irq_context_t *cxt = irq_get_context();
+    int r, pg;
+    int16_t *slot;
+
+    if(context != mmap_cxt || addr < MMAP_BASE ||
+       addr >= MMAP_BASE + MMU_MMAP_PAGES * PAGESIZE ||
+       (r = region_of(virtpage)) < 0)
+        return page;
+
+    pg = virtpage - regions[r].first;
+    slot = &regions[r].slot[pg];
+
+    if(page) {
+        if(*slot >= 0)
+            resident[*slot].ref = true;
+
+        return page;
+    }
+
+    /* Only a thread can wait for the page, and it can't be the pager. */
+    if(cxt != &thd_current->context || (cxt->sr & 0xf0) == 0xf0 ||
+       thd_current == thd_worker_get_thread(pager)) {
+        dbgio_printf("mmu_mmap: page fault at %08lx in thread %d can't "
+                     "wait\n", (unsigned long)addr, thd_current->tid);
+        return NULL;
+    }
+
+    if(*slot == PAGE_ABSENT) {
+        *slot = PAGE_WANTED;
+
+        if(qlen < MMAP_QUEUE) {
+            queue[(qhead + qlen) % MMAP_QUEUE].region = r;
+            queue[(qhead + qlen) % MMAP_QUEUE].page = pg;
+            qlen++;
+        }
+        else {
+            qlost = true;
+        }
+
+        thd_worker_wakeup(pager);
+    }
+
+    genwait_wait_fault(slot, "mmu_mmap");
+
+    not_yet.pteh = addr & ~(uintptr_t)(PAGESIZE - 1);
+    not_yet.ptel = 0;
+
+    return &not_yet;
+}
+
+static void page_map(int r, int page, uintptr_t mem) {
+    mmu_page_map(mmap_cxt, vpage(r, page), page_of(mem & 0x1fffffff), 1,
+                 MMU_ALL_RDONLY, MMU_CACHEABLE, false, false);
+}
+
+/* Drop a resident page out of its mapping. Assumes interrupts are disabled. */
+static void page_drop(int idx) {
+    mmap_resident_t *res = &resident[idx];
+    int vp = vpage(res->region, res->page);
+
+    /* Nothing in it was written, so nothing needs writing back, but the
+       lines cached through this mapping have to go before the page is
+       reused elsewhere. */
+    dcache_inval_range((uintptr_t)vp << PAGESIZE_BITS, PAGESIZE);
+    mmu_page_unmap(mmap_cxt, vp, 1);
+
+    regions[res->region].slot[res->page] = PAGE_ABSENT;
+    res->region = -1;
+}
+
+/* Find a page of RAM to read into. Assumes the pager mutex is held. */
+static int page_get(void) {
+    void *p;
+    int i;
+
+    for(i = 0; i < nresident; i++) {
+        if(resident[i].region < 0)
+            return i;
+    }
+
+    if(nresident < MMU_MMAP_RESIDENT && (p = memalign(PAGESIZE, PAGESIZE))) {
+        resident[nresident].mem = (uintptr_t)p;
+        resident[nresident].region = -1;
+        return nresident++;
+    }
+
+    if(!nresident)
+        return -1;
+
+    irq_disable_scoped();
+
+    for(;;) {
+        hand = (hand + 1) % nresident;
+
+        if(!resident[hand].ref)
+            break;
+
+        /* Give it another chance, but take it out of the TLB, so that the
+           next time it's touched goes through mmap_map() again. */
+        resident[hand].ref = false;
+        mmu_page_unmap(mmap_cxt, vpage(resident[hand].region,
+                                       resident[hand].page), 1);
+        page_map(resident[hand].region, resident[hand].page,
+                 resident[hand].mem);
+    }
+
+    page_drop(hand);
+
+    return hand;
+}
+
+/* Filesystems like FAT only have the 64-bit versions of these. */
+static _off64_t file_tell(const mmap_region_t *reg) {
+    if(reg->vfs->tell64)
+        return reg->vfs->tell64(reg->hnd);
+
+    return reg->vfs->tell(reg->hnd);
+}
+
+static _off64_t file_seek(const mmap_region_t *reg, _off64_t pos) {
+    if(reg->vfs->seek64)
+        return reg->vfs->seek64(reg->hnd, pos, SEEK_SET);
+
+    return reg->vfs->seek(reg->hnd, (off_t)pos, SEEK_SET);
+}
+
+static uint64_t file_total(vfs_handler_t *vfs, void *hnd) {
+    size_t size;
+
+    if(vfs->total64)
+        return vfs->total64(hnd);
+
+    if(!vfs->total || (size = vfs->total(hnd)) == (size_t)-1)
+        return (uint64_t)-1;
+
+    return size;
+}
+
+static void page_fill(int r, int page) {
+    mmap_region_t *reg = &regions[r];
+    uint8_t *buf;
+    size_t len;
+    ssize_t rv = 0;
+    _off64_t pos;
+    int idx;
+
+    mutex_lock_scoped(&pager_mutex);
+
+    /* The mapping may have gone away since the page was asked for. */
+    if(!reg->first || page >= reg->npages || reg->slot[page] != PAGE_WANTED)
+        return;
+
+    if((idx = page_get()) < 0) {
+        /* Let the thread fault again, and ask for it again, later. */
+        dbglog(DBG_ERROR, "mmu_mmap: out of memory for pages\n");
+        irq_disable_scoped();
+        reg->slot[page] = PAGE_ABSENT;
+        genwait_wake_all(&reg->slot[page]);
+        return;
+    }
+
+    buf = (uint8_t *)resident[idx].mem;
+    len = reg->size - (size_t)page * PAGESIZE;
+
+    if(len > PAGESIZE)
+        len = PAGESIZE;
+
+    pos = file_tell(reg);
+
+    if(file_seek(reg, (_off64_t)page * PAGESIZE) < 0 ||
+       (rv = reg->vfs->read(reg->hnd, buf, len)) < 0) {
+        dbglog(DBG_ERROR, "mmu_mmap: can't read page %d of a mapped file\n",
+               page);
+        rv = 0;
+    }
+
+    file_seek(reg, pos);
+    memset(buf + rv, 0, PAGESIZE - rv);
+
+    /* The page is only read through its mapping from now on, which doesn't
+       share cache lines with this address. */
+    dcache_purge_range((uintptr_t)buf, PAGESIZE);
+
+    irq_disable_scoped();
+
+    resident[idx].region = r;
+    resident[idx].page = page;
+    resident[idx].ref = true;
+    reg->slot[page] = idx;
+    page_map(r, page, resident[idx].mem);
+
+    genwait_wake_all(&reg->slot[page]);
+}
+
+static void pager_thread(void *d) {
+    uint32_t flags;
+    int r, page;
+
+    (void)d;
+
+    for(;;) {
+        flags = irq_disable();
+
+        if(qlen) {
+            r = queue[qhead].region;
+            page = queue[qhead].page;
+            qhead = (qhead + 1) % MMAP_QUEUE;
+            qlen--;
+            irq_restore(flags);
+
+            page_fill(r, page);
+            continue;
+        }
+
+        if(!qlost) {
+            irq_restore(flags);
+            break;
+        }
+
+        qlost = false;
+        irq_restore(flags);
+
+        /* Walk everything for pages the queue had no room for. */
+        for(r = 0; r < MMU_MMAP_MAX; r++) {
+            for(page = 0; page < regions[r].npages; page++) {
+                if(regions[r].first && regions[r].slot[page] == PAGE_WANTED)
+                    page_fill(r, page);
+            }
+        }
+    }
+}
+
+int mmu_mmap_init(void) {
+    const kthread_attr_t attr = {
+        .label = "mmu_mmap",
+        .prio = PRIO_DEFAULT / 2
+    };
+    uint32_t flags;
+
+    mutex_lock_scoped(&pager_mutex);
+
+    if(mmap_cxt)
+        return 0;
+
+    if(!mmu_map_get_callback()) {
+        errno = ENXIO;
+        return -1;
+    }
+
+    if(!(pager = thd_worker_create_ex(&attr, pager_thread, NULL))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    flags = irq_disable();
+
+    if(!mmu_cxt_current) {
+        mmucontext_t *cxt = mmu_context_create(0);
+
+        if(!cxt) {
+            irq_restore(flags);
+            thd_worker_destroy(pager);
+            pager = NULL;
+            errno = ENOMEM;
+            return -1;
+        }
+
+        mmu_use_table(cxt);
+    }
+
+    mmap_cxt = mmu_cxt_current;
+    prev_map = mmu_map_set_callback(mmap_map);
+    irq_restore(flags);
+
+    return 0;
+}
+
+int mmu_mmap_shutdown(void) {
+    uint32_t flags;
+    int r;
+
+    mutex_lock_scoped(&pager_mutex);
+
+    if(!mmap_cxt)
+        return 0;
+
+    for(r = 0; r < MMU_MMAP_MAX; r++) {
+        if(regions[r].first) {
+            errno = EBUSY;
+            return -1;
+        }
+    }
+
+    flags = irq_disable();
+    mmu_map_set_callback(prev_map);
+    mmap_cxt = NULL;
+    irq_restore(flags);
+
+    thd_worker_destroy(pager);
+    pager = NULL;
+
+    while(nresident)
+        free((void *)resident[--nresident].mem);
+
+    return 0;
+}
+
+void *mmu_mmap_file(file_t fd) {
+    vfs_handler_t *vfs = fs_get_handler(fd);
+    void *hnd = fs_get_handle(fd);
+    int r, i, first, npages;
+    uint64_t total;
+    size_t size;
+    int16_t *slot;
+
+    mutex_lock_scoped(&pager_mutex);
+
+    if(!mmap_cxt || mmu_cxt_current != mmap_cxt) {
+        errno = ENXIO;
+        return NULL;
+    }
+
+    if(!vfs || !vfs->read || !(vfs->seek || vfs->seek64) ||
+       !(vfs->tell || vfs->tell64)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    total = file_total(vfs, hnd);
+
+    if(total == 0 || total == (uint64_t)-1) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(total > (uint64_t)MMU_MMAP_PAGES * PAGESIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    size = total;
+
+    npages = (size + PAGESIZE - 1) / PAGESIZE;
+
+    for(r = 0; r < MMU_MMAP_MAX && regions[r].first; r++)
+        ;
+
+    if(r == MMU_MMAP_MAX || npages > MMU_MMAP_PAGES ||
+       !(slot = malloc(npages * sizeof(int16_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* Put it in the first gap between the other mappings that fits it,
+       leaving an unmapped page after it. */
+    first = page_of(MMAP_BASE);
+
+    for(i = 0; i < MMU_MMAP_MAX; i++) {
+        if(regions[i].first && first + npages + 1 > regions[i].first &&
+           first < regions[i].first + regions[i].npages + 1) {
+            first = regions[i].first + regions[i].npages + 1;
+            i = -1;
+        }
+    }
+
+    if(first + npages > page_of(MMAP_BASE) + MMU_MMAP_PAGES) {
+        free(slot);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for(i = 0; i < npages; i++)
+        slot[i] = PAGE_ABSENT;
+
+    irq_disable_scoped();
+
+    regions[r].vfs = vfs;
+    regions[r].hnd = hnd;
+    regions[r].size = size;
+    regions[r].npages = npages;
+    regions[r].slot = slot;
+    regions[r].first = first;
+
+    return (void *)((uintptr_t)first << PAGESIZE_BITS);
+}
+
+void mmu_mmap_release(void *addr) {
+    uint32_t flags;
+    int r, i;
+    int16_t *slot;
+
+    mutex_lock_scoped(&pager_mutex);
+
+    if(!mmap_cxt || (r = region_of(page_of((uintptr_t)addr))) < 0)
+        return;
+
+    flags = irq_disable();
+
+    for(i = 0; i < nresident; i++) {
+        if(resident[i].region == r)
+            page_drop(i);
+    }
+
+    /* Anyone still waiting on a page faults for real when they retry. */
+    slot = regions[r].slot;
+
+    for(i = 0; i < regions[r].npages; i++) {
+        if(slot[i] == PAGE_WANTED)
+            genwait_wake_all(&slot[i]);
+    }
+
+    regions[r].first = 0;
+    regions[r].npages = 0;
+    regions[r].slot = NULL;
+
+    irq_restore(flags);
+
+    free(slot);
+}
@@ -0,0 +1,266 @@
+/* KallistiOS ##version##
+
+   arch/dreamcast/kernel/mmu_stack.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Thread stacks that are backed by RAM only as they grow. Each stack gets a
+   range of virtual address space made of one or more 64KB slots, with the
+   stack at the top of it and at least one page below it that is never
+   mapped. Pages are mapped in by the TLB miss handler the first time they're
+   touched, from a reserve of pages that is refilled from malloc() in thread
+   context, as malloc() can't be called from the exception handler. */
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <arch/arch.h>
+#include <arch/cache.h>
+#include <arch/irq.h>
+#include <arch/mmu.h>
+#include <arch/stack.h>
+#include <kos/dbgio.h>
+#include <kos/thread.h>
+
+#define STACK_BASE          0x40000000
+#define STACK_SLOT_PAGES    16
+#define STACK_SLOT_SIZE     (STACK_SLOT_PAGES * PAGESIZE)
+
+/* A stack never crosses a sub-context, so that its page table is always
+   allocated before the stack is used. */
+#define SLOTS_PER_SUB       (MMU_SUB_PAGES / STACK_SLOT_PAGES)
+
+/* The first slot of the stack each slot belongs to, or -1 if it's free. */
+static int16_t slot_head[MMU_STACK_SLOTS];
+
+/* For the first slot of a stack: its number of slots, and its lowest page. */
+static uint8_t slot_count[MMU_STACK_SLOTS];
+static int slot_low[MMU_STACK_SLOTS];
+
+static uintptr_t reserve[MMU_STACK_RESERVE];
+static unsigned int reserved;
+
+static mmucontext_t *stack_cxt;
+static mmu_mapfunc_t prev_map;
+static unsigned int live;
+
+static inline int page_of(uintptr_t addr) {
+    return addr >> PAGESIZE_BITS;
+}
+
+/* Top up the reserve of pages. Assumes interrupts are disabled. */
+static void reserve_fill(void) {
+    void *p;
+
+    while(reserved < MMU_STACK_RESERVE) {
+        if(!(p = memalign(PAGESIZE, PAGESIZE)))
+            break;
+
+        /* The page is only ever accessed through its virtual address from
+           now on, which doesn't share cache lines with this one. */
+        dcache_purge_range((uintptr_t)p, PAGESIZE);
+        reserve[reserved++] = (uintptr_t)p;
+    }
+}
+
+static bool stack_commit(int virtpage) {
+    if(!reserved)
+        return false;
+
+    mmu_page_map(stack_cxt, virtpage,
+                 page_of(reserve[--reserved] & 0x1fffffff), 1,
+                 MMU_ALL_RDWR, MMU_CACHEABLE, false, true);
+
+    return true;
+}
+
+/* Called from the TLB miss handler. */
+static mmupage_t *stack_map(mmucontext_t *context, int virtpage) {
+    mmupage_t *page = prev_map(context, virtpage);
+    uintptr_t addr = (uintptr_t)virtpage << PAGESIZE_BITS;
+    int slot, head;
+
+    if(page || context != stack_cxt || addr < STACK_BASE ||
+       addr >= STACK_BASE + MMU_STACK_SLOTS * STACK_SLOT_SIZE)
+        return page;
+
+    slot = (addr - STACK_BASE) / STACK_SLOT_SIZE;
+    head = slot_head[slot];
+
+    if(head < 0)
+        return NULL;
+
+    if(virtpage < slot_low[head]) {
+        dbgio_printf("mmu_stack: stack overflow in thread %d\n",
+                     thd_current->tid);
+        return NULL;
+    }
+
+    if(!stack_commit(virtpage)) {
+        dbgio_printf("mmu_stack: out of reserved pages in thread %d\n",
+                     thd_current->tid);
+        return NULL;
+    }
+
+    return prev_map(context, virtpage);
+}
+
+int mmu_stack_init(void) {
+    int i;
+
+    irq_disable_scoped();
+
+    if(stack_cxt)
+        return 0;
+
+    if(!mmu_map_get_callback()) {
+        errno = ENXIO;
+        return -1;
+    }
+
+    if(!mmu_cxt_current) {
+        mmucontext_t *cxt = mmu_context_create(0);
+
+        if(!cxt) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        mmu_use_table(cxt);
+    }
+
+    for(i = 0; i < MMU_STACK_SLOTS; i++)
+        slot_head[i] = -1;
+
+    stack_cxt = mmu_cxt_current;
+    prev_map = mmu_map_set_callback(stack_map);
+    reserve_fill();
+
+    return 0;
+}
+
+int mmu_stack_shutdown(void) {
+    irq_disable_scoped();
+
+    if(!stack_cxt)
+        return 0;
+
+    if(live) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    mmu_map_set_callback(prev_map);
+    stack_cxt = NULL;
+
+    while(reserved)
+        free((void *)reserve[--reserved]);
+
+    return 0;
+}
+
+void *arch_stk_alloc_lazy(size_t size) {
+    int i, n, first;
+    uintptr_t top, stack;
+
+    irq_disable_scoped();
+
+    if(!stack_cxt || mmu_cxt_current != stack_cxt)
+        return NULL;
+
+    /* Leave room for at least one guard page. */
+    n = (size + PAGESIZE + STACK_SLOT_SIZE - 1) / STACK_SLOT_SIZE;
+
+    if(n > SLOTS_PER_SUB)
+        return NULL;
+
+    for(first = 0; first + n <= MMU_STACK_SLOTS; first++) {
+        if(first / SLOTS_PER_SUB != (first + n - 1) / SLOTS_PER_SUB) {
+            first = (first + n - 1) / SLOTS_PER_SUB * SLOTS_PER_SUB - 1;
+            continue;
+        }
+
+        for(i = 0; i < n && slot_head[first + i] < 0; i++)
+            ;
+
+        if(i == n)
+            break;
+
+        first += i;
+    }
+
+    if(first + n > MMU_STACK_SLOTS)
+        return NULL;
+
+    reserve_fill();
+
+    top = STACK_BASE + (first + n) * STACK_SLOT_SIZE;
+    stack = (top - size) & ~(uintptr_t)(THD_STACK_ALIGNMENT - 1);
+
+    /* The thread starts right away at the top, and mapping it now also
+       allocates the page table of the range outside of the exception
+       handler. */
+    if(!stack_commit(page_of(top) - 1))
+        return NULL;
+
+    for(i = 0; i < n; i++)
+        slot_head[first + i] = first;
+
+    slot_count[first] = n;
+    slot_low[first] = page_of(stack);
+    ++live;
+
+    return (void *)stack;
+}
+
+size_t arch_stk_lazy_committed(const void *stack) {
+    int slot, first, vp;
+    uintptr_t top;
+
+    irq_disable_scoped();
+
+    slot = ((uintptr_t)stack - STACK_BASE) / STACK_SLOT_SIZE;
+    first = slot_head[slot];
+    top = STACK_BASE + (first + slot_count[first]) * STACK_SLOT_SIZE;
+
+    /* The lowest committed page is as deep as the stack has gone. */
+    for(vp = slot_low[first]; vp < page_of(top); vp++) {
+        if(mmu_virt_to_phys(stack_cxt, vp) >= 0)
+            break;
+    }
+
+    return top - ((uintptr_t)vp << PAGESIZE_BITS);
+}
+
+void arch_stk_free_lazy(void *stack) {
+    int slot, first, vp, phys, i;
+    uintptr_t top;
+
+    irq_disable_scoped();
+
+    slot = ((uintptr_t)stack - STACK_BASE) / STACK_SLOT_SIZE;
+    first = slot_head[slot];
+    top = STACK_BASE + (first + slot_count[first]) * STACK_SLOT_SIZE;
+
+    for(vp = slot_low[first]; vp < page_of(top); vp++) {
+        if((phys = mmu_virt_to_phys(stack_cxt, vp)) < 0)
+            continue;
+
+        /* Write back nothing, drop everything cached through this mapping
+           before the page goes back to the RAM pool. */
+        dcache_inval_range((uintptr_t)vp << PAGESIZE_BITS, PAGESIZE);
+        mmu_page_unmap(stack_cxt, vp, 1);
+
+        if(reserved < MMU_STACK_RESERVE)
+            reserve[reserved++] = (phys << PAGESIZE_BITS) | 0x80000000;
+        else
+            free((void *)((phys << PAGESIZE_BITS) | 0x80000000));
+    }
+
+    for(i = 0; i < slot_count[first]; i++)
+        slot_head[first + i] = -1;
+
+    --live;
+}
@@ -0,0 +1,146 @@
+/* KallistiOS ##version##
+
+   ocram.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Allocator for the operand cache RAM. The 8 KB are split into 256 blocks
+   of 32 bytes (one cache line each), tracked with a bitmap, and each
+   allocation remembers its length at its first block. The static .ocram
+   section comes first and is never handed out. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <arch/irq.h>
+#include <arch/ocram.h>
+#include <kos/dbglog.h>
+
+#define CCR         (*(volatile uint32_t *)(void *)0xff00001c)
+#define CCR_ORA     (1 << 5)
+
+#define BLOCK_SIZE  32
+#define BLOCKS      (OCRAM_SIZE / BLOCK_SIZE)
+
+/* From the linker script */
+extern uint8_t _ocram_start[];
+extern uint8_t _ocram_end[];
+
+static uint32_t used[BLOCKS / 32];
+static uint8_t lens[BLOCKS];        /* Length of each allocation, minus 1 */
+static size_t free_blocks;
+
+static inline bool block_used(unsigned int i) {
+    return used[i >> 5] & (1u << (i & 31));
+}
+
+static void mark(unsigned int first, unsigned int count, bool in_use) {
+    unsigned int i;
+
+    for(i = first; i < first + count; i++) {
+        if(in_use)
+            used[i >> 5] |= 1u << (i & 31);
+        else
+            used[i >> 5] &= ~(1u << (i & 31));
+    }
+}
+
+bool ocram_enabled(void) {
+    return !!(CCR & CCR_ORA);
+}
+
+void ocram_init(void) {
+    size_t stat = _ocram_end - _ocram_start;
+    unsigned int reserved = (stat + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    memset(used, 0, sizeof(used));
+
+    if(!ocram_enabled()) {
+        free_blocks = 0;
+
+        if(stat)
+            dbglog(DBG_WARNING, "ocram: %u bytes of __ocram data but no "
+                   "INIT_OCRAM\n", (unsigned int)stat);
+
+        return;
+    }
+
+    memset(_ocram_start, 0, stat);
+
+    mark(0, reserved, true);
+    free_blocks = BLOCKS - reserved;
+}
+
+void *ocram_alloc(size_t size) {
+    unsigned int count, first, i;
+
+    if(!ocram_enabled()) {
+        errno = ENODEV;
+        return NULL;
+    }
+
+    if(!size) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(size > OCRAM_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    count = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    irq_disable_scoped();
+
+    /* First fit */
+    for(first = 0; first + count <= BLOCKS; first = i + 1) {
+        for(i = first; i < first + count; i++) {
+            if(block_used(i))
+                break;
+        }
+
+        if(i == first + count) {
+            mark(first, count, true);
+            lens[first] = count - 1;
+            free_blocks -= count;
+
+            return (void *)(uintptr_t)(OCRAM_BASE + first * BLOCK_SIZE);
+        }
+    }
+
+    errno = ENOMEM;
+    return NULL;
+}
+
+void ocram_free(void *ptr) {
+    uintptr_t addr = (uintptr_t)ptr;
+    unsigned int first, count;
+
+    if(!ptr)
+        return;
+
+    if(addr < OCRAM_BASE || addr >= OCRAM_BASE + OCRAM_SIZE ||
+       (addr & (BLOCK_SIZE - 1))) {
+        dbglog(DBG_ERROR, "ocram_free: %p was not from ocram_alloc()\n", ptr);
+        return;
+    }
+
+    first = (addr - OCRAM_BASE) / BLOCK_SIZE;
+    count = lens[first] + 1;
+
+    irq_disable_scoped();
+
+    if(!block_used(first)) {
+        dbglog(DBG_ERROR, "ocram_free: %p is not allocated\n", ptr);
+        return;
+    }
+
+    mark(first, count, false);
+    free_blocks += count;
+}
+
+size_t ocram_available(void) {
+    return free_blocks * BLOCK_SIZE;
+}
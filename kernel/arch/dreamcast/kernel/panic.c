@@ -6,11 +6,17 @@
 
 #include <stdio.h>
 #include <arch/arch.h>
+#include <kos/dbgio.h>
 
 /* If something goes badly wrong in the kernel and you don't think you
    can recover, call this. This is a pretty standard tactic from *nixy
    kernels which ought to be avoided if at all possible. */
 void arch_panic(const char *msg) {
     printf("\nkernel panic: %s\r\n", msg);
+
+    /* Get out whatever debug output is queued, this message included. */
+    fflush(stdout);
+    dbgio_flush();
+
     arch_abort();
 }
@@ -4,26 +4,191 @@
    Copyright (C) 2024 Paul Cercueil
 */
 
+#include <errno.h>
+#include <stdbool.h>
+
+#include <arch/irq.h>
+#include <kos/thread.h>
 #include <kos/timer.h>
 #include <dc/perf_monitor.h>
 
+/* How many threads can be inside probe points at once */
+#define MAX_THREADS         32
+
+/* How many (probe point, thread) pairs can be kept track of */
+#define MAX_THREAD_RECORDS  256
+
+struct perf_monitor_thread {
+    struct perf_monitor_thread *next;
+    tid_t tid;
+    uint64_t calls;
+    uint64_t time_ns, self_ns;
+};
+
+/* The innermost probe point each thread is in */
+struct thread_top {
+    tid_t tid;
+    struct perf_monitor_scope *scope;
+};
+
 extern struct perf_monitor _monitors_start, _monitors_end;
 
-void __stop_perf_monitor(struct perf_monitor **monitor) {
-    struct perf_monitor *data = *monitor;
+static struct thread_top tops[MAX_THREADS];
+static struct perf_monitor_thread records[MAX_THREAD_RECORDS];
+static unsigned int records_used;
+
+static perf_cntr_event_t mux_events[PERF_MONITOR_MUX_MAX];
+static unsigned int mux_count;      /* 0 when not multiplexing */
+static bool mux_running;
+static unsigned int mux_first;      /* Index of the event in PRFC0 */
+static volatile unsigned int gen;
+
+static inline tid_t current_tid(void) {
+    return thd_current ? thd_current->tid : 0;
+}
+
+static struct thread_top *thread_top(tid_t tid, bool create) {
+    struct thread_top *free_top = NULL;
+    unsigned int i;
+
+    for(i = 0; i < MAX_THREADS; i++) {
+        if(tops[i].scope && tops[i].tid == tid)
+            return &tops[i];
+
+        if(!tops[i].scope && !free_top)
+            free_top = &tops[i];
+    }
+
+    if(create && free_top)
+        free_top->tid = tid;
+
+    return create ? free_top : NULL;
+}
+
+static struct perf_monitor_thread *thread_record(struct perf_monitor *monitor,
+                                                 tid_t tid) {
+    struct perf_monitor_thread *rec;
+
+    for(rec = monitor->threads; rec; rec = rec->next) {
+        if(rec->tid == tid)
+            return rec;
+    }
+
+    if(records_used == MAX_THREAD_RECORDS)
+        return NULL;
+
+    rec = &records[records_used++];
+    rec->tid = tid;
+    rec->calls = 0;
+    rec->time_ns = 0;
+    rec->self_ns = 0;
+    rec->next = monitor->threads;
+    monitor->threads = rec;
+
+    return rec;
+}
+
+void __stop_perf_monitor(struct perf_monitor_scope **ptr) {
+    struct perf_monitor_scope *scope = *ptr, *parent = scope->parent;
+    struct perf_monitor *data = scope->monitor;
+    struct perf_monitor_thread *rec;
+    struct thread_top *top;
+    uint64_t ns, ev0, ev1;
+    unsigned int idx;
+    tid_t tid;
+
+    ns = timer_ns_gettime64() - scope->time_start;
+    ev0 = perf_cntr_count(PRFC0) - scope->event0_start;
+    ev1 = perf_cntr_count(PRFC1) - scope->event1_start;
+
+    data->time_ns += ns;
+    data->self_ns += ns - scope->child_ns;
+
+    if(scope->gen != gen) {
+        /* The counters were switched over while in here */
+        ev0 = ev1 = 0;
+    }
+    else if(mux_count) {
+        idx = mux_first;
+        data->mux[idx].total += ev0;
+        data->mux[idx].self += ev0 - scope->child_event0;
+        data->mux[idx].calls++;
 
-    data->event0 += perf_cntr_count(PRFC0) - data->event0_start;
-    data->event1 += perf_cntr_count(PRFC1) - data->event1_start;
-    data->time_ns += timer_ns_gettime64() - data->time_start;
+        idx = (idx + 1) % mux_count;
+
+        if(mux_count > 1) {
+            data->mux[idx].total += ev1;
+            data->mux[idx].self += ev1 - scope->child_event1;
+            data->mux[idx].calls++;
+        }
+    }
+    else {
+        data->event0 += ev0;
+        data->self_event0 += ev0 - scope->child_event0;
+        data->event1 += ev1;
+        data->self_event1 += ev1 - scope->child_event1;
+    }
+
+    if(parent) {
+        parent->child_ns += ns;
+        parent->child_event0 += ev0;
+        parent->child_event1 += ev1;
+    }
+
+    tid = current_tid();
+
+    irq_disable_scoped();
+
+    rec = thread_record(data, tid);
+
+    if(rec) {
+        rec->calls++;
+        rec->time_ns += ns;
+        rec->self_ns += ns - scope->child_ns;
+    }
+
+    top = thread_top(tid, false);
+
+    if(top)
+        top->scope = parent;
 }
 
-struct perf_monitor *__start_perf_monitor(struct perf_monitor *data) {
+struct perf_monitor_scope *__start_perf_monitor(struct perf_monitor_scope *scope,
+                                                struct perf_monitor *data) {
+    struct thread_top *top;
+
     data->calls++;
-    data->time_start = timer_ns_gettime64();
-    data->event0_start = perf_cntr_count(PRFC0);
-    data->event1_start = perf_cntr_count(PRFC1);
 
-    return data;
+    scope->monitor = data;
+    scope->child_ns = 0;
+    scope->child_event0 = 0;
+    scope->child_event1 = 0;
+
+    {
+        irq_disable_scoped();
+
+        top = thread_top(current_tid(), true);
+
+        if(top) {
+            scope->parent = top->scope;
+            top->scope = scope;
+        }
+        else {
+            scope->parent = NULL;
+        }
+    }
+
+    scope->gen = gen;
+    scope->time_start = timer_ns_gettime64();
+    scope->event0_start = perf_cntr_count(PRFC0);
+    scope->event1_start = perf_cntr_count(PRFC1);
+
+    return scope;
+}
+
+static void start_counters(perf_cntr_event_t event1, perf_cntr_event_t event2) {
+    perf_cntr_start(PRFC0, event1, PMCR_COUNT_CPU_CYCLES);
+    perf_cntr_start(PRFC1, event2, PMCR_COUNT_CPU_CYCLES);
 }
 
 void perf_monitor_init(perf_cntr_event_t event1, perf_cntr_event_t event2) {
@@ -32,8 +197,48 @@ void perf_monitor_init(perf_cntr_event_t event1, perf_cntr_event_t event2) {
     perf_cntr_clear(PRFC0);
     perf_cntr_clear(PRFC1);
 
-    perf_cntr_start(PRFC0, event1, PMCR_COUNT_CPU_CYCLES);
-    perf_cntr_start(PRFC1, event2, PMCR_COUNT_CPU_CYCLES);
+    mux_count = 0;
+    mux_running = false;
+    gen++;
+
+    start_counters(event1, event2);
+}
+
+int perf_monitor_init_mux(const perf_cntr_event_t *events, size_t count) {
+    unsigned int i;
+
+    if(!count || count > PERF_MONITOR_MUX_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    perf_cntr_timer_disable();
+
+    perf_cntr_clear(PRFC0);
+    perf_cntr_clear(PRFC1);
+
+    for(i = 0; i < count; i++)
+        mux_events[i] = events[i];
+
+    mux_count = count;
+    mux_first = 0;
+    mux_running = true;
+    gen++;
+
+    start_counters(mux_events[0], mux_events[1 % count]);
+
+    return 0;
+}
+
+void perf_monitor_frame(void) {
+    if(!mux_running || mux_count <= 2)
+        return;
+
+    mux_first = (mux_first + 2) % mux_count;
+    gen++;
+
+    start_counters(mux_events[mux_first],
+                   mux_events[(mux_first + 1) % mux_count]);
 }
 
 void perf_monitor_exit(void) {
@@ -43,9 +248,40 @@ void perf_monitor_exit(void) {
     perf_cntr_clear(PRFC0);
     perf_cntr_clear(PRFC1);
 
+    /* Keep mux_count, for perf_monitor_print() */
+    mux_running = false;
+    gen++;
+
     perf_cntr_timer_enable();
 }
 
+static void print_threads(FILE *f, const struct perf_monitor *monitor) {
+    const struct perf_monitor_thread *rec;
+    kthread_t *thd;
+
+    for(rec = monitor->threads; rec; rec = rec->next) {
+        thd = thd_by_tid(rec->tid);
+
+        fprintf(f, "\t\tthread %d (%s): %llu calls, %llu ns, %llu ns self\n",
+                (int)rec->tid, thd && thd->label[0] ? thd->label : "?",
+                rec->calls, rec->time_ns, rec->self_ns);
+    }
+}
+
+static void print_mux(FILE *f, const struct perf_monitor *monitor) {
+    const struct perf_monitor_event *ev;
+    unsigned int i;
+
+    for(i = 0; i < mux_count; i++) {
+        ev = &monitor->mux[i];
+
+        fprintf(f, "\t\tevent 0x%02x: %llu over %llu calls (%f event/call, %f self)\n",
+                (unsigned int)mux_events[i], ev->total, ev->calls,
+                ev->calls ? (float)ev->total / (float)ev->calls : 0.0f,
+                ev->calls ? (float)ev->self / (float)ev->calls : 0.0f);
+    }
+}
+
 void perf_monitor_print(FILE *f) {
     struct perf_monitor *monitor;
 
@@ -53,12 +289,24 @@ void perf_monitor_print(FILE *f) {
         fprintf(f, "Performance monitors:\n");
 
     for(monitor = &_monitors_end - 1; monitor >= &_monitors_start; monitor--) {
-        fprintf(f, "\t%s L%u: %llu calls\n\t\t%llu ns (%f ns/call)\n\t\tevent 0: %llu (%f event/call)\n\t\tevent 1: %llu (%f event/call)\n",
+        fprintf(f, "\t%s L%u: %llu calls\n\t\t%llu ns (%f ns/call), %llu ns self\n",
                 monitor->fn, monitor->line, monitor->calls, monitor->time_ns,
                 monitor->calls ? (float)monitor->time_ns / (float)monitor->calls : 0.0f,
-                monitor->event0,
-                monitor->event0 ? (float)monitor->event0 / (float)monitor->calls : 0.0f,
-                monitor->event1,
-                monitor->event1 ? (float)monitor->event1 / (float)monitor->calls : 0.0f);
+                monitor->self_ns);
+
+        if(mux_count) {
+            print_mux(f, monitor);
+        }
+        else {
+            fprintf(f, "\t\tevent 0: %llu (%f event/call), %llu self\n\t\tevent 1: %llu (%f event/call), %llu self\n",
+                    monitor->event0,
+                    monitor->event0 ? (float)monitor->event0 / (float)monitor->calls : 0.0f,
+                    monitor->self_event0,
+                    monitor->event1,
+                    monitor->event1 ? (float)monitor->event1 / (float)monitor->calls : 0.0f,
+                    monitor->self_event1);
+        }
+
+        print_threads(f, monitor);
     }
 }
@@ -0,0 +1,274 @@
+/* KallistiOS ##version##
+
+   profiler.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Sampling profiler. The TMU1 handler hashes (PC, PR, thread) into an open
+   addressing table that was allocated up front, so nothing is allocated or
+   locked in the interrupt. Printing sorts a copy of the table. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <arch/irq.h>
+#include <arch/timer.h>
+#include <dc/profiler.h>
+#include <kos/exports.h>
+#include <kos/thread.h>
+
+/* How far to probe for a free slot before giving up on a sample */
+#define PROBE_MAX   16
+
+typedef struct sample {
+    uint32_t pc;
+    uint32_t pr;
+    tid_t tid;
+    uint32_t count;                 /* 0 for an empty slot */
+} sample_t;
+
+static sample_t *table;
+static size_t table_mask;
+static volatile uint32_t total;
+static volatile uint32_t dropped;
+static bool running;
+
+static inline uint32_t sample_hash(uint32_t pc, uint32_t pr, tid_t tid) {
+    uint32_t h = pc * 0x9e3779b1;
+
+    h ^= (pr * 0x85ebca6b) >> 7;
+    h ^= (uint32_t)tid * 0xc2b2ae35;
+
+    return h ^ (h >> 15);
+}
+
+static void profiler_irq_hnd(irq_t code, irq_context_t *context, void *data) {
+    const tid_t tid = thd_current ? thd_current->tid : 0;
+    const uint32_t pc = context->pc, pr = context->pr;
+    sample_t *s;
+    size_t i, n;
+
+    (void)code;
+    (void)data;
+
+    timer_clear(TMU1);
+
+    i = sample_hash(pc, pr, tid) & table_mask;
+
+    for(n = 0; n < PROBE_MAX; n++, i = (i + 1) & table_mask) {
+        s = &table[i];
+
+        if(!s->count) {
+            s->pc = pc;
+            s->pr = pr;
+            s->tid = tid;
+        }
+        else if(s->pc != pc || s->pr != pr || s->tid != tid) {
+            continue;
+        }
+
+        s->count++;
+        total++;
+        return;
+    }
+
+    dropped++;
+}
+
+int profiler_start(unsigned int hz, size_t entries) {
+    sample_t *t;
+    size_t size = 1;
+
+    if(running) {
+        errno = EALREADY;
+        return -1;
+    }
+
+    if(!hz)
+        hz = PROFILER_DEFAULT_HZ;
+
+    if(!entries)
+        entries = PROFILER_DEFAULT_ENTRIES;
+
+    while(size < entries)
+        size <<= 1;
+
+    if(timer_claim(TMU1) < 0)
+        return -1;
+
+    t = calloc(size, sizeof(sample_t));
+
+    if(!t) {
+        timer_release(TMU1);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    free(table);
+    table = t;
+    table_mask = size - 1;
+    total = 0;
+    dropped = 0;
+    running = true;
+
+    irq_set_handler(EXC_TMU1_TUNI1, profiler_irq_hnd, NULL);
+    timer_prime(TMU1, hz, 1);
+    timer_start(TMU1);
+
+    return 0;
+}
+
+int profiler_stop(void) {
+    if(!running) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    timer_stop(TMU1);
+    timer_disable_ints(TMU1);
+    timer_clear(TMU1);
+    irq_set_handler(EXC_TMU1_TUNI1, NULL, NULL);
+    timer_release(TMU1);
+
+    running = false;
+
+    return 0;
+}
+
+uint32_t profiler_samples(uint32_t *d) {
+    if(d)
+        *d = dropped;
+
+    return total;
+}
+
+/* Hottest first */
+static int sample_cmp(const void *a, const void *b) {
+    const sample_t *sa = a, *sb = b;
+
+    if(sa->count != sb->count)
+        return sa->count < sb->count ? 1 : -1;
+
+    return sa->pc < sb->pc ? -1 : sa->pc > sb->pc;
+}
+
+/* By address */
+static int sample_pc_cmp(const void *a, const void *b) {
+    const sample_t *sa = a, *sb = b;
+
+    return sa->pc < sb->pc ? -1 : sa->pc > sb->pc;
+}
+
+/* Take a copy of the table, without the empty slots */
+static sample_t *profiler_snapshot(size_t *count) {
+    sample_t *out;
+    size_t i, n = 0;
+
+    if(!table) {
+        *count = 0;
+        return NULL;
+    }
+
+    out = malloc((table_mask + 1) * sizeof(sample_t));
+
+    if(!out) {
+        *count = 0;
+        return NULL;
+    }
+
+    irq_disable_scoped();
+
+    for(i = 0; i <= table_mask; i++) {
+        if(table[i].count)
+            out[n++] = table[i];
+    }
+
+    *count = n;
+
+    return out;
+}
+
+static void print_flat(FILE *f, sample_t *s, size_t n) {
+    export_sym_t *sym;
+    size_t i, j;
+
+    /* Fold the different callers and threads of each PC together */
+    qsort(s, n, sizeof(sample_t), sample_pc_cmp);
+
+    for(i = 0, j = 0; i < n; i++) {
+        if(j && s[j - 1].pc == s[i].pc)
+            s[j - 1].count += s[i].count;
+        else
+            s[j++] = s[i];
+    }
+
+    qsort(s, j, sizeof(sample_t), sample_cmp);
+
+    fprintf(f, "# samples       %%  address     nearest export\n");
+
+    for(i = 0; i < j; i++) {
+        fprintf(f, "%9lu  %6.2f  0x%08lx", (unsigned long)s[i].count,
+                100.0 * s[i].count / total, (unsigned long)s[i].pc);
+
+        sym = export_lookup_addr(s[i].pc);
+
+        if(sym)
+            fprintf(f, "  %s+0x%lx", sym->name,
+                    (unsigned long)(s[i].pc - sym->ptr));
+
+        fprintf(f, "\n");
+    }
+}
+
+static void print_collapsed(FILE *f, sample_t *s, size_t n) {
+    kthread_t *thd;
+    size_t i;
+
+    qsort(s, n, sizeof(sample_t), sample_cmp);
+
+    for(i = 0; i < n; i++) {
+        thd = thd_by_tid(s[i].tid);
+
+        if(thd && thd->label[0])
+            fprintf(f, "%s", thd->label);
+        else
+            fprintf(f, "tid %d", (int)s[i].tid);
+
+        fprintf(f, ";0x%08lx;0x%08lx %lu\n", (unsigned long)s[i].pr,
+                (unsigned long)s[i].pc, (unsigned long)s[i].count);
+    }
+}
+
+void profiler_print(FILE *f, profiler_format_t fmt) {
+    sample_t *s;
+    size_t n;
+
+    s = profiler_snapshot(&n);
+
+    if(fmt == PROFILER_FLAT)
+        fprintf(f, "# %lu samples, %lu dropped\n", (unsigned long)total,
+                (unsigned long)dropped);
+
+    if(!s)
+        return;
+
+    if(fmt == PROFILER_COLLAPSED)
+        print_collapsed(f, s, n);
+    else
+        print_flat(f, s, n);
+
+    free(s);
+}
+
+int profiler_dump(const char *path, profiler_format_t fmt) {
+    FILE *f = fopen(path, "w");
+
+    if(!f)
+        return -1;
+
+    profiler_print(f, fmt);
+    fclose(f);
+
+    return 0;
+}
@@ -33,7 +33,8 @@ _thd_block_now:
 	! to persist across calls. So we'll put our temps down there
 	! and start at R8.
 
-	! Save SR and disable interrupts
+	! Save SR, disable interrupts and enable the FPU. The thread
+	! might not use it, but the scheduler code we call might.
 	mov.l		irqd_and,r1
 	mov.l		irqd_or,r2
 	stc		sr,r0
@@ -46,22 +47,28 @@ _thd_block_now:
 	mov		r0,r1
 	add		#0x72,r4
 
-	sts.l		fpscr,@-r4	! save FPSCR 0xe0
-
-	mov		r4,r3
-	add		#-4,r3
-	mov		#0x7,r2
+	mov.l		@r4,r3		! Get the FPU flag 0xe4
+	tst		r3,r3		! T = 1 if the thread doesn't use the FPU
+	bt/s		1f
+	add		#-4,r4
+	sts		fpscr,r2
+	mov.l		r2,@r4		! save FPSCR 0xe0
 
 1:
 	! Write a bogus value (r0) at each (i*0x20) offset of the irq context
-	! structure, using the movca.l opcode. This will pre-allocate cache
-	! blocks that covers the whole memory area, without fetching data
-	! from RAM, which means that the stores will then be as fast as they
-	! can be.
-	movca.l		r0,@r3
-	dt		r2
-	bf/s		1b
-	add		#-0x20,r3
+	! structure that we are going to fill, using the movca.l opcode. This
+	! will pre-allocate cache blocks that cover those areas, without
+	! fetching data from RAM, which means that the stores will then be as
+	! fast as they can be. The FPU register blocks are done further down,
+	! only if they get saved.
+	mov		r4,r5
+	add		#-4,r5
+	movca.l		r0,@r5		! R8-R15   0xc0
+	add		#-0x20,r5
+	movca.l		r0,@r5		! R0-R7    0xa0
+	add		#-0x50,r5
+	add		#-0x50,r5
+	movca.l		r0,@r5		! PC-FPUL  0x00
 
 	! Ok save the "permanent" GPRs
 	mov.l		r15,@-r4	! save R15   0xdc
@@ -76,6 +83,22 @@ _thd_block_now:
 	mov.l		r8,@-r4		! save R8    0xc0
 	add		#-0x20,r4	! Skip R7-R0
 
+	bf		2f		! Save the FPU registers if they're used
+	mov		#0,r2
+	lds		r2,fpscr	! If not, just reset FPSCR for the scheduler
+	bra		3f
+	add		#-0x80,r4	! and skip them
+
+2:
+	mov		r4,r5
+	add		#-4,r5
+	mov		#4,r6
+4:
+	movca.l		r0,@r5		! FR/XF blocks  0x80-0x20
+	dt		r6
+	bf/s		4b
+	add		#-0x20,r5
+
 	lds		r2,fpscr	! Reset FPSCR, switch to bank 2, 64-bit I/O
 
 	fmov		dr14,@-r4	! Save FR15/FR14  0x98
@@ -98,6 +121,7 @@ _thd_block_now:
 	fmov		dr0,@-r4	! Save FR1/FR0    0x20
 	fschg				! Restore 32-bit I/O
 
+3:
 	! Save any machine words. We want the swapping-in of this task
 	! to simulate returning from this function, so what we'll do is
 	! put PR as PC. Everything else can stay the same.
@@ -126,7 +150,7 @@ _thd_block_now:
 
 	.align 2
 irqd_and:
-	.long	0xefffff0f
+	.long	0xefff7f0f
 irqd_or:
 	.long	0x000000f0
 
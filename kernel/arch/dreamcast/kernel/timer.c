@@ -7,6 +7,7 @@
 */
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 
 #include <arch/arch.h>
@@ -172,6 +173,34 @@ int timer_ints_enabled(int which) {
     return irq_get_priority(IRQ_SRC_TMU0 - which) > 0;
 }
 
+/* Channels taken with timer_claim() */
+static uint8_t timer_claimed;
+
+int timer_claim(int which) {
+    irq_disable_scoped();
+
+    /* The other two belong to the kernel */
+    if(which != TMU1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(timer_claimed & BIT(which)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    timer_claimed |= BIT(which);
+
+    return 0;
+}
+
+void timer_release(int which) {
+    irq_disable_scoped();
+
+    timer_claimed &= ~BIT(which);
+}
+
 /* Seconds elapsed (since KOS startup), updated from the TMU2 underflow ISR */
 static volatile uint32_t timer_ms_counter = 0;
 /* Max counter value (used as TMU2 reload), to target a 1 second interval */
@@ -327,6 +356,60 @@ void timer_primary_wakeup(uint32_t millis) {
     }
 }
 
+/* High-resolution one-shot timer, on TMU1 while it is claimed. Unlike the
+   primary timer, this one takes the full timer resolution instead of going
+   by milliseconds. It doesn't bother emulating long waits: anything past
+   what the counter can hold (a little under six minutes) fires early, and
+   it's up to the callback to notice. */
+#define THR_NS_MAX  300000000000ULL
+
+static timer_hr_callback_t thr_callback;
+
+static void thr_handler(irq_t src, irq_context_t *cxt, void *data) {
+    (void)src;
+    (void)data;
+
+    timer_stop(TMU1);
+    timer_clear(TMU1);
+
+    if(thr_callback)
+        thr_callback(cxt);
+}
+
+int timer_hr_claim(timer_hr_callback_t callback) {
+    if(timer_claim(TMU1) < 0)
+        return -1;
+
+    thr_callback = callback;
+    irq_set_handler(EXC_TMU1_TUNI1, thr_handler, NULL);
+
+    return 0;
+}
+
+void timer_hr_release(void) {
+    timer_stop(TMU1);
+    timer_clear(TMU1);
+    irq_set_handler(EXC_TMU1_TUNI1, NULL, NULL);
+    thr_callback = NULL;
+    timer_release(TMU1);
+}
+
+void timer_hr_wakeup(uint64_t ns) {
+    uint32_t cd;
+
+    if(ns > THR_NS_MAX)
+        ns = THR_NS_MAX;
+
+    cd = (uint32_t)(ns * (TIMER_PCK / TDIV(TIMER_TPSC)) / 1000000000);
+
+    if(!cd)
+        cd = 1;
+
+    timer_stop(TMU1);
+    timer_prime_apply(TMU1, cd, 1);
+    timer_start(TMU1);
+}
+
 /* Init */
 int timer_init(void) {
     /* Disable all timers */
@@ -0,0 +1,346 @@
+/* KallistiOS ##version##
+
+   trace.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Kernel event tracer. Events go into a ring buffer with interrupts off, so
+   they can be recorded from anywhere, and are turned into Chrome's trace
+   event JSON when written out. */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <arch/irq.h>
+#include <dc/perfctr.h>
+#include <kos/thread.h>
+#include <kos/trace.h>
+
+#define DEFAULT_ENTRIES 16384
+
+/* Tracks in the output that aren't threads. Thread IDs are well below. */
+#define TRACK_IRQ       0x10000
+#define TRACK_PVR_TA    0x10001
+#define TRACK_PVR_REND  0x10002
+#define TRACK_MAPLE     0x10003
+#define TRACK_CDROM     0x10004
+#define TRACK_DMA(ch)   (0x10010 + (ch))
+
+typedef struct trace_rec {
+    uint64_t ns;
+    uint32_t arg;
+    uint16_t tid;
+    uint8_t type;
+    uint8_t pad;
+} trace_rec_t;
+
+_Static_assert(sizeof(trace_rec_t) == 16, "trace_rec_t must be 16 bytes");
+
+volatile int __trace_on;
+
+static trace_rec_t *ring;
+static size_t ring_mask;
+static size_t next;                 /* Total events recorded */
+
+void __trace_record(trace_type_t type, unsigned int tid, uint32_t arg) {
+    const irq_mask_t old = irq_disable();
+    trace_rec_t *r;
+
+    if(__trace_on) {
+        r = &ring[next++ & ring_mask];
+        r->ns = perf_cntr_timer_ns();
+        r->arg = arg;
+        r->tid = tid != __TRACE_TID_CURRENT ? tid :
+                 (thd_current ? (unsigned int)thd_current->tid : 0);
+        r->type = type;
+    }
+
+    irq_restore(old);
+}
+
+int trace_start(size_t entries) {
+#ifndef KOS_TRACE
+    (void)entries;
+
+    errno = ENOSYS;
+    return -1;
+#else
+    trace_rec_t *buf;
+    size_t size = 1;
+
+    if(__trace_on) {
+        errno = EALREADY;
+        return -1;
+    }
+
+    if(!entries)
+        entries = DEFAULT_ENTRIES;
+
+    while(size < entries)
+        size <<= 1;
+
+    buf = malloc(size * sizeof(trace_rec_t));
+
+    if(!buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    free(ring);
+    ring = buf;
+    ring_mask = size - 1;
+    next = 0;
+    __trace_on = 1;
+
+    return 0;
+#endif
+}
+
+void trace_stop(void) {
+    __trace_on = 0;
+}
+
+size_t trace_count(size_t *lost) {
+    const size_t size = ring ? ring_mask + 1 : 0;
+    const size_t n = next < size ? next : size;
+
+    if(lost)
+        *lost = next - n;
+
+    return n;
+}
+
+/* Output state: keeps track of the commas between events */
+typedef struct out {
+    FILE *f;
+    bool first;
+} out_t;
+
+static void __printflike(2, 3) emit(out_t *o, const char *fmt, ...) {
+    va_list ap;
+
+    fputs(o->first ? "\n" : ",\n", o->f);
+    o->first = false;
+
+    va_start(ap, fmt);
+    vfprintf(o->f, fmt, ap);
+    va_end(ap);
+}
+
+static void put_string(FILE *f, const char *s) {
+    fputc('"', f);
+
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\')
+            fputc('\\', f);
+
+        if((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", *s);
+        else
+            fputc(*s, f);
+    }
+
+    fputc('"', f);
+}
+
+static void emit_name(out_t *o, unsigned int track, const char *name) {
+    emit(o, "{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\","
+         "\"args\":{\"name\":", track);
+    put_string(o->f, name);
+    fputs("}}", o->f);
+}
+
+/* Timestamps are in microseconds, relative to the first event */
+#define TS_FMT          "\"ts\":%llu.%03u"
+#define TS_ARG(ns)      (unsigned long long)((ns) / 1000), (unsigned int)((ns) % 1000)
+
+static void emit_span(out_t *o, const char *ph, const char *name,
+                      unsigned int track, uint64_t ns) {
+    emit(o, "{\"ph\":\"%s\",\"pid\":1,\"tid\":%u," TS_FMT ",\"name\":\"%s\"}",
+         ph, track, TS_ARG(ns), name);
+}
+
+/* Name each thread that shows up, once */
+static void emit_threads(out_t *o, size_t first, size_t n) {
+    char label[KTHREAD_LABEL_SIZE + 16];
+    uint16_t seen[64];
+    unsigned int nseen = 0, j, k;
+    const trace_rec_t *r;
+    uint16_t tids[2];
+    kthread_t *thd;
+    size_t i;
+
+    for(i = 0; i < n && nseen < 64; i++) {
+        r = &ring[(first + i) & ring_mask];
+        tids[0] = r->tid;
+        tids[1] = r->type == TRACE_THD_SWITCH ? r->arg : r->tid;
+
+        for(k = 0; k < 2 && nseen < 64; k++) {
+            for(j = 0; j < nseen && seen[j] != tids[k]; j++)
+                ;
+
+            if(j < nseen)
+                continue;
+
+            seen[nseen++] = tids[k];
+            thd = thd_by_tid(tids[k]);
+
+            if(thd && thd->label[0])
+                snprintf(label, sizeof(label), "%s (%u)", thd->label,
+                         (unsigned int)tids[k]);
+            else
+                snprintf(label, sizeof(label), "thread %u",
+                         (unsigned int)tids[k]);
+
+            emit_name(o, tids[k], label);
+        }
+    }
+}
+
+static void emit_rec(out_t *o, const trace_rec_t *r, uint64_t ns) {
+    char name[32];
+
+    switch(r->type) {
+        case TRACE_IRQ_ENTER:
+            snprintf(name, sizeof(name), "irq 0x%03lx", (unsigned long)r->arg);
+            emit_span(o, "B", name, TRACK_IRQ, ns);
+            break;
+        case TRACE_IRQ_EXIT:
+            emit_span(o, "E", "irq", TRACK_IRQ, ns);
+            break;
+        case TRACE_GENWAIT_SLEEP:
+        case TRACE_GENWAIT_WAKE:
+            emit(o, "{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%u," TS_FMT
+                 ",\"name\":\"%s\",\"args\":{\"obj\":\"0x%08lx\"}}",
+                 (unsigned int)r->tid, TS_ARG(ns),
+                 r->type == TRACE_GENWAIT_SLEEP ? "sleep" : "woken",
+                 (unsigned long)r->arg);
+            break;
+        case TRACE_PVR_LIST_BEGIN:
+            snprintf(name, sizeof(name), "list %lu", (unsigned long)r->arg);
+            emit_span(o, "B", name, TRACK_PVR_TA, ns);
+            break;
+        case TRACE_PVR_LIST_FINISH:
+            emit_span(o, "E", "list", TRACK_PVR_TA, ns);
+            break;
+        case TRACE_PVR_RENDER_START:
+            emit_span(o, "B", "render", TRACK_PVR_REND, ns);
+            break;
+        case TRACE_PVR_RENDER_DONE:
+            emit_span(o, "E", "render", TRACK_PVR_REND, ns);
+            break;
+        case TRACE_DMA_START:
+            emit_span(o, "B", "transfer", TRACK_DMA(r->arg & 3), ns);
+            break;
+        case TRACE_DMA_DONE:
+            emit_span(o, "E", "transfer", TRACK_DMA(r->arg & 3), ns);
+            break;
+        case TRACE_MAPLE_START:
+            emit_span(o, "B", "frames", TRACK_MAPLE, ns);
+            break;
+        case TRACE_MAPLE_DONE:
+            emit_span(o, "E", "frames", TRACK_MAPLE, ns);
+            break;
+        case TRACE_CDROM_BEGIN:
+            snprintf(name, sizeof(name), "cmd %lu", (unsigned long)r->arg);
+            emit_span(o, "B", name, TRACK_CDROM, ns);
+            break;
+        case TRACE_CDROM_END:
+            emit_span(o, "E", "cmd", TRACK_CDROM, ns);
+            break;
+        case TRACE_MARK_BEGIN:
+            emit(o, "{\"ph\":\"B\",\"pid\":1,\"tid\":%u," TS_FMT ",\"name\":",
+                 (unsigned int)r->tid, TS_ARG(ns));
+            put_string(o->f, (const char *)(uintptr_t)r->arg);
+            fputc('}', o->f);
+            break;
+        case TRACE_MARK_END:
+            emit_span(o, "E", "mark", r->tid, ns);
+            break;
+        default:
+            break;
+    }
+}
+
+int trace_write(FILE *f) {
+    const int was_on = __trace_on;
+    const trace_rec_t *r;
+    out_t o = { f, true };
+    size_t n, first, i;
+    uint64_t base, run_start = 0;
+    unsigned int running;
+
+    __trace_on = 0;
+
+    n = trace_count(NULL);
+
+    if(!n) {
+        __trace_on = was_on;
+        errno = ENOENT;
+        return -1;
+    }
+
+    first = next - n;
+    base = ring[first & ring_mask].ns;
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+
+    emit_name(&o, TRACK_IRQ, "interrupts");
+    emit_name(&o, TRACK_PVR_TA, "pvr ta");
+    emit_name(&o, TRACK_PVR_REND, "pvr render");
+    emit_name(&o, TRACK_MAPLE, "maple");
+    emit_name(&o, TRACK_CDROM, "cdrom");
+
+    for(i = 0; i < 4; i++) {
+        char name[8];
+
+        snprintf(name, sizeof(name), "dma %u", (unsigned int)i);
+        emit_name(&o, TRACK_DMA(i), name);
+    }
+
+    emit_threads(&o, first, n);
+
+    /* Each thread gets a "running" span from one switch to the next */
+    running = ring[first & ring_mask].tid;
+
+    for(i = 0; i < n; i++) {
+        r = &ring[(first + i) & ring_mask];
+
+        if(r->type == TRACE_THD_SWITCH) {
+            emit(&o, "{\"ph\":\"X\",\"pid\":1,\"tid\":%u," TS_FMT
+                 ",\"dur\":%llu.%03u,\"name\":\"running\"}", running,
+                 TS_ARG(run_start), TS_ARG(r->ns - base - run_start));
+            running = r->arg;
+            run_start = r->ns - base;
+        }
+        else {
+            emit_rec(&o, r, r->ns - base);
+        }
+    }
+
+    r = &ring[(next - 1) & ring_mask];
+    emit(&o, "{\"ph\":\"X\",\"pid\":1,\"tid\":%u," TS_FMT
+         ",\"dur\":%llu.%03u,\"name\":\"running\"}", running,
+         TS_ARG(run_start), TS_ARG(r->ns - base - run_start));
+
+    fputs("\n]}\n", f);
+
+    __trace_on = was_on;
+
+    return 0;
+}
+
+int trace_dump(const char *path) {
+    FILE *f = fopen(path, "w");
+    int rv;
+
+    if(!f)
+        return -1;
+
+    rv = trace_write(f);
+    fclose(f);
+
+    return rv;
+}
@@ -0,0 +1,167 @@
+/* KallistiOS ##version##
+
+   cull.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Frustum culling. The planes come from the rows of the matrix, as that's
+   what XMTRX takes dot products with: a point is right of the left edge of
+   the screen when X - x0 * W >= 0, which is (row X - x0 * row W) . p >= 0,
+   and so on. Planes are normalized, so that their dot products with a
+   sphere's center are distances to compare with its radius. */
+
+#include <math.h>
+#include <stdalign.h>
+#include <dc/cull.h>
+#include <dc/fmath.h>
+#include <dc/matrix.h>
+
+/* Row i of a matrix, as ftrv sees it */
+static inline void mat_row(const matrix_t m, int i, float r[4]) {
+    int j;
+
+    for(j = 0; j < 4; j++)
+        r[j] = m[j][i];
+}
+
+/* p = a + s * b, normalized by the length of its normal */
+static void plane(float p[4], const float a[4], float s, const float b[4]) {
+    float len;
+    int j;
+
+    for(j = 0; j < 4; j++)
+        p[j] = a[j] + s * b[j];
+
+    len = fipr_magnitude_sqr(p[0], p[1], p[2], 0.0f);
+
+    if(len > 0.0f) {
+        len = 1.0f / sqrtf(len);
+
+        for(j = 0; j < 4; j++)
+            p[j] *= len;
+    }
+}
+
+void cull_frustum_init(cull_frustum_t *f, float x0, float y0, float x1,
+                       float y1, float near_w) {
+    static const float unit_w[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    alignas(32) matrix_t m;
+    float rx[4], ry[4], rw[4], p[4][4], nx[4];
+    int i, j;
+
+    mat_store(&m);
+    mat_row(m, 0, rx);
+    mat_row(m, 1, ry);
+    mat_row(m, 3, rw);
+
+    plane(p[0], rx, -x0, rw);
+
+    for(j = 0; j < 4; j++)
+        nx[j] = -rx[j];
+
+    plane(p[1], nx, x1, rw);
+    plane(p[2], ry, -y0, rw);
+
+    for(j = 0; j < 4; j++)
+        nx[j] = -ry[j];
+
+    plane(p[3], nx, y1, rw);
+    plane(f->near, rw, -near_w, unit_w);
+
+    for(i = 0; i < 4; i++) {
+        for(j = 0; j < 4; j++) {
+            f->sides[j][i] = p[i][j];
+            f->abs_sides[i][j] = j < 3 ? fabsf(p[i][j]) : 0.0f;
+        }
+
+        f->abs_near[i] = i < 3 ? fabsf(f->near[i]) : 0.0f;
+    }
+}
+
+/* Classify a volume from its distances to the planes and its radius along
+   each of them */
+static inline uint8_t classify(const float d[5], const float r[5]) {
+    uint8_t rv = CULL_INSIDE;
+    int i;
+
+    for(i = 0; i < 5; i++) {
+        if(d[i] < -r[i])
+            return CULL_OUTSIDE;
+
+        if(d[i] < r[i])
+            rv = CULL_INTERSECT;
+    }
+
+    return rv;
+}
+
+/* Distances from a point to the planes. The sides must be in XMTRX. */
+static inline void distances(const cull_frustum_t *f, float x, float y,
+                             float z, float d[5]) {
+    float dx = x, dy = y, dz = z, dw = 1.0f;
+
+    d[4] = fipr(x, y, z, 1.0f, f->near[0], f->near[1], f->near[2],
+                f->near[3]);
+
+    mat_trans_nodiv(dx, dy, dz, dw);
+    d[0] = dx;
+    d[1] = dy;
+    d[2] = dz;
+    d[3] = dw;
+}
+
+size_t cull_spheres(const cull_frustum_t *f, const cull_sphere_t *s,
+                    size_t count, uint8_t *out) {
+    alignas(32) matrix_t saved;
+    float d[5], r[5];
+    size_t i, visible = 0;
+
+    mat_store(&saved);
+    mat_load(&f->sides);
+
+    for(i = 0; i < count; i++) {
+        distances(f, s[i].x, s[i].y, s[i].z, d);
+        r[0] = r[1] = r[2] = r[3] = r[4] = s[i].r;
+
+        out[i] = classify(d, r);
+        visible += out[i] != CULL_OUTSIDE;
+    }
+
+    mat_load(&saved);
+
+    return visible;
+}
+
+size_t cull_aabbs(const cull_frustum_t *f, const cull_aabb_t *b, size_t count,
+                  uint8_t *out) {
+    alignas(32) matrix_t saved;
+    float d[5], r[5], ex, ey, ez;
+    size_t i, visible = 0;
+    int j;
+
+    mat_store(&saved);
+    mat_load(&f->sides);
+
+    for(i = 0; i < count; i++) {
+        ex = (b[i].max.x - b[i].min.x) * 0.5f;
+        ey = (b[i].max.y - b[i].min.y) * 0.5f;
+        ez = (b[i].max.z - b[i].min.z) * 0.5f;
+
+        distances(f, b[i].min.x + ex, b[i].min.y + ey, b[i].min.z + ez, d);
+
+        /* How far the box reaches along each normal */
+        for(j = 0; j < 4; j++)
+            r[j] = fipr(ex, ey, ez, 0.0f, f->abs_sides[j][0],
+                        f->abs_sides[j][1], f->abs_sides[j][2], 0.0f);
+
+        r[4] = fipr(ex, ey, ez, 0.0f, f->abs_near[0], f->abs_near[1],
+                    f->abs_near[2], 0.0f);
+
+        out[i] = classify(d, r);
+        visible += out[i] != CULL_OUTSIDE;
+    }
+
+    mat_load(&saved);
+
+    return visible;
+}
@@ -0,0 +1,78 @@
+/* KallistiOS ##version##
+
+   skin.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Linear blend skinning. Rather than blending the bone matrices for each
+   vertex and loading the result, each vertex goes through ftrv once per bone
+   and the results are blended, which is fewer operations for up to four
+   bones and will often not need a new matrix loaded at all. */
+
+#include <stdalign.h>
+#include <dc/matrix.h>
+#include <dc/skin.h>
+
+void skin_transform(const matrix_t *bones, const skin_influence_t *inf,
+                    const vec3f_t *pos, const vec3f_t *nrm, vec3f_t *out_pos,
+                    vec3f_t *out_nrm, size_t count) {
+    alignas(32) matrix_t saved;
+    float px, py, pz, pw, nx, ny, nz, wt;
+    float ax, ay, az, bx, by, bz;
+    int loaded = -1, bone;
+    size_t i;
+    int j;
+
+    mat_store(&saved);
+
+    for(i = 0; i < count; i++) {
+        __builtin_prefetch(&inf[i + 1]);
+        __builtin_prefetch(&pos[i + 1]);
+
+        ax = ay = az = 0.0f;
+        bx = by = bz = 0.0f;
+
+        for(j = 0; j < SKIN_MAX_BONES; j++) {
+            if((wt = inf[i].weight[j]) == 0.0f)
+                break;
+
+            if((bone = inf[i].bone[j]) != loaded) {
+                mat_load(&bones[bone]);
+                loaded = bone;
+            }
+
+            px = pos[i].x;
+            py = pos[i].y;
+            pz = pos[i].z;
+            pw = 1.0f;
+            mat_trans_nodiv(px, py, pz, pw);
+
+            ax += px * wt;
+            ay += py * wt;
+            az += pz * wt;
+
+            if(nrm) {
+                nx = nrm[i].x;
+                ny = nrm[i].y;
+                nz = nrm[i].z;
+                mat_trans_normal3(nx, ny, nz);
+
+                bx += nx * wt;
+                by += ny * wt;
+                bz += nz * wt;
+            }
+        }
+
+        out_pos[i].x = ax;
+        out_pos[i].y = ay;
+        out_pos[i].z = az;
+
+        if(nrm) {
+            out_nrm[i].x = bx;
+            out_nrm[i].y = by;
+            out_nrm[i].z = bz;
+        }
+    }
+
+    mat_load(&saved);
+}
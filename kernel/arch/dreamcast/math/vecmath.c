@@ -0,0 +1,166 @@
+/* KallistiOS ##version##
+
+   vecmath.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Batched vector math. Each loop loads the next element before it works on
+   the current one, so that the loads overlap the fipr/ftrv latency instead of
+   waiting on it, and prefetches the cache line after the one being read. */
+
+#include <dc/fmath.h>
+#include <dc/matrix.h>
+#include <dc/vecmath.h>
+
+/* Prefetch the line 32 bytes past p */
+#define prefetch_next(p)    __builtin_prefetch((const char *)(p) + 32)
+
+void vec_normalize_batch(vec3f_t *v, size_t count) {
+    float x, y, z, nx, ny, nz, len;
+    size_t i;
+
+    if(!count)
+        return;
+
+    nx = v[0].x;
+    ny = v[0].y;
+    nz = v[0].z;
+
+    for(i = 0; i < count; i++) {
+        x = nx;
+        y = ny;
+        z = nz;
+
+        len = fipr_magnitude_sqr(x, y, z, 0.0f);
+
+        if(i + 1 < count) {
+            prefetch_next(&v[i + 1]);
+            nx = v[i + 1].x;
+            ny = v[i + 1].y;
+            nz = v[i + 1].z;
+        }
+
+        if(len > 0.0f) {
+            len = frsqrt(len);
+            v[i].x = x * len;
+            v[i].y = y * len;
+            v[i].z = z * len;
+        }
+    }
+}
+
+void vec_dot_batch(const vec3f_t *a, const vec3f_t *b, float *out,
+                   size_t count) {
+    size_t i;
+
+    for(i = 0; i < count; i++) {
+        prefetch_next(&a[i]);
+        prefetch_next(&b[i]);
+        out[i] = fipr(a[i].x, a[i].y, a[i].z, 0.0f,
+                      b[i].x, b[i].y, b[i].z, 0.0f);
+    }
+}
+
+void vec_cross_batch(const vec3f_t *a, const vec3f_t *b, vec3f_t *out,
+                     size_t count) {
+    float ax, ay, az, bx, by, bz;
+    size_t i;
+
+    for(i = 0; i < count; i++) {
+        prefetch_next(&a[i]);
+        prefetch_next(&b[i]);
+
+        /* Read both before writing, in case out is a or b */
+        ax = a[i].x;
+        ay = a[i].y;
+        az = a[i].z;
+        bx = b[i].x;
+        by = b[i].y;
+        bz = b[i].z;
+
+        out[i].x = ay * bz - az * by;
+        out[i].y = az * bx - ax * bz;
+        out[i].z = ax * by - ay * bx;
+    }
+}
+
+/* Divide a transformed point by its W, which must be positive. 1/W comes
+   from fsrra(W * W), which is far quicker than an fdiv and needs just one
+   for all three. */
+static inline void project(float x, float y, float w, float *ox, float *oy,
+                           float *oz) {
+    const float inv = frsqrt(w * w);
+
+    *ox = x * inv;
+    *oy = y * inv;
+    *oz = inv;
+}
+
+void vec_transform_project(const vec3f_t *in, vec3f_t *out, size_t count) {
+    float x, y, z, w;
+    size_t i;
+
+    for(i = 0; i < count; i++) {
+        prefetch_next(&in[i]);
+
+        x = in[i].x;
+        y = in[i].y;
+        z = in[i].z;
+        w = 1.0f;
+
+        mat_trans_nodiv(x, y, z, w);
+        project(x, y, w, &out[i].x, &out[i].y, &out[i].z);
+    }
+}
+
+void vec_transform_project_soa(const float *x, const float *y, const float *z,
+                               float *ox, float *oy, float *oz, size_t count) {
+    float tx, ty, tz, tw;
+    size_t i;
+
+    for(i = 0; i < count; i++) {
+        /* Each line holds 8 of them */
+        if(!(i & 7)) {
+            prefetch_next(&x[i]);
+            prefetch_next(&y[i]);
+            prefetch_next(&z[i]);
+        }
+
+        tx = x[i];
+        ty = y[i];
+        tz = z[i];
+        tw = 1.0f;
+
+        mat_trans_nodiv(tx, ty, tz, tw);
+        project(tx, ty, tw, &ox[i], &oy[i], &oz[i]);
+    }
+}
+
+void vec_quat_to_matrix(const quatf_t *q, matrix_t *out) {
+    const float x2 = q->x + q->x, y2 = q->y + q->y, z2 = q->z + q->z;
+    const float xx = q->x * x2, yy = q->y * y2, zz = q->z * z2;
+    const float xy = q->x * y2, xz = q->x * z2, yz = q->y * z2;
+    const float wx = q->w * x2, wy = q->w * y2, wz = q->w * z2;
+    float (*m)[4] = *out;
+
+    /* m[column][row], the way ftrv reads it */
+    m[0][0] = 1.0f - (yy + zz);
+    m[0][1] = xy + wz;
+    m[0][2] = xz - wy;
+    m[0][3] = 0.0f;
+
+    m[1][0] = xy - wz;
+    m[1][1] = 1.0f - (xx + zz);
+    m[1][2] = yz + wx;
+    m[1][3] = 0.0f;
+
+    m[2][0] = xz + wy;
+    m[2][1] = yz - wx;
+    m[2][2] = 1.0f - (xx + yy);
+    m[2][3] = 0.0f;
+
+    m[3][0] = 0.0f;
+    m[3][1] = 0.0f;
+    m[3][2] = 0.0f;
+    m[3][3] = 1.0f;
+}
@@ -14,6 +14,10 @@
 #define CHNREG8A(chn, x) SNDREG8A(0x80*(chn) + (x))
 #define CHNREG8(chn, x) (*CHNREG8A(chn, x))
 
+/* Main CPU interrupt pending; setting SCPU interrupts the SH-4. */
+#define AICA_MCIPD      0x28b8
+#define AICA_MCI_SCPU   0x20
+
 void aica_init(void);
 void aica_play(int ch, int delay);
 void aica_sync_play(uint32 chmap);
@@ -31,7 +31,19 @@
 /* The clock value (in milliseconds) */
 #define AICA_MEM_CLOCK      0x021000    /* 4 bytes */
 
-/* 0x021004 - 0x030000 are reserved for future expansion */
+/* The timer ticks since the driver started, which unlike the clock above
+   are never reset. Each is AICA_TICK_SAMPLES samples at 44.1kHz. */
+#define AICA_MEM_TICKS      0x021004    /* 4 bytes */
+#define AICA_TICK_SAMPLES   10
+
+/* What the driver can do, as AICA_CAP_* bits. Drivers from before this was
+   added leave the zeroes snd_init() cleared it to. */
+#define AICA_MEM_CAPS       0x021008    /* 4 bytes */
+
+/* Mixer status; this is READ-ONLY from the SH-4 side. */
+#define AICA_MEM_MIXER      0x021100    /* 72 bytes */
+
+/* 0x02100c - 0x030000 are otherwise reserved for future expansion */
 
 /* Open ram for sample data */
 #define AICA_RAM_START      0x030000
@@ -44,4 +56,20 @@
 #define AICA_CHANNEL_KEYONEX   0x8000
 #define AICA_CHANNEL_KEYONB    0x4000
 
+/* The 44.1kHz sample clock, from the ticks and the count in timer A, which
+   is reloaded to overflow after each tick. Just past an overflow, the tick
+   may not have been counted yet. */
+#define AICA_TIMA           0x2890
+
+static inline uint32 aica_sample_clock(uint32 ticks, uint32 tima) {
+    tima &= 0xff;
+
+    if(tima >= 256 - AICA_TICK_SAMPLES)
+        tima -= 256 - AICA_TICK_SAMPLES;
+    else
+        tima = AICA_TICK_SAMPLES - 1;
+
+    return ticks * AICA_TICK_SAMPLES + tima;
+}
+
 #endif  /* __ARM_AICA_CMD_IFACE_H */
@@ -66,6 +66,11 @@ fiq_timer:
 	ldr	r9,[r8]
 	add	r9,r9,#1
 	str	r9,[r8]
+
+	# And AICA_MEM_TICKS, which is never reset
+	ldr	r9,[r8,#4]
+	add	r9,r9,#1
+	str	r9,[r8,#4]
 	
 	# Request a new timer interrupt. We'll calculate the number
 	# put in here based on the "jps" (jiffies per second).
@@ -12,10 +12,25 @@
 
 #include "aica_cmd_iface.h"
 #include "aica.h"
+#include "mixer.h"
 
 /****************** Timer *******************************************/
 
 #define timer (*((volatile uint32 *)AICA_MEM_CLOCK))
+#define ticks (*((volatile uint32 *)AICA_MEM_TICKS))
+#define caps (*((volatile uint32 *)AICA_MEM_CAPS))
+
+/* The sample clock, read again if a tick went by while reading it */
+static uint32 clock_now(void) {
+    uint32 t, c;
+
+    do {
+        t = ticks;
+        c = SNDREG32(AICA_TIMA);
+    } while(t != ticks);
+
+    return aica_sample_clock(t, c);
+}
 
 void timer_wait(uint32 jiffies) {
     uint32 fin = timer + jiffies;
@@ -65,25 +80,163 @@ volatile aica_queue_t   *q_cmd = (volatile aica_queue_t *)AICA_MEM_CMD_QUEUE;
 volatile aica_queue_t   *q_resp = (volatile aica_queue_t *)AICA_MEM_RESP_QUEUE;
 volatile aica_channel_t *chans = (volatile aica_channel_t *)AICA_MEM_CHANNELS;
 
+/* For channels the SH-4 wants to hear about, one more than the quarter of
+   the loop they were last seen in */
+static unsigned char notify[64];
+
+/* Sync starts waiting for their time, and how close it has to be, in
+   samples, for the main loop to spin until then rather than go round once
+   more */
+#define SCHED_MAX   8
+#define SCHED_SPIN  160
+
+static struct {
+    uint32 map;
+    uint32 at;
+} sched[SCHED_MAX];
+
+/* Post a response packet for the SH-4, and interrupt it. Packets that
+   don't fit are dropped, as there's nothing better to do here. */
+void post_resp(uint32 cmd, uint32 id, uint32 arg) {
+    uint32 pkt[sizeof(aica_cmd_t) / 4], head, tail, used, i;
+    aica_cmd_t *p = (aica_cmd_t *)pkt;
+
+    for(i = 0; i < sizeof(pkt) / 4; i++)
+        pkt[i] = 0;
+
+    p->size = sizeof(pkt) / 4;
+    p->cmd = cmd;
+    p->timestamp = timer;
+    p->cmd_id = id;
+    p->misc[0] = arg;
+
+    head = q_resp->head;
+    tail = q_resp->tail;
+    used = head >= tail ? head - tail : head + q_resp->size - tail;
+
+    if(used + sizeof(pkt) >= q_resp->size)
+        return;
+
+    for(i = 0; i < sizeof(pkt) / 4; i++) {
+        *((volatile uint32 *)(q_resp->data + head)) = pkt[i];
+        head += 4;
+
+        if(head >= q_resp->size)
+            head = 0;
+    }
+
+    q_resp->head = head;
+    SNDREG32(AICA_MCIPD) = AICA_MCI_SCPU;
+}
+
+/* Tell the SH-4 when a channel moves into another quarter of its loop */
+static void check_notify(int ch, uint32 pos) {
+    uint32 q = chans[ch].loopend >> 2, part;
+
+    if(pos >= q * 3)
+        part = 3;
+    else if(pos >= q * 2)
+        part = 2;
+    else if(pos >= q)
+        part = 1;
+    else
+        part = 0;
+
+    if(part + 1 != notify[ch]) {
+        notify[ch] = part + 1;
+        post_resp(AICA_RESP_CHAN_POS, ch, pos);
+    }
+}
+
+/* The clock for a key-on now. 0 means not keyed on, so that one sample of
+   the clock is skipped. */
+static uint32 keyon_now(void) {
+    uint32 now = clock_now();
+
+    return now ? now : 1;
+}
+
+/* Key on the channels in the map together, noting when */
+static void start_sync(uint32 map) {
+    uint32 now, i;
+
+    now = keyon_now();
+    aica_sync_play(map);
+
+    for(i = 0; map; i++, map >>= 1) {
+        if(map & 1)
+            chans[i].keyon = now;
+    }
+}
+
+static void sched_add(uint32 map, uint32 at) {
+    int i;
+
+    if((long)(at - clock_now()) > 0) {
+        for(i = 0; i < SCHED_MAX; i++) {
+            if(!sched[i].map) {
+                sched[i].map = map;
+                sched[i].at = at;
+                return;
+            }
+        }
+    }
+
+    /* Due already, or no room to wait */
+    start_sync(map);
+}
+
+static void sched_check(void) {
+    int i;
+
+    for(i = 0; i < SCHED_MAX; i++) {
+        if(!sched[i].map || (long)(sched[i].at - clock_now()) > SCHED_SPIN)
+            continue;
+
+        while((long)(sched[i].at - clock_now()) > 0)
+            ;
+
+        start_sync(sched[i].map);
+        sched[i].map = 0;
+    }
+}
+
 /* Process a CHAN command */
 void process_chn(uint32 chn, aica_channel_t *chndat) {
+    int i;
+
     switch(chndat->cmd & AICA_CH_CMD_MASK) {
         case AICA_CH_CMD_NONE:
             break;
         case AICA_CH_CMD_START:
 
             if(chndat->cmd & AICA_CH_START_SYNC) {
-                aica_sync_play(chn);
+                if(chndat->cmd & AICA_CH_START_AT)
+                    sched_add(chn, chndat->keyon);
+                else
+                    start_sync(chn);
             }
             else {
                 memcpy((void*)(chans + chn), chndat, sizeof(aica_channel_t));
                 chans[chn].pos = 0;
+                chans[chn].keyon = 0;
+                notify[chn] = (chndat->cmd & AICA_CH_START_NOTIFY) ? 1 : 0;
+
                 aica_play(chn, chndat->cmd & AICA_CH_START_DELAY);
+
+                if(!(chndat->cmd & AICA_CH_START_DELAY))
+                    chans[chn].keyon = keyon_now();
             }
 
             break;
         case AICA_CH_CMD_STOP:
             aica_stop(chn);
+            notify[chn] = 0;
+            chans[chn].keyon = 0;
+
+            for(i = 0; i < SCHED_MAX && chn < 32; i++)
+                sched[i].map &= ~(1 << chn);
+
             break;
         case AICA_CH_CMD_UPDATE:
 
@@ -147,6 +300,15 @@ uint32 process_one(uint32 tail) {
             /* Reset our timer clock to zero */
             timer = 0;
             break;
+        case AICA_CMD_MIX_START:
+            mix_start((aica_mixer_t *)pkt->cmd_data);
+            break;
+        case AICA_CMD_MIX_STOP:
+            mix_stop();
+            break;
+        case AICA_CMD_MIX_SRC:
+            mix_src(pkt->cmd_id, (aica_channel_t *)pkt->cmd_data);
+            break;
         default:
             /* error */
             break;
@@ -210,16 +372,29 @@ int arm_main(void) {
     /* Initialize the AICA part of the SPU */
     aica_init();
 
+    /* Tell the SH-4 what we can do */
+    caps = AICA_CAP_MIXER | AICA_CAP_CHAN_POS | AICA_CAP_SAMPLE_CLOCK;
+
     /* Wait for a command */
     for(; ;) {
         /* Update channel position counters */
-        for(i = 0; i < 64; i++)
+        for(i = 0; i < 64; i++) {
             aica_get_pos(i);
 
+            if(notify[i])
+                check_notify(i, chans[i].pos);
+        }
+
         /* Check for a command */
         if(q_cmd->process_ok)
             process_cmd_queue();
 
+        /* Start anything due before we're next round */
+        sched_check();
+
+        /* Keep the mixer's output ahead of the channels playing it */
+        mix_update();
+
         /* Little delay to prevent memory lock */
         timer_wait(10);
     }
@@ -0,0 +1,355 @@
+/* KallistiOS ##version##
+
+   mixer.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   Software mixer
+
+   Sources are resampled, scaled and summed into two rings of 16-bit samples,
+   which two channels loop over. Each pass of the main loop fills the rings
+   up to just behind where the left channel is playing, so what's written
+   there is heard one turn of the rings later.
+*/
+
+#include "aica_cmd_iface.h"
+#include "aica.h"
+#include "mixer.h"
+
+/* Samples mixed at a time */
+#define MIX_BLOCK   64
+
+/* Samples kept clear of the play position */
+#define MIX_GUARD   32
+
+/* No next sample */
+#define MIX_END     0xffffffff
+
+typedef struct {
+    int         active;
+    uint32      base, type, length, loop, loopstart, loopend;
+    uint32      step;       /* Source samples per output sample, in 16.16 */
+    uint32      frac;
+    uint32      pos, next;  /* Where s0 and s1 are from */
+    int         s0, s1;
+    int         freq, vol, pan, lvol, rvol;
+
+    /* ADPCM decoder, and the state it had at the loop start */
+    uint32      dec_pos;
+    int         sig, stp, loop_sig, loop_stp;
+} mix_src_t;
+
+extern volatile aica_channel_t *chans;
+
+static volatile aica_mix_status_t *status =
+    (volatile aica_mix_status_t *)AICA_MEM_MIXER;
+
+static struct {
+    int         running;
+    uint32      lchn, rchn;
+    short       *left, *right;
+    uint32      size, freq, vol;
+    uint32      wpos;
+} mix;
+
+static mix_src_t srcs[AICA_MIX_MAX_SOURCES];
+
+/* Yamaha ADPCM, as the channels play it */
+static const int adpcm_diff[8] = { 1, 3, 5, 7, 9, 11, 13, 15 };
+static const int adpcm_scale[8] = {
+    0x0e6, 0x0e6, 0x0e6, 0x0e6, 0x133, 0x199, 0x200, 0x266
+};
+
+static int adpcm_fetch(mix_src_t *s, uint32 idx) {
+    const unsigned char *p = (const unsigned char *)s->base;
+    int n, d;
+
+    /* Samples are decoded in order, so going anywhere else is looping. */
+    if(idx != s->dec_pos) {
+        s->sig = s->loop_sig;
+        s->stp = s->loop_stp;
+        s->dec_pos = idx;
+    }
+
+    if(idx == s->loopstart) {
+        s->loop_sig = s->sig;
+        s->loop_stp = s->stp;
+    }
+
+    n = (p[idx >> 1] >> ((idx & 1) << 2)) & 15;
+    d = (s->stp * adpcm_diff[n & 7]) >> 3;
+    s->sig += (n & 8) ? -d : d;
+
+    if(s->sig > 32767)
+        s->sig = 32767;
+    else if(s->sig < -32768)
+        s->sig = -32768;
+
+    s->stp = (s->stp * adpcm_scale[n & 7]) >> 8;
+
+    if(s->stp < 0x7f)
+        s->stp = 0x7f;
+    else if(s->stp > 0x6000)
+        s->stp = 0x6000;
+
+    s->dec_pos++;
+
+    return s->sig;
+}
+
+static int src_fetch(mix_src_t *s, uint32 idx) {
+    if(idx == MIX_END)
+        return 0;
+
+    switch(s->type) {
+        case AICA_SM_16BIT:
+            return ((const short *)s->base)[idx];
+        case AICA_SM_8BIT:
+            return ((const signed char *)s->base)[idx] << 8;
+        default:
+            return adpcm_fetch(s, idx);
+    }
+}
+
+static uint32 src_next(mix_src_t *s, uint32 idx) {
+    uint32 end = s->loop ? s->loopend : s->length;
+
+    if(++idx < end)
+        return idx;
+
+    return s->loop ? s->loopstart : MIX_END;
+}
+
+static void src_step(mix_src_t *s) {
+    /* Kept short of 32 bits for frequencies up to a few hundred kHz */
+    s->step = (((uint32)s->freq << 10) / mix.freq) << 6;
+}
+
+static void src_gains(mix_src_t *s) {
+    int l = (s->vol * (256 - s->pan)) >> 8;
+    int r = (s->vol * (s->pan + 1)) >> 8;
+
+    s->lvol = (l * (int)mix.vol) >> 8;
+    s->rvol = (r * (int)mix.vol) >> 8;
+}
+
+void mix_src(uint32 n, aica_channel_t *dat) {
+    mix_src_t *s;
+
+    if(n >= AICA_MIX_MAX_SOURCES)
+        return;
+
+    s = srcs + n;
+
+    switch(dat->cmd & AICA_CH_CMD_MASK) {
+        case AICA_CH_CMD_START:
+            s->active = 0;
+            s->base = dat->base;
+            s->type = dat->type;
+            s->length = dat->length;
+            s->loop = dat->loop;
+            s->loopstart = dat->loopstart;
+            s->loopend = dat->loopend;
+            s->freq = dat->freq;
+            s->vol = dat->vol;
+            s->pan = dat->pan;
+
+            if(!s->length || !mix.running)
+                break;
+
+            if(s->loop && (s->loopend > s->length ||
+                           s->loopstart >= s->loopend))
+                s->loop = 0;
+
+            s->dec_pos = 0;
+            s->sig = s->loop_sig = 0;
+            s->stp = s->loop_stp = 0x7f;
+
+            s->frac = 0;
+            s->pos = 0;
+            s->s0 = src_fetch(s, 0);
+            s->next = src_next(s, 0);
+            s->s1 = src_fetch(s, s->next);
+
+            src_step(s);
+            src_gains(s);
+            s->active = 1;
+            break;
+        case AICA_CH_CMD_STOP:
+            s->active = 0;
+            break;
+        case AICA_CH_CMD_UPDATE:
+
+            if(dat->cmd & AICA_CH_UPDATE_SET_FREQ) {
+                s->freq = dat->freq;
+                src_step(s);
+            }
+
+            if(dat->cmd & AICA_CH_UPDATE_SET_VOL)
+                s->vol = dat->vol;
+
+            if(dat->cmd & AICA_CH_UPDATE_SET_PAN)
+                s->pan = dat->pan;
+
+            src_gains(s);
+            break;
+        default:
+            break;
+    }
+}
+
+/* Add n samples of a source in. Linear interpolation is as far as the
+   ARM's cycles go with several sources playing. */
+static void src_mix(mix_src_t *s, int *l, int *r, int n) {
+    int i, smp;
+
+    for(i = 0; i < n; i++) {
+        smp = s->s0 + (((s->s1 - s->s0) * (int)(s->frac >> 1)) >> 15);
+        l[i] += smp * s->lvol;
+        r[i] += smp * s->rvol;
+
+        s->frac += s->step;
+
+        while(s->frac >= 0x10000) {
+            s->frac -= 0x10000;
+
+            if(s->next == MIX_END) {
+                s->active = 0;
+                return;
+            }
+
+            s->pos = s->next;
+            s->s0 = s->s1;
+            s->next = src_next(s, s->pos);
+            s->s1 = src_fetch(s, s->next);
+        }
+    }
+}
+
+static inline short clamp16(int v) {
+    v >>= 8;
+
+    if(v > 32767)
+        return 32767;
+    else if(v < -32768)
+        return -32768;
+
+    return v;
+}
+
+void mix_update(void) {
+    int l[MIX_BLOCK], r[MIX_BLOCK];
+    uint32 play, avail, n, i, playing = 0;
+
+    if(!mix.running)
+        return;
+
+    /* Fill up to just behind the channels. */
+    play = chans[mix.lchn].pos;
+    avail = (play + mix.size - mix.wpos) % mix.size;
+
+    if(avail > MIX_GUARD) {
+        avail -= MIX_GUARD;
+
+        while(avail) {
+            n = avail < MIX_BLOCK ? avail : MIX_BLOCK;
+
+            if(n > mix.size - mix.wpos)
+                n = mix.size - mix.wpos;
+
+            for(i = 0; i < n; i++)
+                l[i] = r[i] = 0;
+
+            for(i = 0; i < AICA_MIX_MAX_SOURCES; i++) {
+                if(srcs[i].active)
+                    src_mix(srcs + i, l, r, n);
+            }
+
+            for(i = 0; i < n; i++) {
+                mix.left[mix.wpos + i] = clamp16(l[i]);
+                mix.right[mix.wpos + i] = clamp16(r[i]);
+            }
+
+            mix.wpos += n;
+
+            if(mix.wpos >= mix.size)
+                mix.wpos = 0;
+
+            avail -= n;
+        }
+    }
+
+    for(i = 0; i < AICA_MIX_MAX_SOURCES; i++) {
+        if(srcs[i].active)
+            playing |= 1 << i;
+
+        status->pos[i] = srcs[i].pos;
+    }
+
+    status->playing = playing;
+}
+
+static void mix_chn(uint32 chn, uint32 base, uint32 pan, int delay) {
+    chans[chn].cmd = AICA_CH_CMD_START;
+    chans[chn].base = base;
+    chans[chn].type = AICA_SM_16BIT;
+    chans[chn].length = mix.size;
+    chans[chn].loop = 1;
+    chans[chn].loopstart = 0;
+    chans[chn].loopend = mix.size;
+    chans[chn].freq = mix.freq;
+    chans[chn].vol = 255;
+    chans[chn].pan = pan;
+    chans[chn].pos = 0;
+    aica_play(chn, delay);
+}
+
+void mix_start(aica_mixer_t *cfg) {
+    uint32 i;
+    int delay;
+
+    if(mix.running)
+        mix_stop();
+
+    if(!cfg->size || cfg->size > 0xffff || !cfg->freq ||
+       cfg->left_chn > 63 || cfg->right_chn > 63)
+        return;
+
+    mix.lchn = cfg->left_chn;
+    mix.rchn = cfg->right_chn;
+    mix.left = (short *)cfg->left;
+    mix.right = (short *)cfg->right;
+    mix.size = cfg->size;
+    mix.freq = cfg->freq;
+    mix.vol = cfg->vol;
+    mix.wpos = 0;
+
+    for(i = 0; i < mix.size; i++)
+        mix.left[i] = mix.right[i] = 0;
+
+    for(i = 0; i < AICA_MIX_MAX_SOURCES; i++)
+        srcs[i].active = 0;
+
+    /* Key both on at once where the channel map reaches them. */
+    delay = mix.lchn < 32 && mix.rchn < 32;
+    mix_chn(mix.lchn, cfg->left, 0, delay);
+    mix_chn(mix.rchn, cfg->right, 255, delay);
+
+    if(delay)
+        aica_sync_play((1 << mix.lchn) | (1 << mix.rchn));
+
+    mix.running = 1;
+    status->playing = 0;
+    status->running = 1;
+}
+
+void mix_stop(void) {
+    if(!mix.running)
+        return;
+
+    aica_stop(mix.lchn);
+    aica_stop(mix.rchn);
+
+    mix.running = 0;
+    status->playing = 0;
+    status->running = 0;
+}
@@ -0,0 +1,9 @@
+#ifndef __MIXER_H
+#define __MIXER_H
+
+void mix_start(aica_mixer_t *cfg);
+void mix_stop(void);
+void mix_src(uint32 src, aica_channel_t *dat);
+void mix_update(void);
+
+#endif  /* __MIXER_H */
@@ -0,0 +1,112 @@
+/* KallistiOS ##version##
+
+   snd_adpcm.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   PCM to Yamaha ADPCM encoder. This is the same algorithm utils/wav2adpcm
+   uses (after superctr's public domain YMZ280B codec), without its
+   division: the code for each sample is how many step sizes fit into four
+   times the difference to the last sample, which is found by comparing
+   against four, two and one step sizes in turn.
+*/
+
+#include <dc/sound/adpcm.h>
+
+#define ADPCM_STEP_MIN  127
+#define ADPCM_STEP_MAX  24576
+
+/* Step size scale for each code, in 1/256 */
+static const int16_t step_scale[8] = {
+    230, 230, 230, 230, 307, 409, 512, 614
+};
+
+void snd_adpcm_init(snd_adpcm_state_t *st) {
+    st->history = 0;
+    st->step = ADPCM_STEP_MIN;
+}
+
+/* Encode a sample, and update the state as the AICA will when decoding */
+static inline unsigned int encode_one(int *hist, int *step, int smp) {
+    int d = (smp & -8) - *hist, t, ss = *step, diff;
+    unsigned int code = 0;
+
+    t = (d < 0 ? -d : d) << 2;
+
+    if(t >= ss << 3) {
+        code = 7;
+    }
+    else {
+        if(t >= ss << 2) {
+            code = 4;
+            t -= ss << 2;
+        }
+
+        if(t >= ss << 1) {
+            code |= 2;
+            t -= ss << 1;
+        }
+
+        if(t >= ss)
+            code |= 1;
+    }
+
+    diff = ((1 + (code << 1)) * ss) >> 3;
+
+    if(d < 0) {
+        code |= 8;
+        *hist -= diff;
+
+        if(*hist < -32768)
+            *hist = -32768;
+    }
+    else {
+        *hist += diff;
+
+        if(*hist > 32767)
+            *hist = 32767;
+    }
+
+    ss = (step_scale[code & 7] * ss) >> 8;
+
+    if(ss < ADPCM_STEP_MIN)
+        ss = ADPCM_STEP_MIN;
+    else if(ss > ADPCM_STEP_MAX)
+        ss = ADPCM_STEP_MAX;
+
+    *step = ss;
+
+    return code;
+}
+
+/* Encode samples spaced stride apart. The AICA plays the low nibble of
+   each byte first. */
+static size_t encode(snd_adpcm_state_t *st, uint8_t *out, const int16_t *in,
+                     size_t samples, size_t stride) {
+    int hist = st->history, step = st->step;
+    unsigned int lo, hi;
+    size_t i;
+
+    for(i = 0; i < samples / 2; i++) {
+        lo = encode_one(&hist, &step, in[0]);
+        hi = encode_one(&hist, &step, in[stride]);
+        out[i] = lo | (hi << 4);
+        in += stride << 1;
+    }
+
+    st->history = hist;
+    st->step = step;
+
+    return samples / 2;
+}
+
+size_t snd_adpcm_encode(snd_adpcm_state_t *st, uint8_t *out,
+                        const int16_t *in, size_t samples) {
+    return encode(st, out, in, samples, 1);
+}
+
+size_t snd_adpcm_encode_stereo(snd_adpcm_state_t st[2], uint8_t *left,
+                               uint8_t *right, const int16_t *in,
+                               size_t frames) {
+    encode(&st[0], left, in, frames, 2);
+    return encode(&st[1], right, in + 1, frames, 2);
+}
@@ -0,0 +1,320 @@
+/* KallistiOS ##version##
+
+   snd_cdstream.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   Disc streams. The ring is counted in bytes read and handed out since the
+   start, so that it's full when the two are the ring size apart. What the
+   callback hands out is only given back on the next call, as the stream
+   copies it out in between. Bursts are whole sectors DMAed in at most two
+   pieces, one up to the end of the ring and one from its start, both on
+   32-byte boundaries.
+*/
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <dc/cdrom.h>
+#include <dc/fs_iso9660.h>
+#include <dc/sound/cdstream.h>
+#include <dc/sound/stream.h>
+#include <kos/cond.h>
+#include <kos/fs.h>
+#include <kos/mutex.h>
+#include <kos/thread.h>
+
+#define SECTOR          2048
+
+/* Attempts at a burst before giving up on the disc */
+#define READ_TRIES      8
+#define RETRY_MS        20
+
+typedef struct {
+    uint8_t *ring;
+    size_t size;
+    size_t burst;               /* Least free space worth reading into */
+    size_t rd, wr;              /* Bytes handed out and read, ever */
+    size_t pending;             /* Handed out, not given back yet */
+
+    uint32_t lba;               /* First sector of the data */
+    uint32_t len;               /* Length of the data */
+    uint32_t pos;               /* Next byte of the data to read */
+    bool loop, eof, err, quit;
+
+    mutex_t mutex;
+    condvar_t cond;
+    kthread_t *thd;
+} cdstream_t;
+
+static cdstream_t *cdstreams[SND_STREAM_MAX];
+
+/* Read sectors into the ring at the given offset */
+static int cdstream_read(cdstream_t *cs, size_t at, uint32_t sector,
+                         size_t count) {
+    size_t bytes = count * SECTOR, first = cs->size - at;
+    uint32_t seq;
+    int i, rv;
+
+    if(first > bytes)
+        first = bytes;
+
+    for(i = 0; i < READ_TRIES; i++) {
+        if(i)
+            thd_sleep(RETRY_MS);
+
+        if(cdrom_stream_start(sector, count, CDROM_READ_DMA) != ERR_OK)
+            continue;
+
+        seq = cdrom_stream_seq();
+        rv = cdrom_stream_request(cs->ring + at, first, true);
+
+        if(rv == ERR_OK && bytes > first)
+            rv = cdrom_stream_request(cs->ring, bytes - first, true);
+
+        /* Someone else starting a stream in the meantime ends ours, and may
+           have taken some of it. */
+        if(seq != cdrom_stream_seq())
+            continue;
+
+        cdrom_stream_stop(false);
+
+        if(rv == ERR_OK)
+            return 0;
+    }
+
+    return -1;
+}
+
+static void *cdstream_thd(void *param) {
+    cdstream_t *cs = param;
+    size_t space, count, at, got;
+    uint32_t pos, left;
+
+    mutex_lock(&cs->mutex);
+
+    while(!cs->quit) {
+        space = cs->size - (cs->wr - cs->rd);
+
+        if(cs->eof || space < cs->burst) {
+            cond_wait(&cs->cond, &cs->mutex);
+            continue;
+        }
+
+        pos = cs->pos;
+        left = cs->len - pos;
+        count = space / SECTOR;
+
+        if(count > (left + SECTOR - 1) / SECTOR)
+            count = (left + SECTOR - 1) / SECTOR;
+
+        at = cs->wr % cs->size;
+        mutex_unlock(&cs->mutex);
+
+        if(cdstream_read(cs, at, cs->lba + pos / SECTOR, count) < 0) {
+            mutex_lock(&cs->mutex);
+            cs->err = cs->eof = true;
+            cond_broadcast(&cs->cond);
+            break;
+        }
+
+        mutex_lock(&cs->mutex);
+
+        /* Past the end of the data, the last sector holds whatever follows
+           on the disc, and a partial 32 bytes can't be handed out without
+           breaking the alignment of the next burst. */
+        got = count * SECTOR;
+
+        if(got >= left) {
+            got = left & ~31;
+            cs->pos = 0;
+            cs->eof = !cs->loop;
+        }
+        else {
+            cs->pos = pos + got;
+        }
+
+        cs->wr += got;
+        cond_broadcast(&cs->cond);
+    }
+
+    mutex_unlock(&cs->mutex);
+
+    return NULL;
+}
+
+static void *cdstream_data(snd_stream_hnd_t hnd, int smp_req, int *smp_recv) {
+    cdstream_t *cs = cdstreams[hnd];
+    size_t at, avail;
+    void *rv = NULL;
+
+    mutex_lock(&cs->mutex);
+
+    cs->rd += cs->pending;
+    at = cs->rd % cs->size;
+    avail = cs->wr - cs->rd;
+
+    if(avail > cs->size - at)
+        avail = cs->size - at;
+
+    if(avail > (size_t)smp_req)
+        avail = smp_req;
+
+    if(avail)
+        rv = cs->ring + at;
+
+    cs->pending = avail;
+    *smp_recv = avail;
+
+    if(cs->size - (cs->wr - cs->rd) >= cs->burst)
+        cond_signal(&cs->cond);
+
+    mutex_unlock(&cs->mutex);
+
+    return rv;
+}
+
+static void cdstream_free(cdstream_t *cs) {
+    cond_destroy(&cs->cond);
+    mutex_destroy(&cs->mutex);
+    free(cs->ring);
+    free(cs);
+}
+
+int snd_cdstream_open(snd_stream_hnd_t hnd, const char *fn, uint32_t offset,
+                      size_t ring, int loop) {
+    const kthread_attr_t attr = {
+        /* Ahead of whatever else is loading from the disc */
+        .prio = PRIO_DEFAULT - 1,
+        .label = "snd_cdstream"
+    };
+    cdstream_t *cs;
+    file_t fd;
+    uint32_t lba;
+    uint64_t size;
+    bool err;
+
+    if(hnd < 0 || hnd >= SND_STREAM_MAX || cdstreams[hnd] ||
+       (offset & (SECTOR - 1))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if((fd = fs_open(fn, O_RDONLY)) < 0)
+        return -1;
+
+    if(fs_iso9660_get_lba(fd, &lba) < 0) {
+        fs_close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    size = fs_total64(fd);
+    fs_close(fd);
+
+    if(size <= offset || size - offset < 32) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!ring)
+        ring = SND_CDSTREAM_RING;
+
+    ring = (ring + SECTOR - 1) & ~(SECTOR - 1);
+
+    if(!(cs = calloc(1, sizeof(cdstream_t))))
+        goto nomem;
+
+    if(!(cs->ring = aligned_alloc(32, ring))) {
+        free(cs);
+        goto nomem;
+    }
+
+    cs->size = ring;
+    cs->burst = (ring / 4) & ~(SECTOR - 1);
+
+    if(cs->burst < SECTOR)
+        cs->burst = SECTOR;
+
+    cs->lba = lba + offset / SECTOR;
+    cs->len = size - offset;
+    cs->loop = !!loop;
+    mutex_init(&cs->mutex, MUTEX_TYPE_NORMAL);
+    cond_init(&cs->cond);
+
+    if(!(cs->thd = thd_create_ex(&attr, cdstream_thd, cs))) {
+        cdstream_free(cs);
+        goto nomem;
+    }
+
+    /* Wait for the first burst */
+    mutex_lock(&cs->mutex);
+
+    while(!cs->eof && cs->wr == 0)
+        cond_wait(&cs->cond, &cs->mutex);
+
+    err = cs->err;
+    mutex_unlock(&cs->mutex);
+
+    if(err) {
+        thd_join(cs->thd, NULL);
+        cdstream_free(cs);
+        errno = EIO;
+        return -1;
+    }
+
+    cdstreams[hnd] = cs;
+    snd_stream_set_callback(hnd, cdstream_data);
+
+    return 0;
+
+nomem:
+    errno = ENOMEM;
+    return -1;
+}
+
+void snd_cdstream_close(snd_stream_hnd_t hnd) {
+    cdstream_t *cs;
+
+    if(hnd < 0 || hnd >= SND_STREAM_MAX || !(cs = cdstreams[hnd]))
+        return;
+
+    snd_stream_set_callback(hnd, NULL);
+    cdstreams[hnd] = NULL;
+
+    mutex_lock(&cs->mutex);
+    cs->quit = true;
+    cond_signal(&cs->cond);
+    mutex_unlock(&cs->mutex);
+
+    thd_join(cs->thd, NULL);
+    cdstream_free(cs);
+}
+
+int snd_cdstream_done(snd_stream_hnd_t hnd) {
+    cdstream_t *cs;
+    int rv;
+
+    if(hnd < 0 || hnd >= SND_STREAM_MAX || !(cs = cdstreams[hnd]))
+        return 1;
+
+    mutex_lock(&cs->mutex);
+    rv = cs->eof && cs->wr == cs->rd + cs->pending;
+    mutex_unlock(&cs->mutex);
+
+    return rv;
+}
+
+size_t snd_cdstream_buffered(snd_stream_hnd_t hnd) {
+    cdstream_t *cs;
+    size_t rv;
+
+    if(hnd < 0 || hnd >= SND_STREAM_MAX || !(cs = cdstreams[hnd]))
+        return 0;
+
+    mutex_lock(&cs->mutex);
+    rv = cs->wr - cs->rd - cs->pending;
+    mutex_unlock(&cs->mutex);
+
+    return rv;
+}
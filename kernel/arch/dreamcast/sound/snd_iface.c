@@ -10,13 +10,16 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 
 #include <kos/dbglog.h>
+#include <kos/mem_tags.h>
 #include <kos/mutex.h>
 #include <kos/timer.h>
 #include <dc/g2bus.h>
 #include <dc/spu.h>
+#include <dc/sq.h>
 #include <dc/sound/sound.h>
 
 #include "arm/aica_cmd_iface.h"
@@ -37,6 +40,8 @@ static mutex_t queue_proc_mutex = MUTEX_INITIALIZER;
 int snd_init(void) {
     size_t amt;
 
+    mem_tag_scoped(MEM_TAG_SOUND);
+
     /* Finish loading the stream driver */
     if(!initted) {
         spu_disable();
@@ -71,6 +76,13 @@ void snd_shutdown(void) {
     }
 }
 
+uint32_t snd_driver_caps(void) {
+    if(!initted)
+        return 0;
+
+    return g2_read_32(SPU_RAM_UNCACHED_BASE + AICA_MEM_CAPS);
+}
+
 /* Submit a request to the SH4->AICA queue; size is in uint32's */
 int snd_sh4_to_aica(void *packet, uint32_t size) {
     uint32_t qa, bot, start, top, *pkt32, cnt;
@@ -117,6 +129,124 @@ int snd_sh4_to_aica(void *packet, uint32_t size) {
     return 0;
 }
 
+int snd_cmd_batch_init(snd_cmd_batch_t *batch, size_t size) {
+    mem_tag_scoped(MEM_TAG_SOUND);
+
+    /* Whole store queue bursts, and the SQs want 32-byte aligned sources
+       for those */
+    size = (size + 7) & ~7;
+    batch->buf = aligned_alloc(32, size * 4);
+
+    if(!batch->buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    batch->size = size;
+    batch->used = 0;
+
+    return 0;
+}
+
+void snd_cmd_batch_free(snd_cmd_batch_t *batch) {
+    free(batch->buf);
+    batch->buf = NULL;
+    batch->size = batch->used = 0;
+}
+
+int snd_cmd_batch_add(snd_cmd_batch_t *batch, const void *packet, uint32_t size) {
+    if(batch->used + size > batch->size) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    memcpy(batch->buf + batch->used, packet, size * 4);
+    batch->used += size;
+
+    return 0;
+}
+
+/* Write dwords to one stretch of the queue; burst through the SQs where
+   the queue is 32-byte aligned. The G2 bus and SQs must be locked. */
+static void queue_write(uint32_t dst, const uint32_t *src, size_t n) {
+    size_t burst;
+
+    while(n && (dst & 31)) {
+        g2_write_32_raw(SPU_RAM_UNCACHED_BASE + dst, *src++);
+        dst += 4;
+        n--;
+    }
+
+    if((burst = n & ~7)) {
+        sq_cpy((void *)(SPU_RAM_BASE + dst), src, burst * 4);
+        sq_wait();
+        dst += burst * 4;
+        src += burst;
+        n -= burst;
+    }
+
+    while(n--) {
+        g2_write_32_raw(SPU_RAM_UNCACHED_BASE + dst, *src++);
+        dst += 4;
+    }
+}
+
+int snd_cmd_batch_submit(snd_cmd_batch_t *batch) {
+    uint32_t qa, bot, size, head, tail, room, first;
+    g2_ctx_t ctx;
+
+    if(!batch->used)
+        return 0;
+
+    qa = SPU_RAM_UNCACHED_BASE + AICA_MEM_CMD_QUEUE;
+
+    sq_lock(NULL);
+    ctx = g2_lock();
+    g2_fifo_wait();
+
+    assert_msg(g2_read_32_raw(qa + offsetof(aica_queue_t, valid)), "Queue is not yet valid");
+
+    bot = g2_read_32_raw(qa + offsetof(aica_queue_t, data));
+    size = g2_read_32_raw(qa + offsetof(aica_queue_t, size));
+    head = g2_read_32_raw(qa + offsetof(aica_queue_t, head));
+    tail = g2_read_32_raw(qa + offsetof(aica_queue_t, tail));
+
+    /* Keep the head from catching up with the tail. */
+    room = (tail > head ? tail - head : size - head + tail) - 4;
+
+    if(batch->used * 4 > room) {
+        g2_unlock(ctx);
+        sq_unlock();
+        errno = EAGAIN;
+        return -1;
+    }
+
+    /* Up to the end of the queue, and the rest from its start */
+    first = (size - head) / 4;
+
+    if(first > batch->used)
+        first = batch->used;
+
+    queue_write(bot + head, batch->buf, first);
+    queue_write(bot, batch->buf + first, batch->used - first);
+
+    head += batch->used * 4;
+
+    if(head >= size)
+        head -= size;
+
+    /* The ARM sees the whole batch when the head moves. */
+    g2_fifo_wait();
+    g2_write_32_raw(qa + offsetof(aica_queue_t, head), head);
+
+    g2_unlock(ctx);
+    sq_unlock();
+
+    batch->used = 0;
+
+    return 0;
+}
+
 /* Start processing requests in the queue */
 void snd_sh4_to_aica_start(void) {
     g2_write_32(SPU_RAM_UNCACHED_BASE + AICA_MEM_CMD_QUEUE + offsetof(aica_queue_t, process_ok), 1);
@@ -129,21 +259,38 @@ void snd_sh4_to_aica_stop(void) {
     g2_write_32(SPU_RAM_UNCACHED_BASE + AICA_MEM_CMD_QUEUE + offsetof(aica_queue_t, process_ok), 0);
 }
 
+/* The driver's ticks only move on together with the timer, so a pair read
+   with the same ticks either side of the timer is consistent. */
+uint32_t snd_sample_clock(void) {
+    uint32_t ticks, tima;
+
+    if(!(snd_driver_caps() & AICA_CAP_SAMPLE_CLOCK))
+        return 0;
+
+    do {
+        ticks = g2_read_32(SPU_RAM_UNCACHED_BASE + AICA_MEM_TICKS);
+        tima = g2_read_32(MEM_AREA_P2_BASE + 0x00700000 + AICA_TIMA);
+    } while(ticks != g2_read_32(SPU_RAM_UNCACHED_BASE + AICA_MEM_TICKS));
+
+    return aica_sample_clock(ticks, tima);
+}
+
 /* Transfer one packet of data from the AICA->SH4 queue. Expects to
    find AICA_CMD_MAX_SIZE dwords of space available. Returns -1
    if failure, 0 for no packets available, 1 otherwise. Failure
    might mean a permanent failure since the queue is probably out of sync. */
 int snd_aica_to_sh4(void *packetout) {
-    uint32  bot, start, stop, top, size, cnt, *pkt32;
+    uint32  qa, bot, start, stop, top, size, cnt, *pkt32;
     g2_ctx_t ctx = g2_lock();
 
     /* Set these up for reference */
-    bot = SPU_RAM_UNCACHED_BASE + AICA_MEM_RESP_QUEUE;
-    assert_msg(g2_read_32_raw(bot + offsetof(aica_queue_t, valid)), "Queue is not yet valid");
+    qa = SPU_RAM_UNCACHED_BASE + AICA_MEM_RESP_QUEUE;
+    assert_msg(g2_read_32_raw(qa + offsetof(aica_queue_t, valid)), "Queue is not yet valid");
 
-    top = SPU_RAM_UNCACHED_BASE + AICA_MEM_RESP_QUEUE + g2_read_32_raw(bot + offsetof(aica_queue_t, size));
-    start = SPU_RAM_UNCACHED_BASE + AICA_MEM_RESP_QUEUE + g2_read_32_raw(bot + offsetof(aica_queue_t, tail));
-    stop = SPU_RAM_UNCACHED_BASE + AICA_MEM_RESP_QUEUE + g2_read_32_raw(bot + offsetof(aica_queue_t, head));
+    bot = SPU_RAM_UNCACHED_BASE + g2_read_32_raw(qa + offsetof(aica_queue_t, data));
+    top = bot + g2_read_32_raw(qa + offsetof(aica_queue_t, size));
+    start = bot + g2_read_32_raw(qa + offsetof(aica_queue_t, tail));
+    stop = bot + g2_read_32_raw(qa + offsetof(aica_queue_t, head));
     cnt = 0;
     pkt32 = (uint32_t *)packetout;
 
@@ -165,8 +312,8 @@ int snd_aica_to_sh4(void *packetout) {
     /* Find stop point for this packet */
     stop = start + size * 4;
 
-    if(stop > top)
-        stop -= top - (SPU_RAM_UNCACHED_BASE + AICA_MEM_RESP_QUEUE);
+    if(stop >= top)
+        stop -= top - bot;
 
     while(start != stop) {
         /* Fifo wait if necessary */
@@ -187,7 +334,7 @@ int snd_aica_to_sh4(void *packetout) {
     if((cnt & 7) == 0)
         g2_fifo_wait();
 
-    g2_write_32_raw(bot + offsetof(aica_queue_t, tail), start - (SPU_RAM_UNCACHED_BASE + AICA_MEM_RESP_QUEUE));
+    g2_write_32_raw(qa + offsetof(aica_queue_t, tail), start - bot);
     g2_unlock(ctx);
 
     return 1;
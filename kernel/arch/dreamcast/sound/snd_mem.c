@@ -12,8 +12,10 @@
 #include <string.h>
 #include <errno.h>
 #include <sys/queue.h>
+#include <dc/spu.h>
 #include <dc/sound/sound.h>
 #include <arch/arch.h>
+#include <arch/irq.h>
 #include <arch/spinlock.h>
 #include <kos/dbglog.h>
 
@@ -215,12 +217,15 @@ uint32 snd_mem_malloc(size_t size) {
    SPU RAM. */
 void snd_mem_free(uint32 addr) {
     snd_block_t *e, *o;
+    spu_fence_t fence;
+    int waited = 0;
 
     assert_msg(initted, "Use of snd_mem_free before snd_mem_init");
 
     if(addr == 0)
         return;
 
+again:
     if(!spinlock_lock_irqsafe(&snd_mem_mutex))
         return;
 
@@ -236,6 +241,22 @@ void snd_mem_free(uint32 addr) {
         return;
     }
 
+    /* Don't give the block out again while an upload into it is pending. */
+    if(!waited && (fence = spu_memload_pending(e->addr, e->size))) {
+        spinlock_unlock(&snd_mem_mutex);
+
+        if(irq_inside_int()) {
+            dbglog(DBG_WARNING, "snd_mem_free: freeing block at %08lx with a "
+                   "pending upload\n", addr);
+        }
+        else {
+            spu_fence_wait(fence, 0);
+        }
+
+        waited = 1;
+        goto again;
+    }
+
     /* Set this block as unused */
     e->inuse = 0;
 
@@ -0,0 +1,229 @@
+/* KallistiOS ##version##
+
+   snd_mixer.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   SH4 side of the AICA mixer. All the mixing is done by the ARM (see
+   arm/mixer.c); this just hands it its channels and output rings, and
+   forwards source commands.
+*/
+
+#include <errno.h>
+#include <stddef.h>
+
+#include <arch/timer.h>
+#include <dc/g2bus.h>
+#include <dc/spu.h>
+#include <dc/sound/sound.h>
+#include <dc/sound/sfxmgr.h>
+#include <dc/sound/mixer.h>
+#include <kos/thread.h>
+
+#include "arm/aica_cmd_iface.h"
+
+/* A source started this recently may not show as playing yet. */
+#define MIX_START_MS    50
+
+/* How long to wait for the ARM to let go of the rings */
+#define MIX_STOP_MS     100
+
+#define MIX_STATUS(f) \
+    (SPU_RAM_UNCACHED_BASE + AICA_MEM_MIXER + offsetof(aica_mix_status_t, f))
+
+static struct {
+    int running;
+    int lchn, rchn;
+    uint32_t left, right;
+    int next;
+    uint64_t started[SND_MIXER_SOURCES];
+} mix;
+
+int snd_mixer_init(uint32_t freq, size_t ring) {
+    AICA_CMDSTR_MIXER(tmp, cmd, cfg);
+
+    if(!ring)
+        ring = SND_MIXER_RING;
+
+    if(!(snd_driver_caps() & AICA_CAP_MIXER)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if(mix.running || !freq || ring < 256 || ring > 65535) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mix.lchn = snd_sfx_chn_alloc();
+    mix.rchn = snd_sfx_chn_alloc();
+    mix.left = snd_mem_malloc(ring * 2);
+    mix.right = snd_mem_malloc(ring * 2);
+
+    if(mix.lchn < 0 || mix.rchn < 0 || !mix.left || !mix.right) {
+        if(mix.right)
+            snd_mem_free(mix.right);
+
+        if(mix.left)
+            snd_mem_free(mix.left);
+
+        if(mix.rchn >= 0)
+            snd_sfx_chn_free(mix.rchn);
+
+        if(mix.lchn >= 0)
+            snd_sfx_chn_free(mix.lchn);
+
+        errno = ENOMEM;
+        return -1;
+    }
+
+    cmd->cmd = AICA_CMD_MIX_START;
+    cmd->timestamp = 0;
+    cmd->size = AICA_CMDSTR_MIXER_SIZE;
+    cmd->cmd_id = 0;
+    cfg->left_chn = mix.lchn;
+    cfg->right_chn = mix.rchn;
+    cfg->left = mix.left;
+    cfg->right = mix.right;
+    cfg->size = ring;
+    cfg->freq = freq;
+    cfg->vol = 255;
+    snd_sh4_to_aica(tmp, cmd->size);
+
+    mix.next = 0;
+    mix.running = 1;
+
+    return 0;
+}
+
+void snd_mixer_shutdown(void) {
+    aica_cmd_t cmd = { 0 };
+    uint64_t end;
+
+    if(!mix.running)
+        return;
+
+    cmd.cmd = AICA_CMD_MIX_STOP;
+    cmd.size = sizeof(cmd) / 4;
+    snd_sh4_to_aica(&cmd, cmd.size);
+
+    /* The rings can't be handed out again while the ARM is writing them. */
+    end = timer_ms_gettime64() + MIX_STOP_MS;
+
+    while(g2_read_32(MIX_STATUS(running)) && timer_ms_gettime64() < end)
+        thd_sleep(1);
+
+    snd_mem_free(mix.right);
+    snd_mem_free(mix.left);
+    snd_sfx_chn_free(mix.rchn);
+    snd_sfx_chn_free(mix.lchn);
+
+    mix.running = 0;
+}
+
+static int find_free_source(void) {
+    uint32_t playing = g2_read_32(MIX_STATUS(playing));
+    uint64_t now = timer_ms_gettime64();
+    int i, src;
+
+    for(i = 0; i < SND_MIXER_SOURCES; i++) {
+        src = (mix.next + i) % SND_MIXER_SOURCES;
+
+        if(!(playing & (1 << src)) && now - mix.started[src] >= MIX_START_MS) {
+            mix.next = (src + 1) % SND_MIXER_SOURCES;
+            return src;
+        }
+    }
+
+    return -1;
+}
+
+static void send_src(int src, aica_cmd_t *cmd) {
+    cmd->cmd = AICA_CMD_MIX_SRC;
+    cmd->timestamp = 0;
+    cmd->size = AICA_CMDSTR_CHANNEL_SIZE;
+    cmd->cmd_id = src;
+    snd_sh4_to_aica(cmd, cmd->size);
+}
+
+int snd_mixer_play(const snd_mixer_play_data_t *data) {
+    AICA_CMDSTR_CHANNEL(tmp, cmd, chan);
+    int src = data->src;
+
+    if(!mix.running || src >= SND_MIXER_SOURCES || !data->len ||
+       data->fmt < SND_MIXER_FMT_16BIT || data->fmt > SND_MIXER_FMT_ADPCM ||
+       data->freq <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(src < 0 && (src = find_free_source()) < 0) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    chan->cmd = AICA_CH_CMD_START;
+    chan->base = data->base;
+    chan->type = data->fmt;
+    chan->length = data->len;
+    chan->loop = data->loop;
+    chan->loopstart = data->loopstart;
+    chan->loopend = data->loopend ? data->loopend : data->len;
+    chan->freq = data->freq;
+    chan->vol = data->vol;
+    chan->pan = data->pan;
+    send_src(src, cmd);
+
+    mix.started[src] = timer_ms_gettime64();
+
+    return src;
+}
+
+void snd_mixer_stop(int src) {
+    AICA_CMDSTR_CHANNEL(tmp, cmd, chan);
+
+    if(!mix.running || src < 0 || src >= SND_MIXER_SOURCES)
+        return;
+
+    chan->cmd = AICA_CH_CMD_STOP;
+    send_src(src, cmd);
+}
+
+void snd_mixer_update(int src, int freq, int vol, int pan) {
+    AICA_CMDSTR_CHANNEL(tmp, cmd, chan);
+
+    if(!mix.running || src < 0 || src >= SND_MIXER_SOURCES)
+        return;
+
+    chan->cmd = AICA_CH_CMD_UPDATE;
+
+    if(freq > 0) {
+        chan->cmd |= AICA_CH_UPDATE_SET_FREQ;
+        chan->freq = freq;
+    }
+
+    if(vol >= 0) {
+        chan->cmd |= AICA_CH_UPDATE_SET_VOL;
+        chan->vol = vol;
+    }
+
+    if(pan >= 0) {
+        chan->cmd |= AICA_CH_UPDATE_SET_PAN;
+        chan->pan = pan;
+    }
+
+    send_src(src, cmd);
+}
+
+bool snd_mixer_is_playing(int src) {
+    if(!mix.running || src < 0 || src >= SND_MIXER_SOURCES)
+        return false;
+
+    return g2_read_32(MIX_STATUS(playing)) & (1 << src);
+}
+
+uint32_t snd_mixer_get_pos(int src) {
+    if(!mix.running || src < 0 || src >= SND_MIXER_SOURCES)
+        return 0;
+
+    return g2_read_32(MIX_STATUS(pos) + src * 4);
+}
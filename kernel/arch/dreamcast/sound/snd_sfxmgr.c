@@ -8,18 +8,30 @@
 
    Sound effects management system; this thing loads and plays sound effects
    during game operation.
+
+   Effects loaded from files double as a cache of sound RAM: loading the same
+   file again just adds a reference to the effect already loaded, and when
+   sound RAM runs out, the least recently played effects that were loaded from
+   files (and aren't pinned or playing) get their sound RAM taken away. They
+   are loaded back in from their file the next time they are played.
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 #include <string.h>
 
 #include <sys/queue.h>
 #include <sys/ioctl.h>
 #include <kos/dbglog.h>
 #include <kos/fs.h>
+#include <kos/mutex.h>
+#include <kos/sem.h>
+#include <kos/thread.h>
+#include <arch/cache.h>
 #include <arch/irq.h>
+#include <arch/timer.h>
 #include <dc/spu.h>
 #include <dc/sound/sound.h>
 #include <dc/sound/sfxmgr.h>
@@ -37,17 +49,119 @@ typedef struct snd_effect {
     uint32_t  fmt;
     uint16_t  stereo;
 
+    /* File to reload the effect from if it gets evicted, or NULL if it can't
+       be. Raw files also keep the parameters they were loaded with, with a
+       bitsize of 0 meaning a WAV file. */
+    char      *path;
+    uint16_t  bitsize;
+    uint16_t  channels;
+
+    uint32_t  refs;
+    uint64_t  last_used;
+    int       pinned;
+
     LIST_ENTRY(snd_effect)  list;
 } snd_effect_t;
 
 struct selist snd_effects;
 
+/* What was last started on each channel, and when it will be done. A
+   stereo effect takes two channels, the second of which is stolen along
+   with the first. */
+typedef struct sfx_voice {
+    snd_effect_t *effect;
+    uint64_t start, end;
+    int prio, cat, vol;
+    int width;      /* Channels taken, on the first one */
+    int second;     /* The right channel of a stereo effect */
+} sfx_voice_t;
+
+static sfx_voice_t voices[64];
+
+/* Voices allowed in each category, or 0 for any number */
+static int cat_limit[SND_SFX_CATEGORIES];
+
+/* Held while picking voices and starting them */
+static mutex_t voice_mutex = MUTEX_INITIALIZER;
+
+/* Are starts being held back until snd_sfx_batch_end()? */
+static int sfx_batching = 0;
+
 /* The next channel we'll use to play sound effects. */
 static int sfx_nextchan = 0;
 
 /* Our channel-in-use mask. */
 static uint64_t sfx_inuse = 0;
 
+/* Free the SPU RAM of a sample, if it has any */
+static void sfx_free_spu(snd_effect_t *t) {
+    if(t->locl)
+        snd_mem_free(t->locl);
+
+    if(t->locr)
+        snd_mem_free(t->locr);
+
+    t->locl = t->locr = 0;
+}
+
+/* Is the sample still playing on any channel? */
+static int sfx_busy(const snd_effect_t *t, uint64_t now) {
+    int i;
+
+    for(i = 0; i < 64; i++) {
+        if(voices[i].effect == t && voices[i].end > now)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Take the SPU RAM away from the least recently played sample that can be
+   reloaded later on. */
+static int sfx_evict(const snd_effect_t *keep) {
+    snd_effect_t *t, *lru = NULL;
+    uint64_t now = timer_ms_gettime64();
+
+    LIST_FOREACH(t, &snd_effects, list) {
+        if(t == keep || !t->path || t->pinned || !t->locl || sfx_busy(t, now))
+            continue;
+
+        if(!lru || t->last_used < lru->last_used)
+            lru = t;
+    }
+
+    if(!lru)
+        return -1;
+
+    sfx_free_spu(lru);
+    return 0;
+}
+
+/* Allocate SPU RAM for a sample, evicting others as needed */
+static uint32_t sfx_mem_malloc(size_t size, const snd_effect_t *keep) {
+    uint32_t loc;
+
+    while(!(loc = snd_mem_malloc(size))) {
+        if(sfx_evict(keep) < 0)
+            return 0;
+    }
+
+    return loc;
+}
+
+static void sfx_destroy(snd_effect_t *t) {
+    int i;
+
+    for(i = 0; i < 64; i++) {
+        if(voices[i].effect == t)
+            voices[i].effect = NULL;
+    }
+
+    sfx_free_spu(t);
+    free(t->path);
+    free(t);
+}
+
 /* Unload all loaded samples and free their SPU RAM */
 void snd_sfx_unload_all(void) {
     snd_effect_t *t, *n;
@@ -56,14 +170,7 @@ void snd_sfx_unload_all(void) {
 
     while(t) {
         n = LIST_NEXT(t, list);
-
-        snd_mem_free(t->locl);
-
-        if(t->stereo)
-            snd_mem_free(t->locr);
-
-        free(t);
-
+        sfx_destroy(t);
         t = n;
     }
 
@@ -79,13 +186,47 @@ void snd_sfx_unload(sfxhnd_t idx) {
         return;
     }
 
-    snd_mem_free(t->locl);
-
-    if(t->stereo)
-        snd_mem_free(t->locr);
+    if(--t->refs)
+        return;
 
     LIST_REMOVE(t, list);
-    free(t);
+    sfx_destroy(t);
+}
+
+void snd_sfx_pin(sfxhnd_t idx, int pinned) {
+    snd_effect_t *t = (snd_effect_t *)idx;
+
+    if(idx != SFXHND_INVALID)
+        t->pinned = pinned;
+}
+
+/* Look for a sample already loaded from the given file */
+static snd_effect_t *sfx_find(const char *fn, uint32_t rate, uint16_t bitsize,
+                              uint16_t channels) {
+    snd_effect_t *t;
+
+    LIST_FOREACH(t, &snd_effects, list) {
+        if(t->path && !strcmp(t->path, fn) && t->bitsize == bitsize &&
+           (!bitsize || (t->rate == rate && t->channels == channels)))
+            return t;
+    }
+
+    return NULL;
+}
+
+/* Add a freshly loaded sample to the list */
+static sfxhnd_t sfx_register(snd_effect_t *t, const char *fn,
+                             uint16_t bitsize, uint16_t channels) {
+    /* If the path can't be saved, the sample just won't be evictable. */
+    t->path = fn ? strdup(fn) : NULL;
+    t->bitsize = bitsize;
+    t->channels = channels;
+    t->refs = 1;
+    t->last_used = timer_ms_gettime64();
+
+    LIST_INSERT_HEAD(&snd_effects, t, list);
+
+    return (sfxhnd_t)t;
 }
 
 typedef struct {
@@ -218,23 +359,6 @@ static int read_wav_header_buf(char *buf, wavhdr_t *wavhdr, size_t *bufidx) {
     return 0;
 }
 
-static uint8_t *read_wav_data(file_t fd, wavhdr_t *wavhdr) {
-    /* Allocate memory for WAV data */
-    uint8_t *wav_data = aligned_alloc(32, wavhdr->chunk.size);
-
-    if(wav_data == NULL)
-        return NULL;
-
-    /* Read WAV data */
-    if((size_t)fs_read(fd, wav_data, wavhdr->chunk.size) != wavhdr->chunk.size) {
-        dbglog(DBG_WARNING, "snd_sfx: file has not been fully read.\n");
-        free(wav_data);
-        return NULL;
-    }
-
-    return wav_data;
-}
-
 static uint8_t *read_wav_data_buf(char *buf, wavhdr_t *wavhdr, size_t *bufidx) {
     /* maintain buffer index during function */
     size_t tmp_bufidx = *bufidx;
@@ -255,36 +379,44 @@ static uint8_t *read_wav_data_buf(char *buf, wavhdr_t *wavhdr, size_t *bufidx) {
     return wav_data;
 }
 
-static snd_effect_t *create_snd_effect(wavhdr_t *wavhdr, uint8_t *wav_data) {
+/* Set up an effect for the WAV data described by the header, with sound RAM
+   for it but nothing loaded in yet. */
+static snd_effect_t *sfx_wav_effect(const wavhdr_t *wavhdr) {
     snd_effect_t *effect;
     uint32_t len, rate;
     uint16_t channels, bitsize, fmt;
 
+    fmt = wavhdr->fmt.format;
+    channels = wavhdr->fmt.channels;
+
+    if(channels != 1 && channels != 2)
+        return NULL;
+
+    if(channels == 2 && fmt != WAVE_FMT_PCM &&
+       fmt != WAVE_FMT_YAMAHA_ADPCM_ITU_G723 && fmt != WAVE_FMT_YAMAHA_ADPCM)
+        return NULL;
+
     effect = malloc(sizeof(snd_effect_t));
     if(effect == NULL)
         return NULL;
 
     memset(effect, 0, sizeof(snd_effect_t));
 
-    fmt = wavhdr->fmt.format;
-    channels = wavhdr->fmt.channels;
     rate = wavhdr->fmt.sample_rate;
     bitsize = wavhdr->fmt.sample_size;
     len = wavhdr->chunk.size;
 
     effect->rate = rate;
     effect->stereo = channels > 1;
-    effect->locl = snd_mem_malloc(len / channels);
+    effect->locl = sfx_mem_malloc(len / channels, effect);
 
     if(!effect->locl) {
         goto err_occurred;
     }
     if(channels > 1) {
-        effect->locr = snd_mem_malloc(len / channels);
-        if(!effect->locr) {
-            snd_mem_free(effect->locl);
+        effect->locr = sfx_mem_malloc(len / channels, effect);
+        if(!effect->locr)
             goto err_occurred;
-        }
     }
 
     if(fmt == WAVE_FMT_YAMAHA_ADPCM_ITU_G723 || fmt == WAVE_FMT_YAMAHA_ADPCM) {
@@ -303,6 +435,27 @@ static snd_effect_t *create_snd_effect(wavhdr_t *wavhdr, uint8_t *wav_data) {
         goto err_occurred;
     }
 
+    return effect;
+
+err_occurred:
+    sfx_free_spu(effect);
+    free(effect);
+    return NULL;
+}
+
+static snd_effect_t *create_snd_effect(wavhdr_t *wavhdr, uint8_t *wav_data) {
+    snd_effect_t *effect;
+    uint32_t len;
+    uint16_t channels, bitsize, fmt;
+
+    if(!(effect = sfx_wav_effect(wavhdr)))
+        return NULL;
+
+    fmt = wavhdr->fmt.format;
+    channels = wavhdr->fmt.channels;
+    bitsize = wavhdr->fmt.sample_size;
+    len = wavhdr->chunk.size;
+
     if(channels == 1) {
         /* Mono PCM/ADPCM */
         spu_memload_sq(effect->locl, wav_data, len);
@@ -375,10 +528,7 @@ static snd_effect_t *create_snd_effect(wavhdr_t *wavhdr, uint8_t *wav_data) {
     }
     else {
 err_occurred:
-        if(effect->locl)
-            snd_mem_free(effect->locl);
-        if(effect->locr)
-            snd_mem_free(effect->locr);
+        sfx_free_spu(effect);
         free(effect);
         effect = SFXHND_INVALID;
     }
@@ -386,26 +536,192 @@ err_occurred:
     return effect;
 }
 
-/* Load a sound effect from a WAV file and return a handle to it */
-sfxhnd_t snd_sfx_load(const char *fn) {
+/* Files are loaded into sound RAM in chunks of this many bytes: one chunk is
+   read into one buffer while the G2 DMA sends the one before it from the
+   other, so loading an effect only takes a few chunks of main RAM. */
+#define SFX_CHUNK   16384
+
+typedef void (*sfx_split_t)(uint32_t *data, uint32_t *left, uint32_t *right,
+                            size_t size);
+
+typedef struct sfx_loader {
+    uint8_t *buf[2];        /* What the DMA sends from */
+    uint8_t *in;            /* Interleaved data read in, when splitting */
+    semaphore_t done;       /* Signaled when the DMA is done with a chunk */
+    int pending;
+
+    /* Second half of the transfer, started from the interrupt */
+    void *right_src;
+    uintptr_t right_dest;
+    size_t right_len;
+    volatile int right_failed;
+} sfx_loader_t;
+
+static void sfx_dma_done(void *data) {
+    sfx_loader_t *ld = (sfx_loader_t *)data;
+
+    sem_signal(&ld->done);
+}
+
+static void sfx_dma_chain(void *data) {
+    sfx_loader_t *ld = (sfx_loader_t *)data;
+
+    if(spu_dma_transfer(ld->right_src, ld->right_dest, ld->right_len, 0,
+                        sfx_dma_done, data) < 0) {
+        ld->right_failed = 1;
+        sfx_dma_done(data);
+    }
+}
+
+/* Wait for the DMA of the last chunk, and finish it off if the second half
+   of it couldn't be started. */
+static void sfx_dma_wait(sfx_loader_t *ld) {
+    if(!ld->pending)
+        return;
+
+    sem_wait(&ld->done);
+    ld->pending = 0;
+
+    if(ld->right_failed) {
+        spu_memload_sq(ld->right_dest, ld->right_src, ld->right_len);
+        ld->right_failed = 0;
+    }
+}
+
+/* Send a chunk to sound RAM, and the right channel's after it if right is
+   non-NULL. Falls back to the store queues if the DMA can't be used. */
+static void sfx_dma_start(sfx_loader_t *ld, void *left, uintptr_t ldest,
+                          void *right, uintptr_t rdest, size_t len) {
+    dcache_purge_range((uintptr_t)left, len);
+
+    if(right) {
+        dcache_purge_range((uintptr_t)right, len);
+        ld->right_src = right;
+        ld->right_dest = rdest;
+        ld->right_len = len;
+    }
+
+    while(spu_dma_transfer(left, ldest, len, 0,
+                           right ? sfx_dma_chain : sfx_dma_done, ld) < 0) {
+        if(errno != EINPROGRESS) {
+            spu_memload_sq(ldest, left, len);
+
+            if(right)
+                spu_memload_sq(rdest, right, len);
+
+            return;
+        }
+
+        thd_pass();
+    }
+
+    ld->pending = 1;
+}
+
+/* Load len bytes of the file into sound RAM at locl, or split them between
+   locl and locr if split is non-NULL. */
+static int sfx_stream(file_t fd, size_t len, uintptr_t locl, uintptr_t locr,
+                      sfx_split_t split) {
+    sfx_loader_t ld = { 0 };
+    const size_t out = split ? SFX_CHUNK / 2 : SFX_CHUNK;
+    uint8_t *mem, *dst;
+    size_t n, padded, off = 0;
+    int i = 0, rv = 0;
+
+    if(!(mem = aligned_alloc(32, SFX_CHUNK * (split ? 3 : 2))))
+        return -1;
+
+    ld.buf[0] = mem;
+    ld.buf[1] = mem + SFX_CHUNK;
+    ld.in = split ? mem + SFX_CHUNK * 2 : NULL;
+    sem_init(&ld.done, 0);
+
+    while(len) {
+        n = len < SFX_CHUNK ? len : SFX_CHUNK;
+        padded = (n + 31) & ~31;
+        dst = split ? ld.in : ld.buf[i];
+
+        /* The DMA is still sending the other buffer while this is read. */
+        if((size_t)fs_read(fd, dst, n) != n) {
+            dbglog(DBG_WARNING, "snd_sfx: file has not been fully read.\n");
+            rv = -1;
+            break;
+        }
+
+        if(padded != n)
+            memset(dst + n, 0, padded - n);
+
+        if(split)
+            split((uint32_t *)ld.in, (uint32_t *)ld.buf[i],
+                  (uint32_t *)(ld.buf[i] + out), padded);
+
+        sfx_dma_wait(&ld);
+
+        if(split)
+            sfx_dma_start(&ld, ld.buf[i], locl + off, ld.buf[i] + out,
+                          locr + off, padded / 2);
+        else
+            sfx_dma_start(&ld, ld.buf[i], locl + off, NULL, 0, padded);
+
+        off += out;
+        len -= n;
+        i ^= 1;
+    }
+
+    sfx_dma_wait(&ld);
+    sem_destroy(&ld.done);
+    free(mem);
+
+    return rv;
+}
+
+/* Load the data of a WAV file into an effect set up for it */
+static int sfx_stream_wav(file_t fd, const wavhdr_t *wavhdr,
+                          snd_effect_t *effect) {
+    uint32_t len = wavhdr->chunk.size;
+    uint16_t fmt = wavhdr->fmt.format;
+
+    if(wavhdr->fmt.channels == 1)
+        return sfx_stream(fd, len, effect->locl, 0, NULL);
+
+    if(fmt == WAVE_FMT_YAMAHA_ADPCM_ITU_G723) {
+        /* Channels are not interleaved */
+        if(sfx_stream(fd, len / 2, effect->locl, 0, NULL) < 0)
+            return -1;
+
+        return sfx_stream(fd, len / 2, effect->locr, 0, NULL);
+    }
+
+    if(fmt == WAVE_FMT_YAMAHA_ADPCM)
+        return sfx_stream(fd, len, effect->locl, effect->locr,
+                          snd_adpcm_split);
+
+    if(wavhdr->fmt.sample_size == 16)
+        return sfx_stream(fd, len, effect->locl, effect->locr,
+                          snd_pcm16_split);
+
+    return sfx_stream(fd, len, effect->locl, effect->locr, snd_pcm8_split);
+}
+
+/* Load a sound effect from a WAV file */
+static snd_effect_t *sfx_load_wav(const char *fn) {
     file_t fd;
     wavhdr_t wavhdr;
     snd_effect_t *effect;
-    uint8_t *wav_data;
     uint32_t sample_count;
 
     /* Open the sound effect file */
     fd = fs_open(fn, O_RDONLY);
     if(fd <= FILEHND_INVALID) {
         dbglog(DBG_ERROR, "snd_sfx_load: can't open %s\n", fn);
-        return SFXHND_INVALID;
+        return NULL;
     }
 
     /* Read WAV header */
     if(read_wav_header(fd, &wavhdr) < 0) {
         fs_close(fd);
         dbglog(DBG_ERROR, "snd_sfx_load: can't read wav header %s\n", fn);
-        return SFXHND_INVALID;
+        return NULL;
     }
     /*
     dbglog(DBG_DEBUG, "WAVE file is %s, %luHZ, %d bits/sample, "
@@ -424,51 +740,29 @@ sfxhnd_t snd_sfx_load(const char *fn) {
         dbglog(DBG_WARNING, "snd_sfx_load: WAVE file is over 65534 samples\n");
     }
 
-    /* Read WAV data */
-    wav_data = read_wav_data(fd, &wavhdr);
-    fs_close(fd);
-    if(!wav_data)
-        return SFXHND_INVALID;
-
-    /* Create and initialize sound effect */
-    effect = create_snd_effect(&wavhdr, wav_data);
-    if(!effect) {
-        free(wav_data);
-        return SFXHND_INVALID;
+    /* Create the sound effect, and stream the WAV data into it */
+    if((effect = sfx_wav_effect(&wavhdr)) &&
+       sfx_stream_wav(fd, &wavhdr, effect) < 0) {
+        sfx_free_spu(effect);
+        free(effect);
+        effect = NULL;
     }
 
-    /* Finish up and return the sound effect handle */
-    free(wav_data);
-    LIST_INSERT_HEAD(&snd_effects, effect, list);
-
-    return (sfxhnd_t)effect;
-}
-
-sfxhnd_t snd_sfx_load_ex(const char *fn, uint32_t rate, uint16_t bitsize, uint16_t channels) {
-    sfxhnd_t effect;
-    file_t fd = fs_open(fn, O_RDONLY);
-
-    if(fd <= FILEHND_INVALID) {
-        dbglog(DBG_ERROR, "snd_sfx_load_ex: can't open sfx %s\n", fn);
-        return SFXHND_INVALID;
-    }
-    effect = snd_sfx_load_fd(fd, fs_total(fd), rate, bitsize, channels);
     fs_close(fd);
     return effect;
 }
 
-sfxhnd_t snd_sfx_load_fd(file_t fd, size_t len, uint32_t rate, uint16_t bitsize, uint16_t channels) {
+/* Load a sound effect from raw data in a file */
+static snd_effect_t *sfx_load_fd(file_t fd, size_t len, uint32_t rate,
+                                 uint16_t bitsize, uint16_t channels) {
     snd_effect_t *effect;
-    size_t chan_len, read_len;
-    // uint32_t fs_rootbus_dma_ready = 0;
-    // uint32_t fs_dma_len = 0;
-    uint8_t *tmp_buff = NULL;
+    size_t chan_len;
 
     chan_len = len / channels;
     effect = malloc(sizeof(snd_effect_t));
 
     if(effect == NULL) {
-        return SFXHND_INVALID;
+        return NULL;
     }
 
     memset(effect, 0, sizeof(snd_effect_t));
@@ -497,77 +791,107 @@ sfxhnd_t snd_sfx_load_fd(file_t fd, size_t len, uint32_t rate, uint16_t bitsize,
         dbglog(DBG_WARNING, "snd_sfx_load_ex: PCM file is over 65534 samples\n");
     }
 
-    effect->locl = snd_mem_malloc(chan_len);
+    effect->locl = sfx_mem_malloc(chan_len, effect);
 
     if(!effect->locl) {
         goto err_occurred;
     }
-    read_len = chan_len;
-    /* Uncomment when implementation is merged.
-    if(fs_ioctl(fd, IOCTL_FS_ROOTBUS_DMA_READY, &fs_dma_len) == 0) {
-        if(chan_len >= fs_dma_len) {
-            fs_rootbus_dma_ready = 1;
-        }
+    if(sfx_stream(fd, chan_len, effect->locl, 0, NULL) < 0) {
+        goto err_occurred;
     }
-    if(fs_rootbus_dma_ready) {
-        read_len = chan_len & ~(fs_dma_len - 1);
 
-        if(fs_read(fd, (void *)(effect->locl | SPU_RAM_UNCACHED_BASE), read_len) <= 0) {
+    if(channels > 1) {
+        effect->locr = sfx_mem_malloc(chan_len, effect);
+
+        if(!effect->locr) {
             goto err_occurred;
         }
-        read_len = chan_len - read_len;
-    }
-    */
-    if(read_len > 0) {
-        tmp_buff = aligned_alloc(32, read_len);
 
-        if(fs_read(fd, tmp_buff, read_len) <= 0) {
+        if(sfx_stream(fd, chan_len, effect->locr, 0, NULL) < 0) {
             goto err_occurred;
         }
-        spu_memload_sq(effect->locl, tmp_buff, read_len);
     }
 
-    if(channels > 1) {
-        effect->locr = snd_mem_malloc(chan_len);
+    return effect;
 
-        if(!effect->locr) {
-            goto err_occurred;
-        }
-        read_len = chan_len;
-        /* Uncomment when implementation is merged.
-        if(fs_rootbus_dma_ready) {
-            read_len = chan_len & ~(fs_dma_len - 1);
+err_occurred:
+    sfx_free_spu(effect);
+    free(effect);
+    return NULL;
+}
 
-            if(fs_read(fd, (void *)(effect->locr | SPU_RAM_UNCACHED_BASE), chan_len) <= 0) {
-                goto err_occurred;
-            }
-            read_len = chan_len - read_len;
-        }
-        */
-        if(read_len > 0) {
-            if(fs_read(fd, tmp_buff, read_len) <= 0) {
-                goto err_occurred;
-            }
-            spu_memload_sq(effect->locr, tmp_buff, read_len);
-        }
+/* Load a sound effect from a raw file */
+static snd_effect_t *sfx_load_raw(const char *fn, uint32_t rate,
+                                  uint16_t bitsize, uint16_t channels) {
+    snd_effect_t *effect;
+    file_t fd = fs_open(fn, O_RDONLY);
+
+    if(fd <= FILEHND_INVALID) {
+        dbglog(DBG_ERROR, "snd_sfx_load_ex: can't open sfx %s\n", fn);
+        return NULL;
     }
 
-    if(tmp_buff) {
-        free(tmp_buff);
+    effect = sfx_load_fd(fd, fs_total(fd), rate, bitsize, channels);
+    fs_close(fd);
+
+    return effect;
+}
+
+/* Bring an evicted sound effect back into SPU RAM */
+static int sfx_reload(snd_effect_t *t) {
+    snd_effect_t *n;
+
+    if(t->bitsize)
+        n = sfx_load_raw(t->path, t->rate, t->bitsize, t->channels);
+    else
+        n = sfx_load_wav(t->path);
+
+    if(!n)
+        return -1;
+
+    t->locl = n->locl;
+    t->locr = n->locr;
+    free(n);
+
+    return 0;
+}
+
+/* Load a sound effect from a WAV file and return a handle to it */
+sfxhnd_t snd_sfx_load(const char *fn) {
+    snd_effect_t *effect;
+
+    if((effect = sfx_find(fn, 0, 0, 0))) {
+        ++effect->refs;
+        return (sfxhnd_t)effect;
     }
-    LIST_INSERT_HEAD(&snd_effects, effect, list);
-    return (sfxhnd_t)effect;
 
-err_occurred:
-    if(effect->locl)
-        snd_mem_free(effect->locl);
-    if(effect->locr)
-        snd_mem_free(effect->locr);
-    if(tmp_buff)
-        free(tmp_buff);
+    if(!(effect = sfx_load_wav(fn)))
+        return SFXHND_INVALID;
 
-    free(effect);
-    return SFXHND_INVALID;
+    return sfx_register(effect, fn, 0, 0);
+}
+
+sfxhnd_t snd_sfx_load_ex(const char *fn, uint32_t rate, uint16_t bitsize, uint16_t channels) {
+    snd_effect_t *effect;
+
+    if((effect = sfx_find(fn, rate, bitsize, channels))) {
+        ++effect->refs;
+        return (sfxhnd_t)effect;
+    }
+
+    if(!(effect = sfx_load_raw(fn, rate, bitsize, channels)))
+        return SFXHND_INVALID;
+
+    return sfx_register(effect, fn, bitsize, channels);
+}
+
+sfxhnd_t snd_sfx_load_fd(file_t fd, size_t len, uint32_t rate, uint16_t bitsize, uint16_t channels) {
+    snd_effect_t *effect = sfx_load_fd(fd, len, rate, bitsize, channels);
+
+    if(!effect)
+        return SFXHND_INVALID;
+
+    return sfx_register(effect, NULL, bitsize, channels);
 }
 
 /* Load a sound effect from a WAV file and return a handle to it */
@@ -620,9 +944,8 @@ sfxhnd_t snd_sfx_load_buf(char *buf) {
 
     /* Finish up and return the sound effect handle */
     free(wav_data);
-    LIST_INSERT_HEAD(&snd_effects, effect, list);
 
-    return (sfxhnd_t)effect;
+    return sfx_register(effect, NULL, 0, 0);
 }
 
 sfxhnd_t snd_sfx_load_raw_buf(char *buf, size_t len, uint32_t rate, uint16_t bitsize, uint16_t channels) {
@@ -669,7 +992,7 @@ sfxhnd_t snd_sfx_load_raw_buf(char *buf, size_t len, uint32_t rate, uint16_t bit
         dbglog(DBG_WARNING, "snd_sfx_load_raw_buf: PCM buffer is over 65534 samples\n");
     }
 
-    effect->locl = snd_mem_malloc(chan_len);
+    effect->locl = sfx_mem_malloc(chan_len, effect);
 
     if(!effect->locl) {
         goto err_occurred;
@@ -685,7 +1008,7 @@ sfxhnd_t snd_sfx_load_raw_buf(char *buf, size_t len, uint32_t rate, uint16_t bit
     }
 
     if(channels > 1) {
-        effect->locr = snd_mem_malloc(chan_len);
+        effect->locr = sfx_mem_malloc(chan_len, effect);
 
         if(!effect->locr) {
             goto err_occurred;
@@ -703,8 +1026,7 @@ sfxhnd_t snd_sfx_load_raw_buf(char *buf, size_t len, uint32_t rate, uint16_t bit
         free(tmp_buff);
     }
 
-    LIST_INSERT_HEAD(&snd_effects, effect, list);
-    return (sfxhnd_t)effect;
+    return sfx_register(effect, NULL, bitsize, channels);
 
 err_occurred:
     if(effect->locl)
@@ -718,6 +1040,10 @@ err_occurred:
     return SFXHND_INVALID;
 }
 
+uint32_t snd_sfx_get_rate(sfxhnd_t idx) {
+    return ((snd_effect_t *)idx)->rate;
+}
+
 int snd_sfx_play_chn(int chn, sfxhnd_t idx, int vol, int pan) {
     sfx_play_data_t data = {0};
     data.chn = chn;
@@ -763,19 +1089,172 @@ int snd_sfx_play(sfxhnd_t idx, int vol, int pan) {
     return snd_sfx_play_ex(&data);
 }
 
-int snd_sfx_play_ex(sfx_play_data_t *data) {
-    if(data->chn < 0) {
-        data->chn = find_free_channel();
-        if(data->chn < 0) {
-            return -1;
+/* Can a voice width channels wide start at chn without cutting anything? */
+static int chn_idle(int chn, int width, uint64_t now) {
+    int i;
+
+    for(i = chn; i < chn + width; i++) {
+        if(i >= 64 || (sfx_inuse & (1ULL << i)) || voices[i].end > now)
+            return 0;
+    }
+
+    return 1;
+}
+
+static int find_idle(int width, uint64_t now) {
+    int i, chn;
+
+    for(i = 0; i < 64; i++) {
+        chn = (sfx_nextchan + i) % 64;
+
+        if(chn_idle(chn, width, now)) {
+            sfx_nextchan = (chn + width) % 64;
+            return chn;
         }
     }
 
-    uint32_t size;
+    return -1;
+}
+
+/* Is a a better voice to cut than b? Lower priorities go first, then the
+   quieter, then the older. */
+static int steal_before(const sfx_voice_t *a, const sfx_voice_t *b) {
+    if(a->prio != b->prio)
+        return a->prio < b->prio;
+
+    if(a->vol != b->vol)
+        return a->vol < b->vol;
+
+    return a->start < b->start;
+}
+
+/* Find the playing voice to cut for a new one, from a category if cat is
+   not negative. */
+static int find_victim(int prio, int cat, int width, uint64_t now) {
+    sfx_voice_t *v;
+    int i, best = -1;
+
+    for(i = 0; i < 64; i++) {
+        v = voices + i;
+
+        if(v->second || v->end <= now || v->prio > prio ||
+           (sfx_inuse & (1ULL << i)))
+            continue;
+
+        if(cat >= 0 && v->cat != cat)
+            continue;
+
+        /* It has to leave room for the new voice. */
+        if(width > v->width && !chn_idle(i + v->width, width - v->width, now))
+            continue;
+
+        if(best < 0 || steal_before(v, voices + best))
+            best = i;
+    }
+
+    return best;
+}
+
+static void voice_stop(int chn) {
+    int i, width = voices[chn].width;
+
+    for(i = chn; i < chn + width; i++)
+        snd_sfx_stop(i);
+}
+
+/* Pick the channel(s) for a new voice, cutting another voice if need be.
+   The voice mutex must be held. */
+static int voice_alloc(int prio, int cat, int width) {
+    uint64_t now = timer_ms_gettime64();
+    int chn, i, n = 0;
+
+    if(cat_limit[cat]) {
+        for(i = 0; i < 64; i++) {
+            if(!voices[i].second && voices[i].end > now && voices[i].cat == cat)
+                n++;
+        }
+
+        if(n >= cat_limit[cat]) {
+            if((chn = find_victim(prio, cat, 0, now)) < 0)
+                return -1;
+
+            voice_stop(chn);
+        }
+    }
+
+    if((chn = find_idle(width, now)) >= 0)
+        return chn;
+
+    if((chn = find_victim(prio, -1, width, now)) < 0)
+        return -1;
+
+    voice_stop(chn);
+
+    return chn;
+}
+
+int snd_sfx_set_voice_limit(int category, int count) {
+    if(category < 0 || category >= SND_SFX_CATEGORIES || count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    cat_limit[category] = count;
+    return 0;
+}
+
+void snd_sfx_batch_begin(void) {
+    snd_sh4_to_aica_stop();
+    sfx_batching = 1;
+}
+
+void snd_sfx_batch_end(void) {
+    sfx_batching = 0;
+    snd_sh4_to_aica_start();
+}
+
+int snd_sfx_play_ex(sfx_play_data_t *data) {
+    uint32_t size, freq;
+    uint64_t now;
     snd_effect_t *t = (snd_effect_t *)data->idx;
+    int sync, i, width;
     AICA_CMDSTR_CHANNEL(tmp, cmd, chan);
 
+    if(data->category < 0 || data->category >= SND_SFX_CATEGORIES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Bring the sample back in if it was evicted */
+    if(!t->locl && sfx_reload(t) < 0) {
+        dbglog(DBG_ERROR, "snd_sfx_play: can't reload %s\n", t->path);
+        return -1;
+    }
+
+    width = t->stereo ? 2 : 1;
+
+    /* Both sides of a stereo effect are keyed on together, which a batch
+       does already. */
+    sync = t->stereo && !sfx_batching;
+
+    if(sync)
+        snd_sh4_to_aica_stop();
+
+    mutex_lock(&voice_mutex);
+
+    if(data->chn < 0 &&
+       (data->chn = voice_alloc(data->priority, data->category, width)) < 0) {
+        mutex_unlock(&voice_mutex);
+
+        if(sync)
+            snd_sh4_to_aica_start();
+
+        errno = EBUSY;
+        return -1;
+    }
+
     size = t->len;
+    freq = data->freq > 0 ? (uint32_t)data->freq : t->rate;
 
     if(size >= 65535) size = 65534;
 
@@ -790,7 +1269,7 @@ int snd_sfx_play_ex(sfx_play_data_t *data) {
     chan->loop = data->loop;
     chan->loopstart = data->loopstart;
     chan->loopend = data->loopend ? data->loopend : size;
-    chan->freq = data->freq > 0 ? (uint32_t)data->freq : t->rate;
+    chan->freq = freq;
     chan->vol = data->vol;
 
     if(!t->stereo) {
@@ -799,17 +1278,36 @@ int snd_sfx_play_ex(sfx_play_data_t *data) {
     }
     else {
         chan->pan = 0;
-
-        snd_sh4_to_aica_stop();
         snd_sh4_to_aica(tmp, cmd->size);
 
         cmd->cmd_id = data->chn + 1;
         chan->base = t->locr;
         chan->pan = 255;
         snd_sh4_to_aica(tmp, cmd->size);
-        snd_sh4_to_aica_start();
     }
 
+    /* Remember until when the sample is in use, so that it isn't evicted
+       while playing, and what's playing, for picking voices to cut. */
+    now = timer_ms_gettime64();
+    t->last_used = now;
+
+    for(i = 0; i < width && data->chn + i < 64; i++) {
+        voices[data->chn + i].effect = i ? NULL : t;
+        voices[data->chn + i].start = now;
+        voices[data->chn + i].end = data->loop ? UINT64_MAX :
+                         now + (uint64_t)size * 1000 / (freq ? freq : 1) + 1;
+        voices[data->chn + i].prio = data->priority;
+        voices[data->chn + i].cat = data->category;
+        voices[data->chn + i].vol = data->vol;
+        voices[data->chn + i].width = i ? 0 : width;
+        voices[data->chn + i].second = i;
+    }
+
+    mutex_unlock(&voice_mutex);
+
+    if(sync)
+        snd_sh4_to_aica_start();
+
     return data->chn;
 }
 
@@ -830,6 +1328,11 @@ void snd_sfx_stop(int chn) {
     chan->vol = 0;
     chan->pan = 0;
     snd_sh4_to_aica(tmp, cmd->size);
+
+    if(chn >= 0 && chn < 64) {
+        voices[chn].effect = NULL;
+        voices[chn].end = 0;
+    }
 }
 
 void snd_sfx_stop_all(void) {
@@ -0,0 +1,156 @@
+/* KallistiOS ##version##
+
+   snd_spatial.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   Positional audio. Distances come from fipr and a single fsrra each,
+   which also gives the direction from the listener to the emitter that
+   panning and doppler shift are dot products with.
+*/
+
+#include <errno.h>
+
+#include <dc/fmath.h>
+#include <dc/sound/sound.h>
+#include <dc/sound/sfxmgr.h>
+#include <dc/sound/spatial.h>
+#include <kos/thread.h>
+
+#include "arm/aica_cmd_iface.h"
+
+/* Emitters sent to the AICA in one go */
+#define SPATIAL_BATCH   32
+
+/* Furthest a doppler shift goes from the sample's own pitch */
+#define PITCH_MIN       0.5f
+#define PITCH_MAX       2.0f
+
+static snd_cmd_batch_t batch;
+
+static void spatial_params(const snd_listener_t *l, const snd_emitter_t *e,
+                           int *vol, int *pan, float *pitch) {
+    float dx = e->pos.x - l->pos.x;
+    float dy = e->pos.y - l->pos.y;
+    float dz = e->pos.z - l->pos.z;
+    float d2 = fipr_magnitude_sqr(dx, dy, dz, 0.0f), inv, dist, gain, c, vl, ve;
+
+    *pitch = 1.0f;
+
+    if(d2 <= e->min_dist * e->min_dist) {
+        /* Close enough not to have a direction worth speaking of */
+        *vol = e->vol;
+        *pan = 128;
+
+        if(d2 < 1e-6f)
+            return;
+
+        gain = 1.0f;
+        inv = frsqrt(d2);
+    }
+    else {
+        inv = frsqrt(d2);
+        dist = d2 * inv;
+
+        if(dist >= e->max_dist) {
+            *vol = 0;
+            *pan = 128;
+            return;
+        }
+
+        gain = e->min_dist * inv * (e->max_dist - dist) /
+               (e->max_dist - e->min_dist);
+        *vol = (int)(e->vol * gain);
+        *pan = 128 + (int)(fipr(dx, dy, dz, 0.0f, l->right.x, l->right.y,
+                                l->right.z, 0.0f) * inv * 127.0f);
+    }
+
+    if((c = l->speed_of_sound) > 0.0f) {
+        /* Speeds towards each other along the line between them */
+        vl = fipr(l->vel.x, l->vel.y, l->vel.z, 0.0f, dx, dy, dz, 0.0f) * inv;
+        ve = fipr(e->vel.x, e->vel.y, e->vel.z, 0.0f, dx, dy, dz, 0.0f) * inv;
+
+        if(c + ve <= c * PITCH_MIN)
+            *pitch = PITCH_MAX;
+        else
+            *pitch = (c + vl) / (c + ve);
+
+        if(*pitch < PITCH_MIN)
+            *pitch = PITCH_MIN;
+        else if(*pitch > PITCH_MAX)
+            *pitch = PITCH_MAX;
+    }
+}
+
+static inline int clamp255(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+int snd_spatial_play(const snd_listener_t *l, snd_emitter_t *e) {
+    sfx_play_data_t data = {0};
+    float pitch;
+
+    spatial_params(l, e, &data.vol, &data.pan, &pitch);
+
+    data.chn = -1;
+    data.idx = e->sfx;
+    data.vol = clamp255(data.vol);
+    data.pan = clamp255(data.pan);
+    data.freq = (int)(snd_sfx_get_rate(e->sfx) * pitch);
+    data.loop = e->loop;
+    data.priority = e->priority;
+    data.category = e->category;
+
+    return e->chn = snd_sfx_play_ex(&data);
+}
+
+void snd_spatial_stop(snd_emitter_t *e) {
+    if(e->chn < 0)
+        return;
+
+    snd_sfx_stop(e->chn);
+    e->chn = -1;
+}
+
+static void spatial_submit(void) {
+    /* The AICA takes commands as quickly as it can; wait for room. */
+    while(snd_cmd_batch_submit(&batch) < 0 && errno == EAGAIN)
+        thd_pass();
+}
+
+int snd_spatial_update(const snd_listener_t *l, snd_emitter_t *e, size_t count) {
+    AICA_CMDSTR_CHANNEL(tmp, cmd, chan);
+    float pitch;
+    int vol, pan;
+    size_t i;
+
+    if(!batch.buf &&
+       snd_cmd_batch_init(&batch, SPATIAL_BATCH * AICA_CMDSTR_CHANNEL_SIZE) < 0)
+        return -1;
+
+    cmd->cmd = AICA_CMD_CHAN;
+    cmd->timestamp = 0;
+    cmd->size = AICA_CMDSTR_CHANNEL_SIZE;
+    chan->cmd = AICA_CH_CMD_UPDATE | AICA_CH_UPDATE_SET_FREQ |
+                AICA_CH_UPDATE_SET_VOL | AICA_CH_UPDATE_SET_PAN;
+
+    for(i = 0; i < count; i++) {
+        if(e[i].chn < 0)
+            continue;
+
+        spatial_params(l, e + i, &vol, &pan, &pitch);
+
+        cmd->cmd_id = e[i].chn;
+        chan->vol = clamp255(vol);
+        chan->pan = clamp255(pan);
+        chan->freq = (uint32_t)(snd_sfx_get_rate(e[i].sfx) * pitch);
+
+        if(snd_cmd_batch_add(&batch, tmp, cmd->size) < 0) {
+            spatial_submit();
+            snd_cmd_batch_add(&batch, tmp, cmd->size);
+        }
+    }
+
+    spatial_submit();
+
+    return 0;
+}
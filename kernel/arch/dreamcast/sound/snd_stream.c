@@ -11,6 +11,7 @@
 */
 
 #include <assert.h>
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -19,9 +20,13 @@
 #include <sys/queue.h>
 
 #include <kos/dbglog.h>
+#include <kos/mem_tags.h>
 #include <kos/sem.h>
 #include <kos/thread.h>
 #include <arch/cache.h>
+#include <arch/memory.h>
+#include <dc/asic.h>
+#include <dc/fmath.h>
 #include <kos/timer.h>
 #include <dc/g2bus.h>
 #include <dc/sq.h>
@@ -52,6 +57,26 @@ typedef struct filter {
     void *data;
 } filter_t;
 
+/* Most phases of a resampler, and so the largest up in a ratio */
+#define RESAMPLE_MAX_PHASES 512
+
+/* Polyphase resampler: each output sample falls at phase / up of the way
+   from input sample pos to the next one, and is the dot product of the taps
+   input samples up to pos with that phase's coefficients. */
+typedef struct resampler {
+    int up, down;           /* up output samples for each down input ones */
+    int step, frac;         /* down / up and down % up */
+    int taps;
+    float *coefs;           /* up phases of taps coefficients */
+
+    float *hist[2];         /* Input samples, per channel */
+    int size, fill;         /* Room in hist, and samples in it */
+    int pos, phase;         /* Where the next output sample falls */
+
+    int16_t *out;
+    int out_size;
+} resampler_t;
+
 /* Each of these represents an active streaming channel */
 typedef struct strchan {
     /* Which AICA channels are we using? */
@@ -74,9 +99,17 @@ typedef struct strchan {
        buffers of AICA channels directly. */
     snd_stream_callback_direct_t req_data;
 
+    /* "Decode data" callback; we'll call this any time we want another
+       buffer of output data already split into channels, in our
+       separation buffers. */
+    snd_stream_callback_split_t split_data;
+
     /* Our list of filter callback functions for this stream */
     TAILQ_HEAD(filterlist, filter) filters;
 
+    /* Resampler for what get_data gives, or NULL */
+    resampler_t *rs;
+
     /* Sample type */
     int type;
 
@@ -96,6 +129,15 @@ typedef struct strchan {
     /* Have we been initialized yet? (and reserved a buffer, etc) */
     volatile int initted;
 
+    /* Refilled by the stream thread when the AICA says so */
+    int autofill;
+
+    /* Scheduled start: the next start is set for start_at, and a start
+       that has been set for it hasn't keyed on yet. */
+    int start_sched;
+    int start_wait;
+    uint32_t start_at;
+
     /* User data. */
     void *user_data;
 
@@ -114,6 +156,21 @@ static semaphore_t stream_sem = SEM_INITIALIZER(1);
 static int max_channels = 0;
 static size_t max_buffer_size = 0;
 
+/* Is the SPU interrupt hooked for refills? Drivers that can't raise it get
+   a thread polling the streams instead. */
+static int irq_hooked = 0;
+static kthread_t *poll_thd = NULL;
+static volatile int poll_quit = 0;
+
+/* How often that thread polls, well inside the quarter of a buffer the
+   interrupt would give */
+#define AUTOFILL_POLL_MS    10
+
+/* The AICA's interrupt registers for the SH-4, and the bit the ARM sets */
+#define AICA_MCIEB      (MEM_AREA_P2_BASE + 0x007028b4)
+#define AICA_MCIRE      (MEM_AREA_P2_BASE + 0x007028bc)
+#define AICA_MCI_SCPU   0x20
+
 /* Check an incoming handle */
 #define CHECK_HND(x) do { \
         assert( (x) >= 0 && (x) < SND_STREAM_MAX ); \
@@ -157,6 +214,11 @@ void snd_stream_set_callback_direct(snd_stream_hnd_t hnd, snd_stream_callback_di
     streams[hnd].req_data = cb;
 }
 
+void snd_stream_set_callback_split(snd_stream_hnd_t hnd, snd_stream_callback_split_t cb) {
+    CHECK_HND(hnd);
+    streams[hnd].split_data = cb;
+}
+
 void snd_stream_set_userdata(snd_stream_hnd_t hnd, void *d) {
     CHECK_HND(hnd);
     streams[hnd].user_data = d;
@@ -200,6 +262,266 @@ static inline void process_filters(snd_stream_hnd_t hnd, void **buffer, int *sam
     }
 }
 
+static void resampler_free(resampler_t *rs) {
+    if(!rs)
+        return;
+
+    free(rs->coefs);
+    free(rs->hist[0]);
+    free(rs->hist[1]);
+    free(rs->out);
+    free(rs);
+}
+
+/* Start over with silence before the first input sample, so that the first
+   output sample is centered on it */
+static void resampler_reset(resampler_t *rs) {
+    rs->fill = rs->taps / 2 - 1;
+    rs->pos = rs->taps - 1;
+    rs->phase = 0;
+    memset(rs->hist[0], 0, rs->fill * sizeof(float));
+    memset(rs->hist[1], 0, rs->fill * sizeof(float));
+}
+
+static int resampler_grow(resampler_t *rs, int size) {
+    float *h;
+    int i;
+
+    if(size <= rs->size)
+        return 0;
+
+    for(i = 0; i < 2; i++) {
+        if(!(h = realloc(rs->hist[i], size * sizeof(float))))
+            return -1;
+
+        rs->hist[i] = h;
+    }
+
+    rs->size = size;
+    return 0;
+}
+
+/* Blackman windowed sinc, for each phase, normalized so that each of them
+   lets DC through as it is. The cutoff is at the lower of the two rates. */
+static void resampler_coefs(resampler_t *rs, float rolloff) {
+    float cutoff = 0.5f * rolloff, u, d, v, sum;
+    int p, i;
+
+    if(rs->down > rs->up)
+        cutoff = cutoff * rs->up / rs->down;
+
+    for(p = 0; p < rs->up; p++) {
+        float *h = rs->coefs + p * rs->taps;
+
+        for(i = 0, sum = 0.0f; i < rs->taps; i++) {
+            u = (float)p / rs->up + (rs->taps - 1 - i);
+            d = u - rs->taps / 2.0f;
+            v = d == 0.0f ? 2.0f * cutoff :
+                sinf(2.0f * F_PI * cutoff * d) / (F_PI * d);
+            v *= 0.42f - 0.5f * cosf(2.0f * F_PI * u / rs->taps) +
+                 0.08f * cosf(4.0f * F_PI * u / rs->taps);
+            h[i] = v;
+            sum += v;
+        }
+
+        for(i = 0; i < rs->taps; i++)
+            h[i] /= sum;
+    }
+}
+
+static inline int16_t resampler_clip(float v) {
+    if(v >= 32767.0f)
+        return 32767;
+    else if(v <= -32768.0f)
+        return -32768;
+
+    return (int16_t)v;
+}
+
+/* Make up to frames output samples from the input there is. Inlined with
+   taps a constant, so the fipr dot products are unrolled. */
+static inline __attribute__((always_inline))
+int resampler_run(resampler_t *rs, int chans, int frames, const int taps) {
+    int n = 0, c, k, pos = rs->pos, phase = rs->phase;
+
+    while(n < frames && pos < rs->fill) {
+        const float *h = rs->coefs + phase * taps;
+
+        for(c = 0; c < chans; c++) {
+            const float *x = rs->hist[c] + pos - (taps - 1);
+            float acc = 0.0f;
+
+            for(k = 0; k < taps; k += 4)
+                acc += fipr(x[k], x[k + 1], x[k + 2], x[k + 3],
+                            h[k], h[k + 1], h[k + 2], h[k + 3]);
+
+            rs->out[n * chans + c] = resampler_clip(acc);
+        }
+
+        n++;
+        pos += rs->step;
+        phase += rs->frac;
+
+        if(phase >= rs->up) {
+            phase -= rs->up;
+            pos++;
+        }
+    }
+
+    rs->pos = pos;
+    rs->phase = phase;
+    return n;
+}
+
+/* Stands in for get_data on resampled streams */
+static void *resampler_get_data(snd_stream_hnd_t hnd, int needed_bytes,
+                                int *got_bytes) {
+    strchan_t *stream = &streams[hnd];
+    resampler_t *rs = stream->rs;
+    const int chans = stream->channels;
+    int frames = needed_bytes / (2 * chans);
+    int want, got = 0, i, c, n, shift;
+    int16_t *in;
+
+    *got_bytes = 0;
+
+    if(frames <= 0)
+        return NULL;
+
+    /* Read in up to where the last sample asked for falls */
+    want = rs->pos + (int)(((int64_t)(frames - 1) * rs->down + rs->phase) /
+                           rs->up) + 1 - rs->fill;
+
+    if(want > 0) {
+        if(resampler_grow(rs, rs->fill + want) < 0)
+            return NULL;
+
+        in = stream->get_data(hnd, want * 2 * chans, &got);
+        got = in ? got / (2 * chans) : 0;
+
+        if(got > want)
+            got = want;
+
+        for(c = 0; c < chans; c++) {
+            float *h = rs->hist[c] + rs->fill;
+
+            for(i = 0; i < got; i++)
+                h[i] = in[i * chans + c];
+        }
+
+        rs->fill += got;
+    }
+
+    if(rs->out_size < needed_bytes) {
+        free(rs->out);
+        rs->out_size = 0;
+
+        if(!(rs->out = aligned_alloc(32, __align_up(needed_bytes, 32))))
+            return NULL;
+
+        rs->out_size = needed_bytes;
+    }
+
+    switch(rs->taps) {
+        case 4:
+            n = resampler_run(rs, chans, frames, 4);
+            break;
+        case 8:
+            n = resampler_run(rs, chans, frames, 8);
+            break;
+        default:
+            n = resampler_run(rs, chans, frames, 16);
+            break;
+    }
+
+    /* Keep what the next output samples need */
+    shift = rs->pos - (rs->taps - 1);
+
+    if(shift > rs->fill)
+        shift = rs->fill;
+
+    if(shift > 0) {
+        for(c = 0; c < chans; c++)
+            memmove(rs->hist[c], rs->hist[c] + shift,
+                    (rs->fill - shift) * sizeof(float));
+
+        rs->fill -= shift;
+        rs->pos -= shift;
+    }
+
+    if(!n)
+        return NULL;
+
+    *got_bytes = n * 2 * chans;
+    return rs->out;
+}
+
+static int gcd(int a, int b) {
+    while(b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+
+    return a;
+}
+
+int snd_stream_resample(snd_stream_hnd_t hnd, uint32_t src_rate,
+                        uint32_t dst_rate, int quality) {
+    static const int taps[] = { 4, 8, 16 };
+    static const float rolloff[] = { 0.8f, 0.9f, 0.95f };
+    resampler_t *rs;
+    int g;
+
+    CHECK_HND(hnd);
+
+    mem_tag_scoped(MEM_TAG_SOUND);
+
+    if(!src_rate) {
+        resampler_free(streams[hnd].rs);
+        streams[hnd].rs = NULL;
+        return 0;
+    }
+
+    if(!dst_rate || quality < SND_STREAM_RESAMPLE_FAST ||
+       quality > SND_STREAM_RESAMPLE_BEST) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    g = gcd(src_rate, dst_rate);
+
+    if(dst_rate / g > RESAMPLE_MAX_PHASES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!(rs = calloc(1, sizeof(resampler_t)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    rs->up = dst_rate / g;
+    rs->down = src_rate / g;
+    rs->step = rs->down / rs->up;
+    rs->frac = rs->down % rs->up;
+    rs->taps = taps[quality];
+
+    if(!(rs->coefs = malloc(rs->up * rs->taps * sizeof(float))) ||
+       resampler_grow(rs, rs->taps * 64) < 0) {
+        resampler_free(rs);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    resampler_coefs(rs, rolloff[quality]);
+    resampler_reset(rs);
+
+    resampler_free(streams[hnd].rs);
+    streams[hnd].rs = rs;
+    return 0;
+}
+
 static void snd_pcm16_split_unaligned(void *buffer, void *left, void *right, size_t len) {
     uint32_t *buf = (uint32_t *)buffer;
     uint32_t *left_ptr = (uint32_t *)left;
@@ -324,6 +646,7 @@ int snd_stream_init(void) {
 }
 
 int snd_stream_init_ex(int channels, size_t buffer_size) {
+    mem_tag_scoped(MEM_TAG_SOUND);
 
     if(max_channels) {
         if(channels > max_channels) {
@@ -376,6 +699,8 @@ snd_stream_hnd_t snd_stream_alloc(snd_stream_callback_t cb, int bufsize) {
     int i;
     snd_stream_hnd_t hnd;
 
+    mem_tag_scoped(MEM_TAG_SOUND);
+
     /* Get an unused handle */
     hnd = -1;
 
@@ -400,6 +725,7 @@ snd_stream_hnd_t snd_stream_alloc(snd_stream_callback_t cb, int bufsize) {
     /* Setup the callback */
     snd_stream_set_callback(hnd, cb);
     snd_stream_set_callback_direct(hnd, NULL);
+    snd_stream_set_callback_split(hnd, NULL);
 
     /* Initialize our filter chain list */
     TAILQ_INIT(&streams[hnd].filters);
@@ -428,6 +754,7 @@ snd_stream_hnd_t snd_stream_reinit(snd_stream_hnd_t hnd, snd_stream_callback_t c
     /* Setup the callback */
     snd_stream_set_callback(hnd, cb);
     snd_stream_set_callback_direct(hnd, NULL);
+    snd_stream_set_callback_split(hnd, NULL);
 
     return hnd;
 }
@@ -460,6 +787,8 @@ void snd_stream_destroy(snd_stream_hnd_t hnd) {
 
     TAILQ_INIT(&streams[hnd].filters);
 
+    resampler_free(streams[hnd].rs);
+
     snd_mem_free(streams[hnd].spu_ram_sch[0]);
     // dbglog(DBG_INFO, "snd_stream: dealloc'd channels %d/%d\n", streams[hnd].ch[0], streams[hnd].ch[1]);
     memset(streams + hnd, 0, sizeof(streams[0]));
@@ -467,11 +796,121 @@ void snd_stream_destroy(snd_stream_hnd_t hnd) {
     sem_signal(&stream_sem);
 }
 
+/* The ARM interrupts us when a channel it was asked to watch passes a
+   quarter of its buffer. This runs in the threaded handler's thread. */
+static void stream_irq(uint32_t code, void *data) {
+    uint32_t pkt[AICA_CMD_MAX_SIZE];
+    aica_cmd_t *cmd = (aica_cmd_t *)pkt;
+    int i;
+
+    (void)code;
+    (void)data;
+
+    while(snd_aica_to_sh4(pkt) > 0) {
+        if(cmd->cmd != AICA_RESP_CHAN_POS)
+            continue;
+
+        for(i = 0; i < SND_STREAM_MAX; i++) {
+            if(streams[i].initted && streams[i].autofill &&
+               streams[i].ch[0] == (int)cmd->cmd_id) {
+                snd_stream_poll(i);
+            }
+        }
+    }
+}
+
+static void stream_irq_ack(uint16_t code) {
+    (void)code;
+    g2_write_32(AICA_MCIRE, AICA_MCI_SCPU);
+}
+
+static void *stream_poll_thd(void *data) {
+    int i;
+
+    (void)data;
+
+    while(!poll_quit) {
+        for(i = 0; i < SND_STREAM_MAX; i++) {
+            if(streams[i].initted && streams[i].autofill) {
+                snd_stream_poll(i);
+            }
+        }
+
+        thd_sleep(AUTOFILL_POLL_MS);
+    }
+
+    return NULL;
+}
+
+static int stream_refill_start(void) {
+    const kthread_attr_t attr = {
+        .label = "snd_stream_poll"
+    };
+
+    if(irq_hooked || poll_thd) {
+        return 0;
+    }
+
+    if(!(snd_driver_caps() & AICA_CAP_CHAN_POS)) {
+        poll_quit = 0;
+
+        if(!(poll_thd = thd_create_ex(&attr, stream_poll_thd, NULL))) {
+            dbglog(DBG_ERROR, "snd_stream_autofill(): can't start the stream thread\n");
+            return -1;
+        }
+
+        return 0;
+    }
+
+    if(asic_evt_request_threaded_handler(ASIC_EVT_SPU_IRQ, stream_irq, NULL,
+                                         stream_irq_ack, NULL) < 0) {
+        dbglog(DBG_ERROR, "snd_stream_autofill(): can't start the stream thread\n");
+        return -1;
+    }
+
+    g2_write_32(AICA_MCIRE, AICA_MCI_SCPU);
+    g2_write_32(AICA_MCIEB, g2_read_32(AICA_MCIEB) | AICA_MCI_SCPU);
+    asic_evt_enable(ASIC_EVT_SPU_IRQ, ASIC_IRQ_DEFAULT);
+    irq_hooked = 1;
+
+    return 0;
+}
+
+static void stream_refill_stop(void) {
+    if(poll_thd) {
+        poll_quit = 1;
+        thd_join(poll_thd, NULL);
+        poll_thd = NULL;
+    }
+
+    if(!irq_hooked) {
+        return;
+    }
+
+    g2_write_32(AICA_MCIEB, g2_read_32(AICA_MCIEB) & ~AICA_MCI_SCPU);
+    asic_evt_disable(ASIC_EVT_SPU_IRQ, ASIC_IRQ_DEFAULT);
+    asic_evt_remove_handler(ASIC_EVT_SPU_IRQ);
+    irq_hooked = 0;
+}
+
+int snd_stream_autofill(snd_stream_hnd_t hnd, int enable) {
+    CHECK_HND(hnd);
+
+    if(enable && stream_refill_start() < 0) {
+        return -1;
+    }
+
+    streams[hnd].autofill = enable;
+    return 0;
+}
+
 /* Shut everything down and free mem */
 void snd_stream_shutdown(void) {
     /* Stop and destroy all active stream */
     int i;
 
+    stream_refill_stop();
+
     for(i = 0; i < SND_STREAM_MAX; i++) {
         if(streams[i].initted)
             snd_stream_destroy(i);
@@ -505,7 +944,8 @@ static void snd_stream_start_type(snd_stream_hnd_t hnd, uint32_t type, uint32_t
 
     CHECK_HND(hnd);
 
-    if(!streams[hnd].get_data && !streams[hnd].req_data) {
+    if(!streams[hnd].get_data && !streams[hnd].req_data &&
+       !streams[hnd].split_data) {
         return;
     }
 
@@ -513,6 +953,9 @@ static void snd_stream_start_type(snd_stream_hnd_t hnd, uint32_t type, uint32_t
     streams[hnd].channels = st ? 2 : 1;
     streams[hnd].frequency = freq;
 
+    if(streams[hnd].rs)
+        resampler_reset(streams[hnd].rs);
+
     if(streams[hnd].channels > max_channels) {
         dbglog(DBG_ERROR, "snd_stream_start_type: initted only for mono\n");
         return;
@@ -556,6 +999,7 @@ static void snd_stream_start_type(snd_stream_hnd_t hnd, uint32_t type, uint32_t
     cmd->size = AICA_CMDSTR_CHANNEL_SIZE;
     cmd->cmd_id = streams[hnd].ch[0];
     chan->cmd = AICA_CH_CMD_START | AICA_CH_START_DELAY;
+    chan->keyon = 0;
     chan->base = streams[hnd].spu_ram_sch[0];
     chan->type = type;
     chan->length = bytes_to_samples(hnd, streams[hnd].buffer_size);
@@ -565,7 +1009,13 @@ static void snd_stream_start_type(snd_stream_hnd_t hnd, uint32_t type, uint32_t
     chan->freq = freq;
     chan->vol = 255;
     chan->pan = streams[hnd].channels == 2 ? 0 : 128;
+
+    /* Only the first channel needs watching for refills. */
+    if(streams[hnd].autofill && irq_hooked) {
+        chan->cmd |= AICA_CH_START_NOTIFY;
+    }
     snd_sh4_to_aica(tmp, cmd->size);
+    chan->cmd &= ~AICA_CH_START_NOTIFY;
 
     if(streams[hnd].channels == 2) {
         /* Channel 1 */
@@ -584,6 +1034,17 @@ static void snd_stream_start_type(snd_stream_hnd_t hnd, uint32_t type, uint32_t
     }
 
     chan->cmd = AICA_CH_CMD_START | AICA_CH_START_SYNC;
+
+    if(streams[hnd].start_sched) {
+        chan->cmd |= AICA_CH_START_AT;
+        chan->keyon = streams[hnd].start_at;
+        streams[hnd].start_sched = 0;
+        streams[hnd].start_wait = 1;
+    }
+    else {
+        streams[hnd].start_wait = 0;
+    }
+
     snd_sh4_to_aica(tmp, cmd->size);
 
     /* Process the changes */
@@ -603,6 +1064,64 @@ void snd_stream_start_adpcm(snd_stream_hnd_t hnd, uint32_t freq, int st) {
     snd_stream_start_type(hnd, AICA_SM_ADPCM_LS, freq, st);
 }
 
+int snd_stream_set_start_time(snd_stream_hnd_t hnd, uint32_t when) {
+    CHECK_HND(hnd);
+
+    /* Older drivers would start it straight away. */
+    if(!(snd_driver_caps() & AICA_CAP_SAMPLE_CLOCK)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    streams[hnd].start_at = when;
+    streams[hnd].start_sched = 1;
+    return 0;
+}
+
+/* The AICA plays at 44.1kHz * 2^hi * lo / 1024, worked out the way the
+   driver does it, so that the clock keeps up with the actual pitch rather
+   than drifting away from it with the rounding. */
+int64_t snd_stream_clock(snd_stream_hnd_t hnd) {
+    uint32_t keyon, freq, freq_lo, freq_base = 5644800;
+    int32_t elapsed;
+    int freq_hi = 7;
+
+    CHECK_HND(hnd);
+
+    if(!(snd_driver_caps() & AICA_CAP_SAMPLE_CLOCK)) {
+        return 0;
+    }
+
+    keyon = g2_read_32(SPU_RAM_UNCACHED_BASE + AICA_CHANNEL(streams[hnd].ch[0]) +
+                       offsetof(aica_channel_t, keyon));
+
+    if(keyon) {
+        streams[hnd].start_wait = 0;
+        elapsed = (int32_t)(snd_sample_clock() - keyon);
+    }
+    else if(streams[hnd].start_wait) {
+        elapsed = (int32_t)(snd_sample_clock() - streams[hnd].start_at);
+
+        /* Keyed on in the meantime */
+        if(elapsed > 0)
+            elapsed = 0;
+    }
+    else {
+        return 0;
+    }
+
+    freq = streams[hnd].frequency;
+
+    while(freq < freq_base && freq_hi > -8) {
+        freq_base >>= 1;
+        freq_hi--;
+    }
+
+    freq_lo = (freq << 10) / freq_base;
+
+    return (int64_t)elapsed * freq_lo / (1LL << (10 - freq_hi));
+}
+
 /* Actually make it go (in queued mode) */
 void snd_stream_queue_go(snd_stream_hnd_t hnd) {
     (void)hnd;
@@ -616,7 +1135,8 @@ void snd_stream_stop(snd_stream_hnd_t hnd) {
 
     CHECK_HND(hnd);
 
-    if(!streams[hnd].get_data && !streams[hnd].req_data) {
+    if(!streams[hnd].get_data && !streams[hnd].req_data &&
+       !streams[hnd].split_data) {
         return;
     }
 
@@ -624,6 +1144,8 @@ void snd_stream_stop(snd_stream_hnd_t hnd) {
         snd_sh4_to_aica_stop();
     }
 
+    streams[hnd].start_wait = 0;
+
     /* Stop stream */
     /* Channel 0 */
     cmd->cmd = AICA_CMD_CHAN;
@@ -713,7 +1235,31 @@ static size_t snd_stream_fill(snd_stream_hnd_t hnd, uint32_t offset, size_t size
     if(got_bytes > 0) {
         return got_bytes;
     }
-    if(stream->get_data) {
+
+    /* The decoder writes straight into the separation buffers, which go
+       out by DMA from there. */
+    if(stream->split_data && sep_buffer[0] != NULL) {
+        sem_wait(&stream_sem);
+        got_bytes = stream->split_data(hnd, sep_buffer[0],
+            (chans == 2 ? sep_buffer[1] : NULL), size);
+
+        if(got_bytes > 0) {
+            got_bytes = __align_up(got_bytes, 32);
+
+            if(got_bytes > (int)size) {
+                got_bytes = size;
+            }
+            if(snd_stream_transfer(stream, sep_buffer[0], offset, got_bytes) < 0) {
+                return 0;
+            }
+            return got_bytes * chans;
+        }
+        sem_signal(&stream_sem);
+    }
+    if(stream->rs && stream->bitsize == 16 && stream->get_data) {
+        data = resampler_get_data(hnd, needed_bytes, &got_bytes);
+    }
+    else if(stream->get_data) {
         data = stream->get_data(hnd, needed_bytes, &got_bytes);
     }
 
@@ -796,7 +1342,8 @@ int snd_stream_poll(snd_stream_hnd_t hnd) {
     assert(hnd >= 0 && hnd < SND_STREAM_MAX);
     stream = &streams[hnd];
 
-    if(!stream->initted || (!stream->get_data && !stream->req_data)) {
+    if(!stream->initted || (!stream->get_data && !stream->req_data &&
+                            !stream->split_data)) {
         return -1;
     }
 
@@ -919,3 +1466,20 @@ void snd_stream_pan(snd_stream_hnd_t hnd, int left_pan, int right_pan) {
         snd_sh4_to_aica_start();
     }
 }
+
+int snd_stream_dsp_send(snd_stream_hnd_t hnd, int input, int level) {
+    CHECK_HND(hnd);
+
+    if(max_channels == 2 && input == 15) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(spu_dsp_send(streams[hnd].ch[0], input, level) < 0)
+        return -1;
+
+    if(max_channels == 2)
+        return spu_dsp_send(streams[hnd].ch[1], input + 1, level);
+
+    return 0;
+}
@@ -8,8 +8,11 @@
 #include <string.h>
 #include <errno.h>
 #include <kos/dbgio.h>
+#include <kos/thread.h>
 #include <dc/fb_console.h>
 #include <dc/biosfont.h>
+#include <dc/pvr.h>
+#include <dc/syscalls.h>
 #include <dc/video.h>
 
 /* This is a very simple dbgio interface for doing debug to the framebuffer with
@@ -17,11 +20,32 @@
    the network stack, and I figured other people would probably get some use out
    of it as well. */
 
+/* When drawing to the screen itself, the console takes two screens' worth of
+   VRAM, and writes every row to both halves. Scrolling is then just moving
+   the start of the display down a line, back up to the top half whenever it
+   gets to the bottom one, which holds the same picture. Nothing ever gets
+   copied. If something else moves the display (the PVR, a vid_flip()...),
+   the console goes back to drawing into vram_s and copying it up to
+   scroll. */
+
 static uint16 *fb;
 static int fb_w, fb_h;
 static int cur_x, cur_y;
 static int min_x, min_y, max_x, max_y;
 
+static uint16 *ring;            /* Top of the two halves, or NULL */
+static uint32 ring_base;        /* And its offset in VRAM */
+static int ring_scroll;         /* Row of the ring at the top of the screen */
+
+/* Glyphs are copied out of the BIOS font the first time they're drawn, and
+   drawn four pixels at a time from a table of the 16 ways of coloring them,
+   for the colors in fb_fg and fb_bg. */
+static uint8 glyphs[256][BFONT_BYTES_PER_CHAR];
+static uint32 glyphs_valid[256 / 32];
+static uint32 nibbles[16][2];
+static uint32 fb_fg, fb_bg;
+static bool nibbles_valid;
+
 #define FONT_CHAR_WIDTH 12
 #define FONT_CHAR_HEIGHT 24
 
@@ -55,14 +79,133 @@ static int fb_read(void) {
     return -1;
 }
 
-static int fb_write(int c) {
+/* Check that the display is still where the ring put it. */
+static bool fb_ring_ok(void) {
+    if(ring && PVR_GET(PVR_FB_ADDR) !=
+       ((ring_base + ring_scroll * fb_w * 2) & (PVR_RAM_SIZE - 1)))
+        ring = NULL;
+
+    return ring != NULL;
+}
+
+/* Where a row of the screen is drawn, and the copy of it in the other half of
+   the ring, if there is one. */
+static uint16 *fb_row(int y, uint16 **mirror) {
     uint16 *t = fb;
+    int r;
+
+    *mirror = NULL;
+
+    if(ring) {
+        r = ring_scroll + y;
+        *mirror = ring + (r >= fb_h ? r - fb_h : r + fb_h) * fb_w;
+        return ring + r * fb_w;
+    }
 
     if(!t)
         t = vram_s;
 
+    return t + y * fb_w;
+}
+
+static void fb_clear_rows(int y, int count) {
+    uint16 *row, *mirror;
+
+    for(; count > 0; y++, count--) {
+        row = fb_row(y, &mirror);
+        memset(row, 0, fb_w * 2);
+
+        if(mirror)
+            memset(mirror, 0, fb_w * 2);
+    }
+}
+
+static void fb_update_nibbles(void) {
+    uint32 fg, bg, px[4];
+    int i, j;
+
+    /* There's no getter for the bfont colors. */
+    fg = bfont_set_foreground_color(0);
+    bfont_set_foreground_color(fg);
+    bg = bfont_set_background_color(0);
+    bfont_set_background_color(bg);
+
+    if(nibbles_valid && fg == fb_fg && bg == fb_bg)
+        return;
+
+    for(i = 0; i < 16; i++) {
+        for(j = 0; j < 4; j++)
+            px[j] = (i & (8 >> j)) ? fg & 0xffff : bg & 0xffff;
+
+        nibbles[i][0] = px[0] | (px[1] << 16);
+        nibbles[i][1] = px[2] | (px[3] << 16);
+    }
+
+    fb_fg = fg;
+    fb_bg = bg;
+    nibbles_valid = true;
+}
+
+static const uint8 *fb_glyph(uint8 c) {
+    if(!(glyphs_valid[c / 32] & (1 << (c % 32)))) {
+        while(syscall_font_lock() != 0)
+            thd_pass();
+
+        memcpy(glyphs[c], bfont_find_char(c), BFONT_BYTES_PER_CHAR);
+        syscall_font_unlock();
+
+        glyphs_valid[c / 32] |= 1 << (c % 32);
+    }
+
+    return glyphs[c];
+}
+
+static void fb_draw_char(uint16 *t, uint8 c) {
+    const uint8 *g;
+    uint32 *d = (uint32 *)t, word;
+    int y;
+
+    /* The fast way needs 16bpp and whole words. */
+    if((vid_mode && vid_mode->pm == PM_RGB0888) || ((uintptr_t)t & 3)) {
+        bfont_draw(t, fb_w, 1, c);
+        return;
+    }
+
+    g = fb_glyph(c);
+
+    for(y = 0; y < FONT_CHAR_HEIGHT; y++, d += fb_w / 2) {
+        /* Two 12-pixel rows in three bytes */
+        if(y & 1)
+            word = ((g[1] << 8) & 0xf00) | g[2];
+        else
+            word = (g[0] << 4) | (g[1] >> 4);
+
+        d[0] = nibbles[word >> 8][0];
+        d[1] = nibbles[word >> 8][1];
+        d[2] = nibbles[(word >> 4) & 15][0];
+        d[3] = nibbles[(word >> 4) & 15][1];
+        d[4] = nibbles[word & 15][0];
+        d[5] = nibbles[word & 15][1];
+
+        if(y & 1)
+            g += 3;
+    }
+}
+
+static int fb_write(int c) {
+    uint16 *t, *row, *mirror;
+    int y;
+
+    fb_ring_ok();
+    fb_update_nibbles();
+
     if(c != '\n') {
-        bfont_draw(t + cur_y * fb_w + cur_x, fb_w, 1, c);
+        row = fb_row(cur_y, &mirror);
+        fb_draw_char(row + cur_x, (uint8)c);
+
+        if(mirror)
+            fb_draw_char(mirror + cur_x, (uint8)c);
+
         cur_x += FONT_CHAR_WIDTH;
     }
 
@@ -75,10 +218,28 @@ static int fb_write(int c) {
         /* If going down a line put us over the edge of the screen, move
            everything up a line, fixing the problem. */
         if(cur_y + FONT_CHAR_HEIGHT > max_y) {
-            memcpy(t + min_y * fb_w, t + (min_y + FONT_CHAR_HEIGHT) * fb_w,
-                    (cur_y - min_y - FONT_CHAR_HEIGHT) * fb_w * 2);
             cur_y -= FONT_CHAR_HEIGHT;
-            memset(t + cur_y * fb_w, 0, FONT_CHAR_HEIGHT * fb_w * 2);
+
+            if(ring) {
+                ring_scroll += FONT_CHAR_HEIGHT;
+
+                if(ring_scroll >= fb_h)
+                    ring_scroll -= fb_h;
+
+                vid_set_start(ring_base + ring_scroll * fb_w * 2);
+
+                /* The top line went up into the border, and whatever was
+                   under the bottom border came up into the text. */
+                y = min_y > FONT_CHAR_HEIGHT ? min_y - FONT_CHAR_HEIGHT : 0;
+                fb_clear_rows(y, min_y - y);
+                fb_clear_rows(cur_y, fb_h - cur_y);
+            }
+            else {
+                t = fb ? fb : vram_s;
+                memcpy(t + min_y * fb_w, t + (min_y + FONT_CHAR_HEIGHT) * fb_w,
+                        (cur_y - min_y) * fb_w * 2);
+                memset(t + cur_y * fb_w, 0, FONT_CHAR_HEIGHT * fb_w * 2);
+            }
         }
     }
 
@@ -133,4 +294,21 @@ void dbgio_fb_set_target(uint16 *t, int w, int h, int borderx, int bordery) {
     max_y = fb_h - bordery;
     cur_x = min_x;
     cur_y = min_y;
+
+    /* Scroll the screen itself around a ring if it's single-buffered and
+       there's the VRAM for it. */
+    ring = NULL;
+    ring_scroll = 0;
+
+    if(!t && vid_mode && vid_mode->fb_count == 1 &&
+       vid_mode->pm != PM_RGB0888 && w == vid_mode->width &&
+       h == vid_mode->height) {
+        ring_base = (uintptr_t)vram_s & (PVR_RAM_SIZE - 1);
+
+        if(PVR_GET(PVR_FB_ADDR) == ring_base &&
+           ring_base + 2 * w * h * 2 <= (uint32)PVR_RAM_SIZE) {
+            ring = vram_s;
+            memcpy(ring + w * h, ring, w * h * 2);
+        }
+    }
 }
@@ -0,0 +1,39 @@
+/* KallistiOS ##version##
+
+   util/mem_stats.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Consolidated memory usage overview: the heap, and whatever the video and
+   sound RAM allocators have left. */
+
+#include <malloc.h>
+#include <string.h>
+
+#include <dc/pvr.h>
+#include <dc/sound/sound.h>
+#include <kos/init.h>
+#include <kos/mem_tags.h>
+
+#define ARAM_SIZE   (2 * 1024 * 1024)
+
+void kos_mem_stats(kos_mem_stats_t *stats) {
+    struct mallinfo mi = mallinfo();
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    stats->heap_size = mi.arena;
+    stats->heap_used = mi.uordblks;
+    stats->heap_free = mi.fordblks;
+
+    if(__kos_init_flags & INIT_MALLOCTAGS) {
+        for(i = 0; i < MEM_TAG_COUNT; i++)
+            mem_tag_stats(i, &stats->tags[i]);
+    }
+
+    stats->vram_size = PVR_RAM_SIZE;
+    stats->vram_free = pvr_mem_available();
+    stats->aram_size = ARAM_SIZE;
+    stats->aram_free = snd_mem_available();
+}
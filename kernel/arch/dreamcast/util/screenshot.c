@@ -8,12 +8,20 @@
 
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/queue.h>
+#include <dc/pvr.h>
+#include <dc/vblank.h>
 #include <dc/video.h>
 #include <kos/dbglog.h>
 #include <kos/fs.h>
+#include <kos/mutex.h>
+#include <kos/thread.h>
+#include <kos/worker_thread.h>
+#include <arch/dmac.h>
 #include <arch/irq.h>
 
 #include <kos/timer.h>
@@ -23,42 +31,27 @@
     data from the currently viewed framebuffer).
 
     This will now work with any of the supported video modes.
+
+    The asynchronous ones are copied out of VRAM by DMA at a vblank into a
+    buffer of their own, then handed to a low priority worker thread, which
+    converts them a row at a time and writes them out through a small buffer.
 */
 
 #define BYTES_PER_PIXEL 3
 
-size_t vid_screen_shot_data(uint8_t **buffer) {
-    int i, numpix;
+/* Convert a row of w pixels of the given mode to 24bpp RGB. */
+static void shot_convert_row(const void *src, vid_pixel_mode_t pm, int w,
+                             uint8_t *data_ptr) {
+    const uint32_t *src_l = (const uint32_t *)src;
+    const uint8_t *src_b = (const uint8_t *)src;
     uint32_t pixel, pixel1, pixel2;
-    size_t buffer_size;
-    uint8_t *data_ptr;
-    uint32_t save;
+    int i;
 
-    /* Allocate buffer to store the 24bpp image data */
-    numpix = vid_mode->width * vid_mode->height;
-    buffer_size = numpix * BYTES_PER_PIXEL;
-    if(!buffer_size) {
-        dbglog(DBG_ERROR, "vid_screen_shot_data: invalid video mode.\n");
-        return 0;
-    }
-
-    *buffer = (uint8_t *)malloc(buffer_size);
-    if(*buffer == NULL) {
-        dbglog(DBG_ERROR, "vid_screen_shot_data: can't allocate memory\n");
-        return 0;
-    }
-
-    data_ptr = *buffer;
-
-    /* Disable interrupts */
-    save = irq_disable();
-
-    /* Write out each pixel as 24-bits */
-    switch(vid_mode->pm) {
+    switch(pm) {
         case PM_RGB555:  /* (15-bit) */
             /* Process two 16-bit pixels at a time */
-            for(i = 0; i < numpix / 2; i++) {
-                pixel = vram_l[i];
+            for(i = 0; i < w / 2; i++) {
+                pixel = src_l[i];
                 pixel1 = pixel & 0xFFFF;
                 pixel2 = pixel >> 16;
 
@@ -75,8 +68,8 @@ size_t vid_screen_shot_data(uint8_t **buffer) {
             break;
         case PM_RGB565: /* (16-bit) */
             /* Process two 16-bit pixels at a time */
-            for(i = 0; i < numpix / 2; i++) {
-                pixel = vram_l[i];
+            for(i = 0; i < w / 2; i++) {
+                pixel = src_l[i];
                 pixel1 = pixel & 0xFFFF;
                 pixel2 = pixel >> 16;
 
@@ -92,34 +85,440 @@ size_t vid_screen_shot_data(uint8_t **buffer) {
             }
             break;
         case PM_RGB888P:  /* (24-bit) */
-            for(i = 0; i < numpix; i++) {
-                data_ptr[i * 3 + 0] = ((uint8_t *)vram_l)[i * 3 + 2]; /* R */
-                data_ptr[i * 3 + 1] = ((uint8_t *)vram_l)[i * 3 + 1]; /* G */
-                data_ptr[i * 3 + 2] = ((uint8_t *)vram_l)[i * 3 + 0]; /* B */
+            for(i = 0; i < w; i++) {
+                data_ptr[i * 3 + 0] = src_b[i * 3 + 2]; /* R */
+                data_ptr[i * 3 + 1] = src_b[i * 3 + 1]; /* G */
+                data_ptr[i * 3 + 2] = src_b[i * 3 + 0]; /* B */
             }
             break;
         case PM_RGB0888:  /* (32-bit) */
-            for(i = 0; i < numpix; i++) {
-                pixel = vram_l[i];
+            for(i = 0; i < w; i++) {
+                pixel = src_l[i];
                 data_ptr[i * 3 + 0] = (((pixel >> 16) & 0xff)); /* R */
                 data_ptr[i * 3 + 1] = (((pixel >> 8) & 0xff));  /* G */
                 data_ptr[i * 3 + 2] = (((pixel >> 0) & 0xff));  /* B */
             }
             break;
-        default:
-            dbglog(DBG_ERROR, "vid_screen_shot_data: can't process pixel mode %d\n", vid_mode->pm);
-            free(*buffer);
-            *buffer = NULL;
-            irq_restore(save);
-            return 0;
+    }
+}
+
+size_t vid_screen_shot_data(uint8_t **buffer) {
+    int y, w, pitch;
+    size_t buffer_size;
+    uint32_t save;
+
+    /* Allocate buffer to store the 24bpp image data */
+    w = vid_mode->width;
+    buffer_size = w * vid_mode->height * BYTES_PER_PIXEL;
+    if(!buffer_size) {
+        dbglog(DBG_ERROR, "vid_screen_shot_data: invalid video mode.\n");
+        return 0;
+    }
+
+    if(vid_mode->pm > PM_RGB0888) {
+        dbglog(DBG_ERROR, "vid_screen_shot_data: can't process pixel mode %d\n", vid_mode->pm);
+        return 0;
+    }
+
+    *buffer = (uint8_t *)malloc(buffer_size);
+    if(*buffer == NULL) {
+        dbglog(DBG_ERROR, "vid_screen_shot_data: can't allocate memory\n");
+        return 0;
     }
 
+    pitch = w * vid_pmode_bpp[vid_mode->pm];
+
+    /* Disable interrupts */
+    save = irq_disable();
+
+    /* Write out each pixel as 24-bits */
+    for(y = 0; y < vid_mode->height; y++)
+        shot_convert_row((uint8_t *)vram_l + y * pitch, vid_mode->pm, w,
+                         *buffer + y * w * BYTES_PER_PIXEL);
+
     /* Restore interrupts */
     irq_restore(save);
 
     return buffer_size;
 }
 
+typedef struct shot_job {
+    STAILQ_ENTRY(shot_job) entry;
+    dma_req_t req;
+    dma_sg_t sg;
+
+    uint8_t *buf;               /* Copy of the framebuffer */
+    size_t size;
+    uint16_t w, h;
+    vid_pixel_mode_t pm;
+    vid_shot_fmt_t fmt;
+    bool failed;                /* The DMA couldn't be started */
+    char fn[];
+} shot_job_t;
+
+STAILQ_HEAD(shot_queue, shot_job);
+
+/* Waiting for a vblank, and copied and waiting for the worker */
+static struct shot_queue shot_capture = STAILQ_HEAD_INITIALIZER(shot_capture);
+static struct shot_queue shot_encode = STAILQ_HEAD_INITIALIZER(shot_encode);
+static int shot_count;
+static kthread_worker_t *shot_worker;
+static mutex_t shot_lock = MUTEX_INITIALIZER;
+
+/* Output through a buffer, so that slow file systems like /pc see few large
+   writes rather than one per row. */
+typedef struct {
+    file_t f;
+    size_t len;
+    bool err;
+    uint8_t buf[8192];
+} shot_out_t;
+
+static void shot_flush(shot_out_t *o) {
+    if(o->len && !o->err && fs_write(o->f, o->buf, o->len) != (ssize_t)o->len)
+        o->err = true;
+
+    o->len = 0;
+}
+
+static void shot_put(shot_out_t *o, const void *data, size_t len) {
+    const uint8_t *d = (const uint8_t *)data;
+    size_t n;
+
+    while(len) {
+        n = sizeof(o->buf) - o->len;
+
+        if(n > len)
+            n = len;
+
+        memcpy(o->buf + o->len, d, n);
+        o->len += n;
+        d += n;
+        len -= n;
+
+        if(o->len == sizeof(o->buf))
+            shot_flush(o);
+    }
+}
+
+static inline void shot_put8(shot_out_t *o, uint8_t v) {
+    if(o->len == sizeof(o->buf))
+        shot_flush(o);
+
+    o->buf[o->len++] = v;
+}
+
+static void shot_put32be(shot_out_t *o, uint32_t v) {
+    uint8_t b[4] = { v >> 24, v >> 16, v >> 8, v };
+
+    shot_put(o, b, sizeof(b));
+}
+
+/* QOI, as in the specification at qoiformat.org, without alpha */
+#define QOI_OP_INDEX    0x00
+#define QOI_OP_DIFF     0x40
+#define QOI_OP_LUMA     0x80
+#define QOI_OP_RUN      0xc0
+#define QOI_OP_RGB      0xfe
+
+typedef struct {
+    uint8_t index[64][4];           /* RGBA, as the decoder sees it */
+    uint8_t px[3];
+    int run;
+} qoi_state_t;
+
+static void qoi_pixel(shot_out_t *o, qoi_state_t *q, const uint8_t *px) {
+    int h, dr, dg, db, dr_dg, db_dg;
+
+    if(px[0] == q->px[0] && px[1] == q->px[1] && px[2] == q->px[2]) {
+        if(++q->run == 62) {
+            shot_put8(o, QOI_OP_RUN | (q->run - 1));
+            q->run = 0;
+        }
+
+        return;
+    }
+
+    if(q->run) {
+        shot_put8(o, QOI_OP_RUN | (q->run - 1));
+        q->run = 0;
+    }
+
+    /* Alpha is always 255. */
+    h = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+
+    if(q->index[h][3] == 255 && !memcmp(q->index[h], px, 3)) {
+        shot_put8(o, QOI_OP_INDEX | h);
+    }
+    else {
+        memcpy(q->index[h], px, 3);
+        q->index[h][3] = 255;
+
+        dr = (int8_t)(px[0] - q->px[0]);
+        dg = (int8_t)(px[1] - q->px[1]);
+        db = (int8_t)(px[2] - q->px[2]);
+        dr_dg = dr - dg;
+        db_dg = db - dg;
+
+        if(dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+            shot_put8(o, QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) |
+                      (db + 2));
+        }
+        else if(dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 &&
+                db_dg >= -8 && db_dg <= 7) {
+            shot_put8(o, QOI_OP_LUMA | (dg + 32));
+            shot_put8(o, ((dr_dg + 8) << 4) | (db_dg + 8));
+        }
+        else {
+            shot_put8(o, QOI_OP_RGB);
+            shot_put(o, px, 3);
+        }
+    }
+
+    memcpy(q->px, px, 3);
+}
+
+static int shot_write(shot_job_t *job) {
+    static const uint8_t qoi_end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    shot_out_t *o;
+    qoi_state_t q;
+    uint8_t *row;
+    int x, y, pitch = job->w * vid_pmode_bpp[job->pm], rv = -1;
+    char header[64];
+
+    o = malloc(sizeof(shot_out_t));
+    row = malloc(job->w * BYTES_PER_PIXEL);
+
+    if(!o || !row) {
+        dbglog(DBG_ERROR, "vid_screen_shot_async: can't allocate memory\n");
+        goto out;
+    }
+
+    o->f = fs_open(job->fn, O_WRONLY | O_TRUNC);
+    o->len = 0;
+    o->err = false;
+
+    if(o->f < 0) {
+        dbglog(DBG_ERROR, "vid_screen_shot_async: can't open output file '%s'\n", job->fn);
+        goto out;
+    }
+
+    if(job->fmt == VID_SHOT_QOI) {
+        shot_put(o, "qoif", 4);
+        shot_put32be(o, job->w);
+        shot_put32be(o, job->h);
+        shot_put8(o, 3);            /* RGB */
+        shot_put8(o, 0);            /* sRGB with linear alpha */
+
+        memset(&q, 0, sizeof(q));
+    }
+    else {
+        x = snprintf(header, sizeof(header),
+                     "P6\n#KallistiOS Screen Shot\n%d %d\n255\n",
+                     job->w, job->h);
+        shot_put(o, header, x);
+    }
+
+    for(y = 0; y < job->h; y++) {
+        shot_convert_row(job->buf + y * pitch, job->pm, job->w, row);
+
+        if(job->fmt == VID_SHOT_QOI) {
+            for(x = 0; x < job->w; x++)
+                qoi_pixel(o, &q, row + x * 3);
+        }
+        else {
+            shot_put(o, row, job->w * BYTES_PER_PIXEL);
+        }
+    }
+
+    if(job->fmt == VID_SHOT_QOI) {
+        if(q.run)
+            shot_put8(o, QOI_OP_RUN | (q.run - 1));
+
+        shot_put(o, qoi_end, sizeof(qoi_end));
+    }
+
+    shot_flush(o);
+    fs_close(o->f);
+
+    if(o->err)
+        dbglog(DBG_ERROR, "vid_screen_shot_async: can't write data to output file '%s'\n", job->fn);
+    else
+        rv = 0;
+
+out:
+    free(row);
+    free(o);
+    return rv;
+}
+
+static void shot_work(void *d) {
+    shot_job_t *job;
+    uint32_t flags;
+
+    (void)d;
+
+    for(;;) {
+        flags = irq_disable();
+
+        job = STAILQ_FIRST(&shot_encode);
+        if(job)
+            STAILQ_REMOVE_HEAD(&shot_encode, entry);
+
+        irq_restore(flags);
+
+        if(!job)
+            break;
+
+        if(job->failed) {
+            dbglog(DBG_ERROR, "vid_screen_shot_async: can't start DMA for '%s'\n", job->fn);
+        }
+        else {
+            dma_sync_for_cpu(job->buf, job->size, DMA_FROM_DEVICE);
+
+            if(!shot_write(job))
+                dbglog(DBG_INFO, "vid_screen_shot_async: written to output file '%s'\n", job->fn);
+        }
+
+        dma_free_coherent(job->buf);
+        free(job);
+
+        flags = irq_disable();
+        shot_count--;
+        irq_restore(flags);
+    }
+}
+
+/* The copy is in RAM: on to the worker. */
+static void shot_copied(void *d) {
+    shot_job_t *job = (shot_job_t *)d;
+
+    STAILQ_INSERT_TAIL(&shot_encode, job, entry);
+    thd_worker_wakeup(shot_worker);
+}
+
+static void shot_vblank(uint32_t code, void *data) {
+    shot_job_t *job = STAILQ_FIRST(&shot_capture);
+    uint32_t base;
+
+    (void)code;
+    (void)data;
+
+    if(!job)
+        return;
+
+    STAILQ_REMOVE_HEAD(&shot_capture, entry);
+
+    /* Whatever is on the screen right now */
+    base = PVR_GET(PVR_FB_ADDR) & (PVR_RAM_SIZE - 1);
+
+    job->sg.src = hw_to_dma_addr(PVR_RAM_BASE | base);
+    job->req.cfg.unit_size = (base & 31) ? DMA_UNITSIZE_32BIT :
+                                           DMA_UNITSIZE_32BYTE;
+
+    /* Nothing can be freed from here, so the worker cleans up. */
+    if(dma_req_submit(&job->req) < 0) {
+        job->failed = true;
+        shot_copied(job);
+    }
+}
+
+int vid_screen_shot_async(const char *destfn, vid_shot_fmt_t fmt) {
+    static int vbl_hnd = -1;
+    kthread_attr_t attr = {
+        .prio = PRIO_DEFAULT + 1,
+        .label = "[screenshot]"
+    };
+    shot_job_t *job;
+    size_t size;
+    uint32_t flags;
+
+    if(fmt > VID_SHOT_QOI || !vid_mode || vid_mode->pm > PM_RGB0888 ||
+       !vid_mode->width || !vid_mode->height) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mutex_lock_scoped(&shot_lock);
+
+    if(!shot_worker) {
+        shot_worker = thd_worker_create_ex(&attr, shot_work, NULL);
+
+        if(!shot_worker) {
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+
+    if(vbl_hnd < 0) {
+        vbl_hnd = vblank_handler_add_ex(shot_vblank, NULL, VBLANK_PRIO_LOW, 0);
+
+        if(vbl_hnd < 0)
+            return -1;
+    }
+
+    flags = irq_disable();
+
+    if(shot_count >= VID_SHOT_ASYNC_MAX) {
+        irq_restore(flags);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    shot_count++;
+    irq_restore(flags);
+
+    size = vid_mode->width * vid_mode->height * vid_pmode_bpp[vid_mode->pm];
+    job = calloc(1, sizeof(shot_job_t) + strlen(destfn) + 1);
+
+    if(job)
+        job->buf = dma_alloc_coherent(size, NULL, DMA_ALLOC_CACHED);
+
+    if(!job || !job->buf) {
+        free(job);
+
+        flags = irq_disable();
+        shot_count--;
+        irq_restore(flags);
+
+        errno = ENOMEM;
+        return -1;
+    }
+
+    strcpy(job->fn, destfn);
+    job->size = size;
+    job->w = vid_mode->width;
+    job->h = vid_mode->height;
+    job->pm = vid_mode->pm;
+    job->fmt = fmt;
+
+    /* The source is filled in at the vblank. The buffer is padded out to
+       whole cache lines, so the length can be too. */
+    job->sg.dst = dma_map_dst(job->buf, size);
+    job->sg.len = (size + 31) & ~31;
+
+    job->req.cfg.channel = DMA_CHANNEL_3;
+    job->req.cfg.request = DMA_REQUEST_AUTO_MEM_TO_MEM;
+    job->req.cfg.src_mode = DMA_ADDRMODE_INCREMENT;
+    job->req.cfg.dst_mode = DMA_ADDRMODE_INCREMENT;
+    job->req.cfg.transmit_mode = DMA_TRANSMITMODE_CYCLE_STEAL;
+    job->req.cfg.callback = shot_copied;
+    job->req.sg = &job->sg;
+    job->req.sg_count = 1;
+    job->req.prio = PRIO_DEFAULT;
+    job->req.data = job;
+
+    flags = irq_disable();
+    STAILQ_INSERT_TAIL(&shot_capture, job, entry);
+    irq_restore(flags);
+
+    return 0;
+}
+
+int vid_screen_shot_pending(void) {
+    return shot_count;
+}
+
 /* Destination file system must be writeable and have enough free space. */
 int vid_screen_shot(const char *destfn) {
     file_t   f;
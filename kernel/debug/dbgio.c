@@ -7,9 +7,15 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <assert.h>
 #include <kos/dbgio.h>
+#include <kos/genwait.h>
+#include <kos/mutex.h>
+#include <kos/thread.h>
+#include <kos/worker_thread.h>
+#include <arch/irq.h>
 #include <arch/spinlock.h>
 
 /*
@@ -24,6 +30,194 @@
 // Our currently selected handler.
 static dbgio_handler_t * dbgio = NULL;
 
+/* Asynchronous output: translated writes go into a ring, which a worker
+   thread hands over to the handler in pieces as large as it can. head and
+   tail count bytes in and out of the ring, and wrap around. Whoever writes
+   to the handler while the ring is running holds out_lock. */
+static struct {
+    uint8_t *buf;
+    size_t size;
+    size_t head, tail;
+    size_t dropped;
+    int active;
+    kthread_worker_t *worker;
+} async;
+
+static mutex_t out_lock = MUTEX_INITIALIZER;
+
+/* Hand the ring over to the handler, up to what's in it now. Called with
+   out_lock held, or when it can't be had (from an interrupt). */
+static void async_drain_locked(void) {
+    size_t n, off, dropped;
+    char msg[48];
+    int old;
+
+    for(;;) {
+        old = irq_disable();
+        off = async.tail % async.size;
+        n = async.head - async.tail;
+        dropped = async.dropped;
+        async.dropped = 0;
+        irq_restore(old);
+
+        if(n > async.size - off)
+            n = async.size - off;
+
+        if(dropped) {
+            snprintf(msg, sizeof(msg), "\n[dbgio: %u bytes dropped]\n",
+                     (unsigned)dropped);
+            dbgio->write_buffer((const uint8_t *)msg, strlen(msg), 1);
+        }
+
+        if(!n)
+            break;
+
+        dbgio->write_buffer(async.buf + off, n, 1);
+
+        old = irq_disable();
+        async.tail += n;
+        genwait_wake_all(&async);
+        irq_restore(old);
+    }
+}
+
+static void async_drain(void *data) {
+    (void)data;
+
+    mutex_lock(&out_lock);
+    async_drain_locked();
+    mutex_unlock(&out_lock);
+}
+
+/* Get the handler to ourselves, draining the ring first. Returns 1 if
+   out_lock is held, and needs to be given back with async_release(). */
+static int async_acquire(void) {
+    int locked = !mutex_trylock(&out_lock);
+
+    if(!locked && !irq_inside_int())
+        locked = !mutex_lock(&out_lock);
+
+    /* From an interrupt with the worker in the middle of a write, just go
+       ahead: losing the output would be worse. */
+    async_drain_locked();
+    return locked;
+}
+
+static void async_release(int locked) {
+    if(locked)
+        mutex_unlock(&out_lock);
+}
+
+/* Queue up as much as possible of a translated write. Threads wait for
+   room in the ring, interrupts drop what doesn't fit. Returns how much was
+   taken, which is less than len if the ring is stopped. */
+static int async_write(const uint8_t *data, int len) {
+    int old = irq_disable();
+    size_t room, n, off;
+    int done = 0;
+
+    while(async.active && done < len) {
+        room = async.size - (async.head - async.tail);
+
+        if(!room) {
+            if(irq_inside_int()) {
+                async.dropped += len - done;
+                done = len;
+                break;
+            }
+
+            thd_worker_wakeup(async.worker);
+            genwait_wait(&async, "dbgio_async", 0, NULL);
+            continue;
+        }
+
+        n = (size_t)(len - done) < room ? (size_t)(len - done) : room;
+        off = async.head % async.size;
+
+        if(n > async.size - off) {
+            memcpy(async.buf + off, data + done, async.size - off);
+            memcpy(async.buf, data + done + (async.size - off),
+                   n - (async.size - off));
+        }
+        else {
+            memcpy(async.buf + off, data + done, n);
+        }
+
+        async.head += n;
+        done += n;
+    }
+
+    if(done)
+        thd_worker_wakeup(async.worker);
+
+    irq_restore(old);
+    return done;
+}
+
+int dbgio_async_start(size_t size) {
+    kthread_attr_t attr = {
+        .prio = DBGIO_ASYNC_PRIO,
+        .label = "dbgio"
+    };
+    kthread_worker_t *worker;
+    uint8_t *buf;
+    int old;
+
+    if(async.buf) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if(!size)
+        size = DBGIO_ASYNC_SIZE;
+
+    if(!(buf = malloc(size))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if(!(worker = thd_worker_create_ex(&attr, async_drain, NULL))) {
+        free(buf);
+        return -1;
+    }
+
+    old = irq_disable();
+    async.buf = buf;
+    async.size = size;
+    async.head = async.tail = async.dropped = 0;
+    async.worker = worker;
+    async.active = 1;
+    irq_restore(old);
+
+    return 0;
+}
+
+int dbgio_async_stop(void) {
+    int old;
+
+    if(!async.buf)
+        return 0;
+
+    mutex_lock(&out_lock);
+    async_drain_locked();
+
+    old = irq_disable();
+    async.active = 0;
+    genwait_wake_all(&async);
+    irq_restore(old);
+
+    /* Anything that slipped in meanwhile */
+    async_drain_locked();
+    mutex_unlock(&out_lock);
+
+    thd_worker_destroy(async.worker);
+    free(async.buf);
+    async.buf = NULL;
+    async.worker = NULL;
+
+    return 0;
+}
+
 int dbgio_dev_select(const char * name) {
     size_t i;
 
@@ -105,27 +299,58 @@ int dbgio_read(void) {
 }
 
 int dbgio_write(int c) {
+    int locked, rv;
+
     if(dbgio_enabled) {
         assert(dbgio);
-        return dbgio->write(c);
+
+        if(!async.active)
+            return dbgio->write(c);
+
+        /* Untranslated writes go out after what's queued, right away. */
+        locked = async_acquire();
+        rv = dbgio->write(c);
+        async_release(locked);
+
+        return rv;
     }
 
     return -1;
 }
 
 int dbgio_flush(void) {
+    int locked, rv;
+
     if(dbgio_enabled) {
         assert(dbgio);
-        return dbgio->flush();
+
+        if(!async.active)
+            return dbgio->flush();
+
+        locked = async_acquire();
+        rv = dbgio->flush();
+        async_release(locked);
+
+        return rv;
     }
 
     return -1;
 }
 
 int dbgio_write_buffer(const uint8_t *data, int len) {
+    int locked, rv;
+
     if(dbgio_enabled) {
         assert(dbgio);
-        return dbgio->write_buffer(data, len, 0);
+
+        if(!async.active)
+            return dbgio->write_buffer(data, len, 0);
+
+        locked = async_acquire();
+        rv = dbgio->write_buffer(data, len, 0);
+        async_release(locked);
+
+        return rv;
     }
 
     return -1;
@@ -141,8 +366,18 @@ int dbgio_read_buffer(uint8_t *data, int len) {
 }
 
 int dbgio_write_buffer_xlat(const uint8_t *data, int len) {
+    int done = 0;
+
     if(dbgio_enabled) {
         assert(dbgio);
+
+        if(async.active && (done = async_write(data, len)) == len)
+            return len;
+
+        /* The ring was stopped meanwhile. */
+        if(done)
+            return done + dbgio->write_buffer(data + done, len - done, 1);
+
         return dbgio->write_buffer(data, len, 1);
     }
 
@@ -9,10 +9,8 @@
 /*
 
 Just a quick interface to actually make use of all those nifty kernel
-export tables. This just does a linear search through the two tables
-to look for a symbol, for now. This should be optimized later with a
-binary search or something, but loading a new program is generally expected
-to be a somewhat slow process anyway.
+export tables. Tables that come with a hash index from genexports.sh are
+looked up through it; any others are searched linearly.
 
 */
 
@@ -29,7 +27,8 @@ static symtab_handler_t st_kern = {
         NMMGR_TYPE_SYMTAB,
         NMMGR_LIST_INIT
     },
-    kernel_symtab
+    kernel_symtab,
+    kernel_symtab_hash
 };
 
 static symtab_handler_t st_arch = {
@@ -41,7 +40,8 @@ static symtab_handler_t st_arch = {
         NMMGR_TYPE_SYMTAB,
         NMMGR_LIST_INIT
     },
-    arch_symtab
+    arch_symtab,
+    arch_symtab_hash
 };
 
 static symtab_handler_t st_subarch = {
@@ -53,7 +53,8 @@ static symtab_handler_t st_subarch = {
         NMMGR_TYPE_SYMTAB,
         NMMGR_LIST_INIT
     },
-    subarch_symtab
+    subarch_symtab,
+    subarch_symtab_hash
 };
 
 void export_init(void) {
@@ -63,11 +64,53 @@ void export_init(void) {
     nmmgr_handler_add(&st_subarch.nmmgr);
 }
 
+static uint32_t export_hash(const char *name) {
+    uint32_t h = 5381;
+
+    while(*name)
+        h = h * 33 + (unsigned char)*name++;
+
+    return h;
+}
+
+static export_sym_t *symtab_find(const symtab_handler_t *sth,
+                                 const char *name, uint32_t h) {
+    const uint32_t *chain;
+    uint32_t nbuckets, i;
+    int j;
+
+    if(!sth->hash) {
+        for(j = 0; sth->table[j].name; j++) {
+            if(!strcmp(name, sth->table[j].name))
+                return sth->table + j;
+        }
+
+        return NULL;
+    }
+
+    nbuckets = sth->hash[0];
+    i = sth->hash[1 + (h & (nbuckets - 1))];
+
+    if(i == 0xffffffff)
+        return NULL;
+
+    chain = sth->hash + 1 + nbuckets;
+
+    for(;; i++) {
+        if((chain[i] | 1) == (h | 1) && !strcmp(name, sth->table[i].name))
+            return sth->table + i;
+
+        if(chain[i] & 1)
+            return NULL;
+    }
+}
+
 export_sym_t *export_lookup(const char *name) {
     nmmgr_handler_t *nmmgr;
     nmmgr_list_t *nmmgrs;
-    int i;
     symtab_handler_t *sth;
+    export_sym_t *sym;
+    uint32_t h = export_hash(name);
 
     /* Get the name manager list */
     nmmgrs = nmmgr_get_list();
@@ -79,15 +122,10 @@ export_sym_t *export_lookup(const char *name) {
             continue;
 
         sth = (symtab_handler_t *)nmmgr;
+        sym = symtab_find(sth, name, h);
 
-        /* First look through the kernel table */
-        for(i = 0; /* */; i++) {
-            if(sth->table[i].name == NULL)
-                break;
-
-            if(!strcmp(name, sth->table[i].name))
-                return sth->table + i;
-        }
+        if(sym)
+            return sym;
     }
 
     return NULL;
@@ -95,8 +133,6 @@ export_sym_t *export_lookup(const char *name) {
 
 export_sym_t *export_lookup_path(const char *name, const char *path) {
     nmmgr_handler_t *nmmgr;
-    symtab_handler_t *sth;
-    int i;
 
     /* Get the name manager list */
     nmmgr = nmmgr_lookup(path);
@@ -104,14 +140,8 @@ export_sym_t *export_lookup_path(const char *name, const char *path) {
     if(nmmgr == NULL) {
         return NULL;
     }
-    sth = (symtab_handler_t *)nmmgr;
 
-    for(i = 0; sth->table[i].name; i++) {
-        if(!strcmp(name, sth->table[i].name))
-            return sth->table + i;
-    }
-
-    return NULL;
+    return symtab_find((symtab_handler_t *)nmmgr, name, export_hash(name));
 }
 
 export_sym_t *export_lookup_addr(uintptr_t addr) {
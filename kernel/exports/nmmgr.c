@@ -20,6 +20,7 @@ interface at the front of their struct.
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
 
 #include <kos/init_base.h>
 #include <kos/nmmgr.h>
@@ -33,18 +34,150 @@ static mutex_t mutex = MUTEX_INITIALIZER;
    describe how to handle a given path name. */
 static nmmgr_list_t nmmgr_handlers;
 
+/* A hash table of the handlers, on their lengths and case-folded names, and
+   the distinct lengths of their names, longest first. A lookup hashes the
+   start of the path at each of those lengths in turn, so the first handler
+   found is the one with the longest matching name, as with the list. It's
+   rebuilt whenever a handler is added or removed, with the mutex held. */
+typedef struct nm_slot {
+    nmmgr_handler_t *hnd;
+    uint32_t hash;
+    size_t len;
+} nm_slot_t;
+
+static nm_slot_t *nm_table;
+static size_t nm_table_size;
+static size_t *nm_lens;
+static size_t nm_len_count;
+
+/* Hash a name as it's read, stopping at len characters, folding case. */
+static uint32_t nm_hash(const char *name, size_t len) {
+    uint32_t h = 2166136261U;
+
+    while(len--) {
+        h ^= (uint8_t)tolower((unsigned char)*name++);
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static int len_cmp(const void *a, const void *b) {
+    size_t la = *(const size_t *)a, lb = *(const size_t *)b;
+
+    return la > lb ? -1 : la < lb;
+}
+
+/* Drop the table, so lookups go through the list. */
+static void nm_index_free(void) {
+    free(nm_table);
+    free(nm_lens);
+    nm_table = NULL;
+    nm_lens = NULL;
+    nm_table_size = nm_len_count = 0;
+}
+
+static void nm_index_build(void) {
+    nmmgr_handler_t *c;
+    size_t count = 0, size = 16, i, j, len;
+    uint32_t h;
+
+    nm_index_free();
+
+    LIST_FOREACH(c, &nmmgr_handlers, list_ent) {
+        ++count;
+    }
+
+    while(size < count * 2)
+        size <<= 1;
+
+    nm_table = (nm_slot_t *)calloc(size, sizeof(nm_slot_t));
+    nm_lens = (size_t *)malloc((count + 1) * sizeof(size_t));
+
+    /* Without it, lookups just scan the list. */
+    if(!nm_table || !nm_lens) {
+        nm_index_free();
+        return;
+    }
+
+    nm_table_size = size;
+
+    LIST_FOREACH(c, &nmmgr_handlers, list_ent) {
+        len = strlen(c->pathname);
+        h = nm_hash(c->pathname, len);
+
+        /* Of two handlers with the same name, the list finds the one added
+           last, which is nearer its head. */
+        for(i = h & (size - 1); nm_table[i].hnd; i = (i + 1) & (size - 1)) {
+            if(nm_table[i].len == len &&
+               !strncasecmp(nm_table[i].hnd->pathname, c->pathname, len))
+                break;
+        }
+
+        if(nm_table[i].hnd)
+            continue;
+
+        nm_table[i].hnd = c;
+        nm_table[i].hash = h;
+        nm_table[i].len = len;
+
+        for(j = 0; j < nm_len_count && nm_lens[j] != len; ++j)
+            ;
+
+        if(j == nm_len_count)
+            nm_lens[nm_len_count++] = len;
+    }
+
+    qsort(nm_lens, nm_len_count, sizeof(size_t), len_cmp);
+}
+
+static nmmgr_handler_t *nm_index_lookup(const char *fn) {
+    size_t fn_len = strlen(fn), i, j, len;
+    uint32_t h;
+
+    for(i = 0; i < nm_len_count; ++i) {
+        len = nm_lens[i];
+
+        if(len > fn_len)
+            continue;
+
+        h = nm_hash(fn, len);
+
+        for(j = h & (nm_table_size - 1); nm_table[j].hnd;
+            j = (j + 1) & (nm_table_size - 1)) {
+            if(nm_table[j].hash == h && nm_table[j].len == len &&
+               !strncasecmp(nm_table[j].hnd->pathname, fn, len))
+                return nm_table[j].hnd;
+        }
+    }
+
+    return NULL;
+}
+
 /* Locate a name handler for a given path name */
 nmmgr_handler_t * nmmgr_lookup(const char *fn) {
     nmmgr_handler_t *cur = NULL, *tmp;
     size_t          cur_len = 0, tmp_len;
+    bool            indexed = false;
+
+    if(mutex_lock_irqsafe(&mutex) == 0) {
+        if(nm_table) {
+            cur = nm_index_lookup(fn);
+            indexed = true;
+        }
+
+        mutex_unlock(&mutex);
+    }
 
     /* Scan the handler table and look for the best path match */
-    LIST_FOREACH(tmp, &nmmgr_handlers, list_ent) {
-        tmp_len = strlen(tmp->pathname);
-        if(!strncasecmp(tmp->pathname, fn, tmp_len)) {
-            if(cur_len < tmp_len) {
-                cur_len = tmp_len;
-                cur = tmp;
+    if(!indexed) {
+        LIST_FOREACH(tmp, &nmmgr_handlers, list_ent) {
+            tmp_len = strlen(tmp->pathname);
+            if(!strncasecmp(tmp->pathname, fn, tmp_len)) {
+                if(cur_len < tmp_len) {
+                    cur_len = tmp_len;
+                    cur = tmp;
+                }
             }
         }
     }
@@ -71,6 +204,7 @@ int nmmgr_handler_add(nmmgr_handler_t *hnd) {
     mutex_lock(&mutex);
 
     LIST_INSERT_HEAD(&nmmgr_handlers, hnd, list_ent);
+    nm_index_build();
 
     mutex_unlock(&mutex);
 
@@ -88,6 +222,7 @@ int nmmgr_handler_remove(nmmgr_handler_t *hnd) {
     LIST_FOREACH_SAFE(c, &nmmgr_handlers, list_ent, tmp) {
         if(c == hnd) {
             LIST_REMOVE(hnd, list_ent);
+            nm_index_build();
             rv = 0;
             break;
         }
@@ -112,6 +247,10 @@ void nmmgr_init(void) {
 void nmmgr_shutdown(void) {
     nmmgr_handler_t *c, *n;
 
+    mutex_lock(&mutex);
+    nm_index_free();
+    mutex_unlock(&mutex);
+
     c = LIST_FIRST(&nmmgr_handlers);
 
     while(c != NULL) {
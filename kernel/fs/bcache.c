@@ -0,0 +1,603 @@
+/* KallistiOS ##version##
+
+   bcache.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Shared block cache. Every valid block is in one hash table and on two LRU
+   lists, the one of all blocks and the one of its own cache, which are kept
+   in the same order. A cache's reserve is allocated with it and only changes
+   hands within it. Blocks past the reserve count against the budget, and are
+   the only ones another cache can take, and then only clean ones, so that a
+   cache's dirty blocks are only ever written by calls on it or under its
+   lock. Blocks being read in with the mutex dropped are on no list, and
+   those being written back by the flush thread are marked busy. */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include <kos/bcache.h>
+#include <kos/cond.h>
+#include <kos/mutex.h>
+#include <kos/opts.h>
+#include <kos/thread.h>
+#include <kos/timer.h>
+
+/* bc_block_t.flags */
+#define BC_VALID        0x01
+#define BC_DIRTY        0x02
+#define BC_BUSY         0x04
+
+#define BC_HASH_BITS    8
+#define BC_HASH_SIZE    (1 << BC_HASH_BITS)
+
+/* How often the flush thread looks for old dirty blocks, and how soon it
+   tries a lock again for a read-ahead */
+#define BC_FLUSH_MS     250
+#define BC_RETRY_MS     2
+
+/* Read-aheads waiting at once */
+#define BC_RA_MAX       16
+
+typedef struct bc_block {
+    LIST_ENTRY(bc_block) hash;
+    TAILQ_ENTRY(bc_block) lru;          /* All blocks */
+    TAILQ_ENTRY(bc_block) clru;         /* The owner's blocks, or free list */
+    bcache_t *owner;
+    uint32_t block;
+    uint32_t flags;
+    uint64_t dirtied;                   /* When it was first made dirty */
+    uint8_t *data;
+} bc_block_t;
+
+TAILQ_HEAD(bc_list, bc_block);
+LIST_HEAD(bc_hash, bc_block);
+
+struct bcache {
+    LIST_ENTRY(bcache) list;
+    size_t size;
+    size_t reserve;
+    size_t count;                       /* Blocks owned, reserve included */
+    size_t dirty;
+    bcache_io_t read, write;
+    void *ctx;
+    mutex_t *lock;
+    struct bc_list lru;
+    struct bc_list free;
+};
+
+static LIST_HEAD(, bcache) caches = LIST_HEAD_INITIALIZER(caches);
+static struct bc_hash hash[BC_HASH_SIZE];
+static struct bc_list lru = TAILQ_HEAD_INITIALIZER(lru);
+
+/* Bytes of blocks past the reserves */
+static size_t budget = BCACHE_BUDGET, extra;
+static unsigned int wb_ms = BCACHE_WRITEBACK_MS;
+
+static struct {
+    bcache_t *c;
+    uint32_t block;
+} ra[BC_RA_MAX];
+static size_t ra_count;
+
+static mutex_t bc_mutex = MUTEX_INITIALIZER;
+static condvar_t bc_cond = COND_INITIALIZER;
+static kthread_t *bc_thd;
+static bool bc_quit;
+
+static inline struct bc_hash *bc_bucket(const bcache_t *c, uint32_t block) {
+    uint32_t h = (((uint32_t)(uintptr_t)c >> 4) ^ block) * 0x9e3779b1;
+
+    return &hash[h >> (32 - BC_HASH_BITS)];
+}
+
+static bc_block_t *bc_find(const bcache_t *c, uint32_t block) {
+    bc_block_t *b;
+
+    LIST_FOREACH(b, bc_bucket(c, block), hash) {
+        if(b->owner == c && b->block == block)
+            return b;
+    }
+
+    return NULL;
+}
+
+static void bc_touch(bc_block_t *b) {
+    TAILQ_REMOVE(&lru, b, lru);
+    TAILQ_INSERT_TAIL(&lru, b, lru);
+    TAILQ_REMOVE(&b->owner->lru, b, clru);
+    TAILQ_INSERT_TAIL(&b->owner->lru, b, clru);
+}
+
+static void bc_insert(bc_block_t *b, uint32_t block) {
+    b->block = block;
+    b->flags = BC_VALID;
+    LIST_INSERT_HEAD(bc_bucket(b->owner, block), b, hash);
+    TAILQ_INSERT_TAIL(&lru, b, lru);
+    TAILQ_INSERT_TAIL(&b->owner->lru, b, clru);
+}
+
+/* Take a block off the lists, throwing away its data. */
+static void bc_unlink(bc_block_t *b) {
+    if(b->flags & BC_DIRTY)
+        b->owner->dirty--;
+
+    LIST_REMOVE(b, hash);
+    TAILQ_REMOVE(&lru, b, lru);
+    TAILQ_REMOVE(&b->owner->lru, b, clru);
+    b->flags = 0;
+}
+
+static bc_block_t *bc_alloc(bcache_t *c) {
+    bc_block_t *b;
+
+    if(!(b = malloc(sizeof(bc_block_t))))
+        return NULL;
+
+    if(!(b->data = aligned_alloc(32, c->size))) {
+        free(b);
+        return NULL;
+    }
+
+    b->owner = c;
+    b->flags = 0;
+    c->count++;
+
+    return b;
+}
+
+/* Let go of a block on no list: past the reserve it's freed, and otherwise
+   it goes on the free list. */
+static void bc_release(bc_block_t *b) {
+    bcache_t *c = b->owner;
+
+    b->flags = 0;
+
+    if(c->count > c->reserve) {
+        c->count--;
+        extra -= c->size;
+        free(b->data);
+        free(b);
+    }
+    else {
+        TAILQ_INSERT_TAIL(&c->free, b, clru);
+    }
+}
+
+static int bc_writeback(bc_block_t *b) {
+    bcache_t *c = b->owner;
+
+    if(!(b->flags & BC_DIRTY))
+        return 0;
+
+    if(!c->write || c->write(c->ctx, b->block, b->data))
+        return -1;
+
+    b->flags &= ~BC_DIRTY;
+    c->dirty--;
+
+    return 0;
+}
+
+/* The least recently used block past the reserve of its cache, that's
+   clean unless it's c's own */
+static bc_block_t *bc_victim(const bcache_t *c) {
+    bc_block_t *b;
+
+    TAILQ_FOREACH(b, &lru, lru) {
+        if(!(b->flags & BC_BUSY) && b->owner->count > b->owner->reserve &&
+           (!(b->flags & BC_DIRTY) || b->owner == c))
+            return b;
+    }
+
+    return NULL;
+}
+
+/* Find a block for c to read another into, on no list. */
+static bc_block_t *bc_slot(bcache_t *c) {
+    bc_block_t *b;
+
+    if((b = TAILQ_FIRST(&c->free))) {
+        TAILQ_REMOVE(&c->free, b, clru);
+        return b;
+    }
+
+    /* Make room in the budget from whichever cache last used its blocks the
+       longest ago. */
+    while(extra + c->size > budget && (b = bc_victim(c))) {
+        if(b->owner == c) {
+            if(bc_writeback(b) < 0) {
+                errno = EIO;
+                return NULL;
+            }
+
+            bc_unlink(b);
+            return b;
+        }
+
+        bc_unlink(b);
+        bc_release(b);
+    }
+
+    if(extra + c->size <= budget && (b = bc_alloc(c))) {
+        extra += c->size;
+        return b;
+    }
+
+    /* Otherwise it's this cache's own least recently used block. */
+    TAILQ_FOREACH(b, &c->lru, clru) {
+        if(!(b->flags & BC_BUSY))
+            break;
+    }
+
+    if(!b || bc_writeback(b) < 0) {
+        errno = EIO;
+        return NULL;
+    }
+
+    bc_unlink(b);
+
+    return b;
+}
+
+/* Read a block into one on no list, dropping the mutex meanwhile. Nothing
+   else looks for the cache's blocks until this returns, as calls on it are
+   made one at a time. */
+static int bc_fill(bc_block_t *b, uint32_t block) {
+    bcache_t *c = b->owner;
+    int rv;
+
+    mutex_unlock(&bc_mutex);
+    rv = c->read(c->ctx, block, b->data);
+    mutex_lock(&bc_mutex);
+
+    if(rv) {
+        bc_release(b);
+        errno = EIO;
+        return -1;
+    }
+
+    bc_insert(b, block);
+
+    return 0;
+}
+
+static uint8_t *bc_get(bcache_t *c, uint32_t block, bool read) {
+    bc_block_t *b;
+    uint8_t *rv = NULL;
+
+    mutex_lock(&bc_mutex);
+
+    if((b = bc_find(c, block))) {
+        bc_touch(b);
+        rv = b->data;
+    }
+    else if((b = bc_slot(c))) {
+        if(!read)
+            bc_insert(b, block);
+
+        if(!read || !bc_fill(b, block))
+            rv = b->data;
+    }
+
+    mutex_unlock(&bc_mutex);
+
+    return rv;
+}
+
+uint8_t *bcache_read(bcache_t *c, uint32_t block) {
+    return bc_get(c, block, true);
+}
+
+uint8_t *bcache_get(bcache_t *c, uint32_t block) {
+    return bc_get(c, block, false);
+}
+
+uint8_t *bcache_lookup(bcache_t *c, uint32_t block) {
+    bc_block_t *b;
+
+    mutex_lock_scoped(&bc_mutex);
+
+    if(!(b = bc_find(c, block)))
+        return NULL;
+
+    bc_touch(b);
+
+    return b->data;
+}
+
+int bcache_mark_dirty(bcache_t *c, uint32_t block) {
+    bc_block_t *b;
+
+    mutex_lock_scoped(&bc_mutex);
+
+    if(!(b = bc_find(c, block))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!(b->flags & BC_DIRTY)) {
+        b->flags |= BC_DIRTY;
+        b->dirtied = timer_ms_gettime64();
+        c->dirty++;
+    }
+
+    bc_touch(b);
+
+    return 0;
+}
+
+int bcache_sync(bcache_t *c) {
+    bc_block_t *b;
+    int rv = 0;
+
+    mutex_lock_scoped(&bc_mutex);
+
+    TAILQ_FOREACH(b, &c->lru, clru) {
+        if(bc_writeback(b) < 0)
+            rv = -1;
+    }
+
+    if(rv)
+        errno = EIO;
+
+    return rv;
+}
+
+void bcache_readahead(bcache_t *c, uint32_t block) {
+    size_t i;
+
+    mutex_lock_scoped(&bc_mutex);
+
+    if(!c->lock || !bc_thd || ra_count == BC_RA_MAX || bc_find(c, block))
+        return;
+
+    for(i = 0; i < ra_count; i++) {
+        if(ra[i].c == c && ra[i].block == block)
+            return;
+    }
+
+    ra[ra_count].c = c;
+    ra[ra_count++].block = block;
+    cond_signal(&bc_cond);
+}
+
+/* Drop the read-aheads waiting on a cache. */
+static void bc_ra_drop(const bcache_t *c) {
+    size_t i, j;
+
+    for(i = j = 0; i < ra_count; i++) {
+        if(ra[i].c != c)
+            ra[j++] = ra[i];
+    }
+
+    ra_count = j;
+}
+
+/* Write back the blocks of a cache dirty since before a given time, with
+   its lock held. */
+static void bc_flush(bcache_t *c, uint64_t before) {
+    bc_block_t *b;
+    int rv;
+
+    for(;;) {
+        TAILQ_FOREACH(b, &c->lru, clru) {
+            if((b->flags & BC_DIRTY) && b->dirtied <= before)
+                break;
+        }
+
+        if(!b)
+            return;
+
+        b->flags = (b->flags & ~BC_DIRTY) | BC_BUSY;
+        c->dirty--;
+
+        mutex_unlock(&bc_mutex);
+        rv = c->write(c->ctx, b->block, b->data);
+        mutex_lock(&bc_mutex);
+
+        b->flags &= ~BC_BUSY;
+
+        /* Leave the rest for another time. */
+        if(rv) {
+            b->flags |= BC_DIRTY;
+            c->dirty++;
+            return;
+        }
+    }
+}
+
+static void *bc_thd_func(void *param) {
+    bc_block_t *b;
+    bcache_t *c;
+    uint64_t now, next = 0;
+    uint32_t block;
+    size_t i;
+
+    (void)param;
+
+    mutex_lock(&bc_mutex);
+
+    while(!bc_quit) {
+        /* Read-aheads come first, in the order asked for, as far as their
+           locks let them. While a cache's lock is held, whoever holds it may
+           well be about to let go. */
+        if(ra_count) {
+            for(i = 0; i < ra_count; i++) {
+                if(!mutex_trylock(ra[i].c->lock))
+                    break;
+            }
+
+            if(i == ra_count) {
+                cond_wait_timed(&bc_cond, &bc_mutex, BC_RETRY_MS);
+                continue;
+            }
+
+            c = ra[i].c;
+            block = ra[i].block;
+            memmove(&ra[i], &ra[i + 1], (--ra_count - i) * sizeof(ra[0]));
+
+            if(!bc_find(c, block) && (b = bc_slot(c)))
+                bc_fill(b, block);
+
+            mutex_unlock(c->lock);
+            continue;
+        }
+
+        /* A cache can't go away while its lock is held, so the list can be
+           carried on through from it after dropping the mutex. */
+        now = timer_ms_gettime64();
+
+        if(wb_ms && now >= next) {
+            next = now + BC_FLUSH_MS;
+
+            LIST_FOREACH(c, &caches, list) {
+                if(c->dirty && c->lock && c->write &&
+                   !mutex_trylock(c->lock)) {
+                    bc_flush(c, now - wb_ms);
+                    mutex_unlock(c->lock);
+                }
+            }
+        }
+
+        cond_wait_timed(&bc_cond, &bc_mutex, BC_FLUSH_MS);
+    }
+
+    mutex_unlock(&bc_mutex);
+
+    return NULL;
+}
+
+static void bc_free(bcache_t *c) {
+    bc_block_t *b;
+
+    while((b = TAILQ_FIRST(&c->free))) {
+        TAILQ_REMOVE(&c->free, b, clru);
+        free(b->data);
+        free(b);
+    }
+
+    free(c);
+}
+
+bcache_t *bcache_create(size_t block_size, size_t reserve, bcache_io_t read,
+                        bcache_io_t write, void *ctx) {
+    const kthread_attr_t attr = {
+        .label = "bcache"
+    };
+    bcache_t *c;
+    bc_block_t *b;
+    size_t i;
+
+    if(!block_size || (block_size & 31) || reserve < 2 || !read) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(!(c = calloc(1, sizeof(bcache_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    c->size = block_size;
+    c->reserve = reserve;
+    c->read = read;
+    c->write = write;
+    c->ctx = ctx;
+    TAILQ_INIT(&c->lru);
+    TAILQ_INIT(&c->free);
+
+    for(i = 0; i < reserve; i++) {
+        if(!(b = bc_alloc(c))) {
+            bc_free(c);
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        TAILQ_INSERT_TAIL(&c->free, b, clru);
+    }
+
+    mutex_lock_scoped(&bc_mutex);
+
+    /* Without the thread, there's just no background work. */
+    if(!bc_thd)
+        bc_thd = thd_create_ex(&attr, bc_thd_func, NULL);
+
+    LIST_INSERT_HEAD(&caches, c, list);
+
+    return c;
+}
+
+void bcache_destroy(bcache_t *c) {
+    bc_block_t *b;
+
+    mutex_lock(&bc_mutex);
+
+    LIST_REMOVE(c, list);
+    bc_ra_drop(c);
+
+    while((b = TAILQ_FIRST(&c->lru))) {
+        bc_unlink(b);
+        TAILQ_INSERT_TAIL(&c->free, b, clru);
+    }
+
+    extra -= (c->count - c->reserve) * c->size;
+
+    mutex_unlock(&bc_mutex);
+
+    bc_free(c);
+}
+
+void bcache_set_lock(bcache_t *c, mutex_t *lock) {
+    mutex_lock_scoped(&bc_mutex);
+
+    c->lock = lock;
+
+    if(!lock)
+        bc_ra_drop(c);
+}
+
+void bcache_set_budget(size_t bytes) {
+    bc_block_t *b;
+
+    mutex_lock_scoped(&bc_mutex);
+
+    budget = bytes;
+
+    while(extra > budget && (b = bc_victim(NULL))) {
+        bc_unlink(b);
+        bc_release(b);
+    }
+}
+
+void bcache_set_writeback(unsigned int ms) {
+    mutex_lock_scoped(&bc_mutex);
+
+    wb_ms = ms;
+    cond_signal(&bc_cond);
+}
+
+void bcache_shutdown(void) {
+    kthread_t *thd;
+
+    mutex_lock(&bc_mutex);
+
+    thd = bc_thd;
+    bc_quit = true;
+    cond_signal(&bc_cond);
+
+    mutex_unlock(&bc_mutex);
+
+    if(thd)
+        thd_join(thd, NULL);
+
+    mutex_lock(&bc_mutex);
+
+    bc_thd = NULL;
+    bc_quit = false;
+
+    mutex_unlock(&bc_mutex);
+}
@@ -7,6 +7,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 
 #include <arch/cache.h>
 #include <arch/arch.h>
@@ -17,16 +18,50 @@
 #include <kos/library.h>
 #include <kos/dbglog.h>
 
-/* Finds a given symbol in a relocated ELF symbol table */
-static int find_sym(char *name, elf_sym_t *table, int tablelen) {
-    int i;
+/* The entry points every loadable library has to define, in the order of
+   the members of elf_prog_t they go into. */
+static const char *const entry_names[4] = {
+    ELF_SYM_PREFIX "lib_get_name",
+    ELF_SYM_PREFIX "lib_get_version",
+    ELF_SYM_PREFIX "lib_open",
+    ELF_SYM_PREFIX "lib_close"
+};
 
-    for(i = 0; i < tablelen; i++) {
-        if(!strcmp((char*)table[i].name, name))
-            return i;
+/* Finds all the entry points in a relocated ELF symbol table, in one go */
+static bool find_entries(elf_sym_t *table, int tablelen, int idx[4]) {
+    int i, j, left = 4;
+
+    for(j = 0; j < 4; j++)
+        idx[j] = -1;
+
+    for(i = 0; i < tablelen && left; i++) {
+        if(table[i].shndx == SHN_UNDEF)
+            continue;
+
+        for(j = 0; j < 4; j++) {
+            if(idx[j] < 0 && !strcmp((char *)table[i].name, entry_names[j])) {
+                idx[j] = i;
+                left--;
+                break;
+            }
+        }
     }
 
-    return -1;
+    return !left;
+}
+
+/* Try to get at the file without copying it. Filesystems that keep files in
+   memory, like the romdisk, hand out a pointer to them. */
+static uint8_t *elf_map(file_t fd) {
+    int old_errno = errno;
+    uint8_t *img = fs_mmap(fd);
+
+    /* Everything in the headers is read a word at a time */
+    if(((uintptr_t)img & 3) != 0)
+        img = NULL;
+
+    errno = old_errno;
+    return img;
 }
 
 /* This function tests the header to determine if it's valid. It's separated
@@ -62,6 +97,9 @@ static bool elf_hdr_validate(elf_hdr_t *hdr) {
    documented by Intel.. I hope that this works for future compilers. */
 int elf_load(const char *fn, klibrary_t *shell, elf_prog_t *out) {
     uint8_t     *img, *imgout;
+    elf_shdr_t  *shcopy = NULL;
+    elf_sym_t   *symcopy = NULL;
+    bool        mapped;
     size_t      sz, rsz;
     int         i, j, sect;
     elf_hdr_t   *hdr;
@@ -88,23 +126,31 @@ int elf_load(const char *fn, klibrary_t *shell, elf_prog_t *out) {
     sz = fs_total(fd);
     dbglog(DBG_KDEBUG, "Loading ELF file of size %d\n", sz);
 
-    img = aligned_alloc(32, sz);
+    /* If the file can be mapped, it stays open until we're done with it and
+       is only read from. The few parts that get changed along the way are
+       copied out. */
+    img = elf_map(fd);
+    mapped = img != NULL;
 
-    if(img == NULL) {
-        dbglog(DBG_ERROR, "elf_load: can't allocate %d bytes for ELF load\n", sz);
-        fs_close(fd);
-        return -1;
-    }
+    if(!mapped) {
+        img = aligned_alloc(32, sz);
 
-    rsz = fs_read(fd, img, sz);
+        if(img == NULL) {
+            dbglog(DBG_ERROR, "elf_load: can't allocate %d bytes for ELF load\n", sz);
+            fs_close(fd);
+            return -1;
+        }
 
-    /* We close it regardless. */
-    fs_close(fd);
+        rsz = fs_read(fd, img, sz);
 
-    if(rsz < sz) {
-        dbglog(DBG_ERROR, "elf_load: only read %d of %d bytes\n", rsz, sz);
-        free(img);
-        return -1;
+        /* We close it regardless. */
+        fs_close(fd);
+
+        if(rsz < sz) {
+            dbglog(DBG_ERROR, "elf_load: only read %d of %d bytes\n", rsz, sz);
+            free(img);
+            return -1;
+        }
     }
 
     /* Header is at the front */
@@ -131,6 +177,18 @@ int elf_load(const char *fn, klibrary_t *shell, elf_prog_t *out) {
        two string tables, one for section names and one for object
        string names. We'll look for the latter. */
     shdrs = (elf_shdr_t *)(img + hdr->shoff);
+
+    if(mapped) {
+        shcopy = malloc(hdr->shnum * sizeof(elf_shdr_t));
+
+        if(!shcopy) {
+            dbglog(DBG_ERROR, "elf_load: can't allocate section headers\n");
+            goto error1;
+        }
+
+        shdrs = memcpy(shcopy, shdrs, hdr->shnum * sizeof(elf_shdr_t));
+    }
+
     stringtab = NULL;
 
     for(i = 0; i < hdr->shnum; i++) {
@@ -162,6 +220,17 @@ int elf_load(const char *fn, klibrary_t *shell, elf_prog_t *out) {
     symtab = (elf_sym_t *)(img + symtabhdr->offset);
     symtabsize = symtabhdr->size / sizeof(elf_sym_t);
 
+    if(mapped) {
+        symcopy = malloc(symtabsize * sizeof(elf_sym_t));
+
+        if(!symcopy) {
+            dbglog(DBG_ERROR, "elf_load: can't allocate symbol table\n");
+            goto error1;
+        }
+
+        symtab = memcpy(symcopy, symtab, symtabsize * sizeof(elf_sym_t));
+    }
+
     /* Relocate symtab entries for quick access */
     for(i = 0; i < symtabsize; i++)
         symtab[i].name = (uint32_t)(stringtab + symtab[i].name);
@@ -376,26 +445,37 @@ int elf_load(const char *fn, klibrary_t *shell, elf_prog_t *out) {
 
     /* Look for the program entry points and deal with that */
     {
-        int sym;
-
-#define DO_ONE(symname, outp) \
-    sym = find_sym(ELF_SYM_PREFIX symname, symtab, symtabsize); \
-    if(sym < 0) { \
-        dbglog(DBG_ERROR, "elf_load: ELF contains no %s()\n", symname); \
-        goto error3; \
-    } \
-    \
-    out->outp = (vma + shdrs[symtab[sym].shndx].addr \
-                 + symtab[sym].value);
-
-        DO_ONE("lib_get_name", lib_get_name);
-        DO_ONE("lib_get_version", lib_get_version);
-        DO_ONE("lib_open", lib_open);
-        DO_ONE("lib_close", lib_close);
-#undef DO_ONE
+        int idx[4];
+        uintptr_t addr[4];
+
+        if(!find_entries(symtab, symtabsize, idx)) {
+            for(j = 0; j < 4; j++) {
+                if(idx[j] < 0)
+                    dbglog(DBG_ERROR, "elf_load: ELF contains no %s()\n",
+                           entry_names[j] + ELF_SYM_PREFIX_LEN);
+            }
+
+            goto error3;
+        }
+
+        for(j = 0; j < 4; j++)
+            addr[j] = vma + shdrs[symtab[idx[j]].shndx].addr
+                      + symtab[idx[j]].value;
+
+        out->lib_get_name = addr[0];
+        out->lib_get_version = addr[1];
+        out->lib_open = addr[2];
+        out->lib_close = addr[3];
     }
 
-    free(img);
+    free(symcopy);
+    free(shcopy);
+
+    if(mapped)
+        fs_close(fd);
+    else
+        free(img);
+
     dbglog(DBG_KDEBUG, "elf_load final ELF stats: memory image at %p, size %08lx\n", out->data, out->size);
 
     /* Flush the icache for that zone */
@@ -407,7 +487,14 @@ error3:
     free(out->data);
 
 error1:
-    free(img);
+    free(symcopy);
+    free(shcopy);
+
+    if(mapped)
+        fs_close(fd);
+    else
+        free(img);
+
     return -1;
 }
 
@@ -34,12 +34,17 @@ something like this:
 #include <stdlib.h>
 #include <limits.h>
 
+#include <kos/bcache.h>
 #include <kos/fs.h>
+#include <kos/fs_aio.h>
+#include <kos/fs_pak.h>
 #include <kos/thread.h>
 #include <kos/mutex.h>
 #include <kos/nmmgr.h>
 #include <kos/dbgio.h>
 #include <kos/dbglog.h>
+#include <kos/mem_tags.h>
+#include <arch/mmu.h>
 
 /* File handle structure; this is an entirely internal structure so it does
    not go in a header file. */
@@ -48,11 +53,53 @@ typedef struct fs_hnd {
     void *hnd;   /* Handler-internal */
     int refcnt;  /* Reference count */
     int idx;     /* Current index for readdir */
+
+    /* Buffer set with F_SETBUFSIZE, or NULL. It holds either data read ahead
+       of the position, from bpos up to blen, or if dirty, blen bytes written
+       at it that the handler hasn't been given yet. */
+    uint8_t *buf;
+    size_t bufsize;
+    size_t bpos;
+    size_t blen;
+    int dirty;
+
+    /* Mapping made by the MMU pager for fs_mmap(), or NULL. */
+    void *map;
 } fs_hnd_t;
 
 /* The global file descriptor table */
 fs_hnd_t *fd_table[FD_SETSIZE] = { NULL };
 
+/* A bit for each entry of fd_table, set if it's in use, so that a free
+   descriptor can be found a word at a time. Both are changed only with
+   fd_mutex held. */
+#define FD_MAP_WORDS    ((FD_SETSIZE + 31) / 32)
+static uint32_t fd_map[FD_MAP_WORDS];
+static mutex_t fd_mutex = MUTEX_INITIALIZER;
+
+static inline void fd_set_used(int fd, fs_hnd_t *hnd) {
+    fd_table[fd] = hnd;
+
+    if(hnd)
+        fd_map[fd >> 5] |= 1U << (fd & 31);
+    else
+        fd_map[fd >> 5] &= ~(1U << (fd & 31));
+}
+
+/* Find the lowest numbered free descriptor, or -1 if there isn't one. */
+static int fd_find_free(void) {
+    int i, fd;
+
+    for(i = 0; i < FD_MAP_WORDS; ++i) {
+        if(fd_map[i] != 0xFFFFFFFF) {
+            fd = (i << 5) + __builtin_ctz(~fd_map[i]);
+            return fd < FD_SETSIZE ? fd : -1;
+        }
+    }
+
+    return -1;
+}
+
 /* Internal file commands for root dir reading */
 static fs_hnd_t *fs_root_opendir(void) {
     return calloc(1, sizeof(fs_hnd_t));
@@ -107,6 +154,8 @@ static fs_hnd_t * fs_hnd_open(const char *fn, int mode) {
     fs_hnd_t    *hnd;
     char        rfn[PATH_MAX];
 
+    mem_tag_scoped(MEM_TAG_FS);
+
     if(!fs_normalize_path(fn, rfn))
         return NULL;
 
@@ -144,7 +193,7 @@ static fs_hnd_t * fs_hnd_open(const char *fn, int mode) {
     if(h == NULL) return NULL;
 
     /* Wrap it up in a structure */
-    hnd = malloc(sizeof(fs_hnd_t));
+    hnd = calloc(1, sizeof(fs_hnd_t));
 
     if(hnd == NULL) {
         cur->close(h);
@@ -154,12 +203,154 @@ static fs_hnd_t * fs_hnd_open(const char *fn, int mode) {
 
     hnd->handler = cur;
     hnd->hnd = h;
-    hnd->refcnt = 0;
-    hnd->idx = 0;
 
     return hnd;
 }
 
+/* Hand what's in a handle's buffer back to its handler: write out what's
+   waiting to be written or, with discard set, move the handler's position
+   back over what was read ahead and forget it. Either way, the handler's
+   position is then the handle's. */
+static int fs_hnd_buf_sync(fs_hnd_t *h, int discard) {
+    size_t done = 0;
+    ssize_t rv;
+    int err = 0;
+
+    if(!h->blen)
+        return 0;
+
+    if(h->dirty) {
+        while(done < h->blen) {
+            if((rv = h->handler->write(h->hnd, h->buf + done,
+                                       h->blen - done)) <= 0) {
+                err = -1;
+                break;
+            }
+
+            done += rv;
+        }
+
+        /* What couldn't be written is lost, as the handler now has its
+           position past what could. */
+        h->blen = h->bpos = 0;
+        h->dirty = 0;
+        return err;
+    }
+
+    if(!discard)
+        return 0;
+
+    if(h->blen != h->bpos) {
+        if(h->handler->seek)
+            err = h->handler->seek(h->hnd, -(off_t)(h->blen - h->bpos),
+                                   SEEK_CUR) < 0 ? -1 : 0;
+        else
+            err = h->handler->seek64(h->hnd, -(_off64_t)(h->blen - h->bpos),
+                                     SEEK_CUR) < 0 ? -1 : 0;
+    }
+
+    h->blen = h->bpos = 0;
+    return err;
+}
+
+static ssize_t fs_hnd_buf_read(fs_hnd_t *h, uint8_t *out, size_t cnt) {
+    size_t done, n;
+    ssize_t rv;
+
+    if(h->dirty && fs_hnd_buf_sync(h, 1))
+        return -1;
+
+    /* Take what we can from what's already been read. */
+    done = h->blen - h->bpos;
+
+    if(done > cnt)
+        done = cnt;
+
+    memcpy(out, h->buf + h->bpos, done);
+    h->bpos += done;
+
+    if(done == cnt)
+        return done;
+
+    /* Reads as big as the buffer go straight to the handler. */
+    if(cnt - done >= h->bufsize) {
+        rv = h->handler->read(h->hnd, out + done, cnt - done);
+        return rv < 0 ? (done ? (ssize_t)done : -1) : (ssize_t)done + rv;
+    }
+
+    if((rv = h->handler->read(h->hnd, h->buf, h->bufsize)) <= 0) {
+        h->blen = h->bpos = 0;
+        return done ? (ssize_t)done : rv;
+    }
+
+    h->blen = rv;
+    n = cnt - done < (size_t)rv ? cnt - done : (size_t)rv;
+    memcpy(out + done, h->buf, n);
+    h->bpos = n;
+
+    return done + n;
+}
+
+static ssize_t fs_hnd_buf_write(fs_hnd_t *h, const void *in, size_t cnt) {
+    if(!h->dirty && fs_hnd_buf_sync(h, 1))
+        return -1;
+
+    if(h->blen + cnt > h->bufsize) {
+        if(fs_hnd_buf_sync(h, 0))
+            return -1;
+
+        if(cnt >= h->bufsize)
+            return h->handler->write(h->hnd, in, cnt);
+    }
+
+    memcpy(h->buf + h->blen, in, cnt);
+    h->blen += cnt;
+    h->dirty = 1;
+
+    return cnt;
+}
+
+/* Where the handle is, from where the handler is. */
+static _off64_t fs_hnd_buf_pos(fs_hnd_t *h, _off64_t pos) {
+    if(pos < 0)
+        return pos;
+
+    if(h->dirty)
+        return pos + h->blen;
+
+    return pos - (_off64_t)(h->blen - h->bpos);
+}
+
+static int fs_hnd_set_buf(fs_hnd_t *h, int size) {
+    uint8_t *buf = NULL;
+
+    /* Read data has to be given back with a seek, and the position worked
+       out with a tell. */
+    if(size < 0 || (size && (!h->handler ||
+                             (!h->handler->read && !h->handler->write) ||
+                             (!h->handler->seek && !h->handler->seek64) ||
+                             (!h->handler->tell && !h->handler->tell64)))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(size && !(buf = malloc(size))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if(fs_hnd_buf_sync(h, 1)) {
+        free(buf);
+        return -1;
+    }
+
+    free(h->buf);
+    h->buf = buf;
+    h->bufsize = size;
+
+    return 0;
+}
+
 /* Reference a file handle. This should be called when a persistent reference
    to a raw handle is created somewhere. */
 static void fs_hnd_ref(fs_hnd_t *ref) {
@@ -180,8 +371,16 @@ static int fs_hnd_unref(fs_hnd_t *ref) {
     if(--ref->refcnt > 0)
         return retval; /* Still references left, nothing to do */
 
-    if(ref->handler && ref->handler->close)
-        retval = ref->handler->close(ref->hnd);
+    if(ref->buf) {
+        retval = fs_hnd_buf_sync(ref, 0);
+        free(ref->buf);
+    }
+
+    if(ref->map)
+        mmu_mmap_release(ref->map);
+
+    if(ref->handler && ref->handler->close && ref->handler->close(ref->hnd))
+        retval = -1;
 
     free(ref);
     return retval;
@@ -194,12 +393,10 @@ static int fs_hnd_assign(fs_hnd_t *hnd) {
 
     fs_hnd_ref(hnd);
 
-    /* XXX Not thread-safe! */
-    for(i = 0; i < FD_SETSIZE; i++)
-        if(!fd_table[i])
-            break;
+    mutex_lock(&fd_mutex);
 
-    if(i >= FD_SETSIZE) {
+    if((i = fd_find_free()) < 0) {
+        mutex_unlock(&fd_mutex);
         dbglog(DBG_ERROR, "fs_hnd_assign: Update FD_SETSIZE definition in \
               opts.h to support additional files being opened. Current \
               limit is %d\n", FD_SETSIZE);
@@ -209,7 +406,8 @@ static int fs_hnd_assign(fs_hnd_t *hnd) {
         return -1;
     }
 
-    fd_table[i] = hnd;
+    fd_set_used(i, hnd);
+    mutex_unlock(&fd_mutex);
 
     return i;
 }
@@ -217,6 +415,8 @@ static int fs_hnd_assign(fs_hnd_t *hnd) {
 int fs_fdtbl_destroy(void) {
     int i;
 
+    mutex_lock(&fd_mutex);
+
     for(i = 0; i < FD_SETSIZE; i++) {
         if(fd_table[i])
             fs_hnd_unref(fd_table[i]);
@@ -224,6 +424,9 @@ int fs_fdtbl_destroy(void) {
         fd_table[i] = NULL;
     }
 
+    memset(fd_map, 0, sizeof(fd_map));
+    mutex_unlock(&fd_mutex);
+
     return 0;
 }
 
@@ -247,7 +450,7 @@ file_t fs_open_handle(vfs_handler_t *vfs, void *vhnd) {
     fs_hnd_t * hnd;
 
     /* Wrap it up in a structure */
-    hnd = malloc(sizeof(fs_hnd_t));
+    hnd = calloc(1, sizeof(fs_hnd_t));
 
     if(hnd == NULL) {
         errno = ENOMEM;
@@ -256,7 +459,6 @@ file_t fs_open_handle(vfs_handler_t *vfs, void *vhnd) {
 
     hnd->handler = vfs;
     hnd->hnd = vhnd;
-    hnd->refcnt = 0;
 
     /* Ok, that succeeded -- now look for a file descriptor. */
     return fs_hnd_assign(hnd);
@@ -310,8 +512,10 @@ file_t fs_dup2(file_t oldfd, file_t newfd) {
     if(fd_table[newfd])
         fs_close(newfd);
 
-    fd_table[newfd] = fd_table[oldfd];
+    mutex_lock(&fd_mutex);
+    fd_set_used(newfd, fd_table[oldfd]);
     fs_hnd_ref(fd_table[newfd]);
+    mutex_unlock(&fd_mutex);
 
     return newfd;
 }
@@ -339,10 +543,12 @@ int fs_close(file_t fd) {
 
     if(!h) return -1;
 
-    /* Deref it and remove it from our table */
-    retval = fs_hnd_unref(h);
+    /* Remove it from our table and deref it */
+    mutex_lock(&fd_mutex);
+    fd_set_used(fd, NULL);
+    mutex_unlock(&fd_mutex);
 
-    fd_table[fd] = NULL;
+    retval = fs_hnd_unref(h);
     return retval ? -1 : 0;
 }
 
@@ -357,6 +563,9 @@ ssize_t fs_read(file_t fd, void *buffer, size_t cnt) {
         return -1;
     }
 
+    if(h->buf)
+        return fs_hnd_buf_read(h, buffer, cnt);
+
     return h->handler->read(h->hnd, buffer, cnt);
 }
 
@@ -372,9 +581,82 @@ ssize_t fs_write(file_t fd, const void *buffer, size_t cnt) {
         return -1;
     }
 
+    if(h->buf)
+        return fs_hnd_buf_write(h, buffer, cnt);
+
     return h->handler->write(h->hnd, buffer, cnt);
 }
 
+ssize_t fs_splice(file_t fd_in, file_t fd_out, size_t len) {
+    fs_hnd_t *in = fs_map_hnd(fd_in), *out = fs_map_hnd(fd_out);
+    uint8_t *buf;
+    size_t done = 0, n, w;
+    ssize_t rv = 0, wr;
+
+    if(!in || !out)
+        return -1;
+
+    if(!in->handler || !in->handler->read ||
+       !out->handler || !out->handler->write) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!len)
+        return 0;
+
+    /* Let either end move the data itself, unless a buffer of ours (see
+       F_SETBUFSIZE) is in the way. */
+    if(!in->buf && !out->buf) {
+        if(in->handler->splice_out) {
+            rv = in->handler->splice_out(in->hnd, fd_out, len);
+
+            if(rv >= 0 || errno != ENOSYS)
+                return rv;
+        }
+
+        if(out->handler->splice_in) {
+            rv = out->handler->splice_in(out->hnd, fd_in, len);
+
+            if(rv >= 0 || errno != ENOSYS)
+                return rv;
+        }
+    }
+
+    n = len < FS_SPLICE_BUF_SIZE ? len : FS_SPLICE_BUF_SIZE;
+
+    if(!(buf = malloc(n))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    while(done < len) {
+        if(n > len - done)
+            n = len - done;
+
+        if((rv = fs_read(fd_in, buf, n)) <= 0)
+            break;
+
+        for(w = 0; w < (size_t)rv; w += wr) {
+            if((wr = fs_write(fd_out, buf + w, rv - w)) <= 0) {
+                done += w;
+                rv = wr;
+                goto out;
+            }
+        }
+
+        done += rv;
+
+        /* Don't wait on a short read for more */
+        if((size_t)rv < n)
+            break;
+    }
+
+out:
+    free(buf);
+    return done ? (ssize_t)done : rv;
+}
+
 off_t fs_seek(file_t fd, off_t offset, int whence) {
     fs_hnd_t *h = fs_map_hnd(fd);
 
@@ -385,6 +667,9 @@ off_t fs_seek(file_t fd, off_t offset, int whence) {
         return -1;
     }
 
+    if(h->buf && fs_hnd_buf_sync(h, 1))
+        return -1;
+
     /* Prefer the 32-bit version, but fall back if needed to the 64-bit one. */
     if(h->handler->seek)
         return h->handler->seek(h->hnd, offset, whence);
@@ -405,6 +690,9 @@ _off64_t fs_seek64(file_t fd, _off64_t offset, int whence) {
         return -1;
     }
 
+    if(h->buf && fs_hnd_buf_sync(h, 1))
+        return -1;
+
     /* Prefer the 64-bit version, but fall back if needed to the 32-bit one. */
     if(h->handler->seek64)
         return h->handler->seek64(h->hnd, offset, whence);
@@ -427,9 +715,9 @@ off_t fs_tell(file_t fd) {
 
     /* Prefer the 32-bit version, but fall back if needed to the 64-bit one. */
     if(h->handler->tell)
-        return h->handler->tell(h->hnd);
+        return (off_t)fs_hnd_buf_pos(h, h->handler->tell(h->hnd));
     else if(h->handler->tell64)
-        return (off_t)h->handler->tell64(h->hnd);
+        return (off_t)fs_hnd_buf_pos(h, h->handler->tell64(h->hnd));
 
     errno = EINVAL;
     return -1;
@@ -447,9 +735,9 @@ _off64_t fs_tell64(file_t fd) {
 
     /* Prefer the 64-bit version, but fall back if needed to the 32-bit one. */
     if(h->handler->tell64)
-        return h->handler->tell64(h->hnd);
+        return fs_hnd_buf_pos(h, h->handler->tell64(h->hnd));
     else if(h->handler->tell)
-        return (_off64_t)h->handler->tell(h->hnd);
+        return fs_hnd_buf_pos(h, h->handler->tell(h->hnd));
 
     errno = EINVAL;
     return -1;
@@ -465,6 +753,10 @@ size_t fs_total(file_t fd) {
         return -1;
     }
 
+    /* Writes that are waiting could make the file bigger. */
+    if(h->buf && fs_hnd_buf_sync(h, 0))
+        return -1;
+
     /* Prefer the 32-bit version, but fall back if needed to the 64-bit one. */
     if(h->handler->total)
         return h->handler->total(h->hnd);
@@ -485,6 +777,10 @@ uint64_t fs_total64(file_t fd) {
         return -1;
     }
 
+    /* Writes that are waiting could make the file bigger. */
+    if(h->buf && fs_hnd_buf_sync(h, 0))
+        return -1;
+
     /* Prefer the 64-bit version, but fall back if needed to the 32-bit one. */
     if(h->handler->total64)
         return h->handler->total64(h->hnd);
@@ -495,28 +791,63 @@ uint64_t fs_total64(file_t fd) {
     return -1;
 }
 
-dirent_t *fs_readdir(file_t fd) {
+/* Make up the status of a directory entry from the entry itself. */
+static void fs_dirent_stat(const dirent_t *d, struct stat *st) {
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = (d->attr & O_DIR) ? S_IFDIR : S_IFREG;
+    st->st_size = d->size;
+    st->st_mtime = d->time;
+    st->st_nlink = 1;
+}
+
+/* Read one entry from the handler, along with its status if st is given. */
+static dirent_t *fs_hnd_readdir(fs_hnd_t *h, struct stat *st) {
+    dirent_t *d;
+
+    if(st && h->handler->readdir_plus)
+        return h->handler->readdir_plus(h->hnd, st);
+
+    d = h->handler->readdir(h->hnd);
+
+    if(d && st)
+        fs_dirent_stat(d, st);
+
+    return d;
+}
+
+static dirent_t *fs_readdir_common(file_t fd, struct stat *st) {
     static dirent_t dot_dirent;
     static dirent_t *temp_dirent;
+    static struct stat temp_stat;
     fs_hnd_t *h = fs_map_hnd(fd);
+    dirent_t *d;
 
     if(!h) return NULL;
 
-    if(h->handler == NULL)
-        return fs_root_readdir(h);
+    if(h->handler == NULL) {
+        d = fs_root_readdir(h);
 
-    if(h->handler->readdir == NULL) {
+        if(d && st)
+            fs_dirent_stat(d, st);
+
+        return d;
+    }
+
+    if(h->handler->readdir == NULL && (!st || !h->handler->readdir_plus)) {
         errno = ENOSYS;
         return NULL;
     }
 
     switch (h->idx) {
         case 0:
-            temp_dirent = h->handler->readdir(h->hnd);
+            temp_dirent = fs_hnd_readdir(h, st ? &temp_stat : NULL);
             h->idx++;
 
             /* Does fs provide its own . directory? */
             if(temp_dirent && (strcmp(temp_dirent->name, ".") == 0)) {
+                if(st)
+                    *st = temp_stat;
+
                 return temp_dirent;
             } else {
                 /* Send . directory first */
@@ -524,6 +855,10 @@ dirent_t *fs_readdir(file_t fd) {
                 dot_dirent.attr = O_DIR;
                 dot_dirent.size = -1;
                 dot_dirent.time = 0;
+
+                if(st)
+                    fs_dirent_stat(&dot_dirent, st);
+
                 return &dot_dirent;
             }
         case 1:
@@ -532,12 +867,16 @@ dirent_t *fs_readdir(file_t fd) {
             /* Did fs provide its own . directory? */
             if(temp_dirent && (strcmp(temp_dirent->name, ".") == 0)) {
                 /* Read a new entry */
-                temp_dirent = h->handler->readdir(h->hnd);
+                temp_dirent = fs_hnd_readdir(h, st ? &temp_stat : NULL);
             }
 
             /* Does fs provide its own .. directory? */
             if(temp_dirent && (strcmp(temp_dirent->name, "..") == 0)) {
                 h->idx++;
+
+                if(st)
+                    *st = temp_stat;
+
                 return temp_dirent;
             } else {
                 /* Send .. directory second */
@@ -545,18 +884,39 @@ dirent_t *fs_readdir(file_t fd) {
                 dot_dirent.attr = O_DIR;
                 dot_dirent.size = -1;
                 dot_dirent.time = 0;
+
+                if(st)
+                    fs_dirent_stat(&dot_dirent, st);
+
                 return &dot_dirent;
             }
         case 2:
             h->idx++;
+
             /* FS didnt provide a . or .. directory. 
                Return what we read first */
+            if(temp_dirent && st)
+                *st = temp_stat;
+
             return temp_dirent;
         default:
-            return h->handler->readdir(h->hnd);
+            return fs_hnd_readdir(h, st);
     }
 }
 
+dirent_t *fs_readdir(file_t fd) {
+    return fs_readdir_common(fd, NULL);
+}
+
+dirent_t *fs_readdir_plus(file_t fd, struct stat *st) {
+    if(!st) {
+        errno = EFAULT;
+        return NULL;
+    }
+
+    return fs_readdir_common(fd, st);
+}
+
 int fs_vioctl(file_t fd, int cmd, va_list ap) {
     fs_hnd_t *h = fs_map_hnd(fd);
     int rv;
@@ -568,6 +928,9 @@ int fs_vioctl(file_t fd, int cmd, va_list ap) {
         return -1;
     }
 
+    if(h->buf && fs_hnd_buf_sync(h, 1))
+        return -1;
+
     rv = h->handler->ioctl(h->hnd, cmd, ap);
 
     return rv;
@@ -669,11 +1032,23 @@ void *fs_mmap(file_t fd) {
 
     if(!h) return NULL;
 
-    if(h->handler == NULL || h->handler->mmap == NULL) {
+    if(h->handler == NULL) {
         errno = EINVAL;
         return NULL;
     }
 
+    if(h->buf && fs_hnd_buf_sync(h, 1))
+        return NULL;
+
+    /* Filesystems that can't map a file themselves get one paged in by the
+       MMU, if that's set up. */
+    if(h->handler->mmap == NULL) {
+        if(!h->map)
+            h->map = mmu_mmap_file(fd);
+
+        return h->map;
+    }
+
     return h->handler->mmap(h->hnd);
 }
 
@@ -736,11 +1111,20 @@ static int fs_vfcntl(file_t fd, int cmd, va_list ap) {
 
     if(!h) return -1;
 
+    /* The buffer is ours, not the handler's. */
+    if(cmd == F_SETBUFSIZE)
+        return fs_hnd_set_buf(h, va_arg(ap, int));
+    else if(cmd == F_GETBUFSIZE)
+        return (int)h->bufsize;
+
     if(!h->handler || !h->handler->fcntl) {
         errno = ENOSYS;
         return -1;
     }
 
+    if(h->buf && fs_hnd_buf_sync(h, 1))
+        return -1;
+
     rv = h->handler->fcntl(h->hnd, cmd, ap);
 
     return rv;
@@ -931,6 +1315,9 @@ int fs_fstat(file_t fd, struct stat *st) {
         return -1;
     }
 
+    if(h->buf && fs_hnd_buf_sync(h, 0))
+        return -1;
+
     return h->handler->fstat(h->hnd, st);
 }
 
@@ -940,5 +1327,8 @@ int fs_init(void) {
 }
 
 void fs_shutdown(void) {
+    fs_pak_shutdown();
+    fs_aio_shutdown();
+    bcache_shutdown();
     fs_fdtbl_destroy();
 }
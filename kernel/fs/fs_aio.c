@@ -0,0 +1,217 @@
+/* KallistiOS ##version##
+
+   fs_aio.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Asynchronous I/O. Requests a filesystem doesn't take itself go to one
+   worker thread, which also makes the callbacks of those completed from an
+   interrupt. A filesystem is only offered a request while the worker has no
+   transfers queued, so that the worker can't be left doing an older request
+   on a file after a newer one has already gone ahead of it. */
+
+#include <arch/irq.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include <kos/fs.h>
+#include <kos/fs_aio.h>
+#include <kos/genwait.h>
+#include <kos/mutex.h>
+#include <kos/thread.h>
+#include <kos/worker_thread.h>
+
+/* fs_aio_t.state */
+#define AIO_QUEUED      0       /* Waiting on the worker to do it */
+#define AIO_BUSY        1       /* Being done by the filesystem */
+#define AIO_CALLBACK    2       /* Over, waiting on the worker to call back */
+#define AIO_DONE        3       /* Over, waiting on fs_aio_wait() */
+
+static kthread_worker_t *worker;
+static mutex_t worker_mutex = MUTEX_INITIALIZER;
+
+/* Jobs on the worker, and how many of them are transfers */
+static size_t jobs, transfers;
+
+static void aio_queue(fs_aio_t *req) {
+    irq_disable_scoped();
+
+    jobs++;
+
+    if(req->state == AIO_QUEUED)
+        transfers++;
+
+    thd_worker_add_job(worker, &req->job);
+    thd_worker_wakeup(worker);
+}
+
+static void aio_finish(fs_aio_t *req) {
+    if(req->cb) {
+        req->cb(req->data, req->rv, req->err);
+        free(req);
+        return;
+    }
+
+    irq_disable_scoped();
+    req->state = AIO_DONE;
+    genwait_wake_all(req);
+}
+
+static void aio_worker(void *d) {
+    kthread_job_t *job;
+    fs_aio_t *req;
+    uint32_t flags;
+
+    (void)d;
+
+    for(;;) {
+        flags = irq_disable();
+
+        if(!jobs) {
+            irq_restore(flags);
+            break;
+        }
+
+        jobs--;
+        job = thd_worker_dequeue_job(worker);
+        irq_restore(flags);
+
+        req = (fs_aio_t *)job->data;
+
+        if(req->state == AIO_QUEUED) {
+            if(req->write)
+                req->rv = fs_write(req->fd, req->buf, req->cnt);
+            else
+                req->rv = fs_read(req->fd, req->buf, req->cnt);
+
+            req->err = req->rv < 0 ? errno : 0;
+
+            flags = irq_disable();
+            transfers--;
+            irq_restore(flags);
+        }
+
+        aio_finish(req);
+    }
+}
+
+static int aio_start_worker(void) {
+    const kthread_attr_t attr = {
+        .label = "fs_aio"
+    };
+
+    mutex_lock_scoped(&worker_mutex);
+
+    if(!worker && !(worker = thd_worker_create_ex(&attr, aio_worker, NULL))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+static fs_aio_t *aio_submit(file_t fd, void *buf, size_t cnt, int write,
+                            fs_aio_cb_t cb, void *data) {
+    vfs_handler_t *vfs = fs_get_handler(fd);
+    void *hnd = fs_get_handle(fd);
+    int (*native)(void *, fs_aio_t *);
+    fs_aio_t *req;
+
+    if(!vfs || !hnd) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    if(!worker && aio_start_worker() < 0)
+        return NULL;
+
+    if(!(req = malloc(sizeof(fs_aio_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    *req = (fs_aio_t) {
+        .job = { .data = req },
+        .fd = fd,
+        .buf = buf,
+        .cnt = cnt,
+        .write = write,
+        .cb = cb,
+        .data = data,
+        .state = AIO_BUSY
+    };
+
+    native = write ? vfs->write_async : vfs->read_async;
+
+    if(native && !transfers && native(hnd, req) == 0)
+        return req;
+
+    req->state = AIO_QUEUED;
+    aio_queue(req);
+
+    return req;
+}
+
+fs_aio_t *fs_read_async(file_t fd, void *buf, size_t cnt, fs_aio_cb_t cb,
+                        void *data) {
+    return aio_submit(fd, buf, cnt, 0, cb, data);
+}
+
+fs_aio_t *fs_write_async(file_t fd, const void *buf, size_t cnt,
+                         fs_aio_cb_t cb, void *data) {
+    return aio_submit(fd, (void *)buf, cnt, 1, cb, data);
+}
+
+void fs_aio_complete(fs_aio_t *req, ssize_t rv, int err) {
+    req->rv = rv;
+    req->err = rv < 0 ? err : 0;
+
+    /* Callbacks are never made from an interrupt. */
+    if(req->cb) {
+        req->state = AIO_CALLBACK;
+        aio_queue(req);
+        return;
+    }
+
+    irq_disable_scoped();
+    req->state = AIO_DONE;
+    genwait_wake_all(req);
+}
+
+int fs_aio_done(const fs_aio_t *req) {
+    return req->state == AIO_DONE;
+}
+
+ssize_t fs_aio_wait(fs_aio_t *req) {
+    ssize_t rv;
+    uint32_t flags;
+
+    if(req->cb) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    flags = irq_disable();
+
+    while(req->state != AIO_DONE)
+        genwait_wait(req, "fs_aio_wait", 0, NULL);
+
+    irq_restore(flags);
+
+    rv = req->rv;
+
+    if(rv < 0)
+        errno = req->err;
+
+    free(req);
+    return rv;
+}
+
+void fs_aio_shutdown(void) {
+    mutex_lock_scoped(&worker_mutex);
+
+    if(worker) {
+        thd_worker_destroy(worker);
+        worker = NULL;
+    }
+}
@@ -12,6 +12,9 @@
 
 #include <kos/dbglog.h>
 #include <kos/fs_dev.h>
+#include <kos/init.h>
+#include <kos/mem_tags.h>
+#include <kos/net.h>
 #include <sys/queue.h>
 
 /* File handle structure; this is an entirely internal structure so it does
@@ -178,13 +181,302 @@ static vfs_handler_t vh = {
     NULL                /* fstat */
 };
 
+/* Text nodes: a snapshot of some statistics, formatted when opened. */
+#define TEXT_SIZE       2048
+
+typedef struct text_hnd {
+    size_t len;
+    size_t pos;
+    char buf[TEXT_SIZE];
+} text_hnd_t;
+
+static void *text_open(const char *fn, int mode,
+                       size_t (*format)(char *buf, size_t size)) {
+    text_hnd_t *hnd;
+
+    if(strcmp(fn, "/") && strcmp(fn, "")) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    if((mode & O_MODE_MASK) != O_RDONLY || (mode & O_DIR)) {
+        errno = EPERM;
+        return NULL;
+    }
+
+    if(!(hnd = malloc(sizeof(*hnd)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    hnd->len = format(hnd->buf, sizeof(hnd->buf));
+    hnd->pos = 0;
+
+    return hnd;
+}
+
+static int text_close(void *h) {
+    free(h);
+    return 0;
+}
+
+static ssize_t text_read(void *h, void *buf, size_t cnt) {
+    text_hnd_t *hnd = (text_hnd_t *)h;
+
+    if(cnt > hnd->len - hnd->pos)
+        cnt = hnd->len - hnd->pos;
+
+    memcpy(buf, hnd->buf + hnd->pos, cnt);
+    hnd->pos += cnt;
+
+    return cnt;
+}
+
+static off_t text_seek(void *h, off_t offset, int whence) {
+    text_hnd_t *hnd = (text_hnd_t *)h;
+
+    switch(whence) {
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += hnd->pos;
+            break;
+        case SEEK_END:
+            offset += hnd->len;
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    if(offset < 0 || (size_t)offset > hnd->len) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    hnd->pos = offset;
+
+    return offset;
+}
+
+static off_t text_tell(void *h) {
+    return ((text_hnd_t *)h)->pos;
+}
+
+static size_t text_total(void *h) {
+    return ((text_hnd_t *)h)->len;
+}
+
+static int text_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
+                     int flag) {
+    (void)vfs;
+    (void)path;
+    (void)flag;
+
+    memset(st, 0, sizeof(struct stat));
+    st->st_dev = (dev_t)('d' | ('e' << 8) | ('v' << 16));
+    st->st_mode = S_IFREG | S_IRUSR | S_IRGRP | S_IROTH;
+    st->st_size = 0;
+    st->st_nlink = 1;
+
+    return 0;
+}
+
+/* Handler of a text node, whose open function formats the snapshot. */
+#define TEXT_VH(path, open) { \
+    /* Name handler */ \
+    { \
+        path,               /* name */ \
+        0,                  /* tbfi */ \
+        0x00010000,         /* Version 1.0 */ \
+        NMMGR_FLAGS_INDEV,  /* flags */ \
+        NMMGR_TYPE_VFS,     /* VFS handler */ \
+        NMMGR_LIST_INIT \
+    }, \
+    0, NULL,            /* In-kernel, privdata */ \
+\
+    open, \
+    text_close, \
+    text_read, \
+    NULL,               /* write */ \
+    text_seek, \
+    text_tell, \
+    text_total, \
+    NULL,               /* readdir */ \
+    NULL,               /* ioctl */ \
+    NULL,               /* rename/move */ \
+    NULL,               /* unlink */ \
+    NULL,               /* mmap */ \
+    NULL,               /* complete */ \
+    text_stat, \
+    NULL,               /* mkdir */ \
+    NULL,               /* rmdir */ \
+    NULL,               /* fcntl */ \
+    NULL,               /* poll */ \
+    NULL,               /* link */ \
+    NULL,               /* symlink */ \
+    NULL,               /* seek64 */ \
+    NULL,               /* tell64 */ \
+    NULL,               /* total64 */ \
+    NULL,               /* readlink */ \
+    NULL,               /* rewinddir */ \
+    NULL                /* fstat */ \
+}
+
+/* /dev/meminfo: a text snapshot of kos_mem_stats(). */
+static size_t meminfo_format(char *buf, size_t size) {
+    kos_mem_stats_t st;
+    size_t len;
+    int i;
+
+    kos_mem_stats(&st);
+
+    len = snprintf(buf, size,
+                   "HeapSize:  %10zu\n"
+                   "HeapUsed:  %10zu\n"
+                   "HeapFree:  %10zu\n"
+                   "VramSize:  %10zu\n"
+                   "VramFree:  %10zu\n"
+                   "AramSize:  %10zu\n"
+                   "AramFree:  %10zu\n",
+                   st.heap_size, st.heap_used, st.heap_free,
+                   st.vram_size, st.vram_free, st.aram_size, st.aram_free);
+
+    if(!(__kos_init_flags & INIT_MALLOCTAGS))
+        return len;
+
+    len += snprintf(buf + len, size - len, "\n%-10s %10s %10s %10s\n",
+                    "Tag", "Current", "Peak", "Blocks");
+
+    for(i = 0; i < MEM_TAG_COUNT && len < size; i++) {
+        len += snprintf(buf + len, size - len, "%-10s %10zu %10zu %10zu\n",
+                        mem_tag_name(i), st.tags[i].current,
+                        st.tags[i].peak, st.tags[i].blocks);
+    }
+
+    return len < size ? len : size - 1;
+}
+
+static void *meminfo_open(vfs_handler_t *vfs, const char *fn, int mode) {
+    (void)vfs;
+    return text_open(fn, mode, meminfo_format);
+}
+
+static vfs_handler_t meminfo_vh = TEXT_VH("/dev/meminfo", meminfo_open);
+
+/* /dev/net: a text snapshot of the network stack's counters. Every device gets
+   a line, and every protocol a line of names followed by one of values. */
+static size_t net_format(char *buf, size_t size) {
+    struct netif_list *list = net_get_if_list();
+    net_ipv4_stats_t ip4 = net_ipv4_get_stats();
+    net_ipv6_stats_t ip6 = net_ipv6_get_stats();
+    net_arp_stats_t arp = net_arp_get_stats();
+    net_udp_stats_t udp = net_udp_get_stats();
+    net_tcp_stats_t tcp = net_tcp_get_stats();
+    netif_t *nif;
+    size_t len;
+
+    len = snprintf(buf, size, "%-6s %10s %12s %8s %10s %12s %8s\n",
+                   "Iface", "RxPkts", "RxBytes", "RxDrop", "TxPkts",
+                   "TxBytes", "TxFail");
+
+    LIST_FOREACH(nif, list, if_list) {
+        if(len >= size)
+            break;
+
+        len += snprintf(buf + len, size - len,
+                        "%.4s%-2d %10lu %12llu %8lu %10lu %12llu %8lu\n",
+                        nif->name, nif->index,
+                        (unsigned long)nif->stats.pkt_recv,
+                        (unsigned long long)nif->stats.bytes_recv,
+                        (unsigned long)nif->stats.pkt_recv_dropped,
+                        (unsigned long)nif->stats.pkt_sent,
+                        (unsigned long long)nif->stats.bytes_sent,
+                        (unsigned long)nif->stats.pkt_send_failed);
+    }
+
+    if(len < size)
+        len += snprintf(buf + len, size - len,
+                        "\nIp: Sent SendFailed Recv BadSize BadChksum "
+                        "BadProto\nIp: %lu %lu %lu %lu %lu %lu\n",
+                        (unsigned long)ip4.pkt_sent,
+                        (unsigned long)ip4.pkt_send_failed,
+                        (unsigned long)ip4.pkt_recv,
+                        (unsigned long)ip4.pkt_recv_bad_size,
+                        (unsigned long)ip4.pkt_recv_bad_chksum,
+                        (unsigned long)ip4.pkt_recv_bad_proto);
+
+    if(len < size)
+        len += snprintf(buf + len, size - len,
+                        "Ip6: Sent SendFailed Recv BadSize BadProto BadExt\n"
+                        "Ip6: %lu %lu %lu %lu %lu %lu\n",
+                        (unsigned long)ip6.pkt_sent,
+                        (unsigned long)ip6.pkt_send_failed,
+                        (unsigned long)ip6.pkt_recv,
+                        (unsigned long)ip6.pkt_recv_bad_size,
+                        (unsigned long)ip6.pkt_recv_bad_proto,
+                        (unsigned long)ip6.pkt_recv_bad_ext);
+
+    if(len < size)
+        len += snprintf(buf + len, size - len,
+                        "Arp: Misses Queries Queued QueueFull TimedOut "
+                        "Pending\nArp: %lu %lu %lu %lu %lu %lu\n",
+                        (unsigned long)arp.lookup_miss,
+                        (unsigned long)arp.query_sent,
+                        (unsigned long)arp.pkt_queued,
+                        (unsigned long)arp.pkt_queue_full,
+                        (unsigned long)arp.pkt_timed_out,
+                        (unsigned long)arp.pending);
+
+    if(len < size)
+        len += snprintf(buf + len, size - len,
+                        "Udp: Sent SendFailed Recv BadSize BadChksum NoSock "
+                        "NoSpace Queued\nUdp: %lu %lu %lu %lu %lu %lu %lu "
+                        "%lu\n",
+                        (unsigned long)udp.pkt_sent,
+                        (unsigned long)udp.pkt_send_failed,
+                        (unsigned long)udp.pkt_recv,
+                        (unsigned long)udp.pkt_recv_bad_size,
+                        (unsigned long)udp.pkt_recv_bad_chksum,
+                        (unsigned long)udp.pkt_recv_no_sock,
+                        (unsigned long)udp.pkt_recv_no_space,
+                        (unsigned long)udp.pkt_queued);
+
+    if(len < size)
+        len += snprintf(buf + len, size - len,
+                        "Tcp: Sent SendFailed Resent Recv BadChksum NoSock "
+                        "OutOfOrder OutsideWnd\nTcp: %lu %lu %lu %lu %lu %lu "
+                        "%lu %lu\n",
+                        (unsigned long)tcp.pkt_sent,
+                        (unsigned long)tcp.pkt_send_failed,
+                        (unsigned long)tcp.pkt_resent,
+                        (unsigned long)tcp.pkt_recv,
+                        (unsigned long)tcp.pkt_recv_bad_chksum,
+                        (unsigned long)tcp.pkt_recv_no_sock,
+                        (unsigned long)tcp.pkt_recv_out_of_order,
+                        (unsigned long)tcp.pkt_recv_outside_wnd);
+
+    return len < size ? len : size - 1;
+}
+
+static void *net_open(vfs_handler_t *vfs, const char *fn, int mode) {
+    (void)vfs;
+    return text_open(fn, mode, net_format);
+}
+
+static vfs_handler_t net_vh = TEXT_VH("/dev/net", net_open);
+
 void fs_dev_init(void) {
     dev_root_hnd.handler = &vh.nmmgr;
     dev_root_hnd.refcnt = 0;
     nmmgr_handler_add(&vh.nmmgr);
+    nmmgr_handler_add(&meminfo_vh.nmmgr);
+    nmmgr_handler_add(&net_vh.nmmgr);
 }
 
 void fs_dev_shutdown(void) {
+    nmmgr_handler_remove(&net_vh.nmmgr);
+    nmmgr_handler_remove(&meminfo_vh.nmmgr);
     memset(&dev_root_hnd, 0, sizeof(dev_root_hnd));
     nmmgr_handler_remove(&vh.nmmgr);
 }
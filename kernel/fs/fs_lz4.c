@@ -0,0 +1,77 @@
+/* KallistiOS ##version##
+
+   fs_lz4.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* LZ4 block decompression, for the file systems that store compressed
+   data. Each sequence is a token, literals and a match: the token's high
+   nibble is the number of literals and its low nibble the match length less
+   4, either extended by bytes up to 255 when 15, and the match is a 16-bit
+   little-endian offset back into what has been decompressed. */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "fs_lz4.h"
+
+ssize_t fs_lz4_decode(const void *src, size_t slen, void *dst, size_t dlen) {
+    const uint8_t *s = src, *send = s + slen;
+    uint8_t *d = dst, *dend = d + dlen;
+    size_t len, off;
+    unsigned int tok;
+
+    while(s < send) {
+        tok = *s++;
+        len = tok >> 4;
+
+        if(len == 15) {
+            do {
+                if(s == send)
+                    return -1;
+
+                len += *s;
+            } while(*s++ == 255);
+        }
+
+        if(len > (size_t)(send - s) || len > (size_t)(dend - d))
+            return -1;
+
+        memcpy(d, s, len);
+        d += len;
+        s += len;
+
+        /* The last sequence is only literals */
+        if(s == send)
+            break;
+
+        if(send - s < 2)
+            return -1;
+
+        off = s[0] | (s[1] << 8);
+        s += 2;
+
+        if(!off || off > (size_t)(d - (uint8_t *)dst))
+            return -1;
+
+        len = (tok & 15) + 4;
+
+        if((tok & 15) == 15) {
+            do {
+                if(s == send)
+                    return -1;
+
+                len += *s;
+            } while(*s++ == 255);
+        }
+
+        if(len > (size_t)(dend - d))
+            return -1;
+
+        /* Matches can overlap what they make, byte by byte */
+        for(; len; len--, d++)
+            *d = d[-off];
+    }
+
+    return d - (uint8_t *)dst;
+}
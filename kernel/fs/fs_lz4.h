@@ -0,0 +1,23 @@
+/* KallistiOS ##version##
+
+   kernel/fs/fs_lz4.h
+   Copyright (C) 2026 KallistiOS Contributors
+
+*/
+
+#ifndef __LOCAL_FS_LZ4_H
+#define __LOCAL_FS_LZ4_H
+
+#include <kos/cdefs.h>
+#include <sys/types.h>
+
+__BEGIN_DECLS
+
+/* Decompress one LZ4 block (not frame) of slen bytes into at most dlen
+   bytes. Returns how many bytes it came to, or -1 if the block is corrupt or
+   doesn't fit. */
+ssize_t fs_lz4_decode(const void *src, size_t slen, void *dst, size_t dlen);
+
+__END_DECLS
+
+#endif /* !__LOCAL_FS_LZ4_H */
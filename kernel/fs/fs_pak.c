@@ -0,0 +1,717 @@
+/* KallistiOS ##version##
+
+   fs_pak.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Packed archives, as made by utils/mkpak. The whole index is read in when
+   an archive is mounted, so an open is a binary search in RAM. Data is read
+   through the one handle on the archive each mount has, which is only
+   sought when a read doesn't carry on from the last one. */
+
+#include <kos/fs_pak.h>
+#include <kos/mutex.h>
+#include <kos/nmmgr.h>
+#include <kos/dbglog.h>
+
+#include <sys/queue.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "fs_lz4.h"
+
+/* Reads smaller than this go through the handle's buffer */
+#define PAK_BUF_SIZE    (8 * PAK_ALIGN)
+
+typedef struct pak {
+    LIST_ENTRY(pak) list_ent;
+    vfs_handler_t *vfsh;
+
+    file_t fd;                      /* The archive */
+    const uint8_t *image;           /* The archive, if it could be mapped */
+    uint32_t pos;                   /* Where fd is */
+    mutex_t mutex;                  /* For reads from fd */
+
+    const pak_entry_t *ents;
+    uint32_t count;
+    const char *names;
+    void *index;                    /* The entries and names */
+    int refs;                       /* Open handles */
+} pak_t;
+
+typedef struct pak_fd {
+    pak_t *pak;
+    const pak_entry_t *ent;         /* NULL for the top directory */
+    bool dir;
+    uint32_t ptr;                   /* Position, or next entry to list */
+    uint32_t size;
+
+    uint8_t *data;                  /* The whole file, once loaded */
+    uint8_t *buf;                   /* Recently read from the archive */
+    uint32_t buf_pos, buf_len;
+
+    dirent_t dirent;
+} pak_fd_t;
+
+static LIST_HEAD(pak_list, pak) paks = LIST_HEAD_INITIALIZER(paks);
+static mutex_t paks_mutex = MUTEX_INITIALIZER;
+
+/* FNV-1a, in lower case */
+static uint32_t pak_hash(const char *fn, size_t len) {
+    uint32_t h = 2166136261U;
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        h ^= (uint8_t)tolower((unsigned char)fn[i]);
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static const pak_entry_t *pak_find(const pak_t *pak, const char *fn, bool dir) {
+    const pak_entry_t *e;
+    uint32_t lo = 0, hi = pak->count, mid, h, flag = dir ? PAK_FLAG_DIR : 0;
+    size_t len;
+
+    while(*fn == '/')
+        fn++;
+
+    len = strlen(fn);
+
+    while(len && fn[len - 1] == '/')
+        len--;
+
+    h = pak_hash(fn, len);
+
+    /* First entry with the hash */
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+
+        if(pak->ents[mid].hash < h)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for(e = pak->ents + lo; e < pak->ents + pak->count && e->hash == h; e++) {
+        if((e->flags & PAK_FLAG_DIR) == flag &&
+           !strncasecmp(pak->names + e->name, fn, len) &&
+           !pak->names[e->name + len]) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+/* Read from the archive */
+static int pak_read_at(pak_t *pak, uint32_t offset, void *buf, size_t len) {
+    ssize_t rv;
+
+    if(pak->image) {
+        memcpy(buf, pak->image + offset, len);
+        return 0;
+    }
+
+    mutex_lock_scoped(&pak->mutex);
+
+    if(pak->pos != offset) {
+        if(fs_seek(pak->fd, offset, SEEK_SET) != (off_t)offset) {
+            pak->pos = UINT32_MAX;
+            errno = EIO;
+            return -1;
+        }
+
+        pak->pos = offset;
+    }
+
+    rv = fs_read(pak->fd, buf, len);
+
+    if(rv != (ssize_t)len) {
+        pak->pos = UINT32_MAX;
+        errno = EIO;
+        return -1;
+    }
+
+    pak->pos += len;
+
+    return 0;
+}
+
+/* Load a whole file into RAM */
+static int pak_load(pak_fd_t *fd) {
+    const pak_entry_t *e = fd->ent;
+    const uint8_t *src;
+    uint8_t *tmp = NULL;
+    int rv = -1;
+
+    if(fd->data)
+        return 0;
+
+    if(!(fd->data = malloc(e->size ? e->size : 1))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if(!(e->flags & PAK_FLAG_LZ4)) {
+        rv = pak_read_at(fd->pak, e->offset, fd->data, e->size);
+        goto out;
+    }
+
+    if(fd->pak->image) {
+        src = fd->pak->image + e->offset;
+    }
+    else {
+        if(!(tmp = malloc(e->stored ? e->stored : 1))) {
+            errno = ENOMEM;
+            goto out;
+        }
+
+        if(pak_read_at(fd->pak, e->offset, tmp, e->stored) < 0)
+            goto out;
+
+        src = tmp;
+    }
+
+    if(fs_lz4_decode(src, e->stored, fd->data, e->size) != (ssize_t)e->size) {
+        dbglog(DBG_ERROR, "fs_pak: %s is corrupt\n",
+               fd->pak->names + e->name);
+        errno = EIO;
+        goto out;
+    }
+
+    rv = 0;
+
+out:
+    free(tmp);
+
+    if(rv < 0) {
+        free(fd->data);
+        fd->data = NULL;
+    }
+
+    return rv;
+}
+
+static void *pak_open(vfs_handler_t *vfs, const char *fn, int mode) {
+    pak_t *pak = (pak_t *)vfs->privdata;
+    const pak_entry_t *e = NULL;
+    const char *p = fn;
+    pak_fd_t *fd;
+    bool dir = (mode & O_DIR) != 0;
+
+    if((mode & O_MODE_MASK) != O_RDONLY) {
+        errno = EROFS;
+        return NULL;
+    }
+
+    while(*p == '/')
+        p++;
+
+    if(!dir || *p) {
+        if(!(e = pak_find(pak, fn, dir))) {
+            errno = ENOENT;
+            return NULL;
+        }
+    }
+
+    if(!(fd = calloc(1, sizeof(pak_fd_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    fd->pak = pak;
+    fd->ent = e;
+    fd->dir = dir;
+    fd->size = dir ? 0 : e->size;
+
+    mutex_lock(&paks_mutex);
+    pak->refs++;
+    mutex_unlock(&paks_mutex);
+
+    return fd;
+}
+
+static int pak_close(void *h) {
+    pak_fd_t *fd = (pak_fd_t *)h;
+
+    mutex_lock(&paks_mutex);
+    fd->pak->refs--;
+    mutex_unlock(&paks_mutex);
+
+    free(fd->data);
+    free(fd->buf);
+    free(fd);
+
+    return 0;
+}
+
+static ssize_t pak_read(void *h, void *buf, size_t bytes) {
+    pak_fd_t *fd = (pak_fd_t *)h;
+    uint8_t *out = (uint8_t *)buf;
+    uint32_t n, off;
+    size_t rv;
+
+    if(fd->dir) {
+        errno = EISDIR;
+        return -1;
+    }
+
+    if(bytes > fd->size - fd->ptr)
+        bytes = fd->size - fd->ptr;
+
+    if(!bytes)
+        return 0;
+
+    /* Compressed files are only ever read whole */
+    if(fd->ent->flags & PAK_FLAG_LZ4) {
+        if(pak_load(fd) < 0)
+            return -1;
+
+        memcpy(out, fd->data + fd->ptr, bytes);
+        fd->ptr += bytes;
+        return bytes;
+    }
+
+    /* No point buffering what's in RAM already, or big reads */
+    if(fd->pak->image || fd->data || bytes >= PAK_BUF_SIZE) {
+        if(fd->data)
+            memcpy(out, fd->data + fd->ptr, bytes);
+        else if(pak_read_at(fd->pak, fd->ent->offset + fd->ptr, out, bytes) < 0)
+            return -1;
+
+        fd->ptr += bytes;
+        return bytes;
+    }
+
+    /* Small reads go through the buffer, a sector-aligned window on the
+       file refilled with one read from the archive. */
+    for(rv = 0; rv < bytes; rv += n) {
+        if(fd->ptr < fd->buf_pos || fd->ptr >= fd->buf_pos + fd->buf_len) {
+            if(!fd->buf && !(fd->buf = malloc(PAK_BUF_SIZE))) {
+                errno = ENOMEM;
+                return -1;
+            }
+
+            fd->buf_pos = fd->ptr & ~(PAK_ALIGN - 1);
+            fd->buf_len = fd->size - fd->buf_pos;
+
+            if(fd->buf_len > PAK_BUF_SIZE)
+                fd->buf_len = PAK_BUF_SIZE;
+
+            if(pak_read_at(fd->pak, fd->ent->offset + fd->buf_pos, fd->buf,
+                           fd->buf_len) < 0) {
+                fd->buf_len = 0;
+                return -1;
+            }
+        }
+
+        off = fd->ptr - fd->buf_pos;
+        n = fd->buf_len - off;
+
+        if(n > bytes - rv)
+            n = bytes - rv;
+
+        memcpy(out + rv, fd->buf + off, n);
+        fd->ptr += n;
+    }
+
+    return rv;
+}
+
+static off_t pak_seek(void *h, off_t offset, int whence) {
+    pak_fd_t *fd = (pak_fd_t *)h;
+
+    if(fd->dir) {
+        errno = EBADF;
+        return -1;
+    }
+
+    switch(whence) {
+        case SEEK_SET:
+            break;
+
+        case SEEK_CUR:
+            offset += fd->ptr;
+            break;
+
+        case SEEK_END:
+            offset += fd->size;
+            break;
+
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    if(offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(offset > fd->size)
+        offset = fd->size;
+
+    fd->ptr = offset;
+
+    return fd->ptr;
+}
+
+static off_t pak_tell(void *h) {
+    pak_fd_t *fd = (pak_fd_t *)h;
+
+    if(fd->dir) {
+        errno = EBADF;
+        return -1;
+    }
+
+    return fd->ptr;
+}
+
+static size_t pak_total(void *h) {
+    pak_fd_t *fd = (pak_fd_t *)h;
+
+    if(fd->dir) {
+        errno = EBADF;
+        return -1;
+    }
+
+    return fd->size;
+}
+
+/* Entries in a directory are the ones whose paths are the directory's, a
+   slash, and no other slash. */
+static dirent_t *pak_readdir(void *h) {
+    pak_fd_t *fd = (pak_fd_t *)h;
+    const pak_t *pak = fd->pak;
+    const pak_entry_t *e;
+    const char *dir = fd->ent ? pak->names + fd->ent->name : "", *name;
+    size_t len = strlen(dir);
+
+    if(!fd->dir) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    while(fd->ptr < pak->count) {
+        e = &pak->ents[fd->ptr++];
+        name = pak->names + e->name;
+
+        if(len) {
+            if(strncasecmp(name, dir, len) || name[len] != '/')
+                continue;
+
+            name += len + 1;
+        }
+
+        if(!*name || strchr(name, '/'))
+            continue;
+
+        strncpy(fd->dirent.name, name, sizeof(fd->dirent.name) - 1);
+        fd->dirent.name[sizeof(fd->dirent.name) - 1] = '\0';
+        fd->dirent.time = 0;
+
+        if(e->flags & PAK_FLAG_DIR) {
+            fd->dirent.attr = O_DIR;
+            fd->dirent.size = -1;
+        }
+        else {
+            fd->dirent.attr = 0;
+            fd->dirent.size = e->size;
+        }
+
+        return &fd->dirent;
+    }
+
+    return NULL;
+}
+
+static int pak_rewinddir(void *h) {
+    pak_fd_t *fd = (pak_fd_t *)h;
+
+    if(!fd->dir) {
+        errno = EBADF;
+        return -1;
+    }
+
+    fd->ptr = 0;
+    return 0;
+}
+
+static void *pak_mmap(void *h) {
+    pak_fd_t *fd = (pak_fd_t *)h;
+
+    if(fd->dir) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(fd->pak->image && !(fd->ent->flags & PAK_FLAG_LZ4))
+        return (void *)(fd->pak->image + fd->ent->offset);
+
+    if(pak_load(fd) < 0)
+        return NULL;
+
+    return fd->data;
+}
+
+static void pak_fill_stat(const pak_t *pak, const pak_entry_t *e, bool dir,
+                          struct stat *st) {
+    memset(st, 0, sizeof(struct stat));
+    st->st_dev = (dev_t)((uintptr_t)pak);
+    st->st_mode = S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH;
+    st->st_blksize = PAK_ALIGN;
+
+    if(dir) {
+        st->st_mode |= S_IFDIR;
+        st->st_size = -1;
+        st->st_nlink = 2;
+    }
+    else {
+        st->st_mode |= S_IFREG;
+        st->st_size = e->size;
+        st->st_nlink = 1;
+        st->st_blocks = (e->stored + 511) / 512;
+    }
+}
+
+static int pak_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
+                    int flag) {
+    pak_t *pak = (pak_t *)vfs->privdata;
+    const pak_entry_t *e = NULL;
+    const char *p = path;
+    bool dir = true;
+
+    (void)flag;
+
+    while(*p == '/')
+        p++;
+
+    /* Anything but the top directory is looked up as a file first */
+    if(*p) {
+        if((e = pak_find(pak, path, false)))
+            dir = false;
+        else if(!(e = pak_find(pak, path, true))) {
+            errno = ENOENT;
+            return -1;
+        }
+    }
+
+    pak_fill_stat(pak, e, dir, st);
+
+    return 0;
+}
+
+static int pak_fstat(void *h, struct stat *st) {
+    pak_fd_t *fd = (pak_fd_t *)h;
+
+    pak_fill_stat(fd->pak, fd->ent, fd->dir, st);
+
+    return 0;
+}
+
+static int pak_fcntl(void *h, int cmd, va_list ap) {
+    pak_fd_t *fd = (pak_fd_t *)h;
+
+    (void)ap;
+
+    switch(cmd) {
+        case F_GETFL:
+            return O_RDONLY | (fd->dir ? O_DIR : 0);
+
+        case F_SETFL:
+        case F_GETFD:
+        case F_SETFD:
+            return 0;
+
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+/* This is a template that will be used for each mount */
+static vfs_handler_t vh = {
+    /* Name Handler */
+    {
+        { 0 },                  /* name */
+        0,                      /* in-kernel */
+        0x00010000,             /* Version 1.0 */
+        NMMGR_FLAGS_NEEDSFREE,  /* We malloc each VFS struct */
+        NMMGR_TYPE_VFS,         /* VFS handler */
+        NMMGR_LIST_INIT         /* list */
+    },
+
+    0, NULL,                    /* no caching, privdata */
+
+    pak_open,
+    pak_close,
+    pak_read,
+    NULL,                       /* write */
+    pak_seek,
+    pak_tell,
+    pak_total,
+    pak_readdir,
+    NULL,                       /* ioctl */
+    NULL,                       /* rename */
+    NULL,                       /* unlink */
+    pak_mmap,
+    NULL,                       /* complete */
+    pak_stat,
+    NULL,                       /* mkdir */
+    NULL,                       /* rmdir */
+    pak_fcntl,
+    NULL,                       /* poll */
+    NULL,                       /* link */
+    NULL,                       /* symlink */
+    NULL,                       /* seek64 */
+    NULL,                       /* tell64 */
+    NULL,                       /* total64 */
+    NULL,                       /* readlink */
+    pak_rewinddir,
+    pak_fstat,
+    NULL,                       /* read_async */
+    NULL                        /* write_async */
+};
+
+static void pak_free(pak_t *pak) {
+    mutex_destroy(&pak->mutex);
+    fs_close(pak->fd);
+    free(pak->index);
+    free(pak->vfsh);
+    free(pak);
+}
+
+int fs_pak_mount(const char *mountpoint, const char *fn) {
+    pak_hdr_t hdr;
+    pak_t *pak;
+    size_t size;
+    uint32_t i;
+    file_t fd;
+    int err;
+
+    if((fd = fs_open(fn, O_RDONLY)) < 0)
+        return -1;
+
+    if(fs_read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        fs_close(fd);
+        errno = EIO;
+        return -1;
+    }
+
+    if(hdr.magic != PAK_MAGIC || hdr.version != PAK_VERSION ||
+       hdr.count > (UINT32_MAX - hdr.names_size) / sizeof(pak_entry_t)) {
+        dbglog(DBG_ERROR, "fs_pak: %s is not a packed archive\n", fn);
+        fs_close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!(pak = calloc(1, sizeof(pak_t)))) {
+        fs_close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pak->fd = fd;
+    pak->count = hdr.count;
+    mutex_init(&pak->mutex, MUTEX_TYPE_NORMAL);
+
+    /* The entries and the names, in one go */
+    size = hdr.count * sizeof(pak_entry_t) + hdr.names_size;
+
+    if(!(pak->index = malloc(size + 1)) ||
+       !(pak->vfsh = malloc(sizeof(vfs_handler_t)))) {
+        err = ENOMEM;
+        goto fail;
+    }
+
+    if(fs_read(fd, pak->index, size) != (ssize_t)size) {
+        err = EIO;
+        goto fail;
+    }
+
+    pak->ents = (const pak_entry_t *)pak->index;
+    pak->names = (const char *)(pak->ents + hdr.count);
+    ((char *)pak->names)[hdr.names_size] = '\0';
+    pak->pos = sizeof(hdr) + size;
+
+    for(i = 0; i < hdr.count; i++) {
+        if(pak->ents[i].name >= hdr.names_size) {
+            dbglog(DBG_ERROR, "fs_pak: %s has a corrupt index\n", fn);
+            err = EINVAL;
+            goto fail;
+        }
+    }
+
+    /* Archives on a file system that can map them are read from there */
+    pak->image = fs_mmap(fd);
+
+    memcpy(pak->vfsh, &vh, sizeof(vfs_handler_t));
+    strncpy(pak->vfsh->nmmgr.pathname, mountpoint,
+            sizeof(pak->vfsh->nmmgr.pathname) - 1);
+    pak->vfsh->privdata = pak;
+
+    if(nmmgr_handler_add(&pak->vfsh->nmmgr) < 0) {
+        err = errno;
+        goto fail;
+    }
+
+    mutex_lock(&paks_mutex);
+    LIST_INSERT_HEAD(&paks, pak, list_ent);
+    mutex_unlock(&paks_mutex);
+
+    dbglog(DBG_DEBUG, "fs_pak: mounted %s on %s, %lu entries\n", fn,
+           mountpoint, (unsigned long)hdr.count);
+
+    return 0;
+
+fail:
+    pak_free(pak);
+    errno = err;
+    return -1;
+}
+
+int fs_pak_unmount(const char *mountpoint) {
+    pak_t *pak;
+
+    mutex_lock_scoped(&paks_mutex);
+
+    LIST_FOREACH(pak, &paks, list_ent) {
+        if(!strcmp(mountpoint, pak->vfsh->nmmgr.pathname))
+            break;
+    }
+
+    if(!pak) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    if(pak->refs) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    LIST_REMOVE(pak, list_ent);
+    nmmgr_handler_remove(&pak->vfsh->nmmgr);
+    pak_free(pak);
+
+    return 0;
+}
+
+void fs_pak_shutdown(void) {
+    pak_t *pak, *n;
+
+    mutex_lock_scoped(&paks_mutex);
+
+    LIST_FOREACH_SAFE(pak, &paks, list_ent, n) {
+        LIST_REMOVE(pak, list_ent);
+        nmmgr_handler_remove(&pak->vfsh->nmmgr);
+        pak_free(pak);
+    }
+}
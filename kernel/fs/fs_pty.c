@@ -14,7 +14,10 @@ in the VFS -- /pty/maXX and /pty/slXX. This is more or less like a dry
 copper loop in the phone system. Anyone can open up the master or slave ends
 and start talking, and it comes out the other end.
 
-A small amount of buffering is done on each pty. If O_NONBLOCK is set, then we
+A small amount of buffering is done on each pty, in a ring of a power of two
+bytes (FS_PTY_BUFFER_SIZE) copied in and out of in at most two pieces. Data
+can also be moved between a pty and another file with fs_splice(), straight
+out of or into the ring. If O_NONBLOCK is set, then we
 return -1 and set errno to EAGAIN when the buffers are full (or when there is
 nothing to read). If O_NONBLOCK is not set (normal) then the caller blocks until
 space or data is available (respectively). Like Unix sockets, the returned
@@ -28,7 +31,9 @@ or space present.
 #include <kos/mutex.h>
 #include <kos/cond.h>
 #include <kos/fs_pty.h>
+#include <kos/opts.h>
 
+#include <poll.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -40,10 +45,15 @@ or space present.
 #include <sys/queue.h>
 
 /* pty buffer size */
-#define PTY_BUFFER_SIZE 1024
+#define PTY_BUFFER_SIZE FS_PTY_BUFFER_SIZE
+#define PTY_BUFFER_MASK (PTY_BUFFER_SIZE - 1)
+
+_Static_assert(!(PTY_BUFFER_SIZE & PTY_BUFFER_MASK),
+               "FS_PTY_BUFFER_SIZE must be a power of two");
 
 /* Forward-declare some stuff */
 struct ptyhalf;
+struct pipefd;
 typedef LIST_HEAD(ptylist, ptyhalf) ptylist_t;
 
 /* This struct represents one half of a pty. Each end is openable as a
@@ -64,6 +74,14 @@ typedef struct ptyhalf {
 
     mutex_t     mutex;
     condvar_t   ready_read, ready_write;
+
+    /* Taken by whoever is removing data from the buffer, and whoever is
+       adding it, across the whole of the read or write. A splice lets go of
+       mutex while it moves data straight out of (or into) the buffer, and
+       these keep anyone else from taking (or filling) that part meanwhile. */
+    mutex_t     rlock, wlock;
+
+    LIST_HEAD(, pipefd) fds;    /* Open files of this half (list_mutex) */
 } ptyhalf_t;
 
 /* Our global pty list */
@@ -99,6 +117,9 @@ typedef struct pipefd {
 
     /* Opened mode */
     int mode;
+
+    /* Entry in the list of open files of the ptyhalf */
+    LIST_ENTRY(pipefd) fdlist;
 } pipefd_t;
 
 /* Here incase fs_pty_create() fails */
@@ -107,6 +128,22 @@ static void pty_destroy_unused(void);
 #define PF_PTY  0
 #define PF_DIR  1
 
+extern void __poll_hnd_event_trigger(void *hnd, short event);
+
+/* Let poll() and kos_epoll_wait() know about a change on a pty half. This has
+   to be called without holding the half's mutex, since poll() holds its own
+   lock while calling pty_poll(). */
+static void pty_notify(ptyhalf_t *ph, short events) {
+    pipefd_t *fdobj;
+
+    mutex_lock(&list_mutex);
+
+    LIST_FOREACH(fdobj, &ph->fds, fdlist)
+        __poll_hnd_event_trigger(fdobj, events);
+
+    mutex_unlock(&list_mutex);
+}
+
 /* Creates a pty pair */
 int fs_pty_create(char *buffer, int maxbuflen, file_t *master_out, file_t *slave_out) {
     ptyhalf_t *master, *slave;
@@ -157,9 +194,13 @@ int fs_pty_create(char *buffer, int maxbuflen, file_t *master_out, file_t *slave
 
     /* Allocate a mutex for each for multiple readers or writers */
     mutex_init(&master->mutex, MUTEX_TYPE_NORMAL);
+    mutex_init(&master->rlock, MUTEX_TYPE_NORMAL);
+    mutex_init(&master->wlock, MUTEX_TYPE_NORMAL);
     cond_init(&master->ready_read);
     cond_init(&master->ready_write);
     mutex_init(&slave->mutex, MUTEX_TYPE_NORMAL);
+    mutex_init(&slave->rlock, MUTEX_TYPE_NORMAL);
+    mutex_init(&slave->wlock, MUTEX_TYPE_NORMAL);
     cond_init(&slave->ready_read);
     cond_init(&slave->ready_write);
 
@@ -229,6 +270,8 @@ again:
                 cond_destroy(&c->ready_read);
                 cond_destroy(&c->ready_write);
                 mutex_destroy(&c->mutex);
+                mutex_destroy(&c->rlock);
+                mutex_destroy(&c->wlock);
 
                 /* Remove us from the list */
                 LIST_REMOVE(c, list);
@@ -237,6 +280,8 @@ again:
                 cond_destroy(&c->other->ready_read);
                 cond_destroy(&c->other->ready_write);
                 mutex_destroy(&c->other->mutex);
+                mutex_destroy(&c->other->rlock);
+                mutex_destroy(&c->other->wlock);
 
                 /* Remove it from the list */
                 LIST_REMOVE(c->other, list);
@@ -389,6 +434,11 @@ static void *pty_open_file(const char *fn, int mode) {
     fdobj->d.p = ph;
     fdobj->type = PF_PTY;
     fdobj->mode = mode;
+
+    mutex_lock(&list_mutex);
+    LIST_INSERT_HEAD(&ph->fds, fdobj, fdlist);
+    mutex_unlock(&list_mutex);
+
     return (void *)fdobj;
 }
 
@@ -420,17 +470,23 @@ static void *pty_open(vfs_handler_t *vfs, const char *fn, int mode) {
 /* Close pty or dirlist */
 static int pty_close(void *h) {
     pipefd_t *fdobj;
+    int hup;
 
     assert(h);
     fdobj = (pipefd_t *)h;
 
     if(fdobj->type == PF_PTY) {
+        mutex_lock(&list_mutex);
+        LIST_REMOVE(fdobj, fdlist);
+        mutex_unlock(&list_mutex);
+
         /* De-ref this end of it */
         mutex_lock_irqsafe(&fdobj->d.p->mutex);
 
         fdobj->d.p->refcnt--;
+        hup = fdobj->d.p->refcnt <= 0;
 
-        if(fdobj->d.p->refcnt <= 0) {
+        if(hup) {
             /* Unblock anyone who might be waiting on the other end */
             cond_broadcast(&fdobj->d.p->other->ready_read);
             cond_broadcast(&fdobj->d.p->ready_write);
@@ -438,6 +494,9 @@ static int pty_close(void *h) {
 
         mutex_unlock(&fdobj->d.p->mutex);
 
+        if(hup)
+            pty_notify(fdobj->d.p->other, POLLHUP);
+
         pty_destroy_unused();
     }
     else {
@@ -449,6 +508,29 @@ static int pty_close(void *h) {
     return 0;
 }
 
+/* Take bytes off the front of a half's buffer, with its mutex held, and
+   let it go */
+static void pty_consumed(ptyhalf_t *ph, size_t bytes) {
+    ph->head = (ph->head + bytes) & PTY_BUFFER_MASK;
+    ph->cnt -= bytes;
+
+    /* Wake anyone waiting for write space */
+    cond_broadcast(&ph->ready_write);
+    mutex_unlock(&ph->mutex);
+}
+
+/* Add bytes to the end of a half's buffer, with its mutex held, and let
+   it go */
+static void pty_produced(ptyhalf_t *ph, size_t bytes) {
+    ph->tail = (ph->tail + bytes) & PTY_BUFFER_MASK;
+    ph->cnt += bytes;
+    assert(ph->cnt <= PTY_BUFFER_SIZE);
+
+    /* Wake anyone waiting on read */
+    cond_broadcast(&ph->ready_read);
+    mutex_unlock(&ph->mutex);
+}
+
 /* Read from a pty endpoint, kernel console special case */
 static ssize_t pty_read_serial(pipefd_t *fdobj, ptyhalf_t *ph, void *buf, size_t bytes) {
     int c, r = 0;
@@ -515,6 +597,7 @@ static ssize_t pty_read(void *h, void *buf, size_t bytes) {
         return pty_read_serial(fdobj, ph, buf, bytes);
 
     /* Lock the ptyhalf */
+    mutex_lock(&ph->rlock);
     mutex_lock(&ph->mutex);
 
     /* Is there anything to read? */
@@ -550,14 +633,15 @@ static ssize_t pty_read(void *h, void *buf, size_t bytes) {
     else
         memcpy(buf, ph->buffer + ph->head, bytes);
 
-    ph->head = (ph->head + bytes) % PTY_BUFFER_SIZE;
-    ph->cnt -= bytes;
+    pty_consumed(ph, bytes);
+    mutex_unlock(&ph->rlock);
 
-    /* Wake anyone waiting for write space */
-    cond_broadcast(&ph->ready_write);
+    pty_notify(ph->other, POLLWRNORM);
+    return bytes;
 
 done:
     mutex_unlock(&ph->mutex);
+    mutex_unlock(&ph->rlock);
     return bytes;
 }
 
@@ -586,6 +670,7 @@ static ssize_t pty_write(void *h, const void *buf, size_t bytes) {
     ph = ph->other;
     assert(ph);
 
+    mutex_lock(&ph->wlock);
     mutex_lock(&ph->mutex);
 
     /* Is there any room to write? */
@@ -620,18 +705,182 @@ static ssize_t pty_write(void *h, const void *buf, size_t bytes) {
     else
         memcpy(ph->buffer + ph->tail, buf, bytes);
 
-    ph->tail = (ph->tail + bytes) % PTY_BUFFER_SIZE;
-    ph->cnt += bytes;
-    assert(ph->cnt <= PTY_BUFFER_SIZE);
+    pty_produced(ph, bytes);
+    mutex_unlock(&ph->wlock);
 
-    /* Wake anyone waiting on read */
-    cond_broadcast(&ph->ready_read);
+    pty_notify(ph, POLLRDNORM);
+    return bytes;
 
 done:
     mutex_unlock(&ph->mutex);
+    mutex_unlock(&ph->wlock);
     return bytes;
 }
 
+static vfs_handler_t vh;
+
+/* The half whose buffer reading fd takes from, if fd is a pty */
+static ptyhalf_t *pty_reads_from(file_t fd) {
+    pipefd_t *fdobj;
+
+    if(fs_get_handler(fd) != &vh || !(fdobj = fs_get_handle(fd)) ||
+       fdobj->type != PF_PTY)
+        return NULL;
+
+    return fdobj->d.p;
+}
+
+/* Is this half the unattached kernel console, read and written through
+   dbgio rather than its buffer? */
+static int pty_is_console(ptyhalf_t *ph) {
+    return ph->id == 0 && !ph->master && ph->other->refcnt == 0;
+}
+
+/* Splice out of a pty: write what's in its buffer to fd_out directly. The
+   data is only taken off the buffer once it's been written, and rlock keeps
+   other readers off it until then. */
+static ssize_t pty_splice_out(void *h, file_t fd_out, size_t len) {
+    pipefd_t *fdobj = (pipefd_t *)h;
+    ptyhalf_t *ph = fdobj->d.p, *dst;
+    size_t n, done = 0, seg, pos;
+    ssize_t rv = 0;
+
+    if(fdobj->type != PF_PTY) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(pty_is_console(ph)) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    /* Writing fd_out mustn't fill the very buffer we're emptying */
+    if((dst = pty_reads_from(fd_out)) && dst->other == ph) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mutex_lock(&ph->rlock);
+    mutex_lock(&ph->mutex);
+
+    while(!ph->cnt && ph->other->refcnt > 0) {
+        if(fdobj->mode & O_NONBLOCK) {
+            mutex_unlock(&ph->mutex);
+            mutex_unlock(&ph->rlock);
+            errno = EAGAIN;
+            return -1;
+        }
+
+        cond_wait(&ph->ready_read, &ph->mutex);
+    }
+
+    n = ph->cnt < len ? ph->cnt : len;
+    mutex_unlock(&ph->mutex);
+
+    /* Writers only ever add behind these n bytes, so they stay put */
+    while(done < n) {
+        pos = (ph->head + done) & PTY_BUFFER_MASK;
+        seg = PTY_BUFFER_SIZE - pos;
+
+        if(seg > n - done)
+            seg = n - done;
+
+        if((rv = fs_write(fd_out, ph->buffer + pos, seg)) <= 0)
+            break;
+
+        done += rv;
+
+        if((size_t)rv < seg)
+            break;
+    }
+
+    if(done) {
+        mutex_lock(&ph->mutex);
+        pty_consumed(ph, done);
+    }
+
+    mutex_unlock(&ph->rlock);
+
+    if(!done)
+        return rv;
+
+    pty_notify(ph->other, POLLWRNORM);
+    return done;
+}
+
+/* Splice into a pty: read from fd_in straight into the free part of its
+   buffer, which wlock keeps other writers out of. This reads at most once,
+   up to where the free space wraps, so it never waits on fd_in after some
+   data has already come in. */
+static ssize_t pty_splice_in(void *h, file_t fd_in, size_t len) {
+    pipefd_t *fdobj = (pipefd_t *)h;
+    ptyhalf_t *ph = fdobj->d.p;
+    size_t n;
+    ssize_t rv;
+
+    if(fdobj->type != PF_PTY) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(pty_is_console(ph)) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    ph = ph->other;
+
+    if(pty_reads_from(fd_in) == ph) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    mutex_lock(&ph->wlock);
+    mutex_lock(&ph->mutex);
+
+    while(ph->cnt >= PTY_BUFFER_SIZE && ph->refcnt > 0) {
+        if(fdobj->mode & O_NONBLOCK) {
+            mutex_unlock(&ph->mutex);
+            mutex_unlock(&ph->wlock);
+            errno = EAGAIN;
+            return -1;
+        }
+
+        cond_wait(&ph->ready_write, &ph->mutex);
+    }
+
+    if(ph->cnt >= PTY_BUFFER_SIZE) {
+        mutex_unlock(&ph->mutex);
+        mutex_unlock(&ph->wlock);
+        return 0;
+    }
+
+    n = PTY_BUFFER_SIZE - ph->cnt;
+
+    if(n > (size_t)(PTY_BUFFER_SIZE - ph->tail))
+        n = PTY_BUFFER_SIZE - ph->tail;
+
+    if(n > len)
+        n = len;
+
+    mutex_unlock(&ph->mutex);
+
+    rv = fs_read(fd_in, ph->buffer + ph->tail, n);
+
+    if(rv > 0) {
+        mutex_lock(&ph->mutex);
+        pty_produced(ph, rv);
+    }
+
+    mutex_unlock(&ph->wlock);
+
+    if(rv > 0)
+        pty_notify(ph, POLLRDNORM);
+
+    return rv;
+}
+
 /* Get total size. For this we return the number of bytes available for reading. */
 static size_t pty_total(void *h) {
     pipefd_t    *fdobj;
@@ -772,6 +1021,41 @@ static int pty_fcntl(void *h, int cmd, va_list ap) {
     return rv;
 }
 
+/* Check the readiness of a pty endpoint */
+static short pty_poll(void *h, short events) {
+    pipefd_t *fdobj = (pipefd_t *)h;
+    ptyhalf_t *ph;
+    short rv = 0;
+
+    /* Directories and the unattached console are always ready, like files. */
+    if(fdobj->type != PF_PTY)
+        return events & (POLLRDNORM | POLLWRNORM);
+
+    ph = fdobj->d.p;
+
+    if(ph->id == 0 && !ph->master && ph->other->refcnt == 0)
+        return events & (POLLRDNORM | POLLWRNORM);
+
+    mutex_lock(&ph->mutex);
+
+    if(ph->cnt)
+        rv |= POLLRDNORM;
+
+    if(ph->other->refcnt == 0)
+        rv |= POLLHUP;
+
+    mutex_unlock(&ph->mutex);
+
+    mutex_lock(&ph->other->mutex);
+
+    if(ph->other->cnt < PTY_BUFFER_SIZE)
+        rv |= POLLWRNORM;
+
+    mutex_unlock(&ph->other->mutex);
+
+    return rv & (events | POLLHUP);
+}
+
 static int pty_rewinddir(void *h) {
     pipefd_t *fdobj = (pipefd_t *)h;
     dirlist_t *dl;
@@ -837,7 +1121,7 @@ static vfs_handler_t vh = {
     NULL,
     NULL,
     pty_fcntl,
-    NULL,
+    pty_poll,
     NULL,
     NULL,
     NULL,
@@ -845,7 +1129,11 @@ static vfs_handler_t vh = {
     NULL,
     NULL,
     pty_rewinddir,
-    pty_fstat
+    pty_fstat,
+    NULL,
+    NULL,
+    pty_splice_out,
+    pty_splice_in
 };
 
 /* Are we initialized? */
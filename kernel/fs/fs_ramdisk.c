@@ -38,6 +38,7 @@ cache data from disk rather than as a general purpose file system.
 
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -61,26 +62,47 @@ typedef struct rd_file {
 
     /* For the following two members:
       - In files, this is a block of allocated memory containing the
-        actual file data. Each time we need to expand it beyond its
-        current capacity, we realloc() with enough to hold the new
-        data plus 4k (to avoid realloc thrashing). All files start
-        out with a 1K block of space.
+        actual file data, if it's kept in one piece: that is, if it was
+        attached with fs_ramdisk_attach() or has been mmapped. Otherwise
+        it's NULL and the data is in chunks, below.
       - In directories, this is just a pointer to an rd_dir struct,
         which is defined below. datasize has no meaning for a
         directory. */
     void    * data;     /* Data block pointer */
     uint32_t  datasize; /* Size of data block pointer */
 
+    /* File data not kept in one piece is in chunks of
+       FS_RAMDISK_CHUNK_SIZE bytes, so that growing a file never copies more
+       than one chunk. The last chunk only holds lastcap bytes, doubling as
+       it fills, so that small files stay small. */
+    uint8_t  ** chunks;     /* Chunk pointers */
+    uint32_t  nchunks;      /* Chunks allocated */
+    uint32_t  chunk_max;    /* Room in the chunks array */
+    uint32_t  lastcap;      /* Size of the last chunk */
+
+    uint32_t  hash;         /* Hash of the name, for the directory */
+    struct rd_file * hnext; /* Next in the directory's hash bucket */
+
     LIST_ENTRY(rd_file) dirlist;    /* Directory list entry */
 } rd_file_t;
 
+#define CHUNK_SIZE  FS_RAMDISK_CHUNK_SIZE
+#define CHUNK_MIN   1024
+
 /* Lock constants */
 #define OPENFOR_NOTHING 0   /* Not opened */
 #define OPENFOR_READ    1   /* Opened read-only */
 #define OPENFOR_WRITE   2   /* Opened read-write */
 
-/* Directory definition -- just basically a list of files we contain */
-typedef LIST_HEAD(rd_dir, rd_file) rd_dir_t;
+/* Directory definition -- a list of the files we contain, in the order
+   they're read back, and a hash table on their names to find them by. If the
+   table couldn't be allocated, the list is searched instead. */
+typedef struct rd_dir {
+    LIST_HEAD(, rd_file) files;
+    rd_file_t   **hash;     /* Buckets, or NULL */
+    size_t      hash_size;  /* Number of buckets, a power of two */
+    size_t      count;      /* Number of files */
+} rd_dir_t;
 
 /* Pointer to the root diretctory */
 static rd_file_t *root = NULL;
@@ -102,12 +124,102 @@ static struct {
 /* Mutex for file system structs */
 static mutex_t rd_mutex;
 
+/* Names are looked up without regard to case, so hash them that way. */
+static uint32_t ramdisk_hash(const char *name, size_t len) {
+    uint32_t h = 2166136261U;
+
+    while(len--) {
+        h ^= (uint8_t)tolower((unsigned char)*name++);
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static void ramdisk_dir_init(rd_dir_t *d) {
+    LIST_INIT(&d->files);
+    d->hash = NULL;
+    d->hash_size = 0;
+    d->count = 0;
+}
+
+/* Rebuild a directory's hash table with a new number of buckets. If there's
+   no memory for it, the old one is kept. */
+static void ramdisk_dir_rehash(rd_dir_t *d, size_t size) {
+    rd_file_t **hash, *f;
+
+    if(!(hash = (rd_file_t **)calloc(size, sizeof(rd_file_t *))))
+        return;
+
+    LIST_FOREACH(f, &d->files, dirlist) {
+        f->hnext = hash[f->hash & (size - 1)];
+        hash[f->hash & (size - 1)] = f;
+    }
+
+    free(d->hash);
+    d->hash = hash;
+    d->hash_size = size;
+}
+
+static void ramdisk_dir_add(rd_dir_t *d, rd_file_t *f) {
+    f->hash = ramdisk_hash(f->name, strlen(f->name));
+    LIST_INSERT_HEAD(&d->files, f, dirlist);
+    ++d->count;
+
+    if(d->count > d->hash_size) {
+        ramdisk_dir_rehash(d, d->hash_size ? d->hash_size * 2 : 16);
+
+        if(d->hash && d->count <= d->hash_size)
+            return;
+    }
+
+    if(d->hash) {
+        f->hnext = d->hash[f->hash & (d->hash_size - 1)];
+        d->hash[f->hash & (d->hash_size - 1)] = f;
+    }
+}
+
+static void ramdisk_dir_remove(rd_dir_t *d, rd_file_t *f) {
+    rd_file_t **pp;
+
+    if(d->hash) {
+        for(pp = &d->hash[f->hash & (d->hash_size - 1)]; *pp;
+            pp = &(*pp)->hnext) {
+            if(*pp == f) {
+                *pp = f->hnext;
+                break;
+            }
+        }
+    }
+
+    LIST_REMOVE(f, dirlist);
+    --d->count;
+}
+
+static void ramdisk_dir_free(rd_dir_t *d) {
+    free(d->hash);
+    free(d);
+}
+
 /* Search a directory for the named file; return the struct if
    we find it. Assumes we hold rd_mutex. */
 static rd_file_t *ramdisk_find(rd_dir_t *parent, const char *name, size_t namelen) {
     rd_file_t   *f;
+    uint32_t    h;
 
-    LIST_FOREACH(f, parent, dirlist) {
+    if(parent->hash) {
+        h = ramdisk_hash(name, namelen);
+
+        for(f = parent->hash[h & (parent->hash_size - 1)]; f; f = f->hnext) {
+            if(f->hash == h && (strlen(f->name) == namelen) &&
+               !strncasecmp(name, f->name, namelen))
+                return f;
+        }
+
+        return NULL;
+    }
+
+    LIST_FOREACH(f, &parent->files, dirlist) {
         if((strlen(f->name) == namelen) && !strncasecmp(name, f->name, namelen))
             return f;
     }
@@ -115,6 +227,152 @@ static rd_file_t *ramdisk_find(rd_dir_t *parent, const char *name, size_t namele
     return NULL;
 }
 
+/* Free a file's data, however it's kept. */
+static void ramdisk_free_data(rd_file_t *f) {
+    uint32_t i;
+
+    free(f->data);
+
+    for(i = 0; i < f->nchunks; ++i)
+        free(f->chunks[i]);
+
+    free(f->chunks);
+    f->data = NULL;
+    f->datasize = 0;
+    f->chunks = NULL;
+    f->nchunks = f->chunk_max = f->lastcap = 0;
+}
+
+/* How much memory a file's data takes up. */
+static uint32_t ramdisk_alloc_size(const rd_file_t *f) {
+    if(f->data)
+        return f->datasize;
+
+    return f->nchunks ? (f->nchunks - 1) * CHUNK_SIZE + f->lastcap : 0;
+}
+
+/* Copy bytes at off in a chunked file out to buf, or in from it. */
+static void ramdisk_copy(rd_file_t *f, uint32_t off, void *buf, size_t bytes,
+                         int in) {
+    uint8_t *p = (uint8_t *)buf;
+    uint32_t c = off / CHUNK_SIZE, o = off % CHUNK_SIZE, n;
+
+    while(bytes) {
+        n = CHUNK_SIZE - o;
+
+        if(n > bytes)
+            n = bytes;
+
+        if(in)
+            memcpy(f->chunks[c] + o, p, n);
+        else
+            memcpy(p, f->chunks[c] + o, n);
+
+        p += n;
+        bytes -= n;
+        o = 0;
+        ++c;
+    }
+}
+
+/* Make room in a chunked file for it to be size bytes long. */
+static int ramdisk_reserve(rd_file_t *f, uint32_t size) {
+    uint32_t need = (size + CHUNK_SIZE - 1) / CHUNK_SIZE, cap, max;
+    uint8_t **chunks, *np;
+
+    if(need > f->chunk_max) {
+        max = f->chunk_max ? f->chunk_max * 2 : 4;
+
+        if(max < need)
+            max = need;
+
+        if(!(chunks = (uint8_t **)realloc(f->chunks, max * sizeof(uint8_t *))))
+            return -1;
+
+        f->chunks = chunks;
+        f->chunk_max = max;
+    }
+
+    while(f->nchunks < need || size > ramdisk_alloc_size(f)) {
+        /* Grow the last chunk if it isn't full size yet, doubling it, or to
+           full size if there are more chunks to follow. */
+        if(f->nchunks && f->lastcap < CHUNK_SIZE) {
+            cap = f->nchunks < need ? CHUNK_SIZE : f->lastcap * 2;
+
+            while(cap < CHUNK_SIZE && (f->nchunks - 1) * CHUNK_SIZE + cap < size)
+                cap *= 2;
+
+            if(cap > CHUNK_SIZE)
+                cap = CHUNK_SIZE;
+
+            if(!(np = (uint8_t *)realloc(f->chunks[f->nchunks - 1], cap)))
+                return -1;
+
+            f->chunks[f->nchunks - 1] = np;
+            f->lastcap = cap;
+            continue;
+        }
+
+        /* Start a new chunk, only as big as is needed if it's the last. */
+        cap = CHUNK_SIZE;
+
+        if(f->nchunks == need - 1) {
+            for(cap = CHUNK_MIN; cap < CHUNK_SIZE &&
+                f->nchunks * CHUNK_SIZE + cap < size; cap *= 2)
+                ;
+
+            if(cap > CHUNK_SIZE)
+                cap = CHUNK_SIZE;
+        }
+
+        if(!(f->chunks[f->nchunks] = (uint8_t *)malloc(cap)))
+            return -1;
+
+        ++f->nchunks;
+        f->lastcap = cap;
+    }
+
+    return 0;
+}
+
+/* Split a file kept in one piece up into chunks, to write to it. */
+static int ramdisk_chunk(rd_file_t *f) {
+    void *data = f->data;
+    uint32_t size = f->size, datasize = f->datasize;
+
+    f->data = NULL;
+
+    if(ramdisk_reserve(f, size)) {
+        ramdisk_free_data(f);
+        f->data = data;
+        f->datasize = datasize;
+        return -1;
+    }
+
+    ramdisk_copy(f, 0, data, size, 1);
+    free(data);
+    f->datasize = 0;
+    return 0;
+}
+
+/* Put a chunked file's data in one piece, to map it or detach it. */
+static int ramdisk_flatten(rd_file_t *f) {
+    uint8_t *data;
+    uint32_t size = f->size;
+
+    if(f->data)
+        return 0;
+
+    if(!(data = (uint8_t *)malloc(size ? size : 1)))
+        return -1;
+
+    ramdisk_copy(f, 0, data, size, 0);
+    ramdisk_free_data(f);
+    f->data = data;
+    f->datasize = size;
+    return 0;
+}
+
 /* Find a path-named file in the ramdisk. There should not be a
    slash at the beginning, nor at the end. Assumes we hold rd_mutex. */
 static rd_file_t * ramdisk_find_path(rd_dir_t * parent, const char * fn, int dir) {
@@ -208,7 +466,7 @@ static rd_file_t * ramdisk_create_file(rd_dir_t * parent, const char * fn, int d
         return NULL;
 
     /* Now add a file to the parent */
-    if(!(f = (rd_file_t *)malloc(sizeof(rd_file_t))))
+    if(!(f = (rd_file_t *)calloc(1, sizeof(rd_file_t))))
         return NULL;
 
     f->name = strdup(p);
@@ -217,27 +475,21 @@ static rd_file_t * ramdisk_create_file(rd_dir_t * parent, const char * fn, int d
         return NULL;
     }
 
-    f->size = 0;
     f->type = dir ? STAT_TYPE_DIR : STAT_TYPE_FILE;
     f->openfor = OPENFOR_NOTHING;
-    f->usage = 0;
 
-    if(!dir) {
-        f->data = malloc(1024);
-        f->datasize = 1024;
-    }
-    else {
-        f->data = malloc(sizeof(rd_dir_t));
-        f->datasize = 0;
-    }
+    /* Files start out with no chunks at all. */
+    if(dir) {
+        if(!(f->data = malloc(sizeof(rd_dir_t)))) {
+            free(f->name);
+            free(f);
+            return NULL;
+        }
 
-    if(f->data == NULL) {
-        free(f->name);
-        free(f);
-        return NULL;
+        ramdisk_dir_init((rd_dir_t *)f->data);
     }
 
-    LIST_INSERT_HEAD(pdir, f, dirlist);
+    ramdisk_dir_add(pdir, f);
 
     return f;
 }
@@ -321,9 +573,7 @@ static void * ramdisk_open(vfs_handler_t * vfs, const char *fn, int mode) {
             fh[fd].ptr = f->size;
         /* If we're opening with O_TRUNC, kill the existing contents */
         else if(mode & O_TRUNC) {
-            free(f->data);
-            f->data = malloc(1024);
-            f->datasize = 1024;
+            ramdisk_free_data(f);
             f->size = 0;
             fh[fd].ptr = 0;
         }
@@ -337,7 +587,7 @@ static void * ramdisk_open(vfs_handler_t * vfs, const char *fn, int mode) {
     /* If we opened a dir, then ptr is actually a pointer to the first
        file entry. */
     if(mode & O_DIR) {
-        fh[fd].ptr = (uint32_t)LIST_FIRST((rd_dir_t *)f->data);
+        fh[fd].ptr = (uint32_t)LIST_FIRST(&((rd_dir_t *)f->data)->files);
     }
 
     /* Increase the usage count */
@@ -393,7 +643,11 @@ static ssize_t ramdisk_read(void * h, void *buf, size_t bytes) {
             bytes = fh[fd].file->size - fh[fd].ptr;
 
         /* Copy out the requested amount */
-        memcpy(buf, ((uint8_t *)fh[fd].file->data) + fh[fd].ptr, bytes);
+        if(fh[fd].file->data)
+            memcpy(buf, ((uint8_t *)fh[fd].file->data) + fh[fd].ptr, bytes);
+        else
+            ramdisk_copy(fh[fd].file, fh[fd].ptr, buf, bytes, 0);
+
         fh[fd].ptr += bytes;
 
         rv = bytes;
@@ -411,20 +665,20 @@ static ssize_t ramdisk_write(void * h, const void *buf, size_t bytes) {
 
     /* Check that the fd is valid */
     if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir && fh[fd].file->openfor == OPENFOR_WRITE) {
-        /* Is there enough left? */
-        if((fh[fd].ptr + bytes) > fh[fd].file->datasize) {
-            /* We need to realloc the block */
-            void * np = realloc(fh[fd].file->data, (fh[fd].ptr + bytes) + 4096);
-
-            if(np == NULL)
-                return -1;
+        /* Writes go to the chunks, so there's room to grow. */
+        if(fh[fd].file->data && ramdisk_chunk(fh[fd].file)) {
+            errno = ENOMEM;
+            return -1;
+        }
 
-            fh[fd].file->data = np;
-            fh[fd].file->datasize = (fh[fd].ptr + bytes) + 4096;
+        /* Is there enough left? */
+        if(ramdisk_reserve(fh[fd].file, fh[fd].ptr + bytes)) {
+            errno = ENOMEM;
+            return -1;
         }
 
-        /* Copy out the requested amount */
-        memcpy(((uint8_t *)fh[fd].file->data) + fh[fd].ptr, buf, bytes);
+        /* Copy in the requested amount */
+        ramdisk_copy(fh[fd].file, fh[fd].ptr, (void *)buf, bytes, 1);
         fh[fd].ptr += bytes;
 
         if(fh[fd].file->size < fh[fd].ptr) {
@@ -549,6 +803,8 @@ static dirent_t *ramdisk_readdir(void * h) {
 
 static int ramdisk_unlink(vfs_handler_t * vfs, const char *fn) {
     rd_file_t   * f;
+    rd_dir_t    * pdir;
+    const char  * name;
     int     rv = -1;
 
     (void)vfs;
@@ -561,12 +817,15 @@ static int ramdisk_unlink(vfs_handler_t * vfs, const char *fn) {
     if(f) {
         /* Make sure it's not in use */
         if(f->usage == 0) {
+            /* Remove it from the parent list */
+            if(ramdisk_get_parent(rootdir, fn, &pdir, &name) < 0)
+                return -1;
+
+            ramdisk_dir_remove(pdir, f);
+
             /* Free its data */
             free(f->name);
-            free(f->data);
-
-            /* Remove it from the parent list */
-            LIST_REMOVE(f, dirlist);
+            ramdisk_free_data(f);
 
             /* Free the entry itself */
             free(f);
@@ -582,8 +841,15 @@ static void * ramdisk_mmap(void * h) {
 
     mutex_lock_scoped(&rd_mutex);
 
-    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir)
+    if(fd < FS_RAMDISK_MAX_FILES && fh[fd].file != NULL && !fh[fd].dir) {
+        /* Mapping needs the file in one piece. */
+        if(ramdisk_flatten(fh[fd].file)) {
+            errno = ENOMEM;
+            return NULL;
+        }
+
         return fh[fd].file->data;
+    }
 
     return NULL;
 }
@@ -621,13 +887,12 @@ static int ramdisk_stat(vfs_handler_t *vfs, const char *path, struct stat *st,
     st->st_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
     st->st_mode |= (f->type == STAT_TYPE_DIR) ? 
         (S_IFDIR | S_IXUSR | S_IXGRP | S_IXOTH) : S_IFREG;
-    st->st_size = (f->type == STAT_TYPE_DIR) ? -1 : (int)f->datasize;
+    st->st_size = (f->type == STAT_TYPE_DIR) ? -1 : (int)f->size;
     st->st_nlink = (f->type == STAT_TYPE_DIR) ? 2 : 1;
     st->st_blksize = 1024;
-    st->st_blocks = f->datasize >> 10;
 
-    if(f->datasize & 0x3ff)
-        ++st->st_blocks;
+    if(f->type != STAT_TYPE_DIR)
+        st->st_blocks = (ramdisk_alloc_size(f) + 0x3ff) >> 10;
 
     return 0;
 }
@@ -670,7 +935,7 @@ static int ramdisk_rewinddir(void * h) {
     }
 
     /* Rewind to the first file. */
-    fh[fd].ptr = (uint32_t)LIST_FIRST((rd_dir_t *)fh[fd].file->data);
+    fh[fd].ptr = (uint32_t)LIST_FIRST(&((rd_dir_t *)fh[fd].file->data)->files);
 
     return 0;
 }
@@ -694,13 +959,12 @@ static int ramdisk_fstat(void *h, struct stat *st) {
     st->st_dev = (dev_t)('r' | ('a' << 8) | ('m' << 16));
     st->st_mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
     st->st_mode |= (f->type == STAT_TYPE_DIR) ? S_IFDIR : S_IFREG;
-    st->st_size = (f->type == STAT_TYPE_DIR) ? -1 : (int)f->datasize;
+    st->st_size = (f->type == STAT_TYPE_DIR) ? -1 : (int)f->size;
     st->st_nlink = (f->type == STAT_TYPE_DIR) ? 2 : 1;
     st->st_blksize = 1024;
-    st->st_blocks = f->datasize >> 10;
 
-    if(f->datasize & 0x3ff)
-        ++st->st_blocks;
+    if(f->type != STAT_TYPE_DIR)
+        st->st_blocks = (ramdisk_alloc_size(f) + 0x3ff) >> 10;
 
     return 0;
 }
@@ -761,9 +1025,9 @@ int fs_ramdisk_attach(const char * fn, void * obj, size_t size) {
     if(fd == NULL)
         return -1;
 
-    /* Ditch the data block we had and replace it with the user one. */
+    /* Ditch the data we had and replace it with the user's block. */
     f = fh[(int)fd].file;
-    free(f->data);
+    ramdisk_free_data(f);
     f->data = obj;
     f->datasize = size;
     f->size = size;
@@ -791,13 +1055,21 @@ int fs_ramdisk_detach(const char * fn, void ** obj, size_t * size) {
     assert(size != NULL);
 
     f = fh[(int)fd].file;
+
+    /* The caller gets the data in one piece. */
+    if(ramdisk_flatten(f)) {
+        ramdisk_close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+
     *obj = f->data;
     *size = f->size;
 
-    /* Ditch the data block we had and replace it with a fake one. */
-    f->data = malloc(64);
-    f->datasize = 64;
-    f->size = 64;
+    /* The file no longer has any data of its own. */
+    f->data = NULL;
+    f->datasize = 0;
+    f->size = 0;
 
     /* Close the file */
     ramdisk_close(fd);
@@ -818,7 +1090,7 @@ void fs_ramdisk_init(void) {
     if(!(rootdir = (rd_dir_t *)malloc(sizeof(rd_dir_t))))
         return;
 
-    root = (rd_file_t *)malloc(sizeof(rd_file_t));
+    root = (rd_file_t *)calloc(1, sizeof(rd_file_t));
     if(root == NULL) {
         free(rootdir);
         return;
@@ -831,14 +1103,11 @@ void fs_ramdisk_init(void) {
         return;
     }
 
-    root->size = 0;
     root->type = STAT_TYPE_DIR;
     root->openfor = OPENFOR_NOTHING;
-    root->usage = 0;
     root->data = rootdir;
-    root->datasize = 0;
 
-    LIST_INIT(rootdir);
+    ramdisk_dir_init(rootdir);
 
     /* Reset fd's */
     memset(fh, 0, sizeof(fh));
@@ -860,17 +1129,17 @@ void fs_ramdisk_shutdown(void) {
 
     /* For now assume there's only the root dir, since mkdir and
        rmdir aren't even implemented... */
-    f1 = LIST_FIRST(rootdir);
+    f1 = LIST_FIRST(&rootdir->files);
 
     while(f1) {
         f2 = LIST_NEXT(f1, dirlist);
         free(f1->name);
-        free(f1->data);
+        ramdisk_free_data(f1);
         free(f1);
         f1 = f2;
     }
 
-    free(rootdir);
+    ramdisk_dir_free(rootdir);
     free(root->name);
     free(root);
 
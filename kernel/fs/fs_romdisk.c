@@ -14,6 +14,13 @@ To create a romdisk image, you will need the program "genromfs". This program wa
 for Linux but ought to compile under Cygwin. The source for this utility can be found
 on sunsite.unc.edu in /pub/Linux/system/recovery/, or as a package under Debian "genromfs".
 
+The genromfs in utils/ can also make compressed images ("-rom1fz-"), which are only
+readable here. Those have the same layout, but a regular file with a non-zero spec_info
+has its data LZ4 compressed in blocks of that many bytes: a table of big-endian offsets
+to each block and to the end of the last, from the start of the data, then the blocks.
+A block that is as long as it decompresses to is stored as is. Blocks are decompressed
+into a small cache shared by all compressed images.
+
 */
 
 #include <kos/thread.h>
@@ -27,9 +34,12 @@ on sunsite.unc.edu in /pub/Linux/system/recovery/, or as a package under Debian
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
+#include <ctype.h>
 #include <assert.h>
 #include <errno.h>
 
+#include "fs_lz4.h"
+
 #define ROMFS_MAXFN 128
 #define ROMFH_HRD 0
 #define ROMFH_DIR 1
@@ -44,6 +54,10 @@ on sunsite.unc.edu in /pub/Linux/system/recovery/, or as a package under Debian
 #define RD_VN_MAX 16
 #define RD_FN_MAX 16
 
+/* Decompressed blocks kept, and the largest block size taken */
+#define RD_ZCACHE_BLOCKS 4
+#define RD_ZBLOCK_MAX (64 * 1024)
+
 /* Header definitions from Linux ROMFS documentation; all integer quantities are
    expressed in big-endian notation. Unfortunately the ROMFS guys were being
    clever and made this header a variable length depending on the size of
@@ -84,11 +98,29 @@ typedef struct rd_image {
     LIST_ENTRY(rd_image) list_ent;  /* List entry */
 
     bool                own_buffer; /* Do we own the memory? */
+    bool                compressed; /* Is it a compressed image? */
     const uint8_t       *image;     /* The actual image */
+    uint32_t            size;       /* Size of the image */
     uint32_t            files;      /* Offset in the image to the files area */
     vfs_handler_t       *vfsh;      /* Our VFS mount struct */
+
+    /* Index of full paths, if built */
+    struct rd_path      *paths;
+    uint32_t            *buckets;   /* First path + 1 in each, or 0 */
+    uint32_t            mask;
+    char                *names;
 } rd_image_t;
 
+/* A path in an image's index */
+typedef struct rd_path {
+    uint32_t            hash;
+    uint32_t            offset;     /* Of the file header */
+    uint32_t            name;       /* Offset in names, with bit 31 set for dirs */
+    uint32_t            next;       /* Next path + 1 in the bucket, or 0 */
+} rd_path_t;
+
+#define RD_PATH_DIR     0x80000000
+
 /* Global list of mounted romdisks */
 static rdi_list_t romdisks;
 
@@ -101,6 +133,8 @@ typedef struct rd_fd {
     bool                dir;    /* true if a directory */
     uint32_t            ptr;    /* Current read position in bytes */
     uint32_t            size;   /* Length of file in bytes */
+    uint32_t            zblock; /* Compressed block size, or 0 if stored */
+    uint8_t             *map;   /* Decompressed file, if mapped */
     dirent_t            dirent; /* A static dirent to pass back to clients */
     rd_image_t          *mnt;   /* Which mount instance are we using? */
     TAILQ_ENTRY(rd_fd)  next;   /* Next handle in the linked list */
@@ -121,15 +155,349 @@ static inline bool romdisk_fd_invalid(rd_fd_t *fd) {
 
 #define ROMFH_MASK  3
 
+/* Hard links, made by genromfs for hard linked and (with -D) identical
+   files, name the header of the file they stand for. "." and ".." are links
+   too, but are handled by name. */
+static bool romdisk_is_link(const romdisk_file_t *fhdr) {
+    return (ntohl_32(&fhdr->next_header) & ROMFH_MASK) == ROMFH_HRD &&
+           strcmp(fhdr->filename, ".") && strcmp(fhdr->filename, "..");
+}
+
+/* Follow a hard link through to the real header. Returns 0 if it doesn't
+   lead anywhere sensible. */
+static uint32_t romdisk_follow(const uint8_t *image, uint32_t size, uint32_t i) {
+    const romdisk_file_t *fhdr;
+    int hops;
+
+    for(hops = 0; hops < 8; hops++) {
+        if(i < sizeof(romdisk_hdr_t) || i + sizeof(romdisk_file_t) > size)
+            return 0;
+
+        fhdr = (const romdisk_file_t *)(image + i);
+
+        if(!romdisk_is_link(fhdr))
+            return i;
+
+        i = ntohl_32(&fhdr->spec_info) & 0xfffffff0;
+    }
+
+    return 0;
+}
+
 /* Mutex for file handles */
 /* We use it for both the files list and the images list. */
 static mutex_t fh_mutex;
 
+/* Cache of decompressed blocks, least recently used last. Blocks are known
+   by where their data is in their image. */
+typedef struct rd_zblock {
+    TAILQ_ENTRY(rd_zblock)  lru;
+    const uint8_t           *src;
+    uint8_t                 *data;
+} rd_zblock_t;
+
+static TAILQ_HEAD(rd_zblock_queue, rd_zblock) zcache =
+    TAILQ_HEAD_INITIALIZER(zcache);
+static size_t zcache_count;
+static mutex_t zcache_mutex = MUTEX_INITIALIZER;
+
+/* Get a block of a compressed file, with zcache_mutex held */
+static const uint8_t *romdisk_zblock(rd_fd_t *fd, uint32_t block,
+                                     uint32_t *len) {
+    const uint8_t *data = fd->mnt->image + fd->index;
+    uint32_t start = ntohl_32(data + block * 4);
+    uint32_t end = ntohl_32(data + block * 4 + 4);
+    uint32_t want = fd->size - block * fd->zblock;
+    rd_zblock_t *b;
+
+    if(want > fd->zblock)
+        want = fd->zblock;
+
+    *len = want;
+
+    /* Stored as is */
+    if(end - start == want)
+        return data + start;
+
+    TAILQ_FOREACH(b, &zcache, lru) {
+        if(b->src == data + start)
+            break;
+    }
+
+    if(b) {
+        TAILQ_REMOVE(&zcache, b, lru);
+        TAILQ_INSERT_HEAD(&zcache, b, lru);
+        return b->data;
+    }
+
+    if(zcache_count < RD_ZCACHE_BLOCKS) {
+        if(!(b = malloc(sizeof(rd_zblock_t)))) {
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        if(!(b->data = malloc(RD_ZBLOCK_MAX))) {
+            free(b);
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        zcache_count++;
+    }
+    else {
+        b = TAILQ_LAST(&zcache, rd_zblock_queue);
+        TAILQ_REMOVE(&zcache, b, lru);
+    }
+
+    if(fs_lz4_decode(data + start, end - start, b->data, want) !=
+       (ssize_t)want) {
+        dbglog(DBG_ERROR, "fs_romdisk: corrupt block at %p\n", data + start);
+        b->src = NULL;
+        TAILQ_INSERT_TAIL(&zcache, b, lru);
+        errno = EIO;
+        return NULL;
+    }
+
+    b->src = data + start;
+    TAILQ_INSERT_HEAD(&zcache, b, lru);
+
+    return b->data;
+}
+
+/* Forget the blocks of an image going away */
+static void romdisk_zcache_drop(const rd_image_t *mnt) {
+    rd_zblock_t *b;
+
+    mutex_lock_scoped(&zcache_mutex);
+
+    TAILQ_FOREACH(b, &zcache, lru) {
+        if(b->src >= mnt->image && b->src < mnt->image + mnt->size)
+            b->src = NULL;
+    }
+}
+
+/* Read from a compressed file */
+static ssize_t romdisk_zread(rd_fd_t *fd, uint8_t *buf, uint32_t ptr,
+                             size_t bytes) {
+    const uint8_t *data;
+    uint32_t block, off, len, n;
+    size_t rv = 0;
+
+    mutex_lock_scoped(&zcache_mutex);
+
+    while(rv < bytes) {
+        block = ptr / fd->zblock;
+        off = ptr % fd->zblock;
+
+        if(!(data = romdisk_zblock(fd, block, &len)))
+            return -1;
+
+        n = len - off;
+
+        if(n > bytes - rv)
+            n = bytes - rv;
+
+        memcpy(buf + rv, data + off, n);
+        ptr += n;
+        rv += n;
+    }
+
+    return rv;
+}
+
+/* Path index */
+
+/* FNV-1a, in lower case */
+static uint32_t romdisk_hash(const char *fn, size_t len) {
+    uint32_t h = 2166136261U;
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        h ^= (uint8_t)tolower((unsigned char)fn[i]);
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+typedef struct {
+    rd_path_t   *paths;
+    size_t      count, max;
+    char        *names;
+    size_t      names_len, names_max;
+    char        path[PATH_MAX];
+} rd_index_build_t;
+
+static int romdisk_index_add(rd_index_build_t *b, size_t len, uint32_t offset,
+                             bool dir) {
+    rd_path_t *p;
+    void *tmp;
+
+    if(b->count == b->max) {
+        b->max = b->max ? b->max * 2 : 256;
+
+        if(!(tmp = realloc(b->paths, b->max * sizeof(rd_path_t))))
+            return -1;
+
+        b->paths = tmp;
+    }
+
+    if(b->names_len + len + 1 > b->names_max) {
+        b->names_max = (b->names_len + len + 1) * 2;
+
+        if(!(tmp = realloc(b->names, b->names_max)))
+            return -1;
+
+        b->names = tmp;
+    }
+
+    p = &b->paths[b->count++];
+    p->hash = romdisk_hash(b->path, len);
+    p->offset = offset;
+    p->name = b->names_len | (dir ? RD_PATH_DIR : 0);
+    memcpy(b->names + b->names_len, b->path, len);
+    b->names[b->names_len + len] = '\0';
+    b->names_len += len + 1;
+
+    return 0;
+}
+
+/* Add the files and directories in a directory, with the path to it in
+   b->path, len bytes long */
+static int romdisk_index_dir(rd_image_t *mnt, rd_index_build_t *b,
+                             uint32_t i, size_t len, int depth) {
+    const romdisk_file_t *fhdr;
+    uint32_t ni, type, target;
+    const char *name;
+    size_t nlen;
+    int rv = 0;
+
+    /* A directory can't be deeper than the path length allows anyway */
+    if(depth > PATH_MAX / 2)
+        return -1;
+
+    while(i && !rv) {
+        fhdr = (const romdisk_file_t *)(mnt->image + i);
+        ni = ntohl_32(&fhdr->next_header);
+        type = ni & ROMFH_MASK;
+        name = fhdr->filename;
+        nlen = strlen(name);
+        target = i;
+
+        if(romdisk_is_link(fhdr) &&
+           (target = romdisk_follow(mnt->image, mnt->size, i))) {
+            fhdr = (const romdisk_file_t *)(mnt->image + target);
+            type = ntohl_32(&fhdr->next_header) & ROMFH_MASK;
+        }
+
+        if((type == ROMFH_DIR || type == ROMFH_REG) &&
+           strcmp(name, ".") && strcmp(name, "..")) {
+            if(len + !!len + nlen >= sizeof(b->path))
+                return -1;
+
+            if(len)
+                b->path[len] = '/';
+
+            memcpy(b->path + len + !!len, name, nlen);
+            rv = romdisk_index_add(b, len + !!len + nlen, target,
+                                   type == ROMFH_DIR);
+
+            if(!rv && type == ROMFH_DIR)
+                rv = romdisk_index_dir(mnt, b, ntohl_32(&fhdr->spec_info),
+                                       len + !!len + nlen, depth + 1);
+        }
+
+        i = ni & 0xfffffff0;
+    }
+
+    return rv;
+}
+
+static void romdisk_index_build(rd_image_t *mnt) {
+    rd_index_build_t *b;
+    size_t i, size;
+
+    mnt->paths = NULL;
+    mnt->buckets = NULL;
+    mnt->names = NULL;
+
+    if(!FS_ROMDISK_INDEX_MIN || !(b = calloc(1, sizeof(*b))))
+        return;
+
+    if(romdisk_index_dir(mnt, b, mnt->files, 0, 0) < 0 ||
+       b->count < FS_ROMDISK_INDEX_MIN)
+        goto out;
+
+    for(size = 16; size < b->count; size <<= 1)
+        ;
+
+    if(!(mnt->buckets = calloc(size, sizeof(uint32_t))))
+        goto out;
+
+    mnt->mask = size - 1;
+
+    for(i = 0; i < b->count; i++) {
+        b->paths[i].next = mnt->buckets[b->paths[i].hash & mnt->mask];
+        mnt->buckets[b->paths[i].hash & mnt->mask] = i + 1;
+    }
+
+    mnt->paths = b->paths;
+    mnt->names = b->names;
+    b->paths = NULL;
+    b->names = NULL;
+
+    dbglog(DBG_DEBUG, "fs_romdisk: indexed %u paths\n", (unsigned int)b->count);
+
+out:
+    free(b->paths);
+    free(b->names);
+    free(b);
+}
+
+static void romdisk_index_free(rd_image_t *mnt) {
+    free(mnt->paths);
+    free(mnt->buckets);
+    free(mnt->names);
+}
+
+/* Look up a path in the index, with any doubled slashes dropped, as
+   romdisk_find() ignores those. */
+static uint32_t romdisk_index_find(rd_image_t *mnt, const char *fn, bool dir) {
+    char key[PATH_MAX];
+    const rd_path_t *p;
+    uint32_t ent;
+    size_t len = 0;
+
+    for(; *fn; fn++) {
+        if(*fn == '/' && (!len || key[len - 1] == '/'))
+            continue;
+
+        if(len == sizeof(key) - 1)
+            return 0;
+
+        key[len++] = *fn;
+    }
+
+    key[len] = '\0';
+
+    for(ent = mnt->buckets[romdisk_hash(key, len) & mnt->mask]; ent;
+        ent = p->next) {
+        p = &mnt->paths[ent - 1];
+
+        if(!!(p->name & RD_PATH_DIR) == dir &&
+           !strcasecmp(mnt->names + (p->name & ~RD_PATH_DIR), key)) {
+            return p->offset;
+        }
+    }
+
+    return 0;
+}
+
 /* Given a filename and a starting romdisk directory listing (byte offset),
    search for the entry in the directory and return the byte offset to its
    entry. */
 static uint32_t romdisk_find_object(rd_image_t *mnt, const char *fn, size_t fnlen, bool dir, uint32_t offset) {
-    uint32_t          i, ni, type;
+    uint32_t          i, ni, type, want = dir ? ROMFH_DIR : ROMFH_REG;
     const romdisk_file_t    *fhdr;
 
     i = offset;
@@ -138,35 +506,22 @@ static uint32_t romdisk_find_object(rd_image_t *mnt, const char *fn, size_t fnle
         /* Locate the entry, next pointer, and type info */
         fhdr = (const romdisk_file_t *)(mnt->image + i);
         ni = ntohl_32(&fhdr->next_header);
-        type = ni & 0x0f;
+        type = ni & ROMFH_MASK;
         ni = ni & 0xfffffff0;
 
-        /* Check the type */
-        if(!dir) {
-            if((type & 3) != 2) {
-                i = ni;
+        /* Check the type, and then the filename. A hard link has to be
+           followed to know what it is. */
+        if((type == want || romdisk_is_link(fhdr)) &&
+           (strlen(fhdr->filename) == fnlen) &&
+           (!strncasecmp(fhdr->filename, fn, fnlen))) {
+            if(type == want)
+                return i;
 
-                if(!i)
-                    break;
-                else
-                    continue;
-            }
-        }
-        else {
-            if((type & 3) != 1) {
-                i = ni;
-
-                if(!i)
-                    break;
-                else
-                    continue;
-            }
-        }
+            i = romdisk_follow(mnt->image, mnt->size, i);
+            fhdr = (const romdisk_file_t *)(mnt->image + i);
 
-        /* Check filename */
-        if((strlen(fhdr->filename) == fnlen) && (!strncasecmp(fhdr->filename, fn, fnlen))) {
-            /* Match: return this index */
-            return i;
+            if(i && (ntohl_32(&fhdr->next_header) & ROMFH_MASK) == want)
+                return i;
         }
 
         i = ni;
@@ -189,6 +544,12 @@ static uint32_t romdisk_find(rd_image_t *mnt, const char *fn, bool dir) {
     const char      *cur;
     uint32_t        i;
     const romdisk_file_t    *fhdr;
+    size_t          len = strlen(fn);
+
+    /* Paths to the top directory, or ending in a slash, go the long way as
+       they find a directory's first entry rather than its header. */
+    if(mnt->paths && len && fn[len - 1] != '/')
+        return romdisk_index_find(mnt, fn, dir);
 
     /* If the object is in a sub-tree, traverse the trees looking
        for the right directory. */
@@ -255,6 +616,19 @@ static void * romdisk_open(vfs_handler_t *vfs, const char *fn, int mode) {
     fd->ptr = 0;
     fd->size = ntohl_32(&fhdr->size);
     fd->mnt = mnt;
+    fd->map = NULL;
+    fd->zblock = 0;
+
+    /* Directories use spec_info for their first entry */
+    if(mnt->compressed && !fd->dir)
+        fd->zblock = ntohl_32(&fhdr->spec_info);
+
+    if(fd->zblock > RD_ZBLOCK_MAX) {
+        dbglog(DBG_ERROR, "fs_romdisk: %s has blocks too big to read\n", fn);
+        free(fd);
+        errno = EIO;
+        return NULL;
+    }
 
     /* Lock before modifying the queue. */
     mutex_lock_scoped(&fh_mutex);
@@ -271,6 +645,7 @@ static int romdisk_close(void *h) {
     /* Lock before modifying the queue. */
     mutex_lock_scoped(&fh_mutex);
     TAILQ_REMOVE(&rd_fd_queue, fd, next);
+    free(fd->map);
     free(fd);
 
     return 0;
@@ -291,7 +666,15 @@ static ssize_t romdisk_read(void *h, void *buf, size_t bytes) {
         bytes = fd->size - fd->ptr;
 
     /* Copy out the requested amount */
-    memcpy(buf, fd->mnt->image + fd->index + fd->ptr, bytes);
+    if(fd->map)
+        memcpy(buf, fd->map + fd->ptr, bytes);
+    else if(fd->zblock) {
+        if(romdisk_zread(fd, buf, fd->ptr, bytes) < 0)
+            return -1;
+    }
+    else
+        memcpy(buf, fd->mnt->image + fd->index + fd->ptr, bytes);
+
     fd->ptr += bytes;
 
     return bytes;
@@ -381,9 +764,10 @@ static size_t romdisk_total(void *h) {
     return fd->size;
 }
 
-/* Read a directory entry */
-static dirent_t *romdisk_readdir(void *h) {
+/* Read a directory entry, and its status as romdisk_stat() would give it */
+static dirent_t *romdisk_readdir_plus(void *h, struct stat *st) {
     romdisk_file_t *fhdr;
+    uint32_t target;
     int type;
     rd_fd_t *fd = (rd_fd_t *)h;
 
@@ -414,6 +798,14 @@ static dirent_t *romdisk_readdir(void *h) {
     strcpy(fd->dirent.name, fhdr->filename);
     fd->dirent.time = 0;
 
+    /* A hard link looks like what it links to */
+    if(romdisk_is_link(fhdr) &&
+       (target = romdisk_follow(fd->mnt->image, fd->mnt->size,
+                                (const uint8_t *)fhdr - fd->mnt->image))) {
+        fhdr = (romdisk_file_t *)(fd->mnt->image + target);
+        type = ntohl_32(&fhdr->next_header) & 0x0f;
+    }
+
     if((type & ROMFH_MASK) == ROMFH_DIR ||
             strcmp(fd->dirent.name, ".") == 0 ||
             strcmp(fd->dirent.name, "..") == 0) {
@@ -425,9 +817,31 @@ static dirent_t *romdisk_readdir(void *h) {
         fd->dirent.size = ntohl_32(&fhdr->size);
     }
 
+    if(st) {
+        memset(st, 0, sizeof(struct stat));
+        st->st_dev = (dev_t)((uintptr_t)fd->mnt);
+        st->st_mode = S_IRUSR | S_IXUSR | S_IRGRP | S_IXGRP | S_IROTH |
+            S_IXOTH;
+        st->st_mode |= (fd->dirent.attr & O_DIR) ? S_IFDIR : S_IFREG;
+        st->st_size = fd->dirent.size;
+        st->st_nlink = (fd->dirent.attr & O_DIR) ? 2 : 1;
+        st->st_blksize = 1024;
+
+        if(!(fd->dirent.attr & O_DIR)) {
+            st->st_blocks = st->st_size >> 10;
+
+            if(st->st_size & 0x3ff)
+                ++st->st_blocks;
+        }
+    }
+
     return &fd->dirent;
 }
 
+static dirent_t *romdisk_readdir(void *h) {
+    return romdisk_readdir_plus(h, NULL);
+}
+
 /* Just to get the errno that might be better recognized upstream. */
 static int romdisk_unlink(vfs_handler_t *vfs, const char *fn) {
     (void)vfs;
@@ -445,6 +859,23 @@ static void *romdisk_mmap(void *h) {
         return NULL;
     }
 
+    /* Compressed files are decompressed whole, for as long as they're open */
+    if(fd->zblock && !fd->map) {
+        if(!(fd->map = malloc(fd->size ? fd->size : 1))) {
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        if(romdisk_zread(fd, fd->map, 0, fd->size) < 0) {
+            free(fd->map);
+            fd->map = NULL;
+            return NULL;
+        }
+    }
+
+    if(fd->map)
+        return fd->map;
+
     /* Can't really help the loss of "const" here */
     return (void *)(fd->mnt->image + fd->index);
 }
@@ -615,7 +1046,12 @@ static vfs_handler_t vh = {
     NULL,                       /* total64 */
     NULL,                       /* readlink */
     romdisk_rewinddir,
-    romdisk_fstat
+    romdisk_fstat,
+    NULL,                       /* read_async */
+    NULL,                       /* write_async */
+    NULL,                       /* splice_out */
+    NULL,                       /* splice_in */
+    romdisk_readdir_plus
 };
 
 /* Are we initialized? */
@@ -632,6 +1068,11 @@ static void fs_romdisk_list_remove(rd_image_t *n) {
     dbglog(DBG_DEBUG, "fs_romdisk: unmounting image at %p from %s\n",
            n->image, n->vfsh->nmmgr.pathname);
 
+    if(n->compressed)
+        romdisk_zcache_drop(n);
+
+    romdisk_index_free(n);
+
     /* Unmount it */
     assert((void *)&n->vfsh->nmmgr == (void *)n->vfsh);
     nmmgr_handler_remove(&n->vfsh->nmmgr);
@@ -707,7 +1148,8 @@ int fs_romdisk_mount(const char *mountpoint, const uint8_t *img, bool own_buffer
         return -1;
 
     /* Check the image and print some info about it */
-    if(strncmp(hdr->magic, "-rom1fs-", sizeof(hdr->magic))) {
+    if(strncmp(hdr->magic, "-rom1fs-", sizeof(hdr->magic)) &&
+       strncmp(hdr->magic, "-rom1fz-", sizeof(hdr->magic))) {
         dbglog(DBG_ERROR, "fs_romdisk: image at %p is not a ROMFS image\n", img);
         return -2;
     }
@@ -723,7 +1165,9 @@ int fs_romdisk_mount(const char *mountpoint, const uint8_t *img, bool own_buffer
         return -3;
     }
     mnt->own_buffer = own_buffer;
+    mnt->compressed = hdr->magic[6] == 'z';
     mnt->image = img;
+    mnt->size = ntohl_32(&hdr->full_size);
     mnt->files = sizeof(romdisk_hdr_t)
                  + (strlen(hdr->volume_name) / RD_VN_MAX) * RD_VN_MAX;
 
@@ -735,6 +1179,8 @@ int fs_romdisk_mount(const char *mountpoint, const uint8_t *img, bool own_buffer
         errno=ENOMEM;
         return -3;
     }
+    romdisk_index_build(mnt);
+
     memcpy(vfsh, &vh, sizeof(vfs_handler_t));
     strcpy(vfsh->nmmgr.pathname, mountpoint);
     vfsh->privdata = (void *)mnt;
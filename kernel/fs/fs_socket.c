@@ -11,10 +11,12 @@
 #include <kos/net.h>
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <sys/queue.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -25,6 +27,9 @@ TAILQ_HEAD(proto_list, fs_socket_proto);
 /* Define the socket list type */
 LIST_HEAD(socket_list, net_socket);
 
+/* Size of the buffer sendfile() reads files that can't be mapped into */
+#define SENDFILE_BUF    16384
+
 static struct proto_list protocols;
 static struct socket_list sockets;
 static mutex_t proto_rlock = RECURSIVE_MUTEX_INITIALIZER;
@@ -505,6 +510,249 @@ ssize_t sendto(int sock, const void *message, size_t length, int flags,
                                  dest_len);
 }
 
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
+    net_socket_t *hnd;
+    const uint8_t *map;
+    uint8_t *buf;
+    off_t pos, orig = -1;
+    size_t total, done = 0;
+    ssize_t rv = 0, got, o;
+
+    hnd = (net_socket_t *)fs_get_handle(out_fd);
+
+    if(hnd == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Make sure this is actually a socket. */
+    if(fs_get_handler(out_fd) != &vh) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+
+    if((orig = fs_tell(in_fd)) < 0)
+        return -1;
+
+    pos = offset ? *offset : orig;
+
+    /* Files that live in memory (or that the MMU can page in) can go to the
+       socket directly from there. */
+    if((map = (const uint8_t *)fs_mmap(in_fd))) {
+        total = fs_total(in_fd);
+
+        if((size_t)pos >= total)
+            count = 0;
+        else if(count > total - pos)
+            count = total - pos;
+
+        while(done < count) {
+            rv = hnd->protocol->sendto(hnd, map + pos + done, count - done, 0,
+                                       NULL, 0);
+
+            if(rv <= 0)
+                break;
+
+            done += rv;
+        }
+    }
+    else {
+        if(!(buf = (uint8_t *)malloc(SENDFILE_BUF))) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        if(offset && fs_seek(in_fd, pos, SEEK_SET) < 0) {
+            free(buf);
+            return -1;
+        }
+
+        while(done < count) {
+            got = count - done < SENDFILE_BUF ? count - done : SENDFILE_BUF;
+
+            if((got = fs_read(in_fd, buf, got)) <= 0) {
+                rv = got;
+                break;
+            }
+
+            for(o = 0; o < got; o += rv) {
+                rv = hnd->protocol->sendto(hnd, buf + o, got - o, 0, NULL, 0);
+
+                if(rv <= 0)
+                    break;
+
+                done += rv;
+            }
+
+            if(rv <= 0)
+                break;
+        }
+
+        free(buf);
+    }
+
+    /* Put the position of the file where it should be: untouched if there was
+       an offset, or just past what was sent. Data read but not sent is not
+       lost that way. */
+    if(offset) {
+        *offset = pos + done;
+        fs_seek(in_fd, orig, SEEK_SET);
+    }
+    else {
+        fs_seek(in_fd, pos + done, SEEK_SET);
+    }
+
+    if(!done && rv < 0)
+        return -1;
+
+    return done;
+}
+
+/* Receive a message with one call to recvfrom() per buffer. This is only
+   meant for stream protocols, datagram ones have their own recvmmsg(). */
+static ssize_t sock_recvmsg(net_socket_t *hnd, struct msghdr *msg, int flags) {
+    struct sockaddr *addr = (struct sockaddr *)msg->msg_name;
+    socklen_t *alen = addr ? &msg->msg_namelen : NULL;
+    ssize_t rv, len = 0;
+    int i;
+
+    msg->msg_flags = 0;
+    msg->msg_controllen = 0;
+
+    for(i = 0; i < msg->msg_iovlen; ++i) {
+        rv = hnd->protocol->recvfrom(hnd, msg->msg_iov[i].iov_base,
+                                     msg->msg_iov[i].iov_len, flags, addr,
+                                     alen);
+
+        if(rv < 0)
+            return len ? len : -1;
+
+        len += rv;
+
+        if((size_t)rv < msg->msg_iov[i].iov_len)
+            break;
+
+        /* Only wait for the start of the message. */
+        flags |= MSG_DONTWAIT;
+        addr = NULL;
+        alen = NULL;
+    }
+
+    return len;
+}
+
+/* Send a message with one call to sendto() per buffer. */
+static ssize_t sock_sendmsg(net_socket_t *hnd, const struct msghdr *msg,
+                            int flags) {
+    ssize_t rv, len = 0;
+    int i;
+
+    for(i = 0; i < msg->msg_iovlen; ++i) {
+        rv = hnd->protocol->sendto(hnd, msg->msg_iov[i].iov_base,
+                                   msg->msg_iov[i].iov_len, flags,
+                                   (const struct sockaddr *)msg->msg_name,
+                                   msg->msg_namelen);
+
+        if(rv < 0)
+            return len ? len : -1;
+
+        len += rv;
+
+        if((size_t)rv < msg->msg_iov[i].iov_len)
+            break;
+    }
+
+    return len;
+}
+
+int recvmmsg(int sock, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+             struct timespec *timeout) {
+    net_socket_t *hnd;
+    unsigned int n;
+    ssize_t rv;
+
+    hnd = (net_socket_t *)fs_get_handle(sock);
+
+    if(hnd == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Make sure this is actually a socket. */
+    if(fs_get_handler(sock) != &vh) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+
+    if(!vlen)
+        return 0;
+
+    if(msgvec == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    if(hnd->protocol->recvmmsg)
+        return hnd->protocol->recvmmsg(hnd, msgvec, vlen, flags, timeout);
+
+    /* The protocol can't do it in one go, so do it one message at a time. The
+       timeout isn't supported this way. */
+    for(n = 0; n < vlen; ++n) {
+        if((rv = sock_recvmsg(hnd, &msgvec[n].msg_hdr, flags)) < 0)
+            return n ? (int)n : -1;
+
+        msgvec[n].msg_len = rv;
+
+        /* The peer is gone, nothing more will come. */
+        if(!rv)
+            return n + 1;
+
+        if(flags & MSG_WAITFORONE)
+            flags |= MSG_DONTWAIT;
+    }
+
+    return n;
+}
+
+int sendmmsg(int sock, struct mmsghdr *msgvec, unsigned int vlen, int flags) {
+    net_socket_t *hnd;
+    unsigned int n;
+    ssize_t rv;
+
+    hnd = (net_socket_t *)fs_get_handle(sock);
+
+    if(hnd == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Make sure this is actually a socket. */
+    if(fs_get_handler(sock) != &vh) {
+        errno = ENOTSOCK;
+        return -1;
+    }
+
+    if(!vlen)
+        return 0;
+
+    if(msgvec == NULL) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    if(hnd->protocol->sendmmsg)
+        return hnd->protocol->sendmmsg(hnd, msgvec, vlen, flags);
+
+    for(n = 0; n < vlen; ++n) {
+        if((rv = sock_sendmsg(hnd, &msgvec[n].msg_hdr, flags)) < 0)
+            return n ? (int)n : -1;
+
+        msgvec[n].msg_len = rv;
+    }
+
+    return n;
+}
+
 int shutdown(int sock, int how) {
     net_socket_t *hnd;
 
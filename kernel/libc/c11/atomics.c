@@ -5,8 +5,11 @@
 */
 
 /* This file provides the additional symbols required to provide
-   support for C11 atomics with the "-matomic-model=soft-imask"
-   build flag.
+   support for C11 atomics with the "-matomic-model=soft-gusa"
+   build flag. GCC expands the 1, 2 and 4 byte atomics inline as
+   restartable sequences, which the exception entry rolls back when
+   they get interrupted (see irq_handle_exception()). Only 64-bit and
+   generically sized atomics end up in here.
 */
 
 #include <arch/arch.h>
@@ -93,7 +96,35 @@
     }
 
 /* GCC provides us with all primitive atomics except for 64-bit types. */
+#ifdef __SH_ATOMIC_MODEL_SOFT_GUSA__
+/* A 64-bit load is two loads and no store, so it fits in a restartable
+   sequence just like the ones GCC generates: if we get interrupted
+   between the two, we start over and read both halves again. That saves
+   the SR writes of masking interrupts. Nothing that writes two words can
+   do the same, as an interrupt between the stores would let another thread
+   see half of the new value. */
+unsigned long long
+__atomic_load_8(const volatile void *ptr, int model) {
+    uint32_t lo, hi;
+
+    (void)model;
+
+    __asm__ __volatile__("   mova    1f, r0\n"
+                         "   .align  2\n"
+                         "   mov     r15, r1\n"
+                         "   mov     #(0f-1f), r15\n"
+                         "0: mov.l   @%2, %0\n"
+                         "   mov.l   @(4,%2), %1\n"
+                         "1: mov     r1, r15\n"
+                         : "=&r"(lo), "=&r"(hi)
+                         : "r"(ptr)
+                         : "r0", "r1", "memory");
+
+    return ((unsigned long long)hi << 32) | lo;
+}
+#else
 ATOMIC_LOAD_N_(unsigned long long, 8)
+#endif
 ATOMIC_STORE_N_(unsigned long long, 8)
 ATOMIC_EXCHANGE_N_(unsigned long long, 8)
 ATOMIC_COMPARE_EXCHANGE_N_(unsigned long long, 8)
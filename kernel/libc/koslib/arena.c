@@ -0,0 +1,74 @@
+/* KallistiOS ##version##
+
+   arena.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kos/arena.h>
+
+int arena_init(arena_t *arena, void *buf, size_t size) {
+    uintptr_t start, end;
+
+    if(!buf) {
+        size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+        if(!(buf = memalign(ARENA_ALIGN, size))) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        arena->owned = 1;
+    }
+    else {
+        arena->owned = 0;
+    }
+
+    start = ((uintptr_t)buf + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+    end = (uintptr_t)buf + size;
+
+    arena->base = (uint8_t *)start;
+    arena->size = end > start ? end - start : 0;
+    arena->used = 0;
+    arena->peak = 0;
+
+    return 0;
+}
+
+void arena_destroy(arena_t *arena) {
+    if(arena->owned)
+        free(arena->base);
+
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+void *arena_calloc(arena_t *arena, size_t nmemb, size_t size) {
+    void *ptr;
+
+    if(size && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if((ptr = arena_alloc(arena, nmemb * size)))
+        memset(ptr, 0, nmemb * size);
+
+    return ptr;
+}
+
+char *arena_strdup(arena_t *arena, const char *str) {
+    size_t len = strlen(str) + 1;
+    char *ptr;
+
+    if((ptr = arena_alloc(arena, len)))
+        memcpy(ptr, str, len);
+
+    return ptr;
+}
@@ -8,11 +8,14 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 
 #include <kos/dbglog.h>
 #include <kos/thread.h>
 #include <kos/dbgio.h>
 #include <kos/fs.h>
+#include <kos/ringbuf.h>
+#include <kos/timer.h>
 
 #include <arch/spinlock.h>
 
@@ -30,6 +33,12 @@ void dbglog_set_level(int level) {
     dbglog_level = level;
 }
 
+/* Write out a formatted message */
+static void dbglog_write(const char *str) {
+    if(irq_inside_int() || (fs_write(STDOUT_FILENO, str, strlen(str)) < 0))
+        dbgio_write_str(str);
+}
+
 /* Kernel debug logging facility */
 void __real_dbglog(int level, const char *fmt, ...) {
     va_list args;
@@ -47,12 +56,149 @@ void __real_dbglog(int level, const char *fmt, ...) {
     i = vsnprintf(printf_buf, sizeof(printf_buf), fmt, args);
     va_end(args);
 
-    if(i > 0) {
-        if(irq_inside_int() || 
-            (fs_write(STDOUT_FILENO, printf_buf, strlen(printf_buf)) < 0))
-                dbgio_write_str(printf_buf);
-    }
+    if(i > 0)
+        dbglog_write(printf_buf);
 
     if(level >= DBG_ERROR && !irq_inside_int())
         spinlock_unlock(&mutex);
 }
+
+/* Trace ring. Messages go in from anywhere, and come out of the one consumer
+   holding trace_lock, either the trace thread or dbgtrace_dump(). */
+typedef struct trace_msg {
+    uint64_t time;
+    const char *fmt;
+    uintptr_t args[DBGTRACE_MAX_ARGS];
+} trace_msg_t;
+
+static ringbuf_t trace_ring;
+static volatile bool trace_on, trace_quit;
+static unsigned int trace_dropped;
+static kthread_t *trace_thd;
+static spinlock_t trace_lock = SPINLOCK_INITIALIZER;
+static char trace_buf[1024];
+
+void __real_dbgtrace(int level, const char *fmt, unsigned int nargs, ...) {
+    trace_msg_t msg;
+    va_list args;
+    unsigned int i;
+
+    if((DBGLOG_LEVEL_SUPPORT < level) || (level > dbglog_level))
+        return;
+
+    va_start(args, nargs);
+
+    for(i = 0; i < DBGTRACE_MAX_ARGS; i++)
+        msg.args[i] = i < nargs ? va_arg(args, uintptr_t) : 0;
+
+    va_end(args);
+
+    if(!trace_on) {
+        __real_dbglog(level, fmt, msg.args[0], msg.args[1], msg.args[2],
+                      msg.args[3], msg.args[4], msg.args[5]);
+        return;
+    }
+
+    msg.time = timer_us_gettime64();
+    msg.fmt = fmt;
+
+    if(!ringbuf_push(&trace_ring, &msg))
+        __atomic_fetch_add(&trace_dropped, 1, __ATOMIC_RELAXED);
+}
+
+/* Format and write out one message. Assumes trace_lock is held. */
+static void trace_write(const trace_msg_t *msg) {
+    unsigned int dropped;
+    int n;
+
+    dropped = __atomic_exchange_n(&trace_dropped, 0, __ATOMIC_RELAXED);
+
+    if(dropped) {
+        snprintf(trace_buf, sizeof(trace_buf),
+                 "dbgtrace: %u messages dropped\n", dropped);
+        dbglog_write(trace_buf);
+    }
+
+    n = snprintf(trace_buf, sizeof(trace_buf), "[%5lu.%06lu] ",
+                 (unsigned long)(msg->time / 1000000),
+                 (unsigned long)(msg->time % 1000000));
+    snprintf(trace_buf + n, sizeof(trace_buf) - n, msg->fmt,
+             msg->args[0], msg->args[1], msg->args[2], msg->args[3],
+             msg->args[4], msg->args[5]);
+    dbglog_write(trace_buf);
+}
+
+static void trace_drain(void) {
+    trace_msg_t msg;
+
+    spinlock_lock(&trace_lock);
+
+    while(ringbuf_pop(&trace_ring, &msg))
+        trace_write(&msg);
+
+    spinlock_unlock(&trace_lock);
+}
+
+static void *trace_thread(void *d) {
+    (void)d;
+
+    while(!trace_quit) {
+        ringbuf_wait(&trace_ring, 0);
+        trace_drain();
+    }
+
+    return NULL;
+}
+
+int dbgtrace_init(size_t count, bool thread) {
+    const kthread_attr_t attr = {
+        .label = "dbgtrace",
+        .prio = PRIO_DEFAULT + 1
+    };
+
+    if(trace_on) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    /* The ring is kept after dbgtrace_shutdown(), as a message might still
+       be on its way in from a thread that saw it running. */
+    if(trace_ring.data && ringbuf_capacity(&trace_ring) != count)
+        ringbuf_destroy(&trace_ring);
+
+    if(!trace_ring.data && ringbuf_init(&trace_ring, sizeof(trace_msg_t),
+                                        count, RINGBUF_MPSC) < 0)
+        return -1;
+
+    trace_quit = false;
+    trace_on = true;
+
+    if(thread && !(trace_thd = thd_create_ex(&attr, trace_thread, NULL))) {
+        trace_on = false;
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+void dbgtrace_dump(void) {
+    if(trace_on)
+        trace_drain();
+}
+
+void dbgtrace_shutdown(void) {
+    if(!trace_on)
+        return;
+
+    if(trace_thd) {
+        trace_quit = true;
+        ringbuf_wake(&trace_ring);
+        thd_join(trace_thd, NULL);
+        trace_thd = NULL;
+    }
+
+    /* Anything logged from here on goes to dbglog() instead. */
+    trace_on = false;
+    trace_drain();
+}
@@ -0,0 +1,359 @@
+/* KallistiOS ##version##
+
+   epoll.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Event-driven readiness notification. Every watched file descriptor has an
+   item, hashed by the VFS handle it refers to, so that a readiness change
+   reported by a handler finds its watchers right away and puts them on the
+   ready queue of their set. Handlers may report changes from interrupts, so
+   the hash and the ready queues are protected by disabling interrupts. The
+   rest of a set is protected by its mutex, which kos_epoll_wait() holds while
+   it looks at the ready queue, so items can't go away under it.
+
+   The ready queue only says which items may be ready: kos_epoll_wait() always
+   asks the handler about the current state of an item before reporting it. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/queue.h>
+
+#include <arch/irq.h>
+#include <kos/epoll.h>
+#include <kos/fs.h>
+#include <kos/genwait.h>
+#include <kos/mutex.h>
+#include <kos/timer.h>
+
+#define EPOLL_BUCKETS   64      /* Must be a power of two */
+
+/* The poll events of an item's events field */
+#define EPOLL_EVENTS    0xFFFF
+
+typedef struct epoll_item {
+    LIST_ENTRY(epoll_item) hash;        /* Items watching the same bucket */
+    LIST_ENTRY(epoll_item) list;        /* Items of the set */
+    TAILQ_ENTRY(epoll_item) ready;      /* Ready queue of the set */
+    kos_epoll_t *ep;
+    int fd;
+    void *hnd;
+    uint32_t events;
+    kos_epoll_data_t data;
+    uint8_t queued;
+    uint8_t armed;
+} epoll_item_t;
+
+TAILQ_HEAD(epoll_queue, epoll_item);
+
+struct kos_epoll {
+    mutex_t mutex;
+    LIST_HEAD(, epoll_item) items;
+    struct epoll_queue ready;
+};
+
+static LIST_HEAD(epoll_bucket, epoll_item) buckets[EPOLL_BUCKETS];
+
+static inline struct epoll_bucket *epoll_bucket(const void *hnd) {
+    return &buckets[((uint32_t)((uintptr_t)hnd >> 3) * 0x9e3779b1u) >> 26 &
+                    (EPOLL_BUCKETS - 1)];
+}
+
+/* Put an item on the ready queue of its set, and wake up the set's waiter.
+   Assumes interrupts are disabled. */
+static void epoll_queue(epoll_item_t *it) {
+    if(it->queued)
+        return;
+
+    TAILQ_INSERT_TAIL(&it->ep->ready, it, ready);
+    it->queued = 1;
+    genwait_wake_all(it->ep);
+}
+
+void __epoll_event_trigger(void *hnd, short event) {
+    epoll_item_t *it;
+
+    irq_disable_scoped();
+
+    LIST_FOREACH(it, epoll_bucket(hnd), hash) {
+        if(it->hnd == hnd && it->armed &&
+           (event & ((it->events & EPOLL_EVENTS) | POLLERR | POLLHUP |
+                     POLLNVAL)))
+            epoll_queue(it);
+    }
+}
+
+kos_epoll_t *kos_epoll_create(void) {
+    kos_epoll_t *ep;
+
+    if(!(ep = (kos_epoll_t *)malloc(sizeof(kos_epoll_t)))) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if(mutex_init(&ep->mutex, MUTEX_TYPE_NORMAL)) {
+        free(ep);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    LIST_INIT(&ep->items);
+    TAILQ_INIT(&ep->ready);
+
+    return ep;
+}
+
+/* Unhook an item from the hash and the ready queue. */
+static void epoll_unhook(epoll_item_t *it) {
+    irq_disable_scoped();
+
+    LIST_REMOVE(it, hash);
+
+    if(it->queued) {
+        TAILQ_REMOVE(&it->ep->ready, it, ready);
+        it->queued = 0;
+    }
+}
+
+static void epoll_hook(epoll_item_t *it) {
+    irq_disable_scoped();
+
+    LIST_INSERT_HEAD(epoll_bucket(it->hnd), it, hash);
+
+    /* Whatever state the file descriptor is in now won't be reported as a
+       change, so have a look at it on the next wait. */
+    epoll_queue(it);
+}
+
+void kos_epoll_destroy(kos_epoll_t *ep) {
+    epoll_item_t *it;
+
+    if(!ep)
+        return;
+
+    mutex_lock(&ep->mutex);
+
+    while((it = LIST_FIRST(&ep->items))) {
+        LIST_REMOVE(it, list);
+        epoll_unhook(it);
+        free(it);
+    }
+
+    mutex_unlock(&ep->mutex);
+    mutex_destroy(&ep->mutex);
+    free(ep);
+}
+
+int kos_epoll_ctl(kos_epoll_t *ep, int op, int fd, kos_epoll_event_t *ev) {
+    epoll_item_t *it, *nit = NULL;
+    void *hnd;
+
+    if(!ep || (op != KOS_EPOLL_CTL_DEL && !ev)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(fd < 0 || fd >= FD_SETSIZE || !(hnd = fs_get_handle(fd))) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if(op == KOS_EPOLL_CTL_ADD &&
+       !(nit = (epoll_item_t *)malloc(sizeof(epoll_item_t)))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    mutex_lock_scoped(&ep->mutex);
+
+    LIST_FOREACH(it, &ep->items, list) {
+        if(it->fd == fd)
+            break;
+    }
+
+    switch(op) {
+        case KOS_EPOLL_CTL_ADD:
+            if(it) {
+                free(nit);
+                errno = EEXIST;
+                return -1;
+            }
+
+            nit->ep = ep;
+            nit->fd = fd;
+            nit->hnd = hnd;
+            nit->events = ev->events;
+            nit->data = ev->data;
+            nit->queued = 0;
+            nit->armed = 1;
+            LIST_INSERT_HEAD(&ep->items, nit, list);
+            epoll_hook(nit);
+            return 0;
+
+        case KOS_EPOLL_CTL_MOD:
+            if(!it) {
+                errno = ENOENT;
+                return -1;
+            }
+
+            /* The descriptor may have been closed and reused since. */
+            epoll_unhook(it);
+            it->hnd = hnd;
+            it->events = ev->events;
+            it->data = ev->data;
+            it->armed = 1;
+            epoll_hook(it);
+            return 0;
+
+        case KOS_EPOLL_CTL_DEL:
+            if(!it) {
+                errno = ENOENT;
+                return -1;
+            }
+
+            LIST_REMOVE(it, list);
+            epoll_unhook(it);
+            free(it);
+            return 0;
+
+        default:
+            free(nit);
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+/* Ask the handler of a watched file descriptor what state it is in. */
+static short epoll_poll(const epoll_item_t *it) {
+    vfs_handler_t *hndl = fs_get_handler(it->fd);
+    short mask = (it->events & EPOLL_EVENTS) | POLLERR | POLLHUP;
+
+    if(!hndl || fs_get_handle(it->fd) != it->hnd)
+        return POLLNVAL;
+
+    /* Assume it's a regular file if there's no poll method in the handler,
+       like poll() does. */
+    if(!hndl->poll)
+        return mask & (POLLRDNORM | POLLWRNORM);
+
+    return hndl->poll(it->hnd, mask) & (mask | POLLNVAL);
+}
+
+/* Report the items of the ready queue that really are ready. */
+static int epoll_harvest(kos_epoll_t *ep, kos_epoll_event_t *events,
+                         int maxevents) {
+    struct epoll_queue again = TAILQ_HEAD_INITIALIZER(again);
+    epoll_item_t *it;
+    irq_mask_t flags;
+    short rev;
+    int n = 0;
+
+    while(n < maxevents) {
+        flags = irq_disable();
+
+        if((it = TAILQ_FIRST(&ep->ready))) {
+            TAILQ_REMOVE(&ep->ready, it, ready);
+            it->queued = 0;
+        }
+
+        irq_restore(flags);
+
+        if(!it)
+            break;
+
+        if(!it->armed || !(rev = epoll_poll(it)))
+            continue;
+
+        events[n].events = rev;
+        events[n++].data = it->data;
+
+        if(it->events & KOS_EPOLLONESHOT) {
+            it->armed = 0;
+        }
+        else if(!(it->events & KOS_EPOLLET)) {
+            /* Level-triggered: look at it again on the next wait, but don't
+               report it twice in this one. */
+            flags = irq_disable();
+
+            if(!it->queued) {
+                TAILQ_INSERT_TAIL(&again, it, ready);
+                it->queued = 1;
+            }
+
+            irq_restore(flags);
+        }
+    }
+
+    flags = irq_disable();
+
+    while((it = TAILQ_FIRST(&again))) {
+        TAILQ_REMOVE(&again, it, ready);
+        TAILQ_INSERT_TAIL(&ep->ready, it, ready);
+    }
+
+    irq_restore(flags);
+
+    return n;
+}
+
+int kos_epoll_wait(kos_epoll_t *ep, kos_epoll_event_t *events, int maxevents,
+                   int timeout) {
+    uint64_t end = 0, now;
+    irq_mask_t flags;
+    int n, rv, err = errno;
+
+    if(!ep || !events || maxevents < 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(timeout > 0)
+        end = timer_ms_gettime64() + timeout;
+
+    if(mutex_lock_irqsafe(&ep->mutex))
+        return -1;
+
+    while(!(n = epoll_harvest(ep, events, maxevents)) && timeout) {
+        /* We can't actually wait while we're in an interrupt. */
+        if(irq_inside_int()) {
+            errno = EPERM;
+            n = -1;
+            break;
+        }
+
+        if(timeout > 0) {
+            now = timer_ms_gettime64();
+
+            if(now >= end)
+                break;
+
+            timeout = (int)(end - now);
+        }
+
+        /* Nothing can become ready between checking the queue and going to
+           sleep, with interrupts disabled. */
+        flags = irq_disable();
+
+        if(TAILQ_EMPTY(&ep->ready)) {
+            mutex_unlock(&ep->mutex);
+            rv = genwait_wait(ep, "kos_epoll_wait", timeout > 0 ? timeout : 0,
+                              NULL);
+            irq_restore(flags);
+            mutex_lock(&ep->mutex);
+
+            /* Timed out, have a last look and give up. */
+            if(rv < 0) {
+                errno = err;
+                n = epoll_harvest(ep, events, maxevents);
+                break;
+            }
+        }
+        else {
+            irq_restore(flags);
+        }
+    }
+
+    mutex_unlock(&ep->mutex);
+    return n;
+}
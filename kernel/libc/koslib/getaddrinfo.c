@@ -18,15 +18,19 @@
    The implementations of getaddrinfo() and freeaddrinfo() are new to this
    version of the code though.
 
-   Eventually, I'd like to add some sort of caching of results to this file so
-   that if you look something up more than once, it doesn't have to go back out
-   to the server to do so. But, for now, there is no local database of cached
-   addresses...
+   Answers are cached for as long as their TTL says they can be (and names
+   that don't exist for a little while), so looking a name up again doesn't
+   have to go back out to the server. When both IPv4 and IPv6 addresses are
+   wanted, the A and AAAA questions are sent as two queries at once, on the
+   same socket.
 */
 
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
+#include <stdalign.h>
+#include <stdbool.h>
 #include <unistd.h>
 #include <errno.h>
 #include <poll.h>
@@ -38,6 +42,9 @@
 
 #include <kos/net.h>
 #include <kos/dbglog.h>
+#include <kos/mutex.h>
+#include <kos/thread.h>
+#include <arch/timer.h>
 
 /* How many attempts to make at contacting the DNS server before giving up. */
 #define DNS_ATTEMPTS    4
@@ -45,6 +52,18 @@
 /* How long to wait between attempts. */
 #define DNS_TIMEOUT     500
 
+/* How many addresses of each type are kept from an answer. */
+#define DNS_MAX_ADDRS   4
+
+/* How many names are cached, and the longest name that can be. */
+#define DNS_CACHE_SIZE  16
+#define DNS_NAME_MAX    64
+
+/* The longest an answer is cached, and how long a name that doesn't exist is
+   remembered, in seconds. */
+#define DNS_TTL_MAX     86400
+#define DNS_NEG_TTL     30
+
 /*
    This performs a simple DNS A-record query. It hasn't been tested extensively
    but so far it seems to work fine.
@@ -122,7 +141,7 @@ static size_t dns_make_query(const char *host, dnsmsg_t *buf, int ip4,
     int i, o = 0, ls, t;
 
     // Build up the header.
-    buf->id = htons(qnum++);
+    buf->id = htons(__atomic_fetch_add(&qnum, 1, __ATOMIC_RELAXED));
     buf->flags = htons(0x0100);
     buf->qdcount = htons(ip4 + ip6);
     buf->ancount = htons(0);
@@ -212,90 +231,161 @@ static size_t dns_make_query(const char *host, dnsmsg_t *buf, int ip4,
    name, and the A answer contains the address.
  */
 
-// Scans through and skips a label in the data payload, starting
-// at the given offset. The new offset (after the label) will be
-// returned.
-static int dns_skip_label(dnsmsg_t *resp, int o) {
-    int cnt;
-
-    // End of the label?
-    while(resp->data[o] != 0) {
-        // Is it a pointer?
-        if((resp->data[o] & 0xc0) == 0xc0)
-            return o + 2;
+/* Forward declaration... */
+static struct addrinfo *add_ipv4_ai(uint32_t ip, uint16_t port,
+                                    struct addrinfo *h, struct addrinfo *tail);
+static struct addrinfo *add_ipv6_ai(const struct in6_addr *ip, uint16_t port,
+                                    struct addrinfo *h, struct addrinfo *tail);
 
-        // Skip this part.
-        cnt = resp->data[o++];
-        o += cnt;
+/* The two kinds of lookup, which index the arrays below. */
+#define DNS_A           0
+#define DNS_AAAA        1
+
+/* The addresses of one type that a lookup found. */
+typedef struct dns_rrset {
+    int rv;                             /* 0, or the EAI_* error */
+    int count;                          /* Number of addresses */
+    uint32_t ttl;                       /* Lowest TTL of the answer */
+    uint8_t addrs[DNS_MAX_ADDRS][16];   /* Only 4 bytes used for A */
+} dns_rrset_t;
+
+/* A cached name. The A and AAAA answers expire on their own. */
+typedef struct dns_cache_ent {
+    char name[DNS_NAME_MAX];
+    uint32_t server;                    /* The DNS server that answered */
+    uint64_t expires[2];                /* In ms, 0 if not cached */
+    uint64_t used;                      /* Last lookup, in ms */
+    dns_rrset_t sets[2];
+} dns_cache_ent_t;
+
+static dns_cache_ent_t dns_cache[DNS_CACHE_SIZE];
+static mutex_t dns_cache_lock = MUTEX_INITIALIZER;
+
+/* Copy out the cached answer of a name, if there is one still good. */
+static bool dns_cache_get(const char *name, uint32_t server, int type,
+                          dns_rrset_t *set) {
+    dns_cache_ent_t *e;
+    uint64_t now = timer_ms_gettime64();
+    bool rv = false;
+    int i;
+
+    mutex_lock(&dns_cache_lock);
+
+    for(i = 0; i < DNS_CACHE_SIZE; i++) {
+        e = &dns_cache[i];
+
+        if(e->expires[type] > now && e->server == server &&
+           !strcasecmp(e->name, name)) {
+            *set = e->sets[type];
+            e->used = now;
+            rv = true;
+            break;
+        }
     }
 
-    // Skip the terminator
-    o++;
+    mutex_unlock(&dns_cache_lock);
 
-    return o;
+    return rv;
 }
 
-// Scans through and copies out a label in the data payload,
-// starting at the given offset. The new offset (after the label)
-// will be returned as well as the label string.
-static int dns_copy_label(dnsmsg_t *resp, int o, char *outbuf) {
-    int cnt;
-    int rv = -1;
-
-    // Do each part.
-    outbuf[0] = 0;
+/* Cache an answer, in the entry of its name if it has one already, or else
+   in place of the least recently used name. */
+static void dns_cache_put(const char *name, uint32_t server, int type,
+                          const dns_rrset_t *set) {
+    dns_cache_ent_t *e = NULL;
+    uint64_t now;
+    uint32_t ttl;
+    int i;
+
+    if(set->rv == 0)
+        ttl = set->ttl < DNS_TTL_MAX ? set->ttl : DNS_TTL_MAX;
+    else if(set->rv == EAI_NONAME)
+        ttl = DNS_NEG_TTL;
+    else
+        return;
 
-    for(;;) {
-        // Is it a pointer?
-        if((resp->data[o] & 0xc0) == 0xc0) {
-            int offs = ((resp->data[o] & ~0xc0) << 8) | resp->data[o + 1];
+    if(!ttl || strlen(name) >= DNS_NAME_MAX)
+        return;
 
-            if(rv < 0)
-                rv = o + 2;
+    now = timer_ms_gettime64();
+    mutex_lock(&dns_cache_lock);
 
-            o = offs - sizeof(dnsmsg_t);
+    for(i = 0; i < DNS_CACHE_SIZE; i++) {
+        if(dns_cache[i].server == server && !strcasecmp(dns_cache[i].name, name)) {
+            e = &dns_cache[i];
+            break;
         }
-        else {
-            cnt = resp->data[o++];
+    }
 
-            if(cnt) {
-                if(outbuf[0] != 0)
-                    strcat(outbuf, ".");
+    if(!e) {
+        e = &dns_cache[0];
 
-                strncat(outbuf, (char *)(resp->data + o), cnt);
-                o += cnt;
-            }
-            else {
-                break;
-            }
+        for(i = 1; i < DNS_CACHE_SIZE; i++) {
+            if(dns_cache[i].used < e->used)
+                e = &dns_cache[i];
         }
+
+        memset(e, 0, sizeof(*e));
+        strcpy(e->name, name);
+        e->server = server;
     }
 
-    if(rv < 0)
-        return o;
-    else
-        return rv;
+    e->sets[type] = *set;
+    e->expires[type] = now + ttl * 1000ULL;
+    e->used = now;
+
+    mutex_unlock(&dns_cache_lock);
 }
 
-/* Forward declaration... */
-static struct addrinfo *add_ipv4_ai(uint32_t ip, uint16_t port,
-                                    struct addrinfo *h, struct addrinfo *tail);
-static struct addrinfo *add_ipv6_ai(const struct in6_addr *ip, uint16_t port,
-                                    struct addrinfo *h, struct addrinfo *tail);
+void getaddrinfo_flush(void) {
+    mutex_lock(&dns_cache_lock);
+    memset(dns_cache, 0, sizeof(dns_cache));
+    mutex_unlock(&dns_cache_lock);
+}
 
-// Parse a response packet from the DNS server. The IP address
-// will be filled in upon a successful return, otherwise the
-// return value will be <0.
-static int dns_parse_response(dnsmsg_t *resp, struct addrinfo *hints,
-                              uint16_t port, struct addrinfo **res) {
-    int i, o, arecs;
-    uint16_t flags;
-    char tmp[64];
-    uint16_t ancnt, len;
-    struct addrinfo *ptr = NULL;
+// Scans through and skips a name in a message, starting at the given offset.
+// The new offset (after the name) will be returned, or 0 if the name runs off
+// the end of the message.
+static size_t dns_skip_name(const uint8_t *msg, size_t len, size_t o) {
+    while(o < len) {
+        // Is it a pointer? That ends the name.
+        if((msg[o] & 0xc0) == 0xc0)
+            return o + 2 <= len ? o + 2 : 0;
+
+        // End of the name?
+        if(!msg[o])
+            return o + 1;
+
+        // Skip this part.
+        o += msg[o] + 1;
+    }
+
+    return 0;
+}
+
+static inline uint16_t dns_get16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+// Parse a response packet from the DNS server, to one question of the given
+// type. The addresses it had will be filled in upon a successful return,
+// otherwise the return value will be an EAI_* error.
+static int dns_parse_response(const uint8_t *msg, size_t len, int type,
+                              dns_rrset_t *set) {
+    uint16_t flags, qdcount, ancount, rtype, rdlen;
+    uint16_t want = type == DNS_A ? QTYPE_A : QTYPE_AAAA;
+    size_t o, alen = type == DNS_A ? 4 : 16;
+    uint32_t ttl;
+    int i;
+
+    set->count = 0;
+    set->ttl = DNS_TTL_MAX;
+
+    if(len < sizeof(dnsmsg_t))
+        return EAI_FAIL;
 
     /* Check the flags first to see if it was successful. */
-    flags = ntohs(resp->flags);
+    flags = dns_get16(msg + 2);
 
     if(!(flags & 0x8000)) {
         /* Not our response! */
@@ -321,106 +411,162 @@ static int dns_parse_response(dnsmsg_t *resp, struct addrinfo *hints,
     }
 
     /* Getting zero answers is also a failure. */
-    ancnt = ntohs(resp->ancount);
+    qdcount = dns_get16(msg + 4);
+    ancount = dns_get16(msg + 6);
 
-    if(ancnt < 1)
+    if(ancount < 1)
         return EAI_NONAME;
 
     /* If we have any query sections (should have at least one), skip 'em. */
-    o = 0;
-    len = ntohs(resp->qdcount);
+    o = sizeof(dnsmsg_t);
 
-    for(i = 0; i < len; i++) {
-        /* Skip the label. */
-        o = dns_skip_label(resp, o);
+    for(i = 0; i < qdcount; i++) {
+        /* Skip the name, and the two type fields. */
+        if(!(o = dns_skip_name(msg, len, o)) || o + 4 > len)
+            return EAI_FAIL;
 
-        /* And the two type fields. */
         o += 4;
     }
 
-    /* Ok, now the answer section (what we're interested in). */
-    arecs = 0;
+    /* Ok, now the answer section (what we're interested in). The addresses
+       can come after CNAME records, which bound how long the addresses are
+       good for too. */
+    for(i = 0; i < ancount; i++) {
+        if(!(o = dns_skip_name(msg, len, o)) || o + 10 > len)
+            return EAI_FAIL;
 
-    for(i = 0; i < ancnt; i++) {
-        /* Copy out the label, in case we need it. */
-        o = dns_copy_label(resp, o, tmp);
+        rtype = dns_get16(msg + o);
+        ttl = ((uint32_t)dns_get16(msg + o + 4) << 16) | dns_get16(msg + o + 6);
+        rdlen = dns_get16(msg + o + 8);
+        o += 10;
 
-        /* Get the type code. If it's not A or AAAA, skip it. */
-        if(resp->data[o] == 0 && resp->data[o + 1] == 1 &&
-           (hints->ai_family == AF_INET || hints->ai_family == AF_UNSPEC)) {
-            uint32_t addr;
+        if(o + rdlen > len)
+            return EAI_FAIL;
 
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2;
+        if(rtype == want && rdlen == alen && set->count < DNS_MAX_ADDRS) {
+            memcpy(set->addrs[set->count++], msg + o, alen);
 
-            /* Grab the address from the response. */
-            addr = htonl((resp->data[o] << 24) | (resp->data[o + 1] << 16) |
-                         (resp->data[o + 2] << 8) | resp->data[o + 3]);
+            if(ttl < set->ttl)
+                set->ttl = ttl;
+        }
+        else if(rtype == 5 && ttl < set->ttl) {
+            set->ttl = ttl;
+        }
 
-            /* Add this address to the chain. */
-            if(!(ptr = add_ipv4_ai(addr, port, hints, ptr)))
-                /* If something goes wrong in here, it's in calling malloc, so
-                   it is definitely a system error. */
-                return EAI_SYSTEM;
+        o += rdlen;
+    }
 
-            if(!*res)
-                *res = ptr;
+    /* Did we find something? */
+    return set->count > 0 ? 0 : EAI_NONAME;
+}
+
+/* Ask the server each of the questions in need, as separate queries that are
+   all out at the same time on one socket. Responses are matched to queries by
+   their ID. The result of each is put in sets; -1 is returned only if the
+   socket fails. */
+static int dns_query(const char *name, uint32_t server, const bool need[2],
+                     dns_rrset_t sets[2]) {
+    struct sockaddr_in toaddr;
+    alignas(4) uint8_t qb[2][512];
+    alignas(4) uint8_t rb[512];
+    size_t size[2];
+    uint16_t id[2];
+    bool pending[2];
+    int sock, tries, t;
+    ssize_t rsize;
+    uint64_t now, deadline;
+    struct pollfd pfd;
+
+    for(t = 0; t < 2; t++) {
+        pending[t] = need[t];
 
-            o += len;
-            arecs++;
+        if(need[t]) {
+            size[t] = dns_make_query(name, (dnsmsg_t *)qb[t], t == DNS_A,
+                                     t == DNS_AAAA);
+            id[t] = ntohs(((dnsmsg_t *)qb[t])->id);
         }
-        else if(resp->data[o] == 0 && resp->data[o + 1] == 28 &&
-                (hints->ai_family == AF_INET6 || hints->ai_family == AF_UNSPEC)) {
-            struct in6_addr addr;
+    }
 
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2;
+    /* Make a socket to talk to the DNS server. */
+    if((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+        return -1;
 
-            /* Grab the address from the response. */
-            memcpy(addr.s6_addr, &resp->data[o], 16);
+    /* "Connect" the socket to the DNS server's address. */
+    memset(&toaddr, 0, sizeof(toaddr));
+    toaddr.sin_family = AF_INET;
+    toaddr.sin_port = htons(53);
+    toaddr.sin_addr.s_addr = htonl(server);
 
-            /* Add this address to the chain. */
-            if(!(ptr = add_ipv6_ai(&addr, port, hints, ptr)))
-                /* If something goes wrong in here, it's in calling malloc, so
-                   it is definitely a system error. */
-                return EAI_SYSTEM;
+    if(connect(sock, (struct sockaddr *)&toaddr, sizeof(toaddr)))
+        goto fail;
 
-            if(!*res)
-                *res = ptr;
+    /* Set up the structure we'll use to feed to the poll function. */
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
 
-            o += len;
-            arecs++;
+    for(tries = 0; tries < DNS_ATTEMPTS && (pending[0] || pending[1]); ++tries) {
+        /* Send the queries still unanswered to the server. */
+        for(t = 0; t < 2; t++) {
+            if(pending[t] && send(sock, qb[t], size[t], 0) < 0)
+                goto fail;
         }
-        else if(resp->data[o] == 0 && resp->data[o + 1] == 5) {
-            char tmp2[64];
 
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2;
-            o = dns_copy_label(resp, o, tmp2);
+        /* Take the responses as they come in until the timeout expires. */
+        deadline = timer_ms_gettime64() + DNS_TIMEOUT;
+
+        while((pending[0] || pending[1]) &&
+              (now = timer_ms_gettime64()) < deadline) {
+            if(poll(&pfd, 1, (int)(deadline - now)) != 1)
+                break;
+
+            if((rsize = recv(sock, rb, sizeof(rb), 0)) < 0)
+                goto fail;
+
+            /* Ignore anything that isn't a response to one of ours. */
+            if(rsize < (ssize_t)sizeof(dnsmsg_t) || !(rb[2] & 0x80))
+                continue;
+
+            for(t = 0; t < 2; t++) {
+                if(pending[t] && dns_get16(rb) == id[t]) {
+                    sets[t].rv = dns_parse_response(rb, rsize, t, &sets[t]);
+                    pending[t] = false;
+                }
+            }
         }
-        else {
-            o += 8;
-            len = (resp->data[o] << 8) | resp->data[o + 1];
-            o += 2 + len;
+    }
+
+    /* Close the socket */
+    close(sock);
+
+    /* If we never actually got a response, then there's probably a problem with
+       the server on the other end. I'm not entirely sure what to return in that
+       case, to be perfectly honest. I suppose that EAI_SYSTEM + ETIMEDOUT would
+       make the most sense, since that's really what happened... */
+    for(t = 0; t < 2; t++) {
+        if(pending[t]) {
+            sets[t].rv = EAI_SYSTEM;
+            errno = ETIMEDOUT;
         }
     }
 
-    /* Did we find something? */
-    return arecs > 0 ? 0 : EAI_NONAME;
+    return 0;
+
+fail:
+    t = errno;
+    close(sock);
+    errno = t;
+    return -1;
 }
 
 static int getaddrinfo_dns(const char *name, struct addrinfo *hints,
                            uint16_t port, struct addrinfo **res) {
-    struct sockaddr_in toaddr;
-    uint8_t qb[512];
-    size_t size;
-    int sock, rv, tries;
-    in_addr_t raddr;
-    ssize_t rsize = 0;
-    struct pollfd pfd;
+    dns_rrset_t sets[2];
+    bool want[2], need[2];
+    uint32_t server, ip4;
+    struct in6_addr ip6;
+    struct addrinfo *ptr = NULL;
+    int t, i;
 
     /* Make sure we have a network device to communicate on. */
     if(!net_default_dev) {
@@ -434,86 +580,73 @@ static int getaddrinfo_dns(const char *name, struct addrinfo *hints,
         return EAI_FAIL;
     }
 
-    /* Setup a query */
-    if(hints->ai_family == AF_UNSPEC)
-        /* Note: This should (in theory) work, but it seems that some resolvers
-           cannot handle multiple questions in one query. So... while the code
-           here supports multiple questions in one query, this branch will never
-           actually be taken -- getaddrinfo() will always make two separate
-           calls if we need to do both IPv4 and IPv6. */
-        size = dns_make_query(name, (dnsmsg_t *)qb, 1, 1);
-    else if(hints->ai_family == AF_INET)
-        size = dns_make_query(name, (dnsmsg_t *)qb, 1, 0);
-    else if(hints->ai_family == AF_INET6)
-        size = dns_make_query(name, (dnsmsg_t *)qb, 0, 1);
-    else {
+    server = (net_default_dev->dns[0] << 24) | (net_default_dev->dns[1] << 16) |
+             (net_default_dev->dns[2] << 8) | net_default_dev->dns[3];
+
+    /* Figure out which lookups we need. Some resolvers cannot handle multiple
+       questions in one query, so those are always separate queries. */
+    if(hints->ai_family != AF_UNSPEC && hints->ai_family != AF_INET &&
+       hints->ai_family != AF_INET6) {
         errno = EAFNOSUPPORT;
         return EAI_SYSTEM;
     }
 
-    /* Make a socket to talk to the DNS server. */
-    if((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
-        return EAI_SYSTEM;
+    want[DNS_A] = hints->ai_family != AF_INET6;
+    want[DNS_AAAA] = hints->ai_family != AF_INET;
 
-    /* "Connect" the socket to the DNS server's address. */
-    raddr = (net_default_dev->dns[0] << 24) | (net_default_dev->dns[1] << 16) |
-            (net_default_dev->dns[2] << 8) | net_default_dev->dns[3];
+    /* Whatever is cached doesn't need to be asked again. */
+    for(t = 0; t < 2; t++)
+        need[t] = want[t] && !dns_cache_get(name, server, t, &sets[t]);
 
-    memset(&toaddr, 0, sizeof(toaddr));
-    toaddr.sin_family = AF_INET;
-    toaddr.sin_port = htons(53);
-    toaddr.sin_addr.s_addr = htonl(raddr);
+    if(need[DNS_A] || need[DNS_AAAA]) {
+        if(dns_query(name, server, need, sets) < 0)
+            return EAI_SYSTEM;
 
-    if(connect(sock, (struct sockaddr *)&toaddr, sizeof(toaddr))) {
-        close(sock);
-        return EAI_SYSTEM;
+        for(t = 0; t < 2; t++) {
+            if(need[t])
+                dns_cache_put(name, server, t, &sets[t]);
+        }
     }
 
-    /* Set up the structure we'll use to feed to the poll function. */
-    pfd.fd = sock;
-    pfd.events = POLLIN;
-    pfd.revents = 0;
+    /* Build up the results, the IPv4 addresses first. */
+    for(t = 0; t < 2; t++) {
+        if(!want[t] || sets[t].rv)
+            continue;
 
-    for(tries = 0; tries < DNS_ATTEMPTS; ++tries) {
-        /* Send the query to the server. */
-        if(send(sock, qb, size, 0) < 0) {
-            return EAI_SYSTEM;
-        }
+        for(i = 0; i < sets[t].count; i++) {
+            if(t == DNS_A) {
+                memcpy(&ip4, sets[t].addrs[i], 4);
+                ptr = add_ipv4_ai(ip4, port, hints, ptr);
+            }
+            else {
+                memcpy(ip6.s6_addr, sets[t].addrs[i], 16);
+                ptr = add_ipv6_ai(&ip6, port, hints, ptr);
+            }
 
-        /* Wait for the timeout to expire or for us to get the response. */
-        if(poll(&pfd, 1, DNS_TIMEOUT) == 1) {
-            /* Get the response. */
-            if((rsize = recv(sock, qb, 512, 0)) < 0) {
+            /* If something goes wrong in here, it's in calling malloc, so it
+               is definitely a system error. */
+            if(!ptr) {
+                freeaddrinfo(*res);
+                *res = NULL;
                 return EAI_SYSTEM;
             }
 
-            break;
+            if(!*res)
+                *res = ptr;
         }
     }
 
-    /* Close the socket */
-    close(sock);
-
-    /* If we never actually got a response, then there's probably a problem with
-       the server on the other end. I'm not entirely sure what to return in that
-       case, to be perfectly honest. I suppose that EAI_SYSTEM + ETIMEDOUT would
-       make the most sense, since that's really what happened... */
-    if(!rsize) {
-        errno = ETIMEDOUT;
-        return EAI_SYSTEM;
-    }
-
-    /* Parse the response. */
-    rv = dns_parse_response((dnsmsg_t *)qb, hints, port, res);
-
-    /* If we got something in the result, but got an error value in the return,
-       free whatever we got. */
-    if(rv != 0 && *res) {
-        freeaddrinfo(*res);
-        *res = NULL;
-    }
+    if(*res)
+        return 0;
 
-    return rv;
+    /* Nothing at all: report why the IPv4 lookup failed, unless the name is
+       just missing there. */
+    if(!want[DNS_A])
+        return sets[DNS_AAAA].rv;
+    else if(!want[DNS_AAAA] || sets[DNS_A].rv != EAI_NONAME)
+        return sets[DNS_A].rv;
+    else
+        return EAI_NONAME;
 }
 
 /* New stuff below here... */
@@ -730,45 +863,69 @@ int getaddrinfo(const char *nodename, const char *servname,
     }
 
     /* If we've gotten this far, do the lookup. */
-    if(ihints.ai_family == AF_UNSPEC) {
-        /* It seems that some resolvers really don't like multi-part questions.
-           So, make sure we only ever send one part at a time... */
-        struct addrinfo *res1 = NULL, *res2 = NULL;
-        int rv;
+    return getaddrinfo_dns(nodename, &ihints, port, res);
+}
 
-        ihints.ai_family = AF_INET;
-        rv = getaddrinfo_dns(nodename, &ihints, port, &res1);
+/* The arguments of a lookup done in the background. */
+typedef struct gai_async {
+    char *nodename;
+    char *servname;
+    struct addrinfo hints;
+    bool has_hints;
+    getaddrinfo_cb_t cb;
+    void *data;
+    char strs[];
+} gai_async_t;
+
+static void *gai_async_thd(void *param) {
+    gai_async_t *req = (gai_async_t *)param;
+    struct addrinfo *res = NULL;
+    int rv;
+
+    rv = getaddrinfo(req->nodename, req->servname,
+                     req->has_hints ? &req->hints : NULL, &res);
+    req->cb(rv, res, req->data);
+    free(req);
+
+    return NULL;
+}
 
-        if(rv && rv != EAI_NONAME)
-            return rv;
+int getaddrinfo_async(const char *nodename, const char *servname,
+                      const struct addrinfo *hints, getaddrinfo_cb_t cb,
+                      void *data) {
+    const kthread_attr_t attr = {
+        .create_detached = true,
+        .label = "[getaddrinfo]"
+    };
+    size_t nlen = nodename ? strlen(nodename) + 1 : 0;
+    size_t slen = servname ? strlen(servname) + 1 : 0;
+    gai_async_t *req;
+
+    if(!cb) {
+        errno = EINVAL;
+        return -1;
+    }
 
-        ihints.ai_family = AF_INET6;
-        getaddrinfo_dns(nodename, &ihints, port, &res2);
+    /* Copy everything, as the call returns before the lookup is done. */
+    if(!(req = (gai_async_t *)malloc(sizeof(gai_async_t) + nlen + slen))) {
+        errno = ENOMEM;
+        return -1;
+    }
 
-        /* Figure out what to do with the result(s). */
-        if(res1 && res2) {
-            *res = res1;
+    req->nodename = nodename ? memcpy(req->strs, nodename, nlen) : NULL;
+    req->servname = servname ? memcpy(req->strs + nlen, servname, slen) : NULL;
+    req->has_hints = hints != NULL;
 
-            /* Go to the end of the chain. */
-            while(res1->ai_next) {
-                res1 = res1->ai_next;
-            }
+    if(hints)
+        req->hints = *hints;
 
-            res1->ai_next = res2;
-            return 0;
-        }
-        else if(res1) {
-            *res = res1;
-            return 0;
-        }
-        else if(res2) {
-            *res = res2;
-            return 0;
-        }
-        else {
-            return EAI_NONAME;
-        }
+    req->cb = cb;
+    req->data = data;
+
+    if(!thd_create_ex(&attr, gai_async_thd, req)) {
+        free(req);
+        return -1;
     }
 
-    return getaddrinfo_dns(nodename, &ihints, port, res);
+    return 0;
 }
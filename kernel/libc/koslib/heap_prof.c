@@ -0,0 +1,313 @@
+/* KallistiOS ##version##
+
+   heap_prof.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Sampling heap profiler. The tables are allocated when the profiler is
+   started and never grow, so that the hooks never have to call back into
+   malloc(). Everything is protected by disabling interrupts, which keeps the
+   hooks usable from wherever malloc() itself is. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arch/arch.h>
+#include <arch/irq.h>
+#include <arch/stack.h>
+#include <kos/dbglog.h>
+#include <kos/heap_prof.h>
+
+typedef struct heap_site {
+    uintptr_t pcs[HEAP_PROF_DEPTH];
+    unsigned int depth;
+    size_t live_count;
+    size_t live_bytes;
+    size_t alloc_count;
+    size_t alloc_bytes;
+} heap_site_t;
+
+typedef struct heap_block {
+    void *ptr;
+    size_t size;
+    heap_site_t *site;
+} heap_block_t;
+
+unsigned int __heap_prof_period;
+
+static unsigned int countdown;
+static heap_site_t *sites;
+static heap_block_t *blocks;
+static size_t nblocks;
+static size_t dropped;
+
+/* Keep the block table at most 3/4 full, so that probing stays short. */
+#define HEAP_PROF_MAX_BLOCKS    (HEAP_PROF_BLOCKS / 4 * 3)
+
+_Static_assert(!(HEAP_PROF_SITES & (HEAP_PROF_SITES - 1)),
+               "HEAP_PROF_SITES must be a power of two");
+_Static_assert(!(HEAP_PROF_BLOCKS & (HEAP_PROF_BLOCKS - 1)),
+               "HEAP_PROF_BLOCKS must be a power of two");
+
+static inline uint32_t hash_word(uint32_t h, uintptr_t x) {
+    return (h ^ (uint32_t)x) * 0x9e3779b1u;
+}
+
+static inline size_t block_slot(const void *ptr) {
+    /* Blocks are at least 8-byte aligned, so drop the low bits first. */
+    return hash_word(0, (uintptr_t)ptr >> 3) >> 20 & (HEAP_PROF_BLOCKS - 1);
+}
+
+/* Record the call chain of the allocator's caller. Without frame pointers all
+   we know is the return address of the allocator. */
+static unsigned int heap_backtrace(uintptr_t *pcs, uintptr_t ret,
+                                   uintptr_t fp) {
+    unsigned int depth = 0;
+
+    if(!__is_defined(FRAME_POINTERS)) {
+        pcs[0] = ret;
+        return 1;
+    }
+
+    while(depth < HEAP_PROF_DEPTH && fp != 0xffffffff) {
+        if((fp & 3) || fp < 0x8c000000 || fp > _arch_mem_top)
+            break;
+
+        ret = arch_fptr_ret_addr(fp);
+        if(!arch_valid_text_address(ret))
+            break;
+
+        pcs[depth++] = ret;
+        fp = arch_fptr_next(fp);
+    }
+
+    return depth;
+}
+
+/* Find (or add) the site for a call chain. Assumes interrupts are disabled. */
+static heap_site_t *heap_site(const uintptr_t *pcs, unsigned int depth) {
+    heap_site_t *site;
+    uint32_t h = depth;
+    size_t i, n;
+
+    for(i = 0; i < depth; i++)
+        h = hash_word(h, pcs[i]);
+
+    for(n = 0, i = h >> 16; n < HEAP_PROF_SITES; n++, i++) {
+        site = &sites[i & (HEAP_PROF_SITES - 1)];
+
+        if(!site->depth) {
+            memcpy(site->pcs, pcs, depth * sizeof(*pcs));
+            site->depth = depth;
+            return site;
+        }
+
+        if(site->depth == depth &&
+           !memcmp(site->pcs, pcs, depth * sizeof(*pcs)))
+            return site;
+    }
+
+    return NULL;
+}
+
+void __heap_prof_alloc(void *ptr, size_t size, uintptr_t ret, uintptr_t fp) {
+    uintptr_t pcs[HEAP_PROF_DEPTH];
+    unsigned int depth;
+    heap_site_t *site;
+    size_t i;
+
+    if(!ptr || __atomic_sub_fetch(&countdown, 1, __ATOMIC_RELAXED))
+        return;
+
+    depth = heap_backtrace(pcs, ret, fp);
+    if(!depth)
+        pcs[depth++] = ret;
+
+    irq_disable_scoped();
+
+    if(!blocks)
+        return;
+
+    countdown = __heap_prof_period;
+
+    if(nblocks == HEAP_PROF_MAX_BLOCKS || !(site = heap_site(pcs, depth))) {
+        ++dropped;
+        return;
+    }
+
+    for(i = block_slot(ptr); blocks[i].ptr; i = (i + 1) & (HEAP_PROF_BLOCKS - 1))
+        ;
+
+    blocks[i].ptr = ptr;
+    blocks[i].size = size;
+    blocks[i].site = site;
+    ++nblocks;
+
+    ++site->live_count;
+    site->live_bytes += size;
+    ++site->alloc_count;
+    site->alloc_bytes += size;
+}
+
+void __heap_prof_free(void *ptr) {
+    size_t i, j, home;
+
+    irq_disable_scoped();
+
+    if(!ptr || !blocks)
+        return;
+
+    for(i = block_slot(ptr); blocks[i].ptr != ptr;
+        i = (i + 1) & (HEAP_PROF_BLOCKS - 1)) {
+        if(!blocks[i].ptr)
+            return;
+    }
+
+    blocks[i].site->live_count--;
+    blocks[i].site->live_bytes -= blocks[i].size;
+    --nblocks;
+
+    /* Linear probing: move back any following entry that could no longer be
+       found once slot i is empty. */
+    for(j = (i + 1) & (HEAP_PROF_BLOCKS - 1); blocks[j].ptr;
+        j = (j + 1) & (HEAP_PROF_BLOCKS - 1)) {
+        home = block_slot(blocks[j].ptr);
+
+        if(((j - home) & (HEAP_PROF_BLOCKS - 1)) >=
+           ((j - i) & (HEAP_PROF_BLOCKS - 1))) {
+            blocks[i] = blocks[j];
+            i = j;
+        }
+    }
+
+    blocks[i].ptr = NULL;
+}
+
+int heap_prof_start(unsigned int period) {
+    heap_site_t *s;
+    heap_block_t *b;
+    irq_mask_t flags;
+
+    if(!period) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    s = calloc(HEAP_PROF_SITES, sizeof(*s));
+    b = calloc(HEAP_PROF_BLOCKS, sizeof(*b));
+
+    if(!s || !b) {
+        free(s);
+        free(b);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    flags = irq_disable();
+
+    if(blocks) {
+        irq_restore(flags);
+        free(s);
+        free(b);
+        errno = EBUSY;
+        return -1;
+    }
+
+    sites = s;
+    blocks = b;
+    nblocks = 0;
+    dropped = 0;
+    countdown = period;
+    __heap_prof_period = period;
+
+    irq_restore(flags);
+
+    return 0;
+}
+
+void heap_prof_stop(void) {
+    heap_site_t *s;
+    heap_block_t *b;
+    irq_mask_t flags;
+
+    flags = irq_disable();
+
+    __heap_prof_period = 0;
+    s = sites;
+    b = blocks;
+    sites = NULL;
+    blocks = NULL;
+
+    irq_restore(flags);
+
+    free(s);
+    free(b);
+}
+
+int heap_prof_dump(int (*pf)(const char *fmt, ...)) {
+    size_t live_count = 0, live_bytes = 0, alloc_count = 0, alloc_bytes = 0;
+    unsigned int period, j;
+    heap_site_t site;
+    irq_mask_t flags;
+    size_t i;
+
+    flags = irq_disable();
+
+    if(!sites) {
+        irq_restore(flags);
+        return -1;
+    }
+
+    period = __heap_prof_period;
+
+    for(i = 0; i < HEAP_PROF_SITES; i++) {
+        live_count += sites[i].live_count;
+        live_bytes += sites[i].live_bytes;
+        alloc_count += sites[i].alloc_count;
+        alloc_bytes += sites[i].alloc_bytes;
+    }
+
+    irq_restore(flags);
+
+    pf("heap profile: %u: %u [ %u: %u] @ heapprofile\n",
+       (unsigned int)(live_count * period), (unsigned int)(live_bytes * period),
+       (unsigned int)(alloc_count * period),
+       (unsigned int)(alloc_bytes * period));
+
+    /* Copy each site out before printing it, as the print function may well
+       allocate memory itself. */
+    for(i = 0; i < HEAP_PROF_SITES; i++) {
+        flags = irq_disable();
+
+        if(!sites) {
+            irq_restore(flags);
+            return -1;
+        }
+
+        site = sites[i];
+        irq_restore(flags);
+
+        if(!site.live_count)
+            continue;
+
+        pf("%u: %u [%u: %u] @", (unsigned int)(site.live_count * period),
+           (unsigned int)(site.live_bytes * period),
+           (unsigned int)(site.alloc_count * period),
+           (unsigned int)(site.alloc_bytes * period));
+
+        for(j = 0; j < site.depth; j++)
+            pf(" 0x%08x", (unsigned int)site.pcs[j]);
+
+        pf("\n");
+    }
+
+    pf("\nMAPPED_LIBRARIES:\n");
+
+    if(dropped)
+        dbglog(DBG_WARNING, "heap_prof: %u samples dropped, tables full\n",
+               (unsigned int)dropped);
+
+    return 0;
+}
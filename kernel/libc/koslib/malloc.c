@@ -19,12 +19,18 @@
 #include <malloc.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <arch/spinlock.h>
 #include <arch/arch.h>
+#include <arch/stack.h>
 
 #include <kos/dbglog.h>
+#include <kos/heap_prof.h>
+#include <kos/init.h>
+#include <kos/mem_tags.h>
 #include <kos/opts.h>
+#include <kos/slab.h>
 
 #undef DEBUG
 
@@ -51,9 +57,37 @@ static spinlock_t mALLOC_MUTEx = SPINLOCK_INITIALIZER;
 /* Use this from within an IRQ to determine if it's safe
    to do memory allocation stuff */
 int malloc_irq_safe(void) {
-    return !spinlock_is_locked(&mALLOC_MUTEx);
+    return !spinlock_is_locked(&mALLOC_MUTEx) && __slab_irq_safe();
 }
 
+/* Heap profiler hooks (see kos/heap_prof.h). These expect the return address
+   of the public function in pr. */
+#define HEAP_PROF_ALLOC(m, bytes) do { \
+        if(__heap_prof_period) \
+            __heap_prof_alloc((m), (bytes), pr, arch_get_fptr()); \
+    } while(0)
+
+#define HEAP_PROF_FREE(m) do { \
+        if(__heap_prof_period) \
+            __heap_prof_free(m); \
+    } while(0)
+
+/* Memory tag hooks (see kos/mem_tags.h). With tagging enabled, requests get
+   one more byte, so that the tag fits at the end of the usable size. */
+#ifndef KM_DBG
+#define MEM_TAGS            (__kos_init_flags & INIT_MALLOCTAGS)
+#else
+#define MEM_TAGS            0
+#endif
+
+#define MEM_TAG_PAD(bytes) \
+    (MEM_TAGS && (bytes) && (bytes) < SIZE_MAX ? (bytes) + 1 : (bytes))
+
+#define MEM_TAG_ALLOC(m, tag) do { \
+        if(MEM_TAGS && (m)) \
+            __mem_tag_alloc((m), usable_size(m), (tag)); \
+    } while(0)
+
 /* <unistd.h> doesn't define this in strict standard-compliant mode, so do so
    here instead. */
 extern void *sbrk (ptrdiff_t __incr);
@@ -1779,7 +1813,15 @@ int mem_check_block_int(memctl_t *ctl, int source) {
 
 #endif  /* KM_DEBUG */
 
+/* Usable size of a block, including the byte of its memory tag. */
+static size_t usable_size(Void_t *m) {
+    size_t size = __slab_usable_size(m);
+
+    return size ? size : mUSABLe(m);
+}
+
 Void_t* public_mALLOc(size_t bytes) {
+    uintptr_t pr = arch_get_ret_addr();
     Void_t* m;
 
 #ifdef KM_DBG
@@ -1787,6 +1829,16 @@ Void_t* public_mALLOc(size_t bytes) {
     memctl_t * ctl;
 #endif
 
+#ifndef KM_DBG
+    /* Small requests come from the slab caches. These have to be tried
+       before taking the lock, as they may grow by calling memalign(). */
+    if(bytes <= SLAB_MALLOC_MAX && (m = __slab_malloc(MEM_TAG_PAD(bytes)))) {
+        MEM_TAG_ALLOC(m, mem_tag_get());
+        HEAP_PROF_ALLOC(m, bytes);
+        return m;
+    }
+#endif
+
     if(MALLOC_PREACTION != 0) {
         return 0;
     }
@@ -1827,12 +1879,15 @@ Void_t* public_mALLOc(size_t bytes) {
 #endif
 
 #else
-    m = mALLOc(bytes);
+    m = mALLOc(MEM_TAG_PAD(bytes));
 #endif
 
     if(MALLOC_POSTACTION != 0) {
     }
 
+    MEM_TAG_ALLOC(m, mem_tag_get());
+    HEAP_PROF_ALLOC(m, bytes);
+
     return m;
 }
 
@@ -1848,6 +1903,16 @@ void public_fREe(Void_t* m) {
     if(m == NULL)
         return;
 
+    HEAP_PROF_FREE(m);
+
+    if(MEM_TAGS)
+        __mem_tag_free(m, usable_size(m));
+
+#ifndef KM_DBG
+    if(__slab_free(m))
+        return;
+#endif
+
     if(MALLOC_PREACTION != 0) {
         return;
     }
@@ -1917,10 +1982,53 @@ int mem_check_all(void) {
 }
 
 Void_t* public_rEALLOc(Void_t* m, size_t bytes) {
+    uintptr_t pr = arch_get_ret_addr();
 #ifdef KM_DBG
     uint32_t rv = arch_get_ret_addr(), rs, *nt, i;
     memctl_t * ctl;
     int dmg = 0;
+#else
+    Void_t* n;
+    size_t size;
+    mem_tag_t tag;
+#endif
+
+    HEAP_PROF_FREE(m);
+
+#ifndef KM_DBG
+    /* The block keeps its owner. */
+    tag = MEM_TAGS && m ? __mem_tag_free(m, usable_size(m)) : mem_tag_get();
+    bytes = MEM_TAG_PAD(bytes);
+
+    /* A slab object stays where it is as long as it's large enough, otherwise
+       it gets moved to a new block. */
+    if(m != NULL && (size = __slab_usable_size(m))) {
+        if(bytes > size) {
+            if(!(n = __slab_malloc(bytes))) {
+                if(MALLOC_PREACTION != 0) {
+                    return 0;
+                }
+
+                n = mALLOc(bytes);
+
+                if(MALLOC_POSTACTION != 0) {
+                }
+            }
+
+            if(!n) {
+                MEM_TAG_ALLOC(m, tag);
+                return NULL;
+            }
+
+            memcpy(n, m, size);
+            __slab_free(m);
+            m = n;
+        }
+
+        MEM_TAG_ALLOC(m, tag);
+        HEAP_PROF_ALLOC(m, bytes);
+        return m;
+    }
 #endif
 
     if(MALLOC_PREACTION != 0) {
@@ -1999,16 +2107,23 @@ Void_t* public_rEALLOc(Void_t* m, size_t bytes) {
     }
 
 #else
-    m = rEALLOc(m, bytes);
+    n = rEALLOc(m, bytes);
+
+    /* On failure, the old block is still there. */
+    MEM_TAG_ALLOC(n ? n : m, tag);
+    m = n;
 #endif
 
     if(MALLOC_POSTACTION != 0) {
     }
 
+    HEAP_PROF_ALLOC(m, bytes);
+
     return m;
 }
 
 Void_t* public_mEMALIGn(size_t alignment, size_t bytes) {
+    uintptr_t pr = arch_get_ret_addr();
     Void_t* m;
 
 #ifdef KM_DBG
@@ -2056,12 +2171,15 @@ Void_t* public_mEMALIGn(size_t alignment, size_t bytes) {
 #endif
 
 #else
-    m = mEMALIGn(alignment, bytes);
+    m = mEMALIGn(alignment, MEM_TAG_PAD(bytes));
 #endif
 
     if(MALLOC_POSTACTION != 0) {
     }
 
+    MEM_TAG_ALLOC(m, mem_tag_get());
+    HEAP_PROF_ALLOC(m, bytes);
+
     return m;
 }
 
@@ -2082,12 +2200,22 @@ Void_t* public_pVALLOc(size_t bytes) {
 }
 
 Void_t* public_cALLOc(size_t n, size_t elem_size) {
+    uintptr_t pr = arch_get_ret_addr();
     Void_t* m;
 
 #ifdef KM_DBG
     uint32_t rv = arch_get_ret_addr(), *nt1, *nt2, i, rs;
     size_t bytes = n * elem_size;
     memctl_t * ctl;
+#else
+    if(n <= SLAB_MALLOC_MAX && elem_size <= SLAB_MALLOC_MAX &&
+       n * elem_size <= SLAB_MALLOC_MAX &&
+       (m = __slab_malloc(MEM_TAG_PAD(n * elem_size)))) {
+        memset(m, 0, n * elem_size);
+        MEM_TAG_ALLOC(m, mem_tag_get());
+        HEAP_PROF_ALLOC(m, n * elem_size);
+        return m;
+    }
 #endif
 
     if(MALLOC_PREACTION != 0) {
@@ -2130,12 +2258,18 @@ Void_t* public_cALLOc(size_t n, size_t elem_size) {
 #endif
 
 #else
-    m = cALLOc(n, elem_size);
+    if(MEM_TAGS && n && elem_size && n <= (SIZE_MAX - 1) / elem_size)
+        m = cALLOc(1, n * elem_size + 1);
+    else
+        m = cALLOc(n, elem_size);
 #endif
 
     if(MALLOC_POSTACTION != 0) {
     }
 
+    MEM_TAG_ALLOC(m, mem_tag_get());
+    HEAP_PROF_ALLOC(m, n * elem_size);
+
     return m;
 }
 
@@ -2179,16 +2313,19 @@ int public_mTRIm(size_t s) {
 size_t public_mUSABLe(Void_t* m) {
     size_t result;
 
-    if(MALLOC_PREACTION != 0) {
-        return 0;
-    }
+    if(!(result = __slab_usable_size(m))) {
+        if(MALLOC_PREACTION != 0) {
+            return 0;
+        }
 
-    result = mUSABLe(m);
+        result = mUSABLe(m);
 
-    if(MALLOC_POSTACTION != 0) {
+        if(MALLOC_POSTACTION != 0) {
+        }
     }
 
-    return result;
+    /* The last byte holds the memory tag. */
+    return MEM_TAGS && result ? result - 1 : result;
 }
 
 void public_mSTATs(void) {
@@ -2222,6 +2359,8 @@ void public_mSTATs(void) {
 
     if(MALLOC_POSTACTION != 0) {
     }
+
+    slab_print_stats(printf);
 }
 
 /*** End KOS Code ***/
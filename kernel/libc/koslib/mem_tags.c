@@ -0,0 +1,94 @@
+/* KallistiOS ##version##
+
+   mem_tags.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Per-subsystem memory accounting. The counters are updated with interrupts
+   disabled, as malloc() may be used from wherever. */
+
+#include <errno.h>
+#include <stdint.h>
+
+#include <arch/irq.h>
+#include <kos/init.h>
+#include <kos/mem_tags.h>
+#include <kos/thread.h>
+
+static mem_tag_stats_t tag_stats[MEM_TAG_COUNT];
+
+static const char *const tag_names[MEM_TAG_COUNT] = {
+    "user", "net", "fs", "pvr", "sound", "maple"
+};
+
+mem_tag_t mem_tag_set(mem_tag_t tag) {
+    mem_tag_t old;
+
+    if(!thd_current)
+        return MEM_TAG_USER;
+
+    old = thd_current->mem_tag;
+    thd_current->mem_tag = tag;
+
+    return old;
+}
+
+mem_tag_t mem_tag_get(void) {
+    return thd_current ? thd_current->mem_tag : MEM_TAG_USER;
+}
+
+const char *mem_tag_name(mem_tag_t tag) {
+    if((unsigned int)tag >= MEM_TAG_COUNT)
+        return NULL;
+
+    return tag_names[tag];
+}
+
+int mem_tag_stats(mem_tag_t tag, mem_tag_stats_t *stats) {
+    if((unsigned int)tag >= MEM_TAG_COUNT) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if(!(__kos_init_flags & INIT_MALLOCTAGS)) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    irq_disable_scoped();
+    *stats = tag_stats[tag];
+
+    return 0;
+}
+
+void __mem_tag_alloc(void *ptr, size_t usable, mem_tag_t tag) {
+    mem_tag_stats_t *st = &tag_stats[tag];
+
+    ((uint8_t *)ptr)[usable - 1] = tag;
+
+    irq_disable_scoped();
+
+    st->current += usable;
+    ++st->blocks;
+
+    if(st->current > st->peak)
+        st->peak = st->current;
+}
+
+mem_tag_t __mem_tag_free(void *ptr, size_t usable) {
+    mem_tag_t tag = ((uint8_t *)ptr)[usable - 1];
+    mem_tag_stats_t *st;
+
+    /* A tag that doesn't make sense means the block was overrun. */
+    if((unsigned int)tag >= MEM_TAG_COUNT)
+        tag = MEM_TAG_USER;
+
+    st = &tag_stats[tag];
+
+    irq_disable_scoped();
+
+    st->current -= usable;
+    --st->blocks;
+
+    return tag;
+}
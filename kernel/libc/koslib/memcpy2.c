@@ -10,12 +10,7 @@
 /* This variant was added by Megan Potter for its usefulness in
    working with GBA external hardware. */
 void * memcpy2(void *dest, const void *src, size_t count) {
-    unsigned short *tmp = (unsigned short *) dest;
-    unsigned short *s = (unsigned short *) src;
-    count = count / 2;
-
-    while(count--)
-        *tmp++ = *s++;
-
-    return dest;
+    /* On the Dreamcast memcpy() copies aligned halfwords with accesses of that
+       size, which is what the hardware this is for needs. */
+    return memcpy(dest, src, count & ~1);
 }
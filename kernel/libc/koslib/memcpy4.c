@@ -10,12 +10,7 @@
 /* This variant was added by Megan Potter for its usefulness in
    working with Dreamcast external hardware. */
 void * memcpy4(void *dest, const void *src, size_t count) {
-    unsigned long *tmp = (unsigned long *) dest;
-    unsigned long *s = (unsigned long *) src;
-    count = count / 4;
-
-    while(count--)
-        *tmp++ = *s++;
-
-    return dest;
+    /* On the Dreamcast memcpy() copies aligned words with accesses of that
+       size, which is what the hardware this is for needs. */
+    return memcpy(dest, src, count & ~3);
 }
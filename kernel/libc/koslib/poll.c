@@ -26,12 +26,17 @@ LIST_HEAD(polllist, poll_int) poll_list;
 
 static mutex_t mutex = MUTEX_INITIALIZER;
 
+extern void __epoll_event_trigger(void *hnd, short event);
+
 void __poll_event_trigger(int fd, short event) {
     struct poll_int *i;
     nfds_t j;
     int gotone = 0;
     short mask;
 
+    if(fd >= 0 && fd < FD_SETSIZE && fd_table[fd])
+        __epoll_event_trigger(fs_get_handle(fd), event);
+
     if(mutex_lock_irqsafe(&mutex))
         /* XXXX: Uhh... this is bad... */
         return;
@@ -59,6 +64,40 @@ void __poll_event_trigger(int fd, short event) {
     mutex_unlock(&mutex);
 }
 
+/* Same as above, for handlers that don't know which fds refer to them. */
+void __poll_hnd_event_trigger(void *hnd, short event) {
+    struct poll_int *i;
+    nfds_t j;
+    int gotone = 0;
+    short mask;
+
+    __epoll_event_trigger(hnd, event);
+
+    if(mutex_lock_irqsafe(&mutex))
+        return;
+
+    LIST_FOREACH(i, &poll_list, entry) {
+        for(j = 0; j < i->nfds; ++j) {
+            if(i->fds[j].fd >= 0 && i->fds[j].fd < FD_SETSIZE &&
+               fd_table[i->fds[j].fd] && fs_get_handle(i->fds[j].fd) == hnd) {
+                mask = i->fds[j].events | POLLERR | POLLHUP | POLLNVAL;
+                if(event & mask) {
+                    i->fds[j].revents |= event & mask;
+                    ++i->nmatched;
+                    gotone = 1;
+                }
+            }
+        }
+
+        if(gotone) {
+            cond_signal(&i->cv);
+            gotone = 0;
+        }
+    }
+
+    mutex_unlock(&mutex);
+}
+
 int poll(struct pollfd fds[], nfds_t nfds, int timeout) {
     struct poll_int p = { { 0 }, fds, nfds, 0, COND_INITIALIZER };
     int tmp;
@@ -0,0 +1,414 @@
+/* KallistiOS ##version##
+
+   slab.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Slab allocator. Each slab is one page, aligned on a page boundary, that
+   starts with a small header followed by as many objects as fit. Free
+   objects are kept on a singly linked list threaded through the objects
+   themselves. A page map with one bit per page of RAM tells free() whether a
+   block is a slab object (and so where to find its header) without having to
+   trust anything stored next to the block.
+
+   Slabs are taken from and given back to the main heap with memalign() and
+   free(); the page map bit is only set once the slab is ready, and cleared
+   before it is handed back, so those calls never come back in here. */
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include <arch/arch.h>
+#include <arch/spinlock.h>
+#include <kos/dbglog.h>
+#include <kos/slab.h>
+
+#define SLAB_SIZE       PAGESIZE
+#define SLAB_SHIFT      PAGESIZE_BITS
+
+/* The range of RAM that can hold slabs (32MB, to cover the dev kits). */
+#define SLAB_RAM_BASE   0x8c000000
+#define SLAB_RAM_TOP    0x8e000000
+#define SLAB_PAGES      ((SLAB_RAM_TOP - SLAB_RAM_BASE) >> SLAB_SHIFT)
+
+/* Keep at most this many empty slabs around per cache. */
+#define SLAB_KEEP_EMPTY 1
+
+struct slab {
+    LIST_ENTRY(slab) list;
+    slab_cache_t *cache;
+    void *free;
+    unsigned int inuse;
+};
+
+LIST_HEAD(slab_list, slab);
+
+struct slab_cache {
+    LIST_ENTRY(slab_cache) list;
+    const char *name;
+    spinlock_t lock;
+
+    size_t size;
+    size_t offset;
+    size_t objs;
+
+    struct slab_list partial;
+    struct slab_list full;
+    struct slab_list empty;
+    size_t nempty;
+
+    size_t slabs;
+    size_t inuse;
+    size_t peak;
+    size_t allocs;
+    size_t frees;
+};
+
+static uint32_t slab_map[SLAB_PAGES / 32];
+
+static LIST_HEAD(slab_cache_list, slab_cache) caches =
+    LIST_HEAD_INITIALIZER(caches);
+static spinlock_t caches_lock = SPINLOCK_INITIALIZER;
+
+#define SLAB_HDR_SIZE   ((sizeof(struct slab) + 7) & ~7)
+
+#define SLAB_MALLOC_CACHE(sz) { \
+        .name = "malloc-" #sz, \
+        .lock = SPINLOCK_INITIALIZER, \
+        .size = (sz), \
+        .offset = SLAB_HDR_SIZE, \
+        .objs = (SLAB_SIZE - SLAB_HDR_SIZE) / (sz), \
+    }
+
+/* The general purpose caches that back small malloc() requests. */
+static slab_cache_t malloc_caches[] = {
+    SLAB_MALLOC_CACHE(16),
+    SLAB_MALLOC_CACHE(24),
+    SLAB_MALLOC_CACHE(32),
+    SLAB_MALLOC_CACHE(48),
+    SLAB_MALLOC_CACHE(64),
+    SLAB_MALLOC_CACHE(96),
+    SLAB_MALLOC_CACHE(128),
+    SLAB_MALLOC_CACHE(192),
+    SLAB_MALLOC_CACHE(256),
+};
+
+#define MALLOC_CACHES   (sizeof(malloc_caches) / sizeof(malloc_caches[0]))
+
+_Static_assert(SLAB_MALLOC_MAX == 256, "SLAB_MALLOC_MAX out of sync");
+
+/* The general purpose caches go on the list the first time they're used, so
+   that slab_print_stats() only shows those that were. */
+static bool malloc_caches_listed;
+
+static inline size_t slab_page(uintptr_t addr) {
+    return (addr - SLAB_RAM_BASE) >> SLAB_SHIFT;
+}
+
+static inline struct slab *slab_of(const void *ptr) {
+    uintptr_t addr = (uintptr_t)ptr;
+    size_t page;
+
+    if(addr < SLAB_RAM_BASE || addr >= SLAB_RAM_TOP)
+        return NULL;
+
+    page = slab_page(addr);
+
+    if(!(slab_map[page / 32] & (1u << (page % 32))))
+        return NULL;
+
+    return (struct slab *)(addr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+static void slab_cache_list_add(slab_cache_t *cache) {
+    spinlock_lock_scoped(&caches_lock);
+
+    LIST_INSERT_HEAD(&caches, cache, list);
+}
+
+static void slab_cache_init(slab_cache_t *cache, const char *name,
+                            size_t size, size_t align) {
+    memset(cache, 0, sizeof(*cache));
+
+    cache->name = name;
+    spinlock_init(&cache->lock);
+    cache->size = (size + align - 1) & ~(align - 1);
+    cache->offset = (SLAB_HDR_SIZE + align - 1) & ~(align - 1);
+    cache->objs = (SLAB_SIZE - cache->offset) / cache->size;
+
+    LIST_INIT(&cache->partial);
+    LIST_INIT(&cache->full);
+    LIST_INIT(&cache->empty);
+}
+
+slab_cache_t *slab_cache_create(const char *name, size_t size, size_t align) {
+    slab_cache_t *cache;
+
+    if(!align)
+        align = 8;
+
+    if(align > 32 || (align & (align - 1)) || !size ||
+       size > SLAB_SIZE - SLAB_HDR_SIZE - 32) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if(size < sizeof(void *))
+        size = sizeof(void *);
+
+    cache = malloc(sizeof(*cache));
+    if(!cache) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    slab_cache_init(cache, name, size, align);
+    slab_cache_list_add(cache);
+
+    return cache;
+}
+
+/* Give a slab back to the main heap. Assumes the cache is locked and the slab
+   is on none of its lists. */
+static void slab_release(slab_cache_t *cache, struct slab *s) {
+    size_t page = slab_page((uintptr_t)s);
+
+    --cache->slabs;
+
+    __atomic_fetch_and(&slab_map[page / 32], ~(1u << (page % 32)),
+                       __ATOMIC_RELAXED);
+    free(s);
+}
+
+int slab_cache_destroy(slab_cache_t *cache) {
+    struct slab *s;
+
+    spinlock_lock(&cache->lock);
+
+    if(cache->inuse) {
+        spinlock_unlock(&cache->lock);
+        errno = EBUSY;
+        return -1;
+    }
+
+    while((s = LIST_FIRST(&cache->empty))) {
+        LIST_REMOVE(s, list);
+        slab_release(cache, s);
+    }
+
+    spinlock_unlock(&cache->lock);
+
+    spinlock_lock(&caches_lock);
+    LIST_REMOVE(cache, list);
+    spinlock_unlock(&caches_lock);
+
+    free(cache);
+
+    return 0;
+}
+
+/* Get a fresh slab from the main heap. Assumes the cache is locked. */
+static struct slab *slab_grow(slab_cache_t *cache) {
+    struct slab *s;
+    uint8_t *obj;
+    size_t i, page;
+
+    s = memalign(SLAB_SIZE, SLAB_SIZE);
+    if(!s)
+        return NULL;
+
+    if((uintptr_t)s < SLAB_RAM_BASE ||
+       (uintptr_t)s + SLAB_SIZE > SLAB_RAM_TOP) {
+        free(s);
+        return NULL;
+    }
+
+    s->cache = cache;
+    s->inuse = 0;
+    s->free = NULL;
+
+    /* Thread the free list back to front, so that objects get handed out in
+       address order. */
+    obj = (uint8_t *)s + cache->offset + cache->size * cache->objs;
+
+    for(i = 0; i < cache->objs; i++) {
+        obj -= cache->size;
+        *(void **)obj = s->free;
+        s->free = obj;
+    }
+
+    page = slab_page((uintptr_t)s);
+    __atomic_fetch_or(&slab_map[page / 32], 1u << (page % 32),
+                      __ATOMIC_RELAXED);
+
+    ++cache->slabs;
+
+    return s;
+}
+
+void *slab_cache_alloc(slab_cache_t *cache) {
+    struct slab *s;
+    void *obj;
+
+    spinlock_lock_scoped(&cache->lock);
+
+    if(!(s = LIST_FIRST(&cache->partial))) {
+        if((s = LIST_FIRST(&cache->empty))) {
+            LIST_REMOVE(s, list);
+            --cache->nempty;
+        }
+        else if(!(s = slab_grow(cache))) {
+            return NULL;
+        }
+
+        LIST_INSERT_HEAD(&cache->partial, s, list);
+    }
+
+    obj = s->free;
+    s->free = *(void **)obj;
+
+    if(++s->inuse == cache->objs) {
+        LIST_REMOVE(s, list);
+        LIST_INSERT_HEAD(&cache->full, s, list);
+    }
+
+    ++cache->allocs;
+
+    if(++cache->inuse > cache->peak)
+        cache->peak = cache->inuse;
+
+    return obj;
+}
+
+static void slab_free_obj(slab_cache_t *cache, struct slab *s, void *obj) {
+    spinlock_lock_scoped(&cache->lock);
+
+    *(void **)obj = s->free;
+    s->free = obj;
+
+    if(s->inuse-- == cache->objs) {
+        LIST_REMOVE(s, list);
+        LIST_INSERT_HEAD(&cache->partial, s, list);
+    }
+
+    if(!s->inuse) {
+        LIST_REMOVE(s, list);
+
+        if(cache->nempty < SLAB_KEEP_EMPTY) {
+            LIST_INSERT_HEAD(&cache->empty, s, list);
+            ++cache->nempty;
+        }
+        else {
+            slab_release(cache, s);
+        }
+    }
+
+    ++cache->frees;
+    --cache->inuse;
+}
+
+void slab_cache_free(slab_cache_t *cache, void *obj) {
+    struct slab *s;
+
+    if(!obj)
+        return;
+
+    s = slab_of(obj);
+
+    if(!s || s->cache != cache) {
+        dbglog(DBG_ERROR, "slab_cache_free: %p is not from cache %s\n", obj,
+               cache->name);
+        return;
+    }
+
+    slab_free_obj(cache, s, obj);
+}
+
+void slab_cache_stats(slab_cache_t *cache, slab_cache_stats_t *stats) {
+    spinlock_lock_scoped(&cache->lock);
+
+    stats->name = cache->name;
+    stats->obj_size = cache->size;
+    stats->objs_per_slab = cache->objs;
+    stats->slabs = cache->slabs;
+    stats->inuse = cache->inuse;
+    stats->peak = cache->peak;
+    stats->allocs = cache->allocs;
+    stats->frees = cache->frees;
+}
+
+int slab_print_stats(int (*pf)(const char *fmt, ...)) {
+    slab_cache_stats_t st;
+    slab_cache_t *cache;
+
+    spinlock_lock_scoped(&caches_lock);
+
+    pf("CACHE\t\tSIZE\tSLABS\tINUSE\tPEAK\tALLOCS\n");
+
+    LIST_FOREACH(cache, &caches, list) {
+        slab_cache_stats(cache, &st);
+        pf("%-15s\t%u\t%u\t%u\t%u\t%u\n", st.name, (unsigned int)st.obj_size,
+           (unsigned int)st.slabs, (unsigned int)st.inuse,
+           (unsigned int)st.peak, (unsigned int)st.allocs);
+    }
+
+    return 0;
+}
+
+void *__slab_malloc(size_t size) {
+    size_t i;
+
+    if(size > SLAB_MALLOC_MAX)
+        return NULL;
+
+    for(i = 0; malloc_caches[i].size < size; i++)
+        ;
+
+    if(!malloc_caches_listed) {
+        size_t j;
+
+        spinlock_lock(&caches_lock);
+
+        if(!malloc_caches_listed) {
+            for(j = MALLOC_CACHES; j--; )
+                LIST_INSERT_HEAD(&caches, &malloc_caches[j], list);
+
+            malloc_caches_listed = true;
+        }
+
+        spinlock_unlock(&caches_lock);
+    }
+
+    return slab_cache_alloc(&malloc_caches[i]);
+}
+
+bool __slab_free(void *ptr) {
+    struct slab *s = slab_of(ptr);
+
+    if(!s)
+        return false;
+
+    slab_free_obj(s->cache, s, ptr);
+    return true;
+}
+
+size_t __slab_usable_size(const void *ptr) {
+    struct slab *s = slab_of(ptr);
+
+    return s ? s->cache->size : 0;
+}
+
+int __slab_irq_safe(void) {
+    size_t i;
+
+    for(i = 0; i < MALLOC_CACHES; i++) {
+        if(spinlock_is_locked(&malloc_caches[i].lock))
+            return 0;
+    }
+
+    return 1;
+}
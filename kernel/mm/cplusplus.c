@@ -2,11 +2,17 @@
 
    cplusplus.c
    (c)2002 Megan Potter
+   Copyright (C) 2026 KallistiOS Contributors
 
-   This is just a wrapper around malloc() and free() for C++ programs.
+   This is just a wrapper around malloc() and free() for C++ programs, plus
+   the allocator of coroutine frames (see kos/coro.hpp).
  */
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <kos/once.h>
+#include <kos/slab.h>
 
 void *__builtin_new(int size) {
     return malloc(size);
@@ -24,3 +30,65 @@ void __builtin_vec_delete(void *ptr) {
     __builtin_delete(ptr);
 }
 
+/* A coroutine frame is allocated each time a coroutine is called and freed
+   once it is over, so a coroutine reading a file one block per call goes
+   through the heap for every block. malloc() already serves the frames of up
+   to SLAB_MALLOC_MAX bytes from its slab caches, but frames holding a few
+   awaiters are usually bigger than that; these caches take over up to a
+   kilobyte. The sizes pack 12, 9, 6 and 4 frames into a slab. */
+static const size_t frame_sizes[] = { 320, 448, 672, 1016 };
+
+#define FRAME_CACHES    (sizeof(frame_sizes) / sizeof(frame_sizes[0]))
+
+static slab_cache_t *frame_caches[FRAME_CACHES];
+static kthread_once_t frame_once = KTHREAD_ONCE_INIT;
+static volatile bool frame_ready;
+
+static void frame_init(void) {
+    size_t i;
+
+    /* A cache that can't be created just leaves its frames to malloc(). */
+    for(i = 0; i < FRAME_CACHES; i++)
+        frame_caches[i] = slab_cache_create("coro-frame", frame_sizes[i], 0);
+
+    frame_ready = true;
+}
+
+static slab_cache_t *frame_cache(size_t size) {
+    size_t i;
+
+    if(size <= SLAB_MALLOC_MAX)
+        return NULL;
+
+    for(i = 0; i < FRAME_CACHES; i++) {
+        if(size <= frame_sizes[i])
+            return frame_caches[i];
+    }
+
+    return NULL;
+}
+
+void *kos_coro_frame_alloc(size_t size) {
+    slab_cache_t *cache;
+
+    /* kthread_once() takes a mutex, skip it once the caches are there. */
+    if(!frame_ready)
+        kthread_once(&frame_once, frame_init);
+
+    if((cache = frame_cache(size)))
+        return slab_cache_alloc(cache);
+
+    return malloc(size);
+}
+
+void kos_coro_frame_free(void *ptr, size_t size) {
+    slab_cache_t *cache;
+
+    if(!ptr)
+        return;
+
+    if((cache = frame_cache(size)))
+        slab_cache_free(cache, ptr);
+    else
+        free(ptr);
+}
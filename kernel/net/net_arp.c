@@ -11,12 +11,16 @@
 #include <stdio.h>
 #include <stdint.h>
 
+#include <sys/queue.h>
+
+#include <arch/irq.h>
 #include <kos/dbglog.h>
 #include <kos/net.h>
 #include <kos/thread.h>
 #include <kos/timer.h>
 
 #include "net_ipv4.h"
+#include "net_thd.h"
 
 /*
 
@@ -37,11 +41,41 @@ typedef struct {
     uint8_t pr_recv[6];
 } __packed arp_pkt_t;
 
+/* Number of buckets of the ARP cache (must be a power of two) */
+#define ARP_HASH_SIZE       32
+
+/* How long an entry is good for after its host last answered, and how long
+   before that to start asking it again if the entry is in use. */
+#define ARP_LIFETIME        (120 * 1000)
+#define ARP_REFRESH         (15 * 1000)
+
+/* How long to wait for a reply before asking again, and how many times to ask
+   before giving up on an address. */
+#define ARP_RETRY           1000
+#define ARP_MAX_TRIES       5
+
+/* Most packets kept for an address while it is being resolved */
+#define ARP_MAX_PENDING     4
+
+/* How often the cache is looked over, and the most queries sent each time */
+#define ARP_TIMER           250
+#define ARP_MAX_QUERIES     8
+
+/* Packet waiting for the address of its destination to be resolved */
+typedef struct arp_pending {
+    TAILQ_ENTRY(arp_pending) list;
+    ip_hdr_t            hdr;
+    int                 data_size;
+    uint8_t             data[];
+} arp_pending_t;
+
+TAILQ_HEAD(arp_pending_list, arp_pending);
+
 /* Structure describing an ARP entry; each entry contains a MAC address,
    an IP address, and a timestamp from 'jiffies'. The timestamp allows
    aging and eventual removal. */
 typedef struct netarp {
-    /* ARP cache list handle */
+    /* ARP cache bucket handle */
     LIST_ENTRY(netarp)  ac_list;
 
     /* Mac address */
@@ -50,17 +84,25 @@ typedef struct netarp {
     /* Associated IP address */
     uint8_t             ip[4];
 
-    /* Cache entry time; if zero, this entry won't expire */
+    /* Whether the MAC address is known */
+    int                 resolved;
+
+    /* When the host last answered; if zero, this entry won't expire */
     uint64_t            timestamp;
 
-    /* Optional packet to send when the entry is filled in */
-    ip_hdr_t            *pkt;
+    /* When the entry was last looked up */
+    uint64_t            used;
 
-    /* Additional data for that packet, if any */
-    uint8_t             *data;
+    /* When the last query was sent, and how many went unanswered */
+    uint64_t            queried;
+    int                 tries;
 
-    /* Size of the additional data for the packet */
-    int                 data_size;
+    /* The device to ask on */
+    netif_t             *nif;
+
+    /* Packets to send when the entry is filled in */
+    struct arp_pending_list pending;
+    int                 npending;
 } netarp_t;
 
 /* Define the list type */
@@ -69,181 +111,307 @@ LIST_HEAD(netarp_list, netarp);
 /**************************************************************************/
 /* Variables */
 
-/* ARP cache */
-struct netarp_list net_arp_cache = LIST_HEAD_INITIALIZER(0);
+/* ARP cache. Lookups come from interrupts as well as threads, so it is
+   protected by disabling interrupts. Nothing is sent with them disabled. */
+static struct netarp_list net_arp_cache[ARP_HASH_SIZE];
+
+static int arp_cb_id = -1;
+
+/* Statistics, protected along with the cache */
+static net_arp_stats_t arp_stats;
 
 /**************************************************************************/
 /* Cache management */
 
-/* Garbage collect timed out entries */
-static int net_arp_gc(netif_t *nif) {
-    netarp_t *a1, *a2;
-    uint64_t now = timer_ms_gettime64();
+static inline struct netarp_list *arp_bucket(const uint8_t ip[4]) {
+    return &net_arp_cache[(ip[2] * 31 + ip[3]) & (ARP_HASH_SIZE - 1)];
+}
 
-    a1 = LIST_FIRST(&net_arp_cache);
+/* Find the entry of an address. Assumes interrupts are disabled. */
+static netarp_t *arp_find(const uint8_t ip[4]) {
+    netarp_t *cur;
 
-    while(a1 != NULL) {
-        a2 = LIST_NEXT(a1, ac_list);
+    LIST_FOREACH(cur, arp_bucket(ip), ac_list) {
+        if(!memcmp(ip, cur->ip, 4))
+            return cur;
+    }
 
-        if(a1->timestamp) {
-            if(now >= (a1->timestamp + 120 * 1000)) {
-                LIST_REMOVE(a1, ac_list);
+    return NULL;
+}
 
-                if(a1->pkt) {
-                    free(a1->pkt);
-                    free(a1->data);
-                }
+static netarp_t *arp_alloc(void) {
+    netarp_t *cur;
 
-                free(a1);
-                a1 = a2;
-                continue;
-            }
+    if(!(cur = (netarp_t *)malloc(sizeof(netarp_t))))
+        return NULL;
+
+    memset(cur, 0, sizeof(netarp_t));
+    TAILQ_INIT(&cur->pending);
+
+    return cur;
+}
+
+static void arp_free_pending(struct arp_pending_list *pending) {
+    arp_pending_t *p;
+
+    while((p = TAILQ_FIRST(pending))) {
+        TAILQ_REMOVE(pending, p, list);
+        free(p);
+    }
+}
 
-            /* If the entry is incomplete and it's been more than 5 seconds
-               since we queried it, try again. */
-            if(a1->mac[0] == 0 && a1->mac[1] == 0 && a1->mac[2] == 0 &&
-               a1->mac[3] == 0 && a1->mac[4] == 0 && a1->mac[5] == 0 &&
-               now > (a1->timestamp + 5 * 1000)) {
-                net_arp_query(nif, a1->ip);
+/* Look over the cache: drop what has expired, and ask again about what is
+   being resolved or is about to expire while still in use. */
+static void net_arp_timer(void *data) {
+    struct {
+        netif_t *nif;
+        uint8_t ip[4];
+    } q[ARP_MAX_QUERIES];
+    struct netarp_list dead = LIST_HEAD_INITIALIZER(dead);
+    netarp_t *cur, *tmp;
+    uint64_t now = timer_ms_gettime64();
+    irq_mask_t flags;
+    int i, n = 0;
+
+    (void)data;
+
+    for(i = 0; i < ARP_HASH_SIZE; ++i) {
+        flags = irq_disable();
+
+        cur = LIST_FIRST(&net_arp_cache[i]);
+
+        while(cur) {
+            tmp = LIST_NEXT(cur, ac_list);
+
+            if(!cur->resolved) {
+                if(now >= cur->queried + ARP_RETRY) {
+                    if(cur->tries >= ARP_MAX_TRIES) {
+                        arp_stats.pkt_timed_out += cur->npending;
+                        arp_stats.pending -= cur->npending;
+                        LIST_REMOVE(cur, ac_list);
+                        LIST_INSERT_HEAD(&dead, cur, ac_list);
+                    }
+                    else if(n < ARP_MAX_QUERIES) {
+                        q[n].nif = cur->nif;
+                        memcpy(q[n++].ip, cur->ip, 4);
+                        cur->queried = now;
+                        ++cur->tries;
+                    }
+                }
+            }
+            else if(cur->timestamp) {
+                if(now >= cur->timestamp + ARP_LIFETIME) {
+                    LIST_REMOVE(cur, ac_list);
+                    LIST_INSERT_HEAD(&dead, cur, ac_list);
+                }
+                else if(now >= cur->timestamp + ARP_LIFETIME - ARP_REFRESH &&
+                        cur->used > cur->timestamp && cur->nif &&
+                        now >= cur->queried + ARP_RETRY &&
+                        n < ARP_MAX_QUERIES) {
+                    /* Still in use, so refresh it before it expires rather
+                       than holding up a send once it has. */
+                    q[n].nif = cur->nif;
+                    memcpy(q[n++].ip, cur->ip, 4);
+                    cur->queried = now;
+                }
             }
+
+            cur = tmp;
         }
 
-        a1 = a2;
+        irq_restore(flags);
     }
 
-    return 0;
+    for(i = 0; i < n; ++i)
+        net_arp_query(q[i].nif, q[i].ip);
+
+    while((cur = LIST_FIRST(&dead))) {
+        LIST_REMOVE(cur, ac_list);
+        arp_free_pending(&cur->pending);
+        free(cur);
+    }
 }
 
 /* Add an entry to the ARP cache manually */
 int net_arp_insert(netif_t *nif, const uint8_t mac[6], const uint8_t ip[4],
                    uint64_t timestamp) {
-    netarp_t *cur;
+    struct arp_pending_list pending = TAILQ_HEAD_INITIALIZER(pending);
+    netarp_t *cur, *nent = NULL;
+    arp_pending_t *p;
+    irq_mask_t flags;
+
+    flags = irq_disable();
 
     /* First make sure the entry isn't already there */
-    LIST_FOREACH(cur, &net_arp_cache, ac_list) {
-        if(!memcmp(ip, cur->ip, 4)) {
-            memcpy(cur->mac, mac, 6);
-            cur->timestamp = timestamp;
-
-            /* Send our queued packet, if we have one */
-            if(cur->pkt) {
-                net_ipv4_send_packet(nif, cur->pkt, cur->data, cur->data_size);
-                free(cur->pkt);
-                free(cur->data);
-
-                cur->pkt = NULL;
-                cur->data = NULL;
-                cur->data_size = 0;
-            }
+    if(!(cur = arp_find(ip))) {
+        /* It's not there, add an entry */
+        irq_restore(flags);
 
-            return 0;
-        }
-    }
+        if(!(nent = arp_alloc()))
+            return -1;
 
-    /* It's not there, add an entry */
-    cur = (netarp_t *)malloc(sizeof(netarp_t));
+        flags = irq_disable();
 
-    if(cur == NULL)
-        return -1;
+        if(!(cur = arp_find(ip))) {
+            cur = nent;
+            nent = NULL;
+            memcpy(cur->ip, ip, 4);
+            LIST_INSERT_HEAD(arp_bucket(ip), cur, ac_list);
+        }
+    }
 
     memcpy(cur->mac, mac, 6);
-    memcpy(cur->ip, ip, 4);
+    cur->resolved = 1;
     cur->timestamp = timestamp;
-    cur->pkt = NULL;
-    cur->data = NULL;
-    cur->data_size = 0;
-    LIST_INSERT_HEAD(&net_arp_cache, cur, ac_list);
+    cur->queried = 0;
+    cur->tries = 0;
+
+    if(!cur->nif)
+        cur->nif = nif;
+
+    /* Take the queued packets, to send them once interrupts are back on */
+    TAILQ_CONCAT(&pending, &cur->pending, list);
+    arp_stats.pending -= cur->npending;
+    cur->npending = 0;
 
-    /* Garbage collect expired entries */
-    net_arp_gc(nif);
+    irq_restore(flags);
+
+    free(nent);
+
+    while((p = TAILQ_FIRST(&pending))) {
+        TAILQ_REMOVE(&pending, p, list);
+        net_ipv4_send_packet(nif, &p->hdr, p->data, p->data_size);
+        free(p);
+    }
 
     return 0;
 }
 
 /* Look up an entry from the ARP cache; if no entry is found, then an ARP
-   query will be sent and an error will be returned. Thus your packet send
-   should also fail. Later when the transmit retries, hopefully the answer
-   will have arrived. */
+   query will be sent and an error will be returned. Any packet given is kept
+   on the entry and sent when the answer comes in, so the sender never has to
+   wait for it. */
 int net_arp_lookup(netif_t *nif, const uint8_t ip_in[4], uint8_t mac_out[6],
                    const ip_hdr_t *pkt, const uint8_t *data, int data_size) {
-    netarp_t *cur;
+    netarp_t *cur, *nent = NULL;
+    arp_pending_t *p = NULL;
+    uint64_t now = timer_ms_gettime64();
+    irq_mask_t flags;
+    int query = 0, rv;
 
-    /* Garbage collect expired entries */
-    net_arp_gc(nif);
+    flags = irq_disable();
 
     /* Look for the entry */
-    LIST_FOREACH(cur, &net_arp_cache, ac_list) {
-        if(!memcmp(ip_in, cur->ip, 4)) {
-            if(cur->mac[0] == 0 && cur->mac[1] == 0 &&
-               cur->mac[2] == 0 && cur->mac[3] == 0 &&
-               cur->mac[4] == 0 && cur->mac[5] == 0) {
-                return -1;
-            }
+    if((cur = arp_find(ip_in)) && cur->resolved &&
+       (!cur->timestamp || now < cur->timestamp + ARP_LIFETIME)) {
+        memcpy(mac_out, cur->mac, 6);
+        cur->used = now;
+        irq_restore(flags);
+        return 0;
+    }
 
-            memcpy(mac_out, cur->mac, 6);
+    ++arp_stats.lookup_miss;
+    irq_restore(flags);
 
-            if(cur->timestamp != 0)
-                cur->timestamp = timer_ms_gettime64();
+    /* Copy our packet if we have one to copy, and make an entry if there
+       wasn't one, before looking again with interrupts disabled. */
+    if(pkt && data && data_size &&
+       (p = (arp_pending_t *)malloc(sizeof(arp_pending_t) + data_size))) {
+        memcpy(&p->hdr, pkt, sizeof(ip_hdr_t));
+        memcpy(p->data, data, data_size);
+        p->data_size = data_size;
+    }
 
-            return 0;
+    if(!cur && !(nent = arp_alloc())) {
+        if(p) {
+            irq_disable_scoped();
+            ++arp_stats.pkt_queue_full;
         }
+
+        free(p);
+        return -3;
     }
 
-    /* It's not there... Add an incomplete ARP entry */
-    cur = (netarp_t *)malloc(sizeof(netarp_t));
+    flags = irq_disable();
 
-    if(cur == NULL)
-        return -3;
+    if(!(cur = arp_find(ip_in))) {
+        /* It's not there... Add an incomplete ARP entry */
+        cur = nent;
+        nent = NULL;
+        memcpy(cur->ip, ip_in, 4);
+        LIST_INSERT_HEAD(arp_bucket(ip_in), cur, ac_list);
+    }
 
-    memset(cur, 0, sizeof(netarp_t));
-    memcpy(cur->ip, ip_in, 4);
-    cur->timestamp = timer_ms_gettime64();
+    if(cur->resolved &&
+       (!cur->timestamp || now < cur->timestamp + ARP_LIFETIME)) {
+        /* The answer came in while we weren't looking. */
+        memcpy(mac_out, cur->mac, 6);
+        cur->used = now;
+        irq_restore(flags);
+        free(nent);
+        free(p);
+        return 0;
+    }
 
-    /* Copy our packet if we have one to copy. */
-    if(pkt && data && data_size) {
-        cur->data = (uint8_t *)malloc(data_size);
+    /* Ask about it if nobody has yet (or the entry has expired). */
+    if(cur->resolved || !cur->queried) {
+        cur->resolved = 0;
+        cur->queried = now;
+        cur->tries = 1;
+        query = 1;
+    }
 
-        if(cur->data) {
-            cur->pkt = (ip_hdr_t *)malloc(sizeof(ip_hdr_t));
+    cur->nif = nif;
+    cur->used = now;
 
-            if(!cur->pkt) {
-                free(cur->data);
-                cur->data = NULL;
-            }
-            else {
-                memcpy(cur->pkt, pkt, sizeof(ip_hdr_t));
-                memcpy(cur->data, data, data_size);
-                cur->data_size = data_size;
-            }
-        }
+    if(p && cur->npending < ARP_MAX_PENDING) {
+        TAILQ_INSERT_TAIL(&cur->pending, p, list);
+        ++cur->npending;
+        ++arp_stats.pkt_queued;
+        ++arp_stats.pending;
+        p = NULL;
+        rv = -2;
+    }
+    else {
+        if(pkt && data && data_size)
+            ++arp_stats.pkt_queue_full;
+
+        rv = query ? -2 : -1;
     }
 
-    LIST_INSERT_HEAD(&net_arp_cache, cur, ac_list);
+    irq_restore(flags);
+
+    free(nent);
+    free(p);
 
     /* Generate an ARP who-has packet */
-    net_arp_query(nif, ip_in);
+    if(query)
+        net_arp_query(nif, ip_in);
 
     /* Return failure */
     memset(mac_out, 0, 6);
-    return -2;
+    return rv;
 }
 
 /* Do a reverse ARP lookup: look for an IP for a given mac address; note
    that if this fails, you have no recourse. */
 int net_arp_revlookup(netif_t *nif, uint8_t ip_out[4], const uint8_t mac_in[6]) {
     netarp_t *cur;
+    int i;
 
     (void)nif;
 
-    /* Look for the entry */
-    LIST_FOREACH(cur, &net_arp_cache, ac_list) {
-        if(!memcmp(mac_in, cur->mac, 6)) {
-            memcpy(ip_out, cur->ip, 4);
+    irq_disable_scoped();
 
-            if(cur->timestamp != 0)
-                cur->timestamp = timer_ms_gettime64();
+    /* Look for the entry */
+    for(i = 0; i < ARP_HASH_SIZE; ++i) {
+        LIST_FOREACH(cur, &net_arp_cache[i], ac_list) {
+            if(cur->resolved && !memcmp(mac_in, cur->mac, 6)) {
+                memcpy(ip_out, cur->ip, 4);
+                cur->used = timer_ms_gettime64();
 
-            return 0;
+                return 0;
+            }
         }
     }
 
@@ -255,6 +423,7 @@ static int net_arp_send(netif_t *nif, arp_pkt_t *pkt) {
     arp_pkt_t pkt_out;
     eth_hdr_t eth_hdr;
     uint8_t buf[sizeof(arp_pkt_t) + sizeof(eth_hdr_t)];
+    struct iovec iov = { buf, sizeof(buf) };
 
     /* First, fill in the ARP packet. */
     pkt_out.hw_type[0] = 0;
@@ -280,7 +449,7 @@ static int net_arp_send(netif_t *nif, arp_pkt_t *pkt) {
     memcpy(buf + sizeof(eth_hdr_t), &pkt_out, sizeof(arp_pkt_t));
 
     /* Send it away */
-    nif->if_tx(nif, buf, sizeof(eth_hdr_t) + sizeof(arp_pkt_t), NETIF_BLOCK);
+    net_tx_iov(nif, &iov, 1, NETIF_BLOCK);
 
     return 0;
 }
@@ -319,6 +488,7 @@ int net_arp_query(netif_t *nif, const uint8_t ip[4]) {
     arp_pkt_t pkt_out;
     eth_hdr_t eth_hdr;
     uint8_t buf[sizeof(arp_pkt_t) + sizeof(eth_hdr_t)];
+    struct iovec iov = { buf, sizeof(buf) };
 
     /* First, fill in the ARP packet. */
     pkt_out.hw_type[0] = 0;
@@ -354,18 +524,34 @@ int net_arp_query(netif_t *nif, const uint8_t ip[4]) {
     memcpy(buf + sizeof(eth_hdr_t), &pkt_out, sizeof(arp_pkt_t));
 
     /* Send it away */
-    nif->if_tx(nif, buf, sizeof(eth_hdr_t) + sizeof(arp_pkt_t), NETIF_BLOCK);
+    net_tx_iov(nif, &iov, 1, NETIF_BLOCK);
+
+    irq_disable_scoped();
+    ++arp_stats.query_sent;
 
     return 0;
 }
 
+net_arp_stats_t net_arp_get_stats(void) {
+    irq_disable_scoped();
+    return arp_stats;
+}
+
 /*****************************************************************************/
 /* Init/shutdown */
 
 /* Init */
 int net_arp_init(void) {
+    int i;
+
     /* Initialize the ARP cache */
-    LIST_INIT(&net_arp_cache);
+    for(i = 0; i < ARP_HASH_SIZE; ++i)
+        LIST_INIT(&net_arp_cache[i]);
+
+    arp_cb_id = net_thd_add_callback(net_arp_timer, NULL, ARP_TIMER);
+
+    if(arp_cb_id < 0)
+        return -1;
 
     return 0;
 }
@@ -374,20 +560,25 @@ int net_arp_init(void) {
 void net_arp_shutdown(void) {
     /* Free all ARP entries */
     netarp_t *a1, *a2;
+    int i;
 
-    a1 = LIST_FIRST(&net_arp_cache);
+    if(arp_cb_id >= 0) {
+        net_thd_del_callback(arp_cb_id);
+        arp_cb_id = -1;
+    }
 
-    while(a1 != NULL) {
-        a2 = LIST_NEXT(a1, ac_list);
+    for(i = 0; i < ARP_HASH_SIZE; ++i) {
+        a1 = LIST_FIRST(&net_arp_cache[i]);
 
-        if(a1->pkt) {
-            free(a1->pkt);
-            free(a1->data);
+        while(a1 != NULL) {
+            a2 = LIST_NEXT(a1, ac_list);
+            arp_free_pending(&a1->pending);
+            free(a1);
+            a1 = a2;
         }
 
-        free(a1);
-        a1 = a2;
+        LIST_INIT(&net_arp_cache[i]);
     }
 
-    LIST_INIT(&net_arp_cache);
+    arp_stats.pending = 0;
 }
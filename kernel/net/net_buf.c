@@ -0,0 +1,184 @@
+/* KallistiOS ##version##
+
+   kernel/net/net_buf.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Network packet buffer pool. The pool is a single block of memory cut into
+   fixed size slots, so finding the buffer that holds a given pointer is just
+   a matter of arithmetic. Drivers allocate from interrupt handlers, so the
+   free list and reference counts are protected by disabling interrupts. */
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <arch/irq.h>
+#include <kos/dbglog.h>
+#include <kos/net_buf.h>
+
+/* Below this many free buffers, net_buf_hold() refuses to let protocols keep
+   buffers around, so that sockets nobody reads can't starve the drivers. */
+#define NET_BUF_LOW     (NET_BUF_COUNT / 4)
+
+static net_buf_t bufs[NET_BUF_COUNT];
+static uint8_t *pool;
+static net_buf_t *free_list;
+static size_t nfree;
+static unsigned int users;
+
+int net_buf_init(void) {
+    irq_mask_t flags;
+    uint8_t *p;
+    int i;
+
+    flags = irq_disable();
+
+    if(pool) {
+        ++users;
+        irq_restore(flags);
+        return 0;
+    }
+
+    irq_restore(flags);
+
+    if(!(p = memalign(32, NET_BUF_COUNT * NET_BUF_SIZE))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    flags = irq_disable();
+
+    if(pool) {
+        ++users;
+        irq_restore(flags);
+        free(p);
+        return 0;
+    }
+
+    pool = p;
+    free_list = NULL;
+
+    for(i = NET_BUF_COUNT - 1; i >= 0; i--) {
+        bufs[i].head = pool + i * NET_BUF_SIZE;
+        bufs[i].refcnt = 0;
+        bufs[i].next = free_list;
+        free_list = &bufs[i];
+    }
+
+    nfree = NET_BUF_COUNT;
+    users = 1;
+
+    irq_restore(flags);
+
+    return 0;
+}
+
+void net_buf_shutdown(void) {
+    irq_mask_t flags;
+    uint8_t *p = NULL;
+
+    flags = irq_disable();
+
+    if(users && !--users) {
+        if(nfree == NET_BUF_COUNT) {
+            p = pool;
+            pool = NULL;
+            free_list = NULL;
+        }
+        else {
+            dbglog(DBG_WARNING, "net_buf: %u buffers still held at shutdown\n",
+                   (unsigned int)(NET_BUF_COUNT - nfree));
+        }
+    }
+
+    irq_restore(flags);
+
+    free(p);
+}
+
+net_buf_t *net_buf_alloc(void) {
+    net_buf_t *nb;
+
+    irq_disable_scoped();
+
+    if(!pool) {
+        errno = ENXIO;
+        return NULL;
+    }
+
+    if(!(nb = free_list)) {
+        errno = ENOBUFS;
+        return NULL;
+    }
+
+    free_list = nb->next;
+    --nfree;
+
+    nb->data = nb->head + NET_BUF_HEADROOM;
+    nb->len = 0;
+    nb->refcnt = 1;
+    nb->next = NULL;
+
+    return nb;
+}
+
+net_buf_t *net_buf_ref(net_buf_t *nb) {
+    irq_disable_scoped();
+
+    ++nb->refcnt;
+
+    return nb;
+}
+
+void net_buf_unref(net_buf_t *nb) {
+    irq_mask_t flags;
+    uint8_t *p = NULL;
+
+    if(!nb)
+        return;
+
+    flags = irq_disable();
+
+    if(!--nb->refcnt) {
+        nb->next = free_list;
+        free_list = nb;
+        ++nfree;
+
+        /* The pool outlived its last user, free it with its last buffer. */
+        if(!users && nfree == NET_BUF_COUNT) {
+            p = pool;
+            pool = NULL;
+            free_list = NULL;
+        }
+    }
+
+    irq_restore(flags);
+
+    free(p);
+}
+
+net_buf_t *net_buf_hold(const void *ptr) {
+    uintptr_t off;
+    net_buf_t *nb;
+
+    irq_disable_scoped();
+
+    if(!pool)
+        return NULL;
+
+    off = (uintptr_t)ptr - (uintptr_t)pool;
+
+    if(off >= NET_BUF_COUNT * NET_BUF_SIZE || nfree < NET_BUF_LOW)
+        return NULL;
+
+    nb = &bufs[off / NET_BUF_SIZE];
+
+    if(!nb->refcnt)
+        return NULL;
+
+    ++nb->refcnt;
+
+    return nb;
+}
@@ -14,6 +14,7 @@
 #include <kos/net.h>
 #include <kos/fs_socket.h>
 #include <kos/dbglog.h>
+#include <kos/mem_tags.h>
 
 #include "net_dhcp.h"
 #include "net_thd.h"
@@ -94,6 +95,40 @@ int net_unreg_device(netif_t *device) {
     return 0;
 }
 
+/* Transmit a packet in pieces, assembling it ourselves if the driver can't */
+int net_tx_iov(netif_t *device, const struct iovec *iov, int iovcnt,
+               int blocking) {
+    size_t len = 0, pos = 0;
+    int i, rv;
+
+    for(i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+
+    if(device->if_tx_iov) {
+        rv = device->if_tx_iov(device, iov, iovcnt, blocking);
+    }
+    else {
+        uint8_t pkt[len];
+
+        for(i = 0; i < iovcnt; i++) {
+            memcpy(pkt + pos, iov[i].iov_base, iov[i].iov_len);
+            pos += iov[i].iov_len;
+        }
+
+        rv = device->if_tx(device, pkt, len, blocking);
+    }
+
+    if(rv == NETIF_TX_OK) {
+        ++device->stats.pkt_sent;
+        device->stats.bytes_sent += len;
+    }
+    else {
+        ++device->stats.pkt_send_failed;
+    }
+
+    return rv;
+}
+
 struct netif_list * net_get_if_list(void) {
     return &net_if_list;
 }
@@ -149,6 +184,8 @@ int net_dev_init(void) {
 int net_init(uint32_t ip) {
     int rv = 0;
 
+    mem_tag_scoped(MEM_TAG_NET);
+
     /* Make sure we haven't already done this */
     if(net_initted)
         return 0;
@@ -5,59 +5,126 @@
 
 */
 
+#include <stdbool.h>
 #include <kos/net.h>
 
-/* Calculate a CRC-32 checksum over a given block of data. Somewhat inspired by
-   the CRC32 function in Figure 14-6 of http://www.hackersdelight.org/crc.pdf */
-uint32_t __pure net_crc32le(const uint8_t *data, int size) {
-    int i;
-    uint32_t rv = 0xFFFFFFFF;
-
-    for(i = 0; i < size; ++i) {
-        rv ^= data[i];
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^(rv >> 1);
+/* These are computed 4 bytes at a time ("slicing-by-4"), with tables that
+   are built the first time they're needed: tab[0] is the usual byte at a
+   time table, and tab[n] gives what a byte does to the CRC when it is
+   followed by n more. Slicing by 8 would need 8KB of tables for the CRC-32,
+   which is half the data cache. Building the tables twice, if two threads
+   get here at once, is harmless. */
+static uint32_t crc32_tab[4][256];
+static uint16_t crc16_tab[4][256];
+static bool crc32_ready, crc16_ready;
+
+static void crc32_init(void) {
+    uint32_t c;
+    int i, j;
+
+    for(i = 0; i < 256; ++i) {
+        c = i;
+
+        for(j = 0; j < 8; ++j)
+            c = (0xEDB88320 & (-(c & 1))) ^ (c >> 1);
+
+        crc32_tab[0][i] = c;
     }
 
-    return ~rv;
+    for(i = 0; i < 256; ++i) {
+        for(j = 1; j < 4; ++j) {
+            c = crc32_tab[j - 1][i];
+            crc32_tab[j][i] = (c >> 8) ^ crc32_tab[0][c & 0xFF];
+        }
+    }
+
+    __atomic_store_n(&crc32_ready, true, __ATOMIC_RELEASE);
 }
 
-/* This one isn't quite as nice as the one above for little-endian... */
-uint32_t __pure net_crc32be(const uint8_t *data, int size) {
+static void crc16_init(void) {
+    uint16_t c;
     int i, j;
-    uint32_t rv = 0xFFFFFFFF, b, c;
 
-    for(i = 0; i < size; ++i) {
-        b = data[i];
+    for(i = 0; i < 256; ++i) {
+        c = i << 8;
+
+        for(j = 0; j < 8; ++j)
+            c = (c & 0x8000) ? (c << 1) ^ 0x1021 : c << 1;
 
-        for(j = 0; j < 8; ++j) {
-            c = ((rv & 0x80000000) ? 1 : 0) ^(b & 1);
-            b >>= 1;
+        crc16_tab[0][i] = c;
+    }
 
-            if(c)   rv = ((rv << 1) ^ 0x04C11DB6) | c;
-            else    rv <<= 1;
+    for(i = 0; i < 256; ++i) {
+        for(j = 1; j < 4; ++j) {
+            c = crc16_tab[j - 1][i];
+            crc16_tab[j][i] = (c << 8) ^ crc16_tab[0][c >> 8];
         }
     }
 
+    __atomic_store_n(&crc16_ready, true, __ATOMIC_RELEASE);
+}
+
+/* The raw CRC-32 register, with the data bits going in LSB first */
+static uint32_t crc32_update(uint32_t rv, const uint8_t *data, int size) {
+    const uint32_t *words;
+
+    if(!__atomic_load_n(&crc32_ready, __ATOMIC_ACQUIRE))
+        crc32_init();
+
+    for(; size && ((uintptr_t)data & 3); --size)
+        rv = (rv >> 8) ^ crc32_tab[0][(rv ^ *data++) & 0xFF];
+
+    /* Two words per loop, so the loads of the second one can be issued while
+       the first is still being looked up. */
+    for(words = (const uint32_t *)data; size >= 8; size -= 8, words += 2) {
+        rv ^= words[0];
+        rv = crc32_tab[3][rv & 0xFF] ^ crc32_tab[2][(rv >> 8) & 0xFF] ^
+             crc32_tab[1][(rv >> 16) & 0xFF] ^ crc32_tab[0][rv >> 24];
+        rv ^= words[1];
+        rv = crc32_tab[3][rv & 0xFF] ^ crc32_tab[2][(rv >> 8) & 0xFF] ^
+             crc32_tab[1][(rv >> 16) & 0xFF] ^ crc32_tab[0][rv >> 24];
+    }
+
+    for(data = (const uint8_t *)words; size; --size)
+        rv = (rv >> 8) ^ crc32_tab[0][(rv ^ *data++) & 0xFF];
+
     return rv;
 }
 
-/* Based on code found at: http://www.ccsinfo.com/forum/viewtopic.php?t=24977 */
-uint16_t __pure net_crc16ccitt(const uint8_t *data, int size, uint16_t start) {
-    uint16_t rv = start, tmp;
+/* Calculate a CRC-32 checksum over a given block of data. The polynomial is
+   the reflected one from Figure 14-6 of http://www.hackersdelight.org/crc.pdf */
+uint32_t net_crc32le(const uint8_t *data, int size) {
+    return ~crc32_update(0xFFFFFFFF, data, size);
+}
+
+/* This computes the same CRC as above, only shifting towards the top: the
+   register is the mirror image of the one above at every step. */
+uint32_t net_crc32be(const uint8_t *data, int size) {
+    uint32_t rv = crc32_update(0xFFFFFFFF, data, size);
+
+    rv = ((rv >> 1) & 0x55555555) | ((rv & 0x55555555) << 1);
+    rv = ((rv >> 2) & 0x33333333) | ((rv & 0x33333333) << 2);
+    rv = ((rv >> 4) & 0x0F0F0F0F) | ((rv & 0x0F0F0F0F) << 4);
+    rv = ((rv >> 8) & 0x00FF00FF) | ((rv & 0x00FF00FF) << 8);
+
+    return (rv >> 16) | (rv << 16);
+}
+
+/* The polynomial is x^16 + x^12 + x^5 + 1, with no reflection */
+uint16_t net_crc16ccitt(const uint8_t *data, int size, uint16_t start) {
+    uint32_t rv = start, x;
 
-    while(size--) {
-        tmp = (rv >> 8) ^ *data++;
-        tmp ^= tmp >> 4;
+    if(!__atomic_load_n(&crc16_ready, __ATOMIC_ACQUIRE))
+        crc16_init();
 
-        rv = (rv << 8) ^ (tmp << 12) ^ (tmp << 5) ^ tmp;
+    for(; size >= 4; size -= 4, data += 4) {
+        x = rv ^ ((data[0] << 8) | data[1]);
+        rv = crc16_tab[3][x >> 8] ^ crc16_tab[2][x & 0xFF] ^
+             crc16_tab[1][data[2]] ^ crc16_tab[0][data[3]];
     }
 
+    while(size--)
+        rv = ((rv << 8) & 0xFFFF) ^ crc16_tab[0][(rv >> 8) ^ *data++];
+
     return rv;
 }
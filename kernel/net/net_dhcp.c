@@ -19,8 +19,10 @@
 #include <unistd.h>
 
 #include <kos/net.h>
+#include <kos/dbglog.h>
 #include <kos/genwait.h>
 #include <kos/mutex.h>
+#include <kos/fs.h>
 #include <kos/fs_socket.h>
 
 #include <kos/timer.h>
@@ -33,6 +35,27 @@
 
 #define DHCP_MIN_OPTIONS_SIZE 64
 
+/* "KDL1", marking a lease written by this version of the code */
+#define DHCP_LEASE_MAGIC 0x4B444C31
+
+/* What is kept in net_dhcp_lease_file between boots. Addresses are in the
+   byte order of netif_t, and times are in seconds since the epoch. */
+typedef struct dhcp_lease {
+    uint32_t magic;
+    uint8_t  mac_addr[6];
+    uint16_t mtu;
+    uint8_t  ip_addr[4];
+    uint8_t  netmask[4];
+    uint8_t  gateway[4];
+    uint8_t  broadcast[4];
+    uint8_t  dns[4];
+    uint32_t obtained;
+    uint32_t lease_time;
+} dhcp_lease_t;
+
+/* Programs can define this themselves to have it set before net_init() is
+   called during KOS' own initialization. */
+const char * __weak_symbol net_dhcp_lease_file = NULL;
 
 static int dhcp_sock = -1;
 struct sockaddr_in srv_addr;
@@ -56,6 +79,11 @@ static uint64_t rebind_time = 0xFFFFFFFFFFFFFFFFULL;
 static uint64_t lease_expires = 0xFFFFFFFFFFFFFFFFULL;
 static int state = DHCP_STATE_INIT;
 
+/* The lease bound to last: when it was obtained, and for how many seconds
+   (0 if the server didn't say, 0xFFFFFFFF if it's forever). */
+static uint32_t lease_obtained = 0;
+static uint32_t lease_time = 0;
+
 static int net_dhcp_fill_options(netif_t *net, dhcp_pkt_t *req, uint8_t msgtype,
                                  uint32_t serverid, uint32_t reqip) {
     int pos = 0;
@@ -204,6 +232,175 @@ static uint16_t __pure net_dhcp_get_16bit(dhcp_pkt_t *pkt, uint8_t opt, int len)
     return 0;
 }
 
+/* Read the lease saved before the last reboot, if there is one that is still
+   good for this adapter. */
+static int net_dhcp_load_lease(dhcp_lease_t *lease) {
+    file_t fd;
+    ssize_t len;
+    uint32_t now = (uint32_t)time(NULL);
+
+    if(!net_dhcp_lease_file)
+        return -1;
+
+    if((fd = fs_open(net_dhcp_lease_file, O_RDONLY)) < 0)
+        return -1;
+
+    len = fs_read(fd, lease, sizeof(dhcp_lease_t));
+    fs_close(fd);
+
+    if(len != sizeof(dhcp_lease_t) || lease->magic != DHCP_LEASE_MAGIC ||
+       memcmp(lease->mac_addr, net_default_dev->mac_addr, 6))
+        return -1;
+
+    if(lease->lease_time == 0xFFFFFFFF)
+        return 0;
+
+    /* A clock that went backwards can't tell if the lease is still good. */
+    if(now < lease->obtained || now - lease->obtained >= lease->lease_time)
+        return -1;
+
+    return 0;
+}
+
+/* Save the lease just bound to, so the next boot can ask for it again rather
+   than go through the whole discovery. */
+static void net_dhcp_save_lease(void) {
+    dhcp_lease_t lease;
+    file_t fd;
+
+    if(!net_dhcp_lease_file || !lease_time)
+        return;
+
+    memset(&lease, 0, sizeof(lease));
+    lease.magic = DHCP_LEASE_MAGIC;
+    memcpy(lease.mac_addr, net_default_dev->mac_addr, 6);
+    lease.mtu = net_default_dev->mtu;
+    memcpy(lease.ip_addr, net_default_dev->ip_addr, 4);
+    memcpy(lease.netmask, net_default_dev->netmask, 4);
+    memcpy(lease.gateway, net_default_dev->gateway, 4);
+    memcpy(lease.broadcast, net_default_dev->broadcast, 4);
+    memcpy(lease.dns, net_default_dev->dns, 4);
+    lease.obtained = lease_obtained;
+    lease.lease_time = lease_time;
+
+    if((fd = fs_open(net_dhcp_lease_file, O_WRONLY | O_TRUNC)) < 0) {
+        dbglog(DBG_WARNING, "net_dhcp: can't save lease to %s\n",
+               net_dhcp_lease_file);
+        return;
+    }
+
+    if(fs_write(fd, &lease, sizeof(lease)) != sizeof(lease))
+        dbglog(DBG_WARNING, "net_dhcp: can't save lease to %s\n",
+               net_dhcp_lease_file);
+
+    fs_close(fd);
+}
+
+/* Forget a saved lease the server won't let us have anymore. */
+static void net_dhcp_forget_lease(void) {
+    if(net_dhcp_lease_file)
+        fs_unlink(net_dhcp_lease_file);
+}
+
+/* Set the timers of a lease that is secs seconds long and was obtained at
+   obtained, in seconds since the epoch. */
+static void net_dhcp_set_timers(uint32_t obtained, uint32_t secs) {
+    uint64_t now = timer_ms_gettime64();
+    uint64_t start, expiry;
+    uint32_t wall = (uint32_t)time(NULL);
+
+    if(secs == 0xFFFFFFFF) {
+        renew_time = rebind_time = lease_expires = 0xFFFFFFFFFFFFFFFFULL;
+        return;
+    }
+
+    /* Work out when the lease was obtained on the millisecond timer. */
+    start = now - (uint64_t)(wall - obtained) * 1000;
+    expiry = (uint64_t)secs * 1000;
+
+    /* Set our renewal timer to half the lease time and the rebinding timer
+       to .875 * lease time. */
+    renew_time = start + (expiry >> 1);
+    rebind_time = start + ((expiry * 7) >> 3);
+    lease_expires = start + expiry;
+}
+
+/* Start using a lease saved before a reboot right away, and ask the server
+   to confirm it is still ours (the INIT-REBOOT state of RFC 2131). If it
+   says no, we go through the normal discovery. Assumes dhcp_lock is held. */
+static int net_dhcp_reboot(const dhcp_lease_t *lease) {
+    uint8_t buf[1500];
+    dhcp_pkt_t *req = (dhcp_pkt_t *)buf;
+    int optlen;
+    struct dhcp_pkt_out *qpkt;
+    uint32_t reqip = (lease->ip_addr[0] << 24) | (lease->ip_addr[1] << 16) |
+                     (lease->ip_addr[2] << 8) | lease->ip_addr[3];
+
+    /* Fill in the DHCP request */
+    req->op = DHCP_OP_BOOTREQUEST;
+    req->htype = DHCP_HTYPE_10MB_ETHERNET;
+    req->hlen = DHCP_HLEN_ETHERNET;
+    req->hops = 0;
+    req->xid = htonl(time(NULL) ^ 0xDEADBEEF);
+    req->secs = 0;
+    req->flags = 0;
+    req->ciaddr = 0;
+    req->yiaddr = 0;
+    req->siaddr = 0;
+    req->giaddr = 0;
+    memcpy(req->chaddr, net_default_dev->mac_addr, DHCP_HLEN_ETHERNET);
+    memset(req->chaddr + DHCP_HLEN_ETHERNET, 0, sizeof(req->chaddr) -
+           DHCP_HLEN_ETHERNET);
+    memset(req->sname, 0, sizeof(req->sname));
+    memset(req->file, 0, sizeof(req->file));
+
+    /* Fill in options, with no server identifier in this state. */
+    optlen = net_dhcp_fill_options(net_default_dev, req, DHCP_MSG_DHCPREQUEST,
+                                   0, reqip);
+
+    /* Add to our packet queue */
+    qpkt = (struct dhcp_pkt_out *)malloc(sizeof(struct dhcp_pkt_out));
+
+    if(!qpkt) {
+        return -1;
+    }
+
+    qpkt->buf = (uint8_t *)malloc(sizeof(dhcp_pkt_t) + optlen);
+
+    if(!qpkt->buf) {
+        free(qpkt);
+        return -1;
+    }
+
+    qpkt->size = sizeof(dhcp_pkt_t) + optlen;
+    memcpy(qpkt->buf, buf, sizeof(dhcp_pkt_t) + optlen);
+    qpkt->pkt_type = DHCP_MSG_DHCPREQUEST;
+    qpkt->next_send = 0;
+    qpkt->next_delay = 2000;
+
+    STAILQ_INSERT_TAIL(&dhcp_pkts, qpkt, pkt_queue);
+
+    /* Configure the interface with what we had, so that everything else can
+       get going while the server confirms it. */
+    irq_disable_scoped();
+
+    memcpy(net_default_dev->ip_addr, lease->ip_addr, 4);
+    memcpy(net_default_dev->netmask, lease->netmask, 4);
+    memcpy(net_default_dev->gateway, lease->gateway, 4);
+    memcpy(net_default_dev->broadcast, lease->broadcast, 4);
+    memcpy(net_default_dev->dns, lease->dns, 4);
+
+    if(lease->mtu)
+        net_default_dev->mtu = lease->mtu;
+
+    lease_obtained = lease->obtained;
+    lease_time = lease->lease_time;
+    net_dhcp_set_timers(lease_obtained, lease_time);
+
+    state = DHCP_STATE_REBOOTING;
+
+    return 0;
+}
 
 int net_dhcp_request(uint32_t required_address) {
     uint8_t pkt[1500];
@@ -211,6 +408,7 @@ int net_dhcp_request(uint32_t required_address) {
     dhcp_pkt_t *req = (dhcp_pkt_t *)pkt;
     int optlen;
     struct dhcp_pkt_out *qpkt;
+    dhcp_lease_t lease;
     int rv = 0;
 
     if(dhcp_sock == -1) {
@@ -220,6 +418,14 @@ int net_dhcp_request(uint32_t required_address) {
     if(mutex_lock_irqsafe(&dhcp_lock))
         return -1;
 
+    /* Reuse the lease from before a reboot if we have one, without waiting for
+       the server to confirm it. */
+    if(!required_address && state == DHCP_STATE_INIT &&
+       !net_dhcp_load_lease(&lease) && !net_dhcp_reboot(&lease)) {
+        mutex_unlock(&dhcp_lock);
+        return 0;
+    }
+
     /* Fill in the initial DHCPDISCOVER packet */
     req->op = DHCP_OP_BOOTREQUEST;
     req->htype = DHCP_HTYPE_10MB_ETHERNET;
@@ -456,20 +662,11 @@ static void net_dhcp_bind(dhcp_pkt_t *pkt, int len) {
 
     /* Grab the Lease expiry time */
     tmp = net_dhcp_get_32bit(pkt, DHCP_OPTION_IP_LEASE_TIME, len);
+    lease_obtained = (uint32_t)time(NULL);
+    lease_time = tmp;
 
-    if(tmp != 0 && tmp != 0xFFFFFFFF) {
-        /* Set our renewal timer to half the lease time and the rebinding timer
-           to .875 * lease time. */
-        uint64_t now = timer_ms_gettime64();
-        int expiry = ntohl(tmp) * 1000;
-
-        renew_time = now + (expiry >> 1);
-        rebind_time = now + (uint64_t)(expiry * 0.875);
-        lease_expires = now + expiry;
-    }
-    else if(tmp == 0xFFFFFFFF) {
-        renew_time = rebind_time = lease_expires = 0xFFFFFFFFFFFFFFFFULL;
-    }
+    if(tmp != 0)
+        net_dhcp_set_timers(lease_obtained, tmp);
 
     /* Grab the interface MTU, if we got it */
     tmp = net_dhcp_get_16bit(pkt, DHCP_OPTION_INTERFACE_MTU, len);
@@ -500,7 +697,8 @@ static void net_dhcp_thd(void *obj) {
 
     /* Make sure we don't need to renew our lease */
     if(lease_expires <= now && (state == DHCP_STATE_BOUND ||
-                                state == DHCP_STATE_RENEWING || state == DHCP_STATE_REBINDING)) {
+                                state == DHCP_STATE_RENEWING || state == DHCP_STATE_REBINDING ||
+                                state == DHCP_STATE_REBOOTING)) {
         STAILQ_FOREACH_SAFE(qpkt, &dhcp_pkts, pkt_queue, q_tmp) {
             STAILQ_REMOVE(&dhcp_pkts, qpkt, dhcp_pkt_out, pkt_queue);
             free(qpkt->buf);
@@ -587,10 +785,16 @@ static void net_dhcp_thd(void *obj) {
 
                         /* Bind to the specified IP address */
                         net_dhcp_bind(pkt, len);
+                        net_dhcp_save_lease();
                         genwait_wake_all(&dhcp_sock);
                     }
                     else if(found == DHCP_MSG_DHCPNAK) {
-                        /* We got a NAK, try to discover again. */
+                        /* We got a NAK, try to discover again. If it was for
+                           a lease from before a reboot, stop using it. */
+                        if(state == DHCP_STATE_REBOOTING)
+                            memset(net_default_dev->ip_addr, 0, 4);
+
+                        net_dhcp_forget_lease();
                         state = DHCP_STATE_INIT;
                         net_dhcp_request(0);
                     }
@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <kos/net.h>
+#include <kos/mem_tags.h>
 #include "net_ipv4.h"
 #include "net_ipv6.h"
 
@@ -53,10 +54,20 @@ net_input_func net_input_target = net_default_input;
 
 /* Process an incoming packet */
 int net_input(netif_t *device, const uint8_t *data, int len) {
+    int rv = 0;
+
+    mem_tag_scoped(MEM_TAG_NET);
+
+    ++device->stats.pkt_recv;
+    device->stats.bytes_recv += len;
+
     if(net_input_target != NULL)
-        return net_input_target(device, data, len);
-    else
-        return 0;
+        rv = net_input_target(device, data, len);
+
+    if(rv < 0)
+        ++device->stats.pkt_recv_dropped;
+
+    return rv;
 }
 
 /* Setup an input target; returns the old target */
@@ -19,51 +19,164 @@
 #include <kos/net.h>
 #include <kos/fs_socket.h>
 #include <kos/timer.h>
+#include <arch/cache.h>
 
 #include "net_ipv4.h"
 #include "net_icmp.h"
 
 static net_ipv4_stats_t ipv4_stats = { 0 };
 
-/* Perform an IP-style checksum on a block of data */
-uint16_t __pure net_ipv4_checksum(const uint8_t *data, size_t bytes, uint16_t start) {
-    uint32_t sum = start;
-    size_t i = bytes;
+/* Fold a wide ones-complement sum down to 16 bits. */
+static inline uint32_t checksum_fold(uint64_t sum) {
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    return (uint32_t)((sum >> 16) + (sum & 0xFFFF));
+}
+
+static inline uint32_t checksum_swap(uint32_t sum) {
+    return ((sum >> 8) | (sum << 8)) & 0xFFFF;
+}
+
+/* Sum the data, copying it to dst on the way if dst isn't NULL. The sum of
+   32-bit words folds down to the same value as the sum of 16-bit words, so
+   the main loop works on whole 32-byte cache lines at a time, prefetching the
+   next one while it is at it. The data must be 4-byte aligned. */
+static uint64_t checksum_words(uint8_t *dst, const uint8_t *data,
+                               size_t bytes, uint64_t sum) {
+    const uint32_t *s = (const uint32_t *)data;
+    uint32_t *d = (uint32_t *)dst;
+    uint32_t w0, w1, w2, w3, w4, w5, w6, w7;
+
+    while(bytes >= 32) {
+        /* Don't prefetch past the end, as that could fault with the MMU on. */
+        if(bytes >= 64)
+            dcache_pref_block(s + 8);
+
+        w0 = s[0]; w1 = s[1]; w2 = s[2]; w3 = s[3];
+        w4 = s[4]; w5 = s[5]; w6 = s[6]; w7 = s[7];
+        sum += (uint64_t)w0 + w1 + w2 + w3;
+        sum += (uint64_t)w4 + w5 + w6 + w7;
+
+        if(d) {
+            d[0] = w0; d[1] = w1; d[2] = w2; d[3] = w3;
+            d[4] = w4; d[5] = w5; d[6] = w6; d[7] = w7;
+            d += 8;
+        }
+
+        s += 8;
+        bytes -= 32;
+    }
+
+    while(bytes >= 4) {
+        w0 = *s++;
+        sum += w0;
+
+        if(d)
+            *d++ = w0;
 
-    /* Make sure we don't do any unaligned memory accesses */
-    if(((uint32_t)data) & 0x01) {
-        const uint8_t *ptr = data;
+        bytes -= 4;
+    }
+
+    data = (const uint8_t *)s;
+    dst = (uint8_t *)d;
 
-        while(i > 1) {
-            sum += *ptr | ((*ptr + 1) << 8);
-            ptr += 2;
-            i -= 2;
+    if(bytes >= 2) {
+        sum += *(const uint16_t *)data;
 
-            while(sum >> 16)
-                sum = (sum >> 16) + (sum & 0xFFFF);
+        if(dst) {
+            *(uint16_t *)dst = *(const uint16_t *)data;
+            dst += 2;
         }
+
+        data += 2;
+        bytes -= 2;
     }
-    else {
-        const uint16_t *ptr = (const uint16_t *)data;
 
-        while(i > 1) {
-            sum += *ptr++;
-            i -= 2;
+    /* A last odd byte is summed as if it was padded with a zero byte. */
+    if(bytes) {
+        sum += data[0];
+
+        if(dst)
+            dst[0] = data[0];
+    }
+
+    return sum;
+}
+
+/* Compute the folded ones-complement sum of a block of data, as if it started
+   at an even offset of the packet, whatever its alignment. */
+static uint32_t checksum_partial(uint8_t *dst, const uint8_t *data,
+                                 size_t bytes) {
+    uint64_t sum = 0;
+    uint32_t first = 0;
+    int odd = (uintptr_t)data & 1;
+
+    if(!bytes)
+        return 0;
+
+    /* If the data starts on an odd address, sum everything after the first
+       byte and swap the result, as each of its words is then off by one. */
+    if(odd) {
+        first = data[0];
+
+        if(dst)
+            *dst++ = data[0];
+
+        ++data;
+        --bytes;
+    }
+
+    if(bytes >= 2 && ((uintptr_t)data & 2)) {
+        sum += *(const uint16_t *)data;
 
-            while(sum >> 16)
-                sum = (sum >> 16) + (sum & 0xFFFF);
+        if(dst) {
+            *(uint16_t *)dst = *(const uint16_t *)data;
+            dst += 2;
         }
+
+        data += 2;
+        bytes -= 2;
+    }
+
+    sum = checksum_words(dst, data, bytes, sum);
+
+    if(odd)
+        return checksum_fold(checksum_swap(checksum_fold(sum)) + first);
+
+    return checksum_fold(sum);
+}
+
+/* Perform an IP-style checksum on a block of data */
+uint16_t __pure net_ipv4_checksum(const uint8_t *data, size_t bytes, uint16_t start) {
+    return ~checksum_fold((uint64_t)start + checksum_partial(NULL, data, bytes));
+}
+
+/* Copy a block of data, checksumming it along the way */
+uint16_t net_ipv4_checksum_copy(uint8_t *dst, const uint8_t *src, size_t bytes,
+                                uint16_t start) {
+    /* The fused loop needs both sides to share the same alignment. */
+    if(((uintptr_t)dst ^ (uintptr_t)src) & 3) {
+        memcpy(dst, src, bytes);
+        dst = NULL;
     }
 
-    /* Handle the last byte, if we have an odd byte count */
-    if(i)
-        sum += data[bytes - 1];
+    return checksum_fold((uint64_t)start + checksum_partial(dst, src, bytes));
+}
 
-    /* Take care of any carry bits */
-    while(sum >> 16)
-        sum = (sum >> 16) + (sum & 0xFFFF);
+/* Update a checksum for a changed 16-bit field, as in RFC 1624, eqn. 3 */
+uint16_t __pure net_ipv4_checksum_update(uint16_t cksum, uint16_t oldval,
+                                         uint16_t newval) {
+    uint32_t sum = (uint16_t)~cksum + (uint16_t)~oldval + (uint32_t)newval;
 
-    return sum ^ 0xFFFF;
+    return ~checksum_fold(sum);
+}
+
+uint16_t __pure net_ipv4_checksum_update32(uint16_t cksum, uint32_t oldval,
+                                           uint32_t newval) {
+    cksum = net_ipv4_checksum_update(cksum, oldval >> 16, newval >> 16);
+    return net_ipv4_checksum_update(cksum, oldval & 0xFFFF, newval & 0xFFFF);
 }
 
 /* Determine if a given IP is in the current network */
@@ -96,8 +209,9 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8_t *data,
                          size_t size) {
     uint8_t dest_ip[4];
     uint8_t dest_mac[6];
-    uint8_t pkt[size + sizeof(ip_hdr_t) + sizeof(eth_hdr_t)];
-    eth_hdr_t *ehdr;
+    size_t hdrlen = 4 * (hdr->version_ihl & 0x0f);
+    eth_hdr_t ehdr;
+    struct iovec iov[3];
     int err;
 
     if(net == NULL) {
@@ -113,27 +227,31 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8_t *data,
 
     /* Is this a loopback address (127/8)? */
     if(dest_ip[0] == 0x7F) {
+        uint8_t pkt[size + hdrlen];
+
         /* Put the IP header / data into our packet */
-        memcpy(pkt, hdr, 4 * (hdr->version_ihl & 0x0f));
-        memcpy(pkt + 4 * (hdr->version_ihl & 0x0f), data, size);
+        memcpy(pkt, hdr, hdrlen);
+        memcpy(pkt + hdrlen, data, size);
 
         ++ipv4_stats.pkt_sent;
 
         /* Send it "away" */
-        net_ipv4_input(NULL, pkt, 4 * (hdr->version_ihl & 0x0f) + size, NULL);
+        net_ipv4_input(NULL, pkt, hdrlen + size, NULL);
 
         return 0;
     }
-    else if(net->flags & NETIF_NOETH) {
-        /* Put the IP header / data into our packet */
-        memcpy(pkt, hdr, 4 * (hdr->version_ihl & 0x0f));
-        memcpy(pkt + 4 * (hdr->version_ihl & 0x0f), data, size);
 
+    /* The driver picks the headers and data up from where they are. */
+    iov[1].iov_base = hdr;
+    iov[1].iov_len = hdrlen;
+    iov[2].iov_base = (void *)data;
+    iov[2].iov_len = size;
+
+    if(net->flags & NETIF_NOETH) {
         ++ipv4_stats.pkt_sent;
 
         /* Send it away */
-        return net->if_tx(net, pkt, 4 * (hdr->version_ihl & 0x0f) + size,
-                          NETIF_BLOCK);
+        return net_tx_iov(net, iov + 1, 2, NETIF_BLOCK);
     }
 
     /* Are we sending a broadcast packet? */
@@ -165,22 +283,18 @@ int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8_t *data,
     }
 
     /* Fill in the ethernet header */
-    ehdr = (eth_hdr_t *)pkt;
-    memcpy(ehdr->dest, dest_mac, 6);
-    memcpy(ehdr->src, net->mac_addr, 6);
-    ehdr->type[0] = 0x08;
-    ehdr->type[1] = 0x00;
+    memcpy(ehdr.dest, dest_mac, 6);
+    memcpy(ehdr.src, net->mac_addr, 6);
+    ehdr.type[0] = 0x08;
+    ehdr.type[1] = 0x00;
 
-    /* Put the IP header / data into our ethernet packet */
-    memcpy(pkt + sizeof(eth_hdr_t), hdr, 4 * (hdr->version_ihl & 0x0f));
-    memcpy(pkt + sizeof(eth_hdr_t) + 4 * (hdr->version_ihl & 0x0f), data,
-           size);
+    iov[0].iov_base = &ehdr;
+    iov[0].iov_len = sizeof(eth_hdr_t);
 
     ++ipv4_stats.pkt_sent;
 
     /* Send it away */
-    net->if_tx(net, pkt, sizeof(ip_hdr_t) + size + sizeof(eth_hdr_t),
-               NETIF_BLOCK);
+    net_tx_iov(net, iov, 3, NETIF_BLOCK);
 
     return 0;
 }
@@ -26,6 +26,20 @@ typedef struct {
 } __packed ipv4_pseudo_hdr_t;
 
 uint16_t __pure net_ipv4_checksum(const uint8_t *data, size_t bytes, uint16_t start);
+
+/* Copy data while checksumming it. This returns the partial sum of the data
+   (not complemented), to be passed as start to net_ipv4_checksum() over the
+   headers in front of it. dst must be at an even offset of the packet. */
+uint16_t net_ipv4_checksum_copy(uint8_t *dst, const uint8_t *src, size_t bytes,
+                                uint16_t start);
+
+/* Update a checksum after a 16 or 32-bit field it covers changed from oldval
+   to newval (RFC 1624), without going over the data again. All values are
+   taken in the byte order they have in the packet. */
+uint16_t __pure net_ipv4_checksum_update(uint16_t cksum, uint16_t oldval,
+                                         uint16_t newval);
+uint16_t __pure net_ipv4_checksum_update32(uint16_t cksum, uint32_t oldval,
+                                           uint32_t newval);
 int net_ipv4_send_packet(netif_t *net, ip_hdr_t *hdr, const uint8_t *data,
                          size_t size);
 int net_ipv4_send(netif_t *net, const uint8_t *data, size_t size, int id, int ttl,
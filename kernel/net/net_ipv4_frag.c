@@ -19,10 +19,41 @@
 #include "net_ipv4.h"
 #include "net_thd.h"
 
-#define MAX(a, b) a > b ? a : b;
+/* Fragments being reassembled are found through a small hash table, keyed on
+   the fields that identify their datagram. Every datagram also sits on a list
+   in the order it was started in, so that when the memory used by reassembly
+   reaches its limit, the oldest datagrams make room for new ones.
+
+   Instead of a bitfield of the fragment blocks that arrived, each datagram
+   keeps the list of holes it has left, as described in RFC 815. A fragment
+   only has to be checked against the holes, and the datagram is complete
+   when there are no holes left. */
+
+#define FRAG_HASH_BITS  5
+#define FRAG_HASH_SIZE  (1 << FRAG_HASH_BITS)
+
+/* Most memory used by datagrams being reassembled, headers included */
+#define FRAG_MAX_MEMORY (256 * 1024)
+
+/* Most holes a datagram may have at once. Fragments arriving in any sane
+   order leave one or two. */
+#define FRAG_MAX_HOLES  16
+
+/* End of the hole at the end of a datagram whose last fragment hasn't arrived
+   yet */
+#define FRAG_INFINITY   0x7FFFFFFF
+
+/* Largest payload of an IPv4 datagram */
+#define FRAG_MAX_SIZE   65535
+
+struct frag_hole {
+    int first;                          /* First byte of the hole */
+    int end;                            /* Byte after the end of the hole */
+};
 
 struct ip_frag {
-    TAILQ_ENTRY(ip_frag) listhnd;
+    TAILQ_ENTRY(ip_frag) listhnd;       /* Datagrams from oldest to newest */
+    LIST_ENTRY(ip_frag) hashhnd;        /* Datagrams of the same bucket */
 
     uint32_t src;
     uint32_t dst;
@@ -31,19 +62,59 @@ struct ip_frag {
 
     ip_hdr_t hdr;
     uint8_t *data;
-    uint8_t bitfield[8192];
     int cur_length;
     int total_length;
     uint64_t death_time;
+
+    int nholes;
+    struct frag_hole holes[FRAG_MAX_HOLES];
 };
 
 TAILQ_HEAD(ip_frag_list, ip_frag);
+LIST_HEAD(ip_frag_bucket, ip_frag);
 
 static struct ip_frag_list frags;
+static struct ip_frag_bucket frag_hash[FRAG_HASH_SIZE];
+static size_t frag_mem;
 static mutex_t frag_mutex = MUTEX_INITIALIZER;
 static int cbid = -1;
 static int initted = 0;
 
+static inline struct ip_frag_bucket *frag_bucket(uint32_t src, uint32_t dst,
+                                                 uint16_t ident,
+                                                 uint8_t proto) {
+    return &frag_hash[((src ^ dst ^ ident ^ proto) * 0x9e3779b1u) >>
+                      (32 - FRAG_HASH_BITS)];
+}
+
+/* Drop a datagram being reassembled. Assumes frag_mutex is held. */
+static void frag_free(struct ip_frag *f) {
+    TAILQ_REMOVE(&frags, f, listhnd);
+    LIST_REMOVE(f, hashhnd);
+    frag_mem -= sizeof(struct ip_frag) + f->cur_length;
+    free(f->data);
+    free(f);
+}
+
+/* Drop the oldest datagrams, other than keep, until size more bytes fit in the
+   memory limit. Assumes frag_mutex is held. */
+static int frag_make_room(size_t size, const struct ip_frag *keep) {
+    struct ip_frag *f, *n;
+
+    f = TAILQ_FIRST(&frags);
+
+    while(f && frag_mem + size > FRAG_MAX_MEMORY) {
+        n = TAILQ_NEXT(f, listhnd);
+
+        if(f != keep)
+            frag_free(f);
+
+        f = n;
+    }
+
+    return frag_mem + size > FRAG_MAX_MEMORY ? -1 : 0;
+}
+
 /* IP fragment "thread" -- this thread is set up to delete fragments for which
    the "death_time" has passed. This is run approximately once every two
    seconds (since death_time is always on the order of seconds). */
@@ -62,65 +133,52 @@ static void frag_thd_cb(void *data) {
     while(f) {
         n = TAILQ_NEXT(f, listhnd);
 
-        if(f->death_time < now) {
-            TAILQ_REMOVE(&frags, f, listhnd);
-            free(f->data);
-            free(f);
-        }
+        if(f->death_time < now)
+            frag_free(f);
 
         f = n;
     }
 }
 
-/* Set the bits in the bitfield for the given set of fragment blocks. */
-static inline void set_bits(uint8_t *bitfield, int start, int end) {
-    /* Use a slightly more efficient method when dealing with an end that is not
-       in the same byte as the start. */
-    if((end >> 3) > (start >> 3)) {
-        int bits = start & 0x07;
-
-        /* Finish off anything in the start byte... */
-        while(bits && bits < 8) {
-            bitfield[start >> 3] |= (1 << bits);
-            ++bits;
-        }
+/* Fill the holes of a datagram covered by a fragment from start to end, which
+   is the last one if more is zero. This is the hole filling algorithm of
+   RFC 815. */
+static int fill_holes(struct ip_frag *frag, int start, int end, int more) {
+    struct frag_hole holes[FRAG_MAX_HOLES];
+    int i, n = 0;
 
-        /* ...and the start of the end byte. */
-        bits = end & 0x07;
-        bitfield[end >> 3] |= (1 << bits) - 1;
+    for(i = 0; i < frag->nholes; ++i) {
+        const struct frag_hole *h = &frag->holes[i];
 
-        /* Now, fill anything in in the middle. */
-        bits = (end >> 3) - ((start + 1) >> 3);
-        memset(bitfield + ((start + 1) >> 3), 0xFF, bits);
-    }
-    /* Fall back to brute-forcing it for when the two are in the same byte. */
-    else {
-        --end;
+        /* Holes the fragment doesn't touch stay as they are. */
+        if(start >= h->end || end <= h->first) {
+            holes[n++] = *h;
+            continue;
+        }
+
+        /* What's left of the hole before the fragment... */
+        if(h->first < start) {
+            if(n == FRAG_MAX_HOLES)
+                return -1;
 
-        while(end >= start) {
-            bitfield[end >> 3] |= (1 << (end & 0x07));
-            --end;
+            holes[n].first = h->first;
+            holes[n++].end = start;
         }
-    }
-}
 
-/* Check if all bits in the bitfield that should be set are set. */
-static inline int __pure all_bits_set(const uint8_t *bitfield, int end) {
-    int i;
+        /* ...and after it, unless it's the end of the datagram. */
+        if(end < h->end && more) {
+            if(n == FRAG_MAX_HOLES)
+                return -1;
 
-    /* Make sure each of the beginning bytes are fully set. */
-    for(i = 0; i < (end >> 3); ++i) {
-        if(bitfield[i] != 0xFF) {
-            return 0;
+            holes[n].first = end;
+            holes[n++].end = h->end;
         }
     }
 
-    /* Check the last byte to make sure it has the right number of bits set. */
-    if(bitfield[(end >> 3)] != ((1 << (end & 0x07)) - 1)) {
-        return 0;
-    }
+    memcpy(frag->holes, holes, n * sizeof(struct frag_hole));
+    frag->nholes = n;
 
-    return 1;
+    return 0;
 }
 
 /* Import the data for a fragment, potentially passing it onward in processing,
@@ -129,33 +187,47 @@ static int frag_import(netif_t *src, const ip_hdr_t *hdr, const uint8_t *data,
                        size_t size, uint16_t flags, struct ip_frag *frag) {
     void *tmp;
     int fo = flags & 0x1FFF;
-    int tl = ntohs(hdr->length);
     int start = (fo << 3);
-    int ihl = (hdr->version_ihl & 0x0F) << 2;
-    int end = start + tl - ihl;
+    int end = start + (int)size;
+    int more = flags & 0x2000;
     int rv = 0;
     uint64_t now = timer_ms_gettime64();
 
-    (void)size;
+    /* Drop the whole datagram if it's too large, or if it won't fit. */
+    if(end > FRAG_MAX_SIZE || (!more && frag->total_length &&
+                               end != frag->total_length)) {
+        errno = EMSGSIZE;
+        goto fail;
+    }
 
     /* Reallocate space for the data buffer, if needed. */
     if(end > frag->cur_length) {
+        if(frag_make_room(end - frag->cur_length, frag)) {
+            errno = ENOMEM;
+            goto fail;
+        }
+
         tmp = realloc(frag->data, end);
 
         if(!tmp) {
             errno = ENOMEM;
-            rv = -1;
-            goto out;
+            goto fail;
         }
 
         frag->data = tmp;
+        frag_mem += end - frag->cur_length;
+        frag->cur_length = end;
     }
 
-    memcpy(frag->data + start, data, end - start);
-    set_bits(frag->bitfield, fo, fo + (((tl - ihl) + 7) >> 3));
+    if(fill_holes(frag, start, end, more)) {
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    memcpy(frag->data + start, data, size);
 
     /* If the MF flag is not set, set the data length. */
-    if(!(flags & 0x2000)) {
+    if(!more) {
         frag->total_length = end;
     }
 
@@ -164,31 +236,38 @@ static int frag_import(netif_t *src, const ip_hdr_t *hdr, const uint8_t *data,
         frag->hdr = *hdr;
     }
 
-    /* If the total length is not zero, and all the bits in the bitfield are
-       set, we continue on. */
-    if(frag->total_length &&
-            all_bits_set(frag->bitfield, frag->total_length >> 3)) {
+    /* If there are no holes left, we continue on. */
+    if(!frag->nholes) {
         /* Set the right length. Don't worry about updating the checksum, since
            net_ipv4_input_proto doesn't check it anyway. */
         frag->hdr.length = htons(frag->total_length +
                                  ((frag->hdr.version_ihl & 0x0F) << 2));
 
+        /* Take the datagram out of the table before passing it on, so the
+           mutex doesn't have to be held while the upper layers look at it. */
+        TAILQ_REMOVE(&frags, frag, listhnd);
+        LIST_REMOVE(frag, hashhnd);
+        frag_mem -= sizeof(struct ip_frag) + frag->cur_length;
+        mutex_unlock(&frag_mutex);
+
         rv = net_ipv4_input_proto(src, &frag->hdr, frag->data);
 
-        /* Remove the fragment from our buffer. */
-        TAILQ_REMOVE(&frags, frag, listhnd);
         free(frag->data);
         free(frag);
-
-        goto out;
+        return rv;
     }
 
     /* Update the timer. */
-    frag->death_time = MAX(frag->death_time, (now + hdr->ttl * 1000));
+    if(frag->death_time < now + hdr->ttl * 1000)
+        frag->death_time = now + hdr->ttl * 1000;
+
+    mutex_unlock(&frag_mutex);
+    return 0;
 
-out:
+fail:
+    frag_free(frag);
     mutex_unlock(&frag_mutex);
-    return rv;
+    return -1;
 }
 
 /* IPv4 fragmentation procedure. This is basically a direct implementation of
@@ -199,6 +278,7 @@ int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8_t *data,
     int total = size + ihl;
     uint16_t flags = ntohs(hdr->flags_frag_offs);
     ip_hdr_t newhdr;
+    uint16_t old_len, old_flags;
     int nfb, ds;
 
     if(net == NULL)
@@ -221,9 +301,12 @@ int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8_t *data,
     newhdr.flags_frag_offs = htons(flags | 0x2000);
     newhdr.length = htons(ihl + ds);
 
-    /* Recompute the checksum. */
-    newhdr.checksum = 0;
-    newhdr.checksum = net_ipv4_checksum((uint8_t *)&newhdr, sizeof(ip_hdr_t), 0);
+    /* Only two fields changed, so update the checksum for them. */
+    newhdr.checksum = net_ipv4_checksum_update(newhdr.checksum,
+                                               hdr->flags_frag_offs,
+                                               newhdr.flags_frag_offs);
+    newhdr.checksum = net_ipv4_checksum_update(newhdr.checksum, hdr->length,
+                                               newhdr.length);
 
     if(net_ipv4_send_packet(net, &newhdr, data, ds)) {
         return -1;
@@ -232,10 +315,14 @@ int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8_t *data,
     /* We don't deal with options right now, so dealing with the rest of the
        fragments is pretty easy. Fix the header, and recursively call this
        function to finish things off. */
+    old_len = hdr->length;
+    old_flags = hdr->flags_frag_offs;
     hdr->length = htons(ihl + size - ds);
     hdr->flags_frag_offs = htons((flags & 0xE000) | ((flags & 0x1FFF) + nfb));
-    hdr->checksum = 0;
-    hdr->checksum = net_ipv4_checksum((uint8_t *)hdr, sizeof(ip_hdr_t), 0);
+    hdr->checksum = net_ipv4_checksum_update(hdr->checksum, old_len,
+                                             hdr->length);
+    hdr->checksum = net_ipv4_checksum_update(hdr->checksum, old_flags,
+                                             hdr->flags_frag_offs);
 
     return net_ipv4_frag_send(net, hdr, data + ds, size - ds);
 }
@@ -246,6 +333,7 @@ int net_ipv4_frag_send(netif_t *net, ip_hdr_t *hdr, const uint8_t *data,
 int net_ipv4_reassemble(netif_t *src, const ip_hdr_t *hdr, const uint8_t *data,
                         size_t size) {
     uint16_t flags = ntohs(hdr->flags_frag_offs);
+    struct ip_frag_bucket *b;
     struct ip_frag *f;
 
     /* If the fragment offset is zero and the MF flag is 0, this is the whole
@@ -259,8 +347,10 @@ int net_ipv4_reassemble(netif_t *src, const ip_hdr_t *hdr, const uint8_t *data,
     if(mutex_lock_irqsafe(&frag_mutex))
         return -1;
 
+    b = frag_bucket(hdr->src, hdr->dest, hdr->packet_id, hdr->protocol);
+
     /* Find the packet if we already have this one in our data buffer. */
-    TAILQ_FOREACH(f, &frags, listhnd) {
+    LIST_FOREACH(f, b, hashhnd) {
         if(f->src == hdr->src && f->dst == hdr->dest &&
            f->ident == hdr->packet_id && f->proto == hdr->protocol) {
             /* We've got it, import the data (this function handles unlocking
@@ -269,10 +359,11 @@ int net_ipv4_reassemble(netif_t *src, const ip_hdr_t *hdr, const uint8_t *data,
         }
     }
 
-    /* We don't have a fragment with that identifier, so make one. */
-    f = (struct ip_frag *)malloc(sizeof(struct ip_frag));
-
-    if(!f) {
+    /* We don't have a fragment with that identifier, so make one, making room
+       for it if needed. */
+    if(frag_make_room(sizeof(struct ip_frag), NULL) ||
+       !(f = (struct ip_frag *)malloc(sizeof(struct ip_frag)))) {
+        mutex_unlock(&frag_mutex);
         errno = ENOMEM;
         return -1;
     }
@@ -284,17 +375,29 @@ int net_ipv4_reassemble(netif_t *src, const ip_hdr_t *hdr, const uint8_t *data,
     f->data = NULL;
     f->cur_length = 0;
     f->total_length = 0;
-    memset(f->bitfield, 0, sizeof(f->bitfield));
+    f->death_time = 0;
+    f->nholes = 1;
+    f->holes[0].first = 0;
+    f->holes[0].end = FRAG_INFINITY;
 
     TAILQ_INSERT_TAIL(&frags, f, listhnd);
+    LIST_INSERT_HEAD(b, f, hashhnd);
+    frag_mem += sizeof(struct ip_frag);
 
     return frag_import(src, hdr, data, size, flags, f);
 }
 
 int net_ipv4_frag_init(void) {
+    int i;
+
     if(!initted) {
-        cbid = net_thd_add_callback(&frag_thd_cb, NULL, 2000);
         TAILQ_INIT(&frags);
+
+        for(i = 0; i < FRAG_HASH_SIZE; ++i)
+            LIST_INIT(&frag_hash[i]);
+
+        frag_mem = 0;
+        cbid = net_thd_add_callback(&frag_thd_cb, NULL, 2000);
     }
 
     initted = 1;
@@ -302,23 +405,20 @@ int net_ipv4_frag_init(void) {
 }
 
 void net_ipv4_frag_shutdown(void) {
-    struct ip_frag *c, *n;
+    struct ip_frag *c;
 
     if(initted) {
         if(cbid != -1)
             net_thd_del_callback(cbid);
 
-        c = TAILQ_FIRST(&frags);
+        mutex_lock(&frag_mutex);
 
-        while(c) {
-            n = TAILQ_NEXT(c, listhnd);
-            free(c->data);
-            free(c->bitfield);
-            c = n;
-        }
+        while((c = TAILQ_FIRST(&frags)))
+            frag_free(c);
+
+        mutex_unlock(&frag_mutex);
     }
 
     cbid = -1;
     initted = 0;
-    TAILQ_INIT(&frags);
 }
@@ -63,11 +63,11 @@ static int __pure is_in_network(netif_t *net, const struct in6_addr *ip) {
 /* Send a packet on the specified network adapter */
 int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8_t *data,
                          size_t data_size) {
-    uint8_t pkt[data_size + sizeof(ipv6_hdr_t) + sizeof(eth_hdr_t)];
     uint8_t dst_mac[6];
     int err;
     struct in6_addr dst = hdr->dst_addr;
-    eth_hdr_t *ehdr;
+    eth_hdr_t ehdr;
+    struct iovec iov[3];
 
     if(!net) {
         net = net_default_dev;
@@ -80,6 +80,8 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8_t *data,
 
     /* Are we sending a packet to loopback? */
     if(IN6_IS_ADDR_LOOPBACK(&hdr->dst_addr)) {
+        uint8_t pkt[data_size + sizeof(ipv6_hdr_t)];
+
         memcpy(pkt, hdr, sizeof(ipv6_hdr_t));
         memcpy(pkt + sizeof(ipv6_hdr_t), data, data_size);
 
@@ -89,15 +91,18 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8_t *data,
         net_ipv6_input(NULL, pkt, sizeof(ipv6_hdr_t) + data_size, NULL);
         return 0;
     }
-    else if(net->flags & NETIF_NOETH) {
-        memcpy(pkt, hdr, sizeof(ipv6_hdr_t));
-        memcpy(pkt + sizeof(ipv6_hdr_t), data, data_size);
 
+    /* The driver picks the headers and data up from where they are. */
+    iov[1].iov_base = hdr;
+    iov[1].iov_len = sizeof(ipv6_hdr_t);
+    iov[2].iov_base = (void *)data;
+    iov[2].iov_len = data_size;
+
+    if(net->flags & NETIF_NOETH) {
         ++ipv6_stats.pkt_sent;
 
         /* Send the packet away */
-        return net->if_tx(net, pkt, sizeof(ipv6_hdr_t) + data_size,
-                          NETIF_BLOCK);
+        return net_tx_iov(net, iov + 1, 2, NETIF_BLOCK);
     }
     else if(IN6_IS_ADDR_MULTICAST(&hdr->dst_addr)) {
         dst_mac[0] = dst_mac[1] = 0x33;
@@ -124,21 +129,18 @@ int net_ipv6_send_packet(netif_t *net, ipv6_hdr_t *hdr, const uint8_t *data,
     }
 
     /* Fill in the ethernet header */
-    ehdr = (eth_hdr_t *)pkt;
-    memcpy(ehdr->dest, dst_mac, 6);
-    memcpy(ehdr->src, net->mac_addr, 6);
-    ehdr->type[0] = 0x86;
-    ehdr->type[1] = 0xDD;
+    memcpy(ehdr.dest, dst_mac, 6);
+    memcpy(ehdr.src, net->mac_addr, 6);
+    ehdr.type[0] = 0x86;
+    ehdr.type[1] = 0xDD;
 
-    /* Put the IP header / data into our ethernet packet */
-    memcpy(pkt + sizeof(eth_hdr_t), hdr, sizeof(ipv6_hdr_t));
-    memcpy(pkt + sizeof(eth_hdr_t) + sizeof(ipv6_hdr_t), data, data_size);
+    iov[0].iov_base = &ehdr;
+    iov[0].iov_len = sizeof(eth_hdr_t);
 
     ++ipv6_stats.pkt_sent;
 
     /* Send it away */
-    net->if_tx(net, pkt, sizeof(ipv6_hdr_t) + data_size + sizeof(eth_hdr_t),
-               NETIF_BLOCK);
+    net_tx_iov(net, iov, 3, NETIF_BLOCK);
 
     return 0;
 }
@@ -11,11 +11,13 @@
 #include <string.h>
 #include <netinet/in.h>
 #include <sys/queue.h>
+#include <arch/irq.h>
 #include <kos/net.h>
 #include <kos/timer.h>
 
 #include "net_ipv6.h"
 #include "net_icmp6.h"
+#include "net_thd.h"
 
 /* This file implements the Neighbor Discovery Protocol for IPv6. Basically, NDP
    acts much like ARP does for IPv4. It is responsible for keeping track of the
@@ -23,20 +25,61 @@
    through ICMPv6 packets. NDP is specified in RFC 4861. Note however, that, for
    the time being at least, this isn't fully compliant with that spec. */
 
+/* Number of buckets of the NDP cache (must be a power of two) */
+#define NDP_HASH_SIZE       32
+
+/* How long an entry is kept without hearing from its host, how long it is
+   considered reachable once it has been heard from, and how long before that
+   runs out to start asking again if the entry is in use. */
+#define NDP_LIFETIME        600000
+#define NDP_REACHABLE       30000
+#define NDP_REFRESH         5000
+
+/* How long to wait for an advertisement before soliciting again, and how many
+   solicitations go unanswered before giving up on an address. */
+#define NDP_RETRY           1000
+#define NDP_MAX_TRIES       3
+
+/* Most packets kept for an address while it is being resolved */
+#define NDP_MAX_PENDING     4
+
+/* How often the cache is looked over, and the most solicitations sent each
+   time */
+#define NDP_TIMER           250
+#define NDP_MAX_QUERIES     8
+
+/* Packet waiting for the address of its destination to be resolved */
+typedef struct ndp_pending {
+    TAILQ_ENTRY(ndp_pending) list;
+    ipv6_hdr_t              hdr;
+    int                     data_size;
+    uint8_t                 data[];
+} ndp_pending_t;
+
+TAILQ_HEAD(ndp_pending_list, ndp_pending);
+
 /* Structure describing a NDP entry. Analogous to the netarp_t for ARP. */
 typedef struct ndp_entry {
     LIST_ENTRY(ndp_entry)   entry;
     struct in6_addr         ip;
     uint64_t                last_reachable;
+    uint64_t                used;
+    uint64_t                queried;
+    int                     tries;
     int                     state;
     uint8_t                 mac[6];
-    ipv6_hdr_t              *pkt;
-    uint8_t                 *data;
-    int                     data_size;
+    netif_t                 *net;
+    struct ndp_pending_list pending;
+    int                     npending;
 } ndp_entry_t;
 
 LIST_HEAD(ndp_list, ndp_entry);
-static struct ndp_list ndp_cache = LIST_HEAD_INITIALIZER(0);
+
+/* NDP cache. Like the ARP cache, it is protected by disabling interrupts, and
+   nothing is sent with them disabled. */
+static struct ndp_list ndp_cache[NDP_HASH_SIZE];
+
+static int ndp_cb_id = -1;
 
 /* List of states for the ndp entry */
 #define NDP_STATE_INCOMPLETE    0
@@ -45,39 +88,141 @@ static struct ndp_list ndp_cache = LIST_HEAD_INITIALIZER(0);
 #define NDP_STATE_DELAY         3
 #define NDP_STATE_PROBE         4
 
+static inline struct ndp_list *ndp_bucket(const struct in6_addr *ip) {
+    return &ndp_cache[(ip->s6_addr[14] * 31 + ip->s6_addr[15]) &
+                      (NDP_HASH_SIZE - 1)];
+}
+
+/* Find the entry of an address. Assumes interrupts are disabled. */
+static ndp_entry_t *ndp_find(const struct in6_addr *ip) {
+    ndp_entry_t *i;
+
+    LIST_FOREACH(i, ndp_bucket(ip), entry) {
+        if(!memcmp(ip, &i->ip, sizeof(struct in6_addr)))
+            return i;
+    }
+
+    return NULL;
+}
+
+static ndp_entry_t *ndp_alloc(void) {
+    ndp_entry_t *i;
+
+    if(!(i = (ndp_entry_t *)malloc(sizeof(ndp_entry_t))))
+        return NULL;
+
+    memset(i, 0, sizeof(ndp_entry_t));
+    TAILQ_INIT(&i->pending);
+
+    return i;
+}
+
+static void ndp_free(ndp_entry_t *i) {
+    ndp_pending_t *p;
+
+    while((p = TAILQ_FIRST(&i->pending))) {
+        TAILQ_REMOVE(&i->pending, p, list);
+        free(p);
+    }
+
+    free(i);
+}
+
+/* Set up and send a neighbor solicitation about the specified address */
+static void net_ndp_send_sol(netif_t *net, const struct in6_addr *ip) {
+    struct in6_addr dst = *ip;
+
+    /* Send to the solicited nodes multicast group for the specified addr */
+    dst.s6_addr[0] = 0xFF;
+    dst.s6_addr[1] = 0x02;
+    dst.__s6_addr.__s6_addr16[1] = 0x0000;
+    dst.__s6_addr.__s6_addr16[2] = 0x0000;
+    dst.__s6_addr.__s6_addr16[3] = 0x0000;
+    dst.__s6_addr.__s6_addr16[4] = 0x0000;
+    dst.s6_addr[10] = 0x00;
+    dst.s6_addr[11] = 0x01;
+    dst.s6_addr[12] = 0xFF;
+
+    net_icmp6_send_nsol(net, &dst, ip, 0);
+}
+
+/* Drop what has expired, and solicit what is being resolved, is stale, or is
+   about to stop being reachable while still in use. */
 void net_ndp_gc(void) {
+    struct {
+        netif_t *net;
+        struct in6_addr ip;
+    } q[NDP_MAX_QUERIES];
+    struct ndp_list dead = LIST_HEAD_INITIALIZER(dead);
     ndp_entry_t *i, *tmp;
     uint64_t now = timer_ms_gettime64();
+    irq_mask_t flags;
+    int b, n = 0;
 
-    i = LIST_FIRST(&ndp_cache);
+    for(b = 0; b < NDP_HASH_SIZE; ++b) {
+        flags = irq_disable();
 
-    while(i) {
-        tmp = LIST_NEXT(i, entry);
+        i = LIST_FIRST(&ndp_cache[b]);
 
-        /* If we haven't gotten a reachable confirmation within 10 minutes, its
-           pretty safe to remove it. Also, remove any incomplete entries that
-           are still incomplete after a few seconds have passed. */
-        if(i->last_reachable + 600000 < now ||
-                (i->state == NDP_STATE_INCOMPLETE &&
-                 i->last_reachable + 2000 < now)) {
-            LIST_REMOVE(i, entry);
+        while(i) {
+            tmp = LIST_NEXT(i, entry);
 
-            if(i->pkt) {
-                free(i->pkt);
-                free(i->data);
+            if(i->state == NDP_STATE_INCOMPLETE) {
+                if(now >= i->queried + NDP_RETRY) {
+                    if(i->tries >= NDP_MAX_TRIES) {
+                        LIST_REMOVE(i, entry);
+                        LIST_INSERT_HEAD(&dead, i, entry);
+                    }
+                    else if(n < NDP_MAX_QUERIES) {
+                        q[n].net = i->net;
+                        q[n++].ip = i->ip;
+                        i->queried = now;
+                        ++i->tries;
+                    }
+                }
+            }
+            else if(i->last_reachable + NDP_LIFETIME < now) {
+                /* If we haven't gotten a reachable confirmation within 10
+                   minutes, its pretty safe to remove it. */
+                LIST_REMOVE(i, entry);
+                LIST_INSERT_HEAD(&dead, i, entry);
+            }
+            else if((i->state == NDP_STATE_STALE ||
+                     now >= i->last_reachable + NDP_REACHABLE - NDP_REFRESH) &&
+                    i->used > i->last_reachable && i->net &&
+                    now >= i->queried + NDP_RETRY && n < NDP_MAX_QUERIES) {
+                q[n].net = i->net;
+                q[n++].ip = i->ip;
+                i->queried = now;
             }
 
-            free(i);
+            i = tmp;
         }
 
-        i = tmp;
+        irq_restore(flags);
     }
+
+    for(b = 0; b < n; ++b)
+        net_ndp_send_sol(q[b].net, &q[b].ip);
+
+    while((i = LIST_FIRST(&dead))) {
+        LIST_REMOVE(i, entry);
+        ndp_free(i);
+    }
+}
+
+static void net_ndp_timer(void *data) {
+    (void)data;
+    net_ndp_gc();
 }
 
 int net_ndp_insert(netif_t *net, const uint8_t mac[6], const struct in6_addr *ip,
                    int unsol) {
-    ndp_entry_t *i;
+    struct ndp_pending_list pending = TAILQ_HEAD_INITIALIZER(pending);
+    ndp_entry_t *i, *nent = NULL;
+    ndp_pending_t *p;
     uint64_t now = timer_ms_gettime64();
+    irq_mask_t flags;
 
     /* Don't allow any multicast or unspecified addresses to end up in the NDP
        cache... */
@@ -85,161 +230,191 @@ int net_ndp_insert(netif_t *net, const uint8_t mac[6], const struct in6_addr *ip
         return -1;
     }
 
-    /* Look through the list first to see if its there */
-    LIST_FOREACH(i, &ndp_cache, entry) {
-        if(!memcmp(ip, &i->ip, sizeof(struct in6_addr))) {
-            /* We found it, update everything */
-            if(unsol && memcmp(i->mac, mac, 6)) {
-                i->state = NDP_STATE_STALE;
-            }
-            else {
-                i->state = NDP_STATE_REACHABLE;
-            }
+    flags = irq_disable();
 
-            memcpy(i->mac, mac, 6);
-            i->last_reachable = now;
+    /* Look through the cache first to see if its there */
+    if((i = ndp_find(ip))) {
+        /* We found it, update everything */
+        if(unsol && memcmp(i->mac, mac, 6)) {
+            i->state = NDP_STATE_STALE;
+        }
+        else {
+            i->state = NDP_STATE_REACHABLE;
+        }
+    }
+    else {
+        irq_restore(flags);
 
-            /* Send our queued packet, if we have one */
-            if(i->pkt) {
-                net_ipv6_send_packet(net, i->pkt, i->data, i->data_size);
-                free(i->pkt);
-                free(i->data);
+        /* No entry exists yet, so create one */
+        if(!(nent = ndp_alloc())) {
+            return -1;
+        }
 
-                i->pkt = NULL;
-                i->data = NULL;
-                i->data_size = 0;
-            }
+        flags = irq_disable();
 
-            return 0;
+        if(!(i = ndp_find(ip))) {
+            i = nent;
+            nent = NULL;
+            memcpy(&i->ip, ip, sizeof(struct in6_addr));
+            LIST_INSERT_HEAD(ndp_bucket(ip), i, entry);
         }
-    }
 
-    /* No entry exists yet, so create one */
-    if(!(i = (ndp_entry_t *)malloc(sizeof(ndp_entry_t)))) {
-        return -1;
+        if(unsol) {
+            i->state = NDP_STATE_STALE;
+        }
+        else {
+            i->state = NDP_STATE_REACHABLE;
+        }
     }
 
-    memset(i, 0, sizeof(ndp_entry_t));
-    memcpy(&i->ip, ip, sizeof(struct in6_addr));
     memcpy(i->mac, mac, 6);
     i->last_reachable = now;
+    i->queried = 0;
+    i->tries = 0;
 
-    if(unsol) {
-        i->state = NDP_STATE_STALE;
-    }
-    else {
-        i->state = NDP_STATE_REACHABLE;
-    }
+    if(!i->net)
+        i->net = net;
 
-    LIST_INSERT_HEAD(&ndp_cache, i, entry);
+    /* Take the queued packets, to send them once interrupts are back on */
+    TAILQ_CONCAT(&pending, &i->pending, list);
+    i->npending = 0;
 
-    /* Garbage collect! */
-    net_ndp_gc();
-
-    return 0;
-}
+    irq_restore(flags);
 
-/* Set up and send a neighbor solicitation about the specified address */
-static void net_ndp_send_sol(netif_t *net, const struct in6_addr *ip) {
-    struct in6_addr dst = *ip;
+    free(nent);
 
-    /* Send to the solicited nodes multicast group for the specified addr */
-    dst.s6_addr[0] = 0xFF;
-    dst.s6_addr[1] = 0x02;
-    dst.__s6_addr.__s6_addr16[1] = 0x0000;
-    dst.__s6_addr.__s6_addr16[2] = 0x0000;
-    dst.__s6_addr.__s6_addr16[3] = 0x0000;
-    dst.__s6_addr.__s6_addr16[4] = 0x0000;
-    dst.s6_addr[10] = 0x00;
-    dst.s6_addr[11] = 0x01;
-    dst.s6_addr[12] = 0xFF;
+    while((p = TAILQ_FIRST(&pending))) {
+        TAILQ_REMOVE(&pending, p, list);
+        net_ipv6_send_packet(net, &p->hdr, p->data, p->data_size);
+        free(p);
+    }
 
-    net_icmp6_send_nsol(net, &dst, ip, 0);
+    return 0;
 }
 
 int net_ndp_lookup(netif_t *net, const struct in6_addr *ip, uint8_t mac_out[6],
                    const ipv6_hdr_t *pkt, const uint8_t *data, int data_size) {
-    ndp_entry_t *i;
+    ndp_entry_t *i, *nent = NULL;
+    ndp_pending_t *p = NULL;
     uint64_t now = timer_ms_gettime64();
+    irq_mask_t flags;
+    int query = 0, rv;
+
+    flags = irq_disable();
+
+    /* Look for the entry. Stale entries are still used, the cache timer takes
+       care of checking on them. */
+    if((i = ndp_find(ip)) && i->state != NDP_STATE_INCOMPLETE) {
+        memcpy(mac_out, i->mac, 6);
+        i->used = now;
+        irq_restore(flags);
+        return 0;
+    }
 
-    /* Garbage collect, so we don't end up returning really stale entries */
-    net_ndp_gc();
-
-    /* Look for the entry */
-    LIST_FOREACH(i, &ndp_cache, entry) {
-        if(!memcmp(ip, &i->ip, sizeof(struct in6_addr))) {
-            if(i->state == NDP_STATE_INCOMPLETE) {
-                memset(mac_out, 0, 6);
-                return -1;
-            }
-            else if(i->state == NDP_STATE_STALE) {
-                net_ndp_send_sol(net, ip);
-            }
+    irq_restore(flags);
 
-            memcpy(mac_out, i->mac, 6);
-            return 0;
-        }
+    /* Copy our packet if we have one to copy, and make an entry if there
+       wasn't one, before looking again with interrupts disabled. */
+    if(pkt && data && data_size &&
+       (p = (ndp_pending_t *)malloc(sizeof(ndp_pending_t) + data_size))) {
+        memcpy(&p->hdr, pkt, sizeof(ipv6_hdr_t));
+        memcpy(p->data, data, data_size);
+        p->data_size = data_size;
     }
 
-    /* Its not there, add an incomplete entry and solicit the info */
-    if(!(i = (ndp_entry_t *)malloc(sizeof(ndp_entry_t)))) {
+    if(!i && !(nent = ndp_alloc())) {
+        free(p);
         return -1;
     }
 
-    memset(i, 0, sizeof(ndp_entry_t));
-    memcpy(&i->ip, ip, sizeof(struct in6_addr));
-    i->last_reachable = now;
-    i->state = NDP_STATE_INCOMPLETE;
+    flags = irq_disable();
 
-    /* Copy our packet if we have one to copy. */
-    if(pkt && data && data_size) {
-        i->data = (uint8_t *)malloc(data_size);
+    if(!(i = ndp_find(ip))) {
+        /* Its not there, add an incomplete entry and solicit the info */
+        i = nent;
+        nent = NULL;
+        memcpy(&i->ip, ip, sizeof(struct in6_addr));
+        i->last_reachable = now;
+        i->state = NDP_STATE_INCOMPLETE;
+        LIST_INSERT_HEAD(ndp_bucket(ip), i, entry);
+    }
 
-        if(i->data) {
-            i->pkt = (ipv6_hdr_t *)malloc(sizeof(ipv6_hdr_t));
+    if(i->state != NDP_STATE_INCOMPLETE) {
+        /* The advertisement came in while we weren't looking. */
+        memcpy(mac_out, i->mac, 6);
+        i->used = now;
+        irq_restore(flags);
+        free(nent);
+        free(p);
+        return 0;
+    }
 
-            if(!i->pkt) {
-                free(i->data);
-                i->data = NULL;
-            }
-            else {
-                memcpy(i->pkt, pkt, sizeof(ipv6_hdr_t));
-                memcpy(i->data, data, data_size);
-                i->data_size = data_size;
-            }
-        }
+    if(!i->queried) {
+        i->queried = now;
+        i->tries = 1;
+        query = 1;
+    }
+
+    i->net = net;
+    i->used = now;
+
+    if(p && i->npending < NDP_MAX_PENDING) {
+        TAILQ_INSERT_TAIL(&i->pending, p, list);
+        ++i->npending;
+        p = NULL;
+        rv = -2;
     }
+    else {
+        rv = query ? -2 : -1;
+    }
+
+    irq_restore(flags);
 
-    LIST_INSERT_HEAD(&ndp_cache, i, entry);
+    free(nent);
+    free(p);
 
-    net_ndp_send_sol(net, ip);
+    if(query)
+        net_ndp_send_sol(net, ip);
 
     memset(mac_out, 0, 6);
-    return -2;
+    return rv;
 }
 
 int net_ndp_init(void) {
+    int i;
+
+    for(i = 0; i < NDP_HASH_SIZE; ++i)
+        LIST_INIT(&ndp_cache[i]);
+
+    ndp_cb_id = net_thd_add_callback(net_ndp_timer, NULL, NDP_TIMER);
+
+    if(ndp_cb_id < 0)
+        return -1;
+
     return 0;
 }
 
 void net_ndp_shutdown(void) {
     /* Free all entries */
     ndp_entry_t *i, *tmp;
+    int b;
 
-    i = LIST_FIRST(&ndp_cache);
+    if(ndp_cb_id >= 0) {
+        net_thd_del_callback(ndp_cb_id);
+        ndp_cb_id = -1;
+    }
 
-    while(i) {
-        tmp = LIST_NEXT(i, entry);
+    for(b = 0; b < NDP_HASH_SIZE; ++b) {
+        i = LIST_FIRST(&ndp_cache[b]);
 
-        if(i->pkt) {
-            free(i->pkt);
-            free(i->data);
+        while(i) {
+            tmp = LIST_NEXT(i, entry);
+            ndp_free(i);
+            i = tmp;
         }
 
-        free(i);
-        i = tmp;
+        /* Reinit the list to the clean state, in case we call net_ndp_init
+           later */
+        LIST_INIT(&ndp_cache[b]);
     }
-
-    /* Reinit the list to the clean state, in case we call net_ndp_init later */
-    LIST_INIT(&ndp_cache);
 }
@@ -80,15 +80,24 @@
    only partially-created). This simplifies the procedure for finding matching
    sockets for incoming packets, since this makes sure that the fully-created
    socket will be found first if it exists when simply iterating through the
-   list of sockets.
+   list of sockets. To keep from going through every socket for every segment,
+   sockets are also kept in a hash table, where connected sockets are found by
+   both ends of the connection and the others by their local port. The lookup
+   tries the connection first and falls back to the local port, which gives
+   the same answer as the list would.
 
    On what's actually here:
-   I didn't bother implementing any TCP extensions beyond RFC 793. That means
-   that I just ignore things like the timestamp option and the selective
-   acknowledgement option. That also means that the window size maxes out at
-   65535. Some extensions may be implemented in the future, if I see fit to do
-   so. That all said, everything in here works just fine over IPv4 or IPv6, and
-   can be used just fine to communicate with "normal" TCP/IP implementations.
+   Beyond RFC 793, the window scale and timestamp options of RFC 7323 and the
+   selective acknowledgement option of RFC 2018 are supported, if the other
+   side agrees to them on the SYN. Window scaling lets the window go past 65535
+   bytes with a large enough SO_RCVBUF, set before connecting or listening.
+   Timestamps are only used to measure the round trip time, which sets the
+   retransmission timeout. Out of order data is kept in the receive buffer
+   (past the in-order data, where it will end up anyway) and reported with
+   SACK blocks. On the sending side, SACKed data is tracked in a small
+   scoreboard and retransmissions skip it. There is no congestion control. That
+   all said, everything in here works just fine over IPv4 or IPv6, and can be
+   used just fine to communicate with "normal" TCP/IP implementations.
 */
 
 typedef struct tcp_hdr {
@@ -111,7 +120,19 @@ struct lsock {
     struct sockaddr_in6 remote_addr;
     uint32_t isn;
     uint32_t wnd;
+    uint32_t ts_recent;
     uint16_t mss;
+    uint8_t opts;
+    uint8_t wscale;
+};
+
+/* Number of SACK blocks kept, on either side of a connection */
+#define TCP_SACK_BLOCKS     4
+
+/* A SACKed range of sequence numbers, [start, end) */
+struct tcp_sack {
+    uint32_t start;
+    uint32_t end;
 };
 
 /* Send/receive variables... */
@@ -124,6 +145,13 @@ struct sndrec {
     uint32_t wl2;
     uint32_t iss;
     uint16_t mss;
+    uint8_t wscale;
+    uint8_t dupacks;
+    int32_t srtt;                       /* In 1/8 ms */
+    int32_t rttvar;                     /* In 1/4 ms */
+    uint32_t rto;
+    int nsack;
+    struct tcp_sack sack[TCP_SACK_BLOCKS];
 };
 
 struct rcvrec {
@@ -131,10 +159,15 @@ struct rcvrec {
     uint32_t wnd;
     uint32_t up;
     uint32_t irs;
+    uint32_t ts_recent;
+    uint8_t wscale;
+    int nsack;
+    struct tcp_sack sack[TCP_SACK_BLOCKS];
 };
 
 struct tcp_sock {
     LIST_ENTRY(tcp_sock) sock_list;
+    LIST_ENTRY(tcp_sock) hash_list;
     struct sockaddr_in6 local_addr;
     struct sockaddr_in6 remote_addr;
 
@@ -171,6 +204,7 @@ struct tcp_sock {
             uint32_t sndbuf_acked;
             uint32_t sndbuf_tail;
             uint64_t timer;
+            uint8_t opts;
             condvar_t send_cv;
             condvar_t recv_cv;
         } data;
@@ -181,12 +215,23 @@ LIST_HEAD(tcp_sock_list, tcp_sock);
 
 static struct tcp_sock_list tcp_socks = LIST_HEAD_INITIALIZER(0);
 static rw_semaphore_t tcp_sem = RWSEM_INITIALIZER;
+static net_tcp_stats_t tcp_stats = { 0 };
 static int thd_cb_id = 0;
 
+/* Sockets by the addresses incoming segments are matched on, so that finding
+   the socket of a segment doesn't mean going through the whole list. Sockets
+   with a remote end are hashed by (remote address, remote port, local port),
+   the others (listening or not yet connected) by their local port alone. */
+#define TCP_HASH_BITS   6
+static struct tcp_sock_list tcp_hash[1 << TCP_HASH_BITS];
+
 /* Default starting window size for connections. This should be big enough as a
    starting point, in general. If you need to adjust it, you can do so... */
 #define TCP_DEFAULT_WINDOW  8192
 
+/* Largest send or receive buffer SO_SNDBUF/SO_RCVBUF will set up. */
+#define TCP_MAX_BUFFER      (1024 * 1024)
+
 /* Default MSS */
 #define TCP_DEFAULT_MSS     1460
 
@@ -194,8 +239,14 @@ static int thd_cb_id = 0;
    to be 15 seconds, since that's what Mac OS X does. */
 #define TCP_DEFAULT_MSL     15000
 
-/* Default retransmission timeout (in milliseconds). */
+/* Default retransmission timeout (in milliseconds), used until the round trip
+   time has been measured, and the bounds of the measured one. */
 #define TCP_DEFAULT_RTTO    2000
+#define TCP_MIN_RTTO        200
+#define TCP_MAX_RTTO        60000
+
+/* Number of duplicate ACKs that trigger a fast retransmit. */
+#define TCP_DUPACK_THRESH   3
 
 /* Default hop limit (or ttl for IPv4) for new sockets */
 #define TCP_DEFAULT_HOPS    64
@@ -230,10 +281,38 @@ static int thd_cb_id = 0;
 #define TCP_IFLAG_CANBEDEL      0x00000001
 #define TCP_IFLAG_QUEUEDCLOSE   0x00000002
 #define TCP_IFLAG_ACCEPTWAIT    0x00000004
+#define TCP_IFLAG_DELACK        0x00000008
 
 #define TCP_OPT_EOL             0
 #define TCP_OPT_NOP             1
 #define TCP_OPT_MSS             2
+#define TCP_OPT_WS              3
+#define TCP_OPT_SACK_PERM       4
+#define TCP_OPT_SACK            5
+#define TCP_OPT_TS              8
+
+/* Most option bytes a header can carry */
+#define TCP_MAX_OPTS            40
+
+/* Largest window shift allowed by RFC 7323 */
+#define TCP_MAX_WSCALE          14
+
+/* Options agreed on with the other side on the SYN */
+#define TCP_OFLAG_WS            0x01
+#define TCP_OFLAG_SACK          0x02
+#define TCP_OFLAG_TS            0x04
+#define TCP_OFLAG_ALL           (TCP_OFLAG_WS | TCP_OFLAG_SACK | TCP_OFLAG_TS)
+
+/* Options gathered from an incoming segment */
+struct tcp_opts {
+    uint16_t mss;
+    uint8_t flags;
+    uint8_t wscale;
+    uint32_t tsval;
+    uint32_t tsecr;
+    int nsack;
+    struct tcp_sack sack[TCP_SACK_BLOCKS];
+};
 
 /* A few macros for comparing sequence numbers */
 #define SEQ_LT(x, y)    (((int32_t)((x) - (y))) < 0)
@@ -254,6 +333,92 @@ static void tcp_send_ack(struct tcp_sock *sock);
 static void tcp_send_data(struct tcp_sock *sock, int resend);
 static void tcp_send_fin_ack(struct tcp_sock *sock);
 
+extern void __poll_event_trigger(int fd, short event);
+
+static inline struct tcp_sock_list *tcp_bucket(const struct in6_addr *raddr,
+                                               uint16_t rport,
+                                               uint16_t lport) {
+    uint32_t h = raddr->__s6_addr.__s6_addr32[0] ^
+                 raddr->__s6_addr.__s6_addr32[1] ^
+                 raddr->__s6_addr.__s6_addr32[2] ^
+                 raddr->__s6_addr.__s6_addr32[3] ^
+                 ((uint32_t)rport << 16 | lport);
+
+    return &tcp_hash[(h * 0x9E3779B1u) >> (32 - TCP_HASH_BITS)];
+}
+
+/* Put a socket in the bucket for the addresses it has now. Assumes the write
+   lock is held. */
+static void tcp_hash_insert(struct tcp_sock *sock) {
+    if(IN6_IS_ADDR_UNSPECIFIED(&sock->remote_addr.sin6_addr))
+        LIST_INSERT_HEAD(tcp_bucket(&in6addr_any, 0,
+                                    sock->local_addr.sin6_port),
+                         sock, hash_list);
+    else
+        LIST_INSERT_HEAD(tcp_bucket(&sock->remote_addr.sin6_addr,
+                                    sock->remote_addr.sin6_port,
+                                    sock->local_addr.sin6_port),
+                         sock, hash_list);
+}
+
+/* Move a socket to the right bucket after its addresses changed. */
+static void tcp_rehash(struct tcp_sock *sock) {
+    LIST_REMOVE(sock, hash_list);
+    tcp_hash_insert(sock);
+}
+
+/* Whether the data part of the socket is in use, with its buffers allocated */
+#define TCP_HAS_BUFFERS(s) \
+    (((s)->state & 0x0F) != TCP_STATE_LISTEN && (s)->data.rcvbuf)
+
+/* Pick the window shift we ask for, so that a receive buffer of the given
+   size can be advertised in full. */
+static uint8_t tcp_wscale(uint32_t sz) {
+    uint8_t shift = 0;
+
+    while(shift < TCP_MAX_WSCALE && (sz >> shift) > 65535)
+        ++shift;
+
+    return shift;
+}
+
+/* How far past the in-order data out of order data goes in the receive
+   buffer. */
+static uint32_t tcp_ooo_extent(const struct tcp_sock *s) {
+    uint32_t rv = 0;
+    int i;
+
+    for(i = 0; i < s->data.rcv.nsack; ++i) {
+        if(s->data.rcv.sack[i].end - s->data.rcv.nxt > rv)
+            rv = s->data.rcv.sack[i].end - s->data.rcv.nxt;
+    }
+
+    return rv;
+}
+
+/* Move the used part of a ring buffer to the start of a new buffer of another
+   size, and free the old one. */
+static uint8_t *tcp_ring_resize(uint8_t *buf, uint32_t sz, uint32_t head,
+                                uint32_t used, uint32_t new_sz) {
+    uint8_t *rv;
+    uint32_t tmp;
+
+    if(!(rv = (uint8_t *)malloc(new_sz)))
+        return NULL;
+
+    if(head + used <= sz) {
+        memcpy(rv, buf + head, used);
+    }
+    else {
+        tmp = sz - head;
+        memcpy(rv, buf + head, tmp);
+        memcpy(rv + tmp, buf, used - tmp);
+    }
+
+    free(buf);
+    return rv;
+}
+
 /* Sockets interface... */
 static int net_tcp_socket(net_socket_t *hnd, int domain, int type, int proto) {
     struct tcp_sock *sock;
@@ -288,6 +453,7 @@ static int net_tcp_socket(net_socket_t *hnd, int domain, int type, int proto) {
     hnd->data = sock;
 
     LIST_INSERT_HEAD(&tcp_socks, sock, sock_list);
+    tcp_hash_insert(sock);
     rwsem_write_unlock(&tcp_sem);
 
     return 0;
@@ -440,6 +606,7 @@ retry:
 
 ret_remove:
     LIST_REMOVE(sock, sock_list);
+    LIST_REMOVE(sock, hash_list);
     mutex_unlock(&sock->mutex);
     mutex_destroy(&sock->mutex);
     free(sock);
@@ -515,6 +682,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
             free(sock->listen.queue);
             cond_destroy(&sock->listen.cv);
             LIST_REMOVE(sock, sock_list);
+            LIST_REMOVE(sock, hash_list);
             mutex_unlock(&sock->mutex);
             mutex_destroy(&sock->mutex);
             free(sock);
@@ -708,8 +876,15 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
     sock2->data.snd.wnd = lsock.wnd;
     sock2->data.snd.wl1 = sock2->data.snd.iss;
     sock2->data.snd.mss = lsock.mss;
+    sock2->data.snd.wscale = lsock.wscale;
+    sock2->data.snd.rto = TCP_DEFAULT_RTTO;
     sock2->data.rcv.nxt = lsock.isn + 1;
     sock2->data.rcv.irs = lsock.isn;
+    sock2->data.rcv.ts_recent = lsock.ts_recent;
+    sock2->data.opts = lsock.opts;
+
+    if(lsock.opts & TCP_OFLAG_WS)
+        sock2->data.rcv.wscale = tcp_wscale(sock2->rcvbuf_sz);
 
     /* Since nothing else has a pointer to this socket, this will not fail. */
     mutex_trylock(&sock2->mutex);
@@ -719,6 +894,7 @@ static int net_tcp_accept(net_socket_t *hnd, struct sockaddr *addr,
     sock2->data.timer = timer_ms_gettime64();
     fd = sock2->sock;
     LIST_INSERT_HEAD(&tcp_socks, sock2, sock_list);
+    tcp_hash_insert(sock2);
     mutex_unlock(&sock2->mutex);
 
     sock->state &= ~TCP_STATE_ACCEPTING;
@@ -870,6 +1046,8 @@ static int net_tcp_bind(net_socket_t *hnd, const struct sockaddr *addr,
         sock->local_addr.sin6_port = htons(port);
     }
 
+    tcp_rehash(sock);
+
     /* Release the locks, we're done */
     mutex_unlock(&sock->mutex);
     rwsem_write_unlock(&tcp_sem);
@@ -1009,6 +1187,7 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
     /* Set the remote address on the socket and go to the SYN-SENT state (this
        includes setting up all the data we need for that). */
     sock->remote_addr = realaddr6;
+    tcp_rehash(sock);
 
     if(!(sock->data.rcvbuf = (uint8_t *)malloc(sock->rcvbuf_sz))) {
         errno = ENOBUFS;
@@ -1045,8 +1224,11 @@ static int net_tcp_connect(net_socket_t *hnd, const struct sockaddr *addr,
     }
 
     sock->data.rcv.wnd = sock->rcvbuf_sz;
+    sock->data.rcv.wscale = tcp_wscale(sock->rcvbuf_sz);
     sock->data.rcvbuf_head = sock->data.rcvbuf_tail = 0;
     sock->data.net = net_default_dev;
+    sock->data.opts = 0;
+    sock->data.snd.rto = TCP_DEFAULT_RTTO;
     sock->data.snd.iss = timer_us_gettime64() >> 2;
     sock->data.snd.una = sock->data.snd.iss;
     sock->data.snd.nxt = sock->data.snd.iss + 1;
@@ -1577,6 +1759,7 @@ static int net_tcp_setsockopt(net_socket_t *hnd, int level, int option_name,
                               const void *option_value, socklen_t option_len) {
     struct tcp_sock *sock;
     int tmp;
+    uint32_t used, sent;
     uint8_t *new_ptr;
 
     if(!option_value || !option_len) {
@@ -1600,18 +1783,44 @@ static int net_tcp_setsockopt(net_socket_t *hnd, int level, int option_name,
                         goto ret_inval;
 
                     tmp = *(uint32_t *)option_value;
-                    /* Receive buffer size must be in the range 256 - 65535 */
+                    /* Receive buffer size must be in the range 256 -
+                       TCP_MAX_BUFFER. Anything past 65535 only gets used if
+                       the window scale option was agreed on. */
                     if(tmp < 256)
                         tmp = 256;
-                    else if(tmp > 65535)
-                        tmp = 65535;
+                    else if(tmp > TCP_MAX_BUFFER)
+                        tmp = TCP_MAX_BUFFER;
+
+                    /* Sockets that aren't connected yet have no buffer, it
+                       will be allocated with the new size later on. */
+                    if(!TCP_HAS_BUFFERS(sock)) {
+                        sock->rcvbuf_sz = tmp;
+                        goto ret_success;
+                    }
+
+                    /* Don't lose anything that's queued, in order or not. */
+                    used = sock->data.rcvbuf_cur_sz + tcp_ooo_extent(sock);
+
+                    if((uint32_t)tmp < used)
+                        tmp = used;
 
-                    new_ptr = realloc(sock->data.rcvbuf, tmp);
+                    new_ptr = tcp_ring_resize(sock->data.rcvbuf,
+                                              sock->rcvbuf_sz,
+                                              sock->data.rcvbuf_head, used,
+                                              tmp);
                     if(!new_ptr)
                         goto ret_nomem;
 
                     sock->data.rcvbuf = new_ptr;
+                    sock->data.rcvbuf_head = 0;
+                    sock->data.rcvbuf_tail = sock->data.rcvbuf_cur_sz;
+                    sock->data.rcv.wnd = tmp - sock->data.rcvbuf_cur_sz;
                     sock->rcvbuf_sz = tmp;
+
+                    /* Let the other side know about the new window. */
+                    if(sock->state == TCP_STATE_ESTABLISHED)
+                        tcp_send_ack(sock);
+
                     goto ret_success;
 
                 case SO_SNDBUF:
@@ -1619,19 +1828,51 @@ static int net_tcp_setsockopt(net_socket_t *hnd, int level, int option_name,
                         goto ret_inval;
 
                     tmp = *(uint32_t *)option_value;
-                    /* Send buffer size must be in the range 2048 - 65535 */
+                    /* Send buffer size must be in the range 2048 -
+                       TCP_MAX_BUFFER */
                     if(tmp < 2048)
                         tmp = 2048;
-                    else if(tmp > 65535)
-                        tmp = 65535;
+                    else if(tmp > TCP_MAX_BUFFER)
+                        tmp = TCP_MAX_BUFFER;
 
-                    new_ptr = realloc(sock->data.sndbuf, tmp);
-                    if(!new_ptr) {
-                        goto ret_nomem;
+                    if(!TCP_HAS_BUFFERS(sock)) {
+                        sock->sndbuf_sz = tmp;
+                        goto ret_success;
                     }
 
+                    /* Everything from the oldest unacknowledged byte on has
+                       to be kept. Work out how much of it was sent before
+                       moving it. */
+                    used = sock->data.sndbuf_cur_sz;
+                    sent = sock->data.sndbuf_head + sock->sndbuf_sz -
+                           sock->data.sndbuf_acked;
+
+                    if(sent >= sock->sndbuf_sz)
+                        sent -= sock->sndbuf_sz;
+
+                    if(!sent && used == sock->sndbuf_sz &&
+                       sock->data.snd.nxt != sock->data.snd.una)
+                        sent = used;
+
+                    if((uint32_t)tmp < used)
+                        tmp = used;
+
+                    new_ptr = tcp_ring_resize(sock->data.sndbuf,
+                                              sock->sndbuf_sz,
+                                              sock->data.sndbuf_acked, used,
+                                              tmp);
+                    if(!new_ptr)
+                        goto ret_nomem;
+
                     sock->data.sndbuf = new_ptr;
+                    sock->data.sndbuf_acked = 0;
+                    sock->data.sndbuf_head = sent == (uint32_t)tmp ? 0 : sent;
+                    sock->data.sndbuf_tail = used == (uint32_t)tmp ? 0 : used;
                     sock->sndbuf_sz = tmp;
+
+                    /* There may be room for more data now. */
+                    __poll_event_trigger(sock->sock, POLLWRNORM | POLLWRBAND);
+                    cond_signal(&sock->data.send_cv);
                     goto ret_success;
             }
 
@@ -1990,6 +2231,19 @@ static short net_tcp_poll(net_socket_t *hnd, short events) {
     return rv & (events | POLLHUP | POLLERR);
 }
 
+/* Send a segment, counting it in the stats. */
+static int tcp_xmit(netif_t *net, const uint8_t *data, size_t size, int hops,
+                    const struct in6_addr *src, const struct in6_addr *dst) {
+    int rv = net_ipv6_send(net, data, size, hops, IPPROTO_TCP, src, dst);
+
+    if(rv)
+        ++tcp_stats.pkt_send_failed;
+    else
+        ++tcp_stats.pkt_sent;
+
+    return rv;
+}
+
 static void tcp_rst(netif_t *net, const struct in6_addr *src,
                     const struct in6_addr *dst, uint16_t src_port,
                     uint16_t dst_port, uint16_t flags, uint32_t seq,
@@ -2010,8 +2264,7 @@ static void tcp_rst(netif_t *net, const struct in6_addr *src,
     c = net_ipv6_checksum_pseudo(src, dst, sizeof(tcp_hdr_t), IPPROTO_TCP);
     pkt.checksum = net_ipv4_checksum((const uint8_t *)&pkt, sizeof(tcp_hdr_t), c);
 
-    net_ipv6_send(net, (const uint8_t *)&pkt, sizeof(tcp_hdr_t), 0, IPPROTO_TCP,
-                  src, dst);
+    tcp_xmit(net, (const uint8_t *)&pkt, sizeof(tcp_hdr_t), 0, src, dst);
 }
 
 static void tcp_bpkt_rst(netif_t *net, const struct in6_addr *src,
@@ -2051,114 +2304,277 @@ static void tcp_bpkt_rst(netif_t *net, const struct in6_addr *src,
     pkt.checksum = net_ipv4_checksum((const uint8_t *)&pkt, sizeof(tcp_hdr_t),
                                      cs);
 
-    net_ipv6_send(net, (const uint8_t *)&pkt, sizeof(tcp_hdr_t), 0, IPPROTO_TCP,
-                  dst, src);
+    tcp_xmit(net, (const uint8_t *)&pkt, sizeof(tcp_hdr_t), 0, dst, src);
+}
+
+static inline void tcp_put32(uint8_t *p, uint32_t v) {
+    p[0] = (v >> 24) & 0xFF;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+static inline uint32_t tcp_get32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* Clock of the timestamp option, in milliseconds */
+static inline uint32_t tcp_ts_now(void) {
+    return (uint32_t)timer_ms_gettime64();
+}
+
+/* Put a timestamp option, echoing the last one we got. */
+static int tcp_put_ts(struct tcp_sock *sock, uint8_t *opt) {
+    opt[0] = TCP_OPT_NOP;
+    opt[1] = TCP_OPT_NOP;
+    opt[2] = TCP_OPT_TS;
+    opt[3] = 10;
+    tcp_put32(opt + 4, tcp_ts_now());
+    tcp_put32(opt + 8, sock->data.rcv.ts_recent);
+
+    return 12;
+}
+
+/* Fill in the options of a segment on a synchronized connection: the timestamp
+   and SACK blocks for any out of order data we hold, as far as they were
+   agreed on. Returns the length of the options. */
+static int tcp_put_opts(struct tcp_sock *sock, uint8_t *opt) {
+    int len = 0, i, n;
+
+    if(sock->data.opts & TCP_OFLAG_TS)
+        len = tcp_put_ts(sock, opt);
+
+    if((sock->data.opts & TCP_OFLAG_SACK) && (n = sock->data.rcv.nsack)) {
+        if(n > (TCP_MAX_OPTS - len - 4) / 8)
+            n = (TCP_MAX_OPTS - len - 4) / 8;
+
+        opt[len++] = TCP_OPT_NOP;
+        opt[len++] = TCP_OPT_NOP;
+        opt[len++] = TCP_OPT_SACK;
+        opt[len++] = 2 + n * 8;
+
+        for(i = 0; i < n; ++i) {
+            tcp_put32(opt + len, sock->data.rcv.sack[i].start);
+            tcp_put32(opt + len + 4, sock->data.rcv.sack[i].end);
+            len += 8;
+        }
+    }
+
+    return len;
+}
+
+/* The window to advertise, scaled down if need be. */
+static inline uint16_t tcp_adv_wnd(const struct tcp_sock *sock) {
+    uint32_t wnd = sock->data.rcv.wnd >> sock->data.rcv.wscale;
+
+    return htons(wnd > 65535 ? 65535 : wnd);
 }
 
 static int tcp_send_syn(struct tcp_sock *sock, int ack) {
-    uint8_t rawpkt[sizeof(tcp_hdr_t) + 4];
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_MAX_OPTS];
     tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
+    uint8_t opts, *opt = hdr->options;
+    int len = sizeof(tcp_hdr_t) + 4;
     uint16_t cs;
 
+    /* Offer every option on a <SYN>, only agree to whatever the other side
+       offered on a <SYN,ACK>. */
+    opts = ack ? sock->data.opts : TCP_OFLAG_ALL;
+
     /* Fill in the base packet */
     hdr->src_port = sock->local_addr.sin6_port;
     hdr->dst_port = sock->remote_addr.sin6_port;
     hdr->seq = htonl(sock->data.snd.iss);
     hdr->ack = htonl(sock->data.rcv.nxt);
 
-    if(ack) {
-        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_FLAG_ACK | TCP_OFFSET(6));
+    /* The window on a SYN is never scaled. */
+    hdr->wnd = htons(sock->data.rcv.wnd > 65535 ? 65535 : sock->data.rcv.wnd);
+    hdr->checksum = 0;
+    hdr->urg = 0;
+
+    /* Fill in our SYN options, starting with the MSS. */
+    opt[0] = TCP_OPT_MSS;
+    opt[1] = 4;
+    opt[2] = (TCP_DEFAULT_MSS >> 8) & 0xFF;
+    opt[3] = TCP_DEFAULT_MSS & 0xFF;
+
+    if(opts & TCP_OFLAG_WS) {
+        opt = rawpkt + len;
+        opt[0] = TCP_OPT_NOP;
+        opt[1] = TCP_OPT_WS;
+        opt[2] = 3;
+        opt[3] = sock->data.rcv.wscale;
+        len += 4;
     }
-    else {
-        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_OFFSET(6));
+
+    if(opts & TCP_OFLAG_SACK) {
+        opt = rawpkt + len;
+        opt[0] = TCP_OPT_NOP;
+        opt[1] = TCP_OPT_NOP;
+        opt[2] = TCP_OPT_SACK_PERM;
+        opt[3] = 2;
+        len += 4;
     }
 
-    hdr->wnd = htons(sock->data.rcv.wnd);
-    hdr->checksum = 0;
-    hdr->urg = 0;
+    if(opts & TCP_OFLAG_TS)
+        len += tcp_put_ts(sock, rawpkt + len);
 
-    /* Fill in our SYN options. The only one we worry about right now is MSS. */
-    hdr->options[0] = TCP_OPT_MSS;
-    hdr->options[1] = 4;
-    hdr->options[2] = (TCP_DEFAULT_MSS >> 8) & 0xFF;
-    hdr->options[3] = TCP_DEFAULT_MSS & 0xFF;
+    if(ack) {
+        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_FLAG_ACK |
+                               TCP_OFFSET(len >> 2));
+    }
+    else {
+        hdr->off_flags = htons(TCP_FLAG_SYN | TCP_OFFSET(len >> 2));
+    }
 
     /* Calculate the real checksum */
     cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
                                   &sock->remote_addr.sin6_addr,
-                                  sizeof(tcp_hdr_t) + 4, IPPROTO_TCP);
-    hdr->checksum = net_ipv4_checksum(rawpkt, sizeof(tcp_hdr_t) + 4, cs);
+                                  len, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, len, cs);
 
-    return net_ipv6_send(sock->data.net, rawpkt, sizeof(tcp_hdr_t) + 4,
-                         sock->hop_limit, IPPROTO_TCP,
-                         &sock->local_addr.sin6_addr,
-                         &sock->remote_addr.sin6_addr);
+    return tcp_xmit(sock->data.net, rawpkt, len, sock->hop_limit,
+                    &sock->local_addr.sin6_addr, &sock->remote_addr.sin6_addr);
 }
 
 static void tcp_send_fin_ack(struct tcp_sock *sock) {
-    uint8_t rawpkt[sizeof(tcp_hdr_t)];
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_MAX_OPTS];
     tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
     uint16_t cs;
+    int len;
+
+    len = sizeof(tcp_hdr_t) + tcp_put_opts(sock, hdr->options);
 
     /* Fill in the base packet */
     hdr->src_port = sock->local_addr.sin6_port;
     hdr->dst_port = sock->remote_addr.sin6_port;
     hdr->seq = htonl(sock->data.snd.nxt);
     hdr->ack = htonl(sock->data.rcv.nxt);
-    hdr->off_flags = htons(TCP_FLAG_FIN | TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr->wnd = htons(sock->data.rcv.wnd);
+    hdr->off_flags = htons(TCP_FLAG_FIN | TCP_FLAG_ACK | TCP_OFFSET(len >> 2));
+    hdr->wnd = tcp_adv_wnd(sock);
     hdr->checksum = 0;
     hdr->urg = 0;
 
     /* Calculate the real checksum */
     cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
                                   &sock->remote_addr.sin6_addr,
-                                  sizeof(tcp_hdr_t), IPPROTO_TCP);
-    hdr->checksum = net_ipv4_checksum(rawpkt, sizeof(tcp_hdr_t), cs);
+                                  len, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, len, cs);
 
-    net_ipv6_send(sock->data.net, rawpkt, sizeof(tcp_hdr_t), sock->hop_limit,
-                  IPPROTO_TCP, &sock->local_addr.sin6_addr,
-                  &sock->remote_addr.sin6_addr);
+    sock->intflags &= ~TCP_IFLAG_DELACK;
+
+    tcp_xmit(sock->data.net, rawpkt, len, sock->hop_limit,
+             &sock->local_addr.sin6_addr, &sock->remote_addr.sin6_addr);
 }
 
 static void tcp_send_ack(struct tcp_sock *sock) {
-    tcp_hdr_t hdr;
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_MAX_OPTS];
+    tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
     uint16_t c;
+    int len;
+
+    len = sizeof(tcp_hdr_t) + tcp_put_opts(sock, hdr->options);
 
     /* Fill in the base packet */
-    hdr.src_port = sock->local_addr.sin6_port;
-    hdr.dst_port = sock->remote_addr.sin6_port;
-    hdr.seq = htonl(sock->data.snd.nxt);
-    hdr.ack = htonl(sock->data.rcv.nxt);
-    hdr.off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr.wnd = htons(sock->data.rcv.wnd);
-    hdr.checksum = 0;
-    hdr.urg = 0;
+    hdr->src_port = sock->local_addr.sin6_port;
+    hdr->dst_port = sock->remote_addr.sin6_port;
+    hdr->seq = htonl(sock->data.snd.nxt);
+    hdr->ack = htonl(sock->data.rcv.nxt);
+    hdr->off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(len >> 2));
+    hdr->wnd = tcp_adv_wnd(sock);
+    hdr->checksum = 0;
+    hdr->urg = 0;
 
     /* Calculate the real checksum */
     c = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
                                  &sock->remote_addr.sin6_addr,
-                                 sizeof(tcp_hdr_t), IPPROTO_TCP);
-    hdr.checksum = net_ipv4_checksum((const uint8_t *)&hdr, sizeof(tcp_hdr_t), c);
+                                 len, IPPROTO_TCP);
+    hdr->checksum = net_ipv4_checksum(rawpkt, len, c);
 
-    net_ipv6_send(sock->data.net, (const uint8_t *)&hdr, sizeof(tcp_hdr_t),
-                  sock->hop_limit, IPPROTO_TCP, &sock->local_addr.sin6_addr,
-                  &sock->remote_addr.sin6_addr);
+    sock->intflags &= ~TCP_IFLAG_DELACK;
+
+    tcp_xmit(sock->data.net, rawpkt, len, sock->hop_limit,
+             &sock->local_addr.sin6_addr, &sock->remote_addr.sin6_addr);
 }
 
-static void tcp_send_data(struct tcp_sock *sock, int resend) {
-    uint32_t wnd = sock->data.snd.wnd, snd;
-    int sz = sizeof(tcp_hdr_t);
-    uint8_t rawpkt[1500];
+/* Acknowledge in-order data. Only every second segment is acknowledged right
+   away, the ACK for a lone one waits for the next run of tcp_thd_cb(), unless
+   we get to send some data to carry it first. */
+static void tcp_ack_data(struct tcp_sock *sock) {
+    if(sock->intflags & TCP_IFLAG_DELACK)
+        tcp_send_ack(sock);
+    else
+        sock->intflags |= TCP_IFLAG_DELACK;
+}
+
+/* Send one segment of at most snd bytes of data, starting with sequence number
+   seq, which is at offset head in the send buffer. Returns the number of bytes
+   actually sent, which the MSS and options may limit. */
+static uint32_t tcp_send_segment(struct tcp_sock *sock, uint32_t seq,
+                                 uint32_t head, uint32_t snd) {
+    uint8_t rawpkt[sizeof(tcp_hdr_t) + TCP_MAX_OPTS + TCP_DEFAULT_MSS];
     tcp_hdr_t *hdr = (tcp_hdr_t *)rawpkt;
+    uint8_t *sb = sock->data.sndbuf + head, *buf;
+    int hlen, olen, sz;
+    uint32_t lim;
     uint16_t cs;
-    uint8_t *sb, *buf;
+
+    olen = tcp_put_opts(sock, hdr->options);
+    hlen = sizeof(tcp_hdr_t) + olen;
+    buf = rawpkt + hlen;
+
+    /* The options come out of the MSS. */
+    lim = sock->data.snd.mss > olen ? sock->data.snd.mss - olen : 1;
+
+    if(snd > lim)
+        snd = lim;
+
+    /* Fill in the base packet */
+    hdr->src_port = sock->local_addr.sin6_port;
+    hdr->dst_port = sock->remote_addr.sin6_port;
+    hdr->seq = htonl(seq);
+    hdr->ack = htonl(sock->data.rcv.nxt);
+    hdr->off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(hlen >> 2));
+    hdr->wnd = tcp_adv_wnd(sock);
+    hdr->checksum = 0;
+    hdr->urg = 0;
+
+    /* Start the checksum with the pseudo header */
+    cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
+                                  &sock->remote_addr.sin6_addr,
+                                  snd + hlen, IPPROTO_TCP);
+
+    /* Copy in the data, checksumming it along the way if it doesn't wrap
+       around the end of the send buffer. */
+    if(head + snd <= sock->sndbuf_sz) {
+        cs = net_ipv4_checksum_copy(buf, sb, snd, cs);
+        hdr->checksum = net_ipv4_checksum(rawpkt, hlen, cs);
+    }
+    else {
+        sz = sock->sndbuf_sz - head;
+        memcpy(buf, sb, sz);
+        memcpy(buf + sz, sock->data.sndbuf, snd - sz);
+        hdr->checksum = net_ipv4_checksum(rawpkt, snd + hlen, cs);
+    }
+
+    /* This carries the ACK of anything received so far. */
+    sock->intflags &= ~TCP_IFLAG_DELACK;
+
+    tcp_xmit(sock->data.net, rawpkt, snd + hlen, sock->hop_limit,
+             &sock->local_addr.sin6_addr, &sock->remote_addr.sin6_addr);
+
+    return snd;
+}
+
+static void tcp_send_data(struct tcp_sock *sock, int resend) {
+    uint32_t wnd = sock->data.snd.wnd, snd;
     uint32_t seq, unacked, head;
 
     if(!resend) {
         seq = sock->data.snd.nxt;
         unacked = sock->data.snd.nxt - sock->data.snd.una;
-        wnd -= unacked;
+        wnd = wnd > unacked ? wnd - unacked : 0;
         head = sock->data.sndbuf_head;
     }
     else {
@@ -2170,57 +2586,25 @@ static void tcp_send_data(struct tcp_sock *sock, int resend) {
     if(!wnd)
         wnd = 1;
 
-    /* Fill in the base packet */
-    hdr->src_port = sock->local_addr.sin6_port;
-    hdr->dst_port = sock->remote_addr.sin6_port;
-    hdr->ack = htonl(sock->data.rcv.nxt);
-    hdr->off_flags = htons(TCP_FLAG_ACK | TCP_OFFSET(5));
-    hdr->wnd = htons(sock->data.rcv.wnd);
-    hdr->urg = 0;
-
     /* Put on some data if we should do so */
     while(sock->data.sndbuf_cur_sz - unacked && wnd) {
-        hdr->seq = htonl(seq);
-        hdr->checksum = 0;
-        buf = rawpkt + sizeof(tcp_hdr_t);
-        sb = sock->data.sndbuf + head;
         snd = wnd;
 
-        if(snd > sock->data.snd.mss - sizeof(tcp_hdr_t))
-            snd = sock->data.snd.mss - sizeof(tcp_hdr_t);
-
         if(snd > sock->data.sndbuf_cur_sz - unacked)
             snd = sock->data.sndbuf_cur_sz - unacked;
 
-        /* Copy in the data */
-        if(head + snd <= sock->sndbuf_sz) {
-            memcpy(buf, sb, snd);
-            head += snd;
+        snd = tcp_send_segment(sock, seq, head, snd);
+        head += snd;
 
-            if(head == sock->sndbuf_sz)
-                head = 0;
-        }
-        else {
-            sz = sock->sndbuf_sz - head;
-            memcpy(buf, sb, sz);
-            memcpy(buf + sz, sock->data.sndbuf, snd - sz);
-            head = snd - sz;
-        }
+        if(resend)
+            ++tcp_stats.pkt_resent;
+
+        if(head >= sock->sndbuf_sz)
+            head -= sock->sndbuf_sz;
 
-        sz = snd + sizeof(tcp_hdr_t);
         wnd -= snd;
         seq += snd;
         unacked += snd;
-
-        /* Calculate the checksum */
-        cs = net_ipv6_checksum_pseudo(&sock->local_addr.sin6_addr,
-                                      &sock->remote_addr.sin6_addr, sz,
-                                      IPPROTO_TCP);
-        hdr->checksum = net_ipv4_checksum(rawpkt, sz, cs);
-
-        net_ipv6_send(sock->data.net, rawpkt, sz, sock->hop_limit, IPPROTO_TCP,
-                      &sock->local_addr.sin6_addr,
-                      &sock->remote_addr.sin6_addr);
     }
 
     sock->data.timer = timer_ms_gettime64();
@@ -2228,6 +2612,89 @@ static void tcp_send_data(struct tcp_sock *sock, int resend) {
     sock->data.snd.nxt = seq;
 }
 
+/* Send whatever buffered data the window now allows. */
+static void tcp_output(struct tcp_sock *sock) {
+    uint32_t unacked = sock->data.snd.nxt - sock->data.snd.una;
+
+    if(sock->data.sndbuf_cur_sz > unacked && sock->data.snd.wnd > unacked)
+        tcp_send_data(sock, 0);
+}
+
+/* Retransmit what the other side is missing. When it has SACKed anything, only
+   the holes are resent: those below the highest SACKed byte on a fast
+   retransmit, and everything outstanding that wasn't SACKed on a timeout.
+   Otherwise, a timeout resends everything outstanding, and a fast retransmit
+   only the first segment. */
+static void tcp_resend(struct tcp_sock *sock, int rto) {
+    const struct tcp_sack *blk = NULL;
+    uint32_t una = sock->data.snd.una, seq = una, end, high = una, head;
+    int i;
+
+    if(!sock->data.snd.nsack) {
+        if(rto) {
+            tcp_send_data(sock, 1);
+            return;
+        }
+
+        end = sock->data.snd.nxt - una;
+
+        if(end > sock->data.sndbuf_cur_sz)
+            end = sock->data.sndbuf_cur_sz;
+
+        if(end) {
+            tcp_send_segment(sock, una, sock->data.sndbuf_acked, end);
+            ++tcp_stats.pkt_resent;
+        }
+
+        sock->data.timer = timer_ms_gettime64();
+        return;
+    }
+
+    if(rto) {
+        high = sock->data.snd.nxt;
+    }
+    else {
+        for(i = 0; i < sock->data.snd.nsack; ++i) {
+            if(SEQ_GT(sock->data.snd.sack[i].end, high))
+                high = sock->data.snd.sack[i].end;
+        }
+    }
+
+    /* Only data still in the send buffer can be resent. */
+    if(high - una > sock->data.sndbuf_cur_sz)
+        high = una + sock->data.sndbuf_cur_sz;
+
+    while(SEQ_LT(seq, high)) {
+        /* Skip over a SACKed block, or find where the hole ends. */
+        end = high;
+
+        for(i = 0; i < sock->data.snd.nsack; ++i) {
+            blk = &sock->data.snd.sack[i];
+
+            if(SEQ_LE(blk->start, seq) && SEQ_GT(blk->end, seq))
+                break;
+
+            if(SEQ_GT(blk->start, seq) && SEQ_LT(blk->start, end))
+                end = blk->start;
+        }
+
+        if(i < sock->data.snd.nsack) {
+            seq = blk->end;
+            continue;
+        }
+
+        head = sock->data.sndbuf_acked + (seq - una);
+
+        if(head >= sock->sndbuf_sz)
+            head -= sock->sndbuf_sz;
+
+        seq += tcp_send_segment(sock, seq, head, end - seq);
+        ++tcp_stats.pkt_resent;
+    }
+
+    sock->data.timer = timer_ms_gettime64();
+}
+
 #define ADDR_EQUAL(a1, a2) \
     (((a1).__s6_addr.__s6_addr32[0] == (a2).__s6_addr.__s6_addr32[0]) && \
      ((a1).__s6_addr.__s6_addr32[1] == (a2).__s6_addr.__s6_addr32[1]) && \
@@ -2240,9 +2707,11 @@ static void tcp_send_data(struct tcp_sock *sock, int resend) {
 static struct tcp_sock *find_sock(const struct in6_addr *src,
                                   const struct in6_addr *dst,
                                   uint16_t sport, uint16_t dport, int domain) {
+    struct tcp_sock_list *bucket = tcp_bucket(src, sport, dport);
     struct tcp_sock *i;
 
-    LIST_FOREACH(i, &tcp_socks, sock_list) {
+again:
+    LIST_FOREACH(i, bucket, hash_list) {
         /* Ignore any closed sockets */
         if(i->state == TCP_STATE_CLOSED)
             continue;
@@ -2275,10 +2744,122 @@ static struct tcp_sock *find_sock(const struct in6_addr *src,
         return i;
     }
 
+    /* No connection matched, look for a socket listening on the port. */
+    if(bucket != tcp_bucket(&in6addr_any, 0, dport)) {
+        bucket = tcp_bucket(&in6addr_any, 0, dport);
+        goto again;
+    }
+
     return NULL;
 }
 
-extern void __poll_event_trigger(int fd, short event);
+/* Parse the options of an incoming segment. Returns -1 if they are malformed. */
+static int tcp_parse_opts(const tcp_hdr_t *tcp, uint16_t flags,
+                          struct tcp_opts *o) {
+    const uint8_t *opt = tcp->options;
+    int j = 0, k, len;
+    int end_of_opts = TCP_GET_OFFSET(flags) - 20;
+
+    o->mss = 0;
+    o->flags = 0;
+    o->nsack = 0;
+
+    while(j < end_of_opts) {
+        if(opt[j] == TCP_OPT_EOL)
+            break;
+
+        if(opt[j] == TCP_OPT_NOP) {
+            ++j;
+            continue;
+        }
+
+        if(j + 2 > end_of_opts || (len = opt[j + 1]) < 2 ||
+                j + len > end_of_opts)
+            return -1;
+
+        switch(opt[j]) {
+            case TCP_OPT_MSS:
+                if(len != 4)
+                    return -1;
+
+                o->mss = (opt[j + 2] << 8) | opt[j + 3];
+                break;
+
+            case TCP_OPT_WS:
+                if(len != 3)
+                    return -1;
+
+                o->flags |= TCP_OFLAG_WS;
+                o->wscale = opt[j + 2] > TCP_MAX_WSCALE ? TCP_MAX_WSCALE :
+                            opt[j + 2];
+                break;
+
+            case TCP_OPT_SACK_PERM:
+                if(len != 2)
+                    return -1;
+
+                o->flags |= TCP_OFLAG_SACK;
+                break;
+
+            case TCP_OPT_SACK:
+                if((len - 2) % 8)
+                    return -1;
+
+                for(k = j + 2; k < j + len && o->nsack < TCP_SACK_BLOCKS;
+                        k += 8) {
+                    o->sack[o->nsack].start = tcp_get32(opt + k);
+                    o->sack[o->nsack++].end = tcp_get32(opt + k + 4);
+                }
+
+                break;
+
+            case TCP_OPT_TS:
+                if(len != 10)
+                    return -1;
+
+                o->flags |= TCP_OFLAG_TS;
+                o->tsval = tcp_get32(opt + j + 2);
+                o->tsecr = tcp_get32(opt + j + 6);
+                break;
+
+            /* Anything else is skipped. */
+        }
+
+        j += len;
+    }
+
+    return 0;
+}
+
+/* Add the range [start, end) to a list of SACK blocks, merging it with any
+   block it overlaps or touches. The result goes first, as the most recent
+   block is the first one to report. When the list is full, the oldest block
+   is forgotten. */
+static void tcp_sack_add(struct tcp_sack *blk, int *n, uint32_t start,
+                         uint32_t end) {
+    int i, j;
+
+    for(i = j = 0; i < *n; ++i) {
+        if(SEQ_LE(blk[i].start, end) && SEQ_GE(blk[i].end, start)) {
+            if(SEQ_LT(blk[i].start, start))
+                start = blk[i].start;
+
+            if(SEQ_GT(blk[i].end, end))
+                end = blk[i].end;
+        }
+        else {
+            blk[j++] = blk[i];
+        }
+    }
+
+    if(j == TCP_SACK_BLOCKS)
+        --j;
+
+    memmove(blk + 1, blk, j * sizeof(*blk));
+    blk[0].start = start;
+    blk[0].end = end;
+    *n = j + 1;
+}
 
 /* This function is basically a direct implementation of the first two and a
    half steps of the SEGMENT ARRIVES event processing defined in RFC 793 on
@@ -2287,9 +2868,9 @@ extern void __poll_event_trigger(int fd, short event);
 static int listen_pkt(netif_t *src, const struct in6_addr *srca,
                       const struct in6_addr *dsta, const tcp_hdr_t *tcp,
                       struct tcp_sock *s, uint16_t flags, int size) {
-    int j = 0;
-    int end_of_opts;
-    uint16_t mss = 576;
+    struct tcp_opts o;
+    uint16_t mss;
+    int j;
 
     (void)size;
 
@@ -2301,36 +2882,12 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
     if(flags & TCP_FLAG_ACK)
         return -1;
 
-    /* Parse options now, in case we need to update the max segment size. */
-    end_of_opts = TCP_GET_OFFSET(flags) - 20;
-
-    while(j < end_of_opts) {
-        switch(tcp->options[j]) {
-            case TCP_OPT_EOL:
-                j = end_of_opts;
-                break;
-
-            case TCP_OPT_NOP:
-                ++j;
-                break;
-
-            case TCP_OPT_MSS:
-                if(j + 4 > end_of_opts || tcp->options[j + 1] != 4)
-                    return -1;
-
-                mss = (tcp->options[j + 2] << 8) | tcp->options[j + 3];
-                j += 4;
-                break;
-
-            default:
-
-                /* Skip unknown options */
-                if(j + 1 > end_of_opts || j + tcp->options[j + 1] > end_of_opts)
-                    return -1;
+    /* Parse options now, in case we need to update the max segment size, and
+       to see which extensions the other side is willing to use. */
+    if(tcp_parse_opts(tcp, flags, &o))
+        return -1;
 
-                j += tcp->options[j + 1];
-        }
-    }
+    mss = o.mss ? o.mss : 576;
 
     /* Silently cap the MSS... */
     if(mss > 1460)
@@ -2346,6 +2903,11 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
                 s->listen.queue[j].remote_addr.sin6_port == tcp->src_port) {
             s->listen.queue[j].isn = ntohl(tcp->seq);
             s->listen.queue[j].mss = mss;
+            s->listen.queue[j].opts = o.flags;
+            s->listen.queue[j].wscale =
+                (o.flags & TCP_OFLAG_WS) ? o.wscale : 0;
+            s->listen.queue[j].ts_recent =
+                (o.flags & TCP_OFLAG_TS) ? o.tsval : 0;
             return 0;
         }
     }
@@ -2364,6 +2926,11 @@ static int listen_pkt(netif_t *src, const struct in6_addr *srca,
     s->listen.queue[s->listen.tail].isn = ntohl(tcp->seq);
     s->listen.queue[s->listen.tail].mss = mss;
     s->listen.queue[s->listen.tail].wnd = ntohs(tcp->wnd);
+    s->listen.queue[s->listen.tail].opts = o.flags;
+    s->listen.queue[s->listen.tail].wscale =
+        (o.flags & TCP_OFLAG_WS) ? o.wscale : 0;
+    s->listen.queue[s->listen.tail].ts_recent =
+        (o.flags & TCP_OFLAG_TS) ? o.tsval : 0;
     ++s->listen.count;
     ++s->listen.tail;
 
@@ -2385,7 +2952,8 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
                        struct tcp_sock *s, uint16_t flags, int size) {
     uint32_t ack, seq;
     int sz = size - TCP_GET_OFFSET(flags), gotack = 0;
-    int j = 0, end_of_opts, mss = 536;
+    struct tcp_opts o;
+    int mss;
 
     (void)src;
 
@@ -2421,40 +2989,25 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
         s->data.rcv.nxt = seq + 1;
         s->data.rcv.irs = seq;
 
-        end_of_opts = TCP_GET_OFFSET(flags) - 20;
-
-        while(j < end_of_opts) {
-            switch(tcp->options[j]) {
-                case TCP_OPT_EOL:
-                    j = end_of_opts;
-                    break;
-
-                case TCP_OPT_NOP:
-                    ++j;
-                    break;
-
-                case TCP_OPT_MSS:
-
-                    if(j + 4 > end_of_opts || tcp->options[j + 1] != 4)
-                        return -1;
+        if(tcp_parse_opts(tcp, flags, &o))
+            return -1;
 
-                    mss = (tcp->options[j + 2] << 8) | tcp->options[j + 3];
-                    j += 4;
-                    break;
+        mss = o.mss ? o.mss : 536;
 
-                default:
+        /* We offered every option we know about, so whatever comes back is
+           what we are going to use. */
+        s->data.opts = o.flags;
 
-                    /* Skip unknown options */
-                    if(j + 1 > end_of_opts ||
-                            j + tcp->options[j + 1] > end_of_opts)
-                        return -1;
+        if(o.flags & TCP_OFLAG_WS)
+            s->data.snd.wscale = o.wscale;
+        else
+            s->data.rcv.wscale = 0;
 
-                    j += tcp->options[j + 1];
-            }
-        }
+        if(o.flags & TCP_OFLAG_TS)
+            s->data.rcv.ts_recent = o.tsval;
 
         s->data.snd.mss = mss > 1460 ? 1460 : mss;
-        s->data.snd.wnd = htons(tcp->wnd);
+        s->data.snd.wnd = ntohs(tcp->wnd);
 
         if(gotack) {
             s->data.snd.una = ack;
@@ -2479,16 +3032,235 @@ static int synsent_pkt(netif_t *src, const struct in6_addr *srca,
     return 0;
 }
 
+/* Copy received data into the receive buffer, off bytes past the in-order
+   data. The caller has made sure it fits in the window. */
+static void tcp_rcvbuf_copy(struct tcp_sock *s, uint32_t off,
+                            const uint8_t *buf, size_t sz) {
+    uint32_t pos = s->data.rcvbuf_tail + off;
+    size_t tmp;
+
+    if(pos >= s->rcvbuf_sz)
+        pos -= s->rcvbuf_sz;
+
+    if(pos + sz <= s->rcvbuf_sz) {
+        memcpy(s->data.rcvbuf + pos, buf, sz);
+    }
+    else {
+        tmp = s->rcvbuf_sz - pos;
+        memcpy(s->data.rcvbuf + pos, buf, tmp);
+        memcpy(s->data.rcvbuf, buf + tmp, sz - tmp);
+    }
+}
+
+/* Move the end of the in-order data forward over data already in the receive
+   buffer. */
+static void tcp_rcvbuf_advance(struct tcp_sock *s, uint32_t sz) {
+    s->data.rcv.nxt += sz;
+    s->data.rcv.wnd -= sz;
+    s->data.rcvbuf_cur_sz += sz;
+    s->data.rcvbuf_tail += sz;
+
+    if(s->data.rcvbuf_tail > s->rcvbuf_sz)
+        s->data.rcvbuf_tail -= s->rcvbuf_sz;
+}
+
+/* Queue in-order data at the tail of the receive buffer. The caller has made
+   sure it fits in the window. Returns 1 if this filled a hole in front of out
+   of order data, which then becomes in-order too. */
+static int tcp_rcvbuf_put(struct tcp_sock *s, const uint8_t *buf, size_t sz) {
+    struct tcp_sack *blk;
+    int i = 0, filled = 0;
+
+    tcp_rcvbuf_copy(s, 0, buf, sz);
+    tcp_rcvbuf_advance(s, sz);
+
+    while(i < s->data.rcv.nsack) {
+        blk = &s->data.rcv.sack[i];
+
+        if(SEQ_GT(blk->start, s->data.rcv.nxt)) {
+            ++i;
+            continue;
+        }
+
+        if(SEQ_GT(blk->end, s->data.rcv.nxt))
+            tcp_rcvbuf_advance(s, blk->end - s->data.rcv.nxt);
+
+        --s->data.rcv.nsack;
+        memmove(blk, blk + 1, (s->data.rcv.nsack - i) * sizeof(*blk));
+        filled = 1;
+        i = 0;
+    }
+
+    /* Signal any waiting thread */
+    __poll_event_trigger(s->sock, POLLRDNORM);
+    cond_signal(&s->data.recv_cv);
+
+    return filled;
+}
+
+/* Hold on to out of order data, off bytes past the next in-order byte, until
+   the hole in front of it is filled. */
+static void tcp_rcvbuf_ooo(struct tcp_sock *s, uint32_t off,
+                           const uint8_t *buf, size_t sz) {
+    uint32_t seq = s->data.rcv.nxt + off;
+
+    tcp_rcvbuf_copy(s, off, buf, sz);
+    tcp_sack_add(s->data.rcv.sack, &s->data.rcv.nsack, seq, seq + sz);
+}
+
+/* Work out the retransmission timeout, as in RFC 6298. */
+static void tcp_set_rto(struct tcp_sock *s) {
+    uint32_t rto = TCP_DEFAULT_RTTO;
+
+    if(s->data.snd.srtt)
+        rto = (s->data.snd.srtt >> 3) + s->data.snd.rttvar;
+
+    if(rto < TCP_MIN_RTTO)
+        rto = TCP_MIN_RTTO;
+    else if(rto > TCP_MAX_RTTO)
+        rto = TCP_MAX_RTTO;
+
+    s->data.snd.rto = rto;
+}
+
+/* Take a round trip time measurement into account. */
+static void tcp_rtt_sample(struct tcp_sock *s, int32_t rtt) {
+    int32_t delta;
+
+    if(!s->data.snd.srtt) {
+        s->data.snd.srtt = rtt << 3;
+        s->data.snd.rttvar = rtt << 1;
+        return;
+    }
+
+    delta = rtt - (s->data.snd.srtt >> 3);
+    s->data.snd.srtt += delta;
+
+    if(delta < 0)
+        delta = -delta;
+
+    s->data.snd.rttvar += delta - (s->data.snd.rttvar >> 2);
+}
+
+/* Take an ACK of some of our data into account. The echoed timestamp, if there
+   is one, gives a round trip time measurement. */
+static void tcp_ack_sent(struct tcp_sock *s, uint32_t ack, int acksyn,
+                         const struct tcp_opts *o) {
+    int i = 0;
+
+    s->data.sndbuf_acked += (int32_t)(ack - s->data.snd.una - acksyn);
+    s->data.sndbuf_cur_sz -= (int32_t)(ack - s->data.snd.una - acksyn);
+    s->data.snd.una = ack;
+    s->data.snd.dupacks = 0;
+    __poll_event_trigger(s->sock, POLLWRNORM | POLLWRBAND);
+    cond_signal(&s->data.send_cv);
+
+    if(s->data.sndbuf_acked >= s->sndbuf_sz)
+        s->data.sndbuf_acked -= s->sndbuf_sz;
+
+    /* Forget about SACKed data that is now acknowledged. */
+    while(i < s->data.snd.nsack) {
+        if(SEQ_LE(s->data.snd.sack[i].end, ack)) {
+            --s->data.snd.nsack;
+            memmove(&s->data.snd.sack[i], &s->data.snd.sack[i + 1],
+                    (s->data.snd.nsack - i) * sizeof(struct tcp_sack));
+            continue;
+        }
+
+        if(SEQ_LT(s->data.snd.sack[i].start, ack))
+            s->data.snd.sack[i].start = ack;
+
+        ++i;
+    }
+
+    if((s->data.opts & TCP_OFLAG_TS) && (o->flags & TCP_OFLAG_TS) &&
+            o->tsecr && (int32_t)(tcp_ts_now() - o->tsecr) >= 0)
+        tcp_rtt_sample(s, (int32_t)(tcp_ts_now() - o->tsecr));
+
+    tcp_set_rto(s);
+}
+
+/* Add the blocks SACKed by the other side to the scoreboard. Only blocks of
+   data sent and not yet acknowledged are of any use. */
+static void tcp_sack_update(struct tcp_sock *s, const struct tcp_opts *o) {
+    uint32_t start, end;
+    int i;
+
+    for(i = 0; i < o->nsack; ++i) {
+        start = o->sack[i].start;
+        end = o->sack[i].end;
+
+        if(!SEQ_LT(start, end) || !SEQ_LT(s->data.snd.una, end) ||
+                SEQ_GT(end, s->data.snd.nxt))
+            continue;
+
+        if(SEQ_LT(start, s->data.snd.una))
+            start = s->data.snd.una;
+
+        tcp_sack_add(s->data.snd.sack, &s->data.snd.nsack, start, end);
+    }
+}
+
+/* The window of an incoming segment, scaled up if need be. */
+static inline uint32_t tcp_seg_wnd(const struct tcp_sock *s,
+                                   const tcp_hdr_t *tcp) {
+    return (uint32_t)ntohs(tcp->wnd) << s->data.snd.wscale;
+}
+
+/* Header prediction, after Van Jacobson: on an established connection, most
+   segments are either the next in-order data with nothing new acked, or a
+   pure ACK of new data with no window change. Handle those two here without
+   going through the whole of process_pkt(). Returns 1 if the segment has been
+   dealt with. */
+static int tcp_fast_path(struct tcp_sock *s, const tcp_hdr_t *tcp,
+                         uint16_t flags, uint32_t seq, uint32_t ack,
+                         const uint8_t *buf, size_t sz,
+                         const struct tcp_opts *o) {
+    if(s->state != TCP_STATE_ESTABLISHED ||
+       (flags & (TCP_FLAG_SYN | TCP_FLAG_FIN | TCP_FLAG_RST | TCP_FLAG_URG |
+                 TCP_FLAG_ACK)) != TCP_FLAG_ACK ||
+       seq != s->data.rcv.nxt || tcp_seg_wnd(s, tcp) != s->data.snd.wnd ||
+       o->nsack)
+        return 0;
+
+    if(!sz) {
+        /* A pure ACK for data we have sent. */
+        if(!(SEQ_LT(s->data.snd.una, ack) && SEQ_LE(ack, s->data.snd.nxt)))
+            return 0;
+
+        tcp_ack_sent(s, ack, 0, o);
+
+        if(SEQ_LT(s->data.snd.wl1, seq) ||
+                (s->data.snd.wl1 == seq && SEQ_LE(s->data.snd.wl2, ack))) {
+            s->data.snd.wl1 = seq;
+            s->data.snd.wl2 = ack;
+        }
+
+        tcp_output(s);
+        return 1;
+    }
+
+    /* The next in-order data, acking nothing new, that fits in the window,
+       with no out of order data waiting behind it. */
+    if(ack != s->data.snd.una || sz > s->data.rcv.wnd || s->data.rcv.nsack)
+        return 0;
+
+    tcp_rcvbuf_put(s, buf, sz);
+    tcp_ack_data(s);
+
+    return 1;
+}
+
 /* This implements the processing described for the synchronized states, as
    described in pages 69-76 of the RFC. */
 static int process_pkt(netif_t *src, const struct in6_addr *srca,
                        const struct in6_addr *dsta, const tcp_hdr_t *tcp,
                        struct tcp_sock *s, uint16_t flags, size_t size) {
-    uint32_t seq, ack, up;
+    uint32_t seq, ack, up, off;
     size_t sz;
-    int bad_pkt = 0, tmp, acksyn = 0;
+    int bad_pkt = 0, acksyn = 0, dupack = 0;
     const uint8_t *buf = (const uint8_t *)tcp;
-    uint8_t *rb;
+    struct tcp_opts o;
 
     (void)src;
 
@@ -2496,10 +3268,37 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
     seq = ntohl(tcp->seq);
     ack = ntohl(tcp->ack);
 
-    /* Check the validity of the incoming segment's sequence number */
     sz = size - TCP_GET_OFFSET(flags);
     buf += TCP_GET_OFFSET(flags);
 
+    /* Look at the options, if there are any. Malformed ones are ignored. */
+    if(TCP_GET_OFFSET(flags) == sizeof(tcp_hdr_t) ||
+            tcp_parse_opts(tcp, flags, &o)) {
+        o.flags = 0;
+        o.nsack = 0;
+    }
+
+    /* Remember the latest timestamp to echo back. */
+    if((s->data.opts & TCP_OFLAG_TS) && (o.flags & TCP_OFLAG_TS) &&
+            SEQ_LE(seq, s->data.rcv.nxt) &&
+            SEQ_GE(o.tsval, s->data.rcv.ts_recent))
+        s->data.rcv.ts_recent = o.tsval;
+
+    if(tcp_fast_path(s, tcp, flags, seq, ack, buf, sz, &o))
+        return 0;
+
+    /* Trim off the front of the segment anything we have already got, in case
+       it was resent along with some new data (or a FIN). */
+    if(SEQ_LT(seq, s->data.rcv.nxt) &&
+            SEQ_GT(seq + sz + !!(flags & TCP_FLAG_FIN), s->data.rcv.nxt)) {
+        off = s->data.rcv.nxt - seq;
+        buf += off;
+        sz -= off;
+        seq = s->data.rcv.nxt;
+    }
+
+    /* Check the validity of the incoming segment's sequence number */
+
     if(s->data.rcv.wnd == 0) {
         if(sz || seq != s->data.rcv.nxt)
             bad_pkt = 1;
@@ -2520,6 +3319,8 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
     /* If the sequence number isn't valid, check the RST bit. If its not set,
        send the appropriate ACK. */
     if(bad_pkt) {
+        ++tcp_stats.pkt_recv_outside_wnd;
+
         if(flags & TCP_FLAG_RST) {
             return 0;
         }
@@ -2580,18 +3381,11 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
 
     /* Check the ack number for validity */
     if(SEQ_LT(s->data.snd.una, ack) && SEQ_LE(ack, s->data.snd.nxt)) {
-        s->data.sndbuf_acked += (int32_t)(ack - s->data.snd.una - acksyn);
-        s->data.sndbuf_cur_sz -= (int32_t)(ack - s->data.snd.una - acksyn);
-        s->data.snd.una = ack;
-        __poll_event_trigger(s->sock, POLLWRNORM | POLLWRBAND);
-        cond_signal(&s->data.send_cv);
-
-        if(s->data.sndbuf_acked >= s->sndbuf_sz)
-            s->data.sndbuf_acked -= s->sndbuf_sz;
+        tcp_ack_sent(s, ack, acksyn, &o);
 
         if(SEQ_LT(s->data.snd.wl1, seq) ||
                 (s->data.snd.wl1 == seq && SEQ_LE(s->data.snd.wl2, ack))) {
-            s->data.snd.wnd = ntohs(tcp->wnd);
+            s->data.snd.wnd = tcp_seg_wnd(s, tcp);
             s->data.snd.wl1 = seq;
             s->data.snd.wl2 = ack;
         }
@@ -2602,6 +3396,23 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
         tcp_send_ack(s);
         return 0;
     }
+    else if(ack == s->data.snd.una && ack != s->data.snd.nxt && !sz &&
+            !(flags & TCP_FLAG_FIN) && tcp_seg_wnd(s, tcp) == s->data.snd.wnd) {
+        /* A duplicate ACK, the other side is probably missing a segment. */
+        dupack = 1;
+    }
+
+    if((s->data.opts & TCP_OFLAG_SACK) && o.nsack)
+        tcp_sack_update(s, &o);
+
+    /* Resend what is missing on the third duplicate ACK, then send whatever
+       new data the window allows. */
+    if(s->state == TCP_STATE_ESTABLISHED || s->state == TCP_STATE_CLOSE_WAIT) {
+        if(dupack && ++s->data.snd.dupacks == TCP_DUPACK_THRESH)
+            tcp_resend(s, 0);
+
+        tcp_output(s);
+    }
 
     /* We need to do a bit more processing in certain states... */
     switch(s->state) {
@@ -2657,35 +3468,31 @@ static int process_pkt(netif_t *src, const struct in6_addr *srca,
             s->state == TCP_STATE_FIN_WAIT_2) {
         /* Next, check the data size versus our window. If its more than the
            window, truncate the data and copy out what we can. */
-        if(sz > s->data.rcv.wnd) {
-            sz = s->data.rcv.wnd;
+        off = seq - s->data.rcv.nxt;
+
+        if(sz && off + sz > s->data.rcv.wnd) {
+            sz = s->data.rcv.wnd - off;
             bad_pkt = 1;
+            ++tcp_stats.pkt_recv_outside_wnd;
         }
 
-        /* Copy the data out */
+        /* Copy the data out, and ack what we read. Ack truncated segments
+           right away, so the other side knows to resend the rest, and so are
+           out of order ones or those that fill a hole, so that it knows what
+           we're missing. A FIN on an out of order segment will come again. */
         if(sz) {
-            rb = s->data.rcvbuf + s->data.rcvbuf_tail;
-            s->data.rcv.nxt += sz;
-            s->data.rcv.wnd -= sz;
-            s->data.rcvbuf_cur_sz += sz;
-
-            if(s->data.rcvbuf_tail + sz <= s->rcvbuf_sz) {
-                memcpy(rb, buf, sz);
-                s->data.rcvbuf_tail += sz;
+            if(off) {
+                ++tcp_stats.pkt_recv_out_of_order;
+                tcp_rcvbuf_ooo(s, off, buf, sz);
+                bad_pkt = 1;
+                tcp_send_ack(s);
+            }
+            else if(tcp_rcvbuf_put(s, buf, sz) || bad_pkt) {
+                tcp_send_ack(s);
             }
             else {
-                tmp = s->rcvbuf_sz - s->data.rcvbuf_tail;
-                memcpy(rb, buf, tmp);
-                sz -= tmp;
-                buf += tmp;
-                memcpy(s->data.rcvbuf, buf, sz);
-                s->data.rcvbuf_tail = sz;
+                tcp_ack_data(s);
             }
-
-            /* Signal any waiting thread and send an ack for what we read */
-            __poll_event_trigger(s->sock, POLLRDNORM);
-            cond_signal(&s->data.recv_cv);
-            tcp_send_ack(s);
         }
     }
     else if(sz) {
@@ -2777,9 +3584,12 @@ static int net_tcp_input(netif_t *src, int domain, const void *hdr,
     if(c) {
         /* The checksum should be 0 on success, so discard the packet if it does
            not match that expectation. */
+        ++tcp_stats.pkt_recv_bad_chksum;
         return 0;
     }
 
+    ++tcp_stats.pkt_recv;
+
     flags = ntohs(tcp->off_flags);
 
     if(rwsem_read_lock_irqsafe(&tcp_sem))
@@ -2823,6 +3633,9 @@ static int net_tcp_input(netif_t *src, int domain, const void *hdr,
 
         mutex_unlock(&s->mutex);
     }
+    else {
+        ++tcp_stats.pkt_recv_no_sock;
+    }
 
     rwsem_read_unlock(&tcp_sem);
 
@@ -2837,6 +3650,7 @@ static int net_tcp_input(netif_t *src, int domain, const void *hdr,
 static void tcp_thd_cb(void *arg) {
     struct tcp_sock *i, *tmp;
     uint64_t timer;
+    int dead = 0;
 
     (void)arg;
 
@@ -2846,6 +3660,10 @@ static void tcp_thd_cb(void *arg) {
         mutex_lock_scoped(&i->mutex);
         timer = timer_ms_gettime64();
 
+        /* Send any ACK that has been held back long enough. */
+        if(i->intflags & TCP_IFLAG_DELACK)
+            tcp_send_ack(i);
+
         switch(i->state) {
             case TCP_STATE_LISTEN:
                 break;
@@ -2857,6 +3675,7 @@ static void tcp_thd_cb(void *arg) {
                    send another one. */
                 if(i->data.timer + TCP_DEFAULT_RTTO <= timer) {
                     tcp_send_syn(i, 0);
+                    ++tcp_stats.pkt_resent;
                     i->data.timer = timer;
                 }
 
@@ -2869,6 +3688,7 @@ static void tcp_thd_cb(void *arg) {
                    state, send another one. */
                 if(i->data.timer + TCP_DEFAULT_RTTO <= timer) {
                     tcp_send_syn(i, 1);
+                    ++tcp_stats.pkt_resent;
                     i->data.timer = timer;
                 }
 
@@ -2887,9 +3707,15 @@ static void tcp_thd_cb(void *arg) {
             case TCP_STATE_ESTABLISHED:
             case TCP_STATE_CLOSE_WAIT:
 
+                /* Back off the timeout on every retransmission, until an
+                   ACK shows up. */
                 if(i->data.sndbuf_cur_sz &&
-                        i->data.timer + TCP_DEFAULT_RTTO <= timer) {
-                    tcp_send_data(i, 1);
+                        i->data.timer + i->data.snd.rto <= timer) {
+                    tcp_resend(i, 1);
+                    i->data.snd.dupacks = 0;
+
+                    if((i->data.snd.rto <<= 1) > TCP_MAX_RTTO)
+                        i->data.snd.rto = TCP_MAX_RTTO;
                 }
                 else if(!i->data.sndbuf_cur_sz &&
                         (i->intflags & TCP_IFLAG_QUEUEDCLOSE)) {
@@ -2906,12 +3732,26 @@ static void tcp_thd_cb(void *arg) {
 
                 break;
         }
+
+        if((i->intflags & TCP_IFLAG_CANBEDEL) &&
+                (i->state & 0x0F) == TCP_STATE_CLOSED)
+            dead = 1;
     }
 
-    rwsem_read_unlock(&tcp_sem);
+    /* Only take the write lock, which holds up every input, if there is any
+       socket to clean up. */
+    if(!dead) {
+        rwsem_read_unlock(&tcp_sem);
+        return;
+    }
 
-    /* Go through and clean up any sockets that need to be destroyed. */
-    rwsem_write_lock(&tcp_sem);
+    /* Go through and clean up any sockets that need to be destroyed. If we
+       are the only reader, there is no need to let go and queue up behind
+       everyone else. */
+    if(rwsem_read_tryupgrade(&tcp_sem)) {
+        rwsem_read_unlock(&tcp_sem);
+        rwsem_write_lock(&tcp_sem);
+    }
 
     i = LIST_FIRST(&tcp_socks);
 
@@ -2921,6 +3761,7 @@ static void tcp_thd_cb(void *arg) {
         if((i->intflags & TCP_IFLAG_CANBEDEL) &&
                 (i->state & 0x0F) == TCP_STATE_CLOSED) {
             LIST_REMOVE(i, sock_list);
+            LIST_REMOVE(i, hash_list);
             cond_destroy(&i->data.send_cv);
             cond_destroy(&i->data.recv_cv);
             mutex_destroy(&i->mutex);
@@ -2956,9 +3797,15 @@ static fs_socket_proto_t proto = {
     net_tcp_getsockname,                /* getsockname */
     net_tcp_getpeername,                /* getpeername */
     net_tcp_fcntl,                      /* fcntl */
-    net_tcp_poll                        /* poll */
+    net_tcp_poll,                       /* poll */
+    NULL,                               /* recvmmsg */
+    NULL                                /* sendmmsg */
 };
 
+net_tcp_stats_t net_tcp_get_stats(void) {
+    return tcp_stats;
+}
+
 int net_tcp_init(void) {
     if((thd_cb_id = net_thd_add_callback(tcp_thd_cb, NULL, 50)) < 0)
         return -1;
@@ -2968,6 +3815,7 @@ int net_tcp_init(void) {
 
 void net_tcp_shutdown(void) {
     struct tcp_sock *i, *tmp;
+    int j;
 
     /* Kill the thread and make sure we can grab the lock */
     if(thd_cb_id >= 0)
@@ -2987,6 +3835,7 @@ void net_tcp_shutdown(void) {
         }
         else {
             LIST_REMOVE(i, sock_list);
+            LIST_REMOVE(i, hash_list);
             cond_destroy(&i->data.send_cv);
             cond_destroy(&i->data.recv_cv);
             mutex_destroy(&i->mutex);
@@ -3000,6 +3849,9 @@ void net_tcp_shutdown(void) {
 
     LIST_INIT(&tcp_socks);
 
+    for(j = 0; j < (1 << TCP_HASH_BITS); ++j)
+        LIST_INIT(&tcp_hash[j]);
+
     /* Remove us from fs_socket and clean up the semaphore */
     fs_socket_proto_remove(&proto);
 }
@@ -11,10 +11,13 @@
 #include <errno.h>
 #include <poll.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <kos/net.h>
 #include <kos/mutex.h>
 #include <kos/genwait.h>
+#include <kos/timer.h>
 #include <sys/queue.h>
 #include <kos/fs_socket.h>
 #include <arch/irq.h>
@@ -33,6 +36,24 @@
 /* Default hop limit (or ttl for IPv4) for new sockets */
 #define UDP_DEFAULT_HOPS    64
 
+/* Default, smallest and largest receive buffer of a socket (SO_RCVBUF). This
+   is how large the ring the datagrams queued on it are copied into may grow,
+   headers included. The smallest one still holds an Ethernet sized datagram. */
+#define UDP_DEFAULT_RCVBUF  (64 * 1024)
+#define UDP_MIN_RCVBUF      2048
+#define UDP_MAX_RCVBUF      (1024 * 1024)
+
+/* Size the receive ring starts at. It doubles whenever a datagram doesn't
+   fit, up to the receive buffer size, so that sockets that only ever see a
+   few small datagrams don't hold on to all of it. */
+#define UDP_RING_MIN_SZ     4096
+
+/* Number of datagrams sendmmsg() looks up destinations for at once */
+#define UDP_MMSG_BATCH      16
+
+/* Number of buckets of the local port hash (must be a power of two) */
+#define UDP_HASH_SIZE       64
+
 typedef struct {
     uint16_t src_port __packed;
     uint16_t dst_port __packed;
@@ -40,14 +61,21 @@ typedef struct {
     uint16_t checksum __packed;
 } udp_hdr_t;
 
-struct udp_pkt {
-    TAILQ_ENTRY(udp_pkt) pkt_queue;
-    struct sockaddr_in6 from;
-    uint8_t *data;
+/* Header of a datagram in the receive ring of a socket. The payload follows
+   it, and the next record starts at the next 4 byte boundary. A datasize of
+   UDP_REC_WRAP marks the rest of the ring as unused, and so does there being
+   no room left for a header before its end. */
+struct udp_rec {
+    struct in6_addr from_addr;
+    uint16_t from_port;
     uint16_t datasize;
 };
 
-TAILQ_HEAD(udp_pkt_queue, udp_pkt);
+#define UDP_REC_WRAP        0xFFFF
+
+static inline uint32_t udp_rec_size(size_t datasize) {
+    return (sizeof(struct udp_rec) + datasize + 3) & ~3;
+}
 
 #define UDPSOCK_NO_CHECKSUM 0x00000001
 #define UDPSOCK_LITE_RCVCOV 0x00000002
@@ -64,24 +92,251 @@ struct udp_sock {
     int hop_limit;
     file_t sock;
 
+    uint32_t rcvbuf_sz;
+    uint32_t rcvbuf_cur_sz;
+
+    /* Receive ring, allocated when the first datagram comes in and grown
+       as needed. It can be larger than rcvbuf_sz after SO_RCVBUF shrank it
+       with data queued, or to hold a datagram larger than rcvbuf_sz. */
+    uint8_t *ring;
+    uint32_t ring_sz;
+    uint32_t ring_head;
+    uint32_t ring_tail;
+    uint32_t ring_cnt;
+
     struct {
         uint16_t send_cscov;
         uint16_t recv_cscov;
     } udp_lite;
-
-    struct udp_pkt_queue packets;
 };
 
 LIST_HEAD(udp_sock_list, udp_sock);
 
-static struct udp_sock_list net_udp_sockets = LIST_HEAD_INITIALIZER(0);
 static mutex_t udp_mutex = MUTEX_INITIALIZER;
 static net_udp_stats_t udp_stats = { 0 };
 
+/* Sockets by local port, so that incoming packets don't have to go through
+   every socket there is. Since no two sockets can be bound to the same port,
+   the local port is all that is needed to find the socket. */
+static struct udp_sock_list udp_hash[UDP_HASH_SIZE];
+
+static inline struct udp_sock_list *udp_bucket(uint16_t port) {
+    return &udp_hash[ntohs(port) & (UDP_HASH_SIZE - 1)];
+}
+
+/* Move a socket to the bucket of its local port, after it changed. Assumes
+   udp_mutex is held. */
+static void udp_rehash(struct udp_sock *udpsock) {
+    LIST_REMOVE(udpsock, sock_list);
+    LIST_INSERT_HEAD(udp_bucket(udpsock->local_addr.sin6_port), udpsock,
+                     sock_list);
+}
+
+/* See if a socket other than udpsock is bound to a port. */
+static int udp_port_used(uint16_t port, const struct udp_sock *udpsock) {
+    struct udp_sock *iter;
+
+    LIST_FOREACH(iter, udp_bucket(port), sock_list) {
+        if(iter != udpsock && iter->local_addr.sin6_port == port)
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Grab the first unused port >= 1024. */
+static uint16_t udp_free_port(const struct udp_sock *udpsock) {
+    uint16_t port = 1024;
+
+    while(udp_port_used(htons(port), udpsock))
+        ++port;
+
+    return htons(port);
+}
+
+/* Find the record at offset off of the receive ring of a socket, skipping
+   over the end of the ring if it's unused. Assumes udp_mutex is held, and
+   that there is a record to find. */
+static struct udp_rec *udp_ring_at(const struct udp_sock *udpsock,
+                                   uint32_t *off) {
+    struct udp_rec *rec;
+
+    if(udpsock->ring_sz - *off < sizeof(struct udp_rec))
+        *off = 0;
+
+    rec = (struct udp_rec *)(udpsock->ring + *off);
+
+    if(rec->datasize == UDP_REC_WRAP) {
+        *off = 0;
+        rec = (struct udp_rec *)udpsock->ring;
+    }
+
+    return rec;
+}
+
+/* The oldest datagram queued on a socket, or NULL if there is none. Assumes
+   udp_mutex is held. */
+static inline struct udp_rec *udp_ring_first(struct udp_sock *udpsock) {
+    if(!udpsock->ring_cnt)
+        return NULL;
+
+    return udp_ring_at(udpsock, &udpsock->ring_head);
+}
+
+/* Take the oldest datagram off the queue of a socket. Assumes udp_mutex is
+   held. */
+static void udp_ring_pop(struct udp_sock *udpsock, struct udp_rec *rec) {
+    uint32_t size = udp_rec_size(rec->datasize);
+
+    udpsock->ring_head = (uint8_t *)rec - udpsock->ring + size;
+    udpsock->rcvbuf_cur_sz -= size;
+    --udpsock->ring_cnt;
+    --udp_stats.pkt_queued;
+}
+
+/* Move the datagrams queued on a socket to the front of a new ring of sz
+   bytes, which must hold all of them. Assumes udp_mutex is held. */
+static int udp_ring_realloc(struct udp_sock *udpsock, uint32_t sz) {
+    uint32_t off = udpsock->ring_head, size, i;
+    struct udp_rec *rec;
+    uint8_t *ring;
+
+    if(!(ring = (uint8_t *)malloc(sz))) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for(i = 0, size = 0; i < udpsock->ring_cnt; ++i) {
+        rec = udp_ring_at(udpsock, &off);
+        memcpy(ring + size, rec, udp_rec_size(rec->datasize));
+        size += udp_rec_size(rec->datasize);
+        off += udp_rec_size(rec->datasize);
+    }
+
+    free(udpsock->ring);
+    udpsock->ring = ring;
+    udpsock->ring_sz = sz;
+    udpsock->ring_head = 0;
+    udpsock->ring_tail = size;
+
+    return 0;
+}
+
+/* Find room for a record of size bytes at the end of the ring of a socket.
+   Datagrams are kept contiguous, so one that doesn't fit before the end of
+   the ring goes at its start, leaving the end unused. Assumes udp_mutex is
+   held. */
+static bool udp_ring_room(struct udp_sock *udpsock, uint32_t size,
+                          uint32_t *off) {
+    if(!udpsock->ring)
+        return false;
+
+    if(!udpsock->ring_cnt) {
+        udpsock->ring_head = udpsock->ring_tail = 0;
+        *off = 0;
+        return udpsock->ring_sz >= size;
+    }
+
+    if(udpsock->ring_tail > udpsock->ring_head) {
+        if(udpsock->ring_sz - udpsock->ring_tail >= size) {
+            *off = udpsock->ring_tail;
+            return true;
+        }
+
+        if(udpsock->ring_head >= size) {
+            if(udpsock->ring_sz - udpsock->ring_tail >= sizeof(struct udp_rec))
+                ((struct udp_rec *)(udpsock->ring + udpsock->ring_tail))->
+                    datasize = UDP_REC_WRAP;
+
+            *off = 0;
+            return true;
+        }
+
+        return false;
+    }
+
+    *off = udpsock->ring_tail;
+    return udpsock->ring_head - udpsock->ring_tail >= size;
+}
+
+/* Queue a received datagram on a socket, copying it to the end of its ring,
+   which is grown toward rcvbuf_sz if there is no room left in it. Returns NULL
+   if the datagram doesn't fit in the receive buffer. Assumes udp_mutex is
+   held. */
+static struct udp_rec *udp_ring_push(struct udp_sock *udpsock,
+                                     const uint8_t *data, size_t datasize) {
+    uint32_t size = udp_rec_size(datasize);
+    uint32_t off, sz;
+    struct udp_rec *rec;
+
+    /* A socket with nothing queued always takes one datagram, however large,
+       so that a small SO_RCVBUF doesn't drop every large one. */
+    if(udpsock->ring_cnt &&
+       udpsock->rcvbuf_cur_sz + size > udpsock->rcvbuf_sz)
+        return NULL;
+
+    if(!udp_ring_room(udpsock, size, &off)) {
+        sz = udpsock->ring_sz ? udpsock->ring_sz * 2 : UDP_RING_MIN_SZ;
+
+        while(sz < udpsock->rcvbuf_cur_sz + size)
+            sz *= 2;
+
+        if(sz > udpsock->rcvbuf_sz)
+            sz = udpsock->rcvbuf_sz;
+
+        if(sz < udpsock->rcvbuf_cur_sz + size)
+            sz = udpsock->rcvbuf_cur_sz + size;
+
+        if(udp_ring_realloc(udpsock, sz))
+            return NULL;
+
+        off = udpsock->ring_tail;
+    }
+
+    rec = (struct udp_rec *)(udpsock->ring + off);
+    rec->datasize = datasize;
+    memcpy(rec + 1, data, datasize);
+
+    udpsock->ring_tail = off + size;
+    udpsock->rcvbuf_cur_sz += size;
+    ++udpsock->ring_cnt;
+    ++udp_stats.pkt_queued;
+
+    return rec;
+}
+
+/* Fit the receive ring of a socket to a new SO_RCVBUF. An empty ring is freed,
+   to start small again with the next datagram, and one larger than the new
+   size is shrunk. The ring never gets smaller than what is queued; new
+   datagrams are just dropped until there is room in rcvbuf_sz again. Assumes
+   udp_mutex is held. */
+static int udp_ring_resize(struct udp_sock *udpsock) {
+    uint32_t sz = udpsock->rcvbuf_sz;
+
+    if(!udpsock->ring)
+        return 0;
+
+    if(!udpsock->ring_cnt) {
+        free(udpsock->ring);
+        udpsock->ring = NULL;
+        udpsock->ring_sz = 0;
+        return 0;
+    }
+
+    if(sz < udpsock->rcvbuf_cur_sz)
+        sz = udpsock->rcvbuf_cur_sz;
+
+    if(udpsock->ring_sz <= sz)
+        return 0;
+
+    return udp_ring_realloc(udpsock, sz);
+}
+
 static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
-                            const struct sockaddr_in6 *dst, const uint8_t *data,
-                            size_t size, uint32_t flags, int hops,
-                            uint32_t iflags, int proto, uint16_t cscov);
+                            const struct sockaddr_in6 *dst,
+                            const struct iovec *iov, int iovcnt,
+                            uint32_t flags, int hops, uint32_t iflags,
+                            int proto, uint16_t cscov);
 
 static int net_udp_accept(net_socket_t *hnd, struct sockaddr *addr,
                           socklen_t *addr_len) {
@@ -94,7 +349,7 @@ static int net_udp_accept(net_socket_t *hnd, struct sockaddr *addr,
 
 static int net_udp_bind(net_socket_t *hnd, const struct sockaddr *addr,
                         socklen_t addr_len) {
-    struct udp_sock *udpsock, *iter;
+    struct udp_sock *udpsock;
     struct sockaddr_in *realaddr4;
     struct sockaddr_in6 realaddr6;
 
@@ -167,38 +422,19 @@ static int net_udp_bind(net_socket_t *hnd, const struct sockaddr *addr,
     if(realaddr6.sin6_port != 0) {
         /* Make sure we don't already have a socket bound to the port
            specified */
-        LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-            if(iter == udpsock)
-                continue;
-
-            if(iter->local_addr.sin6_port == realaddr6.sin6_port) {
-                mutex_unlock(&udp_mutex);
-                errno = EADDRINUSE;
-                return -1;
-            }
+        if(udp_port_used(realaddr6.sin6_port, udpsock)) {
+            mutex_unlock(&udp_mutex);
+            errno = EADDRINUSE;
+            return -1;
         }
-
-        udpsock->local_addr = realaddr6;
     }
     else {
-        uint16_t port = 1024, tmp = 0;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
-
-            LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
-            }
-        }
-
-        udpsock->local_addr = realaddr6;
-        udpsock->local_addr.sin6_port = htons(port);
+        realaddr6.sin6_port = udp_free_port(udpsock);
     }
 
+    udpsock->local_addr = realaddr6;
+    udp_rehash(udpsock);
+
     udpsock->sock = hnd->fd;
 
     mutex_unlock(&udp_mutex);
@@ -305,11 +541,50 @@ static int net_udp_listen(net_socket_t *hnd, int backlog) {
     return -1;
 }
 
+/* Give out the address a received packet came from, in the format of the
+   socket's domain. */
+static void udp_get_from(const struct udp_sock *udpsock,
+                         const struct udp_rec *rec, struct sockaddr *addr,
+                         socklen_t *addr_len) {
+    if(udpsock->domain == AF_INET) {
+        struct sockaddr_in realaddr;
+
+        memset(&realaddr, 0, sizeof(struct sockaddr_in));
+        realaddr.sin_family = AF_INET;
+        realaddr.sin_addr.s_addr = rec->from_addr.__s6_addr.__s6_addr32[3];
+        realaddr.sin_port = rec->from_port;
+
+        if(*addr_len < sizeof(struct sockaddr_in)) {
+            memcpy(addr, &realaddr, *addr_len);
+        }
+        else {
+            memcpy(addr, &realaddr, sizeof(struct sockaddr_in));
+            *addr_len = sizeof(struct sockaddr_in);
+        }
+    }
+    else if(udpsock->domain == AF_INET6) {
+        struct sockaddr_in6 realaddr6;
+
+        memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
+        realaddr6.sin6_family = AF_INET6;
+        realaddr6.sin6_addr = rec->from_addr;
+        realaddr6.sin6_port = rec->from_port;
+
+        if(*addr_len < sizeof(struct sockaddr_in6)) {
+            memcpy(addr, &realaddr6, *addr_len);
+        }
+        else {
+            memcpy(addr, &realaddr6, sizeof(struct sockaddr_in6));
+            *addr_len = sizeof(struct sockaddr_in6);
+        }
+    }
+}
+
 static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
                                 int flags, struct sockaddr *addr,
                                 socklen_t *addr_len) {
     struct udp_sock *udpsock;
-    struct udp_pkt *pkt;
+    struct udp_rec *rec;
 
     if(mutex_lock_irqsafe(&udp_mutex))
         return -1;
@@ -333,7 +608,7 @@ static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
         return -1;
     }
 
-    if(TAILQ_EMPTY(&udpsock->packets) &&
+    if(!udpsock->ring_cnt &&
        ((udpsock->flags & FS_SOCKET_NONBLOCK) || (flags & MSG_DONTWAIT) ||
         irq_inside_int())) {
         mutex_unlock(&udp_mutex);
@@ -341,63 +616,28 @@ static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
         return -1;
     }
 
-    while(TAILQ_EMPTY(&udpsock->packets)) {
+    while(!udpsock->ring_cnt) {
         mutex_unlock(&udp_mutex);
         genwait_wait(udpsock, "net_udp_recvfrom", 0, NULL);
         mutex_lock(&udp_mutex);
     }
 
-    pkt = TAILQ_FIRST(&udpsock->packets);
+    rec = udp_ring_first(udpsock);
 
-    if(pkt->datasize > length) {
-        memcpy(buffer, pkt->data, length);
+    if(rec->datasize > length) {
+        memcpy(buffer, rec + 1, length);
     }
     else {
-        memcpy(buffer, pkt->data, pkt->datasize);
-        length = pkt->datasize;
+        memcpy(buffer, rec + 1, rec->datasize);
+        length = rec->datasize;
     }
 
-    if(addr != NULL) {
-        if(udpsock->domain == AF_INET) {
-            struct sockaddr_in realaddr;
-
-            memset(&realaddr, 0, sizeof(struct sockaddr_in));
-            realaddr.sin_family = AF_INET;
-            realaddr.sin_addr.s_addr =
-                pkt->from.sin6_addr.__s6_addr.__s6_addr32[3];
-            realaddr.sin_port = pkt->from.sin6_port;
-
-            if(*addr_len < sizeof(struct sockaddr_in)) {
-                memcpy(addr, &realaddr, *addr_len);
-            }
-            else {
-                memcpy(addr, &realaddr, sizeof(struct sockaddr_in));
-                *addr_len = sizeof(struct sockaddr_in);
-            }
-        }
-        else if(udpsock->domain == AF_INET6) {
-            struct sockaddr_in6 realaddr6;
-
-            memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
-            realaddr6.sin6_family = AF_INET6;
-            realaddr6.sin6_addr = pkt->from.sin6_addr;
-            realaddr6.sin6_port = pkt->from.sin6_port;
-
-            if(*addr_len < sizeof(struct sockaddr_in6)) {
-                memcpy(addr, &realaddr6, *addr_len);
-            }
-            else {
-                memcpy(addr, &realaddr6, sizeof(struct sockaddr_in6));
-                *addr_len = sizeof(struct sockaddr_in6);
-            }
-        }
-    }
+    if(addr != NULL)
+        udp_get_from(udpsock, rec, addr, addr_len);
 
     /* Remove the packet if we're pulling data out of the queue. */
     if(!(flags & MSG_PEEK)) {
-        TAILQ_REMOVE(&udpsock->packets, pkt, pkt_queue);
-        free(pkt->data);
-        free(pkt);
+        udp_ring_pop(udpsock, rec);
     }
 
     mutex_unlock(&udp_mutex);
@@ -405,103 +645,108 @@ static ssize_t net_udp_recvfrom(net_socket_t *hnd, void *buffer, size_t length,
     return length;
 }
 
-static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
-                              size_t length, int flags,
-                              const struct sockaddr *addr, socklen_t addr_len) {
-    struct udp_sock *udpsock;
-    struct sockaddr_in *realaddr;
-    struct sockaddr_in6 realaddr6;
-    uint32_t sflags, iflags;
-    int hops, proto;
-    uint16_t cscov;
-    struct sockaddr_in6 local_addr;
-
-    (void)flags;
-
-    if(mutex_lock_irqsafe(&udp_mutex))
-        return -1;
-
-    udpsock = (struct udp_sock *)hnd->data;
-
-    if(udpsock == NULL) {
-        errno = EBADF;
-        goto err;
-    }
-
-    if(udpsock->flags & (SHUT_WR << 24)) {
-        errno = EPIPE;
-        goto err;
-    }
+/* Work out where a datagram sent on the socket should go. Assumes udp_mutex is
+   held. */
+static int udp_get_dest(const struct udp_sock *udpsock,
+                        const struct sockaddr *addr, socklen_t addr_len,
+                        struct sockaddr_in6 *dst) {
+    const struct sockaddr_in *realaddr;
 
     if(!IN6_IS_ADDR_UNSPECIFIED(&udpsock->remote_addr.sin6_addr) &&
        udpsock->remote_addr.sin6_port != 0) {
         if(addr) {
             errno = EISCONN;
-            goto err;
+            return -1;
         }
 
-        realaddr6 = udpsock->remote_addr;
+        *dst = udpsock->remote_addr;
     }
     else if(addr == NULL) {
         errno = EDESTADDRREQ;
-        goto err;
+        return -1;
     }
     else if(addr->sa_family != udpsock->domain) {
         errno = EAFNOSUPPORT;
-        goto err;
+        return -1;
     }
     else if(udpsock->domain == AF_INET6) {
         if(addr_len != sizeof(struct sockaddr_in6)) {
             errno = EINVAL;
-            goto err;
+            return -1;
         }
 
-        realaddr6 = *((struct sockaddr_in6 *)addr);
+        *dst = *((const struct sockaddr_in6 *)addr);
     }
     else if(udpsock->domain == AF_INET) {
         if(addr_len != sizeof(struct sockaddr_in)) {
             errno = EINVAL;
-            goto err;
+            return -1;
         }
 
-        realaddr = (struct sockaddr_in *)addr;
-        memset(&realaddr6, 0, sizeof(struct sockaddr_in6));
-        realaddr6.sin6_family = AF_INET6;
-        realaddr6.sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
-        realaddr6.sin6_addr.__s6_addr.__s6_addr32[3] =
-            realaddr->sin_addr.s_addr;
-        realaddr6.sin6_port = realaddr->sin_port;
+        realaddr = (const struct sockaddr_in *)addr;
+        memset(dst, 0, sizeof(struct sockaddr_in6));
+        dst->sin6_family = AF_INET6;
+        dst->sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
+        dst->sin6_addr.__s6_addr.__s6_addr32[3] = realaddr->sin_addr.s_addr;
+        dst->sin6_port = realaddr->sin_port;
     }
     else {
         /* Shouldn't be able to get here... */
         errno = EBADF;
-        goto err;
+        return -1;
     }
 
-    if(message == NULL) {
-        errno = EFAULT;
+    return 0;
+}
+
+/* Give the socket a local port if it doesn't have one yet. Assumes udp_mutex
+   is held. */
+static void udp_autobind(struct udp_sock *udpsock) {
+    if(udpsock->local_addr.sin6_port != 0)
+        return;
+
+    udpsock->local_addr.sin6_port = udp_free_port(udpsock);
+    udp_rehash(udpsock);
+}
+
+static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
+                              size_t length, int flags,
+                              const struct sockaddr *addr, socklen_t addr_len) {
+    struct udp_sock *udpsock;
+    struct sockaddr_in6 realaddr6;
+    struct iovec iov;
+    uint32_t sflags, iflags;
+    int hops, proto;
+    uint16_t cscov;
+    struct sockaddr_in6 local_addr;
+
+    (void)flags;
+
+    if(mutex_lock_irqsafe(&udp_mutex))
+        return -1;
+
+    udpsock = (struct udp_sock *)hnd->data;
+
+    if(udpsock == NULL) {
+        errno = EBADF;
         goto err;
     }
 
-    if(udpsock->local_addr.sin6_port == 0) {
-        uint16_t port = 1024, tmp = 0;
-        struct udp_sock *iter;
-
-        /* Grab the first unused port >= 1024. This is, unfortunately, O(n^2) */
-        while(tmp != port) {
-            tmp = port;
+    if(udpsock->flags & (SHUT_WR << 24)) {
+        errno = EPIPE;
+        goto err;
+    }
 
-            LIST_FOREACH(iter, &net_udp_sockets, sock_list) {
-                if(iter->local_addr.sin6_port == port) {
-                    ++port;
-                    break;
-                }
-            }
-        }
+    if(udp_get_dest(udpsock, addr, addr_len, &realaddr6))
+        goto err;
 
-        udpsock->local_addr.sin6_port = htons(port);
+    if(message == NULL) {
+        errno = EFAULT;
+        goto err;
     }
 
+    udp_autobind(udpsock);
+
     local_addr = udpsock->local_addr;
     sflags = udpsock->flags;
     iflags = udpsock->int_flags;
@@ -510,14 +755,201 @@ static ssize_t net_udp_sendto(net_socket_t *hnd, const void *message,
     cscov = udpsock->udp_lite.send_cscov;
     mutex_unlock(&udp_mutex);
 
-    return net_udp_send_raw(NULL, &local_addr, &realaddr6,
-                            (const uint8_t *)message, length, sflags, hops,
-                            iflags, proto, cscov);
+    iov.iov_base = (void *)message;
+    iov.iov_len = length;
+
+    return net_udp_send_raw(NULL, &local_addr, &realaddr6, &iov, 1, sflags,
+                            hops, iflags, proto, cscov);
 err:
     mutex_unlock(&udp_mutex);
     return -1;
 }
 
+static int net_udp_recvmmsg(net_socket_t *hnd, struct mmsghdr *msgvec,
+                            unsigned int vlen, int flags,
+                            const struct timespec *timeout) {
+    struct udp_sock *udpsock;
+    struct udp_rec *rec;
+    struct msghdr *msg;
+    uint64_t end = 0, now;
+    size_t len, cnt;
+    unsigned int n = 0;
+    int i, wait = 0;
+
+    if(timeout)
+        end = timer_ms_gettime64() + timeout->tv_sec * 1000 +
+              timeout->tv_nsec / 1000000;
+
+    if(mutex_lock_irqsafe(&udp_mutex))
+        return -1;
+
+    udpsock = (struct udp_sock *)hnd->data;
+
+    if(udpsock == NULL) {
+        mutex_unlock(&udp_mutex);
+        errno = EBADF;
+        return -1;
+    }
+
+    if(udpsock->flags & (SHUT_RD << 24)) {
+        mutex_unlock(&udp_mutex);
+        return 0;
+    }
+
+    /* Drain as many datagrams as there are, all under the one lock. */
+    while(n < vlen) {
+        if(!udpsock->ring_cnt) {
+            if(n && (flags & MSG_WAITFORONE))
+                break;
+
+            if((udpsock->flags & FS_SOCKET_NONBLOCK) ||
+               (flags & MSG_DONTWAIT) || irq_inside_int())
+                break;
+
+            if(timeout) {
+                now = timer_ms_gettime64();
+
+                if(now >= end)
+                    break;
+
+                wait = (int)(end - now);
+            }
+
+            mutex_unlock(&udp_mutex);
+            genwait_wait(udpsock, "net_udp_recvmmsg", wait, NULL);
+            mutex_lock(&udp_mutex);
+            continue;
+        }
+
+        rec = udp_ring_first(udpsock);
+        msg = &msgvec[n].msg_hdr;
+
+        if(msg->msg_iovlen && msg->msg_iov == NULL) {
+            if(!n) {
+                mutex_unlock(&udp_mutex);
+                errno = EFAULT;
+                return -1;
+            }
+
+            break;
+        }
+
+        len = 0;
+
+        for(i = 0; i < msg->msg_iovlen && len < rec->datasize; ++i) {
+            cnt = rec->datasize - len;
+
+            if(cnt > msg->msg_iov[i].iov_len)
+                cnt = msg->msg_iov[i].iov_len;
+
+            memcpy(msg->msg_iov[i].iov_base, (uint8_t *)(rec + 1) + len, cnt);
+            len += cnt;
+        }
+
+        msg->msg_flags = len < rec->datasize ? MSG_TRUNC : 0;
+        msg->msg_controllen = 0;
+
+        if(msg->msg_name != NULL)
+            udp_get_from(udpsock, rec, (struct sockaddr *)msg->msg_name,
+                         &msg->msg_namelen);
+
+        msgvec[n++].msg_len = len;
+
+        /* Peeking again would only give the same datagram. */
+        if(flags & MSG_PEEK)
+            break;
+
+        udp_ring_pop(udpsock, rec);
+    }
+
+    mutex_unlock(&udp_mutex);
+
+    if(!n) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    return n;
+}
+
+static int net_udp_sendmmsg(net_socket_t *hnd, struct mmsghdr *msgvec,
+                            unsigned int vlen, int flags) {
+    struct udp_sock *udpsock;
+    struct sockaddr_in6 dst[UDP_MMSG_BATCH], local_addr;
+    struct msghdr *msg;
+    uint32_t sflags, iflags;
+    int hops, proto, rv;
+    uint16_t cscov;
+    unsigned int n = 0, cnt, i;
+
+    (void)flags;
+
+    while(n < vlen) {
+        if(mutex_lock_irqsafe(&udp_mutex))
+            break;
+
+        udpsock = (struct udp_sock *)hnd->data;
+
+        if(udpsock == NULL) {
+            errno = EBADF;
+            mutex_unlock(&udp_mutex);
+            break;
+        }
+
+        if(udpsock->flags & (SHUT_WR << 24)) {
+            errno = EPIPE;
+            mutex_unlock(&udp_mutex);
+            break;
+        }
+
+        /* Look up where a batch of datagrams goes with the lock held once,
+           but send them without it: looped back packets come right back in
+           through net_udp_input(), which needs it. */
+        cnt = vlen - n < UDP_MMSG_BATCH ? vlen - n : UDP_MMSG_BATCH;
+
+        for(i = 0; i < cnt; ++i) {
+            msg = &msgvec[n + i].msg_hdr;
+
+            if(msg->msg_iovlen && msg->msg_iov == NULL) {
+                errno = EFAULT;
+                break;
+            }
+
+            if(udp_get_dest(udpsock, (const struct sockaddr *)msg->msg_name,
+                            msg->msg_namelen, &dst[i]))
+                break;
+        }
+
+        udp_autobind(udpsock);
+
+        local_addr = udpsock->local_addr;
+        sflags = udpsock->flags;
+        iflags = udpsock->int_flags;
+        hops = udpsock->hop_limit;
+        proto = udpsock->proto;
+        cscov = udpsock->udp_lite.send_cscov;
+        mutex_unlock(&udp_mutex);
+
+        for(cnt = i, i = 0; i < cnt; ++i, ++n) {
+            msg = &msgvec[n].msg_hdr;
+            rv = net_udp_send_raw(NULL, &local_addr, &dst[i], msg->msg_iov,
+                                  msg->msg_iovlen, sflags, hops, iflags, proto,
+                                  cscov);
+
+            if(rv < 0)
+                return n ? (int)n : -1;
+
+            msgvec[n].msg_len = rv;
+        }
+
+        /* Stop at a datagram we couldn't find the destination of. */
+        if(cnt < UDP_MMSG_BATCH && n < vlen)
+            break;
+    }
+
+    return n ? (int)n : -1;
+}
+
 static int net_udp_shutdownsock(net_socket_t *hnd, int how) {
     struct udp_sock *udpsock;
 
@@ -568,17 +1000,17 @@ static int net_udp_socket(net_socket_t *hnd, int domain, int type, int proto) {
     }
 
     memset(udpsock, 0, sizeof(struct udp_sock));
-    TAILQ_INIT(&udpsock->packets);
     udpsock->domain = domain;
     udpsock->proto = proto;
     udpsock->hop_limit = UDP_DEFAULT_HOPS;
+    udpsock->rcvbuf_sz = UDP_DEFAULT_RCVBUF;
 
     if(mutex_lock_irqsafe(&udp_mutex)) {
         free(udpsock);
         return -1;
     }
 
-    LIST_INSERT_HEAD(&net_udp_sockets, udpsock, sock_list);
+    LIST_INSERT_HEAD(udp_bucket(0), udpsock, sock_list);
     hnd->data = udpsock;
     mutex_unlock(&udp_mutex);
 
@@ -587,8 +1019,6 @@ static int net_udp_socket(net_socket_t *hnd, int domain, int type, int proto) {
 
 static void net_udp_close(net_socket_t *hnd) {
     struct udp_sock *udpsock;
-    struct udp_pkt *pkt;
-    struct udp_pkt *it;
 
     if(mutex_lock_irqsafe(&udp_mutex))
         return;
@@ -601,18 +1031,11 @@ static void net_udp_close(net_socket_t *hnd) {
         return;
     }
 
-    it = udpsock->packets.tqh_first;
-    while(it) {
-        pkt = it;
-        it = it->pkt_queue.tqe_next;
-
-        free(pkt->data);
-        TAILQ_REMOVE(&udpsock->packets, pkt, pkt_queue);
-        free(pkt);
-    }
+    udp_stats.pkt_queued -= udpsock->ring_cnt;
 
     LIST_REMOVE(udpsock, sock_list);
 
+    free(udpsock->ring);
     free(udpsock);
     mutex_unlock(&udp_mutex);
 }
@@ -638,6 +1061,10 @@ static int net_udp_getsockopt(net_socket_t *hnd, int level, int option_name,
                     tmp = 0;
                     goto copy_int;
 
+                case SO_RCVBUF:
+                    tmp = sock->rcvbuf_sz;
+                    goto copy_int;
+
                 case SO_TYPE:
                     tmp = SOCK_DGRAM;
                     goto copy_int;
@@ -752,6 +1179,28 @@ static int net_udp_setsockopt(net_socket_t *hnd, int level, int option_name,
                 case SO_ERROR:
                 case SO_TYPE:
                     goto ret_inval;
+
+                case SO_RCVBUF:
+                    if(option_len != sizeof(int))
+                        goto ret_inval;
+
+                    /* Datagrams already queued past the new size stay, only
+                       new ones are dropped until there is room again. */
+                    tmp = *((int *)option_value);
+
+                    if(tmp < UDP_MIN_RCVBUF)
+                        tmp = UDP_MIN_RCVBUF;
+                    else if(tmp > UDP_MAX_RCVBUF)
+                        tmp = UDP_MAX_RCVBUF;
+
+                    sock->rcvbuf_sz = tmp;
+
+                    if(udp_ring_resize(sock)) {
+                        mutex_unlock(&udp_mutex);
+                        return -1;
+                    }
+
+                    goto ret_success;
             }
 
             break;
@@ -1087,7 +1536,7 @@ static short net_udp_poll(net_socket_t *hnd, short events) {
         return POLLNVAL;
     }
 
-    if(!TAILQ_EMPTY(&sock->packets))
+    if(sock->ring_cnt)
         rv |= POLLRDNORM;
 
     mutex_unlock(&udp_mutex);
@@ -1103,7 +1552,7 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8_t *data,
     uint16_t cs, cscov = 0;
     int partial = 1;
     struct udp_sock *sock;
-    struct udp_pkt *pkt;
+    struct udp_rec *rec;
 
     (void)src;
 
@@ -1160,7 +1609,7 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8_t *data,
         /* If the mutex is locked, there isn't much that can be done. */
         return -1;
 
-    LIST_FOREACH(sock, &net_udp_sockets, sock_list) {
+    LIST_FOREACH(sock, udp_bucket(hdr->dst_port), sock_list) {
         /* Don't even bother looking at IPv6-only sockets */
         if(sock->domain == AF_INET6 && (sock->flags & FS_SOCKET_V6ONLY))
             continue;
@@ -1198,29 +1647,17 @@ static int net_udp_input4(netif_t *src, const ip_hdr_t *ip, const uint8_t *data,
             return 0;
         }
 
-        if(!(pkt = (struct udp_pkt *)malloc(sizeof(struct udp_pkt)))) {
-            mutex_unlock(&udp_mutex);
-            return -1;
-        }
-
-        memset(pkt, 0, sizeof(struct udp_pkt));
-
-        pkt->datasize = size - sizeof(udp_hdr_t);
-
-        if(!(pkt->data = (uint8_t *)malloc(pkt->datasize))) {
-            free(pkt);
+        if(!(rec = udp_ring_push(sock, data + sizeof(udp_hdr_t),
+                                 size - sizeof(udp_hdr_t)))) {
+            ++udp_stats.pkt_recv_no_space;
             mutex_unlock(&udp_mutex);
             return -1;
         }
 
-        pkt->from.sin6_family = AF_INET6;
-        pkt->from.sin6_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
-        pkt->from.sin6_addr.__s6_addr.__s6_addr32[3] = ip->src;
-        pkt->from.sin6_port = hdr->src_port;
-
-        memcpy(pkt->data, data + sizeof(udp_hdr_t), pkt->datasize);
-
-        TAILQ_INSERT_TAIL(&sock->packets, pkt, pkt_queue);
+        memset(&rec->from_addr, 0, sizeof(struct in6_addr));
+        rec->from_addr.__s6_addr.__s6_addr16[5] = 0xFFFF;
+        rec->from_addr.__s6_addr.__s6_addr32[3] = ip->src;
+        rec->from_port = hdr->src_port;
 
         ++udp_stats.pkt_recv;
         __poll_event_trigger(sock->sock, POLLRDNORM);
@@ -1242,7 +1679,7 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8_t *dat
     uint16_t cs, cscov = 0;
     int partial = 1;
     struct udp_sock *sock;
-    struct udp_pkt *pkt;
+    struct udp_rec *rec;
 
     (void)src;
 
@@ -1297,7 +1734,7 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8_t *dat
         /* If the mutex is locked, there isn't much that can be done. */
         return -1;
 
-    LIST_FOREACH(sock, &net_udp_sockets, sock_list) {
+    LIST_FOREACH(sock, udp_bucket(hdr->dst_port), sock_list) {
         /* Don't even bother looking at IPv4 sockets */
         if(sock->domain == AF_INET)
             continue;
@@ -1335,28 +1772,15 @@ static int net_udp_input6(netif_t *src, const ipv6_hdr_t *ip, const uint8_t *dat
             return 0;
         }
 
-        if(!(pkt = (struct udp_pkt *)malloc(sizeof(struct udp_pkt)))) {
+        if(!(rec = udp_ring_push(sock, data + sizeof(udp_hdr_t),
+                                 size - sizeof(udp_hdr_t)))) {
+            ++udp_stats.pkt_recv_no_space;
             mutex_unlock(&udp_mutex);
             return -1;
         }
 
-        memset(pkt, 0, sizeof(struct udp_pkt));
-
-        pkt->datasize = size - sizeof(udp_hdr_t);
-
-        if(!(pkt->data = (uint8_t *)malloc(pkt->datasize))) {
-            free(pkt);
-            mutex_unlock(&udp_mutex);
-            return -1;
-        }
-
-        pkt->from.sin6_family = AF_INET6;
-        pkt->from.sin6_addr = ip->src_addr;
-        pkt->from.sin6_port = hdr->src_port;
-
-        memcpy(pkt->data, data + sizeof(udp_hdr_t), pkt->datasize);
-
-        TAILQ_INSERT_TAIL(&sock->packets, pkt, pkt_queue);
+        rec->from_addr = ip->src_addr;
+        rec->from_port = hdr->src_port;
 
         ++udp_stats.pkt_recv;
         __poll_event_trigger(sock->sock, POLLRDNORM);
@@ -1385,19 +1809,54 @@ static int net_udp_input(netif_t *src, int domain, const void *hdr,
     return -1;
 }
 
+/* Total length of an I/O vector, or -1 if it's too long for a datagram. */
+static ssize_t udp_iov_len(const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
+    int i;
+
+    for(i = 0; i < iovcnt; ++i) {
+        if(iov[i].iov_len > 0xFFFF - sizeof(udp_hdr_t) - len)
+            return -1;
+
+        len += iov[i].iov_len;
+    }
+
+    return len;
+}
+
+/* Gather an I/O vector into a packet. */
+static void udp_iov_copy(uint8_t *dst, const struct iovec *iov, int iovcnt) {
+    int i;
+
+    for(i = 0; i < iovcnt; ++i) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+}
+
 /* XXX */
 static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
-                            const struct sockaddr_in6 *dst, const uint8_t *data,
-                            size_t size, uint32_t flags, int hops,
-                            uint32_t iflags, int proto, uint16_t cscov) {
+                            const struct sockaddr_in6 *dst,
+                            const struct iovec *iov, int iovcnt,
+                            uint32_t flags, int hops, uint32_t iflags,
+                            int proto, uint16_t cscov) {
+    ssize_t len = udp_iov_len(iov, iovcnt);
+    size_t size = len < 0 ? 0 : (size_t)len;
     uint8_t buf[size + sizeof(udp_hdr_t)];
     udp_hdr_t *hdr = (udp_hdr_t *)buf;
+    uint8_t *dp;
     uint16_t cs;
-    int err;
+    int err, i;
     struct in6_addr srcaddr = src->sin6_addr;
 
     (void)flags;
 
+    if(len < 0) {
+        errno = EMSGSIZE;
+        ++udp_stats.pkt_send_failed;
+        return -1;
+    }
+
     if(!net) {
         net = net_default_dev;
 
@@ -1434,24 +1893,52 @@ static int net_udp_send_raw(netif_t *net, const struct sockaddr_in6 *src,
         }
     }
 
-    memcpy(buf + sizeof(udp_hdr_t), data, size);
-    size += sizeof(udp_hdr_t);
-
     hdr->src_port = src->sin6_port;
     hdr->dst_port = dst->sin6_port;
     hdr->checksum = 0;
 
     /* Is this UDP or UDP-Lite? */
     if(proto == IPPROTO_UDP) {
-        hdr->length = htons(size);
+        hdr->length = htons(size + sizeof(udp_hdr_t));
 
         if(!(iflags & UDPSOCK_NO_CHECKSUM)) {
-            cs = net_ipv6_checksum_pseudo(&srcaddr, &dst->sin6_addr, size,
-                                          proto);
-            hdr->checksum = net_ipv4_checksum(buf, size, cs);
+            /* Checksum the data while copying it in, so that it is only gone
+               over once, then finish up with the header. That only works as
+               long as every piece starts at an even offset. */
+            cs = net_ipv6_checksum_pseudo(&srcaddr, &dst->sin6_addr,
+                                          size + sizeof(udp_hdr_t), proto);
+            dp = buf + sizeof(udp_hdr_t);
+
+            for(i = 0; i < iovcnt; ++i) {
+                if((dp - buf) & 1)
+                    break;
+
+                cs = net_ipv4_checksum_copy(dp, iov[i].iov_base,
+                                            iov[i].iov_len, cs);
+                dp += iov[i].iov_len;
+            }
+
+            size += sizeof(udp_hdr_t);
+
+            if(i < iovcnt) {
+                udp_iov_copy(dp, iov + i, iovcnt - i);
+                cs = net_ipv6_checksum_pseudo(&srcaddr, &dst->sin6_addr, size,
+                                              proto);
+                hdr->checksum = net_ipv4_checksum(buf, size, cs);
+            }
+            else {
+                hdr->checksum = net_ipv4_checksum(buf, sizeof(udp_hdr_t), cs);
+            }
+        }
+        else {
+            udp_iov_copy(buf + sizeof(udp_hdr_t), iov, iovcnt);
+            size += sizeof(udp_hdr_t);
         }
     }
     else {
+        udp_iov_copy(buf + sizeof(udp_hdr_t), iov, iovcnt);
+        size += sizeof(udp_hdr_t);
+
         if(cscov <= size) {
             hdr->length = htons(cscov);
         }
@@ -1503,7 +1990,9 @@ static fs_socket_proto_t proto = {
     net_udp_getsockname,
     net_udp_getpeername,
     net_udp_fcntl,
-    net_udp_poll
+    net_udp_poll,
+    net_udp_recvmmsg,
+    net_udp_sendmmsg
 };
 
 static fs_socket_proto_t proto_lite = {
@@ -1526,7 +2015,9 @@ static fs_socket_proto_t proto_lite = {
     net_udp_getsockname,
     net_udp_getpeername,
     net_udp_fcntl,
-    net_udp_poll
+    net_udp_poll,
+    net_udp_recvmmsg,
+    net_udp_sendmmsg
 };
 
 int net_udp_init(void) {
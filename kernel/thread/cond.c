@@ -21,8 +21,56 @@
 
 /**************************************/
 
+/* Wake up to cnt (or all, if <= 0) waiters. Any thread we woke would only
+   go and block on the mutex, unless it is free, so move them straight onto
+   the mutex's wait queue instead (wait morphing): unlocking it will then
+   wake them one at a time. Priority inheritance mutexes are left alone, as
+   their owner would need boosting for each of the new waiters. Assumes
+   interrupts are disabled. */
+static void cond_wake(condvar_t *cv, int cnt) {
+    mutex_t *m;
+    int moved;
+
+    /* With nobody waiting, the mutex the last waiter used may well be gone,
+       so don't touch it. */
+    if(!genwait_first(cv))
+        goto out;
+
+    m = cv->mutex;
+
+    if(m && !(m->type & MUTEX_TYPE_PI)) {
+        /* If nobody holds the mutex, let one thread go and take it. */
+        if(!m->holder) {
+            genwait_wake_one(cv);
+
+            if(cnt > 0 && !--cnt)
+                goto out;
+        }
+
+        moved = genwait_requeue(cv, m, cnt, "cond_wait (mutex)");
+
+        if(m->holder && moved)
+            __mutex_set_waiters(m);
+
+        if(cnt > 0) {
+            if(moved >= cnt)
+                goto out;
+
+            cnt -= moved;
+        }
+    }
+
+    /* Wake whatever is left, like non-thread waiters */
+    genwait_wake_cnt(cv, cnt, 0);
+
+out:
+    if(!genwait_first(cv))
+        cv->mutex = NULL;
+}
+
 int cond_init(condvar_t *cv) {
     cv->dummy = 0;
+    cv->mutex = NULL;
     return 0;
 }
 
@@ -30,6 +78,7 @@ int cond_init(condvar_t *cv) {
 int cond_destroy(condvar_t *cv) {
     /* Give all sleeping threads a timed out error */
     genwait_wake_all_err(cv, ENOTRECOVERABLE);
+    cv->mutex = NULL;
 
     return 0;
 }
@@ -45,13 +94,14 @@ int cond_wait_timed(condvar_t *cv, mutex_t *m, int timeout) {
 
     irq_disable_scoped();
 
-    if(m->type > MUTEX_TYPE_RECURSIVE ||
+    if((m->type & ~MUTEX_TYPE_PI) > MUTEX_TYPE_RECURSIVE ||
        !mutex_is_locked(m)) {
         errno = EINVAL;
         return -1;
     }
 
     /* First of all, release the associated mutex */
+    cv->mutex = m;
     mutex_unlock(m);
 
     /* Now block us until we're signaled */
@@ -61,9 +111,18 @@ int cond_wait_timed(condvar_t *cv, mutex_t *m, int timeout) {
     if(rv < 0 && errno == EAGAIN)
         errno = ETIMEDOUT;
 
-    /* Re-lock our mutex */
+    /* The last waiter to time out forgets the mutex too */
+    if(!genwait_first(cv))
+        cv->mutex = NULL;
+
+    /* Re-lock our mutex. We may have got it without blocking, while the
+       other threads woken with us got moved onto it by cond_wake(), so make
+       sure we wake them up when unlocking it. */
     mutex_lock(m);
 
+    if(genwait_first(m))
+        __mutex_set_waiters(m);
+
     return rv;
 }
 
@@ -75,7 +134,7 @@ int cond_signal(condvar_t *cv) {
     irq_disable_scoped();
 
     /* Wake one thread who's waiting, if any */
-    genwait_wake_one(cv);
+    cond_wake(cv, 1);
 
     return 0;
 }
@@ -84,7 +143,7 @@ int cond_broadcast(condvar_t *cv) {
     irq_disable_scoped();
 
     /* Wake all threads who are waiting */
-    genwait_wake_all(cv);
+    cond_wake(cv, -1);
 
     return 0;
 }
@@ -0,0 +1,323 @@
+/* KallistiOS ##version##
+
+   fiber.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Cooperative fibers. Each host thread keeps a run queue of fibers and a list
+   of blocked ones. Blocked fibers sleep on their object through a genwait
+   waiter, whose callback just moves them back to the run queue and pokes the
+   host. Timeouts are handled by the host itself, as it is the one that sleeps
+   when nothing can run. */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/queue.h>
+
+#include <kos/fiber.h>
+#include <kos/genwait.h>
+#include <kos/thread.h>
+#include <kos/timer.h>
+#include <arch/fiber.h>
+#include <arch/irq.h>
+#include <arch/stack.h>
+
+typedef enum fiber_state {
+    FIBER_READY,
+    FIBER_RUNNING,
+    FIBER_WAIT,
+    FIBER_DONE,
+} fiber_state_t;
+
+struct kfiber {
+    arch_fiber_ctx_t ctx;
+    TAILQ_ENTRY(kfiber) q;
+    struct fiber_host *host;
+
+    void (*routine)(void *);
+    void *data;
+    void *stack;
+
+    fiber_state_t state;
+    genwait_waiter_t waiter;
+    uint64_t deadline;
+    int wait_err;
+};
+
+TAILQ_HEAD(fiberq, kfiber);
+
+struct fiber_host {
+    arch_fiber_ctx_t ctx;
+    kfiber_t *current;
+    unsigned int count;
+    bool running;
+
+    /* Earliest timeout of the blocked fibers (0 for none). */
+    uint64_t deadline;
+
+    struct fiberq ready;
+    struct fiberq waiting;
+};
+
+kfiber_t *fiber_self(void) {
+    struct fiber_host *host = thd_current->fibers;
+
+    return host ? host->current : NULL;
+}
+
+static void fiber_entry(void) {
+    kfiber_t *f = thd_current->fibers->current;
+
+    f->routine(f->data);
+
+    /* The host frees us once it's back on its own stack. */
+    f->state = FIBER_DONE;
+    arch_fiber_switch(&f->ctx, &f->host->ctx);
+
+    __builtin_unreachable();
+}
+
+kfiber_t *fiber_create(void (*routine)(void *), void *data,
+                       size_t stack_size) {
+    struct fiber_host *host = thd_current->fibers;
+    kfiber_t *f;
+
+    assert(routine != NULL);
+
+    if(!stack_size)
+        stack_size = FIBER_STACK_SIZE;
+
+    stack_size = (stack_size + THD_STACK_ALIGNMENT - 1) &
+        ~(THD_STACK_ALIGNMENT - 1);
+
+    if(!host) {
+        host = malloc(sizeof(*host));
+        if(!host) {
+            errno = ENOMEM;
+            return NULL;
+        }
+
+        host->current = NULL;
+        host->count = 0;
+        host->running = false;
+        host->deadline = 0;
+        TAILQ_INIT(&host->ready);
+        TAILQ_INIT(&host->waiting);
+
+        thd_current->fibers = host;
+    }
+
+    f = malloc(sizeof(*f));
+    if(!f)
+        goto out_free_host;
+
+    f->stack = aligned_alloc(THD_STACK_ALIGNMENT, stack_size);
+    if(!f->stack)
+        goto out_free_fiber;
+
+    f->host = host;
+    f->routine = routine;
+    f->data = data;
+    f->state = FIBER_READY;
+    f->waiter.obj = NULL;
+    f->deadline = 0;
+    f->wait_err = 0;
+
+    arch_fiber_init(&f->ctx, (uint8_t *)f->stack + stack_size, fiber_entry);
+
+    irq_disable_scoped();
+
+    ++host->count;
+    TAILQ_INSERT_TAIL(&host->ready, f, q);
+
+    return f;
+
+out_free_fiber:
+    free(f);
+out_free_host:
+    if(!host->count && !host->running) {
+        thd_current->fibers = NULL;
+        free(host);
+    }
+
+    errno = ENOMEM;
+    return NULL;
+}
+
+/* Make a blocked fiber runnable again. Assumes interrupts are disabled. */
+static void fiber_ready(kfiber_t *f, int err) {
+    struct fiber_host *host = f->host;
+
+    TAILQ_REMOVE(&host->waiting, f, q);
+    f->state = FIBER_READY;
+    f->wait_err = err;
+    TAILQ_INSERT_TAIL(&host->ready, f, q);
+
+    genwait_wake_all(host);
+}
+
+static void fiber_wake(genwait_waiter_t *w, int err) {
+    kfiber_t *f = (kfiber_t *)((uint8_t *)w - offsetof(kfiber_t, waiter));
+
+    fiber_ready(f, err);
+}
+
+/* Wake up fibers whose timeout expired, and figure out how long the host can
+   sleep for. Assumes interrupts are disabled. */
+static unsigned int fiber_check_timeouts(struct fiber_host *host,
+                                         uint64_t now) {
+    uint64_t next = 0;
+    kfiber_t *f, *nf;
+
+    TAILQ_FOREACH_SAFE(f, &host->waiting, q, nf) {
+        if(!f->deadline)
+            continue;
+
+        if(f->deadline <= now) {
+            genwait_waiter_remove(&f->waiter);
+            fiber_ready(f, EAGAIN);
+        }
+        else if(!next || f->deadline < next) {
+            next = f->deadline;
+        }
+    }
+
+    host->deadline = next;
+
+    return next ? (unsigned int)(next - now) : 0;
+}
+
+int fiber_run(void) {
+    struct fiber_host *host = thd_current->fibers;
+    unsigned int timeout;
+    irq_mask_t flags;
+    kfiber_t *f;
+
+    if(!host)
+        return 0;
+
+    if(host->current) {
+        errno = EDEADLK;
+        return -1;
+    }
+
+    host->running = true;
+
+    for(;;) {
+        flags = irq_disable();
+
+        /* Don't let fibers that keep yielding hold up the timeouts. */
+        if(host->deadline && timer_ms_gettime64() >= host->deadline)
+            fiber_check_timeouts(host, timer_ms_gettime64());
+
+        if(TAILQ_EMPTY(&host->ready)) {
+            if(!host->count) {
+                irq_restore(flags);
+                break;
+            }
+
+            timeout = fiber_check_timeouts(host, timer_ms_gettime64());
+
+            /* Everyone is blocked: sleep until one of them gets woken. Any
+               waker runs with interrupts disabled, so we can't miss it. */
+            if(TAILQ_EMPTY(&host->ready))
+                genwait_wait(host, "fiber_run", timeout, NULL);
+
+            irq_restore(flags);
+            continue;
+        }
+
+        f = TAILQ_FIRST(&host->ready);
+        TAILQ_REMOVE(&host->ready, f, q);
+        f->state = FIBER_RUNNING;
+
+        irq_restore(flags);
+
+        host->current = f;
+        arch_fiber_switch(&host->ctx, &f->ctx);
+        host->current = NULL;
+
+        if(f->state == FIBER_DONE) {
+            flags = irq_disable();
+            --host->count;
+            irq_restore(flags);
+
+            free(f->stack);
+            free(f);
+        }
+    }
+
+    thd_current->fibers = NULL;
+    free(host);
+
+    return 0;
+}
+
+void fiber_yield(void) {
+    kfiber_t *f = fiber_self();
+    irq_mask_t flags;
+
+    if(!f) {
+        thd_pass();
+        return;
+    }
+
+    flags = irq_disable();
+
+    f->state = FIBER_READY;
+    TAILQ_INSERT_TAIL(&f->host->ready, f, q);
+
+    irq_restore(flags);
+
+    arch_fiber_switch(&f->ctx, &f->host->ctx);
+}
+
+int fiber_wait(void *obj, const char *mesg, unsigned int timeout) {
+    kfiber_t *f = fiber_self();
+    irq_mask_t flags;
+
+    if(!f)
+        return genwait_wait(obj, mesg, timeout, NULL);
+
+    flags = irq_disable();
+
+    f->state = FIBER_WAIT;
+    f->wait_err = 0;
+    f->deadline = timeout ? timer_ms_gettime64() + timeout : 0;
+    TAILQ_INSERT_TAIL(&f->host->waiting, f, q);
+
+    if(f->deadline && (!f->host->deadline || f->deadline < f->host->deadline))
+        f->host->deadline = f->deadline;
+
+    f->waiter.wake = fiber_wake;
+    genwait_waiter_add(&f->waiter, obj);
+
+    irq_restore(flags);
+
+    /* If we get woken before we're even switched out, we're just back on the
+       run queue, and the host picks us right back up. */
+    arch_fiber_switch(&f->ctx, &f->host->ctx);
+
+    if(f->wait_err) {
+        errno = f->wait_err;
+        return -1;
+    }
+
+    return 0;
+}
+
+void fiber_sleep(unsigned int ms) {
+    kfiber_t *f = fiber_self();
+
+    if(!f) {
+        thd_sleep(ms);
+        return;
+    }
+
+    /* Nobody wakes the fiber itself up, so this only returns on timeout. */
+    if(ms)
+        fiber_wait(f, "fiber_sleep", ms);
+    else
+        fiber_yield();
+}
@@ -23,61 +23,171 @@
 #include <kos/timer.h>
 #include <kos/dbglog.h>
 #include <kos/genwait.h>
+#include <kos/hrtimer.h>
 #include <kos/sem.h>
-
-/* Our sleep queues table. This is also modeled after the BSD numbers. I
-   figure if they've been using it as long as they have, they must be
-   on to something. :) */
-#define TABLESIZE   128
+#include <kos/opts.h>
+#include <kos/trace.h>
+
+/* Our sleep queues table. The size can be tuned in kos/opts.h. Objects are
+   hashed with a multiplicative (Fibonacci) hash: taking the top bits of the
+   product mixes in all the address bits, so objects that sit close together
+   in memory (like the mutexes in a struct) don't all pile up on the same
+   queue. */
+#define TABLESIZE   GENWAIT_TABLE_SIZE
+#define TABLEBITS   __builtin_ctz(TABLESIZE)
 static TAILQ_HEAD(slpquehead, kthread) slpque[TABLESIZE];
-#define LOOKUP(x)   (((uintptr_t)(x) >> 8) & (TABLESIZE - 1))
+#define LOOKUP(x)   ((uint32_t)((uint32_t)(uintptr_t)(x) * 0x9e3779b1u) >> \
+                     (32 - TABLEBITS))
+
+_Static_assert(TABLESIZE >= 2 && (TABLESIZE & (TABLESIZE - 1)) == 0,
+               "GENWAIT_TABLE_SIZE must be a power of two");
+
+/* Non-thread waiters, hashed the same way. */
+static TAILQ_HEAD(waiterhead, genwait_waiter) waitque[TABLESIZE];
+static unsigned int waiter_count;
 
-/* Timed event queue. Anything that isn't ready to run yet, but will be
+/* Current and highest number of threads on each sleep queue. */
+static uint16_t slpque_len[TABLESIZE];
+static uint16_t slpque_peak[TABLESIZE];
+
+/* Timed event wheel. Anything that isn't ready to run yet, but will be
    ready to run at a later time will be placed here. Note that this doesn't
    deal with pre-emptive timeslice context switching, only things that are
    specifically blocked for a timed event (thd_sleep, genwait_wait, etc).
-   This queue is sorted by remaining time (smallest at the front). */
-static struct ktqueue timer_queue;
 
-/* Internal function to insert a thread on the timer queue. Maintains
-   sorting order by wait time. */
+   This is a hierarchical timing wheel with a resolution of one millisecond.
+   Level 0 has one slot per millisecond for the next TW_SLOTS milliseconds,
+   and each level above it has slots covering TW_SLOTS times as much time as
+   the one below. Whenever the lower level wraps around, the next slot of the
+   level above gets cascaded down. Timeouts further away than the whole wheel
+   covers go in the last slot of the top level and get re-filed when they come
+   around. That makes inserting and removing O(1), and expiring O(1) amortized
+   per timeout, no matter how many threads are waiting.
+
+   Each level keeps a bitmap of the slots in use, so that empty stretches of
+   the wheel can be skipped. Bits are only cleared lazily when a slot is found
+   empty, as removing a thread doesn't tell us which slot it was in. */
+#define TW_BITS     6
+#define TW_SLOTS    (1 << TW_BITS)
+#define TW_MASK     (TW_SLOTS - 1)
+#define TW_LEVELS   4
+#define TW_RANGE    (1ULL << (TW_BITS * TW_LEVELS))
+
+LIST_HEAD(twslot, kthread);
+static struct twslot tw_wheel[TW_LEVELS][TW_SLOTS];
+static uint64_t tw_map[TW_LEVELS];
+
+/* The next millisecond the wheel hasn't processed yet. */
+static uint64_t tw_now;
+
+static inline unsigned int tw_shift(unsigned int level) {
+    return TW_BITS * level;
+}
+
+/* Internal function to insert a thread on the timer wheel. */
 static void __nonnull_all tq_insert(kthread_t *thd) {
-    kthread_t *t;
+    uint64_t expires = thd->wait_timeout, delta;
+    unsigned int level, idx;
 
-    /* Search for its place; note that new threads will be placed at
-       the end of a group with the same timeout. */
-    TAILQ_FOREACH_REVERSE(t, &timer_queue, slpquehead, timerq) {
-        if(thd->wait_timeout >= t->wait_timeout) {
-            TAILQ_INSERT_AFTER(&timer_queue, t, thd, timerq);
-            return;
-        }
+    if(expires < tw_now)
+        expires = tw_now;
+
+    delta = expires - tw_now;
+
+    if(delta >= TW_RANGE) {
+        /* Park it as far out as we can; it'll get re-filed from there. */
+        expires = tw_now + TW_RANGE - 1;
+        delta = TW_RANGE - 1;
     }
 
-    /* Couldn't find anything scheduled earlier, put this at the start. */
-    TAILQ_INSERT_HEAD(&timer_queue, thd, timerq);
+    for(level = 0; level < TW_LEVELS - 1; level++) {
+        if(delta < (1ULL << tw_shift(level + 1)))
+            break;
+    }
+
+    idx = (expires >> tw_shift(level)) & TW_MASK;
+
+    LIST_INSERT_HEAD(&tw_wheel[level][idx], thd, timerq);
+    tw_map[level] |= 1ULL << idx;
 }
 
-/* Internal function to remove a thread from the timer queue. */
+/* Internal function to remove a thread from the timer wheel. */
 static void __nonnull_all tq_remove(kthread_t *thd) {
-    TAILQ_REMOVE(&timer_queue, thd, timerq);
+    LIST_REMOVE(thd, timerq);
 }
 
-/* Returns the top thread on the timer queue (next event). If nothing is
-   queued, we'll return NULL. */
-static kthread_t *tq_next(void) {
-    return TAILQ_FIRST(&timer_queue);
+/* Move the current slot of each level above 0 down the wheel, as far up as
+   the lower levels have wrapped around. */
+static void tw_cascade(void) {
+    struct twslot *slot;
+    unsigned int level, idx;
+    kthread_t *t;
+
+    for(level = 1; level < TW_LEVELS; level++) {
+        idx = (tw_now >> tw_shift(level)) & TW_MASK;
+        slot = &tw_wheel[level][idx];
+
+        tw_map[level] &= ~(1ULL << idx);
+
+        while((t = LIST_FIRST(slot))) {
+            LIST_REMOVE(t, timerq);
+            tq_insert(t);
+        }
+
+        if(idx)
+            break;
+    }
 }
 
-int genwait_wait(void *obj, const char *mesg, unsigned int timeout,
-                 void (*callback)(void *)) {
-    kthread_t   *me, *t;
+/* Find the first slot in use at or after start, wrapping around. Clears the
+   bits of any empty slots found along the way. Returns -1 if the level is
+   empty. */
+static int tw_find(unsigned int level, unsigned int start) {
+    uint64_t bits;
+    int idx;
 
-    assert(!irq_inside_int());
+    while(tw_map[level]) {
+        bits = tw_map[level] & (~0ULL << start);
+        idx = __builtin_ctzll(bits ? bits : tw_map[level]);
 
-    irq_disable_scoped();
+        if(!LIST_EMPTY(&tw_wheel[level][idx]))
+            return idx;
+
+        tw_map[level] &= ~(1ULL << idx);
+    }
+
+    return -1;
+}
+
+/* Adds a thread to a sleep queue, after any others of the same or higher
+   priority; assumes ints are disabled. */
+static void __nonnull_all slpque_insert(kthread_t *thd, uint32_t idx) {
+    kthread_t *t;
+
+    /* Go through and find where to insert */
+    TAILQ_FOREACH(t, &slpque[idx], thdq) {
+        if(thd->prio < t->prio) {
+            TAILQ_INSERT_BEFORE(t, thd, thdq);
+            break;
+        }
+    }
+
+    /* We got to the end of the list, so insert at end */
+    if(!t)
+        TAILQ_INSERT_TAIL(&slpque[idx], thd, thdq);
+
+    if(++slpque_len[idx] > slpque_peak[idx])
+        slpque_peak[idx] = slpque_len[idx];
+}
+
+/* Puts a thread to sleep on obj; assumes ints are disabled. */
+static void genwait_sleep(kthread_t *me, void *obj, const char *mesg,
+                          unsigned int timeout, void (*callback)(void *)) {
+    uint32_t    idx = LOOKUP(obj);
+
+    trace_event_thd(TRACE_GENWAIT_SLEEP, me->tid, (uintptr_t)obj);
 
     /* Prepare us for sleep */
-    me = thd_current;
     me->state = STATE_WAIT;
     me->wait_obj = obj;
     me->wait_msg = mesg;
@@ -92,31 +202,54 @@ int genwait_wait(void *obj, const char *mesg, unsigned int timeout,
 
     me->wait_callback = callback;
 
-    /* Go through and find where to insert */
-    TAILQ_FOREACH(t, &slpque[LOOKUP(obj)], thdq) {
-        if(me->prio < t->prio) {
-            TAILQ_INSERT_BEFORE(t, me, thdq);
-            break;
-        }
-    }
+    slpque_insert(me, idx);
+}
 
-    /* We got to the end of the list, so insert at end */
-    if(!t)
-        TAILQ_INSERT_TAIL(&slpque[LOOKUP(obj)], me, thdq);
+int genwait_wait(void *obj, const char *mesg, unsigned int timeout,
+                 void (*callback)(void *)) {
+    kthread_t   *me;
+
+    assert(!irq_inside_int());
+
+    irq_disable_scoped();
+
+    me = thd_current;
+    genwait_sleep(me, obj, mesg, timeout, callback);
 
     /* Block us until we're signaled */
     return thd_block_now(&me->context);
 }
 
+void genwait_wait_fault(void *obj, const char *mesg) {
+    kthread_t   *me = thd_current;
+
+    assert(irq_get_context() == &me->context);
+
+    /* The thread goes back to the instruction it faulted on when woken, so
+       none of its registers may be touched by the wakeup. */
+    genwait_sleep(me, obj, mesg, 0, NULL);
+    me->flags |= THD_WAIT_RETRY;
+
+    /* Switch to someone else on the way out of the exception. */
+    thd_schedule(false);
+}
+
 /* Removes a thread from its wait queue; assumes ints are disabled. */
 static void __nonnull_all genwait_unqueue(kthread_t *thd) {
     if(thd->wait_obj) {
+        uint32_t idx = LOOKUP(thd->wait_obj);
+
+        trace_event_thd(TRACE_GENWAIT_WAKE, thd->tid, (uintptr_t)thd->wait_obj);
+
         /* Remove it from the queue */
-        TAILQ_REMOVE(&slpque[LOOKUP(thd->wait_obj)], thd, thdq);
+        TAILQ_REMOVE(&slpque[idx], thd, thdq);
+        --slpque_len[idx];
 
         /* Also remove it from the timer queue if applicable */
         if(thd->wait_timeout)
             tq_remove(thd);
+        else if(hrtimer_pending(&thd->wait_hrtimer))
+            hrtimer_cancel(&thd->wait_hrtimer);
 
         /* Clean up wait stuff */
         thd->wait_obj = NULL;
@@ -130,6 +263,61 @@ static void __nonnull_all genwait_unqueue(kthread_t *thd) {
     }
 }
 
+/* Wakes a thread up from a wait that has timed out; assumes ints are
+   disabled. */
+static void __nonnull_all genwait_timeout(kthread_t *t) {
+    /* Set an error code */
+    t->thd_errno = EAGAIN;  /* This is fairly close */
+    CONTEXT_RET(t->context) = -1;
+
+    /* If there's a callback, then call it */
+    if(t->wait_callback)
+        t->wait_callback(t->wait_obj);
+
+    /* Re-activate it */
+    genwait_unqueue(t);
+}
+
+/* High-resolution timer callback, for timeouts too short for the wheel. */
+static void genwait_hrtimer_hnd(hrtimer_t *timer, void *data) {
+    (void)timer;
+
+    genwait_timeout((kthread_t *)data);
+}
+
+int genwait_wait_ns(void *obj, const char *mesg, uint64_t timeout,
+                    void (*callback)(void *)) {
+    kthread_t   *me;
+    uint64_t    ms;
+
+    assert(!irq_inside_int());
+
+    irq_disable_scoped();
+
+    me = thd_current;
+
+    /* The wheel only gets looked at on scheduler ticks, so anything shorter
+       than one would get stretched out to the next tick. */
+    if(timeout && timeout < 1000000000ULL / thd_get_hz()) {
+        hrtimer_setup(&me->wait_hrtimer, genwait_hrtimer_hnd, me);
+
+        if(!hrtimer_start(&me->wait_hrtimer, timer_ns_gettime64() + timeout)) {
+            genwait_sleep(me, obj, mesg, 0, callback);
+            return thd_block_now(&me->context);
+        }
+    }
+
+    /* Round up, so that we don't wake up early. */
+    ms = (timeout + 999999) / 1000000;
+
+    if(ms > UINT32_MAX)
+        ms = UINT32_MAX;
+
+    genwait_sleep(me, obj, mesg, (unsigned int)ms, callback);
+
+    return thd_block_now(&me->context);
+}
+
 static int genwait_wake_thd_cnt(const void *obj, int cntmax, kthread_t *thd, int err) {
     kthread_t       * t, * nt;
     struct slpquehead   * qp;
@@ -149,7 +337,10 @@ static int genwait_wake_thd_cnt(const void *obj, int cntmax, kthread_t *thd, int
             genwait_unqueue(t);
 
             /* Set the wake return value */
-            if(err) {
+            if(t->flags & THD_WAIT_RETRY) {
+                t->flags &= ~THD_WAIT_RETRY;
+            }
+            else if(err) {
                 CONTEXT_RET(t->context) = -1;
                 t->thd_errno = err;
             }
@@ -162,11 +353,28 @@ static int genwait_wake_thd_cnt(const void *obj, int cntmax, kthread_t *thd, int
                 cnt++;
 
                 if(cnt >= cntmax)
-                    break;
+                    return cnt;
             }
         }
     }
 
+    /* Then any non-thread waiters. Their callbacks may well wake things up
+       themselves, so just take them off the queue before calling them. */
+    if(!thd && waiter_count) {
+        genwait_waiter_t *w, *nw;
+
+        TAILQ_FOREACH_SAFE(w, &waitque[LOOKUP(obj)], q, nw) {
+            if(w->obj != obj)
+                continue;
+
+            genwait_waiter_remove(w);
+            w->wake(w, err);
+
+            if(cntmax > 0 && ++cnt >= cntmax)
+                break;
+        }
+    }
+
     return cnt;
 }
 
@@ -194,51 +402,210 @@ int genwait_wake_thd(const void *obj, kthread_t *thd, int err) {
     return genwait_wake_thd_cnt(obj, 1, thd, err);
 }
 
+int genwait_requeue(const void *obj, void *newobj, int cntmax,
+                    const char *mesg) {
+    kthread_t *t, *nt;
+    uint32_t idx = LOOKUP(obj), nidx = LOOKUP(newobj);
+    int cnt = 0;
+
+    irq_disable_scoped();
+
+    TAILQ_FOREACH_SAFE(t, &slpque[idx], thdq, nt) {
+        if(t->wait_obj != obj)
+            continue;
+
+        if(cntmax > 0 && cnt >= cntmax)
+            break;
+
+        TAILQ_REMOVE(&slpque[idx], t, thdq);
+        --slpque_len[idx];
+
+        /* Whatever the thread was waiting for has happened, so its timeout
+           doesn't apply to the new wait. */
+        if(t->wait_timeout) {
+            tq_remove(t);
+            t->wait_timeout = 0;
+        }
+        else if(hrtimer_pending(&t->wait_hrtimer)) {
+            hrtimer_cancel(&t->wait_hrtimer);
+        }
+
+        t->wait_callback = NULL;
+        t->wait_obj = newobj;
+
+        if(mesg)
+            t->wait_msg = mesg;
+
+        /* If both objects hash to the same queue, this may put the thread
+           further down the list we're walking, where it won't match obj. */
+        slpque_insert(t, nidx);
+        ++cnt;
+    }
+
+    return cnt;
+}
+
+void genwait_waiter_add(genwait_waiter_t *w, const void *obj) {
+    irq_disable_scoped();
+
+    w->obj = obj;
+    TAILQ_INSERT_TAIL(&waitque[LOOKUP(obj)], w, q);
+    ++waiter_count;
+}
+
+void genwait_waiter_remove(genwait_waiter_t *w) {
+    irq_disable_scoped();
+
+    if(w->obj) {
+        TAILQ_REMOVE(&waitque[LOOKUP(w->obj)], w, q);
+        w->obj = NULL;
+        --waiter_count;
+    }
+}
+
+kthread_t *genwait_first(const void *obj) {
+    kthread_t *t;
+
+    irq_disable_scoped();
+
+    /* Sleep queues are sorted by priority, so the first match is the one. */
+    TAILQ_FOREACH(t, &slpque[LOOKUP(obj)], thdq) {
+        if(t->wait_obj == obj)
+            return t;
+    }
+
+    return NULL;
+}
+
 void genwait_check_timeouts(uint64_t tm) {
-    kthread_t   *t;
+    struct twslot *slot;
+    unsigned int idx, step;
+    uint64_t bits;
+    kthread_t *t;
+
+    while(tw_now <= tm) {
+        idx = tw_now & TW_MASK;
+
+        if(!idx)
+            tw_cascade();
 
-    t = tq_next();
+        /* Skip ahead to the next slot in use, but not past the end of this
+           round of level 0 so we don't miss a cascade. */
+        bits = tw_map[0] >> idx;
 
-    while(t) {
-        /* If the next timeout is beyond our current time, then
-           forget about it. */
-        if(t->wait_timeout > tm)
-            return;
+        if(!(bits & 1)) {
+            step = bits ? __builtin_ctzll(bits) : TW_SLOTS - idx;
 
-        /* Set an error code */
-        t->thd_errno = EAGAIN;  /* This is fairly close */
-        CONTEXT_RET(t->context) = -1;
+            if(tw_now + step > tm + 1)
+                step = tm + 1 - tw_now;
+
+            tw_now += step;
+            continue;
+        }
 
-        /* If there's a callback, then call it */
-        if(t->wait_callback)
-            t->wait_callback(t->wait_obj);
+        /* Everything on a level 0 slot expires this very millisecond. */
+        slot = &tw_wheel[0][idx];
 
-        /* Re-activate it */
-        genwait_unqueue(t);
+        while((t = LIST_FIRST(slot)))
+            genwait_timeout(t);
 
-        /* Get the next one */
-        t = tq_next();
+        tw_map[0] &= ~(1ULL << idx);
+        tw_now++;
     }
 }
 
 uint64_t genwait_next_timeout(void) {
+    uint64_t next = 0;
+    unsigned int level, start;
     kthread_t *t;
+    int idx;
+
+    /* Slots on different levels can overlap in time, so look at the first
+       slot in use on each of them. */
+    for(level = 0; level < TW_LEVELS; level++) {
+        start = (tw_now >> tw_shift(level)) & TW_MASK;
+
+        /* Above level 0, the current slot only holds timeouts for the next
+           time around once it has been cascaded, which happens when the
+           levels below it wrap. */
+        if(tw_now & ((1ULL << tw_shift(level)) - 1))
+            start = (start + 1) & TW_MASK;
+
+        idx = tw_find(level, start);
+        if(idx < 0)
+            continue;
+
+        LIST_FOREACH(t, &tw_wheel[level][idx], timerq) {
+            if(!next || t->wait_timeout < next)
+                next = t->wait_timeout;
+        }
+    }
 
-    t = tq_next();
+    return next;
+}
 
-    if(t == NULL)
-        return 0;
-    else
-        return t->wait_timeout;
+void genwait_get_stats(genwait_stats_t *stats) {
+    unsigned int i;
+
+    irq_disable_scoped();
+
+    memset(stats, 0, sizeof(*stats));
+    stats->queues = TABLESIZE;
+
+    for(i = 0; i < TABLESIZE; i++) {
+        stats->waiting += slpque_len[i];
+
+        if(slpque_len[i])
+            ++stats->used;
+
+        if(slpque_len[i] > stats->longest)
+            stats->longest = slpque_len[i];
+
+        if(slpque_peak[i] > stats->peak)
+            stats->peak = slpque_peak[i];
+    }
+}
+
+int genwait_pslist(int (*pf)(const char *fmt, ...)) {
+    genwait_stats_t stats;
+    unsigned int i;
+
+    genwait_get_stats(&stats);
+
+    pf("Genwait sleep queues: %u waiting on %u of %u queues, longest %u "
+       "(peak %u)\n", (unsigned int)stats.waiting, (unsigned int)stats.used,
+       (unsigned int)stats.queues, (unsigned int)stats.longest,
+       (unsigned int)stats.peak);
+    pf("QUEUE\tLEN\tPEAK\n");
+
+    /* Just a snapshot; the queues may change under us while printing. */
+    for(i = 0; i < TABLESIZE; i++) {
+        if(slpque_peak[i])
+            pf("%u\t%u\t%u\n", i, slpque_len[i], slpque_peak[i]);
+    }
+
+    return 0;
 }
 
 int genwait_init(void) {
     int i;
 
-    for(i = 0; i < TABLESIZE; i++)
+    for(i = 0; i < TABLESIZE; i++) {
         TAILQ_INIT(&slpque[i]);
+        TAILQ_INIT(&waitque[i]);
+    }
+
+    waiter_count = 0;
+
+    memset(slpque_len, 0, sizeof(slpque_len));
+    memset(slpque_peak, 0, sizeof(slpque_peak));
+
+    for(i = 0; i < TW_LEVELS * TW_SLOTS; i++)
+        LIST_INIT(&tw_wheel[i / TW_SLOTS][i % TW_SLOTS]);
+
+    memset(tw_map, 0, sizeof(tw_map));
+    tw_now = timer_ms_gettime64();
 
-    TAILQ_INIT(&timer_queue);
     return 0;
 }
 
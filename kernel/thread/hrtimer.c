@@ -0,0 +1,116 @@
+/* KallistiOS ##version##
+
+   kernel/thread/hrtimer.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+#include <kos/hrtimer.h>
+#include <kos/thread.h>
+#include <kos/timer.h>
+#include <arch/irq.h>
+
+/* Pending timers, in order of expiry. The hardware timer is programmed for
+   the first one, and claimed only for as long as the queue isn't empty. */
+static TAILQ_HEAD(hrtimer_queue, hrtimer) hrt_queue =
+    TAILQ_HEAD_INITIALIZER(hrt_queue);
+static bool hrt_claimed;
+
+/* Program the hardware timer for the first timer on the queue, or let go of
+   it if there aren't any; assumes ints are disabled. */
+static void hrtimer_program(void) {
+    hrtimer_t *first = TAILQ_FIRST(&hrt_queue);
+    uint64_t now;
+
+    if(!first) {
+        timer_hr_release();
+        hrt_claimed = false;
+        return;
+    }
+
+    now = timer_ns_gettime64();
+    timer_hr_wakeup(first->expires > now ? first->expires - now : 0);
+}
+
+static void hrtimer_irq(irq_context_t *context) {
+    hrtimer_t *t;
+    uint64_t now = timer_ns_gettime64();
+    bool fired = false;
+
+    (void)context;
+
+    while((t = TAILQ_FIRST(&hrt_queue)) && t->expires <= now) {
+        TAILQ_REMOVE(&hrt_queue, t, q);
+        t->armed = false;
+        t->callback(t, t->data);
+        fired = true;
+    }
+
+    hrtimer_program();
+
+    /* Whatever the callbacks woke up may well be more important than what
+       was running, so don't make it wait for the next tick to find out. */
+    if(fired && thd_current)
+        thd_schedule(true);
+}
+
+void hrtimer_setup(hrtimer_t *timer,
+                   void (*callback)(hrtimer_t *timer, void *data),
+                   void *data) {
+    timer->callback = callback;
+    timer->data = data;
+    timer->armed = false;
+}
+
+int hrtimer_start(hrtimer_t *timer, uint64_t expires) {
+    hrtimer_t *i;
+
+    irq_disable_scoped();
+
+    if(!hrt_claimed) {
+        if(timer_hr_claim(hrtimer_irq) < 0)
+            return -1;
+
+        hrt_claimed = true;
+    }
+
+    if(timer->armed)
+        TAILQ_REMOVE(&hrt_queue, timer, q);
+
+    timer->expires = expires;
+    timer->armed = true;
+
+    TAILQ_FOREACH(i, &hrt_queue, q) {
+        if(i->expires > expires)
+            break;
+    }
+
+    if(i)
+        TAILQ_INSERT_BEFORE(i, timer, q);
+    else
+        TAILQ_INSERT_TAIL(&hrt_queue, timer, q);
+
+    /* Moving the first timer later matters as much as adding a new first
+       one, so just always reprogram. */
+    hrtimer_program();
+
+    return 0;
+}
+
+bool hrtimer_cancel(hrtimer_t *timer) {
+    bool first;
+
+    irq_disable_scoped();
+
+    if(!timer->armed)
+        return false;
+
+    first = TAILQ_FIRST(&hrt_queue) == timer;
+
+    TAILQ_REMOVE(&hrt_queue, timer, q);
+    timer->armed = false;
+
+    if(first)
+        hrtimer_program();
+
+    return true;
+}
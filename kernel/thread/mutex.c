@@ -19,14 +19,92 @@
 #include <arch/irq.h>
 #include <kos/timer.h>
 
-/* Thread pseudo-ptr representing an active IRQ context. */
-#define IRQ_THREAD  ((kthread_t *)0xFFFFFFFF)
+/* Thread pseudo-ptr representing an active IRQ context. The low bit is left
+   clear, as that's where the waiters flag goes. */
+#define IRQ_THREAD  ((kthread_t *)0xFFFFFFFE)
+
+/* Mutex type without the priority inheritance flag. */
+#define MUTEX_BASE_TYPE(m)  ((m)->type & ~MUTEX_TYPE_PI)
+
+/* How many mutexes deep we'll follow a chain of blocked owners when boosting
+   priorities. This also keeps us from spinning forever on a deadlock. */
+#define PI_MAX_DEPTH    16
 
 static int mutex_trylock_thd(mutex_t *m, kthread_t *thd);
 
+/* Flag the mutex as contended, so that the holder goes through the slow path
+   when unlocking it. Assumes interrupts are disabled. */
+void __mutex_set_waiters(mutex_t *m) {
+    m->holder = (kthread_t *)((uintptr_t)m->holder | __MUTEX_WAITERS);
+}
+
+/* Take a mutex that was just released, keeping the waiters flag set if anyone
+   else is still blocked on it. Assumes interrupts are disabled. */
+static inline void mutex_take(mutex_t *m) {
+    uintptr_t waiters = genwait_first(m) ? __MUTEX_WAITERS : 0;
+
+    m->holder = (kthread_t *)((uintptr_t)thd_current | waiters);
+    m->count = 1;
+}
+
+/* Called by a waiter that gives up on the mutex. If someone grabbed it through
+   the fast path in the meantime, flag it again for the threads still blocked on
+   it; if it is free, pass the wakeup on to the next one in line. Assumes
+   interrupts are disabled. */
+static void mutex_waiter_leave(mutex_t *m) {
+    if(!genwait_first(m))
+        return;
+
+    if(m->holder)
+        __mutex_set_waiters(m);
+    else
+        genwait_wake_one(m);
+}
+
+/* Change the dynamic priority of a thread, keeping the run queue in order. */
+static void mutex_set_dyn_prio(kthread_t *thd, prio_t prio) {
+    thd->prio = prio;
+
+    /* Reschedule if currently scheduled. */
+    if(thd->state == STATE_READY) {
+        /* Thread list is sorted by priority, update the position
+         * of the thread holding the lock */
+        thd_remove_from_runnable(thd);
+        thd_add_to_runnable(thd, true);
+    }
+}
+
+/* Boost the owner of a priority inheritance mutex to (at least) the given
+   priority. If that owner is itself blocked on a priority inheritance mutex,
+   keep going down the chain. Assumes interrupts are disabled. */
+static void mutex_pi_boost(mutex_t *m, prio_t prio) {
+    kthread_t *owner;
+    int depth;
+
+    for(depth = 0; m && depth < PI_MAX_DEPTH; ++depth) {
+        owner = __mutex_holder(m);
+
+        if(!owner || owner == IRQ_THREAD || owner->prio <= prio)
+            break;
+
+        mutex_set_dyn_prio(owner, prio);
+
+        m = owner->pi_wait;
+    }
+}
+
+/* Called by a thread that just acquired a priority inheritance mutex after
+   waiting on it. Take over the priority of whoever is still waiting. */
+static void mutex_pi_acquired(mutex_t *m) {
+    kthread_t *waiter = genwait_first(m);
+
+    if(waiter && waiter->prio < thd_current->prio)
+        thd_current->prio = waiter->prio;
+}
+
 int mutex_init(mutex_t *m, unsigned int mtype) {
     /* Check the type */
-    if(mtype > MUTEX_TYPE_RECURSIVE) {
+    if((mtype & ~MUTEX_TYPE_PI) > MUTEX_TYPE_RECURSIVE) {
         errno = EINVAL;
         return -1;
     }
@@ -42,7 +120,7 @@ int mutex_init(mutex_t *m, unsigned int mtype) {
 int mutex_destroy(mutex_t *m) {
     irq_disable_scoped();
 
-    if(m->type > MUTEX_TYPE_RECURSIVE) {
+    if(MUTEX_BASE_TYPE(m) > MUTEX_TYPE_RECURSIVE) {
         errno = EINVAL;
         return -1;
     }
@@ -72,6 +150,11 @@ int mutex_lock_timed(mutex_t *m, unsigned int timeout) {
 
     assert(!irq_inside_int()); /* Only usable outside IRQ handlers */
 
+    if(__predict_false(irq_inside_int())) {
+        errno = EPERM;
+        return -1;
+    }
+
     rv = mutex_trylock_thd(m, thd_current);
     if(!rv || errno != EBUSY)
         return rv;
@@ -79,8 +162,11 @@ int mutex_lock_timed(mutex_t *m, unsigned int timeout) {
     irq_disable_scoped();
 
     if(__predict_false(!m->holder)) {
-        m->count = 1;
-        m->holder = thd_current;
+        mutex_take(m);
+
+        if(m->type & MUTEX_TYPE_PI)
+            ++thd_current->pi_count;
+
         rv = 0;
     }
     else {
@@ -89,34 +175,42 @@ int mutex_lock_timed(mutex_t *m, unsigned int timeout) {
 
         for(;;) {
             /* Check whether we should boost priority. */
-            if (m->holder->prio >= thd_current->prio) {
-                m->holder->prio = thd_current->prio;
-
-                /* Reschedule if currently scheduled. */
-                if(m->holder->state == STATE_READY) {
-                    /* Thread list is sorted by priority, update the position
-                     * of the thread holding the lock */
-                    thd_remove_from_runnable(m->holder);
-                    thd_add_to_runnable(m->holder, true);
-                }
+            if(m->type & MUTEX_TYPE_PI) {
+                mutex_pi_boost(m, thd_current->prio);
+                thd_current->pi_wait = m;
+            }
+            else if(__mutex_holder(m) != IRQ_THREAD &&
+                    __mutex_holder(m)->prio >= thd_current->prio) {
+                mutex_set_dyn_prio(__mutex_holder(m), thd_current->prio);
             }
 
+            __mutex_set_waiters(m);
+
             rv = genwait_wait(m, timeout ? "mutex_lock_timed" : "mutex_lock",
                               timeout, NULL);
+            thd_current->pi_wait = NULL;
+
             if(rv < 0) {
+                mutex_waiter_leave(m);
                 errno = ETIMEDOUT;
                 break;
             }
 
             if(__predict_true(!m->holder)) {
-                m->holder = thd_current;
-                m->count = 1;
+                mutex_take(m);
+
+                if(m->type & MUTEX_TYPE_PI) {
+                    ++thd_current->pi_count;
+                    mutex_pi_acquired(m);
+                }
+
                 break;
             }
 
             if(timeout) {
                 timeout = deadline - timer_ms_gettime64();
                 if((int)timeout <= 0) {
+                    mutex_waiter_leave(m);
                     errno = ETIMEDOUT;
                     rv = -1;
                     break;
@@ -146,15 +240,19 @@ int mutex_trylock(mutex_t *m) {
 static int mutex_trylock_thd(mutex_t *m, kthread_t *thd) {
     kthread_t *previous_thd = NULL;
 
-    assert(m->type <= MUTEX_TYPE_RECURSIVE);
+    assert(MUTEX_BASE_TYPE(m) <= MUTEX_TYPE_RECURSIVE);
 
     if(atomic_compare_exchange_strong(&m->holder, &previous_thd, thd)) {
         m->count = 1;
+
+        if((m->type & MUTEX_TYPE_PI) && thd != IRQ_THREAD)
+            ++thd->pi_count;
+
         return 0;
     }
 
-    if(__predict_false(previous_thd == thd)) {
-        assert(m->type == MUTEX_TYPE_RECURSIVE);
+    if(__predict_false(__mutex_holder(m) == thd)) {
+        assert(MUTEX_BASE_TYPE(m) == MUTEX_TYPE_RECURSIVE);
 
         /* Recursive mutex, we can just increment normally. */
         if(__predict_false(m->count == INT_MAX)) {
@@ -174,23 +272,38 @@ static int mutex_trylock_thd(mutex_t *m, kthread_t *thd) {
 int mutex_unlock(mutex_t *m) {
     kthread_t *thd = thd_current;
 
-    assert(m->type <= MUTEX_TYPE_RECURSIVE);
+    assert(MUTEX_BASE_TYPE(m) <= MUTEX_TYPE_RECURSIVE);
 
     /* If we're inside of an interrupt, use the special value for the thread
        from mutex_trylock(). */
     if(__predict_false(irq_inside_int()))
         thd = IRQ_THREAD;
 
-    assert(m->holder == thd && m->count > 0);
+    assert(__mutex_holder(m) == thd && m->count > 0);
 
     if (__predict_true(!--m->count)) {
-        m->holder = NULL;
+        if(__predict_true(thd != IRQ_THREAD)) {
+            if(m->type & MUTEX_TYPE_PI)
+                --thd->pi_count;
+
+            /* Restore real priority in case we were dynamically boosted. If
+               we still hold other priority inheritance mutexes, keep the
+               boost until the last of them is released, as someone may still
+               be waiting on one of those. */
+            if(!thd->pi_count)
+                thd->prio = thd->real_prio;
+        }
 
-        /* Restore real priority in case we were dynamically boosted. */
-        if (__predict_true(thd != IRQ_THREAD))
-            thd->prio = thd->real_prio;
+        /* Nobody is waiting: just drop the mutex. This fails if a waiter has
+           flagged the mutex in the meantime. */
+        if(__predict_true(atomic_compare_exchange_strong(&m->holder, &thd,
+                                                         NULL)))
+            return 0;
 
-        /* If we need to wake up a thread, do so. */
+        /* Otherwise, wake up the next thread in line. */
+        irq_disable_scoped();
+
+        m->holder = NULL;
         genwait_wake_one(m);
     }
 
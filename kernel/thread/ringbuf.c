@@ -0,0 +1,225 @@
+/* KallistiOS ##version##
+
+   ringbuf.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+/* Lock-free ring buffers. The single producer flavor is the classic
+   head/tail pair: the producer owns head, the consumer owns tail, and each only
+   publishes its index after it is done touching the slot. The multiple
+   producer flavor is a bounded sequence-numbered queue (after Dmitry Vyukov's
+   MPMC design): producers claim a slot with a compare-and-swap on head and then
+   publish it by bumping that slot's sequence number, so a producer that gets
+   interrupted between the two steps only holds back the consumer, never the
+   other producers.
+
+   With -matomic-model=soft-gusa, the compare-and-swap is a short restartable
+   sequence rather than an interrupt-disabling libcall, so none of this needs
+   irq_disable() except for the genwait bookkeeping in ringbuf_wait(). */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <kos/ringbuf.h>
+#include <kos/genwait.h>
+#include <arch/irq.h>
+
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define load_relaxed(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+int ringbuf_init(ringbuf_t *rb, size_t elem_size, size_t count,
+                 uint32_t flags) {
+    size_t i;
+
+    if(!elem_size || !count || (count & (count - 1))) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(rb, 0, sizeof(*rb));
+
+    /* Keep each slot 4-byte aligned so that elements holding pointers or
+       integers can be accessed in place. */
+    rb->elem_size = elem_size;
+    rb->stride = (elem_size + 3) & ~3;
+    rb->mask = count - 1;
+    rb->flags = flags;
+
+    rb->data = aligned_alloc(32, (rb->stride * count + 31) & ~31);
+    if(!rb->data) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if(flags & RINGBUF_MPSC) {
+        rb->seq = aligned_alloc(32, (sizeof(size_t) * count + 31) & ~31);
+        if(!rb->seq) {
+            free(rb->data);
+            rb->data = NULL;
+            errno = ENOMEM;
+            return -1;
+        }
+
+        for(i = 0; i < count; ++i)
+            rb->seq[i] = i;
+    }
+
+    return 0;
+}
+
+void ringbuf_destroy(ringbuf_t *rb) {
+    genwait_wake_all_err(rb, ENOTRECOVERABLE);
+
+    free((void *)rb->seq);
+    free(rb->data);
+
+    rb->seq = NULL;
+    rb->data = NULL;
+    rb->head = rb->tail = 0;
+}
+
+static inline uint8_t *ringbuf_slot(const ringbuf_t *rb, size_t pos) {
+    return rb->data + (pos & rb->mask) * rb->stride;
+}
+
+/* Wake up the consumer if it has gone to sleep on us. */
+static inline void ringbuf_notify(ringbuf_t *rb) {
+    if(rb->waiters)
+        genwait_wake_all(rb);
+}
+
+static bool ringbuf_push_spsc(ringbuf_t *rb, const void *elem) {
+    size_t head = load_relaxed(&rb->head);
+
+    if(head - load_acquire(&rb->tail) > rb->mask)
+        return false;
+
+    memcpy(ringbuf_slot(rb, head), elem, rb->elem_size);
+    store_release(&rb->head, head + 1);
+
+    return true;
+}
+
+static bool ringbuf_push_mpsc(ringbuf_t *rb, const void *elem) {
+    size_t pos = load_relaxed(&rb->head);
+    size_t seq;
+    intptr_t diff;
+
+    for(;;) {
+        seq = load_acquire(&rb->seq[pos & rb->mask]);
+        diff = (intptr_t)seq - (intptr_t)pos;
+
+        if(diff == 0) {
+            /* The slot is free; try to claim it. On failure pos is updated
+               with the current head and we go around again. */
+            if(__atomic_compare_exchange_n(&rb->head, &pos, pos + 1, true,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if(diff < 0) {
+            /* The consumer hasn't released this slot yet, so we're full. */
+            return false;
+        }
+        else {
+            /* Someone else claimed it first. */
+            pos = load_relaxed(&rb->head);
+        }
+    }
+
+    memcpy(ringbuf_slot(rb, pos), elem, rb->elem_size);
+    store_release(&rb->seq[pos & rb->mask], pos + 1);
+
+    return true;
+}
+
+bool ringbuf_push(ringbuf_t *rb, const void *elem) {
+    bool rv;
+
+    if(rb->flags & RINGBUF_MPSC)
+        rv = ringbuf_push_mpsc(rb, elem);
+    else
+        rv = ringbuf_push_spsc(rb, elem);
+
+    if(rv)
+        ringbuf_notify(rb);
+
+    return rv;
+}
+
+void *ringbuf_peek(ringbuf_t *rb) {
+    size_t tail = load_relaxed(&rb->tail);
+
+    if(rb->flags & RINGBUF_MPSC) {
+        if(load_acquire(&rb->seq[tail & rb->mask]) != tail + 1)
+            return NULL;
+    }
+    else if(load_acquire(&rb->head) == tail) {
+        return NULL;
+    }
+
+    return ringbuf_slot(rb, tail);
+}
+
+bool ringbuf_pop(ringbuf_t *rb, void *elem) {
+    size_t tail = load_relaxed(&rb->tail);
+    uint8_t *slot = ringbuf_peek(rb);
+
+    if(!slot)
+        return false;
+
+    if(elem)
+        memcpy(elem, slot, rb->elem_size);
+
+    /* Hand the slot back to the producers. */
+    if(rb->flags & RINGBUF_MPSC)
+        store_release(&rb->seq[tail & rb->mask], tail + rb->mask + 1);
+
+    store_release(&rb->tail, tail + 1);
+
+    return true;
+}
+
+int ringbuf_wait(ringbuf_t *rb, unsigned int timeout) {
+    int rv;
+
+    assert(!irq_inside_int());
+
+    /* Producers only check the waiter count after publishing, so registering
+       and then re-checking with interrupts off closes the race with a push
+       from an interrupt handler. */
+    irq_disable_scoped();
+
+    if(ringbuf_peek(rb))
+        return 0;
+
+    ++rb->waiters;
+    rv = genwait_wait(rb, "ringbuf_wait", timeout, NULL);
+    --rb->waiters;
+
+    if(rv < 0 && errno == EAGAIN)
+        errno = ETIMEDOUT;
+
+    return rv;
+}
+
+int ringbuf_pop_wait(ringbuf_t *rb, void *elem, unsigned int timeout) {
+    if(ringbuf_pop(rb, elem))
+        return 0;
+
+    if(ringbuf_wait(rb, timeout) < 0)
+        return -1;
+
+    if(!ringbuf_pop(rb, elem)) {
+        errno = EINTR;
+        return -1;
+    }
+
+    return 0;
+}
+
+void ringbuf_wake(ringbuf_t *rb) {
+    genwait_wake_all(rb);
+}
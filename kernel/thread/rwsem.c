@@ -7,92 +7,151 @@
 
 /* Defines reader/writer semaphores */
 
-#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <errno.h>
 
+#include <arch/irq.h>
+#include <kos/genwait.h>
 #include <kos/rwsem.h>
-#include <kos/timer.h>
 
-typedef enum rwsem_update_type {
-    UPDATE_TYPE_READ,
-    UPDATE_TYPE_WRITE,
-    UPDATE_TYPE_UPGRADE,
-} rwsem_update_type_t;
+/* Write lock holder pseudo-ptr for a lock taken in an interrupt */
+#define IRQ_THREAD  ((kthread_t *)0xFFFFFFFE)
+
+/* The semaphore itself isn't used as a genwait object: readers sleep on the
+   read count, writers on the writer and an upgrading reader on the upgrader,
+   so that each kind can be woken separately. */
+#define READ_QUEUE(s)       ((void *)&(s)->read_count)
+#define WRITE_QUEUE(s)      ((void *)&(s)->writer)
+#define UPGRADE_QUEUE(s)    ((void *)&(s)->upgrader)
+
+static inline kthread_t *rwsem_self(void) {
+    return irq_inside_int() ? IRQ_THREAD : thd_current;
+}
+
+/* Can a reader get in right now? Assumes interrupts are disabled. */
+static bool rwsem_can_read(const rw_semaphore_t *s) {
+    if(s->writer || s->upgrader)
+        return false;
+
+    return s->policy == RWSEM_PREFER_READERS || !genwait_first(WRITE_QUEUE(s));
+}
+
+/* Can a writer get in right now? Assumes interrupts are disabled. */
+static bool rwsem_can_write(const rw_semaphore_t *s) {
+    return !s->writer && !s->upgrader && !s->read_count;
+}
+
+/* Let in every reader that is waiting, in one go. They wake up holding the
+   lock already. Assumes interrupts are disabled. */
+static void rwsem_admit_readers(rw_semaphore_t *s) {
+    s->read_count += genwait_wake_cnt(READ_QUEUE(s), -1, 0);
+}
+
+/* Hand the semaphore over to whoever should have it next, if anyone.
+   after_write tells if it was just released by a writer, which is when
+   phase-fair semaphores let the readers go first. Assumes interrupts are
+   disabled. */
+static void rwsem_wake(rw_semaphore_t *s, bool after_write) {
+    kthread_t *w;
+    bool readers_first;
+
+    if(s->writer)
+        return;
+
+    /* An upgrade only has to wait for the other readers */
+    if(s->upgrader) {
+        if(s->read_count == 1) {
+            w = s->upgrader;
+            s->read_count = 0;
+            s->upgrader = NULL;
+            s->writer = w;
+            genwait_wake_thd(UPGRADE_QUEUE(s), w, 0);
+        }
+
+        return;
+    }
+
+    w = genwait_first(WRITE_QUEUE(s));
+
+    /* Readers have it: let in any that were only held up by a writer that
+       has since given up. */
+    if(s->read_count) {
+        if(!w || s->policy == RWSEM_PREFER_READERS)
+            rwsem_admit_readers(s);
+
+        return;
+    }
+
+    if(w && genwait_first(READ_QUEUE(s))) {
+        readers_first = s->policy == RWSEM_PREFER_READERS ||
+                        (s->policy == RWSEM_PHASE_FAIR && after_write);
+    }
+    else {
+        readers_first = !w;
+    }
+
+    if(readers_first) {
+        rwsem_admit_readers(s);
+    }
+    else {
+        s->writer = w;
+        genwait_wake_thd(WRITE_QUEUE(s), w, 0);
+    }
+}
 
 int rwsem_init(rw_semaphore_t *s) {
     s->read_count = 0;
-    s->write_lock = (mutex_t)MUTEX_INITIALIZER;
-    s->read_lock = (mutex_t)MUTEX_INITIALIZER;
+    s->writer = NULL;
+    s->upgrader = NULL;
+    s->policy = RWSEM_PHASE_FAIR;
 
     return 0;
 }
 
-/* Destroy a reader/writer semaphore */
-int rwsem_destroy(rw_semaphore_t *s) {
-    if(mutex_is_locked(&s->write_lock) || mutex_is_locked(&s->read_lock)) {
-        errno = EBUSY;
+int rwsem_set_policy(rw_semaphore_t *s, rwsem_policy_t policy) {
+    if(policy != RWSEM_PHASE_FAIR && policy != RWSEM_PREFER_WRITERS &&
+       policy != RWSEM_PREFER_READERS) {
+        errno = EINVAL;
         return -1;
     }
 
+    irq_disable_scoped();
+
+    s->policy = policy;
+
     return 0;
 }
 
-static int rwsem_update_timed(rw_semaphore_t *s, unsigned int timeout,
-                              rwsem_update_type_t type) {
-    uint64_t deadline = 0;
-
-    if(timeout)
-        deadline = timer_ms_gettime64() + timeout;
+/* Destroy a reader/writer semaphore */
+int rwsem_destroy(rw_semaphore_t *s) {
+    irq_disable_scoped();
 
-    if(mutex_lock_timed(&s->write_lock, timeout))
+    if(s->writer || s->read_count) {
+        errno = EBUSY;
         return -1;
-
-    if(type != UPDATE_TYPE_READ || atomic_fetch_add(&s->read_count, 1) == 0) {
-        if(timeout) {
-            /* Update the timeout value to the remaining time */
-            timeout = deadline - timer_ms_gettime64();
-            if(timeout <= 0) {
-                if(type == UPDATE_TYPE_READ)
-                    atomic_fetch_sub(&s->read_count, 1);
-                mutex_unlock(&s->write_lock);
-                errno = ETIMEDOUT;
-                return -1;
-            }
-        }
-
-        if(type == UPDATE_TYPE_UPGRADE)
-            rwsem_read_unlock(s);
-
-        if(mutex_lock_timed(&s->read_lock, timeout)) {
-            if(type == UPDATE_TYPE_READ) {
-                atomic_fetch_sub(&s->read_count, 1);
-            } else if(type == UPDATE_TYPE_UPGRADE
-                      && atomic_fetch_add(&s->read_count, 1) == 0) {
-                /* mutex_locked_timed() timed out, but the read count we just
-                 * updated was zero, which means that whatever was holding up
-                 * the mutex may have unlocked it since then, or will unlock it
-                 * the next time it runs without delay. This is guaranteed
-                 * because we hold up the write mutex, so no other reader or
-                 * writer can lock up the read mutex before we do. */
-                mutex_lock(&s->read_lock);
-            }
-
-            mutex_unlock(&s->write_lock);
-            errno = ETIMEDOUT;
-            return -1;
-        }
     }
 
-    if(type == UPDATE_TYPE_READ)
-        mutex_unlock(&s->write_lock);
-
     return 0;
 }
 
 /* Lock a reader/writer semaphore for reading */
 int rwsem_read_lock_timed(rw_semaphore_t *s, unsigned int timeout) {
-    return rwsem_update_timed(s, timeout, UPDATE_TYPE_READ);
+    irq_disable_scoped();
+
+    if(rwsem_can_read(s)) {
+        s->read_count++;
+        return 0;
+    }
+
+    /* Whoever wakes us up counts us in as a reader. */
+    if(genwait_wait(READ_QUEUE(s), timeout ? "rwsem_read_lock_timed" :
+                    "rwsem_read_lock", timeout, NULL) < 0) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    return 0;
 }
 
 int rwsem_read_lock_irqsafe(rw_semaphore_t *s) {
@@ -104,7 +163,23 @@ int rwsem_read_lock_irqsafe(rw_semaphore_t *s) {
 
 /* Lock a reader/writer semaphore for writing */
 int rwsem_write_lock_timed(rw_semaphore_t *s, unsigned int timeout) {
-    return rwsem_update_timed(s, timeout, UPDATE_TYPE_WRITE);
+    irq_disable_scoped();
+
+    if(rwsem_can_write(s)) {
+        s->writer = thd_current;
+        return 0;
+    }
+
+    /* Whoever wakes us up makes us the writer. */
+    if(genwait_wait(WRITE_QUEUE(s), timeout ? "rwsem_write_lock_timed" :
+                    "rwsem_write_lock", timeout, NULL) < 0) {
+        /* Readers might have been waiting on us only */
+        rwsem_wake(s, false);
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    return 0;
 }
 
 int rwsem_write_lock_irqsafe(rw_semaphore_t *s) {
@@ -116,16 +191,30 @@ int rwsem_write_lock_irqsafe(rw_semaphore_t *s) {
 
 /* Unlock a reader/writer semaphore from a read lock. */
 int rwsem_read_unlock(rw_semaphore_t *s) {
-    if(atomic_fetch_sub(&s->read_count, 1) == 1)
-        mutex_unlock(&s->read_lock);
+    irq_disable_scoped();
+
+    if(!s->read_count) {
+        errno = EPERM;
+        return -1;
+    }
+
+    if(!--s->read_count || s->upgrader)
+        rwsem_wake(s, false);
 
     return 0;
 }
 
 /* Unlock a reader/writer semaphore from a write lock. */
 int rwsem_write_unlock(rw_semaphore_t *s) {
-    mutex_unlock(&s->read_lock);
-    mutex_unlock(&s->write_lock);
+    irq_disable_scoped();
+
+    if(!s->writer) {
+        errno = EPERM;
+        return -1;
+    }
+
+    s->writer = NULL;
+    rwsem_wake(s, true);
 
     return 0;
 }
@@ -141,64 +230,91 @@ int rwsem_unlock(rw_semaphore_t *s) {
 
 /* Attempt to lock a reader/writer semaphore for reading, but do not block. */
 int rwsem_read_trylock(rw_semaphore_t *s) {
-    if(mutex_trylock(&s->write_lock)) {
-        errno = EWOULDBLOCK;
-        return -1;
-    }
+    irq_disable_scoped();
 
-    if(atomic_fetch_add(&s->read_count, 1) == 0
-       && mutex_trylock(&s->read_lock)) {
-        atomic_fetch_sub(&s->read_count, 1);
-        mutex_unlock(&s->write_lock);
+    if(!rwsem_can_read(s)) {
         errno = EWOULDBLOCK;
         return -1;
     }
 
-    mutex_unlock(&s->write_lock);
+    s->read_count++;
 
     return 0;
 }
 
 /* Attempt to lock a reader/writer semaphore for writing, but do not block. */
 int rwsem_write_trylock(rw_semaphore_t *s) {
-    if(mutex_trylock(&s->write_lock)) {
-        errno = EWOULDBLOCK;
-        return -1;
-    }
+    irq_disable_scoped();
 
-    if(mutex_trylock(&s->read_lock)) {
-        mutex_unlock(&s->write_lock);
+    if(!rwsem_can_write(s)) {
         errno = EWOULDBLOCK;
         return -1;
     }
 
+    s->writer = rwsem_self();
+
     return 0;
 }
 
 /* "Upgrade" a read lock to a write lock. */
 int rwsem_read_upgrade_timed(rw_semaphore_t *s, unsigned int timeout) {
-    return rwsem_update_timed(s, timeout, UPDATE_TYPE_UPGRADE);
+    irq_disable_scoped();
+
+    if(s->upgrader) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if(s->read_count == 1) {
+        s->read_count = 0;
+        s->writer = thd_current;
+        return 0;
+    }
+
+    /* We stay a reader until the other readers are gone, at which point the
+       last of them hands the write lock over. No one else gets in before. */
+    s->upgrader = thd_current;
+
+    if(genwait_wait(UPGRADE_QUEUE(s), timeout ? "rwsem_read_upgrade_timed" :
+                    "rwsem_read_upgrade", timeout, NULL) < 0) {
+        s->upgrader = NULL;
+
+        /* Let in the readers and writers that were held up for us */
+        rwsem_wake(s, false);
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    return 0;
 }
 
 /* Attempt to upgrade a read lock to a write lock, but do not block. */
 int rwsem_read_tryupgrade(rw_semaphore_t *s) {
-    int one = 1;
+    irq_disable_scoped();
 
-    if(mutex_trylock(&s->write_lock)) {
-        errno = EWOULDBLOCK;
+    if(s->upgrader) {
+        errno = EBUSY;
         return -1;
     }
 
-    if(!atomic_compare_exchange_strong(&s->read_count, &one, 0)) {
-        /* upgrade failed */
-        mutex_unlock(&s->write_lock);
+    if(s->read_count != 1) {
         errno = EWOULDBLOCK;
         return -1;
     }
 
+    s->read_count = 0;
+    s->writer = rwsem_self();
+
     return 0;
 }
 
+int rwsem_read_upgrade_irqsafe(rw_semaphore_t *s) {
+    if(irq_inside_int())
+        return rwsem_read_tryupgrade(s);
+    else
+        return rwsem_read_upgrade(s);
+}
+
 /* Return the current reader count */
 int rwsem_read_count(const rw_semaphore_t *s) {
     return s->read_count;
@@ -206,5 +322,5 @@ int rwsem_read_count(const rw_semaphore_t *s) {
 
 /* Return the current status of the write lock */
 int rwsem_write_locked(const rw_semaphore_t *s) {
-    return mutex_is_locked(&s->write_lock);
+    return s->writer != NULL;
 }
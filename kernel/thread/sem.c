@@ -85,17 +85,19 @@ int sem_wait_timed(semaphore_t *sm, unsigned int timeout) {
 /* Attempt to wait on a semaphore. If the semaphore would block,
    then return an error instead of actually blocking. */
 int sem_trywait(semaphore_t *sm) {
-    assert(sm->initialized == 1);
-
-    irq_disable_scoped();
+    int count = __atomic_load_n(&sm->count, __ATOMIC_RELAXED);
 
-    /* Is there enough count left? */
-    if(sm->count <= 0) {
-        errno = EWOULDBLOCK;
-        return -1;
-    }
+    assert(sm->initialized == 1);
 
-    sm->count--;
+    /* Is there enough count left? On failure, count gets reloaded with the
+       current value and we try again. */
+    do {
+        if(count <= 0) {
+            errno = EWOULDBLOCK;
+            return -1;
+        }
+    } while(!__atomic_compare_exchange_n(&sm->count, &count, count - 1, true,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
 
     return 0;
 }
@@ -104,13 +106,13 @@ int sem_trywait(semaphore_t *sm) {
 int sem_signal(semaphore_t *sm) {
     assert(sm->initialized == 1);
 
-    irq_disable_scoped();
-
-    /* Is there anyone waiting? If so, pass off to them */
-    if(sm->count < 0)
+    /* Is there anyone waiting? If so, pass off to them. Waiters decrement the
+       count with interrupts disabled right before going to sleep, so a negative
+       count means there is at least one thread in the genwait queue. */
+    if(__atomic_fetch_add(&sm->count, 1, __ATOMIC_RELEASE) < 0) {
+        irq_disable_scoped();
         genwait_wake_one(sm);
-
-    sm->count++;
+    }
 
     return 0;
 }
@@ -24,6 +24,8 @@
 #include <kos/rwsem.h>
 #include <kos/cond.h>
 #include <kos/genwait.h>
+#include <kos/trace.h>
+#include <kos/opts.h>
 
 #include <arch/arch.h>
 #include <arch/irq.h>
@@ -54,17 +56,48 @@ static alignas(THD_STACK_ALIGNMENT) uint8_t thd_idle_stack[64];
 /* Scheduler timer interrupt frequency (Hertz) */
 static unsigned int thd_sched_ms = 1000 / THD_SCHED_HZ;
 
+/* Tickless idle. When enabled and nothing but the idle thread is runnable, the
+   primary timer is reprogrammed for the next genwait timeout instead of firing
+   at the regular scheduler frequency. thd_tickless_idle is set while such a
+   long wakeup is pending, so that the first thread made runnable (from an
+   interrupt) can bring the regular tick back. */
+static bool thd_tickless = false;
+static bool thd_tickless_idle = false;
+
 /* Thread list. This includes all threads except dead ones. */
 static struct ktlist thd_list;
 
-/* Run queue. This is more like on a standard time sharing system than the
-   previous versions. The top element of this priority queue should be the
-   thread that is ready to run next. When a thread is scheduled, it will be
-   removed from this queue. When it's de-scheduled, it will be re-inserted
-   by its priority value at the end of its priority group. Note that right
-   now this condition is being broken because sleeping threads are on the
-   same queue. We deal with those in thd_switch below. */
-static struct ktqueue run_queue;
+/* Run queues. This is more like on a standard time sharing system than the
+   previous versions. There is one queue per priority level below
+   THD_RUNQ_COUNT - 1, and a single shared queue (sorted by priority) for
+   everything at or beyond that. The first thread of the highest priority
+   non-empty queue is the one that is ready to run next. When a thread is
+   scheduled, it will be removed from its queue. When it's de-scheduled, it
+   will be re-inserted at the end of its priority group.
+
+   Non-empty queues are tracked in a two-level bitmap: bit n of
+   run_queue_map[w] is set if queue (w * 32 + n) has threads on it, and bit w
+   of run_queue_summary is set if run_queue_map[w] is non-zero. Finding the
+   highest priority runnable thread is then two find-first-set operations. */
+#define RUNQ_OVERFLOW   (THD_RUNQ_COUNT - 1)
+#define RUNQ_WORDS      (THD_RUNQ_COUNT / 32)
+
+static struct ktqueue run_queue[THD_RUNQ_COUNT];
+static uint32_t run_queue_map[RUNQ_WORDS];
+static uint32_t run_queue_summary;
+
+_Static_assert(THD_RUNQ_COUNT % 32 == 0 && RUNQ_WORDS <= 32,
+               "THD_RUNQ_COUNT must be a multiple of 32 and at most 1024");
+
+/* Real-time threads that are ready to run (see thd_set_rt()). These are picked
+   earliest deadline first instead of by priority, ahead of everything in the
+   run queues. There won't be many of them, so they're kept on a plain list
+   that gets searched, and their runq index is RUNQ_RT. rt_util is the total
+   share of the CPU reserved by real-time threads, in parts per million. */
+#define RUNQ_RT         0xffff
+
+static struct ktqueue rt_queue;
+static uint32_t rt_util;
 
 /* The currently executing thread. This thread should not be on any queues. */
 kthread_t *thd_current = NULL;
@@ -81,9 +114,55 @@ static size_t thd_count = 0;
 /* The idle task */
 static kthread_t *thd_idle_thd = NULL;
 
+/* What painted stacks are filled with (see thd_get_stack_usage()). */
+#define STACK_PAINT_BYTE    0xa5
+#define STACK_PAINT_WORD    0xa5a5a5a5
+
 /*****************************************************************************/
 /* Debug */
 
+/* How far into its stack a thread has been, or -1 if there's no telling. */
+static ssize_t thd_stack_usage(const kthread_t *thd) {
+    uintptr_t p, end;
+    size_t used;
+
+    if(thd->flags & THD_LAZY_STACK) {
+        used = arch_stk_lazy_committed(thd->stack);
+        return used < thd->stack_size ? used : thd->stack_size;
+    }
+
+    if(!(thd->flags & THD_STACK_PAINT))
+        return -1;
+
+    /* The stack grows down, so look for the first word from the bottom up
+       that isn't paint anymore. */
+    p = ((uintptr_t)thd->stack + 3) & ~(uintptr_t)3;
+    end = (uintptr_t)thd->stack + thd->stack_size;
+
+    while(p + 4 <= end && *(const uint32_t *)p == STACK_PAINT_WORD)
+        p += 4;
+
+    return end - p;
+}
+
+#ifdef THD_STACK_PAINT_ALL
+/* Log how much stack a thread used, along with a size that would have done
+   with some room to spare. */
+static void thd_stack_report(const kthread_t *thd) {
+    ssize_t used = thd_stack_usage(thd);
+    size_t suggest;
+
+    if(used < 0)
+        return;
+
+    suggest = (used + used / 4 + 1023) & ~(size_t)1023;
+
+    dbglog(DBG_INFO, "thd: '%s' used %u of %u bytes of stack, %u would do\n",
+           thd->label, (unsigned int)used, (unsigned int)thd->stack_size,
+           (unsigned int)(suggest ? suggest : 1024));
+}
+#endif
+
 static const char *thd_state_to_str(kthread_t *thd) {
     switch(thd->state) {
         case STATE_ZOMBIE:
@@ -120,10 +199,11 @@ int thd_each(int (*cb)(kthread_t *thd, void *user_data), void *data) {
 
 int thd_pslist(int (*pf)(const char *fmt, ...)) {
     uint64_t cpu_time, ns_time, cpu_total = 0;
+    ssize_t stack_used;
     kthread_t *cur;
 
     pf("All threads (may not be deterministic):\n");
-    pf("addr\t  tid\tprio\tflags\t  wait_timeout\t  cpu_time\t      state\t  name\n");
+    pf("addr\t  tid\tprio\tflags\t  wait_timeout\t  cpu_time\t      state\t  stack\t\t name\n");
 
     irq_disable_scoped();
     thd_get_cpu_time(thd_get_current());
@@ -133,7 +213,9 @@ int thd_pslist(int (*pf)(const char *fmt, ...)) {
         pf("%08lx  ", CONTEXT_PC(cur->context));
         pf("%d\t", cur->tid);
 
-        if(cur->prio == PRIO_MAX)
+        if(cur->rt.params.period)
+            pf("RT\t");
+        else if(cur->prio == PRIO_MAX)
             pf("MAX\t");
         else
             pf("%d\t", cur->prio);
@@ -148,6 +230,14 @@ int thd_pslist(int (*pf)(const char *fmt, ...)) {
             cpu_time, (double)cpu_time / (double)ns_time * 100.0);
 
         pf("%-10s  ", thd_state_to_str(cur));
+
+        stack_used = thd_stack_usage(cur);
+
+        if(stack_used < 0)
+            pf("     -/%-7lu  ", (unsigned long)cur->stack_size);
+        else
+            pf("%6ld/%-7lu  ", (long)stack_used, (unsigned long)cur->stack_size);
+
         pf("%-10s\n", cur->label);
     }
 
@@ -160,26 +250,81 @@ int thd_pslist(int (*pf)(const char *fmt, ...)) {
     return 0;
 }
 
+static void thd_pslist_queue_one(int (*pf)(const char *fmt, ...),
+                                 kthread_t *cur) {
+    pf("%08lx\t", CONTEXT_PC(cur->context));
+    pf("%d\t", cur->tid);
+
+    if(cur->runq == RUNQ_RT)
+        pf("RT\t");
+    else if(cur->prio == PRIO_MAX)
+        pf("MAX\t");
+    else
+        pf("%d\t", cur->prio);
+
+    pf("%08lx\t", cur->flags);
+    pf("%ld\t\t", (uint32_t)cur->wait_timeout);
+    pf("%10s", thd_state_to_str(cur));
+    pf("%s\n", cur->label);
+}
+
 int thd_pslist_queue(int (*pf)(const char *fmt, ...)) {
     kthread_t *cur;
+    unsigned int i;
 
     pf("Queued threads:\n");
     pf("addr\t\ttid\tprio\tflags\twait_timeout\tstate     name\n");
-    TAILQ_FOREACH(cur, &run_queue, thdq) {
-        pf("%08lx\t", CONTEXT_PC(cur->context));
-        pf("%d\t", cur->tid);
 
-        if(cur->prio == PRIO_MAX)
-            pf("MAX\t");
-        else
-            pf("%d\t", cur->prio);
+    TAILQ_FOREACH(cur, &rt_queue, thdq) {
+        thd_pslist_queue_one(pf, cur);
+    }
+
+    for(i = 0; i < THD_RUNQ_COUNT; ++i) {
+        TAILQ_FOREACH(cur, &run_queue[i], thdq) {
+            thd_pslist_queue_one(pf, cur);
+        }
+    }
+
+    return 0;
+}
+
+static void thd_pslist_hist(int (*pf)(const char *fmt, ...), const char *name,
+                            const uint32_t *hist, uint64_t max) {
+    unsigned int i;
+
+    pf("  %-8s", name);
+
+    for(i = 0; i < THD_SCHED_HIST_BUCKETS; ++i)
+        pf(" %6lu", hist[i]);
 
-        pf("%08lx\t", cur->flags);
-        pf("%ld\t\t", (uint32_t)cur->wait_timeout);
-        pf("%10s", thd_state_to_str(cur));
-        pf("%s\n", cur->label);
+    pf("  max %llu ns\n", max);
+}
+
+int thd_pslist_sched(int (*pf)(const char *fmt, ...)) {
+    kthread_sched_stats_t stats;
+    kthread_t *cur;
+    unsigned int i;
+
+    pf("Scheduling statistics (bucket n: [2^n, 2^(n+1)) x 1024ns):\n");
+    pf("          ");
+
+    for(i = 0; i < THD_SCHED_HIST_BUCKETS; ++i)
+        pf(" %6u", i);
+
+    pf("\n");
+
+    irq_disable_scoped();
+
+    LIST_FOREACH(cur, &thd_list, t_list) {
+        stats = cur->sched_stats;
+
+        pf("%d\t%s\n", cur->tid, cur->label);
+        thd_pslist_hist(pf, "latency", stats.latency, stats.latency_max);
+        thd_pslist_hist(pf, "runtime", stats.runtime, stats.runtime_max);
     }
 
+    pf("--end of list--\n");
+
     return 0;
 }
 
@@ -306,57 +451,242 @@ void thd_exit(void *rv) {
 /*****************************************************************************/
 /* Thread creation and deletion */
 
-/* Enqueue a process in the runnable queue; adds it right after the
-   process group of the same priority (front_of_line==0) or
-   right before the process group of the same priority (front_of_line!=0).
-   See thd_schedule for why this is helpful. */
-void thd_add_to_runnable(kthread_t *t, bool front_of_line) {
-    kthread_t *i;
-    int done;
+/* Find-first-set lookup table (de Bruijn sequence 0x077cb531). The SH4 has no
+   bit scan instruction, so isolating the lowest set bit and doing a multiply
+   and table lookup is about as quick as it gets. */
+static const uint8_t runq_ffs_table[32] = {
+     0,  1, 28,  2, 29, 14, 24,  3, 30, 22, 20, 15, 25, 17,  4,  8,
+    31, 27, 13, 23, 21, 19, 16,  7, 26, 12, 18,  6, 11,  5, 10,  9
+};
+
+/* Index of the lowest set bit in a non-zero word. */
+static inline unsigned int runq_ffs(uint32_t v) {
+    return runq_ffs_table[((v & -v) * 0x077cb531u) >> 27];
+}
 
-    if(t->flags & THD_QUEUED)
+/* Map a priority onto its run queue. */
+static inline unsigned int runq_index(prio_t prio) {
+    return prio < RUNQ_OVERFLOW ? (unsigned int)prio : RUNQ_OVERFLOW;
+}
+
+/* Return the first thread of the highest priority non-empty run queue, or NULL
+   if all of them are empty. */
+static inline kthread_t *runq_first(void) {
+    unsigned int w;
+
+    if(!run_queue_summary)
+        return NULL;
+
+    w = runq_ffs(run_queue_summary);
+    return TAILQ_FIRST(&run_queue[w * 32 + runq_ffs(run_queue_map[w])]);
+}
+
+static inline bool thd_is_rt(const kthread_t *thd) {
+    return thd->rt.params.period != 0;
+}
+
+/* The window a real-time thread's budget has to fit in, in milliseconds. */
+static inline uint32_t rt_window(const kthread_rt_params_t *params) {
+    return params->deadline ? params->deadline : params->period;
+}
+
+/* Share of the CPU reserved by a real-time thread, in parts per million. This
+   goes by the deadline rather than the period, which is pessimistic for
+   deadlines shorter than the period but keeps the admission test simple. */
+static uint32_t rt_share(const kthread_rt_params_t *params) {
+    return (uint32_t)((uint64_t)params->budget * 1000000 / rt_window(params));
+}
+
+/* Move a real-time thread on to the period that now falls in, refilling its
+   budget if that's a new one. Periods that were missed entirely (because the
+   thread was blocked) are skipped. */
+static void rt_update(kthread_t *thd, uint64_t now) {
+    const uint64_t period = thd->rt.params.period * 1000000ULL;
+
+    if(now < thd->rt.release + period)
         return;
 
-    done = 0;
+    thd->rt.release += (now - thd->rt.release) / period * period;
+    thd->rt.deadline = thd->rt.release +
+                       rt_window(&thd->rt.params) * 1000000ULL;
+    thd->rt.left = thd->rt.params.budget * 1000000ULL;
+}
 
-    if(!front_of_line) {
-        /* Look for a thread of lower priority and insert
-           before it. If there is nothing on the run queue, we'll
-           fall through to the bottom. */
-        TAILQ_FOREACH(i, &run_queue, thdq) {
-            if(i->prio > t->prio) {
-                TAILQ_INSERT_BEFORE(i, t, thdq);
-                done = 1;
-                break;
-            }
-        }
+/* Take the time a real-time thread has run since it was last charged out of
+   its budget. */
+static void rt_charge(kthread_t *thd, uint64_t now) {
+    const uint64_t ran = now - thd->rt.charged;
+
+    thd->rt.charged = now;
+
+    if(!thd->rt.left)
+        return;
+
+    if(ran < thd->rt.left) {
+        thd->rt.left -= ran;
     }
     else {
-        /* Look for a thread of the same or lower priority and
-           insert before it. If there is nothing on the run queue,
-           we'll fall through to the bottom. */
-        TAILQ_FOREACH(i, &run_queue, thdq) {
-            if(i->prio >= t->prio) {
-                TAILQ_INSERT_BEFORE(i, t, thdq);
-                done = 1;
+        thd->rt.left = 0;
+        ++thd->rt.overruns;
+    }
+}
+
+/* Return the ready real-time thread with the earliest deadline that has some
+   budget left, or NULL if there isn't one. */
+static kthread_t *rt_first(uint64_t now) {
+    kthread_t *t, *best = NULL;
+
+    TAILQ_FOREACH(t, &rt_queue, thdq) {
+        rt_update(t, now);
+
+        if(t->rt.left && (!best || t->rt.deadline < best->rt.deadline))
+            best = t;
+    }
+
+    return best;
+}
+
+/* Milliseconds until the real-time class next needs the scheduler to run:
+   either the current thread running out of budget, or a throttled thread
+   getting a new period. Returns 0 if there's nothing coming up. */
+static uint32_t rt_next_event(void) {
+    uint64_t now, next = UINT64_MAX;
+    kthread_t *t;
+
+    if(!rt_util)
+        return 0;
+
+    now = timer_ns_gettime64();
+
+    if(thd_is_rt(thd_current) && thd_current->rt.left)
+        next = thd_current->rt.charged + thd_current->rt.left;
+
+    TAILQ_FOREACH(t, &rt_queue, thdq) {
+        if(!t->rt.left &&
+           t->rt.release + t->rt.params.period * 1000000ULL < next)
+            next = t->rt.release + t->rt.params.period * 1000000ULL;
+    }
+
+    if(next == UINT64_MAX)
+        return 0;
+    else if(next <= now)
+        return 1;
+    else if(next - now > THD_TICKLESS_MAX_MS * 1000000ULL)
+        return THD_TICKLESS_MAX_MS;
+
+    /* Round up, so that the budget has really run out by then. */
+    return (uint32_t)((next - now + 999999) / 1000000);
+}
+
+/* Put a thread on the run queue for its priority. Returns the queue index. */
+static unsigned int runq_insert(kthread_t *t, bool front_of_line) {
+    struct ktqueue *q;
+    kthread_t *i;
+    unsigned int idx;
+
+    idx = runq_index(t->prio);
+    q = &run_queue[idx];
+
+    if(__predict_true(idx != RUNQ_OVERFLOW)) {
+        /* Every thread in this queue has the same priority, so there's no
+           searching to be done. */
+        if(front_of_line)
+            TAILQ_INSERT_HEAD(q, t, thdq);
+        else
+            TAILQ_INSERT_TAIL(q, t, thdq);
+    }
+    else {
+        /* The overflow queue holds a range of priorities, so look for a thread
+           of lower priority (or the same or lower, for front_of_line) and
+           insert before it. If there isn't one, put it at the end. */
+        TAILQ_FOREACH(i, q, thdq) {
+            if(i->prio > t->prio || (front_of_line && i->prio == t->prio))
                 break;
-            }
         }
+
+        if(i)
+            TAILQ_INSERT_BEFORE(i, t, thdq);
+        else
+            TAILQ_INSERT_TAIL(q, t, thdq);
+    }
+
+    run_queue_map[idx / 32] |= 1u << (idx % 32);
+    run_queue_summary |= 1u << (idx / 32);
+
+    return idx;
+}
+
+/* Put a real-time thread on the real-time queue. Returns RUNQ_RT. */
+static unsigned int rt_insert(kthread_t *t) {
+    TAILQ_INSERT_TAIL(&rt_queue, t, thdq);
+
+    /* Get the scheduler in as soon as possible if this thread should preempt
+       whatever is running now. */
+    if(t != thd_current && thd_current) {
+        rt_update(t, timer_ns_gettime64());
+
+        if(t->rt.left && (!thd_is_rt(thd_current) ||
+                          t->rt.deadline < thd_current->rt.deadline))
+            timer_primary_wakeup(1);
     }
 
-    /* Didn't find one, put it at the end */
-    if(!done)
-        TAILQ_INSERT_TAIL(&run_queue, t, thdq);
+    return RUNQ_RT;
+}
+
+/* Enqueue a process in the runnable queue; adds it right after the
+   process group of the same priority (front_of_line==0) or
+   right before the process group of the same priority (front_of_line!=0).
+   See thd_schedule for why this is helpful. */
+void thd_add_to_runnable(kthread_t *t, bool front_of_line) {
+    if(t->flags & THD_QUEUED)
+        return;
+
+    if(__predict_false(thd_is_rt(t)))
+        t->runq = rt_insert(t);
+    else
+        t->runq = runq_insert(t, front_of_line);
 
     t->flags |= THD_QUEUED;
+
+    /* Start the wakeup latency clock, unless the thread was preempted (or is
+       just being requeued). */
+    if(t != thd_current && !t->sched_stats.ready_time)
+        t->sched_stats.ready_time = timer_ns_gettime64();
+
+    /* If the timer was stretched out because we were idle, get a scheduler
+       tick in as soon as possible so the new thread actually gets to run. */
+    if(__predict_false(thd_tickless_idle) && t != thd_idle_thd) {
+        thd_tickless_idle = false;
+        timer_primary_wakeup(1);
+    }
 }
 
 /* Removes a thread from the runnable queue, if it's there. */
 int thd_remove_from_runnable(kthread_t *thd) {
+    unsigned int idx;
+
     if(!(thd->flags & THD_QUEUED)) return 0;
 
+    /* Use the queue we were put on, since our priority may have been changed
+       since then. */
+    idx = thd->runq;
+
     thd->flags &= ~THD_QUEUED;
-    TAILQ_REMOVE(&run_queue, thd, thdq);
+
+    if(idx == RUNQ_RT) {
+        TAILQ_REMOVE(&rt_queue, thd, thdq);
+        return 0;
+    }
+
+    TAILQ_REMOVE(&run_queue[idx], thd, thdq);
+
+    if(TAILQ_EMPTY(&run_queue[idx])) {
+        run_queue_map[idx / 32] &= ~(1u << (idx % 32));
+
+        if(!run_queue_map[idx / 32])
+            run_queue_summary &= ~(1u << (idx / 32));
+    }
+
     return 0;
 }
 
@@ -366,12 +696,20 @@ int thd_remove_from_runnable(kthread_t *thd) {
    Note that this function is also used in thd_init() to add the
    already running kernel thread to the thread scheduler. This is
    the only circumstance in which routine should be NULL. */
+/* Free the stack of a thread, if we're managing it. */
+static void thd_free_stack(kthread_t *thd) {
+    if(thd->flags & THD_LAZY_STACK)
+        arch_stk_free_lazy(thd->stack);
+    else if(thd->flags & THD_OWNS_STACK)
+        free(thd->stack);
+}
+
 kthread_t *thd_create_ex(const kthread_attr_t *restrict attr,
                          void *(*routine)(void *param), void *param) {
     kthread_t *nt = NULL;
     tid_t tid;
     uint32_t params[4];
-    kthread_attr_t real_attr = { false, THD_STACK_SIZE, NULL, PRIO_DEFAULT, NULL, false };
+    kthread_attr_t real_attr = { false, THD_STACK_SIZE, NULL, PRIO_DEFAULT, NULL, false, false };
 
     if(attr)
         real_attr = *attr;
@@ -405,8 +743,19 @@ kthread_t *thd_create_ex(const kthread_attr_t *restrict attr,
             /* Initialize the flags to defaults immediately. */
             nt->flags = THD_DEFAULTS;
 
+            /* Memory is accounted the same way as the creator's. */
+            if(thd_current)
+                nt->mem_tag = thd_current->mem_tag;
+
             /* Create a new thread stack */
-            if(!real_attr.stack_ptr) {
+            if(!real_attr.stack_ptr && real_attr.lazy_stack)
+                nt->stack = (uint32_t*)arch_stk_alloc_lazy(real_attr.stack_size);
+
+            if(nt->stack) {
+                /* Ours as well, but it has to go back to the arch code. */
+                nt->flags |= THD_OWNS_STACK | THD_LAZY_STACK;
+            }
+            else if(!real_attr.stack_ptr) {
                 nt->stack = (uint32_t*)aligned_alloc(THD_STACK_ALIGNMENT,
                                                      real_attr.stack_size);
 
@@ -424,6 +773,19 @@ kthread_t *thd_create_ex(const kthread_attr_t *restrict attr,
 
             nt->stack_size = real_attr.stack_size;
 
+#ifdef THD_STACK_PAINT_ALL
+            real_attr.paint_stack = true;
+#endif
+
+            /* Paint the stack, so that we can tell how deep it gets later.
+               Not the kernel thread's though, which is already running on
+               it, and not a lazy one, which would all get committed. */
+            if(real_attr.paint_stack && routine &&
+               !(nt->flags & THD_LAZY_STACK)) {
+                memset(nt->stack, STACK_PAINT_BYTE, nt->stack_size);
+                nt->flags |= THD_STACK_PAINT;
+            }
+
             /* Populate the context */
             params[0] = (uint32_t)routine;
             params[1] = (uint32_t)param;
@@ -444,8 +806,7 @@ kthread_t *thd_create_ex(const kthread_attr_t *restrict attr,
             if(real_attr.disable_tls) {
                 nt->flags |= THD_DISABLE_TLS;
             } else if(!arch_tls_setup_data(nt)) {
-                if(nt->flags & THD_OWNS_STACK)
-                    free(nt->stack);
+                thd_free_stack(nt);
                 free(nt);
                 return NULL;
             }
@@ -500,6 +861,8 @@ kthread_t *thd_create(bool detach, void *(*routine)(void *), void *param) {
    the execution chain. */
 int thd_destroy(kthread_t *thd) {
     kthread_tls_kv_t *i, *i2;
+    void (*dest)(void *);
+    int k;
 
     /* Make sure there are no ints */
     irq_disable_scoped();
@@ -516,10 +879,23 @@ int thd_destroy(kthread_t *thd) {
     /* De-schedule the thread if it's scheduled. */
     thd_remove_from_runnable(thd);
 
+    /* Give back its real-time reservation, if it had one. */
+    if(thd_is_rt(thd))
+        rt_util -= rt_share(&thd->rt.params);
+
     /* Remove it from the thread list. */
     LIST_REMOVE(thd, t_list);
 
+#ifdef THD_STACK_PAINT_ALL
+    thd_stack_report(thd);
+#endif
+
     /* Call destructors on TLS entries.  */
+    for(k = 0; k < KTHREAD_TLS_FAST_KEYS; k++) {
+        if(thd->tls_fast[k] && (dest = kthread_key_get_destructor(k + 1)))
+            dest(thd->tls_fast[k]);
+    }
+
     LIST_FOREACH(i, &thd->tls_list, kv_list) {
         if(i->destructor) {
             i->destructor(i->data);
@@ -535,8 +911,7 @@ int thd_destroy(kthread_t *thd) {
     }
 
     /* Free its stack (if we're managing it). */
-    if(thd->flags & THD_OWNS_STACK)
-        free(thd->stack);
+    thd_free_stack(thd);
 
     /* Free static TLS segment (if it hasn't been disabled for the thread). */
     if(!(thd->flags & THD_DISABLE_TLS))
@@ -562,12 +937,117 @@ int thd_set_prio(kthread_t *thd, prio_t prio) {
     if((prio < 0) || (prio > PRIO_MAX))
         return -2;
 
-    /* Set the new priority */
-    thd->prio = prio;
+    irq_disable_scoped();
+
+    /* Set the new priority, moving the thread to the right run queue if it is
+       currently on one. */
+    if(thd->flags & THD_QUEUED) {
+        thd_remove_from_runnable(thd);
+        thd->prio = prio;
+        thd_add_to_runnable(thd, false);
+    }
+    else {
+        thd->prio = prio;
+    }
+
     thd->real_prio = prio;
     return 0;
 }
 
+int thd_set_rt(kthread_t *thd, const kthread_rt_params_t *params) {
+    uint32_t share = 0, old = 0;
+    uint64_t now;
+    bool queued;
+
+    if(!thd)
+        thd = thd_current;
+
+    if(params) {
+        if(!params->period || !params->budget ||
+           params->deadline > params->period ||
+           params->budget > rt_window(params)) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        share = rt_share(params);
+    }
+
+    irq_disable_scoped();
+
+    if(thd_is_rt(thd))
+        old = rt_share(&thd->rt.params);
+
+    if(rt_util - old + share > THD_RT_MAX_UTIL * 10000) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    rt_util = rt_util - old + share;
+
+    /* Switching classes moves the thread to the other kind of queue. */
+    queued = thd->flags & THD_QUEUED;
+
+    if(queued)
+        thd_remove_from_runnable(thd);
+
+    if(params) {
+        now = timer_ns_gettime64();
+
+        thd->rt.params = *params;
+        thd->rt.overruns = 0;
+        thd->rt.release = now;
+        thd->rt.deadline = now + rt_window(params) * 1000000ULL;
+        thd->rt.left = params->budget * 1000000ULL;
+        thd->rt.charged = now;
+    }
+    else {
+        memset(&thd->rt, 0, sizeof(thd->rt));
+    }
+
+    if(queued)
+        thd_add_to_runnable(thd, false);
+
+    return 0;
+}
+
+int thd_get_rt(const kthread_t *thd, kthread_rt_params_t *params) {
+    if(!params)
+        return -1;
+
+    if(!thd)
+        thd = thd_current;
+
+    irq_disable_scoped();
+    *params = thd->rt.params;
+
+    return thd_is_rt(thd);
+}
+
+void thd_rt_wait_period(void) {
+    uint64_t now, next;
+
+    irq_disable_scoped();
+
+    if(!thd_is_rt(thd_current)) {
+        thd_pass();
+        return;
+    }
+
+    now = timer_ns_gettime64();
+    rt_update(thd_current, now);
+
+    /* Done for this period, so whatever budget is left goes unused. */
+    thd_current->rt.left = 0;
+    next = thd_current->rt.release +
+           thd_current->rt.params.period * 1000000ULL;
+
+    if(next > now)
+        thd_sleep_ns(next - now);
+    else
+        thd_pass();
+}
+
 prio_t thd_get_prio(const kthread_t *thd) {
     if(!thd)
         thd = thd_current;
@@ -585,20 +1065,66 @@ tid_t thd_get_id(const kthread_t *thd) {
 /*****************************************************************************/
 /* Scheduling routines */
 
-static void thd_update_cpu_time(kthread_t *thd) {
+static uint64_t thd_update_cpu_time(kthread_t *thd) {
     const uint64_t ns = timer_ns_gettime64();
 
     thd_current->cpu_time.total +=
             ns - thd_current->cpu_time.scheduled;
 
     thd->cpu_time.scheduled = ns;
+
+    return ns;
+}
+
+/* Add a duration (in ns) to a scheduling histogram. */
+static void thd_hist_add(uint32_t *hist, uint64_t *max, uint64_t ns) {
+    uint32_t units = ns >> 42 ? UINT32_MAX : (uint32_t)(ns >> 10);
+    unsigned int b = 0;
+
+    while(units > 1 && b < THD_SCHED_HIST_BUCKETS - 1) {
+        units >>= 1;
+        ++b;
+    }
+
+    ++hist[b];
+
+    if(ns > *max)
+        *max = ns;
 }
 
 /* Helper function that sets a thread being scheduled */
 static inline void thd_schedule_inner(kthread_t *thd) {
+    kthread_sched_stats_t *stats;
+    uint64_t ns;
+
     thd_remove_from_runnable(thd);
 
-    thd_update_cpu_time(thd);
+    ns = thd_update_cpu_time(thd);
+
+    /* Close out the run slice of whoever was running, if it's not just going
+       to keep on running. */
+    if(thd_current != thd) {
+        if(thd_is_rt(thd_current))
+            rt_charge(thd_current, ns);
+
+        if(thd_is_rt(thd))
+            thd->rt.charged = ns;
+
+        stats = &thd_current->sched_stats;
+        thd_hist_add(stats->runtime, &stats->runtime_max,
+                     ns - stats->slice_start);
+        thd->sched_stats.slice_start = ns;
+    }
+
+    if(thd->sched_stats.ready_time) {
+        stats = &thd->sched_stats;
+        thd_hist_add(stats->latency, &stats->latency_max,
+                     ns - stats->ready_time);
+        stats->ready_time = 0;
+    }
+
+    if(thd_current != thd)
+        trace_event(TRACE_THD_SWITCH, thd->tid);
 
     thd_current = thd;
     _impure_ptr = &thd->thd_reent;
@@ -638,6 +1164,10 @@ void thd_schedule(bool front_of_line) {
 
     now = timer_ms_gettime64();
 
+    /* We're rescheduling right now, so whoever ends up running will have the
+       timer reprogrammed for them. */
+    thd_tickless_idle = false;
+
     /* If there's only two thread left, it's the idle task and the reaper task:
        exit the OS */
     if(thd_count == 2) {
@@ -645,6 +1175,18 @@ void thd_schedule(bool front_of_line) {
         arch_exit();
     }
 
+    /* A running real-time thread has to compete with the others on its
+       deadline, so charge it for the time it has run and put it back on the
+       queue before picking. */
+    if(thd_is_rt(thd_current)) {
+        rt_charge(thd_current, timer_ns_gettime64());
+
+        if(thd_current->state == STATE_RUNNING) {
+            thd_current->state = STATE_READY;
+            thd_add_to_runnable(thd_current, false);
+        }
+    }
+
     /* If the current thread is supposed to be in the front of the line, and it
        did not die, re-enqueue it to the front of the line now. */
     if(front_of_line && thd_current->state == STATE_RUNNING) {
@@ -655,14 +1197,13 @@ void thd_schedule(bool front_of_line) {
     /* Look for timed out waits */
     genwait_check_timeouts(now);
 
-    /* Search downwards through the run queue for a runnable thread; if
-       we don't find a normal runnable thread, the idle process will
-       always be there at the bottom. */
-    TAILQ_FOREACH(thd, &run_queue, thdq) {
-        /* Is it runnable? If not, keep going */
-        if(thd->state == STATE_READY)
-            break;
-    }
+    /* Real-time threads with budget left go first. Otherwise, grab the first
+       thread from the highest priority run queue; if there isn't a normal
+       runnable thread, the idle process will always be there at the bottom. */
+    thd = TAILQ_EMPTY(&rt_queue) ? NULL : rt_first(timer_ns_gettime64());
+
+    if(!thd)
+        thd = runq_first();
 
     /* If we didn't already re-enqueue the thread and we are supposed to do so,
        do it now. */
@@ -716,6 +1257,48 @@ void thd_schedule_next(kthread_t *thd) {
     thd_schedule_inner(thd);
 }
 
+/* Program the next primary timer wakeup. Normally that's just the next
+   scheduler tick, but if tickless idle is on and only the idle thread can run,
+   sleep through to the next genwait timeout instead. Either way, the timer
+   fires early if a real-time thread needs it to. Returns true if the timer
+   was reprogrammed. */
+static bool thd_timer_rearm(bool force) {
+    uint64_t next, now;
+    uint32_t ms, rt_ms = rt_next_event();
+
+    if(!thd_tickless || thd_current != thd_idle_thd) {
+        if(rt_ms && rt_ms < thd_sched_ms) {
+            timer_primary_wakeup(rt_ms);
+            return true;
+        }
+
+        if(force)
+            timer_primary_wakeup(thd_sched_ms);
+
+        return force;
+    }
+
+    next = genwait_next_timeout();
+    now = timer_ms_gettime64();
+
+    if(!next)
+        ms = THD_TICKLESS_MAX_MS;
+    else if(next <= now)
+        ms = 1;
+    else if(next - now > THD_TICKLESS_MAX_MS)
+        ms = THD_TICKLESS_MAX_MS;
+    else
+        ms = (uint32_t)(next - now);
+
+    if(rt_ms && rt_ms < ms)
+        ms = rt_ms;
+
+    thd_tickless_idle = true;
+    timer_primary_wakeup(ms);
+
+    return true;
+}
+
 /* See kos/thread.h for description */
 irq_context_t *thd_choose_new(void) {
     //printf("thd_choose_new() woken at %d\n", (uint32_t)now);
@@ -723,6 +1306,10 @@ irq_context_t *thd_choose_new(void) {
     /* Do any re-scheduling */
     thd_schedule(false);
 
+    /* If we just went idle, there's no sense in ticking until the next thing
+       we are waiting on. */
+    thd_timer_rearm(false);
+
     /* Return the new IRQ context back to the caller */
     return &thd_current->context;
 }
@@ -739,7 +1326,7 @@ static void thd_timer_hnd(irq_context_t *context) {
     //printf("timer woke at %d\n", (uint32_t)now);
 
     thd_schedule(false);
-    timer_primary_wakeup(thd_sched_ms);
+    thd_timer_rearm(true);
 }
 
 /*****************************************************************************/
@@ -766,6 +1353,17 @@ void thd_sleep(unsigned int ms) {
     genwait_wait((void *)0xffffffff, "thd_sleep", ms, NULL);
 }
 
+void thd_sleep_ns(uint64_t ns) {
+    assert(thd_mode != THD_MODE_NONE);
+
+    if(!ns) {
+        thd_pass();
+        return;
+    }
+
+    genwait_wait_ns((void *)0xffffffff, "thd_sleep", ns, NULL);
+}
+
 /* Manually cause a re-schedule */
 __used
 void thd_pass(void) {
@@ -923,6 +1521,57 @@ uint64_t thd_get_cpu_time(kthread_t *thd) {
     return thd->cpu_time.total;
 }
 
+ssize_t thd_get_stack_usage(const kthread_t *thd) {
+    ssize_t used;
+
+    if(!thd)
+        thd = thd_current;
+
+    used = thd_stack_usage(thd);
+
+    if(used < 0)
+        errno = EINVAL;
+
+    return used;
+}
+
+int thd_get_sched_stats(const kthread_t *thd, kthread_sched_stats_t *stats) {
+    if(!stats)
+        return -1;
+
+    if(!thd)
+        thd = thd_current;
+
+    irq_disable_scoped();
+    *stats = thd->sched_stats;
+
+    return 0;
+}
+
+static void thd_reset_sched_stats_one(kthread_t *thd) {
+    kthread_sched_stats_t *stats = &thd->sched_stats;
+
+    memset(stats->latency, 0, sizeof(stats->latency));
+    memset(stats->runtime, 0, sizeof(stats->runtime));
+    stats->latency_max = 0;
+    stats->runtime_max = 0;
+}
+
+void thd_reset_sched_stats(kthread_t *thd) {
+    kthread_t *cur;
+
+    irq_disable_scoped();
+
+    if(thd) {
+        thd_reset_sched_stats_one(thd);
+        return;
+    }
+
+    LIST_FOREACH(cur, &thd_list, t_list) {
+        thd_reset_sched_stats_one(cur);
+    }
+}
+
 uint64_t thd_get_total_cpu_time(void) {
     kthread_t *cur;
     uint64_t retval = 0;
@@ -961,6 +1610,22 @@ int thd_set_hz(unsigned int hertz) {
     return 0;
 }
 
+void thd_set_tickless(bool enable) {
+    irq_disable_scoped();
+
+    thd_tickless = enable;
+
+    /* Make sure we aren't left sleeping on a long wakeup. */
+    if(!enable && thd_tickless_idle) {
+        thd_tickless_idle = false;
+        timer_primary_wakeup(thd_sched_ms);
+    }
+}
+
+bool thd_get_tickless(void) {
+    return thd_tickless;
+}
+
 /* Delete a TLS key. Note that currently this doesn't prevent you from reusing
    the key after deletion. This seems ok, as the pthreads standard states that
    using the key after deletion results in "undefined behavior".
@@ -986,6 +1651,11 @@ int kthread_key_delete(kthread_key_t key) {
 
     /* Go through each thread searching for (and removing) the data. */
     LIST_FOREACH(cur, &thd_list, t_list) {
+        if(__KTHREAD_TLS_FAST(key)) {
+            cur->tls_fast[key - 1] = NULL;
+            continue;
+        }
+
         LIST_FOREACH_SAFE(i, &cur->tls_list, kv_list, tmp) {
             if(i->key == key) {
                 LIST_REMOVE(i, kv_list);
@@ -1028,6 +1698,7 @@ int thd_init(void) {
     };
 
     kthread_t *kern;
+    unsigned int i;
 
     /* Make sure we're not already running */
     if(thd_mode != THD_MODE_NONE)
@@ -1042,8 +1713,15 @@ int thd_init(void) {
     /* Initialize the thread list */
     LIST_INIT(&thd_list);
 
-    /* Initialize the run queue */
-    TAILQ_INIT(&run_queue);
+    /* Initialize the run queues */
+    for(i = 0; i < THD_RUNQ_COUNT; ++i)
+        TAILQ_INIT(&run_queue[i]);
+
+    TAILQ_INIT(&rt_queue);
+    rt_util = 0;
+
+    memset(run_queue_map, 0, sizeof(run_queue_map));
+    run_queue_summary = 0;
 
     /* Start off with no "current" thread */
     thd_current = NULL;
@@ -1061,7 +1739,10 @@ int thd_init(void) {
         return -1;
     }
 
-    /* Main thread -- the kern thread */
+    /* Main thread -- the kern thread. It's been running with the FPU
+       enabled all along, so its FPU registers are live already. */
+    kern->context.fpu = 1;
+    kern->flags |= THD_FPU;
     thd_current = kern;
     thd_schedule_inner(kern);
 
@@ -1096,6 +1777,8 @@ void thd_shutdown(void) {
 
     /* Remove our pre-emption handler */
     timer_primary_set_callback(NULL);
+    thd_tickless = false;
+    thd_tickless_idle = false;
 
     /* Kill remaining live threads */
     LIST_FOREACH_SAFE(cur, &thd_list, t_list, tmp) {
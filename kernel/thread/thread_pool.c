@@ -0,0 +1,300 @@
+/* KallistiOS ##version##
+
+   thread_pool.c
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+#include <arch/irq.h>
+#include <assert.h>
+#include <errno.h>
+#include <kos/genwait.h>
+#include <kos/thread.h>
+#include <kos/thread_pool.h>
+#include <kos/worker_thread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/queue.h>
+
+TAILQ_HEAD(kthread_tasks, kthread_task);
+
+struct pool_worker {
+    kthread_pool_t *pool;
+    kthread_worker_t *worker;
+    bool idle;
+
+    /* Sorted by priority, most urgent first. The owner takes from the front,
+       thieves take from the back. */
+    struct kthread_tasks tasks;
+};
+
+struct kthread_pool {
+    unsigned int nworkers;
+    unsigned int next;
+    struct pool_worker workers[];
+};
+
+/* Find the pool worker running in the current thread, if any. Assumes
+   interrupts are disabled. */
+static struct pool_worker *pool_self(kthread_pool_t *pool) {
+    unsigned int i;
+
+    if(irq_inside_int())
+        return NULL;
+
+    for(i = 0; i < pool->nworkers; i++) {
+        if(thd_worker_get_thread(pool->workers[i].worker) == thd_current)
+            return &pool->workers[i];
+    }
+
+    return NULL;
+}
+
+static void pool_enqueue(struct pool_worker *w, kthread_task_t *task) {
+    kthread_task_t *i;
+
+    /* Tasks of the same priority stay in FIFO order. */
+    TAILQ_FOREACH_REVERSE(i, &w->tasks, kthread_tasks, entry) {
+        if(i->prio <= task->prio) {
+            TAILQ_INSERT_AFTER(&w->tasks, i, task, entry);
+            return;
+        }
+    }
+
+    TAILQ_INSERT_HEAD(&w->tasks, task, entry);
+}
+
+/* Grab the next task to run: the most urgent one from our own queue, or the
+   least urgent one from someone else's. Assumes interrupts are disabled. */
+static kthread_task_t *pool_take(kthread_pool_t *pool, struct pool_worker *self) {
+    kthread_task_t *task;
+    unsigned int i, start;
+
+    if(self && (task = TAILQ_FIRST(&self->tasks))) {
+        TAILQ_REMOVE(&self->tasks, task, entry);
+        return task;
+    }
+
+    start = self ? (unsigned int)(self - pool->workers) + 1 : 0;
+
+    for(i = 0; i < pool->nworkers; i++) {
+        struct pool_worker *victim = &pool->workers[(start + i) % pool->nworkers];
+
+        if((task = TAILQ_LAST(&victim->tasks, kthread_tasks))) {
+            TAILQ_REMOVE(&victim->tasks, task, entry);
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+static void pool_run(kthread_task_t *task) {
+    kthread_pool_group_t *group = task->group;
+
+    task->routine(task->data);
+
+    if(group) {
+        irq_disable_scoped();
+
+        if(!--group->pending)
+            genwait_wake_all(group);
+    }
+}
+
+static void pool_work(void *d) {
+    struct pool_worker *self = d;
+    kthread_task_t *task;
+    uint32_t flags;
+
+    for(;;) {
+        flags = irq_disable();
+
+        task = pool_take(self->pool, self);
+
+        /* Nothing left: go back to sleep until thd_pool_submit() wakes us. */
+        if(!task)
+            self->idle = true;
+
+        irq_restore(flags);
+
+        if(!task)
+            break;
+
+        pool_run(task);
+    }
+}
+
+kthread_pool_t *thd_pool_create(unsigned int nworkers,
+                                const kthread_attr_t *attr) {
+    kthread_pool_t *pool;
+    unsigned int i;
+
+    if(!nworkers || (attr && attr->stack_ptr)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    pool = malloc(sizeof(*pool) + nworkers * sizeof(struct pool_worker));
+    if(!pool) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    pool->nworkers = nworkers;
+    pool->next = 0;
+
+    for(i = 0; i < nworkers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].idle = true;
+        TAILQ_INIT(&pool->workers[i].tasks);
+    }
+
+    for(i = 0; i < nworkers; i++) {
+        pool->workers[i].worker = thd_worker_create_ex(attr, pool_work,
+                                                       &pool->workers[i]);
+
+        if(!pool->workers[i].worker) {
+            while(i--)
+                thd_worker_destroy(pool->workers[i].worker);
+
+            free(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+void thd_pool_destroy(kthread_pool_t *pool) {
+    unsigned int i;
+
+    assert(pool != NULL);
+
+    for(i = 0; i < pool->nworkers; i++)
+        thd_worker_destroy(pool->workers[i].worker);
+
+    free(pool);
+}
+
+void thd_pool_submit(kthread_pool_t *pool, kthread_task_t *task,
+                     kthread_pool_group_t *group) {
+    struct pool_worker *target;
+    unsigned int i;
+
+    assert(pool != NULL && task != NULL && task->routine != NULL);
+
+    irq_disable_scoped();
+
+    task->group = group;
+    if(group)
+        ++group->pending;
+
+    /* Forked tasks stay with the worker that forked them; everything else is
+       handed out round-robin. */
+    target = pool_self(pool);
+
+    if(!target) {
+        target = &pool->workers[pool->next];
+        pool->next = (pool->next + 1) % pool->nworkers;
+    }
+
+    pool_enqueue(target, task);
+
+    if(target->idle) {
+        target->idle = false;
+        thd_worker_wakeup(target->worker);
+        return;
+    }
+
+    /* The target is busy, so get an idle worker to steal the task. */
+    for(i = 0; i < pool->nworkers; i++) {
+        if(pool->workers[i].idle) {
+            pool->workers[i].idle = false;
+            thd_worker_wakeup(pool->workers[i].worker);
+            break;
+        }
+    }
+}
+
+void thd_pool_group_wait(kthread_pool_t *pool, kthread_pool_group_t *group) {
+    kthread_task_t *task;
+    uint32_t flags;
+
+    assert(!irq_inside_int());
+
+    for(;;) {
+        flags = irq_disable();
+
+        if(!group->pending) {
+            irq_restore(flags);
+            return;
+        }
+
+        /* Help out rather than just sleeping; this also keeps a worker that
+           waits on its own children from deadlocking the pool. */
+        task = pool_take(pool, pool_self(pool));
+
+        if(!task)
+            genwait_wait(group, "thd_pool_group_wait", 0, NULL);
+
+        irq_restore(flags);
+
+        if(task)
+            pool_run(task);
+    }
+}
+
+struct pool_chunk {
+    kthread_task_t task;
+    size_t begin, end;
+    void (*routine)(size_t, size_t, void *);
+    void *data;
+};
+
+static void pool_chunk_run(void *d) {
+    struct pool_chunk *chunk = d;
+
+    chunk->routine(chunk->begin, chunk->end, chunk->data);
+}
+
+int thd_pool_parallel_for(kthread_pool_t *pool, size_t begin, size_t end,
+                          size_t grain,
+                          void (*routine)(size_t begin, size_t end, void *data),
+                          void *data) {
+    kthread_pool_group_t group = KTHREAD_POOL_GROUP_INITIALIZER;
+    struct pool_chunk *chunks;
+    size_t nchunks, i;
+
+    if(end <= begin)
+        return 0;
+
+    if(!grain)
+        grain = (end - begin + pool->nworkers - 1) / pool->nworkers;
+
+    nchunks = (end - begin + grain - 1) / grain;
+
+    chunks = malloc(nchunks * sizeof(*chunks));
+    if(!chunks) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for(i = 0; i < nchunks; i++) {
+        chunks[i].begin = begin + i * grain;
+        chunks[i].end = chunks[i].begin + grain;
+        if(chunks[i].end > end)
+            chunks[i].end = end;
+
+        chunks[i].routine = routine;
+        chunks[i].data = data;
+
+        thd_pool_task_init(&chunks[i].task, pool_chunk_run, &chunks[i],
+                           thd_get_prio(NULL));
+        thd_pool_submit(pool, &chunks[i].task, &group);
+    }
+
+    thd_pool_group_wait(pool, &group);
+    free(chunks);
+
+    return 0;
+}
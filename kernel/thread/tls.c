@@ -11,6 +11,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <malloc.h>
+#include <string.h>
 
 #include <kos/tls.h>
 #include <kos/thread.h>
@@ -35,17 +36,23 @@ LIST_HEAD(kthread_tls_dest_list, kthread_tls_dest);
 
 static struct kthread_tls_dest_list dest_list;
 
+typedef void (*destructor)(void *);
+
+/* Destructors of the keys stored in each thread's array */
+static destructor fast_dest[KTHREAD_TLS_FAST_KEYS];
+
 /* What is the next key that will be given out? */
 kthread_key_t kthread_key_next(void) {
     return next_key;
 }
 
-typedef void (*destructor)(void *);
-
 /* Get the destructor for a given key. */
-static destructor kthread_key_get_destructor(kthread_key_t key) {
+destructor kthread_key_get_destructor(kthread_key_t key) {
     kthread_tls_dest_t *i;
 
+    if(__KTHREAD_TLS_FAST(key))
+        return fast_dest[key - 1];
+
     LIST_FOREACH(i, &dest_list, dest_list) {
         if(i->key == key) {
             return i->destructor;
@@ -59,6 +66,11 @@ static destructor kthread_key_get_destructor(kthread_key_t key) {
 void kthread_key_delete_destructor(kthread_key_t key) {
     kthread_tls_dest_t *i, *tmp;
 
+    if(__KTHREAD_TLS_FAST(key)) {
+        fast_dest[key - 1] = NULL;
+        return;
+    }
+
     LIST_FOREACH_SAFE(i, &dest_list, dest_list, tmp) {
         if(i->key == key) {
             LIST_REMOVE(i, dest_list);
@@ -81,7 +93,10 @@ int kthread_key_create(kthread_key_t *key, void (*destructor)(void *)) {
     spinlock_lock_scoped(&mutex);
 
     /* Store the destructor if need be. */
-    if(destructor) {
+    if(__KTHREAD_TLS_FAST(next_key)) {
+        fast_dest[next_key - 1] = destructor;
+    }
+    else if(destructor) {
         dest = (kthread_tls_dest_t *)malloc(sizeof(kthread_tls_dest_t));
 
         if(!dest) {
@@ -105,6 +120,9 @@ void *kthread_getspecific(kthread_key_t key) {
     kthread_t *cur = thd_get_current();
     kthread_tls_kv_t *i;
 
+    if(__KTHREAD_TLS_FAST(key))
+        return cur->tls_fast[key - 1];
+
     LIST_FOREACH(i, &cur->tls_list, kv_list) {
         if(i->key == key) {
             return i->data;
@@ -137,6 +155,11 @@ int kthread_setspecific(kthread_key_t key, const void *value) {
         }
     }
 
+    if(__KTHREAD_TLS_FAST(key)) {
+        cur->tls_fast[key - 1] = (void *)value;
+        return 0;
+    }
+
     /* Check if we already have an entry for this key. */
     LIST_FOREACH(i, &cur->tls_list, kv_list) {
         if(i->key == key) {
@@ -164,6 +187,7 @@ int kthread_setspecific(kthread_key_t key, const void *value) {
 int kthread_tls_init(void) {
     /* Initialize the destructor list. */
     LIST_INIT(&dest_list);
+    memset(fast_dest, 0, sizeof(fast_dest));
 
     return 0;
 }
@@ -0,0 +1,152 @@
+/* KallistiOS ##version##
+
+   binpack.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   Compresses a KOS program binary, as made by elf2bin, so that it unpacks
+   itself when started. Everything after the startup code is replaced with
+   one LZ4 block, and the header near the start of startup.S is filled in to
+   tell it how big that is. The result can be sent through dcload as it is,
+   or scrambled into a 1ST_READ.BIN.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lz4enc.h"
+
+/* The header in startup.S */
+#define HDR_OFFSET      4
+#define HDR_MAGIC       0x5a534f4b
+#define HDR_SIZE        16
+
+/* Where startup.S stages the packed data while it unpacks: just below the
+   top 64 KB of the lowest 16 MB of RAM. Programs are loaded 64 KB in on the
+   Dreamcast and 128 KB in on the NAOMI; take the worse of the two. */
+#define RAM_SIZE        0x01000000
+#define RAM_RESERVED    0x00010000
+#define LOAD_OFFSET     0x00020000
+
+static void *xmalloc(size_t size) {
+    void *rv = malloc(size ? size : 1);
+
+    if(!rv) {
+        fprintf(stderr, "binpack: out of memory\n");
+        exit(1);
+    }
+
+    return rv;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint8_t *load(const char *fn, size_t *size) {
+    FILE *f = fopen(fn, "rb");
+    uint8_t *data;
+    long len;
+
+    if(!f) {
+        perror(fn);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    data = xmalloc(len);
+
+    if(len < 0 || fread(data, 1, len, f) != (size_t)len) {
+        fprintf(stderr, "binpack: can't read %s\n", fn);
+        fclose(f);
+        free(data);
+        return NULL;
+    }
+
+    fclose(f);
+    *size = len;
+
+    return data;
+}
+
+int main(int argc, char *argv[]) {
+    uint8_t *in, *out, *hdr;
+    size_t size, split, packed, total;
+    FILE *f;
+
+    if(argc != 3) {
+        fprintf(stderr, "usage: binpack <program.bin> <packed.bin>\n");
+        return 1;
+    }
+
+    in = load(argv[1], &size);
+
+    if(!in)
+        return 1;
+
+    hdr = in + HDR_OFFSET;
+
+    if(size < HDR_OFFSET + HDR_SIZE || get32(hdr) != HDR_MAGIC) {
+        fprintf(stderr, "binpack: %s is not a KOS program binary, or was "
+                "built with a startup.S that can't unpack it\n", argv[1]);
+        return 1;
+    }
+
+    if(get32(hdr + 4)) {
+        fprintf(stderr, "binpack: %s is packed already\n", argv[1]);
+        return 1;
+    }
+
+    split = get32(hdr + 12);
+
+    if(split >= size || (split & 3)) {
+        fprintf(stderr, "binpack: bad header in %s\n", argv[1]);
+        return 1;
+    }
+
+    out = xmalloc(LZ4_BOUND(size));
+    memcpy(out, in, split);
+    packed = lz4_encode(in + split, size - split, out + split);
+    total = split + packed;
+
+    /* Unpacking must not run over the staged data */
+    if(LOAD_OFFSET + size + ((packed + 3) & ~3) > RAM_SIZE - RAM_RESERVED) {
+        fprintf(stderr, "binpack: %s is too big to unpack in place\n",
+                argv[1]);
+        return 1;
+    }
+
+    put32(out + HDR_OFFSET + 4, packed);
+    put32(out + HDR_OFFSET + 8, size - split);
+
+    f = fopen(argv[2], "wb");
+
+    if(!f) {
+        perror(argv[2]);
+        return 1;
+    }
+
+    if(fwrite(out, 1, total, f) != total || fclose(f)) {
+        fprintf(stderr, "binpack: can't write %s\n", argv[2]);
+        return 1;
+    }
+
+    printf("binpack: %zu -> %zu bytes (%.1f%%)\n", size, total,
+           100.0 * total / size);
+
+    free(out);
+    free(in);
+
+    return 0;
+}
@@ -1,6 +1,6 @@
 /* KallistiOS ##version##
 
-   kmg/kmg.h
+   utils/common/kmg.h
    Copyrigh (C)2003 Megan Potter
 */
 
@@ -66,6 +66,30 @@ typedef struct kmg_header {
 #define KMG_DCFMT_TWIDDLED	0x0200	/* Pre-twiddled */
 #define KMG_DCFMT_MIPMAP	0x0400	/* Includes mipmaps */
 
+/* Header for KMG packs, which hold many KMG textures in one file so that a
+   whole level's worth can be loaded with one open. The header is followed by
+   the table of contents, and each texture's data starts on a 2048-byte
+   boundary, so it can be read from disc with a single seek. The texture
+   headers are kept in the table rather than with the data. */
+typedef struct kmg_pack_header {
+	uint32		magic;		/* Magic code */
+	uint32		version;	/* Version code */
+	uint32		count;		/* Number of textures */
+	uint8		padding[20];	/* Pad to a 32-byte header (all zeros) */
+} __attribute__((packed)) kmg_pack_header_t;
+
+/* Table of contents entry, one per texture */
+typedef struct kmg_pack_entry {
+	char		name[56];	/* Texture name, NUL padded */
+	uint32		offset;		/* Data offset from the start of the pack */
+	uint32		reserved;	/* Zero */
+	kmg_header_t	hdr;		/* The texture's KMG header */
+} __attribute__((packed)) kmg_pack_entry_t;
+
+#define KMG_PACK_MAGIC		0x4b504d4b	/* 'KMPK' */
+#define KMG_PACK_VERSION	1
+#define KMG_PACK_ALIGN		2048
+
 #ifdef _arch_dreamcast
 
 	/* Call to load a KMG file from the VFS. */
@@ -0,0 +1,150 @@
+/* KallistiOS ##version##
+
+   kmgpack.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   Writes KMG packs. The table of contents is sized for every file given on
+   the command line up front; if some of them fail to encode, the unused
+   entries are left as zeros.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define NEED_KOS_TYPES
+#include "kmg.h"
+#include "kmgpack.h"
+
+static long align(long x) {
+    return (x + KMG_PACK_ALIGN - 1) & ~(long)(KMG_PACK_ALIGN - 1);
+}
+
+/* Pad with zeros up to the next boundary */
+static int pad(FILE *fp) {
+    long pos = ftell(fp), end = align(pos);
+
+    for(; pos < end; pos++) {
+        if(fputc(0, fp) == EOF)
+            return -1;
+    }
+
+    return 0;
+}
+
+int kmg_pack_open(kmg_pack_t *pack, const char *filename, int max) {
+    memset(pack, 0, sizeof(*pack));
+
+    pack->toc = calloc(max, sizeof(kmg_pack_entry_t));
+
+    if(pack->toc == NULL) {
+        fprintf(stderr, "FATAL: out of memory for %s\n", filename);
+        return -ENOMEM;
+    }
+
+    pack->fp = fopen(filename, "wb");
+
+    if(pack->fp == NULL) {
+        fprintf(stderr, "FATAL: cannot create %s\n", filename);
+        free(pack->toc);
+        return -errno;
+    }
+
+    pack->filename = filename;
+    pack->max = max;
+    pack->data_start = align(sizeof(kmg_pack_header_t) +
+                             max * sizeof(kmg_pack_entry_t));
+
+    return 0;
+}
+
+FILE *kmg_pack_begin(kmg_pack_t *pack, const char *infile) {
+    kmg_pack_entry_t *ent;
+    const char *base, *ext;
+    size_t len;
+
+    if(pack->count == pack->max)
+        return NULL;
+
+    ent = &pack->toc[pack->count];
+    memset(ent, 0, sizeof(*ent));
+
+    /* The name is the file's, without its directory or extension */
+    base = strrchr(infile, '/');
+    base = base ? base + 1 : infile;
+    ext = strrchr(base, '.');
+    len = ext ? (size_t)(ext - base) : strlen(base);
+
+    if(len >= sizeof(ent->name)) {
+        fprintf(stderr, "warning: name of %s cut to %d characters\n", infile,
+                (int)sizeof(ent->name) - 1);
+        len = sizeof(ent->name) - 1;
+    }
+
+    memcpy(ent->name, base, len);
+
+    if(fseek(pack->fp, pack->data_start, SEEK_SET) < 0)
+        return NULL;
+
+    ent->offset = pack->data_start;
+
+    return pack->fp;
+}
+
+int kmg_pack_end(kmg_pack_t *pack, const kmg_header_t *hdr) {
+    kmg_pack_entry_t *ent = &pack->toc[pack->count];
+
+    memcpy(&ent->hdr, hdr, sizeof(*hdr));
+
+    if(pad(pack->fp) < 0) {
+        fprintf(stderr, "FATAL: error writing %s\n", pack->filename);
+        return -1;
+    }
+
+    pack->data_start = ftell(pack->fp);
+    pack->count++;
+
+    return 0;
+}
+
+int kmg_pack_close(kmg_pack_t *pack) {
+    kmg_pack_header_t hdr;
+    int rv = 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = KMG_PACK_MAGIC;
+    hdr.version = KMG_PACK_VERSION;
+    hdr.count = pack->count;
+
+    /* Only the entries in use go in the table, so the rest stay zero */
+    if(fseek(pack->fp, 0, SEEK_SET) < 0 ||
+       fwrite(&hdr, sizeof(hdr), 1, pack->fp) != 1 ||
+       (pack->count &&
+        fwrite(pack->toc, sizeof(kmg_pack_entry_t), pack->count, pack->fp) !=
+        (size_t)pack->count)) {
+        fprintf(stderr, "FATAL: can't write table of contents to %s\n",
+                pack->filename);
+        rv = -1;
+    }
+
+    /* Drop whatever a failed texture left at the end */
+    fflush(pack->fp);
+
+    if(ftruncate(fileno(pack->fp), pack->data_start) < 0 && rv == 0) {
+        fprintf(stderr, "FATAL: error writing %s\n", pack->filename);
+        rv = -1;
+    }
+
+    if(fclose(pack->fp) && rv == 0)
+        rv = -1;
+
+    if(rv < 0)
+        unlink(pack->filename);
+
+    free(pack->toc);
+    pack->fp = NULL;
+    pack->toc = NULL;
+
+    return rv;
+}
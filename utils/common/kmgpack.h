@@ -0,0 +1,38 @@
+/* KallistiOS ##version##
+
+   kmgpack.h
+   Copyright (C) 2026 KallistiOS Contributors
+*/
+
+#ifndef __KMGPACK_H
+#define __KMGPACK_H
+
+#include <stdio.h>
+
+struct kmg_header;
+struct kmg_pack_entry;
+
+/* A KMG pack being written (see kmg.h for the layout) */
+typedef struct kmg_pack {
+    FILE *fp;
+    const char *filename;
+    int count;                      /* Textures added so far */
+    int max;                        /* Room in the table of contents */
+    long data_start;                /* Where the current texture's data starts */
+    struct kmg_pack_entry *toc;
+} kmg_pack_t;
+
+/* Create a pack with room for up to max textures. */
+int kmg_pack_open(kmg_pack_t *pack, const char *filename, int max);
+
+/* Start a texture, named after the file it came from. Its data is then
+   written to the returned file. */
+FILE *kmg_pack_begin(kmg_pack_t *pack, const char *infile);
+
+/* Finish the current texture, with its header to put in the table. */
+int kmg_pack_end(kmg_pack_t *pack, const struct kmg_header *hdr);
+
+/* Write the table of contents and close the pack. */
+int kmg_pack_close(kmg_pack_t *pack);
+
+#endif
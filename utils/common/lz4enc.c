@@ -0,0 +1,92 @@
+/* KallistiOS ##version##
+
+   lz4enc.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   LZ4 block compression, greedy with one candidate per hash. The format
+   wants the last 5 bytes as literals, and no match starting in the last 12.
+*/
+
+#include <string.h>
+
+#include "lz4enc.h"
+
+#define LZ4_HASH_BITS       16
+#define LZ4_MFLIMIT         12
+#define LZ4_LASTLITS        5
+
+static uint32_t lz4_hash(const uint8_t *p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+    return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint8_t *lz4_len(uint8_t *d, size_t len) {
+    for(; len >= 255; len -= 255)
+        *d++ = 255;
+
+    *d++ = len;
+    return d;
+}
+
+static uint8_t *lz4_seq(uint8_t *d, const uint8_t *lit, size_t nlit,
+                        size_t off, size_t mlen) {
+    uint8_t *tok = d++;
+
+    *tok = (nlit >= 15 ? 15 : nlit) << 4;
+
+    if(nlit >= 15)
+        d = lz4_len(d, nlit - 15);
+
+    memcpy(d, lit, nlit);
+    d += nlit;
+
+    if(mlen) {
+        *d++ = off & 0xff;
+        *d++ = off >> 8;
+        mlen -= 4;
+        *tok |= mlen >= 15 ? 15 : mlen;
+
+        if(mlen >= 15)
+            d = lz4_len(d, mlen - 15);
+    }
+
+    return d;
+}
+
+size_t lz4_encode(const uint8_t *src, size_t len, uint8_t *dst) {
+    static uint32_t tab[1 << LZ4_HASH_BITS];
+    size_t ip = 0, anchor = 0, ref, mlen;
+    uint8_t *d = dst;
+    uint32_t h;
+
+    memset(tab, 0xff, sizeof(tab));
+
+    if(len > LZ4_MFLIMIT) {
+        while(ip < len - LZ4_MFLIMIT) {
+            h = lz4_hash(src + ip);
+            ref = tab[h];
+            tab[h] = ip;
+
+            if(ref == UINT32_MAX || ip - ref > 65535 ||
+               memcmp(src + ref, src + ip, 4)) {
+                ip++;
+                continue;
+            }
+
+            mlen = 4;
+
+            while(ip + mlen < len - LZ4_LASTLITS &&
+                  src[ref + mlen] == src[ip + mlen])
+                mlen++;
+
+            d = lz4_seq(d, src + anchor, ip - anchor, ip - ref, mlen);
+            ip += mlen;
+            anchor = ip;
+        }
+    }
+
+    d = lz4_seq(d, src + anchor, len - anchor, 0, 0);
+
+    return d - dst;
+}
@@ -0,0 +1,23 @@
+/* KallistiOS ##version##
+
+   lz4enc.h
+   Copyright (C) 2026 KallistiOS Contributors
+
+   LZ4 block compression for the host tools that make compressed images:
+   genromfs, mkpak and binpack.
+*/
+
+#ifndef __LZ4ENC_H
+#define __LZ4ENC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* How large the output of lz4_encode() can get for len bytes of input */
+#define LZ4_BOUND(len)  ((len) + (len) / 255 + 16)
+
+/* Compress len bytes of src into dst as one LZ4 block, and return its size.
+   dst needs room for LZ4_BOUND(len) bytes. */
+size_t lz4_encode(const uint8_t *src, size_t len, uint8_t *dst);
+
+#endif
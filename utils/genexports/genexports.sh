@@ -18,7 +18,8 @@ outpsym=$3
 includes=`cat $inpfile | grep '^include ' | cut -d' ' -f2 | sort`
 
 # Get the list of export names
-names=`cat $inpfile | grep -v '^#' | grep -v '^include ' | grep -v '^$' | sort`
+names=`cat $inpfile | grep -v '^#' | grep -v '^include ' | grep -v '^$' | LC_ALL=C sort`
+count=`echo "$names" | grep -c .`
 
 # Write out a header
 rm -f $outpfile
@@ -34,12 +35,66 @@ for i in $includes; do
 	echo "#include <$i>" >> $outpfile
 done
 
-# Now write out the sym table
+# Now write out the sym table. The entries are grouped by hash bucket, so
+# that export_lookup() can go straight to the few that might match; see
+# symtab_handler_t in kos/exports.h for the layout of the index.
 echo '#pragma GCC diagnostic ignored "-Wdeprecated-declarations"' >> $outpfile
-echo "export_sym_t ${outpsym}[] = {" >> $outpfile
-for i in $names; do
-	echo "	{ \"$i\", (unsigned long)(&$i) }," >> $outpfile
-done
+echo "$names" | grep . | awk -v count="$count" '
+	BEGIN {
+		for(i = 32; i < 127; i++)
+			ord[sprintf("%c", i)] = i;
+
+		for(nbuckets = 1; nbuckets * 2 < count; nbuckets *= 2)
+			;
+	}
+	{
+		h = 5381;
+
+		for(i = 1; i <= length($0); i++)
+			h = (h * 33 + ord[substr($0, i, 1)]) % 4294967296;
+
+		printf "%d %s %.0f\n", h % nbuckets, $0, h;
+	}' | LC_ALL=C sort -k1,1n -k2,2 | awk -v count="$count" -v sym="$outpsym" '
+	BEGIN {
+		for(nbuckets = 1; nbuckets * 2 < count; nbuckets *= 2)
+			;
+
+		for(i = 0; i < nbuckets; i++)
+			bucket[i] = "0xffffffff";
+
+		n = 0;
+	}
+	{
+		if(!($1 in seen)) {
+			bucket[$1] = n;
+			seen[$1] = 1;
+
+			if(n)
+				last[n - 1] = 1;
+		}
+
+		name[n] = $2;
+		hash[n] = $3;
+		n++;
+	}
+	END {
+		if(n)
+			last[n - 1] = 1;
+
+		printf "export_sym_t %s[] = {\n", sym;
+
+		for(i = 0; i < n; i++)
+			printf "\t{ \"%s\", (unsigned long)(&%s) },\n", name[i], name[i];
+
+		printf "\t{ 0, 0 }\n};\n\n";
+
+		printf "const uint32_t %s_hash[] = {\n\t%d,\n", sym, nbuckets;
+
+		for(i = 0; i < nbuckets; i++)
+			printf "\t%s,\n", bucket[i];
+
+		for(i = 0; i < n; i++)
+			printf "\t%.0fu,\n", hash[i] - hash[i] % 2 + (i in last);
 
-echo "	{ 0, 0 }" >> $outpfile
-echo "};" >> $outpfile
+		printf "};\n";
+	}' >> $outpfile
@@ -56,6 +56,8 @@
  * -A N,/name force named file(s) (shell globbing applied against the filenames)
  *       to be aligned on N bytes boundary
  * In both cases, N must be a power of two.
+ * -D    store files with the same contents only once, as hard links
+ * -s    sort the entries of each directory by name
  */
 
 /*
@@ -92,6 +94,8 @@
 #    include <sys/sysmacros.h>
 #endif
 
+#include "lz4enc.h"
+
 struct romfh {
     int32_t nextfh;
     int32_t spec;
@@ -110,6 +114,9 @@ struct romfh {
 #define ROMFH_FIF 7
 #define ROMFH_EXEC 8
 
+/* Block size of compressed files (see compressnode) */
+#define ZBLOCK 8192
+
 struct filenode;
 
 struct filehdr {
@@ -138,6 +145,9 @@ struct filenode {
     unsigned int offset;
     unsigned int size;
     unsigned int pad;
+    unsigned char *zdata;       /* Compressed data, if any */
+    unsigned int zsize;
+    uint32_t hash;              /* Of the contents, for -D */
 };
 
 struct aligns {
@@ -198,6 +208,11 @@ static char bigbuf[4096];
 static char fixbuf[512];
 static int atoffs = 0;
 static int align = 16;
+static int compress = 0;
+static int dedupe = 0;
+static int sortdirs = 0;
+static struct filenode **regfiles = NULL;   /* Files stored so far, for -D */
+static int nregfiles = 0;
 struct aligns *alignlist = NULL;
 struct excludes *excludelist = NULL;
 int realbase;
@@ -377,6 +392,12 @@ int dumpnode(struct filenode *node, FILE *f) {
         dumpdataa(bigbuf, node->size, f);
     }
 #endif
+    else if(S_ISREG(node->modes) && node->zdata) {
+        ri.nextfh |= htonl(ROMFH_REG);
+        ri.spec = htonl(ZBLOCK);
+        dumpri(&ri, node, f);
+        dumpdataa(node->zdata, node->zsize, f);
+    }
     else if(S_ISREG(node->modes)) {
         int offset, len, fd, max, avail;
         ri.nextfh |= htonl(ROMFH_REG);
@@ -452,7 +473,7 @@ int dumpall(struct filenode *node, int lastoff, FILE *f) {
     struct filenode *p;
 
     ri.nextfh = htonl(0x2d726f6d);
-    ri.spec = htonl(0x3166732d);
+    ri.spec = htonl(compress ? 0x31667a2d : 0x3166732d);
     ri.size = htonl(lastoff);
     ri.checksum = htonl(0x55555555);
     dumpri(&ri, node, f);
@@ -542,6 +563,9 @@ struct filenode *newnode(const char *base, const char *name, int curroffset) {
     node->orig_link = NULL;
     node->offset = curroffset;
     node->pad = 0;
+    node->zdata = NULL;
+    node->zsize = 0;
+    node->hash = 0;
 
     return node;
 }
@@ -574,7 +598,151 @@ struct filenode *findnode(struct filenode *node, dev_t dev, ino_t ino) {
 #define ALIGNUP16(x) (((x)+15)&~15)
 
 int spaceneeded(struct filenode *node) {
-    return 16 + ALIGNUP16(strlen(node->name) + 1) + ALIGNUP16(node->size);
+    return 16 + ALIGNUP16(strlen(node->name) + 1) +
+           ALIGNUP16(node->zdata ? node->zsize : node->size);
+}
+
+/* KallistiOS compressed images: regular files are LZ4 compressed in blocks
+   of ZBLOCK bytes, after a table of big-endian offsets from the start of the
+   data to each block and to the end of the last. A block that doesn't get
+   smaller is stored as is. The block size goes in the file's spec_info. */
+static void putbe32(unsigned char *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/* Compress a regular file, if that makes it smaller */
+int compressnode(struct filenode *node) {
+    unsigned char *data, *out, *d;
+    unsigned int blocks, i, len, n, table;
+    FILE *in;
+
+    if(!node->size)
+        return 0;
+
+    blocks = (node->size + ZBLOCK - 1) / ZBLOCK;
+    table = (blocks + 1) * 4;
+    data = malloc(node->size);
+    out = malloc(table + node->size + blocks * (ZBLOCK / 255 + 16));
+
+    if(!data || !out) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    if(!(in = fopen(node->realname, "rb")) ||
+       fread(data, 1, node->size, in) != node->size) {
+        perror(node->realname);
+        return -1;
+    }
+
+    fclose(in);
+    d = out + table;
+
+    for(i = 0; i < blocks; i++) {
+        putbe32(out + i * 4, d - out);
+        len = node->size - i * ZBLOCK;
+
+        if(len > ZBLOCK)
+            len = ZBLOCK;
+
+        n = lz4_encode(data + i * ZBLOCK, len, d);
+
+        if(n >= len) {
+            memcpy(d, data + i * ZBLOCK, len);
+            n = len;
+        }
+
+        d += n;
+    }
+
+    putbe32(out + blocks * 4, d - out);
+    free(data);
+
+    if((unsigned int)(d - out) >= node->size) {
+        free(out);
+        return 0;
+    }
+
+    node->zdata = out;
+    node->zsize = d - out;
+
+    return 0;
+}
+
+/* FNV-1a of a file's contents */
+int hashnode(struct filenode *node) {
+    uint32_t h = 2166136261U;
+    size_t len, i;
+    FILE *in;
+
+    if(!(in = fopen(node->realname, "rb"))) {
+        perror(node->realname);
+        return -1;
+    }
+
+    while((len = fread(bigbuf, 1, sizeof(bigbuf), in)) > 0) {
+        for(i = 0; i < len; i++) {
+            h ^= (unsigned char)bigbuf[i];
+            h *= 16777619U;
+        }
+    }
+
+    fclose(in);
+    node->hash = h;
+
+    return 0;
+}
+
+int samecontents(struct filenode *a, struct filenode *b) {
+    char buf[4096];
+    size_t len;
+    FILE *fa, *fb;
+    int same = 1;
+
+    fa = fopen(a->realname, "rb");
+    fb = fopen(b->realname, "rb");
+
+    while(fa && fb && same && (len = fread(bigbuf, 1, sizeof(bigbuf), fa)) > 0) {
+        same = fread(buf, 1, len, fb) == len && !memcmp(buf, bigbuf, len);
+    }
+
+    if(!fa || !fb)
+        same = 0;
+
+    if(fa)
+        fclose(fa);
+
+    if(fb)
+        fclose(fb);
+
+    return same;
+}
+
+/* Find a file already in the image with the same contents as this one */
+struct filenode *findsame(struct filenode *node) {
+    int i;
+
+    for(i = 0; i < nregfiles; i++) {
+        if(regfiles[i]->size == node->size && regfiles[i]->hash == node->hash &&
+                samecontents(regfiles[i], node))
+            return regfiles[i];
+    }
+
+    return NULL;
+}
+
+int namecmp(const void *a, const void *b) {
+    const char *na = *(const char **)a, *nb = *(const char **)b;
+#if defined(_WIN32) && !defined(__CYGWIN__)
+    int rv = _stricmp(na, nb);
+#else
+    int rv = strcasecmp(na, nb);
+#endif
+
+    return rv ? rv : strcmp(na, nb);
 }
 
 int alignnode(struct filenode *node, int curroffset, int extraspace) {
@@ -598,6 +766,8 @@ int processdir(int level, const char *base, const char *dirname, struct stat *sb
     struct dirent *dp;
     struct filenode *n, *link;
     struct excludes *pe;
+    char **names = NULL;
+    int nnames = 0, ent;
 
     if(level <= 1) {
         /* Ok, to make sure . and .. are handled correctly
@@ -636,7 +806,21 @@ int processdir(int level, const char *base, const char *dirname, struct stat *sb
                  || strcmp(dp->d_name, "..") == 0))
             continue;
 
-        n = newnode(base, dp->d_name, curroffset);
+        names = realloc(names, (nnames + 1) * sizeof(*names));
+
+        if(!names || !(names[nnames++] = strdup(dp->d_name))) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+
+    closedir(dirfd);
+
+    if(sortdirs && nnames)
+        qsort(names, nnames, sizeof(*names), namecmp);
+
+    for(ent = 0; ent < nnames; ent++) {
+        n = newnode(base, names[ent], curroffset);
 
         /* Process exclude list. */
         for(pe = excludelist; pe; pe = pe->next) {
@@ -741,9 +925,36 @@ int processdir(int level, const char *base, const char *dirname, struct stat *sb
             continue;
         }
 
+        if(S_ISREG(sb->st_mode) && dedupe && sb->st_size) {
+            n->size = sb->st_size;
+
+            if(hashnode(n))
+                return -1;
+
+            if((link = findsame(n))) {
+                n->orig_link = link;
+                n->size = 0;
+                curroffset = alignnode(n, curroffset, 0) + spaceneeded(n);
+                continue;
+            }
+
+            regfiles = realloc(regfiles, (nregfiles + 1) * sizeof(*regfiles));
+
+            if(!regfiles) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+
+            regfiles[nregfiles++] = n;
+            n->size = 0;
+        }
+
         if(S_ISREG(sb->st_mode)) {
             curroffset = alignnode(n, curroffset, spaceneeded(n));
             n->size = sb->st_size;
+
+            if(compress && compressnode(n))
+                return -1;
         }
         else
             curroffset = alignnode(n, curroffset, 0);
@@ -762,11 +973,11 @@ int processdir(int level, const char *base, const char *dirname, struct stat *sb
 
         if(S_ISDIR(sb->st_mode)) {
             if(!strcmp(n->name, "..")) {
-                curroffset = processdir(level + 1, dir->realname, dp->d_name,
+                curroffset = processdir(level + 1, dir->realname, names[ent],
                                         sb, dir, root, curroffset);
             }
             else {
-                curroffset = processdir(level + 1, n->realname, dp->d_name,
+                curroffset = processdir(level + 1, n->realname, names[ent],
                                         sb, n, root, curroffset);
             }
 
@@ -775,7 +986,10 @@ int processdir(int level, const char *base, const char *dirname, struct stat *sb
         }
     }
 
-    closedir(dirfd);
+    for(ent = 0; ent < nnames; ent++)
+        free(names[ent]);
+
+    free(names);
     return curroffset;
 }
 
@@ -788,9 +1002,12 @@ void showhelp(const char *argv0) {
     printf("  -d DIRECTORY           Use this directory as source\n");
     printf("  -v                     (Too) verbose operation\n");
     printf("  -V VOLUME              Use the specified volume name\n");
-    printf("  -a ALIGN               Align regular file data to ALIGN bytes\n");
+    printf("  -a ALIGN               Align regular file data to ALIGN bytes (32 for DMA)\n");
     printf("  -A ALIGN,PATTERN       Align all objects matching pattern to at least ALIGN bytes\n");
     printf("  -x PATTERN             Exclude all objects matching pattern\n");
+    printf("  -z                     LZ4 compress files (KallistiOS only)\n");
+    printf("  -D                     Store identical files once, as hard links\n");
+    printf("  -s                     Sort directory entries by name\n");
     printf("  -h                     Show this help\n");
     printf("\n");
     printf("Report bugs to chexum@shadow.banki.hu\n");
@@ -812,7 +1029,7 @@ int main(int argc, char *argv[]) {
     struct excludes *pe, *pe2;
     FILE *f;
 
-    while((c = getopt(argc, argv, "V:vd:f:ha:A:x:")) != EOF) {
+    while((c = getopt(argc, argv, "V:vd:f:ha:A:x:zDs")) != EOF) {
         switch(c) {
             case 'd':
                 dir = optarg;
@@ -866,6 +1083,15 @@ int main(int argc, char *argv[]) {
                     pa2->next = pa;
                 }
 
+                break;
+            case 'z':
+                compress = 1;
+                break;
+            case 'D':
+                dedupe = 1;
+                break;
+            case 's':
+                sortdirs = 1;
                 break;
             case 'x':
                 pe = (struct excludes *)malloc(sizeof(*pe) + strlen(optarg) + 1);
@@ -0,0 +1,149 @@
+/* KallistiOS ##version##
+
+   isosort.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   Turns a read trace from fs_iso9660_trace_stop() into a sort file for the
+   -sort option of mkisofs or genisoimage, so that files are laid out on the
+   disc in the order they were first read. The trace can be the file it was
+   written to, or a dcload console log with the "iso_trace: " lines in it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PREFIX "iso_trace: "
+
+static char **files;
+static size_t nfiles, maxfiles;
+
+static int seen(const char *fn) {
+    size_t i;
+
+    for(i = 0; i < nfiles; i++) {
+        if(!strcmp(files[i], fn))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int add(const char *fn) {
+    char **f;
+
+    if(nfiles == maxfiles) {
+        maxfiles = maxfiles ? maxfiles * 2 : 256;
+
+        if(!(f = realloc(files, maxfiles * sizeof(char *))))
+            return -1;
+
+        files = f;
+    }
+
+    if(!(files[nfiles] = strdup(fn)))
+        return -1;
+
+    nfiles++;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-p prefix] [-o sortfile] [trace]\n\n"
+            "  -p prefix   Put prefix in front of each path, as the files are\n"
+            "              named on the mkisofs command line (such as the\n"
+            "              directory the disc is made from)\n"
+            "  -o sortfile Write the sort file there rather than to stdout\n\n"
+            "The trace is read from stdin if not given.\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *prefix = "", *ofn = NULL;
+    char line[8192], fn[8192], *p;
+    unsigned long long time;
+    unsigned long sector, len;
+    FILE *in = stdin, *out = stdout;
+    size_t i, l;
+    int c, n;
+
+    while((c = getopt(argc, argv, "p:o:h")) != -1) {
+        switch(c) {
+            case 'p':
+                prefix = optarg;
+                break;
+
+            case 'o':
+                ofn = optarg;
+                break;
+
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if(optind < argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(optind < argc && !(in = fopen(argv[optind], "r"))) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    /* Remove a trailing slash on the prefix, as the paths start with one */
+    l = strlen(prefix);
+
+    if(l && prefix[l - 1] == '/') {
+        if(!(p = strdup(prefix)))
+            goto nomem;
+
+        p[l - 1] = '\0';
+        prefix = p;
+    }
+
+    while(fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        p = strstr(line, PREFIX);
+        p = p ? p + strlen(PREFIX) : line;
+
+        /* Anything else in a console log doesn't look like a read */
+        if(sscanf(p, "%llu %lu %lu %n", &time, &sector, &len, &n) != 3 ||
+           p[n] != '/') {
+            continue;
+        }
+
+        if(!seen(p + n) && add(p + n) < 0)
+            goto nomem;
+    }
+
+    if(in != stdin)
+        fclose(in);
+
+    if(!nfiles) {
+        fprintf(stderr, "%s: no reads found in the trace\n", argv[0]);
+        return 1;
+    }
+
+    if(ofn && !(out = fopen(ofn, "w"))) {
+        perror(ofn);
+        return 1;
+    }
+
+    /* mkisofs puts files with higher weights first */
+    for(i = 0; i < nfiles; i++) {
+        snprintf(fn, sizeof(fn), "%s%s", prefix, files[i]);
+        fprintf(out, "%s %lu\n", fn, (unsigned long)(nfiles - i));
+    }
+
+    if(out != stdout)
+        fclose(out);
+
+    return 0;
+
+nomem:
+    fprintf(stderr, "%s: out of memory\n", argv[0]);
+    return 1;
+}
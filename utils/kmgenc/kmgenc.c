@@ -14,6 +14,7 @@
    - Twiddling (or no)
    - Mipmaps (or no)
    - VQ encoding (or no)
+   - One KMG per image, or all of them in one KMG pack (-p)
 
    Any combination of these attributes may be selected for the final
    output file. Note that input textures must be a power of 2 on each
@@ -39,11 +40,15 @@
 */
 
 #include "kmgenc.h"
+#include "kmgpack.h"
 
 int use_twiddle = 1;
 int use_verbose = 1;
 int use_debug = 1;
 int use_alpha = 0;
+int use_pack = 0;
+
+static kmg_pack_t kmgpack;
 
 /* Linear/iterative twiddling algorithm from Marcus' tatest */
 #define TWIDTAB(x) ( (x&1)|((x&2)<<1)|((x&4)<<2)|((x&8)<<3)|((x&16)<<4)| \
@@ -108,11 +113,14 @@ static int save(const char *filename, image_t *img) {
     uint16      * tmp = NULL;
     int     fmt, cnt;
 
-    fp = fopen(filename, "wb");
+    if(use_pack)
+        fp = kmg_pack_begin(&kmgpack, filename);
+    else
+        fp = fopen(filename, "wb");
 
     if(fp == NULL) {
         fprintf(stderr, "FATAL: cannot create %s\n", filename);
-        return -errno;
+        return use_pack ? -1 : -errno;
     }
 
     memset(&hdr, 0, sizeof(hdr));
@@ -143,7 +151,8 @@ static int save(const char *filename, image_t *img) {
     cnt = img->w * img->h * 2;
     hdr.byte_count = le32(cnt);
 
-    if(fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+    /* A pack keeps the headers in its table of contents */
+    if(!use_pack && fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
         fprintf(stderr, "FATAL: can't write KMG header to %s\n", filename);
         goto loser;
     }
@@ -159,6 +168,10 @@ static int save(const char *filename, image_t *img) {
     }
 
     free(tmp);
+
+    if(use_pack)
+        return kmg_pack_end(&kmgpack, &hdr);
+
     fclose(fp);
     return 0;
 
@@ -167,6 +180,9 @@ loser:
     if(tmp)
         free(tmp);
 
+    if(use_pack)
+        return -1;
+
     fclose(fp);
     unlink(filename);
     return -1;
@@ -184,6 +200,7 @@ static void banner(const char *progname) {
     /* printf("\t-q, --highq\thigher quality (much slower)\n"); */
     printf("\t-a4, --argb4444\tuse alpha channel (and output ARGB4444)\n");
     printf("\t-a1, --argb1555\tuse alpha channel (and output ARGB1555)\n");
+    printf("\t-p, --pack FILE\twrite all images to a KMG pack\n");
 }
 
 static int valid_size(int x) {
@@ -343,11 +360,23 @@ static int process_option(char *arg) {
 }
 
 static int process(int argc, char *argv[]) {
-    int arg;
+    const char *packname = NULL;
+    int arg, rv;
 
     arg = 1;
 
     while(arg < argc) {
+        if(!strcmp(argv[arg], "-p") || !strcmp(argv[arg], "--pack")) {
+            if(arg + 1 >= argc) {
+                fprintf(stderr, "%s needs a file name\n", argv[arg]);
+                return -EINVAL;
+            }
+
+            packname = argv[arg + 1];
+            arg += 2;
+            continue;
+        }
+
         if(argv[arg][0] == '-') {
             if(process_option(argv[arg]) < 0) {
                 fprintf(stderr, "invalid option %s\n", argv[arg]);
@@ -367,12 +396,22 @@ static int process(int argc, char *argv[]) {
         return -EINVAL;
     }
 
+    if(packname) {
+        if((rv = kmg_pack_open(&kmgpack, packname, argc - arg)) < 0)
+            return rv;
+
+        use_pack = 1;
+    }
+
     while(arg < argc) {
         /* ordinary image */
         encode(argv[arg]);
         arg++;
     }
 
+    if(use_pack)
+        return kmg_pack_close(&kmgpack);
+
     return 0;
 }
 
@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+#
+# KallistiOS ##version##
+#
+# utils/kosbench/kosbench.py
+# Copyright (C) 2026 KallistiOS Contributors
+#
+# Compares the results of the kosbench example (examples/dreamcast/dev/kosbench)
+# with a baseline, so that a KOS revision that makes things slower shows up.
+# The results can be the kosbench.json it writes to /pc, or a dcload console
+# log with its "kosbench: " line in it.
+#
+
+import argparse
+import json
+import sys
+
+PREFIX = "kosbench: "
+
+
+def load(fn):
+    """Read results from a JSON file or the last kosbench line of a log."""
+    with open(fn, "r", errors="replace") as f:
+        text = f.read()
+
+    found = None
+
+    for line in text.splitlines():
+        pos = line.find(PREFIX)
+
+        if pos >= 0:
+            found = line[pos + len(PREFIX):]
+
+    try:
+        return json.loads(found if found is not None else text)
+    except ValueError:
+        sys.exit("%s: no kosbench results found" % fn)
+
+
+def main():
+    p = argparse.ArgumentParser(
+        description="Compare kosbench results with a baseline.")
+    p.add_argument("results", help="kosbench.json or a console log")
+    p.add_argument("-b", "--baseline", help="results to compare with")
+    p.add_argument("-t", "--threshold", type=float, default=5.0,
+                   help="percent worse than the baseline that counts as a "
+                        "regression (default 5)")
+    p.add_argument("-o", "--output",
+                   help="save the results as JSON, to use as a baseline")
+    args = p.parse_args()
+
+    new = load(args.results)
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(new, f, indent=2, sort_keys=True)
+            f.write("\n")
+
+    if not args.baseline:
+        print("KOS %s" % new.get("kos", "?"))
+
+        for name, r in sorted(new["results"].items()):
+            print("  %-24s %12.3f %s" % (name, r["value"], r["unit"]))
+
+        return 0
+
+    base = load(args.baseline)
+    regressions = 0
+
+    print("%-24s %12s %12s %8s   (KOS %s -> %s)" %
+          ("test", "baseline", "new", "change", base.get("kos", "?"),
+           new.get("kos", "?")))
+
+    for name in sorted(set(base["results"]) | set(new["results"])):
+        b = base["results"].get(name)
+        n = new["results"].get(name)
+
+        if not b or not n:
+            print("%-24s %12s %12s   %s" %
+                  (name, "-" if not b else "%.3f" % b["value"],
+                   "-" if not n else "%.3f" % n["value"],
+                   "only in the new results" if n else "missing"))
+            continue
+
+        if b["value"] == 0:
+            continue
+
+        change = (n["value"] - b["value"]) * 100.0 / b["value"]
+        worse = -change if n["better"] == "higher" else change
+        flag = ""
+
+        if worse > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif worse < -args.threshold:
+            flag = "  better"
+
+        print("%-24s %12.3f %12.3f %+7.1f%% %s%s" %
+              (name, b["value"], n["value"], change, n["unit"], flag))
+
+    if regressions:
+        print("\n%d regression(s) over %.1f%%" % (regressions, args.threshold))
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
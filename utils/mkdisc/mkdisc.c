@@ -0,0 +1,865 @@
+/* KallistiOS ##version##
+
+   mkdisc.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   Builds the ISO9660 data track of a bootable disc from a directory, with
+   the IP.BIN in its system area, laying out the files for loading speed
+   rather than in directory order:
+
+   - Files in a read trace from fs_iso9660_trace_stop() (the same one that
+     isosort takes) go in the order they were first read, one after the
+     other, following the boot file. The rest go on their own.
+   - The path tables and directories sit right in front of those files, as
+     they are read on the way to every open.
+   - Large files start on a block boundary, so that whole blocks of them
+     can be read with no partial block at either end.
+   - With -e, the track is padded out with zeros so that the traced files
+     end at the given sector. On a GD-ROM, which spins at a constant speed,
+     that puts them at the outer edge of the high density area where the
+     data rate is highest, with the untraced files at the inner edge out of
+     the way.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define SECTOR          2048
+#define SYSTEM_SECTORS  16
+#define MAX_NAME        31          /* ISO9660 level 2, with ";1" for files */
+
+/* Start of the high density area of a GD-ROM, and its end on a full disc */
+#define GD_HD_START     45000
+#define GD_HD_END       549150
+
+#define TRACE_PREFIX    "iso_trace: "
+
+typedef struct node {
+    char *name;                     /* The name on the disc */
+    char *path;                     /* The file on the host */
+    int is_dir;
+    uint32_t size;                  /* Bytes of file, or of directory records */
+    uint32_t lba;
+    time_t mtime;
+    int hot;                        /* Position in the read order, or -1 */
+    int number;                     /* Directory number in the path table */
+    struct node *parent;
+    struct node **children;
+    int nchildren;
+} node_t;
+
+static const char *prog;
+static const char *volume_id = "DREAMCAST";
+static uint32_t start_lba = GD_HD_START;
+static uint32_t end_lba;            /* 0 for no padding */
+static uint32_t align_blocks = 16;  /* Sectors */
+static uint32_t align_min = 256 * 1024;
+static int verbose;
+
+static node_t **dirs;               /* In path table order */
+static int ndirs;
+static node_t **order;              /* Files in the order they go on disc */
+static int norder;
+static uint32_t path_table_size;
+
+static void *xmalloc(size_t size) {
+    void *p = calloc(1, size);
+
+    if(!p) {
+        fprintf(stderr, "%s: out of memory\n", prog);
+        exit(1);
+    }
+
+    return p;
+}
+
+static char *xstrdup(const char *s) {
+    return strcpy(xmalloc(strlen(s) + 1), s);
+}
+
+static uint32_t sectors(uint32_t bytes) {
+    return (bytes + SECTOR - 1) / SECTOR;
+}
+
+/* Both-endian and single-endian fields */
+static void put16le(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put16be(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put32le(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void put32be(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void put16both(uint8_t *p, uint16_t v) {
+    put16le(p, v);
+    put16be(p + 2, v);
+}
+
+static void put32both(uint8_t *p, uint32_t v) {
+    put32le(p, v);
+    put32be(p + 4, v);
+}
+
+/* A space padded string, uppercase as the d-characters require */
+static void put_str(uint8_t *p, const char *s, size_t len) {
+    size_t i;
+
+    for(i = 0; i < len; i++)
+        p[i] = *s ? toupper((unsigned char)*s++) : ' ';
+}
+
+/* Turn a host file name into one allowed on the disc: uppercase letters,
+   digits and underscores, with a single dot before the extension. Files
+   with no extension end with the dot. */
+static char *iso_name(const char *host, int is_dir) {
+    char *name = xmalloc(MAX_NAME + 1);
+    const char *dot = is_dir ? NULL : strrchr(host, '.');
+    size_t len = 0;
+    const char *s;
+
+    for(s = host; *s && len < MAX_NAME - (is_dir ? 0 : 2); s++) {
+        if(s == dot)
+            name[len++] = '.';
+        else if(isalnum((unsigned char)*s))
+            name[len++] = toupper((unsigned char)*s);
+        else
+            name[len++] = '_';
+    }
+
+    if(!is_dir && !dot)
+        name[len++] = '.';
+
+    return name;
+}
+
+static int compare_nodes(const void *a, const void *b) {
+    return strcmp((*(node_t *const *)a)->name, (*(node_t *const *)b)->name);
+}
+
+static node_t *scan(const char *path, const char *name, node_t *parent) {
+    node_t *n = xmalloc(sizeof(node_t)), *c;
+    struct dirent *ent;
+    struct stat st;
+    char *child;
+    DIR *dir;
+    int i;
+
+    if(stat(path, &st) < 0) {
+        perror(path);
+        exit(1);
+    }
+
+    n->path = xstrdup(path);
+    n->is_dir = S_ISDIR(st.st_mode);
+    n->name = name ? iso_name(name, n->is_dir) : xstrdup("");
+    n->mtime = st.st_mtime;
+    n->hot = -1;
+    n->parent = parent ? parent : n;
+
+    /* Only files and directories go on the disc */
+    if(!n->is_dir && !S_ISREG(st.st_mode)) {
+        free(n->name);
+        free(n->path);
+        free(n);
+        return NULL;
+    }
+
+    if(!n->is_dir) {
+        if(st.st_size > 0xffffffffLL) {
+            fprintf(stderr, "%s: %s is too large\n", prog, path);
+            exit(1);
+        }
+
+        n->size = st.st_size;
+        return n;
+    }
+
+    if(!(dir = opendir(path))) {
+        perror(path);
+        exit(1);
+    }
+
+    while((ent = readdir(dir))) {
+        if(!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+            continue;
+
+        child = xmalloc(strlen(path) + strlen(ent->d_name) + 2);
+        sprintf(child, "%s/%s", path, ent->d_name);
+        c = scan(child, ent->d_name, n);
+        free(child);
+
+        if(!c)
+            continue;
+
+        n->children = realloc(n->children, (n->nchildren + 1) *
+                              sizeof(node_t *));
+
+        if(!n->children) {
+            fprintf(stderr, "%s: out of memory\n", prog);
+            exit(1);
+        }
+
+        n->children[n->nchildren++] = c;
+    }
+
+    closedir(dir);
+    qsort(n->children, n->nchildren, sizeof(node_t *), compare_nodes);
+
+    for(i = 1; i < n->nchildren; i++) {
+        if(!strcmp(n->children[i]->name, n->children[i - 1]->name)) {
+            fprintf(stderr, "%s: %s and %s have the same name on the disc\n",
+                    prog, n->children[i - 1]->path, n->children[i]->path);
+            exit(1);
+        }
+    }
+
+    return n;
+}
+
+static size_t record_len(size_t name_len) {
+    return (33 + name_len + 1) & ~1;
+}
+
+static size_t name_len(const node_t *n) {
+    return strlen(n->name) + (n->is_dir ? 0 : 2);
+}
+
+/* Directory records may not cross a sector, so add up sector by sector */
+static void size_dir(node_t *d) {
+    uint32_t size = 2 * record_len(1), len;
+    int i;
+
+    for(i = 0; i < d->nchildren; i++) {
+        len = record_len(name_len(d->children[i]));
+
+        if(size / SECTOR != (size + len - 1) / SECTOR)
+            size = (size / SECTOR + 1) * SECTOR;
+
+        size += len;
+    }
+
+    d->size = sectors(size) * SECTOR;
+}
+
+/* List the directories breadth first, which is the path table order */
+static void list_dirs(node_t *root) {
+    int i, j;
+
+    dirs = xmalloc(sizeof(node_t *));
+    dirs[ndirs++] = root;
+    path_table_size = 10;
+
+    for(i = 0; i < ndirs; i++) {
+        dirs[i]->number = i + 1;
+        size_dir(dirs[i]);
+
+        for(j = 0; j < dirs[i]->nchildren; j++) {
+            node_t *c = dirs[i]->children[j];
+
+            if(!c->is_dir)
+                continue;
+
+            if(ndirs == 65535) {
+                fprintf(stderr, "%s: too many directories\n", prog);
+                exit(1);
+            }
+
+            dirs = realloc(dirs, (ndirs + 1) * sizeof(node_t *));
+
+            if(!dirs) {
+                fprintf(stderr, "%s: out of memory\n", prog);
+                exit(1);
+            }
+
+            dirs[ndirs++] = c;
+            path_table_size += (8 + strlen(c->name) + 1) & ~1;
+        }
+    }
+}
+
+/* Find a file by its path as the program opened it, matching names the way
+   they were made up for the disc */
+static node_t *lookup(node_t *root, const char *path) {
+    char comp[1024], *name;
+    const char *end;
+    node_t *n = root;
+    size_t len;
+    int i;
+
+    while(n && *path) {
+        while(*path == '/')
+            path++;
+
+        if(!*path)
+            break;
+
+        end = strchr(path, '/');
+        len = end ? (size_t)(end - path) : strlen(path);
+
+        if(len >= sizeof(comp) || !n->is_dir)
+            return NULL;
+
+        memcpy(comp, path, len);
+        comp[len] = '\0';
+
+        /* ISO9660 names may carry a version, which isn't part of ours */
+        if(strchr(comp, ';'))
+            *strchr(comp, ';') = '\0';
+
+        path += len;
+
+        for(i = 0; i < n->nchildren; i++) {
+            name = iso_name(comp, n->children[i]->is_dir);
+
+            if(!strcmp(name, n->children[i]->name)) {
+                free(name);
+                break;
+            }
+
+            free(name);
+        }
+
+        n = i < n->nchildren ? n->children[i] : NULL;
+    }
+
+    return n && !n->is_dir ? n : NULL;
+}
+
+static void make_hot(node_t *n) {
+    if(n->hot >= 0)
+        return;
+
+    n->hot = norder;
+    order = realloc(order, (norder + 1) * sizeof(node_t *));
+
+    if(!order) {
+        fprintf(stderr, "%s: out of memory\n", prog);
+        exit(1);
+    }
+
+    order[norder++] = n;
+}
+
+static int read_trace(node_t *root, const char *fn) {
+    unsigned long long time;
+    unsigned long sector, len;
+    char line[8192], *p;
+    int n, missing = 0;
+    node_t *f;
+    FILE *in;
+
+    if(!(in = fopen(fn, "r"))) {
+        perror(fn);
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        p = strstr(line, TRACE_PREFIX);
+        p = p ? p + strlen(TRACE_PREFIX) : line;
+
+        if(sscanf(p, "%llu %lu %lu %n", &time, &sector, &len, &n) != 3 ||
+           p[n] != '/')
+            continue;
+
+        /* Traces from the disc being made over are named with /cd in front */
+        if(!strncmp(p + n, "/cd/", 4))
+            n += 3;
+
+        if((f = lookup(root, p + n)))
+            make_hot(f);
+        else if(!missing++ || verbose)
+            fprintf(stderr, "%s: %s is in the trace but not in the "
+                    "directory\n", prog, p + n);
+    }
+
+    fclose(in);
+    return 0;
+}
+
+/* The rest of the files, in directory order */
+static void add_cold(node_t *d, node_t ***cold, int *ncold) {
+    int i;
+
+    for(i = 0; i < d->nchildren; i++) {
+        node_t *c = d->children[i];
+
+        if(c->is_dir) {
+            add_cold(c, cold, ncold);
+        }
+        else if(c->hot < 0) {
+            *cold = realloc(*cold, (*ncold + 1) * sizeof(node_t *));
+
+            if(!*cold) {
+                fprintf(stderr, "%s: out of memory\n", prog);
+                exit(1);
+            }
+
+            (*cold)[(*ncold)++] = c;
+        }
+    }
+}
+
+static uint32_t place_file(node_t *f, uint32_t lba) {
+    if(f->size >= align_min && align_blocks > 1)
+        lba = (lba + align_blocks - 1) / align_blocks * align_blocks;
+
+    f->lba = lba;
+
+    return lba + sectors(f->size);
+}
+
+/* Place the path tables, directories and traced files from lba on, and
+   return where they end. */
+static uint32_t place_hot(uint32_t lba, uint32_t *l_table, uint32_t *m_table) {
+    int i;
+
+    *l_table = lba;
+    lba += sectors(path_table_size);
+    *m_table = lba;
+    lba += sectors(path_table_size);
+
+    for(i = 0; i < ndirs; i++) {
+        dirs[i]->lba = lba;
+        lba += dirs[i]->size / SECTOR;
+    }
+
+    for(i = 0; i < norder; i++)
+        lba = place_file(order[i], lba);
+
+    return lba;
+}
+
+static void put_date7(uint8_t *p, time_t t) {
+    struct tm *tm = gmtime(&t);
+
+    p[0] = tm->tm_year;
+    p[1] = tm->tm_mon + 1;
+    p[2] = tm->tm_mday;
+    p[3] = tm->tm_hour;
+    p[4] = tm->tm_min;
+    p[5] = tm->tm_sec;
+    p[6] = 0;
+}
+
+static void put_date17(uint8_t *p, time_t t) {
+    struct tm *tm = gmtime(&t);
+    char buf[64];
+
+    if(!t) {
+        memset(p, '0', 16);
+        p[16] = 0;
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "%04d%02d%02d%02d%02d%02d00",
+             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour,
+             tm->tm_min, tm->tm_sec);
+    memcpy(p, buf, 16);
+    p[16] = 0;
+}
+
+static size_t put_record(uint8_t *p, const node_t *n, const char *name,
+                         size_t len) {
+    size_t rlen = record_len(len);
+
+    memset(p, 0, rlen);
+    p[0] = rlen;
+    put32both(p + 2, n->lba);
+    put32both(p + 10, n->size);
+    put_date7(p + 18, n->mtime);
+    p[25] = n->is_dir ? 2 : 0;
+    put16both(p + 28, 1);
+    p[32] = len;
+    memcpy(p + 33, name, len);
+
+    return rlen;
+}
+
+static void make_dir(uint8_t *buf, const node_t *d) {
+    char name[MAX_NAME + 3];
+    size_t pos, len;
+    int i;
+
+    memset(buf, 0, d->size);
+    pos = put_record(buf, d, "\0", 1);
+    pos += put_record(buf + pos, d->parent, "\1", 1);
+
+    for(i = 0; i < d->nchildren; i++) {
+        const node_t *c = d->children[i];
+
+        snprintf(name, sizeof(name), c->is_dir ? "%s" : "%s;1", c->name);
+        len = strlen(name);
+
+        if(pos / SECTOR != (pos + record_len(len) - 1) / SECTOR)
+            pos = (pos / SECTOR + 1) * SECTOR;
+
+        pos += put_record(buf + pos, c, name, len);
+    }
+}
+
+static void make_path_table(uint8_t *buf, int big_endian) {
+    size_t pos = 0, len;
+    int i;
+
+    memset(buf, 0, sectors(path_table_size) * SECTOR);
+
+    for(i = 0; i < ndirs; i++) {
+        len = i ? strlen(dirs[i]->name) : 1;
+        buf[pos] = len;
+
+        if(big_endian) {
+            put32be(buf + pos + 2, dirs[i]->lba);
+            put16be(buf + pos + 6, dirs[i]->parent->number);
+        }
+        else {
+            put32le(buf + pos + 2, dirs[i]->lba);
+            put16le(buf + pos + 6, dirs[i]->parent->number);
+        }
+
+        memcpy(buf + pos + 8, i ? dirs[i]->name : "\0", len);
+        pos += (8 + len + 1) & ~1;
+    }
+}
+
+static void make_pvd(uint8_t *buf, const node_t *root, uint32_t end,
+                     uint32_t l_table, uint32_t m_table) {
+    time_t now = time(NULL);
+
+    memset(buf, 0, SECTOR);
+    buf[0] = 1;
+    memcpy(buf + 1, "CD001", 5);
+    buf[6] = 1;
+    put_str(buf + 8, "SEGA SEGAKATANA", 32);
+    put_str(buf + 40, volume_id, 32);
+    put32both(buf + 80, end);
+    put16both(buf + 120, 1);
+    put16both(buf + 124, 1);
+    put16both(buf + 128, SECTOR);
+    put32both(buf + 132, path_table_size);
+    put32le(buf + 140, l_table);
+    put32be(buf + 148, m_table);
+    put_record(buf + 156, root, "\0", 1);
+    put_str(buf + 190, volume_id, 128);
+    put_str(buf + 318, "", 128);
+    put_str(buf + 446, "", 128);
+    put_str(buf + 574, "MKDISC", 128);
+    put_str(buf + 702, "", 37);
+    put_str(buf + 739, "", 37);
+    put_str(buf + 776, "", 37);
+    put_date17(buf + 813, now);
+    put_date17(buf + 830, now);
+    put_date17(buf + 847, 0);
+    put_date17(buf + 864, 0);
+    buf[881] = 1;
+}
+
+/* Output, kept to the order of the sectors so that it can be piped */
+static FILE *out;
+static uint32_t out_lba;
+static const char *out_name;
+
+static void write_at(uint32_t lba, const void *data, size_t len) {
+    static const uint8_t zero[SECTOR];
+
+    while(out_lba < lba) {
+        if(fwrite(zero, SECTOR, 1, out) != 1)
+            goto fail;
+
+        out_lba++;
+    }
+
+    if(len && fwrite(data, len, 1, out) != 1)
+        goto fail;
+
+    /* Pad the last sector */
+    if(len % SECTOR && fwrite(zero, SECTOR - len % SECTOR, 1, out) != 1)
+        goto fail;
+
+    out_lba += sectors(len);
+    return;
+
+fail:
+    fprintf(stderr, "%s: can't write %s: %s\n", prog, out_name,
+            strerror(errno));
+    exit(1);
+}
+
+static void write_file(const node_t *f) {
+    uint8_t buf[64 * SECTOR];
+    uint32_t left = f->size;
+    size_t len;
+    FILE *in;
+
+    if(!(in = fopen(f->path, "rb"))) {
+        perror(f->path);
+        exit(1);
+    }
+
+    write_at(f->lba, NULL, 0);
+
+    while(left) {
+        len = left < sizeof(buf) ? left : sizeof(buf);
+
+        if(fread(buf, len, 1, in) != 1) {
+            fprintf(stderr, "%s: can't read %s\n", prog, f->path);
+            exit(1);
+        }
+
+        write_at(out_lba, buf, len);
+        left -= len;
+    }
+
+    fclose(in);
+}
+
+static int compare_lba(const void *a, const void *b) {
+    const node_t *na = *(node_t *const *)a, *nb = *(node_t *const *)b;
+
+    return na->lba < nb->lba ? -1 : na->lba > nb->lba;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: %s [options] -o image.iso directory\n\n"
+            "  -i ip.bin   Put an IP.BIN (see makeip) in the system area\n"
+            "  -t trace    Lay out the files read in a trace from\n"
+            "              fs_iso9660_trace_stop(), in the order they were read\n"
+            "  -b file     Boot file, placed ahead of the traced files\n"
+            "              (default: the one IP.BIN names, or 1ST_READ.BIN)\n"
+            "  -s sector   First sector of the track (default %d, the GD-ROM\n"
+            "              high density area; 11702 for a CD-R second session)\n"
+            "  -e sector   Pad with zeros so that the traced files end at this\n"
+            "              sector, such as %d for the outer edge of a full\n"
+            "              GD-ROM (default: no padding)\n"
+            "  -a sectors  Block size large files are aligned to (default 16)\n"
+            "  -m bytes    Size from which files get aligned (default 262144)\n"
+            "  -V volid    Volume name (default DREAMCAST)\n"
+            "  -v          Print where each file goes\n\n"
+            "The image holds 2048-byte sectors, starting with the system area.\n",
+            prog, GD_HD_START, GD_HD_END);
+}
+
+static unsigned long number(const char *s) {
+    char *end;
+    unsigned long v = strtoul(s, &end, 0);
+
+    if(*end || end == s) {
+        usage();
+        exit(1);
+    }
+
+    return v;
+}
+
+int main(int argc, char *argv[]) {
+    const char *ip = NULL, *trace = NULL, *boot = NULL;
+    char ip_boot[17];
+    uint8_t sys[SYSTEM_SECTORS * SECTOR], pvd[SECTOR], *buf;
+    uint32_t lba, hot_start, hot_end, l_table, m_table;
+    node_t *root, **cold = NULL, **all, *f;
+    int c, i, ncold = 0;
+    FILE *in;
+    size_t len;
+
+    prog = argv[0];
+
+    while((c = getopt(argc, argv, "i:t:b:s:e:a:m:V:o:vh")) != -1) {
+        switch(c) {
+            case 'i': ip = optarg; break;
+            case 't': trace = optarg; break;
+            case 'b': boot = optarg; break;
+            case 's': start_lba = number(optarg); break;
+            case 'e': end_lba = number(optarg); break;
+            case 'a': align_blocks = number(optarg); break;
+            case 'm': align_min = number(optarg); break;
+            case 'V': volume_id = optarg; break;
+            case 'o': out_name = optarg; break;
+            case 'v': verbose = 1; break;
+            default:
+                usage();
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if(optind != argc - 1 || !out_name) {
+        usage();
+        return 1;
+    }
+
+    if(!align_blocks)
+        align_blocks = 1;
+
+    root = scan(argv[optind], NULL, NULL);
+
+    if(!root->is_dir) {
+        fprintf(stderr, "%s: %s is not a directory\n", prog, argv[optind]);
+        return 1;
+    }
+
+    list_dirs(root);
+
+    /* System area */
+    memset(sys, 0, sizeof(sys));
+
+    if(ip) {
+        if(!(in = fopen(ip, "rb"))) {
+            perror(ip);
+            return 1;
+        }
+
+        len = fread(sys, 1, sizeof(sys), in);
+        fclose(in);
+
+        if(len != sizeof(sys))
+            fprintf(stderr, "%s: warning: %s is short\n", prog, ip);
+
+        /* The boot file name is at 0x60, space padded */
+        if(!boot && len >= 0x70 && !memcmp(sys, "SEGA SEGAKATANA", 15)) {
+            memcpy(ip_boot, sys + 0x60, 16);
+            ip_boot[16] = '\0';
+            ip_boot[strcspn(ip_boot, " ")] = '\0';
+            boot = ip_boot;
+        }
+    }
+
+    if(!boot)
+        boot = "1ST_READ.BIN";
+
+    if((f = lookup(root, boot)))
+        make_hot(f);
+    else
+        fprintf(stderr, "%s: warning: no boot file %s\n", prog, boot);
+
+    if(trace && read_trace(root, trace) < 0)
+        return 1;
+
+    add_cold(root, &cold, &ncold);
+
+    /* Without padding, the hot files follow the volume descriptors and the
+       cold ones follow them. With it, the cold ones go first, and the hot
+       ones are pushed to the end, keeping their alignment. */
+    lba = start_lba + SYSTEM_SECTORS + 2;
+
+    if(!end_lba) {
+        lba = hot_end = place_hot(lba, &l_table, &m_table);
+
+        for(i = 0; i < ncold; i++)
+            lba = place_file(cold[i], lba);
+    }
+    else {
+        for(i = 0; i < ncold; i++)
+            lba = place_file(cold[i], lba);
+
+        hot_end = place_hot(0, &l_table, &m_table);
+
+        if(end_lba < hot_end || end_lba - hot_end < lba) {
+            fprintf(stderr, "%s: the files don't fit before sector %lu\n",
+                    prog, (unsigned long)end_lba);
+            return 1;
+        }
+
+        /* Shifting by whole blocks keeps the layout the same */
+        hot_start = (end_lba - hot_end) / align_blocks * align_blocks;
+
+        if(hot_start < lba) {
+            fprintf(stderr, "%s: the files don't fit before sector %lu\n",
+                    prog, (unsigned long)end_lba);
+            return 1;
+        }
+
+        hot_end = place_hot(hot_start, &l_table, &m_table);
+        lba = hot_end;
+    }
+
+    if(verbose) {
+        for(i = 0; i < norder; i++)
+            printf("%8lu %10lu  hot  %s\n", (unsigned long)order[i]->lba,
+                   (unsigned long)order[i]->size, order[i]->path);
+
+        for(i = 0; i < ncold; i++)
+            printf("%8lu %10lu  cold %s\n", (unsigned long)cold[i]->lba,
+                   (unsigned long)cold[i]->size, cold[i]->path);
+    }
+
+    if(!(out = fopen(out_name, "wb"))) {
+        perror(out_name);
+        return 1;
+    }
+
+    out_lba = start_lba;
+    write_at(start_lba, sys, sizeof(sys));
+
+    make_pvd(pvd, root, lba, l_table, m_table);
+    write_at(out_lba, pvd, SECTOR);
+
+    memset(pvd, 0, SECTOR);
+    pvd[0] = 255;
+    memcpy(pvd + 1, "CD001", 5);
+    pvd[6] = 1;
+    write_at(out_lba, pvd, SECTOR);
+
+    /* Everything else goes out in sector order */
+    all = xmalloc((norder + ncold) * sizeof(node_t *));
+    memcpy(all, order, norder * sizeof(node_t *));
+    memcpy(all + norder, cold, ncold * sizeof(node_t *));
+    qsort(all, norder + ncold, sizeof(node_t *), compare_lba);
+
+    for(i = 0; i < norder + ncold && all[i]->lba < l_table; i++)
+        write_file(all[i]);
+
+    buf = xmalloc(sectors(path_table_size) * SECTOR);
+    make_path_table(buf, 0);
+    write_at(l_table, buf, sectors(path_table_size) * SECTOR);
+    make_path_table(buf, 1);
+    write_at(m_table, buf, sectors(path_table_size) * SECTOR);
+    free(buf);
+
+    for(c = 0; c < ndirs; c++) {
+        buf = xmalloc(dirs[c]->size);
+        make_dir(buf, dirs[c]);
+        write_at(dirs[c]->lba, buf, dirs[c]->size);
+        free(buf);
+    }
+
+    for(; i < norder + ncold; i++)
+        write_file(all[i]);
+
+    write_at(lba, NULL, 0);
+
+    if(fclose(out)) {
+        fprintf(stderr, "%s: can't write %s: %s\n", prog, out_name,
+                strerror(errno));
+        return 1;
+    }
+
+    if(verbose)
+        printf("%lu sectors, %d traced files from sector %lu\n",
+               (unsigned long)(lba - start_lba), norder,
+               (unsigned long)l_table);
+
+    return 0;
+}
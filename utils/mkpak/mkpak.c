@@ -0,0 +1,354 @@
+/* KallistiOS ##version##
+
+   mkpak.c
+   Copyright (C) 2026 KallistiOS Contributors
+
+   Makes a packed archive for fs_pak from a directory. See kos/fs_pak.h for
+   the layout. Files can be LZ4 compressed, and are kept compressed only when
+   that saves space.
+*/
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "lz4enc.h"
+
+#define PAK_MAGIC       0x4b41504b
+#define PAK_VERSION     1
+#define PAK_ALIGN       2048
+#define PAK_FLAG_DIR    0x00000001
+#define PAK_FLAG_LZ4    0x00000002
+
+#define HDR_SIZE        16
+#define ENTRY_SIZE      24
+
+typedef struct {
+    char *path;                 /* In the archive */
+    char *src;                  /* On the host */
+    uint32_t hash, name, offset, size, stored, flags;
+} entry_t;
+
+static entry_t *ents;
+static size_t nents, maxents;
+static int compress, verbose;
+
+static uint32_t hash(const char *fn) {
+    uint32_t h = 2166136261U;
+
+    for(; *fn; fn++) {
+        h ^= (uint8_t)tolower((unsigned char)*fn);
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static void *xmalloc(size_t size) {
+    void *rv = malloc(size ? size : 1);
+
+    if(!rv) {
+        fprintf(stderr, "mkpak: out of memory\n");
+        exit(1);
+    }
+
+    return rv;
+}
+
+static char *join(const char *a, const char *b) {
+    char *rv = xmalloc(strlen(a) + strlen(b) + 2);
+
+    if(*a)
+        sprintf(rv, "%s/%s", a, b);
+    else
+        strcpy(rv, b);
+
+    return rv;
+}
+
+static int namecmp(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void add(const char *path, const char *src, uint32_t size,
+                uint32_t flags) {
+    entry_t *e;
+
+    if(nents == maxents) {
+        maxents = maxents ? maxents * 2 : 256;
+
+        if(!(ents = realloc(ents, maxents * sizeof(entry_t)))) {
+            fprintf(stderr, "mkpak: out of memory\n");
+            exit(1);
+        }
+    }
+
+    e = &ents[nents++];
+    memset(e, 0, sizeof(*e));
+    e->path = strdup(path);
+    e->src = strdup(src);
+    e->hash = hash(path);
+    e->size = size;
+    e->flags = flags;
+}
+
+/* Add everything under a directory, in name order */
+static int walk(const char *src, const char *path) {
+    DIR *d;
+    struct dirent *de;
+    struct stat st;
+    char **names = NULL, *s, *p;
+    size_t n = 0, max = 0, i;
+    int rv = 0;
+
+    if(!(d = opendir(src))) {
+        perror(src);
+        return -1;
+    }
+
+    while((de = readdir(d))) {
+        if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+
+        if(n == max) {
+            max = max ? max * 2 : 64;
+
+            if(!(names = realloc(names, max * sizeof(char *)))) {
+                fprintf(stderr, "mkpak: out of memory\n");
+                exit(1);
+            }
+        }
+
+        names[n++] = strdup(de->d_name);
+    }
+
+    closedir(d);
+    qsort(names, n, sizeof(char *), namecmp);
+
+    for(i = 0; i < n && !rv; i++) {
+        s = join(src, names[i]);
+        p = join(path, names[i]);
+
+        if(stat(s, &st) < 0) {
+            perror(s);
+            rv = -1;
+        }
+        else if(S_ISDIR(st.st_mode)) {
+            add(p, s, 0, PAK_FLAG_DIR);
+            rv = walk(s, p);
+        }
+        else if(S_ISREG(st.st_mode)) {
+            if(st.st_size > UINT32_MAX) {
+                fprintf(stderr, "mkpak: %s is too big\n", s);
+                rv = -1;
+            }
+            else {
+                add(p, s, st.st_size, 0);
+            }
+        }
+
+        free(s);
+        free(p);
+    }
+
+    for(i = 0; i < n; i++)
+        free(names[i]);
+
+    free(names);
+
+    return rv;
+}
+
+static int entcmp(const void *a, const void *b) {
+    const entry_t *x = a, *y = b;
+
+    if(x->hash != y->hash)
+        return x->hash < y->hash ? -1 : 1;
+
+    return strcmp(x->path, y->path);
+}
+
+static int pathcmp(const void *a, const void *b) {
+    return strcmp((*(entry_t * const *)a)->path, (*(entry_t * const *)b)->path);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static int pad(FILE *f, long *pos) {
+    static const uint8_t zero[PAK_ALIGN];
+    size_t n = (PAK_ALIGN - (*pos % PAK_ALIGN)) % PAK_ALIGN;
+
+    *pos += n;
+    return fwrite(zero, 1, n, f) == n ? 0 : -1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-c] [-v] directory archive\n\n"
+            "  -c  LZ4 compress files, where that makes them smaller\n"
+            "  -v  List the files as they're added\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    uint8_t hdr[HDR_SIZE], ent[ENTRY_SIZE], *data, *packed = NULL;
+    size_t i, names_size = 0, n;
+    entry_t *e, **order;
+    FILE *in, *out;
+    uint32_t offset;
+    long pos;
+    int c;
+
+    while((c = getopt(argc, argv, "cvh")) != -1) {
+        switch(c) {
+            case 'c':
+                compress = 1;
+                break;
+
+            case 'v':
+                verbose = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+
+    if(argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(walk(argv[optind], "") < 0)
+        return 1;
+
+    qsort(ents, nents, sizeof(entry_t), entcmp);
+
+    for(i = 0; i < nents; i++) {
+        ents[i].name = names_size;
+        names_size += strlen(ents[i].path) + 1;
+    }
+
+    if(!(out = fopen(argv[optind + 1], "wb"))) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+
+    /* The index is written once the data is, as it holds where each file
+       went and how big it came out. */
+    offset = HDR_SIZE + nents * ENTRY_SIZE + names_size;
+    offset = (offset + PAK_ALIGN - 1) & ~(PAK_ALIGN - 1);
+
+    if(fseek(out, offset, SEEK_SET) < 0)
+        goto write_err;
+
+    pos = offset;
+
+    /* Data goes in path order, so that a directory's files are together */
+    order = xmalloc(nents * sizeof(entry_t *));
+
+    for(i = 0; i < nents; i++)
+        order[i] = &ents[i];
+
+    qsort(order, nents, sizeof(entry_t *), pathcmp);
+
+    for(i = 0; i < nents; i++) {
+        e = order[i];
+
+        if(e->flags & PAK_FLAG_DIR)
+            continue;
+
+        if(!(in = fopen(e->src, "rb"))) {
+            perror(e->src);
+            return 1;
+        }
+
+        data = xmalloc(e->size);
+
+        if(fread(data, 1, e->size, in) != e->size) {
+            perror(e->src);
+            return 1;
+        }
+
+        fclose(in);
+
+        e->offset = pos;
+        e->stored = e->size;
+
+        if(compress && e->size) {
+            packed = xmalloc(LZ4_BOUND(e->size));
+            n = lz4_encode(data, e->size, packed);
+
+            if(n < e->size) {
+                free(data);
+                data = packed;
+                e->stored = n;
+                e->flags |= PAK_FLAG_LZ4;
+            }
+            else {
+                free(packed);
+            }
+        }
+
+        if(verbose)
+            printf("%-50s %10lu %10lu\n", e->path, (unsigned long)e->size,
+                   (unsigned long)e->stored);
+
+        if(fwrite(data, 1, e->stored, out) != e->stored)
+            goto write_err;
+
+        free(data);
+        pos += e->stored;
+
+        if(pad(out, &pos) < 0)
+            goto write_err;
+    }
+
+    rewind(out);
+    put32(hdr, PAK_MAGIC);
+    put32(hdr + 4, PAK_VERSION);
+    put32(hdr + 8, nents);
+    put32(hdr + 12, names_size);
+
+    if(fwrite(hdr, 1, sizeof(hdr), out) != sizeof(hdr))
+        goto write_err;
+
+    for(i = 0; i < nents; i++) {
+        e = &ents[i];
+        put32(ent, e->hash);
+        put32(ent + 4, e->name);
+        put32(ent + 8, e->offset);
+        put32(ent + 12, e->size);
+        put32(ent + 16, e->stored);
+        put32(ent + 20, e->flags);
+
+        if(fwrite(ent, 1, sizeof(ent), out) != sizeof(ent))
+            goto write_err;
+    }
+
+    for(i = 0; i < nents; i++) {
+        if(fwrite(ents[i].path, 1, strlen(ents[i].path) + 1, out) !=
+           strlen(ents[i].path) + 1)
+            goto write_err;
+    }
+
+    if(fclose(out)) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+
+    return 0;
+
+write_err:
+    perror(argv[optind + 1]);
+    return 1;
+}
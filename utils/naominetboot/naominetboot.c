@@ -19,33 +19,48 @@
 
 #include <sys/socket.h>
 #include <sys/signal.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #define NETDIMM_PORT 10703
 
-/* This function is taken (with minor modifications) from:
+/* Size of each piece of the program sent to the NetDIMM */
+#define CHUNK_SIZE 0x8000
+
+/* Most NAOMIs that can be uploaded to at once */
+#define MAX_TARGETS 64
+
+/* Adapted from the table-driven CRC in:
    KallistiOS ##version##
 
    kernel/net/net_crc.c
    Copyright (C) 2009, 2010, 2012 Lawrence Sebald
 
 */
+static uint32_t crc_tab[256];
+
+static void crc32le_init(void) {
+    uint32_t i, j, c;
+
+    for(i = 0; i < 256; ++i) {
+        c = i;
+
+        for(j = 0; j < 8; ++j)
+            c = (0xEDB88320 & (-(c & 1))) ^ (c >> 1);
+
+        crc_tab[i] = c;
+    }
+}
+
 uint32_t crc32le(uint32_t crc, const uint8_t *data, int size) {
     int i;
     uint32_t rv = ~crc;
 
-    for(i = 0; i < size; ++i) {
-        rv ^= data[i];
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-    }
+    for(i = 0; i < size; ++i)
+        rv = crc_tab[(rv ^ data[i]) & 0xFF] ^ (rv >> 8);
 
     return ~rv;
 }
@@ -85,6 +100,8 @@ ssize_t set_null_key(int s) {
 
 ssize_t upload_data(int s, uint32_t addr, uint32_t len, const uint8_t data[]) {
     uint8_t cmd[14];
+    struct iovec iov[2];
+    ssize_t rv;
 
     len += 0x0A;
     cmd[0] = (uint8_t)(len & 0xFF);
@@ -98,11 +115,19 @@ ssize_t upload_data(int s, uint32_t addr, uint32_t len, const uint8_t data[]) {
     cmd[11] = (uint8_t)((addr >> 24) & 0xFF);
     cmd[12] = cmd[13] = 0;
 
-    if(send(s, cmd, 14, 0) < 14) {
+    /* Send the command and its data together, so the tail of each chunk
+       doesn't sit waiting for the ACK of the command before it. */
+    iov[0].iov_base = cmd;
+    iov[0].iov_len = 14;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len = len - 0x0A;
+
+    if((rv = writev(s, iov, 2)) < (ssize_t)(len + 4)) {
         perror("Upload Failed");
+        return -1;
     }
 
-    return send(s, data, len - 0x0A, 0);
+    return rv;
 }
 
 ssize_t finalize_upload(int s, uint32_t addr) {
@@ -166,95 +191,123 @@ ssize_t set_host_mode(int s, uint8_t v_and, uint8_t v_or) {
     return 8;
 }
 
-static uint8_t buf[0x8000];
-
-int connect_and_send(struct sockaddr_in *a, const char *fn, int ka) {
+/* Read the whole program in, so that it only has to be read (and its CRC
+   computed) once however many NAOMIs it goes to. */
+static uint8_t *read_file(const char *fn, uint32_t *size) {
     FILE *fp;
-    int s;
-    uint32_t crc = 0, size = 0, addr = 0, crc2 = 0;
+    long len;
+    uint8_t *data;
 
     if(!(fp = fopen(fn, "rb"))) {
         perror("Error opening file");
-        return -1;
+        return NULL;
     }
 
+    if(fseek(fp, 0, SEEK_END) || (len = ftell(fp)) < 0 ||
+       fseek(fp, 0, SEEK_SET)) {
+        perror("Error reading file");
+        fclose(fp);
+        return NULL;
+    }
+
+    if(!(data = (uint8_t *)malloc(len ? len : 1))) {
+        perror("malloc");
+        fclose(fp);
+        return NULL;
+    }
+
+    if(fread(data, 1, len, fp) != (size_t)len) {
+        perror("Error reading file");
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+
+    fclose(fp);
+    *size = (uint32_t)len;
+    return data;
+}
+
+int connect_and_send(struct sockaddr_in *a, const uint8_t *data, uint32_t len,
+                     uint32_t crc, int ka) {
+    int s, one = 1, sndbuf = 1024 * 1024;
+    uint32_t size = 0, addr = 0;
+    char name[INET_ADDRSTRLEN];
+
+    inet_ntop(AF_INET, &a->sin_addr, name, INET_ADDRSTRLEN);
+
     if((s = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
         perror("Create socket");
-        fclose(fp);
         return -2;
     }
 
+    /* Keep plenty of the program in flight rather than trickling it out. */
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(s, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
     if(connect(s, (struct sockaddr *)a, sizeof(struct sockaddr_in)) < 0) {
         perror("Connect socket");
         close(s);
-        fclose(fp);
         return -3;
     }
 
     if(set_host_mode(s, 0, 1) < 0) {
-        fprintf(stderr, "Error setting host mode\n");
+        fprintf(stderr, "%s: Error setting host mode\n", name);
         close(s);
-        fclose(fp);
         return -4;
     }
 
     if(set_null_key(s) < 0) {
-        fprintf(stderr, "Error setting null key\n");
+        fprintf(stderr, "%s: Error setting null key\n", name);
         close(s);
-        fclose(fp);
         return -5;
     }
 
     /* Send file */
-    while(!feof(fp)) {
-        size = fread(buf, 1, 0x8000, fp);
-        if(size != 0) {
-            printf("%08x\n", addr);
-            if(upload_data(s, addr, size, buf) < 0) {
-                fprintf(stderr, "Error uploading data\n");
-                close(s);
-                fclose(fp);
-                return -6;
-            }
-
-            crc = crc32le(crc, buf, size);
-
-            addr += size;
+    while(addr < len) {
+        size = len - addr < CHUNK_SIZE ? len - addr : CHUNK_SIZE;
+
+        printf("%s: %08x\n", name, addr);
+        if(upload_data(s, addr, size, data + addr) < 0) {
+            fprintf(stderr, "%s: Error uploading data\n", name);
+            close(s);
+            return -6;
         }
+
+        addr += size;
     }
 
-    printf("%08x\n", addr);
-    fclose(fp);
-    crc = ~crc;
+    printf("%s: %08x\n", name, addr);
 
     if(finalize_upload(s, addr) < 0) {
-        fprintf(stderr, "Error finalizing upload\n");
+        fprintf(stderr, "%s: Error finalizing upload\n", name);
         close(s);
         return -7;
     }
 
     if(send_prog_info(s, crc, addr) < 0) {
-        fprintf(stderr, "Error sending program information\n");
+        fprintf(stderr, "%s: Error sending program information\n", name);
         close(s);
         return -8;
     }
 
     if(send_restart_cmd(s) < 0) {
-        fprintf(stderr, "Error sending restart command\n");
+        fprintf(stderr, "%s: Error sending restart command\n", name);
         close(s);
         return -9;
     }
 
     if(set_time_limit(s, 10 * 60 * 1000) < 0) {
-        fprintf(stderr, "Error setting time limit\n");
+        fprintf(stderr, "%s: Error setting time limit\n", name);
         close(s);
         return -10;
     }
 
-    printf("Entering Keep Alive Loop. CTRL + C will end the program.\n");
     /* If the keep alive flag is set, send a packet to the NetDIMM every few
        seconds to keep it awake without a security PIC. */
     if(ka) {
+        printf("%s: Entering Keep Alive Loop. CTRL + C will end the program.\n",
+               name);
         sleep(20);
         for(;;) {
             set_time_limit(s, 10 * 60 * 1000);
@@ -266,19 +319,56 @@ int connect_and_send(struct sockaddr_in *a, const char *fn, int ka) {
     return 0;
 }
 
+/* Upload to each NAOMI from its own process, all at the same time. */
+int send_to_all(struct sockaddr_in *addrs, int cnt, const uint8_t *data,
+                uint32_t len, uint32_t crc, int ka) {
+    pid_t pids[MAX_TARGETS];
+    int i, status, rv = 0;
+
+    if(cnt == 1)
+        return connect_and_send(&addrs[0], data, len, crc, ka);
+
+    fflush(stdout);
+
+    for(i = 0; i < cnt; ++i) {
+        if((pids[i] = fork()) < 0) {
+            perror("fork");
+            rv = -1;
+            cnt = i;
+            break;
+        }
+        else if(!pids[i]) {
+            exit(connect_and_send(&addrs[i], data, len, crc, ka) < 0 ?
+                 EXIT_FAILURE : 0);
+        }
+    }
+
+    for(i = 0; i < cnt; ++i) {
+        if(waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) ||
+           WEXITSTATUS(status))
+            rv = -1;
+    }
+
+    return rv;
+}
+
 void usage(const char *progname) {
-    printf("Usage: %s -t ip -x prog\n\n", progname);
+    printf("Usage: %s -t ip [-t ip...] -x prog\n\n", progname);
     printf("Arguments:\n"
-           "  -t ip    - Specify the IP of the NAOMI.\n"
+           "  -t ip    - Specify the IP of the NAOMI. Give several to upload\n"
+           "             to all of them at once.\n"
            "  -x prog  - Load and execute the NAOMI rom file 'prog'.\n"
            "  -a       - Attempt to keep the NAOMI awake without a PIC.\n");
 }
 
 int main(int argc, char *argv[]) {
     int c;
-    struct sockaddr_in naomi_addr;
+    struct sockaddr_in naomi_addr[MAX_TARGETS];
+    int naomi_cnt = 0;
     char *progfn = NULL;
     int keepalive = 0;
+    uint8_t *data;
+    uint32_t len, crc;
 
     struct sigaction sa;
 
@@ -293,7 +383,7 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    memset(&naomi_addr, 0, sizeof(struct sockaddr_in));
+    memset(naomi_addr, 0, sizeof(naomi_addr));
 
     if(argc < 5) {
         usage(argv[0]);
@@ -304,15 +394,21 @@ int main(int argc, char *argv[]) {
     while((c = getopt(argc, argv, ":t:x:a")) != -1) {
         switch(c) {
             case 't':
-                if(inet_pton(AF_INET, optarg, &naomi_addr.sin_addr) != 1) {
-                    fprintf(stderr, "Invalid IP address specified.\n");
+                if(naomi_cnt == MAX_TARGETS) {
+                    fprintf(stderr, "Too many NAOMIs, at most %d.\n",
+                            MAX_TARGETS);
                     goto err;
                 }
 
-                naomi_addr.sin_family = AF_INET;
-                naomi_addr.sin_port = htons(NETDIMM_PORT);
+                if(inet_pton(AF_INET, optarg,
+                             &naomi_addr[naomi_cnt].sin_addr) != 1) {
+                    fprintf(stderr, "Invalid IP address specified.\n");
+                    goto err;
+                }
 
-                inet_ntop(AF_INET, &naomi_addr.sin_addr, buf, INET6_ADDRSTRLEN);
+                naomi_addr[naomi_cnt].sin_family = AF_INET;
+                naomi_addr[naomi_cnt].sin_port = htons(NETDIMM_PORT);
+                ++naomi_cnt;
                 break;
 
             case 'x':
@@ -342,7 +438,7 @@ int main(int argc, char *argv[]) {
     }
 
     /* Make sure we got all the requisite arguments */
-    if(!naomi_addr.sin_family) {
+    if(!naomi_cnt) {
         fprintf(stderr, "You must specify the IP address of the NAOMI.\n");
         goto err;
     }
@@ -351,7 +447,14 @@ int main(int argc, char *argv[]) {
         goto err;
     }
 
-    c = connect_and_send(&naomi_addr, progfn, keepalive);
+    if(!(data = read_file(progfn, &len)))
+        goto err;
+
+    crc32le_init();
+    crc = ~crc32le(0, data, len);
+
+    c = send_to_all(naomi_addr, naomi_cnt, data, len, crc, keepalive);
+    free(data);
     free(progfn);
     return c < 0 ? EXIT_FAILURE: 0;
 
@@ -0,0 +1,295 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "atlas.h"
+#include "mycommon.h"
+#include "stb_image.h"
+
+/*
+	Sub-images are packed with MaxRects: the free space is kept as a list of
+	possibly overlapping maximal rectangles, and each image goes in the one
+	that leaves the shortest side over (best short side fit). Images are
+	placed from largest to smallest, and page sizes are tried from smallest
+	to largest until everything fits.
+*/
+
+typedef struct {
+	unsigned x, y, w, h;
+} Rect;
+
+typedef struct {
+	Rect *rects;
+	unsigned cnt, space;
+} FreeList;
+
+typedef struct {
+	unsigned w, h;
+} PageSize;
+
+static void AddFree(FreeList *fl, unsigned x, unsigned y, unsigned w, unsigned h) {
+	if (fl->cnt == fl->space) {
+		fl->space = fl->space ? fl->space * 2 : 64;
+		fl->rects = realloc(fl->rects, fl->space * sizeof(Rect));
+		assert(fl->rects);
+	}
+	fl->rects[fl->cnt++] = (Rect){x, y, w, h};
+}
+
+static bool Contains(const Rect *outer, const Rect *inner) {
+	return inner->x >= outer->x && inner->y >= outer->y &&
+		inner->x + inner->w <= outer->x + outer->w &&
+		inner->y + inner->h <= outer->y + outer->h;
+}
+
+//Find the free rect that fits w x h best, returns false if none do
+static bool FindPosition(const FreeList *fl, unsigned w, unsigned h, unsigned *x, unsigned *y) {
+	unsigned best_short = ~0u, best_long = ~0u;
+
+	for(unsigned i = 0; i < fl->cnt; i++) {
+		const Rect *r = fl->rects + i;
+		if (r->w < w || r->h < h)
+			continue;
+
+		unsigned left_w = r->w - w, left_h = r->h - h;
+		unsigned left_short = MIN(left_w, left_h), left_long = MAX(left_w, left_h);
+		if (left_short < best_short || (left_short == best_short && left_long < best_long)) {
+			best_short = left_short;
+			best_long = left_long;
+			*x = r->x;
+			*y = r->y;
+		}
+	}
+
+	return best_short != ~0u;
+}
+
+//Take the placed rect out of the free space
+static void SplitFree(FreeList *fl, const Rect *used) {
+	unsigned cnt = fl->cnt;
+
+	for(unsigned i = 0; i < cnt; i++) {
+		Rect r = fl->rects[i];
+
+		if (used->x >= r.x + r.w || used->x + used->w <= r.x ||
+		    used->y >= r.y + r.h || used->y + used->h <= r.y)
+			continue;
+
+		//Keep what is left on each side of the placed rect
+		if (used->x > r.x)
+			AddFree(fl, r.x, r.y, used->x - r.x, r.h);
+		if (used->x + used->w < r.x + r.w)
+			AddFree(fl, used->x + used->w, r.y, r.x + r.w - used->x - used->w, r.h);
+		if (used->y > r.y)
+			AddFree(fl, r.x, r.y, r.w, used->y - r.y);
+		if (used->y + used->h < r.y + r.h)
+			AddFree(fl, r.x, used->y + used->h, r.w, r.y + r.h - used->y - used->h);
+
+		fl->rects[i].w = 0;	//Mark as gone
+	}
+
+	//Drop the split rects, and any that are contained in another
+	unsigned kept = 0;
+	for(unsigned i = 0; i < fl->cnt; i++) {
+		const Rect *r = fl->rects + i;
+		bool drop = r->w == 0;
+
+		for(unsigned j = 0; j < fl->cnt && !drop; j++) {
+			const Rect *o = fl->rects + j;
+			if (j != i && o->w && Contains(o, r) && (!Contains(r, o) || j < i))
+				drop = true;
+		}
+
+		if (!drop)
+			fl->rects[kept++] = *r;
+	}
+	fl->cnt = kept;
+}
+
+static unsigned PaddedW(const pteAtlas *atlas, unsigned i) {
+	return ROUND_UP_POW2(atlas->rects[i].w, ATLAS_ALIGN);
+}
+static unsigned PaddedH(const pteAtlas *atlas, unsigned i) {
+	return ROUND_UP_POW2(atlas->rects[i].h, ATLAS_ALIGN);
+}
+
+//Try to pack everything into a page of size w x h, setting each rect's x and y
+static bool Pack(pteAtlas *atlas, const unsigned *order, unsigned w, unsigned h) {
+	FreeList fl = {0};
+	bool fits = true;
+
+	AddFree(&fl, 0, 0, w, h);
+
+	for(unsigned i = 0; i < atlas->cnt && fits; i++) {
+		pteAtlasRect *ar = atlas->rects + order[i];
+		Rect used = {0, 0, PaddedW(atlas, order[i]), PaddedH(atlas, order[i])};
+
+		fits = FindPosition(&fl, used.w, used.h, &used.x, &used.y);
+		if (fits) {
+			ar->x = used.x;
+			ar->y = used.y;
+			SplitFree(&fl, &used);
+		}
+	}
+
+	free(fl.rects);
+	return fits;
+}
+
+static const pteAtlas *sort_atlas;
+
+//Largest first, keeping the input order between equal sizes
+static int CompareRects(const void *a, const void *b) {
+	unsigned ia = *(const unsigned *)a, ib = *(const unsigned *)b;
+	unsigned wa = PaddedW(sort_atlas, ia), ha = PaddedH(sort_atlas, ia);
+	unsigned wb = PaddedW(sort_atlas, ib), hb = PaddedH(sort_atlas, ib);
+
+	if (MAX(wa, ha) != MAX(wb, hb))
+		return MAX(wa, ha) > MAX(wb, hb) ? -1 : 1;
+	if (wa * ha != wb * hb)
+		return wa * ha > wb * hb ? -1 : 1;
+	return ia < ib ? -1 : 1;
+}
+
+//Smallest first, then squarest
+static int ComparePages(const void *a, const void *b) {
+	const PageSize *pa = a, *pb = b;
+	unsigned area_a = pa->w * pa->h, area_b = pb->w * pb->h;
+	unsigned diff_a = pa->w > pa->h ? pa->w - pa->h : pa->h - pa->w;
+	unsigned diff_b = pb->w > pb->h ? pb->w - pb->h : pb->h - pb->w;
+
+	if (area_a != area_b)
+		return area_a < area_b ? -1 : 1;
+	if (diff_a != diff_b)
+		return diff_a < diff_b ? -1 : 1;
+	return pa->w < pb->w ? -1 : (pa->w > pb->w);
+}
+
+void pteLoadAtlas(PvrTexEncoder *pte, pteAtlas *atlas, const char **fnames, unsigned filecnt, bool square) {
+	assert(pte);
+	assert(atlas);
+	assert(filecnt > 0);
+
+	pteImage *imgs = calloc(filecnt, sizeof(pteImage));
+	unsigned *order = malloc(filecnt * sizeof(unsigned));
+	assert(imgs && order);
+
+	atlas->cnt = filecnt;
+	atlas->rects = calloc(filecnt, sizeof(pteAtlasRect));
+	assert(atlas->rects);
+
+	unsigned long long area = 0;
+	unsigned maxw = 0, maxh = 0;
+	for(unsigned i = 0; i < filecnt; i++) {
+		pteImage *img = imgs + i;
+		img->channels = 4;
+		img->pixels = (void*)stbi_load(fnames[i], &img->w, &img->h, &img->channels, 4);
+		ErrorExitOn(img->pixels == NULL,
+			"Could not load image \"%s\", exiting\n", fnames[i]);
+
+		atlas->rects[i] = (pteAtlasRect){fnames[i], 0, 0, img->w, img->h};
+		order[i] = i;
+
+		area += (unsigned long long)PaddedW(atlas, i) * PaddedH(atlas, i);
+		maxw = MAX(maxw, PaddedW(atlas, i));
+		maxh = MAX(maxh, PaddedH(atlas, i));
+	}
+
+	sort_atlas = atlas;
+	qsort(order, filecnt, sizeof(unsigned), CompareRects);
+
+	//List every valid page size that is large enough to possibly fit
+	PageSize pages[34 * 8];
+	unsigned page_cnt = 0;
+	for(unsigned w = 8; w <= 1024; w += pteIsStrided(pte) && w >= 32 ? 32 : w) {
+		for(unsigned h = 8; h <= 1024; h <<= 1) {
+			if (w < maxw || h < maxh || (unsigned long long)w * h < area)
+				continue;
+			if (square && w != h)
+				continue;
+			if (pteIsStrided(pte) && !IsValidStrideWidth(w))
+				continue;
+			pages[page_cnt++] = (PageSize){w, h};
+		}
+	}
+	qsort(pages, page_cnt, sizeof(PageSize), ComparePages);
+
+	unsigned p;
+	for(p = 0; p < page_cnt; p++) {
+		if (Pack(atlas, order, pages[p].w, pages[p].h))
+			break;
+	}
+	ErrorExitOn(p == page_cnt, "%u images do not fit in a single %satlas page of up to 1024x1024\n",
+		filecnt, square ? "square " : "");
+
+	atlas->w = pages[p].w;
+	atlas->h = pages[p].h;
+	pteLog(LOG_INFO, "Packed %u images into a %ux%u atlas (%.1f%% used)\n", filecnt,
+		atlas->w, atlas->h, 100.0 * area / (atlas->w * atlas->h));
+
+	//Copy each image in, extending its edges over the alignment padding so
+	//filtering doesn't pull in its neighbors
+	pteImage *page = pte->src_imgs;
+	page->w = atlas->w;
+	page->h = atlas->h;
+	page->channels = 4;
+	SMART_ALLOC(&page->pixels, pteImgSize(page));
+	assert(page->pixels);
+
+	for(unsigned i = 0; i < filecnt; i++) {
+		const pteAtlasRect *ar = atlas->rects + i;
+		const pteImage *img = imgs + i;
+		unsigned pw = PaddedW(atlas, i), ph = PaddedH(atlas, i);
+
+		for(unsigned y = 0; y < ph; y++) {
+			const pxlABGR8888 *src = img->pixels + MIN(y, img->h - 1) * img->w;
+			pxlABGR8888 *dst = page->pixels + (ar->y + y) * page->w + ar->x;
+			for(unsigned x = 0; x < pw; x++)
+				dst[x] = src[MIN(x, img->w - 1)];
+		}
+
+		stbi_image_free(img->pixels);
+	}
+
+	pte->src_img_cnt = 1;
+	pte->w = atlas->w;
+	pte->h = atlas->h;
+
+	free(order);
+	free(imgs);
+}
+
+void pteWriteAtlasUV(const PvrTexEncoder *pte, const pteAtlas *atlas, const char *fname) {
+	assert(pte);
+	assert(atlas);
+	assert(fname);
+
+	FILE *f = fopen(fname, "w");
+	ErrorExitOn(f == NULL, "Could not open \"%s\" to write atlas UVs\n", fname);
+
+	//The texture might have been resized after packing (to make it square, for example)
+	double sx = (double)pte->w / atlas->w, sy = (double)pte->h / atlas->h;
+
+	fprintf(f, "# pvrtex atlas, %ux%u\n", pte->w, pte->h);
+	fprintf(f, "# x y w h u0 v0 u1 v1 name\n");
+	for(unsigned i = 0; i < atlas->cnt; i++) {
+		const pteAtlasRect *ar = atlas->rects + i;
+		unsigned x = ar->x * sx, w = ar->w * sx;
+		unsigned y = ar->y * sy, h = ar->h * sy;
+
+		if (pte->flip_v)
+			y = pte->h - y - h;
+
+		fprintf(f, "%u %u %u %u %f %f %f %f %s\n", x, y, w, h,
+			(double)x / pte->w, (double)y / pte->h,
+			(double)(x + w) / pte->w, (double)(y + h) / pte->h, ar->name);
+	}
+
+	fclose(f);
+}
+
+void pteFreeAtlas(pteAtlas *atlas) {
+	assert(atlas);
+	SAFE_FREE(&atlas->rects);
+	atlas->cnt = 0;
+}
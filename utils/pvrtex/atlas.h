@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include "pvr_texture_encoder.h"
+
+//Sub-images are placed on this grid, so no 4x4 VQ vector or twiddled block
+//ever covers more than one of them
+#define ATLAS_ALIGN	4
+
+typedef struct {
+	const char *name;	//file name the sub-image was loaded from
+	unsigned x, y, w, h;	//position and size in the packed page, in pixels
+} pteAtlasRect;
+
+typedef struct {
+	unsigned w, h;		//size of the packed page
+	unsigned cnt;
+	pteAtlasRect *rects;	//one per input file, in the order given
+} pteAtlas;
+
+//Loads every file as a sub-image, packs them into the smallest page that
+//fits, and sets that page as the only source image of pte. If square is
+//true, only square pages are considered.
+void pteLoadAtlas(PvrTexEncoder *pte, pteAtlas *atlas, const char **fnames, unsigned filecnt, bool square);
+
+//Writes the UV table for the encoded texture. Rects are scaled if pte was
+//resized after packing.
+void pteWriteAtlasUV(const PvrTexEncoder *pte, const pteAtlas *atlas, const char *fname);
+
+void pteFreeAtlas(pteAtlas *atlas);
@@ -24,6 +24,7 @@
  */
 
 #include <string.h>
+#include <pthread.h>
 
 #include "libavutil/avassert.h"
 #include "libavutil/common.h"
@@ -32,6 +33,8 @@
 
 #define DELTA_ERR_MAX 0.1  ///< Precision of the ELBG algorithm (as percentage error)
 
+#define MAX_THREADS 64     ///< Most threads the Voronoi partition is split over
+
 /**
  * In the ELBG jargon, a cell is the set of points that are closest to a
  * codebook entry. Not to be confused with a RoQ Video cell. */
@@ -52,12 +55,14 @@ typedef struct ELBGContext {
     int *utility;
     int *utility_inc;
     int *nearest_cb;
+    int *nearest_dist;
     int *points;
     int *temp_points;
     int *size_part;
     AVLFG *rand_state;
     int *scratchbuf;
     cell *cell_buffer;
+    int threads;
 
     /* Sizes for the buffers above. Pointers without such a field
      * are not allocated by us and only valid for the duration
@@ -69,15 +74,19 @@ typedef struct ELBGContext {
     unsigned scratchbuf_allocated;
     unsigned cell_buffer_allocated;
     unsigned temp_points_allocated;
+    unsigned nearest_dist_allocated;
 } ELBGContext;
 
-static inline int distance_limited(int *a, int *b, int dim, int limit)
+static inline int distance_limited(const int *av_restrict a, const int *av_restrict b,
+                                   int dim, int limit)
 {
     //Changing the conditional allows for auto-vectorization, and does not seem to
     //have any affect on final result
+    //Components are 8 bit values, so the squares fit in an int, which keeps the
+    //vectorized loop in 32 bit lanes
     int i, dist=0;
     for (i=0; i<dim; i++) {
-        int64_t distance = a[i] - b[i];
+        int distance = a[i] - b[i];
 
         distance *= distance;
 //      if (dist >= limit - distance)
@@ -364,6 +373,77 @@ static void do_shiftings(ELBGContext *elbg)
         }
 }
 
+typedef struct nearest_job {
+    ELBGContext *elbg;
+    int start, end;
+} nearest_job;
+
+/**
+ * Find the first codebook entry at the smallest distance from each point in
+ * [start, end), storing it in nearest_cb and the distance in nearest_dist.
+ */
+static void *nearest_range(void *arg)
+{
+    const nearest_job *job = arg;
+    ELBGContext *elbg = job->elbg;
+    const int dim = elbg->dim;
+
+    for (int i = job->start; i < job->end; i++) {
+        const int *point = elbg->points + i * dim;
+        int best_idx = 0;
+        int best_dist = distance_limited(point, elbg->codebook, dim, INT_MAX);
+
+        for (int k = 1; k < elbg->num_cb; k++) {
+            int dist = distance_limited(point, elbg->codebook + k * dim,
+                                        dim, best_dist);
+            if (dist < best_dist) {
+                best_dist = dist;
+                best_idx = k;
+            }
+        }
+        elbg->nearest_cb[i]   = best_idx;
+        elbg->nearest_dist[i] = best_dist;
+    }
+
+    return NULL;
+}
+
+/**
+ * Run nearest_range() over all the points, split between elbg->threads
+ * threads. Each point is looked at on its own, so how the points are split
+ * has no effect on the result.
+ */
+static void find_nearest(ELBGContext *elbg, int numpoints)
+{
+    nearest_job jobs[MAX_THREADS];
+    pthread_t thds[MAX_THREADS];
+    int started;
+    int cnt = FFMIN(elbg->threads, numpoints / 1024);
+
+    if (cnt <= 1) {
+        jobs[0] = (nearest_job){ elbg, 0, numpoints };
+        nearest_range(&jobs[0]);
+        return;
+    }
+
+    for (int t = 0; t < cnt; t++) {
+        jobs[t] = (nearest_job){ elbg, (int64_t)numpoints * t / cnt,
+                                 (int64_t)numpoints * (t + 1) / cnt };
+    }
+
+    /* The last range is done here, as is any range a thread could not be
+       started for. */
+    for (started = 0; started < cnt - 1; started++) {
+        if (pthread_create(&thds[started], NULL, nearest_range, &jobs[started]))
+            break;
+    }
+    for (int t = started; t < cnt; t++)
+        nearest_range(&jobs[t]);
+
+    for (int t = 0; t < started; t++)
+        pthread_join(thds[t], NULL);
+}
+
 static void do_elbg(ELBGContext *av_restrict elbg, int *points, int numpoints,
                     int max_steps)
 {
@@ -386,20 +466,19 @@ static void do_elbg(ELBGContext *av_restrict elbg, int *points, int numpoints,
 
         /* This loop evaluate the actual Voronoi partition. It is the most
            costly part of the algorithm. */
+        find_nearest(elbg, numpoints);
+
         for (i=0; i < numpoints; i++) {
-            int best_dist = distance_limited(elbg->points   + i * elbg->dim,
-                                             elbg->codebook + best_idx * elbg->dim,
-                                             elbg->dim, INT_MAX);
-            for (int k = 0; k < elbg->num_cb; k++) {
-                int dist = distance_limited(elbg->points   + i * elbg->dim,
-                                            elbg->codebook + k * elbg->dim,
-                                            elbg->dim, best_dist);
-                if (dist < best_dist) {
-                    best_dist = dist;
-                    best_idx = k;
-                }
+            int best_dist = elbg->nearest_dist[i];
+
+            /* A tie goes to the entry the previous point picked */
+            if (elbg->nearest_cb[i] != best_idx &&
+                distance_limited(elbg->points   + i * elbg->dim,
+                                 elbg->codebook + best_idx * elbg->dim,
+                                 elbg->dim, INT_MAX) == best_dist) {
+                elbg->nearest_cb[i] = best_idx;
             }
-            elbg->nearest_cb[i] = best_idx;
+            best_idx = elbg->nearest_cb[i];
             elbg->error = (elbg->error >= INT_MAX - best_dist) ? INT_MAX : elbg->error + best_dist;
             elbg->utility[elbg->nearest_cb[i]] = (elbg->utility[elbg->nearest_cb[i]] >= INT_MAX - best_dist) ?
                                                   INT_MAX : elbg->utility[elbg->nearest_cb[i]] + best_dist;
@@ -477,6 +556,7 @@ int avpriv_elbg_do(ELBGContext **elbgp, int *points, int dim, int numpoints,
     elbg->codebook   = codebook;
     elbg->num_cb     = num_cb;
     elbg->dim        = dim;
+    elbg->threads    = av_clip(ELBG_THREADS(flags), 1, MAX_THREADS);
 
 #define ALLOCATE_IF_NECESSARY(field, new_elements, multiplicator)            \
     if (elbg->field ## _allocated < new_elements) {                          \
@@ -498,6 +578,7 @@ int avpriv_elbg_do(ELBGContext **elbgp, int *points, int dim, int numpoints,
     ALLOCATE_IF_NECESSARY(utility_inc, num_cb,    1)
     ALLOCATE_IF_NECESSARY(size_part,   num_cb,    1)
     ALLOCATE_IF_NECESSARY(cell_buffer, numpoints, 1)
+    ALLOCATE_IF_NECESSARY(nearest_dist, numpoints, 1)
     ALLOCATE_IF_NECESSARY(scratchbuf,  dim,       5)
     if (numpoints > 24LL * elbg->num_cb) {
         /* The first step in the recursion in init_elbg() needs a buffer with
@@ -524,6 +605,7 @@ av_cold void avpriv_elbg_free(ELBGContext **elbgp)
     av_freep(&elbg->size_part);
     av_freep(&elbg->utility);
     av_freep(&elbg->cell_buffer);
+    av_freep(&elbg->nearest_dist);
     av_freep(&elbg->cells);
     av_freep(&elbg->utility_inc);
     av_freep(&elbg->scratchbuf);
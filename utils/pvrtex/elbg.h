@@ -28,6 +28,14 @@
 
 struct ELBGContext;
 
+/**
+ * Flags for avpriv_elbg_do(): the number of threads to search for the nearest
+ * codebook entries with. 0 or 1 does it all in the calling thread. The
+ * codebook comes out the same whatever the count is.
+ */
+#define ELBG_FLAG_THREADS(n) ((uintptr_t)(n) & 0xff)
+#define ELBG_THREADS(flags)  ((int)((flags) & 0xff))
+
 /**
  * Implementation of the Enhanced LBG Algorithm
  * Based on the paper "Neural Networks 14:1219-1237" that can be found in
@@ -44,7 +52,7 @@ struct ELBGContext;
  * @param num_steps The maximum number of steps. One step is already a good compromise between time and quality.
  * @param closest_cb Return the closest codebook to each point. Must be allocated.
  * @param rand_state A random number generator state. Should be already initialized by av_lfg_init().
- * @param flags Currently unused; must be set to 0.
+ * @param flags ELBG_FLAG_THREADS(), or 0.
  * @return < 0 in case of error, 0 otherwise
  */
 int avpriv_elbg_do(struct ELBGContext **ctx, int *points, int dim,
@@ -14,6 +14,7 @@
 #include "mycommon.h"
 #include "file_pvr.h"
 #include "file_tex.h"
+#include "atlas.h"
 
 extern int LoadPalette(const char *fname, PvrTexEncoder *pte);
 
@@ -203,15 +204,20 @@ int main(int argc, char **argv) {
 		{"normal-style", 1, OPTPARSE_REQUIRED},
 		{"flip-v", 2, OPTPARSE_NONE},
 		{"flip-y", 2, OPTPARSE_NONE},
+		{"threads", 'j', OPTPARSE_REQUIRED},
+		{"atlas", 'A', OPTPARSE_REQUIRED},
 		{0}
 	};
 
-	#define MAX_FNAMES	11
+	#define MAX_MIP_FNAMES	11
+	#define MAX_FNAMES	256
 	const char *fnames[MAX_FNAMES];
 	unsigned fname_cnt = 0;
 	const char *outname = "";
 	const char *prevname = "";
 	const char *palfile = NULL;
+	const char *atlasname = NULL;
+	pteAtlas atlas = {0};
 
 	//Parse command line parameters
 	struct optparse options;
@@ -343,6 +349,14 @@ int main(int argc, char **argv) {
 		case 'P':
 			palfile = options.optarg;
 			break;
+		case 'A':
+			atlasname = options.optarg;
+			break;
+		case 'j':
+			if ((sscanf(options.optarg, "%u", &pte.threads) != 1) || (pte.threads < 1) || (pte.threads > 64))  {
+				ErrorExit("invalid thread count (should be [1, 64])\n");
+			}
+			break;
 		case 1:
 			pte.normal_style = GetOptMap(normal_style_options, ARR_SIZE(normal_style_options), options.optarg, -0, "invalid normal style method\n");
 			break;
@@ -376,9 +390,17 @@ int main(int argc, char **argv) {
 
 	ErrorExitOn(!have_output && !have_preview, "No output or preview file name specified, nothing to do\n");
 	ErrorExitOn(fname_cnt == 0, "No input files specified\n");
+	ErrorExitOn(!atlasname && fname_cnt >= MAX_MIP_FNAMES, "Too many input files have been specified\n");
 
 	pteLog(LOG_PROGRESS, "Reading input...\n");
-	pteLoadFromFiles(&pte, fnames, fname_cnt);
+	if (atlasname) {
+		//Mipmaps and compressed .PVR files need square textures, so pack
+		//into a square page instead of having it stretched later
+		bool square = pteHasMips(&pte) || (output_file_type == EXT_PVR && pteIsCompressed(&pte));
+		pteLoadAtlas(&pte, &atlas, fnames, fname_cnt, square);
+	} else {
+		pteLoadFromFiles(&pte, fnames, fname_cnt);
+	}
 
 	//Check and fix up image size
 	pteSetSize(&pte);
@@ -506,6 +528,12 @@ int main(int argc, char **argv) {
 		pteLog(LOG_COMPLETION, "No output file specified\n");
 	}
 
+	if (atlasname) {
+		pteLog(LOG_COMPLETION, "Writing atlas UVs to \"%s\"...\n", atlasname);
+		pteWriteAtlasUV(&pte, &atlas, atlasname);
+		pteFreeAtlas(&atlas);
+	}
+
 	pteFree(&pte);
 
 	return 0;
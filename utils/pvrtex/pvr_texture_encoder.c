@@ -52,6 +52,7 @@ void pteInit(PvrTexEncoder *pte) {
 	pte->auto_small_vq = false;
 	pte->edge_method = 0;
 	pte->mip_shift_correction = true;
+	pte->threads = 1;
 }
 
 void pteFree(PvrTexEncoder *pte) {
@@ -370,6 +371,7 @@ void pteGeneratePalette(PvrTexEncoder *pte) {
 	VQCompressor vqc;
 	vqcInit(&vqc, VQC_UINT8, 4, 1, pte->palette_size);
 	vqcSetRGBAGamma(&vqc, pte->rgb_gamma, pte->alpha_gamma);
+	vqcSetThreads(&vqc, pte->threads);
 
 	//Add mipmaps to compressor input
 	FOR_EACH_MIP(pte, i) {
@@ -486,6 +488,7 @@ void pteCompress(PvrTexEncoder *pte) {
 	VQCompressor vqc;
 	vqcInit(&vqc, VQC_UINT8, 4, vectorarea, cbsize);
 	vqcSetRGBAGamma(&vqc, pte->rgb_gamma, pte->alpha_gamma);
+	vqcSetThreads(&vqc, pte->threads);
 
 	//Add uncompressed data
 	const unsigned perfect_mip_pixels = perfect_mip_idx * vectorarea;
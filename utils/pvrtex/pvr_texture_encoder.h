@@ -102,6 +102,10 @@ typedef struct PvrTexEncoder {
 	//Generate small codebook size based on texture dimensions
 	bool auto_small_vq;
 
+	//Number of threads to use for VQ compression and palette generation
+	//Output is the same no matter how many are used
+	unsigned threads;
+
 	//Flip the image upside-down before converting
 	//Basically, this puts UV coord (0,0) at the bottom left, instead of
 	//the top left.
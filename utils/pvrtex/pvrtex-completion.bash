@@ -9,8 +9,8 @@ _pvrtex_completions()
 	_init_completion || return
 	
 	case $prev in
-		--help|--version|--no-mip-shift|--max-color|--perfect-mip|--high-weight|--dither|--stride|--bilinear|--nearest|\
-		-!(-*)[hvCSMHdsbn])
+		--help|--version|--no-mip-shift|--max-color|--perfect-mip|--high-weight|--dither|--stride|--bilinear|--nearest|--threads|\
+		-!(-*)[hvCSMHdsbnj])
 			return
 			;;
 		-i|--in)
@@ -21,6 +21,10 @@ _pvrtex_completions()
 			_filedir "@(pal|png|jpg|bmp|tga|gif|psd|hdr|pic|pmn)"
 			return
 			;;
+		-A|--atlas)
+			_filedir "txt"
+			return
+			;;
 		-o|--out)
 			_filedir "@(dt|tex|pvr)"
 			return
@@ -56,7 +60,7 @@ _pvrtex_completions()
 		*)
 			
 			#This is the suggestion if not suggesting for one of the above. It suggests supported options.
-			COMPREPLY=($(compgen -W "--in --out --preview --format --compress --mipmap --perfect-mip --max-color --no-mip-shift --high-weight --high-weight --dither --stride --resize --mip-resize --edge --bilinear --nearest --normal-style --flip-v" -- "$cur"))
+			COMPREPLY=($(compgen -W "--in --out --preview --format --compress --mipmap --perfect-mip --max-color --no-mip-shift --high-weight --high-weight --dither --stride --resize --mip-resize --edge --bilinear --nearest --normal-style --flip-v --threads --atlas" -- "$cur"))
 			return
 			;;
 		
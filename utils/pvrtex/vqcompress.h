@@ -20,6 +20,8 @@ typedef struct {
 
 	size_t data_space;
 	int *data;	//data to compress
+
+	unsigned threads;	//number of threads to compress with, results are the same for any number
 } VQCompressor;
 
 typedef struct {
@@ -33,6 +35,7 @@ void vqcAddPoints(VQCompressor *c, const void *src, size_t pixel_cnt);
 void vqcSetChannelGamma(VQCompressor *c, unsigned channel, float val);
 void vqcSetRGBAGamma(VQCompressor *c, float rgb, float alpha);
 void vqcSetARGBGamma(VQCompressor *c, float rgb, float alpha);
+void vqcSetThreads(VQCompressor *c, unsigned threads);
 vqcResults vqcCompress(VQCompressor *c, int quality);
 
 
@@ -7,6 +7,8 @@
    must be squared. Twiddled and mipmapped toggles are supported. I feel
    dizzy, I think I over-twiddled.
 
+   With -p, all of the images go in one KMG pack instead of a file each.
+
    This code is based on the work of Jonas Norberg, you can find more info at
    http://www.acc.umu.se/~bedev/software/vq/
 */
@@ -25,6 +27,7 @@
 
 /* For outputting KMG files */
 #include "kmg.h"
+#include "kmgpack.h"
 
 static int use_mipmap = 0;
 static int use_twiddle = 0;
@@ -33,6 +36,9 @@ static int use_debug = 0;
 static int use_hq = 0;
 static int use_kmg = 0;
 static int use_alpha = 0;
+static int use_pack = 0;
+
+static kmg_pack_t kmgpack;
 
 #define PACK1555(a, r, g, b) ( (a ? 0x8000 : 0) | ((r>>3)<<10) | ((g>>3)<<5) | ((b >>3)))
 #define PACK4444(a, r, g, b) ( ((a>>4) << 12) | ((r>>4)<<8) | ((g>>4)<<4) | ((b>>4)) )
@@ -393,17 +399,19 @@ static int save_codebook(FILE *out, context_t *cb) {
 static int save(const char *filename, context_t *cb, mipmap_t *m, image_t *img) {
     int ok, res;
     FILE    *fp;
+    kmg_header_t    hdr;
 
-    fp = fopen(filename, "wb");
+    if(use_pack)
+        fp = kmg_pack_begin(&kmgpack, filename);
+    else
+        fp = fopen(filename, "wb");
 
     if(fp == NULL) {
         fprintf(stderr, "FATAL: cannot create %s\n", filename);
-        return -errno;
+        return use_pack ? -1 : -errno;
     }
 
     if(use_kmg) {
-        kmg_header_t    hdr;
-
         memset(&hdr, 0, sizeof(hdr));
         hdr.magic = KMG_MAGIC;
         hdr.version = KMG_VERSION;
@@ -432,7 +440,8 @@ static int save(const char *filename, context_t *cb, mipmap_t *m, image_t *img)
             }
         }
 
-        if(fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
+        /* A pack keeps the headers in its table of contents */
+        if(!use_pack && fwrite(&hdr, sizeof(hdr), 1, fp) != 1) {
             fprintf(stderr, "FATAL: can't write KMG header to %s\n", filename);
             goto loser;
         }
@@ -468,10 +477,16 @@ static int save(const char *filename, context_t *cb, mipmap_t *m, image_t *img)
         }
     }
 
+    if(use_pack)
+        return kmg_pack_end(&kmgpack, &hdr);
+
     fclose(fp);
     return 0;
 
 loser:
+    if(use_pack)
+        return -1;
+
     fclose(fp);
     unlink(filename);
     return -1;
@@ -490,6 +505,7 @@ static void banner(const char *progname) {
     printf("\t-k, --kmg\twrite a KMG for output\n");
     printf("\t-a, --alpha\tuse alpha channel (and output ARGB4444)\n");
     printf("\t-b, --amask\tuse 1-bit alpha mask (and output ARGB1555)\n");
+    printf("\t-p, --pack FILE\twrite all images to a KMG pack (implies -k)\n");
 }
 
 static int mipmap_index(int s) {
@@ -853,11 +869,23 @@ static int process_option(char *arg) {
 }
 
 static int process(int argc, char *argv[]) {
-    int arg;
+    const char *packname = NULL;
+    int arg, rv;
 
     arg = 1;
 
     while(arg < argc) {
+        if(!strcmp(argv[arg], "-p") || !strcmp(argv[arg], "--pack")) {
+            if(arg + 1 >= argc) {
+                fprintf(stderr, "%s needs a file name\n", argv[arg]);
+                return -EINVAL;
+            }
+
+            packname = argv[arg + 1];
+            arg += 2;
+            continue;
+        }
+
         if(argv[arg][0] == '-') {
             if(process_option(argv[arg]) < 0) {
                 fprintf(stderr, "invalid option %s\n", argv[arg]);
@@ -877,12 +905,23 @@ static int process(int argc, char *argv[]) {
         return -EINVAL;
     }
 
+    if(packname) {
+        if((rv = kmg_pack_open(&kmgpack, packname, argc - arg)) < 0)
+            return rv;
+
+        use_pack = 1;
+        use_kmg = 1;
+    }
+
     while(arg < argc) {
         /* ordinary image */
         encode(argv[arg]);
         arg++;
     }
 
+    if(use_pack)
+        return kmg_pack_close(&kmgpack);
+
     return 0;
 }
 
@@ -22,6 +22,10 @@
 
     Public domain code source:
     https://github.com/superctr/adpcm/blob/master/ymz_codec.c
+
+    The trellis encoder (-q) is a beam search over the decoder's state, as
+    done by FFmpeg's ADPCM encoders, against the same decoder model that
+    adpcm2pcm() uses.
 */
 
 #include <stdio.h>
@@ -29,6 +33,10 @@
 #include <stdint.h>
 #include <string.h>
 #include <math.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 /* WAV Header */
 typedef struct wavhdr {
@@ -51,9 +59,37 @@ typedef struct wavhdr_chunk {
     uint32_t datasize;
 } wavhdr_chunk_t;
 
+/* Sampler chunk, holding loop points */
+typedef struct wavhdr_smpl {
+    char hdr[4];
+    uint32_t size;
+    uint32_t manufacturer;
+    uint32_t product;
+    uint32_t sample_period;
+    uint32_t midi_unity_note;
+    uint32_t midi_pitch_fraction;
+    uint32_t smpte_format;
+    uint32_t smpte_offset;
+    uint32_t num_loops;
+    uint32_t sampler_data;
+
+    /* First loop */
+    uint32_t cue_point_id;
+    uint32_t type;
+    uint32_t start;
+    uint32_t end;               /* Last sample played, inclusive */
+    uint32_t fraction;
+    uint32_t play_count;
+} wavhdr_smpl_t;
+
 /* Holds flags */
 static int interleaved = 0;
 static int no_header = 0;
+static int trellis = 0;         /* log2 of the paths kept, 0 for greedy */
+static long loop_start = -1;    /* From -l, overriding the input's */
+static long loop_end = -1;
+static FILE *manifest = NULL;
+static pthread_mutex_t manifest_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* Output Formats */
 #define WAVE_FMT_PCM                   0x01 /* PCM */
@@ -128,6 +164,147 @@ void pcm2adpcm(uint8_t *outbuffer, int16_t *buffer, size_t bytes) {
     }
 }
 
+/* Samples the trellis works on before settling on the best path so far */
+#define TRELLIS_BLOCK 4096
+
+typedef struct trellis_node {
+    uint64_t ssd;
+    int16_t history;
+    int16_t step_size;
+} trellis_node_t;
+
+/* Add a path to the next frontier, if it's among the best seen so far */
+static void trellis_add(trellis_node_t *nodes, uint16_t *from, uint8_t *codes,
+                        int *cnt, int max, const trellis_node_t *n,
+                        int parent, uint8_t code) {
+    int i, worst = 0;
+
+    for(i = 0; i < *cnt; i++) {
+        /* Paths that have met up will stay together, keep the better one */
+        if(nodes[i].history == n->history && nodes[i].step_size == n->step_size) {
+            if(n->ssd >= nodes[i].ssd)
+                return;
+
+            worst = i;
+            goto store;
+        }
+
+        if(nodes[i].ssd > nodes[worst].ssd)
+            worst = i;
+    }
+
+    if(*cnt < max)
+        worst = (*cnt)++;
+    else if(n->ssd >= nodes[worst].ssd)
+        return;
+
+store:
+    nodes[worst] = *n;
+    from[worst] = parent;
+    codes[worst] = code;
+}
+
+void pcm2adpcm_trellis(uint8_t *outbuffer, int16_t *buffer, size_t bytes) {
+    const int max = 1 << trellis;
+    size_t num_samples = bytes / 2;
+    trellis_node_t *cur, *next, *tmp, n;
+    uint16_t *from;
+    uint8_t *codes, *block;
+    size_t i, base = 0;
+    int cnt = 1, next_cnt, j, k, t, best;
+
+    cur = malloc(max * sizeof(*cur));
+    next = malloc(max * sizeof(*next));
+    from = malloc(TRELLIS_BLOCK * max * sizeof(*from));
+    codes = malloc(TRELLIS_BLOCK * max);
+    block = malloc(TRELLIS_BLOCK);
+
+    if(!cur || !next || !from || !codes || !block) {
+        fprintf(stderr, "pcm2adpcm_trellis: Memory allocation failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    cur[0].ssd = 0;
+    cur[0].history = 0;
+    cur[0].step_size = 127;
+
+    memset(outbuffer, 0, (num_samples + 1) / 2);
+
+    for(i = 0; i < num_samples; i++) {
+        int target = buffer[i];
+        t = i - base;
+        next_cnt = 0;
+
+        for(j = 0; j < cnt; j++) {
+            /* Start from the greedy choice, and try its neighbors */
+            int history = cur[j].history * 254 / 256;
+            int diff = target - history;
+            int mag = (abs(diff) << 16) / (cur[j].step_size << 14);
+            uint8_t sign = diff < 0 ? 8 : 0;
+
+            mag = CLAMP(mag, 0, 7);
+
+            for(k = mag - 1; k <= mag + 1; k++) {
+                int err;
+
+                if(k < 0 || k > 7)
+                    continue;
+
+                n.history = history;
+                n.step_size = cur[j].step_size;
+                err = ymz_step(sign | k, &n.history, &n.step_size) - target;
+                n.ssd = cur[j].ssd + (uint64_t)((int64_t)err * err);
+                trellis_add(next, from + t * max, codes + t * max, &next_cnt,
+                            max, &n, j, sign | k);
+            }
+        }
+
+        tmp = cur;
+        cur = next;
+        next = tmp;
+        cnt = next_cnt;
+
+        /* At the end of a block, keep the best path and start over from it */
+        if(t == TRELLIS_BLOCK - 1 || i == num_samples - 1) {
+            for(best = 0, j = 1; j < cnt; j++) {
+                if(cur[j].ssd < cur[best].ssd)
+                    best = j;
+            }
+
+            for(j = best; t >= 0; t--) {
+                block[t] = codes[t * max + j];
+                j = from[t * max + j];
+            }
+
+            for(t = 0; t <= (int)(i - base); t++) {
+                /* The low nibble is played first */
+                if((base + t) & 1)
+                    outbuffer[(base + t) / 2] |= block[t] << 4;
+                else
+                    outbuffer[(base + t) / 2] |= block[t];
+            }
+
+            cur[0] = cur[best];
+            cur[0].ssd = 0;
+            cnt = 1;
+            base = i + 1;
+        }
+    }
+
+    free(cur);
+    free(next);
+    free(from);
+    free(codes);
+    free(block);
+}
+
+static void encode(uint8_t *outbuffer, int16_t *buffer, size_t bytes) {
+    if(trellis)
+        pcm2adpcm_trellis(outbuffer, buffer, bytes);
+    else
+        pcm2adpcm(outbuffer, buffer, bytes);
+}
+
 void deinterleave(void *buffer, size_t bytes) {
     uint16_t *buf;
     uint16_t *left, *right;
@@ -287,6 +464,30 @@ int validate_wav_header(wavhdr_t *wavhdr, wavhdr_chunk_t *wavhdr3, int format_ma
     return result;
 }
 
+/* Look through the chunks after the data for the first loop of a sampler
+   chunk. Returns 0 if there is one. */
+int read_loop(FILE *in, uint32_t *start, uint32_t *end) {
+    wavhdr_smpl_t smpl;
+    wavhdr_chunk_t chunk;
+
+    while(fread(&chunk, sizeof(chunk), 1, in) == 1) {
+        if(!memcmp(chunk.hdr3, "smpl", 4) &&
+           chunk.datasize >= sizeof(smpl) - sizeof(chunk) &&
+           fread(&smpl.manufacturer, sizeof(smpl) - sizeof(chunk), 1, in) == 1 &&
+           smpl.num_loops > 0) {
+            *start = smpl.start;
+            *end = smpl.end + 1;
+            return 0;
+        }
+
+        /* Chunks are padded to an even size */
+        if(fseek(in, (chunk.datasize + 1) & ~1, SEEK_CUR))
+            break;
+    }
+
+    return -1;
+}
+
 /* Do a straight copy of the input to output file */
 int straight_copy(FILE *in, const char *outfile) {
     FILE *out = NULL;
@@ -336,10 +537,13 @@ cleanup:
 int wav2adpcm(const char *infile, const char *outfile) {
     wavhdr_t wavhdr;
     wavhdr_chunk_t wavhdr_chunk;
+    wavhdr_smpl_t smpl;
     FILE *in, *out = NULL;
     size_t pcmsize, adpcmsize;
     int16_t *pcmbuf = NULL;
     uint8_t *adpcmbuf = NULL;
+    uint32_t start = 0, end = 0;
+    int have_loop = 0;
     int result = 0;
 
     in = fopen(infile, "rb");
@@ -387,17 +591,31 @@ int wav2adpcm(const char *infile, const char *outfile) {
         result = -1;
         goto cleanup;
     }
+
+    if(pcmsize & 1)
+        fseek(in, 1, SEEK_CUR);
+
+    /* Loop points are in samples, which stay the same */
+    if(loop_start >= 0) {
+        start = loop_start;
+        end = loop_end;
+        have_loop = 1;
+    }
+    else {
+        have_loop = !read_loop(in, &start, &end);
+    }
+
     fclose(in);
     in = NULL;
 
     if(wavhdr.channels == 1)
-        pcm2adpcm(adpcmbuf, pcmbuf, pcmsize);
+        encode(adpcmbuf, pcmbuf, pcmsize);
     else {
         /* For stereo we just deinterleave the input and store the
            left and right channel of the ADPCM data separately. */
         deinterleave(pcmbuf, pcmsize);
-        pcm2adpcm(adpcmbuf, pcmbuf, pcmsize / 2);
-        pcm2adpcm(adpcmbuf + adpcmsize / 2, pcmbuf + pcmsize / 4,  pcmsize / 2);
+        encode(adpcmbuf, pcmbuf, pcmsize / 2);
+        encode(adpcmbuf + adpcmsize / 2, pcmbuf + pcmsize / 4,  pcmsize / 2);
 
         if(interleaved)
             interleave_adpcm(adpcmbuf, adpcmsize);
@@ -426,6 +644,9 @@ int wav2adpcm(const char *infile, const char *outfile) {
         wavhdr.block_align = (wavhdr.channels * wavhdr.bits_per_sample) / 8;
         wavhdr.byte_per_sec = (wavhdr.freq * wavhdr.channels * wavhdr.bits_per_sample) / 8;
         wavhdr.totalsize = adpcmsize + sizeof(wavhdr) + sizeof(wavhdr_chunk) - 8;
+
+        if(have_loop)
+            wavhdr.totalsize += (adpcmsize & 1) + sizeof(smpl);
         
         memcpy(wavhdr_chunk.hdr3, "data", 4);
         wavhdr_chunk.datasize = adpcmsize;
@@ -438,6 +659,34 @@ int wav2adpcm(const char *infile, const char *outfile) {
             result = -1;
             goto cleanup;
         }
+
+        /* Keep the loop, after the data where loaders don't look for it */
+        if(have_loop) {
+            memset(&smpl, 0, sizeof(smpl));
+            memcpy(smpl.hdr, "smpl", 4);
+            smpl.size = sizeof(smpl) - 8;
+            smpl.sample_period = 1000000000 / wavhdr.freq;
+            smpl.midi_unity_note = 60;
+            smpl.num_loops = 1;
+            smpl.start = start;
+            smpl.end = end - 1;
+
+            if(((adpcmsize & 1) && fputc(0, out) == EOF) ||
+               fwrite(&smpl, sizeof(smpl), 1, out) != 1) {
+                fprintf(stderr, "Cannot write loop points.\n");
+                result = -1;
+                goto cleanup;
+            }
+        }
+    }
+
+    /* What it takes to load and play it back with snd_sfx_load_ex() */
+    if(manifest) {
+        pthread_mutex_lock(&manifest_lock);
+        fprintf(manifest, "%s %u 4 %u %u %u\n", outfile, (unsigned)wavhdr.freq,
+                (unsigned)wavhdr.channels, (unsigned)(have_loop ? start : 0),
+                (unsigned)(have_loop ? end : 0));
+        pthread_mutex_unlock(&manifest_lock);
     }
 
 cleanup:
@@ -562,6 +811,120 @@ cleanup:
     return result;
 }
 
+/* Batch conversion of a directory, shared by the worker threads */
+typedef struct batch {
+    int (*convert)(const char *infile, const char *outfile);
+    const char *indir, *outdir;
+    char **names;
+    int count;
+    int next;
+    int result;
+    pthread_mutex_t lock;
+} batch_t;
+
+static void *batch_worker(void *arg) {
+    batch_t *b = arg;
+    char infile[4096], outfile[4096];
+    int i;
+
+    for(;;) {
+        pthread_mutex_lock(&b->lock);
+        i = b->next++;
+        pthread_mutex_unlock(&b->lock);
+
+        if(i >= b->count)
+            break;
+
+        snprintf(infile, sizeof(infile), "%s/%s", b->indir, b->names[i]);
+        snprintf(outfile, sizeof(outfile), "%s/%s", b->outdir, b->names[i]);
+
+        if(b->convert(infile, outfile)) {
+            pthread_mutex_lock(&b->lock);
+            b->result = -1;
+            pthread_mutex_unlock(&b->lock);
+        }
+    }
+
+    return NULL;
+}
+
+static int has_wav_ext(const char *name) {
+    size_t len = strlen(name);
+
+    return len > 4 && (!strcmp(name + len - 4, ".wav") ||
+                       !strcmp(name + len - 4, ".WAV"));
+}
+
+/* Convert every .wav in indir into the same name in outdir, with jobs
+   threads. */
+int convert_dir(int (*convert)(const char *, const char *),
+                const char *indir, const char *outdir, int jobs) {
+    batch_t b = { convert, indir, outdir, NULL, 0, 0, 0,
+                  PTHREAD_MUTEX_INITIALIZER };
+    pthread_t *threads;
+    struct dirent *ent;
+    DIR *dir;
+    int i, started;
+
+    dir = opendir(indir);
+    if(!dir) {
+        fprintf(stderr, "Cannot open directory %s\n", indir);
+        return -1;
+    }
+
+    while((ent = readdir(dir))) {
+        if(!has_wav_ext(ent->d_name))
+            continue;
+
+        b.names = realloc(b.names, (b.count + 1) * sizeof(char *));
+        if(!b.names || !(b.names[b.count] = strdup(ent->d_name))) {
+            fprintf(stderr, "Cannot allocate memory for file names\n");
+            closedir(dir);
+            return -1;
+        }
+        b.count++;
+    }
+    closedir(dir);
+
+#ifdef _WIN32
+    if(mkdir(outdir) && errno != EEXIST) {
+#else
+    if(mkdir(outdir, 0777) && errno != EEXIST) {
+#endif
+        fprintf(stderr, "Cannot create directory %s\n", outdir);
+        b.result = -1;
+        goto cleanup;
+    }
+
+    if(jobs > b.count)
+        jobs = b.count;
+
+    threads = malloc(jobs * sizeof(pthread_t));
+    started = 0;
+
+    /* This thread does its share too, so it can't come out empty handed if
+       threads can't be created. */
+    for(i = 1; threads && i < jobs; i++) {
+        if(pthread_create(&threads[started], NULL, batch_worker, &b))
+            break;
+        started++;
+    }
+
+    batch_worker(&b);
+
+    for(i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+
+cleanup:
+    for(i = 0; i < b.count; i++)
+        free(b.names[i]);
+    free(b.names);
+
+    return b.result;
+}
+
 void usage() {
     printf("wav2adpcm: Convert 16-bit WAV to AICA ADPCM and vice-versa\n"
            "Copyright (C) 2002 BERO\n"
@@ -574,22 +937,40 @@ void usage() {
            "    wav2adpcm -f <infile.wav> <outfile.wav>       (From ADPCM)\n"
            "    wav2adpcm -n -i -t <infile.wav> <outfile.wav> (To ADPCM interleaved without a header)\n"
            "    wav2adpcm -n -f <infile.wav> <outfile.wav>    (From ADPCM without a header)\n"
+           "    wav2adpcm -q -j 4 -t <indir> <outdir>         (Every .wav in a directory)\n"
            "\n"
            "Options:\n"
            "    -t    Convert 16-bit WAV to AICA ADPCM.\n"
            "    -f    Convert AICA ADPCM back to 16-bit WAV.\n"
            "    -i    Optional parameter to output interleaved adpcm data (use with -t).\n"
            "    -n    Optional parameter to output headerless pcm/adpcm data (use with -t or -f).\n"
+           "    -q[N] Use the trellis encoder, keeping 2^N paths (default 4, up to 6).\n"
+           "          Slower, but with less quantization noise (use with -t).\n"
+           "    -l start:end\n"
+           "          Loop points in samples, end excluded (use with -t). By default\n"
+           "          the first loop of the input's smpl chunk is kept.\n"
+           "    -m <file>\n"
+           "          Append a line per converted file to a manifest:\n"
+           "          outfile rate bits channels loopstart loopend (use with -t)\n"
+           "    -j N  Convert N files at a time in directory mode.\n"
            "    -h    Prints this usage information.\n"
            "\n"
            "Note:\n"
            "If you are having trouble with your input WAV file, you can preprocess it using ffmpeg:\n"
            "    ffmpeg -i input.wav -ac 1 -acodec pcm_s16le output.wav\n"
+           "If <infile.wav> is a directory, every .wav file in it is converted to the same\n"
+           "name in <outfile.wav>, which is created if it doesn't exist. Options must\n"
+           "come before -t or -f.\n"
           );
 }
 
 int main(int argc, char **argv) {
+    int (*convert)(const char *, const char *);
     int t_flag_pos = 0;
+    int jobs = 1;
+    struct stat st;
+    char *end;
+    int result;
 
     /* Check for help flag first */
     for(int i = 1; i < argc; i++) {
@@ -617,6 +998,55 @@ int main(int argc, char **argv) {
             }
             interleaved = 1;
         }
+        else if(!strncmp(argv[i], "-q", 2)) {
+            if(t_flag_pos) {
+                fprintf(stderr, "-q flag must come before -t\n");
+                usage();
+                return -1;
+            }
+            trellis = argv[i][2] ? (int)strtol(argv[i] + 2, &end, 10) : 4;
+            if(argv[i][2] && (*end || trellis < 0 || trellis > 6)) {
+                fprintf(stderr, "-q takes a number from 0 to 6\n");
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[i], "-l")) {
+            if(t_flag_pos || i + 1 >= argc) {
+                fprintf(stderr, "-l flag must come before -t, with start:end\n");
+                usage();
+                return -1;
+            }
+            loop_start = strtol(argv[++i], &end, 10);
+            loop_end = *end == ':' ? strtol(end + 1, &end, 10) : -1;
+            if(*end || loop_start < 0 || loop_end <= loop_start) {
+                fprintf(stderr, "Invalid loop points %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[i], "-m")) {
+            if(t_flag_pos || i + 1 >= argc) {
+                fprintf(stderr, "-m flag must come before -t, with a file\n");
+                usage();
+                return -1;
+            }
+            if(manifest)
+                fclose(manifest);
+            manifest = fopen(argv[++i], "a");
+            if(!manifest) {
+                fprintf(stderr, "Cannot open %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[i], "-j")) {
+            if(t_flag_pos || i + 1 >= argc) {
+                fprintf(stderr, "-j flag must come before -t or -f, with a count\n");
+                usage();
+                return -1;
+            }
+            jobs = atoi(argv[++i]);
+            if(jobs < 1)
+                jobs = 1;
+        }
         else if(!strcmp(argv[i], "-t") || !strcmp(argv[i], "-f")) {
             if(t_flag_pos) {
                 fprintf(stderr, "Only one of -t or -f is allowed\n");
@@ -640,17 +1070,36 @@ int main(int argc, char **argv) {
         return -1;
     }
 
+    /* The rest only apply to encoding */
+    if((trellis || loop_start >= 0 || manifest) &&
+       strcmp(argv[t_flag_pos], "-t") != 0) {
+        fprintf(stderr, "-q, -l and -m flags can only be used with -t\n");
+        usage();
+        return -1;
+    }
+
     /* Handle conversion based on -t or -f */
     if(!strcmp(argv[t_flag_pos], "-t")) {
         /* Convert WAV to ADPCM */
-        return wav2adpcm(argv[t_flag_pos + 1], argv[t_flag_pos + 2]);
+        convert = wav2adpcm;
     }
     else if(!strcmp(argv[t_flag_pos], "-f")) {
         /* Convert ADPCM to WAV */
-        return adpcm2wav(argv[t_flag_pos + 1], argv[t_flag_pos + 2]);
+        convert = adpcm2wav;
     }
     else {
         usage();
         return -1;
     }
+
+    if(!stat(argv[t_flag_pos + 1], &st) && S_ISDIR(st.st_mode))
+        result = convert_dir(convert, argv[t_flag_pos + 1],
+                             argv[t_flag_pos + 2], jobs);
+    else
+        result = convert(argv[t_flag_pos + 1], argv[t_flag_pos + 2]);
+
+    if(manifest)
+        fclose(manifest);
+
+    return result;
 }